@@ -57,6 +57,10 @@ typedef enum {
 
 /*
  * 连接状态
+ *
+ * 会话经信令重新建立时（对端重新发起，本端回调 CLOSED 后再次进入 CONNECTED），
+ * 双方会话对象均保留则在 CONN 中互换续传令牌：字节流 / 消息流从对端已交付的偏移继续，
+ * 只重传未交付的尾部，接收缓冲区中未读的数据保留；对端进程重启（令牌不符）时无法续传。
  */
 typedef enum {
     P2P_STATE_INIT = 0,                         // 初始状态
@@ -99,7 +103,10 @@ typedef enum {
     P2P_PATH_LAN,                               // 同一子网，直连
     P2P_PATH_PUNCH,                             // NAT 打洞
     P2P_PATH_RELAY,                             // 数据中继（TURN 服务器）
-    P2P_PATH_SIGNALING                          // 信令服务器转发（最终降级方案）
+    P2P_PATH_SIGNALING,                         // 信令服务器转发（最终降级方案）
+    P2P_PATH_TCP,                               // TCP 同时打开打洞（UDP 受限时的回退，需 enable_tcp）
+    P2P_PATH_OVERLAY,                           // 经与双方均直连的第三方对端中转（见 p2p_session_via）
+    P2P_PATH_SHM                                // 同主机共享内存环（对端在本机时优先，需 enable_shm）
 } p2p_path_type_t;
 
 /*
@@ -140,6 +147,16 @@ typedef enum {
 typedef const void* p2p_handle_t;
 typedef const void* p2p_session_t;
 
+/* ---------- 外部事件循环集成 ---------- */
+
+#define P2P_FD_READ          0x01               // 关注可读
+#define P2P_FD_WRITE         0x02               // 关注可写（如 RELAY 信令 TCP 连接建立中）
+
+typedef struct {
+    intptr_t                fd;                 // 平台原生套接字（POSIX: int，Windows: SOCKET）
+    int                     events;             // P2P_FD_* 组合
+} p2p_fd_t;
+
 /* ---------- 事件回调类型 ---------- */
 
 /*
@@ -159,6 +176,27 @@ typedef const void* p2p_session_t;
  */
 typedef void (*p2p_on_state_fn)(p2p_session_t session, p2p_state_t old_state, p2p_state_t new_state, void *userdata);
 
+/*
+ * 建连阶段里程碑（p2p_stats_t.setup_ms / on_setup / p2p_instance_stats_t 分位数）
+ * 各值为距 p2p_connect 的毫秒数，-1 = 未到达（如直接中继时没有 REACH，PUBSUB 模式没有 SIGNALED）
+ */
+enum {
+    P2P_SETUP_GATHER = 0,                       // 本地候选收集完成（STUN / TURN 不再 pending）
+    P2P_SETUP_SIGNALED,                         // 信令服务器受理会话（COMPACT SYNC0_ACK / RELAY 会话接受：SIGNALING → WAITING）
+    P2P_SETUP_REMOTE_CAND,                      // 收到首批对端候选
+    P2P_SETUP_CANDS_DONE,                       // 对端候选全部收到
+    P2P_SETUP_PUNCH,                            // 开始 NAT 打洞
+    P2P_SETUP_REACH,                            // PUNCH/REACH 双向确认（开始 CONN/CONN_ACK 握手）
+    P2P_SETUP_CONNECTED,                        // 首次进入 CONNECTED / RELAY
+    P2P_SETUP_NUM
+};
+
+/*
+ * 建连完成回调：会话首次进入 CONNECTED / RELAY 时触发一次（紧随 on_state 之后）
+ *   setup_ms: 各里程碑耗时（P2P_SETUP_* 下标），仅在回调期间有效
+ */
+typedef void (*p2p_on_setup_fn)(p2p_session_t session, const int setup_ms[P2P_SETUP_NUM], void *userdata);
+
 /*
  * 数据到达回调（可选，如果未设置则需要主动调用 p2p_recv）
  * 参数：
@@ -170,11 +208,11 @@ typedef void (*p2p_on_state_fn)(p2p_session_t session, p2p_state_t old_state, p2
 typedef void (*p2p_on_data_fn)(p2p_session_t session, const void *data, int len, void *userdata);
 
 /*
- * MSG RPC 请求到达回调（B 端，服务器把 A 的 MSG_REQ 中转给 B 时触发）
- * - sid   : 序列号，B 调用 p2p_response(session, sid, ...) 时传回
+ * MSG RPC 请求到达回调（B 端，服务器把 A 的 MSG_REQ 中转给 B，或经会话直连到达时触发）
+ * - sid   : 序列号，B 调用 p2p_response_to(session, sid, ...) 时传回
  * - msg   : 消息类型（1 字节，由 A 端指定）
  *           msg=0: Echo 请求，已由底层自动回复，不会触发此回调
- *           msg>0: 应用层自定义消息类型，需调用 p2p_response() 回复
+ *           msg>0: 应用层自定义消息类型，需调用 p2p_response_to() / p2p_response() 回复
  * - data/len : 请求数据
  */
 typedef void (*p2p_on_request_fn)(p2p_session_t session, uint16_t sid,
@@ -189,13 +227,16 @@ typedef void (*p2p_on_request_fn)(p2p_session_t session, uint16_t sid,
  * - data/len : 应答数据；len=-1 表示失败，具体错误见 msg 字段：
  *              msg=原始请求msg: B 不在线（在 REQ_ACK 阶段已知，立即失败）
  *              msg=P2P_MSG_ERR_PEER_OFFLINE (0xFF): B 在等待响应期间离线
- *              msg=P2P_MSG_ERR_TIMEOUT (0xFE): 服务器向 B 转发请求超时
+ *              msg=P2P_MSG_ERR_TIMEOUT (0xFE): 服务器向 B 转发请求超时（直连请求：超时未获应答）
+ *              msg=P2P_MSG_ERR_FRAG (0xFC): 分片传输失败（超出 rpc_max_size / 对端不支持 / 无进展超时）
  */
 typedef void (*p2p_on_response_fn)(p2p_session_t session, uint16_t sid,
                                    uint8_t msg, const void *data, int len,
                                    void *userdata);
 #define P2P_MSG_ERR_TIMEOUT         0xFE    // 服务器转发请求超时
 #define P2P_MSG_ERR_PEER_OFFLINE    0xFF    // B端在等待响应期间离线（区别于 REQ_ACK 时已知离线）
+#define P2P_MSG_ERR_FRAG            0xFC    // 超过 P2P_MSG_DATA_MAX 的请求/应答分片传输失败
+#define P2P_MSG_FRAG                0xFD    // 保留：分片传输使用的 msg / code，应用不可使用
 
 /*
  * ICE 候选收集回调（仅 P2P_SIGNALING_MODE_ICE 模式，类似 WebRTC onicecandidate）
@@ -223,47 +264,156 @@ typedef void (*p2p_on_response_fn)(p2p_session_t session, uint16_t sid,
  */
 typedef void (*p2p_on_ice_candidate_fn)(p2p_session_t session, const char *candidate, void *userdata);
 
+/*
+ * 可写回调（发送背压，工作线程中调用）
+ *
+ * 某条流的 p2p_send / p2p_send_msg / p2p_send_stream 写入后待发送字节超过 send_lowat，
+ * 或写入未被全部接受时登记；待发送字节降到 send_lowat 及以下时回调一次，之后需再次写满才会重新登记。
+ *   sid:   流编号（0 号流即 p2p_send）
+ *   space: 该流当前可写入的字节数（同 p2p_send_space）
+ * threaded 模式下回调时持有内部锁，应通知生产者线程写入，不要在回调内调用 p2p_send
+ */
+typedef void (*p2p_on_writable_fn)(p2p_session_t session, int sid, int space, void *userdata);
+
+/*
+ * 文件传输回调（p2p_send_file / p2p_recv_file，工作线程中调用）
+ *   dir: P2P_FILE_SEND / P2P_FILE_RECV
+ *   progress: done = 已提交发送 / 已写入文件的字节数，total = 传输总字节数
+ *   done:     result = 0 完成（发送侧为最后一个包已被确认），负值为读写失败
+ */
+#define P2P_FILE_SEND   0
+#define P2P_FILE_RECV   1
+typedef void (*p2p_on_file_progress_fn)(p2p_session_t session, int dir, int64_t done, int64_t total, void *userdata);
+typedef void (*p2p_on_file_done_fn)(p2p_session_t session, int dir, int result, void *userdata);
+
+/*
+ * 路径缓存（0-RTT 重连）
+ *
+ * 连接成功后按 remote_peer_id 记录最后可用的直连路径；下次 p2p_connect 同一对端时，
+ * 在信令交换的同时立即向该地址打洞，对端应答即建立连接，无需等待候选收集与交换。
+ * 打洞超时未应答的条目自动作废。
+ *
+ * 应用可通过 on_path_load / on_path_save 自行持久化（返回 false 时回退到内置缓存），
+ * 或设置 path_cache_file 由内置缓存读写文件。回调在库内部锁中调用，不得回调库 API。
+ */
+typedef struct {
+    uint32_t                remote_ip;                  // 对端地址（网络字节序）
+    uint16_t                remote_port;                // 对端端口（网络字节序）
+    uint16_t                local_port;                 // 本端套接字端口（主机字节序，仅供参考：本端端口变化不影响对端映射）
+    uint8_t                 path_type;                  // P2P_PATH_LAN / P2P_PATH_PUNCH（中继路径不缓存）
+    uint64_t                stamp;                      // 记录时间（UNIX 秒）
+} p2p_path_hint_t;
+
+typedef bool (*p2p_on_path_load_fn)(const char *peer_id, p2p_path_hint_t *hint, void *userdata);
+typedef void (*p2p_on_path_save_fn)(const char *peer_id, const p2p_path_hint_t *hint/* NULL = 作废 */, void *userdata);
+
+/* ---------- 发送节奏 ---------- */
+
+typedef enum {
+    P2P_PACING_OFF = 0,                         // 关闭：每次 update 整窗突发发送（默认）
+    P2P_PACING_TOKEN_BUCKET,                    // 令牌桶：按 ≈ 1.25 * cwnd / SRTT 速率平滑发送，避免冲击浅缓冲 NAT/家用路由
+} p2p_pacing_t;
+
+/* ---------- 拥塞控制算法（use_pseudotcp） ---------- */
+
+typedef enum {
+    P2P_CC_AIMD = 0,                            // 加性增乘性减（默认）：每 RTT +1 MSS，丢包窗口重置
+    P2P_CC_CUBIC,                               // CUBIC (RFC 9438)：窗口按距上次丢包时间的三次函数增长，高 BDP 链路恢复更快
+} p2p_cc_algo_t;
+
+/* ---------- ECN（显式拥塞通知，use_pseudotcp） ---------- */
+
+typedef enum {
+    P2P_ECN_OFF = 0,                            // 关闭（默认）：发出的包不带 ECT，丢包是唯一拥塞信号
+    P2P_ECN_CLASSIC,                            // ECT(0)（RFC 3168）：CE 标记按丢包减窗（每 RTT 至多一次，不重传）
+    P2P_ECN_L4S,                                // ECT(1)（L4S，RFC 9331）：按每 RTT 内 CE 标记比例减窗（DCTCP 风格），排队时延更低
+} p2p_ecn_t;
+
+/* ---------- TURN 客户端到服务器的传输 ---------- */
+
+typedef enum {
+    P2P_TURN_UDP = 0,                           // UDP（默认）
+    P2P_TURN_TCP,                               // TCP（RFC 5766 Section 2.1）：UDP 被封锁的网络，中继地址仍为 UDP
+    P2P_TURN_TLS,                               // TLS over TCP（需 WITH_DTLS 构建）：配合 turn_port = 443 穿过只放行 HTTPS 的防火墙
+} p2p_turn_transport_t;
+
 /* ---------- 配置结构 ---------- */
 
 typedef struct {
     uint16_t                bind_port;                  // 本地 UDP 端口 (0 = any)
     bool                    multi_session;              // 允许单个实例管理多个并发会话（默认关闭）
+    bool                    overlay_relay;              // 允许对端经本实例中转到本实例的其他直连会话（需 multi_session，见 p2p_session_via）
     
     /* 信令配置 */
     p2p_signaling_t         signaling_mode;             // P2P_SIGNALING_MODE_* (连接时使用的信令模式)
-    const char*             server_host;                // 信令服务器主机名 (用于 COMPACT/RELAY 模式)
+    const char*             server_host;                // 信令服务器主机名 (用于 COMPACT/RELAY 模式；PUBSUB 模式下为 WebSocket 推送中继)
+                                                        // + COMPACT/RELAY 可为集群节点列表 "host:port,host:port,..."（见 p2p_cluster_pick），
+                                                        //   COMPACT 按 local_peer_id 选择节点，RELAY 使用首个节点
     uint16_t                server_port;                // 信令服务器端口
+    bool                    relay_mux;                  // RELAY：同进程内连接同一服务器的实例共享一条 TCP 连接，减少服务器 fd 与保活流量
+                                                        // + 服务器通告 P2P_RLY_FEATURE_MUX 时生效，否则各自独立连接
     const char*             gh_token;                   // GitHub Token (用于 Gist API)
     const char*             gist_id;                    // Gist ID (用于 PUB/SUB 模式)
+                                                        // + 可为逗号分隔的分片列表 "g1,g2,..."（各端须相同）：按 peer_id 散列到其中一个 Gist，
+                                                        //   每端只轮询自己的分片（约 N/分片数 个对等体），按规模增加分片
+    const char*             tls_ca_file;                // TLS 客户端校验服务器证书的 CA 证书包（PEM）路径，NULL = 依次尝试常见系统证书包
+                                                        // + 无可用证书包时拒绝建立连接（不以未校验的连接发送 gh_token）
+    bool                    tls_insecure;               // 显式允许找不到 CA 证书包时不校验服务器证书（仅限测试环境：凭证可被中间人截获）
     
     /* 协议选择 */
     bool                    use_ice;                    // false = (使用私有协议 PUNCH/REACH 打洞)，
                                                         // true = ICE 标准协议 (RFC 5245，使用 STUN connectivity check) 打洞
+    bool                    ice_lite;                   // ICE-lite（公网 IP 的服务端）：不收集 srflx/relay 候选、不主动发起检查，
+                                                        // 只响应对端检查；首个到达的检查即视为提名，直接进入连接握手
+    bool                    ice_aggressive;             // 积极提名：controlling 端每个检查都携带提名（PUNCH NOMINATE），
+                                                        // 对端收到即确认该路径，无需等待自己的检查往返
     
     /* STUN/TURN 配置 (仅当 use_ice=true 或需要高级诊断时使用) */
     const char*             stun_server;                // STUN 服务器 (例如 stun.l.google.com)
     uint16_t                stun_port;
+    const char*             stun_servers;               // 额外 STUN 服务器列表，逗号分隔 "host[:port],..."（端口缺省同 stun_port，最多 3 个）
+                                                        // 与 stun_server 并行查询：首个响应生成 Srflx 候选，其余仅用于交叉校验 NAT 映射
     bool                    skip_stun_test;             // 跳过 NAT 类型检测（RFC 3489 Test II/III）
                                                         // 大多数公共 STUN 服务器不支持 CHANGE-REQUEST
                                                         // 设为 true 可跳过这些会超时的测试
     bool                    multi_srflx;                // 多路 Srflx：为每个网卡创建独立 socket 收集映射地址
                                                         // false(默认) = 仅用一个 socket 收集单个 Srflx
+    bool                    enable_ipv6;                // IPv6 双栈：另开 IPv6 UDP socket（尽量与 bind_port 同端口），
+                                                        // 收集全局/ULA IPv6 地址为 Host 候选，对端可直连无需穿透
 
     const char*             turn_server;                // TURN 服务器
     uint16_t                turn_port;
     const char*             turn_user;                  // TURN 认证用户
     const char*             turn_pass;                  // TURN 认证密码
+    const char*             turn_servers;               // 额外 TURN 服务器列表，逗号分隔 "host[:port],..."（端口缺省同 turn_port，与 turn_server 共最多 8 个，凭证相同）
+                                                        // 启动时以 STUN Binding 测各服务器 RTT，在最近的 turn_allocs 个上分配
+    int                     turn_allocs;                // 同时保持的 TURN 分配数（0 = 1，最多 2）：每个分配通告一个中继候选，
+                                                        // 中继发送经最近的服务器，对端按各中继候选实测 RTT 选路
+    int                     turn_transport;             // 到 TURN 服务器的传输，p2p_turn_transport_t（默认 P2P_TURN_UDP）；
+                                                        // TCP/TLS 时不做 RTT 探测（按配置顺序分配），turn_port 缺省 3478 / TLS 5349
 
     /* TCP 选项 */
-    bool                    enable_tcp;                 // 是否尝试 TCP 打洞/回退
-    uint16_t                tcp_port;                   // TCP 监听端口 (0 = any)
+    bool                    enable_tcp;                 // 是否尝试 TCP 同时打开打洞（成功后作为 P2P_PATH_TCP 路径参与选路）
+    uint16_t                tcp_port;                   // TCP 打洞本地/目标端口 (0 = 与 UDP 端口相同)
+
+    /* 同主机选项 */
+    bool                    enable_shm;                 // 对端在本机时改经共享内存环传输（作为 P2P_PATH_SHM 路径优先选用）
 
     /* 传输层 */
-    bool                    use_pseudotcp;              // 是否启用拥塞控制 (AIMD)
+    bool                    use_pseudotcp;              // 是否启用拥塞控制（算法见 cc_algo）
+    int                     cc_algo;                    // 拥塞控制算法，p2p_cc_algo_t（默认 P2P_CC_AIMD）
     bool                    use_sctp;                   // 是否启用 usrsctp (SCTP)
+    bool                    use_bbr;                    // 是否启用 BBR 拥塞控制（按瓶颈带宽/最小 RTT 建模，随机丢包下优于 AIMD）
+    int                     pacing;                     // 发送节奏策略，p2p_pacing_t（默认 P2P_PACING_OFF）
+    int                     ecn;                        // ECN 标记与拥塞反馈，p2p_ecn_t（默认 P2P_ECN_OFF；实例级，标记所有 UDP 套接字，
+                                                        //   对端须回显 CE 计数（RELIABLE_CAP_ECN），仅拥塞控制算法据此减窗）
+    int                     ack_freq;                   // 请求对端每收到 N 个按序数据包回一次 ACK (默认 2，乱序时对端仍立即 ACK)
+    int                     ack_delay_ms;               // 请求对端延迟 ACK 的最长时间 (默认 10ms，上限 25ms)
+    int                     reliable_window;            // reliable 层发送/接收窗口包数 (默认 32，向上取 2 的幂，最大 16384，固定内存构建 256；CONN 握手时与对端协商取较小值)
 
     /* 加密层（与传输层正交，管加密） */
-    int                     dtls_backend;               // 0=disabled, 1=mbedtls, 2=openssl
+    int                     dtls_backend;               // 0=disabled, 1=mbedtls, 2=openssl,
+                                                        //   3=内置 AEAD（ChaCha20-Poly1305，零依赖；密钥由 auth_key 与 CONN 交换的随机数派生，无握手往返）
     int                     dtls_role;                  // DTLS 握手角色：
                                                         //   0 = 自动（默认）：按 peer_id 字典序决定，
                                                         //       ID 较大者为 server（被动方），较小者为 client（主动方）；
@@ -273,8 +423,41 @@ typedef struct {
 
     /* 其他选项 */
     bool                    threaded;                   // false = 手动更新, true = 内部线程
-    int                     update_interval_ms;         // 内部线程更新间隔 (默认 10)
+    int                     worker_count;               // 内部线程数 (仅 threaded，默认 1，上限 P2P_MAX_WORKERS)；>1 时会话分片到 worker_count-1 个数据线程，主线程负责收包派发与信令
+    int                     crypto_workers;             // 加密线程数 (仅 threaded 且 dtls_backend = 3，默认 0，上限 P2P_MAX_CRYPTO_WORKERS)：>0 时记录加解密由线程池并行执行
+                                                        //   发送：记录按会话顺序分配序号后进入发送合并队列，flush 前整批并行封装，再按入队顺序发出
+                                                        //   接收：批量读取到的记录先并行解开，派发时按到达顺序确认重放窗口后交给会话
+    int                     update_interval_ms;         // 内部线程 / p2p_next_timeout_ms 最长等待间隔 (默认 50；线程阻塞于 I/O，按协议定时器或 p2p_send 即时唤醒)
+    bool                    shared_executor;            // 由进程级共享执行器（p2p_executor_start）服务，不启动独立线程（仅 threaded）；
+                                                        //   执行器未启动或 worker_count > 1 / latency_mode / udp_iocp 时仍启动独立线程
+    bool                    latency_mode;               // 低延迟模式（仅 threaded）：主线程不阻塞等待，忙轮询套接字，空闲时依次退避为
+                                                        //   让出 CPU、1ms 短睡眠，有包到达即恢复忙轮询；UDP 套接字同时开启 SO_BUSY_POLL（Linux）
+    bool                    low_power;                  // 低功耗（移动端）：全部会话空闲 3s 后周期任务（保活、探测、信令、TURN 刷新）对齐到
+                                                        //   1s 整数倍的共同唤醒窗口，tick 放宽到 5s；有数据收发或建连即恢复正常节奏
+    uint64_t                thread_cpu_mask;            // 内部线程（主线程与会话分片线程）绑定的 CPU 掩码 (bit i = CPU i，默认 0 = 不绑定；Linux / Windows)
+    int                     thread_priority;            // 内部线程优先级，按 P_THD_* 传给 P_thread (默认 0 = P_THD_NORMAL)
+    int                     recv_batch;                 // 每次 update 最多处理的接收包数 (默认 256，超出部分留待下次 update)
+    int                     recv_budget_us;             // 每次 update 接收阶段的时间预算，微秒 (默认 2000；<0 = 不限)，用尽后先处理
+                                                        //   定时器与发送，剩余的包留待下次 update（套接字仍可读，不会进入等待）
+    int                     sock_buf_size;              // UDP 套接字内核收发缓冲区字节数 (默认 0 = 自动：按窗口与观测 BDP 只增不减，256KB..16MB；
+                                                        //   <0 = 保持系统默认)；均受系统上限 rmem_max / wmem_max 截断
+    bool                    udp_iocp;                   // Windows：UDP 接收改用 IOCP 预投递重叠接收（其他平台忽略）；开启后 p2p_get_fds 中的
+                                                        //   UDP 套接字不再就绪，单线程模式须定时调用 p2p_update；cfg.latency_mode 下退化为完成端口非阻塞轮询
+    bool                    udp_uring;                  // Linux：UDP 接收改用 io_uring 多发 recvmsg + 提供缓冲区环（内核 6.0+，不支持时自动回退 recvmmsg）；
+                                                        //   p2p_get_fds 以环描述符代替各 UDP 套接字
     bool                    nagle;                      // 是否启用 Nagle 批处理 (默认 0)
+    int                     nagle_delay_ms;             // Nagle 尾部最长合并等待 (默认 2ms)，超时后不足一包的数据也会发出
+    int                     send_buf_size;              // 发送环形缓冲区初始字节数 (默认 64KB，向上取 2 的幂)
+    int                     recv_buf_size;              // 接收环形缓冲区初始字节数 (默认 64KB，向上取 2 的幂)
+    int                     buf_max_size;               // 收发缓冲区按需扩容上限 (默认 4MB；空闲 5s 后收缩回初始大小)
+    int                     send_lowat;                 // 发送低水位：待发送字节降到该值及以下时回调 on_writable (默认 0 = send_buf_size)
+    int                     hibernate_ms;               // 空闲休眠：已连接会话超过该时长无数据收发且缓冲区全空时释放流与 reliable 层缓冲区，
+                                                        // 只保留 NAT 保活与序列号状态，下次 p2p_send 或收到 DATA 时自动恢复（默认 0 = 关闭；仅基础 reliable 层）
+    bool                    message_mode;               // 消息模式：可靠有序且保留消息边界，使用 p2p_send_msg / p2p_recv_msg (默认 0；两端须一致)
+    int                     stream_count;               // 独立有序流数量 (默认 1，上限 P2P_MAX_STREAMS；两端协商取较小值)，非 0 号流使用 p2p_send_stream / p2p_recv_stream
+    bool                    compress;                   // 流压缩：DATA 包经内置 LZ 编码压缩后发出 (默认 0；CONN 协商，两端均开启时生效)，压缩率见 p2p_compress_ratio
+    int                     rpc_window;                 // 每会话同时在途的 MSG RPC 数 (1..P2P_RPC_WINDOW_MAX，0=上限；实际取与服务器通告窗口的较小值)
+    int                     rpc_max_size;               // MSG RPC 请求/应答数据上限 (默认 64KB，上限 4MB)；超过 P2P_MSG_DATA_MAX 时自动分片，接收端按本端上限拒绝
     const char*             auth_key;                   // 安全握手密钥 (可选)
     
     /* 语言选项（已废弃，保留字段以兼容旧 API） */
@@ -282,13 +465,46 @@ typedef struct {
     
     /* 路径管理策略 */
     int                     path_strategy;              // 路径选择策略：0=直连优先，1=性能优先，2=混合模式（默认0）
+    bool                    path_race;                  // 竞速连接：打洞 300ms 仍无直连路径即经信令中转先行传输，后台继续打洞，
+                                                        // 直连打通后由路径管理器无缝升级（默认 false：打洞超时后才回退中继）
+    bool                    path_cache;                 // 启用路径缓存（0-RTT 重连，见 p2p_path_hint_t）；设置 path_cache_file 或 on_path_load 时自动启用
+    const char*             path_cache_file;            // 路径缓存持久化文件 (可选，p2p_create 时读取，更新时整体重写)
+    bool                    lan_discovery;              // 局域网发现：在本地网卡上组播通告 peer_id 与 Host 候选，p2p_connect 的对端在局域网内时
+                                                        //   与信令并行立即向其 Host 地址打洞（设置 auth_key 时通告带 MAC；不支持 multi_session）
+    bool                    keepalive_adaptive;         // 自适应保活：连通后经独立套接字探测本端 NAT 映射存活期，
+                                                        // 打洞直连路径的保活间隔取其一半（默认 false：固定 5s，见 p2p_keepalive_interval）
+    bool                    pmtu_discovery;             // 路径 MTU 探测：直连 UDP 路径连通后以填充包二分探测可承载的最大包（上限 P2P_MTU_MAX），
+                                                        // 基础 reliable 层的 DATA 按确认值组包（默认 false：固定 P2P_MTU，见 p2p_path_mtu）
+    bool                    fec;                        // 前向纠错：基础 reliable 层的 DATA 每 K 个附发一个 XOR 校验包，组内单个丢包由对端直接还原、
+                                                        // 不等重传；K 随活跃 UDP 路径丢包率自适应，低于 1% 时不发（默认 false）
+    bool                    bundle;                     // 包合并：一次会话 tick 内发往同一 UDP/TURN 路径的小 DATA/ACK/DGRAM/FEC 包合为一个数据报
+                                                        // （P2P_PKT_BUNDLE，不超过路径负载上限），减少包数与 TURN 指示数（默认 false；对端须支持）
+    bool                    multipath;                  // 多路径并发：基础 reliable 层的 DATA 按最低 RTT 优先分摊到所有可用直连路径，
+                                                        // 每条路径独立拥塞窗口（默认 false：仅活跃路径；启用加密、高级传输层或 multi_session 时不生效）
+    bool                    early_data;                 // 0-RTT 数据：建连期间即可 p2p_send（先缓冲），本端发出 CONN 后紧随其后发出首个窗口的
+                                                        // 默认流数据，不等 CONN_ACK；对端握手完成前收到的数据暂留 reliable 层，进入 CONNECTED 后交付
+                                                        // （默认 false；加密会话待密钥就绪；高级传输层、多流、会话续传时不提前发送）
+    bool                    path_predictive;            // 预测式切换：活跃路径质量趋势下降（quality_trend）即预热次优路径并在首个劣化迹象时切换，
+                                                        // 不等连续超时（默认 false；各路径类型的趋势阈值见 path_manager_set_threshold）
+    const char*             trace_file;                 // 结构化事件追踪文件 (可选，NDJSON 追加写入：收发包、RTT、拥塞窗口、重传、路径切换、
+                                                        // 状态与信令里程碑，供离线分析；事件经无锁缓冲区由内部线程写出)
+    bool                    mem_arena;                  // 实例内存区：会话生存期对象从实例内存区分配，p2p_get_instance_stats 精确报告
+                                                        // 占用，p2p_destroy 最后整体回收（默认 false；每块多一个块头）
     
     /* 事件回调 */
     p2p_on_state_fn         on_state;                   // 状态变化回调 (可选)
+    p2p_on_setup_fn         on_setup;                   // 建连完成回调，附各阶段耗时 (可选)
     p2p_on_data_fn          on_data;                    // 数据到达回调 (可选)
+    p2p_on_data_fn          on_message;                 // 消息模式下整条消息到达回调 (可选，工作线程中调用；设置后消息不进入 p2p_recv_msg)
+    p2p_on_data_fn          on_dgram;                   // 数据报到达回调 (可选，工作线程中调用；设置后数据报不进入 p2p_recv_dgram)
     p2p_on_request_fn       on_request;                 // MSG RPC 请求到达（B 端，服务器可选）
     p2p_on_response_fn      on_response;                // MSG RPC 应答到达（A 端，服务器可选）
     p2p_on_ice_candidate_fn on_ice_candidate;           // ICE 候选收集回调（仅 ICE 模式，类似 WebRTC onicecandidate）
+    p2p_on_writable_fn      on_writable;                // 发送缓冲区降到低水位（send_lowat）以下 (可选)
+    p2p_on_file_progress_fn on_file_progress;           // 文件传输进度 (可选)
+    p2p_on_file_done_fn     on_file_done;               // 文件传输完成/失败 (可选)
+    p2p_on_path_load_fn     on_path_load;               // 路径缓存读取 (可选，应用自行持久化)
+    p2p_on_path_save_fn     on_path_save;               // 路径缓存更新/作废 (可选)
     void*                   userdata;                   // 用户自定义数据，传递给回调函数
 
     /* 测试选项 */
@@ -308,6 +524,35 @@ extern uint16_t             p2p_instrument_base;        // instrument 选项基
 
 ///////////////////////////////////////////////////////////////////////////////
 
+/* 内存分配钩子（p2p_set_allocator），ud 为 userdata */
+typedef struct {
+    void*                 (*malloc_fn)(size_t size, void *ud);
+    void*                 (*realloc_fn)(void *ptr, size_t size, void *ud);
+    void                  (*free_fn)(void *ptr, void *ud);
+    void*                   userdata;
+} p2p_allocator_t;
+
+/*
+ * 安装库内全部堆分配使用的钩子（NULL 恢复为 libc）。须在首次 p2p_create 之前、或全部实例销毁之后调用，
+ * 钩子须可在内部线程中并发调用。第三方库（mbedtls / OpenSSL / usrsctp）的内部分配不经过钩子。
+ * 返回 0 成功，-1 表示钩子不完整。
+ */
+int
+p2p_set_allocator(const p2p_allocator_t *a);
+
+/*
+ * 启动进程级共享执行器：threads 个线程（上限 P2P_MAX_EXECUTOR_THREADS）共同服务 cfg.shared_executor 的实例，
+ * 代替每实例一个内部线程。一个空闲线程阻塞于全部已登记实例描述符的 poll，就绪或定时器到期的实例
+ * 由任一空闲线程执行一轮 p2p_update；同一实例同时至多由一个线程服务。
+ * 须在创建使用它的实例之前调用。返回 0 成功，-1 表示未启用线程支持、参数无效、已启动或资源不足。
+ */
+int
+p2p_executor_start(int threads);
+
+/* 停止共享执行器；须在全部登记到执行器的实例销毁之后调用 */
+void
+p2p_executor_stop(void);
+
 /**
  * 创建一个新的 P2P 会话。
  * @param local_peer_id 本端身份标识
@@ -326,13 +571,35 @@ p2p_destroy(p2p_handle_t hdl);
 
 /**
  * 驱动会话状态机 (单线程模式)
- * 必须周期性调用（例如每 10 毫秒一次）从应用程序事件循环
+ * 必须周期性调用（例如每 10 毫秒一次）从应用程序事件循环，
+ * 或结合 p2p_get_fds / p2p_next_timeout_ms 仅在描述符就绪或定时器到期时调用
  * 在线程模式下，这将被内部调用
  * 如果成功则返回 0，失败则返回 -1。
  */
 int
 p2p_update(p2p_handle_t hdl);
 
+/**
+ * 获取需要由外部事件循环（epoll/kqueue/poll）监听的描述符（单线程模式）
+ * 包括所有 UDP 套接字、RELAY 信令 TCP 连接和 TCP 打洞套接字。
+ * 描述符集合可能随 p2p_update 变化（如信令重连），应在每次 p2p_update 后重新获取。
+ * @param fds 输出数组
+ * @param max 数组容量
+ * @return 实际描述符数量（可能大于 max，此时仅填充前 max 项），失败返回 -1
+ */
+int
+p2p_get_fds(p2p_handle_t hdl, p2p_fd_t *fds, int max);
+
+/**
+ * 距下一次需要调用 p2p_update 的毫秒数（单线程模式）
+ * 典型用法：epoll_wait(epfd, events, n, p2p_next_timeout_ms(hdl))，
+ * 描述符就绪或超时后调用 p2p_update。
+ * 最长不超过 update_interval_ms（覆盖信令、STUN、TURN 等实例级定时任务）。
+ * @return >=0 毫秒数（0 表示应立即调用），失败返回 -1
+ */
+int
+p2p_next_timeout_ms(p2p_handle_t hdl);
+
 /**
  * 获取本地 NAT 类型（由 STUN 检测得出，仅在 use_ice=true 时自动检测）。
  *
@@ -355,6 +622,18 @@ p2p_update(p2p_handle_t hdl);
 int
 p2p_nat_type(p2p_handle_t hdl);
 
+/**
+ * 通知网络已变化（网卡切换、地址变化等）。
+ * 同进程内的实例共享 NAT 类型检测结果（按 STUN 服务器与本地地址）；调用后缓存的结果作废，
+ * 之后创建的实例重新检测。
+ * 同时清空进程内的主机名解析缓存，之后的解析重新查询系统解析器。
+ * 本机地址变化本身由库订阅系统通知（Linux netlink、macOS/BSD 路由套接字、Windows NotifyAddrChange）
+ * 自动检测：地址集合变化后约 200ms 内各实例重新收集候选并增量同步给对端，无需调用本函数；
+ * 调用本函数时同样会重新枚举本机地址（用于系统通知不可用的平台）。
+ */
+void
+p2p_network_changed(void);
+
 //-----------------------------------------------------------------------------
 
 /**
@@ -388,15 +667,104 @@ p2p_nat_type(p2p_handle_t hdl);
  *      * NULL: SUB 角色（订阅者），监听 Gist 中的 offer 并自动回复 answer
  *    - 原理：使用 GitHub Gist 或类似的 KV 存储作为信令中介，发布者写入 offer，订阅者读取并回复 answer
  *    - cfg 配置要求：gh_token, gist_id
+ *      或 server_host/server_port：改经 WebSocket 中继推送（p2p_server --ws），状态机不变，延迟约一个 RTT
  *    - 示例：
  *      p2p_connect(s, "bob")  // PUB 模式，发布 offer 等待 bob 的 answer
  *      p2p_connect(s, NULL)   // SUB 模式，监听任意 offer 并回复 answer
  * 
+ * wait_stun_pending: 首批候选是否等待 Srflx 收集完成再同步（COMPACT 模式忽略）。
+ *    p2p_create 已并行预收集 Srflx，空闲期映射仍新鲜（STUN_SRFLX_FRESH_MS 内）时无需等待。
+ * 
  * 返回：0 = 成功，-1 = 失败
  */
 p2p_session_t
 p2p_connect(p2p_handle_t hdl, const char *remote_peer_id, bool wait_stun_pending);
 
+/**
+ * 为实例附加一个本端身份（仅 COMPACT 模式，且须启用 multi_session）。
+ *
+ * 一个实例可同时代表多个本端 ID（如网关代理多个设备）：各身份共用实例的套接字、
+ * NAT 探测与 TURN 分配，仅各自向信令服务器登录、保活。主身份上线后自动登录。
+ *
+ * @return 0=成功；-1=模式不支持、ID 重复或内存不足
+ */
+int
+p2p_identity_add(p2p_handle_t hdl, const char *local_peer_id);
+
+/**
+ * 移除附加身份（向服务器注销）。仍有会话以该身份连接时失败，须先 p2p_close 这些会话。
+ *
+ * @return 0=成功；-1=身份不存在或仍在使用
+ */
+int
+p2p_identity_remove(p2p_handle_t hdl, const char *local_peer_id);
+
+/**
+ * 以指定本端身份发起连接（local_peer_id 为 NULL 或主身份 ID 时等同 p2p_connect）。
+ *
+ * local_peer_id 须已通过 p2p_identity_add 附加；会话的信令、DTLS 角色均按该身份进行。
+ */
+p2p_session_t
+p2p_connect_as(p2p_handle_t hdl, const char *local_peer_id, const char *remote_peer_id, bool wait_stun_pending);
+
+/* p2p_session_opts_t.transport 传输层 */
+typedef enum {
+    P2P_TRANS_RELIABLE = 0,                     // 基础 reliable 层（实例未选择高级传输层时的默认）
+    P2P_TRANS_PSEUDOTCP,                        // 拥塞控制层，算法按 cc_algo（同 cfg.use_pseudotcp）
+    P2P_TRANS_BBR,                              // BBR（同 cfg.use_bbr）
+    P2P_TRANS_SCTP,                             // usrsctp（同 cfg.use_sctp，未链接时回退基础层）
+} p2p_transport_t;
+
+/* p2p_session_opts_t.set 字段选择位 */
+#define P2P_SOPT_TRANSPORT  0x01                // transport
+#define P2P_SOPT_CC         0x02                // cc_algo, pacing
+#define P2P_SOPT_WINDOW     0x04                // reliable_window
+#define P2P_SOPT_BUFFERS    0x08                // send_buf_size, recv_buf_size, buf_max_size
+#define P2P_SOPT_NAGLE      0x10                // nagle, nagle_delay_ms
+#define P2P_SOPT_CRYPTO     0x20                // dtls_backend
+#define P2P_SOPT_PATH       0x40                // path_strategy
+
+/* 会话级传输选项：仅 set 中置位的字段生效，其余沿用实例配置（同名 p2p_config_t 字段，取值含义相同） */
+typedef struct {
+    uint32_t                set;                // P2P_SOPT_* 位或
+    int                     transport;          // p2p_transport_t
+    int                     cc_algo;            // p2p_cc_algo_t
+    int                     pacing;             // p2p_pacing_t
+    int                     reliable_window;
+    int                     send_buf_size;
+    int                     recv_buf_size;
+    int                     buf_max_size;
+    bool                    nagle;
+    int                     nagle_delay_ms;
+    int                     dtls_backend;       // 两端须一致（同实例配置的要求）
+    int                     path_strategy;
+} p2p_session_opts_t;
+
+/**
+ * 以会话级传输选项发起连接（opts 为 NULL 时等同 p2p_connect）。
+ *
+ * multi_session 下同一实例的各会话可分别选择传输层、窗口、缓冲区、拥塞控制、Nagle 与加密，
+ * 如批量数据会话用大窗口 + BBR，控制会话关闭 Nagle 并使用小缓冲区。
+ * 带选项的连接不接管 p2p_prewarm 预热的会话（预热会话按实例配置建立）。
+ */
+p2p_session_t
+p2p_connect_opts(p2p_handle_t hdl, const char *remote_peer_id, bool wait_stun_pending, const p2p_session_opts_t *opts);
+
+/**
+ * 预热到常用对端的会话（仅 COMPACT / RELAY 模式）。
+ *
+ * 后台建立并维持与 peer_id 的会话：信令配对、NAT 打洞、DTLS 握手照常完成，
+ * 之后只有常规 NAT 保活流量；预热期间不触发 on_state / on_setup 回调。
+ * 之后以主身份 p2p_connect(hdl, peer_id, ...) 直接取得该会话，无需再等待建连
+ * （返回时可能已是 CONNECTED，不会再收到此前状态变化的回调，以 p2p_state / p2p_is_ready 判断）。
+ * 预热会话被对端关闭后，下次 p2p_connect / p2p_prewarm 重新建立。
+ * 对端须同样 p2p_connect 或 p2p_prewarm 本端，信令服务器才能完成配对。
+ *
+ * @return 0=已开始或已在预热；-1=模式不支持或创建失败
+ */
+int
+p2p_prewarm(p2p_handle_t hdl, const char *peer_id);
+
 /**
  * 发起优雅关闭。
  */
@@ -409,6 +777,15 @@ p2p_close(p2p_session_t session);
 p2p_state_t
 p2p_state(p2p_session_t session);
 
+/**
+ * 等待会话进入指定状态，最多 timeout_ms（< 0 无限等待，0 只检查一次）。
+ * 线程模式下由工作线程在状态变化时唤醒；非线程模式下调用线程自行驱动 p2p_update。
+ *
+ * @return 0=已处于该状态；1=超时；-1=会话已进入 CLOSED / ERROR（且不是所等待的状态）或参数非法
+ */
+int
+p2p_wait_state(p2p_session_t session, p2p_state_t state, int timeout_ms);
+
 /**
  * 获取信道外可达性探测状态。
  *
@@ -433,34 +810,474 @@ p2p_is_ready(p2p_session_t session);
 int
 p2p_path(p2p_session_t session);
 
+/*
+ * 叠加中继：请求 via 会话的对端为 session 中转（session 与 via 属于同一 multi_session 实例，三方均需开启 multi_session）。
+ * via 须已连接在直连路径（LAN / PUNCH）上，其对端需开启 cfg.overlay_relay 并与 session 的对端直连。
+ * 对端确认后登记一条 P2P_PATH_OVERLAY 路径，经连通性检查测得 RTT 后参与选路：
+ * 优先于 TURN 与信令转发、次于直连。未确认时自动重发，via 为 NULL 时取消尚未确认的请求。
+ * 返回 0 表示已发出请求；参数非法、未开启 multi_session 或 via 不在直连路径上返回 -1。
+ */
+int
+p2p_session_via(p2p_session_t session, p2p_session_t via);
+
+/* 会话统计（p2p_get_stats） */
+typedef struct {
+    p2p_state_t             state;
+    int                     path;                       // P2P_PATH_*
+    int                     srtt_ms;                    // 数据层平滑 RTT（0 = 尚无 ACK 样本）
+    int                     rttvar_ms;                  // 数据层 RTT 方差
+    int                     rto_ms;                     // 当前重传超时
+    int64_t                 cwnd;                       // 拥塞窗口（字节；基础 reliable 层为发送窗口折算）
+    int64_t                 ssthresh;                   // 慢启动阈值（字节，仅 PseudoTCP，否则为 0）
+    int                     inflight;                   // 已发出待确认的 DATA 包数
+    int64_t                 delivery_rate;              // 最近一次交付速率样本（字节/秒）
+    uint64_t                bytes_sent;                 // 累计发出字节（含协议包头与控制包）
+    uint64_t                bytes_recv;                 // 累计收到字节
+    uint64_t                packets_sent;
+    uint64_t                packets_recv;
+    uint64_t                retransmits;                // DATA 重传次数
+    uint64_t                ecn_ce_recv;                // 收到的带 CE 标记的 DATA 包数（回显给对端）
+    uint64_t                ecn_ce_echoed;              // 对端回显的 CE 标记数（本端发出的包在途中被标记拥塞）
+    /* 活跃路径（路径管理健康检查周期刷新） */
+    int                     path_rtt_ms;                // 综合 RTT（含打洞 / 保活探测样本）
+    float                   loss_rate;                  // 丢包率（0.0-1.0）
+    int                     quality;                    // 质量等级：0 很差 .. 4 优秀
+    uint64_t                bandwidth_bps;              // 估计带宽（bit/s，0 = 未估计）
+    int                     setup_ms[P2P_SETUP_NUM];    // 建连阶段里程碑（见 P2P_SETUP_*）
+} p2p_stats_t;
+
+/*
+ * 获取会话统计。不获取任何锁，只读取各字段的当前值（由工作线程并发更新，字段之间不保证同一时刻），
+ * 开销与会话数无关，可对大量会话周期调用。返回 0 成功，-1 表示参数错误。
+ */
+int
+p2p_get_stats(p2p_session_t session, p2p_stats_t *st);
+
+/* 实例统计（p2p_get_instance_stats） */
+typedef struct {
+    int                     connections;                // 当前活跃连接数
+    int                     hibernated;                 // 处于空闲休眠的会话数（cfg.hibernate_ms）
+    uint64_t                bytes_sent;                 // 全部会话累计（含已关闭的会话），口径同 p2p_stats_t
+    uint64_t                bytes_recv;
+    uint64_t                packets_sent;
+    uint64_t                packets_recv;
+    uint64_t                retransmits;
+    uint32_t                rx_drops;                   // 会话分片收件箱满丢弃的包数（cfg.worker_count > 1）
+    uint32_t                kernel_drops;               // 内核套接字接收队列溢出丢弃的包数（SO_RXQ_OVFL，仅 Linux）
+    int                     sock_buf_bytes;             // 套接字接收缓冲区内核实际字节数（见 cfg.sock_buf_size）
+    /* 最近 P2P_SETUP_HISTORY 次建连的各里程碑分位数（毫秒，未到达的样本不计入，无样本为 -1） */
+    int                     setup_count;                // 参与统计的建连次数
+    int                     setup_p50_ms[P2P_SETUP_NUM];
+    int                     setup_p90_ms[P2P_SETUP_NUM];
+    int                     setup_max_ms[P2P_SETUP_NUM];
+    /* 实例内存区（cfg.mem_arena，未启用时为 0） */
+    uint64_t                mem_bytes;                  // 当前占用（字节，不含块头）
+    uint64_t                mem_peak_bytes;             // 峰值占用
+    uint32_t                mem_blocks;                 // 当前块数
+} p2p_instance_stats_t;
+
+/* 实例保留的建连耗时样本数 */
+#define P2P_SETUP_HISTORY   64
+
+/*
+ * 获取实例汇总统计。不获取锁、不遍历会话（计数在收发时按分片累加），返回 0 成功，-1 表示参数错误。
+ */
+int
+p2p_get_instance_stats(p2p_handle_t hdl, p2p_instance_stats_t *st);
+
+/* 按组件的堆内存占用（p2p_memory_stats，字节；经 p2p_set_allocator 钩子的分配，不含第三方库内部分配） */
+typedef struct {
+    uint64_t                session;                    // 会话结构
+    uint64_t                stream;                     // 流收发环形缓冲区与附加流（空闲休眠时释放）
+    uint64_t                reliable;                   // reliable 槽位数组；实例另含各会话共享的重传 / 乱序缓冲区池
+    uint64_t                cands;                      // 本地 / 远端候选数组
+    uint64_t                reaching;                   // 打洞 reaching 队列
+    uint64_t                turn;                       // TURN TCP / TLS 连接（实例级，会话为 0）
+    uint64_t                dtls;                       // DTLS 上下文；实例另含会话恢复缓存
+    uint64_t                signal;                     // 信令缓冲区（实例级，会话为 0）
+    uint64_t                total;                      // 以上合计
+} p2p_memory_stats_t;
+
+/*
+ * 获取内存占用。session 为 NULL 时返回实例合计（全部现存会话 + 实例级组件），否则返回该会话名下的部分。
+ * 计数在分配 / 释放处累加，读取不获取锁、不遍历会话。返回 0 成功，-1 表示参数错误。
+ */
+int
+p2p_memory_stats(p2p_handle_t hdl, p2p_session_t session, p2p_memory_stats_t *st);
+
 /*
  * 发送数据 (字节流语义，类似于 TCP send)。
  * 数据被缓冲、分片并可靠地发送。
  * 返回接受的字节数（可能小于 len），或 -1 表示错误。
+ * 会话未连接时返回 -1；启用 cfg.early_data 时建连期间（SIGNALING..PUNCHING）亦可写入，随 CONN 握手发出。
+ * 线程模式下不获取实例锁（无锁 SPSC 缓冲），同一会话的 p2p_send 应在单一线程中调用。
  */
 int
 p2p_send(p2p_session_t session, const void *buf, int len);
 
+/* 会话内独立有序流的数量上限（cfg.stream_count） */
+#define P2P_MAX_STREAMS 16
+
+/* 内部线程数量上限（cfg.worker_count） */
+#define P2P_MAX_WORKERS 16
+
+/* 加密线程数量上限（cfg.crypto_workers） */
+#define P2P_MAX_CRYPTO_WORKERS 8
+
+/* 共享执行器线程数量上限（p2p_executor_start） */
+#define P2P_MAX_EXECUTOR_THREADS 64
+
+/* p2p_send_flags 标志 */
+#define P2P_SEND_MORE   0x01    // 后续还有数据：不足一包的尾部暂缓（cork），直到不带该标志的发送、p2p_flush 或 200ms
+
+/*
+ * 带标志发送，语义同 p2p_send。
+ * flags 为 P2P_SEND_* 组合；批量写入时对除最后一次外的调用加 P2P_SEND_MORE，
+ * 可与交互数据共用会话而不被 Nagle 拖慢。
+ */
+int
+p2p_send_flags(p2p_session_t session, const void *buf, int len, int flags);
+
+/* p2p_sendv 数据段 */
+typedef struct p2p_iovec {
+    const void             *base;
+    int                     len;
+} p2p_iovec_t;
+
+/*
+ * 聚集发送：按顺序发送 cnt 个数据段，语义同 p2p_send（各段在字节流中首尾相接）。
+ * 各段直接拷入发送缓冲区，无需先拼接到临时缓冲区；全部段写入后才对工作线程可见，
+ * 不会在段边界额外切出小包。返回接受的总字节数（可能小于各段之和），或 -1 表示错误。
+ */
+int
+p2p_sendv(p2p_session_t session, const p2p_iovec_t *iov, int cnt);
+
+/*
+ * 立即发出已缓冲的数据（含 Nagle / cork 暂缓的不足一包尾部），并解除 cork。
+ * 返回 0 成功，-1 表示错误。不获取实例锁，可在 p2p_send 所在线程调用。
+ */
+int
+p2p_flush(p2p_session_t session);
+
+/*
+ * 扇出发送：把同一份数据发给同一实例的 n 个会话（0 号流），每个会话语义同 p2p_send
+ * （消息模式的会话按 p2p_send_msg 整条发送），各会话独立分片、独立可靠传输。
+ * 与逐个调用 p2p_send 相比，驱动这些会话的每个内部线程只唤醒一次。
+ * 返回完整接受该数据的会话数（未连接、不属于该实例或缓冲区不足的会话不计入；
+ * 字节流会话可能只接受了部分数据，可用 p2p_send_space 预先检查）；参数非法返回 -1。
+ */
+int
+p2p_send_group(p2p_handle_t hdl, const p2p_session_t *sessions, int n, const void *buf, int len);
+
+/*
+ * 0 号流当前可写入的字节数：p2p_send 可全部接受的上限（含发送缓冲区按需扩容到 buf_max_size 的余量；
+ * 消息模式下已扣除消息头，即单条 p2p_send_msg 的上限）。
+ * 未连接返回 -1。不获取实例锁；与 on_writable 配合，生产者按传输层实际排空速率写入。
+ */
+int
+p2p_send_space(p2p_session_t session);
+
 /*
  * 接收数据 (字节流语义，类似于 TCP recv)。
  * 返回读取的字节数（如果无数据则为 0），或 -1 表示错误。
+ * 线程模式下不获取实例锁（无锁 SPSC 缓冲），同一会话的 p2p_recv 应在单一线程中调用。
  */
 int
 p2p_recv(p2p_session_t session, void *buf, int len);
 
+/*
+ * 零拷贝接收：借出接收缓冲区中下一段连续的已收数据，*ptr / *len 为其地址和长度。
+ * 数据在缓冲区末尾回绕时只返回到末尾的部分，p2p_recv_consume 后再次调用获得其余部分。
+ * 返回可读字节数（无数据为 0，*ptr 为 NULL），或 -1 表示错误。
+ * 借出的区段在 p2p_recv_consume 之前保持有效，期间不要在其他线程调用 p2p_recv / p2p_recv_peek。
+ */
+int
+p2p_recv_peek(p2p_session_t session, const void **ptr, int *len);
+
+/*
+ * 归还 p2p_recv_peek 借出区段的前 n 字节（n 不超过借出长度），释放的空间可继续接收。
+ * 返回 0 成功，-1 表示错误。
+ */
+int
+p2p_recv_consume(p2p_session_t session, int n);
+
+/*
+ * 阻塞接收：接收缓冲区无数据时等待数据到达，最多 timeout_ms（< 0 无限等待，0 即 p2p_recv）。
+ * 返回读取的字节数，超时返回 0，会话已关闭/出错或参数非法返回 -1。
+ * 线程模式下由工作线程在数据到达时唤醒（不占用实例锁）；非线程模式下调用线程自行驱动 p2p_update 直至满足或超时。
+ * 同一会话同一时刻只应有一个线程在 p2p_recv_wait 中等待。
+ */
+int
+p2p_recv_wait(p2p_session_t session, void *buf, int len, int timeout_ms);
+
+/*
+ * 阻塞发送：发送缓冲区空间不足时等待工作线程排空，直到 len 字节全部写入或超时（timeout_ms 同 p2p_recv_wait）。
+ * 返回写入的字节数（超时可能小于 len），一个字节都未写入时会话未连接或参数非法返回 -1。
+ * 同一会话同一时刻只应有一个线程在 p2p_send_wait 中等待。
+ */
+int
+p2p_send_wait(p2p_session_t session, const void *buf, int len, int timeout_ms);
+
+/*
+ * 消息模式发送（需 cfg.message_mode）：整条消息可靠有序送达，对端按发送时的边界取出。
+ * 消息不超过 buf_max_size - 4 字节，超过一包时自动分片。
+ * 返回 len（整条接受），0 表示缓冲区已满稍后重试，或 -1 表示错误（含消息过大）。
+ * 消息模式下 p2p_send / p2p_sendv / p2p_recv / p2p_recv_peek 返回 -1。
+ */
+int
+p2p_send_msg(p2p_session_t session, const void *buf, int len);
+
+/*
+ * 带有效期的消息发送（需 cfg.message_mode）：消息写入后 lifetime_ms 内未送达即作废。
+ * 到期时尚未发出的消息整条丢弃；已发出的分片不再重传，改发跳过通知，对端丢弃不完整的消息，
+ * 不影响其后消息的按序交付（对端为不支持跳过通知的旧版本时，已发出的分片照常重传）。
+ * 适合过时即无用的数据（实时状态、音视频帧等）。lifetime_ms <= 0 等同 p2p_send_msg，返回值同 p2p_send_msg。
+ */
+int
+p2p_send_msg_ttl(p2p_session_t session, const void *buf, int len, int lifetime_ms);
+
+/*
+ * 消息模式接收：取出一条完整消息。
+ * 返回消息长度（无消息为 0），或 -1 表示错误；
+ * 返回值大于 len 时表示 buf 太小，消息保留，可用更大的缓冲区重试。
+ */
+int
+p2p_recv_msg(p2p_session_t session, void *buf, int len);
+
+/*
+ * 发送不可靠数据报（类似 UDP sendto）：不确认、不重传、不保序，适合语音/遥测等过期即无用的数据。
+ * 与字节流/消息共用会话的 session_id、加密与路径选择，len 不超过 1192 字节。
+ * lifetime_ms > 0 时为生存期：数据报排队超过该时长仍未发出（如 DTLS 握手中、中继限流）则丢弃；
+ * <= 0 不限时。返回 len（已排队），0 表示缓冲区已满，或 -1 表示错误。
+ */
+int
+p2p_send_dgram(p2p_session_t session, const void *buf, int len, int lifetime_ms);
+
+/*
+ * 接收一条数据报。返回数据报长度（无数据报为 0），或 -1 表示错误；
+ * 返回值大于 len 时表示 buf 太小，数据报保留，可用更大的缓冲区重试。
+ * 接收缓冲区满时新到的数据报被丢弃。
+ */
+int
+p2p_recv_dgram(p2p_session_t session, void *buf, int len);
+
+/*
+ * 向指定流发送（sid 为 0..协商流数量-1；0 号流即 p2p_send / p2p_send_msg 使用的流）。
+ * 各流独立有序：一条流上的丢包重传不阻塞其他流已到达数据的交付；各流共用会话的拥塞窗口。
+ * 消息模式下按整条消息发送，返回值同 p2p_send_msg；否则同 p2p_send。
+ * sid 超出协商的流数量（或传输层不支持多流）时返回 -1。
+ */
+int
+p2p_send_stream(p2p_session_t session, int sid, const void *buf, int len);
+
+/*
+ * 从指定流接收，消息模式下取出一条完整消息（返回值同 p2p_recv_msg），否则同 p2p_recv。
+ */
+int
+p2p_recv_stream(p2p_session_t session, int sid, void *buf, int len);
+
+/* p2p_stream_redundant 模式 */
+#define P2P_REDUNDANT_OFF   0   // 仅经活跃路径发送（默认）
+#define P2P_REDUNDANT_ON    1   // 每个数据包同时经次优路径再发一份
+#define P2P_REDUNDANT_AUTO  2   // 活跃路径质量趋势转负（或已降级）时才双发
+
+/*
+ * 设置流的冗余双发模式，适合尾延迟比带宽更重要的控制面消息。
+ * 该流的数据包（含重传）除经活跃路径外，再经路径管理器按同一策略选出的次优路径（如 PUNCH + TURN）
+ * 发送一份，接收端按序列号丢弃后到的副本；无次优路径时照常单发。
+ * 返回 0 成功；sid 非法、mode 非法或传输层自带发送路径（PseudoTCP/SCTP）时返回 -1。
+ */
+int
+p2p_stream_redundant(p2p_session_t session, int sid, int mode);
+
+/*
+ * 设置流（消息模式）为无序交付：每条消息到达即交付，不等待同一流上此前消息的重传，
+ * 适合彼此独立的状态更新类消息；消息本身仍完整、可靠。映射为 SCTP 原生流的 U 标志。
+ * 返回 0 成功；sid 非法、非消息模式或传输层不是 SCTP（原生多流）时返回 -1。
+ */
+int
+p2p_stream_unordered(p2p_session_t session, int sid, int on);
+
+/* p2p_stream_priority 优先级类别 */
+#define P2P_PRIO_NORMAL     0   // 普通（默认）
+#define P2P_PRIO_HIGH       1   // 高：严格优先于其他类别发送，重传排在其他类别之前
+#define P2P_PRIO_BULK       2   // 批量：与普通类别按 1:P2P_PRIO_WEIGHT 加权分享发送窗口
+
+#define P2P_PRIO_WEIGHT     4   // 普通类别相对批量类别的发送权重（每轮包数）
+
+/*
+ * 设置流的优先级类别。多流 flush 时高优先级流先排空，普通与批量流再按权重轮转；
+ * 高优先级流的数据包（含排队未发与待重传的包）在可靠层中先于其他包发出。
+ * 同一类别内各流仍轮转，单流会话不受影响。
+ * 返回 0 成功；sid 非法、prio 非法或传输层自带发送路径（PseudoTCP/SCTP）时返回 -1。
+ */
+int
+p2p_stream_priority(p2p_session_t session, int sid, int prio);
+
+#define P2P_RATE_WEIGHT_MAX 1000    // p2p_set_rate_weight 权重上限
+
+/*
+ * 设置会话发送限速：令牌桶以 bytes_per_sec 字节/秒补充，容量 burst 字节（0 = 约 100ms 的积累量，至少 2 个包）。
+ * 在可靠层发送节奏处执行（首发与重传均计入，按线上包长），与拥塞控制的节奏取较严者；
+ * 超出限速的数据留在发送缓冲区，缓冲区满后 p2p_send 照常返回部分写入。bytes_per_sec 为 0 取消限速。
+ * 返回 0 成功；参数为负或传输层自带发送路径（SCTP）时返回 -1。
+ */
+int
+p2p_set_rate_limit(p2p_session_t session, int64_t bytes_per_sec, int64_t burst);
+
+/*
+ * 设置会话在实例总限速（p2p_set_rate_limit_total）下的分享权重（1 ~ P2P_RATE_WEIGHT_MAX，默认 1）。
+ * 返回 0 成功；权重越界返回 -1。
+ */
+int
+p2p_set_rate_weight(p2p_session_t session, int weight);
+
+/*
+ * 设置实例内所有会话的发送总限速（字节/秒，0 取消），burst 为总令牌桶容量（0 = 约 100ms 的积累量）。
+ * 正在发送的会话按权重分享总速率（约每 100ms 重新统计活跃会话），空闲会话不占份额；
+ * 会话自身的 p2p_set_rate_limit 同时生效。返回 0 成功；参数为负返回 -1。
+ */
+int
+p2p_set_rate_limit_total(p2p_handle_t hdl, int64_t bytes_per_sec, int64_t burst);
+
+/*
+ * 发送方向的流压缩率（cfg.compress）：原始字节数 / 实际负载字节数 × 100。
+ * 未协商压缩（任一端未开启）或尚无数据时返回 0；无压缩收益的数据按 1:1 计入。
+ */
+int
+p2p_compress_ratio(p2p_session_t session);
+
+/*
+ * 当前保活间隔（毫秒）。binding_lifetime_ms 可选，返回探测到的本端 NAT 映射存活期（0 = 未开启或探测未完成）。
+ */
+int
+p2p_keepalive_interval(p2p_session_t session, int *binding_lifetime_ms);
+
+/*
+ * 活跃路径当前的 UDP 负载上限（字节，含 4 字节包头）：未开启 cfg.pmtu_discovery、探测未完成、
+ * 非直连 UDP 路径或检测到黑洞回退时为 P2P_MTU。会话无效返回 -1。
+ */
+int
+p2p_path_mtu(p2p_session_t session);
+
+/*
+ * 运行时调参：传输参数的类型化注册表，无需重新编译或重启即可按会话 / 实例 / 进程调整。
+ * 取值按 会话 → 实例 → 进程 → 内置默认 逐层查找首个已设置的值，修改即时作用于后续的计算
+ * （如下一个 RTT 样本、下一次保活、下一次切换判定）。参数均为整数，单位见名称后缀。
+ * 进程层也可经 instrument 'X' 通道 tag "tune" 远程设置（txt = "name=value"，空串输出全部当前值）。
+ */
+enum {
+    P2P_TUNE_RTO_MIN_MS,        /* RTO 下限（默认 50，10..10000） */
+    P2P_TUNE_RTO_MAX_MS,        /* RTO 上限，也是重传退避上限（默认 2000，100..60000） */
+    P2P_TUNE_SEND_WINDOW,       /* 在途包数上限（默认 0 = 按 CONN 协商的窗口，0..16384；只能收紧协商值） */
+    P2P_TUNE_PACING_GAIN,       /* 令牌桶节奏增益百分比：速率 = gain% * cwnd / SRTT（默认 125，50..400；拥塞控制自设速率时不生效） */
+    P2P_TUNE_KEEPALIVE_MS,      /* NAT 保活间隔（默认 0 = 自动：固定 5s 或 cfg.keepalive_adaptive，0..120000；非 0 时不低于 1000） */
+    P2P_TUNE_PATH_COOLDOWN_MS,  /* 路径切换冷却期（默认 0 = 按路径类型阈值，0..600000） */
+    P2P_TUNE_PATH_STABILITY_MS, /* 路径切换稳定窗口（默认 0 = 按路径类型阈值，0..600000） */
+    P2P_TUNE_RTO_INIT_MS,       /* 首个 RTT 样本前的初始 RTO（默认 200，10..10000；限制在 RTO 上下限内，会话初始化 / 路径迁移时生效） */
+    P2P_TUNE_TLP,               /* 尾部丢失探测：最后发出的包约 2×SRTT 无 ACK 时重发该包（默认 1 = 开启，0..1） */
+    P2P_TUNE_PUNCH_TIMEOUT_MIN_MS,  /* 打洞超时下限：超时按对端 RTT 缩放，到期仍无直连即转信令中转（默认 1500，100..60000） */
+    P2P_TUNE_PUNCH_TIMEOUT_MAX_MS,  /* 打洞超时上限，也是无 RTT 样本时的超时（默认 5000，100..60000） */
+    P2P_TUNE_CONN_TIMEOUT_MIN_MS,   /* CONN 握手超时下限（按 RTT 缩放，默认 1000，100..60000） */
+    P2P_TUNE_CONN_TIMEOUT_MAX_MS,   /* CONN 握手超时上限，也是无 RTT 样本时的超时（默认 3000，100..60000） */
+    P2P_TUNE_NUM
+};
+
+#define P2P_TUNE_INHERIT    (-1)    /* p2p_tune_set 的 value：清除该层的设置，恢复继承上一层 */
+
+/*
+ * 设置参数：session 非 NULL 时设置会话层，否则 hdl 非 NULL 时设置实例层，均为 NULL 时设置进程层。
+ * 可在任意线程调用。返回 0 成功；id 无效或 value 超出范围返回 -1。
+ */
+int
+p2p_tune_set(p2p_handle_t hdl, p2p_session_t session, int id, int value);
+
+/*
+ * 读取参数在指定层（选层规则同 p2p_tune_set）生效的值，即该层及其上各层逐层查找的结果；id 无效返回 -1。
+ */
+int
+p2p_tune_get(p2p_handle_t hdl, p2p_session_t session, int id);
+
+/* 参数名（如 "rto_min_ms"），id 无效返回 NULL */
+const char*
+p2p_tune_name(int id);
+
+/* 按参数名查找 id，未找到返回 -1 */
+int
+p2p_tune_find(const char *name);
+
+/*
+ * 发送文件：从 fd 的 offset 处起 len 字节，随发送窗口打开逐包 pread 到数据包，不经发送缓冲区。
+ * 文件数据在 0 号流中紧随调用前已写入的数据；传输完成前之后 p2p_send 的数据排在文件之后。
+ * 进度与结果经 on_file_progress / on_file_done 回调；fd 由调用方持有，完成（或会话关闭）后自行关闭。
+ * 已有文件在发送、消息模式、或使用自带发送路径的传输层（PseudoTCP/SCTP）时返回 -1，成功返回 0。
+ */
+int
+p2p_send_file(p2p_session_t session, int fd, int64_t offset, int64_t len);
+
+/*
+ * 接收文件：此后 0 号流上按序到达的 len 字节（含尚未读出的已缓冲数据）写入 fd 的 offset 处，
+ * 不经接收缓冲区；其后的数据照常由 p2p_recv 读出。
+ * 已有文件在接收、消息模式、或使用 SCTP 时返回 -1，成功返回 0。
+ */
+int
+p2p_recv_file(p2p_session_t session, int fd, int64_t offset, int64_t len);
+
+/*
+ * 可续传分块批量传输
+ *
+ * 对象按 1 MiB 切块，可同时挂接至多 8 个已连接会话并行取块（各会话各自的路径与发送窗口），
+ * 每块以 CRC32 校验；接收端完成位图持久化到 state_path，断线或进程重启后续传未完成的块。
+ *   提供端: b = p2p_bulk_send(hdl, fd, size);      接收端: b = p2p_bulk_recv(hdl, fd, "x.part");
+ *           p2p_bulk_attach(b, session) ...                p2p_bulk_attach(b, session) ...
+ * + 挂接的会话由传输独占 0 号流（须为字节流模式且无进行中的文件收发），期间不得 p2p_send / p2p_recv
+ * + 会话 LOST 或关闭即自动脱离，其在途块改由其余会话取；以新会话（p2p_connect）再次挂接即继续
+ * + 续传状态与对端提供的对象（大小与首块内容）不符时从头开始；全部完成后删除 state_path
+ * + fd 由调用方持有（接收端须可写）；p2p_bulk_close 须在 p2p_destroy 之前调用
+ */
+typedef struct p2p_bulk* p2p_bulk_t;
+
+/* 提供 fd 起始的 size 字节（计算对象标签时读取首块），失败返回 NULL */
+p2p_bulk_t
+p2p_bulk_send(p2p_handle_t hdl, int fd, int64_t size);
+
+/* 接收到 fd（按块偏移写入）；state_path 为 NULL 时不可续传。失败返回 NULL */
+p2p_bulk_t
+p2p_bulk_recv(p2p_handle_t hdl, int fd, const char *state_path);
+
+/* 挂接已连接会话；会话已挂接、不满足条件或已达上限返回 -1 */
+int
+p2p_bulk_attach(p2p_bulk_t bulk, p2p_session_t session);
+
+/*
+ * 接收进度：done = 已校验完成的字节数，total = 对象大小（尚未收到对端 INFO 时为 0），可为 NULL。
+ * 返回 1 全部完成，0 进行中（提供端恒为 0），-1 文件读写失败、传输已终止
+ */
+int
+p2p_bulk_status(p2p_bulk_t bulk, int64_t *done, int64_t *total);
+
+/* 脱离全部会话并释放（会话保持连接，0 号流中可能残留未读的传输数据） */
+void
+p2p_bulk_close(p2p_bulk_t bulk);
+
 //-----------------------------------------------------------------------------
 
 /**
- * 通过信令服务器向对端发送 MSG 请求（A 端）。
+ * 向对端发送 MSG 请求（A 端）。
+ *
+ * 会话已连通（CONNECTED / RELAY）且对端支持时，请求经会话的可靠通道直接发送，不经服务器
+ * （任何信令模式均可用，在途上限为 cfg.rpc_window）；否则仅在 COMPACT / RELAY 模式且服务器
+ * 支持 MSG 时经信令服务器中转，上限为 min(cfg.rpc_window, 服务器窗口)（旧服务器为 1）。
+ * 各请求通过 on_response 回调按 sid 分别接收应答，到达顺序不保证与发送顺序一致。
  *
- * 仅在 COMPACT 模式、服务器支持 MSG（ONLINE_ACK flags 含 SIG_ONACK_FLAG_MSG）
- * 且当前无挂起请求时有效。发送成功后通过 on_response 回调接收应答。
+ * 超过 P2P_MSG_DATA_MAX 的数据自动拆分为多个 RPC 在窗口内并发发送，对端收齐后
+ * 作为一次 on_request 交付（两端均需支持分片）；同一会话同时只能有一个分片请求。
  *
  * @param session   会话对象
- * @param msg       消息ID（1 字节，应用自定义）
- * @param data      请求数据（最多 P2P_MSG_DATA_MAX 字节）
+ * @param msg       消息ID（1 字节，应用自定义，P2P_MSG_FRAG 保留）
+ * @param data      请求数据（最多 cfg.rpc_max_size 字节）
  * @param len       数据长度
- * @return 0=已加入发送队列，-1=失败（不支持/已有挂起/参数错误/未注册）
+ * @return >0=该请求的 sid（与 on_response 的 sid 对应），<0=失败（不支持/窗口已满/参数错误/未注册）
  */
 int
 p2p_request(p2p_session_t session, uint8_t msg, const void *data, int len);
@@ -469,9 +1286,22 @@ p2p_request(p2p_session_t session, uint8_t msg, const void *data, int len);
  * 回复对端的 MSG 请求（B 端，在 on_request 回调中或异步调用）。
  *
  * @param session   会话对象
- * @param code      应答码（1 字节）
+ * 应答数据超过 P2P_MSG_DATA_MAX（最多 cfg.rpc_max_size）时，首片随应答发出，
+ * 其余缓存在本端由请求方拉取；同一会话同时只缓存一个大应答，未取完前再次发送大应答返回失败。
+ *
+ * @param sid       on_request 回调给出的序列号
+ * @param code      应答码（1 字节，P2P_MSG_FRAG 保留）
  * @param data      应答数据
  * @param len       数据长度
+ * @return 0=成功，-1=失败（该 sid 不在待回复状态/参数错误/大应答缓存占用中）
+ */
+int
+p2p_response_to(p2p_session_t session, uint16_t sid, uint8_t code, const void *data, int len);
+
+/**
+ * 回复最早到达、尚未回复的 MSG 请求，等同于以该请求的 sid 调用 p2p_response_to。
+ * 存在已重组完成、尚未回复的分片请求时优先回复该请求。
+ *
  * @return 0=成功，-1=失败（无挂起请求/参数错误）
  */
 int
@@ -20,4 +20,39 @@ enum {
 
 void p2p_instrument(uint16_t rid, uint8_t chn, const char* tag, char *txt, int len);
 
+/*
+ * 延迟直方图（编译选项 P2P_METRICS，未启用时 p2p_hist_get 返回 -1、p2p_hist_reset 为空操作）
+ *
+ * 进程级，所有实例共用；对数-线性分桶（每个 2 的幂区间 8 个子桶，相对误差 ≤ 12.5%），
+ * 记录为无锁原子累加，可在任意线程查询与清零。也可经 instrument 'X' 通道远程操作：
+ *   tag "hist"        按 I: 日志输出全部直方图摘要
+ *   tag "hist_reset"  清零全部直方图
+ */
+enum {
+    P2P_HIST_UPDATE,                                            /* 一轮 p2p_update（线程模式为一轮控制阶段）总耗时 */
+    P2P_HIST_STAGE_RECV,                                        /* 收包派发阶段 */
+    P2P_HIST_STAGE_SIGNAL,                                      /* 信令阶段（控制收 + 控制发） */
+    P2P_HIST_STAGE_SESSIONS,                                    /* 会话 tick 阶段 */
+    P2P_HIST_SEND_ACK,                                          /* DATA 首次发出到被确认（未重传的包，毫秒精度） */
+    P2P_HIST_SEND_QUEUE,                                        /* 应用写入 send_ring 到离开 send_ring 交给可靠层 / 传输层（采样） */
+    P2P_HIST_NUM
+};
+
+/* 直方图摘要（微秒）；分位数为所在桶的中点，不超过 max_us */
+typedef struct {
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t min_us, max_us;
+    uint64_t p50_us, p90_us, p99_us, p999_us;
+} p2p_hist_stat_t;
+
+/* 读取直方图摘要，返回 0；id 无效或未编译直方图返回 -1 */
+int  p2p_hist_get(int id, p2p_hist_stat_t *out);
+
+/* 清零直方图（id < 0 清零全部）；与记录并发时可能残留个别样本 */
+void p2p_hist_reset(int id);
+
+/* 直方图名称（日志 / 基准输出用），id 无效返回 NULL */
+const char *p2p_hist_name(int id);
+
 #endif //P2P_INSTRUMENT_H
@@ -13,6 +13,7 @@
 #pragma clang diagnostic ignored "-Wunused-function"
 #pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -92,6 +93,7 @@ typedef struct {
  *     0x10-0x1F: 保活协议
  *     0x20-0x2F: 数据传输协议
  *     0x30-0x3F: 会话控制和路由探测协议
+ *     0x40-0x7F: 保留（与 TURN ChannelData 首字节区间重叠，不分配）
  *   0x80-0xFF: COMPACT 信令协议（本节）
 */
 
@@ -99,7 +101,18 @@ typedef struct {
 #define P2P_MTU         1200              
 #define P2P_HDR_SIZE    4                           /* 包头大小 */
 #define P2P_MAX_PAYLOAD (P2P_MTU - P2P_HDR_SIZE)    /* 1196 */
+
+/* 路径 MTU 探测上限（P2P_PKT_PMTU_PROBE）：默认以太网 1500 - IPv4(20) - UDP(8)，巨帧网络可编译时 -DP2P_MTU_MAX=8972 */
+#ifndef P2P_MTU_MAX
+#define P2P_MTU_MAX     1472
+#endif
+#if P2P_MTU_MAX < P2P_MTU
+#error "P2P_MTU_MAX must not be smaller than P2P_MTU"
+#endif
+#define P2P_PMTU_PAYLOAD_MAX (P2P_MTU_MAX - P2P_HDR_SIZE)   /* 探测确认后直连 UDP 路径的负载上限（接收缓冲区按此分配） */
 #define P2P_MSG_DATA_MAX  (P2P_MAX_PAYLOAD - 11)    /* MSG RPC data upper bound: relay path needs [session_id(P2P_SESS_ID_PSZ)+sid(2)+msg(1)] */
+#define P2P_DGRAM_MAX     (P2P_MAX_PAYLOAD - 4)     /* DGRAM data upper bound: relay path needs [session_id(P2P_SESS_ID_PSZ)] */
+#define P2P_RPC_WINDOW_MAX  8                       /* MSG RPC: concurrent in-flight sids per session (ONLINE_ACK rpc_window upper bound) */
 
 typedef struct {
     uint8_t             type;               // 包类型（0x01-0x7F: P2P协议, 0x80-0xFF: 信令协议）
@@ -222,12 +235,29 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
  *   - REACH echo target: 告知发送方"你的包到达了这个地址"
  *   - 发送方收到 REACH 后，标记该 target 对应的路径为 writable
  *   - 解决单向防火墙：即使收到包的端口不能回复，也能通过其他可写路径回复 REACH
+ *
+ * 时间戳回显（可选，按负载长度识别，旧版本忽略多出的字段）
+ * ============================================================================
+ *
+ * PUNCH 负载: [target_addr(6B) | ts(4B)]
+ *   ts: 发送方微秒时钟（P_tick_us 低 32 位，network order）
+ *
+ * REACH 负载: [target_addr(6B) | echo_ts(4B) | hold(4B) | ts(4B)]
+ *   echo_ts: 原样回显 PUNCH.ts
+ *   hold:    应答方从收到该 PUNCH 到发出本 REACH 的微秒数（reaching 排队、转发路径）
+ *   ts:      应答方发送时的微秒时钟
+ *
+ * 发送方：RTT = 收包时间 - echo_ts - hold，无需按 seq 记录每个 PUNCH；
+ *   收包时间 - ts 为反向单程延迟（含两端时钟差），减去其历史最小值即反向路径排队延迟。
+ *   对端回显过时间戳后 PUNCH 不再进入 pending 队列；旧版本对端只回 6 字节，仍按 seq 匹配。
  */
-#define P2P_PKT_PUNCH           0x01        // 连接探测包（打洞/保活），负载: target_addr(6B)
-#define P2P_PKT_REACH           0x02        // PUNCH 到达确认包，负载: echo target_addr(6B)
+#define P2P_PKT_PUNCH           0x01        // 连接探测包（打洞/保活），负载: target_addr(6B) [+ ts(4B)]
+#define P2P_PKT_REACH           0x02        // PUNCH 到达确认包，负载: echo target_addr(6B) [+ echo_ts/hold/ts(12B)]
 
 #define P2P_PKT_PUNCH_PSZ           6u      // target_addr(4) + target_port(2)
 #define P2P_PKT_REACH_PSZ           6u      // echo target_addr(4) + target_port(2)
+#define P2P_PKT_PUNCH_TS_PSZ        10u     // PUNCH_PSZ + ts(4)
+#define P2P_PKT_REACH_TS_PSZ        18u     // REACH_PSZ + echo_ts(4) + hold(4) + ts(4)
 
 /*
  * ============================================================================
@@ -236,13 +266,13 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
  *
  * CONN (0x03) — 连接就绪包
  *   包头: [type=0x03 | flags=0 | seq=发送方序列号(2B)]
- *   负载: 无
+ *   负载: [caps(1B) | window(2B) | ack_freq(1B) | ack_delay(1B)]（reliable 能力通告，旧版实现为空负载）
  *   发送: 收到第一个 REACH 后定期发送，直到收到 CONN_ACK 或数据包
  *   接收: 立即回复 CONN_ACK，状态机转换为 CONNECTED，允许数据传输
  *
  * CONN_ACK (0x04) — 连接就绪确认包
  *   包头: [type=0x04 | flags=0 | seq=回传对方的 CONN seq(2B)]
- *   负载: 无
+ *   负载: [caps(1B) | window(2B) | ack_freq(1B) | ack_delay(1B)]（同 CONN）
  *   发送: 收到 CONN 后立即回复
  *   接收: 停止发送 CONN，状态机转换为 CONNECTED
  *
@@ -257,10 +287,24 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
  *   - 发送方: 收到 REACH → 定期发送 CONN → 收到 CONN_ACK → CONNECTED
  *   - 接收方: 收到 CONN → 回复 CONN_ACK → CONNECTED
  *
+ * 能力协商：
+ *   - caps bit0 = 支持扩展 ACK（SACK 区段），window = 本端接收窗口包数
+ *   - caps bit1 = 支持接收窗口通告（ACK 携带 rwnd 字节数，双方均支持时发送方据此限制新包）
+ *   - 双方发送窗口取 min(本端, 对端通告)；负载为空（旧版对端）时按默认 32 包 + 32 位 SACK 位图
+ *   - ack_freq / ack_delay = 请求对端每 N 个按序包或至多 T 毫秒 ACK 一次（乱序时对端立即 ACK）；
+ *     缺省（负载仅 3 字节或为空）时对端每次处理到新数据即 ACK
+ *   - 接收方忽略多余负载，新旧版本可互通
+ *
  * 超时处理：
  *   - 收到任何数据包（DATA/CRYPTO）也可停止 CONN 重传
  *   - 防止握手包丢失导致单方等待
  *
+ * 0-RTT 数据（cfg.early_data）：
+ *   - 发送方发出 CONN 后不等 CONN_ACK，紧随其后发出首个窗口（对端能力未知前的默认窗口）的 DATA；
+ *     应答方收到 CONN 即进入 CONNECTED，其待发数据紧随 CONN_ACK 发出
+ *   - 接收方握手完成前收到的 DATA 照常进入 reliable 接收窗口并 ACK，进入 CONNECTED 后再交付应用；
+ *     尚不能处理的（如多会话模式下尚未登记地址）由发送方按 RTO 重传，新旧版本可互通
+ *
  * 交互示例
  * ============================================================================
  *
@@ -287,8 +331,8 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
 #define P2P_PKT_CONN            0x03        // 连接就绪包（三次握手最后一次）
 #define P2P_PKT_CONN_ACK        0x04        // 连接就绪确认包
 
-#define P2P_PKT_CONN_PSZ            0u      // 无 payload
-#define P2P_PKT_CONN_ACK_PSZ        0u      // 无 payload
+#define P2P_PKT_CONN_PSZ            6u      // caps(1) + window(2) + ack_freq(1) + ack_delay(1) + streams(1)（旧版为 0 或 5）
+#define P2P_PKT_CONN_ACK_PSZ        6u      // caps(1) + window(2) + ack_freq(1) + ack_delay(1) + streams(1)（旧版为 0 或 5）
 
 /*
  * ============================================================================
@@ -313,14 +357,123 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
 
 #define P2P_PKT_FIN_PSZ             0u      // 无 payload
 
+/*
+ * ============================================================================
+ * P2P_PKT_BIND_PROBE 协议（NAT 绑定存活期探测，cfg.keepalive_adaptive）
+ * ============================================================================
+ *
+ * BIND_PROBE (0x10)
+ *   包头: [type=0x10 | flags | seq=探测轮次(2B)]
+ *   负载: [session_id(多会话)][op(1B)]
+ *     op=1 OPEN:  探测方从独立的探测套接字发出，应答方记录来源地址（即探测套接字的 NAT 映射）
+ *     op=2 ECHO:  探测方经活跃路径发出，请求应答方向记录的地址回复
+ *     op=3 REPLY: 应答方发往 OPEN 的来源地址；探测方收到即说明映射在 OPEN 之后空闲 gap 仍存活
+ *
+ *   探测方逐轮增大 gap，首次失败后二分收敛，以最后存活的 gap 作为映射存活期。
+ *   应答方只需回复，不维护定时器；旧版实现忽略此包，探测方在首轮（gap≈0）无应答时放弃。
+ */
+#define P2P_PKT_BIND_PROBE      0x10        // NAT 绑定存活期探测
+
+#define P2P_BIND_OP_OPEN            1
+#define P2P_BIND_OP_ECHO            2
+#define P2P_BIND_OP_REPLY           3
+
+/*
+ * ============================================================================
+ * P2P_PKT_PMTU_PROBE 协议（路径 MTU 探测，DPLPMTUD / RFC 8899，cfg.pmtu_discovery）
+ * ============================================================================
+ *
+ * PMTU_PROBE (0x11)
+ *   包头: [type=0x11 | flags | seq=探测编号(2B)]
+ *   负载: [session_id(多会话)][op(1B)][size(2B)][padding]
+ *     op=1 PROBE: 探测方经活跃直连路径发出，整个 UDP 负载（含包头）填充到 size 字节，IPv4 置 DF
+ *     op=2 ACK:   应答方原样回带 seq 与 size（不填充）；探测方收到即确认该路径可承载 size 字节
+ *
+ *   探测方先以 P2P_MTU 校验对端支持，再直接尝试 P2P_MTU_MAX，失败后在 [已确认, 失败] 间二分；
+ *   负载超过 P2P_MAX_PAYLOAD 的 DATA 只发往已确认的路径，其余路径（TURN / 信令中转 / TCP）
+ *   或黑洞回退后仍在途的大包按 P2P_DATA_FLAG_PART 拆分。旧版实现忽略此包，探测方校验无应答时放弃。
+ */
+#define P2P_PKT_PMTU_PROBE      0x11        // 路径 MTU 探测
+
+#define P2P_PMTU_OP_PROBE           1
+#define P2P_PMTU_OP_ACK             2
+#define P2P_PKT_PMTU_PROBE_PSZ      3u      // op(1) + size(2)（不含多会话 session_id 与填充）
+
+/*
+ * ============================================================================
+ * P2P_PKT_OVERLAY 协议（经第三方对端中转，cfg.overlay_relay / p2p_session_via）
+ * ============================================================================
+ *
+ * A、B 无法直连而二者都与 C 直连时（三方均为 multi_session 实例），A 请求 C 为 A↔B 会话中转：
+ *
+ * OVERLAY (0x12)
+ *   包头: [type=0x12 | flags | seq=0]
+ *   负载: [session_id(多会话，A↔C 会话)][op(1B)][sess_id(4B)][peer_len(1B)][peer_id(peer_len)]
+ *     op=1 REQ: A 经 A↔C 会话发出，sess_id 为 A↔B 会话 ID，peer_id 为 B 的身份标识
+ *     op=2 ACK: C 已登记转发（负载 [op][sess_id]）；A 以 C 的地址登记 OVERLAY 候选并发起连通性检查
+ *     op=3 NAK: C 未开启中转、与 B 无直连会话或转发表已满
+ *
+ *   C 登记后，来自 A、B 且携带 P2P_FLAG_SESSION = sess_id（C 本地无此会话）的包在两条直连腿之间原样转发；
+ *   经 OVERLAY 路径发出的包（含 DATA/ACK/CRYPTO）始终携带 session_id。B 收到携带 sess_id、
+ *   来源为 B↔C 会话地址的包时，将该地址登记为 A↔B 会话的 OVERLAY 候选（无需额外通知）。
+ *   转发表项在 P2P_OVERLAY_IDLE_MS 内无流量或任一腿会话断开时清除；旧版实现忽略此包，A 重试后放弃。
+ */
+#define P2P_PKT_OVERLAY         0x12        // 经第三方对端中转
+
+#define P2P_OVERLAY_OP_REQ          1
+#define P2P_OVERLAY_OP_ACK          2
+#define P2P_OVERLAY_OP_NAK          3
+#define P2P_PKT_OVERLAY_PSZ         5u      // op(1) + sess_id(4)（不含多会话 session_id 与 REQ 的 peer_id）
+
+/*
+ * ============================================================================
+ * P2P_PKT_SHM 协议（同主机共享内存路径发现，cfg.enable_shm）
+ * ============================================================================
+ *
+ * 直连 UDP 路径建立后，双方交换主机标识；一致时改经共享内存环传输（见 src/p2p_shm.h）：
+ *
+ * SHM (0x13)
+ *   包头: [type=0x13 | flags | seq=0]
+ *   负载: [session_id(多会话)][op(1B)][host_id(8B)][name_len(1B)][name(name_len)]
+ *     op=1 HELLO: 探测（不含 name），按 P2P_SHM_HELLO_MS 重发；host_id 一致的一方创建接收环并回复 OFFER
+ *     op=2 OFFER: name 为发送方接收环的共享内存段名；接收方映射为发送环，尚未发过 OFFER 时回复自己的 OFFER
+ *
+ *   双方都持有收发两个环后登记 P2P_PATH_SHM 路径；host_id 不一致时停止探测，旧版实现忽略此包。
+ */
+#define P2P_PKT_SHM             0x13        // 同主机共享内存路径发现
+
+#define P2P_SHM_OP_HELLO            1
+#define P2P_SHM_OP_OFFER            2
+#define P2P_PKT_SHM_PSZ             9u      // op(1) + host_id(8)（不含多会话 session_id 与 OFFER 的段名）
+
 /*
  * ============================================================================
  * 数据传输 (peer-to-peer)
  * ============================================================================
  *
  * DATA:   [hdr(4)][data(N)]                // 数据包，负载为应用数据
+ *         [idx(1)][cnt(1)][chunk(N)]       // flags & P2P_DATA_FLAG_PART：超出本路径上限的大包分段（见 P2P_PKT_PMTU_PROBE）
+ *         [aflags(1)][ack_seq(2)][sack(4)] // flags & P2P_DATA_FLAG_ACK：捎带 ACK 前置于 data（CONN 协商 RELIABLE_CAP_ACK_DATA 后发送），
+ *         [rwnd(4)][ce(4)]                 //   aflags & P2P_ACK_FLAG_RWND / P2P_ACK_FLAG_ECN 时携带，语义同独立 ACK（不含扩展 SACK 区段）
  * ACK:    [hdr(4)][ack_seq(2)][sack(4)]    // 累积确认 + 选择性确认位图
+ *         [rwnd(4)]                        // 接收窗口字节数（flags & P2P_ACK_FLAG_RWND 时存在，CONN 协商 caps bit1 后发送）
+ *         [ce(4)]                          // 累计收到的 CE 标记 DATA 包数（flags & P2P_ACK_FLAG_ECN 时存在，CONN 协商 caps bit7 后发送）
+ *         [n(1)][start(2) count(2)]*n      // 扩展 SACK 区段（可选，CONN 协商 caps bit0 后发送）
  * CRYPTO: [hdr(4)][crypto_data(N)]         // DTLS 握手或加密数据
+ *                                          // （多会话模式下未协商 DTLS CID 时携带 P2P_FLAG_SESSION；
+ *                                          //   tls12_cid 记录按记录头中的 CID 派发，均不依赖来源地址）
+ * DGRAM:  [hdr(4)][data(N)]                // 不可靠数据报：不经 reliable 层，无 ACK/重传，seq 仅递增标识
+ *                                          // （DTLS 就绪后与 DATA/ACK 一样封装在 CRYPTO 内）
+ * FEC:    [hdr(4)][k(1)][len_xor(2)][parity(N)]  // XOR 校验包：seq 起连续 k 个 DATA 负载的逐字节异或（补 0 到最长者），
+ *                                          // len_xor 为各负载长度异或；组内只丢一个包时接收方据此还原（见 p2p_fec.h，
+ *                                          // 双方 CONN 通告 RELIABLE_CAP_FEC 且发送方开启 cfg.fec，DTLS 就绪后封装在 CRYPTO 内）
+ * BULK:   [hdr(4)][len(2) data(len)]*n     // 批量数据：seq 起连续 n 个 DATA 负载合为一帧，仅经 RELAY 信令 TCP 中转
+ *                                          // （双方 CONN 通告 RELIABLE_CAP_BULK 且服务器通告 P2P_RLY_FEATURE_BULK，
+ *                                          //   未加密会话；TCP 链路已可靠，发送方不做快速重传，见 p2p_transport.h）
+ * BUNDLE: [hdr(4)][len(2) pkt(len)]*n      // 合并帧：同一会话 tick 内发往同一路径的多个 DATA/ACK/DGRAM/FEC 包
+ *                                          // （pkt 为完整内层包 hdr(4)+负载，不含 session_id）合为一个数据报，
+ *                                          // 接收方拆开后逐个按原类型处理（双方 CONN 通告 RELIABLE_CAP2_BUNDLE
+ *                                          //   且发送方开启 cfg.bundle，DTLS 就绪后整体封装在 CRYPTO 内）
  *
  * 当 flags & P2P_FLAG_SESSION 时，所有包在 hdr(4) 之后前置 session_id(P2P_SESS_ID_PSZ)，
  * 详见下方 P2P_FLAG_SESSION 说明。
@@ -328,6 +481,15 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
 #define P2P_PKT_DATA            0x20        // 数据包
 #define P2P_PKT_ACK             0x21        // 确认包
 #define P2P_PKT_CRYPTO          0x22        // DTLS 加密包（握手/密文数据）
+#define P2P_PKT_DGRAM           0x23        // 不可靠数据报（语音/遥测等不需要重传的数据）
+#define P2P_PKT_BULK            0x24        // 批量数据帧（RELAY 信令中转路径专用，平铺连续序号的 DATA 负载）
+#define P2P_PKT_FEC             0x25        // 前向纠错校验包（XOR 单校验）
+#define P2P_PKT_BUNDLE          0x26        // 合并帧（多个数据面包共用一个数据报）
+
+#define P2P_PKT_BULK_MAX            4096u   // BULK 帧负载上限（约 3 个满载 DATA）
+#define P2P_PKT_BULK_LARGE_MAX      65280u  // 大帧模式 BULK 负载上限（约 64 KB，整帧不超出 RELAY 16 位长度；见 P2P_RLY_FEATURE_BULK_LARGE）
+#define P2P_PKT_FEC_PSZ             3u      // k(1) + len_xor(2)（不含 parity）
+#define P2P_PKT_BUNDLE_FRAME_HDR    2u      // 合并帧内每个包的 len(2) 前缀
 
 #define P2P_PKT_ACK_PSZ             6u                          // ack_seq(2) + sack(4)（无 session_id）
 #define P2P_PKT_ACK_SESSION_PSZ     (P2P_SESS_ID_PSZ + 6u)      // session_id(P2P_SESS_ID_PSZ) + ack_seq(2) + sack(4)
@@ -338,13 +500,13 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
  *   P2P_FLAG_SESSION (0x01): 包头后携带 session_id(P2P_SESS_ID_PSZ)
  *     - 多会话模式下（p2p_config_t.multi_session=true）由发送方设置，接收方据此路由到正确 session
  *     - 信令服务器中转（relay）路径上同时设置此位（接收方用于会话隔离验证）
- *     适用包类型: PUNCH / DATA / ACK / CRYPTO / REACH / CONN / CONN_ACK / FIN
+ *     适用包类型: PUNCH / DATA / ACK / CRYPTO / DGRAM / REACH / CONN / CONN_ACK / FIN
  *
  *   SIG_FLAG_RELAY (0x02): 此包经信令服务器中转（非 P2P 直连）
  *     - 由信令中转接口（signaling_relay_fn）在发送时自动设置
  *     - 信令中转包同时设置 P2P_FLAG_SESSION（携带 session_id 供服务器路由）
  *     - 接收方在 REACH 处理时需清除此标志，再传给 NAT 层
- *     适用包类型: PUNCH / DATA / ACK / CRYPTO / REACH / CONN / CONN_ACK / FIN（中转版本）
+ *     适用包类型: PUNCH / DATA / ACK / CRYPTO / DGRAM / REACH / CONN / CONN_ACK / FIN（中转版本）
  *
  *   未设任何标志（直连单会话）:
  *     PUNCH:    [hdr(4)][target_addr(6)]
@@ -373,6 +535,15 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
  */
 #define P2P_FLAG_SESSION            0x01    // 携带 session_id（紧跟包头），用于多会话派发/会话隔离/中继路由
 #define SIG_FLAG_RELAY              0x02    // 经信令服务器中转（非直连），同时携带 P2P_FLAG_SESSION
+#define P2P_ACK_FLAG_RWND           0x04    // ACK 专用：sack 之后携带 rwnd(4B)
+#define P2P_ACK_FLAG_ECN            0x08    // ACK 专用：rwnd（若有）之后携带 ce(4B)，累计收到的 CE 标记 DATA 包数
+#define P2P_PUNCH_FLAG_NOMINATE     0x04    // PUNCH 专用：提名该路径（等同 ICE USE-CANDIDATE，见 cfg.ice_aggressive）
+#define P2P_DATA_FLAG_DUP           0x04    // DATA 专用：经次优路径发出的冗余副本，已收到同序号包时静默丢弃（不触发立即 ACK）
+#define P2P_DATA_FLAG_PART          0x08    // DATA 专用：超出当前路径上限的大包的一个分段，负载 [idx(1)][cnt(1)][chunk]，
+                                            // 第 idx 段位于原负载 idx * P2P_DATA_PART_SIZE 处，cnt 段收齐后按原 DATA 处理
+#define P2P_DATA_PART_SIZE          1024u   // DATA 分段大小（加密、session_id 前缀后仍不超过 P2P_MTU）
+#define P2P_DATA_FLAG_ACK           0x10    // DATA 专用：负载前置捎带 ACK [aflags(1)][ack_seq(2)][sack(4)][rwnd(4)?][ce(4)?]，其后为原 DATA 负载
+#define P2P_DATA_ACK_MAX            15u     // 捎带 ACK 最大长度：aflags(1) + ack_seq(2) + sack(4) + rwnd(4) + ce(4)
 
 /* NAT 链路 payload 大小常量（不含 4 字节包头） */
 
@@ -398,9 +569,11 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
 #define SIG_PKT_SYNC            0x87        // 候选列表同步包（序列化传输）
 #define SIG_PKT_SYNC_ACK        0x88        // 候选列表确认（确认指定序列号）
 #define SIG_PKT_FIN             0x89        // 对端已离线/断开
+#define SIG_PKT_PUNCH_AT        0x8A        // 同时打洞起跑提示（server→client，服务器可选实现）：[session_id][delay_ms(2)]
 
 /* SYNC 标志位（p2p_packet_hdr_t.flags） */
 #define SIG_SYNC_FLAG_FIN           0x01    // 候选列表发送完毕
+#define SIG_SYNC_FLAG_DELTA         0x02    // 增量候选更新（同步完成后的增删，见 SYNC 说明）
 
 /* MSG RPC 包类型（服务器可选实现，详见协议详细说明节） */
 #define SIG_PKT_MSG_REQ         0x90        // MSG 请求：A→Server；Server→B relay（flags=SIG_FLAG_RELAY）
@@ -415,6 +588,12 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
 /* ONLINE_ACK 标志位（p2p_packet_hdr_t.flags） */
 #define SIG_ONACK_FLAG_RELAY        0x01    // 服务器支持数据中继功能（P2P 打洞失败降级）
 #define SIG_ONACK_FLAG_MSG          0x02    // 服务器支持 MSG RPC 机制（可可靠中转请求-应答）
+#define SIG_ONACK_FLAG_BACKOFF      0x04    // 限流拒绝（auth_key=0）：payload 末 2 字节为建议的 ONLINE 重发间隔（毫秒）
+#define SIG_ONACK_FLAG_PUNCH_AT     0x08    // 服务器下发 SIG_PKT_PUNCH_AT：客户端开始打洞后暂缓 PUNCH，按提示时刻起跑
+#define SIG_ONACK_FLAG_SYNC0        0x10    // 服务器已受理 ONLINE 捎带的 SYNC0，随后回复其 SYNC0_ACK（客户端无需再单独发送 SYNC0）
+
+/* ONLINE 标志位（p2p_packet_hdr_t.flags） */
+#define SIG_ONLINE_FLAG_SYNC0       0x01    // payload 尾部捎带首个 SYNC0（不含 auth_key），见 ONLINE 说明
 
 /* MSG 包标志位（p2p_packet_hdr_t.flags） */
 /* SIG_FLAG_RELAY (0x02) 复用为 MSG_REQ/MSG_RESP relay 标志：标识此包是 Server→B/A 的中转包 */
@@ -425,14 +604,72 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
 
 #define SIG_AUTH_KEY_PSZ            (sizeof(uint64_t))          // auth_key 大小（8 字节）
 
+/* MSG RPC sid 去重（Server 与 B 端共用）
+ *
+ * *last 为已接受的最大 sid（0=从未接受），*seen 为其之前 32 个 sid 的接受位图（bit i 对应 *last-1-i）。
+ * 流水线下多个 sid 可能乱序到达：较小的 sid 只要在窗口内且未出现过，仍视为新请求。
+ * @return true: 新 sid（已记为接受）; false: 重复或过旧
+ */
+static inline bool p2p_rpc_sid_accept(uint16_t *last, uint32_t *seen, uint16_t sid) {
+    if (!sid) return false;
+    if (!*last) { *last = sid; *seen = 0; return true; }
+    uint16_t d = (uint16_t)(sid - *last);
+    if (d && !(d & 0x8000)) {                                   // 更新于 *last：窗口前移
+        *seen = d > 32 ? 0 : d == 32 ? 0x80000000u : (*seen << d) | (1u << (d - 1));
+        *last = sid;
+        return true;
+    }
+    d = (uint16_t)(*last - sid);
+    if (d == 0 || d > 32 || (*seen & (1u << (d - 1)))) return false;
+    *seen |= 1u << (d - 1);
+    return true;
+}
+
+/* 集群节点选择（COMPACT 模式多节点部署，rendezvous hashing）
+ *
+ * 节点列表为逗号分隔的 "host:port"（客户端 server_host 与服务器 --cluster 使用同一字符串）。
+ * 每个节点按 score(节点名, key) 打分，分数最高者为 key 的所属节点：
+ *   - 客户端以 local_peer_id 为 key 选择上线节点
+ *   - 服务器以配对双方中较小的 peer_id 为 key 确定配对所属节点（即该端的上线节点，另一端由其入口节点代理）
+ * 增删一个节点只会迁移原属于该节点的 key，其余 key 的归属不变。
+ */
+static inline uint32_t p2p_cluster_score(const char *node, size_t node_len, const char *key, size_t key_len) {
+    uint32_t h = 2166136261u;                                   // FNV-1a
+    for (size_t i = 0; i < node_len && node[i]; i++) { h ^= (uint8_t)node[i]; h *= 16777619u; }
+    h ^= 0xFFu; h *= 16777619u;                                 // 分隔，避免 "ab"+"c" 与 "a"+"bc" 同分
+    for (size_t i = 0; i < key_len && key[i]; i++) { h ^= (uint8_t)key[i]; h *= 16777619u; }
+    h ^= h >> 16; h *= 0x85EBCA6Bu; h ^= h >> 13; h *= 0xC2B2AE35u; h ^= h >> 16;
+    return h;
+}
+
+/* 从节点列表中为 key 选择所属节点（同分取靠前者）
+ * @return 选中项在 list 中的起始偏移，*len 输出其长度；列表为空返回 -1
+ */
+static inline int p2p_cluster_pick(const char *list, const char *key, size_t key_len, size_t *len) {
+    int best = -1; uint32_t best_score = 0; *len = 0;
+    for (const char *p = list; *p; ) {
+        const char *e = p; while (*e && *e != ',') e++;
+        if (e > p) {
+            uint32_t sc = p2p_cluster_score(p, (size_t)(e - p), key, key_len);
+            if (best < 0 || sc > best_score) { best = (int)(p - list); best_score = sc; *len = (size_t)(e - p); }
+        }
+        p = *e ? e + 1 : e;
+    }
+    return best;
+}
+
 /* ============================================================================
  * COMPACT 模式协议详细说明
  * ============================================================================
  *
  * ONLINE:
  *   payload: [local_peer_id(32)][instance_id(4)]
- *   包头: type=0x80, flags=0, seq=0
- *   - ONLINE 仅建立客户端与服务器的关系，不携带 remote_peer_id 和候选地址
+ *            [remote_peer_id(32)][candidate_count(1)][candidates(N*23)]    ← 仅 flags 含 SIG_ONLINE_FLAG_SYNC0
+ *   包头: type=0x80, flags=0 或 SIG_ONLINE_FLAG_SYNC0, seq=0
+ *   - ONLINE 建立客户端与服务器的关系；登录时已有待连接的会话，可在尾部捎带其 SYNC0 负载（去掉 auth_key），
+ *     服务器登录后立即按 SYNC0 处理，在 ONLINE_ACK 中置 SIG_ONACK_FLAG_SYNC0 并随后回复 SYNC0_ACK，省去一次往返
+ *     · 旧服务器只读前 36 字节并忽略尾部，其 ONLINE_ACK 不含该标志，客户端按常规在收到后单独发送 SYNC0
+ *     · 服务器不受理捎带（如集群模式下对端归属其他节点）时同样不置该标志
  *   - instance_id: 本次 connect() 的实例 ID（网络字节序，32位，必须非 0）
  *   - 语义:
  *       * instance_id 相同: 视为 ONLINE 重传（例如客户端未收到 ONLINE_ACK）
@@ -440,11 +677,14 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
  *   总大小: 4(包头) + 36(payload) = 40 字节
  */
  #define SIG_PKT_ONLINE_PSZ          (P2P_PEER_ID_MAX + sizeof(uint32_t))                               // peer_id(32) + instance_id(4)
+ #define SIG_PKT_ONLINE_SYNC0_PSZ(n) (SIG_PKT_ONLINE_PSZ + P2P_PEER_ID_MAX + 1u + (n)*sizeof(p2p_candidate_t)) // + remote_peer_id(32) + count(1) + cands(n*23)
 /* ONLINE_ACK:
  *   payload: [instance_id(4)][auth_key(SIG_AUTH_KEY_PSZ)][max_candidates(1)][public_ip(4)][public_port(2)][probe_port(2)]
  *   包头: type=0x81, flags=见下, seq=0
  *   - auth_key: 客户端-服务器认证令牌（network byte order, 64-bit），用于后续 SYNC0 和 ALIVE 包的身份验证
  *     · auth_key=0 表示服务器拒绝登录（无可用槽位），客户端应停止重试
+ *     · auth_key=0 且 flags 含 SIG_ONACK_FLAG_BACKOFF 表示请求被限流：probe_port 位置为建议的重发间隔
+ *       （毫秒，网络字节序），客户端应按该间隔继续重试 ONLINE
  *     · 与 session_id（对端配对会话 ID）语义不同：auth_key 标识 client↔server 关系，session_id 标识 client↔peer 关系
  *   - instance_id: 回显客户端 ONLINE 中的 instance_id（网络字节序，32位）
  *     客户端收到后应比较 instance_id 与当前实例是否一致，不一致则丢弃此 ACK
@@ -454,7 +694,12 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
  *   - flags: 包头的 flags 字段可设置：
  *       SIG_ONACK_FLAG_RELAY (0x01) 表示服务器支持中继
  *       SIG_ONACK_FLAG_MSG (0x02) 表示服务器支持 MSG RPC 机制
- *   总大小: 4(包头) + 21(payload) = 25 字节
+ *       SIG_ONACK_FLAG_PUNCH_AT (0x08) 表示服务器会为配对双方下发 PUNCH_AT 同时起跑提示
+ *       SIG_ONACK_FLAG_SYNC0 (0x10) 表示服务器已受理 ONLINE 捎带的 SYNC0（SYNC0_ACK 随后发出）
+ *   - rpc_window（可选尾字节）: 服务器允许每个会话同时进行的 MSG RPC 数（1..P2P_RPC_WINDOW_MAX）
+ *     旧服务器不携带，客户端按 1 处理（逐个串行）
+ *   - alive_s（可选，rpc_window 之后 2 字节，网络字节序）: 服务器建议的 ALIVE 间隔（秒），见 ALIVE_ACK
+ *   总大小: 4(包头) + 21(payload) [+ 1 [+ 2]] = 25 [26 [28]] 字节
  */
  #define SIG_PKT_ONLINE_ACK_PSZ      (sizeof(uint32_t) + SIG_AUTH_KEY_PSZ + 1u + 4u + 2u + 2u)          // instance_id(4) + auth_key(SIG_AUTH_KEY_PSZ) + max_cands(1) + ip(4) + port(2) + probe(2)
 /* OFFLINE:
@@ -466,18 +711,23 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
  */
  #define SIG_PKT_OFFLINE_PSZ         SIG_AUTH_KEY_PSZ                                                   // auth_key(SIG_AUTH_KEY_PSZ)
 /* ALIVE:
- *   payload: [auth_key(SIG_AUTH_KEY_PSZ)]
+ *   payload: [auth_key(SIG_AUTH_KEY_PSZ)][bind_life_s(2)，可选]
  *   包头: type=0x83, flags=0, seq=0
  *   - auth_key: 客户端-服务器认证令牌（来自 ONLINE_ACK），用于服务器识别并更新槽位活跃时间
- *   用于客户端在 ONLINE/READY 状态定期发送，保持服务器槽位活跃
+ *   - bind_life_s: 客户端测得的 NAT 绑定存活期（秒，网络字节序，0=未知），服务器据此限制建议的 ALIVE 间隔
+ *   用于客户端在 ONLINE/READY 状态定期发送，保持服务器槽位活跃，间隔按服务器最近的通告（默认 20 秒）
  */
  #define SIG_PKT_ALIVE_PSZ           (SIG_AUTH_KEY_PSZ)                                                 // auth_key(SIG_AUTH_KEY_PSZ)
+ #define SIG_PKT_ALIVE_EXT_PSZ       (SIG_AUTH_KEY_PSZ + 2u)                                            // + bind_life_s(2)
 /* ALIVE_ACK:
- *   payload: 空（仅包头）
+ *   payload: [alive_s(2)，可选]
  *   包头: type=0x84, flags=0, seq=0
  *   服务器回复确认，表示槽位仍然有效
+ *   - alive_s: 建议的 ALIVE 间隔（秒，网络字节序）。服务器按在线客户端数拉长间隔以控制 ALIVE 总速率，
+ *     且不超过客户端报告的绑定存活期的一半；客户端空闲超时随之顺延（不短于 90 秒）。旧服务器不携带
  */
  #define SIG_PKT_ALIVE_ACK_PSZ       0u                                                                 // 无 payload
+ #define SIG_PKT_ALIVE_ACK_EXT_PSZ   2u                                                                 // alive_s(2)
 /* SYNC0（双向首次 sync，两方向 payload 格式不同，由各端角色区分处理）:
  *
  * 方向 1: client → server（建立和对端连接，并提交首批同步候选）
@@ -489,9 +739,11 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
  *   客户端在收到 ONLINE_ACK 后立即发送，同时完成：
  *     1. 提交首批候选供服务器缓存
  *     2. 指定 remote_peer_id，建立与对端的配对关系
+ *   首个会话的 SYNC0 也可捎带在 ONLINE 中（见 ONLINE 说明），服务器受理后客户端不再单独发送；
+ *   此后的重传仍使用独立的 SYNC0 包
  *
  * 方向 2: server → client（对端已配对后触发，下发对端候选地址）
- *   payload: [remote_peer_id(P2P_PEER_ID_MAX)][session_id(P2P_SESS_ID_PSZ)][0x00(1)][candidate_count(1)][candidates(N*23)]
+ *   payload: [remote_peer_id(P2P_PEER_ID_MAX)][session_id(P2P_SESS_ID_PSZ)][0x00(1)][candidate_count(1)][candidates(N*23)][instance_id(4)]?
  *   - remote_peer_id: 对端 ID（32字节，不足补零），用于客户端多会话派发定位目标 session
  *   - session_id: 对端配对会话 ID（network byte order，由服务器在配对成功时分配）
  *   - 0x00: 保留字节（固定为 0，供 unpack_remote_candidates 识别为初始推送）
@@ -501,10 +753,17 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
  */
 #define SIG_PKT_SYNC0_PSZ(n)        (SIG_AUTH_KEY_PSZ + P2P_PEER_ID_MAX + 1u + (n)*sizeof(p2p_candidate_t)) // client→server: auth_key(SIG_AUTH_KEY_PSZ) + peer_id(32) + count(1) + cands(n*23)
 #define SIG_PKT_SYNC0_S2C_PSZ(n)    (P2P_PEER_ID_MAX + P2P_SESS_ID_PSZ + 2u + (n)*sizeof(p2p_candidate_t)) // server→client: remote_peer_id(32) + session_id(P2P_SESS_ID_PSZ) + reserved(1) + count(1) + cands(n*23)
+/*
+ * 可选尾部 [instance_id(4)]（server→client 的 SYNC0 / SYNC0_ACK）:
+ *   接收方客户端 ONLINE 时提交的 instance_id（network byte order）。
+ *   同一实例以多个本端身份与同一对端建立会话时，客户端据此定位所属身份的会话；
+ *   旧服务器不带该字段，客户端按 remote_peer_id 取首个匹配会话
+ */
+#define SIG_PKT_INST_ID_PSZ         4u
 /* SYNC0_ACK（双向，两端 payload 格式不同）:
  *
  * 方向 1: server → client（对 client SYNC0 的回复）
- *   payload: [remote_peer_id(P2P_PEER_ID_MAX)][session_id(P2P_SESS_ID_PSZ)][online(1)]
+ *   payload: [remote_peer_id(P2P_PEER_ID_MAX)][session_id(P2P_SESS_ID_PSZ)][online(1)][instance_id(4)]?
  *   - remote_peer_id: 对端 ID（32字节，不足补零），用于客户端多会话派发定位目标 session
  *   - session_id: 对端配对会话 ID（network byte order, 64-bit），标识 client↔peer 会话
  *     · 语义不同于 auth_key（auth_key 标识 client↔server）
@@ -540,8 +799,21 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
  *   - flags: 包头的 flags 字段可设置 SIG_SYNC_FLAG_FIN (0x01) 表示候选列表发送完毕
  *   - seq 窗口: 0..16（1..16 为客户端候选批次，0 为地址变更通知）
  *   - 乱序处理: 允许 seq>0 先于 SYNC0 到达；接收端按序号位图去重，重复包仅 ACK 不重复入表
+ *
+ * SYNC（增量，flags=SIG_SYNC_FLAG_DELTA）:
+ *   payload: [session_id(P2P_SESS_ID_PSZ)][version(1)][op_count(1)][ops(N*(1+23))]
+ *   包头: type=0x87, flags=SIG_SYNC_FLAG_DELTA, seq=version
+ *   - 客户端发送、服务器原样 relay：候选同步完成后（或 seq 窗口用尽时）本端候选的增删
+ *   - version: 增量版本号（1..255 循环，跳过 0），停等发送，未确认前的新变更攒入下一版本
+ *   - op: [op(1)][candidate(23)]，op=SIG_SYNC_DELTA_ADD 新增 / SIG_SYNC_DELTA_DEL 移除（按地址匹配）
+ *   - 接收端按 version 循环序排重，仅应用更新的版本，重复包仅 ACK
+ *   - 以 SYNC_ACK(flags=SIG_SYNC_FLAG_DELTA, seq=version) 确认
  */
 #define SIG_PKT_SYNC_PSZ(n)         (P2P_SESS_ID_PSZ + 2u + (n)*sizeof(p2p_candidate_t))                // session_id(P2P_SESS_ID_PSZ) + base(1) + count(1) + cands(n*23)
+#define SIG_SYNC_DELTA_ADD          1u
+#define SIG_SYNC_DELTA_DEL          2u
+#define SIG_SYNC_DELTA_OPSZ         (1u + sizeof(p2p_candidate_t))                                      // op(1) + cand(23)
+#define SIG_PKT_SYNC_DELTA_PSZ(n)   (P2P_SESS_ID_PSZ + 2u + (n)*SIG_SYNC_DELTA_OPSZ)                    // session_id(P2P_SESS_ID_PSZ) + version(1) + count(1) + ops(n*24)
 /* SYNC_ACK:
  *   payload: [session_id(P2P_SESS_ID_PSZ)]
  *   包头: type=0x88, flags=0, seq=确认的序列号
@@ -549,6 +821,7 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
  *   - seq=0: 客户端→服务器，确认地址变更通知（SYNC seq=0）
  *       注：服务器 SYNC0（server→client 首次候逳推送）由 SIG_PKT_SYNC0_ACK 确认，不使用此类型
  *   - seq>0: 服务器→客户端，确认客户端发送的 SYNC(seq>0) 候选批次；或客户端→服务器 relay 转发
+ *   - flags=SIG_SYNC_FLAG_DELTA: 确认增量 SYNC，seq 为其 version（1..255），经服务器 relay
  *   - seq 窗口: 0..16
  */
 #define SIG_PKT_SYNC_ACK_PSZ        (P2P_SESS_ID_PSZ)                                                   // session_id(P2P_SESS_ID_PSZ)
@@ -560,6 +833,16 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
  *   客户端收到此包后应停止该会话的所有传输和重传
  */
 #define SIG_PKT_FIN_PSZ             (P2P_SESS_ID_PSZ)                                                   // session_id(P2P_SESS_ID_PSZ)
+/* PUNCH_AT:
+ *   payload: [session_id(P2P_SESS_ID_PSZ)][delay_ms(2)]
+ *   包头: type=0x8A, flags=0, seq=0
+ *   服务器下行提示：双方都确认了对端 SYNC0 后，服务器同时向两端发送，约定"delay_ms 毫秒后开始发送 PUNCH"
+ *   - delay_ms = Δ − owd：owd 为服务器到该端的单程时延估计（SYNC0 握手 RTT 的一半），
+ *     Δ 为较远一端的 owd 加一个余量，使两端在同一时刻起跑，PUNCH 在网络中交叉，首轮即打开双方映射
+ *   - 仅 ONLINE_ACK 含 SIG_ONACK_FLAG_PUNCH_AT 时客户端才等待此提示；无确认重传，丢失时客户端等待
+ *     上限（客户端 PUNCH_AT_WAIT_MS）后自行起跑；等待期间收到对端 PUNCH 即立即起跑
+ */
+#define SIG_PKT_PUNCH_AT_PSZ        (P2P_SESS_ID_PSZ + 2u)                                              // session_id(P2P_SESS_ID_PSZ) + delay_ms(2)
 
 /* MSG_REQ (A → Server):
  *   payload: [session_id(P2P_SESS_ID_PSZ)][sid(2)][msg(1)][data(N)]
@@ -734,6 +1017,23 @@ static inline void p2p_pkt_hdr_decode(const uint8_t *buf, p2p_packet_hdr_t *hdr)
  *   ├── MSG_RESP_ACK ────────►│  流程完成                │
  *   │   [session_id][sid]     │                         │
  * 
+ * 流水线（多个 sid 同时进行）：
+ *   每个会话最多 rpc_window 个 RPC 同时进行（ONLINE_ACK 尾字节，缺省为 1），各 sid 独立走上述流程、独立重传。
+ *   - A 端 sid 单调递增（跳过 0），在途数达到窗口时 p2p_request 返回忙
+ *   - Server/B 端按 sid 去重：记录已接受的最大 sid 及其之前 32 个 sid 的位图，
+ *     乱序到达的较小 sid 只要未出现过仍视为新请求
+ *   - Server 端窗口已满时新 sid 取消最老的进行中 RPC（A 端只有在本地放弃了该 sid 后才会超出窗口），
+ *     窗口为 1 时即原有的"新请求覆盖旧请求"行为
+ *
+ * 分片（超过 P2P_MSG_DATA_MAX 的请求/应答，端到端实现，服务器无感知，见 src/p2p_rpc.h）：
+ *   - 请求拆分为 msg=P2P_MSG_FRAG (0xFD) 的多个 RPC，在上述窗口内并发；B 重组后作为一次请求交付
+ *   - 大应答以 code=P2P_MSG_FRAG 返回首片，A 再以 P2P_MSG_FRAG 的 PULL 请求拉取其余分片
+ *   - 分片负载: [kind(1)][xid(2)][idx(2)][total(4)][code(1)][chunk(N)]
+ *   - 失败（超出接收端 rpc_max_size、对端不支持、无进展超时）时 on_response(len=-1, code=P2P_MSG_ERR_FRAG)
+ *
+ * 直连（会话已连通且双方通告 RELIABLE_CAP2_RPC，见 src/p2p_rpc.h）：
+ *   请求 / 应答改以 P2P_FRAG_RPC 的 DATA 包经会话 reliable 通道传输，不经服务器；
+ *   sid 与上述流程共用计数器，经直连到达的请求经直连回复
  */
 
 /* ============================================================================
@@ -766,6 +1066,9 @@ typedef enum {
     /* 消息 RPC（服务器中转的请求-应答机制） */
     P2P_RLY_REQ,                            // 请求: Client -> Server / Server -> Client (双向)
     P2P_RLY_RESP,                           // 响应: Client -> Server / Server -> Client (双向)
+
+    /* 连接复用（服务器通告 P2P_RLY_FEATURE_MUX） */
+    P2P_RLY_MUX,                            // 登录选择 / 关闭: 双向（一条连接承载多个登录）
 } p2p_relay_type_t;
 
 /* RELAY 模式包头 (3 bytes) */
@@ -786,6 +1089,9 @@ typedef struct {
 /* RELAY 上线确认功能标志 */
 #define P2P_RLY_FEATURE_RELAY       0x01    // 支持数据包中继
 #define P2P_RLY_FEATURE_MSG         0x02    // 支持 MSG RPC 机制
+#define P2P_RLY_FEATURE_BULK        0x04    // 支持 P2P_RLY_PACKET 大帧（内层 P2P_PKT_BULK，负载上限 P2P_RLY_PAYLOAD_MAX）
+#define P2P_RLY_FEATURE_MUX         0x08    // 支持 P2P_RLY_MUX 连接复用
+#define P2P_RLY_FEATURE_BULK_LARGE  0x10    // 支持 BULK 大帧模式（P2P_RLY_PACKET 负载上限 P2P_RLY_PAYLOAD_LARGE_MAX）
 #define P2P_RLY_SYNC_FIN_MARKER     0xFF    // SYNC 负载尾部 FIN 标记字节
 
 /* ============================================================================
@@ -810,9 +1116,10 @@ typedef struct {
  */
 #define P2P_RLY_ONLINE_PSZ          (P2P_PEER_ID_MAX + sizeof(uint32_t))
  /* P2P_RLY_ONLINE_ACK:
- *   payload: [features(1)][candidate_sync_max(1)]
+ *   payload: [features(1)][candidate_sync_max(1)][rpc_window(1)]
  *   - features: 0x01=RELAY, 0x02=MSG
  *   - candidate_sync_max: 单包最大候选数（0=客户端用默认）
+ *   - rpc_window: 每个会话可同时进行的 MSG RPC 数（可选，旧服务器不携带，按 1 处理）
  */
 #define P2P_RLY_ONLINE_ACK_PSZ      2
 /* P2P_RLY_SYNC0 (双向，上下行负载格式不同):
@@ -860,6 +1167,20 @@ typedef struct {
 */
 #define P2P_RLY_FIN_PSZ             (P2P_SESS_ID_PSZ)
 
+/* P2P_RLY_MUX:
+ *   payload: [login(2)][op(1)]
+ *   - login: 登录号（网络字节序），连接本身为 0 号登录，其余由客户端分配
+ *   - op=P2P_RLY_MUX_SELECT: 本方向后续帧均属于该登录，直到下一个 SELECT（首帧前默认 0 号）
+ *     服务器收到未知登录号的 SELECT 即为其创建登录槽位，帧内容（ONLINE 起）与独立连接完全相同
+ *   - op=P2P_RLY_MUX_CLOSE: 登录下线（Client -> Server），或被服务器踢下线（Server -> Client，如同名新实例上线）；
+ *     不改变当前选择，连接及其余登录不受影响
+ *   - 客户端仅在首个登录的 ONLINE_ACK 通告 P2P_RLY_FEATURE_MUX 后才复用连接，旧服务器不会收到 MUX 帧
+ *   - 同一连接上所有登录的保活由连接承担（任一登录的 ALIVE 或任意帧均刷新连接活跃时间）
+ */
+#define P2P_RLY_MUX_PSZ             3
+#define P2P_RLY_MUX_SELECT          0
+#define P2P_RLY_MUX_CLOSE           1
+
 /* P2P_RLY_PACKET:
  *   所有 TCP relay 数据包 payload 统一格式: [session_id(P2P_SESS_ID_PSZ)][P2P hdr(4)][data]
  *   P2P hdr = [type(1)][flags(1)][seq(2)]，内层 type 区分实际包类型
@@ -868,8 +1189,12 @@ typedef struct {
  *   说明：
  *   - session_id 用于会话隔离与服务器路由（转发到配对会话）。
  *   - 服务器零拷贝转发，仅重写 session_id，不解析内层 P2P hdr。
+ *   - 大帧模式（P2P_RLY_FEATURE_BULK_LARGE）：负载可达 P2P_RLY_PAYLOAD_LARGE_MAX，仅用于内层 P2P_PKT_BULK，
+ *     且只发给在 CONN 能力中声明可接收大帧的对端（旧版客户端不会收到）。
  */
 #define P2P_RLY_PACKET_PSZ(n)       (P2P_SESS_ID_PSZ + P2P_HDR_SIZE + (n))
+#define P2P_RLY_PAYLOAD_MAX         P2P_RLY_PACKET_PSZ(P2P_PKT_BULK_MAX)   // 通告 P2P_RLY_FEATURE_BULK 时的帧负载上限（其余消息仍为 P2P_MAX_PAYLOAD）
+#define P2P_RLY_PAYLOAD_LARGE_MAX   P2P_RLY_PACKET_PSZ(P2P_PKT_BULK_LARGE_MAX) // 通告 P2P_RLY_FEATURE_BULK_LARGE 时的 PACKET 负载上限
 
 /* P2P_RLY_REQ / P2P_RLY_RESP 最小负载长度（session_id + sid + msg/code = 11 字节） */
 #define P2P_RLY_REQ_MIN_PSZ         (P2P_SESS_ID_PSZ + 3)
@@ -10,6 +10,10 @@
  *   - 输入行固定在终端底部（使用 ANSI 滚动区域）
  *   - 日志和收到的消息从上方滚动输出
  *   - --echo 选项可自动回复收到的消息
+ *
+ * --bench <秒>（两端均需指定，会话改为消息模式）：有 --to 的一端按 --bench-size / --bench-rate 持续发送，
+ * 每秒输出一行 goodput、应用层 RTT 分位数与抖动、重传率、路径与 cwnd，结束时输出汇总后退出；
+ * 另一端作为接收端统计并回报，可连续接受多轮测试。
  */
 
 #define MOD_TAG "P2P_PING"
@@ -45,6 +49,10 @@ ARGS_B(false, no_host,      0,   "no-host",      LA_CS("Disable Host candidates
 ARGS_B(false, no_srflx,     0,   "no-srflx",     LA_CS("Disable Srflx candidates (for testing)", LA_S17, 17));
 ARGS_B(false, no_relay,     0,   "no-relay",     LA_CS("Disable Relay candidates (for testing)", LA_S16, 16));
 ARGS_B(false, no_prflx,     0,   "no-prflx",     LA_CS("Disable Prflx candidates (for testing)", LA_S15, 15));
+ARGS_I(false, bench,        0,   "bench",        LA_CS("Benchmark mode: seconds to run (both peers; the --to side sends)", 0, 0));
+ARGS_I(false, bench_size,   0,   "bench-size",   LA_CS("Benchmark message size in bytes (default 1200)", 0, 0));
+ARGS_I(false, bench_rate,   0,   "bench-rate",   LA_CS("Benchmark send rate in KB/s (0 = saturate)", 0, 0));
+ARGS_I(false, bench_ping,   0,   "bench-ping",   LA_CS("Benchmark RTT probe interval in ms (default 100)", 0, 0));
 
 static p2p_language_t s_lang = P2P_LANG_EN;
 static void cb_cn(const char* argv) { (void)argv;  s_lang = P2P_LANG_CN; lang_cn(); }
@@ -407,6 +415,236 @@ static void on_instrument(uint16_t rid, uint8_t chn, const char* msg, char *cont
     instrument_resp(rid, "unknown");
 }
 
+/* ============================================================================
+ * 基准模式（--bench）
+ *
+ * 两端均以消息模式收发，消息首字节为类型：
+ *   'D' + 填充               数据（接收端只计数）
+ *   'P' + seq:4 + t_us:8     RTT 探测（接收端原样以 'Q' 回送）
+ *   'S' + bytes:8 + msgs:8   接收端回报：累计收到的数据负载字节与消息数（每秒一次，及收到 'F' 后）
+ *   'F'                      发送端结束，接收端回报最终计数后清零，等待下一轮
+ *
+ * goodput 以接收端回报的负载字节计；RTT 探测与数据共用同一有序流，测得的是含发送队列排队的应用层往返时延。
+ * ============================================================================ */
+
+#define BENCH_MSG_MAX           16384
+#define BENCH_RTT_MAX           4096            /* 每个统计区间 / 全程保留的 RTT 样本上限 */
+
+typedef struct {
+    uint32_t    v[BENCH_RTT_MAX];
+    int         n;
+} bench_rtt_t;
+
+static struct {
+    bool            active;                     // 本端为发送端且测试进行中
+    bool            finishing;                  // 已发 'F'，等待最终回报
+    uint64_t        start_us, end_us, last_report_us, next_ping_us, fin_at_us;
+    double          tokens;                     // 限速令牌（字节）
+    uint64_t        tokens_us;
+    uint32_t        ping_seq;
+    uint64_t        sent_bytes;
+    uint64_t        peer_bytes, peer_msgs;      // 接收端最近一次回报
+    uint64_t        last_peer_bytes, last_peer_us;
+    uint64_t        last_pkts, last_retx;
+    double          jitter_us;                  // RFC 3550 式平滑抖动
+    uint32_t        last_rtt_us;
+    bench_rtt_t     win, all;
+    /* 接收端 */
+    uint64_t        rx_bytes, rx_msgs, rx_last_report_us;
+} g_bench;
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t bench_pct(bench_rtt_t *r, int p) {
+    return r->n ? r->v[(r->n - 1) * p / 100] : 0;
+}
+
+static const char *bench_path_name(int path) {
+    switch (path) {
+        case P2P_PATH_LAN:          return "LAN";
+        case P2P_PATH_PUNCH:        return "PUNCH";
+        case P2P_PATH_RELAY:        return "RELAY";
+        case P2P_PATH_SIGNALING:    return "SIGNALING";
+        case P2P_PATH_TCP:          return "TCP";
+        case P2P_PATH_OVERLAY:      return "OVERLAY";
+        case P2P_PATH_SHM:          return "SHM";
+        default:                    return "NONE";
+    }
+}
+
+static void bench_put64(uint8_t *p, uint64_t v) { for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (56 - 8 * i)); }
+static uint64_t bench_get64(const uint8_t *p) { uint64_t v = 0; for (int i = 0; i < 8; i++) v = v << 8 | p[i]; return v; }
+
+static void bench_report(p2p_session_t s, uint8_t type, uint64_t bytes, uint64_t msgs) {
+    uint8_t m[17];
+    m[0] = type;
+    bench_put64(m + 1, bytes);
+    bench_put64(m + 9, msgs);
+    p2p_send_msg(s, m, sizeof(m));
+}
+
+static void bench_start(void) {
+    memset(&g_bench, 0, sizeof(g_bench));
+    uint64_t now = P_tick_us();
+    g_bench.active = true;
+    g_bench.start_us = g_bench.last_report_us = g_bench.last_peer_us = g_bench.next_ping_us = g_bench.tokens_us = now;
+    g_bench.end_us = now + (uint64_t)ARGS_bench.i64 * 1000000;
+    print("I:", "[BENCH] start: %d s, msg=%d B, rate=%d KB/s (0 = saturate), ping every %d ms", (int)ARGS_bench.i64,
+          ARGS_bench_size.i64 > 0 ? (int)ARGS_bench_size.i64 : 1200, (int)ARGS_bench_rate.i64,
+          ARGS_bench_ping.i64 > 0 ? (int)ARGS_bench_ping.i64 : 100);
+}
+
+/* 每秒一行：区间 goodput / RTT / 抖动 / 重传率，及当前路径与拥塞窗口 */
+static void bench_interval(p2p_session_t s, uint64_t now) {
+    p2p_stats_t st;
+    if (p2p_get_stats(s, &st) != 0) return;
+
+    double sec = (double)(now - g_bench.last_peer_us) / 1e6;
+    double mbps = sec > 0 ? (double)(g_bench.peer_bytes - g_bench.last_peer_bytes) * 8 / sec / 1e6 : 0;
+    uint64_t pkts = st.packets_sent - g_bench.last_pkts, retx = st.retransmits - g_bench.last_retx;
+    qsort(g_bench.win.v, (size_t)g_bench.win.n, sizeof(uint32_t), cmp_u32);
+
+    print("I:", "[BENCH] %3ds goodput=%.2f Mbps rtt p50=%.1f p90=%.1f p99=%.1f ms (n=%d) jitter=%.2f ms "
+                "retx=%.2f%% path=%s cwnd=%lld srtt=%d ms",
+          (int)((now - g_bench.start_us) / 1000000), mbps,
+          bench_pct(&g_bench.win, 50) / 1000.0, bench_pct(&g_bench.win, 90) / 1000.0, bench_pct(&g_bench.win, 99) / 1000.0,
+          g_bench.win.n, g_bench.jitter_us / 1000.0, pkts ? 100.0 * (double)retx / (double)pkts : 0.0,
+          bench_path_name(st.path), (long long)st.cwnd, st.srtt_ms);
+
+    g_bench.win.n = 0;
+    g_bench.last_peer_bytes = g_bench.peer_bytes;
+    g_bench.last_peer_us = now;
+    g_bench.last_pkts = st.packets_sent;
+    g_bench.last_retx = st.retransmits;
+}
+
+static void bench_summary(p2p_session_t s, uint64_t now) {
+    p2p_stats_t st;
+    p2p_get_stats(s, &st);
+    double sec = (double)(now - g_bench.start_us) / 1e6;
+    qsort(g_bench.all.v, (size_t)g_bench.all.n, sizeof(uint32_t), cmp_u32);
+    print("I:", "[BENCH] done: %.1f s, sent=%llu B, delivered=%llu B (%llu msgs), goodput=%.2f Mbps",
+          sec, (unsigned long long)g_bench.sent_bytes, (unsigned long long)g_bench.peer_bytes,
+          (unsigned long long)g_bench.peer_msgs, sec > 0 ? (double)g_bench.peer_bytes * 8 / sec / 1e6 : 0);
+    print("I:", "[BENCH] rtt p50=%.1f p90=%.1f p99=%.1f max=%.1f ms (n=%d) jitter=%.2f ms",
+          bench_pct(&g_bench.all, 50) / 1000.0, bench_pct(&g_bench.all, 90) / 1000.0, bench_pct(&g_bench.all, 99) / 1000.0,
+          g_bench.all.n ? g_bench.all.v[g_bench.all.n - 1] / 1000.0 : 0, g_bench.all.n, g_bench.jitter_us / 1000.0);
+    print("I:", "[BENCH] retransmits=%llu / %llu packets (%.2f%%), path=%s, loss=%.2f%%",
+          (unsigned long long)st.retransmits, (unsigned long long)st.packets_sent,
+          st.packets_sent ? 100.0 * (double)st.retransmits / (double)st.packets_sent : 0.0,
+          bench_path_name(st.path), st.loss_rate * 100);
+}
+
+/* 处理收到的基准消息（两端） */
+static void bench_on_msg(p2p_session_t s, uint8_t *m, int n, uint64_t now) {
+    switch (m[0]) {
+    case 'D':
+        g_bench.rx_bytes += (uint64_t)n;
+        g_bench.rx_msgs++;
+        break;
+    case 'P':
+        m[0] = 'Q';
+        p2p_send_msg(s, m, n);
+        break;
+    case 'Q': {
+        if (n < 13) break;
+        uint32_t rtt = (uint32_t)(now - bench_get64(m + 5));
+        if (g_bench.last_rtt_us) {
+            double d = (double)rtt - (double)g_bench.last_rtt_us;
+            g_bench.jitter_us += ((d < 0 ? -d : d) - g_bench.jitter_us) / 16;
+        }
+        g_bench.last_rtt_us = rtt;
+        if (g_bench.win.n < BENCH_RTT_MAX) g_bench.win.v[g_bench.win.n++] = rtt;
+        if (g_bench.all.n < BENCH_RTT_MAX) g_bench.all.v[g_bench.all.n++] = rtt;
+        break;
+    }
+    case 'S':
+        if (n < 17) break;
+        g_bench.peer_bytes = bench_get64(m + 1);
+        g_bench.peer_msgs = bench_get64(m + 9);
+        if (g_bench.finishing) {
+            bench_summary(s, now);
+            g_bench.active = g_bench.finishing = false;
+            g_running = false;
+        }
+        break;
+    case 'F':
+        bench_report(s, 'S', g_bench.rx_bytes, g_bench.rx_msgs);
+        print("I:", "[BENCH] peer finished: received %llu B in %llu msgs",
+              (unsigned long long)g_bench.rx_bytes, (unsigned long long)g_bench.rx_msgs);
+        g_bench.rx_bytes = g_bench.rx_msgs = 0;
+        break;
+    }
+}
+
+/* 基准模式主循环一步：收消息、回报 / 发送数据与探测 */
+static void bench_step(p2p_session_t s, bool sender) {
+    static uint8_t m[BENCH_MSG_MAX];
+    uint64_t now = P_tick_us();
+    int n;
+
+    while ((n = p2p_recv_msg(s, m, sizeof(m))) > 0 && n <= (int)sizeof(m)) bench_on_msg(s, m, n, now);
+
+    if (!sender) {
+        if (g_bench.rx_bytes && now - g_bench.rx_last_report_us >= 1000000) {
+            g_bench.rx_last_report_us = now;
+            bench_report(s, 'S', g_bench.rx_bytes, g_bench.rx_msgs);
+        }
+        return;
+    }
+    if (!g_bench.active) return;
+
+    if (g_bench.finishing) {
+        if (now >= g_bench.fin_at_us + 5000000) {         // 接收端未回报：按最后一次回报汇总
+            print("W:", "[BENCH] no final report from peer");
+            bench_summary(s, now);
+            g_bench.active = false;
+            g_running = false;
+        }
+        return;
+    }
+    if (now >= g_bench.end_us) {
+        m[0] = 'F';
+        while (p2p_send_msg(s, m, 1) == 0) p2p_update(g_hdl);
+        g_bench.finishing = true;
+        g_bench.fin_at_us = now;
+        return;
+    }
+
+    if (now >= g_bench.next_ping_us) {
+        m[0] = 'P';
+        uint32_t seq = g_bench.ping_seq++;
+        m[1] = (uint8_t)(seq >> 24); m[2] = (uint8_t)(seq >> 16); m[3] = (uint8_t)(seq >> 8); m[4] = (uint8_t)seq;
+        bench_put64(m + 5, now);
+        if (p2p_send_msg(s, m, 13) > 0)
+            g_bench.next_ping_us = now + (uint64_t)(ARGS_bench_ping.i64 > 0 ? ARGS_bench_ping.i64 : 100) * 1000;
+    }
+
+    int size = ARGS_bench_size.i64 > 0 ? (int)ARGS_bench_size.i64 : 1200;
+    if (size > BENCH_MSG_MAX) size = BENCH_MSG_MAX;
+    if (ARGS_bench_rate.i64 > 0) {
+        double rate = (double)ARGS_bench_rate.i64 * 1024;  // 字节/秒，至多积攒 100ms
+        g_bench.tokens += rate * (double)(now - g_bench.tokens_us) / 1e6;
+        if (g_bench.tokens > rate / 10 + size) g_bench.tokens = rate / 10 + size;
+        g_bench.tokens_us = now;
+    }
+    m[0] = 'D';
+    for (int i = 0; i < 256; i++) {
+        if (ARGS_bench_rate.i64 > 0 && g_bench.tokens < size) break;
+        if (p2p_send_msg(s, m, size) <= 0) break;           // 发送缓冲区满
+        g_bench.sent_bytes += (uint64_t)size;
+        g_bench.tokens -= size;
+    }
+
+    if (now - g_bench.last_report_us >= 1000000) {
+        g_bench.last_report_us = now;
+        bench_interval(s, now);
+    }
+}
+
 int main(int argc, char *argv[]) {
 
     /* 初始化语言系统 */
@@ -441,6 +679,10 @@ int main(int argc, char *argv[]) {
         &ARGS_DEF_no_srflx,
         &ARGS_DEF_no_relay,
         &ARGS_DEF_no_prflx,
+        &ARGS_DEF_bench,
+        &ARGS_DEF_bench_size,
+        &ARGS_DEF_bench_rate,
+        &ARGS_DEF_bench_ping,
         NULL);
 
     /* 设置日志级别 */
@@ -504,6 +746,7 @@ int main(int argc, char *argv[]) {
     cfg.test_ice_srflx_off = ARGS_no_srflx.i64 ? true : false;
     cfg.test_ice_relay_off = ARGS_no_relay.i64 ? true : false;
     cfg.test_ice_prflx_off = ARGS_no_prflx.i64 ? true : false;
+    cfg.message_mode    = ARGS_bench.i64 ? true : false;    /* 基准模式按消息收发（两端须一致） */
 
     #ifndef NDEBUG
     p2p_instrument_base = 10;
@@ -636,7 +879,18 @@ int main(int argc, char *argv[]) {
 
         log_state_change(g_session);
 
-        if (p2p_is_ready(g_session)) {
+        if (p2p_is_ready(g_session) && ARGS_bench.i64) {
+
+            /* 基准模式：不进入聊天 TUI，发送端首次连通时开始计时 */
+            if (!g_connected_once) { g_connected_once = true;
+                print("I:", "[BENCH] connected, %s", target_name ? "sending" : "receiving");
+                if (target_name) bench_start();
+            }
+            bench_step(g_session, target_name != NULL);
+            P_usleep(1000);
+            continue;
+        }
+        else if (p2p_is_ready(g_session)) {
 
             /* 首次连接成功：初始化 TUI，降低日志等级 */
             if (!g_connected_once) { g_connected_once = true;
@@ -673,6 +927,11 @@ int main(int argc, char *argv[]) {
         else if (g_connected_once) { g_connected_once = false;
             tui_println(P2P_LOG_LEVEL_WARN, LA_S("--- Disconnected ---", LA_S11, 11));
             tui_cleanup();
+            if (g_bench.active) {                           /* 基准进行中断开：按已有回报汇总后退出 */
+                bench_summary(g_session, P_tick_us());
+                g_bench.active = false;
+                g_running = false;
+            }
         }
 
         // 间隔 ms
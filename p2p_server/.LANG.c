@@ -157,6 +157,14 @@ static const char* s_lang_en[LA_NUM] = {
     [LA_F147] = "type=%u rejected: client not logged in\n",  /* SID:147 */
     [LA_F148] = "unknown ses_id=%u (type=%u)\n",  /* SID:148 */
     [LA_F149] = "unsupported type=%u (ses_id=%u)\n",  /* SID:149 */
+    [LA_F150] = "%s init failed(%d)\n",  /* SID:150 */
+    [LA_F151] = "Event loop: %s, up to %d relay clients\n",  /* SID:151 */
+    [LA_F152] = "%s failed(%d)\n",  /* SID:152 */
+    [LA_F153] = "[TCP] Failed to watch client socket (%d), rejecting\n",  /* SID:153 */
+    [LA_F154] = "UDP worker %d dropped %u datagrams (mailbox full)\n",  /* SID:154 */
+    [LA_F155] = "COMPACT UDP receive workers: %d (SO_REUSEPORT)\n",  /* SID:155 */
+    [LA_F156] = "--workers requires Linux SO_REUSEPORT, ignored\n",  /* SID:156 */
+    [LA_F157] = "Send %s: peer='%s', delay=%ums, rtt=%ums, ses_id=%u\n",  /* SID:157 */
 };
 
 /* 语言初始化函数（自动生成，请勿修改）*/
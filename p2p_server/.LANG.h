@@ -191,6 +191,14 @@ enum {
     LA_F147,  /* "type=%u rejected: client not logged in\n" (%u)  [server.c] */
     LA_F148,  /* "unknown ses_id=%u (type=%u)\n" (%u,%u)  [server.c] */
     LA_F149,  /* "unsupported type=%u (ses_id=%u)\n" (%u,%u)  [server.c] */
+    LA_F150,  /* "%s init failed(%d)\n" (%s,%d)  [server.c] */
+    LA_F151,  /* "Event loop: %s, up to %d relay clients\n" (%s,%d)  [server.c] */
+    LA_F152,  /* "%s failed(%d)\n" (%s,%d)  [server.c] */
+    LA_F153,  /* "[TCP] Failed to watch client socket (%d), rejecting\n" (%d)  [server.c] */
+    LA_F154,  /* "UDP worker %d dropped %u datagrams (mailbox full)\n" (%d,%u)  [server.c] */
+    LA_F155,  /* "COMPACT UDP receive workers: %d (SO_REUSEPORT)\n" (%d)  [server.c] */
+    LA_F156,  /* "--workers requires Linux SO_REUSEPORT, ignored\n"  [server.c] */
+    LA_F157,  /* "Send %s: peer='%s', delay=%ums, rtt=%ums, ses_id=%u\n" (%s,%s,%u,%u,%u)  [server.c] */
 
     LA_NUM
 };
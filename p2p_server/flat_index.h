@@ -0,0 +1,149 @@
+/*
+ * flat_index — 整数 key 的开放寻址哈希索引（p2p_server 热路径查找）
+ *
+ * 用于每个包都要查一次的索引（auth_key → COMPACT 客户端，session_id → 会话）。
+ * 与 uthash 的链式哈希相比：
+ *   - key 内嵌在槽位中，命中 / 未命中都只扫描连续内存，不追指针
+ *   - 被索引的对象无需携带 UT_hash_handle（每个约 56 字节）
+ *
+ * 实现：Robin Hood 线性探测
+ *   - 槽位 { key, val }，key=0 表示空槽（auth_key / session_id 均不为 0）
+ *   - 插入时与"离本位更近"的元素交换位置，使各 key 的探测距离趋于均匀；
+ *     查找遇到探测距离小于当前距离的槽位即可判定不存在
+ *   - 删除采用后移（backward shift），不留墓碑
+ *   - 容量为 2 的幂，负载超过 3/4 时翻倍扩容（最小 FLAT_INDEX_MIN_CAP）
+ *
+ * 非线程安全；与 uthash 一样只在主事件循环中使用。
+ */
+
+#ifndef FLAT_INDEX_H
+#define FLAT_INDEX_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FLAT_INDEX_MIN_CAP      64
+
+typedef struct {
+    uint64_t                        key;                        // 0=空槽
+    void*                           val;
+} flat_slot_t;
+
+typedef struct {
+    flat_slot_t*                    slots;
+    uint32_t                        mask;                       // 容量 - 1（slots 为 NULL 时为 0）
+    uint32_t                        count;
+} flat_index_t;
+
+/* 64 位混合（splitmix64 终结器）：session_id 的集群节点高位、连续的测试 key 都能均匀散开 */
+static inline uint32_t flat_index_hash(uint64_t key) {
+    key ^= key >> 30; key *= 0xBF58476D1CE4E5B9ull;
+    key ^= key >> 27; key *= 0x94D049BB133111EBull;
+    key ^= key >> 31;
+    return (uint32_t)key;
+}
+
+/* 槽位 i 上元素离本位的探测距离 */
+static inline uint32_t flat_index_dist(const flat_index_t *t, uint32_t i) {
+    return (i - flat_index_hash(t->slots[i].key)) & t->mask;
+}
+
+static inline void *flat_index_find(const flat_index_t *t, uint64_t key) {
+    if (!t->slots || !key) return NULL;
+    uint32_t i = flat_index_hash(key) & t->mask;
+    for (uint32_t d = 0;; d++, i = (i + 1) & t->mask) {
+        const flat_slot_t *e = &t->slots[i];
+        if (e->key == key) return e->val;
+        if (!e->key || flat_index_dist(t, i) < d) return NULL;
+    }
+}
+
+/* 插入一个确定不存在的 key（扩容重排与 put 共用）*/
+static inline void flat_index_place(flat_index_t *t, uint64_t key, void *val) {
+    uint32_t i = flat_index_hash(key) & t->mask;
+    for (uint32_t d = 0;; d++, i = (i + 1) & t->mask) {
+        flat_slot_t *e = &t->slots[i];
+        if (!e->key) { e->key = key; e->val = val; t->count++; return; }
+        uint32_t ed = flat_index_dist(t, i);
+        if (ed < d) {                                           // 劫富济贫：交换后继续为被挤出的元素找位置
+            flat_slot_t tmp = *e;
+            e->key = key; e->val = val;
+            key = tmp.key; val = tmp.val; d = ed;
+        }
+    }
+}
+
+static inline int flat_index_grow(flat_index_t *t) {
+    uint32_t cap = t->slots ? (t->mask + 1) * 2 : FLAT_INDEX_MIN_CAP;
+    flat_slot_t *old = t->slots;
+    uint32_t old_cap = old ? t->mask + 1 : 0;
+
+    flat_slot_t *slots = (flat_slot_t*)calloc(cap, sizeof(flat_slot_t));
+    if (!slots) return -1;
+    t->slots = slots; t->mask = cap - 1; t->count = 0;
+    for (uint32_t i = 0; i < old_cap; i++)
+        if (old[i].key) flat_index_place(t, old[i].key, old[i].val);
+    free(old);
+    return 0;
+}
+
+/*
+ * 预留容量：保证随后 n 次插入新 key 不会扩容失败
+ * 调用方在创建对象前预留，之后的 flat_index_put 即不会失败，无需回滚
+ * @return 0=成功，-1=内存不足
+ */
+static inline int flat_index_reserve(flat_index_t *t, uint32_t n) {
+    while (!t->slots || (uint64_t)(t->count + n) * 4 > (uint64_t)(t->mask + 1) * 3) {
+        if (flat_index_grow(t) < 0) return -1;
+    }
+    return 0;
+}
+
+/*
+ * 插入或替换 key → val
+ * @return 0=成功，-1=key 为 0 或内存不足（索引保持不变）
+ */
+static inline int flat_index_put(flat_index_t *t, uint64_t key, void *val) {
+    if (!key) return -1;
+    if (t->slots) {
+        uint32_t i = flat_index_hash(key) & t->mask;
+        for (uint32_t d = 0;; d++, i = (i + 1) & t->mask) {
+            flat_slot_t *e = &t->slots[i];
+            if (e->key == key) { e->val = val; return 0; }
+            if (!e->key || flat_index_dist(t, i) < d) break;
+        }
+    }
+    if (flat_index_reserve(t, 1) < 0) return -1;
+    flat_index_place(t, key, val);
+    return 0;
+}
+
+/* 删除 key，返回原 val（不存在返回 NULL）*/
+static inline void *flat_index_del(flat_index_t *t, uint64_t key) {
+    if (!t->slots || !key) return NULL;
+    uint32_t i = flat_index_hash(key) & t->mask;
+    for (uint32_t d = 0;; d++, i = (i + 1) & t->mask) {
+        flat_slot_t *e = &t->slots[i];
+        if (!e->key || flat_index_dist(t, i) < d) return NULL;
+        if (e->key == key) break;
+    }
+
+    void *val = t->slots[i].val;
+    for (;;) {                                                  // 后继元素依次前移一格，直到空槽或已在本位
+        uint32_t n = (i + 1) & t->mask;
+        if (!t->slots[n].key || flat_index_dist(t, n) == 0) break;
+        t->slots[i] = t->slots[n];
+        i = n;
+    }
+    t->slots[i].key = 0; t->slots[i].val = NULL;
+    t->count--;
+    return val;
+}
+
+static inline void flat_index_free(flat_index_t *t) {
+    free(t->slots);
+    t->slots = NULL; t->mask = 0; t->count = 0;
+}
+
+#endif /* FLAT_INDEX_H */
@@ -32,6 +32,11 @@
  *   > 超时、清理等异常情况，输出 W 级日志
  */
 
+/* recvmmsg / sendmmsg 需要 GNU 扩展 */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #define MOD_TAG "P2P0_SERVER"
 
 #include <p2p.h>
@@ -41,13 +46,99 @@
 #include "LANG.cn.h"
 
 #include <signal.h>    /* signal() */
+#include <stdarg.h>    /* va_list（指标输出）*/
 #include "uthash.h"
+#include "flat_index.h"
+
+/*
+ * 事件循环后端（编译期选择，-DSERVER_USE_SELECT 强制回退 select）
+ *   Linux          epoll
+ *   BSD / macOS    kqueue
+ *   其他（Windows） select，受 FD_SETSIZE 限制
+ */
+#if !defined(SERVER_USE_SELECT) && defined(__linux__)
+#  define SERVER_EPOLL      1
+#  include <sys/epoll.h>
+#  include <sys/eventfd.h>
+#  include <poll.h>
+#elif !defined(SERVER_USE_SELECT) && (defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__))
+#  define SERVER_KQUEUE     1
+#  include <sys/event.h>
+#  include <poll.h>
+#endif
+
+/* RELAY 大帧 MSG_ZEROCOPY 发送（--relay-zerocopy，Linux 4.14+，完成通知经套接字错误队列返回）*/
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#  define SERVER_ZEROCOPY   1
+#  include <linux/errqueue.h>
+#endif
 
 #ifdef WITH_WSLAY
 #  include "ws_server.h"
 #  include <stdlib.h>   /* malloc / free */
 static ws_server_t *g_ws_srv = NULL;
 
+/*
+ * PUBSUB 推送帧 {"gist":"<id>","files":{"<peer>":...}} 按 gist/文件保留最后一帧，
+ * 新连接握手完成后补发，晚加入方因此也能读到对端的心跳 / 已发布的候选
+ */
+#define WS_RETAIN_MAX   256
+
+typedef struct ws_retained {
+    char                            key[192];                   // "<gist_id>/<peer_id>"
+    char                           *msg;
+    UT_hash_handle                  hh;
+} ws_retained_t;
+
+static ws_retained_t *g_ws_retained = NULL;                     // 插入顺序即新旧顺序（更新时移到末尾）
+
+static void ws_retain(const char *msg) {
+    const char *g = strstr(msg, "\"gist\":\"");
+    const char *f = g ? strstr(g, "\"files\":{\"") : NULL;
+    if (!f) return;
+    g += 8; f += 10;
+    const char *ge = strchr(g, '"'), *fe = strchr(f, '"');
+    char key[192];
+    if (!ge || !fe || (size_t)(ge - g) + (size_t)(fe - f) + 2 > sizeof(key)) return;
+    snprintf(key, sizeof(key), "%.*s/%.*s", (int)(ge - g), g, (int)(fe - f), f);
+
+    size_t len = strlen(msg) + 1;
+    char *dup = (char *)malloc(len);
+    if (!dup) return;
+    memcpy(dup, msg, len);
+    ws_retained_t *r = NULL;
+    HASH_FIND_STR(g_ws_retained, key, r);
+    if (r) {
+        HASH_DEL(g_ws_retained, r);
+        free(r->msg);
+    } else {
+        if (HASH_COUNT(g_ws_retained) >= WS_RETAIN_MAX) {   // 淘汰最旧的一帧
+            ws_retained_t *old = g_ws_retained;
+            HASH_DEL(g_ws_retained, old);
+            free(old->msg); free(old);
+        }
+        if (!(r = (ws_retained_t *)calloc(1, sizeof(*r)))) { free(dup); return; }
+        memcpy(r->key, key, sizeof(key));
+    }
+    r->msg = dup;
+    HASH_ADD_STR(g_ws_retained, key, r);
+}
+
+static void ws_retain_clear(void) {
+    ws_retained_t *r, *tmp;
+    HASH_ITER(hh, g_ws_retained, r, tmp) {
+        HASH_DEL(g_ws_retained, r);
+        free(r->msg); free(r);
+    }
+}
+
+/* 新连接：补发保留的推送帧 */
+static void ws_on_connect_replay(ws_server_t *srv, ws_client_id_t cid, void *user_data) {
+    (void)user_data;
+    ws_retained_t *r, *tmp;
+    HASH_ITER(hh, g_ws_retained, r, tmp) ws_server_send_text(srv, cid, r->msg);
+}
+
 /* 将收到的文本消息广播给所有已连接的 WS 客户端 */
 static void ws_on_msg_broadcast(ws_server_t *srv, ws_client_id_t cid,
                                 ws_srv_msg_type_t type,
@@ -59,6 +150,7 @@ static void ws_on_msg_broadcast(ws_server_t *srv, ws_client_id_t cid,
     if (!tmp) return;
     memcpy(tmp, data, len);
     tmp[len] = '\0';
+    ws_retain(tmp);
     ws_server_broadcast_text(srv, tmp);
     free(tmp);
 }
@@ -71,22 +163,71 @@ ARGS_B(false, relay,      'r', "relay",      LA_CS("Enable data relay support (C
 ARGS_B(false, msg,        'm', "msg",        LA_CS("Enable MSG RPC support", LA_S5, 5));
 ARGS_B(false, ws,         'S', "ws",         "Enable WebSocket service on same TCP port");
 ARGS_I(false, ws_port,    0,   "ws-port",   "WebSocket dedicated port (also enables --ws)");
+ARGS_I(false, workers,    'w', "workers",    "COMPACT UDP receive threads sharing the port via SO_REUSEPORT (0=disabled)");
+ARGS_I(false, relay_mem,  0,   "relay-mem",  "Relay frame buffer memory cap in MB (default 256)");
+ARGS_B(false, nagle,      0,   "nagle",      "Keep Nagle's algorithm on RELAY connections (default: TCP_NODELAY + corked batch flush)");
+ARGS_B(false, relay_zerocopy, 0, "relay-zerocopy", "Send large RELAY frames with MSG_ZEROCOPY (Linux; buffers held until the kernel completes)");
+ARGS_I(false, metrics_port, 0, "metrics-port", "Prometheus metrics HTTP port (0=disabled)");
+ARGS_I(false, hot_top,    0,   "hot-top",    "Heavy hitters tracked per metric (packets/bytes/CPU) by peer id and source IP (default 10, max 32, -1=disabled)");
+ARGS_I(false, rate_limit, 0,   "rate-limit", "ONLINE/SYNC0/MSG_REQ/TCP accept per source IP and auth_key, per second (burst 2x, 0=disabled)");
+ARGS_S(false, cluster,    0,   "cluster",    "Cluster node list host:port,... (same string clients use as server_host)");
+ARGS_S(false, cluster_self, 0, "cluster-self", "This node's entry in --cluster");
+ARGS_I(false, cluster_port, 0, "cluster-port", "Inter-node link TCP port (same on every node)");
+ARGS_S(false, state,      0,   "state",      "COMPACT state snapshot file (saved on shutdown, restored on start)");
+ARGS_I(false, rpc_window, 0,   "rpc-window", "Concurrent MSG RPCs per session (1..8, default 8)");
+ARGS_I(false, alive_pps,  0,   "alive-pps",  "Target total COMPACT ALIVE rate; the keepalive interval advertised to clients grows with load (default 2000)");
+ARGS_B(false, stun,       0,   "stun",       "Answer STUN Binding requests (RFC 5389) on the signaling and probe ports");
+ARGS_S(false, stun_alt_ip, 0,  "stun-alt-ip", "Second local IP for STUN CHANGE-REQUEST / CHANGED-ADDRESS (with --stun)");
 
 static void cb_cn(const char* argv) { (void)argv;  lang_cn(); }
 ARGS_PRE(cb_cn, cn,         0,   "cn",       LA_CS("Use Chinese language", LA_S10, 10));
 
 #define DEFAULT_PORT                    9333
 
-// cleanup 过期配对/客户端的时间间隔（秒）
-#define CLEANUP_INTERVAL_S              10
-
-// 允许最大同时在线客户端数量
+// select 回退时允许的最大同时在线 RELAY 客户端数量（每个 fd 都要落在 fd_set 内）
 #define MAX_PEERS                       128
 
+// RELAY 模式（TCP）允许的最大同时连接数
+// + epoll/kqueue 不受 FD_SETSIZE 限制，可支撑数万长连接（需同时调高进程 fd 上限，如 ulimit -n）
+#ifndef MAX_RELAY_CLIENTS
+#  if defined(SERVER_EPOLL) || defined(SERVER_KQUEUE)
+#    define MAX_RELAY_CLIENTS           32768
+#  else
+#    define MAX_RELAY_CLIENTS           MAX_PEERS
+#  endif
+#endif
+
+// COMPACT 模式（UDP）允许的最大同时在线客户端数量（无 fd 占用，仅受内存限制）
+#ifndef MAX_COMPACT_CLIENTS
+#define MAX_COMPACT_CLIENTS             65536
+#endif
+
+// COMPACT UDP 接收线程（--workers）：Linux 上以 SO_REUSEPORT 绑定同一端口，内核按四元组分流
+#if defined(SERVER_EPOLL) && defined(SO_REUSEPORT)
+#  define SERVER_UDP_WORKERS            1
+#endif
+#define UDP_WORKER_MAX                  16
+#define UDP_BATCH_MAX                   64      // COMPACT UDP 单次批量收包 / 发包队列容量（recvmmsg / sendmmsg）
+#define UDP_MAILBOX_SLOTS               1024    // 每个接收线程的信箱容量（2 的幂），满时丢包（COMPACT 协议自带重传）
+
+// 客户端池每次增长的槽位数（slab 大小）
+#define CLIENT_SLAB_SLOTS               1024
+
+// RELAY 帧缓冲池
+#define RELAY_BUF_MEM_DEFAULT_MB        256     // 全局内存上限默认值（--relay-mem）
+#define RELAY_BUF_SMALL_RESERVE         (1024 * 1024)   // 小帧（控制/状态回复）可超出上限的余量，保证 BUSY 等回复总能发出
+#define RELAY_BUF_CACHE_LARGE           256     // 大帧空闲缓存上限（超出部分归还系统）
+#define RELAY_BUF_CACHE_SMALL           1024    // 小帧空闲缓存上限
+#define RELAY_BUF_CACHE_BULK            16      // BULK 大帧模式（约 64 KB）空闲缓存上限
+#define RELAY_SESSION_QUEUE_MAX         32      // 单个 session 发送队列的帧数配额（对端不读时不再为其排队）
+#define RELAY_DRR_QUANTUM               RELAY_FRAME_SIZE    // 客户端连接上各 session 每轮的发送字节配额（BULK 大帧跨轮累积额度后发出）
+#define RELAY_ZC_MIN_FRAME              2048    // --relay-zerocopy：不小于此长度的帧走 MSG_ZEROCOPY（更小的帧拷贝更快）
+#define RELAY_ZC_COPIED_MAX             8       // 连续收到内核“已回退为拷贝”的通知数达到此值即停用该连接的零拷贝
+
 // 允许最大候选队列缓存数量
 /* + 服务器为每个用户提供的候选缓存能力
  |   32 个候选可容纳大多数网络环境的完整候选集合，实际场景通常：20-30 个候选，32 提供充足余量
- | + 内存占用：COMPACT 模式 32×7字节=224B/用户，RELAY 模式 32×32字节=1KB/用户
+ | + 内存占用：COMPACT 模式按实际候选数分配（每个 7 字节），RELAY 模式 32×32字节=1KB/用户
 */
 #define MAX_CANDIDATES_CONFIG           32
 #define MAX_CANDIDATES_BY_PAYLOAD       ((P2P_MAX_PAYLOAD - (2 * P2P_PEER_ID_MAX + P2P_SESS_ID_PSZ + 1)) / sizeof(p2p_candidate_t))
@@ -96,24 +237,134 @@ ARGS_PRE(cb_cn, cn,         0,   "cn",       LA_CS("Use Chinese language", LA_S1
 // 客户端在 REGISTERED 状态每 20 秒发一次 keepalive REGISTER，此值取 3 倍间隔
 #define COMPACT_PAIR_TIMEOUT_S          90
 
+// COMPACT 模式客户端 ALIVE 间隔（服务器在 ONLINE_ACK / ALIVE_ACK 中通告，见 compact_alive_interval）
+#define COMPACT_ALIVE_DEFAULT_S         20      // 默认间隔（与客户端未收到通告时的间隔一致）
+#define COMPACT_ALIVE_MIN_S             5
+#define COMPACT_ALIVE_MAX_S             120
+#define COMPACT_ALIVE_MISS              4       // 空闲超时至少容许的连续 ALIVE 丢失数
+#define COMPACT_ALIVE_PPS_DEFAULT       2000    // 全部客户端 ALIVE 总速率目标（--alive-pps）
+
 // RELAY 模式心跳超时时间（秒）
 // 如果客户端超过此时间未发送任何消息（包括心跳），服务器将主动断开连接
 #define RELAY_CLIENT_TIMEOUT_S          60
 
-#define COMPACT_RETRY_INTERVAL_MS       1000    // COMPACT 模式重传检查间隔（毫秒）
-
 // COMPACT 模式 SYNC 重传参数
 #define SYNC0_RETRY_INTERVAL_MS         2000    // 重传间隔（毫秒）
 #define SYNC0_MAX_RETRY                 5       // 最大重传次数
 
+// COMPACT 模式同时打洞起跑提示（SIG_PKT_PUNCH_AT）
+#define PUNCH_AT_GUARD_MS               20      // 起跑时刻在较远一端预计收到提示之后的余量（吸收时延抖动）
+#define PUNCH_AT_RTT_MAX_MS             1000    // RTT 样本上限（超出视为排队异常，不采样）
+
 // COMPACT 模式 MSG RPC 重传参数
 #define MSG_RPC_RETRY_INTERVAL_MS       1000    // MSG RPC 统一重传间隔（毫秒）
 #define MSG_REQ_MAX_RETRY               5       // MSG_REQ 最大重传次数
 #define MSG_RESP_MAX_RETRY              10      // MSG_RESP 最大重传次数（比 REQ 更多，确保 A 端收到）
+#define MSG_RPC_BUF_CACHE               256     // RPC 数据缓冲区空闲缓存上限（超出部分归还系统）
+#define MSG_RPC_WINDOW_DEFAULT          P2P_RPC_WINDOW_MAX  // 每会话并发 RPC 数默认值（--rpc-window）
 
 // RELAY 模式 SYNC 参数（TCP 保证可靠传输，无需应用层重传）
 #define RELAY_SYNC_CANDS_PER_PACKET     10      // 每包最大候选数
 
+// 集群（--cluster）
+#define CLUSTER_MAX_NODES               16
+#define CLUSTER_SESS_SHIFT              28      // 集群内 session_id 高 4 位 = 分配节点序号
+#define CLUSTER_SENDBUF_MAX             (1024 * 1024)   // 节点间链路发送缓冲上限（超出丢弃数据报，由客户端重传恢复）
+#define CLUSTER_RECONNECT_MS            1000    // 链路断开后的重连间隔
+#define CLUSTER_TICK_MS                 200     // 链路建连检查 / 重连周期
+#define CLUSTER_ADDR_TIMEOUT_S          (COMPACT_PAIR_TIMEOUT_S * 2)    // 代理客户端地址表项空闲超时
+
+// 定时器时间轮：TIMER_SLOTS 个槽，每槽 TIMER_TICK_MS（一圈 102.4 秒，覆盖所有超时/重传间隔）
+#define TIMER_TICK_MS                   100
+#define TIMER_SLOTS                     1024
+
+/* 服务器定时器（哈希时间轮）
+ * + 定时器内嵌在所属对象中（客户端空闲超时、会话重传），按到期 tick 挂入 (tick % TIMER_SLOTS) 槽的双向循环链表
+ * + 添加 / 删除 O(1)，主循环推进时只访问经过的槽；超过一圈的定时器留在槽内等待下一轮
+ * + 回调中可以重新添加自身或删除其他定时器（包括同槽尚未处理的）
+ */
+typedef struct srv_timer srv_timer_t;
+typedef void (*srv_timer_fn)(srv_timer_t *t, uint64_t now);
+
+struct srv_timer {
+    srv_timer_t*                    prev;                       // NULL = 未挂载
+    srv_timer_t*                    next;
+    uint64_t                        expire;                     // 到期 tick（毫秒 / TIMER_TICK_MS）
+    srv_timer_fn                    fn;
+};
+
+#define timer_active(t)             ((t)->prev != NULL)
+#define TIMER_OWNER(t, type, member) ((type*)(void*)((char*)(t) - offsetof(type, member)))
+
+static srv_timer_t                  g_timer_slots[TIMER_SLOTS]; // 每槽一个哨兵节点
+static uint64_t                     g_timer_tick = 0;           // 已推进到的 tick
+
+static void timer_init(uint64_t now) {
+    for (int i = 0; i < TIMER_SLOTS; i++) g_timer_slots[i].prev = g_timer_slots[i].next = &g_timer_slots[i];
+    g_timer_tick = now / TIMER_TICK_MS;
+}
+
+static void timer_del(srv_timer_t *t) {
+    if (!t->prev) return;
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = t->next = NULL;
+}
+
+static inline void timer_link(srv_timer_t *head, srv_timer_t *t) {
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+// 添加（或重新设置）定时器，在 expire_ms 时刻之后触发（向上取整到 tick，不会提前）
+static void timer_add(srv_timer_t *t, uint64_t expire_ms, srv_timer_fn fn) {
+    timer_del(t);
+    uint64_t tick = (expire_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    if (tick <= g_timer_tick) tick = g_timer_tick + 1;
+    t->expire = tick;
+    t->fn = fn;
+    timer_link(&g_timer_slots[tick % TIMER_SLOTS], t);
+}
+
+// 推进时间轮到 now，触发所有到期定时器
+static void timer_run(uint64_t now) {
+
+    uint64_t target = now / TIMER_TICK_MS;
+    while (g_timer_tick < target) {
+        uint64_t tick = ++g_timer_tick;
+        srv_timer_t *head = &g_timer_slots[tick % TIMER_SLOTS];
+        if (head->next == head) continue;
+
+        // 整槽移到临时链表再处理：回调中重新添加到本槽（下一圈）的定时器不会在本轮再次触发
+        srv_timer_t list;
+        list.next = head->next; list.prev = head->prev;
+        list.next->prev = &list; list.prev->next = &list;
+        head->prev = head->next = head;
+
+        while (list.next != &list) {
+            srv_timer_t *t = list.next;
+            timer_del(t);
+            if (t->expire > tick) { timer_link(head, t); continue; }
+            t->fn(t, now);
+        }
+    }
+}
+
+// 距最近到期定时器的毫秒数（最多向前探查 max_ms；无到期返回 max_ms），用作事件等待超时
+static int timer_next_ms(uint64_t now, int max_ms) {
+
+    uint64_t last = (now + (uint64_t)max_ms) / TIMER_TICK_MS;
+    for (uint64_t tick = g_timer_tick + 1; tick <= last; tick++) {
+        srv_timer_t *head = &g_timer_slots[tick % TIMER_SLOTS];
+        if (head->next == head) continue;
+        uint64_t at = tick * TIMER_TICK_MS;
+        return at > now ? (int)(at - now) : 0;
+    }
+    return max_ms;
+}
+
 typedef struct session session_t;
 
 typedef struct client {
@@ -122,8 +373,82 @@ typedef struct client {
     uint32_t                        instance_id;
     uint64_t                        last_active;
     session_t*                      sessions;
+
+    srv_timer_t                     idle_timer;                 // 空闲超时定时器（到期时检查 last_active，仍活跃则顺延）
+    uint64_t                        rx_pkts;                    // 中继数据收包数 / 字节数（指标：热点客户端）
+    uint64_t                        rx_bytes;
+
+    int                             slot;                       // 池内槽位号（分配后不变，可作事件标签）
+    struct client*                  pool_next;                  // 空闲链表
 } client_t;
 
+/* 客户端槽位池
+ * + 按 slab（CLIENT_SLAB_SLOTS 个槽位）增长，已分配 slab 不移动：session / 哈希表持有的 client 指针始终有效
+ * + 释放的槽位挂入空闲链表，下次分配优先复用（LIFO）
+ * + 槽位只在进程退出时整体回收；初始化由调用方按字段完成（保留 slot 等池字段）
+ */
+typedef struct client_pool {
+    size_t                          slot_size;
+    int                             max;                        // 在用槽位上限
+    int                             cap;                        // 已分配槽位数（slab 数 × CLIENT_SLAB_SLOTS）
+    int                             used;                       // 在用槽位数
+    uint8_t**                       slabs;
+    client_t*                       free_list;
+} client_pool_t;
+
+// 内存计量（/metrics p2p_memory_bytes）：客户端槽位 slab、会话结构及其附属数组；RELAY 帧缓冲见 g_relay_bufs.held
+static struct {
+    size_t                          client;                     // 客户端槽位 slab 与 slab 指针表
+    size_t                          session;                    // 会话、配对结构与 COMPACT 会话的候选 / RPC 槽位数组
+} g_mem;
+
+static inline client_t* pool_at(const client_pool_t *p, int slot) {
+    return (client_t*)(p->slabs[slot / CLIENT_SLAB_SLOTS] + (size_t)(slot % CLIENT_SLAB_SLOTS) * p->slot_size);
+}
+
+static client_t* pool_alloc(client_pool_t *p) {
+
+    if (p->used >= p->max) return NULL;
+    if (!p->free_list) {
+        int n = p->cap / CLIENT_SLAB_SLOTS;
+        uint8_t **slabs = (uint8_t**)realloc(p->slabs, (size_t)(n + 1) * sizeof(*slabs));
+        if (!slabs) return NULL;
+        p->slabs = slabs;
+        g_mem.client += sizeof(*slabs);
+        if (!(slabs[n] = (uint8_t*)calloc(CLIENT_SLAB_SLOTS, p->slot_size))) return NULL;
+        g_mem.client += CLIENT_SLAB_SLOTS * p->slot_size;
+
+        // 逆序压入空闲链表，使新 slab 按槽位号递增分配
+        for (int i = CLIENT_SLAB_SLOTS - 1; i >= 0; i--) {
+            client_t *c = (client_t*)(slabs[n] + (size_t)i * p->slot_size);
+            c->slot = p->cap + i;
+            c->pool_next = p->free_list;
+            p->free_list = c;
+        }
+        p->cap += CLIENT_SLAB_SLOTS;
+    }
+
+    client_t *c = p->free_list;
+    p->free_list = c->pool_next;
+    c->pool_next = NULL;
+    p->used++;
+    return c;
+}
+
+static void pool_free(client_pool_t *p, client_t *c) {
+    c->pool_next = p->free_list;
+    p->free_list = c;
+    p->used--;
+}
+
+static void pool_destroy(client_pool_t *p) {
+    for (int n = 0; n < p->cap / CLIENT_SLAB_SLOTS; n++) free(p->slabs[n]);
+    g_mem.client -= (size_t)(p->cap / CLIENT_SLAB_SLOTS) * (sizeof(*p->slabs) + CLIENT_SLAB_SLOTS * p->slot_size);
+    free(p->slabs);
+    p->slabs = NULL; p->free_list = NULL;
+    p->cap = p->used = 0;
+}
+
 typedef struct session_pair {
     bool                            valid;
     char                            peer_id[2][P2P_PEER_ID_MAX];   // hh_peer 复合 key 起始（与 remote_peer_id 连续）
@@ -136,13 +461,16 @@ struct session {
     struct session*                 prev;
     struct session*                 next;
     session_pair_t*                 pair;
-    uint32_t                        session_id;
-    UT_hash_handle                  hh_session;
+    uint32_t                        session_id;                 // g_session_index 的 key
+    uint32_t                        mem_size;                   // 会话结构字节数（g_mem.session）
 };
 
-static session_t*                   g_sessions = NULL;
+// session_id → session_t*：每个中转包都要查，使用内嵌 key 的开放寻址索引（见 flat_index.h）
+static flat_index_t                 g_session_index = { NULL, 0, 0 };
 static session_pair_t*              g_session_pairs = NULL;
 
+#define SESSION_FIND(id)            ((session_t*)flat_index_find(&g_session_index, (id)))
+
 #pragma pack(push, 1)
 typedef struct buffer_item {
     struct buffer_item*             next;
@@ -165,16 +493,18 @@ typedef struct relay_session {
                                                                 //   当对端发送完来自本端的项后，会来此继续取下一项
                                                                 // ! 该值可以为 -1, 表示最后一个数据包正在对端的发送队列中
 
-    /* MSG RPC 忙标志（独立于 peer_pending 的并行通道）*/
-    uint16_t                        rpc_pending_sid;            // RPC 生命周期锁：0=空闲，非0=进行中的 RPC sid
-                                                                // 全程：REQ→转发→RESP→转发回来才解锁
-                                                                // RESP 返回时验证 sid 一致性
-    uint64_t                        rpc_sent_time;              // RPC 发起时间戳（毫秒，用于超时检测）
-    struct relay_session*           rpc_pending_next;           // RPC 待确认链表指针（NULL=不在链表中，-1=链表尾）
+    /* MSG RPC 进行中的 sid（独立于 peer_pending 的并行通道，最多 g_rpc_window 个）*/
+    uint16_t                        rpc_sid[P2P_RPC_WINDOW_MAX];        // 0=空闲，非0=进行中的 RPC sid
+                                                                        // 全程：REQ→转发→RESP→转发回来才释放
+                                                                        // RESP 返回时按 sid 匹配
+    uint64_t                        rpc_deadline[P2P_RPC_WINDOW_MAX];   // 各 sid 的超时时刻（毫秒）
+    srv_timer_t                     rpc_timer;                  // RPC 超时定时器（按最早到期的 sid 挂载）
     
     /* 本地发送队列 */
     buffer_item_t*                  send_head;
     buffer_item_t*                  send_rear;
+    uint16_t                        send_cnt;                   // 发送队列帧数（受 RELAY_SESSION_QUEUE_MAX 限制）
+    int32_t                         send_deficit;               // DRR 剩余字节额度（优先级小帧也计入，可为负）
     struct relay_session*           send_prev;
     struct relay_session*           send_next;
 } relay_session_t;
@@ -183,30 +513,114 @@ typedef struct relay_session {
 typedef struct relay_client {
     client_t                        base;
     sock_t                          fd;
+    uint32_t                        ip;                         // 对端 IP（网络字节序，热点统计）
     
     bool                            online_ack_pending;         // ONLINE_ACK 待发送标志（复用 recv_buf）
     
     uint8_t*                        recv_buf;
     uint16_t                        recv_len;
     
+    /* 发送调度：sending 链表为有待发数据的 session（DRR 轮转顺序）
+     * + 队头为小帧（RELAY_BUF_FLAGS_SMALL，控制 / 状态回复）的 session 优先于大帧 session
+     * + 其余 session 按字节额度（RELAY_DRR_QUANTUM）轮转，单个大流量 session 不会独占连接
+     * + 同一 session 内保持 FIFO（如 FIN 必须在其前的数据之后）
+     */
     relay_session_t*                sending_head;
     relay_session_t*                sending_rear;
+    relay_session_t*                sending_cur;                // 正在发送（send_offset > 0）帧所属 session，帧边界时为 NULL
+    uint16_t                        sending_small;              // sending 链表中队头为小帧的 session 数
     uint16_t                        send_offset;
+
+    /* 事件循环就绪状态（epoll/kqueue 边沿触发：通知后一直有效，直到收/发返回 WOULDBLOCK）*/
+    bool                            ev_readable;
+    bool                            ev_writable;
+    bool                            ev_ready;                   // 是否在就绪链表中
+    struct relay_client*            ev_ready_next;
+
+    /* 连接复用（P2P_RLY_MUX）：一条 TCP 连接承载多个登录
+     * + 连接槽位（mux == NULL）持有 fd 与收发状态，其自身即 0 号登录
+     * + 其余登录为虚拟槽位：mux 指向所属连接，fd 与连接相同（仅表示在线），不参与事件循环与空闲超时；
+     *   其会话挂入连接的 sending 链表，帧边界按所属登录插入 SELECT
+     * + 连接收到首个 MUX 帧后（mux_ctl != NULL）直接回复类消息（ONLINE_ACK / ALIVE_ACK / STATUS / FIN）
+     *   连同 SELECT 写入 mux_ctl，由主循环在帧边界发出，不与会话帧交错
+     */
+    struct relay_client*            mux;                        // 虚拟登录：所属连接
+    struct relay_client*            mux_logins;                 // 连接：虚拟登录链表（mux_next 串接）
+    struct relay_client*            mux_next;
+    struct relay_client*            mux_rx;                     // 连接：当前接收登录（NULL = 0 号登录）
+    bool                            mux_rx_drop;                // 连接：当前接收登录已关闭 / 创建失败，丢弃至下一个 SELECT
+    uint16_t                        mux_id;                     // 虚拟登录：登录号
+    uint16_t                        mux_tx;                     // 连接：当前发送登录号
+    uint8_t*                        mux_ctl;                    // 连接：直接回复缓冲（RELAY_MUX_CTL_MAX）
+    uint16_t                        mux_ctl_len;
+    uint16_t                        mux_ctl_off;                // 已发送字节数
+
+    /* 零拷贝发送（--relay-zerocopy）：大帧经 MSG_ZEROCOPY 发出后，缓冲留在 zc 链表直到内核完成通知再归还缓冲池
+     * + 内核按成功的 send 调用依次编号（部分发送也占一个），完成通知给出已完成的编号区间
+     * + 链表内缓冲的 refer 为其最后一次 send 之后的编号，zc_done 越过即可释放
+     */
+    bool                            zc;                         // 连接已启用 SO_ZEROCOPY
+    uint8_t                         zc_copied;                  // 连续“内核回退为拷贝”的通知数（达 RELAY_ZC_COPIED_MAX 即停用）
+    uint32_t                        zc_seq;                     // 下一次零拷贝 send 的编号
+    uint32_t                        zc_done;                    // 已完成编号上界（不含）
+    uint32_t                        zc_mark;                    // 当前帧开始发送时的 zc_seq（帧发完时判断是否用过零拷贝）
+    buffer_item_t*                  zc_head;                    // 等待完成通知的缓冲（按发送顺序）
+    buffer_item_t*                  zc_rear;
+
+    UT_hash_handle                  hh_name;                    // 按 local_peer_id 索引（已 ONLINE 的客户端）
 } relay_client_t;
 
-static relay_client_t               g_relay_clients[MAX_PEERS];
-static buffer_item_t*               g_relay_recycle = NULL;
-static buffer_item_t*               g_relay_recycleS = NULL;
+static client_pool_t                g_relay_pool = { sizeof(relay_client_t), MAX_RELAY_CLIENTS, 0, 0, NULL, NULL };
+static relay_client_t*              g_relay_by_name = NULL;     // ONLINE 客户端：local_peer_id → client
+static relay_client_t*              g_relay_ready = NULL;       // 就绪链表：有待处理读/写的客户端
 
-// RELAY RPC 待确认链表（按 rpc_sent_time 排序，队头最早超时）
-static relay_session_t*             g_relay_rpc_pending_head = NULL;
-static relay_session_t*             g_relay_rpc_pending_rear = NULL;
+#define RELAY_CLIENT_AT(slot)       ((relay_client_t*)pool_at(&g_relay_pool, (slot)))
+#define RELAY_CONN(c)               ((c)->mux ? (c)->mux : (c))                 // 登录所属的连接槽位
 
-#define RELAY_FRAME_SIZE            (sizeof(p2p_relay_hdr_t) + P2P_MAX_PAYLOAD)
+#define RELAY_MUX_CTL_MAX           4096    // 复用连接直接回复缓冲（超过 RELAY_MUX_CTL_MAX - RELAY_MUX_CTL_ROOM 时暂停读取）
+#define RELAY_MUX_CTL_ROOM          128     // 处理一帧最多产生的直接回复字节数（含 SELECT）
+
+#define RELAY_FRAME_SIZE            (sizeof(p2p_relay_hdr_t) + P2P_RLY_PAYLOAD_MAX)     // PACKET 可为 BULK 大帧
 #define RELAY_SMALL_FRAME_SIZE      (sizeof(p2p_relay_hdr_t) + P2P_MAX_PAYLOAD / 4)
+#define RELAY_BULK_FRAME_SIZE       (sizeof(p2p_relay_hdr_t) + P2P_RLY_PAYLOAD_LARGE_MAX)   // BULK 大帧模式（P2P_RLY_FEATURE_BULK_LARGE）
+
+#define RELAY_FLUSH_FRAMES          16      // 每轮主循环单个连接最多发出的帧数（其余留待下一轮，兼顾各连接公平）
 
 #define RELAY_BUF_FLAGS_SMALL       0x01    // 小包标志（提示服务器优先发送，减少延迟）
 #define RELAY_BUF_FLAGS_SYNC_FIN    0x02    // SYNC 包尾部 FIN 标记（告知服务器这是最后一包候选）
+#define RELAY_BUF_FLAGS_BULK        0x04    // BULK 大帧级缓冲（RELAY_BULK_FRAME_SIZE）
+
+/* RELAY 帧缓冲池（按大小分三级：RELAY_BULK_FRAME_SIZE / RELAY_FRAME_SIZE / RELAY_SMALL_FRAME_SIZE）
+ * + BULK 大帧级只在读到超出 RELAY_FRAME_SIZE 的 PACKET 帧头时换入接收缓冲，随零拷贝转发交给对端，
+ *   连接的下一个接收缓冲仍取 RELAY_FRAME_SIZE 级：只有正在转发大帧的连接占用约 64 KB 缓冲
+ * + 释放的缓冲进入本级空闲缓存，缓存满时 free 归还系统：突发过后常驻内存回落到缓存上限
+ * + 全局持有字节数（在用 + 缓存）受 --relay-mem 限制；超限时新分配失败，转发请求回复 P2P_RLY_ERR_BUSY
+ */
+typedef struct relay_buf_class {
+    size_t                          capacity;
+    uint8_t                         flags;
+    int                             cache_max;
+    int                             cached;                     // 空闲缓存数
+    int                             inuse;                      // 在用数
+    buffer_item_t*                  free_list;
+} relay_buf_class_t;
+
+static relay_buf_class_t            g_relay_buf_large = { RELAY_FRAME_SIZE, 0, RELAY_BUF_CACHE_LARGE, 0, 0, NULL };
+static relay_buf_class_t            g_relay_buf_small = { RELAY_SMALL_FRAME_SIZE, RELAY_BUF_FLAGS_SMALL, RELAY_BUF_CACHE_SMALL, 0, 0, NULL };
+static relay_buf_class_t            g_relay_buf_bulk  = { RELAY_BULK_FRAME_SIZE, RELAY_BUF_FLAGS_BULK, RELAY_BUF_CACHE_BULK, 0, 0, NULL };
+
+static struct {
+    size_t                          cap;                        // 持有字节上限
+    size_t                          held;                       // 当前持有字节数（在用 + 缓存）
+    size_t                          peak;                       // 持有字节峰值
+    uint64_t                        alloc_fail;                 // 超限 / OOM 导致的分配失败次数
+    uint64_t                        busy;                       // 因超限 / 配额回复 BUSY 的次数
+    bool                            capped;                     // 当前处于超限状态（避免重复告警）
+} g_relay_bufs = { (size_t)RELAY_BUF_MEM_DEFAULT_MB << 20, 0, 0, 0, 0, false };
+
+// 每会话并发 MSG RPC 数（--rpc-window，两种模式的 ONLINE_ACK 均下发给客户端）
+static int                          g_rpc_window = MSG_RPC_WINDOW_DEFAULT;
+static int                          g_alive_pps = COMPACT_ALIVE_PPS_DEFAULT;
 
 //-----------------------------------------------------------------------------
 
@@ -217,13 +631,27 @@ static relay_session_t*             g_relay_rpc_pending_rear = NULL;
  *   服务器检测到双向匹配后，同时向 A 和 B 发送对方的候选列表
  */
 
+// COMPACT 模式 MSG RPC 槽位（每个进行中的 sid 一个，REQ / RESP 两个阶段共用字段）
+typedef struct compact_rpc {
+    struct compact_session*         cs;                         // 所属会话（请求方 A）
+    uint16_t                        sid;                        // RPC 序列号（0=空闲槽位）
+    srv_timer_t                     timer;                      // 重传定时器（挂载 = 该 sid 有待确认的包）
+    uint64_t                        sent_time;                  // 最后发送时间（毫秒）
+    int                             retry;                      // 重传次数
+    bool                            responding;                 // RPC 阶段（false=REQ等待对端，true=RESP等待确认）
+    uint8_t                         code;                       // 消息类型/响应码（REQ阶段=消息类型，RESP阶段=响应码）
+    uint8_t                         flags;                      // RESP 阶段 flags（PEER_OFFLINE/TIMEOUT）
+    uint8_t*                        data;                       // 数据缓冲区（P2P_MSG_DATA_MAX 字节，仅携带数据期间从缓冲池借用）
+    int                             data_len;                   // 数据长度
+} compact_rpc_t;
+
 typedef struct compact_session {
     session_t                       base;
     struct compact_session*         peer;
 
     uint8_t                         addr_notify_seq;            // 发给对端的地址变更通知序号（base_index，1..255 循环）
 
-    p2p_candidate_t                 candidates[MAX_CANDIDATES]; // 候选列表（网络格式，直接收发）
+    p2p_candidate_t*                candidates;                 // 候选列表（网络格式，直接收发；按实际数量分配，无候选时为 NULL）
     int                             candidate_count;            // 候选数量
 
     // SYNC(seq=0) 可靠传输（首包 + 地址变更通知）
@@ -233,21 +661,17 @@ typedef struct compact_session {
     //   2  = 客户端对（服务器转发的）对端 SYNC0 的 ACK 确认
     //  -1  = 重传超时放弃
     int                             sync0_acked;
-    struct compact_session*         sync0_pending_next;         // 待确认链表指针（-1 表示链表最后一个）
-    uint64_t                        sync0_sent_time;            // 当前待确认 seq=0 最近发送时间（毫秒）
+    srv_timer_t                     sync0_timer;                // 重传定时器（挂载 = 有待确认的 seq=0）
     int                             sync0_retry;                // 当前待确认 seq=0 重传次数
     uint8_t                         sync0_base_index;           // 当前待确认 seq=0 的 base_index（0=首包，!=0 地址变更通知）
+    uint64_t                        sync0_sent;                 // 当前待确认 seq=0 的首次发送时间（RTT 采样）
+    uint32_t                        rtt_ms;                     // 服务器↔客户端 RTT 平滑估计（SYNC0 握手采样，0=无样本）
 
-    // MSG RPC（请求-响应机制，共用字段存储两个阶段的数据）
-    uint16_t                        rpc_last_sid;               // 最后一次完成或正在执行的 RPC 序列号（0=未使用）
-    struct compact_session*         rpc_pending_next;           // RPC 待确认链表指针（NULL=空闲，-1=链表尾）
-    uint64_t                        rpc_sent_time;              // 最后发送时间（毫秒）
-    int                             rpc_retry;                  // 重传次数
-    bool                            rpc_responding;             // RPC 阶段（false=REQ等待对端，true=RESP等待确认）
-    uint8_t                         rpc_code;                   // RPC 消息类型/响应码（REQ阶段=消息类型，RESP阶段=响应码）
-    uint8_t                         rpc_flags;                  // RPC flags（RESP 阶段使用：PEER_OFFLINE/TIMEOUT）
-    uint8_t                         rpc_data[P2P_MSG_DATA_MAX]; // RPC 数据缓冲区
-    int                             rpc_data_len;               // RPC 数据长度
+    // MSG RPC（请求-响应机制，最多 g_rpc_window 个 sid 同时进行）
+    compact_rpc_t*                  rpc;                        // 槽位数组（g_rpc_window 个，首个 RPC 到达时分配；NULL=从未使用）
+    int                             rpc_active;                 // 进行中的槽位数
+    uint16_t                        rpc_last_sid;               // 已接受的最大 RPC 序列号（0=未使用）
+    uint32_t                        rpc_seen;                   // rpc_last_sid 之前 32 个 sid 的接受位图（p2p_rpc_sid_accept）
 
 } compact_session_t;
 
@@ -257,24 +681,243 @@ typedef struct compact_client {
     struct sockaddr_in              addr;                       // 公网地址（UDP 源地址）
     uint64_t                        auth_key;                   // client↔server 认证令牌（ONLINE_ACK 分配，OFFLINE/ALIVE/SYNC0 鉴权用）
 
-    UT_hash_handle                  hh_client;                  // 按 auth_key 索引（client↔server 鉴权查找）
+    struct cluster_proxy*           cluster;                    // 集群：在其他 owner 节点上的代理登录（按需分配）
+
+    uint16_t                        alive_s;                    // 最近通告给客户端的 ALIVE 间隔（秒，空闲超时据此顺延）
+    uint16_t                        bind_life_s;                // 客户端报告的 NAT 绑定存活期（秒，0=未知）
+
+    UT_hash_handle                  hh_name;                    // 按 local_peer_id 索引（ONLINE 查找）
 } compact_client_t;
 
-// COMPACT 模式客户端数组和按 auth_key 查找的哈希表
-static compact_client_t             g_compact_clients[MAX_PEERS];
-static compact_client_t*            g_compact_clients_by_auth = NULL;
+// COMPACT 模式客户端池，以及按 auth_key / local_peer_id 查找的索引
+// auth_key 每个 ALIVE/SYNC/中转包都要查，使用开放寻址索引；local_peer_id 只在 ONLINE 时查，沿用 uthash
+static client_pool_t                g_compact_pool = { sizeof(compact_client_t), MAX_COMPACT_CLIENTS, 0, 0, NULL, NULL };
+static flat_index_t                 g_compact_auth_index = { NULL, 0, 0 };
+static compact_client_t*            g_compact_clients_by_name = NULL;
 
-// SYNC(seq=0) 待确认链表（仅包含已发送首包但未收到 ACK 的配对）
-static compact_session_t*           g_compact_sync0_pending_head = NULL;
-static compact_session_t*           g_compact_sync0_pending_rear = NULL;
+#define COMPACT_FIND_BY_AUTH(key)   ((compact_client_t*)flat_index_find(&g_compact_auth_index, (key)))
 
-// MSG RPC 待确认链表（统一管理 REQ 和 RESP 阶段，通过 rpc_responding 区分）
-static compact_session_t*           g_compact_rpc_pending_head = NULL;
-static compact_session_t*           g_compact_rpc_pending_rear = NULL;
+#define COMPACT_CLIENT_AT(slot)     ((compact_client_t*)pool_at(&g_compact_pool, (slot)))
+
+// COMPACT 信令 UDP 套接字（定时器回调中重传 / 通知使用）
+static sock_t                       g_udp_fd = P_INVALID_SOCKET;
+
+// STUN Binding 应答源 [ip][port]：ip 0 = 主地址，1 = --stun-alt-ip；port 0 = 信令端口，1 = --probe-port
+static sock_t                       g_stun_socks[2][2] = { { P_INVALID_SOCKET, P_INVALID_SOCKET },
+                                                           { P_INVALID_SOCKET, P_INVALID_SOCKET } };
+static struct in_addr               g_stun_alt_ip;
 
 #define PEER_ONLINE(s)      ((s)->peer && (s)->peer != (compact_session_t*)(void*)-1)  // 判断对端是否在线（peer 指针为 (void*)-1 表示已断开）
 #define PEER_OF(s)          (PEER_ONLINE(s) ? (s)->peer : NULL)
 
+/* COMPACT 数据中继转发表：session_id → 对端 session_id + 双方地址
+ * + 已配对会话的中继数据包（DATA/ACK/CRYPTO/...）在进入信令分发前查表转发：一次哈希查找 + 改写 session_id + 入发送队列
+ * + 开放寻址（线性探测，删除时后移补位，无墓碑）；session_id 为随机数，直接取低位作槽位
+ * + 配对 / 地址变更时写入，会话释放时删除；源地址与表中不一致的包走完整信令路径（由其处理地址变更后刷新表项）
+ */
+typedef struct compact_fwd {
+    uint32_t                        session_id;                 // 0 = 空槽
+    uint32_t                        peer_session_id;
+    client_t*                       client;                     // 本端客户端（计入热点统计；表项随会话释放而删除）
+    struct sockaddr_in              src;                        // 本端客户端地址（只接受来自该地址的快速转发）
+    struct sockaddr_in              dst;                        // 对端客户端地址
+} compact_fwd_t;
+
+static compact_fwd_t*               g_compact_fwd = NULL;
+static uint32_t                     g_compact_fwd_cap = 0;      // 槽位数（2 的幂）
+static uint32_t                     g_compact_fwd_cnt = 0;
+static uint64_t                     g_compact_fwd_pkts = 0;     // 快速路径转发计数
+
+/* 运行指标（--metrics-port 以 Prometheus 文本格式导出）
+ * + 计数器只增不减，每秒包数等速率由抓取方按时间差计算（rate()）
+ * + 在线数、会话数、缓冲池占用、重传队列深度等仪表值在抓取时现场统计，不在热路径维护
+ */
+#define METRICS_LOOP_BUCKETS        8
+#define METRICS_TOP_CLIENTS         10
+
+static const uint32_t               g_metrics_loop_us[METRICS_LOOP_BUCKETS] = { 100, 250, 500, 1000, 2500, 10000, 50000, 250000 };
+
+static struct {
+    uint64_t                        udp_pkts[256];              // COMPACT UDP 收包数（按包类型 SIG_PKT_* / P2P_PKT_*）
+    uint64_t                        relay_frames[256];          // RELAY TCP 收帧数（按 P2P_RLY_* 类型）
+    uint64_t                        relay_rx_bytes;             // RELAY TCP 收帧字节
+    uint64_t                        relay_tx_bytes;             // RELAY session 队列发出字节（中转数据 + 状态回复）
+    uint64_t                        relay_zc_bytes;             // 其中经 MSG_ZEROCOPY 发出的字节（--relay-zerocopy）
+    uint64_t                        compact_fwd_bytes;          // COMPACT 快速路径转发字节
+    uint64_t                        stun_requests;              // STUN Binding 请求（--stun）
+    uint64_t                        stun_rejected;              // 其中因所需 IP / 端口未配置回 420 的
+    uint64_t                        loop_buckets[METRICS_LOOP_BUCKETS + 1];    // 主循环单轮处理耗时分布（末格 = +Inf）
+    uint64_t                        loop_sum_us;
+    uint64_t                        loop_count;
+} g_metrics;
+
+/* 热点来源（--hot-top）：按 peer_id / 源 IP 统计收包数、字节数与处理耗时，定位压垮服务器的客户端
+ * + 每个维度每项指标一个 count-min sketch（HOT_DEPTH 行 × HOT_WIDTH 列，估计值只偏大不偏小）
+ *   与 top-K 候选表：每包各行一次加法、取最小值为估计，再与 K 个候选比较（命中则更新，否则替换最小者）
+ * + 每 HOT_DECAY_MS 全部计数减半，排名反映最近几分钟的负载而非进程启动以来的累计，导出为仪表值
+ * + COMPACT 按数据报计量（含快速路径转发），RELAY 按帧计量字节、按读事件计量耗时；
+ *   peer_id 在处理中识别出客户端后才能归属（未登录的源只计入 IP 维度）
+ * + --metrics-port 导出 p2p_hot_*；SIGUSR1 输出到日志
+ */
+#define HOT_DEPTH                   4
+#define HOT_WIDTH                   1024                        // 2 的幂（取哈希高 HOT_WIDTH_BITS 位）
+#define HOT_WIDTH_BITS              10
+#define HOT_TOP_DEFAULT             10
+#define HOT_TOP_MAX                 32
+#define HOT_DECAY_MS                60000
+
+enum { HOT_PKTS, HOT_BYTES, HOT_CPU_US, HOT_METRICS };
+
+typedef struct hot_entry {
+    uint64_t                        key;
+    uint64_t                        est;                        // 该项指标的 sketch 估计值
+    char                            label[P2P_PEER_ID_MAX];     // peer_id 或点分 IP
+} hot_entry_t;
+
+typedef struct hot_tracker {
+    uint64_t                        cm[HOT_METRICS][HOT_DEPTH][HOT_WIDTH];
+    hot_entry_t                     top[HOT_METRICS][HOT_TOP_MAX];
+    int                             top_n[HOT_METRICS];
+} hot_tracker_t;
+
+static hot_tracker_t                g_hot_peer, g_hot_ip;
+static int                          g_hot_k = 0;                // 每项指标保留的候选数（0 = 关闭）
+static uint64_t                     g_hot_decay_ts = 0;
+static const client_t*              g_hot_client = NULL;        // 正在处理的 COMPACT 数据报所属客户端（处理中识别）
+static volatile sig_atomic_t        g_hot_dump = 0;             // SIGUSR1：主循环输出热点表
+
+static uint64_t hot_peer_key(const char *peer_id) {
+    uint64_t h = 14695981039346656037ull;                       // FNV-1a
+    for (int i = 0; i < P2P_PEER_ID_MAX && peer_id[i]; i++) h = (h ^ (uint8_t)peer_id[i]) * 1099511628211ull;
+    return h;
+}
+
+static void hot_add(hot_tracker_t *t, uint64_t key, const char *peer_id, uint32_t ip, const uint64_t v[HOT_METRICS]) {
+
+    uint32_t idx[HOT_DEPTH];
+    for (int d = 0; d < HOT_DEPTH; d++)
+        idx[d] = (uint32_t)(((key ^ (0x9E3779B97F4A7C15ull * (uint64_t)(d + 1))) * 0xBF58476D1CE4E5B9ull) >> (64 - HOT_WIDTH_BITS));
+
+    for (int m = 0; m < HOT_METRICS; m++) { if (!v[m]) continue;
+        uint64_t est = UINT64_MAX;
+        for (int d = 0; d < HOT_DEPTH; d++) {
+            uint64_t *c = &t->cm[m][d][idx[d]];
+            *c += v[m];
+            if (*c < est) est = *c;
+        }
+
+        hot_entry_t *top = t->top[m], *e = NULL;
+        int n = t->top_n[m], i;
+        for (i = 0; i < n && top[i].key != key; i++) if (!e || top[i].est < e->est) e = &top[i];
+        if (i < n) { top[i].est = est; continue; }
+        if (n < g_hot_k) e = &top[t->top_n[m]++];
+        else if (est <= e->est) continue;
+
+        e->key = key; e->est = est;
+        if (peer_id) memcpy(e->label, peer_id, P2P_PEER_ID_MAX);
+        else { struct in_addr a; a.s_addr = ip; snprintf(e->label, sizeof(e->label), "%s", inet_ntoa(a)); }
+    }
+}
+
+// 计入一次处理：源 IP（网络字节序）与已识别的客户端
+static void hot_observe(uint32_t ip, const client_t *c, uint64_t pkts, uint64_t bytes, uint64_t us) {
+    if (!g_hot_k) return;
+    const uint64_t v[HOT_METRICS] = { pkts, bytes, us };
+    hot_add(&g_hot_ip, (uint64_t)ip + 1, NULL, ip, v);
+    if (c && c->valid && c->local_peer_id[0]) hot_add(&g_hot_peer, hot_peer_key(c->local_peer_id), c->local_peer_id, 0, v);
+}
+
+static void hot_decay(hot_tracker_t *t) {
+    for (int m = 0; m < HOT_METRICS; m++) {
+        for (int d = 0; d < HOT_DEPTH; d++)
+            for (int w = 0; w < HOT_WIDTH; w++) t->cm[m][d][w] >>= 1;
+        for (int i = 0; i < t->top_n[m]; i++) t->top[m][i].est >>= 1;
+    }
+}
+
+static void hot_tick(uint64_t now) {
+    if (!g_hot_k || now - g_hot_decay_ts < HOT_DECAY_MS) return;
+    g_hot_decay_ts = now;
+    hot_decay(&g_hot_peer);
+    hot_decay(&g_hot_ip);
+}
+
+static const char*                  g_hot_metric_names[HOT_METRICS] = { "packets", "bytes", "cpu_us" };
+
+static void hot_dump(void) {
+    const hot_tracker_t *ts[2] = { &g_hot_peer, &g_hot_ip };
+    const char *by[2] = { "peer", "ip" };
+    for (int k = 0; k < 2; k++)
+        for (int m = 0; m < HOT_METRICS; m++)
+            for (int i = 0; i < ts[k]->top_n[m]; i++)
+                print("I:", "hot %s by %s: %.*s %" PRIu64 "\n", g_hot_metric_names[m], by[k],
+                      P2P_PEER_ID_MAX, ts[k]->top[m][i].label, ts[k]->top[m][i].est);
+}
+
+/* 集群（--cluster）：各节点按 rendezvous hashing（p2p_cluster_pick）分担配对
+ * + 配对 (A,B) 属于较小 peer_id 的所属节点（owner）；客户端按 local_peer_id 选择上线节点，因此该端总是 owner 的本地客户端
+ * + 入口节点（客户端实际发包的节点）将 owner 不是自己的 SYNC0 及其后续会话包经节点间链路交给 owner（UP），
+ *   owner 发往该客户端的包经链路交回入口节点，由入口节点的 UDP 套接字发出（DOWN）：客户端始终只与入口节点通信
+ * + owner 把代理客户端当作以其真实地址登录的普通客户端：入口节点首次转发前代为发送 ONLINE，
+ *   之后把上行 SYNC0 / ALIVE / OFFLINE 中本节点的 auth_key 换成 owner 分配的 auth_key
+ * + 集群内 session_id 高位为分配节点序号（CLUSTER_SESS_SHIFT），入口节点据此直接路由会话包，无需查表
+ * + 节点间链路为单向 TCP：主动连接各节点用于发送，接受各节点的连接用于接收；链路无鉴权，只应暴露在可信内网
+ */
+#define CLUSTER_HDR_SIZE            17                          // [len(2)][type(1)][tag(8)][ip(4)][port(2)]
+#define CLUSTER_FRAME_MAX           (CLUSTER_HDR_SIZE + P2P_MTU)
+
+#define CLUSTER_MSG_HELLO           0                           // 建链首帧：tag = 发送方节点序号
+#define CLUSTER_MSG_UP              1                           // 入口节点 → owner：客户端发来的数据报（tag = 入口节点 auth_key，未知为 0）
+#define CLUSTER_MSG_DOWN            2                           // owner → 入口节点：发往客户端的数据报（tag 回显）
+
+typedef struct cluster_node {
+    char                            name[64];                   // --cluster 中的节点名（host:port，参与 owner 计算）
+    struct sockaddr_in              link_addr;                  // 节点间链路地址（host:--cluster-port）
+    sock_t                          fd;                         // 发送链路（本节点主动连接）
+    bool                            connected;
+    uint64_t                        retry_at;                   // 断开后的重连时间
+    uint8_t*                        out_buf;                    // 待发送帧（HELLO 总在最前）
+    size_t                          out_len;
+    uint64_t                        tx_frames;
+    uint64_t                        rx_frames;
+    uint64_t                        tx_drops;                   // 链路未建立 / 缓冲满丢弃的帧数
+} cluster_node_t;
+
+// 接收链路（其他节点连入）
+typedef struct cluster_conn {
+    sock_t                          fd;
+    int                             node;                       // 收到 HELLO 前为 -1
+    uint16_t                        len;
+    uint8_t                         buf[CLUSTER_FRAME_MAX];
+} cluster_conn_t;
+
+// owner 侧：代理客户端真实地址 → 入口节点
+typedef struct cluster_addr {
+    uint8_t                         key[6];                     // ip(4) + port(2)，网络字节序
+    int                             node;
+    uint64_t                        tag;                        // 入口节点上该客户端的 auth_key（DOWN 帧回显）
+    uint64_t                        last_seen;
+    srv_timer_t                     timer;
+    UT_hash_handle                  hh;
+} cluster_addr_t;
+
+// 入口侧：本地客户端在各 owner 节点上的 auth_key（0 = 尚未代为登录）
+typedef struct cluster_proxy {
+    uint64_t                        auth_key[CLUSTER_MAX_NODES];
+} cluster_proxy_t;
+
+static cluster_node_t               g_cluster[CLUSTER_MAX_NODES];
+static int                          g_cluster_n = 0;            // 节点数（0 = 未启用集群）
+static int                          g_cluster_self = -1;
+static sock_t                       g_cluster_listen = P_INVALID_SOCKET;
+static cluster_conn_t               g_cluster_in[CLUSTER_MAX_NODES * 2];
+static cluster_addr_t*              g_cluster_addrs = NULL;
+static srv_timer_t                  g_cluster_timer;
+
+static bool cluster_route(uint8_t *buf, size_t len, const struct sockaddr_in *from);
+static bool cluster_deliver(const void *buf, int len, const struct sockaddr_in *to);
+static void cluster_proxy_drop(compact_client_t *c);
+
 //-----------------------------------------------------------------------------
 
 // 全局运行状态标志（用于信号处理）
@@ -291,14 +934,15 @@ static uint32_t generate_session_id(void) {
     // 使用循环代替递归，避免极端情况下的栈溢出
     do {
         id = P_rand32();  // 使用 stdc.h 统一封装的加密安全随机数
-        HASH_FIND(hh_session, g_sessions, &id, sizeof(uint32_t), existing);
+        if (g_cluster_n) id = (id >> (32 - CLUSTER_SESS_SHIFT)) | ((uint32_t)g_cluster_self << CLUSTER_SESS_SHIFT);
+        existing = id ? SESSION_FIND(id) : NULL;
         
         // 安全限制：虽然冲突概率极低（1/2^32），但在极端情况下提供保护
         if (++attempts > 1000) {
             print("F:", "Cannot generate unique session_id after 1000 attempts\n");
             exit(1);
         }
-    } while (existing);
+    } while (!id || existing);                                 // 0 是索引空槽，不可作为 session_id
     
     return id;
 }
@@ -311,7 +955,8 @@ static int build_session(client_t *client, const char *remote_peer_id,
     *remote_s = NULL;
 
     session_t *s = (session_t*)calloc(1, session_type_size);
-    if (!s) {
+    if (!s || flat_index_reserve(&g_session_index, 1) < 0) {
+        free(s);
         return -1;
     }
 
@@ -337,6 +982,7 @@ static int build_session(client_t *client, const char *remote_peer_id,
             return -1;
         }
 
+        g_mem.session += sizeof(session_pair_t);
         pair->valid = true;
         memcpy(pair->peer_id[0], client->local_peer_id, P2P_PEER_ID_MAX);
         memcpy(pair->peer_id[1], remote_peer_id, P2P_PEER_ID_MAX);
@@ -370,6 +1016,8 @@ static int build_session(client_t *client, const char *remote_peer_id,
 
     pair->sessions[side] = s;
     s->pair = pair;
+    s->mem_size = (uint32_t)session_type_size;
+    g_mem.session += session_type_size;
 
     s->client = client;
     s->prev = NULL;
@@ -378,7 +1026,7 @@ static int build_session(client_t *client, const char *remote_peer_id,
     client->sessions = s;
 
     s->session_id = generate_session_id();
-    HASH_ADD(hh_session, g_sessions, session_id, sizeof(uint32_t), s);
+    flat_index_put(&g_session_index, s->session_id, s);       // 已预留容量，不会失败
     
     *local_s = s;
     *remote_s = opposite_s;
@@ -397,7 +1045,7 @@ static void free_session(session_t *s) {
         s->prev = s->next = NULL;
     }
 
-    HASH_DELETE(hh_session, g_sessions, s);
+    flat_index_del(&g_session_index, s->session_id);
 
     session_pair_t *pair = s->pair;
     if (pair) {
@@ -409,10 +1057,12 @@ static void free_session(session_t *s) {
         }
         if (!pair->sessions[0] && !pair->sessions[1]) {
             HASH_DELETE(hh_peer, g_session_pairs, pair);
+            g_mem.session -= sizeof(session_pair_t);
             free(pair);
         }
     }
 
+    g_mem.session -= s->mem_size;
     free(s);
 }
 
@@ -423,22 +1073,270 @@ static void free_session(session_t *s) {
 #endif
 #define MOD_TAG "RELAY"
 
+// 将客户端挂入就绪链表（主循环下一轮处理其读/写）
+static inline void relay_ready(relay_client_t *c) {
+    if (c->ev_ready) return;
+    c->ev_ready = true;
+    c->ev_ready_next = g_relay_ready;
+    g_relay_ready = c;
+}
+
+/*
+ * 事件循环后端
+ *
+ * + epoll / kqueue：RELAY 客户端以边沿触发注册读+写兴趣，事件到达时只置位 ev_readable / ev_writable
+ *   并挂入就绪链表；主循环只处理就绪链表中的客户端，开销与活跃连接数成正比
+ * + select：每轮按所有客户端重建 fd_set，结果同样写入就绪状态与就绪链表
+ * + 监听 / UDP / 探测套接字始终水平触发（每轮只 accept / recvfrom 一次）
+ * + 关闭 fd 时内核自动注销，无需显式删除
+ */
+#define EV_TAG_LISTEN   (-1)
+#define EV_TAG_UDP      (-2)
+#define EV_TAG_PROBE    (-3)
+#define EV_TAG_WAKE     (-4)
+#define EV_TAG_METRICS  (-5)
+#define EV_TAG_CLUSTER  (-6)
+#define EV_TAG_STUN     (-7)                    // 备用 IP 上的 STUN 套接字（--stun-alt-ip）
+#define EV_TAG_CLUSTER_IN(i)    (-32 - (i))     // 集群接收链路（g_cluster_in 下标）
+
+#define EV_BIT_LISTEN   0x01
+#define EV_BIT_UDP      0x02
+#define EV_BIT_PROBE    0x04
+#define EV_BIT_WAKE     0x08
+#define EV_BIT_METRICS  0x10
+#define EV_BIT_CLUSTER  0x20
+#define EV_BIT_STUN     0x40
+
+#define EV_MAX_EVENTS   256
+
+#if defined(SERVER_EPOLL)
+#define EV_BACKEND      "epoll"
+static int g_ev_fd = -1;
+
+static int ev_open(void) { return (g_ev_fd = epoll_create1(0)) < 0 ? -1 : 0; }
+static void ev_close(void) { if (g_ev_fd >= 0) close(g_ev_fd); g_ev_fd = -1; }
+
+static int ev_ctl(int op, sock_t fd, int tag, bool edge) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = edge ? (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET) : EPOLLIN;
+    ev.data.u32 = (uint32_t)tag;
+    return epoll_ctl(g_ev_fd, op, fd, &ev);
+}
+static int ev_watch(sock_t fd, int tag) { return ev_ctl(EPOLL_CTL_ADD, fd, tag, false); }
+static int ev_watch_client(relay_client_t *c) {
+    return ev_ctl(EPOLL_CTL_ADD, c->fd, c->base.slot, true);
+}
+static void ev_rebind(relay_client_t *c) {
+    ev_ctl(EPOLL_CTL_MOD, c->fd, c->base.slot, true);
+}
+
+#elif defined(SERVER_KQUEUE)
+#define EV_BACKEND      "kqueue"
+static int g_ev_fd = -1;
+
+static int ev_open(void) { return (g_ev_fd = kqueue()) < 0 ? -1 : 0; }
+static void ev_close(void) { if (g_ev_fd >= 0) close(g_ev_fd); g_ev_fd = -1; }
+
+static int ev_ctl(sock_t fd, int tag, bool edge) {
+    struct kevent kev[2]; int n = 0;
+    EV_SET(&kev[n++], fd, EVFILT_READ, EV_ADD | (edge ? EV_CLEAR : 0), 0, 0, (void *)(intptr_t)tag);
+    if (edge) EV_SET(&kev[n++], fd, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0, (void *)(intptr_t)tag);
+    return kevent(g_ev_fd, kev, n, NULL, 0, NULL);
+}
+static int ev_watch(sock_t fd, int tag) { return ev_ctl(fd, tag, false); }
+static int ev_watch_client(relay_client_t *c) { return ev_ctl(c->fd, c->base.slot, true); }
+static void ev_rebind(relay_client_t *c) { ev_ctl(c->fd, c->base.slot, true); }  // EV_ADD 覆盖 udata
+
+#else
+#define EV_BACKEND      "select"
+static int  ev_open(void) { return 0; }
+static void ev_close(void) {}
+static int  ev_watch(sock_t fd, int tag) { (void)fd; (void)tag; return 0; }
+static int  ev_watch_client(relay_client_t *c) {
+#if !P_WIN
+    if ((int)c->fd >= FD_SETSIZE) return -1;
+#endif
+    (void)c; return 0;
+}
+static void ev_rebind(relay_client_t *c) { (void)c; }
+#endif
+
+/*
+ * 等待事件（就绪链表非空时不等待）
+ *
+ * @return 监听 / UDP / 探测 / 指标套接字的可读位（EV_BIT_*）；< 0 表示出错（errno 语义同 select）
+ */
+static int ev_wait(int timeout_ms, sock_t listen_fd, sock_t udp_fd, sock_t probe_fd, sock_t metrics_fd) {
+
+    int bits = 0;
+    if (g_relay_ready) timeout_ms = 0;
+
+#if defined(SERVER_EPOLL) || defined(SERVER_KQUEUE)
+    (void)listen_fd; (void)udp_fd; (void)probe_fd; (void)metrics_fd;
+#  if defined(SERVER_EPOLL)
+    struct epoll_event evs[EV_MAX_EVENTS];
+    int n = epoll_wait(g_ev_fd, evs, EV_MAX_EVENTS, timeout_ms);
+#  else
+    struct kevent evs[EV_MAX_EVENTS];
+    struct timespec ts = { timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000L };
+    int n = kevent(g_ev_fd, NULL, 0, evs, EV_MAX_EVENTS, &ts);
+#  endif
+    if (n < 0) return -1;
+
+    for (int k = 0; k < n; k++) {
+#  if defined(SERVER_EPOLL)
+        int tag = (int)evs[k].data.u32;
+        uint32_t e = evs[k].events;
+        bool rd = (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0;   // 挂断/错误交给 recv 报告
+        bool wr = (e & EPOLLOUT) != 0;
+#  else
+        int tag = (int)(intptr_t)evs[k].udata;
+        bool rd = evs[k].filter == EVFILT_READ || (evs[k].flags & (EV_EOF | EV_ERROR));
+        bool wr = evs[k].filter == EVFILT_WRITE;
+#  endif
+        if (tag == EV_TAG_LISTEN)     bits |= EV_BIT_LISTEN;
+        else if (tag == EV_TAG_UDP)   bits |= EV_BIT_UDP;
+        else if (tag == EV_TAG_PROBE) bits |= EV_BIT_PROBE;
+        else if (tag == EV_TAG_WAKE)  bits |= EV_BIT_WAKE;
+        else if (tag == EV_TAG_METRICS) bits |= EV_BIT_METRICS;
+        else if (tag == EV_TAG_CLUSTER || tag <= EV_TAG_CLUSTER_IN(0)) bits |= EV_BIT_CLUSTER;
+        else if (tag == EV_TAG_STUN)  bits |= EV_BIT_STUN;
+        else if (tag >= 0 && tag < g_relay_pool.cap) {
+            relay_client_t *c = RELAY_CLIENT_AT(tag);
+            if (!c->base.valid || c->fd == P_INVALID_SOCKET || c->mux) continue;
+            if (rd) c->ev_readable = true;
+            if (wr) c->ev_writable = true;
+            relay_ready(c);
+        }
+    }
+#else
+    // + max_fd 必须是所有监听套接字中数值最大的那个（Windows 不使用此值，但 POSIX 需要正确设置）
+    fd_set read_fds, write_fds;
+    int max_fd = 0;
+    FD_ZERO(&read_fds);
+    FD_ZERO(&write_fds);
+    FD_SET(listen_fd, &read_fds);
+    FD_SET(udp_fd, &read_fds);
+    if (probe_fd != P_INVALID_SOCKET) FD_SET(probe_fd, &read_fds);
+    if (metrics_fd != P_INVALID_SOCKET) FD_SET(metrics_fd, &read_fds);
+#if !P_WIN
+    max_fd = (int)((listen_fd > udp_fd) ? listen_fd : udp_fd);
+    if (probe_fd != P_INVALID_SOCKET && (int)probe_fd > max_fd) max_fd = (int)probe_fd;
+    if (metrics_fd != P_INVALID_SOCKET && (int)metrics_fd > max_fd) max_fd = (int)metrics_fd;
+#endif
+    for (int i = -1; i < (int)(sizeof(g_cluster_in) / sizeof(g_cluster_in[0])); i++) {
+        sock_t fd = i < 0 ? g_cluster_listen : g_cluster_in[i].fd;
+        if (fd == P_INVALID_SOCKET) continue;
+        FD_SET(fd, &read_fds);
+#if !P_WIN
+        if ((int)fd > max_fd) max_fd = (int)fd;
+#endif
+    }
+    for (int i = 0; i < 2; i++) { sock_t fd = g_stun_socks[1][i];
+        if (fd == P_INVALID_SOCKET) continue;
+        FD_SET(fd, &read_fds);
+#if !P_WIN
+        if ((int)fd > max_fd) max_fd = (int)fd;
+#endif
+    }
+    for (int i = 0; i < g_relay_pool.cap; i++) { relay_client_t *c = RELAY_CLIENT_AT(i);
+        if (!c->base.valid || c->fd == P_INVALID_SOCKET || c->mux) continue;
+        FD_SET(c->fd, &read_fds);
+        // 如果有待发送的 ONLINE_ACK 或 session 数据，监听可写事件
+        if (c->online_ack_pending || c->sending_head || c->mux_ctl_len) FD_SET(c->fd, &write_fds);
+#if !P_WIN
+        if ((int)c->fd > max_fd) max_fd = (int)c->fd;
+#endif
+    }
+
+    struct timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+    if (select(max_fd + 1, &read_fds, &write_fds, NULL, &tv) < 0) return -1;
+
+    if (FD_ISSET(listen_fd, &read_fds)) bits |= EV_BIT_LISTEN;
+    if (FD_ISSET(udp_fd, &read_fds)) bits |= EV_BIT_UDP;
+    if (probe_fd != P_INVALID_SOCKET && FD_ISSET(probe_fd, &read_fds)) bits |= EV_BIT_PROBE;
+    if (metrics_fd != P_INVALID_SOCKET && FD_ISSET(metrics_fd, &read_fds)) bits |= EV_BIT_METRICS;
+    for (int i = -1; i < (int)(sizeof(g_cluster_in) / sizeof(g_cluster_in[0])); i++) {
+        sock_t fd = i < 0 ? g_cluster_listen : g_cluster_in[i].fd;
+        if (fd != P_INVALID_SOCKET && FD_ISSET(fd, &read_fds)) bits |= EV_BIT_CLUSTER;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (g_stun_socks[1][i] != P_INVALID_SOCKET && FD_ISSET(g_stun_socks[1][i], &read_fds)) bits |= EV_BIT_STUN;
+    }
+    for (int i = 0; i < g_relay_pool.cap; i++) { relay_client_t *c = RELAY_CLIENT_AT(i);
+        if (!c->base.valid || c->fd == P_INVALID_SOCKET || c->mux) continue;
+        c->ev_readable = FD_ISSET(c->fd, &read_fds) != 0;
+        c->ev_writable = FD_ISSET(c->fd, &write_fds) != 0;
+        if (c->ev_readable || c->ev_writable) relay_ready(c);
+    }
+#endif
+    return bits;
+}
+
+/* RELAY 连接的 TCP 发送策略（--nagle 关闭）
+ * + TCP_NODELAY：控制 / 状态小帧（ONLINE_ACK、SYNC0_ACK、MSG_REQ 等）立即发出，不与对端的延迟 ACK 相互等待
+ * + 一轮内连续发送多帧时先 cork（Linux TCP_CORK / BSD TCP_NOPUSH），发完 uncork：
+ *   批量帧合并成满段，尾部不足一段的数据在 uncork 时立即推出
+ */
+static void tcp_nodelay(sock_t fd) {
+#ifdef TCP_NODELAY
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on));
+#else
+    (void)fd;
+#endif
+}
+
+static bool tcp_cork(sock_t fd, bool on) {
+    int v = on ? 1 : 0;
+#if defined(TCP_CORK)
+    return setsockopt(fd, IPPROTO_TCP, TCP_CORK, (const char *)&v, sizeof(v)) == 0;
+#elif defined(TCP_NOPUSH)
+    return setsockopt(fd, IPPROTO_TCP, TCP_NOPUSH, (const char *)&v, sizeof(v)) == 0;
+#else
+    (void)fd; (void)v;
+    return false;
+#endif
+}
+
+// 开启 SO_ZEROCOPY（--relay-zerocopy）：之后带 MSG_ZEROCOPY 的 send 不拷贝用户缓冲，完成后经错误队列通知
+static bool tcp_zerocopy(sock_t fd) {
+#ifdef SERVER_ZEROCOPY
+    int on = 1;
+    return setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0;
+#else
+    (void)fd;
+    return false;
+#endif
+}
+
 // TCP 发送辅助函数：异步发送，遇到 WOULDBLOCK 则加入发送队列
 // 说明：用于发送小消息（ACK、header 等）
 //      先尝试立即发送，若发送缓冲区满则依赖主循环的异步发送机制
 // 返回: 0=全部发送完成, +1=WOULDBLOCK, -1=连接关闭(EOF), -2=真错误
 // len_io: 输入=希望发送字节数，输出=实际发送字节数
-static int tcp_send(relay_client_t *client, const void *buf, size_t *len_io, const char *reason) {
+// zc: 以 MSG_ZEROCOPY 发送（调用方须保留缓冲直到完成通知，见 relay_zc_hold），每次成功的 send 递增 zc_seq
+static int tcp_send_ex(relay_client_t *client, const void *buf, size_t *len_io, const char *reason, bool zc) {
     if (!len_io) return -2;
     size_t len = *len_io; *len_io = 0;
     if (!client || client->fd == P_INVALID_SOCKET) return -2;
     if (!reason) reason = "unknown";
 
+    int flags = 0;
+#ifdef SERVER_ZEROCOPY
+    if (zc) flags = MSG_ZEROCOPY;
+#else
+    (void)zc;
+#endif
     while (*len_io < len) {
-        ssize_t n = send(client->fd, (const char *)buf + *len_io, len - *len_io, 0);
+        ssize_t n = send(client->fd, (const char *)buf + *len_io, len - *len_io, flags);
         if (n < 0) {
             if (P_sock_is_interrupted()) continue;
-            if (P_sock_is_wouldblock()) return 1;
+            if (P_sock_is_wouldblock()) { client->ev_writable = false; return 1; }
+#ifdef SERVER_ZEROCOPY
+            if (flags && errno == ENOBUFS) { flags = 0; continue; }    // 超出 optmem 限额：本帧剩余部分改为拷贝发送
+#endif
             print("E:", LA_F("send(%s) failed: errno=%d\n", LA_F144, 144), reason, P_sock_errno());
             return -2;
         }
@@ -446,11 +1344,16 @@ static int tcp_send(relay_client_t *client, const void *buf, size_t *len_io, con
             print("I:", LA_F("Client closed connection (EOF on send, reason=%s)\n", LA_F79, 79), reason);
             return -1;
         }
+        if (flags) client->zc_seq++;
         *len_io += (size_t)n;
     }
     return 0;
 }
 
+static int tcp_send(relay_client_t *client, const void *buf, size_t *len_io, const char *reason) {
+    return tcp_send_ex(client, buf, len_io, reason, false);
+}
+
 // TCP 接收辅助函数：异步接收，遇到 WOULDBLOCK 立即返回
 // 返回: 0=全部接收完成, +1=WOULDBLOCK, -1=连接关闭(EOF), -2=真错误
 // len_io: 输入=希望接收字节数，输出=实际接收字节数
@@ -463,7 +1366,7 @@ static int tcp_recv(relay_client_t *client, void *buf, size_t *len_io) {
         ssize_t n = recv(client->fd, (char *)buf + *len_io, len - *len_io, 0);
         if (n < 0) {
             if (P_sock_is_interrupted()) continue;
-            if (P_sock_is_wouldblock()) return 1;
+            if (P_sock_is_wouldblock()) { client->ev_readable = false; return 1; }
             print("E:", LA_F("recv() failed: errno=%d\n", LA_F142, 142), P_sock_errno());
             return -2;
         }
@@ -476,107 +1379,282 @@ static int tcp_recv(relay_client_t *client, void *buf, size_t *len_io) {
     return 0;
 }
 
-static buffer_item_t* relay_buf_alloc(uint16_t len) {
+//-----------------------------------------------------------------------------
+// 连接复用（P2P_RLY_MUX）
+
+#define RELAY_MUX_ID(c)             ((c)->mux ? (c)->mux_id : (uint16_t)0)
+#define RELAY_MUX_FRAME             (sizeof(p2p_relay_hdr_t) + P2P_RLY_MUX_PSZ)
 
-    buffer_item_t **recycle_head; size_t capacity; uint8_t flags;
-    if (len <= RELAY_SMALL_FRAME_SIZE) {
-        recycle_head = &g_relay_recycleS;
-        capacity = RELAY_SMALL_FRAME_SIZE;
-        flags = RELAY_BUF_FLAGS_SMALL;
-    } else {
-        recycle_head = &g_relay_recycle;
-        capacity = RELAY_FRAME_SIZE;
-        flags = 0;
+// 写入 SELECT / CLOSE 帧（调用方保证 mux_ctl 有空间）
+static void relay_mux_op(relay_client_t *conn, uint16_t id, uint8_t op) {
+    p2p_relay_hdr_t *hdr = (p2p_relay_hdr_t *)(conn->mux_ctl + conn->mux_ctl_len);
+    hdr->type = P2P_RLY_MUX;
+    hdr->size = htons(P2P_RLY_MUX_PSZ);
+    uint8_t *p = (uint8_t *)(hdr + 1);
+    nwrite_s(p, id);
+    p[2] = op;
+    conn->mux_ctl_len += RELAY_MUX_FRAME;
+    if (op == P2P_RLY_MUX_SELECT) conn->mux_tx = id;
+    if (conn->ev_writable) relay_ready(conn);
+}
+
+// 复用连接上的直接回复：必要时先选择登录，整帧写入 mux_ctl；缓冲已满时丢弃（同 WOULDBLOCK 下的直接发送）
+static bool relay_mux_frame(relay_client_t *conn, uint16_t id, const void *frame, size_t len) {
+    size_t need = len + (id != conn->mux_tx ? RELAY_MUX_FRAME : 0);
+    if (conn->mux_ctl_len + need > RELAY_MUX_CTL_MAX) {
+        print("W:", "MUX: reply buffer full, dropped %u bytes (login=%u)\n", (unsigned)len, (unsigned)id);
+        return false;
     }
+    if (id != conn->mux_tx) relay_mux_op(conn, id, P2P_RLY_MUX_SELECT);
+    memcpy(conn->mux_ctl + conn->mux_ctl_len, frame, len);
+    conn->mux_ctl_len += (uint16_t)len;
+    if (conn->ev_writable) relay_ready(conn);
+    return true;
+}
+
+// 不经会话队列的直接回复（返回值同 tcp_send）：复用连接写入 mux_ctl，否则立即发送
+static int relay_direct_send(relay_client_t *login, const void *buf, size_t *len_io, const char *reason) {
+    relay_client_t *conn = RELAY_CONN(login);
+    if (!conn->mux_ctl) return tcp_send(conn, buf, len_io, reason);
+    if (!relay_mux_frame(conn, RELAY_MUX_ID(login), buf, *len_io)) { *len_io = 0; return 1; }
+    return 0;
+}
+
+// 帧边界发出直接回复缓冲（返回值同 tcp_send）
+static int relay_mux_flush(relay_client_t *conn) {
+    size_t len = conn->mux_ctl_len - conn->mux_ctl_off;
+    int rc = tcp_send(conn, conn->mux_ctl + conn->mux_ctl_off, &len, "MUX");
+    conn->mux_ctl_off += (uint16_t)len;
+    if (conn->mux_ctl_off == conn->mux_ctl_len) conn->mux_ctl_off = conn->mux_ctl_len = 0;
+    return rc;
+}
+
+// 本级能否再提供一个缓冲（有缓存，或新分配不超出上限）
+static inline bool relay_buf_available(const relay_buf_class_t *bc) {
+    size_t limit = g_relay_bufs.cap + (bc == &g_relay_buf_small ? RELAY_BUF_SMALL_RESERVE : 0);
+    return bc->free_list || g_relay_bufs.held + bc->capacity <= limit;
+}
 
-    buffer_item_t *item = *recycle_head;
-    if (item) *recycle_head = item->next;
-    else if (!((item = (buffer_item_t*)malloc(sizeof(buffer_item_t) + capacity)))) return NULL;
-    else item->flags = flags;
+static inline relay_buf_class_t* relay_buf_class(size_t len) {
+    return len <= RELAY_SMALL_FRAME_SIZE ? &g_relay_buf_small : len <= RELAY_FRAME_SIZE ? &g_relay_buf_large : &g_relay_buf_bulk;
+}
+
+static buffer_item_t* relay_buf_alloc(size_t len) {
+
+    relay_buf_class_t *bc = relay_buf_class(len);
+
+    buffer_item_t *item = bc->free_list;
+    if (item) { bc->free_list = item->next; bc->cached--; }
+    else {
+        if (!relay_buf_available(bc) || !((item = (buffer_item_t*)malloc(sizeof(buffer_item_t) + bc->capacity)))) {
+            g_relay_bufs.alloc_fail++;
+            if (!g_relay_bufs.capped) { g_relay_bufs.capped = true;
+                print("W:", "Relay buffer pool exhausted (held=%zu KB, cap=%zu KB), applying backpressure\n",
+                      g_relay_bufs.held >> 10, g_relay_bufs.cap >> 10);
+            }
+            return NULL;
+        }
+        item->flags = bc->flags;
+        g_relay_bufs.held += bc->capacity;
+        if (g_relay_bufs.held > g_relay_bufs.peak) g_relay_bufs.peak = g_relay_bufs.held;
+    }
+    bc->inuse++;
     item->refer = NULL;
     return item;
 }
 
 static void relay_buf_free(buffer_item_t *buf_item) {
 
-    buf_item->flags &= RELAY_BUF_FLAGS_SMALL;  // 清除小包以外的所有其他标志
-    if (buf_item->flags & RELAY_BUF_FLAGS_SMALL) {
-        buf_item->next = g_relay_recycleS;
-        g_relay_recycleS = buf_item;
+    buf_item->flags &= RELAY_BUF_FLAGS_SMALL | RELAY_BUF_FLAGS_BULK;   // 只保留缓冲级别标志
+    relay_buf_class_t *bc = (buf_item->flags & RELAY_BUF_FLAGS_SMALL) ? &g_relay_buf_small
+                          : (buf_item->flags & RELAY_BUF_FLAGS_BULK) ? &g_relay_buf_bulk : &g_relay_buf_large;
+    bc->inuse--;
+
+    if (bc->cached < bc->cache_max) {
+        buf_item->next = bc->free_list;
+        bc->free_list = buf_item;
+        bc->cached++;
         return;
     }
-    buf_item->next = g_relay_recycle;
-    g_relay_recycle = buf_item;
+    free(buf_item);
+    g_relay_bufs.held -= bc->capacity;
+    if (g_relay_bufs.held <= g_relay_bufs.cap / 4 * 3) g_relay_bufs.capped = false;     // 回落到 3/4 以下才重新告警
 }
 
-// forward declaration（retry_relay_rpc_pending 需要调用）
-static void relay_session_send_rpc_error(relay_session_t *s, uint16_t sid, uint8_t code);
+//-----------------------------------------------------------------------------
+// 零拷贝发送完成跟踪（--relay-zerocopy）
+
+// 已发完的零拷贝帧：内核仍引用其页面，挂入等待链表（refer = 需等到的完成编号）
+static void relay_zc_hold(relay_client_t *c, buffer_item_t *item) {
+    item->refer = (void*)(uintptr_t)c->zc_seq;
+    item->next = NULL;
+    if (c->zc_rear) c->zc_rear->next = item; else c->zc_head = item;
+    c->zc_rear = item;
+}
 
-// 将 session 加入 RELAY RPC 待确认链表尾部
-static inline void enqueue_relay_rpc_pending(relay_session_t *s) {
-    s->rpc_pending_next = (relay_session_t*)(void*)-1;
-    if (g_relay_rpc_pending_rear) {
-        g_relay_rpc_pending_rear->rpc_pending_next = s;
-        g_relay_rpc_pending_rear = s;
-    } else {
-        g_relay_rpc_pending_head = s;
-        g_relay_rpc_pending_rear = s;
+// 归还完成编号已越过的缓冲
+static void relay_zc_release(relay_client_t *c, bool all) {
+    while (c->zc_head && (all || (int32_t)(c->zc_done - (uint32_t)(uintptr_t)c->zc_head->refer) >= 0)) {
+        buffer_item_t *item = c->zc_head;
+        if (!(c->zc_head = item->next)) c->zc_rear = NULL;
+        item->refer = NULL;
+        relay_buf_free(item);
     }
 }
 
-// 从 RELAY RPC 待确认链表移除
-static void remove_relay_rpc_pending(relay_session_t *s) {
-    if (!g_relay_rpc_pending_head || !s->rpc_pending_next) return;
-
-    if (g_relay_rpc_pending_head == s) {
-        g_relay_rpc_pending_head = s->rpc_pending_next;
-        s->rpc_pending_next = NULL;
-        if (g_relay_rpc_pending_head == (void*)-1) {
-            g_relay_rpc_pending_head = NULL;
-            g_relay_rpc_pending_rear = NULL;
+// 读取错误队列中的完成通知；内核持续回退为拷贝（如回环、不支持 SG 的网卡）时停用本连接的零拷贝
+static void relay_zc_reap(relay_client_t *c) {
+#ifdef SERVER_ZEROCOPY
+    while (c->zc_head) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(c->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            const struct sock_extended_err *ee = (const struct sock_extended_err *)CMSG_DATA(cm);
+            if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+            c->zc_done = ee->ee_data + 1;               // [ee_info, ee_data] 已完成（按序）
+            if (!(ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)) c->zc_copied = 0;
+            else if (++c->zc_copied >= RELAY_ZC_COPIED_MAX && c->zc) {
+                c->zc = false;
+                print("V:", "RELAY: zerocopy disabled for '%s' (kernel copied)\n", c->base.local_peer_id);
+            }
         }
-        return;
     }
+#endif
+    relay_zc_release(c, false);
+}
 
-    relay_session_t *prev = g_relay_rpc_pending_head;
-    while (prev->rpc_pending_next != s) {
-        if (prev->rpc_pending_next == (void*)-1) return;
-        prev = prev->rpc_pending_next;
+// 释放全部空闲缓存（退出时）
+static void relay_buf_drain(relay_buf_class_t *bc) {
+    while (bc->free_list) {
+        buffer_item_t *next = bc->free_list->next;
+        free(bc->free_list);
+        bc->free_list = next;
+        g_relay_bufs.held -= bc->capacity;
     }
-    prev->rpc_pending_next = s->rpc_pending_next;
-    if (s->rpc_pending_next == (void*)-1) {
-        g_relay_rpc_pending_rear = prev;
-    }
-    s->rpc_pending_next = NULL;
+    bc->cached = 0;
 }
 
-// 检查 RELAY RPC 超时（队列按时间排序，未超时即短路返回）
-static void retry_relay_rpc_pending(uint64_t now) {
-    if (!g_relay_rpc_pending_head) return;
+static void relay_buf_log_stats(void) {
+    print("I:", "Relay buffers: bulk %d in use / %d cached, large %d in use / %d cached, small %d in use / %d cached, "
+                "held=%zu KB (peak %zu KB, cap %zu KB), alloc_fail=%" PRIu64 ", busy=%" PRIu64 "\n",
+          g_relay_buf_bulk.inuse, g_relay_buf_bulk.cached,
+          g_relay_buf_large.inuse, g_relay_buf_large.cached, g_relay_buf_small.inuse, g_relay_buf_small.cached,
+          g_relay_bufs.held >> 10, g_relay_bufs.peak >> 10, g_relay_bufs.cap >> 10,
+          g_relay_bufs.alloc_fail, g_relay_bufs.busy);
+}
 
-    for (;;) {
-        relay_session_t *s = g_relay_rpc_pending_head;
+// forward declaration（relay_rpc_expire 需要调用）
+static void relay_session_send_rpc_error(relay_session_t *s, uint16_t sid, uint8_t code);
 
-        // 队列按时间排序，未超时即全部未超时
-        if (tick_diff(now, s->rpc_sent_time) < MSG_REQ_MAX_RETRY * MSG_RPC_RETRY_INTERVAL_MS) return;
+static void relay_rpc_expire(srv_timer_t *t, uint64_t now);
 
-        // 移除队头
-        g_relay_rpc_pending_head = s->rpc_pending_next;
-        if (g_relay_rpc_pending_head == (void*)-1) {
-            g_relay_rpc_pending_head = NULL;
-            g_relay_rpc_pending_rear = NULL;
-        }
-        s->rpc_pending_next = NULL;
+// 按最早到期的 sid 重新挂载超时定时器（无进行中的 RPC 时摘除）
+static void relay_rpc_arm(relay_session_t *s) {
+    uint64_t next = 0;
+    for (int i = 0; i < g_rpc_window; i++)
+        if (s->rpc_sid[i] && (!next || s->rpc_deadline[i] < next)) next = s->rpc_deadline[i];
+    if (next) timer_add(&s->rpc_timer, next, relay_rpc_expire);
+    else timer_del(&s->rpc_timer);
+}
 
-        // 向请求方发送超时错误 RESP
-        uint16_t sid = s->rpc_pending_sid;
-        s->rpc_pending_sid = 0;
+// 进行中的 sid 槽位（sid=0 查找空闲槽位），未找到返回 -1
+static int relay_rpc_slot(const relay_session_t *s, uint16_t sid) {
+    for (int i = 0; i < g_rpc_window; i++)
+        if (s->rpc_sid[i] == sid) return i;
+    return -1;
+}
+
+// RPC 超时：向请求方发送超时错误 RESP 并释放到期的 sid
+static void relay_rpc_expire(srv_timer_t *t, uint64_t now) {
+    relay_session_t *s = TIMER_OWNER(t, relay_session_t, rpc_timer);
+
+    for (int i = 0; i < g_rpc_window; i++) {
+        if (!s->rpc_sid[i] || s->rpc_deadline[i] > now) continue;
+        uint16_t sid = s->rpc_sid[i];
+        s->rpc_sid[i] = 0;
 
         print("W:", "RELAY RPC timeout: sid=%u (ses_id=%u)\n", sid, s->base.session_id);
         relay_session_send_rpc_error(s, sid, P2P_MSG_ERR_TIMEOUT);
+    }
+    relay_rpc_arm(s);
+}
+
+//-----------------------------------------------------------------------------
+// 客户端连接上的 session 发送调度（优先级小帧 + DRR）
+
+#define RELAY_ITEM_SMALL(item)      (((item)->flags & RELAY_BUF_FLAGS_SMALL) != 0)
+
+// session 发送队列由空变为非空：挂入 sending 链表尾部，领取首轮额度
+static void relay_sending_link(relay_client_t *client, relay_session_t *s) {
+    s->send_prev = client->sending_rear;
+    s->send_next = NULL;
+    if (client->sending_rear) client->sending_rear->send_next = s;
+    else                      client->sending_head = s;
+    client->sending_rear = s;
+    s->send_deficit = RELAY_DRR_QUANTUM;
+    if (RELAY_ITEM_SMALL(s->send_head)) client->sending_small++;
+}
+
+// 从 sending 链表摘除（调用时 send_head 仍为原队头，用于维护小帧计数）
+static void relay_sending_unlink(relay_client_t *client, relay_session_t *s) {
+    if (s->send_prev) s->send_prev->send_next = s->send_next;
+    else              client->sending_head = s->send_next;
+    if (s->send_next) s->send_next->send_prev = s->send_prev;
+    else              client->sending_rear = s->send_prev;
+    s->send_prev = s->send_next = NULL;
+    s->send_deficit = 0;
+    if (s->send_head && RELAY_ITEM_SMALL(s->send_head)) client->sending_small--;
+}
+
+// 帧边界选择下一个发送的 session，并按帧长扣减其额度
+// + 优先：队头为小帧的 session（链表顺序）
+// + 否则 DRR：队头 session 额度够发队头帧则发送，不够则轮转到链表尾部并补充一轮额度
+static relay_session_t* relay_sending_pick(relay_client_t *client) {
+
+    relay_session_t *s = NULL;
+    if (client->sending_small) {
+        for (s = client->sending_head; s && !RELAY_ITEM_SMALL(s->send_head); s = s->send_next) {}
+    }
+    if (!s) for (;;) {
+        s = client->sending_head;
+        const p2p_relay_hdr_t *hdr = (const p2p_relay_hdr_t *)ITEM2BUF(s->send_head);
+        if (s->send_deficit >= (int32_t)(sizeof(p2p_relay_hdr_t) + ntohs(hdr->size)) || !s->send_next) break;
+
+        client->sending_head = s->send_next;
+        client->sending_head->send_prev = NULL;
+        s->send_prev = client->sending_rear;
+        s->send_next = NULL;
+        client->sending_rear->send_next = s;
+        client->sending_rear = s;
+        s->send_deficit += RELAY_DRR_QUANTUM;
+    }
+
+    const p2p_relay_hdr_t *hdr = (const p2p_relay_hdr_t *)ITEM2BUF(s->send_head);
+    s->send_deficit -= (int32_t)(sizeof(p2p_relay_hdr_t) + ntohs(hdr->size));
+    client->sending_cur = s;
+    return s;
+}
+
+// 队头帧发送完成：出队（由调用方释放），队列为空时摘出 sending 链表
+static buffer_item_t* relay_sending_pop(relay_client_t *client, relay_session_t *s) {
+
+    buffer_item_t *item = s->send_head;
+    client->sending_cur = NULL;
+    if (RELAY_ITEM_SMALL(item)) client->sending_small--;
 
-        if (!g_relay_rpc_pending_head) return;
+    s->send_cnt--;
+    if ((s->send_head = item->next)) {
+        if (RELAY_ITEM_SMALL(s->send_head)) client->sending_small++;
     }
+    else { s->send_rear = NULL;
+        relay_sending_unlink(client, s);
+    }
+    return item;
 }
 
 static void relay_free_session(relay_session_t *s) {
@@ -595,22 +1673,17 @@ static void relay_free_session(relay_session_t *s) {
             fhdr->size = htons(P2P_RLY_FIN_PSZ);
             nwrite_l(fin_buf + sizeof(*fhdr), peer->base.session_id);
             size_t flen = sizeof(fin_buf);
-            tcp_send(peer_client, fin_buf, &flen, "FIN");  /* best-effort，尽力发送 */
+            relay_direct_send(peer_client, fin_buf, &flen, "FIN");  /* best-effort，尽力发送 */
         }
 
         relay_free_session(peer);
     }
 
-    // 从 client->sending 链表中摘除当前 session（双向链表 O(1)）
-    if (s->base.client && (s->send_prev || s->send_next
-                          || ((relay_client_t*)s->base.client)->sending_head == s)) {
-        relay_client_t *client = (relay_client_t*)s->base.client;
-        if (s->send_prev) s->send_prev->send_next = s->send_next;
-        else              client->sending_head = s->send_next;
-        if (s->send_next) s->send_next->send_prev = s->send_prev;
-        else              client->sending_rear = s->send_prev;
-        s->send_prev = s->send_next = NULL;
-        client->send_offset = 0;
+    // 从 client->sending 链表中摘除当前 session
+    if (s->base.client && s->send_head) {
+        relay_client_t *client = RELAY_CONN((relay_client_t*)s->base.client);
+        if (client->sending_cur == s) { client->sending_cur = NULL; client->send_offset = 0; }
+        relay_sending_unlink(client, s);
     }
 
     // 释放发送队列
@@ -620,6 +1693,7 @@ static void relay_free_session(relay_session_t *s) {
         s->send_head = next;
     }
     s->send_rear = NULL;
+    s->send_cnt = 0;
 
     // 释放对端待处理项
     if (s->peer_pending) {
@@ -629,19 +1703,31 @@ static void relay_free_session(relay_session_t *s) {
         s->peer_pending = NULL;
     }
 
-    // 从 RPC 待确认链表移除并清除忙标志
-    if (s->rpc_pending_sid) {
-        remove_relay_rpc_pending(s);
-        s->rpc_pending_sid = 0;
-    }
+    // 取消 RPC 超时定时器并清除进行中的 sid
+    timer_del(&s->rpc_timer);
+    memset(s->rpc_sid, 0, sizeof(s->rpc_sid));
 
     free_session(&s->base);
 }
 
+// 注销登录：释放会话（逐个摘出所属连接的 sending 链表）并移出在线索引，连接保持
+static void relay_logout(relay_client_t *c) {
+    while (c->base.sessions) {
+        relay_free_session((relay_session_t*)c->base.sessions);
+    }
+    if (c->base.local_peer_id[0]) HASH_DELETE(hh_name, g_relay_by_name, c);
+    c->base.local_peer_id[0] = 0;
+}
+
 static void relay_clear_client(relay_client_t *c) {
 
-    P_sock_close(c->fd);
+    // 复用连接：先清理其上的虚拟登录（会话的 FIN 通知仍可经本连接发出）
+    while (!c->mux && c->mux_logins) relay_clear_client(c->mux_logins);
+
+    if (!c->mux) P_sock_close(c->fd);   // 虚拟登录的 fd 归所属连接
     c->fd = P_INVALID_SOCKET;
+    relay_zc_release(c, true);          // 关闭后内核自持页面引用，缓冲可直接归还
+    c->zc = false;
 
     c->online_ack_pending = false;
     c->recv_len = 0;
@@ -649,19 +1735,26 @@ static void relay_clear_client(relay_client_t *c) {
         relay_buf_free(BUF2ITEM(c->recv_buf));
         c->recv_buf = NULL;
     }
-    for (relay_session_t *p = c->sending_head; p; ) {
-        relay_session_t *nx = p->send_next;
-        p->send_prev = p->send_next = NULL;
-        p = nx;
-    }
-    c->sending_head = c->sending_rear = NULL;
+    relay_logout(c);
+    assert(!c->sending_head && !c->sending_small);
+    c->sending_cur = NULL;
     c->send_offset = 0;
-
-    while (c->base.sessions) {
-        relay_free_session((relay_session_t*)c->base.sessions);
+    if (c->mux) {
+        relay_client_t **pp = &c->mux->mux_logins;
+        while (*pp != c) pp = &(*pp)->mux_next;
+        *pp = c->mux_next;
+        if (c->mux->mux_rx == c) { c->mux->mux_rx = NULL; c->mux->mux_rx_drop = true; }
+        c->mux = NULL;
     }
-    c->base.local_peer_id[0] = 0;
-    c->base.valid = false;
+    free(c->mux_ctl);
+    c->mux_ctl = NULL;
+    c->mux_ctl_len = c->mux_ctl_off = 0;
+    c->mux_rx = NULL;
+    c->mux_rx_drop = false;
+    c->mux_tx = 0;
+    c->ev_readable = c->ev_writable = false;
+    timer_del(&c->base.idle_timer);
+    if (c->base.valid) { c->base.valid = false; pool_free(&g_relay_pool, &c->base); }
 }
 
 //-----------------------------------------------------------------------------
@@ -672,23 +1765,28 @@ static void relay_session_send(relay_session_t *s, buffer_item_t* buf_item) {
 
     // 添加到 session 的本地发送队列
     buf_item->next = NULL;
+    s->send_cnt++;
     if (s->send_rear) {
         s->send_rear->next = buf_item;
         s->send_rear = buf_item;
         return;
     }
 
-    // 发送队列原本为空，添加 session 到客户端的发送链表尾部（如果不在链表中）
+    // 发送队列原本为空，添加 session 到客户端的发送链表尾部
     assert(!s->send_next && !s->send_prev);
     s->send_head = s->send_rear = buf_item;
 
-    relay_client_t *client = (relay_client_t*)s->base.client;
-    s->send_prev = client->sending_rear;
-    s->send_next = NULL;
-    if (client->sending_rear) {
-        client->sending_rear->send_next = s;
-        client->sending_rear = s;
-    } else client->sending_head = client->sending_rear = s;
+    relay_client_t *client = RELAY_CONN((relay_client_t*)s->base.client);
+    relay_sending_link(client, s);
+
+    // 边沿触发下可写通知不会重复到达：已可写时直接挂入就绪链表
+    if (client->ev_writable) relay_ready(client);
+}
+
+// 为 session 排队的服务器回复分配缓冲；发送队列已达配额（客户端不读）时返回 NULL，由调用方丢弃
+static buffer_item_t* relay_session_buf_alloc(relay_session_t *s, uint16_t len) {
+    if (s->send_cnt >= RELAY_SESSION_QUEUE_MAX) return NULL;
+    return relay_buf_alloc(len);
 }
 
 static void relay_send_error(relay_client_t *client, uint8_t req_type, uint8_t status_code) {
@@ -707,7 +1805,7 @@ static void relay_send_error(relay_client_t *client, uint8_t req_type, uint8_t s
     // STATUS 包不走 session 队列，直接挂到 client 上
     // 借用一个临时空 session 结构是不合适的，这里直接用 tcp_send 尝试发送
     size_t len = sizeof(p2p_relay_hdr_t) + payload_len;
-    tcp_send(client, ITEM2BUF(buf_item), &len, "STATUS");
+    relay_direct_send(client, ITEM2BUF(buf_item), &len, "STATUS");
     relay_buf_free(buf_item);
 }
 
@@ -717,7 +1815,7 @@ static void relay_session_send_sync0_ack(relay_session_t *s, const char *target_
     relay_client_t *client = (relay_client_t*)s->base.client;
 
     uint16_t payload_len = P2P_RLY_SYNC0_ACK_PSZ;
-    buffer_item_t *buf_item = relay_buf_alloc(sizeof(p2p_relay_hdr_t) + payload_len);
+    buffer_item_t *buf_item = relay_session_buf_alloc(s, sizeof(p2p_relay_hdr_t) + payload_len);
     if (!buf_item) {
         print("W:", LA_F("SYNC0_ACK queue busy for '%s', drop\n", LA_F106, 106), client->base.local_peer_id);
         return;
@@ -742,7 +1840,7 @@ static void relay_session_send_sync_ack(relay_session_t *s, uint8_t confirmed_co
     relay_client_t *client = (relay_client_t*)s->base.client;
 
     uint16_t payload_len = P2P_RLY_SYNC_ACK_PSZ;
-    buffer_item_t *buf_item = relay_buf_alloc(sizeof(p2p_relay_hdr_t) + payload_len);
+    buffer_item_t *buf_item = relay_session_buf_alloc(s, sizeof(p2p_relay_hdr_t) + payload_len);
     if (!buf_item) {
         print("W:", LA_F("SYNC_ACK queue busy for '%s', drop\n", LA_F107, 107), client->base.local_peer_id);
         return;
@@ -764,7 +1862,7 @@ static void relay_session_send_status(relay_session_t *s, uint8_t req_type, uint
     assert(s && s->base.client);
 
     uint16_t payload_len = P2P_RLY_STATUS_PSZ(2, 0);
-    buffer_item_t *buf_item = relay_buf_alloc(sizeof(p2p_relay_hdr_t) + payload_len);
+    buffer_item_t *buf_item = relay_session_buf_alloc(s, sizeof(p2p_relay_hdr_t) + payload_len);
     if (!buf_item) return;
 
     p2p_relay_hdr_t *hdr = (p2p_relay_hdr_t *)ITEM2BUF(buf_item);
@@ -797,7 +1895,7 @@ static void relay_send_sync0_error(relay_client_t *client, const char *remote_pe
     p[1 + P2P_PEER_ID_MAX] = status_code;
 
     size_t len = sizeof(p2p_relay_hdr_t) + payload_len;
-    tcp_send(client, ITEM2BUF(buf_item), &len, "SYNC0_STATUS");
+    relay_direct_send(client, ITEM2BUF(buf_item), &len, "SYNC0_STATUS");
     relay_buf_free(buf_item);
 }
 
@@ -805,7 +1903,7 @@ static void relay_send_sync0_error(relay_client_t *client, const char *remote_pe
 // payload: [session_id(8)][sid(2)][code(1)]
 static void relay_session_send_rpc_error(relay_session_t *s, uint16_t sid, uint8_t code) {
 
-    buffer_item_t *buf_item = relay_buf_alloc(RELAY_SMALL_FRAME_SIZE);
+    buffer_item_t *buf_item = relay_session_buf_alloc(s, RELAY_SMALL_FRAME_SIZE);
     if (!buf_item) {
         print("E:", LA_F("RPC_ERR: OOM\n", LA_F100, 100));
         return;
@@ -868,6 +1966,7 @@ static void relay_session_send_complete(relay_session_t *s, buffer_item_t* buf_i
 // 注意：payload 已在接收阶段插入 session_id 间隙，布局为：
 static void handle_relay_sync0(relay_client_t *client, uint8_t *payload, uint16_t len) {
     const char *PROTO = "SYNC0";
+    relay_client_t *conn = RELAY_CONN(client);     // 接收缓冲归连接，会话归登录
 
     if (len < P2P_PEER_ID_MAX + 1) {
         print("E:", LA_F("%s: bad payload(len=%u)\n", LA_F41, 41), PROTO, len);
@@ -903,7 +2002,7 @@ static void handle_relay_sync0(relay_client_t *client, uint8_t *payload, uint16_
     // + SYNC0_ACK 告知会话建立结果：target_name + session_id + 对端在线状态
     relay_session_send_sync0_ack(local_s, (const char *)payload, remote_s && ((relay_client_t*)remote_s->base.client)->fd != P_INVALID_SOCKET);
 
-    assert(client->recv_buf && payload == client->recv_buf + sizeof(p2p_relay_hdr_t));
+    assert(conn->recv_buf && payload == conn->recv_buf + sizeof(p2p_relay_hdr_t));
 
     buffer_item_t *sync0_item; p2p_relay_hdr_t *hdr;
     if (cand_count) {
@@ -921,12 +2020,12 @@ static void handle_relay_sync0(relay_client_t *client, uint8_t *payload, uint16_
         memset(payload, 0, P2P_PEER_ID_MAX);
         strncpy((char*)payload, client->base.local_peer_id, P2P_PEER_ID_MAX - 1);
 
-        hdr = (p2p_relay_hdr_t *)client->recv_buf;
+        hdr = (p2p_relay_hdr_t *)conn->recv_buf;
         hdr->size = htons(P2P_RLY_SYNC0_S2C_PSZ(cand_count));
 
-        buffer_item_t* item = BUF2ITEM(client->recv_buf);
-        client->recv_buf = ITEM2BUF(sync0_item);
-        client->recv_len = 0;
+        buffer_item_t* item = BUF2ITEM(conn->recv_buf);
+        conn->recv_buf = ITEM2BUF(sync0_item);
+        conn->recv_len = 0;
         sync0_item = item;
     }
     else {
@@ -1187,7 +2286,7 @@ static void handle_relay_req(relay_client_t *client, relay_session_t *s, uint8_t
     int data_len = (int)len - (int)P2P_RLY_REQ_MIN_PSZ;
 
     print("V:", LA_F("%s: '%s' sid=%u msg=%u data_len=%d\n", LA_F25, 25),
-          PROTO, client->base.local_peer_id, sid, msg, data_len);
+          PROTO, s->base.client->local_peer_id, sid, msg, data_len);
 
     // 检查对端是否在线
     if (!s->peer || !s->peer->base.client
@@ -1197,9 +2296,10 @@ static void handle_relay_req(relay_client_t *client, relay_session_t *s, uint8_t
         return;
     }
 
-    // rpc_pending_sid 忙检查
-    if (s->rpc_pending_sid) {
-        print("W:", LA_F("%s: rpc busy (pending sid=%u)\n", LA_F67, 67), PROTO, s->rpc_pending_sid);
+    // 窗口忙检查：无空闲槽位，或该 sid 已在进行中
+    int slot = relay_rpc_slot(s, sid) < 0 ? relay_rpc_slot(s, 0) : -1;
+    if (slot < 0) {
+        print("W:", LA_F("%s: rpc busy (pending sid=%u)\n", LA_F67, 67), PROTO, sid);
         relay_session_send_status(s, P2P_RLY_REQ, P2P_RLY_ERR_BUSY);
         return;
     }
@@ -1221,11 +2321,11 @@ static void handle_relay_req(relay_client_t *client, relay_session_t *s, uint8_t
     // 就地重写 session_id 为对端的 session_id
     nwrite_l(payload, s->peer->base.session_id);
 
-    // 转发 REQ 到对端，记录 pending sid（等 RESP 回来才解锁）
+    // 转发 REQ 到对端，记录进行中的 sid（等 RESP 回来才释放）
     buf_item->refer = NULL;
-    s->rpc_pending_sid = sid;
-    s->rpc_sent_time = P_tick_ms();
-    enqueue_relay_rpc_pending(s);
+    s->rpc_sid[slot] = sid;
+    s->rpc_deadline[slot] = P_tick_ms() + MSG_REQ_MAX_RETRY * MSG_RPC_RETRY_INTERVAL_MS;
+    relay_rpc_arm(s);
     relay_session_send(s->peer, buf_item);
 }
 
@@ -1244,7 +2344,7 @@ static void handle_relay_resp(relay_client_t *client, relay_session_t *s, uint8_
     int data_len  = (int)len - (int)P2P_RLY_RESP_MIN_PSZ;
 
     print("V:", LA_F("%s: '%s' sid=%u code=%u data_len=%d\n", LA_F24, 24),
-          PROTO, client->base.local_peer_id, sid, code, data_len);
+          PROTO, s->base.client->local_peer_id, sid, code, data_len);
 
     // 检查对端（请求方）是否在线
     if (!s->peer || !s->peer->base.client
@@ -1253,10 +2353,10 @@ static void handle_relay_resp(relay_client_t *client, relay_session_t *s, uint8_
         return;
     }
 
-    // 验证 sid 与请求方 pending sid 一致
-    if (s->peer->rpc_pending_sid != sid) {
-        print("W:", LA_F("%s: sid mismatch (got=%u, pending=%u), discarding\n", LA_F68, 68),
-              PROTO, sid, s->peer->rpc_pending_sid);
+    // 验证 sid 为请求方进行中的 RPC
+    int slot = sid ? relay_rpc_slot(s->peer, sid) : -1;
+    if (slot < 0) {
+        print("W:", "%s: sid=%u not pending for requester, discarding\n", PROTO, sid);
         return;
     }
 
@@ -1277,21 +2377,121 @@ static void handle_relay_resp(relay_client_t *client, relay_session_t *s, uint8_
     // 就地重写 session_id 为请求方的 session_id
     nwrite_l(payload, s->peer->base.session_id);
 
-    // 转发 RESP 到请求方，解锁 rpc_pending_sid（RPC 生命周期完成）
+    // 转发 RESP 到请求方，释放该 sid（RPC 生命周期完成）
     buf_item->refer = NULL;
-    remove_relay_rpc_pending(s->peer);
-    s->peer->rpc_pending_sid = 0;
+    s->peer->rpc_sid[slot] = 0;
+    relay_rpc_arm(s->peer);
     relay_session_send(s->peer, buf_item);
 }
 
 //-----------------------------------------------------------------------------
 
+// 初始化新分配的客户端槽位（连接或虚拟登录；ev_ready 保留：槽位可能仍在就绪链表中）
+static void relay_client_init(relay_client_t *c, sock_t fd) {
+    c->base.valid = true;
+    c->base.last_active = P_tick_ms();
+    c->base.local_peer_id[0] = '\0';
+    c->base.instance_id = 0;
+    c->base.sessions = NULL;
+    c->base.rx_pkts = c->base.rx_bytes = 0;
+
+    c->fd = fd;
+    c->online_ack_pending = false;
+    c->recv_buf = NULL;
+    c->recv_len = 0;
+    c->sending_head = NULL;
+    c->sending_rear = NULL;
+    c->sending_cur = NULL;
+    c->sending_small = 0;
+    c->send_offset = 0;
+    c->ev_readable = false;             // 注册后由首个事件置位
+    c->ev_writable = false;
+
+    c->mux = c->mux_logins = c->mux_next = c->mux_rx = NULL;
+    c->mux_rx_drop = false;
+    c->mux_id = c->mux_tx = 0;
+    c->zc = false;
+    c->zc_copied = 0;
+    c->zc_seq = c->zc_done = c->zc_mark = 0;
+    c->zc_head = c->zc_rear = NULL;
+    c->mux_ctl = NULL;
+    c->mux_ctl_len = c->mux_ctl_off = 0;
+}
+
+// 同名新实例上线：踢下旧登录（复用连接上只注销该登录并通知客户端，连接及其余登录不受影响）
+static void relay_kick(relay_client_t *c) {
+    relay_client_t *conn = RELAY_CONN(c);
+    if (!conn->mux_ctl) { relay_clear_client(c); return; }
+
+    if (conn->mux_ctl_len + RELAY_MUX_FRAME <= RELAY_MUX_CTL_MAX)
+        relay_mux_op(conn, RELAY_MUX_ID(c), P2P_RLY_MUX_CLOSE);
+    if (c->mux) relay_clear_client(c);
+    else relay_logout(c);
+}
+
+// 处理 P2P_RLY_MUX：[login(2)][op(1)]；返回 false 为协议错误（断开连接）
+static bool relay_mux_input(relay_client_t *conn, const uint8_t *payload) {
+
+    uint16_t id = nget_s(payload); uint8_t op = payload[2];
+    if (op != P2P_RLY_MUX_SELECT && op != P2P_RLY_MUX_CLOSE) return false;
+
+    // 首个 MUX 帧：连接进入复用模式，此后直接回复经 mux_ctl 发出
+    if (!conn->mux_ctl && !(conn->mux_ctl = (uint8_t *)malloc(RELAY_MUX_CTL_MAX))) return false;
+
+    relay_client_t *c = NULL;
+    if (id) for (c = conn->mux_logins; c && c->mux_id != id; c = c->mux_next) {}
+
+    if (op == P2P_RLY_MUX_CLOSE) {
+        relay_client_t *login = id ? c : conn;
+        if (login && login->base.local_peer_id[0])
+            print("I:", "MUX: '%s' logged out (login=%u)\n", login->base.local_peer_id, (unsigned)id);
+        if (c) relay_clear_client(c);
+        else if (!id) relay_logout(conn);
+        return true;
+    }
+
+    conn->mux_rx_drop = false;
+    if (!id || c) { conn->mux_rx = c; return true; }
+
+    // 新登录：分配虚拟槽位（共享连接 fd，随连接释放）
+    if (!(c = (relay_client_t*)pool_alloc(&g_relay_pool))) {
+        print("W:", "MUX: max peers reached, rejecting login %u\n", (unsigned)id);
+        conn->mux_rx = NULL;
+        conn->mux_rx_drop = true;
+        if (conn->mux_ctl_len + RELAY_MUX_FRAME <= RELAY_MUX_CTL_MAX)
+            relay_mux_op(conn, id, P2P_RLY_MUX_CLOSE);
+        return true;
+    }
+    relay_client_init(c, conn->fd);
+    c->mux = conn;
+    c->mux_id = id;
+    c->mux_next = conn->mux_logins;
+    conn->mux_logins = c;
+    conn->mux_rx = c;
+    return true;
+}
+
+// ONLINE_ACK：[features(1)][candidate_sync_max(1)][rpc_window(1)]，返回帧长
+static size_t relay_fill_online_ack(uint8_t *buf) {
+    p2p_relay_hdr_t *ack_hdr = (p2p_relay_hdr_t *)buf;
+    ack_hdr->type = P2P_RLY_ONLINE_ACK;
+    ack_hdr->size = htons(P2P_RLY_ONLINE_ACK_PSZ + 1);
+    uint8_t *ack_payload = (uint8_t*)(ack_hdr+1);
+    ack_payload[0/* features */] = P2P_RLY_FEATURE_MUX;
+    if (ARGS_relay.i64) ack_payload[0] |= P2P_RLY_FEATURE_RELAY | P2P_RLY_FEATURE_BULK | P2P_RLY_FEATURE_BULK_LARGE;
+    if (ARGS_msg.i64) ack_payload[0] |= P2P_RLY_FEATURE_MSG;
+    ack_payload[1/* candidate_sync_max */] = (uint8_t)RELAY_SYNC_CANDS_PER_PACKET;
+    ack_payload[2/* rpc_window */] = (uint8_t)g_rpc_window;
+    return sizeof(p2p_relay_hdr_t) + P2P_RLY_ONLINE_ACK_PSZ + 1;
+}
+
 // 处理 RELAY 模式信令（TCP 长连接）- 统一接收+分发架构
 // 架构：client 统一接收完整消息到 recv_buf，解析后分发给对应的处理函数
 // 流程：read header → read full payload → dispatch → reset buffer
-static void handle_relay_signaling(int idx) {
-    relay_client_t *client = &g_relay_clients[idx]; 
-    assert(client->recv_buf);
+// + client 为连接槽位（收发状态），消息按当前 MUX 选择分发给所属登录（未复用时即连接自身）
+// + 复用连接上单个登录的协议错误只回复错误，不断开连接（其余登录不受影响）
+static void handle_relay_signaling(relay_client_t *client) {
+    assert(client->recv_buf && !client->mux);
 
     client->base.last_active = P_tick_ms();
     for(;;) {
@@ -1303,6 +2503,9 @@ static void handle_relay_signaling(int idx) {
             goto disconnect;
         }
 
+        // 复用连接：直接回复缓冲将满时暂停读取，由主循环发出后继续（ev_readable 保持置位）
+        if (client->mux_ctl_len > RELAY_MUX_CTL_MAX - RELAY_MUX_CTL_ROOM) return;
+
         // 读取 header (3字节)
         while (client->recv_len < sizeof(p2p_relay_hdr_t)) {
             size_t need = sizeof(p2p_relay_hdr_t) - client->recv_len;
@@ -1315,11 +2518,22 @@ static void handle_relay_signaling(int idx) {
         // 解析 header
         uint8_t type = client->recv_buf[0]; uint8_t* ptr = client->recv_buf + 1;
         uint16_t payload_len = nget_s(ptr);
-        if (payload_len > P2P_MAX_PAYLOAD) {
+        // 仅 PACKET 可携带 BULK 大帧（P2P_RLY_FEATURE_BULK / _BULK_LARGE），其余消息仍受 P2P_MAX_PAYLOAD 限制
+        if (payload_len > (type == P2P_RLY_PACKET ? P2P_RLY_PAYLOAD_LARGE_MAX : P2P_MAX_PAYLOAD)) {
             print("E:", LA_F("bad payload len %u\n", LA_F139, 139), payload_len);
             goto disconnect;
         }
 
+        // 超出当前接收缓冲的大帧：换入 BULK 级缓冲（仅复制已读的帧头）；池超限时暂停读取，TCP 回压发送方
+        if (sizeof(p2p_relay_hdr_t) + payload_len > RELAY_FRAME_SIZE
+            && !(BUF2ITEM(client->recv_buf)->flags & RELAY_BUF_FLAGS_BULK)) {
+            buffer_item_t *bulk = relay_buf_alloc(RELAY_BULK_FRAME_SIZE);
+            if (!bulk) return;
+            memcpy(ITEM2BUF(bulk), client->recv_buf, client->recv_len);
+            relay_buf_free(BUF2ITEM(client->recv_buf));
+            client->recv_buf = ITEM2BUF(bulk);
+        }
+
         // 读取完整 payload
         uint16_t total_need = sizeof(p2p_relay_hdr_t) + payload_len;
         while (client->recv_len < total_need) {
@@ -1332,6 +2546,23 @@ static void handle_relay_signaling(int idx) {
         
         // 完整消息已接收，分发处理
         uint8_t *payload = client->recv_buf + sizeof(p2p_relay_hdr_t);
+        g_metrics.relay_frames[type]++;
+        g_metrics.relay_rx_bytes += total_need;
+        hot_observe(client->ip, &client->base, 1, total_need, 0);
+
+        // 连接复用：切换 / 关闭登录
+        if (type == P2P_RLY_MUX) {
+            if (payload_len != P2P_RLY_MUX_PSZ || !relay_mux_input(client, payload)) {
+                print("E:", "MUX: bad frame(len=%u)\n", payload_len);
+                goto disconnect;
+            }
+            client->recv_len = 0;
+            continue;
+        }
+        if (client->mux_rx_drop) { client->recv_len = 0; continue; }
+
+        relay_client_t *login = client->mux_rx ? client->mux_rx : client;
+        if (type == P2P_RLY_PACKET) { login->base.rx_pkts++; login->base.rx_bytes += total_need; }
 
         if (type == P2P_RLY_ONLINE) {
 
@@ -1339,37 +2570,45 @@ static void handle_relay_signaling(int idx) {
             if (payload_len != P2P_RLY_ONLINE_PSZ) {
                 print("E:", LA_F("ONLINE: bad payload(len=%u, expected=%u)\n", LA_F96, 96), 
                        payload_len, (uint32_t)(P2P_PEER_ID_MAX + 4));
+                if (client->mux_ctl) { relay_send_error(login, type, P2P_RLY_ERR_PROTOCOL); client->recv_len = 0; continue; }
                 goto disconnect;
             }
             // 禁止重复 ONLINE
-            if (client->base.local_peer_id[0]) {
-                print("E:", LA_F("ONLINE: duplicate from '%s'\n", LA_F97, 97), client->base.local_peer_id);
+            if (login->base.local_peer_id[0]) {
+                print("E:", LA_F("ONLINE: duplicate from '%s'\n", LA_F97, 97), login->base.local_peer_id);
+                if (client->mux_ctl) { relay_send_error(login, type, P2P_RLY_ERR_PROTOCOL); client->recv_len = 0; continue; }
                 goto disconnect;
             }
             
-            memcpy(client->base.local_peer_id, payload, P2P_PEER_ID_MAX);
-            client->base.local_peer_id[P2P_PEER_ID_MAX-1] = '\0';
-            nread_l(&client->base.instance_id, payload + P2P_PEER_ID_MAX);
+            memcpy(login->base.local_peer_id, payload, P2P_PEER_ID_MAX);
+            login->base.local_peer_id[P2P_PEER_ID_MAX-1] = '\0';
+            nread_l(&login->base.instance_id, payload + P2P_PEER_ID_MAX);
 
             // 查找是否存在同名的已登录 client（断网重连场景）
-            // MAX_PEERS=128，ONLINE 低频操作，线性扫描足够
             relay_client_t *old = NULL;
-            for (int i = 0; i < MAX_PEERS; i++) {
-                relay_client_t *c = &g_relay_clients[i];
-                if (c != client && c->base.valid && c->base.local_peer_id[0]
-                    && strcmp(c->base.local_peer_id, client->base.local_peer_id) == 0) {
-                    old = c; break;
-                }
-            }
+            HASH_FIND(hh_name, g_relay_by_name, login->base.local_peer_id,
+                      strlen(login->base.local_peer_id), old);
 
             // 如果存在同名 client，根据 instance_id 判断是否同实例重连
+            // + fd 迁移仅用于新旧均为独立连接的情形，涉及复用连接时按新实例处理
             if (old) {
-                if (old->base.instance_id == client->base.instance_id) {
+                if (old->base.instance_id == login->base.instance_id
+                    && !client->mux_ctl && !old->mux && !old->mux_ctl) {
                     // 同实例重连：迁移 fd 到旧槽位，保留会话状态
                     print("I:", LA_F("ONLINE: '%s' reconnected (inst=%u), migrating fd\n", LA_F95, 95),
                            client->base.local_peer_id, client->base.instance_id);
                     P_sock_close(old->fd);
+                    relay_zc_release(old, true);
                     old->fd = client->fd;
+                    old->zc = client->zc;
+                    old->zc_copied = client->zc_copied;
+                    old->zc_seq = old->zc_done = client->zc_seq;    // 新连接尚无在途零拷贝帧（ONLINE 之前不发会话帧）
+                    ev_rebind(old);
+                    old->ev_readable = client->ev_readable;
+                    old->ev_writable = client->ev_writable;
+                    old->sending_cur = NULL;    // 新连接从帧边界开始：未发完的帧整帧重发
+                    old->send_offset = 0;
+                    if (old->sending_head && old->ev_writable) relay_ready(old);
                     old->base.last_active = P_tick_ms();
                     old->online_ack_pending = false;
                     old->recv_len = 0;
@@ -1381,30 +2620,35 @@ static void handle_relay_signaling(int idx) {
                     client->fd = P_INVALID_SOCKET;
                     client->base.local_peer_id[0] = 0;
                     client->base.valid = false;
-                    client = old;
+                    timer_del(&client->base.idle_timer);
+                    pool_free(&g_relay_pool, &client->base);
+                    client = login = old;
                 } else {
                     // 新实例：销毁旧 client 的所有状态
                     print("I:", LA_F("ONLINE: '%s' new instance (old=%u, new=%u), destroying old\n", LA_F94, 94),
-                           client->base.local_peer_id, old->base.instance_id, client->base.instance_id);
-                    relay_clear_client(old);
+                           login->base.local_peer_id, old->base.instance_id, login->base.instance_id);
+                    relay_kick(old);
                 }
             }
+            if (login != old)
+                HASH_ADD_KEYPTR(hh_name, g_relay_by_name, login->base.local_peer_id,
+                                strlen(login->base.local_peer_id), login);
             
             print("I:", LA_F("ONLINE: '%s' came online (inst=%u)\n", LA_F93, 93),
-                     client->base.local_peer_id, client->base.instance_id);
-            
+                     login->base.local_peer_id, login->base.instance_id);
+
+            // 复用连接：ONLINE_ACK 经直接回复缓冲发出
+            if (client->mux_ctl) {
+                uint8_t ack[sizeof(p2p_relay_hdr_t) + P2P_RLY_ONLINE_ACK_PSZ + 1];
+                size_t ack_len = relay_fill_online_ack(ack);
+                relay_direct_send(login, ack, &ack_len, "ONLINE_ACK");
+                client->recv_len = 0;
+                continue;
+            }
+
             // 就地修改 recv_buf 为 ONLINE_ACK (复用缓冲区)
-            p2p_relay_hdr_t *ack_hdr = (p2p_relay_hdr_t *)client->recv_buf;
-            ack_hdr->type = P2P_RLY_ONLINE_ACK;
-            ack_hdr->size = htons(P2P_RLY_ONLINE_ACK_PSZ);
-            uint8_t *ack_payload = (uint8_t*)(ack_hdr+1);
-            ack_payload[0/* features */] = 0;
-            if (ARGS_relay.i64) ack_payload[0] |= P2P_RLY_FEATURE_RELAY;
-            if (ARGS_msg.i64) ack_payload[0] |= P2P_RLY_FEATURE_MSG;
-            ack_payload[1/* candidate_sync_max */] = (uint8_t)RELAY_SYNC_CANDS_PER_PACKET;
-            
             // 尝试立即发送（WOULDBLOCK 循环直到发送完或）
-            size_t ack_len = sizeof(p2p_relay_hdr_t) + P2P_RLY_ONLINE_ACK_PSZ;
+            size_t ack_len = relay_fill_online_ack(client->recv_buf);
             int rc = tcp_send(client, client->recv_buf, &ack_len, "ONLINE_ACK");
             if (rc > 0) { // WOULDBLOCK，标记待发送
                 client->online_ack_pending = true;
@@ -1414,10 +2658,10 @@ static void handle_relay_signaling(int idx) {
             if (rc < 0) goto disconnect;            
         }
         // 除 ONLINE 外，所有消息都要求已完成登录
-        else if (!client->base.local_peer_id[0]) {
+        else if (!login->base.local_peer_id[0]) {
             print("E:", LA_F("type=%u rejected: client not logged in\n", LA_F147, 147), (unsigned)type);
-            relay_send_error(client, type, P2P_RLY_ERR_NOT_ONLINE);
-            goto disconnect;
+            relay_send_error(login, type, P2P_RLY_ERR_NOT_ONLINE);
+            if (!client->mux_ctl) goto disconnect;
         }
         else if (type == P2P_RLY_ALIVE) {
             // 心跳包：last_active 已在循环入口更新，就地改写 recv_buf 为 ALIVE_ACK 回复
@@ -1425,10 +2669,10 @@ static void handle_relay_signaling(int idx) {
             // size 已经是 0（ALIVE 无 payload），无需修改
             size_t ack_len = sizeof(p2p_relay_hdr_t);
             // 这里直接发送 ACK，理论上不应出现 WOULDBLOCK（3 bytes 数据），如果发生了也无妨，等下次心跳再回复即可
-            tcp_send(client, client->recv_buf, &ack_len, "ALIVE_ACK");
+            relay_direct_send(login, client->recv_buf, &ack_len, "ALIVE_ACK");
         }
         else if (type == P2P_RLY_SYNC0) {
-            handle_relay_sync0(client, payload, payload_len);
+            handle_relay_sync0(login, payload, payload_len);
         }
         else {
             if (payload_len < P2P_SESS_ID_PSZ) {
@@ -1440,8 +2684,8 @@ static void handle_relay_signaling(int idx) {
             uint32_t session_id;
             nread_l(&session_id, payload);
             session_t *s = NULL;
-            HASH_FIND(hh_session, g_sessions, &session_id, P2P_SESS_ID_PSZ, s);
-            if (s == NULL || s->client != &client->base) {
+            s = SESSION_FIND(session_id);
+            if (s == NULL || s->client != &login->base) {
                 print("W:", LA_F("unknown ses_id=%u (type=%u)\n", LA_F148, 148), session_id, (unsigned)type);
                 client->recv_len = 0;
                 continue;
@@ -1472,6 +2716,14 @@ static void handle_relay_signaling(int idx) {
                 print("W:", LA_F("ses_id=%u busy (pending relay)\n", LA_F145, 145), session_id);
                 relay_session_send_status(rs, type, P2P_RLY_ERR_BUSY);
             }
+            // 转发需要新的大帧缓冲（零拷贝接收替换）并占用对端发送队列：池已超限或对端队列达到配额时回压
+            else if ((type == P2P_RLY_SYNC || type == P2P_RLY_PACKET || type == P2P_RLY_REQ || type == P2P_RLY_RESP)
+                     && (!relay_buf_available(&g_relay_buf_large) || rs->peer->send_cnt >= RELAY_SESSION_QUEUE_MAX)) {
+
+                g_relay_bufs.busy++;
+                print("W:", "ses_id=%u busy (relay buffers exhausted or peer queue full)\n", session_id);
+                relay_session_send_status(rs, type, P2P_RLY_ERR_BUSY);
+            }
             else switch (type) {
             case P2P_RLY_SYNC:
                 handle_relay_sync(client, rs, payload, payload_len);
@@ -1505,20 +2757,21 @@ disconnect:
     relay_clear_client(client);
 }
 
-// 清理过期的 Relay 模式客户端连接（检测死连接）
-static void cleanup_relay_clients(void) {
+// Relay 模式客户端空闲超时（检测死连接）
+// + last_active 由收包路径更新，不触碰定时器；到期时若期间有活动则按 last_active 顺延
+static void relay_idle_expire(srv_timer_t *t, uint64_t now) {
+    relay_client_t *c = TIMER_OWNER(t, relay_client_t, base.idle_timer);
 
-    uint64_t now = P_tick_ms();
-    for (int i = 0; i < MAX_PEERS; i++) { relay_client_t *c = &g_relay_clients[i];
+    if (!c->base.valid || c->fd == P_INVALID_SOCKET) return;
+    if (tick_diff(now, c->base.last_active) <= RELAY_CLIENT_TIMEOUT_S * 1000) {
+        timer_add(t, c->base.last_active + RELAY_CLIENT_TIMEOUT_S * 1000 + 1, relay_idle_expire);
+        return;
+    }
 
-        if (!c->base.valid || c->fd == P_INVALID_SOCKET) continue;
-        if (tick_diff(now, c->base.last_active) <= RELAY_CLIENT_TIMEOUT_S * 1000) continue;
+    print("W:", LA_F("'%s' timeout (inactive for %.1f sec)\n", LA_F73, 73), 
+           c->base.local_peer_id, tick_diff(now, c->base.last_active) / 1000.0);
 
-        print("W:", LA_F("'%s' timeout (inactive for %.1f sec)\n", LA_F73, 73), 
-               c->base.local_peer_id, tick_diff(now, c->base.last_active) / 1000.0);
-        
-        relay_clear_client(c);
-    }
+    relay_clear_client(c);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1543,37 +2796,285 @@ static inline const char* cs_remote_peer(const compact_session_t *cs) {
 // session / client 生命周期管理
 
 // UDP 发送 + 统一日志
-static inline ssize_t udp_send(sock_t fd, const char *PROTO,
-                                const void *buf, int len,
-                                const struct sockaddr_in *to) {
-    ssize_t sent = sendto(fd, (const char *)buf, len, 0,
-                          (const struct sockaddr *)to, sizeof(*to));
-    if (sent == (ssize_t)len)
-        printf(LA_F("[UDP] %s send to %s:%d, len=%d\n", LA_F137, 137),
-               PROTO, inet_ntoa(to->sin_addr), ntohs(to->sin_port), (int)sent);
-    else
-        print("E:", LA_F("[UDP] %s send to %s:%d failed(%d)\n", LA_F136, 136),
-              PROTO, inet_ntoa(to->sin_addr), ntohs(to->sin_port), P_sock_errno());
-    return sent;
+/*
+ * UDP 发送队列
+ *
+ * + 处理函数的回包 / 转发先进入队列，主循环在每轮等待事件前调用 udp_flush() 统一发出
+ *   （Linux 下按套接字合并为 sendmmsg，其他平台逐个 sendto）
+ * + 队列满时立即 flush，因此入队总能成功；发送失败在 flush 时记录
+ */
+typedef struct udp_tx {
+    sock_t                          fd;
+    const char*                     proto;
+    struct sockaddr_in              to;
+    int                             len;
+    uint8_t                         buf[P2P_MTU];
+} udp_tx_t;
+
+static udp_tx_t                     g_udp_tx[UDP_BATCH_MAX];
+static int                          g_udp_tx_cnt = 0;
+
+static void udp_tx_failed(const udp_tx_t *t) {
+    print("E:", LA_F("[UDP] %s send to %s:%d failed(%d)\n", LA_F136, 136),
+          t->proto, inet_ntoa(t->to.sin_addr), ntohs(t->to.sin_port), P_sock_errno());
+}
+
+static void udp_flush(void) {
+
+#if defined(__linux__)
+    struct mmsghdr msgs[UDP_BATCH_MAX];
+    struct iovec iovs[UDP_BATCH_MAX];
+
+    for (int i = 0; i < g_udp_tx_cnt; i++) {
+        iovs[i].iov_base = g_udp_tx[i].buf;
+        iovs[i].iov_len = (size_t)g_udp_tx[i].len;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &g_udp_tx[i].to;
+        msgs[i].msg_hdr.msg_namelen = sizeof(g_udp_tx[i].to);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // 相同套接字的连续项合并提交；sendmmsg 遇错提前返回，跳过出错的包继续发送剩余部分
+    for (int off = 0; off < g_udp_tx_cnt; ) {
+        int end = off + 1;
+        while (end < g_udp_tx_cnt && g_udp_tx[end].fd == g_udp_tx[off].fd) end++;
+        while (off < end) {
+            int n = sendmmsg(g_udp_tx[off].fd, msgs + off, (unsigned int)(end - off), 0);
+            if (n > 0) { off += n; continue; }
+            udp_tx_failed(&g_udp_tx[off]);
+            off++;
+        }
+    }
+#else
+    for (int i = 0; i < g_udp_tx_cnt; i++) { const udp_tx_t *t = &g_udp_tx[i];
+        if (sendto(t->fd, (const char *)t->buf, t->len, 0, (const struct sockaddr *)&t->to, sizeof(t->to)) != (ssize_t)t->len)
+            udp_tx_failed(t);
+    }
+#endif
+    g_udp_tx_cnt = 0;
+}
+
+// 入队一个数据报（静默；buf 立即被复制，调用方可复用）
+static void udp_enqueue(sock_t fd, const char *PROTO, const void *buf, int len, const struct sockaddr_in *to) {
+
+    if (len <= 0 || len > P2P_MTU) return;
+    if (g_udp_tx_cnt >= UDP_BATCH_MAX) udp_flush();
+
+    udp_tx_t *t = &g_udp_tx[g_udp_tx_cnt++];
+    t->fd = fd;
+    t->proto = PROTO;
+    t->to = *to;
+    t->len = len;
+    memcpy(t->buf, buf, (size_t)len);
+}
+
+// 同上；集群中经其他入口节点代理的客户端改由链路交给入口节点发出
+static void udp_queue(sock_t fd, const char *PROTO, const void *buf, int len, const struct sockaddr_in *to) {
+    if (g_cluster_addrs && fd == g_udp_fd && cluster_deliver(buf, len, to)) return;
+    udp_enqueue(fd, PROTO, buf, len, to);
+}
+
+static inline void udp_send(sock_t fd, const char *PROTO,
+                            const void *buf, int len,
+                            const struct sockaddr_in *to) {
+    udp_queue(fd, PROTO, buf, len, to);
+    printf(LA_F("[UDP] %s send to %s:%d, len=%d\n", LA_F137, 137),
+           PROTO, inet_ntoa(to->sin_addr), ntohs(to->sin_port), len);
+}
+
+//-----------------------------------------------------------------------------
+// 中继转发表
+
+static compact_fwd_t* compact_fwd_find(uint32_t session_id) {
+    if (!g_compact_fwd_cnt) return NULL;
+    uint32_t mask = g_compact_fwd_cap - 1;
+    for (uint32_t i = session_id & mask; g_compact_fwd[i].session_id; i = (i + 1) & mask) {
+        if (g_compact_fwd[i].session_id == session_id) return &g_compact_fwd[i];
+    }
+    return NULL;
+}
+
+static compact_fwd_t* compact_fwd_slot(uint32_t session_id) {
+    uint32_t mask = g_compact_fwd_cap - 1, i = session_id & mask;
+    while (g_compact_fwd[i].session_id && g_compact_fwd[i].session_id != session_id) i = (i + 1) & mask;
+    return &g_compact_fwd[i];
+}
+
+// 写入（或更新）表项；负载因子超过 1/2 时翻倍重建。OOM 时放弃（数据包退回完整信令路径）
+static void compact_fwd_set(uint32_t session_id, uint32_t peer_session_id, client_t *client,
+                            const struct sockaddr_in *src, const struct sockaddr_in *dst) {
+
+    if ((g_compact_fwd_cnt + 1) * 2 > g_compact_fwd_cap) {
+        uint32_t cap = g_compact_fwd_cap ? g_compact_fwd_cap * 2 : 1024;
+        compact_fwd_t *tab = (compact_fwd_t*)calloc(cap, sizeof(compact_fwd_t));
+        if (!tab) return;
+        compact_fwd_t *old = g_compact_fwd; uint32_t old_cap = g_compact_fwd_cap;
+        g_compact_fwd = tab; g_compact_fwd_cap = cap;
+        for (uint32_t i = 0; i < old_cap; i++) {
+            if (old[i].session_id) *compact_fwd_slot(old[i].session_id) = old[i];
+        }
+        free(old);
+    }
+
+    compact_fwd_t *e = compact_fwd_slot(session_id);
+    if (!e->session_id) g_compact_fwd_cnt++;
+    e->session_id = session_id;
+    e->peer_session_id = peer_session_id;
+    e->client = client;
+    e->src = *src;
+    e->dst = *dst;
+}
+
+static void compact_fwd_del(uint32_t session_id) {
+
+    compact_fwd_t *e = compact_fwd_find(session_id);
+    if (!e) return;
+
+    // 后移补位：把探测链上后续可前移的表项移入空位，保持查找链连续
+    uint32_t mask = g_compact_fwd_cap - 1, hole = (uint32_t)(e - g_compact_fwd);
+    for (uint32_t i = (hole + 1) & mask; g_compact_fwd[i].session_id; i = (i + 1) & mask) {
+        uint32_t home = g_compact_fwd[i].session_id & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            g_compact_fwd[hole] = g_compact_fwd[i];
+            hole = i;
+        }
+    }
+    g_compact_fwd[hole].session_id = 0;
+    g_compact_fwd_cnt--;
+}
+
+// 按会话当前配对状态刷新双向表项（配对建立 / 任一端地址变更时调用）
+static void compact_fwd_pair(compact_session_t *cs) {
+    if (!PEER_ONLINE(cs)) return;
+    compact_session_t *peer = cs->peer;
+    compact_fwd_set(cs->base.session_id, peer->base.session_id, cs->base.client,
+                    &COMPACT_CLIENT(cs)->addr, &COMPACT_CLIENT(peer)->addr);
+    compact_fwd_set(peer->base.session_id, cs->base.session_id, peer->base.client,
+                    &COMPACT_CLIENT(peer)->addr, &COMPACT_CLIENT(cs)->addr);
 }
 
+//-----------------------------------------------------------------------------
+// COMPACT 会话的按需存储
+/* + 候选列表按实际数量分配（通常 3~5 个），数量不变时原地覆盖
+ | + RPC 槽位数组在会话首个 RPC 到达时分配；数据缓冲区仅在 RPC 携带数据期间从空闲链表借用，RPC 结束即归还
+ |   绝大多数会话从不使用 RPC，会话本体因此保持在几百字节以内
+*/
+
+static uint8_t*                     g_rpc_buf_free = NULL;      // 空闲链表（缓冲区首部存放 next 指针）
+static int                          g_rpc_buf_cached = 0;
+
+static uint8_t* rpc_buf_alloc(void) {
+    uint8_t *buf = g_rpc_buf_free;
+    if (buf) { g_rpc_buf_free = *(uint8_t**)buf; g_rpc_buf_cached--; return buf; }
+    return (uint8_t*)malloc(P2P_MSG_DATA_MAX);
+}
+
+static void rpc_buf_free(uint8_t *buf) {
+    if (g_rpc_buf_cached >= MSG_RPC_BUF_CACHE) { free(buf); return; }
+    *(uint8_t**)buf = g_rpc_buf_free;
+    g_rpc_buf_free = buf;
+    g_rpc_buf_cached++;
+}
+
+// 缓存 RPC 数据（无数据时归还缓冲区）；缓冲区分配失败返回 false，原数据不变
+static bool compact_rpc_store(compact_rpc_t *r, const uint8_t *data, int len) {
+    if (len <= 0 || !data) {
+        if (r->data) { rpc_buf_free(r->data); r->data = NULL; }
+        r->data_len = 0;
+        return true;
+    }
+    if (!r->data && !(r->data = rpc_buf_alloc())) return false;
+    memcpy(r->data, data, len);
+    r->data_len = len;
+    return true;
+}
+
+// RPC 结束（完成 / 放弃 / 取消）：停止重传、归还数据缓冲区并释放槽位
+static void compact_rpc_release(compact_rpc_t *r) {
+    timer_del(&r->timer);
+    compact_rpc_store(r, NULL, 0);
+    if (r->sid) { r->sid = 0; r->cs->rpc_active--; }
+}
+
+// 按 sid 查找进行中的槽位
+static compact_rpc_t* compact_rpc_find(compact_session_t *cs, uint16_t sid) {
+    if (!cs->rpc || !sid) return NULL;
+    for (int i = 0; i < g_rpc_window; i++)
+        if (cs->rpc[i].sid == sid) return &cs->rpc[i];
+    return NULL;
+}
+
+// 为新 sid 取空闲槽位（首次使用时分配槽位数组）；窗口已满时取消最老的 RPC 腾出槽位
+static compact_rpc_t* compact_rpc_take(compact_session_t *cs, uint16_t sid) {
+    if (!cs->rpc) {
+        if (!(cs->rpc = (compact_rpc_t*)calloc((size_t)g_rpc_window, sizeof(compact_rpc_t)))) return NULL;
+        g_mem.session += (size_t)g_rpc_window * sizeof(compact_rpc_t);
+        for (int i = 0; i < g_rpc_window; i++) cs->rpc[i].cs = cs;
+    }
+    compact_rpc_t *r = NULL, *oldest = NULL;
+    for (int i = 0; i < g_rpc_window && !r; i++) {
+        compact_rpc_t *q = &cs->rpc[i];
+        if (!q->sid) r = q;
+        else if (!oldest || uint16_circle_newer(oldest->sid, q->sid)) oldest = q;
+    }
+    if (!r) {
+        print("I:", LA_F("%s new sid=%u > pending sid=%u (responding=%d), canceling old RPC (ses_id=%u)\n", LA_F20, 20),
+              "MSG_REQ", sid, oldest->sid, oldest->responding, cs->base.session_id);
+        compact_rpc_release(oldest);
+        r = oldest;
+    }
+    r->sid = sid;
+    cs->rpc_active++;
+    return r;
+}
+
+// 会话释放：结束全部 RPC 并释放槽位数组
+static void compact_rpc_free_all(compact_session_t *cs) {
+    if (!cs->rpc) return;
+    for (int i = 0; i < g_rpc_window; i++) compact_rpc_release(&cs->rpc[i]);
+    g_mem.session -= (size_t)g_rpc_window * sizeof(compact_rpc_t);
+    free(cs->rpc); cs->rpc = NULL;
+}
+
+// 更新候选列表；数量变化时重新分配，失败返回 false 并保留原列表
+static bool compact_set_candidates(compact_session_t *cs, const p2p_candidate_t *cands, int count) {
+    if (count != cs->candidate_count) {
+        if (!count) { free(cs->candidates); cs->candidates = NULL; }
+        else {
+            p2p_candidate_t *p = (p2p_candidate_t*)realloc(cs->candidates, sizeof(p2p_candidate_t) * count);
+            if (!p) return false;
+            cs->candidates = p;
+        }
+        g_mem.session += sizeof(p2p_candidate_t) * count;
+        g_mem.session -= sizeof(p2p_candidate_t) * cs->candidate_count;
+        cs->candidate_count = count;
+    }
+    if (count) memcpy(cs->candidates, cands, sizeof(p2p_candidate_t) * count);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
 // forward declarations
-static void remove_compact_sync0_pending(compact_session_t *cs);
-static void remove_compact_rpc_pending(compact_session_t *cs);
+static void compact_idle_expire(srv_timer_t *t, uint64_t now);
 static void compact_send_fin(sock_t udp_fd, compact_session_t *cs, const char *reason);
-static void compact_transition_to_resp_pending(sock_t udp_fd, compact_session_t *requester, uint64_t now,
+static void compact_transition_to_resp_pending(sock_t udp_fd, compact_rpc_t *r, uint64_t now,
                                        uint8_t flags, uint8_t code, const uint8_t *data, int len);
 
 static void compact_free_session(sock_t udp_fd, compact_session_t *cs) {
-    if (cs->sync0_pending_next) remove_compact_sync0_pending(cs);
-    if (cs->rpc_pending_next)   remove_compact_rpc_pending(cs);
+    timer_del(&cs->sync0_timer);
+    compact_rpc_free_all(cs);
 
     // 通知对端断开，并标记对端 peer 指针为 -1
+    compact_fwd_del(cs->base.session_id);
     if (PEER_ONLINE(cs)) {
+        compact_fwd_del(cs->peer->base.session_id);
         cs->peer->peer = (compact_session_t*)(void*)-1;
         compact_send_fin(udp_fd, cs->peer, "peer_disconnect");
     }
 
+    compact_set_candidates(cs, NULL, 0);
     free_session(&cs->base);
 }
 
@@ -1582,23 +3083,53 @@ static void compact_clear_client(sock_t udp_fd, compact_client_t *c) {
     while (c->base.sessions) {
         compact_free_session(udp_fd, (compact_session_t*)c->base.sessions);
     }
-    // 从 auth 哈希表移除
+    cluster_proxy_drop(c);
+    // 从 auth / name 哈希表移除
     if (c->auth_key) {
-        HASH_DELETE(hh_client, g_compact_clients_by_auth, c);
+        flat_index_del(&g_compact_auth_index, c->auth_key);
         c->auth_key = 0;
     }
+    timer_del(&c->base.idle_timer);
+    if (c->base.valid) {
+        HASH_DELETE(hh_name, g_compact_clients_by_name, c);
+        c->base.valid = false;
+        pool_free(&g_compact_pool, &c->base);
+    }
     c->base.local_peer_id[0] = 0;
-    c->base.valid = false;
 }
 
 //-----------------------------------------------------------------------------
 
+/*
+ * 建议客户端的 ALIVE 间隔（秒）
+ * + 负载：在线客户端越多间隔越长，使 ALIVE 总速率不超过 --alive-pps（不短于默认间隔）
+ * + 绑定存活期：不超过客户端报告的 NAT 绑定存活期的一半，保证服务器→客户端方向的映射不失效；
+ *   未报告时不超过默认间隔
+ */
+static uint16_t compact_alive_interval(const compact_client_t *c) {
+
+    uint32_t iv = (uint32_t)((g_compact_pool.used + g_alive_pps - 1) / g_alive_pps);
+    if (iv < COMPACT_ALIVE_DEFAULT_S) iv = COMPACT_ALIVE_DEFAULT_S;
+
+    uint32_t cap = c->bind_life_s ? c->bind_life_s / 2u : COMPACT_ALIVE_DEFAULT_S;
+    if (iv > cap) iv = cap;
+    return (uint16_t)(iv < COMPACT_ALIVE_MIN_S ? COMPACT_ALIVE_MIN_S : iv > COMPACT_ALIVE_MAX_S ? COMPACT_ALIVE_MAX_S : iv);
+}
+
+// 客户端空闲超时（毫秒）：不短于 COMPACT_PAIR_TIMEOUT_S，通告的间隔较长时容许 COMPACT_ALIVE_MISS 个 ALIVE 丢失
+static inline uint64_t compact_idle_timeout_ms(const compact_client_t *c) {
+    uint32_t s = (uint32_t)c->alive_s * COMPACT_ALIVE_MISS + 10;
+    return (uint64_t)(s > COMPACT_PAIR_TIMEOUT_S ? s : COMPACT_PAIR_TIMEOUT_S) * 1000;
+}
+
 // 发送 ONLINE_ACK: [hdr(4)][instance_id(4)][auth_key(SIG_AUTH_KEY_PSZ)][max_candidates(1)][public_ip(4)][public_port(2)][probe_port(2)] = 25字节
-// auth_key=0 表示服务器拒绝（无可用槽位）
-static void compact_send_online_ack(sock_t udp_fd, const struct sockaddr_in *to, uint64_t auth_key, uint32_t instance_id) {
+// + 尾部 [rpc_window(1)][alive_s(2)]
+// auth_key=0 表示服务器拒绝（无可用槽位）；sync0 表示已受理 ONLINE 捎带的 SYNC0
+static void compact_send_online_ack(sock_t udp_fd, const struct sockaddr_in *to, uint64_t auth_key, uint32_t instance_id,
+                                    uint16_t alive_s, bool sync0) {
     const char* PROTO = "ONLINE_ACK";
 
-    uint8_t ack[sizeof(p2p_packet_hdr_t) + SIG_PKT_ONLINE_ACK_PSZ];
+    uint8_t ack[sizeof(p2p_packet_hdr_t) + SIG_PKT_ONLINE_ACK_PSZ + 1/* rpc_window */ + 2/* alive_s */];
     p2p_packet_hdr_t *hdr = (p2p_packet_hdr_t *)ack;
     hdr->type = SIG_PKT_ONLINE_ACK;
     hdr->flags = 0;
@@ -1607,6 +3138,8 @@ static void compact_send_online_ack(sock_t udp_fd, const struct sockaddr_in *to,
     if (auth_key != 0) {
         if (ARGS_relay.i64)    hdr->flags |= SIG_ONACK_FLAG_RELAY;
         if (ARGS_msg.i64)      hdr->flags |= SIG_ONACK_FLAG_MSG;
+        hdr->flags |= SIG_ONACK_FLAG_PUNCH_AT;
+        if (sync0)             hdr->flags |= SIG_ONACK_FLAG_SYNC0;
 
         int ofz = sizeof(p2p_packet_hdr_t);
         nwrite_l(ack + ofz, instance_id); ofz += (int)sizeof(instance_id);
@@ -1616,6 +3149,8 @@ static void compact_send_online_ack(sock_t udp_fd, const struct sockaddr_in *to,
         memcpy(ack + ofz, &to->sin_port, 2); ofz += 2;
         uint16_t probe = htons((uint16_t)ARGS_probe_port.i64);
         memcpy(ack + ofz, &probe, 2); ofz += 2;
+        ack[ofz++] = (uint8_t)g_rpc_window;
+        nwrite_s(ack + ofz, alive_s); ofz += 2;
 
         print("V:", LA_F("Send %s: max_cands=%d, relay=%s, msg=%s, public=%s:%d, probe=%d, auth_key=%" PRIu64 ", inst_id=%u\n", LA_F112, 112),
               PROTO, MAX_CANDIDATES,
@@ -1623,19 +3158,35 @@ static void compact_send_online_ack(sock_t udp_fd, const struct sockaddr_in *to,
               inet_ntoa(to->sin_addr), ntohs(to->sin_port),
               (int)ARGS_probe_port.i64, auth_key, instance_id);
     } else {
-        memset(ack + sizeof(p2p_packet_hdr_t), 0, SIG_PKT_ONLINE_ACK_PSZ);
+        memset(ack + sizeof(p2p_packet_hdr_t), 0, sizeof(ack) - sizeof(p2p_packet_hdr_t));
         print("V:", LA_F("Send %s: rejected (no slot available)\n", LA_F114, 114), PROTO);
     }
 
     udp_send(udp_fd, PROTO, ack, (int)sizeof(ack), to);
 }
 
-// 发送 SYNC0_ACK: [hdr(4)][remote_peer_id(32)][session_id(4)][online(1)]
+// 限流拒绝：auth_key=0 + SIG_ONACK_FLAG_BACKOFF，末 2 字节为建议的 ONLINE 重发间隔（毫秒）
+static void compact_send_online_backoff(sock_t udp_fd, const struct sockaddr_in *to, uint32_t instance_id, uint32_t backoff_ms) {
+    const char* PROTO = "ONLINE_ACK";
+
+    uint8_t ack[sizeof(p2p_packet_hdr_t) + SIG_PKT_ONLINE_ACK_PSZ];
+    memset(ack, 0, sizeof(ack));
+    p2p_pkt_hdr_encode(ack, SIG_PKT_ONLINE_ACK, SIG_ONACK_FLAG_BACKOFF, 0);
+    nwrite_l(ack + sizeof(p2p_packet_hdr_t), instance_id);
+    nwrite_s(ack + sizeof(ack) - 2, (uint16_t)(backoff_ms > 0xFFFF ? 0xFFFF : backoff_ms));
+
+    print("V:", "Send %s: rate limited %s:%d, backoff=%ums\n", PROTO, inet_ntoa(to->sin_addr), ntohs(to->sin_port), backoff_ms);
+    udp_send(udp_fd, PROTO, ack, (int)sizeof(ack), to);
+}
+
+// 发送 SYNC0_ACK: [hdr(4)][remote_peer_id(32)][session_id(4)][online(1)][instance_id(4)]
+// 尾部 instance_id 为接收方客户端的实例 ID（同一客户端多个本端身份连接同一对端时据此定位会话）
 static void compact_send_sync0_ack(sock_t udp_fd, const struct sockaddr_in *to,
-                                   const char *remote_peer_id, uint32_t session_id, uint8_t online) {
+                                   const char *remote_peer_id, uint32_t session_id, uint8_t online,
+                                   uint32_t instance_id) {
     const char* PROTO = "SYNC0_ACK";
 
-    uint8_t ack[sizeof(p2p_packet_hdr_t) + SIG_PKT_SYNC0_ACK_PSZ];
+    uint8_t ack[sizeof(p2p_packet_hdr_t) + SIG_PKT_SYNC0_ACK_PSZ + SIG_PKT_INST_ID_PSZ];
     p2p_packet_hdr_t *hdr = (p2p_packet_hdr_t *)ack;
     hdr->type = SIG_PKT_SYNC0_ACK;
     hdr->flags = 0;
@@ -1645,6 +3196,7 @@ static void compact_send_sync0_ack(sock_t udp_fd, const struct sockaddr_in *to,
     memcpy(ack + ofz, remote_peer_id, P2P_PEER_ID_MAX); ofz += P2P_PEER_ID_MAX;
     nwrite_l(ack + ofz, session_id); ofz += P2P_SESS_ID_PSZ;
     ack[ofz++] = online;
+    nwrite_l(ack + ofz, instance_id); ofz += SIG_PKT_INST_ID_PSZ;
 
     print("V:", LA_F("Send %s: ses_id=%u, peer=%s\n", LA_F115, 115),
           PROTO, session_id, online ? "online" : "offline");
@@ -1670,7 +3222,7 @@ static void compact_send_fin(sock_t udp_fd, compact_session_t *cs, const char *r
 }
 
 // 发送首次对端候选推送（base_index=0）或地址变更通知（base_index != 0 为循环通知序号）
-// base_index=0: SIG_PKT_SYNC0，payload: [session_id(4)][0x00(1)][cand_cnt(1)][candidates]
+// base_index=0: SIG_PKT_SYNC0，payload: [session_id(4)][0x00(1)][cand_cnt(1)][candidates][instance_id(4)]
 // base_index!=0: SIG_PKT_SYNC（seq=0），payload: [session_id(4)][notify_seq(1)][1][candidate]
 static void compact_send_sync0(sock_t udp_fd, compact_session_t *cs, uint8_t base_index) {
     const char* PROTO = base_index == 0 ? "SYNC0" : "SYNC";
@@ -1681,7 +3233,7 @@ static void compact_send_sync0(sock_t udp_fd, compact_session_t *cs, uint8_t bas
     compact_session_t *peer     = cs->peer;
     compact_client_t  *peer_cli = COMPACT_CLIENT(peer);
 
-    uint8_t pkt[sizeof(p2p_packet_hdr_t) + P2P_PEER_ID_MAX + P2P_SESS_ID_PSZ + 2 + MAX_CANDIDATES * sizeof(p2p_candidate_t)];
+    uint8_t pkt[sizeof(p2p_packet_hdr_t) + P2P_PEER_ID_MAX + P2P_SESS_ID_PSZ + 2 + MAX_CANDIDATES * sizeof(p2p_candidate_t) + SIG_PKT_INST_ID_PSZ];
     p2p_packet_hdr_t *resp_hdr = (p2p_packet_hdr_t *)pkt;
     resp_hdr->flags = 0;
     resp_hdr->seq = htons(0);
@@ -1712,6 +3264,7 @@ static void compact_send_sync0(sock_t udp_fd, compact_session_t *cs, uint8_t bas
             memcpy(pkt + ofz, &peer->candidates[i], sizeof(p2p_candidate_t));
             ofz += sizeof(p2p_candidate_t);
         }
+        nwrite_l(pkt + ofz, client->base.instance_id); ofz += SIG_PKT_INST_ID_PSZ;
 
         print("V:", LA_F("Send %s: cands=%d, ses_id=%u, peer='%s'\n", LA_F110, 110),
               PROTO, cand_cnt, cs->base.session_id, client->base.local_peer_id);
@@ -1761,11 +3314,12 @@ static void compact_send_msg_req_ack(sock_t udp_fd, const struct sockaddr_in *to
 }
 
 // 发送 MSG_REQ 给对端（Server→对端 relay）
-static void compact_send_msg_req_to_peer(sock_t udp_fd, compact_session_t *cs) {
+static void compact_send_msg_req_to_peer(sock_t udp_fd, compact_rpc_t *r) {
     const char* PROTO = "MSG_REQ";
 
+    compact_session_t *cs = r->cs;
     assert(cs && PEER_ONLINE(cs));
-    assert(cs->rpc_pending_next && !cs->rpc_responding);
+    assert(timer_active(&r->timer) && !r->responding);
 
     compact_session_t *peer     = cs->peer;
     compact_client_t  *peer_cli = COMPACT_CLIENT(peer);
@@ -1778,16 +3332,16 @@ static void compact_send_msg_req_to_peer(sock_t udp_fd, compact_session_t *cs) {
 
     int ofz = sizeof(p2p_packet_hdr_t);
     nwrite_l(pkt + ofz, peer->base.session_id); ofz += P2P_SESS_ID_PSZ;
-    nwrite_s(pkt + ofz, cs->rpc_last_sid); ofz += 2;
-    pkt[ofz++] = cs->rpc_code;
-    if (cs->rpc_data_len > 0) {
-        memcpy(pkt + ofz, cs->rpc_data, cs->rpc_data_len);
-        ofz += cs->rpc_data_len;
+    nwrite_s(pkt + ofz, r->sid); ofz += 2;
+    pkt[ofz++] = r->code;
+    if (r->data_len > 0) {
+        memcpy(pkt + ofz, r->data, r->data_len);
+        ofz += r->data_len;
     }
 
     print("V:", LA_F("Send %s: ses_id=%u, sid=%u, msg=%u, data_len=%d, peer='%s', retries=%d\n", LA_F116, 116),
-          PROTO, peer->base.session_id, cs->rpc_last_sid, cs->rpc_code, cs->rpc_data_len,
-          peer_cli->base.local_peer_id, cs->rpc_retry);
+          PROTO, peer->base.session_id, r->sid, r->code, r->data_len,
+          peer_cli->base.local_peer_id, r->retry);
 
     udp_send(udp_fd, PROTO, pkt, ofz, &peer_cli->addr);
 }
@@ -1814,296 +3368,218 @@ static void compact_send_msg_resp_ack_to_responder(sock_t udp_fd, const struct s
 }
 
 // 发送 MSG_RESP 给请求方（Server→A）
-static void compact_send_msg_resp_to_requester(sock_t udp_fd, compact_session_t *cs) {
+static void compact_send_msg_resp_to_requester(sock_t udp_fd, compact_rpc_t *r) {
     const char* PROTO = "MSG_RESP";
 
-    assert(cs && cs->rpc_responding);
+    compact_session_t *cs = r->cs;
+    assert(cs && r->responding);
 
     compact_client_t *client = COMPACT_CLIENT(cs);
     uint8_t pkt[sizeof(p2p_packet_hdr_t) + P2P_SESS_ID_PSZ + 2 + 1 + P2P_MSG_DATA_MAX];
     p2p_packet_hdr_t *hdr = (p2p_packet_hdr_t *)pkt;
     hdr->type = SIG_PKT_MSG_RESP;
-    hdr->flags = cs->rpc_flags;
+    hdr->flags = r->flags;
     hdr->seq = 0;
 
     int ofz = sizeof(p2p_packet_hdr_t);
     nwrite_l(pkt + ofz, cs->base.session_id); ofz += P2P_SESS_ID_PSZ;
-    nwrite_s(pkt + ofz, cs->rpc_last_sid); ofz += 2;
+    nwrite_s(pkt + ofz, r->sid); ofz += 2;
 
-    if (!(cs->rpc_flags & (SIG_MSG_FLAG_PEER_OFFLINE | SIG_MSG_FLAG_TIMEOUT))) {
-        pkt[ofz++] = cs->rpc_code;
-        if (cs->rpc_data_len > 0) {
-            memcpy(pkt + ofz, cs->rpc_data, cs->rpc_data_len);
-            ofz += cs->rpc_data_len;
+    if (!(r->flags & (SIG_MSG_FLAG_PEER_OFFLINE | SIG_MSG_FLAG_TIMEOUT))) {
+        pkt[ofz++] = r->code;
+        if (r->data_len > 0) {
+            memcpy(pkt + ofz, r->data, r->data_len);
+            ofz += r->data_len;
         }
     }
 
     print("V:", LA_F("Send %s: ses_id=%u, sid=%u, peer='%s', flags=0x%02x, code=%u, data_len=%d, retries=%d\n", LA_F117, 117),
-          PROTO, cs->base.session_id, cs->rpc_last_sid, client->base.local_peer_id, cs->rpc_flags, cs->rpc_code, cs->rpc_data_len, cs->rpc_retry);
+          PROTO, cs->base.session_id, r->sid, client->base.local_peer_id, r->flags, r->code, r->data_len, r->retry);
 
     udp_send(udp_fd, PROTO, pkt, ofz, &client->addr);
 }
 
 //-----------------------------------------------------------------------------
-// SYNC(seq=0) 待确认链表管理
-
-// 从待确认链表移除
-static void remove_compact_sync0_pending(compact_session_t *cs) {
-
-    if (!g_compact_sync0_pending_head || !cs->sync0_pending_next) return;
-
-    if (g_compact_sync0_pending_head == cs) {
-        g_compact_sync0_pending_head = cs->sync0_pending_next;
-        cs->sync0_pending_next = NULL;
-        if (g_compact_sync0_pending_head == (compact_session_t*)(void*)-1) {
-            g_compact_sync0_pending_head = NULL;
-            g_compact_sync0_pending_rear = NULL;
-        }
-        return;
-    }
-
-    compact_session_t *prev = g_compact_sync0_pending_head;
-    while (prev->sync0_pending_next != cs) {
-        if (prev->sync0_pending_next == (compact_session_t*)(void*)-1) return;
-        prev = prev->sync0_pending_next;
-    }
-
-    prev->sync0_pending_next = cs->sync0_pending_next;
+// SYNC(seq=0) 可靠传输
 
-    if (cs->sync0_pending_next == (compact_session_t*)(void*)-1) {
-        g_compact_sync0_pending_rear = prev;
-    }
+static void compact_sync0_expire(srv_timer_t *t, uint64_t now);
 
-    cs->sync0_pending_next = NULL;
+// 停止 SYNC(seq=0) 重传
+static inline void remove_compact_sync0_pending(compact_session_t *cs) {
+    timer_del(&cs->sync0_timer);
 }
 
-// 将 session 加入 SYNC(seq=0) 待确认链表
+// 开始（或重新开始）SYNC(seq=0) 重传计时
 static void enqueue_compact_sync0_pending(compact_session_t *cs, uint8_t base_index, uint64_t now) {
 
-    if (cs->sync0_pending_next) {
-        remove_compact_sync0_pending(cs);
-    }
-
     cs->sync0_base_index = base_index;
     cs->sync0_retry = 0;
-    cs->sync0_sent_time = now;
-
-    cs->sync0_pending_next = (compact_session_t*)(void*)-1;
-    if (g_compact_sync0_pending_rear) {
-        g_compact_sync0_pending_rear->sync0_pending_next = cs;
-        g_compact_sync0_pending_rear = cs;
-    } else {
-        g_compact_sync0_pending_head = cs;
-        g_compact_sync0_pending_rear = cs;
-    }
+    cs->sync0_sent = now;
+    timer_add(&cs->sync0_timer, now + SYNC0_RETRY_INTERVAL_MS, compact_sync0_expire);
 }
 
-// 检查并重传未确认的 SYNC 包
-static void retry_compact_sync0_pending(sock_t udp_fd, uint64_t now) {
+// 重传未确认的 SYNC 包
+static void compact_sync0_expire(srv_timer_t *t, uint64_t now) {
+    compact_session_t *q = TIMER_OWNER(t, compact_session_t, sync0_timer);
 
-    if (!g_compact_sync0_pending_head) return;
+    if (q->sync0_retry >= SYNC0_MAX_RETRY) {
 
-    for(;;) {
+        print("W:", LA_F("SYNC retransmit failed: %s <-> %s (gave up after %d tries)\n", LA_F104, 104),
+               COMPACT_CLIENT(q)->base.local_peer_id, cs_remote_peer(q), q->sync0_retry);
 
-        if (tick_diff(now, g_compact_sync0_pending_head->sync0_sent_time) < SYNC0_RETRY_INTERVAL_MS) {
-            return;
+        if (q->sync0_base_index == 0) {
+            q->sync0_acked = -1/* 超时停止 */;
         }
+        return;
+    }
 
-        compact_session_t *q = g_compact_sync0_pending_head;
-        g_compact_sync0_pending_head = q->sync0_pending_next;
-
-        if (q->sync0_retry >= SYNC0_MAX_RETRY) {
+    // 状态 0：重传 SYNC0_ACK，等待客户端二次确认
+    if (q->sync0_acked == 0) {
+        compact_send_sync0_ack(g_udp_fd, &COMPACT_CLIENT(q)->addr,
+                               cs_remote_peer(q), q->base.session_id, PEER_ONLINE(q),
+                               COMPACT_CLIENT(q)->base.instance_id);
+    }
+    // 状态 1：重传 SYNC0，等待客户端确认收到该（来自对端的）SYNC0
+    else {
 
-            print("W:", LA_F("SYNC retransmit failed: %s <-> %s (gave up after %d tries)\n", LA_F104, 104),
-                   COMPACT_CLIENT(q)->base.local_peer_id, cs_remote_peer(q), q->sync0_retry);
+        // 如果对端已经不在线了，就不必重传了
+        if (!PEER_ONLINE(q)) return;
+        compact_send_sync0(g_udp_fd, q, q->sync0_base_index);
+    }
 
-            q->sync0_pending_next = NULL;
-            if (q->sync0_base_index == 0) {
-                q->sync0_acked = -1/* 超时停止 */;
-            }
+    q->sync0_retry++;
+    timer_add(t, now + SYNC0_RETRY_INTERVAL_MS, compact_sync0_expire);
 
-            if (g_compact_sync0_pending_head == (compact_session_t*)(void*)-1) {
-                g_compact_sync0_pending_head = NULL;
-                g_compact_sync0_pending_rear = NULL;
-                return;
-            }
-        }
-        else {
+    print("V:", LA_F("SYNC resent, %s <-> %s, attempt %d/%d (ses_id=%u)\n", LA_F103, 103),
+           COMPACT_CLIENT(q)->base.local_peer_id, cs_remote_peer(q),
+           q->sync0_retry, SYNC0_MAX_RETRY, q->base.session_id);
+}
 
-            // 状态 0：重传 SYNC0_ACK，等待客户端二次确认
-            if (q->sync0_acked == 0) {
-                compact_send_sync0_ack(udp_fd, &COMPACT_CLIENT(q)->addr,
-                                       cs_remote_peer(q), q->base.session_id, PEER_ONLINE(q));
-            }
-            // 状态 1：重传 SYNC0，等待客户端确认收到该（来自对端的）SYNC0
-            else {
+// 客户端确认了未重传过的 seq=0 包：发送到确认的间隔即一次 RTT 样本（Karn：重传过的不采样）
+static void compact_sync0_rtt_sample(compact_session_t *cs, uint64_t now) {
 
-                // 如果对端已经不在线了，就不必重传了
-                if (!PEER_ONLINE(q)) {
-                    q->sync0_pending_next = NULL;
-                    if (g_compact_sync0_pending_head == (compact_session_t*)(void*)-1) {
-                        g_compact_sync0_pending_head = NULL;
-                        g_compact_sync0_pending_rear = NULL;
-                        return; // sync0_pending 链表已空，直接返回
-                    }
-                    continue;
-                }
-                compact_send_sync0(udp_fd, q, q->sync0_base_index);
-            }
+    if (!timer_active(&cs->sync0_timer) || cs->sync0_retry || now < cs->sync0_sent) return;
+    uint64_t sample = now - cs->sync0_sent;
+    if (sample > PUNCH_AT_RTT_MAX_MS) return;
 
-            q->sync0_retry++;
-            q->sync0_sent_time = now;
+    cs->rtt_ms = cs->rtt_ms ? (uint32_t)((cs->rtt_ms * 7u + sample) / 8u) : (uint32_t)(sample ? sample : 1);
+}
 
-            if (g_compact_sync0_pending_head == (compact_session_t*)(void*)-1) {
-                g_compact_sync0_pending_head = q;
-            } else {
-                q->sync0_pending_next = (compact_session_t*)(void*)-1;
-                g_compact_sync0_pending_rear->sync0_pending_next = q;
-                g_compact_sync0_pending_rear = q;
-            }
+// 发送同时打洞起跑提示: [hdr(4)][session_id(4)][delay_ms(2)]
+static void compact_send_punch_at(sock_t udp_fd, compact_session_t *cs, uint32_t delay_ms) {
+    const char* PROTO = "PUNCH_AT";
 
-            print("V:", LA_F("SYNC resent, %s <-> %s, attempt %d/%d (ses_id=%u)\n", LA_F103, 103),
-                   COMPACT_CLIENT(q)->base.local_peer_id, cs_remote_peer(q),
-                   q->sync0_retry, SYNC0_MAX_RETRY, q->base.session_id);
+    compact_client_t *client = COMPACT_CLIENT(cs);
+    uint8_t pkt[sizeof(p2p_packet_hdr_t) + SIG_PKT_PUNCH_AT_PSZ];
+    p2p_packet_hdr_t *hdr = (p2p_packet_hdr_t *)pkt;
+    hdr->type = SIG_PKT_PUNCH_AT; hdr->flags = 0; hdr->seq = htons(0);
 
-            if (g_compact_sync0_pending_head == q) return;
-        }
-    }
-}
+    nwrite_l(pkt + sizeof(p2p_packet_hdr_t), cs->base.session_id);
+    nwrite_s(pkt + sizeof(p2p_packet_hdr_t) + P2P_SESS_ID_PSZ, (uint16_t)delay_ms);
 
+    print("V:", LA_F("Send %s: peer='%s', delay=%ums, rtt=%ums, ses_id=%u\n", LA_F157, 157),
+          PROTO, client->base.local_peer_id, delay_ms, cs->rtt_ms, cs->base.session_id);
 
-//-----------------------------------------------------------------------------
-// MSG RPC 待确认链表管理
+    udp_send(udp_fd, PROTO, pkt, (int)sizeof(pkt), &client->addr);
+}
 
-// 从 RPC 待确认链表移除
-static void remove_compact_rpc_pending(compact_session_t *cs) {
+/*
+ * 双方都确认了对端 SYNC0（都已开始打洞）后，约定同一起跑时刻：
+ *   两端单程时延 owd 取 RTT 的一半，起跑时刻 Δ = max(owd) + 余量，
+ *   各端的延迟 = Δ − 本端 owd，使两端的首个 PUNCH 同时发出、在网络中交叉
+ */
+static void compact_punch_at(sock_t udp_fd, compact_session_t *cs) {
 
-    if (!g_compact_rpc_pending_head || !cs->rpc_pending_next) return;
+    compact_session_t *peer = cs->peer;
+    uint32_t owd = cs->rtt_ms / 2, peer_owd = peer->rtt_ms / 2;
+    uint32_t lead = (owd > peer_owd ? owd : peer_owd) + PUNCH_AT_GUARD_MS;
 
-    if (g_compact_rpc_pending_head == cs) {
-        g_compact_rpc_pending_head = cs->rpc_pending_next;
-        cs->rpc_pending_next = NULL;
-        if (g_compact_rpc_pending_head == (compact_session_t*)(void*)-1) {
-            g_compact_rpc_pending_head = NULL;
-            g_compact_rpc_pending_rear = NULL;
-        }
-        return;
-    }
+    compact_send_punch_at(udp_fd, cs, lead - owd);
+    compact_send_punch_at(udp_fd, peer, lead - peer_owd);
+}
 
-    compact_session_t *prev = g_compact_rpc_pending_head;
-    while (prev->rpc_pending_next != cs) {
-        if (prev->rpc_pending_next == (compact_session_t*)(void*)-1) return;
-        prev = prev->rpc_pending_next;
-    }
 
-    prev->rpc_pending_next = cs->rpc_pending_next;
-    if (cs->rpc_pending_next == (compact_session_t*)(void*)-1) {
-        g_compact_rpc_pending_rear = prev;
-    }
-    cs->rpc_pending_next = NULL;
-}
+//-----------------------------------------------------------------------------
+// MSG RPC 重传（每个 sid 独立计时，统一管理 REQ 和 RESP 阶段，通过 responding 区分）
 
-// 将 session 加入 RPC 待确认链表
-static inline void enqueue_compact_rpc_pending(compact_session_t *cs) {
+static void compact_rpc_expire(srv_timer_t *t, uint64_t now);
 
-    cs->rpc_pending_next = (compact_session_t*)(void*)-1;
-    if (g_compact_rpc_pending_rear) {
-        g_compact_rpc_pending_rear->rpc_pending_next = cs;
-        g_compact_rpc_pending_rear = cs;
-    } else {
-        g_compact_rpc_pending_head = cs;
-        g_compact_rpc_pending_rear = cs;
-    }
+// 以 sent_time 为起点开始 RPC 重传计时
+static inline void enqueue_compact_rpc_pending(compact_rpc_t *r) {
+    timer_add(&r->timer, r->sent_time + MSG_RPC_RETRY_INTERVAL_MS, compact_rpc_expire);
 }
 
-// 检查并重传 RPC（统一处理 REQ 和 RESP 阶段）
-static void retry_compact_rpc_pending(sock_t udp_fd, uint64_t now) {
+// 重传 RPC（统一处理 REQ 和 RESP 阶段）
+static void compact_rpc_expire(srv_timer_t *t, uint64_t now) {
+    compact_rpc_t *r = TIMER_OWNER(t, compact_rpc_t, timer);
+    compact_session_t *q = r->cs;
+    sock_t udp_fd = g_udp_fd;
 
-    if (!g_compact_rpc_pending_head) return;
+    if (!r->responding) {
 
-    for (;;) {
+        if (!PEER_ONLINE(q)) {
+            print("W:", LA_F("MSG_REQ peer went offline, sending error to '%s', sid=%u (ses_id=%u)\n", LA_F86, 86),
+                  COMPACT_CLIENT(q)->base.local_peer_id, r->sid, q->base.session_id);
 
-        if (tick_diff(now, g_compact_rpc_pending_head->rpc_sent_time) < MSG_RPC_RETRY_INTERVAL_MS) {
-            return;
+            compact_transition_to_resp_pending(udp_fd, r, now, SIG_MSG_FLAG_PEER_OFFLINE, 0, NULL, 0);
         }
+        else if (r->retry >= MSG_REQ_MAX_RETRY) {
+            print("W:", LA_F("MSG_REQ peer timeout after %d retries, sending timeout error to '%s', sid=%u (ses_id=%u)\n", LA_F85, 85),
+                  r->retry, COMPACT_CLIENT(q)->base.local_peer_id, r->sid, q->base.session_id);
 
-        compact_session_t *q = g_compact_rpc_pending_head;
-        g_compact_rpc_pending_head = q->rpc_pending_next;
-        if (g_compact_rpc_pending_head == (compact_session_t*)(void*)-1) {
-            g_compact_rpc_pending_head = NULL;
-            g_compact_rpc_pending_rear = NULL;
+            compact_transition_to_resp_pending(udp_fd, r, now, SIG_MSG_FLAG_TIMEOUT, 0, NULL, 0);
         }
+        else {
+            // 先重新挂载再发送：compact_send_msg_req_to_peer 断言 RPC 进行中
+            r->retry++;
+            r->sent_time = now;
+            enqueue_compact_rpc_pending(r);
+            compact_send_msg_req_to_peer(udp_fd, r);
+
+            print("V:", LA_F("MSG_REQ resent, '%s' -> '%s', sid=%u, attempt %d/%d (ses_id=%u)\n", LA_F87, 87),
+                  COMPACT_CLIENT(q)->base.local_peer_id, COMPACT_CLIENT(q->peer)->base.local_peer_id,
+                  r->sid, r->retry, MSG_REQ_MAX_RETRY, q->base.session_id);
+        }
+    }
+    else {
 
-        if (!q->rpc_responding) {
-
-            if (!PEER_ONLINE(q)) {
-                print("W:", LA_F("MSG_REQ peer went offline, sending error to '%s', sid=%u (ses_id=%u)\n", LA_F86, 86),
-                      COMPACT_CLIENT(q)->base.local_peer_id, q->rpc_last_sid, q->base.session_id);
-
-                compact_transition_to_resp_pending(udp_fd, q, now, SIG_MSG_FLAG_PEER_OFFLINE, 0, NULL, 0);
-            }
-            else if (q->rpc_retry >= MSG_REQ_MAX_RETRY) {
-                print("W:", LA_F("MSG_REQ peer timeout after %d retries, sending timeout error to '%s', sid=%u (ses_id=%u)\n", LA_F85, 85),
-                      q->rpc_retry, COMPACT_CLIENT(q)->base.local_peer_id, q->rpc_last_sid, q->base.session_id);
-
-                compact_transition_to_resp_pending(udp_fd, q, now, SIG_MSG_FLAG_TIMEOUT, 0, NULL, 0);
-            }
-            else {
-                compact_send_msg_req_to_peer(udp_fd, q);
-                q->rpc_retry++;
-                q->rpc_sent_time = now;
-                enqueue_compact_rpc_pending(q);
-
-                print("V:", LA_F("MSG_REQ resent, '%s' -> '%s', sid=%u, attempt %d/%d (ses_id=%u)\n", LA_F87, 87),
-                      COMPACT_CLIENT(q)->base.local_peer_id, COMPACT_CLIENT(q->peer)->base.local_peer_id,
-                      q->rpc_last_sid, q->rpc_retry, MSG_REQ_MAX_RETRY, q->base.session_id);
+        if (r->retry >= MSG_RESP_MAX_RETRY) {
+            print("W:", LA_F("MSG_RESP gave up after %d retries, sid=%u (ses_id=%u)\n", LA_F88, 88),
+                  r->retry, r->sid, q->base.session_id);
 
-                if (g_compact_rpc_pending_head == q) return;
-            }
+            compact_rpc_release(r);
         }
         else {
+            r->retry++;
+            compact_send_msg_resp_to_requester(udp_fd, r);
+            r->sent_time = now;
+            enqueue_compact_rpc_pending(r);
 
-            if (q->rpc_retry >= MSG_RESP_MAX_RETRY) {
-                print("W:", LA_F("MSG_RESP gave up after %d retries, sid=%u (ses_id=%u)\n", LA_F88, 88),
-                      q->rpc_retry, q->rpc_last_sid, q->base.session_id);
-
-                q->rpc_pending_next = NULL;
-                q->rpc_responding = false;
-                q->rpc_retry = 0;
-            }
-            else {
-                q->rpc_retry++;
-                compact_send_msg_resp_to_requester(udp_fd, q);
-                q->rpc_sent_time = now;
-                enqueue_compact_rpc_pending(q);
-
-                print("V:", LA_F("MSG_RESP resent back to '%s', sid=%u, attempt %d/%d (ses_id=%u)\n", LA_F89, 89),
-                      COMPACT_CLIENT(q)->base.local_peer_id, q->rpc_last_sid, q->rpc_retry, MSG_RESP_MAX_RETRY, q->base.session_id);
-
-                if (g_compact_rpc_pending_head == q) return;
-            }
+            print("V:", LA_F("MSG_RESP resent back to '%s', sid=%u, attempt %d/%d (ses_id=%u)\n", LA_F89, 89),
+                  COMPACT_CLIENT(q)->base.local_peer_id, r->sid, r->retry, MSG_RESP_MAX_RETRY, q->base.session_id);
         }
-
-        if (!g_compact_rpc_pending_head) return;
     }
 }
 
 // 缓存响应数据并从 REQ 阶段转换到 RESP 阶段
-static void compact_transition_to_resp_pending(sock_t udp_fd, compact_session_t *requester, uint64_t now,
+static void compact_transition_to_resp_pending(sock_t udp_fd, compact_rpc_t *r, uint64_t now,
                                        uint8_t flags, uint8_t code, const uint8_t *data, int len) {
 
-    requester->rpc_responding = true;
-    requester->rpc_flags = flags;
-    requester->rpc_code = code;
-    requester->rpc_data_len = 0;
-    if (len > 0 && data) {
-        memcpy(requester->rpc_data, data, len);
-        requester->rpc_data_len = len;
+    // 缓冲区不足时无法保存 B 的响应，按转发超时回复 A（A 可重新发起）
+    if (!compact_rpc_store(r, data, len)) {
+        print("W:", "MSG_RESP: no rpc buffer, reporting timeout to '%s', sid=%u (ses_id=%u)\n",
+              COMPACT_CLIENT(r->cs)->base.local_peer_id, r->sid, r->cs->base.session_id);
+        flags |= SIG_MSG_FLAG_TIMEOUT;
+        compact_rpc_store(r, NULL, 0);
     }
-    requester->rpc_sent_time = now;
-    requester->rpc_retry = 0;
-    enqueue_compact_rpc_pending(requester);
-    compact_send_msg_resp_to_requester(udp_fd, requester);
+
+    r->responding = true;
+    r->flags = flags;
+    r->code = code;
+    r->sent_time = now;
+    r->retry = 0;
+    enqueue_compact_rpc_pending(r);
+    compact_send_msg_resp_to_requester(udp_fd, r);
 }
 
 //-----------------------------------------------------------------------------
@@ -2111,6 +3587,8 @@ static void compact_transition_to_resp_pending(sock_t udp_fd, compact_session_t
 // 检测地址变更并通知对端（所有已配对 session 均会发出通知）
 static bool check_addr_change(sock_t udp_fd, compact_client_t *client, const struct sockaddr_in *from) {
 
+    g_hot_client = &client->base;       // 各信令处理识别出客户端后均经此处
+
     if (memcmp(&client->addr, from, sizeof(*from)) == 0) return false;
 
     client->addr = *from;
@@ -2120,6 +3598,7 @@ static bool check_addr_change(sock_t udp_fd, compact_client_t *client, const str
         if (!PEER_ONLINE(cs)) continue;
 
         compact_session_t *peer = cs->peer;
+        compact_fwd_pair(cs);
 
         // 如果本端已收到过来自对端的 SYNC0
         if (peer->sync0_acked > 1) {
@@ -2172,46 +3651,163 @@ static compact_session_t* compact_find_session(compact_client_t *client, const c
     return NULL;
 }
 
-// 处理 COMPACT 模式信令（UDP 无状态，对应 p2p_signal_compact 模块）
-static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, struct sockaddr_in *from) {
-
-    if (len < 4) return;
-
-    p2p_packet_hdr_t *hdr = (p2p_packet_hdr_t *)buf;
-    uint8_t *payload = buf + 4; size_t payload_len = len - 4;
+// 处理 SYNC0 负载（去掉 auth_key 后的部分）：[remote_peer_id(32)][candidate_count(1)][candidates(N*23)]
+// + 单独的 SYNC0 与 ONLINE 捎带的 SYNC0 共用；调用方已校验 body_len >= P2P_PEER_ID_MAX + 1
+static void compact_sync0(sock_t udp_fd, compact_client_t *local_client, const uint8_t *body, size_t body_len,
+                          const struct sockaddr_in *from, const char *PROTO) {
 
     char from_str[64];
     snprintf(from_str, sizeof(from_str), "%s:%d", inet_ntoa(from->sin_addr), ntohs(from->sin_port));
 
-    switch (hdr->type) {
-    case SIG_PKT_ONLINE: { const char* PROTO = "ONLINE";
-
-        printf(LA_F("[UDP] %s recv from %s, seq=%u, flags=0x%02x, len=%zu\n", LA_F135, 135),
-               PROTO, from_str, ntohs(hdr->seq), hdr->flags, len);
+    const char *remote_peer_id = (const char *)body;
+
+    // 解析候选列表
+    int candidate_count = body[P2P_PEER_ID_MAX];
+    if (candidate_count > (int)MAX_CANDIDATES) candidate_count = MAX_CANDIDATES;
+    p2p_candidate_t candidates[MAX_CANDIDATES];
+    memset(candidates, 0, sizeof(candidates));
+    size_t cand_offset = P2P_PEER_ID_MAX + 1;
+    for (int i = 0; i < candidate_count && cand_offset + sizeof(p2p_candidate_t) <= body_len; i++) {
+        memcpy(&candidates[i], body + cand_offset, sizeof(p2p_candidate_t));
+        cand_offset += sizeof(p2p_candidate_t);
+    }
 
-        if (payload_len < SIG_PKT_ONLINE_PSZ) {
-            print("E:", LA_F("%s: bad payload(len=%zu)\n", LA_F42, 42), PROTO, payload_len);
-            return;
+    local_client->base.last_active = P_tick_ms();
+    check_addr_change(udp_fd, local_client, from);
+
+    // 查找或创建会话
+    compact_session_t *local = compact_find_session(local_client, remote_peer_id);
+    if (local) {
+        // 已有会话（同一 instance_id 的重传或自动重连）
+        // + 若上一个伙伴已死亡（peer==-1），清除标记，并重置 SYNC0 确认状态（让服务器可重新推送 SYNC0）
+        if (local->peer == (compact_session_t*)(void*)-1) {
+            local->peer = NULL;
+            local->sync0_acked = 0;         // 重置：SYNC0 握手状态
+            local->addr_notify_seq = 0;     // 重置地址变更序列号
+            print("I:", LA_F("%s: '%.*s' cleared stale peer marker, ready for re-pair\n", LA_F23, 23),
+                   PROTO, P2P_PEER_ID_MAX, local_client->base.local_peer_id);
+
+            // Case B：新对端已经发过 SYNC0 但被 skip（pair 里有等待中的 session）
+            // 先更新候选再配对，让对端拿到最新地址
+            if (!compact_set_candidates(local, candidates, candidate_count))
+                print("W:", "%s: candidate alloc failed, keeping %d old candidates\n", PROTO, local->candidate_count);
+
+            session_pair_t *pair = local->base.pair;
+            if (pair) {
+                for (int _i = 0; _i < 2; _i++) {
+                    compact_session_t *waiting = (compact_session_t*)pair->sessions[_i];
+                    if (waiting && waiting != local && waiting->peer == NULL) {
+                        local->peer = waiting; waiting->peer = local;
+                        compact_fwd_pair(local);
+                        print("I:", LA_F("%s: late-paired '%.*s' <-> '%.*s' (waiting session found)\n", LA_F54, 54),
+                              PROTO, P2P_PEER_ID_MAX, local_client->base.local_peer_id,
+                              P2P_PEER_ID_MAX, remote_peer_id);
+                        break;
+                    }
+                }
+            }
         }
+    } else {
 
-        uint32_t instance_id = 0;
-        nread_l(&instance_id, payload + P2P_PEER_ID_MAX);
-        if (instance_id == 0) {
-            print("E:", LA_F("%s: invalid instance_id=0 from %s\n", LA_F50, 50), PROTO, from_str);
+        session_t *local_s = NULL, *remote_s = NULL;
+        int side = build_session(&local_client->base, remote_peer_id,
+                                 &local_s, &remote_s, sizeof(compact_session_t));
+        if (side < 0 || !local_s) {
+            print("E:", LA_F("%s: build_session failed for '%.*s'\n", LA_F43, 43), PROTO, P2P_PEER_ID_MAX,
+                  local_client->base.local_peer_id);
+            return;
+        }
+        local = (compact_session_t*)local_s;
+
+        // 对端已经创建了会话，双向配对
+        // + peer==-1 表示对端会话的上一个伙伴已崩溃（e.g. SIGKILL），且对端从未重发 SYNC0 刷新候选
+        // + 此时不立即配对，等对端用新 instance_id 重新注册（或重发 SYNC0 清除标记）后再配对
+        if (remote_s) {
+            compact_session_t *remote_cs = (compact_session_t*)remote_s;
+            if (remote_cs->peer != (compact_session_t*)(void*)-1) {
+                local->peer = remote_cs; remote_cs->peer = local;
+                compact_fwd_pair(local);
+                print("I:", LA_F("%s: paired '%.*s' <-> '%.*s'\n", LA_F60, 60),
+                       PROTO, P2P_PEER_ID_MAX, local_client->base.local_peer_id,
+                       P2P_PEER_ID_MAX, remote_peer_id);
+            } else {
+                print("I:", LA_F("%s: skip pairing '%.*s' with stale '%.*s' (peer_died, awaiting re-register)\n", LA_F69, 69),
+                       PROTO, P2P_PEER_ID_MAX, local_client->base.local_peer_id,
+                       P2P_PEER_ID_MAX, remote_peer_id);
+            }
+        }
+    }
+
+    // 更新候选列表
+    if (!compact_set_candidates(local, candidates, candidate_count))
+        print("W:", "%s: candidate alloc failed, keeping %d old candidates\n", PROTO, local->candidate_count);
+
+    print("V:", LA_F("%s: auth_key=%" PRIu64 ", cands=%d from %s\n", LA_F37, 37),
+           PROTO, local_client->auth_key, candidate_count, from_str);
+
+    // 发送 SYNC0_ACK 并加入待确认队列（等待客户端二次确认）
+    compact_send_sync0_ack(udp_fd, from, remote_peer_id, local->base.session_id, PEER_ONLINE(local),
+                           local_client->base.instance_id);
+    if (local->sync0_acked == 0 && !timer_active(&local->sync0_timer)) {
+        enqueue_compact_sync0_pending(local, 0, local_client->base.last_active);
+    }
+
+    // 已配对，触发 SYNC0（仅在对方已二次确认 SYNC0_ACK 后才推送）
+    if (PEER_ONLINE(local)) {
+
+        compact_session_t *remote = local->peer;
+        if (local->sync0_acked == 1 && !timer_active(&local->sync0_timer)) {
+            compact_send_sync0(udp_fd, local, 0);
+            enqueue_compact_sync0_pending(local, 0, local_client->base.last_active);
+        }
+        if (remote->sync0_acked == 1 && !timer_active(&remote->sync0_timer)) {
+            compact_send_sync0(udp_fd, remote, 0);
+            enqueue_compact_sync0_pending(remote, 0, local_client->base.last_active);
+        }
+
+        print("I:", LA_F("SYNC0: candidates exchanged '%.*s'(%d) <-> '%.*s'(%d)\n", LA_F105, 105),
+               P2P_PEER_ID_MAX, local_client->base.local_peer_id, local->candidate_count,
+               P2P_PEER_ID_MAX, remote_peer_id, remote->candidate_count);
+    }
+}
+
+// 处理 COMPACT 模式信令（UDP 无状态，对应 p2p_signal_compact 模块）
+static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, struct sockaddr_in *from) {
+
+    if (len < 4) return;
+
+    p2p_packet_hdr_t *hdr = (p2p_packet_hdr_t *)buf;
+    uint8_t *payload = buf + 4; size_t payload_len = len - 4;
+
+    char from_str[64];
+    snprintf(from_str, sizeof(from_str), "%s:%d", inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+
+    switch (hdr->type) {
+    case SIG_PKT_ONLINE: { const char* PROTO = "ONLINE";
+
+        printf(LA_F("[UDP] %s recv from %s, seq=%u, flags=0x%02x, len=%zu\n", LA_F135, 135),
+               PROTO, from_str, ntohs(hdr->seq), hdr->flags, len);
+
+        if (payload_len < SIG_PKT_ONLINE_PSZ) {
+            print("E:", LA_F("%s: bad payload(len=%zu)\n", LA_F42, 42), PROTO, payload_len);
+            return;
+        }
+
+        uint32_t instance_id = 0;
+        nread_l(&instance_id, payload + P2P_PEER_ID_MAX);
+        if (instance_id == 0) {
+            print("E:", LA_F("%s: invalid instance_id=0 from %s\n", LA_F50, 50), PROTO, from_str);
             return;
         }
 
         const char *local_peer_id = (const char *)payload;
 
-        // 扫描客户端数组，查找匹配的 local_peer_id
+        // 捎带的首个 SYNC0（集群模式下配对会话可能归属其他节点，不受理，由客户端单独发送 SYNC0 经路由转交）
+        bool sync0 = (hdr->flags & SIG_ONLINE_FLAG_SYNC0) && payload_len >= SIG_PKT_ONLINE_SYNC0_PSZ(0) && !g_cluster_n;
+
+        // 按 local_peer_id 查找已登录客户端（instance_id 用于区分重传与客户端重启）
         compact_client_t *existing = NULL;
-        for (int i = 0; i < MAX_PEERS; i++) {
-            if (g_compact_clients[i].base.valid &&
-                memcmp(g_compact_clients[i].base.local_peer_id, local_peer_id, P2P_PEER_ID_MAX) == 0) {
-                existing = &g_compact_clients[i];
-                break;
-            }
-        }
+        HASH_FIND(hh_name, g_compact_clients_by_name, local_peer_id, P2P_PEER_ID_MAX, existing);
 
         // 重传（instance_id 相同）：幂等响应
         if (existing && existing->base.instance_id == instance_id) {
@@ -2219,53 +3815,54 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
             check_addr_change(udp_fd, existing, from);
             existing->base.last_active = P_tick_ms();
 
-            compact_send_online_ack(udp_fd, from, existing->auth_key, instance_id);
+            compact_send_online_ack(udp_fd, from, existing->auth_key, instance_id, existing->alive_s, sync0);
+            if (sync0) compact_sync0(udp_fd, existing, payload + SIG_PKT_ONLINE_PSZ, payload_len - SIG_PKT_ONLINE_PSZ, from, PROTO);
             return;
         }
 
         print("V:", LA_F("%s: accepted, local='%.*s', inst_id=%u\n", LA_F30, 30),
                PROTO, P2P_PEER_ID_MAX, local_peer_id, instance_id);
 
-        // 找空位或复用现有槽（instance_id 变更 = 客户端重启）
-        compact_client_t *client = existing;
-        if (!client) {
-            for (int i = 0; i < MAX_PEERS; i++) {
-                if (!g_compact_clients[i].base.valid) {
-                    client = &g_compact_clients[i];
-                    break;
-                }
-            }
-        }
-
-        // 无可用槽位
-        if (!client) {
-            compact_send_online_ack(udp_fd, from, 0, instance_id);
-            return;
-        }
-
-        // 新 instance_id：重置旧会话
+        // 新 instance_id（客户端重启）：重置旧会话，释放的槽位随即被复用
         if (existing) {
             print("I:", LA_F("%s from '%.*s': new instance(old=%u new=%u), resetting\n", LA_F19, 19),
                    PROTO, P2P_PEER_ID_MAX, local_peer_id, existing->base.instance_id, instance_id);
             compact_clear_client(udp_fd, existing);
         }
 
+        // 从客户端池分配槽位；无可用槽位（或 auth_key 索引无法扩容）时回复 auth_key=0 拒绝
+        compact_client_t *client = flat_index_reserve(&g_compact_auth_index, 1) < 0 ? NULL
+                                 : (compact_client_t*)pool_alloc(&g_compact_pool);
+        if (!client) {
+            compact_send_online_ack(udp_fd, from, 0, instance_id, 0, false);
+            return;
+        }
+
         // 初始化客户端槽位
         client->base.valid = true;
         memcpy(client->base.local_peer_id, local_peer_id, P2P_PEER_ID_MAX);
         client->base.instance_id = instance_id;
         client->base.last_active = P_tick_ms();
         client->base.sessions = NULL;
+        client->base.rx_pkts = client->base.rx_bytes = 0;
         client->addr = *from;
+        client->cluster = NULL;
+        client->bind_life_s = 0;
+        client->alive_s = compact_alive_interval(client);
+        timer_add(&client->base.idle_timer, client->base.last_active + compact_idle_timeout_ms(client) + 1, compact_idle_expire);
 
         // 生成 auth_key 并加入哈希表
-        do { client->auth_key = P_rand64(); } while (!client->auth_key);
-        HASH_ADD(hh_client, g_compact_clients_by_auth, auth_key, sizeof(uint64_t), client);
+        do { client->auth_key = P_rand64(); } while (!client->auth_key || COMPACT_FIND_BY_AUTH(client->auth_key));
+        flat_index_put(&g_compact_auth_index, client->auth_key, client);  // 已预留容量，不会失败
+        HASH_ADD(hh_name, g_compact_clients_by_name, base.local_peer_id, P2P_PEER_ID_MAX, client);
 
-        compact_send_online_ack(udp_fd, from, client->auth_key, instance_id);
+        compact_send_online_ack(udp_fd, from, client->auth_key, instance_id, client->alive_s, sync0);
 
         print("V:", LA_F("%s: auth_key=%" PRIu64 " assigned for '%.*s'\n", LA_F36, 36),
                PROTO, client->auth_key, P2P_PEER_ID_MAX, local_peer_id);
+
+        // 登录与配对一步完成：ONLINE_ACK 之后紧跟 SYNC0_ACK
+        if (sync0) compact_sync0(udp_fd, client, payload + SIG_PKT_ONLINE_PSZ, payload_len - SIG_PKT_ONLINE_PSZ, from, PROTO);
     } break;
 
     // SIG_PKT_OFFLINE: [auth_key(SIG_AUTH_KEY_PSZ)]
@@ -2287,7 +3884,7 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
         }
 
         compact_client_t *client = NULL;
-        HASH_FIND(hh_client, g_compact_clients_by_auth, &auth_key, sizeof(uint64_t), client);
+        client = COMPACT_FIND_BY_AUTH(auth_key);
 
         if (client) {
             print("V:", LA_F("%s: accepted, releasing slot for '%s'\n", LA_F31, 31),
@@ -2296,7 +3893,7 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
         }
     } break;
 
-    // SIG_PKT_ALIVE: [auth_key(SIG_AUTH_KEY_PSZ)]
+    // SIG_PKT_ALIVE: [auth_key(SIG_AUTH_KEY_PSZ)][bind_life_s(2)，可选]
     case SIG_PKT_ALIVE: { const char* PROTO = "ALIVE";
 
         printf(LA_F("[UDP] %s recv from %s, seq=%u, flags=0x%02x, len=%zu\n", LA_F135, 135),
@@ -2310,7 +3907,7 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
         uint64_t auth_key = nget_ll(payload);
 
         compact_client_t *client = NULL;
-        HASH_FIND(hh_client, g_compact_clients_by_auth, &auth_key, sizeof(uint64_t), client);
+        client = COMPACT_FIND_BY_AUTH(auth_key);
         if (client) {
 
             print("V:", LA_F("%s accepted, peer='%s', auth_key=%" PRIu64 "\n", LA_F14, 14),
@@ -2319,10 +3916,15 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
             client->base.last_active = P_tick_ms();
             check_addr_change(udp_fd, client, from);
 
+            // 按当前负载与客户端报告的绑定存活期更新建议间隔，随 ACK 下发
+            if (payload_len >= SIG_PKT_ALIVE_EXT_PSZ) nread_s(&client->bind_life_s, payload + SIG_AUTH_KEY_PSZ);
+            client->alive_s = compact_alive_interval(client);
+
             {   const char* ACK_PROTO = "ALIVE_ACK";
 
-                uint8_t ack[4];
+                uint8_t ack[sizeof(p2p_packet_hdr_t) + SIG_PKT_ALIVE_ACK_EXT_PSZ];
                 p2p_pkt_hdr_encode(ack, SIG_PKT_ALIVE_ACK, 0, 0);
+                nwrite_s(ack + sizeof(p2p_packet_hdr_t), client->alive_s);
 
                 print("V:", LA_F("Send %s: auth_key=%" PRIu64 ", peer='%s'\n", LA_F108, 108),
                       ACK_PROTO, auth_key, client->base.local_peer_id);
@@ -2354,121 +3956,13 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
         }
 
         compact_client_t *local_client = NULL;
-        HASH_FIND(hh_client, g_compact_clients_by_auth, &auth_key, sizeof(uint64_t), local_client);
+        local_client = COMPACT_FIND_BY_AUTH(auth_key);
         if (!local_client) {
             print("W:", LA_F("%s: unknown auth_key=%" PRIu64 " from %s\n", LA_F70, 70), PROTO, auth_key, from_str);
             return;
         }
 
-        const char *remote_peer_id = (const char *)(payload + sizeof(uint64_t));
-
-        // 解析候选列表
-        int candidate_count = (uint8_t)payload[sizeof(uint64_t) + P2P_PEER_ID_MAX];
-        if (candidate_count > (int)MAX_CANDIDATES) candidate_count = MAX_CANDIDATES;
-        p2p_candidate_t candidates[MAX_CANDIDATES];
-        memset(candidates, 0, sizeof(candidates));
-        size_t cand_offset = sizeof(uint64_t) + P2P_PEER_ID_MAX + 1;
-        for (int i = 0; i < candidate_count && cand_offset + sizeof(p2p_candidate_t) <= payload_len; i++) {
-            memcpy(&candidates[i], payload + cand_offset, sizeof(p2p_candidate_t));
-            cand_offset += sizeof(p2p_candidate_t);
-        }
-
-        local_client->base.last_active = P_tick_ms();
-        check_addr_change(udp_fd, local_client, from);
-
-        // 查找或创建会话
-        compact_session_t *local = compact_find_session(local_client, remote_peer_id);
-        if (local) {
-            // 已有会话（同一 instance_id 的重传或自动重连）
-            // + 若上一个伙伴已死亡（peer==-1），清除标记，并重置 SYNC0 确认状态（让服务器可重新推送 SYNC0）
-            if (local->peer == (compact_session_t*)(void*)-1) {
-                local->peer = NULL;
-                local->sync0_acked = 0;         // 重置：SYNC0 握手状态
-                local->addr_notify_seq = 0;     // 重置地址变更序列号
-                print("I:", LA_F("%s: '%.*s' cleared stale peer marker, ready for re-pair\n", LA_F23, 23),
-                       PROTO, P2P_PEER_ID_MAX, local_client->base.local_peer_id);
-
-                // Case B：新对端已经发过 SYNC0 但被 skip（pair 里有等待中的 session）
-                // 先更新候选再配对，让对端拿到最新地址
-                local->candidate_count = candidate_count;
-                if (candidate_count) memcpy(local->candidates, candidates, sizeof(p2p_candidate_t) * candidate_count);
-
-                session_pair_t *pair = local->base.pair;
-                if (pair) {
-                    for (int _i = 0; _i < 2; _i++) {
-                        compact_session_t *waiting = (compact_session_t*)pair->sessions[_i];
-                        if (waiting && waiting != local && waiting->peer == NULL) {
-                            local->peer = waiting; waiting->peer = local;
-                            print("I:", LA_F("%s: late-paired '%.*s' <-> '%.*s' (waiting session found)\n", LA_F54, 54),
-                                  PROTO, P2P_PEER_ID_MAX, local_client->base.local_peer_id,
-                                  P2P_PEER_ID_MAX, remote_peer_id);
-                            break;
-                        }
-                    }
-                }
-            }
-        } else {
-
-            session_t *local_s = NULL, *remote_s = NULL;
-            int side = build_session(&local_client->base, remote_peer_id,
-                                     &local_s, &remote_s, sizeof(compact_session_t));
-            if (side < 0 || !local_s) {
-                print("E:", LA_F("%s: build_session failed for '%.*s'\n", LA_F43, 43), PROTO, P2P_PEER_ID_MAX,
-                      local_client->base.local_peer_id);
-                return;
-            }
-            local = (compact_session_t*)local_s;
-
-            // 对端已经创建了会话，双向配对
-            // + peer==-1 表示对端会话的上一个伙伴已崩溃（e.g. SIGKILL），且对端从未重发 SYNC0 刷新候选
-            // + 此时不立即配对，等对端用新 instance_id 重新注册（或重发 SYNC0 清除标记）后再配对
-            if (remote_s) {
-                compact_session_t *remote_cs = (compact_session_t*)remote_s;
-                if (remote_cs->peer != (compact_session_t*)(void*)-1) {
-                    local->peer = remote_cs; remote_cs->peer = local;
-                    print("I:", LA_F("%s: paired '%.*s' <-> '%.*s'\n", LA_F60, 60),
-                           PROTO, P2P_PEER_ID_MAX, local_client->base.local_peer_id,
-                           P2P_PEER_ID_MAX, remote_peer_id);
-                } else {
-                    print("I:", LA_F("%s: skip pairing '%.*s' with stale '%.*s' (peer_died, awaiting re-register)\n", LA_F69, 69),
-                           PROTO, P2P_PEER_ID_MAX, local_client->base.local_peer_id,
-                           P2P_PEER_ID_MAX, remote_peer_id);
-                }
-            }
-        }
-
-        // 更新候选列表
-        local->candidate_count = candidate_count;
-        if (candidate_count) {
-            memcpy(local->candidates, candidates, sizeof(p2p_candidate_t) * candidate_count);
-        }
-
-        print("V:", LA_F("%s: auth_key=%" PRIu64 ", cands=%d from %s\n", LA_F37, 37),
-               PROTO, auth_key, candidate_count, from_str);
-
-        // 发送 SYNC0_ACK 并加入待确认队列（等待客户端二次确认）
-        compact_send_sync0_ack(udp_fd, from, remote_peer_id, local->base.session_id, PEER_ONLINE(local));
-        if (local->sync0_acked == 0 && !local->sync0_pending_next) {
-            enqueue_compact_sync0_pending(local, 0, local_client->base.last_active);
-        }
-
-        // 已配对，触发 SYNC0（仅在对方已二次确认 SYNC0_ACK 后才推送）
-        if (PEER_ONLINE(local)) {
-
-            compact_session_t *remote = local->peer;
-            if (local->sync0_acked == 1 && !local->sync0_pending_next) {
-                compact_send_sync0(udp_fd, local, 0);
-                enqueue_compact_sync0_pending(local, 0, local_client->base.last_active);
-            }
-            if (remote->sync0_acked == 1 && !remote->sync0_pending_next) {
-                compact_send_sync0(udp_fd, remote, 0);
-                enqueue_compact_sync0_pending(remote, 0, local_client->base.last_active);
-            }
-
-            print("I:", LA_F("SYNC0: candidates exchanged '%.*s'(%d) <-> '%.*s'(%d)\n", LA_F105, 105),
-                   P2P_PEER_ID_MAX, local_client->base.local_peer_id, local->candidate_count,
-                   P2P_PEER_ID_MAX, remote_peer_id, remote->candidate_count);
-        }
+        compact_sync0(udp_fd, local_client, payload + SIG_AUTH_KEY_PSZ, payload_len - SIG_AUTH_KEY_PSZ, from, PROTO);
     } break;
 
     // SIG_PKT_SYNC0_ACK（client→server）
@@ -2486,7 +3980,7 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
 
         uint32_t session_id = nget_l(payload);
         session_t *_s = NULL;
-        HASH_FIND(hh_session, g_sessions, &session_id, sizeof(uint32_t), _s);
+        _s = SESSION_FIND(session_id);
         compact_session_t *cs = (compact_session_t*)_s;
 
         if (cs) {
@@ -2498,17 +3992,15 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
                 cs->sync0_acked = 1;
 
                 // 从 SYNC0_ACK 待确认队列中移除
-                if (cs->sync0_pending_next) {
-                    remove_compact_sync0_pending(cs);
-                }
+                compact_sync0_rtt_sample(cs, P_tick_ms());
+                remove_compact_sync0_pending(cs);
                 cs->sync0_retry = 0;
-                cs->sync0_sent_time = 0;
 
                 print("V:", LA_F("%s: 2nd-ack confirmed '%s' (ses_id=%u)\n", LA_F26, 26),
                        PROTO, COMPACT_CLIENT(cs)->base.local_peer_id, session_id);
 
                 // 二次确认后，若已配对则触发 SYNC0 推送
-                if (PEER_ONLINE(cs) && !cs->sync0_pending_next) {
+                if (PEER_ONLINE(cs) && !timer_active(&cs->sync0_timer)) {
                     compact_send_sync0(udp_fd, cs, 0);
                     enqueue_compact_sync0_pending(cs, 0, P_tick_ms());
                 }
@@ -2520,15 +4012,17 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
 
                     print("V:", LA_F("%s: confirmed '%s', retries=%d (ses_id=%u)\n", LA_F46, 46),
                            PROTO, COMPACT_CLIENT(cs)->base.local_peer_id, cs->sync0_retry, session_id);
-                }
 
-                if (cs->sync0_pending_next) {
-                    remove_compact_sync0_pending(cs);
+                    if (cs->sync0_base_index == 0) compact_sync0_rtt_sample(cs, P_tick_ms());
+
+                    // 后确认的一端到达：双方都已拿到对端候选，下发同时起跑提示
+                    if (PEER_ONLINE(cs) && cs->peer->sync0_acked == 2) compact_punch_at(udp_fd, cs);
                 }
 
+                remove_compact_sync0_pending(cs);
+
                 cs->sync0_base_index = 0;
                 cs->sync0_retry = 0;
-                cs->sync0_sent_time = 0;
 
                 // 有延期的地址变更通知，立即发送
                 if (cs->addr_notify_seq != 0) {
@@ -2559,13 +4053,14 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
 
         uint32_t session_id = nget_l(payload);
         uint16_t ack_seq = ntohs(hdr->seq);
-        if (ack_seq > 16) {
+        // 增量 SYNC 的确认：seq 为版本号（1..255），与普通 ack_seq≠0 一样转发
+        if (ack_seq > 16 && !(hdr->flags & SIG_SYNC_FLAG_DELTA)) {
             print("E:", LA_F("%s: invalid seq=%u\n", LA_F52, 52), PROTO, ack_seq);
             return;
         }
 
         session_t *_s = NULL;
-        HASH_FIND(hh_session, g_sessions, &session_id, sizeof(uint32_t), _s);
+        _s = SESSION_FIND(session_id);
         compact_session_t *cs = (compact_session_t*)_s;
 
         print("V:", LA_F("%s accepted, seq=%u, ses_id=%u\n", LA_F15, 15),
@@ -2577,13 +4072,10 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
             if (cs) {
                 check_addr_change(udp_fd, COMPACT_CLIENT(cs), from);
 
-                if (cs->sync0_pending_next) {
-                    remove_compact_sync0_pending(cs);
-                }
+                remove_compact_sync0_pending(cs);
 
                 cs->sync0_base_index = 0;
                 cs->sync0_retry = 0;
-                cs->sync0_sent_time = 0;
 
                 print("V:", LA_F("%s: addr-notify confirmed '%s' (ses_id=%u)\n", LA_F35, 35),
                        PROTO, COMPACT_CLIENT(cs)->base.local_peer_id, session_id);
@@ -2598,9 +4090,7 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
 
                 nwrite_l((uint8_t *)payload, cs->peer->base.session_id);
 
-                sendto(udp_fd, (const char *)buf, 4 + payload_len, 0,
-                       (struct sockaddr *)&COMPACT_CLIENT(cs->peer)->addr,
-                       sizeof(COMPACT_CLIENT(cs->peer)->addr));
+                udp_queue(udp_fd, PROTO, buf, (int)(4 + payload_len), &COMPACT_CLIENT(cs->peer)->addr);
 
                 print("V:", LA_F("Relay %s seq=%u: '%s' -> '%s' (ses_id=%u)\n", LA_F101, 101),
                        PROTO, ack_seq, COMPACT_CLIENT(cs)->base.local_peer_id,
@@ -2615,6 +4105,7 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
     case P2P_PKT_DATA:
     case P2P_PKT_ACK:
     case P2P_PKT_CRYPTO:
+    case P2P_PKT_DGRAM:
     case P2P_PKT_CONN:
     case P2P_PKT_CONN_ACK:
     case P2P_PKT_REACH:
@@ -2623,6 +4114,7 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
                   (hdr->type == P2P_PKT_DATA) ? "RELAY-DATA" :
                   (hdr->type == P2P_PKT_ACK) ? "RELAY-ACK" :
                   (hdr->type == P2P_PKT_CRYPTO) ? "RELAY-CRYPTO" :
+                  (hdr->type == P2P_PKT_DGRAM) ? "RELAY-DGRAM" :
                   (hdr->type == SIG_PKT_SYNC) ? "SYNC" :
                   (hdr->type == P2P_PKT_CONN) ? "RELAY-CONN" :
                   (hdr->type == P2P_PKT_CONN_ACK) ? "RELAY-CONN_ACK" : "RELAY-REACH");
@@ -2632,6 +4124,7 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
         const char* PROTO = (hdr->type == P2P_PKT_DATA) ? "RELAY-DATA" :
                            (hdr->type == P2P_PKT_ACK) ? "RELAY-ACK" :
                            (hdr->type == P2P_PKT_CRYPTO) ? "RELAY-CRYPTO" :
+                           (hdr->type == P2P_PKT_DGRAM) ? "RELAY-DGRAM" :
                            (hdr->type == SIG_PKT_SYNC) ? "SYNC" :
                            (hdr->type == P2P_PKT_CONN) ? "RELAY-CONN" :
                            (hdr->type == P2P_PKT_CONN_ACK) ? "RELAY-CONN_ACK" : "RELAY-REACH";
@@ -2652,7 +4145,7 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
         uint32_t session_id = nget_l(payload);
 
         session_t *_s = NULL;
-        HASH_FIND(hh_session, g_sessions, &session_id, sizeof(uint32_t), _s);
+        _s = SESSION_FIND(session_id);
         compact_session_t *cs = (compact_session_t*)_s;
         if (!cs) {
             print("W:", LA_F("[Relay] %s for unknown ses_id=%u (dropped)\n", LA_F124, 124), PROTO, session_id);
@@ -2671,9 +4164,7 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
 
         nwrite_l((uint8_t *)payload, cs->peer->base.session_id);
 
-        sendto(udp_fd, (const char *)buf, 4 + payload_len, 0,
-               (struct sockaddr *)&COMPACT_CLIENT(cs->peer)->addr,
-               sizeof(COMPACT_CLIENT(cs->peer)->addr));
+        udp_queue(udp_fd, PROTO, buf, (int)(4 + payload_len), &COMPACT_CLIENT(cs->peer)->addr);
 
         if (hdr->type == SIG_PKT_SYNC || hdr->type == P2P_PKT_REACH ||
             hdr->type == P2P_PKT_DATA || hdr->type == P2P_PKT_CRYPTO) {
@@ -2721,7 +4212,7 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
         const uint8_t *msg_data = payload + 7;
 
         session_t *_s = NULL;
-        HASH_FIND(hh_session, g_sessions, &session_id, sizeof(uint32_t), _s);
+        _s = SESSION_FIND(session_id);
         compact_session_t *requester = (compact_session_t*)_s;
         if (!requester) {
             print("W:", LA_F("%s: requester not found for ses_id=%u\n", LA_F65, 65), PROTO, session_id);
@@ -2742,54 +4233,49 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
 
         check_addr_change(udp_fd, COMPACT_CLIENT(requester), from);
 
-        if (requester->rpc_pending_next) {
+        compact_rpc_t *r = compact_rpc_find(requester, sid);
+        if (r) {
 
-            if (sid == requester->rpc_last_sid) {
+            if (!r->responding) {
 
-                if (!requester->rpc_responding) {
+                compact_send_msg_req_ack(udp_fd, from, requester->base.session_id, sid, 0);
 
-                    compact_send_msg_req_ack(udp_fd, from, requester->base.session_id, sid, 0);
-
-                    print("V:", LA_F("%s retransmit, resend ACK, sid=%u (ses_id=%u)\n", LA_F22, 22),
-                          PROTO, sid, requester->base.session_id);
-                }
-                else {
-                    print("V:", LA_F("%s retransmit during RESP phase, ignoring, sid=%u (ses_id=%u)\n", LA_F21, 21),
-                          PROTO, sid, requester->base.session_id);
-                }
-                return;
+                print("V:", LA_F("%s retransmit, resend ACK, sid=%u (ses_id=%u)\n", LA_F22, 22),
+                      PROTO, sid, requester->base.session_id);
             }
-
-            if (!uint16_circle_newer(sid, requester->rpc_last_sid)) {
-                print("V:", LA_F("%s: obsolete sid=%u (current=%u), ignoring\n", LA_F58, 58),
-                      PROTO, sid, requester->rpc_last_sid);
-                return;
+            else {
+                print("V:", LA_F("%s retransmit during RESP phase, ignoring, sid=%u (ses_id=%u)\n", LA_F21, 21),
+                      PROTO, sid, requester->base.session_id);
             }
-
-            print("I:", LA_F("%s new sid=%u > pending sid=%u (responding=%d), canceling old RPC (ses_id=%u)\n", LA_F20, 20),
-                  PROTO, sid, requester->rpc_last_sid, requester->rpc_responding, requester->base.session_id);
-
-            remove_compact_rpc_pending(requester);
+            return;
         }
 
-        if (requester->rpc_last_sid != 0 && !uint16_circle_newer(sid, requester->rpc_last_sid)) {
+        // 去重（允许窗口内乱序到达的较小 sid）；先试探再提交，缓冲区不足时不记为已接受
+        uint16_t last_sid = requester->rpc_last_sid; uint32_t seen = requester->rpc_seen;
+        if (!p2p_rpc_sid_accept(&last_sid, &seen, sid)) {
             print("V:", LA_F("%s: obsolete sid=%u (last=%u) in IDLE state, ignoring\n", LA_F59, 59),
                   PROTO, sid, requester->rpc_last_sid);
             return;
         }
 
-        requester->rpc_last_sid = sid;
-        requester->rpc_responding = false;
-        requester->rpc_code = msg;
-        requester->rpc_data_len = msg_data_len;
-        if (msg_data_len > 0) memcpy(requester->rpc_data, msg_data, msg_data_len);
+        // 槽位或缓冲区不足：不确认，由 A 重传
+        if (!(r = compact_rpc_take(requester, sid)) || !compact_rpc_store(r, msg_data, msg_data_len)) {
+            print("W:", "%s: no rpc buffer, dropping sid=%u (ses_id=%u)\n", PROTO, sid, requester->base.session_id);
+            if (r) compact_rpc_release(r);
+            return;
+        }
+
+        requester->rpc_last_sid = last_sid;
+        requester->rpc_seen = seen;
+        r->responding = false;
+        r->code = msg;
 
         compact_send_msg_req_ack(udp_fd, from, requester->base.session_id, sid, 0);
 
-        requester->rpc_sent_time = P_tick_ms();
-        requester->rpc_retry = 0;
-        enqueue_compact_rpc_pending(requester);
-        compact_send_msg_req_to_peer(udp_fd, requester);
+        r->sent_time = P_tick_ms();
+        r->retry = 0;
+        enqueue_compact_rpc_pending(r);
+        compact_send_msg_req_to_peer(udp_fd, r);
 
         print("I:", LA_F("%s forwarded: '%s' -> '%s', sid=%u, msg=%u (ses_id=%u)\n", LA_F18, 18),
                PROTO, COMPACT_CLIENT(requester)->base.local_peer_id,
@@ -2823,7 +4309,7 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
         }
 
         session_t *_s = NULL;
-        HASH_FIND(hh_session, g_sessions, &session_id, sizeof(uint32_t), _s);
+        _s = SESSION_FIND(session_id);
         compact_session_t *responder = (compact_session_t*)_s;
         if (!responder) {
             print("W:", LA_F("%s: unknown session_id=%u\n", LA_F71, 71), PROTO, session_id);
@@ -2849,14 +4335,14 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
 
         compact_session_t *requester = responder->peer;
 
-        if (!requester->rpc_pending_next || requester->rpc_responding || requester->rpc_last_sid != sid) {
+        compact_rpc_t *r = compact_rpc_find(requester, sid);
+        if (!r || r->responding) {
             print("W:", LA_F("%s: no matching pending msg (sid=%u, expected=%u)\n", LA_F57, 57),
                   PROTO, sid, requester->rpc_last_sid);
             return;
         }
 
-        remove_compact_rpc_pending(requester);
-        compact_transition_to_resp_pending(udp_fd, requester, P_tick_ms(), 0, resp_code, resp_data, resp_len);
+        compact_transition_to_resp_pending(udp_fd, r, P_tick_ms(), 0, resp_code, resp_data, resp_len);
 
         print("I:", LA_F("%s forwarded: '%s' -> '%s', sid=%u (ses_id=%u)\n", LA_F17, 17),
               PROTO, COMPACT_CLIENT(responder)->base.local_peer_id,
@@ -2888,21 +4374,20 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
                PROTO, session_id, sid);
 
         session_t *_s = NULL;
-        HASH_FIND(hh_session, g_sessions, &session_id, sizeof(uint32_t), _s);
+        _s = SESSION_FIND(session_id);
         compact_session_t *requester = (compact_session_t*)_s;
         if (!requester) {
             print("W:", LA_F("%s: unknown session_id=%u\n", LA_F71, 71), PROTO, session_id);
             return;
         }
 
-        if (!requester->rpc_responding || requester->rpc_last_sid != sid) {
+        compact_rpc_t *r = compact_rpc_find(requester, sid);
+        if (!r || !r->responding) {
             print("V:", LA_F("%s: no matching pending msg (sid=%u)\n", LA_F56, 56), PROTO, sid);
             return;
         }
 
-        remove_compact_rpc_pending(requester);
-        requester->rpc_responding = false;
-        requester->rpc_retry = 0;
+        compact_rpc_release(r);
 
         print("I:", LA_F("%s: RPC complete for '%s', sid=%u (ses_id=%u)\n", LA_F29, 29),
                PROTO, COMPACT_CLIENT(requester)->base.local_peer_id, sid, requester->base.session_id);
@@ -2914,22 +4399,401 @@ static void handle_compact_signaling(sock_t udp_fd, uint8_t *buf, size_t len, st
     } // switch
 }
 
-// 清理过期的 COMPACT 模式客户端（超时未活跃）
-static void cleanup_compact_clients(sock_t udp_fd) {
+// COMPACT 数据报分发：已配对会话的中继数据包查转发表直接转发，其余进入完整信令分发
+static void compact_udp_dispatch(sock_t udp_fd, uint8_t *buf, size_t len, struct sockaddr_in *from) {
+
+    g_metrics.udp_pkts[buf[0]]++;
+    if (len >= 4 + P2P_SESS_ID_PSZ && (buf[1] & P2P_FLAG_SESSION)) {
+        switch (buf[0]) {
+        case P2P_PKT_DATA: case P2P_PKT_ACK: case P2P_PKT_CRYPTO: case P2P_PKT_DGRAM:
+        case P2P_PKT_CONN: case P2P_PKT_CONN_ACK: case P2P_PKT_REACH: {
+            compact_fwd_t *e = compact_fwd_find(nget_l(buf + 4));
+            if (e && e->src.sin_addr.s_addr == from->sin_addr.s_addr && e->src.sin_port == from->sin_port) {
+                nwrite_l(buf + 4, e->peer_session_id);
+                udp_queue(udp_fd, "RELAY", buf, (int)len, &e->dst);
+                g_compact_fwd_pkts++;
+                g_metrics.compact_fwd_bytes += len;
+                g_hot_client = e->client;
+                e->client->rx_pkts++;
+                e->client->rx_bytes += len;
+                return;
+            }
+        } break;
+        default: break;
+        }
+    }
+    handle_compact_signaling(udp_fd, buf, len, from);
+}
+
+//-----------------------------------------------------------------------------
+// 准入控制：按源 IP / auth_key 的令牌桶限流（--rate-limit）
+
+/* 只对代价高的请求（ONLINE / SYNC0 / MSG_REQ、RELAY 建连）计费；会话数据与 ALIVE 不受限
+ * + 桶表为 4 路组相联的定长哈希（RATE_SETS 组），查找 / 插入 O(1)；组满时淘汰最久未访问的一项
+ *   （淘汰即遗忘：被挤出的源重新从满桶开始，表只需容纳"当前活跃"的源）
+ * + 令牌以千分之一为单位整数计算：每毫秒补充 rate 个单位，上限为 2 倍速率（突发）
+ * + 超限的 ONLINE 回复携带退避提示的 ONLINE_ACK（SIG_ONACK_FLAG_BACKOFF），其余请求直接丢弃（由客户端重传）
+ */
+#define RATE_WAYS                   4
+#define RATE_SETS                   2048
+
+typedef struct rate_entry {
+    uint64_t                        key;                        // 0 = 空
+    uint32_t                        tokens;                     // 剩余令牌（千分之一）
+    uint32_t                        stamp;                      // 上次补充时间（毫秒，低 32 位；兼作 LRU 时间）
+} rate_entry_t;
+
+typedef struct rate_table {
+    rate_entry_t                    sets[RATE_SETS][RATE_WAYS];
+    uint64_t                        limited;                    // 超限次数（指标）
+} rate_table_t;
+
+static rate_table_t*                g_rate_ip = NULL;           // 按源 IP（--rate-limit 启用时分配）
+static rate_table_t*                g_rate_auth = NULL;         // 按 auth_key
+
+// 扣除一个令牌：返回 0 表示放行，否则为距下一个令牌可用的毫秒数
+static uint32_t rate_take(rate_table_t *t, uint64_t key, uint64_t now_ms) {
+
+    uint32_t rate = (uint32_t)ARGS_rate_limit.i64, cap = rate * 2000, now = (uint32_t)now_ms;
+    rate_entry_t *set = t->sets[((key * 0x9E3779B97F4A7C15ull) >> 53) & (RATE_SETS - 1)], *e = NULL;
+    for (int i = 0; i < RATE_WAYS && !e; i++) if (set[i].key == key) e = &set[i];
+    if (!e) {   // 新来源：占用空项，或淘汰组内最久未访问的一项
+        e = &set[0];
+        for (int i = 1; i < RATE_WAYS && e->key; i++)
+            if (!set[i].key || (uint32_t)(now - set[i].stamp) > (uint32_t)(now - e->stamp)) e = &set[i];
+        e->key = key; e->tokens = cap;
+    }
+    else {
+        uint64_t add = (uint64_t)(uint32_t)(now - e->stamp) * rate;
+        e->tokens = add >= cap - e->tokens ? cap : e->tokens + (uint32_t)add;
+    }
+    e->stamp = now;
+
+    if (e->tokens >= 1000) { e->tokens -= 1000; return 0; }
+    t->limited++;
+    return (1000 - e->tokens + rate - 1) / rate;
+}
+
+static inline uint32_t rate_take_ip(const struct sockaddr_in *from, uint64_t now) {
+    return g_rate_ip ? rate_take(g_rate_ip, (1ull << 32) | from->sin_addr.s_addr, now) : 0;
+}
+
+// COMPACT 请求准入：返回 false 表示已限流（本包不再处理）
+static bool compact_admit(sock_t udp_fd, const uint8_t *buf, size_t len, const struct sockaddr_in *from) {
+
+    uint8_t type = buf[0];
+    if (type != SIG_PKT_ONLINE && type != SIG_PKT_SYNC0 && type != SIG_PKT_MSG_REQ) return true;
 
     uint64_t now = P_tick_ms();
-    for (int i = 0; i < MAX_PEERS; i++) {
-        if (!g_compact_clients[i].base.valid) continue;
-        if (tick_diff(now, g_compact_clients[i].base.last_active) <= COMPACT_PAIR_TIMEOUT_S * 1000) continue;
+    uint32_t wait = rate_take_ip(from, now);
+    if (!wait && type != SIG_PKT_ONLINE && len >= 4 + SIG_AUTH_KEY_PSZ) {
+        uint64_t auth_key = nget_ll(buf + 4);
+        if (auth_key) wait = rate_take(g_rate_auth, auth_key, now);
+    }
+    if (!wait) return true;
+
+    if (type == SIG_PKT_ONLINE && len >= 4 + SIG_PKT_ONLINE_PSZ)
+        compact_send_online_backoff(udp_fd, from, nget_l(buf + 4 + P2P_PEER_ID_MAX), wait);
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// STUN Binding 应答（--stun：RFC 5389；CHANGE-REQUEST / CHANGED-ADDRESS 见 RFC 3489、RFC 5780）
+
+/* + 信令端口与探测端口上的 Binding 请求按类型、魔术字与长度识别（不会与 COMPACT / NAT_PROBE 包混淆），
+ *   应答无状态，与信令回包一样进入发送队列按 sendmmsg 批量发出
+ * + 应答源 g_stun_socks[ip][port]：主地址的两个套接字绑定 INADDR_ANY（由路由选源）；
+ *   备用 IP 的两个套接字以 SO_REUSEADDR 绑定具体地址，内核把发往备用 IP 的包交给它们
+ * + CHANGE-REQUEST 按标志翻转请求所到套接字的 ip / port 下标选出应答套接字，该套接字未配置时回 420
+ * + 四个套接字齐备时携带 CHANGED-ADDRESS 与 OTHER-ADDRESS（备用 IP : 探测端口）
+ * + 应答比请求大，--rate-limit 启用时按源 IP 计费，避免被用作反射放大
+ */
+#define STUN_MAGIC_COOKIE           0x2112A442u
+#define STUN_HDR_SIZE               20
+#define STUN_BINDING_REQUEST        0x0001
+#define STUN_BINDING_RESPONSE       0x0101
+#define STUN_BINDING_ERROR          0x0111
+#define STUN_ATTR_MAPPED            0x0001
+#define STUN_ATTR_CHANGE_REQUEST    0x0003
+#define STUN_ATTR_CHANGED           0x0005
+#define STUN_ATTR_ERROR_CODE        0x0009
+#define STUN_ATTR_UNKNOWN           0x000A
+#define STUN_ATTR_XOR_MAPPED        0x0020
+#define STUN_ATTR_OTHER_ADDRESS     0x802C
+#define STUN_CHANGE_IP              0x04
+#define STUN_CHANGE_PORT            0x02
+
+// [type(2)][len=8][0][family=IPv4][port(2)][ip(4)]，XOR 形式按魔术字异或
+static int stun_put_addr(uint8_t *p, uint16_t type, const struct sockaddr_in *a, bool xor_cookie) {
+    uint16_t port = ntohs(a->sin_port);
+    uint32_t ip = ntohl(a->sin_addr.s_addr);
+    if (xor_cookie) { port ^= (uint16_t)(STUN_MAGIC_COOKIE >> 16); ip ^= STUN_MAGIC_COOKIE; }
+    nwrite_s(p, type);
+    nwrite_s(p + 2, 8);
+    p[4] = 0;
+    p[5] = 0x01;
+    nwrite_s(p + 6, port);
+    nwrite_l(p + 8, ip);
+    return 12;
+}
+
+// 处理 STUN Binding 请求；返回 false 表示不是 STUN 包（或未启用 --stun），由调用方照常处理
+static bool stun_input(sock_t fd, const uint8_t *buf, size_t len, const struct sockaddr_in *from) {
+
+    if (!ARGS_stun.i64 || len < STUN_HDR_SIZE || (len & 3) || nget_s(buf) != STUN_BINDING_REQUEST
+        || nget_l(buf + 4) != STUN_MAGIC_COOKIE || (size_t)nget_s(buf + 2) + STUN_HDR_SIZE != len)
+        return false;
+    g_metrics.stun_requests++;
+    if (rate_take_ip(from, P_tick_ms())) return true;
+
+    int ip = 0, port = 0;
+    for (int i = 0; i < 4; i++) {
+        if (g_stun_socks[i >> 1][i & 1] == fd) { ip = i >> 1; port = i & 1; break; }
+    }
+
+    uint8_t change = 0;
+    for (size_t off = STUN_HDR_SIZE; off + 4 <= len; ) {
+        uint16_t t = nget_s(buf + off), l = nget_s(buf + off + 2);
+        if (off + 4 + l > len) break;
+        if (t == STUN_ATTR_CHANGE_REQUEST && l == 4) change = buf[off + 7] & (STUN_CHANGE_IP | STUN_CHANGE_PORT);
+        off += 4 + ((l + 3u) & ~3u);
+    }
+    sock_t out = g_stun_socks[ip ^ !!(change & STUN_CHANGE_IP)][port ^ !!(change & STUN_CHANGE_PORT)];
+
+    uint8_t rsp[STUN_HDR_SIZE + 4 * 12];
+    int n = STUN_HDR_SIZE;
+    memcpy(rsp + 4, buf + 4, 16);                   // 魔术字 + 事务 ID
+    if (out == P_INVALID_SOCKET) {
+        // 无法从所要求的 IP / 端口应答：420 Unknown Attribute + UNKNOWN-ATTRIBUTES(CHANGE-REQUEST)
+        static const char reason[20] = "Unknown Attribute";
+        nwrite_s(rsp, STUN_BINDING_ERROR);
+        nwrite_s(rsp + n, STUN_ATTR_ERROR_CODE);
+        nwrite_s(rsp + n + 2, 4 + 17);
+        nwrite_l(rsp + n + 4, 4 * 100 + 20);        // class 4, number 20
+        memcpy(rsp + n + 8, reason, sizeof(reason));
+        n += 8 + (int)sizeof(reason);
+        nwrite_s(rsp + n, STUN_ATTR_UNKNOWN);
+        nwrite_s(rsp + n + 2, 2);
+        nwrite_s(rsp + n + 4, STUN_ATTR_CHANGE_REQUEST);
+        nwrite_s(rsp + n + 6, 0);
+        n += 8;
+        out = fd;
+        g_metrics.stun_rejected++;
+    }
+    else {
+        nwrite_s(rsp, STUN_BINDING_RESPONSE);
+        n += stun_put_addr(rsp + n, STUN_ATTR_XOR_MAPPED, from, true);
+        n += stun_put_addr(rsp + n, STUN_ATTR_MAPPED, from, false);
+        if (g_stun_socks[1][1] != P_INVALID_SOCKET) {
+            struct sockaddr_in alt = {0};
+            alt.sin_family = AF_INET;
+            alt.sin_addr = g_stun_alt_ip;
+            alt.sin_port = htons((uint16_t)ARGS_probe_port.i64);
+            n += stun_put_addr(rsp + n, STUN_ATTR_CHANGED, &alt, false);
+            n += stun_put_addr(rsp + n, STUN_ATTR_OTHER_ADDRESS, &alt, false);
+        }
+    }
+    nwrite_s(rsp + 2, (uint16_t)(n - STUN_HDR_SIZE));
+    udp_enqueue(out, "STUN", rsp, n, from);
+    return true;
+}
+
+// 绑定备用 IP 上的 STUN 套接字（与 INADDR_ANY 上的同端口套接字共存，需双方都设置 SO_REUSEADDR）
+static sock_t stun_alt_open(uint16_t port) {
+    int on = 1;
+    struct sockaddr_in a = {0};
+    a.sin_family = AF_INET;
+    a.sin_addr = g_stun_alt_ip;
+    a.sin_port = htons(port);
+    sock_t fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == P_INVALID_SOCKET) return fd;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on));
+    if (bind(fd, (struct sockaddr *)&a, sizeof(a)) < 0 || P_sock_nonblock(fd, true) != E_NONE
+        || ev_watch(fd, EV_TAG_STUN) != 0) {
+        print("W:", "STUN alt socket %s:%u failed(%d)\n", inet_ntoa(g_stun_alt_ip), port, P_sock_errno());
+        P_sock_close(fd);
+        return P_INVALID_SOCKET;
+    }
+    return fd;
+}
+
+// COMPACT UDP 入口（客户端直接发来的数据报）：超限请求在此丢弃；集群中属于其他 owner 的包经链路转交
+static void compact_udp_route(sock_t udp_fd, uint8_t *buf, size_t len, struct sockaddr_in *from) {
+    if (buf[0] == 0x00 && stun_input(udp_fd, buf, len, from)) return;
+    if (g_rate_ip && !compact_admit(udp_fd, buf, len, from)) return;
+    if (g_cluster_n && cluster_route(buf, len, from)) return;
+    compact_udp_dispatch(udp_fd, buf, len, from);
+}
+
+// 逐包计入热点统计（处理中识别出的客户端经 g_hot_client 带回）
+static void compact_udp_input(sock_t udp_fd, uint8_t *buf, size_t len, struct sockaddr_in *from) {
+    if (!g_hot_k) { compact_udp_route(udp_fd, buf, len, from); return; }
+    uint64_t t0 = P_tick_us();
+    uint32_t ip = from->sin_addr.s_addr;
+    g_hot_client = NULL;
+    compact_udp_route(udp_fd, buf, len, from);
+    hot_observe(ip, g_hot_client, 1, len, P_tick_us() - t0);
+}
+
+// COMPACT 模式客户端空闲超时（到期时若期间有活动则按 last_active 顺延）
+static void compact_idle_expire(srv_timer_t *t, uint64_t now) {
+    compact_client_t *c = TIMER_OWNER(t, compact_client_t, base.idle_timer);
+
+    if (!c->base.valid) return;
+    uint64_t timeout = compact_idle_timeout_ms(c);
+    if (tick_diff(now, c->base.last_active) <= timeout) {
+        timer_add(t, c->base.last_active + timeout + 1, compact_idle_expire);
+        return;
+    }
+
+    print("W:", LA_F("Timeout & cleanup for client '%s' (inactive for %.1f seconds)\n", LA_F121, 121),
+           c->base.local_peer_id,
+           tick_diff(now, c->base.last_active) / 1000.0);
+
+    compact_clear_client(g_udp_fd, c);
+}
+
+//-----------------------------------------------------------------------------
+
+#ifdef SERVER_UDP_WORKERS
+/*
+ * COMPACT UDP 接收线程
+ *
+ * + 每个线程持有一个以 SO_REUSEPORT 绑定信令端口的 UDP 套接字，内核按四元组把客户端分流到
+ *   主套接字与各线程套接字上，recvfrom 系统调用因此并行
+ * + 线程只收包：数据报写入自己的单生产者/单消费者信箱，经 eventfd 唤醒主循环；
+ *   信令状态（客户端、会话、配对表）仍只由主循环访问，无需加锁
+ * + 回包统一走主 UDP 套接字（同一绑定地址，客户端看到的源地址/端口不变）
+ */
+typedef struct udp_dgram {
+    struct sockaddr_in              from;
+    uint16_t                        len;
+    uint8_t                         buf[P2P_MTU];
+} udp_dgram_t;
+
+typedef struct udp_worker {
+    sock_t                          fd;
+    thd_t                           thread;
+    udp_dgram_t*                    box;                        // 信箱（UDP_MAILBOX_SLOTS 项）
+    uint32_t                        head;                       // 消费者（主循环）读位置
+    uint32_t                        tail;                       // 生产者（接收线程）写位置
+    uint32_t                        dropped;                    // 信箱满丢弃计数
+} udp_worker_t;
+
+static udp_worker_t                 g_udp_workers[UDP_WORKER_MAX];
+static int                          g_udp_worker_cnt = 0;
+static int                          g_udp_wake_fd = -1;         // eventfd：接收线程 → 主循环
+static int                          g_udp_wake_pending = 0;     // 已发出唤醒、主循环尚未清除
+static int                          g_udp_workers_quit = 0;
+
+static int32_t udp_worker_func(void *arg) {
+    udp_worker_t *w = (udp_worker_t *)arg;
+
+    while (!__atomic_load_n(&g_udp_workers_quit, __ATOMIC_ACQUIRE)) {
+        struct pollfd pfd = { w->fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 200) <= 0) continue;                  // 超时用于检查退出标志
+
+        // 以 recvmmsg 直接收进信箱空闲槽位，每次最多 UDP_BATCH_MAX 个
+        bool pushed = false;
+        for (;;) {
+            uint32_t tail = w->tail;
+            uint32_t room = UDP_MAILBOX_SLOTS - (tail - __atomic_load_n(&w->head, __ATOMIC_ACQUIRE));
+            if (room == 0) {
+                // 信箱满：读出丢弃，避免内核缓冲区积压陈旧包
+                uint8_t tmp[P2P_MTU];
+                if (recv(w->fd, (char *)tmp, sizeof(tmp), 0) < 0) break;
+                w->dropped++;
+                continue;
+            }
+            if (room > UDP_BATCH_MAX) room = UDP_BATCH_MAX;
+
+            struct mmsghdr msgs[UDP_BATCH_MAX];
+            struct iovec iovs[UDP_BATCH_MAX];
+            for (uint32_t i = 0; i < room; i++) {
+                udp_dgram_t *d = &w->box[(tail + i) & (UDP_MAILBOX_SLOTS - 1)];
+                iovs[i].iov_base = d->buf;
+                iovs[i].iov_len = sizeof(d->buf);
+                memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+                msgs[i].msg_hdr.msg_name = &d->from;
+                msgs[i].msg_hdr.msg_namelen = sizeof(d->from);
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int n = recvmmsg(w->fd, msgs, room, MSG_DONTWAIT, NULL);
+            if (n <= 0) break;                                  // EAGAIN：本轮收完
+            for (int i = 0; i < n; i++)
+                w->box[(tail + (uint32_t)i) & (UDP_MAILBOX_SLOTS - 1)].len = (uint16_t)msgs[i].msg_len;
+            __atomic_store_n(&w->tail, tail + (uint32_t)n, __ATOMIC_RELEASE);
+            pushed = true;
+        }
+
+        if (pushed && !__atomic_exchange_n(&g_udp_wake_pending, 1, __ATOMIC_ACQ_REL)) {
+            uint64_t one = 1;
+            if (write(g_udp_wake_fd, &one, sizeof(one)) < 0) { /* 计数器溢出之外不会失败 */ }
+        }
+    }
+    return 0;
+}
+
+// 启动 cnt 个接收线程（失败时已启动的线程照常工作，返回实际数量）
+static int udp_workers_start(int cnt, const struct sockaddr_in *addr) {
+
+    if (cnt > UDP_WORKER_MAX) cnt = UDP_WORKER_MAX;
+    if ((g_udp_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) return 0;
+    if (ev_watch(g_udp_wake_fd, EV_TAG_WAKE) != 0) { close(g_udp_wake_fd); g_udp_wake_fd = -1; return 0; }
+
+    int sockopt = 1;
+    for (int i = 0; i < cnt; i++) { udp_worker_t *w = &g_udp_workers[g_udp_worker_cnt];
+        memset(w, 0, sizeof(*w));
+        if ((w->fd = socket(AF_INET, SOCK_DGRAM, 0)) == P_INVALID_SOCKET) break;
+        setsockopt(w->fd, SOL_SOCKET, SO_REUSEPORT, (const char *)&sockopt, sizeof(sockopt));
+        if (bind(w->fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0
+            || P_sock_nonblock(w->fd, true) != E_NONE
+            || !(w->box = (udp_dgram_t *)malloc(sizeof(udp_dgram_t) * UDP_MAILBOX_SLOTS))) {
+            P_sock_close(w->fd);
+            break;
+        }
+        if (P_thread(&w->thread, udp_worker_func, w, P_THD_NORMAL, 0) != E_NONE) {
+            P_sock_close(w->fd); free(w->box);
+            break;
+        }
+        g_udp_worker_cnt++;
+    }
+    return g_udp_worker_cnt;
+}
 
-        print("W:", LA_F("Timeout & cleanup for client '%s' (inactive for %.1f seconds)\n", LA_F121, 121),
-               g_compact_clients[i].base.local_peer_id,
-               tick_diff(now, g_compact_clients[i].base.last_active) / 1000.0);
+// 主循环：处理各接收线程信箱中的数据报
+static void udp_workers_drain(sock_t udp_fd) {
 
-        compact_clear_client(udp_fd, &g_compact_clients[i]);
+    // 先清除唤醒标志再取包：取包期间新到的包会重新触发唤醒
+    uint64_t cnt;
+    if (read(g_udp_wake_fd, &cnt, sizeof(cnt)) < 0) { /* EAGAIN：无待处理唤醒 */ }
+    __atomic_exchange_n(&g_udp_wake_pending, 0, __ATOMIC_ACQ_REL);
+
+    for (int i = 0; i < g_udp_worker_cnt; i++) { udp_worker_t *w = &g_udp_workers[i];
+        uint32_t head = w->head, tail = __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            udp_dgram_t *d = &w->box[head & (UDP_MAILBOX_SLOTS - 1)];
+            compact_udp_input(udp_fd, d->buf, d->len, &d->from);
+        }
+        __atomic_store_n(&w->head, head, __ATOMIC_RELEASE);
     }
 }
 
+// 通知接收线程退出并释放资源
+static void udp_workers_stop(void) {
+    __atomic_store_n(&g_udp_workers_quit, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < g_udp_worker_cnt; i++) { udp_worker_t *w = &g_udp_workers[i];
+        P_join(w->thread, NULL);
+        if (w->dropped) print("W:", LA_F("UDP worker %d dropped %u datagrams (mailbox full)\n", LA_F154, 154), i, w->dropped);
+        P_sock_close(w->fd);
+        free(w->box);
+    }
+    g_udp_worker_cnt = 0;
+    if (g_udp_wake_fd >= 0) { close(g_udp_wake_fd); g_udp_wake_fd = -1; }
+}
+#endif /* SERVER_UDP_WORKERS */
+
 //-----------------------------------------------------------------------------
 
 // 处理 NAT 探测请求
@@ -2938,6 +4802,8 @@ static void handle_probe(sock_t probe_fd, uint8_t *buf, size_t len, struct socka
     char from_str[64];
     snprintf(from_str, sizeof(from_str), "%s:%d", inet_ntoa(from->sin_addr), ntohs(from->sin_port));
 
+    if (len >= 4 && buf[0] == 0x00 && stun_input(probe_fd, buf, len, from)) return;
+
     // NAT_PROBE: [hdr(4)] = 4 bytes
     if (len < 4 || buf[0] != SIG_PKT_NAT_PROBE) return;
     const char* PROTO = "NAT_PROBE";
@@ -2963,6 +4829,936 @@ static void handle_probe(sock_t probe_fd, uint8_t *buf, size_t len, struct socka
     udp_send(probe_fd, PROTO_ACK, buf, 4 + SIG_PKT_NAT_PROBE_ACK_PSZ, from);
 }
 
+//-----------------------------------------------------------------------------
+// Prometheus 指标导出（--metrics-port 独立端口，HTTP/1.0 一问一答，响应后关闭连接）
+
+#define METRICS_IO_WAIT_MS          200                         // 等待请求 / 发送缓冲可写的单次时限
+
+typedef struct metrics_buf {
+    char*                           data;
+    size_t                          len;
+    size_t                          cap;
+    bool                            oom;
+} metrics_buf_t;
+
+static void metrics_printf(metrics_buf_t *b, const char *fmt, ...) {
+
+    while (!b->oom) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if ((size_t)n < b->cap - b->len) { b->len += (size_t)n; return; }
+
+        char *data = (char*)realloc(b->data, b->cap * 2);
+        if (!data) { b->oom = true; return; }
+        b->data = data; b->cap *= 2;
+    }
+}
+
+static void metrics_head(metrics_buf_t *b, const char *name, const char *type, const char *help) {
+    metrics_printf(b, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// 标签值转义（peer_id 由客户端提供，可能含 '"' / '\\' / 换行）
+static void metrics_label(metrics_buf_t *b, const char *s, size_t max) {
+    for (size_t i = 0; i < max && s[i]; i++) {
+        char c = s[i];
+        if (c == '"' || c == '\\') metrics_printf(b, "\\%c", c);
+        else if (c == '\n')        metrics_printf(b, "\\n");
+        else                       metrics_printf(b, "%c", c);
+    }
+}
+
+#define METRICS_CASE(x)             case x: return #x;
+
+static const char* metrics_udp_type(uint8_t type) {
+    switch (type) {
+    METRICS_CASE(SIG_PKT_ONLINE)    METRICS_CASE(SIG_PKT_ONLINE_ACK) METRICS_CASE(SIG_PKT_OFFLINE)
+    METRICS_CASE(SIG_PKT_ALIVE)     METRICS_CASE(SIG_PKT_ALIVE_ACK)
+    METRICS_CASE(SIG_PKT_SYNC0)     METRICS_CASE(SIG_PKT_SYNC0_ACK)  METRICS_CASE(SIG_PKT_SYNC)
+    METRICS_CASE(SIG_PKT_SYNC_ACK)  METRICS_CASE(SIG_PKT_FIN)        METRICS_CASE(SIG_PKT_PUNCH_AT)
+    METRICS_CASE(SIG_PKT_MSG_REQ)   METRICS_CASE(SIG_PKT_MSG_REQ_ACK)
+    METRICS_CASE(SIG_PKT_MSG_RESP)  METRICS_CASE(SIG_PKT_MSG_RESP_ACK)
+    METRICS_CASE(SIG_PKT_NAT_PROBE) METRICS_CASE(SIG_PKT_NAT_PROBE_ACK)
+    METRICS_CASE(P2P_PKT_PUNCH)     METRICS_CASE(P2P_PKT_REACH)      METRICS_CASE(P2P_PKT_CONN)
+    METRICS_CASE(P2P_PKT_CONN_ACK)  METRICS_CASE(P2P_PKT_FIN)        METRICS_CASE(P2P_PKT_BIND_PROBE)
+    METRICS_CASE(P2P_PKT_DATA)      METRICS_CASE(P2P_PKT_ACK)        METRICS_CASE(P2P_PKT_CRYPTO)
+    METRICS_CASE(P2P_PKT_DGRAM)     METRICS_CASE(P2P_PKT_BULK)
+    default: return NULL;
+    }
+}
+
+static const char* metrics_relay_type(uint8_t type) {
+    switch (type) {
+    METRICS_CASE(P2P_RLY_STATUS)    METRICS_CASE(P2P_RLY_ONLINE)     METRICS_CASE(P2P_RLY_ONLINE_ACK)
+    METRICS_CASE(P2P_RLY_ALIVE)     METRICS_CASE(P2P_RLY_ALIVE_ACK)
+    METRICS_CASE(P2P_RLY_SYNC0)     METRICS_CASE(P2P_RLY_SYNC0_ACK)  METRICS_CASE(P2P_RLY_SYNC)
+    METRICS_CASE(P2P_RLY_SYNC_ACK)  METRICS_CASE(P2P_RLY_FIN)        METRICS_CASE(P2P_RLY_PACKET)
+    METRICS_CASE(P2P_RLY_REQ)       METRICS_CASE(P2P_RLY_RESP)
+    default: return NULL;
+    }
+}
+
+// 按类型导出计数器（只输出出现过的类型；未知类型以十六进制值作标签）
+static void metrics_by_type(metrics_buf_t *b, const char *name, const uint64_t cnt[256],
+                            const char* (*type_name)(uint8_t)) {
+    for (int t = 0; t < 256; t++) {
+        if (!cnt[t]) continue;
+        const char *tn = type_name((uint8_t)t);
+        if (tn) metrics_printf(b, "%s{type=\"%s\"} %" PRIu64 "\n", name, tn, cnt[t]);
+        else    metrics_printf(b, "%s{type=\"0x%02x\"} %" PRIu64 "\n", name, t, cnt[t]);
+    }
+}
+
+// 主循环单轮处理耗时（不含事件等待）计入直方图
+static inline void metrics_loop_observe(uint64_t us) {
+    int i = 0;
+    while (i < METRICS_LOOP_BUCKETS && us > g_metrics_loop_us[i]) i++;
+    g_metrics.loop_buckets[i]++;
+    g_metrics.loop_sum_us += us;
+    g_metrics.loop_count++;
+}
+
+typedef struct metrics_top {
+    const client_t*                 client;
+    const char*                     mode;
+} metrics_top_t;
+
+// 按中继字节数保留前 METRICS_TOP_CLIENTS 名（插入排序，n 为当前名次数）
+static int metrics_top_add(metrics_top_t *top, int n, const client_t *c, const char *mode) {
+    if (!c->valid || !c->rx_bytes) return n;
+    if (n == METRICS_TOP_CLIENTS && top[n - 1].client->rx_bytes >= c->rx_bytes) return n;
+    int i = n < METRICS_TOP_CLIENTS ? n++ : n - 1;
+    while (i > 0 && top[i - 1].client->rx_bytes < c->rx_bytes) { top[i] = top[i - 1]; i--; }
+    top[i].client = c; top[i].mode = mode;
+    return n;
+}
+
+static void metrics_render(metrics_buf_t *b) {
+
+    // 现场统计：配对状态、重传队列深度、热点客户端
+    uint64_t pairs_full = 0, pairs_half = 0;
+    for (session_pair_t *pair = g_session_pairs; pair; pair = (session_pair_t*)pair->hh_peer.next) {
+        if (pair->sessions[0] && pair->sessions[1]) pairs_full++; else pairs_half++;
+    }
+
+    metrics_top_t top[METRICS_TOP_CLIENTS]; int top_n = 0;
+    uint64_t relay_online = HASH_CNT(hh_name, g_relay_by_name), relay_rpc = 0, relay_queued = 0;
+    uint64_t compact_online = HASH_CNT(hh_name, g_compact_clients_by_name), compact_sync0 = 0, compact_rpc = 0;
+
+    for (int i = 0; i < g_relay_pool.cap; i++) { relay_client_t *c = RELAY_CLIENT_AT(i);
+        if (!c->base.valid) continue;
+        for (session_t *sb = c->base.sessions; sb; sb = sb->next) { relay_session_t *s = (relay_session_t*)sb;
+            for (int k = 0; k < g_rpc_window; k++) relay_rpc += s->rpc_sid[k] != 0;
+            relay_queued += s->send_cnt;
+        }
+        top_n = metrics_top_add(top, top_n, &c->base, "relay");
+    }
+    for (int i = 0; i < g_compact_pool.cap; i++) { compact_client_t *c = COMPACT_CLIENT_AT(i);
+        if (!c->base.valid) continue;
+        for (session_t *sb = c->base.sessions; sb; sb = sb->next) { compact_session_t *s = (compact_session_t*)sb;
+            if (timer_active(&s->sync0_timer)) compact_sync0++;
+            compact_rpc += (uint64_t)s->rpc_active;
+        }
+        top_n = metrics_top_add(top, top_n, &c->base, "compact");
+    }
+
+    metrics_head(b, "p2p_clients", "gauge", "Connected client slots by mode");
+    metrics_printf(b, "p2p_clients{mode=\"relay\"} %d\np2p_clients{mode=\"compact\"} %d\n",
+                   g_relay_pool.used, g_compact_pool.used);
+    metrics_head(b, "p2p_clients_online", "gauge", "Clients that completed ONLINE, by mode");
+    metrics_printf(b, "p2p_clients_online{mode=\"relay\"} %" PRIu64 "\np2p_clients_online{mode=\"compact\"} %" PRIu64 "\n",
+                   relay_online, compact_online);
+    metrics_head(b, "p2p_sessions", "gauge", "Active sessions (both modes)");
+    metrics_printf(b, "p2p_sessions %u\n", (unsigned)g_session_index.count);
+    metrics_head(b, "p2p_session_pairs", "gauge", "Session pairs by state");
+    metrics_printf(b, "p2p_session_pairs{state=\"paired\"} %" PRIu64 "\np2p_session_pairs{state=\"waiting\"} %" PRIu64 "\n",
+                   pairs_full, pairs_half);
+
+    metrics_head(b, "p2p_udp_packets_total", "counter", "COMPACT UDP packets received by type");
+    metrics_by_type(b, "p2p_udp_packets_total", g_metrics.udp_pkts, metrics_udp_type);
+    metrics_head(b, "p2p_relay_frames_total", "counter", "RELAY TCP frames received by type");
+    metrics_by_type(b, "p2p_relay_frames_total", g_metrics.relay_frames, metrics_relay_type);
+
+    metrics_head(b, "p2p_relay_rx_bytes_total", "counter", "RELAY TCP frame bytes received");
+    metrics_printf(b, "p2p_relay_rx_bytes_total %" PRIu64 "\n", g_metrics.relay_rx_bytes);
+    metrics_head(b, "p2p_relay_tx_bytes_total", "counter", "RELAY session queue bytes sent");
+    metrics_printf(b, "p2p_relay_tx_bytes_total %" PRIu64 "\n", g_metrics.relay_tx_bytes);
+    metrics_head(b, "p2p_relay_zerocopy_bytes_total", "counter", "RELAY session queue bytes sent with MSG_ZEROCOPY");
+    metrics_printf(b, "p2p_relay_zerocopy_bytes_total %" PRIu64 "\n", g_metrics.relay_zc_bytes);
+    metrics_head(b, "p2p_compact_fwd_packets_total", "counter", "COMPACT relay packets forwarded by the fast path");
+    metrics_printf(b, "p2p_compact_fwd_packets_total %" PRIu64 "\n", g_compact_fwd_pkts);
+    metrics_head(b, "p2p_compact_fwd_bytes_total", "counter", "COMPACT relay bytes forwarded by the fast path");
+    metrics_printf(b, "p2p_compact_fwd_bytes_total %" PRIu64 "\n", g_metrics.compact_fwd_bytes);
+    metrics_head(b, "p2p_compact_fwd_entries", "gauge", "COMPACT forwarding table entries");
+    metrics_printf(b, "p2p_compact_fwd_entries %u\n", g_compact_fwd_cnt);
+
+    metrics_head(b, "p2p_memory_bytes", "gauge", "Heap memory by component (client slots, sessions, RELAY frame buffers)");
+    metrics_printf(b, "p2p_memory_bytes{component=\"client\"} %zu\np2p_memory_bytes{component=\"session\"} %zu\n"
+                      "p2p_memory_bytes{component=\"relay_buf\"} %zu\n", g_mem.client, g_mem.session, g_relay_bufs.held);
+    metrics_head(b, "p2p_relay_buf_bytes", "gauge", "RELAY frame buffer memory (in use + cached)");
+    metrics_printf(b, "p2p_relay_buf_bytes{stat=\"held\"} %zu\np2p_relay_buf_bytes{stat=\"peak\"} %zu\n"
+                      "p2p_relay_buf_bytes{stat=\"cap\"} %zu\n", g_relay_bufs.held, g_relay_bufs.peak, g_relay_bufs.cap);
+    metrics_head(b, "p2p_relay_bufs", "gauge", "RELAY frame buffers by size class and state");
+    metrics_printf(b, "p2p_relay_bufs{class=\"bulk\",state=\"inuse\"} %d\np2p_relay_bufs{class=\"bulk\",state=\"cached\"} %d\n"
+                      "p2p_relay_bufs{class=\"large\",state=\"inuse\"} %d\np2p_relay_bufs{class=\"large\",state=\"cached\"} %d\n"
+                      "p2p_relay_bufs{class=\"small\",state=\"inuse\"} %d\np2p_relay_bufs{class=\"small\",state=\"cached\"} %d\n",
+                   g_relay_buf_bulk.inuse, g_relay_buf_bulk.cached, g_relay_buf_large.inuse, g_relay_buf_large.cached, g_relay_buf_small.inuse, g_relay_buf_small.cached);
+    metrics_head(b, "p2p_relay_buf_alloc_fail_total", "counter", "RELAY buffer allocations refused by the memory cap");
+    metrics_printf(b, "p2p_relay_buf_alloc_fail_total %" PRIu64 "\n", g_relay_bufs.alloc_fail);
+    metrics_head(b, "p2p_relay_busy_total", "counter", "RELAY requests answered with BUSY");
+    metrics_printf(b, "p2p_relay_busy_total %" PRIu64 "\n", g_relay_bufs.busy);
+    metrics_head(b, "p2p_relay_queued_frames", "gauge", "Frames waiting in RELAY session send queues");
+    metrics_printf(b, "p2p_relay_queued_frames %" PRIu64 "\n", relay_queued);
+
+    metrics_head(b, "p2p_stun_requests_total", "counter", "STUN Binding requests answered (--stun)");
+    metrics_printf(b, "p2p_stun_requests_total %" PRIu64 "\n", g_metrics.stun_requests);
+    metrics_head(b, "p2p_stun_rejected_total", "counter", "STUN CHANGE-REQUESTs refused with 420 (address not configured)");
+    metrics_printf(b, "p2p_stun_rejected_total %" PRIu64 "\n", g_metrics.stun_rejected);
+
+    metrics_head(b, "p2p_retry_pending", "gauge", "Outstanding retransmit / timeout timers by queue");
+    metrics_printf(b, "p2p_retry_pending{queue=\"compact_sync0\"} %" PRIu64 "\np2p_retry_pending{queue=\"compact_rpc\"} %" PRIu64 "\n"
+                      "p2p_retry_pending{queue=\"relay_rpc\"} %" PRIu64 "\n", compact_sync0, compact_rpc, relay_rpc);
+
+    metrics_head(b, "p2p_loop_duration_seconds", "histogram", "Event loop iteration processing time (excluding wait)");
+    uint64_t cum = 0;
+    for (int i = 0; i < METRICS_LOOP_BUCKETS; i++) { cum += g_metrics.loop_buckets[i];
+        metrics_printf(b, "p2p_loop_duration_seconds_bucket{le=\"%g\"} %" PRIu64 "\n", g_metrics_loop_us[i] / 1e6, cum);
+    }
+    metrics_printf(b, "p2p_loop_duration_seconds_bucket{le=\"+Inf\"} %" PRIu64 "\n", g_metrics.loop_count);
+    metrics_printf(b, "p2p_loop_duration_seconds_sum %.6f\np2p_loop_duration_seconds_count %" PRIu64 "\n",
+                   g_metrics.loop_sum_us / 1e6, g_metrics.loop_count);
+
+    metrics_head(b, "p2p_client_relay_bytes_total", "counter", "Relayed bytes received from the busiest clients");
+    for (int i = 0; i < top_n; i++) {
+        metrics_printf(b, "p2p_client_relay_bytes_total{mode=\"%s\",peer=\"", top[i].mode);
+        metrics_label(b, top[i].client->local_peer_id, P2P_PEER_ID_MAX);
+        metrics_printf(b, "\"} %" PRIu64 "\n", top[i].client->rx_bytes);
+    }
+
+    if (g_hot_k) {
+        static const char *names[HOT_METRICS] = { "p2p_hot_packets", "p2p_hot_bytes", "p2p_hot_cpu_seconds" };
+        static const char *helps[HOT_METRICS] = {
+            "Heavy hitters: packets received (count-min estimate, halved every minute)",
+            "Heavy hitters: bytes received (count-min estimate, halved every minute)",
+            "Heavy hitters: handler CPU time (count-min estimate, halved every minute)" };
+        const hot_tracker_t *ts[2] = { &g_hot_peer, &g_hot_ip };
+        const char *by[2] = { "peer", "ip" };
+        for (int m = 0; m < HOT_METRICS; m++) {
+            metrics_head(b, names[m], "gauge", helps[m]);
+            for (int k = 0; k < 2; k++)
+                for (int i = 0; i < ts[k]->top_n[m]; i++) {
+                    const hot_entry_t *e = &ts[k]->top[m][i];
+                    metrics_printf(b, "%s{by=\"%s\",key=\"", names[m], by[k]);
+                    metrics_label(b, e->label, P2P_PEER_ID_MAX);
+                    if (m == HOT_CPU_US) metrics_printf(b, "\"} %.6f\n", e->est / 1e6);
+                    else                 metrics_printf(b, "\"} %" PRIu64 "\n", e->est);
+                }
+        }
+    }
+
+    if (g_rate_ip) {
+        metrics_head(b, "p2p_rate_limited_total", "counter", "Requests refused by the rate limiter, by key");
+        metrics_printf(b, "p2p_rate_limited_total{key=\"ip\"} %" PRIu64 "\np2p_rate_limited_total{key=\"auth_key\"} %" PRIu64 "\n",
+                       g_rate_ip->limited, g_rate_auth->limited);
+    }
+
+    if (!g_cluster_n) return;
+    metrics_head(b, "p2p_cluster_link_up", "gauge", "Outbound inter-node link state by node");
+    for (int i = 0; i < g_cluster_n; i++) if (i != g_cluster_self)
+        metrics_printf(b, "p2p_cluster_link_up{node=\"%s\"} %d\n", g_cluster[i].name, g_cluster[i].connected ? 1 : 0);
+    metrics_head(b, "p2p_cluster_frames_total", "counter", "Inter-node frames by node and direction");
+    for (int i = 0; i < g_cluster_n; i++) if (i != g_cluster_self)
+        metrics_printf(b, "p2p_cluster_frames_total{node=\"%s\",dir=\"tx\"} %" PRIu64 "\n"
+                          "p2p_cluster_frames_total{node=\"%s\",dir=\"rx\"} %" PRIu64 "\n",
+                       g_cluster[i].name, g_cluster[i].tx_frames, g_cluster[i].name, g_cluster[i].rx_frames);
+    metrics_head(b, "p2p_cluster_tx_drops_total", "counter", "Inter-node frames dropped (link down or send buffer full)");
+    for (int i = 0; i < g_cluster_n; i++) if (i != g_cluster_self)
+        metrics_printf(b, "p2p_cluster_tx_drops_total{node=\"%s\"} %" PRIu64 "\n", g_cluster[i].name, g_cluster[i].tx_drops);
+}
+
+// 等待套接字可读 / 可写（最多 ms 毫秒）
+static bool sock_wait(sock_t fd, bool wr, int ms) {
+#if defined(SERVER_EPOLL) || defined(SERVER_KQUEUE)
+    struct pollfd pfd = { fd, wr ? POLLOUT : POLLIN, 0 };
+    return poll(&pfd, 1, ms) > 0;
+#else
+#  if !P_WIN
+    if ((int)fd >= FD_SETSIZE) return false;
+#  endif
+    fd_set fds; FD_ZERO(&fds); FD_SET(fd, &fds);
+    struct timeval tv = { ms / 1000, (ms % 1000) * 1000 };
+    return select((int)fd + 1, wr ? NULL : &fds, wr ? &fds : NULL, NULL, &tv) > 0;
+#endif
+}
+
+// 发送全部数据；出错或抓取方过慢（发送缓冲持续已满）时放弃
+static bool metrics_send(sock_t fd, const char *data, size_t len) {
+    size_t off = 0;
+    while (off < len) {
+        ssize_t w = send(fd, data + off, len - off, 0);
+        if (w > 0) { off += (size_t)w; continue; }
+        if (w < 0 && P_sock_is_interrupted()) continue;
+        if (w < 0 && P_sock_is_wouldblock() && sock_wait(fd, true, METRICS_IO_WAIT_MS)) continue;
+        return false;
+    }
+    return true;
+}
+
+// 处理一次抓取：GET /metrics（或 /）返回指标，其余路径 404
+static void metrics_serve(sock_t fd) {
+
+    char req[256]; int n = 0;
+    P_sock_nonblock(fd, true);
+    while (n < (int)sizeof(req) - 1 && sock_wait(fd, false, METRICS_IO_WAIT_MS)) {
+        int r = (int)recv(fd, req + n, sizeof(req) - 1 - n, 0);
+        if (r <= 0) break;
+        n += r; req[n] = '\0';
+        if (strchr(req, '\n')) break;       // 只需要请求行
+    }
+    req[n] = '\0';
+
+    metrics_buf_t b = { (char*)malloc(16384), 0, 16384, false };
+    if (!b.data) { P_sock_close(fd); return; }
+
+    const char *status = "404 Not Found";
+    if (!strncmp(req, "GET /metrics", 12) || !strncmp(req, "GET / ", 6)) {
+        metrics_render(&b);
+        status = b.oom ? "503 Service Unavailable" : "200 OK";
+    }
+    if (b.oom || strcmp(status, "200 OK")) b.len = 0;
+
+    char head[160];
+    int hl = snprintf(head, sizeof(head), "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                      "Content-Length: %zu\r\nConnection: close\r\n\r\n", status, b.len);
+    if (metrics_send(fd, head, (size_t)hl)) metrics_send(fd, b.data, b.len);
+    free(b.data);
+    P_sock_close(fd);
+}
+
+//-----------------------------------------------------------------------------
+// 集群：节点间链路、代理登录与数据报路由
+
+// 配对 (a,b) 的 owner 节点：较小 peer_id 按 p2p_cluster_pick 规则选出的节点（同分取靠前者）
+static int cluster_owner(const char *a, const char *b) {
+    const char *key = strncmp(a, b, P2P_PEER_ID_MAX) <= 0 ? a : b;
+    int best = 0; uint32_t best_score = 0;
+    for (int i = 0; i < g_cluster_n; i++) {
+        uint32_t sc = p2p_cluster_score(g_cluster[i].name, strlen(g_cluster[i].name), key, P2P_PEER_ID_MAX);
+        if (i == 0 || sc > best_score) { best = i; best_score = sc; }
+    }
+    return best;
+}
+
+// 追加一帧到节点发送缓冲（主循环每轮等待前统一 cluster_flush）
+static void cluster_send(int node, uint8_t type, uint64_t tag, const struct sockaddr_in *addr, const void *data, size_t len) {
+
+    cluster_node_t *n = &g_cluster[node];
+    size_t total = CLUSTER_HDR_SIZE + len;
+    if (n->fd == P_INVALID_SOCKET || len > P2P_MTU || n->out_len + total > CLUSTER_SENDBUF_MAX) { n->tx_drops++; return; }
+
+    uint8_t *f = n->out_buf + n->out_len;
+    nwrite_s(f, (uint16_t)total);
+    f[2] = type;
+    nwrite_ll(f + 3, tag);
+    if (addr) { memcpy(f + 11, &addr->sin_addr.s_addr, 4); memcpy(f + 15, &addr->sin_port, 2); }
+    else memset(f + 11, 0, 6);
+    if (len) memcpy(f + CLUSTER_HDR_SIZE, data, len);
+    n->out_len += total;
+    n->tx_frames++;
+}
+
+// 清除各本地客户端在该 owner 上的代理登录（链路重建后按需重新登录；owner 未重启时 ONLINE 重传返回原 auth_key）
+static void cluster_reset_proxies(int node) {
+    for (int i = 0; i < g_compact_pool.cap; i++) { compact_client_t *c = COMPACT_CLIENT_AT(i);
+        if (c->base.valid && c->cluster) c->cluster->auth_key[node] = 0;
+    }
+}
+
+static void cluster_link_down(int node, uint64_t now) {
+    cluster_node_t *n = &g_cluster[node];
+    if (n->connected) print("W:", "Cluster link to %s lost\n", n->name);
+    P_sock_close(n->fd);
+    n->fd = P_INVALID_SOCKET;
+    n->connected = false;
+    n->out_len = 0;
+    n->retry_at = now + CLUSTER_RECONNECT_MS;
+    cluster_reset_proxies(node);
+}
+
+static void cluster_connect(int node) {
+    cluster_node_t *n = &g_cluster[node];
+    n->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (n->fd == P_INVALID_SOCKET) return;
+    P_sock_nonblock(n->fd, true);
+    if (connect(n->fd, (struct sockaddr *)&n->link_addr, sizeof(n->link_addr)) < 0
+        && !P_sock_is_wouldblock() && P_sock_errno() != EINPROGRESS) {
+        cluster_link_down(node, P_tick_ms());
+        return;
+    }
+    n->out_len = 0;
+    cluster_send(node, CLUSTER_MSG_HELLO, (uint64_t)g_cluster_self, NULL, NULL, 0);
+}
+
+static void cluster_flush(int node) {
+
+    cluster_node_t *n = &g_cluster[node];
+    if (n->fd == P_INVALID_SOCKET) return;
+
+    // 非阻塞 connect 完成检查
+    if (!n->connected) {
+        if (!sock_wait(n->fd, true, 0)) return;
+        int err = 0; socklen_t elen = sizeof(err);
+        if (getsockopt(n->fd, SOL_SOCKET, SO_ERROR, (char *)&err, &elen) < 0 || err) {
+            cluster_link_down(node, P_tick_ms());
+            return;
+        }
+        n->connected = true;
+        print("I:", "Cluster link to %s up\n", n->name);
+        cluster_reset_proxies(node);
+    }
+
+    size_t off = 0;
+    while (off < n->out_len) {
+        ssize_t w = send(n->fd, (const char *)n->out_buf + off, n->out_len - off, 0);
+        if (w > 0) { off += (size_t)w; continue; }
+        if (w < 0 && P_sock_is_interrupted()) continue;
+        if (w < 0 && P_sock_is_wouldblock()) break;
+        cluster_link_down(node, P_tick_ms());
+        return;
+    }
+    if (off) { n->out_len -= off; memmove(n->out_buf, n->out_buf + off, n->out_len); }
+}
+
+static void cluster_flush_all(void) {
+    for (int i = 0; i < g_cluster_n; i++) if (i != g_cluster_self && g_cluster[i].out_len) cluster_flush(i);
+}
+
+// 周期：重连断开的链路、推进建连中的链路
+static void cluster_tick(srv_timer_t *t, uint64_t now) {
+    for (int i = 0; i < g_cluster_n; i++) { cluster_node_t *n = &g_cluster[i];
+        if (i == g_cluster_self) continue;
+        if (n->fd == P_INVALID_SOCKET) { if ((int64_t)(now - n->retry_at) >= 0) cluster_connect(i); }
+        else if (!n->connected) cluster_flush(i);
+    }
+    timer_add(t, now + CLUSTER_TICK_MS, cluster_tick);
+}
+
+//-------------------------------
+
+static void cluster_addr_expire(srv_timer_t *t, uint64_t now) {
+    cluster_addr_t *a = TIMER_OWNER(t, cluster_addr_t, timer);
+    if (tick_diff(now, a->last_seen) <= CLUSTER_ADDR_TIMEOUT_S * 1000) {
+        timer_add(t, a->last_seen + CLUSTER_ADDR_TIMEOUT_S * 1000 + 1, cluster_addr_expire);
+        return;
+    }
+    HASH_DEL(g_cluster_addrs, a);
+    free(a);
+}
+
+static inline void cluster_addr_key(uint8_t key[6], const struct sockaddr_in *addr) {
+    memcpy(key, &addr->sin_addr.s_addr, 4);
+    memcpy(key + 4, &addr->sin_port, 2);
+}
+
+// owner 侧：记录代理客户端地址所属的入口节点
+static void cluster_addr_touch(const struct sockaddr_in *addr, int node, uint64_t tag, uint64_t now) {
+    uint8_t key[6]; cluster_addr_key(key, addr);
+    cluster_addr_t *a = NULL;
+    HASH_FIND(hh, g_cluster_addrs, key, sizeof(key), a);
+    if (!a) {
+        if (!(a = (cluster_addr_t*)calloc(1, sizeof(*a)))) return;
+        memcpy(a->key, key, sizeof(key));
+        HASH_ADD(hh, g_cluster_addrs, key, sizeof(a->key), a);
+        timer_add(&a->timer, now + CLUSTER_ADDR_TIMEOUT_S * 1000 + 1, cluster_addr_expire);
+    }
+    a->node = node;
+    if (tag) a->tag = tag;
+    a->last_seen = now;
+}
+
+// 客户端直接发来数据报：不再经入口节点代理
+static void cluster_addr_forget(const struct sockaddr_in *addr) {
+    uint8_t key[6]; cluster_addr_key(key, addr);
+    cluster_addr_t *a = NULL;
+    HASH_FIND(hh, g_cluster_addrs, key, sizeof(key), a);
+    if (!a) return;
+    timer_del(&a->timer);
+    HASH_DEL(g_cluster_addrs, a);
+    free(a);
+}
+
+static bool cluster_deliver(const void *buf, int len, const struct sockaddr_in *to) {
+    uint8_t key[6]; cluster_addr_key(key, to);
+    cluster_addr_t *a = NULL;
+    HASH_FIND(hh, g_cluster_addrs, key, sizeof(key), a);
+    if (!a) return false;
+    cluster_send(a->node, CLUSTER_MSG_DOWN, a->tag, to, buf, (size_t)len);
+    return true;
+}
+
+//-------------------------------
+
+// 入口侧：以 owner 上的 auth_key 改写并上送（尚未登录时代发 ONLINE，本包丢弃，由客户端重传）
+static void cluster_up_auth(compact_client_t *c, int node, const uint8_t *buf, size_t len, const struct sockaddr_in *from) {
+
+    if (!c->cluster && !(c->cluster = (cluster_proxy_t*)calloc(1, sizeof(cluster_proxy_t)))) return;
+
+    uint8_t pkt[P2P_MTU];
+    uint64_t key = c->cluster->auth_key[node];
+    if (!key) {
+        p2p_pkt_hdr_encode(pkt, SIG_PKT_ONLINE, 0, 0);
+        memcpy(pkt + 4, c->base.local_peer_id, P2P_PEER_ID_MAX);
+        nwrite_l(pkt + 4 + P2P_PEER_ID_MAX, c->base.instance_id);
+        cluster_send(node, CLUSTER_MSG_UP, c->auth_key, from, pkt, 4 + SIG_PKT_ONLINE_PSZ);
+        return;
+    }
+    if (len > sizeof(pkt)) return;
+    memcpy(pkt, buf, len);
+    nwrite_ll(pkt + 4, key);
+    cluster_send(node, CLUSTER_MSG_UP, c->auth_key, from, pkt, len);
+}
+
+static void cluster_proxy_drop(compact_client_t *c) {
+    if (!c->cluster) return;
+    for (int i = 0; i < g_cluster_n; i++) {
+        if (!c->cluster->auth_key[i]) continue;
+        uint8_t pkt[4 + SIG_PKT_OFFLINE_PSZ];
+        p2p_pkt_hdr_encode(pkt, SIG_PKT_OFFLINE, 0, 0);
+        nwrite_ll(pkt + 4, c->cluster->auth_key[i]);
+        cluster_send(i, CLUSTER_MSG_UP, c->auth_key, &c->addr, pkt, sizeof(pkt));
+    }
+    free(c->cluster);
+    c->cluster = NULL;
+}
+
+// 入口侧路由：返回 true 表示数据报已转交其他节点（本节点不再处理）
+static bool cluster_route(uint8_t *buf, size_t len, const struct sockaddr_in *from) {
+
+    if (g_cluster_addrs) cluster_addr_forget(from);
+
+    uint8_t type = buf[0];
+    switch (type) {
+    case SIG_PKT_SYNC0: {
+        if (len < 4 + SIG_PKT_SYNC0_PSZ(0)) return false;
+        uint64_t auth_key = nget_ll(buf + 4);
+        compact_client_t *c = NULL;
+        c = COMPACT_FIND_BY_AUTH(auth_key);
+        if (!c) return false;
+        int owner = cluster_owner(c->base.local_peer_id, (const char *)buf + 4 + SIG_AUTH_KEY_PSZ);
+        if (owner == g_cluster_self) return false;
+        cluster_up_auth(c, owner, buf, len, from);
+        return true;
+    }
+    case SIG_PKT_ALIVE: {       // 本地处理，同时为各 owner 上的代理登录保活
+        if (len < 4 + SIG_PKT_ALIVE_PSZ) return false;
+        uint64_t auth_key = nget_ll(buf + 4);
+        compact_client_t *c = NULL;
+        c = COMPACT_FIND_BY_AUTH(auth_key);
+        if (c && c->cluster) {
+            for (int i = 0; i < g_cluster_n; i++) if (c->cluster->auth_key[i]) cluster_up_auth(c, i, buf, len, from);
+        }
+        return false;
+    }
+    case SIG_PKT_ONLINE: case SIG_PKT_OFFLINE:
+        return false;
+    default: break;
+    }
+
+    // 会话包（SYNC0_ACK..FIN、MSG_*，以及携带 session_id 的中继数据包）：按 session_id 高位路由
+    bool sess = (type >= SIG_PKT_SYNC0_ACK && type <= SIG_PKT_FIN)
+             || (type >= SIG_PKT_MSG_REQ && type <= SIG_PKT_MSG_RESP_ACK)
+             || (type < 0x80 && (buf[1] & P2P_FLAG_SESSION));
+    if (!sess || len < 4 + P2P_SESS_ID_PSZ) return false;
+    int node = (int)(nget_l(buf + 4) >> CLUSTER_SESS_SHIFT);
+    if (node == g_cluster_self || node >= g_cluster_n) return false;
+    cluster_send(node, CLUSTER_MSG_UP, 0, from, buf, len);
+    return true;
+}
+
+// 处理一帧（接收链路）
+static bool cluster_frame(cluster_conn_t *cc, uint8_t *f, size_t flen) {
+
+    uint8_t type = f[2];
+    uint64_t tag = nget_ll(f + 3);
+
+    if (type == CLUSTER_MSG_HELLO) {
+        if (tag >= (uint64_t)g_cluster_n || (int)tag == g_cluster_self) return false;
+        cc->node = (int)tag;
+        for (size_t i = 0; i < sizeof(g_cluster_in) / sizeof(g_cluster_in[0]); i++) {    // 对端重连：关闭旧链路
+            cluster_conn_t *o = &g_cluster_in[i];
+            if (o != cc && o->fd != P_INVALID_SOCKET && o->node == cc->node) { P_sock_close(o->fd); o->fd = P_INVALID_SOCKET; }
+        }
+        print("I:", "Cluster link from %s accepted\n", g_cluster[cc->node].name);
+        return true;
+    }
+    if (cc->node < 0) return false;
+    g_cluster[cc->node].rx_frames++;
+
+    struct sockaddr_in addr; memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    memcpy(&addr.sin_addr.s_addr, f + 11, 4);
+    memcpy(&addr.sin_port, f + 15, 2);
+    uint8_t *pkt = f + CLUSTER_HDR_SIZE; size_t plen = flen - CLUSTER_HDR_SIZE;
+    if (plen < 4) return true;
+
+    if (type == CLUSTER_MSG_UP) {
+        cluster_addr_touch(&addr, cc->node, tag, P_tick_ms());
+        compact_udp_dispatch(g_udp_fd, pkt, plen, &addr);
+    }
+    else if (type == CLUSTER_MSG_DOWN) {
+        // 代为登录的应答：记下 owner 分配的 auth_key，不交给客户端
+        if (pkt[0] == SIG_PKT_ONLINE_ACK) {
+            compact_client_t *c = NULL;
+            c = COMPACT_FIND_BY_AUTH(tag);
+            if (c && c->cluster && plen >= 4 + SIG_PKT_ONLINE_ACK_PSZ) {
+                c->cluster->auth_key[cc->node] = nget_ll(pkt + 4 + sizeof(uint32_t));
+                print("V:", "Cluster: '%.*s' logged in on %s\n", P2P_PEER_ID_MAX, c->base.local_peer_id, g_cluster[cc->node].name);
+            }
+        }
+        else if (pkt[0] != SIG_PKT_ALIVE_ACK) udp_enqueue(g_udp_fd, "CLUSTER", pkt, (int)plen, &addr);
+    }
+    return true;
+}
+
+static void cluster_conn_close(cluster_conn_t *cc) {
+    if (cc->node >= 0) print("W:", "Cluster link from %s closed\n", g_cluster[cc->node].name);
+    P_sock_close(cc->fd);
+    cc->fd = P_INVALID_SOCKET;
+}
+
+// 接受新链路并读取各接收链路上的帧
+static void cluster_input(void) {
+
+    for (;;) {
+        sock_t fd = accept(g_cluster_listen, NULL, NULL);
+        if (fd == P_INVALID_SOCKET) break;
+        cluster_conn_t *cc = NULL;
+        for (size_t i = 0; i < sizeof(g_cluster_in) / sizeof(g_cluster_in[0]); i++) {
+            if (g_cluster_in[i].fd == P_INVALID_SOCKET) { cc = &g_cluster_in[i]; break; }
+        }
+        if (!cc || P_sock_nonblock(fd, true) != E_NONE || ev_watch(fd, EV_TAG_CLUSTER_IN((int)(cc - g_cluster_in))) != 0) {
+            P_sock_close(fd);
+            continue;
+        }
+        cc->fd = fd; cc->node = -1; cc->len = 0;
+    }
+
+    for (size_t i = 0; i < sizeof(g_cluster_in) / sizeof(g_cluster_in[0]); i++) { cluster_conn_t *cc = &g_cluster_in[i];
+        while (cc->fd != P_INVALID_SOCKET) {
+            ssize_t r = recv(cc->fd, (char *)cc->buf + cc->len, sizeof(cc->buf) - cc->len, 0);
+            if (r < 0 && P_sock_is_interrupted()) continue;
+            if (r < 0 && P_sock_is_wouldblock()) break;
+            if (r <= 0) { cluster_conn_close(cc); break; }
+            cc->len += (uint16_t)r;
+
+            size_t off = 0;
+            while (cc->len - off >= 2) {
+                size_t flen = nget_s(cc->buf + off);
+                if (flen < CLUSTER_HDR_SIZE || flen > CLUSTER_FRAME_MAX) { cluster_conn_close(cc); break; }
+                if (cc->len - off < flen) break;
+                if (!cluster_frame(cc, cc->buf + off, flen)) { cluster_conn_close(cc); break; }
+                off += flen;
+            }
+            if (cc->fd == P_INVALID_SOCKET) break;
+            cc->len -= (uint16_t)off;
+            memmove(cc->buf, cc->buf + off, cc->len);
+        }
+    }
+}
+
+// 解析 --cluster 节点列表并开始监听节点间链路
+static int cluster_init(const char *list, const char *self, int link_port) {
+
+    for (const char *p = list; *p; ) {
+        size_t len = strcspn(p, ",");
+        if (len) {
+            if (g_cluster_n >= CLUSTER_MAX_NODES || len >= sizeof(g_cluster[0].name)) return -1;
+            cluster_node_t *n = &g_cluster[g_cluster_n];
+            memcpy(n->name, p, len); n->name[len] = '\0';
+            char host[64]; memcpy(host, n->name, len + 1);
+            char *colon = strrchr(host, ':'); if (colon) *colon = '\0';
+            if (resolve_host(host, (uint16_t)link_port, &n->link_addr) != E_NONE) {
+                print("E:", "Cluster node %s: cannot resolve host\n", n->name);
+                return -1;
+            }
+            n->fd = P_INVALID_SOCKET;
+            if (!strcmp(n->name, self)) g_cluster_self = g_cluster_n;
+            else if (!(n->out_buf = (uint8_t*)malloc(CLUSTER_SENDBUF_MAX))) return -1;
+            g_cluster_n++;
+        }
+        p += len; if (*p) p++;
+    }
+    if (g_cluster_self < 0) { print("E:", "--cluster-self '%s' is not in --cluster\n", self); return -1; }
+
+    for (size_t i = 0; i < sizeof(g_cluster_in) / sizeof(g_cluster_in[0]); i++) g_cluster_in[i].fd = P_INVALID_SOCKET;
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons((uint16_t)link_port);
+    int on = 1;
+    g_cluster_listen = socket(AF_INET, SOCK_STREAM, 0);
+    if (g_cluster_listen == P_INVALID_SOCKET) return -1;
+    setsockopt(g_cluster_listen, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on));
+    if (bind(g_cluster_listen, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(g_cluster_listen, CLUSTER_MAX_NODES * 2) < 0
+        || P_sock_nonblock(g_cluster_listen, true) != E_NONE) {
+        print("E:", "Cluster link bind on port %d failed(%d)\n", link_port, P_sock_errno());
+        return -1;
+    }
+    return 0;
+}
+
+static void cluster_shutdown(void) {
+    for (int i = 0; i < g_cluster_n; i++) {
+        if (g_cluster[i].fd != P_INVALID_SOCKET) P_sock_close(g_cluster[i].fd);
+        free(g_cluster[i].out_buf); g_cluster[i].out_buf = NULL;
+    }
+    for (size_t i = 0; i < sizeof(g_cluster_in) / sizeof(g_cluster_in[0]); i++)
+        if (g_cluster_in[i].fd != P_INVALID_SOCKET) P_sock_close(g_cluster_in[i].fd);
+    if (g_cluster_listen != P_INVALID_SOCKET) P_sock_close(g_cluster_listen);
+    cluster_addr_t *a, *tmp;
+    HASH_ITER(hh, g_cluster_addrs, a, tmp) { HASH_DEL(g_cluster_addrs, a); free(a); }
+    for (int i = 0; i < g_compact_pool.cap; i++) { compact_client_t *c = COMPACT_CLIENT_AT(i);
+        if (c->base.valid) { free(c->cluster); c->cluster = NULL; }
+    }
+    g_cluster_n = 0;
+}
+
+//-----------------------------------------------------------------------------
+// 热重启：COMPACT 客户端 / 会话快照（--state）
+
+/* 快照文件：[头部][客户端记录 × client_cnt][会话记录 × session_cnt]
+ * + 定长记录、本机字节序，整体读入（或 mmap）即可按下标访问；头部记录各记录大小，结构变化的旧快照直接作废
+ * + 退出时写入临时文件再 rename，避免半截文件；启动时读入后即删除，崩溃重启不会重放旧状态
+ * + 恢复 auth_key / session_id / 候选 / 配对关系 / SYNC0 确认状态；进行中的 MSG RPC 不保存（由客户端超时重试）
+ * + 集群模式下一并保存 owner 侧的代理地址映射；入口侧的代理登录在首次上送时自动重建
+ */
+#define SNAP_MAGIC                  0x50435332u                 // "2SCP"
+#define SNAP_VERSION                1
+#define SNAP_PEER_STALE             0xFFFFFFFFu                 // peer_session_id：对端已断开（peer == -1）
+
+typedef struct snap_hdr {
+    uint32_t                        magic;
+    uint32_t                        version;
+    uint32_t                        client_size;                // sizeof(snap_client_t)
+    uint32_t                        session_size;               // sizeof(snap_session_t)
+    uint32_t                        client_cnt;
+    uint32_t                        session_cnt;
+    int32_t                         cluster_self;               // 写入时的集群节点号（-1 = 未启用）
+    uint32_t                        reserved;
+    uint64_t                        saved_at;                   // 写入时间（Unix 秒）
+} snap_hdr_t;
+
+typedef struct snap_client {
+    char                            peer_id[P2P_PEER_ID_MAX];
+    uint64_t                        auth_key;
+    uint64_t                        cluster_tag;                // 代理客户端：入口节点上的 auth_key
+    uint32_t                        instance_id;
+    uint32_t                        ip;                         // 网络字节序
+    uint16_t                        port;                       // 网络字节序
+    int16_t                         cluster_node;               // 代理客户端的入口节点（-1 = 本地客户端）
+    uint32_t                        reserved;
+} snap_client_t;
+
+typedef struct snap_session {
+    uint32_t                        session_id;
+    uint32_t                        client;                     // 客户端记录下标
+    uint32_t                        peer_session_id;            // 0 = 未配对，SNAP_PEER_STALE = 对端已断开
+    int8_t                          sync0_acked;
+    uint8_t                         sync0_pending;              // 有待确认的 seq=0（恢复后重新计时重传）
+    uint8_t                         sync0_base_index;
+    uint8_t                         addr_notify_seq;
+    uint16_t                        rpc_last_sid;
+    uint8_t                         candidate_count;
+    uint8_t                         reserved;
+    char                            remote_peer_id[P2P_PEER_ID_MAX];
+    p2p_candidate_t                 candidates[MAX_CANDIDATES];
+} snap_session_t;
+
+static int snap_save(const char *path) {
+
+    snap_hdr_t hdr = { SNAP_MAGIC, SNAP_VERSION, sizeof(snap_client_t), sizeof(snap_session_t), 0, 0, g_cluster_self, 0, (uint64_t)time(NULL) };
+    for (int i = 0; i < g_compact_pool.cap; i++) { compact_client_t *c = COMPACT_CLIENT_AT(i);
+        if (!c->base.valid || !c->auth_key) continue;
+        hdr.client_cnt++;
+        for (session_t *s = c->base.sessions; s; s = s->next) hdr.session_cnt++;
+    }
+
+    // 客户端记录下标 = 写入顺序（按槽位记下，供会话记录引用）
+    uint32_t *index = (uint32_t*)malloc((size_t)(g_compact_pool.cap ? g_compact_pool.cap : 1) * sizeof(uint32_t));
+    if (!index) return -1;
+
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) { free(index); return -1; }
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+
+    uint32_t idx = 0;
+    for (int i = 0; ok && i < g_compact_pool.cap; i++) { compact_client_t *c = COMPACT_CLIENT_AT(i);
+        if (!c->base.valid || !c->auth_key) continue;
+        snap_client_t r; memset(&r, 0, sizeof(r));
+        memcpy(r.peer_id, c->base.local_peer_id, P2P_PEER_ID_MAX);
+        r.auth_key = c->auth_key;
+        r.instance_id = c->base.instance_id;
+        r.ip = c->addr.sin_addr.s_addr;
+        r.port = c->addr.sin_port;
+        r.cluster_node = -1;
+        if (g_cluster_addrs) {
+            uint8_t key[6]; cluster_addr_key(key, &c->addr);
+            cluster_addr_t *a = NULL;
+            HASH_FIND(hh, g_cluster_addrs, key, sizeof(key), a);
+            if (a) { r.cluster_node = (int16_t)a->node; r.cluster_tag = a->tag; }
+        }
+        index[i] = idx++;
+        ok = fwrite(&r, sizeof(r), 1, fp) == 1;
+    }
+    for (int i = 0; ok && i < g_compact_pool.cap; i++) { compact_client_t *c = COMPACT_CLIENT_AT(i);
+        if (!c->base.valid || !c->auth_key) continue;
+        for (session_t *s = c->base.sessions; ok && s; s = s->next) { compact_session_t *cs = (compact_session_t*)s;
+            snap_session_t r; memset(&r, 0, sizeof(r));
+            r.session_id = s->session_id;
+            r.client = index[i];
+            r.peer_session_id = PEER_ONLINE(cs) ? cs->peer->base.session_id : cs->peer ? SNAP_PEER_STALE : 0;
+            r.sync0_acked = (int8_t)cs->sync0_acked;
+            r.sync0_pending = timer_active(&cs->sync0_timer);
+            r.sync0_base_index = cs->sync0_base_index;
+            r.addr_notify_seq = cs->addr_notify_seq;
+            r.rpc_last_sid = cs->rpc_last_sid;
+            r.candidate_count = (uint8_t)cs->candidate_count;
+            memcpy(r.remote_peer_id, cs_remote_peer(cs), P2P_PEER_ID_MAX);
+            if (cs->candidate_count) memcpy(r.candidates, cs->candidates, sizeof(p2p_candidate_t) * cs->candidate_count);
+            ok = fwrite(&r, sizeof(r), 1, fp) == 1;
+        }
+    }
+    free(index);
+    if (fclose(fp) != 0) ok = false;
+#if P_WIN
+    if (ok) remove(path);       // Windows rename 不覆盖已有文件
+#endif
+    if (!ok || rename(tmp, path) != 0) { remove(tmp); return -1; }
+
+    print("I:", "State saved to %s: %u clients, %u sessions\n", path, hdr.client_cnt, hdr.session_cnt);
+    return 0;
+}
+
+static int snap_load(const char *path, uint64_t now) {
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+
+    uint8_t *data = NULL; long size = 0;
+    if (fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) >= (long)sizeof(snap_hdr_t) && fseek(fp, 0, SEEK_SET) == 0
+        && (data = (uint8_t*)malloc((size_t)size)) && fread(data, 1, (size_t)size, fp) != (size_t)size) {
+        free(data); data = NULL;
+    }
+    fclose(fp);
+    remove(path);
+    if (!data) { print("W:", "State file %s unreadable, ignored\n", path); return -1; }
+
+    snap_hdr_t hdr; memcpy(&hdr, data, sizeof(hdr));
+    const snap_client_t *cr = (const snap_client_t*)(void*)(data + sizeof(hdr));
+    const snap_session_t *sr = (const snap_session_t*)(void*)(cr + hdr.client_cnt);
+    uint64_t age = (uint64_t)time(NULL) - hdr.saved_at;
+    const char *why = NULL;
+    if (hdr.magic != SNAP_MAGIC || hdr.version != SNAP_VERSION
+        || hdr.client_size != sizeof(snap_client_t) || hdr.session_size != sizeof(snap_session_t)) why = "format mismatch";
+    else if (hdr.client_cnt > (uint32_t)g_compact_pool.max
+          || (size_t)size != sizeof(hdr) + (size_t)hdr.client_cnt * sizeof(snap_client_t) + (size_t)hdr.session_cnt * sizeof(snap_session_t)) why = "truncated";
+    else if (hdr.saved_at > (uint64_t)time(NULL) || age > COMPACT_PAIR_TIMEOUT_S) why = "expired";
+    else if (hdr.cluster_self != g_cluster_self) why = "cluster node changed";
+    if (why) {
+        print("W:", "State file %s discarded (%s)\n", path, why);
+        free(data);
+        return -1;
+    }
+
+    compact_client_t **clients = (compact_client_t**)calloc(hdr.client_cnt ? hdr.client_cnt : 1, sizeof(*clients));
+    if (!clients) { free(data); return -1; }
+
+    uint32_t nc = 0, ns = 0;
+    for (uint32_t i = 0; i < hdr.client_cnt; i++) { const snap_client_t *r = &cr[i];
+        compact_client_t *dup = NULL;
+        if (!r->auth_key || !r->peer_id[0]) continue;
+        dup = COMPACT_FIND_BY_AUTH(r->auth_key);
+        if (!dup) HASH_FIND(hh_name, g_compact_clients_by_name, r->peer_id, P2P_PEER_ID_MAX, dup);
+        if (dup) continue;
+        if (flat_index_reserve(&g_compact_auth_index, 1) < 0) break;
+        compact_client_t *c = (compact_client_t*)pool_alloc(&g_compact_pool);
+        if (!c) break;
+
+        // 与 ONLINE 分配槽位时的初始化一致；last_active 从恢复时刻起算
+        c->base.valid = true;
+        memcpy(c->base.local_peer_id, r->peer_id, P2P_PEER_ID_MAX);
+        c->base.instance_id = r->instance_id;
+        c->base.last_active = now;
+        c->base.sessions = NULL;
+        c->base.rx_pkts = c->base.rx_bytes = 0;
+        memset(&c->addr, 0, sizeof(c->addr));
+        c->addr.sin_family = AF_INET;
+        c->addr.sin_addr.s_addr = r->ip;
+        c->addr.sin_port = r->port;
+        c->cluster = NULL;
+        c->auth_key = r->auth_key;
+        c->bind_life_s = 0;
+        c->alive_s = 0;         // 客户端下一次 ALIVE 时重新通告
+        timer_add(&c->base.idle_timer, now + compact_idle_timeout_ms(c) + 1, compact_idle_expire);
+        flat_index_put(&g_compact_auth_index, c->auth_key, c);
+        HASH_ADD(hh_name, g_compact_clients_by_name, base.local_peer_id, P2P_PEER_ID_MAX, c);
+        if (r->cluster_node >= 0 && r->cluster_node < g_cluster_n && r->cluster_node != g_cluster_self)
+            cluster_addr_touch(&c->addr, r->cluster_node, r->cluster_tag, now);
+        clients[i] = c;
+        nc++;
+    }
+
+    // 会话：经 build_session 建立会话对后换回原 session_id
+    for (uint32_t i = 0; i < hdr.session_cnt; i++) { const snap_session_t *r = &sr[i];
+        session_t *dup = NULL, *ls = NULL, *rs = NULL;
+        if (r->client >= hdr.client_cnt || !clients[r->client] || !r->session_id) continue;
+        dup = SESSION_FIND(r->session_id);
+        if (dup || build_session(&clients[r->client]->base, r->remote_peer_id, &ls, &rs, sizeof(compact_session_t)) < 0) continue;
+        flat_index_del(&g_session_index, ls->session_id);
+        ls->session_id = r->session_id;
+        flat_index_put(&g_session_index, ls->session_id, ls);     // 刚删除一项，不会扩容
+
+        compact_session_t *cs = (compact_session_t*)ls;
+        cs->sync0_acked = r->sync0_acked;
+        cs->sync0_base_index = r->sync0_base_index;
+        cs->addr_notify_seq = r->addr_notify_seq;
+        cs->rpc_last_sid = r->rpc_last_sid;
+        compact_set_candidates(cs, r->candidates, r->candidate_count > MAX_CANDIDATES ? MAX_CANDIDATES : r->candidate_count);
+        if (r->peer_session_id == SNAP_PEER_STALE) cs->peer = (compact_session_t*)(void*)-1;
+        ns++;
+    }
+
+    // 配对关系：双方均已恢复且互指时重新配对（同时重建快速转发表）
+    for (uint32_t i = 0; i < hdr.session_cnt; i++) { const snap_session_t *r = &sr[i];
+        if (!r->peer_session_id || r->peer_session_id == SNAP_PEER_STALE) continue;
+        session_t *s = NULL, *p = NULL;
+        s = SESSION_FIND(r->session_id);
+        p = SESSION_FIND(r->peer_session_id);
+        if (!s || !p || s->pair != p->pair || ((compact_session_t*)s)->peer) continue;
+        compact_session_t *cs = (compact_session_t*)s, *ps = (compact_session_t*)p;
+        if (ps->peer) continue;
+        cs->peer = ps; ps->peer = cs;
+        compact_fwd_pair(cs);
+    }
+    for (uint32_t i = 0; i < hdr.session_cnt; i++) { const snap_session_t *r = &sr[i];
+        session_t *s = NULL;
+        if (!r->sync0_pending || r->client >= hdr.client_cnt || !clients[r->client]) continue;
+        s = SESSION_FIND(r->session_id);
+        if (s && s->client == &clients[r->client]->base) enqueue_compact_sync0_pending((compact_session_t*)s, r->sync0_base_index, now);
+    }
+
+    print("I:", "State restored from %s (%" PRIu64 "s old): %u clients, %u sessions\n", path, age, nc, ns);
+    free(clients);
+    free(data);
+    return 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 #ifdef MOD_TAG
@@ -2990,6 +5786,7 @@ void signal_handler(int signum) {
         print("I: \n%s\n", LA_S("Received shutdown signal, exiting gracefully...", LA_S7, 7));
         g_running = 0;
     }
+    if (signum == SIGUSR1) g_hot_dump = 1;
 }
 #endif
 
@@ -3026,6 +5823,7 @@ int main(int argc, char *argv[]) {
             &ARGS_DEF_msg,
             &ARGS_DEF_ws,
             &ARGS_DEF_ws_port,
+            &ARGS_DEF_workers,
             &ARGS_DEF_cn,
             NULL);
     }
@@ -3047,6 +5845,13 @@ int main(int argc, char *argv[]) {
         ARGS_print(argv[0]);
         return 1;
     }
+    if (ARGS_metrics_port.i64 < 0 || ARGS_metrics_port.i64 > 65535) {
+        print("E:", "Invalid metrics port %d (range: 0-65535)\n", (int)ARGS_metrics_port.i64);
+        ARGS_print(argv[0]);
+        return 1;
+    }
+    g_hot_k = ARGS_hot_top.i64 < 0 ? 0 : ARGS_hot_top.i64 == 0 ? HOT_TOP_DEFAULT
+            : ARGS_hot_top.i64 > HOT_TOP_MAX ? HOT_TOP_MAX : (int)ARGS_hot_top.i64;
     
     if (P_net_init() != E_NONE) {
         print("E:", LA_F("net init failed\n", LA_F140, 140));
@@ -3063,6 +5868,19 @@ int main(int argc, char *argv[]) {
           (int)ARGS_probe_port.i64);
     print("I:", LA_F("Relay support: %s\n", LA_F102, 102), 
           ARGS_relay.i64 ? LA_W("enabled", LA_W2, 2) : LA_W("disabled", LA_W1, 1));
+    if (ARGS_relay_mem.i64 > 0) g_relay_bufs.cap = (size_t)ARGS_relay_mem.i64 << 20;
+    if (ARGS_rpc_window.i64 > 0)
+        g_rpc_window = ARGS_rpc_window.i64 > P2P_RPC_WINDOW_MAX ? P2P_RPC_WINDOW_MAX : (int)ARGS_rpc_window.i64;
+    if (ARGS_alive_pps.i64 > 0) g_alive_pps = ARGS_alive_pps.i64 > 1000000 ? 1000000 : (int)ARGS_alive_pps.i64;
+    if (ARGS_rate_limit.i64 > 0) {
+        if (ARGS_rate_limit.i64 > 1000000) ARGS_rate_limit.i64 = 1000000;
+        g_rate_ip = (rate_table_t*)calloc(1, sizeof(rate_table_t));
+        g_rate_auth = (rate_table_t*)calloc(1, sizeof(rate_table_t));
+        if (!g_rate_ip || !g_rate_auth) { print("E:", "Rate limiter: out of memory\n"); return 1; }
+        print("I:", "Rate limit: %d requests/s per source IP and auth_key (burst %d)\n",
+              (int)ARGS_rate_limit.i64, (int)ARGS_rate_limit.i64 * 2);
+    }
+    print("I:", "Relay buffer memory cap: %zu MB\n", g_relay_bufs.cap >> 20);
 #ifdef WITH_WSLAY
     if (!ARGS_ws.i64) {
         print("I:", "WebSocket service: disabled\n");
@@ -3081,6 +5899,7 @@ int main(int argc, char *argv[]) {
 #else
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    signal(SIGUSR1, signal_handler);   /* 热点来源表输出到日志（--hot-top） */
     signal(SIGPIPE, SIG_IGN);  /* 屏蔽 SIGPIPE：对端 socket 关闭时 send() 返回 EPIPE 而不是 kill 进程 */
 #endif
 
@@ -3100,6 +5919,11 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     setsockopt(udp_fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&sockopt, sizeof(sockopt));
+#ifdef SERVER_UDP_WORKERS
+    // 接收线程的套接字与主套接字组成 SO_REUSEPORT 组（须在 bind 前设置）
+    if (ARGS_workers.i64 > 0)
+        setsockopt(udp_fd, SOL_SOCKET, SO_REUSEPORT, (const char *)&sockopt, sizeof(sockopt));
+#endif
 
     // 创建 NAT 探测 UDP 套接字（可选，仅当配置了 probe_port 时）
     sock_t probe_fd = P_INVALID_SOCKET;
@@ -3146,14 +5970,86 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    // 指标 HTTP 监听（可选，独立端口；绑定失败时仅禁用指标导出）
+    sock_t metrics_fd = P_INVALID_SOCKET;
+    if (ARGS_metrics_port.i64 > 0) {
+        struct sockaddr_in metrics_addr = {0};
+        metrics_addr.sin_family = AF_INET;
+        metrics_addr.sin_addr.s_addr = INADDR_ANY;
+        metrics_addr.sin_port = htons((uint16_t)ARGS_metrics_port.i64);
+        metrics_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (metrics_fd != P_INVALID_SOCKET) {
+            setsockopt(metrics_fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&sockopt, sizeof(sockopt));
+            if (bind(metrics_fd, (struct sockaddr *)&metrics_addr, sizeof(metrics_addr)) < 0 || listen(metrics_fd, 16) < 0) {
+                P_sock_close(metrics_fd);
+                metrics_fd = P_INVALID_SOCKET;
+            }
+        }
+        if (metrics_fd == P_INVALID_SOCKET)
+            print("W:", "Metrics disabled (listen on port %d failed: %d)\n", (int)ARGS_metrics_port.i64, P_sock_errno());
+        else print("I:", "Metrics endpoint: http://0.0.0.0:%d/metrics\n", (int)ARGS_metrics_port.i64);
+    }
+
     // 启动 TCP 监听（用于 Relay 模式与客户端连接）
-    listen(listen_fd, 10);
+    // + 大量客户端同时（重）连时，系统上限的积压队列避免握手被丢弃
+    listen(listen_fd, SOMAXCONN);
     print("I:", LA_F("P2P Signaling Server listening on port %d (TCP + UDP)...\n", LA_F99, 99), port);
 
+    // 初始化事件循环后端，注册监听 / UDP / 探测套接字（RELAY 客户端在 accept 时注册）
+    if (ev_open() != 0 || ev_watch(listen_fd, EV_TAG_LISTEN) != 0 || ev_watch(udp_fd, EV_TAG_UDP) != 0
+        || (probe_fd != P_INVALID_SOCKET && ev_watch(probe_fd, EV_TAG_PROBE) != 0)
+        || (metrics_fd != P_INVALID_SOCKET && ev_watch(metrics_fd, EV_TAG_METRICS) != 0)) {
+        print("E:", LA_F("%s init failed(%d)\n", LA_F150, 150), EV_BACKEND, P_sock_errno());
+        return 1;
+    }
+    print("I:", LA_F("Event loop: %s, up to %d relay clients\n", LA_F151, 151), EV_BACKEND, MAX_RELAY_CLIENTS);
+
+    // STUN Binding 应答：主地址复用信令 / 探测套接字，备用 IP 另绑两个套接字（绑定失败仅禁用对应的 CHANGE-REQUEST）
+    if (ARGS_stun.i64) {
+        g_stun_socks[0][0] = udp_fd;
+        g_stun_socks[0][1] = probe_fd;
+        if (ARGS_stun_alt_ip.str && *ARGS_stun_alt_ip.str) {
+            if (inet_pton(AF_INET, ARGS_stun_alt_ip.str, &g_stun_alt_ip) != 1) {
+                print("E:", "invalid --stun-alt-ip '%s'\n", ARGS_stun_alt_ip.str);
+                return 1;
+            }
+            g_stun_socks[1][0] = stun_alt_open((uint16_t)port);
+            if (probe_fd != P_INVALID_SOCKET) g_stun_socks[1][1] = stun_alt_open((uint16_t)ARGS_probe_port.i64);
+        }
+        print("I:", "STUN responder enabled (change-ip %s, change-port %s)\n",
+              g_stun_socks[1][0] != P_INVALID_SOCKET ? "on" : "off", probe_fd != P_INVALID_SOCKET ? "on" : "off");
+    }
+
+    // 集群：解析节点列表、监听节点间链路（出链路由 cluster_tick 建立）
+    if (ARGS_cluster.str && *ARGS_cluster.str) {
+        if (!ARGS_cluster_self.str || !*ARGS_cluster_self.str || ARGS_cluster_port.i64 <= 0 || ARGS_cluster_port.i64 > 65535) {
+            print("E:", "--cluster requires --cluster-self and --cluster-port\n");
+            return 1;
+        }
+        if (cluster_init(ARGS_cluster.str, ARGS_cluster_self.str, (int)ARGS_cluster_port.i64) != 0
+            || ev_watch(g_cluster_listen, EV_TAG_CLUSTER) != 0) {
+            cluster_shutdown();
+            return 1;
+        }
+        print("I:", "Cluster: node %d of %d (%s), link port %d\n",
+              g_cluster_self, g_cluster_n, g_cluster[g_cluster_self].name, (int)ARGS_cluster_port.i64);
+    }
+
+    // 启动 COMPACT UDP 接收线程
+    if (ARGS_workers.i64 > 0) {
+#ifdef SERVER_UDP_WORKERS
+        int n = udp_workers_start((int)ARGS_workers.i64, &addr);
+        print("I:", LA_F("COMPACT UDP receive workers: %d (SO_REUSEPORT)\n", LA_F155, 155), n);
+#else
+        print("W:", LA_F("--workers requires Linux SO_REUSEPORT, ignored\n", LA_F156, 156));
+#endif
+    }
+
 #ifdef WITH_WSLAY
     if (ARGS_ws.i64) {
         ws_server_cfg_t ws_cfg = {0};
         ws_cfg.on_message = ws_on_msg_broadcast; /* 广播收到的消息给所有客户端 */
+        ws_cfg.on_connect = ws_on_connect_replay; /* 新连接补发保留的 PUBSUB 推送帧 */
         /* ws_port>0: 独立端口，ws_server 自建监听；否则嵌入同端口（port=0）*/
         uint16_t ws_listen_port = (uint16_t)(ARGS_ws_port.i64 > 0 ? ARGS_ws_port.i64 : 0);
         g_ws_srv = ws_server_create(&ws_cfg, ws_listen_port);
@@ -3168,92 +6064,72 @@ int main(int argc, char *argv[]) {
 #endif
 
     // 主循环
-    fd_set read_fds;
-    uint64_t last_cleanup = P_tick_ms(), last_compact_retry_check = last_cleanup;
+    g_udp_fd = udp_fd;
+    timer_init(P_tick_ms());
+    if (g_cluster_n) timer_add(&g_cluster_timer, P_tick_ms(), cluster_tick);
+    if (ARGS_state.str && *ARGS_state.str) snap_load(ARGS_state.str, P_tick_ms());
     while (g_running) {
 
-        uint64_t now = P_tick_ms();
+        uint64_t now = P_tick_ms(), loop_us = P_tick_us();
 
-        // 周期清理过期的 COMPACT 配对记录和 Relay 客户端连接
-        if (tick_diff(now, last_cleanup) >= CLEANUP_INTERVAL_S * 1000) {
-            cleanup_compact_clients(udp_fd);
-            cleanup_relay_clients();
-            last_cleanup = now;
-        }
-        
-        // 检查并重传未确认的 SYNC 包 + MSG RPC 包（每秒检查一次）
-        if (tick_diff(now, last_compact_retry_check) >= COMPACT_RETRY_INTERVAL_MS) {
-            if (g_compact_sync0_pending_head) retry_compact_sync0_pending(udp_fd, now);
-            if (g_compact_rpc_pending_head) retry_compact_rpc_pending(udp_fd, now);
-            if (g_relay_rpc_pending_head)  retry_relay_rpc_pending(now);
-            last_compact_retry_check = now;
-        }
-
-        // 设置要监听的套接口 fd
-        // + TCP listen + TCP clients + UDP + probe UDP + 客户端...
-        // + max_fd 必须是所有监听套接字中数值最大的那个（Windows 不使用此值，但 POSIX 需要正确设置）
-        int max_fd = 0;
-        fd_set write_fds;
-        FD_ZERO(&read_fds);
-        FD_ZERO(&write_fds);
-        FD_SET(listen_fd, &read_fds);
-        FD_SET(udp_fd, &read_fds);
-        if (probe_fd != P_INVALID_SOCKET) FD_SET(probe_fd, &read_fds);
-#if !P_WIN
-        max_fd = (int)((listen_fd > udp_fd) ? listen_fd : udp_fd);
-        if (probe_fd != P_INVALID_SOCKET && (int)probe_fd > max_fd) max_fd = (int)probe_fd;
-#endif
-        // 添加有效的 TCP 客户端套接字到监听集合中
-        for (int i = 0; i < MAX_PEERS; i++) {
-            if (g_relay_clients[i].base.valid && g_relay_clients[i].fd != P_INVALID_SOCKET) {
-                FD_SET(g_relay_clients[i].fd, &read_fds);                
-                // 如果有待发送的 ONLINE_ACK 或 session 数据，监听可写事件
-                if (g_relay_clients[i].online_ack_pending || g_relay_clients[i].sending_head)
-                    FD_SET(g_relay_clients[i].fd, &write_fds);                
-#if !P_WIN
-                if ((int)g_relay_clients[i].fd > max_fd) max_fd = (int)g_relay_clients[i].fd;
-#endif
-            }
-        }
+        // 触发到期定时器：SYNC / MSG RPC 重传、RPC 超时、客户端空闲超时
+        timer_run(now);
 
-        // 等待套接口数据（超时1秒，用于周期性清理）
+        // 等待套接口事件，超时取最近的定时器到期时间（无定时器时最长 1 秒）
         // WS 启用时缩短至 50ms，以减少 WebSocket 消息延迟
 #ifdef WITH_WSLAY
-        struct timeval tv = g_ws_srv ? (struct timeval){0, 50000} : (struct timeval){1, 0};
+        int timeout_ms = timer_next_ms(now, g_ws_srv ? 50 : 1000);
 #else
-        struct timeval tv = {1, 0};
+        int timeout_ms = timer_next_ms(now, 1000);
 #endif
-        int sel_ret = select(max_fd + 1, &read_fds, &write_fds, NULL, &tv);
-        if (sel_ret < 0) {
+        udp_flush();    // 上一轮（含重传 / 清理）排队的 UDP 回包
+        if (g_cluster_n) cluster_flush_all();
+        uint64_t wait_us = P_tick_us();
+        int ev_bits = ev_wait(timeout_ms, listen_fd, udp_fd, probe_fd, metrics_fd);
+        if (ev_bits < 0) {
             if (P_sock_is_interrupted()) continue;  // 被信号打断，继续循环
-            print("E:", LA_F("select failed(%d)\n", LA_F143, 143), P_sock_errno());
+            print("E:", LA_F("%s failed(%d)\n", LA_F152, 152), EV_BACKEND, P_sock_errno());
             break;
         }
+        loop_us -= P_tick_us() - wait_us;           // 处理耗时不含事件等待
 
         //-------------------------------
 
         // 如果存在新的 TCP 连接请求，accept 并将其添加到客户端列表中
-        if (FD_ISSET(listen_fd, &read_fds)) {
+        if (ev_bits & EV_BIT_LISTEN) {
 
             struct sockaddr_in client_addr; socklen_t client_len = sizeof(client_addr);
             sock_t client_fd = accept(listen_fd, (struct sockaddr *)&client_addr, &client_len);
+            if (client_fd != P_INVALID_SOCKET && rate_take_ip(&client_addr, now)) {
+                P_sock_close(client_fd);
+                continue;
+            }
             
             // 设置为非阻塞模式，避免慢客户端阻塞整个服务器事件循环
             if (P_sock_nonblock(client_fd, true) != E_NONE) {
                 print("W:", LA_F("[TCP] Failed to set client socket to non-blocking mode\n", LA_F130, 130));
             }
+            if (!ARGS_nagle.i64) tcp_nodelay(client_fd);
 
 #ifdef WITH_WSLAY
             /* 同端口 WS 检测：仅在嵌入模式（无独立端口）时执行。
-             * 需要先用 select() 等数据到达，因为 socket 已设为非阻塞，
-             * 直接 recv+MSG_PEEK 会立刻返回 EAGAIN（数据尚未到达）。 */
+             * 需要先等数据到达，因为 socket 已设为非阻塞，
+             * 直接 recv+MSG_PEEK 会立刻返回 EAGAIN（数据尚未到达）。
+             * epoll/kqueue 下 fd 可能超出 FD_SETSIZE，改用 poll() */
             if (g_ws_srv && ARGS_ws_port.i64 == 0) {
+                char peek_byte = 0;
+#if defined(SERVER_EPOLL) || defined(SERVER_KQUEUE)
+                struct pollfd _pp = { client_fd, POLLIN, 0 };
+                if (poll(&_pp, 1, 200) > 0) {       /* 最多等 200ms */
+                    recv(client_fd, &peek_byte, 1, MSG_PEEK);
+                }
+#else
                 fd_set _ps; FD_ZERO(&_ps); FD_SET(client_fd, &_ps);
                 struct timeval _pt = {0, 200000}; /* 最多等 200ms */
-                char peek_byte = 0;
                 if (select((int)client_fd + 1, &_ps, NULL, NULL, &_pt) > 0) {
                     recv(client_fd, &peek_byte, 1, MSG_PEEK);
                 }
+#endif
                 if (peek_byte == 'G') {
                     if (ws_server_inject_fd(g_ws_srv, client_fd) != 0) {
                         print("W:", "[WS] inject_fd failed (slots full), closing\n");
@@ -3265,96 +6141,117 @@ int main(int argc, char *argv[]) {
             }
 #endif
             
-            int i = 0;
-            for (i = 0; i < MAX_PEERS; i++) {
-
-                // 查找一个空闲槽位来存储这个新的连接
-                if (!g_relay_clients[i].base.valid) {
-
-                    buffer_item_t *buf_item = relay_buf_alloc(RELAY_FRAME_SIZE);
-                    if (!buf_item) {
-                        print("E:", LA_F("[TCP] OOM: cannot allocate recv buffer for new client\n", LA_F133, 133));
-                        P_sock_close(client_fd);
-                        i = MAX_PEERS + 1;
-                        break;
-                    }
-
-                    g_relay_clients[i].base.valid = true;
-                    g_relay_clients[i].base.last_active = P_tick_ms();
-                    g_relay_clients[i].base.local_peer_id[0] = '\0';
-                    g_relay_clients[i].base.instance_id = 0;
-                    g_relay_clients[i].base.sessions = NULL;
-
-                    g_relay_clients[i].fd = client_fd;
-                    g_relay_clients[i].online_ack_pending = false;
-                    g_relay_clients[i].recv_buf = ITEM2BUF(buf_item);
-                    g_relay_clients[i].recv_len = 0;
-                    g_relay_clients[i].sending_head = NULL;
-                    g_relay_clients[i].sending_rear = NULL;
-                    g_relay_clients[i].send_offset = 0;
-
-                    print("V:", LA_F("[TCP] New connection from %s:%d\n", LA_F132, 132), 
-                          inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-                    break;
-                }
-            }
-            if (i == MAX_PEERS) {
+            // 从客户端池分配槽位（优先复用空闲槽位，不足时按 slab 增长）
+            relay_client_t *nc = (relay_client_t*)pool_alloc(&g_relay_pool);
+            buffer_item_t *buf_item = nc ? relay_buf_alloc(RELAY_FRAME_SIZE) : NULL;
+            if (!nc) {
                 print("W:", LA_F("[TCP] Max peers reached, rejecting connection\n", LA_F131, 131));
                 P_sock_close(client_fd);
             }
+            else if (!buf_item) {
+                print("E:", LA_F("[TCP] OOM: cannot allocate recv buffer for new client\n", LA_F133, 133));
+                pool_free(&g_relay_pool, &nc->base);
+                P_sock_close(client_fd);
+            }
+            else {
+                relay_client_init(nc, client_fd);
+                nc->ip = client_addr.sin_addr.s_addr;
+                nc->zc = ARGS_relay_zerocopy.i64 && tcp_zerocopy(client_fd);
+                nc->recv_buf = ITEM2BUF(buf_item);
+                timer_add(&nc->base.idle_timer, nc->base.last_active + RELAY_CLIENT_TIMEOUT_S * 1000 + 1, relay_idle_expire);
+
+                if (ev_watch_client(nc) != 0) {
+                    print("W:", LA_F("[TCP] Failed to watch client socket (%d), rejecting\n", LA_F153, 153), P_sock_errno());
+                    relay_clear_client(nc);
+                }
+                else print("V:", LA_F("[TCP] New connection from %s:%d\n", LA_F132, 132),
+                           inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+            }
         }
         
         // UDP 监听端口收到数据包（COMPACT 模式的信令交互）
-        if (FD_ISSET(udp_fd, &read_fds)) {
-
+        // + Linux 下以 recvmmsg 一次取出最多 UDP_BATCH_MAX 个包（重连风暴时大幅减少系统调用）
+        if (ev_bits & EV_BIT_UDP) {
+#if defined(__linux__)
+            static uint8_t bufs[UDP_BATCH_MAX][P2P_MTU];
+            struct sockaddr_in froms[UDP_BATCH_MAX];
+            struct mmsghdr msgs[UDP_BATCH_MAX];
+            struct iovec iovs[UDP_BATCH_MAX];
+            for (int i = 0; i < UDP_BATCH_MAX; i++) {
+                iovs[i].iov_base = bufs[i];
+                iovs[i].iov_len = sizeof(bufs[i]);
+                memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+                msgs[i].msg_hdr.msg_name = &froms[i];
+                msgs[i].msg_hdr.msg_namelen = sizeof(froms[i]);
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int n = recvmmsg(udp_fd, msgs, UDP_BATCH_MAX, MSG_DONTWAIT, NULL);
+            for (int i = 0; i < n; i++) {
+                if (msgs[i].msg_len > 0) compact_udp_input(udp_fd, bufs[i], msgs[i].msg_len, &froms[i]);
+            }
+#else
             uint8_t buf[P2P_MTU]; struct sockaddr_in from; socklen_t from_len = sizeof(from);
             size_t n = recvfrom(udp_fd, (char *)buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
             if (n > 0) {
-                handle_compact_signaling(udp_fd, buf, n, &from);
+                compact_udp_input(udp_fd, buf, n, &from);
             }
+#endif
         }
 
+#ifdef SERVER_UDP_WORKERS
+        // 接收线程转来的 COMPACT 数据报
+        if (ev_bits & EV_BIT_WAKE) udp_workers_drain(udp_fd);
+#endif
+
         // NAT 探测 UDP 收到数据包（也是 COMPACT 模式的信令交互）
-        if (probe_fd != P_INVALID_SOCKET && FD_ISSET(probe_fd, &read_fds)) {
+        if (ev_bits & EV_BIT_PROBE) {
 
-            uint8_t buf[64]; struct sockaddr_in from; socklen_t from_len = sizeof(from);
+            uint8_t buf[P2P_MTU]; struct sockaddr_in from; socklen_t from_len = sizeof(from);
             size_t n = recvfrom(probe_fd, (char *)buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
             if (n > 0) {
                 handle_probe(probe_fd, buf, n, &from);
             }
         }
 
-        // 处理 Relay 模式的 TCP 事件（先发送后接收，单次遍历）
-        for (int i = 0; i < MAX_PEERS; i++) {
-            if (!g_relay_clients[i].base.valid || g_relay_clients[i].fd == P_INVALID_SOCKET) continue;
-            
-            relay_client_t *client = &g_relay_clients[i];
-            relay_session_t *sending_session = client->sending_head;
+        // 备用 IP 上的 STUN 请求（非阻塞，读空为止）
+        if (ev_bits & EV_BIT_STUN) {
+            for (int i = 0; i < 2; i++) { sock_t fd = g_stun_socks[1][i];
+                if (fd == P_INVALID_SOCKET) continue;
+                for (;;) {
+                    uint8_t buf[P2P_MTU]; struct sockaddr_in from; socklen_t from_len = sizeof(from);
+                    int n = (int)recvfrom(fd, (char *)buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
+                    if (n <= 0) break;
+                    stun_input(fd, buf, (size_t)n, &from);
+                }
+            }
+        }
+
+        // 处理 Relay 模式的 TCP 事件（仅就绪链表中的客户端，先发送后接收）
+        // + 本轮处理中新就绪的客户端（如被转发了数据）挂入新链表，下一轮处理
+        relay_client_t *ready = g_relay_ready; g_relay_ready = NULL;
+        while (ready) {
+            relay_client_t *client = ready;
+            ready = client->ev_ready_next;
+            client->ev_ready = false;
+            if (!client->base.valid || client->fd == P_INVALID_SOCKET || client->mux) continue;
+
+            // 零拷贝完成通知（错误队列可读时以 EPOLLERR 唤醒，归入可读事件）
+            if (client->zc_head) relay_zc_reap(client);
 
             // 如果当前正在等待发送中的数据
-            if ((client->online_ack_pending || sending_session) 
-                && FD_ISSET(client->fd, &write_fds)) {
+            if ((client->online_ack_pending || client->sending_head || client->mux_ctl_len) 
+                && client->ev_writable) {
 
                 // 当前正在发送 ONLINE_ACK
                 // + 此时还没有 session，复用 recv_buf 作为 send_buf，recv_len 作为已发送长度
                 if (client->online_ack_pending) {
 
-                    size_t ack_total = sizeof(p2p_relay_hdr_t) + 2;
+                    size_t ack_total = sizeof(p2p_relay_hdr_t) + P2P_RLY_ONLINE_ACK_PSZ + 1/* rpc_window */;
                     size_t len = ack_total - client->recv_len;
                     int rc = tcp_send(client, client->recv_buf + client->recv_len, &len, "ONLINE_ACK pending");
                     if (rc < 0) {
-                        P_sock_close(client->fd);
-                        client->fd = P_INVALID_SOCKET;
-                        client->base.valid = false;
-                        client->online_ack_pending = false;
-                        client->recv_len = 0;
-                        if (client->recv_buf) {
-                            relay_buf_free(BUF2ITEM(client->recv_buf));
-                            client->recv_buf = NULL;
-                        }
-                        while (client->base.sessions) {
-                            relay_free_session((relay_session_t*)client->base.sessions);
-                        }
+                        relay_clear_client(client);
                         continue;
                     }
 
@@ -3371,50 +6268,87 @@ int main(int argc, char *argv[]) {
                     if (client->online_ack_pending) continue;
                 }
                 // 2. 处理 session 发送队列（与 ONLINE_ACK 分支互斥）
-                else { assert(sending_session->send_head);
+                // + 每轮最多发出 RELAY_FLUSH_FRAMES 帧（逐帧按优先级 / DRR 选择），第二帧起 cork 合并
+                else {
 
-                    buffer_item_t *item = sending_session->send_head;
-                    const p2p_relay_hdr_t *hdr = (const p2p_relay_hdr_t *)ITEM2BUF(item);
+                    bool corked = false, dead = false;
+                    for (int k = 0; k < RELAY_FLUSH_FRAMES && (client->sending_head || client->mux_ctl_len) && client->ev_writable; k++) {
+                        if (k == 1 && !ARGS_nagle.i64) corked = tcp_cork(client->fd, true);
 
-                    const uint16_t len = (uint16_t)(sizeof(p2p_relay_hdr_t) + ntohs(hdr->size));
-                    size_t remaining = len - client->send_offset;
-                    int rc = tcp_send(client, (const char *)hdr + client->send_offset, &remaining, "session queue");
-                    if (rc < 0) {
-                        relay_clear_client(client);
-                        continue;
-                    }
-
-                    if (remaining > 0) { client->send_offset += (uint32_t)remaining;
+                        // 复用连接：帧边界先发出直接回复（含 SELECT）
+                        if (client->mux_ctl_len && !client->send_offset) {
+                            if (relay_mux_flush(client) < 0) {
+                                relay_clear_client(client);
+                                dead = true;
+                                break;
+                            }
+                            continue;
+                        }
+                        if (!client->sending_head) break;
 
-                        // 当前 session 发送完成
-                        if (client->send_offset >= len) { client->send_offset = 0;
+                        // 帧边界时按优先级 / DRR 选择 session，帧未发完时继续同一 session
+                        relay_session_t *sending_session = client->sending_cur ? client->sending_cur : relay_sending_pick(client);
 
-                            // 如果 item 有 refer，说明这是一个需要发送完成回调的包
-                            if (item->refer) {
-                                relay_session_send_complete((relay_session_t*)item->refer, item);
-                            }
+                        // 复用连接：帧所属登录与当前发送选择不同，先插入 SELECT（下一轮迭代发出）
+                        uint16_t login_id = RELAY_MUX_ID((relay_client_t*)sending_session->base.client);
+                        if (client->mux_ctl && !client->send_offset && login_id != client->mux_tx) {
+                            relay_mux_op(client, login_id, P2P_RLY_MUX_SELECT);
+                            continue;
+                        }
+                        buffer_item_t *item = sending_session->send_head;
+                        const p2p_relay_hdr_t *hdr = (const p2p_relay_hdr_t *)ITEM2BUF(item);
+
+                        const uint16_t len = (uint16_t)(sizeof(p2p_relay_hdr_t) + ntohs(hdr->size));
+                        size_t remaining = len - client->send_offset;
+                        if (!client->send_offset) client->zc_mark = client->zc_seq;
+                        int rc = tcp_send_ex(client, (const char *)hdr + client->send_offset, &remaining, "session queue",
+                                             client->zc && len >= RELAY_ZC_MIN_FRAME);
+                        if (rc < 0) {
+                            relay_clear_client(client);
+                            dead = true;
+                            break;
+                        }
 
-                            // 删除已发送完成的 item
-                            if (!((sending_session->send_head = item->next)))
-                                sending_session->send_rear = NULL;
-                            relay_buf_free(item);
-                            
-                            // 如果 session 发送队列已空，发送下一条待发送 session
-                            if (!sending_session->send_head) {
-                                client->sending_head = sending_session->send_next;
-                                if (client->sending_head) client->sending_head->send_prev = NULL;
-                                else                      client->sending_rear = NULL;
-                                sending_session->send_next = NULL;
+                        if (remaining > 0) { client->send_offset += (uint32_t)remaining;
+
+                            // 当前 session 发送完成
+                            if (client->send_offset >= len) { client->send_offset = 0;
+                                g_metrics.relay_tx_bytes += len;
+
+                                // 如果 item 有 refer，说明这是一个需要发送完成回调的包
+                                if (item->refer) {
+                                    relay_session_send_complete((relay_session_t*)item->refer, item);
+                                }
+
+                                // 删除已发送完成的 item（session 队列为空时摘出 sending 链表）
+                                // + 经零拷贝发出的帧等内核完成通知后再归还
+                                buffer_item_t *done = relay_sending_pop(client, sending_session);
+                                if (client->zc_seq != client->zc_mark) {
+                                    g_metrics.relay_zc_bytes += len;
+                                    relay_zc_hold(client, done);
+                                }
+                                else relay_buf_free(done);
                             }
                         }
                     }
+                    if (dead) continue;
+                    if (corked) tcp_cork(client->fd, false);
                 }
             }
             
             // 3. 处理接收数据（信令交互）
-            if (FD_ISSET(g_relay_clients[i].fd, &read_fds)) {
-                handle_relay_signaling(i);
+            if (client->ev_readable) {
+                uint64_t t0 = g_hot_k ? P_tick_us() : 0;
+                handle_relay_signaling(client);
+                if (g_hot_k) hot_observe(client->ip, &client->base, 0, 0, P_tick_us() - t0);
             }
+
+            // 仍有可做的工作（队列未发完且仍可写 / 数据未读尽）：留在就绪链表
+            if (client->base.valid && client->fd != P_INVALID_SOCKET
+                && ((client->ev_writable && (client->online_ack_pending || client->sending_head || client->mux_ctl_len))
+                    || (client->ev_readable && !client->online_ack_pending
+                        && client->mux_ctl_len <= RELAY_MUX_CTL_MAX - RELAY_MUX_CTL_ROOM)))
+                relay_ready(client);
         }
 
 #ifdef WITH_WSLAY
@@ -3422,30 +6356,65 @@ int main(int argc, char *argv[]) {
         if (g_ws_srv) ws_server_update(g_ws_srv);
 #endif
 
+        // 指标抓取（本轮计时之后处理，渲染耗时不计入循环耗时分布）
+        if (ev_bits & EV_BIT_CLUSTER) cluster_input();
+
+        metrics_loop_observe(P_tick_us() - loop_us);
+        hot_tick(now);
+        if (g_hot_dump) { g_hot_dump = 0; hot_dump(); }
+        if (ev_bits & EV_BIT_METRICS) {
+            sock_t fd = accept(metrics_fd, NULL, NULL);
+            if (fd != P_INVALID_SOCKET) metrics_serve(fd);
+        }
+
     } // while (g_running)
 
     // 清理资源
+    udp_flush();
+    if (ARGS_state.str && *ARGS_state.str && snap_save(ARGS_state.str) != 0)
+        print("E:", "State save to %s failed(%d)\n", ARGS_state.str, errno);
     print("I: \n%s", LA_S("Shutting down...\n", LA_S8, 8));
     
     // 关闭所有客户端连接
-    for (int i = 0; i < MAX_PEERS; i++) {
-        if (g_relay_clients[i].base.valid && g_relay_clients[i].fd != P_INVALID_SOCKET) {
-            P_sock_close(g_relay_clients[i].fd);
+    for (int i = 0; i < g_relay_pool.cap; i++) { relay_client_t *c = RELAY_CLIENT_AT(i);
+        if (c->base.valid && c->fd != P_INVALID_SOCKET && !c->mux) {
+            P_sock_close(c->fd);
         }
-        if (g_relay_clients[i].recv_buf) {
-            relay_buf_free(BUF2ITEM(g_relay_clients[i].recv_buf));
-            g_relay_clients[i].recv_buf = NULL;
+        if (c->recv_buf) {
+            relay_buf_free(BUF2ITEM(c->recv_buf));
+            c->recv_buf = NULL;
         }
-        g_relay_clients[i].recv_len = 0;
+        c->recv_len = 0;
     }
     
     // 关闭监听套接字
     P_sock_close(listen_fd);
     P_sock_close(udp_fd);
     if (probe_fd != P_INVALID_SOCKET) P_sock_close(probe_fd);
+    for (int i = 0; i < 2; i++) if (g_stun_socks[1][i] != P_INVALID_SOCKET) P_sock_close(g_stun_socks[1][i]);
+    if (metrics_fd != P_INVALID_SOCKET) P_sock_close(metrics_fd);
+    if (g_cluster_n) cluster_shutdown();
+#ifdef SERVER_UDP_WORKERS
+    udp_workers_stop();
+#endif
+    ev_close();
+    HASH_CLEAR(hh_name, g_relay_by_name);
+    HASH_CLEAR(hh_name, g_compact_clients_by_name);
+    flat_index_free(&g_compact_auth_index);
+    flat_index_free(&g_session_index);
+    pool_destroy(&g_relay_pool);
+    pool_destroy(&g_compact_pool);
+    relay_buf_log_stats();
+    print("I:", "COMPACT relay fast path: %" PRIu64 " packets forwarded\n", g_compact_fwd_pkts);
+    free(g_compact_fwd); g_compact_fwd = NULL;
+    free(g_rate_ip); free(g_rate_auth); g_rate_ip = g_rate_auth = NULL;
+    relay_buf_drain(&g_relay_buf_bulk);
+    relay_buf_drain(&g_relay_buf_large);
+    relay_buf_drain(&g_relay_buf_small);
 
 #ifdef WITH_WSLAY
     if (g_ws_srv) { ws_server_destroy(g_ws_srv); g_ws_srv = NULL; }
+    ws_retain_clear();
 #endif
 
     P_net_cleanup();
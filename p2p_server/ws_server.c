@@ -2,10 +2,12 @@
  * ws_server.c — 轻量 WebSocket 服务器实现
  *
  * 依赖：wslay（third_party/wslay），无其他外部依赖。
- * SHA-1 / Base64 在本文件内自包含实现，仅用于 WS 握手。
+ * SHA-1 / Base64 在本文件内自包含实现，仅用于 WS 握手；permessage-deflate 编解码见 src/ws_deflate.c。
+ * 帧解析与分片重组由 wslay 增量完成，槽位不另设接收缓冲（只暂存握手请求之后已收到的少量字节）。
  */
 
 #include "ws_server.h"
+#include "ws_deflate.h"
 #include <stdc.h>          /* sock_t / P_INVALID_SOCKET / P_sock_close / P_sock_nonblock /
                             P_sock_is_wouldblock / P_sock_is_interrupted 等跟平台操作 */
 
@@ -18,6 +20,9 @@ void ws_server_dummy(void) {}
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#ifndef _WIN32
+#  include <sys/uio.h>     /* writev */
+#endif
 
 #define VALID_SOCK(s) ((s) != P_INVALID_SOCKET)
 
@@ -95,7 +100,19 @@ static void ws_b64_sha1(const uint8_t src[20], char dst[29]) {
  * ====================================================================== */
 
 #define WS_SRV_HTTP_BUF  4096
-#define WS_SRV_RECV_BUF  65536
+#define WS_SRV_SENDQ_MAX 256    /* 每客户端待发广播帧上限，积压超出即视为慢客户端并断开 */
+#define WS_SRV_IOV_MAX   16     /* 单次 writev 聚合的帧数 */
+
+/* 广播帧：WS 帧头 + 负载只组帧一次，各客户端发送队列按引用共享，最后一个引用释放时回收 */
+typedef struct {
+    int                     ref;
+    size_t                  len;
+    uint8_t                 data[1];
+} ws_frame_t;
+
+static void ws_frame_unref(ws_frame_t *f) {
+    if (--f->ref == 0) free(f);
+}
 
 typedef enum {
     WS_SLOT_FREE        = 0,
@@ -115,10 +132,23 @@ typedef struct {
     char                    http_buf[WS_SRV_HTTP_BUF];
     size_t                  http_buf_len;
 
-    /* wslay 收取缓冲（HTTP 握手完成后的残余数据）*/
-    uint8_t                 recv_buf[WS_SRV_RECV_BUF];
-    size_t                  recv_buf_pos;
-    size_t                  recv_buf_len;
+    /* HTTP 请求之后已收到的帧数据（按实际长度分配，交给 wslay 读完即释放）*/
+    uint8_t                *pending;
+    size_t                  pending_pos;
+    size_t                  pending_len;
+    int                     eof;         /* 对端已关闭 TCP（recv 返回 0） */
+
+    /* permessage-deflate：deflate_wbits 为本端压缩窗口（客户端提议的 server_max_window_bits） */
+    int                     deflate;
+    int                     deflate_wbits;
+
+    /* 广播发送队列（环形，非阻塞 writev 发出）
+     * + 与 wslay 自身的发送队列只在帧边界交替：队头帧发出一部分（sendq_off > 0）时不调用 wslay_event_send，
+     *   wslay 有未发完的帧时不写广播队列，两者的帧不会交错 */
+    ws_frame_t             *sendq[WS_SRV_SENDQ_MAX];
+    int                     sendq_head;
+    int                     sendq_cnt;
+    size_t                  sendq_off;   /* 队头帧已发出字节数 */
 } ws_slot_t;
 
 /* =========================================================================
@@ -145,10 +175,11 @@ static ssize_t sslot_recv_cb(wslay_event_context_ptr ctx,
     ws_srv_cbdata_t *d = (ws_srv_cbdata_t *)ud;
     ws_slot_t *slot = d->slot;
 
-    if (slot->recv_buf_len > 0) {
-        size_t cp = slot->recv_buf_len < len ? slot->recv_buf_len : len;
-        memcpy(buf, slot->recv_buf + slot->recv_buf_pos, cp);
-        slot->recv_buf_pos += cp; slot->recv_buf_len -= cp;
+    if (slot->pending) {
+        size_t cp = slot->pending_len - slot->pending_pos < len ? slot->pending_len - slot->pending_pos : len;
+        memcpy(buf, slot->pending + slot->pending_pos, cp);
+        slot->pending_pos += cp;
+        if (slot->pending_pos == slot->pending_len) { free(slot->pending); slot->pending = NULL; }
         return (ssize_t)cp;
     }
     ssize_t n;
@@ -161,7 +192,7 @@ static ssize_t sslot_recv_cb(wslay_event_context_ptr ctx,
                                    : WSLAY_ERR_CALLBACK_FAILURE);
         return -1;
     }
-    if (n == 0) { wslay_event_set_error(ctx, WSLAY_ERR_CALLBACK_FAILURE); return -1; }
+    if (n == 0) { slot->eof = 1; wslay_event_set_error(ctx, WSLAY_ERR_CALLBACK_FAILURE); return -1; }
     return n;
 }
 
@@ -207,13 +238,152 @@ static void sslot_on_msg_cb(wslay_event_context_ptr ctx,
         case WSLAY_PONG:         type = WS_SRV_MSG_PONG;   break;
         default: return;
     }
-    srv->cfg.on_message(srv, slot->id, type, arg->msg, arg->msg_length, srv->cfg.user_data);
+
+    /* RSV1：压缩消息（wslay 只在协商后放行 RSV1） */
+    if (!wslay_get_rsv1(arg->rsv)) {
+        srv->cfg.on_message(srv, slot->id, type, arg->msg, arg->msg_length, srv->cfg.user_data);
+        return;
+    }
+    uint8_t *out = NULL;
+    int n = -2;
+    for (size_t cap = arg->msg_length * 4 + 256; n == -2; cap *= 2) {
+        if (cap > WS_INFLATE_MAX_LEN) cap = WS_INFLATE_MAX_LEN;
+        uint8_t *p = (uint8_t *)realloc(out, cap);
+        if (!p) break;
+        out = p;
+        n = ws_inflate(arg->msg, arg->msg_length, out, cap);
+        if (cap == WS_INFLATE_MAX_LEN) break;
+    }
+    if (n >= 0) srv->cfg.on_message(srv, slot->id, type, out, (size_t)n, srv->cfg.user_data);
+    else wslay_event_queue_close(ctx, WSLAY_CODE_INVALID_FRAME_PAYLOAD_DATA, NULL, 0);
+    free(out);
+}
+
+/* 尽量发出广播队列（writev 聚合多帧），返回 -1 表示连接出错 */
+static int ws_slot_flush(ws_slot_t *slot) {
+    while (slot->sendq_cnt > 0) {
+        int n = 0;
+#ifdef _WIN32
+        WSABUF iov[WS_SRV_IOV_MAX];
+#else
+        struct iovec iov[WS_SRV_IOV_MAX];
+#endif
+        for (; n < slot->sendq_cnt && n < WS_SRV_IOV_MAX; n++) {
+            ws_frame_t *f = slot->sendq[(slot->sendq_head + n) % WS_SRV_SENDQ_MAX];
+            size_t off = n ? 0 : slot->sendq_off;
+#ifdef _WIN32
+            iov[n].buf = (char *)f->data + off; iov[n].len = (ULONG)(f->len - off);
+#else
+            iov[n].iov_base = f->data + off;    iov[n].iov_len = f->len - off;
+#endif
+        }
+
+        ssize_t w;
+#ifdef _WIN32
+        DWORD sent = 0;
+        w = WSASend(slot->fd, iov, (DWORD)n, &sent, 0, NULL, NULL) == 0 ? (ssize_t)sent : -1;
+#else
+        w = writev(slot->fd, iov, n);
+#endif
+        if (w < 0) {
+            if (P_sock_is_interrupted()) continue;
+            return P_sock_is_wouldblock() ? 0 : -1;
+        }
+
+        /* 按已发字节数出队 */
+        size_t left = (size_t)w;
+        while (slot->sendq_cnt > 0) {
+            ws_frame_t *f = slot->sendq[slot->sendq_head];
+            size_t rest = f->len - slot->sendq_off;
+            if (left < rest) { slot->sendq_off += left; break; }
+            left -= rest;
+            slot->sendq_off = 0;
+            slot->sendq_head = (slot->sendq_head + 1) % WS_SRV_SENDQ_MAX;
+            slot->sendq_cnt--;
+            ws_frame_unref(f);
+        }
+        if (slot->sendq_off) return 0;   /* 内核缓冲已满 */
+    }
+    return 0;
+}
+
+static void ws_slot_sendq_clear(ws_slot_t *slot) {
+    while (slot->sendq_cnt > 0) {
+        ws_frame_unref(slot->sendq[slot->sendq_head]);
+        slot->sendq_head = (slot->sendq_head + 1) % WS_SRV_SENDQ_MAX;
+        slot->sendq_cnt--;
+    }
+    slot->sendq_head = 0;
+    slot->sendq_off  = 0;
+}
+
+/* 推进一个槽位的发送：wslay 队列（控制帧 / 单播）与广播队列在帧边界交替 */
+static int ws_slot_send(ws_slot_t *slot) {
+    if (slot->sendq_off == 0 && wslay_event_want_write(slot->ws_ctx))
+        wslay_event_send(slot->ws_ctx);
+    if (slot->sendq_cnt > 0 && (slot->sendq_off > 0 || !wslay_event_want_write(slot->ws_ctx)))
+        return ws_slot_flush(slot);
+    return 0;
 }
 
 /* =========================================================================
  * 升级握手
  * ====================================================================== */
 
+/*
+ * 从请求的 Sec-WebSocket-Extensions 中选取可接受的 permessage-deflate 提议（逗号分隔的提议按序尝试），
+ * 接受时写入 slot->deflate / deflate_wbits 与响应头 hdr 并返回 1；没有可接受的提议返回 0
+ *
+ * 响应总是带 client_no_context_takeover（客户端每条消息独立压缩，本端不为连接保留 32KB 解压窗口）
+ * 与 server_no_context_takeover（本端本来就每条消息独立压缩）
+ */
+static int ws_srv_accept_deflate(ws_slot_t *slot, char *hdr, size_t cap) {
+    const char *h = strstr(slot->http_buf, "Sec-WebSocket-Extensions:");
+    if (!h) return 0;
+    h += 25;
+    const char *end = strstr(h, "\r\n");
+    if (!end || end - h >= 512) return 0;
+
+    char v[512];
+    memcpy(v, h, (size_t)(end - h));
+    v[end - h] = '\0';
+
+    for (char *offer = v, *next_offer; offer; offer = next_offer) {
+        next_offer = strchr(offer, ',');
+        if (next_offer) *next_offer++ = '\0';
+
+        int first = 1, ok = 1, wbits = 0;
+        for (char *tok = offer, *next; tok && ok; tok = next, first = 0) {
+            next = strchr(tok, ';');
+            if (next) *next++ = '\0';
+            while (*tok == ' ' || *tok == '\t') tok++;
+            size_t len = strlen(tok);
+            while (len && (tok[len - 1] == ' ' || tok[len - 1] == '\t')) tok[--len] = '\0';
+
+            if (first) ok = !strcmp(tok, "permessage-deflate");
+            else if (!strcmp(tok, "server_no_context_takeover") || !strcmp(tok, "client_no_context_takeover")) {}
+            else if (!strncmp(tok, "server_max_window_bits=", 23)) {
+                wbits = atoi(tok + 23);
+                ok = wbits >= 8 && wbits <= 15;
+            }
+            else if (!strcmp(tok, "client_max_window_bits") || !strncmp(tok, "client_max_window_bits=", 23)) {}
+            else ok = 0;                    /* 未知参数：拒绝该提议 */
+        }
+        if (!ok) continue;
+
+        slot->deflate = 1;
+        slot->deflate_wbits = wbits ? wbits : 15;
+        if (wbits)
+            snprintf(hdr, cap, "Sec-WebSocket-Extensions: permessage-deflate; server_no_context_takeover; "
+                     "client_no_context_takeover; server_max_window_bits=%d\r\n", wbits);
+        else
+            snprintf(hdr, cap, "Sec-WebSocket-Extensions: permessage-deflate; server_no_context_takeover; "
+                     "client_no_context_takeover\r\n");
+        return 1;
+    }
+    return 0;
+}
+
 static int ws_srv_do_handshake(ws_server_t *srv, ws_slot_t *slot) {
     /* 继续接收 HTTP 请求 */
     while (slot->http_buf_len < sizeof(slot->http_buf) - 1) {
@@ -251,6 +421,10 @@ static int ws_srv_do_handshake(ws_server_t *srv, ws_slot_t *slot) {
     char accept[29];
     ws_b64_sha1(digest, accept);
 
+    char ext[160] = "";
+    slot->deflate = 0;
+    if (!srv->cfg.disable_deflate) ws_srv_accept_deflate(slot, ext, sizeof(ext));
+
     /* 组装 101 响应 */
     char resp[512];
     int rlen = snprintf(resp, sizeof(resp),
@@ -258,9 +432,10 @@ static int ws_srv_do_handshake(ws_server_t *srv, ws_slot_t *slot) {
         "Upgrade: websocket\r\n"
         "Connection: Upgrade\r\n"
         "Sec-WebSocket-Accept: %s\r\n"
+        "%s"
         "%s%s%s"
         "\r\n",
-        accept,
+        accept, ext,
         srv->cfg.sub_protocol ? "Sec-WebSocket-Protocol: " : "",
         srv->cfg.sub_protocol ? srv->cfg.sub_protocol       : "",
         srv->cfg.sub_protocol ? "\r\n"                      : "");
@@ -286,10 +461,10 @@ static int ws_srv_do_handshake(ws_server_t *srv, ws_slot_t *slot) {
     if (body) {
         body += 4;
         size_t leftover = slot->http_buf_len - (size_t)(body - slot->http_buf);
-        if (leftover > 0 && leftover <= WS_SRV_RECV_BUF) {
-            memcpy(slot->recv_buf, body, leftover);
-            slot->recv_buf_pos = 0;
-            slot->recv_buf_len = leftover;
+        if (leftover > 0 && (slot->pending = (uint8_t *)malloc(leftover)) != NULL) {
+            memcpy(slot->pending, body, leftover);
+            slot->pending_pos = 0;
+            slot->pending_len = leftover;
         }
     }
     slot->http_buf_len = 0;
@@ -312,6 +487,7 @@ static int ws_srv_do_handshake(ws_server_t *srv, ws_slot_t *slot) {
         return -1;
     }
     slot->ws_cbdata = cbdata;  /* 记录，随 slot 一起释放 */
+    if (slot->deflate) wslay_event_config_set_allowed_rsv_bits(slot->ws_ctx, WSLAY_RSV1_BIT);
 
     slot->state = WS_SLOT_OPEN;
     srv->client_count++;
@@ -343,6 +519,7 @@ static void ws_slot_close(ws_server_t *srv, ws_slot_t *slot) {
         free(slot->ws_cbdata);
         slot->ws_cbdata = NULL;
     }
+    ws_slot_sendq_clear(slot);
 
     if (VALID_SOCK(slot->fd)) {
         P_sock_close(slot->fd);
@@ -351,8 +528,10 @@ static void ws_slot_close(ws_server_t *srv, ws_slot_t *slot) {
 
     slot->state       = WS_SLOT_FREE;
     slot->http_buf_len = 0;
-    slot->recv_buf_len = 0;
-    slot->recv_buf_pos = 0;
+    free(slot->pending);
+    slot->pending = NULL;
+    slot->eof     = 0;
+    slot->deflate = 0;
 }
 
 /* =========================================================================
@@ -437,8 +616,6 @@ void ws_server_update(ws_server_t *srv) {
         slot->fd    = fd;
         slot->state = WS_SLOT_HANDSHAKING;
         slot->http_buf_len = 0;
-        slot->recv_buf_len = 0;
-        slot->recv_buf_pos = 0;
     }
     } /* if VALID_SOCK(listen_fd) */
 
@@ -455,23 +632,17 @@ void ws_server_update(ws_server_t *srv) {
         }
 
         if (slot->state == WS_SLOT_OPEN || slot->state == WS_SLOT_CLOSING) {
-            /* 读取新到达的 socket 数据 */
-            if (slot->recv_buf_len == 0) {
-                slot->recv_buf_pos = 0;
-                ssize_t n = recv(slot->fd, (char*)slot->recv_buf, WS_SRV_RECV_BUF, 0);
-                if (n == 0) {
-                    ws_slot_close(srv, slot);
-                    continue;
-                } else if (n > 0) {
-                    slot->recv_buf_len = (size_t)n;
-                }
-                /* n < 0 且 EWOULDBLOCK：无新数据，继续 */
-            }
-
+            /* wslay 经 recv 回调直接从 socket 读入其帧解析缓冲，读到 EWOULDBLOCK 为止 */
             if (wslay_event_want_read(slot->ws_ctx))
                 wslay_event_recv(slot->ws_ctx);
-            if (wslay_event_want_write(slot->ws_ctx))
-                wslay_event_send(slot->ws_ctx);
+            if (slot->eof) {
+                ws_slot_close(srv, slot);
+                continue;
+            }
+            if (ws_slot_send(slot) < 0) {
+                ws_slot_close(srv, slot);
+                continue;
+            }
 
             /* 检查是否需要关闭 */
             if (slot->state == WS_SLOT_CLOSING ||
@@ -481,6 +652,13 @@ void ws_server_update(ws_server_t *srv) {
             }
         }
     }
+
+    /* 本轮收到的消息可能向前面已处理过的槽位广播：再推进一次发送，不必等到下一轮 */
+    for (int i = 0; i < WS_SERVER_MAX_CLIENTS; i++) {
+        ws_slot_t *slot = &srv->slots[i];
+        if (slot->state == WS_SLOT_OPEN && slot->sendq_cnt > 0 && ws_slot_send(slot) < 0)
+            ws_slot_close(srv, slot);
+    }
 }
 
 /* =========================================================================
@@ -495,32 +673,89 @@ static ws_slot_t *find_slot(ws_server_t *srv, ws_client_id_t cid) {
     return NULL;
 }
 
+/* 入队一条数据消息：已协商 permessage-deflate 且压缩后更短时以 RSV1 压缩消息发送（wslay 入队时复制负载） */
+static int ws_slot_queue(ws_slot_t *slot, uint8_t opcode, const uint8_t *data, size_t len) {
+    struct wslay_event_msg msg;
+    msg.opcode     = opcode;
+    msg.msg        = data;
+    msg.msg_length = len;
+
+    uint8_t *z = NULL;
+    int zlen = -1;
+    if (slot->deflate && len >= WS_DEFLATE_MIN_LEN && len <= WS_INFLATE_MAX_LEN
+        && (z = (uint8_t *)malloc(len)) != NULL
+        && (zlen = ws_deflate(data, len, z, len, slot->deflate_wbits)) > 0) {
+        msg.msg        = z;
+        msg.msg_length = (size_t)zlen;
+    }
+    int r = wslay_event_queue_msg_ex(slot->ws_ctx, &msg, zlen > 0 ? WSLAY_RSV1_BIT : WSLAY_RSV_NONE);
+    free(z);
+    return r == 0 ? 0 : -1;
+}
+
 int ws_server_send_text(ws_server_t *srv, ws_client_id_t cid, const char *text) {
     ws_slot_t *slot = find_slot(srv, cid);
     if (!slot || !slot->ws_ctx) return -1;
-    struct wslay_event_msg msg;
-    msg.opcode     = WSLAY_TEXT_FRAME;
-    msg.msg        = (const uint8_t *)text;
-    msg.msg_length = strlen(text);
-    return wslay_event_queue_msg(slot->ws_ctx, &msg) == 0 ? 0 : -1;
+    return ws_slot_queue(slot, WSLAY_TEXT_FRAME, (const uint8_t *)text, strlen(text));
 }
 
 int ws_server_send_binary(ws_server_t *srv, ws_client_id_t cid,
                            const uint8_t *data, size_t len) {
     ws_slot_t *slot = find_slot(srv, cid);
     if (!slot || !slot->ws_ctx) return -1;
-    struct wslay_event_msg msg;
-    msg.opcode     = WSLAY_BINARY_FRAME;
-    msg.msg        = data;
-    msg.msg_length = len;
-    return wslay_event_queue_msg(slot->ws_ctx, &msg) == 0 ? 0 : -1;
+    return ws_slot_queue(slot, WSLAY_BINARY_FRAME, data, len);
+}
+
+/* 组帧（服务端帧不加掩码）：b0 = FIN | RSV1 | opcode，7 / 7+16 / 7+64 位长度 */
+static ws_frame_t *ws_frame_build(uint8_t b0, const uint8_t *payload, size_t len) {
+    size_t hlen = len < 126 ? 2 : len <= 0xFFFF ? 4 : 10;
+    ws_frame_t *f = (ws_frame_t *)malloc(sizeof(ws_frame_t) + hlen + len);
+    if (!f) return NULL;
+    f->ref = 1;
+    f->len = hlen + len;
+    f->data[0] = b0;
+    if (hlen == 2) f->data[1] = (uint8_t)len;
+    else if (hlen == 4) { f->data[1] = 126; f->data[2] = (uint8_t)(len >> 8); f->data[3] = (uint8_t)len; }
+    else { f->data[1] = 127; for (int i = 0; i < 8; i++) f->data[2 + i] = (uint8_t)((uint64_t)len >> (56 - 8 * i)); }
+    memcpy(f->data + hlen, payload, len);
+    return f;
 }
 
 void ws_server_broadcast_text(ws_server_t *srv, const char *text) {
+    if (!srv || srv->client_count == 0) return;
+
+    size_t len = strlen(text);
+    ws_frame_t *f = ws_frame_build(0x80 | WSLAY_TEXT_FRAME, (const uint8_t *)text, len);
+    if (!f) return;
+
+    /* 协商了 permessage-deflate 的客户端共享一份压缩帧（不使用上下文接管，同一压缩结果对各连接都有效），
+     * 窗口取这些客户端允许的最小值 */
+    ws_frame_t *fz = NULL;
+    int wbits = 0;
+    for (int i = 0; i < WS_SERVER_MAX_CLIENTS; i++) {
+        const ws_slot_t *slot = &srv->slots[i];
+        if (slot->state == WS_SLOT_OPEN && slot->deflate && (!wbits || slot->deflate_wbits < wbits))
+            wbits = slot->deflate_wbits;
+    }
+    if (wbits && len >= WS_DEFLATE_MIN_LEN && len <= WS_INFLATE_MAX_LEN) {
+        uint8_t *z = (uint8_t *)malloc(len);
+        int zlen = z ? ws_deflate((const uint8_t *)text, len, z, len, wbits) : -1;
+        if (zlen > 0) fz = ws_frame_build(0x80 | 0x40 | WSLAY_TEXT_FRAME, z, (size_t)zlen);
+        free(z);
+    }
+
+    /* 只入队，由 ws_server_update 非阻塞发出；积压超限的慢客户端标记关闭，不拖累其他客户端 */
     for (int i = 0; i < WS_SERVER_MAX_CLIENTS; i++) {
-        if (srv->slots[i].state == WS_SLOT_OPEN)
-            ws_server_send_text(srv, srv->slots[i].id, text);
+        ws_slot_t *slot = &srv->slots[i];
+        if (slot->state != WS_SLOT_OPEN) continue;
+        if (slot->sendq_cnt >= WS_SRV_SENDQ_MAX) { slot->state = WS_SLOT_CLOSING; continue; }
+        ws_frame_t *q = slot->deflate && fz ? fz : f;
+        slot->sendq[(slot->sendq_head + slot->sendq_cnt) % WS_SRV_SENDQ_MAX] = q;
+        slot->sendq_cnt++;
+        q->ref++;
     }
+    ws_frame_unref(f);
+    if (fz) ws_frame_unref(fz);
 }
 
 void ws_server_disconnect(ws_server_t *srv, ws_client_id_t cid, uint16_t code) {
@@ -550,8 +785,6 @@ int ws_server_inject_fd(ws_server_t *srv, ws_srv_fd_t fd) {
     slot->fd           = (sock_t)fd;
     slot->state        = WS_SLOT_HANDSHAKING;
     slot->http_buf_len = 0;
-    slot->recv_buf_len = 0;
-    slot->recv_buf_pos = 0;
     return 0;
 }
 
@@ -10,6 +10,8 @@
  *   - 自包含 HTTP Upgrade 握手（SHA-1 + Base64 内置）
  *   - 回调驱动：on_connect / on_message / on_disconnect
  *   - 支持向单个客户端发送或广播
+ *   - permessage-deflate（RFC 7692）：接受客户端提议，压缩收发（广播的压缩帧各客户端共享）
+ *   - 帧由 wslay 增量解析与分片重组，空闲连接不预留接收缓冲
  *
  * 典型用法：
  *   ws_server_t *srv = ws_server_create(&cfg, 8080);
@@ -90,6 +92,9 @@ typedef struct {
 
     /* 允许的 WebSocket 子协议（如 "webrtc-signal"），NULL 表示不校验 */
     const char             *sub_protocol;
+
+    /* 非 0：不接受 permessage-deflate 提议（默认接受） */
+    int                     disable_deflate;
 } ws_server_cfg_t;
 
 /* -------------------------------------------------------------------------
@@ -133,7 +138,9 @@ int ws_server_send_text(ws_server_t *srv, ws_client_id_t cid, const char *text);
 int ws_server_send_binary(ws_server_t *srv, ws_client_id_t cid,
                            const uint8_t *data, size_t len);
 
-/* 向所有已连接客户端广播文本帧 */
+/* 向所有已连接客户端广播文本帧
+ * 帧只构建一次、各客户端共享引用，入队后由 ws_server_update 非阻塞发出；
+ * 待发积压超过上限的慢客户端会被断开，不影响其他客户端 */
 void ws_server_broadcast_text(ws_server_t *srv, const char *text);
 
 /* 断开指定客户端（发送 Close 帧）*/
@@ -480,6 +480,244 @@ static const char* s_lang_en[LA_NUM] = {
     [LA_F470] = "% ✗ Add Srflx candidate failed(OOM)",  /* SID:470 */
     [LA_S34] = "sync candidates",  /* SID:34 disabled */
     [LA_S35] = "waiting for peer",  /* SID:35 disabled */
+    [LA_F473] = "Reliable buffers alloc failed win=%d",  /* SID:473 */
+    [LA_F474] = "Reliable peer caps=0x%02x win=%d, send window=%d",  /* SID:474 */
+    [LA_F475] = "Reliable pool grow failed total=%d",  /* SID:475 */
+    [LA_F476] = "fast retransmit seq=%u retx=%d rack_seq=%u",  /* SID:476 */
+    [LA_F477] = "Peer requested ACK every %d pkts or %d ms",  /* SID:477 */
+    [LA_F478] = "BBR state=%d btl_bw=%lld B/s min_rtt=%d cwnd=%lld",  /* SID:478 */
+    [LA_F479] = "BBR enabled as transport layer",  /* SID:479 */
+    [LA_F480] = "congestion control: %s",  /* SID:480 */
+    [LA_F481] = "ring grow to %d failed",  /* SID:481 */
+    [LA_F482] = "stream buffers alloc failed",  /* SID:482 */
+    [LA_F483] = "zero window probe rwnd=%d",  /* SID:483 */
+    [LA_F484] = "Receive window full, dropping seq=%u buffered=%d",  /* SID:484 */
+    [LA_F485] = "Data delivered in order seq=%u len=%d",  /* SID:485 */
+    [LA_F486] = "message truncated by peer, %d bytes discarded",  /* SID:486 */
+    [LA_F487] = "message exceeds recv buffer max %d, dropped",  /* SID:487 */
+    [LA_F488] = "datagram buffers alloc failed",  /* SID:488 */
+    [LA_F489] = "Data delivered ahead of gap seq=%u len=%d base=%u",  /* SID:489 */
+    [LA_F490] = "Started %d session worker threads",  /* SID:490 */
+    [LA_F491] = "corrupt compressed DATA (%d bytes), dropped",  /* SID:491 */
+    [LA_F492] = "file read failed at %lld (ret=%d), transfer aborted",  /* SID:492 */
+    [LA_F493] = "file write failed at %lld, transfer aborted",  /* SID:493 */
+    [LA_F494] = "session too large to cache (%d bytes)",  /* SID:494 */
+    [LA_F495] = "DTLS session cache unavailable, reconnects use full handshakes",  /* SID:495 */
+    [LA_F496] = "[MbedTLS] ticket setup failed: -0x%x",  /* SID:496 */
+    [LA_F497] = "[MbedTLS] resuming cached session for %s",  /* SID:497 */
+    [LA_F498] = "[OpenSSL] resuming cached session for %s",  /* SID:498 */
+    [LA_F499] = "%s: peer migrated to %s:%d, path[%d] → path[%d]",  /* SID:499 */
+    [LA_F500] = "%s requires auth_key",  /* SID:500 */
+    [LA_F501] = "%s: peer echoed our own nonce, ignored",  /* SID:501 */
+    [LA_F502] = "%s: session keys %s",  /* SID:502 */
+    [LA_F503] = "%s: replayed or stale record seq=%llu dropped",  /* SID:503 */
+    [LA_F504] = "%s: record authentication failed",  /* SID:504 */
+    [LA_F505] = "Peer sent no %s params, traffic stays unencrypted",  /* SID:505 */
+    [LA_F506] = "Built-in AEAD (ChaCha20-Poly1305) enabled as encryption layer",  /* SID:506 */
+    [LA_F507] = "%s: path tx UP (nominated)",  /* SID:507 */
+    [LA_F508] = "%s: path[%d] UP (nominated, %s:%d)",  /* SID:508 */
+    [LA_F509] = "%s: PUNCHING → %s (nominated)",  /* SID:509 */
+    [LA_F510] = "ICE-lite: skip srflx/relay gathering",  /* SID:510 */
+    [LA_F511] = "%s: open predict sockets failed, predicting via default socket",  /* SID:511 */
+    [LA_F512] = "%s: symmetric NAT, predicting ports of %s:%d (step %d)",  /* SID:512 */
+    [LA_F513] = "%s: predicted port hit cand[%d]<%s:%d> via sock %d",  /* SID:513 */
+    [LA_F514] = "path cache unavailable, reconnects start from signaling",  /* SID:514 */
+    [LA_F515] = "%s: resume cached path %s:%d (%s)",  /* SID:515 */
+    [LA_F516] = "%s: cached path %s:%d unreachable, dropped",  /* SID:516 */
+    [LA_F517] = "path cache: %d entries loaded from %s",  /* SID:517 */
+    [LA_F518] = "path cache: write %s failed",  /* SID:518 */
+    [LA_F519] = "%s: cached path %s:%d confirmed (%llu ms)",  /* SID:519 */
+    [LA_F520] = "Cross-check: %s:%d maps us to %s:%d, symmetric mapping",  /* SID:520 */
+    [LA_F521] = "Detection completed %s (shared)",  /* SID:521 */
+    [LA_F522] = "%s: no direct path after %llu ms, racing on signaling relay",  /* SID:522 */
+    [LA_F523] = "Gathered Host candidate: [%s]:%d (priority=0x%08x)",  /* SID:523 */
+    [LA_F524] = "Open IPv6 UDP socket failed(%d), IPv6 candidates disabled",  /* SID:524 */
+    [LA_F525] = "Open IPv6 UDP socket on port %d",  /* SID:525 */
+    [LA_F526] = "Local IPv6 address detection done: %d address(es)",  /* SID:526 */
+    [LA_F527] = "%s: NAT binding lifetime >= %u ms, keepalive interval %u ms",  /* SID:527 */
+    [LA_F528] = "%s: binding probe #%u, idle gap %u ms",  /* SID:528 */
+    [LA_F529] = "%s: peer does not answer binding probe, adaptive keepalive off for this session",  /* SID:529 */
+    [LA_F530] = "%s: binding expired within %u ms idle",  /* SID:530 */
+    [LA_F531] = "%s: binding alive after %u ms idle",  /* SID:531 */
+    [LA_F532] = "path migrated: %d in-flight packets resent",  /* SID:532 */
+    [LA_F533] = "Path switched predictively (idx=%d)",  /* SID:533 */
+    [LA_W534] = "prewarm",  /* SID:534 */
+    [LA_F535] = "TURN ChannelBind %s:%u -> 0x%04x",  /* SID:535 */
+    [LA_F536] = "TURN channel 0x%04x bound",  /* SID:536 */
+    [LA_F537] = "TURN ChannelBind 0x%04x failed (error=%d), using Send Indication",  /* SID:537 */
+    [LA_F538] = "TURN Allocate timeout after %d tries",  /* SID:538 */
+    [LA_F539] = "TURN allocation expired, re-allocating",  /* SID:539 */
+    [LA_F540] = "bind :%u failed(%d)",  /* SID:540 */
+    [LA_F541] = "connected to %s:%u (path[%d])",  /* SID:541 */
+    [LA_F542] = "punch round timed out, retry in %ds",  /* SID:542 */
+    [LA_F543] = "path[%d] lost: %s",  /* SID:543 */
+    [LA_F544] = "punch round: %d targets from :%u",  /* SID:544 */
+    [LA_F545] = "tx backlog full, frame dropped (type=%u)",  /* SID:545 */
+    [LA_F546] = "[SCTP] stream %d backlog full, %d bytes dropped",  /* SID:546 */
+    [LA_F547] = "%s sent (ses_id=%u), ver=%u, ops=%d\n",  /* SID:547 */
+    [LA_F548] = "%s: ignored stale delta ack ver=%u (current=%u)\n",  /* SID:548 */
+    [LA_F549] = "%s: delta ver=%u acked\n",  /* SID:549 */
+    [LA_F550] = "%s: bad payload(len=%d ver=%u ops=%d)\n",  /* SID:550 */
+    [LA_F551] = "%s: remote cand[%d]<%s:%d> re-added\n",  /* SID:551 */
+    [LA_F552] = "%s: remote cand[%d]<%s:%d> removed\n",  /* SID:552 */
+    [LA_F553] = "%s: unknown delta op %u, skipped\n",  /* SID:553 */
+    [LA_F554] = "%s: ignored old ver=%u (current=%u)\n",  /* SID:554 */
+    [LA_F555] = "%s: delta queue full, cand<%s:%d> change dropped\n",  /* SID:555 */
+    [LA_F556] = "%s: delta %s cand<%s:%d> (ses_id=%u)\n",  /* SID:556 */
+    [LA_F557] = "%s: delta ver=%u unacked after %d attempts, dropped\n",  /* SID:557 */
+    [LA_F558] = "%s: protocol mismatch, recv PKT_BULK on trans=%s",  /* SID:558 */
+    [LA_F559] = "bulk frame sent seq=%u pkts=%d len=%d",  /* SID:559 */
+    [LA_F560] = "resolve %s failed",  /* SID:560 */
+    [LA_F561] = "connect %s:%u failed(%d)",  /* SID:561 */
+    [LA_F562] = "no CA bundle found, server certificate will not be verified",  /* SID:562 */
+    [LA_F563] = "keep-alive connection to %s lost, reconnecting",  /* SID:563 */
+    [LA_F564] = "connect %s:%u failed(%d)",  /* SID:564 */
+    [LA_F565] = "TLS handshake with %s failed: -0x%04x",  /* SID:565 */
+    [LA_F566] = "request to %s timed out",  /* SID:566 */
+    [LA_F567] = "%s: request queue full, dropping %s %s",  /* SID:567 */
+    [LA_F568] = "%s: push channel ws://%s:%u open",  /* SID:568 */
+    [LA_F569] = "%s: push channel lost, reconnecting",  /* SID:569 */
+    [LA_F570] = "ONLINE: WebSocket push requires WITH_WSLAY",  /* SID:570 */
+    [LA_F571] = "PUBSUB mode requires gh_token and gist_id, or server_host for WebSocket push",  /* SID:571 */
+    [LA_F572] = "REG to PUBSUB signaling (WebSocket push: %s:%d)",  /* SID:572 */
+    [LA_F573] = "Cluster node selected: %s:%d",  /* SID:573 */
+    [LA_F574] = "%s: rate limited by server, retry in %u ms\n",  /* SID:574 */
+    [LA_F575] = "%s: ignored for sid=%u (not pending)\n",  /* SID:575 */
+    [LA_F576] = "%s: session offer(st=%s peer=%s), %s\n",  /* SID:576 */
+    [LA_F577] = "%s: duplicate/irrelevant response acked (sid=%u)\n",  /* SID:577 */
+    [LA_F578] = "%s: irrelevant response (sid=%u)\n",  /* SID:578 */
+    [LA_F579] = "%s: request (sid=%u) failed, code=%u\n",  /* SID:579 */
+    [LA_F580] = "%s: response (sid=%u) pull failed, code=%u\n",  /* SID:580 */
+    [LA_F581] = "%s: bad response frame (sid=%u)\n",  /* SID:581 */
+    [LA_F582] = "%s: response (sid=%u, len=%u) rejected, %s\n",  /* SID:582 */
+    [LA_F583] = "%s: pulling response (sid=%u, len=%u)\n",  /* SID:583 */
+    [LA_F584] = "%s: request len=%d exceeds rpc_max_size=%u\n",  /* SID:584 */
+    [LA_F585] = "%s: request (sid=%u) len=%d in %u fragments\n",  /* SID:585 */
+    [LA_F586] = "%s: response len=%d exceeds rpc_max_size=%u\n",  /* SID:586 */
+    [LA_F587] = "%s: pull rejected (xid=%u idx=%u)\n",  /* SID:587 */
+    [LA_F588] = "%s: request fragment rejected (xid=%u idx=%u total=%u)\n",  /* SID:588 */
+    [LA_F589] = "%s: request (sid=%u) overrides unanswered request (sid=%u)\n",  /* SID:589 */
+    [LA_F590] = "%s: request reassembled (sid=%u) msg=%u len=%u\n",  /* SID:590 */
+    [LA_F591] = "%s: response complete (sid=%u) len=%u\n",  /* SID:591 */
+    [LA_F592] = "%s: fragment %u rejected by peer\n",  /* SID:592 */
+    [LA_F593] = "%s: %s timeout (sid=%u)\n",  /* SID:593 */
+    [LA_F594] = "%s: path[%d] MTU %u bytes, data payload %d",  /* SID:594 */
+    [LA_F595] = "%s: peer does not answer PMTU probe, path MTU stays %d",  /* SID:595 */
+    [LA_F596] = "%s: path[%d] PMTU probe %u bytes lost",  /* SID:596 */
+    [LA_F597] = "%s: path[%d] PMTU probe %u bytes acked",  /* SID:597 */
+    [LA_F598] = "%s: path[%d] large packets time out, path MTU %u → %d",  /* SID:598 */
+    [LA_F599] = "%s: peer sends parity, keeping last %d DATA",  /* SID:599 */
+    [LA_F600] = "%s: recovered seq=%u from group %u+%d",  /* SID:600 */
+    [LA_F601] = "%s: bad option '%s=%s'",  /* SID:601 */
+    [LA_F602] = "%s: impairment on (seed=%d): tx loss=%.3f delay=%dms rate=%dkbps, rx loss=%.3f delay=%dms rate=%dkbps",  /* SID:602 */
+    [LA_F603] = "%s: cannot open '%s'",  /* SID:603 */
+    [LA_F604] = "%s: writing events to '%s'",  /* SID:604 */
+    [LA_F605] = "hist %s: n=%llu avg=%llu min=%llu p50=%llu p90=%llu p99=%llu p999=%llu max=%llu us",  /* SID:605 */
+    [LA_F606] = "hist: not compiled in (build with P2P_METRICS)",  /* SID:606 */
+    [LA_F607] = "hist: reset",  /* SID:607 */
+    [LA_F608] = "Setup: gather=%d signaled=%d remote_cand=%d cands_done=%d punch=%d reach=%d connected=%d ms",  /* SID:608 */
+    [LA_F609] = "%s: reclaimed %u arena blocks",  /* SID:609 */
+    [LA_F610] = "%s: idle %d ms, session buffers released",  /* SID:610 */
+    [LA_F611] = "%s: session buffers restored",  /* SID:611 */
+    [LA_F612] = "resolved %s -> %s (%llu ms)",  /* SID:612 */
+    [LA_F613] = "DNS resolver thread unavailable, resolving synchronously",  /* SID:613 */
+    [LA_F614] = "Resolve RELAY signaling server address: %s:%d failed(%d)",  /* SID:614 */
+    [LA_F615] = "Address change notification unavailable",  /* SID:615 */
+    [LA_F616] = "Local addresses changed (gen=%u)",  /* SID:616 */
+    [LA_F617] = "Local addresses changed: %d address(es), re-gathering candidates",  /* SID:617 */
+    [LA_F618] = "request relay via %s for %s (ses_id=%u)",  /* SID:618 */
+    [LA_F619] = "%s: cand[%d]<%s:%d> via %s",  /* SID:619 */
+    [LA_F620] = "relay table full, ses_id=%u rejected",  /* SID:620 */
+    [LA_F621] = "relaying ses_id=%u between %s and %s",  /* SID:621 */
+    [LA_F622] = "relay via %s refused for %s",  /* SID:622 */
+    [LA_F623] = "relay via %s not answered, giving up",  /* SID:623 */
+    [LA_F624] = "relay ses_id=%u expired",  /* SID:624 */
+    [LA_F625] = "socket buffer %d -> %d bytes (kernel %d)",  /* SID:625 */
+    [LA_F626] = "set thread affinity 0x%llx failed(%d)",  /* SID:626 */
+    [LA_F627] = "thread affinity not supported on this platform",  /* SID:627 */
+    [LA_F628] = "ECN congestion, cwnd: %u (alpha=%.3f)",  /* SID:628 */
+    [LA_F629] = "IOCP create failed(%d), using recvfrom",  /* SID:629 */
+    [LA_F630] = "IOCP associate failed(%d), using recvfrom",  /* SID:630 */
+    [LA_F631] = "IOCP close with %d receives outstanding",  /* SID:631 */
+    [LA_F632] = "io_uring unavailable(%d), using recvmmsg",  /* SID:632 */
+    [LA_F633] = "io_uring multishot recvmsg unsupported(%d), using recvmmsg",  /* SID:633 */
+    [LA_F634] = "Unknown local identity '%s'",  /* SID:634 */
+    [LA_F635] = "Unknown local identity '%s'",  /* SID:635 */
+    [LA_F636] = "identities require COMPACT mode with multi_session",  /* SID:636 */
+    [LA_F637] = "%s sent, ident='%s' inst_id=%u\n",  /* SID:637 */
+    [LA_F638] = "identity '%s' added (%d extra)\n",  /* SID:638 */
+    [LA_F639] = "%s sent, ident='%s' inst_id=%u\n",  /* SID:639 */
+    [LA_F640] = "identity '%s' removed\n",  /* SID:640 */
+    [LA_F641] = "%s: identity '%s' timeout, max(%d) attempts reached\n",  /* SID:641 */
+    [LA_F642] = "STUN collecting on %d socket(s) via %s:%d",  /* SID:642 */
+    [LA_F643] = "%s: handing over prewarmed session (state=%d)",  /* SID:643 */
+    [LA_F644] = "%s: prewarm session started",  /* SID:644 */
+    [LA_F645] = "resume from %s: %d/%d chunks done",  /* SID:645 */
+    [LA_F646] = "state file %s not writable, transfer not resumable",  /* SID:646 */
+    [LA_F647] = "%s: attached to bulk %s (%d session(s))",  /* SID:647 */
+    [LA_F648] = "%s: unexpected bulk record 0x%02x, detached",  /* SID:648 */
+    [LA_F649] = "bulk object: %lld bytes, %d chunks of %u",  /* SID:649 */
+    [LA_F650] = "%s: chunk %d CRC mismatch, refetching",  /* SID:650 */
+    [LA_F651] = "bulk transfer complete: %lld bytes",  /* SID:651 */
+    [LA_F652] = "%s: peer offers a different object, detached",  /* SID:652 */
+    [LA_F653] = "%s: session unusable, detached from bulk",  /* SID:653 */
+    [LA_F654] = "tune: bad '%s'",  /* SID:654 */
+    [LA_F655] = "tune %s=%d",  /* SID:655 */
+    [LA_F656] = "Started %d crypto worker threads",  /* SID:656 */
+    [LA_F657] = "Candidate decompress failed",  /* SID:657 */
+    [LA_F658] = "%s: candidate delta gap (base=%d, have=%d), requesting resend",  /* SID:658 */
+    [LA_F659] = "[R] MUX login %u rx backlog overflow (%d bytes), closing login\n",  /* SID:659 */
+    [LA_F660] = "[R] MUX joined shared link as login %u (refs=%d)\n",  /* SID:660 */
+    [LA_F661] = "[R] server does not support MUX, using a dedicated connection\n",  /* SID:661 */
+    [LA_F662] = "[R] MUX login %u closed by server\n",  /* SID:662 */
+    [LA_F663] = "create %s failed(%d)",  /* SID:663 */
+    [LA_F664] = "same-host peer, shared memory path[%d] (%s)",  /* SID:664 */
+    [LA_F665] = "attach %s failed, staying on %s",  /* SID:665 */
+    [LA_F666] = "ring full, frame dropped (type=%u)",  /* SID:666 */
+    [LA_F667] = "TURN probe: no server resolvable",  /* SID:667 */
+    [LA_F668] = "TURN server %s:%u selected (rtt=%ums)",  /* SID:668 */
+    [LA_F669] = "TURN probe %s:%u rtt=%ums",  /* SID:669 */
+    [LA_F670] = "Probing RTT of %d TURN servers",  /* SID:670 */
+    [LA_F671] = "[R] OOM for large frame (%u bytes)\n",  /* SID:671 */
+    [LA_F672] = "tail loss probe seq=%u srtt=%d",  /* SID:672 */
+    [LA_F673] = "%s: cand history net=%s/24 nat=%d tried=0x%x win=%s %u ms",  /* SID:673 */
+    [LA_F674] = "candidate history unavailable, checks use fixed priority order",  /* SID:674 */
+    [LA_F675] = "Started shared executor with %d threads",  /* SID:675 */
+    [LA_F676] = "shared executor not running, starting own thread",  /* SID:676 */
+    [LA_F677] = "worker_count/latency_mode/udp_iocp need own thread, not using shared executor",  /* SID:677 */
+    [LA_F678] = "%s: stale response ignored (sid=%u)\n",  /* SID:678 */
+    [LA_F679] = "%s: new request (sid=%u) overrides pending request (sid=%u)\n",  /* SID:679 */
+    [LA_F680] = "%s: request accepted (sid=%u) msg=%u len=%d\n",  /* SID:680 */
+    [LA_F681] = "%s: ignored, punch already started (nat=%d)\n",  /* SID:681 */
+    [LA_F682] = "%s: punch in %u ms (ses_id=%u)\n",  /* SID:682 */
+    [LA_F683] = "%s: identity '%s' online, auth_key=%llu\n",  /* SID:683 */
+    [LA_F684] = "%s: peer shares public address, probing host candidates first",  /* SID:684 */
+    [LA_F685] = "%s: keepalive interval %u s advised by server\n",  /* SID:685 */
+    [LA_F686] = "ONLINE: gist list too long (%d > %d)",  /* SID:686 */
+    [LA_F687] = "ACK beyond send_seq ignored ack_seq=%u send_seq=%u",  /* SID:687 */
+    [LA_F688] = "expired message dropped before send, len=%d",  /* SID:688 */
+    [LA_F689] = "expired message skipped by peer, %d bytes discarded",  /* SID:689 */
+    [LA_F690] = "expired message fragment seq=%u replaced by skip (%d bytes)",  /* SID:690 */
+    [LA_F691] = "resume buffers alloc failed, %d packets dropped",  /* SID:691 */
+    [LA_F692] = "session reset, %d packets retained for resume",  /* SID:692 */
+    [LA_F693] = "resume token mismatch, %d retained packets dropped",  /* SID:693 */
+    [LA_F694] = "resume gap on stream %d: peer at %u, resending from %u",  /* SID:694 */
+    [LA_F695] = "session resumed, %d packets requeued",  /* SID:695 */
+    [LA_F696] = "lan: bad announce MAC from %s:%d",  /* SID:696 */
+    [LA_F697] = "lan: peer '%s' seen at %s:%d (%d addrs)",  /* SID:697 */
+    [LA_F698] = "lan: discovery on %s:%d",  /* SID:698 */
+    [LA_F699] = "lan discovery unavailable(%d), LAN peers connect via signaling",  /* SID:699 */
+    [LA_F700] = "%s sent, inst_id=%u, +SYNC0 remote='%.32s' cands=%d\n",  /* SID:700 */
+    [LA_F701] = "ONLINE: auth_key acquired, SYNC0 accepted with ONLINE\n",  /* SID:701 */
+    [LA_F702] = "no CA bundle found, server certificate will not be verified",  /* SID:702 */
+    [LA_F703] = "TURN over TLS requires a WITH_DTLS build",  /* SID:703 */
+    [LA_F704] = "connect %s:%u failed(%d)",  /* SID:704 */
+    [LA_F705] = "TURN %s connecting to %s:%u",  /* SID:705 */
+    [LA_F706] = "TURN connection to %s:%u lost: %s",  /* SID:706 */
+    [LA_F707] = "TLS handshake with %s failed: -0x%04x",  /* SID:707 */
+    [LA_F708] = "TURN tx backlog full, message dropped (%d bytes)",  /* SID:708 */
+    [LA_F709] = "load CA bundle %s failed",  /* SID:709 */
+    [LA_F710] = "no CA bundle found, refusing unverified TLS (set tls_ca_file)",  /* SID:710 */
 };
 
 /* 语言初始化函数（自动生成，请勿修改）*/
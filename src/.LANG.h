@@ -514,6 +514,244 @@ enum {
     LA_F470,  /* "✗ Add Srflx candidate failed(OOM)"  [p2p_stun.c] */
     LA_F471,  /* "%s: recorded peer conn_seq=%u for future CONN_ACK" (%s,%u)  [p2p_nat.c] */
     LA_F472,  /* "retry seq=%u retx=%d rto=%d" (%u,%d,%d)  [p2p_trans_reliable.c] */
+    LA_F473,  /* "Reliable buffers alloc failed win=%d" (%d)  [p2p_trans_reliable.c] */
+    LA_F474,  /* "Reliable peer caps=0x%02x win=%d, send window=%d" (%d,%d,%d)  [p2p_trans_reliable.c] */
+    LA_F475,  /* "Reliable pool grow failed total=%d" (%d)  [p2p_trans_reliable.c] */
+    LA_F476,  /* "fast retransmit seq=%u retx=%d rack_seq=%u" (%u,%d,%u)  [p2p_trans_reliable.c] */
+    LA_F477,  /* "Peer requested ACK every %d pkts or %d ms" (%d,%d)  [p2p_trans_reliable.c] */
+    LA_F478,  /* "BBR state=%d btl_bw=%lld B/s min_rtt=%d cwnd=%lld" (%d,%d,%d,%d)  [p2p_trans_bbr.c] */
+    LA_F479,  /* "BBR enabled as transport layer"  [p2p.c] */
+    LA_F480,  /* "congestion control: %s" (%s)  [p2p_trans_pseudotcp.c] */
+    LA_F481,  /* "ring grow to %d failed" (%d)  [p2p_stream.c] */
+    LA_F482,  /* "stream buffers alloc failed"  [p2p.c] */
+    LA_F483,  /* "zero window probe rwnd=%d" (%d)  [p2p_trans_reliable.c] */
+    LA_F484,  /* "Receive window full, dropping seq=%u buffered=%d" (%u,%d)  [p2p_trans_reliable.c] */
+    LA_F485,  /* "Data delivered in order seq=%u len=%d" (%u,%d)  [p2p_trans_reliable.c] */
+    LA_F486,  /* "message truncated by peer, %d bytes discarded" (%d)  [p2p_stream.c] */
+    LA_F487,  /* "message exceeds recv buffer max %d, dropped" (%d)  [p2p_stream.c] */
+    LA_F488,  /* "datagram buffers alloc failed"  [p2p.c] */
+    LA_F489,  /* "Data delivered ahead of gap seq=%u len=%d base=%u" (%u,%d,%u)  [p2p_trans_reliable.c] */
+    LA_F490,  /* "Started %d session worker threads" (%d)  [p2p_thread.c] */
+    LA_F491,  /* "corrupt compressed DATA (%d bytes), dropped" (%d)  [p2p_stream.c] */
+    LA_F492,  /* "file read failed at %lld (ret=%d), transfer aborted" (%d,%d)  [p2p_stream.c] */
+    LA_F493,  /* "file write failed at %lld, transfer aborted" (%d)  [p2p_stream.c] */
+    LA_F494,  /* "session too large to cache (%d bytes)" (%d)  [p2p_dtls.c] */
+    LA_F495,  /* "DTLS session cache unavailable, reconnects use full handshakes"  [p2p.c] */
+    LA_F496,  /* "[MbedTLS] ticket setup failed: -0x%x" (%d)  [p2p_dtls_mbedtls.c] */
+    LA_F497,  /* "[MbedTLS] resuming cached session for %s" (%s)  [p2p_dtls_mbedtls.c] */
+    LA_F498,  /* "[OpenSSL] resuming cached session for %s" (%s)  [p2p_dtls_openssl.c] */
+    LA_F499,  /* "%s: peer migrated to %s:%d, path[%d] → path[%d]" (%s,%s,%d,%d,%d)  [p2p_nat.c] */
+    LA_F500,  /* "%s requires auth_key" (%s)  [p2p_dtls_aead.c] */
+    LA_F501,  /* "%s: peer echoed our own nonce, ignored" (%s)  [p2p_dtls_aead.c] */
+    LA_F502,  /* "%s: session keys %s" (%s,%s)  [p2p_dtls_aead.c] */
+    LA_F503,  /* "%s: replayed or stale record seq=%llu dropped" (%s,%u)  [p2p_dtls_aead.c] */
+    LA_F504,  /* "%s: record authentication failed" (%s)  [p2p_dtls_aead.c] */
+    LA_F505,  /* "Peer sent no %s params, traffic stays unencrypted" (%s)  [p2p_trans_reliable.c] */
+    LA_F506,  /* "Built-in AEAD (ChaCha20-Poly1305) enabled as encryption layer"  [p2p.c] */
+    LA_F507,  /* "%s: path tx UP (nominated)" (%s)  [p2p_nat.c] */
+    LA_F508,  /* "%s: path[%d] UP (nominated, %s:%d)" (%s,%d,%s,%d)  [p2p_nat.c] */
+    LA_F509,  /* "%s: PUNCHING → %s (nominated)" (%s,%s)  [p2p_nat.c] */
+    LA_F510,  /* "ICE-lite: skip srflx/relay gathering"  [p2p.c] */
+    LA_F511,  /* "%s: open predict sockets failed, predicting via default socket" (%s)  [p2p_nat.c] */
+    LA_F512,  /* "%s: symmetric NAT, predicting ports of %s:%d (step %d)" (%s,%s,%d,%d)  [p2p_nat.c] */
+    LA_F513,  /* "%s: predicted port hit cand[%d]<%s:%d> via sock %d" (%s,%d,%s,%d,%d)  [p2p_nat.c] */
+    LA_F514,  /* "path cache unavailable, reconnects start from signaling"  [p2p.c] */
+    LA_F515,  /* "%s: resume cached path %s:%d (%s)" (%s,%s,%d,%s)  [p2p_nat.c] */
+    LA_F516,  /* "%s: cached path %s:%d unreachable, dropped" (%s,%s,%d)  [p2p_nat.c] */
+    LA_F517,  /* "path cache: %d entries loaded from %s" (%d,%s)  [p2p_path_cache.c] */
+    LA_F518,  /* "path cache: write %s failed" (%s)  [p2p_path_cache.c] */
+    LA_F519,  /* "%s: cached path %s:%d confirmed (%llu ms)" (%s,%s,%d,%u)  [p2p_nat.c] */
+    LA_F520,  /* "Cross-check: %s:%d maps us to %s:%d, symmetric mapping" (%s,%d,%s,%d)  [p2p_stun.c] */
+    LA_F521,  /* "Detection completed %s (shared)" (%s)  [p2p_stun.c] */
+    LA_F522,  /* "%s: no direct path after %llu ms, racing on signaling relay" (%s,%u)  [p2p_nat.c] */
+    LA_F523,  /* "Gathered Host candidate: [%s]:%d (priority=0x%08x)" (%s,%d,%d)  [p2p.c] */
+    LA_F524,  /* "Open IPv6 UDP socket failed(%d), IPv6 candidates disabled" (%d)  [p2p.c] */
+    LA_F525,  /* "Open IPv6 UDP socket on port %d" (%d)  [p2p.c] */
+    LA_F526,  /* "Local IPv6 address detection done: %d address(es)" (%d)  [p2p_route.c] */
+    LA_F527,  /* "%s: NAT binding lifetime >= %u ms, keepalive interval %u ms" (%s,%u,%u)  [p2p_nat.c] */
+    LA_F528,  /* "%s: binding probe #%u, idle gap %u ms" (%s,%u,%u)  [p2p_nat.c] */
+    LA_F529,  /* "%s: peer does not answer binding probe, adaptive keepalive off for this session" (%s)  [p2p_nat.c] */
+    LA_F530,  /* "%s: binding expired within %u ms idle" (%s,%u)  [p2p_nat.c] */
+    LA_F531,  /* "%s: binding alive after %u ms idle" (%s,%u)  [p2p_nat.c] */
+    LA_F532,  /* "path migrated: %d in-flight packets resent" (%d)  [p2p_trans_reliable.c] */
+    LA_F533,  /* "Path switched predictively (idx=%d)" (%d)  [p2p.c] */
+    LA_W534,  /* "prewarm"  [p2p_nat.c] */
+    LA_F535,  /* "TURN ChannelBind %s:%u -> 0x%04x" (%s,%u,%d)  [p2p_turn.c] */
+    LA_F536,  /* "TURN channel 0x%04x bound" (%d)  [p2p_turn.c] */
+    LA_F537,  /* "TURN ChannelBind 0x%04x failed (error=%d), using Send Indication" (%d,%d)  [p2p_turn.c] */
+    LA_F538,  /* "TURN Allocate timeout after %d tries" (%d)  [p2p_turn.c] */
+    LA_F539,  /* "TURN allocation expired, re-allocating"  [p2p_turn.c] */
+    LA_F540,  /* "bind :%u failed(%d)" (%u,%d)  [p2p_tcp_punch.c] */
+    LA_F541,  /* "connected to %s:%u (path[%d])" (%s,%u,%d)  [p2p_tcp_punch.c] */
+    LA_F542,  /* "punch round timed out, retry in %ds" (%d)  [p2p_tcp_punch.c] */
+    LA_F543,  /* "path[%d] lost: %s" (%d,%s)  [p2p_tcp_punch.c] */
+    LA_F544,  /* "punch round: %d targets from :%u" (%d,%u)  [p2p_tcp_punch.c] */
+    LA_F545,  /* "tx backlog full, frame dropped (type=%u)" (%u)  [p2p_tcp_punch.c] */
+    LA_F546,  /* "[SCTP] stream %d backlog full, %d bytes dropped" (%d,%d)  [p2p_trans_sctp.c] */
+    LA_F547,  /* "%s sent (ses_id=%u), ver=%u, ops=%d\n" (%s,%u,%u,%d)  [p2p_signal_compact.c] */
+    LA_F548,  /* "%s: ignored stale delta ack ver=%u (current=%u)\n" (%s,%u,%u)  [p2p_signal_compact.c] */
+    LA_F549,  /* "%s: delta ver=%u acked\n" (%s,%u)  [p2p_signal_compact.c] */
+    LA_F550,  /* "%s: bad payload(len=%d ver=%u ops=%d)\n" (%s,%d,%u,%d)  [p2p_signal_compact.c] */
+    LA_F551,  /* "%s: remote cand[%d]<%s:%d> re-added\n" (%s,%d,%s,%d)  [p2p_signal_compact.c] */
+    LA_F552,  /* "%s: remote cand[%d]<%s:%d> removed\n" (%s,%d,%s,%d)  [p2p_signal_compact.c] */
+    LA_F553,  /* "%s: unknown delta op %u, skipped\n" (%s,%u)  [p2p_signal_compact.c] */
+    LA_F554,  /* "%s: ignored old ver=%u (current=%u)\n" (%s,%u,%u)  [p2p_signal_compact.c] */
+    LA_F555,  /* "%s: delta queue full, cand<%s:%d> change dropped\n" (%s,%s,%d)  [p2p_signal_compact.c] */
+    LA_F556,  /* "%s: delta %s cand<%s:%d> (ses_id=%u)\n" (%s,%s,%s,%d,%u)  [p2p_signal_compact.c] */
+    LA_F557,  /* "%s: delta ver=%u unacked after %d attempts, dropped\n" (%s,%u,%d)  [p2p_signal_compact.c] */
+    LA_F558,  /* "%s: protocol mismatch, recv PKT_BULK on trans=%s" (%s,%s)  [p2p_nat.c] */
+    LA_F559,  /* "bulk frame sent seq=%u pkts=%d len=%d" (%u,%d,%d)  [p2p_trans_reliable.c] */
+    LA_F560,  /* "resolve %s failed" (%s)  [p2p_http.c] */
+    LA_F561,  /* "connect %s:%u failed(%d)" (%s,%u,%d)  [p2p_http.c] */
+    LA_F562,  /* "no CA bundle found, server certificate will not be verified"  [p2p_http.c] */
+    LA_F563,  /* "keep-alive connection to %s lost, reconnecting" (%s)  [p2p_http.c] */
+    LA_F564,  /* "connect %s:%u failed(%d)" (%s,%u,%d)  [p2p_http.c] */
+    LA_F565,  /* "TLS handshake with %s failed: -0x%04x" (%s,%d)  [p2p_http.c] */
+    LA_F566,  /* "request to %s timed out" (%s)  [p2p_http.c] */
+    LA_F567,  /* "%s: request queue full, dropping %s %s" (%s,%s,%s)  [p2p_signal_pubsub.c] */
+    LA_F568,  /* "%s: push channel ws://%s:%u open" (%s,%s,%u)  [p2p_signal_pubsub.c] */
+    LA_F569,  /* "%s: push channel lost, reconnecting" (%s)  [p2p_signal_pubsub.c] */
+    LA_F570,  /* "ONLINE: WebSocket push requires WITH_WSLAY"  [p2p_signal_pubsub.c] */
+    LA_F571,  /* "PUBSUB mode requires gh_token and gist_id, or server_host for WebSocket push"  [p2p.c] */
+    LA_F572,  /* "REG to PUBSUB signaling (WebSocket push: %s:%d)" (%s,%d)  [p2p.c] */
+    LA_F573,  /* "Cluster node selected: %s:%d" (%s,%d)  [p2p.c] */
+    LA_F574,  /* "%s: rate limited by server, retry in %u ms\n" (%s,%u)  [p2p_signal_compact.c] */
+    LA_F575,  /* "%s: ignored for sid=%u (not pending)\n" (%s,%u)  [p2p_signal_compact.c] */
+    LA_F576,  /* "%s: session offer(st=%s peer=%s), %s\n" (%s,%s,%s,%s)  [p2p_signal_relay.c] */
+    LA_F577,  /* "%s: duplicate/irrelevant response acked (sid=%u)\n" (%s,%u)  [p2p_signal_compact.c] */
+    LA_F578,  /* "%s: irrelevant response (sid=%u)\n" (%s,%u)  [p2p_signal_relay.c] */
+    LA_F579,  /* "%s: request (sid=%u) failed, code=%u\n" (%s,%u,%u)  [p2p_rpc.c] */
+    LA_F580,  /* "%s: response (sid=%u) pull failed, code=%u\n" (%s,%u,%u)  [p2p_rpc.c] */
+    LA_F581,  /* "%s: bad response frame (sid=%u)\n" (%s,%u)  [p2p_rpc.c] */
+    LA_F582,  /* "%s: response (sid=%u, len=%u) rejected, %s\n" (%s,%u,%u,%s)  [p2p_rpc.c] */
+    LA_F583,  /* "%s: pulling response (sid=%u, len=%u)\n" (%s,%u,%u)  [p2p_rpc.c] */
+    LA_F584,  /* "%s: request len=%d exceeds rpc_max_size=%u\n" (%s,%d,%u)  [p2p_rpc.c] */
+    LA_F585,  /* "%s: request (sid=%u) len=%d in %u fragments\n" (%s,%u,%d,%u)  [p2p_rpc.c] */
+    LA_F586,  /* "%s: response len=%d exceeds rpc_max_size=%u\n" (%s,%d,%u)  [p2p_rpc.c] */
+    LA_F587,  /* "%s: pull rejected (xid=%u idx=%u)\n" (%s,%u,%u)  [p2p_rpc.c] */
+    LA_F588,  /* "%s: request fragment rejected (xid=%u idx=%u total=%u)\n" (%s,%u,%u,%u)  [p2p_rpc.c] */
+    LA_F589,  /* "%s: request (sid=%u) overrides unanswered request (sid=%u)\n" (%s,%u,%u)  [p2p_rpc.c] */
+    LA_F590,  /* "%s: request reassembled (sid=%u) msg=%u len=%u\n" (%s,%u,%u,%u)  [p2p_rpc.c] */
+    LA_F591,  /* "%s: response complete (sid=%u) len=%u\n" (%s,%u,%u)  [p2p_rpc.c] */
+    LA_F592,  /* "%s: fragment %u rejected by peer\n" (%s,%u)  [p2p_rpc.c] */
+    LA_F593,  /* "%s: %s timeout (sid=%u)\n" (%s,%s,%u)  [p2p_rpc.c] */
+    LA_F594,  /* "%s: path[%d] MTU %u bytes, data payload %d" (%s,%d,%u,%d)  [p2p_nat.c] */
+    LA_F595,  /* "%s: peer does not answer PMTU probe, path MTU stays %d" (%s,%d)  [p2p_nat.c] */
+    LA_F596,  /* "%s: path[%d] PMTU probe %u bytes lost" (%s,%d,%u)  [p2p_nat.c] */
+    LA_F597,  /* "%s: path[%d] PMTU probe %u bytes acked" (%s,%d,%u)  [p2p_nat.c] */
+    LA_F598,  /* "%s: path[%d] large packets time out, path MTU %u → %d" (%s,%d,%u,%d)  [p2p_nat.c] */
+    LA_F599,  /* "%s: peer sends parity, keeping last %d DATA" (%s,%d)  [p2p_fec.c] */
+    LA_F600,  /* "%s: recovered seq=%u from group %u+%d" (%s,%u,%u,%d)  [p2p_fec.c] */
+    LA_F601,  /* "%s: bad option '%s=%s'" (%s,%s,%s)  [p2p_netem.c] */
+    LA_F602,  /* "%s: impairment on (seed=%d): tx loss=%.3f delay=%dms rate=%dkbps, rx loss=%.3f delay=%dms rate=%dkbps" (%s,%d,%f,%d,%d,%f,%d,%d)  [p2p_netem.c] */
+    LA_F603,  /* "%s: cannot open '%s'" (%s,%s)  [p2p_trace.c] */
+    LA_F604,  /* "%s: writing events to '%s'" (%s,%s)  [p2p_trace.c] */
+    LA_F605,  /* "hist %s: n=%llu avg=%llu min=%llu p50=%llu p90=%llu p99=%llu p999=%llu max=%llu us" (%s,%u,%u,%u,%u,%u,%u,%u,%u)  [p2p_instrument.c] */
+    LA_F606,  /* "hist: not compiled in (build with P2P_METRICS)"  [p2p_instrument.c] */
+    LA_F607,  /* "hist: reset"  [p2p_instrument.c] */
+    LA_F608,  /* "Setup: gather=%d signaled=%d remote_cand=%d cands_done=%d punch=%d reach=%d connected=%d ms" (%d,%d,%d,%d,%d,%d,%d)  [p2p.c] */
+    LA_F609,  /* "%s: reclaimed %u arena blocks" (%s,%u)  [p2p.c] */
+    LA_F610,  /* "%s: idle %d ms, session buffers released" (%s,%d)  [p2p.c] */
+    LA_F611,  /* "%s: session buffers restored" (%s)  [p2p.c] */
+    LA_F612,  /* "resolved %s -> %s (%llu ms)" (%s,%s,%u)  [p2p_dns.c] */
+    LA_F613,  /* "DNS resolver thread unavailable, resolving synchronously"  [p2p_dns.c] */
+    LA_F614,  /* "Resolve RELAY signaling server address: %s:%d failed(%d)" (%s,%d,%d)  [p2p.c] */
+    LA_F615,  /* "Address change notification unavailable"  [p2p_route.c] */
+    LA_F616,  /* "Local addresses changed (gen=%u)" (%u)  [p2p_route.c] */
+    LA_F617,  /* "Local addresses changed: %d address(es), re-gathering candidates" (%d)  [p2p.c] */
+    LA_F618,  /* "request relay via %s for %s (ses_id=%u)" (%s,%s,%u)  [p2p_overlay.c] */
+    LA_F619,  /* "%s: cand[%d]<%s:%d> via %s" (%s,%d,%s,%d,%s)  [p2p_overlay.c] */
+    LA_F620,  /* "relay table full, ses_id=%u rejected" (%u)  [p2p_overlay.c] */
+    LA_F621,  /* "relaying ses_id=%u between %s and %s" (%u,%s,%s)  [p2p_overlay.c] */
+    LA_F622,  /* "relay via %s refused for %s" (%s,%s)  [p2p_overlay.c] */
+    LA_F623,  /* "relay via %s not answered, giving up" (%s)  [p2p_overlay.c] */
+    LA_F624,  /* "relay ses_id=%u expired" (%u)  [p2p_overlay.c] */
+    LA_F625,  /* "socket buffer %d -> %d bytes (kernel %d)" (%d,%d,%d)  [p2p_udp.c] */
+    LA_F626,  /* "set thread affinity 0x%llx failed(%d)" (%d,%d)  [p2p_thread.c] */
+    LA_F627,  /* "thread affinity not supported on this platform"  [p2p_thread.c] */
+    LA_F628,  /* "ECN congestion, cwnd: %u (alpha=%.3f)" (%u,%f)  [p2p_cc.c] */
+    LA_F629,  /* "IOCP create failed(%d), using recvfrom" (%d)  [p2p_udp.c] */
+    LA_F630,  /* "IOCP associate failed(%d), using recvfrom" (%d)  [p2p_udp.c] */
+    LA_F631,  /* "IOCP close with %d receives outstanding" (%d)  [p2p_udp.c] */
+    LA_F632,  /* "io_uring unavailable(%d), using recvmmsg" (%d)  [p2p_udp.c] */
+    LA_F633,  /* "io_uring multishot recvmsg unsupported(%d), using recvmmsg" (%d)  [p2p_udp.c] */
+    LA_F634,  /* "Unknown local identity '%s'" (%s)  [p2p.c] */
+    LA_F635,  /* "Unknown local identity '%s'" (%s)  [p2p.c] */
+    LA_F636,  /* "identities require COMPACT mode with multi_session"  [p2p.c] */
+    LA_F637,  /* "%s sent, ident='%s' inst_id=%u\n" (%s,%s,%u)  [p2p_signal_compact.c] */
+    LA_F638,  /* "identity '%s' added (%d extra)\n" (%s,%d)  [p2p_signal_compact.c] */
+    LA_F639,  /* "%s sent, ident='%s' inst_id=%u\n" (%s,%s,%u)  [p2p_signal_compact.c] */
+    LA_F640,  /* "identity '%s' removed\n" (%s)  [p2p_signal_compact.c] */
+    LA_F641,  /* "%s: identity '%s' timeout, max(%d) attempts reached\n" (%s,%s,%d)  [p2p_signal_compact.c] */
+    LA_F642,  /* "STUN collecting on %d socket(s) via %s:%d" (%d,%s,%d)  [p2p_stun.c] */
+    LA_F643,  /* "%s: handing over prewarmed session (state=%d)" (%s,%d)  [p2p.c] */
+    LA_F644,  /* "%s: prewarm session started" (%s)  [p2p.c] */
+    LA_F645,  /* "resume from %s: %d/%d chunks done" (%s,%d,%d)  [p2p_bulk.c] */
+    LA_F646,  /* "state file %s not writable, transfer not resumable" (%s)  [p2p_bulk.c] */
+    LA_F647,  /* "%s: attached to bulk %s (%d session(s))" (%s,%s,%d)  [p2p_bulk.c] */
+    LA_F648,  /* "%s: unexpected bulk record 0x%02x, detached" (%s,%d)  [p2p_bulk.c] */
+    LA_F649,  /* "bulk object: %lld bytes, %d chunks of %u" (%d,%d,%u)  [p2p_bulk.c] */
+    LA_F650,  /* "%s: chunk %d CRC mismatch, refetching" (%s,%d)  [p2p_bulk.c] */
+    LA_F651,  /* "bulk transfer complete: %lld bytes" (%d)  [p2p_bulk.c] */
+    LA_F652,  /* "%s: peer offers a different object, detached" (%s)  [p2p_bulk.c] */
+    LA_F653,  /* "%s: session unusable, detached from bulk" (%s)  [p2p_bulk.c] */
+    LA_F654,  /* "tune: bad '%s'" (%s)  [p2p_instrument.c] */
+    LA_F655,  /* "tune %s=%d" (%s,%d)  [p2p_instrument.c] */
+    LA_F656,  /* "Started %d crypto worker threads" (%d)  [p2p_thread.c] */
+    LA_F657,  /* "Candidate decompress failed"  [p2p_signal_pubsub.c] */
+    LA_F658,  /* "%s: candidate delta gap (base=%d, have=%d), requesting resend" (%s,%d,%d)  [p2p_signal_pubsub.c] */
+    LA_F659,  /* "[R] MUX login %u rx backlog overflow (%d bytes), closing login\n" (%u,%d)  [p2p_signal_relay.c] */
+    LA_F660,  /* "[R] MUX joined shared link as login %u (refs=%d)\n" (%u,%d)  [p2p_signal_relay.c] */
+    LA_F661,  /* "[R] server does not support MUX, using a dedicated connection\n"  [p2p_signal_relay.c] */
+    LA_F662,  /* "[R] MUX login %u closed by server\n" (%u)  [p2p_signal_relay.c] */
+    LA_F663,  /* "create %s failed(%d)" (%s,%d)  [p2p_shm.c] */
+    LA_F664,  /* "same-host peer, shared memory path[%d] (%s)" (%d,%s)  [p2p_shm.c] */
+    LA_F665,  /* "attach %s failed, staying on %s" (%s,%s)  [p2p_shm.c] */
+    LA_F666,  /* "ring full, frame dropped (type=%u)" (%u)  [p2p_shm.c] */
+    LA_F667,  /* "TURN probe: no server resolvable"  [p2p_turn.c] */
+    LA_F668,  /* "TURN server %s:%u selected (rtt=%ums)" (%s,%u,%u)  [p2p_turn.c] */
+    LA_F669,  /* "TURN probe %s:%u rtt=%ums" (%s,%u,%u)  [p2p_turn.c] */
+    LA_F670,  /* "Probing RTT of %d TURN servers" (%d)  [p2p_turn.c] */
+    LA_F671,  /* "[R] OOM for large frame (%u bytes)\n" (%u)  [p2p_signal_relay.c] */
+    LA_F672,  /* "tail loss probe seq=%u srtt=%d" (%u,%d)  [p2p_trans_reliable.c] */
+    LA_F673,  /* "%s: cand history net=%s/24 nat=%d tried=0x%x win=%s %u ms" (%s,%s,%d,%d,%s,%u)  [p2p_nat.c] */
+    LA_F674,  /* "candidate history unavailable, checks use fixed priority order"  [p2p.c] */
+    LA_F675,  /* "Started shared executor with %d threads" (%d)  [p2p_thread.c] */
+    LA_F676,  /* "shared executor not running, starting own thread"  [p2p_thread.c] */
+    LA_F677,  /* "worker_count/latency_mode/udp_iocp need own thread, not using shared executor"  [p2p_thread.c] */
+    LA_F678,  /* "%s: stale response ignored (sid=%u)\n" (%s,%u)  [p2p_rpc.c] */
+    LA_F679,  /* "%s: new request (sid=%u) overrides pending request (sid=%u)\n" (%s,%u,%u)  [p2p_rpc.c] */
+    LA_F680,  /* "%s: request accepted (sid=%u) msg=%u len=%d\n" (%s,%u,%u,%d)  [p2p_rpc.c] */
+    LA_F681,  /* "%s: ignored, punch already started (nat=%d)\n" (%s,%d)  [p2p_signal_compact.c] */
+    LA_F682,  /* "%s: punch in %u ms (ses_id=%u)\n" (%s,%u,%u)  [p2p_signal_compact.c] */
+    LA_F683,  /* "%s: identity '%s' online, auth_key=%llu\n" (%s,%s,%l)  [p2p_signal_compact.c] */
+    LA_F684,  /* "%s: peer shares public address, probing host candidates first" (%s)  [p2p_nat.c] */
+    LA_F685,  /* "%s: keepalive interval %u s advised by server\n" (%s,%u)  [p2p_signal_compact.c] */
+    LA_F686,  /* "ONLINE: gist list too long (%d > %d)" (%d,%d)  [p2p_signal_pubsub.c] */
+    LA_F687,  /* "ACK beyond send_seq ignored ack_seq=%u send_seq=%u" (%u,%u)  [p2p_trans_reliable.c] */
+    LA_F688,  /* "expired message dropped before send, len=%d" (%d)  [p2p_stream.c] */
+    LA_F689,  /* "expired message skipped by peer, %d bytes discarded" (%d)  [p2p_stream.c] */
+    LA_F690,  /* "expired message fragment seq=%u replaced by skip (%d bytes)" (%u,%d)  [p2p_trans_reliable.c] */
+    LA_F691,  /* "resume buffers alloc failed, %d packets dropped" (%d)  [p2p_trans_reliable.c] */
+    LA_F692,  /* "session reset, %d packets retained for resume" (%d)  [p2p_trans_reliable.c] */
+    LA_F693,  /* "resume token mismatch, %d retained packets dropped" (%d)  [p2p_trans_reliable.c] */
+    LA_F694,  /* "resume gap on stream %d: peer at %u, resending from %u" (%d,%u,%u)  [p2p_trans_reliable.c] */
+    LA_F695,  /* "session resumed, %d packets requeued" (%d)  [p2p_trans_reliable.c] */
+    LA_F696,  /* "lan: bad announce MAC from %s:%d" (%s,%d)  [p2p_lan.c] */
+    LA_F697,  /* "lan: peer '%s' seen at %s:%d (%d addrs)" (%s,%s,%d,%d)  [p2p_lan.c] */
+    LA_F698,  /* "lan: discovery on %s:%d" (%s,%d)  [p2p_lan.c] */
+    LA_F699,  /* "lan discovery unavailable(%d), LAN peers connect via signaling" (%d)  [p2p.c] */
+    LA_F700,  /* "%s sent, inst_id=%u, +SYNC0 remote='%.32s' cands=%d\n" (%s,%u,%s,%d)  [p2p_signal_compact.c] */
+    LA_F701,  /* "ONLINE: auth_key acquired, SYNC0 accepted with ONLINE\n"  [p2p_signal_compact.c] */
+    LA_F702,  /* "no CA bundle found, server certificate will not be verified"  [p2p_turn_tcp.c] */
+    LA_F703,  /* "TURN over TLS requires a WITH_DTLS build"  [p2p_turn_tcp.c] */
+    LA_F704,  /* "connect %s:%u failed(%d)" (%s,%u,%d)  [p2p_turn_tcp.c] */
+    LA_F705,  /* "TURN %s connecting to %s:%u" (%s,%s,%u)  [p2p_turn_tcp.c] */
+    LA_F706,  /* "TURN connection to %s:%u lost: %s" (%s,%u,%s)  [p2p_turn_tcp.c] */
+    LA_F707,  /* "TLS handshake with %s failed: -0x%04x" (%s,%d)  [p2p_turn_tcp.c] */
+    LA_F708,  /* "TURN tx backlog full, message dropped (%d bytes)" (%d)  [p2p_turn_tcp.c] */
+    LA_F709,  /* "load CA bundle %s failed" (%s)  [p2p_http.c] */
+    LA_F710,  /* "no CA bundle found, refusing unverified TLS (set tls_ca_file)"  [p2p_http.c] */
 
     LA_NUM
 };
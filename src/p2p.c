@@ -9,6 +9,12 @@
 #include "p2p_udp.h"
 #include "LANG.cn.h"
 
+#ifdef _WIN32
+#define poll WSAPoll
+#else
+#include <poll.h>
+#endif
+
 /* ---- 信令重发配置 ---- */
 #define SIGNAL_MAX_RESEND_COUNT             12     /* 最大重发次数 (共约60秒) */
 #define SIGNAL_RESEND_INTERVAL_MS           5000   /* 信令重发间隔 (5秒，relay/compact/等) */
@@ -16,6 +22,9 @@
 
 /* ---- 路径管理配置 ---- */
 #define PATH_RESELECT_INTERVAL_MS           5000   /* 路径重选间隔 (5秒检查一次是否有更优路径) */
+#define TRANS_TICK_INTERVAL_MS              10     /* 高级传输层（PseudoTCP/SCTP/DTLS）连接期间的 tick 间隔 */
+#define UPDATE_MAX_WAIT_MS                  50     /* 事件驱动线程无 I/O 时的默认最长等待 (update_interval_ms 缺省值) */
+#define SESSION_TICK_MAX_MS                 1000   /* 会话最长调度间隔：未显式唤醒的状态变化最迟在此时限内处理 */
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -30,6 +39,8 @@ p2p_log_level_t      p2p_log_level = P2P_LOG_LEVEL_INFO;
 #endif
 bool                 p2p_log_pre_tag = false;
 
+P2P_TLS uint64_t     p2p_clock_ms = 0;
+
 #ifndef NDEBUG
 uint16_t             p2p_instrument_base = 0;
 #endif
@@ -37,16 +48,34 @@ uint16_t             p2p_instrument_base = 0;
 ///////////////////////////////////////////////////////////////////////////////
 
 #ifdef P2P_THREADED
-#define LOCK(s)        do { if ((s)->inst->cfg.threaded) P_mutex_lock(&(s)->inst->mtx); } while(0)
-#define UNLOCK(s)      do { if ((s)->inst->cfg.threaded) P_mutex_unlock(&(s)->inst->mtx); } while(0)
-#define LOCK_INST(i)   do { if ((i)->cfg.threaded) P_mutex_lock(&(i)->mtx); } while(0)
-#define UNLOCK_INST(i) do { if ((i)->cfg.threaded) P_mutex_unlock(&(i)->mtx); } while(0)
+#define LOCK(s)        do { if ((s)->inst->cfg.threaded) session_lock(s); } while(0)
+#define UNLOCK(s)      do { if ((s)->inst->cfg.threaded) session_unlock(s); } while(0)
+#define LOCK_INST(i)   do { if ((i)->cfg.threaded) p2p_thread_lock_all(i); } while(0)
+#define UNLOCK_INST(i) do { if ((i)->cfg.threaded) p2p_thread_unlock_all(i); } while(0)
+
+/* 会话锁：所属分片锁 + 实例锁（按锁顺序获取） */
+static inline void session_lock(struct p2p_session *s) {
+    if (s->worker) P_mutex_lock(&s->worker->mtx);
+    P_mutex_lock(&s->inst->mtx);
+}
+
+static inline void session_unlock(struct p2p_session *s) {
+    P_mutex_unlock(&s->inst->mtx);
+    if (s->worker) P_mutex_unlock(&s->worker->mtx);
+}
 #else
 #define LOCK(s)        ((void)0)
 #define UNLOCK(s)      ((void)0)
 #define LOCK_INST(i)   ((void)0)
 #define UNLOCK_INST(i) ((void)0)
 #endif
+#define WAKEUP(s)      session_notify(s)
+
+#define WAIT_MAX_FDS    32      /* 非线程模式阻塞等待：参与 poll 的最大描述符数量 */
+
+#define SEND_DEFER_WAKE 0x100   /* 内部发送标志：只登记唤醒，由调用方统一通知线程（p2p_send_group） */
+
+#define SESSION_OF_TIMER(t) ((struct p2p_session*)((char*)(t) - offsetof(struct p2p_session, timer)))
 
 static inline void gather_local_candidates(struct p2p_session *s) {
 
@@ -64,7 +93,7 @@ static inline void gather_local_candidates(struct p2p_session *s) {
 
         if (inst->sock_cnt > 0 && inst->socks) {
 
-            const route_ctx_t *rt = route_shared_get(); int host_index = 0;
+            const route_ctx_t *rt = p2p_inst_route(inst); int host_index = 0;
 
             // socks[0] 绑定 INADDR_ANY：展开为路由表中的每个真实网卡地址
             // socks[1..N] 是多路 srflx 收集专用（随机端口），不作为 HOST 候选
@@ -85,6 +114,24 @@ static inline void gather_local_candidates(struct p2p_session *s) {
                 print("I:", LA_F("Gathered Host candidate: %s:%d (priority=0x%08x)", LA_F299, 299),
                         inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port), c->priority);
             }
+
+            // IPv6 Host：地址以别名形式进入候选表；全局地址通常无 NAT，即为对端可直达的地址
+            for (int r = 0; inst->sock6_port && r < rt->addr6_count; r++) {
+                struct sockaddr_in alias;
+                if (!p2p_udp_v6_alias(rt->local_addrs6[r], inst->sock6_port, &alias)) break;
+                int idx = p2p_cand_push_local(s);
+                if (idx < 0) return;
+
+                p2p_local_candidate_entry_t *c = &s->local_cands[idx];
+                c->type = P2P_CAND_HOST;
+                c->addr = alias;
+                c->priority = p2p_ice_calc_priority(P2P_ICE_CAND_HOST, (uint16_t)(65535 - host_index++), 1);
+
+                char ip6[INET6_ADDRSTRLEN];
+                inet_ntop(AF_INET6, rt->local_addrs6[r], ip6, sizeof(ip6));
+                print("I:", LA_F("Gathered Host candidate: [%s]:%d (priority=0x%08x)", LA_F523, 523),
+                      ip6, ntohs(alias.sin_port), c->priority);
+            }
         }
         else print("W:", LA_F("No shared local route addresses available, host candidates skipped", LA_F326, 326));
     }
@@ -128,13 +175,14 @@ static inline void gather_local_candidates(struct p2p_session *s) {
      *   2. 接收 Allocate Success 时，在 turn_handle_packet 中递减 turn_pending
      */
     if (!inst->cfg.test_ice_relay_off && inst->cfg.turn_server) {
-        if (inst->turn.state == TURN_ALLOCATED) {
+        for (int k = 0; k < TURN_MAX_ALLOCS; k++) {     // 多个分配时各自一个中继候选
+            if (inst->turn[k].state != TURN_ALLOCATED) continue;
 
             int idx = p2p_cand_push_local(s);
             if (idx >= 0) {
                 p2p_local_candidate_entry_t *c = &s->local_cands[idx];
                 c->type = P2P_CAND_RELAY;
-                c->addr = inst->turn.relay_addr;
+                c->addr = inst->turn[k].relay_addr;
                 c->priority = p2p_ice_calc_priority(P2P_ICE_CAND_RELAY, 65535, 1);
                 if (s->public_base < 0) s->public_base = idx;
                 print("I:", LA_F("Reuse Relay Candidate %s:%u (priority=%u)", LA_F365, 365),
@@ -145,18 +193,44 @@ static inline void gather_local_candidates(struct p2p_session *s) {
 
     /* ======================== 4. TCP 候选（可选） ======================== */
     /*
-     * RFC 6544 扩展了 ICE 以支持 TCP 候选。
-     * 目前仅预留接口，未完全实现。
+     * 不另行收集/交换 TCP 候选（非 RFC 6544 的 passive/active/so 模型）：
+     * 打洞阶段双方按已交换的 UDP 候选地址同时发起 connect，端口见 cfg.tcp_port，
+     * 连接建立后在 remote_cands 中登记 P2P_CAND_TCP 候选（见 p2p_tcp_punch.c）。
      */
-    if (inst->cfg.enable_tcp) {
-        for (int i = 0; i < s->local_cand_cnt; i++) {
-            if (s->local_cands[i].type == P2P_CAND_HOST) {
-                /* TODO: 建立 TCP 监听端口 */
-            }
-        }
+}
+
+/* 建连里程碑耗时（距 p2p_connect 的毫秒数，-1 = 未到达） */
+static void setup_ms(const struct p2p_session *s, int ms[P2P_SETUP_NUM]) {
+    for (int m = 0; m < P2P_SETUP_NUM; m++) {
+        uint64_t ts = s->setup_ts[m];
+        ms[m] = !ts ? -1 : ts > s->setup_start ? (int)(ts - s->setup_start) : 0;
     }
 }
 
+/* 首次进入 CONNECTED / RELAY：汇入实例的建连样本并触发 on_setup */
+static void setup_complete(struct p2p_session *s) {
+
+    struct p2p_instance *inst = s->inst;
+    s->setup_done = true;
+    p2p_setup_mark(s, P2P_SETUP_CONNECTED, p2p_now_ms());
+
+    int ms[P2P_SETUP_NUM];
+    setup_ms(s, ms);
+    memcpy(inst->setup_hist[inst->setup_hist_cnt % P2P_SETUP_HISTORY], ms, sizeof(ms));
+    __atomic_store_n(&inst->setup_hist_cnt, inst->setup_hist_cnt + 1, __ATOMIC_RELEASE);
+
+    print("I:", LA_F("Setup: gather=%d signaled=%d remote_cand=%d cands_done=%d punch=%d reach=%d connected=%d ms", LA_F608, 608),
+          ms[P2P_SETUP_GATHER], ms[P2P_SETUP_SIGNALED], ms[P2P_SETUP_REMOTE_CAND], ms[P2P_SETUP_CANDS_DONE],
+          ms[P2P_SETUP_PUNCH], ms[P2P_SETUP_REACH], ms[P2P_SETUP_CONNECTED]);
+    if (inst->cfg.on_setup && !s->standby) inst->cfg.on_setup((p2p_session_t)s, ms, inst->cfg.userdata);
+}
+
+void p2p_setup_gathered(struct p2p_instance *inst, uint64_t now_ms) {
+    inst->setup_gather_wait = 0;
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next)
+        p2p_setup_mark(s, P2P_SETUP_GATHER, now_ms);
+}
+
 /*
  * 统一状态转换 — 更新状态并触发回调
  *
@@ -172,11 +246,14 @@ static inline bool p2p_set_state(struct p2p_session *s, p2p_state_t new_state) {
     if (old_state == new_state) return false;
     
     s->state = new_state;
+    P2P_TRACE(s, P2P_TRACE_STATE, 0, 0, old_state, new_state, 0, 0, NULL);
     
-    // 触发状态回调
-    if (s->inst->cfg.on_state) {
+    // 触发状态回调（预热会话尚未交给应用）
+    if (s->inst->cfg.on_state && !s->standby) {
         s->inst->cfg.on_state((p2p_session_t)s, old_state, new_state, s->inst->cfg.userdata);
     }
+    if (!s->setup_done && (new_state == P2P_STATE_CONNECTED || new_state == P2P_STATE_RELAY))
+        setup_complete(s);
     
     return true;
 }
@@ -198,6 +275,9 @@ void p2p_connecting(struct p2p_session *s) {
 
     struct p2p_instance *inst = s->inst;
 
+    P2P_TRACE(s, P2P_TRACE_SIG, 0, 0, 0, 0, 0, 0, "punch_start");
+    p2p_setup_mark(s, P2P_SETUP_PUNCH, p2p_now_ms());
+
     // 递增连接计数
     if (inst->connections++ != 0) {
         return;  // 已有活跃 session，资源已分配
@@ -228,6 +308,25 @@ void p2p_connecting(struct p2p_session *s) {
  *   - NAT 模块收到 CONN/CONN_ACK/DATA 后进入 NAT_CONNECTED 状态
  *   - NAT 握手完成（双向 REACH 确认后收到 CONN_ACK）
  */
+/* 记录连通的直连路径，供下次 p2p_connect 0-RTT 重连（中继路径、端口预测套接字上的路径、IPv6 别名地址不缓存） */
+static void path_cache_save(struct p2p_session *s) {
+
+    if (!s->inst->path_cache || s->active_path < 0 || !s->remote_peer_id[0]) return;
+    if (s->path_type != P2P_PATH_LAN && s->path_type != P2P_PATH_PUNCH) return;
+
+    const p2p_remote_candidate_entry_t *c = &s->remote_cands[s->active_path];
+    if (c->sock || p2p_udp_v6_is_alias(&c->addr)) return;     // 别名仅在本进程内有效
+
+    p2p_path_hint_t hint = {
+        .remote_ip   = c->addr.sin_addr.s_addr,
+        .remote_port = c->addr.sin_port,
+        .local_port  = ntohs(s->inst->socks[0].local_addr.sin_port),
+        .path_type   = (uint8_t)s->path_type,
+        .stamp       = (uint64_t)time(NULL),
+    };
+    p2p_path_cache_put(s->inst, s->remote_peer_id, &hint);
+}
+
 void p2p_connected(struct p2p_session *s, uint64_t now_ms) {
     
     // 仅在 PUNCHING/REGISTERING/REGISTERED 状态下转换
@@ -235,6 +334,8 @@ void p2p_connected(struct p2p_session *s, uint64_t now_ms) {
     if (s->state < P2P_STATE_SIGNALING || s->state > P2P_STATE_PUNCHING) {
         return;
     }
+    P2P_TRACE(s, P2P_TRACE_SIG, 0, 0, 0, 0, 0, 0, "nat_connected");
+    p2p_setup_mark(s, P2P_SETUP_REACH, now_ms);       // 对端先进入 CONNECTING 时不经 bidirectional_confirmed
 
     // 选择最佳路径
     int best_path = path_manager_select_best_path(s);
@@ -255,7 +356,325 @@ void p2p_connected(struct p2p_session *s, uint64_t now_ms) {
     } else {
         print("I:", LA_F("State: → CONNECTED, path[%d]", LA_F396, 396), best_path);
         p2p_set_state(s, P2P_STATE_CONNECTED);
+        path_cache_save(s);
+        nat_hist_record(s, true, now_ms);
+    }
+}
+
+/* ============================================================================
+ * 会话索引
+ * ============================================================================
+ *
+ * multi_session 模式下每个收到的包都需要路由到会话，链表线性扫描在会话数较多时开销为 O(n)。
+ * 这里维护两个开放寻址哈希（线性探测，删除时后移保持探测链连续，负载因子 ≤ 1/2）：
+ *   - sess_by_id:   s->id → s，用于携带 P2P_FLAG_SESSION 的包和信令包
+ *   - sess_by_addr: s->index_addr（活跃路径地址）→ s，用于不携带 session_id 的包（如 DATA/ACK）
+ *     信令中转路径地址由多个会话共享，不登记
+ */
+
+#define SESS_INDEX_INIT_CAP     16
+
+static inline uint32_t sess_hash_u32(uint32_t x) {
+    x ^= x >> 16; x *= 0x7feb352dU;
+    x ^= x >> 15; x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static inline uint32_t sess_key_hash(const struct p2p_session *s, bool by_addr) {
+    if (!by_addr) return sess_hash_u32(s->id);
+    return sess_hash_u32(s->index_addr.sin_addr.s_addr ^ ((uint32_t)s->index_addr.sin_port << 16));
+}
+
+static inline uint32_t sess_addr_hash(const struct sockaddr_in *a) {
+    return sess_hash_u32(a->sin_addr.s_addr ^ ((uint32_t)a->sin_port << 16));
+}
+
+static void sess_index_insert(p2p_sess_index_t *ix, struct p2p_session *s, bool by_addr);
+
+static bool sess_index_grow(p2p_sess_index_t *ix, bool by_addr) {
+
+    int cap = ix->cap ? ix->cap * 2 : SESS_INDEX_INIT_CAP;
+    struct p2p_session **slots = (struct p2p_session **)p2p_calloc((size_t)cap, sizeof(*slots));
+    if (!slots) return false;
+
+    p2p_sess_index_t old = *ix;
+    ix->slots = slots; ix->cap = cap; ix->cnt = 0;
+    for (int i = 0; i < old.cap; i++) {
+        if (old.slots[i]) sess_index_insert(ix, old.slots[i], by_addr);
+    }
+    p2p_free(old.slots);
+    return true;
+}
+
+static void sess_index_insert(p2p_sess_index_t *ix, struct p2p_session *s, bool by_addr) {
+
+    if ((ix->cnt + 1) * 2 > ix->cap && !sess_index_grow(ix, by_addr)) return;
+
+    uint32_t mask = (uint32_t)ix->cap - 1;
+    uint32_t i = sess_key_hash(s, by_addr) & mask;
+    while (ix->slots[i]) {
+        if (ix->slots[i] == s) return;
+        i = (i + 1) & mask;
+    }
+    ix->slots[i] = s;
+    ix->cnt++;
+}
+
+static void sess_index_remove(p2p_sess_index_t *ix, struct p2p_session *s, bool by_addr) {
+
+    if (!ix->cnt) return;
+
+    uint32_t mask = (uint32_t)ix->cap - 1;
+    uint32_t i = sess_key_hash(s, by_addr) & mask;
+    while (ix->slots[i] != s) {
+        if (!ix->slots[i]) return;
+        i = (i + 1) & mask;
+    }
+
+    // 后移删除：把探测链上后续、且原始位置不在 (i, j] 区间内的项前移填补空洞
+    ix->slots[i] = NULL; ix->cnt--;
+    for (uint32_t j = (i + 1) & mask; ix->slots[j]; j = (j + 1) & mask) {
+        uint32_t home = sess_key_hash(ix->slots[j], by_addr) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            ix->slots[i] = ix->slots[j];
+            ix->slots[j] = NULL;
+            i = j;
+        }
+    }
+}
+
+void p2p_session_set_id(struct p2p_session *s, uint32_t id) {
+
+    if (s->id == id) return;
+
+    struct p2p_instance *inst = s->inst;
+    if (s->id) sess_index_remove(&inst->sess_by_id, s, false);
+    s->id = id;
+    if (id) sess_index_insert(&inst->sess_by_id, s, false);
+}
+
+void p2p_session_bind_addr(struct p2p_session *s, const struct sockaddr_in *addr) {
+
+    struct p2p_instance *inst = s->inst;
+
+    // 信令中转地址由多个会话共享，不作为派发依据
+    if (addr && (!addr->sin_port || sockaddr_equal(addr, &inst->signaling.addr))) addr = NULL;
+
+    if (s->index_addr.sin_port) {
+        if (addr && sockaddr_equal(addr, &s->index_addr)) return;
+        sess_index_remove(&inst->sess_by_addr, s, true);
+        memset(&s->index_addr, 0, sizeof(s->index_addr));
+    }
+    if (addr) {
+        s->index_addr = *addr;
+        sess_index_insert(&inst->sess_by_addr, s, true);
+    }
+}
+
+struct p2p_session* p2p_session_find(struct p2p_instance *inst, uint32_t id) {
+
+    p2p_sess_index_t *ix = &inst->sess_by_id;
+    if (!id || !ix->cnt) return NULL;
+
+    uint32_t mask = (uint32_t)ix->cap - 1;
+    for (uint32_t i = sess_hash_u32(id) & mask; ix->slots[i]; i = (i + 1) & mask) {
+        if (ix->slots[i]->id == id) return ix->slots[i];
+    }
+    return NULL;
+}
+
+struct p2p_session* p2p_session_find_by_addr(struct p2p_instance *inst, const struct sockaddr_in *addr) {
+
+    p2p_sess_index_t *ix = &inst->sess_by_addr;
+    if (!ix->cnt) return NULL;
+
+    uint32_t mask = (uint32_t)ix->cap - 1;
+    for (uint32_t i = sess_addr_hash(addr) & mask; ix->slots[i]; i = (i + 1) & mask) {
+        if (sockaddr_equal(&ix->slots[i]->index_addr, addr)) return ix->slots[i];
+    }
+    return NULL;
+}
+
+/*
+ * 会话调度
+ * + 工作线程内的状态变化（收包、打洞开始、信令推进）调用 p2p_session_wake，挂到所属时间轮当前时刻
+ * + 应用侧接口（p2p_send 等）不持实例锁，经无锁栈 wake_list 转交，驱动该会话的线程每轮开头取出
+ */
+void p2p_session_wake(struct p2p_session *s) {
+    if (s->timer.slot == TIMER_SLOT_DUE) return;
+    p2p_timer_add(p2p_session_wheel(s), &s->timer, 0);
+#ifdef P2P_THREADED
+    // 主线程控制阶段或应用接口推进分片会话：通知分片线程重新计算等待时间
+    if (s->worker && s->worker != p2p_worker_self) p2p_worker_wakeup(s->worker);
+#endif
+}
+
+/* 登记到驱动该会话的线程的唤醒栈（不通知线程；扇出发送批量登记后每个线程只通知一次） */
+static void session_wake_mark(struct p2p_session *s) {
+    struct p2p_session **list = &s->inst->wake_list;
+#ifdef P2P_THREADED
+    if (s->worker) list = &s->worker->wake_list;
+#endif
+#if defined(_MSC_VER)
+    if (!_InterlockedExchange((volatile long*)&s->wake_req, 1)) {
+        void *head;
+        do { head = *list; s->wake_next = (struct p2p_session*)head; }
+        while (_InterlockedCompareExchangePointer((void* volatile*)list, s, head) != head);
+    }
+#else
+    if (!__atomic_exchange_n(&s->wake_req, 1, __ATOMIC_ACQ_REL)) {
+        struct p2p_session *head = __atomic_load_n(list, __ATOMIC_RELAXED);
+        do { s->wake_next = head; }
+        while (!__atomic_compare_exchange_n(list, &head, s, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+#endif
+}
+
+static void session_notify(struct p2p_session *s) {
+    session_wake_mark(s);
+#ifdef P2P_THREADED
+    if (s->worker) p2p_worker_wakeup(s->worker);
+    else if (s->inst->cfg.threaded) p2p_thread_wakeup(s->inst);
+#endif
+}
+
+/* 取出应用侧唤醒的全部会话（驱动这些会话的线程，持相应的锁） */
+static void session_drain_wakes(struct p2p_session **list) {
+#if defined(_MSC_VER)
+    struct p2p_session *s = (struct p2p_session*)_InterlockedExchangePointer((void* volatile*)list, NULL);
+#else
+    struct p2p_session *s = __atomic_exchange_n(list, NULL, __ATOMIC_ACQUIRE);
+#endif
+    while (s) {
+        struct p2p_session *next = s->wake_next;
+        RING_STORE_REL(&s->wake_req, 0);
+        p2p_session_wake(s);
+        s = next;
+    }
+}
+
+/* 唤醒栈非空（等待前检查，避免遗漏已压入的唤醒） */
+static inline bool session_wakes_pending(struct p2p_session **list) {
+#if defined(_MSC_VER)
+    return *(void* volatile*)list != NULL;
+#else
+    return __atomic_load_n(list, __ATOMIC_ACQUIRE) != NULL;
+#endif
+}
+
+/* 会话释放前移出所有索引 */
+static void session_unindex(struct p2p_session *s) {
+    p2p_overlay_unlink(s);
+    bulk_unlink(s);
+    p2p_session_set_id(s, 0);
+    p2p_session_bind_addr(s, NULL);
+}
+
+/* 分配会话的全部流（0 号流内嵌于会话，其余按 cfg.stream_count 追加） */
+static ret_t session_streams_init(struct p2p_session *s) {
+    const p2p_config_t *cfg = &s->inst->cfg;
+    int cnt = cfg->stream_count > 1 ? cfg->stream_count : 1;
+    int nagle_delay = P2P_SOPT(s, P2P_SOPT_NAGLE, nagle_delay_ms);
+    if (cnt > P2P_MAX_STREAMS) cnt = P2P_MAX_STREAMS;
+
+    if (cnt > 1 && !(s->xstreams = (stream_t*)p2p_arena_calloc(s->inst->arena, cnt - 1, sizeof(stream_t)))) return E_OUT_OF_MEMORY;
+    if (cnt > 1) p2p_mem_add(&s->mem, P2P_MEM_STREAM, (int64_t)(cnt - 1) * sizeof(stream_t));
+    s->stream_cnt = cnt;
+    s->file_tx.fd = s->file_rx.fd = -1;
+    s->resume.token = P_rand32() | 1;   // 续传令牌：标识本会话对象的字节流（非 0）
+
+    for (int i = 0; i < cnt; i++) {
+        stream_t *st = stream_get(s, i);
+        if (stream_init_in(st, s->inst->arena, &s->mem, P2P_SOPT(s, P2P_SOPT_NAGLE, nagle),
+                           P2P_SOPT(s, P2P_SOPT_BUFFERS, send_buf_size), P2P_SOPT(s, P2P_SOPT_BUFFERS, recv_buf_size),
+                           P2P_SOPT(s, P2P_SOPT_BUFFERS, buf_max_size)) != E_NONE)
+            return E_OUT_OF_MEMORY;
+        st->sid = i;
+        if (nagle_delay > 0) st->nagle_delay = nagle_delay;
+        st->msg_mode = cfg->message_mode;
+    }
+    return E_NONE;
+}
+
+/* 关闭应用侧阻塞等待的唤醒描述符 */
+static void session_waiters_close(struct p2p_session *s) {
+#ifdef P2P_THREADED
+    for (int i = 0; i < P2P_WAIT_KINDS; i++) p2p_waiter_close(&s->waiters[i]);
+#else
+    (void)s;
+#endif
+}
+
+static void session_streams_free(struct p2p_session *s) {
+    if (s->hibernated) __atomic_sub_fetch(&s->inst->hibernated, 1, __ATOMIC_RELAXED);
+    s->hibernated = false;
+    for (int i = 0; i < s->stream_cnt; i++) stream_free(stream_get(s, i));
+    if (!s->stream_cnt) stream_free(&s->stream);
+    if (s->xstreams) p2p_mem_add(&s->mem, P2P_MEM_STREAM, -(int64_t)((s->stream_cnt - 1) * sizeof(stream_t)));
+    p2p_arena_free(s->inst->arena, s->xstreams);
+    s->xstreams = NULL;
+    s->stream_cnt = 0;
+}
+
+/*
+ * 空闲休眠（cfg.hibernate_ms）
+ *
+ * 已连接会话持续 hibernate_ms 没有数据收发，且各流缓冲区、reliable 窗口均为空时，
+ * 释放流收发缓冲区与 reliable 槽位数组，只保留 NAT 保活、路径与序列号状态；
+ * 应用侧写入、开始文件发送或收到数据面包时由 p2p_session_thaw 按原容量重新分配。
+ *
+ * 休眠与恢复都在会话锁内进行。应用侧写入 send_ring 不持锁，因此与工作线程以
+ * hib_hold / hibernated 顺序一致地交叉读写：工作线程置位 hibernated 后看到 hib_hold 非 0 即放弃，
+ * 应用侧递增 hib_hold 后看到 hibernated 即持锁恢复，两端不会同时通过。
+ * 读取端无需处理：休眠的环形缓冲区容量为 0，ring_used 恒为 0，不会访问 data
+ */
+static bool session_drained(const struct p2p_session *s) {
+    if (!reliable_drained(s) || s->file_tx.fd >= 0 || s->file_rx.fd >= 0 || s->bulk.b) return false;
+    for (int i = 0; i < s->stream_cnt; i++) {
+        if (!stream_drained(stream_get((struct p2p_session*)s, i))) return false;
+    }
+    return true;
+}
+
+void p2p_session_hibernate(struct p2p_session *s, uint64_t now_ms) {
+
+    int idle_ms = s->inst->cfg.hibernate_ms;
+    if (idle_ms <= 0 || s->hibernated || s->trans) return;
+    if (s->state != P2P_STATE_CONNECTED && s->state != P2P_STATE_RELAY) return;
+
+    if (!s->data_ts || !session_drained(s)) { s->data_ts = now_ms; return; }
+    if (tick_diff(now_ms, s->data_ts) < (uint64_t)idle_ms) return;
+
+    // 置位后再确认没有进行中的应用侧写入；此前完成的写入此时必然可见，需重新检查缓冲区
+    __atomic_store_n(&s->hibernated, true, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->hib_hold, __ATOMIC_SEQ_CST) || !session_drained(s)) {
+        __atomic_store_n(&s->hibernated, false, __ATOMIC_SEQ_CST);
+        s->data_ts = now_ms;
+        return;
     }
+
+    for (int i = 0; i < s->stream_cnt; i++) stream_hibernate(stream_get(s, i));
+    reliable_hibernate(s);
+    __atomic_add_fetch(&s->inst->hibernated, 1, __ATOMIC_RELAXED);
+    print("V:", LA_F("%s: idle %d ms, session buffers released", LA_F610, 610), MOD_TAG, (int)tick_diff(now_ms, s->data_ts));
+}
+
+ret_t p2p_session_thaw(struct p2p_session *s, uint64_t now) {
+
+    s->data_ts = now;
+    if (!s->hibernated) return E_NONE;
+
+    // 部分分配失败时已恢复的缓冲区保留（thaw 可重入），仍保持休眠，下次重试
+    for (int i = 0; i < s->stream_cnt; i++) {
+        if (stream_thaw(stream_get(s, i)) != E_NONE) return E_OUT_OF_MEMORY;
+    }
+    if (reliable_thaw(s) != E_NONE) return E_OUT_OF_MEMORY;
+
+    __atomic_store_n(&s->hibernated, false, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&s->inst->hibernated, 1, __ATOMIC_RELAXED);
+    print("V:", LA_F("%s: session buffers restored", LA_F611, 611), MOD_TAG);
+    return E_NONE;
 }
 
 /*
@@ -266,6 +685,10 @@ void p2p_connected(struct p2p_session *s, uint64_t now_ms) {
  */
 static void session_deactivate(struct p2p_instance *inst) {
 
+    // 端口预测套接字只服务于打洞中的 session
+    nat_predict_close(inst);
+    nat_bind_probe_close(inst);
+
     // STUN: 标记映射地址失效，下次激活时重新收集
     // NAT 类型检测结果保留（nat_type 是环境属性，不随 session 改变）
     for (int i = 0; i < inst->sock_cnt; i++) {
@@ -302,8 +725,10 @@ static void disconnect(struct p2p_session *s) {
 
     p2p_session_reset(s, true);  // 这会设置 s->state = P2P_STATE_CLOSED
 
+    P2P_TRACE(s, P2P_TRACE_STATE, 0, 0, old_state, P2P_STATE_CLOSED, 0, 0, NULL);
+
     // 触发回调
-    if (old_state >= P2P_STATE_LOST) {
+    if (old_state >= P2P_STATE_LOST && !s->standby) {
         if (s->inst->cfg.on_state) s->inst->cfg.on_state((p2p_session_t)s, old_state, P2P_STATE_CLOSED, s->inst->cfg.userdata);
     }
 
@@ -317,6 +742,11 @@ static void disconnect(struct p2p_session *s) {
 
         p2p_signal_relay_disconnect(s);
     }
+    // PUBSUB 信令模式：取消排队中的 Gist 请求并清除会话
+    else if (s->inst->sig_mode == P2P_SIGNALING_MODE_PUBSUB) {
+
+        p2p_signal_pubsub_disconnect(s);
+    }
 
     // 递减连接计数，归零时释放 STUN 资源
     if (--s->inst->connections == 0) {
@@ -350,7 +780,8 @@ static void peer_disconnect(struct p2p_session *s) {
     }
 
     // 触发状态回调
-    if (s->inst->cfg.on_state) s->inst->cfg.on_state((p2p_session_t)s, old_state, P2P_STATE_CLOSED, s->inst->cfg.userdata);
+    P2P_TRACE(s, P2P_TRACE_STATE, 0, 0, old_state, P2P_STATE_CLOSED, 0, 0, NULL);
+    if (s->inst->cfg.on_state && !s->standby) s->inst->cfg.on_state((p2p_session_t)s, old_state, P2P_STATE_CLOSED, s->inst->cfg.userdata);
 
     // 递减连接计数，归零时释放 STUN 资源
     if (--s->inst->connections == 0) {
@@ -360,6 +791,155 @@ static void peer_disconnect(struct p2p_session *s) {
 
 ///////////////////////////////////////////////////////////////////////////////
 
+/*
+ * COMPACT / RELAY 信令服务器地址异步解析，就绪后上线
+ * + p2p_create 首次调用（数值地址与缓存命中立即上线），之后由 update_control_send 轮询
+ * + 解析期间实例保持 REG：p2p_connect 登记的对端在上线后自动发起同步（见 *_connect 的 WAIT_ONLINE）
+ */
+static void sig_online(struct p2p_instance *inst) {
+
+    struct sockaddr_in server_addr;
+    int r = p2p_dns_resolve(inst->cfg.server_host, inst->cfg.server_port, &server_addr);
+    if (r == 0) return;
+    inst->sig_resolving = false;
+
+    ret_t ret;
+    if (inst->sig_mode == P2P_SIGNALING_MODE_COMPACT) {
+        if (r < 0) {
+            print("E:", LA_F("Resolve COMPACT signaling server address: %s:%d failed(%d)", LA_F364, 364),
+                  inst->cfg.server_host, inst->cfg.server_port, r);
+            inst->state = P2P_SIG_ST_ERROR;
+        }
+        else if ((ret = p2p_signal_compact_online(inst, inst->local_peer_id, &server_addr)) != E_NONE) {
+            print("E:", LA_F("Connect to COMPACT signaling server failed(%d)", LA_F269, 269), ret);
+            inst->state = P2P_SIG_ST_ERROR;
+        }
+    }
+    else {
+        if (r < 0) {
+            print("E:", LA_F("Resolve RELAY signaling server address: %s:%d failed(%d)", LA_F614, 614),
+                  inst->cfg.server_host, inst->cfg.server_port, r);
+            inst->state = P2P_SIG_ST_ERROR;
+        }
+        else if ((ret = p2p_signal_relay_online(inst, inst->local_peer_id, &server_addr)) != E_NONE) {
+            print("E:", LA_F("Connect to RELAY signaling server failed(%d)", LA_F270, 270), ret);
+            inst->state = P2P_SIG_ST_ERROR;
+        }
+    }
+}
+
+/*
+ * ============================================================================
+ * 本机地址变化（route_shared_poll：netlink / PF_ROUTE / NotifyAddrChange）
+ * ============================================================================
+ *
+ * 每轮 update 由 update_control_send 调用 p2p_route_refresh：
+ *   + 检测到变化的实例作废进程内共享的 NAT 结果与解析缓存；其余实例按地址集合代次各自处理一次
+ *   + 套接字与 Srflx 重整见 p2p_stun_route_changed
+ *   + 新地址作为 Host 候选追加到各会话并立即 Trickle；已消失的 Host 候选只有 COMPACT 能以增量 DEL 撤回
+ *     （撤回的候选 priority 置 0，地址恢复后重新 ADD），其他信令由连通性检查自然淘汰
+ */
+
+/* 追加的本地候选按信令模式增量同步给对端（首批候选尚未发送时随首批发送，各 trickle 接口自行判断） */
+static void host_trickle(struct p2p_session *s, const p2p_local_candidate_entry_t *c) {
+
+    struct p2p_instance *inst = s->inst;
+    if (inst->sig_mode == P2P_SIGNALING_MODE_COMPACT) {
+        if (inst->sig_ctx.compact.state == SIG_COMPACT_ONLINE) p2p_signal_compact_trickle_candidate(s);
+    }
+    else if (inst->sig_mode == P2P_SIGNALING_MODE_RELAY) {
+        if (inst->sig_ctx.relay.state == SIG_RELAY_ONLINE) p2p_signal_relay_trickle_candidate(s);
+    }
+    else if (inst->sig_mode == P2P_SIGNALING_MODE_PUBSUB) {
+        p2p_signal_pubsub_trickle_candidate(s);
+    }
+    else if (inst->sig_mode == P2P_SIGNALING_MODE_ICE && inst->cfg.on_ice_candidate) {
+        char sdp_a[256];
+        if (p2p_ice_export_candidate(c, sdp_a, sizeof(sdp_a)) > 0)
+            inst->cfg.on_ice_candidate((p2p_session_t)s, sdp_a, inst->cfg.userdata);
+    }
+}
+
+/* Host 候选地址是否仍属于本机（IPv6 Host 以别名地址比较） */
+static bool host_alive(const struct p2p_instance *inst, const route_ctx_t *rt, const struct sockaddr_in *a) {
+    for (int r = 0; r < rt->addr_count; r++)
+        if (rt->local_addrs[r].sin_addr.s_addr == a->sin_addr.s_addr) return true;
+    for (int r = 0; inst->sock6_port && r < rt->addr6_count; r++) {
+        struct sockaddr_in alias;
+        if (p2p_udp_v6_alias(rt->local_addrs6[r], inst->sock6_port, &alias) && sockaddr_equal(&alias, a)) return true;
+    }
+    return false;
+}
+
+/* 追加（或恢复已撤回的）Host 候选并 Trickle */
+static void host_add(struct p2p_session *s, const struct sockaddr_in *addr, int *host_index) {
+
+    p2p_local_candidate_entry_t *c;
+    int idx = p2p_cand_find_local(s, P2P_CAND_HOST, addr);
+    if (idx >= 0) {
+        c = &s->local_cands[idx];
+        if (c->priority) return;                    // 仍有效；priority 为 0 仅见于 COMPACT 撤回的候选
+        c->priority = p2p_ice_calc_priority(P2P_ICE_CAND_HOST, (uint16_t)(65535 - (*host_index)++), 1);
+        p2p_signal_compact_delta_candidate(s, c, false);
+        return;
+    }
+
+    if ((idx = p2p_cand_push_local(s)) < 0) return;
+    c = &s->local_cands[idx];
+    memset(c, 0, sizeof(*c));
+    c->type = P2P_CAND_HOST;
+    c->addr = *addr;
+    c->priority = p2p_ice_calc_priority(P2P_ICE_CAND_HOST, (uint16_t)(65535 - (*host_index)++), 1);
+    print("I:", LA_F("Gathered Host candidate: %s:%d (priority=0x%08x)", LA_F299, 299),
+          inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port), c->priority);
+    host_trickle(s, c);
+}
+
+void p2p_route_refresh(struct p2p_instance *inst, uint64_t now_ms) {
+
+    if (route_shared_poll(now_ms)) {
+        p2p_stun_shared_invalidate();
+        p2p_dns_flush();
+    }
+
+    uint32_t gen = route_shared_gen();
+    if (gen == inst->route_gen) return;
+    inst->route_gen = gen;
+
+    const route_ctx_t *rt = p2p_inst_route(inst);
+    if (!rt || !inst->socks) return;
+    print("I:", LA_F("Local addresses changed: %d address(es), re-gathering candidates", LA_F617, 617), rt->addr_count);
+
+    p2p_stun_route_changed(inst);
+    if (inst->cfg.test_ice_host_off) return;
+
+    uint16_t port = inst->socks[0].local_addr.sin_port;
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
+
+        if (s->state == P2P_STATE_CLOSED) continue;
+
+        int host_index = 0;
+        for (int i = 0; i < s->local_cand_cnt; i++) {
+            p2p_local_candidate_entry_t *c = &s->local_cands[i];
+            if (c->type != P2P_CAND_HOST) continue;
+            if (host_alive(inst, rt, &c->addr)) { host_index++; continue; }
+            if (inst->sig_mode != P2P_SIGNALING_MODE_COMPACT || !c->priority) continue;
+            p2p_signal_compact_delta_candidate(s, c, true);
+            c->priority = 0;
+        }
+
+        for (int r = 0; r < rt->addr_count; r++) {
+            struct sockaddr_in a = rt->local_addrs[r];
+            a.sin_port = port;
+            host_add(s, &a, &host_index);
+        }
+        for (int r = 0; inst->sock6_port && r < rt->addr6_count; r++) {
+            struct sockaddr_in alias;
+            if (p2p_udp_v6_alias(rt->local_addrs6[r], inst->sock6_port, &alias)) host_add(s, &alias, &host_index);
+        }
+    }
+}
+
 p2p_handle_t
 p2p_create(const char *local_peer_id, const p2p_config_t *cfg) {
 
@@ -387,8 +967,8 @@ p2p_create(const char *local_peer_id, const p2p_config_t *cfg) {
     }
 
     if (cfg->signaling_mode == P2P_SIGNALING_MODE_PUBSUB) {
-        if (!cfg->gh_token || !cfg->gist_id) {
-            print("E:", LA_F("PUBSUB mode requires gh_token and gist_id", LA_F336, 336));
+        if (!(cfg->server_host && cfg->server_host[0]) && (!cfg->gh_token || !cfg->gist_id)) {
+            print("E:", LA_F("PUBSUB mode requires gh_token and gist_id, or server_host for WebSocket push", LA_F571, 571));
             return NULL;
         }
     }
@@ -403,18 +983,27 @@ p2p_create(const char *local_peer_id, const p2p_config_t *cfg) {
     }
 
     // 分配实例结构
-    struct p2p_instance *inst = (struct p2p_instance*)calloc(1, sizeof(*inst));
+    struct p2p_instance *inst = (struct p2p_instance*)p2p_calloc(1, sizeof(*inst));
     if (!inst) {
         print("E:", LA_F("Failed to allocate memory for instance", LA_F282, 282));
         return NULL;
     }
+    if (cfg->mem_arena && !(inst->arena = p2p_arena_create())) {
+        print("E:", LA_F("Failed to allocate memory for instance", LA_F282, 282));
+        p2p_free(inst);
+        return NULL;
+    }
+    inst->rel_pool.mem = &inst->mem;
 
     // 初始化信令上下文（实例级别，只初始化不注册）
     print("I:", LA_F("Initialize signaling mode: %d", LA_F312, 312), (int)cfg->signaling_mode);
     if (cfg->signaling_mode == P2P_SIGNALING_MODE_COMPACT)
         p2p_signal_compact_init(&inst->sig_ctx.compact);
-    else if (cfg->signaling_mode == P2P_SIGNALING_MODE_RELAY)
+    else if (cfg->signaling_mode == P2P_SIGNALING_MODE_RELAY) {
         p2p_signal_relay_init(&inst->sig_ctx.relay);
+        inst->sig_ctx.relay.arena = inst->arena;
+        inst->sig_ctx.relay.mem = &inst->mem;
+    }
     else if (cfg->signaling_mode == P2P_SIGNALING_MODE_PUBSUB) {
         p2p_signal_pubsub_init(&inst->sig_ctx.pubsub);
     }
@@ -422,17 +1011,19 @@ p2p_create(const char *local_peer_id, const p2p_config_t *cfg) {
     // 初始化共享路由层
     if ((ret = route_shared_acquire()) < 0) {
         print("E:", LA_F("Detect local network interfaces failed(%d)", LA_F275, 275), ret);
-        free(inst);
+        p2p_arena_destroy(inst->arena);
+        p2p_free(inst);
         return NULL;
     }
+    inst->route_gen = route_shared_gen();
 
     // 创建 UDP 套接字
     print("I:", LA_F("Open P2P UDP socket on port %d", LA_F330, 330), cfg->bind_port);    
     do {
-        const route_ctx_t *rt = route_shared_get(); assert(rt);
+        const route_ctx_t *rt = p2p_inst_route(inst); assert(rt);
 
-        int cap = 1 + rt->addr_count;
-        inst->socks = (p2p_sock_t *)calloc((size_t)cap, sizeof(p2p_sock_t));
+        int cap = 1 + rt->addr_count + NAT_PREDICT_SOCKS + 1;   // 末尾预留端口预测套接字、绑定存活期探测套接字
+        inst->socks = (p2p_sock_t *)p2p_calloc((size_t)cap, sizeof(p2p_sock_t));
         if (!inst->socks) {
             ret = E_OUT_OF_MEMORY;
             break;
@@ -452,50 +1043,96 @@ p2p_create(const char *local_peer_id, const p2p_config_t *cfg) {
                 p2p_udp_open(inst, &rt->local_addrs[i], 0);
             }
         }
+
+        // IPv6 双栈：无可用 IPv6 地址或打开失败时仅告警，不影响 IPv4
+        if (cfg->enable_ipv6 && rt->addr6_count > 0) {
+            ret_t r6 = p2p_udp_open6(inst, ntohs(inst->socks[0].local_addr.sin_port));
+            if (r6 != E_NONE) print("W:", LA_F("Open IPv6 UDP socket failed(%d), IPv6 candidates disabled", LA_F524, 524), r6);
+            else print("I:", LA_F("Open IPv6 UDP socket on port %d", LA_F525, 525), ntohs(inst->sock6_port));
+        }
     } while (0);
     if (ret != E_NONE) {
         print("E:", LA_F("Open P2P UDP socket on port %d failed(%d)", LA_F331, 331), cfg->bind_port, ret);
         p2p_udp_close_all(inst);
         route_shared_release();
-        free(inst);
+        p2p_arena_destroy(inst->arena);
+        p2p_free(inst);
         return NULL;
     }
 
+    // 网络损伤模拟（测试用，见 p2p_netem.h）：格式错误时忽略
+    const char *netem = getenv("P2P_NETEM");
+    if (netem && *netem) p2p_netem_config(inst, netem);
+
     // 配置
     inst->cfg = *cfg;
-    if (inst->cfg.update_interval_ms <= 0) inst->cfg.update_interval_ms = 10;
+    if (inst->cfg.update_interval_ms <= 0) inst->cfg.update_interval_ms = UPDATE_MAX_WAIT_MS;
+    if (inst->cfg.recv_batch <= 0) inst->cfg.recv_batch = P2P_UDP_BATCH_BUDGET;
+    if (inst->cfg.recv_budget_us == 0) inst->cfg.recv_budget_us = P2P_UDP_TIME_BUDGET_US;
+    inst->lp_active_ms = P_tick_ms();
+    if (!inst->cfg.threaded || inst->cfg.worker_count < 1) inst->cfg.worker_count = 1;
+    if (inst->cfg.worker_count > P2P_MAX_WORKERS) inst->cfg.worker_count = P2P_MAX_WORKERS;
+    if (!inst->cfg.threaded || inst->cfg.crypto_workers < 0) inst->cfg.crypto_workers = 0;
+    if (inst->cfg.crypto_workers > P2P_MAX_CRYPTO_WORKERS) inst->cfg.crypto_workers = P2P_MAX_CRYPTO_WORKERS;
     if (inst->cfg.signaling_mode == P2P_SIGNALING_MODE_ICE) inst->cfg.use_ice = true;
+    if (inst->cfg.ice_lite && (inst->cfg.stun_server || inst->cfg.turn_server)) {
+        // ICE-lite 部署在公网 IP 上，只通告 host 候选：不收集 srflx/relay，也不做 NAT 类型检测
+        print("I:", LA_F("ICE-lite: skip srflx/relay gathering", LA_F510, 510));
+        inst->cfg.stun_server = NULL;
+        inst->cfg.turn_server = NULL;
+    }
 
     // 本端身份标识
     strncpy(inst->local_peer_id, local_peer_id, P2P_PEER_ID_MAX - 1);
 
+    // 信令服务器为集群节点列表（"host:port,host:port,..."）时选定一个节点
+    // + COMPACT：按 local_peer_id 选择所属节点（与服务器 --cluster 同一规则，跨节点配对由服务器间转发）
+    // + RELAY：配对需双方在同一节点，固定使用首个节点
+    if ((cfg->signaling_mode == P2P_SIGNALING_MODE_COMPACT || cfg->signaling_mode == P2P_SIGNALING_MODE_RELAY)
+        && strchr(cfg->server_host, ',')) {
+        size_t len = strcspn(cfg->server_host, ",");
+        int off = cfg->signaling_mode == P2P_SIGNALING_MODE_COMPACT
+                ? p2p_cluster_pick(cfg->server_host, inst->local_peer_id, P2P_PEER_ID_MAX, &len) : 0;
+        if (off >= 0 && len < sizeof(inst->server_node)) {
+            memcpy(inst->server_node, cfg->server_host + off, len);
+            inst->server_node[len] = '\0';
+            char *colon = strrchr(inst->server_node, ':');
+            if (colon) { inst->cfg.server_port = (uint16_t)atoi(colon + 1); *colon = '\0'; }
+            inst->cfg.server_host = inst->server_node;
+            print("I:", LA_F("Cluster node selected: %s:%d", LA_F573, 573), inst->cfg.server_host, inst->cfg.server_port);
+        }
+    }
+
     inst->state = P2P_SIG_ST_INIT;
-    inst->tcp_sock = P_INVALID_SOCKET;
+    p2p_timer_wheel_init(&inst->timers, P_tick_ms());
     inst->sig_mode = cfg->signaling_mode;
 
-    p2p_turn_init(&inst->turn);
+    for (int i = 0; i < TURN_MAX_ALLOCS; i++) p2p_turn_init(&inst->turn[i]);
 
     // NAT 类型初始化
     inst->nat_type = P2P_NAT_UNKNOWN;
-    if (cfg->stun_server) {
+    if (inst->cfg.stun_server) {
 
         // 初始化 STUN 上下文（预解析服务器地址）
-        if (p2p_stun_init(&inst->stun_ctx, cfg->stun_server, cfg->stun_port) &&
+        if (p2p_stun_init(&inst->stun_ctx, cfg->stun_server, cfg->stun_port, cfg->stun_servers) &&
             !cfg->test_ice_srflx_off) {
             inst->srflx_count = (uint16_t)inst->sock_cnt;
             if (inst->sig_mode == P2P_SIGNALING_MODE_COMPACT) --inst->srflx_count;
         }
 
         // 启动 STUN NAT 类型检测（并默认作为 Srflx 候选收集）
-        // 注：如果检测完成时 connections==0，nat_detect_done 会将 sock.state 重置为 1（bound）
         p2p_stun_nat_detect_start(inst, inst->sig_mode != P2P_SIGNALING_MODE_COMPACT && !cfg->test_ice_srflx_off);
 
+        // 预收集其余套接字的 Srflx（与 NAT 检测、TURN 分配、信令上线并行）：
+        // 首个 session 创建时新鲜的映射直接作为候选，无需等待 STUN（见 p2p_stun_srflx_refresh）
+        if (inst->srflx_active < inst->srflx_count) p2p_stun_collect(inst);
+
     } else if (inst->sig_mode != P2P_SIGNALING_MODE_COMPACT) {
         inst->nat_type = P2P_NAT_UNDETECTABLE;
     }
 
     // TURN 分配（实例级资源，与 session 无关）
-    if (!cfg->test_ice_relay_off && cfg->turn_server) {
+    if (!cfg->test_ice_relay_off && inst->cfg.turn_server) {
         if (p2p_turn_allocate(inst) == 0) {
             print("I:", LA_F("Requested Relay Candidate from TURN %s", LA_F363, 363), cfg->turn_server);
         }
@@ -508,43 +1145,24 @@ p2p_create(const char *local_peer_id, const p2p_config_t *cfg) {
 
         print("I:", LA_F("REG to COMPACT signaling server at %s:%d", LA_F319, 319),
               inst->cfg.server_host, inst->cfg.server_port);
-
-        do {
-            struct sockaddr_in server_addr;
-            if ((ret = resolve_host(inst->cfg.server_host, inst->cfg.server_port, &server_addr)) != E_NONE) {
-                print("E:", LA_F("Resolve COMPACT signaling server address: %s:%d failed(%d)", LA_F364, 364),
-                              inst->cfg.server_host, inst->cfg.server_port, ret);
-                inst->state = P2P_SIG_ST_ERROR;
-                break;
-            }
-            if ((ret = p2p_signal_compact_online(inst, inst->local_peer_id, &server_addr)) != E_NONE) {
-                print("E:", LA_F("Connect to COMPACT signaling server failed(%d)", LA_F269, 269), ret);
-                inst->state = P2P_SIG_ST_ERROR;
-                break;
-            }
-            inst->state = P2P_SIG_ST_REG;
-        } while (0);
+        inst->state = P2P_SIG_ST_REG;
+        inst->sig_resolving = true;
+        sig_online(inst);
     }
     else if (inst->sig_mode == P2P_SIGNALING_MODE_RELAY) {
 
         print("I:", LA_F("REG to RELAY signaling server at %s:%d", LA_F320, 320),
               inst->cfg.server_host, inst->cfg.server_port);
-
-        struct sockaddr_in server_addr;
-        memset(&server_addr, 0, sizeof(server_addr));
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(inst->cfg.server_port);
-        inet_pton(AF_INET, inst->cfg.server_host, &server_addr.sin_addr);
-
-        if ((ret = p2p_signal_relay_online(inst, inst->local_peer_id, &server_addr)) != E_NONE) {
-            print("E:", LA_F("Connect to RELAY signaling server failed(%d)", LA_F270, 270), ret);
-            inst->state = P2P_SIG_ST_ERROR;
-        }
-        else inst->state = P2P_SIG_ST_REG;
+        inst->state = P2P_SIG_ST_REG;
+        inst->sig_resolving = true;
+        sig_online(inst);
     }
     else if (inst->sig_mode == P2P_SIGNALING_MODE_PUBSUB) {
 
-        print("I:", LA_F("REG to PUBSUB signaling (Gist: %s)", LA_F320, 320), inst->cfg.gist_id);
+        if (inst->cfg.server_host && inst->cfg.server_host[0])
+            print("I:", LA_F("REG to PUBSUB signaling (WebSocket push: %s:%d)", LA_F572, 572),
+                  inst->cfg.server_host, inst->cfg.server_port);
+        else print("I:", LA_F("REG to PUBSUB signaling (Gist: %s)", LA_F320, 320), inst->cfg.gist_id);
 
         if ((ret = p2p_signal_pubsub_online(inst, inst->local_peer_id,
                                              inst->cfg.gh_token, inst->cfg.gist_id)) != E_NONE) {
@@ -553,14 +1171,46 @@ p2p_create(const char *local_peer_id, const p2p_config_t *cfg) {
         }
         else inst->state = P2P_SIG_ST_REG;
     }
+    // ICE 模式：候选由应用层交换，无需登录，实例创建即可发起会话
+    else if (inst->sig_mode == P2P_SIGNALING_MODE_ICE) inst->state = P2P_SIG_ST_READY;
+
+    // DTLS 会话恢复缓存（各会话的加密层上下文之间共享）
+    if ((inst->cfg.dtls_backend == 1 || inst->cfg.dtls_backend == 2) && p2p_dtls_cache_create(inst) != E_NONE) {
+        print("W:", LA_F("DTLS session cache unavailable, reconnects use full handshakes", LA_F495, 495));
+    }
 
+    // 路径缓存（0-RTT 重连）
+    if ((inst->cfg.path_cache || inst->cfg.path_cache_file || inst->cfg.on_path_load)
+        && p2p_path_cache_create(inst) != E_NONE) {
+        print("W:", LA_F("path cache unavailable, reconnects start from signaling", LA_F514, 514));
+    }
+
+    // 局域网发现（组播通告）
+    if (inst->cfg.lan_discovery && (ret = p2p_lan_create(inst)) != E_NONE) {
+        print("W:", LA_F("lan discovery unavailable(%d), LAN peers connect via signaling", LA_F699, 699), ret);
+    }
+
+    // 候选类型历史（打洞检查排序）
+    if (nat_hist_create(inst) != E_NONE) {
+        print("W:", LA_F("candidate history unavailable, checks use fixed priority order", LA_F674, 674));
+    }
+
+    // 结构化事件追踪（打开失败仅告警，不影响连接）
+    if (inst->cfg.trace_file && inst->cfg.trace_file[0]) p2p_trace_open(inst, inst->cfg.trace_file);
 
 #ifdef P2P_THREADED
     if (cfg->threaded) {
         print("I:", LA_F("Starting internal thread", LA_F393, 393));
         if ((ret = p2p_thread_start(inst)) != E_NONE) {
             print("E:", LA_F("Start internal thread failed(%d)", LA_F390, 390), ret);
-            p2p_udp_close_all(inst); route_shared_release(); free(inst);
+            p2p_dtls_cache_free(inst);
+            p2p_path_cache_free(inst);
+            p2p_lan_free(inst);
+            nat_hist_free(inst);
+            p2p_trace_close(inst);
+            p2p_stun_shared_release(inst);
+            p2p_udp_close_all(inst); route_shared_release();
+            p2p_arena_destroy(inst->arena); p2p_free(inst);
             return NULL;
         }
     }
@@ -584,7 +1234,7 @@ p2p_destroy(p2p_handle_t hdl) {
 
     // 先告知信令服务器下线（信令函数需要 session 指针，必须在释放会话前调用）
     if (inst->sig_mode == P2P_SIGNALING_MODE_COMPACT &&
-        inst->sig_ctx.compact.state != SIG_COMPACT_INIT) {
+        (inst->sig_ctx.compact.state != SIG_COMPACT_INIT || inst->sig_ctx.compact.ident_cnt)) {
         print("I:", LA_F("Sending OFFLINE packet to COMPACT signaling server", LA_F381, 381));
         p2p_signal_compact_offline(inst);
     }
@@ -604,21 +1254,44 @@ p2p_destroy(p2p_handle_t hdl) {
         struct p2p_session *next = s->next;
 
         probe_reset(s);
+        rpc_reset(s);
+        fec_reset(s);
+        p2p_bundle_free(s);
         if (s->state > P2P_STATE_ERROR) disconnect(s);
 
         if (s->dtls && s->dtls->close) { s->dtls->close(s); s->dtls = NULL; }
         if (s->trans && s->trans->close) { s->trans->close(s); s->trans = NULL; }
 
-        free(s->local_cands);
-        free(s->remote_cands);
-        free(s);
+        p2p_shm_close(s, true);         // 删除共享内存段名并通知同机对端
+        reliable_resume_free(s);
+        reliable_free(s);
+        session_streams_free(s);
+        session_waiters_close(s);
+        dgram_free(&s->dgram);
+        p2p_mem_release(&s->mem);
+        p2p_arena_free(inst->arena, s->local_cands);
+        p2p_arena_free(inst->arena, s->remote_cands);
+        p2p_arena_free(inst->arena, s);
         s = next;
     }
     inst->sessions_head = inst->sessions_rear = NULL;
+    p2p_free(inst->sess_by_id.slots);
+    p2p_free(inst->sess_by_addr.slots);
+    reliable_pool_trim(&inst->rel_pool);
+#ifdef P2P_THREADED
+    if (inst->cfg.threaded) p2p_thread_release(inst);
+#endif
 
     // 释放 TURN 分配
     p2p_turn_reset(inst);
 
+    p2p_dtls_cache_free(inst);
+    p2p_path_cache_free(inst);
+    p2p_lan_free(inst);
+    nat_hist_free(inst);
+    p2p_trace_close(inst);
+    p2p_stun_shared_release(inst);
+
     // todo stun 不需要？sock ？
 
     // 关闭 socket
@@ -626,17 +1299,24 @@ p2p_destroy(p2p_handle_t hdl) {
     p2p_udp_close_all(inst);
 
     route_shared_release();
-    free(inst);
+
+    // 实例内存区：整体回收各模块未逐一释放的会话对象
+    if (inst->arena) {
+        uint32_t n = p2p_arena_destroy(inst->arena);
+        if (n) print("V:", LA_F("%s: reclaimed %u arena blocks", LA_F609, 609), MOD_TAG, n);
+    }
+    p2p_free(inst);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-p2p_session_t
-p2p_connect(p2p_handle_t hdl, const char *remote_peer_id, bool wait_stun_pending) {
-
-    P_check(hdl, return NULL;)
-
-    struct p2p_instance *inst = (struct p2p_instance*)hdl;
+/*
+ * 创建会话并启动信令（local_id 非 NULL 时以该附加身份连接，仅 COMPACT；standby = 预热会话；
+ * opts 非 NULL 时为会话级传输选项）
+ */
+static p2p_session_t
+connect_session(struct p2p_instance *inst, const char *local_id, const char *remote_peer_id, bool wait_stun_pending,
+                bool standby, const p2p_session_opts_t *opts) {
 
     // 实例出错时不允许继续连接
     if (inst->state <= P2P_SIG_ST_ERROR) {
@@ -655,27 +1335,55 @@ p2p_connect(p2p_handle_t hdl, const char *remote_peer_id, bool wait_stun_pending
     }
 
     // 分配会话结构
-    struct p2p_session *s = (struct p2p_session*)calloc(1, sizeof(*s));
+    struct p2p_session *s = (struct p2p_session*)p2p_arena_calloc(inst->arena, 1, sizeof(*s));
     if (!s) {
         print("E:", LA_F("Failed to allocate memory for session", LA_F283, 283));
         return NULL;
     }
+    p2p_timer_node_init(&s->timer);
+#ifdef P2P_THREADED
+    for (int i = 0; i < P2P_WAIT_KINDS; i++) s->waiters[i].rd = s->waiters[i].wr = P_INVALID_SOCKET;
+#endif
 
     // 分配候选地址列表
+#ifdef P2P_FIXED_MEM
+    const int initial_cand_cap = P2P_FIXED_CANDS;
+#else
     const int initial_cand_cap = 8;
-    s->local_cands  = (p2p_local_candidate_entry_t *)calloc(initial_cand_cap, sizeof(p2p_local_candidate_entry_t));
-    s->remote_cands = (p2p_remote_candidate_entry_t *)calloc(initial_cand_cap, sizeof(p2p_remote_candidate_entry_t));
+#endif
+    s->local_cands  = (p2p_local_candidate_entry_t *)p2p_arena_calloc(inst->arena, initial_cand_cap, sizeof(p2p_local_candidate_entry_t));
+    s->remote_cands = (p2p_remote_candidate_entry_t *)p2p_arena_calloc(inst->arena, initial_cand_cap, sizeof(p2p_remote_candidate_entry_t));
     if (!s->local_cands || !s->remote_cands) {
         print("E:", LA_F("Failed to allocate memory for candidate lists", LA_F281, 281));
-        if (s->local_cands) free(s->local_cands);
-        if (s->remote_cands) free(s->remote_cands);
-        free(s);
+        p2p_arena_free(inst->arena, s->local_cands);
+        p2p_arena_free(inst->arena, s->remote_cands);
+        p2p_arena_free(inst->arena, s);
         return NULL;
     }
     s->local_cand_cap = s->remote_cand_cap = initial_cand_cap;
+    s->mem.parent = &inst->mem;
+    p2p_mem_add(&s->mem, P2P_MEM_SESSION, sizeof(*s));
+    p2p_mem_add(&s->mem, P2P_MEM_CANDS, (int64_t)initial_cand_cap * (sizeof(p2p_local_candidate_entry_t) + sizeof(p2p_remote_candidate_entry_t)));
 
     s->inst = inst;
     s->next = NULL;
+    s->standby = standby;
+    if (opts) s->opts = *opts;
+
+    // 所属本端身份（DTLS 等按本端 ID 选择角色，须在其初始化之前确定）
+    if (local_id) {
+        LOCK_INST(inst);
+        s->sig_sess.compact.ident = p2p_signal_compact_ident_find(inst, local_id);
+        UNLOCK_INST(inst);
+        if (!s->sig_sess.compact.ident) {
+            print("E:", LA_F("Unknown local identity '%s'", LA_F634, 634), local_id);
+            p2p_mem_release(&s->mem);
+            p2p_arena_free(inst->arena, s->local_cands);
+            p2p_arena_free(inst->arena, s->remote_cands);
+            p2p_arena_free(inst->arena, s);
+            return NULL;
+        }
+    }
 
     // 初始化对端 ID
     if (remote_peer_id) {
@@ -692,18 +1400,35 @@ p2p_connect(p2p_handle_t hdl, const char *remote_peer_id, bool wait_stun_pending
 
     // 会话级状态初始化
     nat_init(&s->nat);
+    s->nat.arena = inst->arena;
+    s->nat.mem = &s->mem;
 
-    p2p_path_strategy_t strategy = (p2p_path_strategy_t)(inst->cfg.path_strategy);
+    p2p_path_strategy_t strategy = (p2p_path_strategy_t)P2P_SOPT(s, P2P_SOPT_PATH, path_strategy);
     if (strategy < P2P_PATH_STRATEGY_CONNECTION_FIRST || strategy > P2P_PATH_STRATEGY_HYBRID)
         strategy = P2P_PATH_STRATEGY_CONNECTION_FIRST;
     path_manager_init(s, strategy);
     print("I:", LA_F("Path manager initialized with strategy: %d (0=conn,1=perf,2=hybrid)", LA_F339, 339), strategy);
 
-    reliable_init(s);
+    // 流缓冲区（传输层初始化时需要流数量）
+    if (session_streams_init(s) != E_NONE) {
+        print("E:", LA_F("stream buffers alloc failed", LA_F482, 482));
+        goto fail;
+    }
+    if (dgram_init(&s->dgram) != E_NONE) {
+        print("E:", LA_F("datagram buffers alloc failed", LA_F488, 488));
+        goto fail;
+    }
+
+    if (reliable_init(s) != E_NONE) goto fail;
 
-    // 传输层选择
+    // 传输层选择（会话未指定时按实例配置：SCTP > PseudoTCP > BBR）
     s->trans = NULL;
-    if (inst->cfg.use_sctp) {
+    int trans = P2P_TRANS_RELIABLE;
+    if (s->opts.set & P2P_SOPT_TRANSPORT) trans = s->opts.transport;
+    else if (inst->cfg.use_sctp) trans = P2P_TRANS_SCTP;
+    else if (inst->cfg.use_pseudotcp) trans = P2P_TRANS_PSEUDOTCP;
+    else if (inst->cfg.use_bbr) trans = P2P_TRANS_BBR;
+    if (trans == P2P_TRANS_SCTP) {
 #ifdef WITH_SCTP
         print("I:", LA_F("SCTP (usrsctp) enabled as transport layer", LA_F289, 289));
         s->trans = &p2p_trans_sctp;
@@ -711,10 +1436,14 @@ p2p_connect(p2p_handle_t hdl, const char *remote_peer_id, bool wait_stun_pending
         print("W:", LA_F("SCTP (usrsctp) requested but library not linked", LA_F367, 367));
 #endif
     }
-    else if (inst->cfg.use_pseudotcp) {
+    else if (trans == P2P_TRANS_PSEUDOTCP) {
         print("I:", LA_F("PseudoTCP enabled as transport layer", LA_F343, 343));
         s->trans = &p2p_trans_pseudotcp;
     }
+    else if (trans == P2P_TRANS_BBR) {
+        print("I:", LA_F("BBR enabled as transport layer", LA_F479, 479));
+        s->trans = &p2p_trans_bbr;
+    }
     else print("I:", LA_F("No advanced transport layer enabled, using simple reliable layer", LA_F324, 324));
 
     if (s->trans && s->trans->init) {
@@ -728,7 +1457,8 @@ p2p_connect(p2p_handle_t hdl, const char *remote_peer_id, bool wait_stun_pending
     // 加密层选择
     s->dtls = NULL;
     s->dtls_data = NULL;
-    if (inst->cfg.dtls_backend == 1) {
+    int dtls_backend = P2P_SOPT(s, P2P_SOPT_CRYPTO, dtls_backend);
+    if (dtls_backend == 1) {
 #ifdef WITH_DTLS
         print("I:", LA_F("DTLS (MbedTLS) enabled as encryption layer", LA_F196, 196));
         s->dtls = &p2p_dtls_mbedtls;
@@ -736,7 +1466,7 @@ p2p_connect(p2p_handle_t hdl, const char *remote_peer_id, bool wait_stun_pending
         print("W:", LA_F("DTLS (MbedTLS) requested but library not linked", LA_F272, 272));
 #endif
     }
-    else if (inst->cfg.dtls_backend == 2) {
+    else if (dtls_backend == 2) {
 #ifdef WITH_OPENSSL
         print("I:", LA_F("OpenSSL DTLS enabled as encryption layer", LA_F243, 243));
         s->dtls = &p2p_dtls_openssl;
@@ -744,6 +1474,10 @@ p2p_connect(p2p_handle_t hdl, const char *remote_peer_id, bool wait_stun_pending
         print("W:", LA_F("OpenSSL requested but library not linked", LA_F332, 332));
 #endif
     }
+    else if (dtls_backend == 3) {
+        print("I:", LA_F("Built-in AEAD (ChaCha20-Poly1305) enabled as encryption layer", LA_F506, 506));
+        s->dtls = &p2p_dtls_aead;
+    }
 
     // DTLS 初始化（需要 remote_peer_id 以确定自动角色）
     if (s->dtls && s->dtls->init) {
@@ -754,24 +1488,45 @@ p2p_connect(p2p_handle_t hdl, const char *remote_peer_id, bool wait_stun_pending
         }
     }
 
-    stream_init(&s->stream, inst->cfg.nagle);
     probe_init(&s->probe);
+    rpc_init(&s->rpc);
 
     s->state = P2P_STATE_INIT;
     s->path_type = P2P_PATH_NONE;
     s->active_path = PATH_IDX_NONE;
 
+    // 空闲期预收集的 Srflx 映射：过期的作废并立即补收集，新鲜的由 gather 直接复用
+    LOCK_INST(inst);
+    p2p_stun_srflx_refresh(inst, p2p_now_ms());
+    UNLOCK_INST(inst);
+
     // 收集本地候选地址（Host/TURN）
     gather_local_candidates(s);
 
     LOCK_INST(inst);
 
+#ifdef P2P_THREADED
+    // 分配会话分片（此后由该分片线程驱动）
+    p2p_thread_assign(inst, s);
+#endif
+
+    // 建连里程碑起点；候选尚在收集时，由 update 在收集完成后补记 GATHER
+    s->setup_start = p2p_now_ms();
+    if (P2P_CAND_PENDING(inst)) inst->setup_gather_wait++;
+    else p2p_setup_mark(s, P2P_SETUP_GATHER, s->setup_start);
+
     ret_t ret;
     switch (inst->sig_mode) {
 
         // COMPACT 模式
         case P2P_SIGNALING_MODE_COMPACT: {
 
+            // 身份在解锁期间被移除
+            if (local_id && p2p_signal_compact_ident_find(inst, local_id) != s->sig_sess.compact.ident) {
+                print("E:", LA_F("Unknown local identity '%s'", LA_F635, 635), local_id);
+                goto fail_locked;
+            }
+
             if (!s->sig_sess.compact.remote_peer_id[0])
                 print("I:", LA_F("Starting COMPACT session with %s", LA_F391, 391), remote_peer_id);
             if ((ret = p2p_signal_compact_connect(s, remote_peer_id)) != E_NONE)
@@ -816,13 +1571,24 @@ p2p_connect(p2p_handle_t hdl, const char *remote_peer_id, bool wait_stun_pending
         default:
             print("E:", LA_F("Unknown signaling mode: %d", LA_F422, 422), inst->sig_mode);
             s->state = P2P_STATE_ERROR;
-            UNLOCK_INST(inst);
-            goto fail;
+            goto fail_locked;
     }
 
-    s->last_update = P_tick_ms();
+    // 0-RTT 重连：与信令并行，立即向局域网内发现的对端或上次连通的路径打洞
+    // + 多会话模式的 PUNCH 需携带信令分配的 session_id，无法先于信令发出
+    if (!inst->cfg.multi_session && !p2p_lan_connect(s)) { p2p_path_hint_t hint;
+        if (p2p_path_cache_get(inst, s->remote_peer_id, &hint)) {
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = hint.remote_ip;
+            addr.sin_port = hint.remote_port;
+            nat_resume(s, &addr, hint.path_type == P2P_PATH_LAN ? P2P_CAND_HOST : P2P_CAND_PRFLX);
+        }
+    }
 
-    UNLOCK_INST(inst);
+    s->last_update = p2p_now_ms();
+    p2p_session_wake(s);
 
     // 加入实例会话链表
     if (!inst->sessions_head) {
@@ -833,17 +1599,146 @@ p2p_connect(p2p_handle_t hdl, const char *remote_peer_id, bool wait_stun_pending
         inst->sessions_rear = s;
     }
 
+    UNLOCK_INST(inst);
+
+    // 唤醒工作线程立即开始驱动新会话
+    WAKEUP(s);
+
     return (p2p_session_t)s;
 
+fail_locked:
+    p2p_timer_del(p2p_session_wheel(s), &s->timer);
+#ifdef P2P_THREADED
+    p2p_thread_detach(s);
+#endif
+    UNLOCK_INST(inst);
 fail:
     if (s->trans && s->trans->close) s->trans->close(s);
     if (s->dtls && s->dtls->close) s->dtls->close(s);
-    free(s->local_cands);
-    free(s->remote_cands);
-    free(s);
+    reliable_resume_free(s);
+    reliable_free(s);
+    session_streams_free(s);
+    dgram_free(&s->dgram);
+    p2p_mem_release(&s->mem);
+    p2p_arena_free(inst->arena, s->local_cands);
+    p2p_arena_free(inst->arena, s->remote_cands);
+    p2p_arena_free(inst->arena, s);
+    return NULL;
+}
+
+/*
+ * 取出连接 remote_peer_id 的预热会话（主身份）。已失效（对端关闭或出错）的由调用方关闭后重建
+ * @param live  输出：会话仍可用
+ */
+static struct p2p_session *
+standby_find(struct p2p_instance *inst, const char *remote_peer_id, bool *live) {
+
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
+        if (!s->standby || strncmp(s->remote_peer_id, remote_peer_id, P2P_PEER_ID_MAX - 1)) continue;
+        if (inst->sig_mode == P2P_SIGNALING_MODE_COMPACT && s->sig_sess.compact.ident) continue;
+        *live = s->state != P2P_STATE_CLOSED && s->state != P2P_STATE_ERROR;
+        return s;
+    }
     return NULL;
 }
 
+p2p_session_t
+p2p_connect(p2p_handle_t hdl, const char *remote_peer_id, bool wait_stun_pending) {
+
+    P_check(hdl, return NULL;)
+    struct p2p_instance *inst = (struct p2p_instance*)hdl;
+
+    // 预热会话：直接交给应用（信令配对、打洞、DTLS 握手均已在后台完成或进行中）
+    if (remote_peer_id && *remote_peer_id) {
+        bool live = false;
+        LOCK_INST(inst);
+        struct p2p_session *s = standby_find(inst, remote_peer_id, &live);
+        if (s && live) s->standby = false;
+        UNLOCK_INST(inst);
+        if (s && live) {
+            print("I:", LA_F("%s: handing over prewarmed session (state=%d)", LA_F643, 643), remote_peer_id, s->state);
+            return (p2p_session_t)s;
+        }
+        if (s) p2p_close((p2p_session_t)s);
+    }
+    return connect_session(inst, NULL, remote_peer_id, wait_stun_pending, false, NULL);
+}
+
+p2p_session_t
+p2p_connect_opts(p2p_handle_t hdl, const char *remote_peer_id, bool wait_stun_pending, const p2p_session_opts_t *opts) {
+
+    P_check(hdl, return NULL;)
+    if (!opts) return p2p_connect(hdl, remote_peer_id, wait_stun_pending);
+    if ((opts->set & P2P_SOPT_TRANSPORT) && (opts->transport < P2P_TRANS_RELIABLE || opts->transport > P2P_TRANS_SCTP))
+        return NULL;
+    if ((opts->set & P2P_SOPT_CRYPTO) && (opts->dtls_backend < 0 || opts->dtls_backend > 3)) return NULL;
+    return connect_session((struct p2p_instance*)hdl, NULL, remote_peer_id, wait_stun_pending, false, opts);
+}
+
+int
+p2p_prewarm(p2p_handle_t hdl, const char *peer_id) {
+
+    P_check(hdl && peer_id && *peer_id, return -1;)
+    struct p2p_instance *inst = (struct p2p_instance*)hdl;
+
+    // 只有按对端 ID 寻址的信令模式可预先配对
+    if (inst->sig_mode != P2P_SIGNALING_MODE_COMPACT && inst->sig_mode != P2P_SIGNALING_MODE_RELAY) return -1;
+
+    bool live = false;
+    LOCK_INST(inst);
+    struct p2p_session *s = standby_find(inst, peer_id, &live);
+    UNLOCK_INST(inst);
+    if (s && live) return 0;
+    if (s) p2p_close((p2p_session_t)s);
+
+    if (!connect_session(inst, NULL, peer_id, false, true, NULL)) return -1;
+    print("I:", LA_F("%s: prewarm session started", LA_F644, 644), peer_id);
+    return 0;
+}
+
+p2p_session_t
+p2p_connect_as(p2p_handle_t hdl, const char *local_peer_id, const char *remote_peer_id, bool wait_stun_pending) {
+
+    P_check(hdl, return NULL;)
+    struct p2p_instance *inst = (struct p2p_instance*)hdl;
+
+    if (local_peer_id && (!*local_peer_id || !strncmp(local_peer_id, inst->local_peer_id, P2P_PEER_ID_MAX - 1)))
+        local_peer_id = NULL;
+    if (local_peer_id && inst->sig_mode != P2P_SIGNALING_MODE_COMPACT) return NULL;
+    return connect_session(inst, local_peer_id, remote_peer_id, wait_stun_pending, false, NULL);
+}
+
+int
+p2p_identity_add(p2p_handle_t hdl, const char *local_peer_id) {
+
+    P_check(hdl, return -1;)
+    struct p2p_instance *inst = (struct p2p_instance*)hdl;
+
+    // 附加身份的会话依赖包内 session_id 派发（同一对端可能同时对应多个会话）
+    if (inst->sig_mode != P2P_SIGNALING_MODE_COMPACT || !inst->cfg.multi_session) {
+        print("E:", LA_F("identities require COMPACT mode with multi_session", LA_F636, 636));
+        return -1;
+    }
+
+    LOCK_INST(inst);
+    ret_t ret = p2p_signal_compact_ident_add(inst, local_peer_id);
+    UNLOCK_INST(inst);
+    return ret == E_NONE ? 0 : -1;
+}
+
+int
+p2p_identity_remove(p2p_handle_t hdl, const char *local_peer_id) {
+
+    P_check(hdl, return -1;)
+    struct p2p_instance *inst = (struct p2p_instance*)hdl;
+    if (inst->sig_mode != P2P_SIGNALING_MODE_COMPACT) return -1;
+
+    LOCK_INST(inst);
+    ret_t ret = p2p_signal_compact_ident_remove(inst, local_peer_id);
+    UNLOCK_INST(inst);
+    return ret == E_NONE ? 0 : -1;
+}
+
 void
 p2p_close(p2p_session_t session) {
 
@@ -858,8 +1753,20 @@ p2p_close(p2p_session_t session) {
         // 主动断开（NAT FIN + 信令层 disconnect）
         disconnect(s);
     }
+    // PUBSUB 请求队列持有会话指针，释放前必须取消（disconnect 未执行时）
+    else if (inst->sig_mode == P2P_SIGNALING_MODE_PUBSUB) {
+        p2p_signal_pubsub_disconnect(s);
+    }
 
-    UNLOCK_INST(inst);
+    // 移出调度（先取出应用侧唤醒栈，避免其中残留本会话）
+    session_drain_wakes(&inst->wake_list);
+#ifdef P2P_THREADED
+    if (s->worker) session_drain_wakes(&s->worker->wake_list);
+#endif
+    p2p_timer_del(p2p_session_wheel(s), &s->timer);
+#ifdef P2P_THREADED
+    p2p_thread_detach(s);
+#endif
 
     // 从实例的会话链表中移除
     if (inst->sessions_head == s) {
@@ -874,208 +1781,309 @@ p2p_close(p2p_session_t session) {
         }
     }
 
+    // 移出会话索引
+    session_unindex(s);
+
+    UNLOCK_INST(inst);
+
     // 释放会话资源
     if (s->dtls && s->dtls->close) { s->dtls->close(s); s->dtls = NULL; }
     if (s->trans && s->trans->close) { s->trans->close(s); s->trans = NULL; }
-    free(s->local_cands);
-    free(s->remote_cands);
-    free(s);
+    p2p_tcp_punch_close(s, true);
+    p2p_shm_close(s, true);
+    rpc_reset(s);
+    fec_reset(s);
+    p2p_bundle_free(s);
+    reliable_resume_free(s);
+    reliable_free(s);
+    session_streams_free(s);
+    session_waiters_close(s);
+    dgram_free(&s->dgram);
+    p2p_mem_release(&s->mem);
+    p2p_arena_free(inst->arena, s->local_cands);
+    p2p_arena_free(inst->arena, s->remote_cands);
+    p2p_arena_free(inst->arena, s);
 }
 
-/*
- * 主更新循环 — 驱动所有状态机。
- * > 在单线程模式下，应用程序调用此函数
- * > 在多线程模式下，内部线程在锁下调用此函数
- * 
- * ============================================================================
- * 执行流程说明（按逻辑顺序组织）
- * ============================================================================
- *
- * 阶段 1: 远程数据输入（被动接收）
- *   - 从 UDP socket 接收数据包
- *   - 分发到各个协议处理器（STUN/TURN/P2P）
- *   - 更新本地状态（NAT 打洞确认、数据接收等）
- * 
- * 阶段 2: 信令服务维护（主动拉取）
- *   - COMPACT: 维护与 UDP 信令服务器的注册状态
- *   - RELAY: 维护 TCP 长连接，接收对方候选
- *   - PUBSUB: 轮询 GitHub Gist，检查对方发布的 offer/answer
- * 
- * 阶段 3: ICE 候选收集
- *   - 向 STUN 服务器发送探测请求
- *   - 向 TURN 服务器发送分配请求
- *   - 收集本地反射地址（Srflx）和中继地址（Relay）
- * 
- * 阶段 4: NAT 层维护
- *   - 向对端候选地址发送 PUNCH 包（NAT 打洞）
- *   - 维护已建立连接的保活（定期发送心跳）
- *   - 检测连接超时（转 NAT_LOST 状态）
- *   - LAN 路径升级（同子网直连优化）
- * 
- * 阶段 5: 统一状态机（集中处理所有状态转换）
- *   - REGISTERING → PUNCHING: 开始 NAT 打洞
- *   - PUNCHING/REGISTERING → CONNECTED: NAT 穿透成功
- *   - PUNCHING → RELAY: NAT 打洞失败，降级中继
- *   - CONNECTED → RELAY: NAT 连接超时，降级中继
- * 
- * 阶段 6: 数据传输
- *   - 应用层数据 → 传输层（DTLS/SCTP/Reliable）
- *   - 传输层 tick（重传、拥塞控制）
- *   - 传输层 → 应用层接收缓冲区
- * 
- * 阶段 7: 信令输出（主动推送）
- *   - RELAY: Trickle ICE 增量发送候选（含断点续传）
- *   - PUBSUB: 发布 offer（PUB 角色）
- *
- * 阶段 8: 连接监控与维护
- *  - 监控连接质量（RTT、丢包率等）
- *  - 根据策略动态切换路径（直连/中继）
- *  - 连接异常处理（重试、降级、断开）
- *
- * 阶段 9: NAT 类型检测
- *   - 后台定期运行 STUN 探测
- *   - 检测 NAT 类型（Full Cone / Symmetric 等）
- * 
- * ============================================================================
- * 设计原则
- * ============================================================================
- * 
- * 1. **远程输入优先**：先处理网络接收的数据包，确保及时响应
- * 2. **拉取在前，推送在后**：信令拉取在 ICE/NAT 前获取对端信息，
- *    信令推送在状态机后确保发送最新状态
- * 3. **状态机集中化**：所有 P2P 连接状态转换集中在阶段 5，便于维护
- * 4. **数据传输独立**：仅在已连接状态下执行，与信令/NAT 解耦
- */
+static int session_ctrl_timeout(struct p2p_session *s, uint64_t now_ms);
+static int session_next_timeout(struct p2p_session *s, uint64_t now_ms);
 
-int
-p2p_update(p2p_handle_t hdl) {
+static int update_dispatch(struct p2p_instance *inst, uint8_t *pkt, int n, struct sockaddr_in from,
+                           int recv_sock_idx, uint64_t rx_us, uint8_t ecn, uint64_t now_ms, bool steer);
 
-    if (!hdl) return -1;
+void p2p_dispatch_packet(struct p2p_instance *inst, uint8_t *pkt, int n, const struct sockaddr_in *from, uint64_t now_ms) {
+    update_dispatch(inst, pkt, n, *from, 0, P_tick_us(), 0, now_ms, false);
+}
 
-    struct p2p_instance *inst = (struct p2p_instance*)hdl;
-    struct p2p_session *s = inst->sessions_head;
-    if (!s) return 0;  /* 尚无活跃会话 */
+/*
+ * 阶段 1 单包派发：STUN/TURN、COMPACT 信令、P2P 协议包
+ * + steer 时（会话分片模式主线程，只持实例锁）会话包投递到所属分片；
+ *   实例级包不在此处理，返回 1 由调用方延后到控制阶段
+ */
+static int update_dispatch(struct p2p_instance *inst, uint8_t *pkt, int n, struct sockaddr_in from,
+                           int recv_sock_idx, uint64_t rx_us, uint8_t ecn, uint64_t now_ms, bool steer) { (void)steer;
 
-    uint8_t buf[P2P_MTU + 16]; struct sockaddr_in from; uint8_t* pkt; int n; int recv_sock_idx;
+    struct p2p_session *s = inst->sessions_head;
 
-    uint64_t now_ms = P_tick_ms();
+    // --------------------
+    // STUN/TURN 协议包
+    // --------------------
+    // 注：TURN 是 STUN 的扩展，共享相同的包格式和 Magic Cookie (0x2112A442)
+    //     两个 handler 内部会根据消息类型（Method）分别过滤处理
+    if (n >= 20 && pkt[0] < 2) { // STUN type 0x00xx or 0x01xx
+        uint8_t* ptr = pkt + 4; /* [4-7]:magic */
+        if (nget_l(ptr) == STUN_MAGIC) {
+
+            uint16_t type = nget_s(pkt); /* [0-1]:type */
+            if (P2P_LOG_ON(VERBOSE)) printf(LA_F("Recv STUN/TURN pkt from %s:%d, type=0x%04x, len=%d", LA_F360, 360),
+                                            inet_ntoa(from.sin_addr), ntohs(from.sin_port), type, n);
+            
+            // 单次遍历建立属性索引，后续 ICE / STUN / TURN 处理共用
+            p2p_stun_attrs_t attrs;
+            p2p_stun_attrs_parse(pkt, n, &attrs);
 
-    /* ========================================================================
-     * 阶段 1：远程数据输入（被动接收所有网络数据包）
-     * ======================================================================== */
-    while ((n = p2p_udp_recv_from(inst, &from, buf, sizeof(buf), &recv_sock_idx)) > 0) { pkt = buf;
-
-        // --------------------
-        // STUN/TURN 协议包
-        // --------------------
-        // 注：TURN 是 STUN 的扩展，共享相同的包格式和 Magic Cookie (0x2112A442)
-        //     两个 handler 内部会根据消息类型（Method）分别过滤处理
-        if (n >= 20 && pkt[0] < 2) { // STUN type 0x00xx or 0x01xx
-            uint8_t* ptr = pkt + 4; /* [4-7]:magic */
-            if (nget_l(ptr) == STUN_MAGIC) {
-
-                uint16_t type = nget_s(pkt); /* [0-1]:type */
-                printf(LA_F("Recv STUN/TURN pkt from %s:%d, type=0x%04x, len=%d", LA_F360, 360),
-                       inet_ntoa(from.sin_addr), ntohs(from.sin_port), type, n);
-                
-                // 如果使用 ICE 机制进行打洞
-                // todo ice 打洞如何支持 multi sess
-                if (inst->cfg.use_ice && p2p_stun_has_ice_attrs(pkt, n)) {
-                    nat_on_stun_packet(s, type, pkt, n, &from, now_ms);
-                    continue;
-                }
-                
-                // STUN 模块处理（NAT 检测 / Srflx 地址探测）
-                if (p2p_stun_is_binding_response(type, pkt, n)) {
-                    p2p_stun_handle_packet(inst, recv_sock_idx, &from, type, pkt, n);
-                    continue;
+            // 如果使用 ICE 机制进行打洞
+            // todo ice 打洞如何支持 multi sess
+            if (inst->cfg.use_ice && attrs.intact && attrs.ice) {
+#ifdef P2P_THREADED
+                if (steer) {
+                    if (!s->worker) return 1;
+                    p2p_worker_post(s->worker, s, true, pkt, n, &from, rx_us, ecn);
+                    return 0;
                 }
+#endif
+                nat_on_stun_packet(s, type, pkt, n, &attrs, &from, now_ms);
+                return 0;
+            }
+
+#ifdef P2P_THREADED
+            // 分片模式：NAT 检测、TURN 响应等实例级包延后到控制阶段处理
+            if (steer) return 1;
+#endif
+            
+            // TURN 服务器 RTT 探测的 Binding 响应（多服务器启动阶段）
+            if (p2p_turn_probe_response(inst, &from, type, pkt, n)) return 0;
 
-                // TURN 响应处理（Allocate/Refresh/CreatePermission/Data Indication）
-                const uint8_t *inner_data = NULL; int inner_len = 0; struct sockaddr_in inner_peer = {0};
-                int turn_ret = p2p_turn_handle_packet(inst, &from, type, pkt, n,
-                                                      &inner_data, &inner_len, &inner_peer);
-                if (turn_ret == 1 && inner_data && inner_len >= P2P_HDR_SIZE) {
+            // STUN 模块处理（NAT 检测 / Srflx 地址探测）
+            if (p2p_stun_is_binding_response(type, pkt, n)) {
+                p2p_stun_handle_packet(inst, recv_sock_idx, &from, type, pkt, n, &attrs);
+                return 0;
+            }
 
-                    // Data Indication: 解包为内层完整 P2P 包，转换为 P2P 协议继续执行下面主派发循环
-                    pkt = (uint8_t*)inner_data; n = inner_len; from = inner_peer;
-                    goto dispatch_p2p;
-                }
+            // TURN 响应处理（Allocate/Refresh/CreatePermission/Data Indication）
+            const uint8_t *inner_data = NULL; int inner_len = 0; struct sockaddr_in inner_peer = {0};
+            int turn_ret = p2p_turn_handle_packet(inst, &from, type, pkt, n, &attrs,
+                                                  &inner_data, &inner_len, &inner_peer);
+            if (turn_ret == 1 && inner_data && inner_len >= P2P_HDR_SIZE) {
 
-                continue;
+                // Data Indication: 解包为内层完整 P2P 包，转换为 P2P 协议继续执行下面主派发循环
+                pkt = (uint8_t*)inner_data; n = inner_len; from = inner_peer;
+                goto dispatch_p2p;
             }
+
+            return 0;
+        }
+    }
+
+    // --------------------
+    // TURN ChannelData（首字节 0x40-0x7F，P2P/信令包类型不使用该区间）
+    // --------------------
+    if (n >= 4 && (pkt[0] & 0xC0) == 0x40) {
+#ifdef P2P_THREADED
+        if (steer) return 1;
+#endif
+        const uint8_t *inner_data = NULL; int inner_len = 0; struct sockaddr_in inner_peer = {0};
+        if (p2p_turn_handle_channel_data(inst, &from, pkt, n, &inner_data, &inner_len, &inner_peer) == 1
+            && inner_len >= P2P_HDR_SIZE) {
+            pkt = (uint8_t*)inner_data; n = inner_len; from = inner_peer;
+            goto dispatch_p2p;
         }
+        return 0;
+    }
 
-        // --------------------
-        // P2P 协议（见 p2pp.h）
-        // --------------------
+    // --------------------
+    // P2P 协议（见 p2pp.h）
+    // --------------------
 
-        dispatch_p2p:
-        if (n < P2P_HDR_SIZE) continue;
+    dispatch_p2p:
+    if (n < P2P_HDR_SIZE) return 0;
 
-        // 获取 header
-        p2p_packet_hdr_t hdr;
-        p2p_pkt_hdr_decode(pkt, &hdr);
+    // 获取 header
+    p2p_packet_hdr_t hdr;
+    p2p_pkt_hdr_decode(pkt, &hdr);
+
+    // 获取 payload
+    const uint8_t *payload = pkt + P2P_HDR_SIZE; int payload_len = n - P2P_HDR_SIZE;
+
+    // 对于 COMPACT 模式的信令包，直接交给信令处理器
+    if (hdr.type >= 0x80) {
+#ifdef P2P_THREADED
+        if (steer) return 1;
+#endif
+        p2p_signal_compact_proto(inst, hdr.type, hdr.flags, hdr.seq, (uint8_t*)payload, payload_len, now_ms);
+        return 0;
+    }
 
-        // 获取 payload
-        const uint8_t *payload = pkt + P2P_HDR_SIZE; int payload_len = n - P2P_HDR_SIZE;
+    /* ================================================================
+     * 多会话派发：根据 session_id 或来源地址将包路由到正确会话
+     * 单会话模式直接使用 sessions_head，无附加开销
+     * ================================================================ */
 
-        // 对于 COMPACT 模式的信令包，直接交给信令处理器
-        if (hdr.type >= 0x80) {
+    /* 包含 session_id：根据 session_id 匹配 session，或验证 */
+    if (hdr.flags & P2P_FLAG_SESSION) {
 
-            p2p_signal_compact_proto(inst, hdr.type, hdr.flags, hdr.seq, (uint8_t*)payload, payload_len, now_ms);
-            continue;
+        if (payload_len < (int)P2P_SESS_ID_PSZ) {
+            return 0;
         }
+        uint32_t sess_id = nget_l(payload);
 
-        /* ================================================================
-         * 多会话派发：根据 session_id 或来源地址将包路由到正确会话
-         * 单会话模式直接使用 sessions_head，无附加开销
-         * ================================================================ */
+        if (s->id != sess_id) {
 
-        /* 包含 session_id：根据 session_id 匹配 session，或验证 */
-        if (hdr.flags & P2P_FLAG_SESSION) {
+            // 多会话：O(1) 哈希查找
+            struct p2p_session *ss;
+            if (!inst->cfg.multi_session || !(ss = p2p_session_find(inst, sess_id))) {
 
-            if (payload_len < (int)P2P_SESS_ID_PSZ) {
-                continue;
-            }
-            uint32_t sess_id = nget_l(payload);
-
-            if (s->id != sess_id) {
-
-                if (inst->cfg.multi_session) {
-                    if (s == inst->sessions_head) {
-                        for (; s; s = s->next) if (s->id == sess_id) break;
-                        if (!s) { s = inst->sessions_head;
-                            print("W:", LA_F("%s: invalid ses_id=%u\n", LA_F150, 150), "P2P", sess_id);
-                            continue;
-                        }
-                    } else { struct p2p_session *ss = s;
-                        for (s = s->next; s; s = s->next) if (s->id == sess_id) break;
-                        if (!s) {
-                            for (s=inst->sessions_head; s!=ss; s=s->next) if (s->id == sess_id) break;
-                            if (s == ss) {
-                                print("W:", LA_F("%s: invalid ses_id=%u\n", LA_F150, 150), "P2P", sess_id);
-                                continue;
-                            }
-                        }
-                    }
+                // 叠加中继：本端无此会话，按转发表转发到另一条腿（转发表由控制阶段维护）
+                if (inst->overlay_cnt) {
+#ifdef P2P_THREADED
+                    if (steer) return 1;
+#endif
+                    if (p2p_overlay_forward(inst, sess_id, pkt, n, &from, now_ms)) return 0;
                 }
-                else { print("W:", LA_F("%s: invalid ses_id=%u\n", LA_F150, 150), "P2P", sess_id); continue; }
+                print("W:", LA_F("%s: invalid ses_id=%u\n", LA_F150, 150), "P2P", sess_id);
+                return 0;
             }
+            s = ss;
+        }
 
-            payload     += P2P_SESS_ID_PSZ;
-            payload_len -= (int)P2P_SESS_ID_PSZ;
+        payload     += P2P_SESS_ID_PSZ;
+        payload_len -= (int)P2P_SESS_ID_PSZ;
+
+    } else if (inst->cfg.multi_session) {
 
-        } else if (inst->cfg.multi_session) {
+        // 携带 CID 的 DTLS 记录按 CID 派发（不依赖来源地址，NAT 重绑定后仍能找到会话）
+        // + 其余未携带 session_id 的包（如 DATA/ACK）：按来源地址回退查找活跃路径匹配的会话
+        struct p2p_session *ss = NULL;
+        uint32_t cid;
+        if (hdr.type == P2P_PKT_CRYPTO && p2p_dtls_record_cid(payload, payload_len, &cid))
+            ss = p2p_session_find(inst, cid);
+        if (!ss) ss = p2p_session_find_by_addr(inst, &from);
+        if (!ss) {
             print("W:", LA_F("%s: no ses_id for multi session\n", LA_F159, 159), "P2P");
-            continue;
+            return 0;
+        }
+        s = ss;
+    }
+
+    // 叠加中继控制包：涉及多个会话（腿与被中转会话），在控制阶段处理
+    if (hdr.type == P2P_PKT_OVERLAY) {
+#ifdef P2P_THREADED
+        if (steer) return 1;
+#endif
+        p2p_overlay_on_packet(s, payload, payload_len, now_ms);
+        return 0;
+    }
+
+#ifdef P2P_THREADED
+    // 分片模式：投递到会话所属分片，由分片线程处理
+    if (steer) {
+        if (!s->worker) return 1;
+        p2p_worker_post(s->worker, s, false, pkt, n, &from, rx_us, ecn);
+        return 0;
+    }
+#endif
+
+    print("V:", LA_F("%s: recv (ses_id=%u), type=%u\n", LA_F199, 199), "P2P", s->id, hdr.type);
+
+    s->rx_us = rx_us;
+    s->rx_ecn = ecn;
+    nat_proto(s, hdr.type, hdr.flags, hdr.seq, payload, payload_len, &from, now_ms);
+    s->rx_us = 0;
+    s->rx_ecn = 0;
+    return 0;
+}
+
+#ifdef P2P_THREADED
+/*
+ * 加密线程池：本批直收的 CRYPTO 记录先并行解开（cfg.crypto_workers），派发仍按到达顺序逐个进行，
+ * 由加密层在 decrypt_recv 中确认重放窗口后取用明文
+ * + 会话匹配与 update_dispatch 一致；TURN 解包的内层记录不在此列，派发时就地解密
+ * + jobs[i] 为 rx_slots[i] 的任务，未预解开的槽位 len = 0
+ */
+static void update_recv_open(struct p2p_instance *inst, int cnt) {
+
+    p2p_aead_job_t *jobs = inst->crypto_rx, batch[P2P_UDP_BATCH_SLOTS];
+    int n = 0;
+    for (int i = 0; i < cnt; i++) { p2p_udp_slot_t *slot = &inst->rx_slots[i];
+
+        jobs[i].len = 0;
+        if (slot->len < P2P_HDR_SIZE || slot->buf[0] != P2P_PKT_CRYPTO) continue;
+
+        const uint8_t *rec = slot->buf + P2P_HDR_SIZE; int rec_len = slot->len - P2P_HDR_SIZE;
+        struct p2p_session *s = inst->sessions_head;
+        if (slot->buf[1] & P2P_FLAG_SESSION) {
+            if (rec_len < (int)P2P_SESS_ID_PSZ) continue;
+            uint32_t sess_id = nget_l(rec);
+            if (s && s->id != sess_id) s = inst->cfg.multi_session ? p2p_session_find(inst, sess_id) : NULL;
+            rec += P2P_SESS_ID_PSZ; rec_len -= (int)P2P_SESS_ID_PSZ;
         }
+        else if (inst->cfg.multi_session) s = p2p_session_find_by_addr(inst, &slot->from);
+        if (!s || !s->dtls || !s->dtls->open_prepare || !s->dtls->is_ready(s)) continue;
+
+        if (!s->dtls->open_prepare(s, rec, rec_len, &jobs[i])) { jobs[i].len = 0; continue; }
+        batch[n++] = jobs[i];
+    }
+    if (!n) return;
+
+    p2p_crypto_run(inst, batch, n);
+    for (int i = 0, k = 0; i < cnt && k < n; i++)
+        if (jobs[i].len) jobs[i].result = batch[k++].result;
+}
+#endif
+
+/*
+ * 阶段 1：远程数据输入（被动接收所有网络数据包）
+ * + 批量读取（recvmmsg）到 inst->rx_slots 后逐个派发，单次 update 最多处理 cfg.recv_batch 个包，
+ *   且每批之后检查 cfg.recv_budget_us，接收负载下定时器与发送仍按时运行
+ */
+static void update_recv(struct p2p_instance *inst, uint64_t now_ms, bool steer) {
+
+    // 损伤模拟：先发出 tx 队列中已到期的包
+    if (inst->netem) p2p_netem_flush(inst);
 
-        print("V:", LA_F("%s: recv (ses_id=%u), type=%u\n", LA_F199, 199), "P2P", s->id, hdr.type);
+    int rx_budget = inst->cfg.recv_batch, rx_cnt;
+    uint64_t rx_start = inst->cfg.recv_budget_us > 0 ? P_tick_us() : 0;
+    while (rx_budget > 0 && (rx_cnt = p2p_udp_recv_batch(inst, rx_budget)) > 0) { rx_budget -= rx_cnt;
 
-        nat_proto(s, hdr.type, hdr.flags, hdr.seq, payload, payload_len, &from, now_ms);
+#ifdef P2P_THREADED
+        // 分片模式下记录在各分片线程解密，已按会话并行
+        bool open = inst->crypto_rx && !steer;
+        if (open) update_recv_open(inst, rx_cnt);
+#endif
+        for (int i = 0; i < rx_cnt; i++) { p2p_udp_slot_t *slot = &inst->rx_slots[i];
+#ifdef P2P_THREADED
+            inst->crypto_rx_cur = open && inst->crypto_rx[i].len ? &inst->crypto_rx[i] : NULL;
+#endif
+            int r = update_dispatch(inst, slot->buf, slot->len, slot->from, slot->sock_idx, slot->rx_us, slot->ecn, now_ms, steer);
+#ifdef P2P_THREADED
+            inst->crypto_rx_cur = NULL;
+#endif
+            if (r <= 0) continue;
+#ifdef P2P_THREADED
+            // 延后到控制阶段（ctrl_slots 容量等于单批最大接收数，本批结束即停止接收）
+            inst->ctrl_slots[inst->ctrl_cnt++] = *slot;
+#endif
+        }
+#ifdef P2P_THREADED
+        if (inst->ctrl_cnt) break;
+#endif
+        // 时间预算用尽：余下的包留在套接字中，下次 update 继续（就绪的套接字使等待立即返回）
+        if (rx_start && P_tick_us() - rx_start >= (uint64_t)inst->cfg.recv_budget_us) break;
+    }
+}
 
-    } // while ((n = p2p_udp_recv_from(s, &from, buf, sizeof(buf))) > 0)
+/* 阶段 2、3：信令拉取与 TURN 维护（实例级） */
+static void update_control_recv(struct p2p_instance *inst, uint64_t now_ms) {
 
     /* ========================================================================
      * 阶段 2：信令服务维护（主动拉取远端候选地址）
@@ -1092,369 +2100,1707 @@ p2p_update(p2p_handle_t hdl) {
     }
 
     /* ========================================================================
-     * 阶段 3：TURN 定时维护（Refresh 续期、权限同步）—实例级，不内于会话循环
+     * 阶段 3：TURN 定时维护（Allocate 重传、Refresh 续期、权限同步）—实例级，不内于会话循环
      * ======================================================================== */
     p2p_turn_tick(inst, now_ms);
 
-    /* ========================================================================
-     * 阶段 3-9：遍历所有会话，逐个执行会话级 tick
-     * ======================================================================== */
-    for (s = inst->sessions_head; s; s = s->next) {
+    // 局域网发现：读取组播通告，向刚发现的对端打洞
+    if (inst->lan) p2p_lan_tick_recv(inst, now_ms);
+}
 
-        /* ========================================================================
-        * 阶段 4：NAT 层维护（打洞、保活）
-        * ======================================================================== */
+/* 阶段 6：数据传输（应用层数据 → 传输层、传输层 tick、传输层 → 应用层接收缓冲区） */
 
-        if (s->nat.state != NAT_INIT) {
-            nat_tick(s, now_ms);
+/*
+ * 0-RTT 发送（cfg.early_data）：本端已发出 CONN、尚未收到 CONN_ACK 时即把默认流数据交给 reliable 层
+ * + 对端能力未知前发送窗口为 RELIABLE_WINDOW，即只提前发出首个窗口；对端未就绪时丢弃的包照常重传
+ * + 加密会话须密钥已就绪（否则 DATA 会以明文发出）；续传需在首个新包之前重排保留的包，不提前发送
+ */
+static bool session_early_send(struct p2p_session *s) {
+    return s->inst->cfg.early_data && s->state == P2P_STATE_PUNCHING && s->nat.state == NAT_CONNECTING
+        && !s->trans && s->stream_cnt <= 1 && !s->resume.pending
+        && (!s->dtls || s->dtls->is_ready(s));
+}
+
+static void session_transfer(struct p2p_session *s, uint64_t now_ms) {
+
+    uint8_t buf[P2P_MTU + 16]; int n;
+
+    // 批量传输：解析对端记录、接续下一块（挂接的会话不休眠），会话不可用时脱离
+    if (s->bulk.b) bulk_tick(s);
+
+    // 空闲休眠：流与 reliable 层没有可处理的数据，只维护数据报与加密层
+    if (s->hibernated) {
+        if (s->state > P2P_STATE_LOST) dgram_flush(s, now_ms);
+        if (s->dtls && s->dtls->tick) s->dtls->tick(s);
+        return;
+    }
+
+    // 包合并（cfg.bundle）：本阶段发往同一路径的小包合为一个数据报
+    p2p_bundle_begin(s);
+
+    // 发送数据：数据流层 → 传输层 flush 写入
+    if (s->state > P2P_STATE_LOST) {
+        
+        // 传输层原生多流（SCTP）：由传输层直接从各流 send_ring 取数据
+        if (s->trans && s->trans->flush) {
+            if (!s->trans->is_ready || s->trans->is_ready(s)) s->trans->flush(s);
+        }
+        // 如果使用高级传输层（DTLS、PseudoTCP）
+        else if (s->trans && s->trans->send_data) {
+
+            // 传输层就绪检查：DTLS 握手完成前不 drain 数据，避免丢失
+            int ready = !s->trans->is_ready || s->trans->is_ready(s);
+            // 由高级传输模块自行处理流的数据；非 0 号流经 send_stream 映射到传输层原生流
+            for (int i = 0; ready && i < s->stream_cnt; i++) {
+                stream_t *st = stream_get(s, i);
+                if (i && !s->trans->send_stream) break;
+                n = ring_read(&st->send_ring, buf, sizeof(buf));
+                if (n <= 0) continue;
+                stream_queue_sent(st, n);
+                int sent = i ? s->trans->send_stream(s, i, buf, n) : s->trans->send_data(s, buf, n);
+                if (sent > 0) {
+                    st->send_offset += n;
+                } else {
+                    // send_data 失败，数据已从 ring 消费，记录丢失
+                    print("W:", LA_F("transport send_data failed, %d bytes dropped", LA_F468, 468), n);
+                }
+            }
+        }
+        // 使用基础 reliable 层
+        else stream_flush_to_reliable(s);
+
+        // 不可靠数据报：不经传输层，直接发出
+        dgram_flush(s, now_ms);
+
+        // 发送背压：待发送字节降到低水位以下时通知应用
+        stream_writable_poll(s);
+    }
+    else if (session_early_send(s)) stream_flush_to_reliable(s);
+
+    // 如果使用了高级传输层（如 DTLS/SCTP/PseudoTCP）
+    if (s->trans) {
+
+        // 传输模块周期 tick（重传，拥塞控制等）
+        if (s->trans->tick) {
+            if (s->state > P2P_STATE_LOST) {
+                s->trans->tick(s);
+            }
+        }
+
+        // 将高级传输层统计同步到路径管理器（Group 2: 数据层 RTT + 丢包率）
+        if (s->trans->get_stats && s->active_path >= -1) {
+            uint32_t rtt_ms = 0;
+            float loss_rate = 0.0f;
+            
+            if (s->trans->get_stats(s, &rtt_ms, &loss_rate) == 0) {
+
+                if (rtt_ms > 0)
+                    path_manager_on_data_rtt(s, s->active_path, rtt_ms);
+
+                // 上报数据层丢包率（之前被忽略，导致路径质量评估缺少数据层信息）
+                if (loss_rate > 0.0f)
+                    path_manager_on_data_loss_rate(s, s->active_path, loss_rate);
+            }
+        }
+    }
+    // reliable 周期 tick：发送/重传数据包 + 发 ACK
+    // 注：仅在无高级传输层时调用。PseudoTCP 虽然 on_packet==NULL（复用 reliable 收包），
+    //     但它有自己的 tick（cwnd 控制），不能再调 reliable_tick，否则双重发送且绕过拥塞控制。
+    else reliable_tick(s);
+
+    // 接收数据：传输层 → 数据流层
+    // 注：DTLS/SCTP 直接写入 stream.recv_ring，不需要此步骤
+    //     只有基础 reliable 层需要从 reliable 缓冲区读取
+    //     握手完成前到达的 0-RTT 数据在进入 CONNECTED（on_state 回调）之后才交付
+    if ((!s->trans || !s->trans->on_packet) && !p2p_session_handshaking(s)) {
+        stream_feed_from_reliable(s);
+    }
+
+    // 加密层周期 tick（DTLS 握手推进、重传定时器）
+    if (s->dtls && s->dtls->tick) {
+        s->dtls->tick(s);
+    }
+
+    p2p_bundle_end(s);
+}
+
+/* cfg.low_power：会话是否需要正常节奏推进（建连中，或缓冲区中有待收发的数据） */
+static bool session_lp_busy(const struct p2p_session *s) {
+    if (s->state == P2P_STATE_SIGNALING || s->state == P2P_STATE_PUNCHING) return true;
+    if (s->state != P2P_STATE_CONNECTED && s->state != P2P_STATE_RELAY) return false;
+    return !s->hibernated && !session_drained(s);
+}
+
+/*
+ * 按各模块下一截止时刻重新挂入时间轮（0 = 仍有待处理的工作，下一毫秒继续）
+ * + 低功耗空闲时对齐到共同唤醒窗口
+ */
+static void session_reschedule(struct p2p_session *s, uint64_t now_ms) {
+
+    s->last_update = now_ms;
+    if (s->inst->cfg.low_power && session_lp_busy(s)) p2p_lp_touch(s->inst, now_ms);
+
+    int t = session_next_timeout(s, now_ms);
+    if (p2p_lp_idle(s->inst, now_ms)) t = p2p_lp_align(now_ms, t);
+    p2p_timer_add(p2p_session_wheel(s), &s->timer, now_ms + (uint64_t)(t > 0 ? t : 1));
+}
+
+/* 阶段 4~7：会话级 tick（NAT 维护、状态机、数据传输、路径管理），结束后重新调度 */
+static void session_tick(struct p2p_session *s, uint64_t now_ms) {
+
+    /* ========================================================================
+    * 阶段 4：NAT 层维护（打洞、保活）
+    * ======================================================================== */
+
+    if (s->nat.state != NAT_INIT || s->nat.resume) {
+        nat_tick(s, now_ms);
+    }
+
+    // TCP 打洞与 TCP 路径收发（与 UDP 打洞并行，建立后登记为 TCP 候选）
+    if (s->inst->cfg.enable_tcp) p2p_tcp_punch_tick(s, now_ms);
+
+    // 同主机探测与共享内存路径收包（直连建立后进行，建立后登记为共享内存候选）
+    if (s->inst->cfg.enable_shm) p2p_shm_tick(s, now_ms);
+
+    /* ========================================================================
+    * 阶段 5：统一状态机（集中处理所有 P2P 连接状态转换）
+    * ======================================================================== */
+
+    // 转换：REGISTERING/ONLINE → PUNCHING（开始打洞）
+    if ((s->state == P2P_STATE_SIGNALING || s->state == P2P_STATE_WAITING)
+        && (s->nat.state == NAT_PUNCHING || s->nat.state == NAT_CONNECTING)) {
+
+        print("I:", LA_F("State: → PUNCHING", LA_F399, 399));
+        p2p_set_state(s, P2P_STATE_PUNCHING);
+    }
+
+    // NAT_CONNECTED 状态转换已由 nat 模块通过 p2p_connected() 同步触发
+    // + 同步转换保证了数据包处理总是在 on_connected 事件之后发生（数据层会话一致性契约）
+    // + 此处不再需要异步协同（NAT_CONNECTED → P2P_STATE_CONNECTED）
+
+    // NAT_RELAY 状态转换已由 nat 模块通过 p2p_connected() 同步触发
+    // relay 候选也需要通过 NAT 层 connect 握手，已统一处理
+
+    // 转换：PUNCHING → ERROR（NAT 打洞超时且无中继服务）
+    if ((s->state == P2P_STATE_PUNCHING || s->state == P2P_STATE_SIGNALING || s->state == P2P_STATE_WAITING)
+        && s->nat.state == NAT_CLOSED) {
+
+        print("E:", LA_F("State: → ERROR (punch timeout, no relay available)", LA_F397, 397));
+        p2p_set_state(s, P2P_STATE_ERROR);
+        // NAT_CLOSED 表示打洞失败且无信令中转服务，连接已不可恢复
+    }
+
+    // NAT 重新连接后恢复路径（NAT_RELAY → NAT_CONNECTED）
+    if (s->state == P2P_STATE_RELAY
+        && s->nat.state == NAT_CONNECTED) {
+        
+        // 标记中继路径为降级（但不移除，保留作为备份）
+        path_manager_set_path_state(s, PATH_IDX_SIGNALING, PATH_STATE_DEGRADED);
+        
+        // 重新选择最佳路径（PUNCH 应当优先）
+        // + 竞速连接：经防抖切换（新路径稳定后再切），切换前数据继续走中继，流不中断
+        int best_path = path_manager_select_best_path(s);
+        if (best_path >= -1 && s->inst->cfg.path_race) {
+            if (path_manager_switch_path(s, best_path, "race upgrade", now_ms) == 0) {
+                print("I:", LA_F("State: RELAY → CONNECTED, path=PUNCH[%d]", LA_F395, 395), best_path);
+                p2p_set_state(s, P2P_STATE_CONNECTED);
+                path_cache_save(s);
+            }
+        } else if (best_path >= -1) {  // -1=SIGNALING, >=0=候选
+            p2p_set_active_path(s, best_path);
+            path_manager_switch_reset(s, now_ms);
+            print("I:", LA_F("State: RELAY → CONNECTED, path=PUNCH[%d]", LA_F395, 395), best_path);
+            p2p_set_state(s, P2P_STATE_CONNECTED);
+        } else {
+            print("W:", LA_F("RELAY recovery: NAT connected but no path available", LA_F346, 346));
+        }
+    }
+
+    // 转换：CONNECTED/RELAY → LOST（NAT 连接丢失）
+    // NAT_LOST 表示所有数据通道都断了（PUNCH/TURN/SIGNALING），等待恢复
+    if ((s->state == P2P_STATE_CONNECTED || s->state == P2P_STATE_RELAY)
+        && s->nat.state == NAT_LOST) {
+        
+        // 标记当前活跃路径为失效
+        path_manager_set_path_state(s, s->active_path, PATH_STATE_FAILED);
+        
+        // 清除活跃路径
+        p2p_set_active_path(s, PATH_IDX_NONE);
+        
+        print("W:", LA_F("State: → LOST (all paths failed)", LA_F398, 398));
+        p2p_set_state(s, P2P_STATE_LOST);
+    }
+
+    // 转换：LOST → CONNECTED（NAT 连接恢复）
+    if (s->state == P2P_STATE_LOST
+        && (s->nat.state == NAT_CONNECTED || s->nat.state == NAT_RELAY)) {
+        
+        int best_path = path_manager_select_best_path(s);
+        if (best_path >= -1) {
+            // 状态机立即切换（不走防抖）
+            p2p_set_active_path(s, best_path);
+            path_manager_switch_reset(s, now_ms);
+            print("I:", LA_F("State: LOST → CONNECTED, path=PUNCH[%d]", LA_F394, 394), best_path);
+            p2p_set_state(s, P2P_STATE_CONNECTED);
+        } else {
+            // 无可用路径，保持 LOST 状态
+            print("W:", LA_F("LOST recovery: NAT connected but no path available", LA_F317, 317));
+        }
+    }
+
+    // 转换：CONNECTED/RELAY/LOST → CLOSED
+    // + NAT FIN 和信令 FIN 都归一化为 NAT_CLOSED，统一在此处理
+    if (s->state >= P2P_STATE_LOST
+        && s->nat.state == NAT_CLOSED) {
+        peer_disconnect(s);
+    }
+
+    /* ========================================================================
+    * 阶段 6：数据传输（应用层数据收发）
+    * ======================================================================== */
+
+    session_transfer(s, now_ms);
+
+    /* ========================================================================
+    * 阶段 7：路径管理器维护（健康检查与路径选择）
+    * ======================================================================== */
+
+    // LOST 状态下无活跃路径（active_path = -2），恢复由 NAT 层驱动，无需路径管理器维护
+    if (s->state > P2P_STATE_LOST) { assert(s->active_path >= PATH_IDX_SIGNALING && s->path_type != P2P_PATH_NONE);
+
+        // 路径健康检查（检测超时、失效路径）
+        path_manager_tick(s, now_ms);
+        
+        // 预测式切换：活跃路径质量趋势下降时预热备用路径，首个劣化迹象即切换（不等连续超时）
+        int predicted = path_manager_predict(s, now_ms);
+        if (predicted >= PATH_IDX_SIGNALING
+            && path_manager_switch_path(s, predicted, "predictive", now_ms) == 0) {
+            print("I:", LA_F("Path switched predictively (idx=%d)", LA_F533, 533), predicted);
+        }
+
+        // 周期性路径重选（检查是否有更优路径）
+        if (tick_diff(now_ms, s->path_mgr.last_reselect_ms) > PATH_RESELECT_INTERVAL_MS) { 
+            s->path_mgr.last_reselect_ms = now_ms;
+
+            int best_path = path_manager_select_best_path(s);        
+            if (best_path >= PATH_IDX_SIGNALING && best_path != s->active_path) { 
+                
+                // 如果找到更优路径
+                path_stats_t *new_stats = p2p_get_path_stats(s, best_path);
+                path_stats_t *old_stats = p2p_get_path_stats(s, s->active_path);
+                
+                // 判断是否值得切换（性能提升显著）
+                // 根据当前活跃路径类型查抽切换阈值
+                const path_threshold_config_t *thr = &s->path_mgr.thresholds[s->path_type];
+                if ((new_stats->rtt_ms < old_stats->rtt_ms - thr->rtt_threshold_ms) ||  // RTT 显著改善
+                    (old_stats->loss_rate > thr->loss_threshold) ||                     // 当前路径丢包严重
+                    (s->path_mgr.strategy == P2P_PATH_STRATEGY_CONNECTION_FIRST
+                    && new_stats->cost_score < old_stats->cost_score)                  // 直连优先模式：更低成本
+                    ) {
+
+                    /* 执行路径切换（含防抖、历史记录） */
+                    int ret = path_manager_switch_path(s, best_path, "periodic reselect", now_ms);
+                    if (ret == 0) {
+                        print("I:", LA_F("Path switched to better route (idx=%d)", LA_F341, 341), best_path);
+                    } else if (ret > 0) {
+                        print("V:", LA_F("Path switch debounced, waiting for stability", LA_F340, 340));
+                    }
+                }
+            }
+            // 如果没有可用路径，那当前路径肯定是最后一个路径，且状态应该是 PATH_STATE_FAILED
+            else assert(best_path == s->active_path || p2p_get_path_stats(s, s->active_path)->state == PATH_STATE_FAILED);
+        }
+    } else assert(s->state != P2P_STATE_LOST || (s->active_path < PATH_IDX_SIGNALING && s->path_type == P2P_PATH_NONE));
+
+    p2p_session_hibernate(s, now_ms);
+    session_reschedule(s, now_ms);
+#ifdef P2P_THREADED
+    int ctrl = session_ctrl_timeout(s, now_ms);
+    s->ctrl_due = now_ms + (uint64_t)(ctrl > 0 ? ctrl : 0);
+#endif
+}
+
+/*
+ * 阶段 3-9：逐个执行到期会话的会话级 tick
+ * + 只处理时间轮到期、本轮收到数据包或被应用侧唤醒的会话，空闲会话不参与
+ * + 会话 tick 期间的数据包发送合并为批量提交（sendmmsg/GSO），循环结束后统一 flush
+ */
+/* 共享内存门铃：取出通知，接收环非空的会话登记唤醒（分片会话通知其线程） */
+static void shm_poll(struct p2p_instance *inst) {
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
+        if (!s->shm || !s->shm->bell_wait) continue;
+        p2p_shm_bell_drain(s);
+        if (p2p_shm_pending(s)) session_wake_mark(s);
+    }
+}
+
+static void update_sessions(struct p2p_instance *inst, uint64_t now_ms) {
+
+    if (inst->shm_cnt) shm_poll(inst);
+    session_drain_wakes(&inst->wake_list);
+    p2p_timer_advance(&inst->timers, now_ms);
+
+    p2p_udp_tx_begin(inst);
+    for (p2p_timer_t *tm; (tm = p2p_timer_pop(&inst->timers)) != NULL; )
+        session_tick(SESSION_OF_TIMER(tm), now_ms);
+    p2p_udp_tx_end(inst);
+}
+
+/* 信令路径检测、阶段 8 信令输出、阶段 9 NAT 类型检测（实例级） */
+static void update_control_send(struct p2p_instance *inst, uint64_t now_ms) {
+
+    /* ========================================================================
+    * 信令路径检测
+    * ======================================================================== */
+
+    path_manager_signaling_tick(inst, now_ms);
+
+    /* ========================================================================
+    * 阶段 8：信令输出
+    * ======================================================================== */
+
+    if (inst->sig_resolving) sig_online(inst);
+
+    // 本机地址变化：重整套接字与 Srflx，增量同步 Host 候选
+    p2p_route_refresh(inst, now_ms);
+
+    if (inst->sig_mode == P2P_SIGNALING_MODE_COMPACT) {
+        p2p_signal_compact_tick_send(inst, now_ms);
+    }
+    else if (inst->sig_mode == P2P_SIGNALING_MODE_RELAY) {
+        p2p_signal_relay_tick_send(inst, now_ms);
+    }
+    else if (inst->sig_mode == P2P_SIGNALING_MODE_PUBSUB) {
+        p2p_signal_pubsub_tick_send(inst, now_ms);
+    }
+
+    // MSG RPC：补发窗口内的分片与暂存的直连应答、整体超时
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) rpc_tick(s, now_ms);
+
+    // 套接字缓冲区：按观测 BDP 扩大
+    p2p_udp_sock_buf_tick(inst, now_ms);
+
+    // 叠加中继：请求重发、转发表过期
+    if (inst->cfg.multi_session) p2p_overlay_tick(inst, now_ms);
+
+    // 局域网发现：周期通告、应答查询
+    if (inst->lan) p2p_lan_tick_send(inst, now_ms);
+
+    /* ========================================================================
+    * 阶段 9：NAT 类型检测（后台定期运行 STUN 探测）
+    * ======================================================================== */
+
+    if (inst->cfg.stun_server) p2p_stun_nat_detect_tick(inst, now_ms);
+    if (inst->sig_mode == P2P_SIGNALING_MODE_COMPACT)
+        p2p_signal_compact_nat_detect_tick(inst, now_ms);
+
+    // 建连里程碑：候选收集完成
+    if (inst->setup_gather_wait && !P2P_CAND_PENDING(inst)) p2p_setup_gathered(inst, now_ms);
+
+    // 事件追踪：格式化本轮写入的事件
+    p2p_trace_flush(inst);
+}
+
+/* 收包之后的控制与会话阶段（t 为收包阶段结束时刻，仅用于延迟直方图） */
+static void update_stages(struct p2p_instance *inst, uint64_t now_ms, uint64_t t) {
+
+    if (inst->state == P2P_SIG_ST_REG) p2p_lp_touch(inst, now_ms);
+    update_control_recv(inst, now_ms);
+    uint64_t t1 = P2P_HIST_NOW();
+    update_sessions(inst, now_ms);
+    uint64_t t2 = P2P_HIST_NOW();
+    update_control_send(inst, now_ms);
+
+    P2P_HIST(P2P_HIST_STAGE_SIGNAL, (t1 - t) + (P2P_HIST_NOW() - t2));
+    P2P_HIST(P2P_HIST_STAGE_SESSIONS, t2 - t1);
+}
+
+/*
+ * 应用侧阻塞等待（p2p_recv_wait / p2p_send_wait / p2p_wait_state）
+ *
+ * 等待方登记 armed（并计入 inst->wait_cnt）后复查条件再阻塞于会话的唤醒描述符；
+ * 驱动会话的线程每轮处理后（p2p_update / p2p_update_control 逐个会话，分片线程只查本轮收包与到期的会话）
+ * 检查已登记的条件，满足即清除 armed 并唤醒。双方对 armed / wait_cnt 的访问均为 SEQ_CST，不会漏掉唤醒
+ */
+static bool session_wait_ready(struct p2p_session *s, int kind) {
+    if (s->state == P2P_STATE_CLOSED || s->state == P2P_STATE_ERROR) return true;
+    switch (kind) {
+    case P2P_WAIT_RECV:  return ring_used(&s->stream.recv_ring) > 0;
+    case P2P_WAIT_SEND:  return p2p_send_space((p2p_session_t)s) >= s->wait_space;
+    default:             return (int)s->state == s->wait_state;
+    }
+}
+
+#ifdef P2P_THREADED
+static inline bool session_waiters(struct p2p_instance *inst) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&inst->wait_cnt, __ATOMIC_RELAXED) > 0;
+}
+
+static void session_wait_poll(struct p2p_session *s) {
+    for (int i = 0; i < P2P_WAIT_KINDS; i++) { p2p_waiter_t *w = &s->waiters[i];
+        if (__atomic_load_n(&w->armed, __ATOMIC_SEQ_CST) && session_wait_ready(s, i)
+            && __atomic_exchange_n(&w->armed, 0, __ATOMIC_SEQ_CST))
+            p2p_waiter_signal(w);
+    }
+}
+
+static void sessions_wait_poll(struct p2p_instance *inst) {
+    if (!session_waiters(inst)) return;
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) session_wait_poll(s);
+}
+#endif
+
+/*
+ * 主更新循环 — 驱动所有状态机。
+ * > 在单线程模式下，应用程序调用此函数
+ * > 在多线程模式下，内部线程在锁下调用此函数
+ * > 会话分片模式（cfg.worker_count > 1）下由 p2p_update_steer / p2p_update_control / p2p_worker_update 分步执行
+ * 
+ * ============================================================================
+ * 执行流程说明（按逻辑顺序组织）
+ * ============================================================================
+ *
+ * 阶段 1: 远程数据输入（被动接收）
+ *   - 从 UDP socket 接收数据包
+ *   - 分发到各个协议处理器（STUN/TURN/P2P）
+ *   - 更新本地状态（NAT 打洞确认、数据接收等）
+ * 
+ * 阶段 2: 信令服务维护（主动拉取）
+ *   - COMPACT: 维护与 UDP 信令服务器的注册状态
+ *   - RELAY: 维护 TCP 长连接，接收对方候选
+ *   - PUBSUB: 轮询 GitHub Gist，检查对方发布的 offer/answer
+ * 
+ * 阶段 3: ICE 候选收集
+ *   - 向 STUN 服务器发送探测请求
+ *   - 向 TURN 服务器发送分配请求
+ *   - 收集本地反射地址（Srflx）和中继地址（Relay）
+ * 
+ * 阶段 4: NAT 层维护
+ *   - 向对端候选地址发送 PUNCH 包（NAT 打洞）
+ *   - 维护已建立连接的保活（定期发送心跳）
+ *   - 检测连接超时（转 NAT_LOST 状态）
+ *   - LAN 路径升级（同子网直连优化）
+ * 
+ * 阶段 5: 统一状态机（集中处理所有状态转换）
+ *   - REGISTERING → PUNCHING: 开始 NAT 打洞
+ *   - PUNCHING/REGISTERING → CONNECTED: NAT 穿透成功
+ *   - PUNCHING → RELAY: NAT 打洞失败，降级中继
+ *   - CONNECTED → RELAY: NAT 连接超时，降级中继
+ * 
+ * 阶段 6: 数据传输
+ *   - 应用层数据 → 传输层（DTLS/SCTP/Reliable）
+ *   - 传输层 tick（重传、拥塞控制）
+ *   - 传输层 → 应用层接收缓冲区
+ * 
+ * 阶段 7: 信令输出（主动推送）
+ *   - RELAY: Trickle ICE 增量发送候选（含断点续传）
+ *   - PUBSUB: 发布 offer（PUB 角色）
+ *
+ * 阶段 8: 连接监控与维护
+ *  - 监控连接质量（RTT、丢包率等）
+ *  - 根据策略动态切换路径（直连/中继）
+ *  - 连接异常处理（重试、降级、断开）
+ *
+ * 阶段 9: NAT 类型检测
+ *   - 后台定期运行 STUN 探测
+ *   - 检测 NAT 类型（Full Cone / Symmetric 等）
+ * 
+ * ============================================================================
+ * 设计原则
+ * ============================================================================
+ * 
+ * 1. **远程输入优先**：先处理网络接收的数据包，确保及时响应
+ * 2. **拉取在前，推送在后**：信令拉取在 ICE/NAT 前获取对端信息，
+ *    信令推送在状态机后确保发送最新状态
+ * 3. **状态机集中化**：所有 P2P 连接状态转换集中在阶段 5，便于维护
+ * 4. **数据传输独立**：仅在已连接状态下执行，与信令/NAT 解耦
+ */
+
+int
+p2p_update(p2p_handle_t hdl) {
+
+    if (!hdl) return -1;
+
+    struct p2p_instance *inst = (struct p2p_instance*)hdl;
+    if (!inst->sessions_head) return 0;  /* 尚无活跃会话 */
+
+    uint64_t clk;
+    uint64_t now_ms = p2p_clock_begin(&clk);
+    uint64_t t0 = P2P_HIST_NOW();
+
+    update_recv(inst, now_ms, false);
+    uint64_t t1 = P2P_HIST_NOW();
+    P2P_HIST(P2P_HIST_STAGE_RECV, t1 - t0);
+
+    update_stages(inst, now_ms, t1);
+    P2P_HIST(P2P_HIST_UPDATE, P2P_HIST_NOW() - t0);
+#ifdef P2P_THREADED
+    if (inst->cfg.threaded) sessions_wait_poll(inst);
+#endif
+
+    p2p_clock_end(clk);
+    return 0;
+}
+
+#ifdef P2P_THREADED
+bool p2p_update_steer(struct p2p_instance *inst) {
+
+    if (inst->sessions_head) {
+        uint64_t clk;
+        uint64_t t0 = P2P_HIST_NOW();
+        update_recv(inst, p2p_clock_begin(&clk), true);
+        P2P_HIST(P2P_HIST_STAGE_RECV, P2P_HIST_NOW() - t0);
+        p2p_clock_end(clk);
+    }
+    return inst->ctrl_cnt > 0;
+}
+
+void p2p_update_control(struct p2p_instance *inst) {
+
+    if (!inst->sessions_head) { inst->ctrl_cnt = 0; return; }
+
+    uint64_t clk;
+    uint64_t now_ms = p2p_clock_begin(&clk);
+    uint64_t t0 = P2P_HIST_NOW();
+
+    // 收包派发阶段延后的实例级包（信令、STUN、TURN）
+    for (int i = 0; i < inst->ctrl_cnt; i++) { p2p_udp_slot_t *slot = &inst->ctrl_slots[i];
+        update_dispatch(inst, slot->buf, slot->len, slot->from, slot->sock_idx, slot->rx_us, slot->ecn, now_ms, false);
+    }
+    inst->ctrl_cnt = 0;
+
+    update_stages(inst, now_ms, t0);
+    P2P_HIST(P2P_HIST_UPDATE, P2P_HIST_NOW() - t0);
+    sessions_wait_poll(inst);
+    p2p_clock_end(clk);
+}
+
+/*
+ * 分片线程无需实例锁即可处理的会话：直连路径上已连接，使用基础 reliable 层且无加密层
+ * + 此时 DATA/ACK/DGRAM 收包与数据传输 tick 只访问会话自身与分片私有资源（时间轮、缓冲区池、发送队列）
+ */
+static inline bool session_fast(const struct p2p_session *s) {
+    return s->state == P2P_STATE_CONNECTED && s->nat.state == NAT_CONNECTED
+        && (s->path_type == P2P_PATH_PUNCH || s->path_type == P2P_PATH_LAN)
+        && !s->trans && !s->dtls;
+}
+
+int p2p_worker_update(p2p_worker_t *w) {
+
+    struct p2p_instance *inst = w->inst;
+    uint64_t clk;
+    uint64_t now_ms = p2p_clock_begin(&clk);
+
+    p2p_udp_tx_begin(inst);
+
+    // 收件箱：整批取走主线程派发的数据包，主线程随即写入另一侧
+    P_mutex_lock(&w->rx_mtx);
+    p2p_rx_item_t *items = w->rx_items[w->rx_fill];
+    int cnt = w->rx_cnt;
+    w->rx_fill ^= 1;
+    w->rx_cnt = 0;
+    P_mutex_unlock(&w->rx_mtx);
+
+    for (int i = 0; i < cnt; i++) { p2p_rx_item_t *it = &items[i];
+
+        struct p2p_session *s = it->s;
+        if (!s) continue;
+
+        if (it->stun) {
+            P_mutex_lock(&inst->mtx);
+            nat_on_stun_packet(s, nget_s(it->buf), it->buf, it->len, NULL, &it->from, now_ms);
+            P_mutex_unlock(&inst->mtx);
+            continue;
         }
 
-        /* ========================================================================
-        * 阶段 5：统一状态机（集中处理所有 P2P 连接状态转换）
-        * ======================================================================== */
+        // 主线程已完成会话匹配与长度校验
+        p2p_packet_hdr_t hdr;
+        p2p_pkt_hdr_decode(it->buf, &hdr);
+        const uint8_t *payload = it->buf + P2P_HDR_SIZE; int payload_len = it->len - P2P_HDR_SIZE;
+        if (hdr.flags & P2P_FLAG_SESSION) {
+            payload     += P2P_SESS_ID_PSZ;
+            payload_len -= (int)P2P_SESS_ID_PSZ;
+        }
+
+        bool fast = session_fast(s) && sockaddr_equal(&it->from, &s->active_addr)
+                    && (p2p_bundle_type(hdr.type) || hdr.type == P2P_PKT_BUNDLE);
+        if (!fast) P_mutex_lock(&inst->mtx);
+        s->rx_us = it->rx_us;
+        s->rx_ecn = it->ecn;
+        nat_proto(s, hdr.type, hdr.flags, hdr.seq, payload, payload_len, &it->from, now_ms);
+        s->rx_us = 0;
+        s->rx_ecn = 0;
+        if (!fast) P_mutex_unlock(&inst->mtx);
+    }
+    if (cnt && session_waiters(inst)) {
+        for (int i = 0; i < cnt; i++) if (items[i].s) session_wait_poll(items[i].s);
+    }
+
+    // 到期会话：控制面尚未到期时只执行数据传输，否则持实例锁执行完整 tick
+    session_drain_wakes(&w->wake_list);
+    p2p_timer_advance(&w->timers, now_ms);
+
+    for (p2p_timer_t *tm; (tm = p2p_timer_pop(&w->timers)) != NULL; ) {
+        struct p2p_session *s = SESSION_OF_TIMER(tm);
+
+        if (session_fast(s) && now_ms < s->ctrl_due) {
+            session_transfer(s, now_ms);
+            session_reschedule(s, now_ms);
+        }
+        else {
+            P_mutex_lock(&inst->mtx);
+            session_tick(s, now_ms);
+            P_mutex_unlock(&inst->mtx);
+        }
+        if (session_waiters(inst)) session_wait_poll(s);
+    }
+
+    p2p_udp_tx_end(inst);
+    p2p_clock_end(clk);
+
+    if (session_wakes_pending(&w->wake_list)) return 0;
+    return p2p_timer_next_timeout(&w->timers, P_tick_ms());
+}
+#endif
+
+/*
+ * 计算会话距下一次需要 tick 的毫秒数（tick 结束时据此重新挂入时间轮）
+ *
+ * 会话级定时器（NAT 打洞/保活、reliable 发送/重传、路径健康检查）精确计算，
+ * 以 SESSION_TICK_MAX_MS 为上限兜底。
+ * 高级传输层（PseudoTCP/SCTP/DTLS）内部有自己的定时器，连接期间按 TRANS_TICK_INTERVAL_MS 节奏 tick。
+ */
+/* 控制面（NAT 打洞/保活、路径健康检查）距下一截止时刻的毫秒数，以 SESSION_TICK_MAX_MS 为上限 */
+static int session_ctrl_timeout(struct p2p_session *s, uint64_t now_ms) {
+
+    int next = p2p_lp_idle(s->inst, now_ms) ? P2P_LP_TICK_MS : SESSION_TICK_MAX_MS, t;
+
+    if ((s->nat.state != NAT_INIT || s->nat.resume) && (t = nat_next_timeout(s, now_ms)) >= 0 && t < next) next = t;
+
+    if ((t = path_manager_next_timeout(&s->path_mgr, now_ms)) < next) next = t;
+
+    if (s->inst->cfg.enable_tcp && (t = p2p_tcp_punch_next_timeout(s, now_ms)) >= 0 && t < next) next = t;
+
+    if (s->inst->cfg.enable_shm && (t = p2p_shm_next_timeout(s, now_ms)) >= 0 && t < next) next = t;
+
+    return next;
+}
+
+static int session_next_timeout(struct p2p_session *s, uint64_t now_ms) {
+
+    int next = session_ctrl_timeout(s, now_ms), t;
+
+    if (s->state <= P2P_STATE_LOST && !session_early_send(s)) return next;
+
+    // 有待发数据报（且上次 flush 未因路径不可发而中止）时立即处理
+    if (!s->dgram.blocked && ring_used(&s->dgram.send_ring)) return 0;
+
+    if (s->trans || s->dtls) {
+        if (TRANS_TICK_INTERVAL_MS < next && !p2p_lp_idle(s->inst, now_ms)) next = TRANS_TICK_INTERVAL_MS;
+        // 发送节奏暂停时按令牌补充时间提前唤醒（亚 tick）
+        if ((t = reliable_pace_wait(s, now_ms)) >= 0 && t < next) next = t;
+        return next;
+    }
+
+    // 发送缓冲区有可立即 flush 的数据；Nagle/cork 暂缓的尾部按剩余等待时间唤醒；文件未发完且窗口未满时立即继续
+    if (s->file_tx.fd >= 0 && s->file_tx.done < s->file_tx.total && reliable_window_avail(s) > 0) return 0;
+    for (int i = 0; i < s->stream_cnt && reliable_window_avail(s) > 0; i++) {
+        if ((t = stream_flush_timeout(s, stream_get(s, i), now_ms)) < 0) continue;
+        if (t == 0) return 0;
+        if (t < next) next = t;
+    }
+
+    if ((t = reliable_next_timeout(s, now_ms)) >= 0 && t < next) next = t;
+    return next;
+}
+
+/*
+ * 计算距下一次需要 p2p_update 的毫秒数
+ *
+ * 会话级定时器由时间轮给出最早到期时刻（各会话上次 tick 时按 session_next_timeout 挂入）；
+ * 实例级定时任务（信令、STUN、TURN、探测）不逐一计算，由 update_interval_ms 上限兜底
+ * （低功耗空闲时放宽并对齐到共同唤醒窗口，见 p2p_lp_idle）。
+ */
+int p2p_next_timeout(struct p2p_instance *inst, uint64_t now_ms) {
+
+    int next = p2p_tick_interval(inst, now_ms), t;
+
+    // 应用侧唤醒的会话尚未取出
+    if (session_wakes_pending(&inst->wake_list)) return 0;
+
+    // 共享 RELAY 连接上其他实例已代收本实例的信令帧
+    if (inst->sig_mode == P2P_SIGNALING_MODE_RELAY && inst->sig_ctx.relay.mux_rx_len) return 0;
+
+    if ((t = p2p_timer_next_timeout(&inst->timers, now_ms)) >= 0 && t < next) next = t;
+
+    if (inst->signaling.active && (t = path_manager_next_timeout(&inst->path_mgr, now_ms)) < next) next = t;
+
+    // 损伤模拟队列中的包到期时需要发出 / 交付
+    if (inst->netem && (t = p2p_netem_next_timeout(inst)) >= 0 && t < next) next = t;
+
+    // TURN TCP/TLS：连接建立中、发送积压、TLS 已解密未读取的数据
+    for (int i = 0; i < TURN_MAX_ALLOCS; i++)
+        if ((t = p2p_turn_tcp_next_timeout(&inst->turn[i])) >= 0 && t < next) next = t;
+
+    if (p2p_lp_idle(inst, now_ms)) next = p2p_lp_align(now_ms, next);
+    return next;
+}
+
+int p2p_collect_fds(struct p2p_instance *inst, p2p_fd_t *fds, int max) {
+
+    int n = p2p_udp_poll_fds(inst, fds, max);
+
+    bool connecting; sock_t sig_fd;
+    if (inst->sig_mode == P2P_SIGNALING_MODE_RELAY &&
+        (sig_fd = p2p_signal_relay_sock(&inst->sig_ctx.relay, &connecting)) != P_INVALID_SOCKET) {
+        if (n < max) {
+            fds[n].fd = (intptr_t)sig_fd;
+            // 非阻塞 connect 进行中时等待可写
+            fds[n].events = P2P_FD_READ | (connecting ? P2P_FD_WRITE : 0);
+        }
+        n++;
+    }
+
+    // 会话 TCP 打洞：已建立的连接等待可读，同时打开进行中的尝试等待可写
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
+        const p2p_tcp_punch_t *c = s->tcp_punch;
+        if (!c) continue;
+        if (c->sock != P_INVALID_SOCKET) {
+            if (n < max) { fds[n].fd = (intptr_t)c->sock; fds[n].events = P2P_FD_READ | (c->tx_len ? P2P_FD_WRITE : 0); }
+            n++;
+        }
+        for (int i = 0; i < c->try_cnt; i++) {
+            if (c->trys[i].sock == P_INVALID_SOCKET) continue;
+            if (n < max) { fds[n].fd = (intptr_t)c->trys[i].sock; fds[n].events = P2P_FD_WRITE; }
+            n++;
+        }
+    }
+
+    // TURN TCP/TLS 连接：等待可读，连接建立中或有发送积压时等待可写
+    for (int i = 0; i < TURN_MAX_ALLOCS; i++) {
+        bool want_write;
+        sock_t fd = p2p_turn_tcp_sock(&inst->turn[i], &want_write);
+        if (fd == P_INVALID_SOCKET) continue;
+        if (n < max) { fds[n].fd = (intptr_t)fd; fds[n].events = P2P_FD_READ | (want_write ? P2P_FD_WRITE : 0); }
+        n++;
+    }
+
+    // 局域网发现：组播通告到达
+    if (inst->lan) {
+        if (n < max) { fds[n].fd = (intptr_t)p2p_lan_sock(inst); fds[n].events = P2P_FD_READ; }
+        n++;
+    }
+
+    // 共享内存门铃：同机对端写入接收环且本端已取空时收到通知
+    for (struct p2p_session *s = inst->sessions_head; inst->shm_cnt && s; s = s->next) {
+        if (!s->shm || !s->shm->bell_wait) continue;
+        if (n < max) { fds[n].fd = (intptr_t)s->shm->bell; fds[n].events = P2P_FD_READ; }
+        n++;
+    }
+
+    return n;
+}
+
+int
+p2p_get_fds(p2p_handle_t hdl, p2p_fd_t *fds, int max) {
+
+    if (!hdl || (!fds && max > 0) || max < 0) return -1;
+
+    struct p2p_instance *inst = (struct p2p_instance*)hdl;
+
+    LOCK_INST(inst);
+    int n = p2p_collect_fds(inst, fds, max);
+    UNLOCK_INST(inst);
+    return n;
+}
+
+int
+p2p_next_timeout_ms(p2p_handle_t hdl) {
+
+    if (!hdl) return -1;
+
+    struct p2p_instance *inst = (struct p2p_instance*)hdl;
+
+    LOCK_INST(inst);
+    int ms = p2p_next_timeout(inst, P_tick_ms());
+    UNLOCK_INST(inst);
+    return ms < 0 ? 0 : ms;
+}
+
+p2p_state_t
+p2p_state(p2p_session_t session) {
+    return session ? ((struct p2p_session*)session)->state : P2P_STATE_ERROR;
+}
+
+static bool session_wait(struct p2p_session *s, int kind, int timeout_ms, uint64_t start);
+
+int
+p2p_wait_state(p2p_session_t session, p2p_state_t state, int timeout_ms) {
+
+    if (!session) return -1;
+
+    struct p2p_session *s = (struct p2p_session*)session;
+    s->wait_state = (int)state;
+    bool ok = session_wait(s, P2P_WAIT_STATE, timeout_ms, P_tick_ms());
+    if (s->state == state) return 0;
+    return ok ? -1 : 1;
+}
+
+int
+p2p_nat_type(p2p_handle_t hdl) {
+    return hdl ? ((struct p2p_instance*)hdl)->nat_type : P2P_NAT_UNKNOWN;
+}
+
+p2p_probe_state_t
+p2p_probe(p2p_session_t session) {
+    if (!session) return P2P_PROBE_STATE_OFFLINE;
+    struct p2p_session *s = (struct p2p_session*)session;
+
+    // 已关闭：信令通道已断，返回 OFFLINE
+    if (s->state == P2P_STATE_CLOSED) return P2P_PROBE_STATE_OFFLINE;
+
+    // 已直连时无需探测
+    if (s->state == P2P_STATE_CONNECTED) return P2P_PROBE_STATE_CONNECTED;
+
+    // 直接返回统一状态
+    return s->probe.state;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+int
+p2p_path(p2p_session_t session) {
+    return session ? ((struct p2p_session*)session)->path_type : P2P_PATH_NONE;
+}
+
+int
+p2p_session_via(p2p_session_t session, p2p_session_t via) {
+
+    P_check(session, return -1;)
+    struct p2p_session *s = (struct p2p_session*)session;
+    struct p2p_instance *inst = s->inst;
+
+    LOCK_INST(inst);
+    ret_t ret = p2p_overlay_request(s, (struct p2p_session*)via, p2p_now_ms());
+    UNLOCK_INST(inst);
+    return ret == E_NONE ? 0 : -1;
+}
+
+int
+p2p_get_stats(p2p_session_t session, p2p_stats_t *st) {
+
+    P_check(session && st, return -1;)
+    struct p2p_session *s = (struct p2p_session*)session;
+    const reliable_t *r = &s->reliable;
+
+    memset(st, 0, sizeof(*st));
+    st->state = s->state;
+    st->path = s->path_type;
+    st->srtt_ms = r->srtt;
+    st->rttvar_ms = r->rttvar;
+    st->rto_ms = r->rto;
+    if (s->cc) {
+        st->cwnd = s->cc->cwnd(s);
+        st->ssthresh = s->tcp.ssthresh;
+    }
+    else if (s->trans == &p2p_trans_bbr) st->cwnd = s->bbr.cwnd;
+    else st->cwnd = (int64_t)r->send_window * P2P_MAX_PAYLOAD;
+    st->inflight = r->send_count;
+    st->delivery_rate = r->rs_rate;
+
+    st->bytes_sent = s->stat.bytes_sent;
+    st->bytes_recv = s->stat.bytes_recv;
+    st->packets_sent = s->stat.packets_sent;
+    st->packets_recv = s->stat.packets_recv;
+    st->retransmits = s->stat.retransmits;
+    st->ecn_ce_recv = r->ecn_ce_rx;
+    st->ecn_ce_echoed = r->ecn_ce_tx;
+
+    st->path_rtt_ms = (int)s->stat_rtt;
+    st->loss_rate = s->stat_loss;
+    st->quality = s->stat_quality;
+    st->bandwidth_bps = s->stat_bw;
+    setup_ms(s, st->setup_ms);
+    return 0;
+}
+
+static int int_cmp(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+/* 最近 P2P_SETUP_HISTORY 次建连的各里程碑分位数（样本由工作线程写入，读取时可能混入正在写入的一条） */
+static void setup_percentiles(struct p2p_instance *inst, p2p_instance_stats_t *st) {
+    uint32_t cnt = __atomic_load_n(&inst->setup_hist_cnt, __ATOMIC_ACQUIRE);
+    int n = cnt < P2P_SETUP_HISTORY ? (int)cnt : P2P_SETUP_HISTORY;
+    st->setup_count = n;
+    for (int m = 0; m < P2P_SETUP_NUM; m++) {
+        int v[P2P_SETUP_HISTORY], k = 0;
+        for (int i = 0; i < n; i++) if (inst->setup_hist[i][m] >= 0) v[k++] = inst->setup_hist[i][m];
+        if (!k) { st->setup_p50_ms[m] = st->setup_p90_ms[m] = st->setup_max_ms[m] = -1; continue; }
+        qsort(v, (size_t)k, sizeof(int), int_cmp);
+        st->setup_p50_ms[m] = v[(k - 1) * 50 / 100];
+        st->setup_p90_ms[m] = v[(k - 1) * 90 / 100];
+        st->setup_max_ms[m] = v[k - 1];
+    }
+}
+
+static void counters_add(p2p_instance_stats_t *st, p2p_counters_t *c) {
+    st->bytes_sent   += __atomic_load_n(&c->bytes_sent, __ATOMIC_RELAXED);
+    st->bytes_recv   += __atomic_load_n(&c->bytes_recv, __ATOMIC_RELAXED);
+    st->packets_sent += __atomic_load_n(&c->packets_sent, __ATOMIC_RELAXED);
+    st->packets_recv += __atomic_load_n(&c->packets_recv, __ATOMIC_RELAXED);
+    st->retransmits  += __atomic_load_n(&c->retransmits, __ATOMIC_RELAXED);
+}
+
+int
+p2p_get_instance_stats(p2p_handle_t hdl, p2p_instance_stats_t *st) {
+
+    P_check(hdl && st, return -1;)
+    struct p2p_instance *inst = (struct p2p_instance*)hdl;
+
+    memset(st, 0, sizeof(*st));
+    st->connections = inst->connections;
+    st->hibernated = __atomic_load_n(&inst->hibernated, __ATOMIC_RELAXED);
+    counters_add(st, &inst->stat);
+#ifdef P2P_THREADED
+    for (int i = 0; i < inst->worker_cnt; i++) {
+        counters_add(st, &inst->workers[i].stat);
+        st->rx_drops += inst->workers[i].rx_drops;
+    }
+#endif
+    st->kernel_drops = __atomic_load_n(&inst->kernel_drops, __ATOMIC_RELAXED);
+    st->sock_buf_bytes = inst->sock_buf_eff;
+    setup_percentiles(inst, st);
+    if (inst->arena) {
+        st->mem_bytes = __atomic_load_n(&inst->arena->bytes, __ATOMIC_RELAXED);
+        st->mem_peak_bytes = __atomic_load_n(&inst->arena->peak, __ATOMIC_RELAXED);
+        st->mem_blocks = __atomic_load_n(&inst->arena->blocks, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+int
+p2p_memory_stats(p2p_handle_t hdl, p2p_session_t session, p2p_memory_stats_t *st) {
+
+    struct p2p_instance *inst = (struct p2p_instance*)hdl;
+    struct p2p_session *s = (struct p2p_session*)session;
+    P_check(inst && st && (!s || s->inst == inst), return -1;)
+
+    p2p_mem_acct_t *m = s ? &s->mem : &inst->mem;
+    uint64_t b[P2P_MEM_NUM];
+    st->total = 0;
+    for (int i = 0; i < P2P_MEM_NUM; i++) st->total += b[i] = __atomic_load_n(&m->bytes[i], __ATOMIC_RELAXED);
+    st->session  = b[P2P_MEM_SESSION];
+    st->stream   = b[P2P_MEM_STREAM];
+    st->reliable = b[P2P_MEM_RELIABLE];
+    st->cands    = b[P2P_MEM_CANDS];
+    st->reaching = b[P2P_MEM_REACHING];
+    st->turn     = b[P2P_MEM_TURN];
+    st->dtls     = b[P2P_MEM_DTLS];
+    st->signal   = b[P2P_MEM_SIGNAL];
+    return 0;
+}
+
+bool
+p2p_is_ready(p2p_session_t session) {
+    if (!session) return false;
+
+    struct p2p_session *s = (struct p2p_session*)session;
+    if (s->state < P2P_STATE_LOST) return false;
+    if (s->trans && s->trans->is_ready) {
+        return s->trans->is_ready(s);
+    }
+    return true; // 默认准备好，如果不需要传输特定检查
+}
+
+int
+p2p_send(p2p_session_t session, const void *buf, int len) {
+    return p2p_send_flags(session, buf, len, 0);
+}
+
+/*
+ * 应用侧写入流缓冲区前后调用：休眠中的会话持锁恢复（见 p2p_session_hibernate），
+ * hold 期间工作线程不会进入休眠
+ */
+static ret_t session_hold(struct p2p_session *s) {
+    __atomic_add_fetch(&s->hib_hold, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&s->hibernated, __ATOMIC_SEQ_CST)) return E_NONE;
+
+    LOCK(s);
+    ret_t ret = p2p_session_thaw(s, p2p_now_ms());
+    UNLOCK(s);
+    if (ret != E_NONE) __atomic_sub_fetch(&s->hib_hold, 1, __ATOMIC_SEQ_CST);
+    return ret;
+}
+
+static inline void session_unhold(struct p2p_session *s) {
+    __atomic_sub_fetch(&s->hib_hold, 1, __ATOMIC_SEQ_CST);
+}
+
+/* p2p_send_flags / p2p_sendv / p2p_send_stream 公共路径：len 为各段总长 */
+static int session_sendv(struct p2p_session *s, stream_t *st, const p2p_iovec_t *iov, int cnt, int len, int flags) {
+
+    if (s->state != P2P_STATE_CONNECTED && s->state != P2P_STATE_RELAY
+        && !(s->inst->cfg.early_data && p2p_session_handshaking(s))) return -1;
+    if (st->msg_mode) return -1;
+    if (session_hold(s) != E_NONE) return -1;
+
+    // send_ring 为 SPSC 无锁环形缓冲区（应用线程生产，工作线程消费），无需实例锁
+    // 仅在扩容/空闲收缩重分配缓冲区时持锁，与工作线程互斥
+    bool idle = stream_ring_idle(&st->send_ring, &st->send_active_ts);
+    if (idle || ring_free(&st->send_ring) < len) {
+        LOCK(s);
+        if (idle) ring_shrink(&st->send_ring);
+        ring_reserve(&st->send_ring, len);
+        UNLOCK(s);
+    }
+
+    int ret = stream_writev(st, iov, cnt);
+    session_unhold(s);
+    stream_writable_arm(s, st, ret < len);
+
+    // cork 状态在数据写入后发布：工作线程看到 cork=0 时本次数据必然可见
+    int cork = (flags & P2P_SEND_MORE) ? 1 : 0;
+    if (st->cork != cork) RING_STORE_REL(&st->cork, cork);
+    if (ret > 0) { if (flags & SEND_DEFER_WAKE) session_wake_mark(s); else WAKEUP(s); }
+    return ret;
+}
+
+int
+p2p_send_flags(p2p_session_t session, const void *buf, int len, int flags) {
+
+    if (!session || !buf || len <= 0) return -1;
+
+    p2p_iovec_t iov = { buf, len };
+    struct p2p_session *s = (struct p2p_session*)session;
+    return session_sendv(s, &s->stream, &iov, 1, len, flags & ~SEND_DEFER_WAKE);
+}
+
+int
+p2p_sendv(p2p_session_t session, const p2p_iovec_t *iov, int cnt) {
+
+    if (!session || !iov || cnt <= 0) return -1;
+
+    int len = 0;
+    for (int i = 0; i < cnt; i++) {
+        if (iov[i].len < 0 || (iov[i].len > 0 && !iov[i].base) || iov[i].len > INT32_MAX - len) return -1;
+        len += iov[i].len;
+    }
+    if (len == 0) return -1;
+
+    struct p2p_session *s = (struct p2p_session*)session;
+    return session_sendv(s, &s->stream, iov, cnt, len, 0);
+}
+
+int
+p2p_flush(p2p_session_t session) {
+
+    if (!session) return -1;
+
+    struct p2p_session *s = (struct p2p_session*)session;
+    if (s->state != P2P_STATE_CONNECTED && s->state != P2P_STATE_RELAY) return -1;
+
+    // flush_req 只由应用侧递增，工作线程发完当时缓冲的全部数据后记入 flush_done
+    for (int i = 0; i < s->stream_cnt; i++) {
+        stream_t *st = stream_get(s, i);
+        RING_STORE_REL(&st->cork, 0);
+        RING_STORE_REL(&st->flush_req, st->flush_req + 1);
+    }
+    WAKEUP(s);
+    return 0;
+}
+
+int
+p2p_send_space(p2p_session_t session) {
+
+    if (!session) return -1;
+
+    struct p2p_session *s = (struct p2p_session*)session;
+    if (s->state != P2P_STATE_CONNECTED && s->state != P2P_STATE_RELAY) return -1;
+
+    int space = ring_space(&s->stream.send_ring);
+    if (s->stream.msg_mode) space -= STREAM_MSG_HDR_SIZE;
+    return space > 0 ? space : 0;
+}
+
+/*
+ * 应用侧读取前的接收缓冲区维护
+ * recv_ring 为 SPSC 无锁环形缓冲区（工作线程生产，应用线程消费），无需实例锁
+ * 工作线程请求扩容（recv_need）或空闲收缩时持锁重分配，扩容后唤醒工作线程继续投递
+ */
+static void session_recv_prepare(struct p2p_session *s, stream_t *st) {
+    int need = RING_LOAD_ACQ(&st->recv_need);
+    bool idle = stream_ring_idle(&st->recv_ring, &st->recv_active_ts);
+    if (need || idle) {
+        LOCK(s);
+        if (idle) ring_shrink(&st->recv_ring);
+        if (need) ring_reserve(&st->recv_ring, need);
+        st->recv_need = 0;
+        UNLOCK(s);
+        if (need) WAKEUP(s);
+    }
+}
+
+/* 应用侧读出 n 字节后：已通告的接收窗口接近关闭时唤醒工作线程，由其判断是否发送窗口更新 */
+static void session_recv_done(struct p2p_session *s, int n) {
+    if (n > 0 && s->reliable.ext_rwnd && RING_LOAD_ACQ(&s->reliable.rwnd_adv) < RELIABLE_RWND_UPDATE)
+        WAKEUP(s);
+}
+
+int
+p2p_recv(p2p_session_t session, void *buf, int len) {
+
+    if (!session || !buf || len <= 0) return -1;
+
+    struct p2p_session *s = (struct p2p_session*)session;
+    if (s->stream.msg_mode) return -1;
+    session_recv_prepare(s, &s->stream);
+
+    int n = stream_read(&s->stream, buf, len);
+    session_recv_done(s, n);
+    return n;
+}
+
+int
+p2p_recv_peek(p2p_session_t session, const void **ptr, int *len) {
+
+    if (!session || !ptr || !len) return -1;
 
-        // 转换：REGISTERING/ONLINE → PUNCHING（开始打洞）
-        if ((s->state == P2P_STATE_SIGNALING || s->state == P2P_STATE_WAITING)
-            && (s->nat.state == NAT_PUNCHING || s->nat.state == NAT_CONNECTING)) {
+    struct p2p_session *s = (struct p2p_session*)session;
+    if (s->stream.msg_mode) return -1;
 
-            print("I:", LA_F("State: → PUNCHING", LA_F399, 399));
-            p2p_set_state(s, P2P_STATE_PUNCHING);
-        }
+    // 借出期间缓冲区不会被重分配：扩容/收缩只发生在本线程的下一次 p2p_recv / p2p_recv_peek
+    session_recv_prepare(s, &s->stream);
+    *len = stream_peek(&s->stream, ptr);
+    if (!*len) *ptr = NULL;
+    return *len;
+}
 
-        // NAT_CONNECTED 状态转换已由 nat 模块通过 p2p_connected() 同步触发
-        // + 同步转换保证了数据包处理总是在 on_connected 事件之后发生（数据层会话一致性契约）
-        // + 此处不再需要异步协同（NAT_CONNECTED → P2P_STATE_CONNECTED）
+int
+p2p_recv_consume(p2p_session_t session, int n) {
 
-        // NAT_RELAY 状态转换已由 nat 模块通过 p2p_connected() 同步触发
-        // relay 候选也需要通过 NAT 层 connect 握手，已统一处理
+    if (!session || n < 0) return -1;
 
-        // 转换：PUNCHING → ERROR（NAT 打洞超时且无中继服务）
-        if ((s->state == P2P_STATE_PUNCHING || s->state == P2P_STATE_SIGNALING || s->state == P2P_STATE_WAITING)
-            && s->nat.state == NAT_CLOSED) {
+    struct p2p_session *s = (struct p2p_session*)session;
+    stream_consume(&s->stream, n);
+    session_recv_done(s, n);
+    return 0;
+}
 
-            print("E:", LA_F("State: → ERROR (punch timeout, no relay available)", LA_F397, 397));
-            p2p_set_state(s, P2P_STATE_ERROR);
-            // NAT_CLOSED 表示打洞失败且无信令中转服务，连接已不可恢复
-        }
+/* 非线程模式：调用线程驱动一轮 p2p_update，再在实例描述符上等待至多 ms（不超过下一截止时刻，< 0 为不限） */
+static void session_wait_pump(struct p2p_instance *inst, int ms) {
+
+    p2p_update((p2p_handle_t)inst);
+    int next = p2p_next_timeout(inst, P_tick_ms());
+    if (ms < 0 || (next >= 0 && next < ms)) ms = next;
+    if (ms <= 0) return;
+
+    p2p_fd_t fds[WAIT_MAX_FDS];
+    struct pollfd pfd[WAIT_MAX_FDS];
+    int n = p2p_collect_fds(inst, fds, WAIT_MAX_FDS);
+    if (n > WAIT_MAX_FDS) n = WAIT_MAX_FDS;
+    for (int i = 0; i < n; i++) {
+        pfd[i].fd = (sock_t)fds[i].fd;
+        pfd[i].events = (short)(((fds[i].events & P2P_FD_READ) ? POLLIN : 0) | ((fds[i].events & P2P_FD_WRITE) ? POLLOUT : 0));
+        pfd[i].revents = 0;
+    }
+    if (n > 0) poll(pfd, (unsigned)n, ms);
+    else P_usleep((uint32_t)ms * 1000);
+}
 
-        // NAT 重新连接后恢复路径（NAT_RELAY → NAT_CONNECTED）
-        if (s->state == P2P_STATE_RELAY
-            && s->nat.state == NAT_CONNECTED) {
-            
-            // 标记中继路径为降级（但不移除，保留作为备份）
-            path_manager_set_path_state(s, PATH_IDX_SIGNALING, PATH_STATE_DEGRADED);
-            
-            // 重新选择最佳路径（PUNCH 应当优先）
-            int best_path = path_manager_select_best_path(s);
-            if (best_path >= -1) {  // -1=SIGNALING, >=0=候选
-                p2p_set_active_path(s, best_path);
-                path_manager_switch_reset(s, now_ms);
-                print("I:", LA_F("State: RELAY → CONNECTED, path=PUNCH[%d]", LA_F395, 395), best_path);
-                p2p_set_state(s, P2P_STATE_CONNECTED);
-            } else {
-                print("W:", LA_F("RELAY recovery: NAT connected but no path available", LA_F346, 346));
-            }
-        }
+/*
+ * 等待 kind 条件成立，timeout_ms 从 start 起算（< 0 无限）；返回 false 表示超时（或无法打开唤醒描述符）
+ * + 线程模式阻塞于会话唤醒描述符，由驱动会话的线程唤醒；非线程模式由调用线程驱动 p2p_update
+ */
+static bool session_wait(struct p2p_session *s, int kind, int timeout_ms, uint64_t start) {
 
-        // 转换：CONNECTED/RELAY → LOST（NAT 连接丢失）
-        // NAT_LOST 表示所有数据通道都断了（PUNCH/TURN/SIGNALING），等待恢复
-        if ((s->state == P2P_STATE_CONNECTED || s->state == P2P_STATE_RELAY)
-            && s->nat.state == NAT_LOST) {
-            
-            // 标记当前活跃路径为失效
-            path_manager_set_path_state(s, s->active_path, PATH_STATE_FAILED);
-            
-            // 清除活跃路径
-            p2p_set_active_path(s, PATH_IDX_NONE);
-            
-            print("W:", LA_F("State: → LOST (all paths failed)", LA_F398, 398));
-            p2p_set_state(s, P2P_STATE_LOST);
-        }
+    for (;;) {
+        if (session_wait_ready(s, kind)) return true;
 
-        // 转换：LOST → CONNECTED（NAT 连接恢复）
-        if (s->state == P2P_STATE_LOST
-            && (s->nat.state == NAT_CONNECTED || s->nat.state == NAT_RELAY)) {
-            
-            int best_path = path_manager_select_best_path(s);
-            if (best_path >= -1) {
-                // 状态机立即切换（不走防抖）
-                p2p_set_active_path(s, best_path);
-                path_manager_switch_reset(s, now_ms);
-                print("I:", LA_F("State: LOST → CONNECTED, path=PUNCH[%d]", LA_F394, 394), best_path);
-                p2p_set_state(s, P2P_STATE_CONNECTED);
-            } else {
-                // 无可用路径，保持 LOST 状态
-                print("W:", LA_F("LOST recovery: NAT connected but no path available", LA_F317, 317));
-            }
+        int left = -1;
+        if (timeout_ms >= 0) {
+            uint64_t el = tick_diff(P_tick_ms(), start);
+            if (el >= (uint64_t)timeout_ms) return false;
+            left = timeout_ms - (int)el;
         }
 
-        // 转换：CONNECTED/RELAY/LOST → CLOSED
-        // + NAT FIN 和信令 FIN 都归一化为 NAT_CLOSED，统一在此处理
-        if (s->state >= P2P_STATE_LOST
-            && s->nat.state == NAT_CLOSED) {
-            peer_disconnect(s);
+#ifdef P2P_THREADED
+        if (s->inst->cfg.threaded) {
+            p2p_waiter_t *w = &s->waiters[kind];
+            if (p2p_waiter_open(w) != E_NONE) return false;
+
+            __atomic_add_fetch(&s->inst->wait_cnt, 1, __ATOMIC_SEQ_CST);
+            __atomic_store_n(&w->armed, 1, __ATOMIC_SEQ_CST);
+            if (!session_wait_ready(s, kind)) p2p_waiter_block(w, left);
+            __atomic_store_n(&w->armed, 0, __ATOMIC_SEQ_CST);
+            __atomic_sub_fetch(&s->inst->wait_cnt, 1, __ATOMIC_SEQ_CST);
+            continue;
         }
+#endif
+        session_wait_pump(s->inst, left);
+    }
+}
 
-        /* ========================================================================
-        * 阶段 6：数据传输（应用层数据收发）
-        * ======================================================================== */
+int
+p2p_recv_wait(p2p_session_t session, void *buf, int len, int timeout_ms) {
 
-        // 发送数据：数据流层 → 传输层 flush 写入
-        if (s->state > P2P_STATE_LOST) {
-            
-            // 如果使用高级传输层（DTLS、SCTP、PseudoTCP）
-            if (s->trans && s->trans->send_data) {
-
-                // 传输层就绪检查：DTLS 握手完成前不 drain 数据，避免丢失
-                int ready = !s->trans->is_ready || s->trans->is_ready(s);
-                if (ready) {
-                    // 由高级传输模块自行处理流的数据
-                    n = ring_read(&s->stream.send_ring, buf, sizeof(buf));
-                    if (n > 0) {
-                        int sent = s->trans->send_data(s, buf, n);
-                        if (sent > 0) {
-                            s->stream.pending_bytes -= n;
-                            s->stream.send_offset += n;
-                        } else {
-                            // send_data 失败，数据已从 ring 消费，记录丢失
-                            print("W:", LA_F("transport send_data failed, %d bytes dropped", LA_F468, 468), n);
-                        }
-                    }
-                }
-            }
-            // 使用基础 reliable 层
-            else stream_flush_to_reliable(s);
-        }
+    if (!session || !buf || len <= 0) return -1;
+
+    struct p2p_session *s = (struct p2p_session*)session;
+    uint64_t start = P_tick_ms();
+    for (;;) {
+        int n = p2p_recv(session, buf, len);
+        if (n != 0) return n;
+        if (s->state == P2P_STATE_CLOSED || s->state == P2P_STATE_ERROR) return -1;
+        if (!session_wait(s, P2P_WAIT_RECV, timeout_ms, start)) return 0;
+    }
+}
 
-        // 如果使用了高级传输层（如 DTLS/SCTP/PseudoTCP）
-        if (s->trans) {
+int
+p2p_send_wait(p2p_session_t session, const void *buf, int len, int timeout_ms) {
 
-            // 传输模块周期 tick（重传，拥塞控制等）
-            if (s->trans->tick) {
-                if (s->state > P2P_STATE_LOST) {
-                    s->trans->tick(s);
-                }
-            }
+    if (!session || !buf || len <= 0) return -1;
 
-            // 将高级传输层统计同步到路径管理器（Group 2: 数据层 RTT + 丢包率）
-            if (s->trans->get_stats && s->active_path >= -1) {
-                uint32_t rtt_ms = 0;
-                float loss_rate = 0.0f;
-                
-                if (s->trans->get_stats(s, &rtt_ms, &loss_rate) == 0) {
+    struct p2p_session *s = (struct p2p_session*)session;
+    uint64_t start = P_tick_ms();
+    int done = 0;
+    for (;;) {
+        int n = p2p_send(session, (const uint8_t*)buf + done, len - done);
+        if (n < 0) return done ? done : -1;
+        if ((done += n) >= len) return done;
+
+        // 等到可写空间足以放下剩余数据，或达到发送缓冲区初始容量（避免逐字节写入）
+        int rest = len - done, base = s->stream.send_ring.base;
+        s->wait_space = rest < base ? rest : base;
+        if (!session_wait(s, P2P_WAIT_SEND, timeout_ms, start)) return done;
+    }
+}
 
-                    if (rtt_ms > 0)
-                        path_manager_on_data_rtt(s, s->active_path, rtt_ms);
+/* p2p_send_msg / p2p_send_stream（消息模式）公共路径 */
+static int session_send_msg(struct p2p_session *s, stream_t *st, const void *buf, int len, int flags,
+                            uint32_t deadline) {
 
-                    // 上报数据层丢包率（之前被忽略，导致路径质量评估缺少数据层信息）
-                    if (loss_rate > 0.0f)
-                        path_manager_on_data_loss_rate(s, s->active_path, loss_rate);
-                }
-            }
-        }
-        // reliable 周期 tick：发送/重传数据包 + 发 ACK
-        // 注：仅在无高级传输层时调用。PseudoTCP 虽然 on_packet==NULL（复用 reliable 收包），
-        //     但它有自己的 tick（cwnd 控制），不能再调 reliable_tick，否则双重发送且绕过拥塞控制。
-        else reliable_tick(s);
-
-        // 接收数据：传输层 → 数据流层
-        // 注：DTLS/SCTP 直接写入 stream.recv_ring，不需要此步骤
-        //     只有基础 reliable 层需要从 reliable 缓冲区读取
-        if (!s->trans || !s->trans->on_packet) {
-            stream_feed_from_reliable(s);
-        }
+    if (s->state != P2P_STATE_CONNECTED && s->state != P2P_STATE_RELAY) return -1;
 
-        // 加密层周期 tick（DTLS 握手推进、重传定时器）
-        if (s->dtls && s->dtls->tick) {
-            s->dtls->tick(s);
-        }
+    // 整条消息须能放入扩容上限内的 send_ring（带过期时间的记录多 4 字节）
+    int hlen = STREAM_MSG_HDR_SIZE + (deadline ? STREAM_MSG_DEADLINE_SIZE : 0);
+    int need = hlen + len;
+    if (!st->msg_mode || len > st->send_ring.max - 1 - hlen) return -1;
+    if (session_hold(s) != E_NONE) return -1;
+
+    bool idle = stream_ring_idle(&st->send_ring, &st->send_active_ts);
+    if (idle || ring_free(&st->send_ring) < need) {
+        LOCK(s);
+        if (idle) ring_shrink(&st->send_ring);
+        ring_reserve(&st->send_ring, need);
+        UNLOCK(s);
+    }
 
-        /* ========================================================================
-        * 阶段 7：路径管理器维护（健康检查与路径选择）
-        * ======================================================================== */
+    int ret = stream_write_msg_at(st, buf, len, deadline);
+    session_unhold(s);
+    stream_writable_arm(s, st, ret <= 0);
+    if (ret > 0) { if (flags & SEND_DEFER_WAKE) session_wake_mark(s); else WAKEUP(s); }
+    return ret;
+}
 
-        // LOST 状态下无活跃路径（active_path = -2），恢复由 NAT 层驱动，无需路径管理器维护
-        if (s->state > P2P_STATE_LOST) { assert(s->active_path >= PATH_IDX_SIGNALING && s->path_type != P2P_PATH_NONE);
+int
+p2p_send_msg(p2p_session_t session, const void *buf, int len) {
 
-            // 路径健康检查（检测超时、失效路径）
-            path_manager_tick(s, now_ms);
-            
-            // 周期性路径重选（检查是否有更优路径）
-            if (tick_diff(now_ms, s->path_mgr.last_reselect_ms) > PATH_RESELECT_INTERVAL_MS) { 
-                s->path_mgr.last_reselect_ms = now_ms;
-
-                int best_path = path_manager_select_best_path(s);        
-                if (best_path >= PATH_IDX_SIGNALING && best_path != s->active_path) { 
-                    
-                    // 如果找到更优路径
-                    path_stats_t *new_stats = p2p_get_path_stats(s, best_path);
-                    path_stats_t *old_stats = p2p_get_path_stats(s, s->active_path);
-                    
-                    // 判断是否值得切换（性能提升显著）
-                    // 根据当前活跃路径类型查抽切换阈值
-                    const path_threshold_config_t *thr = &s->path_mgr.thresholds[s->path_type];
-                    if ((new_stats->rtt_ms < old_stats->rtt_ms - thr->rtt_threshold_ms) ||  // RTT 显著改善
-                        (old_stats->loss_rate > thr->loss_threshold) ||                     // 当前路径丢包严重
-                        (s->path_mgr.strategy == P2P_PATH_STRATEGY_CONNECTION_FIRST
-                        && new_stats->cost_score < old_stats->cost_score)                  // 直连优先模式：更低成本
-                        ) {
-
-                        /* 执行路径切换（含防抖、历史记录） */
-                        int ret = path_manager_switch_path(s, best_path, "periodic reselect", now_ms);
-                        if (ret == 0) {
-                            print("I:", LA_F("Path switched to better route (idx=%d)", LA_F341, 341), best_path);
-                        } else if (ret > 0) {
-                            print("V:", LA_F("Path switch debounced, waiting for stability", LA_F340, 340));
-                        }
-                    }
-                }
-                // 如果没有可用路径，那当前路径肯定是最后一个路径，且状态应该是 PATH_STATE_FAILED
-                else assert(best_path == s->active_path || p2p_get_path_stats(s, s->active_path)->state == PATH_STATE_FAILED);
-            }
-        } else assert(s->state != P2P_STATE_LOST || (s->active_path < PATH_IDX_SIGNALING && s->path_type == P2P_PATH_NONE));
+    if (!session || !buf || len <= 0) return -1;
 
-        s->last_update = now_ms;
+    struct p2p_session *s = (struct p2p_session*)session;
+    return session_send_msg(s, &s->stream, buf, len, 0, 0);
+}
 
-    } // for (s = inst->sessions_head; s; s = s->next)
+int
+p2p_send_msg_ttl(p2p_session_t session, const void *buf, int len, int lifetime_ms) {
 
-    /* ========================================================================
-    * 信令路径检测
-    * ======================================================================== */
+    if (!session || !buf || len <= 0) return -1;
 
-    path_manager_signaling_tick(inst, now_ms);
+    struct p2p_session *s = (struct p2p_session*)session;
+    return session_send_msg(s, &s->stream, buf, len, 0, stream_deadline(lifetime_ms, p2p_now_ms()));
+}
 
-    /* ========================================================================
-    * 阶段 8：信令输出
-    * ======================================================================== */
+static int session_recv_msg(struct p2p_session *s, stream_t *st, void *buf, int len) {
 
-    if (inst->sig_mode == P2P_SIGNALING_MODE_COMPACT) {
-        p2p_signal_compact_tick_send(inst, now_ms);
-    }
-    else if (inst->sig_mode == P2P_SIGNALING_MODE_RELAY) {
-        p2p_signal_relay_tick_send(inst, now_ms);
+    if (!st->msg_mode) return -1;
+    session_recv_prepare(s, st);
+
+    int n = stream_read_msg(st, buf, len);
+    if (n <= len) session_recv_done(s, n);
+    return n;
+}
+
+int
+p2p_send_group(p2p_handle_t hdl, const p2p_session_t *sessions, int n, const void *buf, int len) {
+
+    if (!hdl || !sessions || n < 0 || !buf || len <= 0) return -1;
+
+    struct p2p_instance *inst = (struct p2p_instance*)hdl;
+    p2p_iovec_t iov = { buf, len };
+    int ok = 0;
+    for (int i = 0; i < n; i++) {
+        struct p2p_session *s = (struct p2p_session*)sessions[i];
+        if (!s || s->inst != inst) continue;
+        int ret = s->stream.msg_mode ? session_send_msg(s, &s->stream, buf, len, SEND_DEFER_WAKE, 0)
+                                     : session_sendv(s, &s->stream, &iov, 1, len, SEND_DEFER_WAKE);
+        if (ret == len) ok++;
     }
-    else if (inst->sig_mode == P2P_SIGNALING_MODE_PUBSUB) {
-        p2p_signal_pubsub_tick_send(inst, now_ms);
+
+    // 各会话已登记到所属线程的唤醒栈：每个有待处理会话的线程只通知一次
+#ifdef P2P_THREADED
+    if (inst->cfg.threaded) {
+        for (int i = 0; i < inst->worker_cnt; i++)
+            if (session_wakes_pending(&inst->workers[i].wake_list)) p2p_worker_wakeup(&inst->workers[i]);
+        if (session_wakes_pending(&inst->wake_list)) p2p_thread_wakeup(inst);
     }
+#endif
+    return ok;
+}
 
-    /* ========================================================================
-    * 阶段 9：NAT 类型检测（后台定期运行 STUN 探测）
-    * ======================================================================== */
+int
+p2p_recv_msg(p2p_session_t session, void *buf, int len) {
 
-    if (inst->cfg.stun_server) p2p_stun_nat_detect_tick(inst, now_ms);
-    if (inst->sig_mode == P2P_SIGNALING_MODE_COMPACT)
-        p2p_signal_compact_nat_detect_tick(inst, now_ms);
+    if (!session || !buf || len < 0) return -1;
+
+    struct p2p_session *s = (struct p2p_session*)session;
+    return session_recv_msg(s, &s->stream, buf, len);
+}
+
+/*
+ * 可发送的流：须在本端与对端协商的流数量内
+ * + 有独立发送路径的传输层（send_data）须支持按流发送（send_stream），否则只有 0 号流
+ */
+static stream_t *session_tx_stream(struct p2p_session *s, int sid) {
+    if (sid < 0 || sid >= s->stream_cnt || sid >= s->reliable.peer_streams) return NULL;
+    if (sid && s->trans && s->trans->send_data && !s->trans->send_stream) return NULL;
+    return stream_get(s, sid);
+}
+
+int
+p2p_send_stream(p2p_session_t session, int sid, const void *buf, int len) {
+
+    if (!session || !buf || len <= 0) return -1;
+
+    struct p2p_session *s = (struct p2p_session*)session;
+    stream_t *st = session_tx_stream(s, sid);
+    if (!st) return -1;
+
+    if (st->msg_mode) return session_send_msg(s, st, buf, len, 0, 0);
+    p2p_iovec_t iov = { buf, len };
+    return session_sendv(s, st, &iov, 1, len, 0);
+}
+
+int
+p2p_recv_stream(p2p_session_t session, int sid, void *buf, int len) {
+
+    if (!session || !buf || len < 0) return -1;
+
+    struct p2p_session *s = (struct p2p_session*)session;
+    stream_t *st = stream_get(s, sid);
+    if (!st) return -1;
+
+    if (st->msg_mode) return session_recv_msg(s, st, buf, len);
+    if (len == 0) return -1;
+    session_recv_prepare(s, st);
+    int n = stream_read(st, buf, len);
+    session_recv_done(s, n);
+    return n;
+}
+
+int
+p2p_stream_redundant(p2p_session_t session, int sid, int mode) {
+
+    if (!session || mode < P2P_REDUNDANT_OFF || mode > P2P_REDUNDANT_AUTO) return -1;
+
+    struct p2p_session *s = (struct p2p_session*)session;
+    if (s->trans && s->trans->send_data) return -1;     // 自带发送路径的传输层不经 reliable 条目
+    stream_t *st = stream_get(s, sid);
+    if (!st) return -1;
 
+    RING_STORE_REL(&st->redundant, mode);
     return 0;
 }
 
-p2p_state_t
-p2p_state(p2p_session_t session) {
-    return session ? ((struct p2p_session*)session)->state : P2P_STATE_ERROR;
+int
+p2p_stream_priority(p2p_session_t session, int sid, int prio) {
+
+    if (!session || prio < P2P_PRIO_NORMAL || prio > P2P_PRIO_BULK) return -1;
+
+    struct p2p_session *s = (struct p2p_session*)session;
+    if (s->trans && s->trans->send_data) return -1;     // 自带发送路径的传输层不经 reliable 条目
+    stream_t *st = stream_get(s, sid);
+    if (!st) return -1;
+
+    RING_STORE_REL(&st->prio, prio);
+    return 0;
 }
 
 int
-p2p_nat_type(p2p_handle_t hdl) {
-    return hdl ? ((struct p2p_instance*)hdl)->nat_type : P2P_NAT_UNKNOWN;
+p2p_set_rate_limit(p2p_session_t session, int64_t bytes_per_sec, int64_t burst) {
+
+    if (!session || bytes_per_sec < 0 || burst < 0) return -1;
+
+    struct p2p_session *s = (struct p2p_session*)session;
+    if (s->trans && s->trans->send_data) return -1;     // 自带发送路径的传输层不经 reliable 发送节奏
+
+    __atomic_store_n(&s->shaper.burst, burst, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->shaper.rate, bytes_per_sec, __ATOMIC_RELEASE);
+    WAKEUP(s);                                          // 放宽限速后尽快发出被暂停的包
+    return 0;
 }
 
-p2p_probe_state_t
-p2p_probe(p2p_session_t session) {
-    if (!session) return P2P_PROBE_STATE_OFFLINE;
+int
+p2p_set_rate_weight(p2p_session_t session, int weight) {
+
+    if (!session || weight < 1 || weight > P2P_RATE_WEIGHT_MAX) return -1;
+
     struct p2p_session *s = (struct p2p_session*)session;
+    __atomic_store_n(&s->shaper.weight, (uint32_t)weight, __ATOMIC_RELAXED);
+    return 0;
+}
 
-    // 已关闭：信令通道已断，返回 OFFLINE
-    if (s->state == P2P_STATE_CLOSED) return P2P_PROBE_STATE_OFFLINE;
+int
+p2p_set_rate_limit_total(p2p_handle_t hdl, int64_t bytes_per_sec, int64_t burst) {
 
-    // 已直连时无需探测
-    if (s->state == P2P_STATE_CONNECTED) return P2P_PROBE_STATE_CONNECTED;
+    if (!hdl || bytes_per_sec < 0 || burst < 0) return -1;
 
-    // 直接返回统一状态
-    return s->probe.state;
+    struct p2p_instance *inst = (struct p2p_instance*)hdl;
+    __atomic_store_n(&inst->shape_burst, burst, __ATOMIC_RELAXED);
+    __atomic_store_n(&inst->shape_rate, bytes_per_sec, __ATOMIC_RELEASE);
+
+    LOCK_INST(inst);
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) WAKEUP(s);
+    UNLOCK_INST(inst);
+    return 0;
 }
 
-///////////////////////////////////////////////////////////////////////////////
+int
+p2p_stream_unordered(p2p_session_t session, int sid, int on) {
+
+    if (!session) return -1;
+
+    struct p2p_session *s = (struct p2p_session*)session;
+    if (!s->trans || !s->trans->flush) return -1;      // 仅原生多流传输层可按消息无序交付
+    stream_t *st = stream_get(s, sid);
+    if (!st || !st->msg_mode) return -1;                // 字节流无消息边界，乱序即损坏
+
+    RING_STORE_REL(&st->unordered, on ? 1 : 0);
+    return 0;
+}
 
 int
-p2p_path(p2p_session_t session) {
-    return session ? ((struct p2p_session*)session)->path_type : P2P_PATH_NONE;
+p2p_compress_ratio(p2p_session_t session) {
+
+    if (!session) return 0;
+
+    // 计数由工作线程更新，这里只做统计读取
+    const struct p2p_session *s = (const struct p2p_session*)session;
+    uint64_t raw = s->lz_raw, wire = s->lz_wire;
+    if (!s->reliable.lz || !wire) return 0;
+    return (int)(raw * 100 / wire);
 }
 
-bool
-p2p_is_ready(p2p_session_t session) {
-    if (!session) return false;
+int
+p2p_keepalive_interval(p2p_session_t session, int *binding_lifetime_ms) {
+
+    if (!session) return -1;
+
+    const struct p2p_session *s = (const struct p2p_session*)session;
+    if (binding_lifetime_ms) *binding_lifetime_ms = (int)s->inst->bind_probe.lifetime_ms;
+    return (int)nat_keepalive_ms(s);
+}
+
+int
+p2p_path_mtu(p2p_session_t session) {
+
+    if (!session) return -1;
+
+    const struct p2p_session *s = (const struct p2p_session*)session;
+    if (s->path_type != P2P_PATH_PUNCH && s->path_type != P2P_PATH_LAN) return P2P_MTU;
+    if (s->active_path < 0 || s->active_path >= s->remote_cand_cnt) return P2P_MTU;
+    int mtu = s->remote_cands[s->active_path].stats.pmtu;
+    return mtu > P2P_MTU ? mtu : P2P_MTU;
+}
+
+/* 文件收发的前置检查：0 号流字节流模式，数据经 stream_flush_to_reliable（发送）/ stream_deliver（接收） */
+static bool session_file_ok(struct p2p_session *s, int fd, int64_t offset, int64_t len, bool send) {
+    if (fd < 0 || offset < 0 || len <= 0) return false;
+    if (s->state != P2P_STATE_CONNECTED && s->state != P2P_STATE_RELAY) return false;
+    if (s->stream.msg_mode) return false;
+    if (!s->trans) return true;
+    return send ? !s->trans->send_data : !s->trans->on_packet;
+}
+
+int
+p2p_send_file(p2p_session_t session, int fd, int64_t offset, int64_t len) {
+
+    if (!session) return -1;
 
     struct p2p_session *s = (struct p2p_session*)session;
-    if (s->state < P2P_STATE_LOST) return false;
-    if (s->trans && s->trans->is_ready) {
-        return s->trans->is_ready(s);
+    if (!session_file_ok(s, fd, offset, len, true)) return -1;
+
+    // 持锁与工作线程互斥：send_ring 中此刻的数据排在文件之前
+    LOCK(s);
+    int ret = -1;
+    if (s->file_tx.fd < 0 && p2p_session_thaw(s, p2p_now_ms()) == E_NONE) {
+        stream_file_t *f = &s->file_tx;
+        f->offset = offset;
+        f->total = len;
+        f->done = 0;
+        f->pre = ring_used(&s->stream.send_ring);
+        f->fd = fd;
+        ret = 0;
     }
-    return true; // 默认准备好，如果不需要传输特定检查
+    UNLOCK(s);
+    if (ret == 0) WAKEUP(s);
+    return ret;
 }
 
 int
-p2p_send(p2p_session_t session, const void *buf, int len) {
+p2p_recv_file(p2p_session_t session, int fd, int64_t offset, int64_t len) {
 
-    if (!session || !buf || len <= 0) return -1;
+    if (!session) return -1;
 
     struct p2p_session *s = (struct p2p_session*)session;
-    if (s->state != P2P_STATE_CONNECTED && s->state != P2P_STATE_RELAY) return -1;
+    if (!session_file_ok(s, fd, offset, len, false)) return -1;
 
+    // 持锁写入 recv_ring 中已缓冲的数据，之后到达的数据由工作线程直接写入文件
     LOCK(s);
-    int ret = stream_write(&s->stream, buf, len);
+    int ret = -1;
+    if (s->file_rx.fd < 0) {
+        stream_file_t *f = &s->file_rx;
+        f->offset = offset;
+        f->total = len;
+        f->done = 0;
+        f->fd = fd;
+        ret = stream_file_recv_ring(s) < 0 ? -1 : 0;
+    }
     UNLOCK(s);
+    // 窗口可能因读出 recv_ring 而重新打开
+    if (ret == 0) WAKEUP(s);
     return ret;
 }
 
+p2p_bulk_t
+p2p_bulk_send(p2p_handle_t hdl, int fd, int64_t size) {
+
+    if (!hdl) return NULL;
+
+    struct p2p_bulk *b = NULL;
+    return bulk_create((struct p2p_instance*)hdl, true, fd, size, NULL, &b) == E_NONE ? b : NULL;
+}
+
+p2p_bulk_t
+p2p_bulk_recv(p2p_handle_t hdl, int fd, const char *state_path) {
+
+    if (!hdl) return NULL;
+
+    struct p2p_bulk *b = NULL;
+    return bulk_create((struct p2p_instance*)hdl, false, fd, 0, state_path, &b) == E_NONE ? b : NULL;
+}
+
 int
-p2p_recv(p2p_session_t session, void *buf, int len) {
+p2p_bulk_attach(p2p_bulk_t bulk, p2p_session_t session) {
 
-    if (!session || !buf || len <= 0) return -1;
+    if (!bulk || !session) return -1;
 
     struct p2p_session *s = (struct p2p_session*)session;
+    if (!session_file_ok(s, 0, 0, 1, bulk->sender)) return -1;
 
     LOCK(s);
-    int ret = stream_read(&s->stream, buf, len);
+    ret_t ret = p2p_session_thaw(s, p2p_now_ms());
+    if (ret == E_NONE) ret = bulk_attach(bulk, s);
     UNLOCK(s);
+    if (ret == E_NONE) WAKEUP(s);
+    return ret == E_NONE ? 0 : -1;
+}
+
+int
+p2p_bulk_status(p2p_bulk_t bulk, int64_t *done, int64_t *total) {
+
+    if (!bulk) return -1;
+    return bulk_status(bulk, done, total);
+}
+
+void
+p2p_bulk_close(p2p_bulk_t bulk) {
+
+    if (!bulk) return;
+
+    struct p2p_instance *inst = bulk->inst;
+    LOCK_INST(inst);
+    bulk_free(bulk);
+    UNLOCK_INST(inst);
+}
+
+int
+p2p_send_dgram(p2p_session_t session, const void *buf, int len, int lifetime_ms) {
+
+    if (!session || !buf || len <= 0 || len > P2P_DGRAM_MAX) return -1;
+
+    struct p2p_session *s = (struct p2p_session*)session;
+    if (s->state != P2P_STATE_CONNECTED && s->state != P2P_STATE_RELAY) return -1;
+
+    // dgram.send_ring 为固定容量 SPSC 缓冲区，不扩容，无需实例锁
+    int ret = dgram_write(&s->dgram, buf, len, lifetime_ms);
+    if (ret > 0) WAKEUP(s);
     return ret;
 }
 
+int
+p2p_recv_dgram(p2p_session_t session, void *buf, int len) {
+
+    if (!session || !buf || len < 0) return -1;
+
+    struct p2p_session *s = (struct p2p_session*)session;
+    return dgram_read(&s->dgram, buf, len);
+}
+
 int
 p2p_request(p2p_session_t session, uint8_t msg, const void *data, int len) {
 
     if (!session) return -1;
     struct p2p_session *s = (struct p2p_session*)session;
 
+    if (msg == P2P_MSG_FRAG) return -1;
+
     LOCK(s);
-    int ret;
-    if (s->inst->sig_mode == P2P_SIGNALING_MODE_COMPACT)
-        ret = p2p_signal_compact_request(s, msg, data, len);
-    else if (s->inst->sig_mode == P2P_SIGNALING_MODE_RELAY)
-        ret = p2p_signal_relay_request(s, msg, data, len);
+    int ret; uint16_t sid = 0;
+    if (len > P2P_MSG_DATA_MAX)
+        ret = rpc_request(s, msg, data, len, &sid);
     else
-        ret = -1;
+        ret = rpc_send_request(s, msg, data, len, &sid);
     UNLOCK(s);
-    return ret;
+    if (ret == E_NONE) WAKEUP(s);                                                   // 经直连发出时由工作线程尽快发送
+    return ret == E_NONE ? (int)sid : (ret < 0 ? ret : -1);
 }
 
 int
-p2p_response(p2p_session_t session, uint8_t code, const void *data, int len) {
+p2p_response_to(p2p_session_t session, uint16_t sid, uint8_t code, const void *data, int len) {
 
     if (!session) return -1;
     struct p2p_session *s = (struct p2p_session*)session;
 
+    if (code == P2P_MSG_FRAG) return -1;
+
     LOCK(s);
     int ret;
-    if (s->inst->sig_mode == P2P_SIGNALING_MODE_COMPACT)
-        ret = p2p_signal_compact_response(s, code, data, len);
-    else if (s->inst->sig_mode == P2P_SIGNALING_MODE_RELAY)
-        ret = p2p_signal_relay_response(s, code, data, len);
+    if (rpc_holds(s, sid) || len > P2P_MSG_DATA_MAX)
+        ret = rpc_response(s, sid, code, data, len);
     else
-        ret = -1;
+        ret = rpc_send_response(s, sid, code, data, len);
     UNLOCK(s);
+    if (ret == E_NONE) WAKEUP(s);
     return ret;
 }
 
+int
+p2p_response(p2p_session_t session, uint8_t code, const void *data, int len) {
+    return p2p_response_to(session, 0, code, data, len);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // ICE / SDP 公开接口
 ///////////////////////////////////////////////////////////////////////////////
@@ -1529,6 +3875,9 @@ p2p_import_ice_sdp(p2p_session_t session, const char *sdp_text) {
         if (idx < 0) break;
         s->remote_cands[idx] = tmp[i];
         added++;
+
+        // 会话已开始打洞：新候选按 Trickle ICE 追加打洞（批量打洞只在首次启动时遍历候选）
+        if (s->nat.state >= NAT_PUNCHING) nat_punch(s, idx);
     }
     UNLOCK(s);
 
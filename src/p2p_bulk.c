@@ -0,0 +1,433 @@
+/*
+ * 可续传分块批量传输（协议、续传状态与线程约定见 p2p_bulk.h）
+ */
+
+#define MOD_TAG "BULK"
+
+#include "p2p_internal.h"
+
+#define BULK_MAGIC          0x50325042u     /* 状态文件头 "P2PB" */
+
+#define BULK_OP_OPEN        'O'
+#define BULK_OP_INFO        'I'
+#define BULK_OP_WANT        'W'
+#define BULK_OP_CHUNK       'C'
+
+#define BULK_OPEN_SIZE      1
+#define BULK_INFO_SIZE      17
+#define BULK_WANT_SIZE      5
+#define BULK_CHUNK_SIZE     9
+#define BULK_CRC_SIZE       4
+
+enum { BULK_RX_HDR = 0, BULK_RX_DATA, BULK_RX_CRC };
+
+#ifdef P2P_THREADED
+#define BULK_LOCK(b)        P_mutex_lock(&(b)->mtx)
+#define BULK_UNLOCK(b)      P_mutex_unlock(&(b)->mtx)
+#else
+#define BULK_LOCK(b)        ((void)0)
+#define BULK_UNLOCK(b)      ((void)0)
+#endif
+
+static inline bool bit_get(const uint8_t *m, int32_t i) { return (m[i >> 3] >> (i & 7)) & 1; }
+static inline void bit_set(uint8_t *m, int32_t i)       { m[i >> 3] |= (uint8_t)(1u << (i & 7)); }
+static inline void bit_clr(uint8_t *m, int32_t i)       { m[i >> 3] &= (uint8_t)~(1u << (i & 7)); }
+
+static inline uint32_t chunk_len(const struct p2p_bulk *b, int32_t i) {
+    return i == b->count - 1 ? (uint32_t)(b->size - (int64_t)i * b->chunk) : b->chunk;
+}
+
+static inline bool link_usable(const struct p2p_session *s) {
+    return s->state == P2P_STATE_CONNECTED || s->state == P2P_STATE_RELAY;
+}
+
+/* 提供端对象标签：首块 CRC32 与大小组合（块数据读取失败返回 E_EXTERNAL） */
+static ret_t object_tag(int fd, int64_t size, uint32_t chunk, uint32_t *tag) {
+
+    int len = size < chunk ? (int)size : (int)chunk;
+    uint8_t *buf = (uint8_t *)p2p_malloc(len);
+    if (!buf) return E_OUT_OF_MEMORY;
+#if defined(_WIN32)
+    int n = _lseeki64(fd, 0, SEEK_SET) < 0 ? -1 : _read(fd, buf, (unsigned)len);
+#else
+    int n = (int)pread(fd, buf, (size_t)len, 0);
+#endif
+    if (n == len) *tag = p2p_crc32(buf, len) ^ (uint32_t)size ^ (uint32_t)((uint64_t)size >> 32);
+    p2p_free(buf);
+    return n == len ? E_NONE : E_EXTERNAL(errno);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/* 续传状态：头部与 INFO 一致时恢复位图，否则（含文件不存在）新建；无法创建时照常传输，只是不可续传 */
+static void state_open(struct p2p_bulk *b) {
+
+    int bytes = (b->count + 7) / 8;
+    uint8_t hdr[P2P_BULK_STATE_HDR];
+
+    FILE *fp = fopen(b->state_path, "r+b");
+    if (fp && fread(hdr, 1, sizeof(hdr), fp) == sizeof(hdr) && nget_l(hdr) == BULK_MAGIC
+        && nget_l(hdr + 4) == b->tag && (int64_t)nget_ll(hdr + 8) == b->size && nget_l(hdr + 16) == b->chunk
+        && (int)fread(b->done, 1, (size_t)bytes, fp) == bytes) {
+
+        for (int32_t i = 0; i < b->count; i++) if (bit_get(b->done, i)) b->done_cnt++;
+        b->state = fp;
+        print("I:", LA_F("resume from %s: %d/%d chunks done", LA_F645, 645), b->state_path, b->done_cnt, b->count);
+        return;
+    }
+    if (fp) fclose(fp);
+
+    memset(b->done, 0, (size_t)bytes);
+    b->done_cnt = 0;
+    if (!(fp = fopen(b->state_path, "w+b"))) {
+        print("W:", LA_F("state file %s not writable, transfer not resumable", LA_F646, 646), b->state_path);
+        return;
+    }
+    memset(hdr, 0, sizeof(hdr));
+    nwrite_l(hdr, BULK_MAGIC);
+    nwrite_l(hdr + 4, b->tag);
+    nwrite_ll(hdr + 8, (uint64_t)b->size);
+    nwrite_l(hdr + 16, b->chunk);
+    fwrite(hdr, 1, sizeof(hdr), fp);
+    fwrite(b->done, 1, (size_t)bytes, fp);
+    fflush(fp);
+    b->state = fp;
+}
+
+/* 逐块置位：只重写该位所在的字节 */
+static void state_mark(struct p2p_bulk *b, int32_t i) {
+    if (!b->state) return;
+    if (fseek(b->state, P2P_BULK_STATE_HDR + (long)(i >> 3), SEEK_SET) == 0) {
+        fputc(b->done[i >> 3], b->state);
+        fflush(b->state);
+    }
+}
+
+static void state_close(struct p2p_bulk *b, bool finished) {
+    if (!b->state) return;
+    fclose(b->state);
+    b->state = NULL;
+    if (finished) remove(b->state_path);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+ret_t bulk_create(struct p2p_instance *inst, bool sender, int fd, int64_t size, const char *state_path,
+                  struct p2p_bulk **out) {
+
+    if (fd < 0 || (sender && size <= 0)) return E_INVALID;
+
+    struct p2p_bulk *b = (struct p2p_bulk *)p2p_calloc(1, sizeof(*b));
+    if (!b) return E_OUT_OF_MEMORY;
+    b->inst = inst;
+    b->sender = sender;
+    b->fd = fd;
+
+    ret_t ret = E_NONE;
+    if (sender) {
+        b->size = size;
+        b->chunk = P2P_BULK_CHUNK;
+        b->count = (int32_t)((size + b->chunk - 1) / b->chunk);
+        ret = object_tag(fd, size, b->chunk, &b->tag);
+    }
+    else if (state_path && state_path[0]) {
+        size_t n = strlen(state_path) + 1;
+        if ((b->state_path = (char *)p2p_malloc(n)) != NULL) memcpy(b->state_path, state_path, n);
+        else ret = E_OUT_OF_MEMORY;
+    }
+#ifdef P2P_THREADED
+    if (ret == E_NONE && P_mutex_init(&b->mtx) != 0) ret = E_OUT_OF_MEMORY;
+#endif
+    if (ret != E_NONE) {
+        p2p_free(b->state_path);
+        p2p_free(b);
+        return ret;
+    }
+    *out = b;
+    return E_NONE;
+}
+
+/* 脱离会话（持 b->mtx）：在途块退回待取，停止该会话上的块收发 */
+static void link_drop(struct p2p_bulk *b, struct p2p_session *s) {
+
+    p2p_bulk_link_t *l = &s->bulk;
+    if (!b->sender && b->busy) {
+        for (int k = 0; k < l->want_cnt; k++) bit_clr(b->busy, l->want[k]);
+    }
+    if (b->sender ? l->cur >= 0 : l->rx == BULK_RX_DATA) {
+        stream_file_t *f = b->sender ? &s->file_tx : &s->file_rx;
+        f->fd = -1;
+    }
+    for (int i = 0; i < b->sess_cnt; i++) {
+        if (b->sess[i] == s) { b->sess[i] = b->sess[--b->sess_cnt]; break; }
+    }
+    memset(l, 0, sizeof(*l));
+}
+
+ret_t bulk_attach(struct p2p_bulk *b, struct p2p_session *s) {
+
+    if (s->inst != b->inst || s->bulk.b || s->file_tx.fd >= 0 || s->file_rx.fd >= 0) return E_INVALID;
+    if (!b->sender && ring_free(&s->stream.send_ring) < BULK_OPEN_SIZE) return E_NONE_CONTEXT;
+
+    BULK_LOCK(b);
+    ret_t ret = b->err;
+    if (ret == E_NONE && b->sess_cnt >= P2P_BULK_SESSIONS) ret = E_OUT_OF_RANGE;
+    if (ret == E_NONE) {
+        b->sess[b->sess_cnt++] = s;
+        memset(&s->bulk, 0, sizeof(s->bulk));
+        s->bulk.b = b;
+        s->bulk.cur = -1;
+        if (!b->sender) {
+            uint8_t op = BULK_OP_OPEN;
+            stream_write(&s->stream, &op, BULK_OPEN_SIZE);
+        }
+        print("I:", LA_F("%s: attached to bulk %s (%d session(s))", LA_F647, 647), s->remote_peer_id,
+              b->sender ? "send" : "recv", b->sess_cnt);
+    }
+    BULK_UNLOCK(b);
+    return ret;
+}
+
+int bulk_status(struct p2p_bulk *b, int64_t *done, int64_t *total) {
+
+    BULK_LOCK(b);
+    int64_t d = 0;
+    if (!b->sender && b->count) {
+        d = (int64_t)b->done_cnt * b->chunk;
+        if (bit_get(b->done, b->count - 1)) d -= b->chunk - chunk_len(b, b->count - 1);
+    }
+    if (done) *done = d;
+    if (total) *total = b->size;
+    int ret = b->err != E_NONE ? -1 : (!b->sender && b->count && b->done_cnt == b->count) ? 1 : 0;
+    BULK_UNLOCK(b);
+    return ret;
+}
+
+void bulk_free(struct p2p_bulk *b) {
+
+    while (b->sess_cnt) link_drop(b, b->sess[0]);
+    state_close(b, false);
+#ifdef P2P_THREADED
+    P_mutex_final(&b->mtx);
+#endif
+    p2p_free(b->done);
+    p2p_free(b->busy);
+    p2p_free(b->state_path);
+    p2p_free(b);
+}
+
+void bulk_unlink(struct p2p_session *s) {
+
+    struct p2p_bulk *b = s->bulk.b;
+    if (!b) return;
+    BULK_LOCK(b);
+    link_drop(b, s);
+    BULK_UNLOCK(b);
+}
+
+/* 对端发来不合预期的记录：流内位置已无法确定，脱离该会话 */
+static void proto_error(struct p2p_bulk *b, struct p2p_session *s, uint8_t op) {
+    print("W:", LA_F("%s: unexpected bulk record 0x%02x, detached", LA_F648, 648), s->remote_peer_id, op);
+    link_drop(b, s);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/* 接收端：首个 INFO 确定对象并载入续传状态，其后各会话的 INFO 须与之一致 */
+static bool recv_info(struct p2p_bulk *b, const uint8_t *rec) {
+
+    int64_t size = (int64_t)nget_ll(rec + 1);
+    uint32_t chunk = nget_l(rec + 9), tag = nget_l(rec + 13);
+    if (b->count) return size == b->size && chunk == b->chunk && tag == b->tag;
+
+    if (size <= 0 || !chunk || chunk > P2P_BULK_CHUNK * 64u || (size + chunk - 1) / chunk > INT32_MAX) return false;
+    int32_t count = (int32_t)((size + chunk - 1) / chunk);
+    if (!(b->done = (uint8_t *)p2p_calloc(1, (size_t)(count + 7) / 8))
+        || !(b->busy = (uint8_t *)p2p_calloc(1, (size_t)(count + 7) / 8))) {
+        p2p_free(b->done); b->done = NULL;
+        b->err = E_OUT_OF_MEMORY;
+        return false;
+    }
+    b->size = size;
+    b->chunk = chunk;
+    b->tag = tag;
+    b->count = count;
+    if (b->state_path) state_open(b);
+    print("I:", LA_F("bulk object: %lld bytes, %d chunks of %u", LA_F649, 649), (long long)size, count, chunk);
+    return true;
+}
+
+/* 从选块起点向后找未完成、未在途的块 */
+static int32_t recv_pick(struct p2p_bulk *b) {
+    for (int32_t k = 0; k < b->count; k++) {
+        int32_t i = (b->cursor + k) % b->count;
+        if (bit_get(b->done, i) || bit_get(b->busy, i)) continue;
+        bit_set(b->busy, i);
+        b->cursor = i + 1;
+        return i;
+    }
+    return -1;
+}
+
+/* 块收完：CRC 一致即置位并持久化，否则退回待取 */
+static void recv_chunk_end(struct p2p_bulk *b, struct p2p_session *s, int32_t i, bool ok) {
+
+    bit_clr(b->busy, i);
+    if (!ok) {
+        print("W:", LA_F("%s: chunk %d CRC mismatch, refetching", LA_F650, 650), s->remote_peer_id, i);
+        return;
+    }
+    if (bit_get(b->done, i)) return;
+    bit_set(b->done, i);
+    b->done_cnt++;
+    state_mark(b, i);
+    if (b->done_cnt == b->count) {
+        print("I:", LA_F("bulk transfer complete: %lld bytes", LA_F651, 651), (long long)b->size);
+        state_close(b, true);
+    }
+}
+
+static void recv_tick(struct p2p_bulk *b, struct p2p_session *s) {
+
+    p2p_bulk_link_t *l = &s->bulk;
+    ringbuf_t *rr = &s->stream.recv_ring;
+    stream_file_t *f = &s->file_rx;
+    uint8_t rec[BULK_INFO_SIZE];
+
+    for (;;) {
+        if (l->rx == BULK_RX_DATA) {
+            if (f->done < f->total) {
+                if (f->fd >= 0) break;          // 块数据未收完
+                b->err = E_UNKNOWN;             // 写入失败（已记录日志），传输终止
+                link_drop(b, s);
+                return;
+            }
+            l->rx = BULK_RX_CRC;
+        }
+        if (l->rx == BULK_RX_CRC) {
+            if (ring_used(rr) < BULK_CRC_SIZE) break;
+            ring_read(rr, rec, BULK_CRC_SIZE);
+            recv_chunk_end(b, s, l->want[0], nget_l(rec) == f->crc);
+            memmove(l->want, l->want + 1, (size_t)--l->want_cnt * sizeof(l->want[0]));
+            l->rx = BULK_RX_HDR;
+            continue;
+        }
+
+        if (ring_peek(rr, rec, 1) < 1) break;
+        int need = rec[0] == BULK_OP_INFO ? BULK_INFO_SIZE : rec[0] == BULK_OP_CHUNK ? BULK_CHUNK_SIZE : 0;
+        if (need && ring_used(rr) < need) break;
+        if (need) ring_read(rr, rec, need);
+
+        if (need == BULK_INFO_SIZE) {
+            if (recv_info(b, rec)) continue;
+            print("W:", LA_F("%s: peer offers a different object, detached", LA_F652, 652), s->remote_peer_id);
+            link_drop(b, s);
+            return;
+        }
+        int32_t i = need ? (int32_t)nget_l(rec + 1) : -1;
+        if (!need || !l->want_cnt || i != l->want[0] || nget_l(rec + 5) != chunk_len(b, i)) {
+            proto_error(b, s, rec[0]);
+            return;
+        }
+
+        // 块数据直接写入目标文件（已缓冲的部分先写入），其后的 CRC 尾照常进入 recv_ring
+        f->offset = (int64_t)i * b->chunk;
+        f->total = chunk_len(b, i);
+        f->done = 0;
+        f->crc = 0;
+        f->fd = b->fd;
+        l->rx = BULK_RX_DATA;
+        stream_file_recv_ring(s);
+    }
+
+    // 补足在途请求
+    while (b->count && b->err == E_NONE && l->want_cnt < P2P_BULK_DEPTH
+           && ring_free(&s->stream.send_ring) >= BULK_WANT_SIZE) {
+        int32_t i = recv_pick(b);
+        if (i < 0) break;
+        rec[0] = BULK_OP_WANT;
+        nwrite_l(rec + 1, (uint32_t)i);
+        stream_write(&s->stream, rec, BULK_WANT_SIZE);
+        l->want[l->want_cnt++] = i;
+    }
+}
+
+static void send_tick(struct p2p_bulk *b, struct p2p_session *s) {
+
+    p2p_bulk_link_t *l = &s->bulk;
+    stream_t *st = &s->stream;
+    stream_file_t *f = &s->file_tx;
+    uint8_t rec[BULK_INFO_SIZE];
+
+    // 当前块已全部提交 reliable：补上 CRC 尾，下一块的头部与数据紧随其后，不等待确认
+    if (l->cur >= 0 && f->done >= f->total && ring_free(&st->send_ring) >= BULK_CRC_SIZE) {
+        nwrite_l(rec, f->crc);
+        stream_write(st, rec, BULK_CRC_SIZE);
+        f->fd = -1;
+        l->cur = -1;
+    }
+    else if (l->cur >= 0 && f->fd < 0 && f->done < f->total) {
+        b->err = E_UNKNOWN;                     // 读取失败（已记录日志），传输终止
+        link_drop(b, s);
+        return;
+    }
+
+    ringbuf_t *rr = &st->recv_ring;
+    while (ring_peek(rr, rec, 1) == 1) {
+        if (rec[0] == BULK_OP_OPEN) {
+            if (ring_free(&st->send_ring) < BULK_INFO_SIZE) break;
+            ring_skip(rr, BULK_OPEN_SIZE);
+            rec[0] = BULK_OP_INFO;
+            nwrite_ll(rec + 1, (uint64_t)b->size);
+            nwrite_l(rec + 9, b->chunk);
+            nwrite_l(rec + 13, b->tag);
+            stream_write(st, rec, BULK_INFO_SIZE);
+            continue;
+        }
+        if (rec[0] != BULK_OP_WANT || l->want_cnt >= P2P_BULK_DEPTH) {
+            proto_error(b, s, rec[0]);
+            return;
+        }
+        if (ring_used(rr) < BULK_WANT_SIZE) break;
+        ring_read(rr, rec, BULK_WANT_SIZE);
+        int32_t i = (int32_t)nget_l(rec + 1);
+        if (i < 0 || i >= b->count) {
+            proto_error(b, s, rec[0]);
+            return;
+        }
+        l->want[l->want_cnt++] = i;
+    }
+
+    // 开始下一块：头部写入 send_ring，块数据随窗口逐包从文件读出（见 stream_flush_file）
+    if (l->cur < 0 && l->want_cnt && ring_free(&st->send_ring) >= BULK_CHUNK_SIZE) {
+        int32_t i = l->want[0];
+        memmove(l->want, l->want + 1, (size_t)--l->want_cnt * sizeof(l->want[0]));
+        rec[0] = BULK_OP_CHUNK;
+        nwrite_l(rec + 1, (uint32_t)i);
+        nwrite_l(rec + 5, chunk_len(b, i));
+        stream_write(st, rec, BULK_CHUNK_SIZE);
+
+        f->offset = (int64_t)i * b->chunk;
+        f->total = chunk_len(b, i);
+        f->done = 0;
+        f->crc = 0;
+        f->pre = ring_used(&st->send_ring);
+        f->fd = b->fd;
+        l->cur = i;
+    }
+}
+
+void bulk_tick(struct p2p_session *s) {
+
+    struct p2p_bulk *b = s->bulk.b;
+    BULK_LOCK(b);
+    if (!link_usable(s)) {
+        print("I:", LA_F("%s: session unusable, detached from bulk", LA_F653, 653), s->remote_peer_id);
+        link_drop(b, s);
+    }
+    else if (b->err == E_NONE) {
+        if (b->sender) send_tick(b, s);
+        else recv_tick(b, s);
+    }
+    BULK_UNLOCK(b);
+}
@@ -0,0 +1,83 @@
+/*
+ * 可续传分块批量传输（p2p_bulk_*，见 p2p.h）
+ *
+ * 对象（一个文件）按 chunk 字节切分为块，块以（对象标签 tag, 块号）寻址、以 CRC32 校验。
+ * 同一对象可挂接多个会话并行取块；挂接的会话独占其 0 号流（字节流模式），按以下记录交互：
+ *   接收端 → 提供端  OPEN   [O]
+ *   提供端 → 接收端  INFO   [I][size(8)][chunk(4)][tag(4)]
+ *   接收端 → 提供端  WANT   [W][index(4)]
+ *   提供端 → 接收端  CHUNK  [C][index(4)][len(4)] <len 字节块数据> [crc(4)]
+ * + 接收端按完成位图选取未完成、未在途的块，每个会话至多 P2P_BULK_DEPTH 个在途，提供端按请求顺序应答；
+ *   块数据经文件收发（file_tx / file_rx）直接在文件与数据包之间读写，两端沿途累计 CRC32
+ * + 块校验通过后置位续传状态文件中对应的位；状态文件与对端 INFO 不符时从头开始，全部完成后删除
+ * + 会话离开 CONNECTED / RELAY（LOST、关闭）即脱离，在途块退回待取；重新挂接（原会话或新会话）后继续
+ * + tag 由提供端以首块 CRC32 与对象大小组合得出，用于识别续传时对端提供的是否为同一对象
+ *
+ * 线程约定：会话侧逻辑在会话 tick 中执行（持会话锁），多个会话共享的位图由 b->mtx 保护（最内层锁）
+ */
+#ifndef P2P_BULK_H
+#define P2P_BULK_H
+
+#include "predefine.h"
+
+struct p2p_session;
+struct p2p_instance;
+struct p2p_bulk;
+
+#define P2P_BULK_CHUNK          (1024 * 1024)   /* 块长 */
+#define P2P_BULK_DEPTH          2               /* 每个会话的在途块上限（当前块发完即接续下一块） */
+#define P2P_BULK_SESSIONS       8               /* 一个对象可同时挂接的会话数 */
+#define P2P_BULK_STATE_HDR      24              /* 状态文件头：magic(4) tag(4) size(8) chunk(4) 保留(4)，其后为位图 */
+
+/* 会话级挂接状态 */
+typedef struct {
+    struct p2p_bulk*    b;                      // 所属传输（NULL = 未挂接）
+    uint8_t             rx;                     // 接收端：记录解析阶段（BULK_RX_*）
+    int32_t             want[P2P_BULK_DEPTH];   // 接收端：已请求未完成的块；提供端：待应答的块
+    int                 want_cnt;
+    int32_t             cur;                    // 提供端：正在发送的块（-1 = 无）
+} p2p_bulk_link_t;
+
+/* 一次传输（p2p_bulk_t） */
+struct p2p_bulk {
+    struct p2p_instance*    inst;
+    bool                    sender;             // 提供端
+    int                     fd;                 // 对象文件（应用持有）
+    int64_t                 size;               // 对象大小（接收端收到 INFO 前为 0）
+    uint32_t                chunk;              // 块长
+    uint32_t                tag;                // 对象标签
+    int32_t                 count;              // 块数（接收端收到 INFO 前为 0）
+    int32_t                 done_cnt;           // 接收端：已完成块数
+    uint8_t*                done;               // 接收端：完成位图
+    uint8_t*                busy;               // 接收端：在途位图
+    int32_t                 cursor;             // 接收端：选块起点
+    FILE*                   state;              // 接收端：续传状态文件
+    char*                   state_path;
+    ret_t                   err;                // 文件读写失败等不可恢复错误（非 E_NONE 后停止收发）
+    struct p2p_session*     sess[P2P_BULK_SESSIONS];
+    int                     sess_cnt;
+#ifdef P2P_THREADED
+    P_mutex_t               mtx;                // 保护以上状态（会话锁之内获取）
+#endif
+};
+
+/* 提供端：以 fd 中 size 字节为对象；接收端（sender = false）：写入 fd，续传状态保存在 state_path */
+ret_t bulk_create(struct p2p_instance *inst, bool sender, int fd, int64_t size, const char *state_path,
+                  struct p2p_bulk **out);
+
+/* 挂接会话（持会话锁），接收端随即发出 OPEN */
+ret_t bulk_attach(struct p2p_bulk *b, struct p2p_session *s);
+
+/* 进度：接收端为已校验完成的字节数 / 对象大小（收到 INFO 前 total = 0）；返回 1 完成，0 进行中，负值失败 */
+int   bulk_status(struct p2p_bulk *b, int64_t *done, int64_t *total);
+
+/* 脱离全部会话并释放（持全部锁） */
+void  bulk_free(struct p2p_bulk *b);
+
+/* 会话 tick：解析记录、请求与应答块；会话不再可用时脱离 */
+void  bulk_tick(struct p2p_session *s);
+
+/* 会话释放前：脱离所属传输 */
+void  bulk_unlink(struct p2p_session *s);
+
+#endif /* P2P_BULK_H */
@@ -0,0 +1,273 @@
+
+#define MOD_TAG "CC"
+
+#include "p2p_internal.h"
+
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * 可插拔拥塞控制
+ *
+ * 传输层只与 p2p_cc_ops_t 交互：
+ *   - on_ack:        每个新确认的数据包（按实际字节数计量，与在途字节数一致）
+ *   - on_loss:       超时/丢包事件
+ *   - on_ce:         对端回显的 CE 标记（cfg.ecn，见下方 ECN）
+ *   - on_rtt_sample: 每个有效 RTT 样本（非重传包）
+ *   - cwnd:          当前拥塞窗口（字节）
+ *   - pacing_rate:   发送速率（字节/秒，0 = 不限速）
+ *
+ * 状态统一保存在 s->tcp 中，cwnd/ssthresh 的含义在各算法间保持一致。
+ */
+
+#define INITIAL_CWND (2 * P2P_CC_MSS)   /* 初始拥塞窗口 */
+#define MIN_CWND (2 * P2P_CC_MSS)       /* 最小拥塞窗口 */
+
+/* 窗口型算法的默认发送节奏：1.25 * cwnd / SRTT（仅 cfg.pacing 开启时） */
+static int64_t cc_window_pacing_rate(struct p2p_session *s) {
+    if (P2P_SOPT(s, P2P_SOPT_CC, pacing) != P2P_PACING_TOKEN_BUCKET || s->reliable.srtt <= 0) return 0;
+    return (int64_t)s->tcp.cwnd * 5 / 4 * 1000 / s->reliable.srtt;
+}
+
+static int64_t cc_window_cwnd(struct p2p_session *s) {
+    return (int64_t)s->tcp.cwnd;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ECN（cfg.ecn，各窗口型算法共用）
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * + P2P_ECN_CLASSIC：CE 等同一次拥塞事件，按算法的乘性减因子减窗（每 RTT 至多一次，无需重传）
+ * + P2P_ECN_L4S：按 RTT 划分观察窗口，α = (1-g)·α + g·F（F = 窗口内 CE 标记数 / 确认包数），
+ *   窗口内有标记时 cwnd ← cwnd·(1 - α/2)（DCTCP，RFC 8257）；轻度拥塞只小幅减窗，队列保持很短
+ */
+#define ECN_G           0.0625f         /* α 增益 g = 1/16 */
+
+static void ecn_reduce(struct p2p_session *s, double factor, uint64_t now) {
+    uint32_t cwnd = (uint32_t)(s->tcp.cwnd * factor);
+    if (cwnd < MIN_CWND) cwnd = MIN_CWND;
+    s->tcp.w_max = s->tcp.cwnd;
+    s->tcp.cwnd = s->tcp.ssthresh = cwnd;
+    s->tcp.epoch_start = 0;
+    s->tcp.last_loss = now;
+    print("V:", LA_F("ECN congestion, cwnd: %u (alpha=%.3f)", LA_F628, 628), s->tcp.cwnd, (double)s->tcp.ecn_alpha);
+}
+
+static void ecn_init(struct p2p_session *s) {
+    s->tcp.ecn_alpha = 1.0f;            // 初始保守取 1：首个有标记的窗口减半
+    s->tcp.ecn_acked = 0;
+    s->tcp.ecn_marked = 0;
+    s->tcp.ecn_win_end = 0;
+}
+
+/* 每个确认包调用：L4S 模式下累计并在观察窗口结束时更新 α、按比例减窗 */
+static void ecn_on_ack(struct p2p_session *s, uint64_t now) {
+    if (s->inst->cfg.ecn != P2P_ECN_L4S) return;
+    s->tcp.ecn_acked++;
+    if (s->tcp.ecn_win_end && now < s->tcp.ecn_win_end) return;
+
+    if (s->tcp.ecn_win_end) {
+        float f = s->tcp.ecn_marked >= s->tcp.ecn_acked ? 1.0f : (float)s->tcp.ecn_marked / (float)s->tcp.ecn_acked;
+        s->tcp.ecn_alpha = (1.0f - ECN_G) * s->tcp.ecn_alpha + ECN_G * f;
+        if (s->tcp.ecn_marked) ecn_reduce(s, 1.0 - s->tcp.ecn_alpha / 2.0, now);
+    }
+    s->tcp.ecn_acked = s->tcp.ecn_marked = 0;
+    s->tcp.ecn_win_end = now + (uint64_t)(s->reliable.srtt > 0 ? s->reliable.srtt : 100);
+}
+
+static void ecn_on_ce(struct p2p_session *s, uint32_t ce, double beta, uint64_t now) {
+    if (s->inst->cfg.ecn == P2P_ECN_L4S) {
+        s->tcp.ecn_marked += ce;
+        return;
+    }
+    int rtt = s->reliable.srtt > 0 ? s->reliable.srtt : 100;
+    if (s->tcp.last_loss && tick_diff(now, s->tcp.last_loss) < (uint64_t)rtt) return;
+    ecn_reduce(s, beta, now);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// AIMD（加性增乘性减）
+///////////////////////////////////////////////////////////////////////////////
+
+static void aimd_init(struct p2p_session *s) {
+    s->tcp.cwnd = INITIAL_CWND;
+    s->tcp.ssthresh = 65535;
+    s->tcp.dup_acks = 0;
+    s->tcp.cc_state = 0; /* 慢启动阶段 */
+    s->tcp.loss_rate = 0.0f;
+    s->tcp.last_loss = 0;
+    ecn_init(s);
+}
+
+/*
+ * - 慢启动阶段 (cwnd < ssthresh): cwnd 增加确认字节数（指数增长）
+ * - 拥塞避免阶段 (cwnd >= ssthresh): cwnd 每 RTT 增加约 1 MSS（线性增长，按字节比例累加）
+ */
+static void aimd_on_ack(struct p2p_session *s, uint32_t acked, uint64_t now) {
+    if (s->tcp.cwnd == 0) return;  /* 未初始化，避免除零 */
+    if (s->tcp.cwnd < s->tcp.ssthresh) {
+        s->tcp.cwnd += acked;
+    } else {
+        s->tcp.cwnd += (uint32_t)((uint64_t)P2P_CC_MSS * acked / s->tcp.cwnd);
+    }
+    s->tcp.dup_acks = 0;
+    s->tcp.last_ack = now;
+    s->tcp.loss_rate *= 0.98f;  /* EWMA 衰减：收到 ACK → 丢包率趋向 0 */
+    ecn_on_ack(s, now);
+}
+
+/*
+ * 乘性减策略：
+ * - ssthresh 设为当前 cwnd 的一半
+ * - cwnd 重置为最小值
+ */
+static void aimd_on_loss(struct p2p_session *s, uint64_t now) {
+    (void)now;
+    s->tcp.ssthresh = s->tcp.cwnd / 2;
+    if (s->tcp.ssthresh < MIN_CWND) s->tcp.ssthresh = MIN_CWND;
+    s->tcp.cwnd = MIN_CWND;
+    s->tcp.dup_acks = 0;
+    s->tcp.loss_rate = s->tcp.loss_rate * 0.98f + 0.02f;  /* EWMA 上报：检测到丢包 */
+    print("W:", LA_F("congestion detected, new ssthresh: %u, cwnd: %u", LA_F461, 461), s->tcp.ssthresh, s->tcp.cwnd);
+}
+
+/* CE 标记：经典模式按快速恢复减半（不同于超时的窗口重置） */
+static void aimd_on_ce(struct p2p_session *s, uint32_t ce, uint64_t now) {
+    ecn_on_ce(s, ce, 0.5, now);
+}
+
+const p2p_cc_ops_t p2p_cc_aimd = {
+    .name = "AIMD",
+    .init = aimd_init,
+    .on_ack = aimd_on_ack,
+    .on_loss = aimd_on_loss,
+    .on_ce = aimd_on_ce,
+    .on_rtt_sample = NULL,
+    .cwnd = cc_window_cwnd,
+    .pacing_rate = cc_window_pacing_rate
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CUBIC（RFC 9438）
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * 拥塞避免阶段窗口按距上次丢包的时间 t 的三次函数增长：
+ *   W(t) = C * (t - K)^3 + W_max,   K = cbrt(W_max * (1 - beta) / C)
+ * + 远离 W_max 时快速增长，接近 W_max 时趋于平缓，对高 BDP 链路比 AIMD 恢复更快
+ * + Reno 友好区：估算同条件下 AIMD 的窗口 W_est，取两者较大值
+ * + 快速收敛：连续丢包且窗口未恢复到 W_max 时进一步降低 W_max，让出带宽
+ * 窗口以 MSS 为单位计算，t/K 以秒为单位。
+ */
+#define CUBIC_C         0.4
+#define CUBIC_BETA      0.7
+#define CUBIC_ALPHA     (3.0 * (1.0 - CUBIC_BETA) / (1.0 + CUBIC_BETA))
+
+/* 牛顿迭代求立方根，避免引入 libm */
+static double cc_cbrt(double x) {
+    if (x <= 0) return 0;
+    double y = x > 1 ? x / 3 : 1;
+    for (int i = 0; i < 32; i++) {
+        double n = (2 * y + x / (y * y)) / 3;
+        if (n == y) break;
+        y = n;
+    }
+    return y;
+}
+
+static void cubic_init(struct p2p_session *s) {
+    aimd_init(s);
+    s->tcp.w_max = 0;
+    s->tcp.epoch_start = 0;
+    s->tcp.last_loss = 0;
+    s->tcp.cubic_k = 0;
+    s->tcp.w_est = 0;
+}
+
+static void cubic_on_ack(struct p2p_session *s, uint32_t acked, uint64_t now) {
+    if (s->tcp.cwnd == 0) return;
+    s->tcp.dup_acks = 0;
+    s->tcp.last_ack = now;
+    s->tcp.loss_rate *= 0.98f;
+    ecn_on_ack(s, now);
+
+    if (s->tcp.cwnd < s->tcp.ssthresh) {
+        s->tcp.cwnd += acked;
+        return;
+    }
+
+    double cwnd = (double)s->tcp.cwnd / P2P_CC_MSS;
+    if (!s->tcp.epoch_start) {
+        /* 新的拥塞避免阶段：以当前窗口为起点 */
+        s->tcp.epoch_start = now;
+        double w_max = (double)s->tcp.w_max / P2P_CC_MSS;
+        s->tcp.cubic_k = cwnd < w_max ? cc_cbrt((w_max - cwnd) / CUBIC_C) : 0;
+        if (cwnd > w_max) s->tcp.w_max = s->tcp.cwnd;
+        s->tcp.w_est = cwnd;
+    }
+
+    /* 目标取一个 RTT 之后的 W(t)，且单 RTT 内最多增长 50% */
+    int rtt = s->reliable.srtt > 0 ? s->reliable.srtt : 100;
+    double t = (double)(tick_diff(now, s->tcp.epoch_start) + (uint64_t)rtt) / 1000.0;
+    double d = t - s->tcp.cubic_k;
+    double target = CUBIC_C * d * d * d + (double)s->tcp.w_max / P2P_CC_MSS;
+    if (target > 1.5 * cwnd) target = 1.5 * cwnd;
+
+    double segs = (double)acked / P2P_CC_MSS;
+    s->tcp.w_est += CUBIC_ALPHA * segs / cwnd;
+
+    double next = cwnd;
+    if (target > cwnd) next += (target - cwnd) * segs / cwnd;
+    else next += 0.01 * segs / cwnd;
+    if (s->tcp.w_est > next) next = s->tcp.w_est;
+
+    s->tcp.cwnd = (uint32_t)(next * P2P_CC_MSS);
+}
+
+/*
+ * 乘性减（beta = 0.7）
+ * + 同一 RTT 内的多次超时只视为一次拥塞事件，避免窗口连续坍缩
+ */
+static void cubic_on_loss(struct p2p_session *s, uint64_t now) {
+    int rtt = s->reliable.srtt > 0 ? s->reliable.srtt : 100;
+    s->tcp.loss_rate = s->tcp.loss_rate * 0.98f + 0.02f;
+    s->tcp.dup_acks = 0;
+    if (s->tcp.last_loss && tick_diff(now, s->tcp.last_loss) < (uint64_t)rtt) return;
+    s->tcp.last_loss = now;
+
+    if (s->tcp.w_max && s->tcp.cwnd < s->tcp.w_max)
+        s->tcp.w_max = (uint32_t)(s->tcp.cwnd * (1.0 + CUBIC_BETA) / 2.0);   /* 快速收敛 */
+    else
+        s->tcp.w_max = s->tcp.cwnd;
+
+    uint32_t cwnd = (uint32_t)(s->tcp.cwnd * CUBIC_BETA);
+    if (cwnd < MIN_CWND) cwnd = MIN_CWND;
+    s->tcp.cwnd = s->tcp.ssthresh = cwnd;
+    s->tcp.epoch_start = 0;
+    print("W:", LA_F("congestion detected, new ssthresh: %u, cwnd: %u", LA_F461, 461), s->tcp.ssthresh, s->tcp.cwnd);
+}
+
+static void cubic_on_ce(struct p2p_session *s, uint32_t ce, uint64_t now) {
+    ecn_on_ce(s, ce, CUBIC_BETA, now);
+}
+
+const p2p_cc_ops_t p2p_cc_cubic = {
+    .name = "CUBIC",
+    .init = cubic_init,
+    .on_ack = cubic_on_ack,
+    .on_loss = cubic_on_loss,
+    .on_ce = cubic_on_ce,
+    .on_rtt_sample = NULL,
+    .cwnd = cc_window_cwnd,
+    .pacing_rate = cc_window_pacing_rate
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+const p2p_cc_ops_t* p2p_cc_find(int algo) {
+    switch (algo) {
+    case P2P_CC_CUBIC: return &p2p_cc_cubic;
+    case P2P_CC_AIMD:
+    default:           return &p2p_cc_aimd;
+    }
+}
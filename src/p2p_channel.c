@@ -9,7 +9,8 @@ ret_t p2p_udp_send_packet(struct p2p_instance *inst, const struct sockaddr_in *a
                           uint8_t type, uint8_t flags, uint16_t seq,
                           const void *payload, int payload_len) {
 
-    if (P2P_HDR_SIZE + payload_len > P2P_MTU) return E_INVALID;
+    // 直连 UDP 上限为 P2P_MTU_MAX：超过 P2P_MTU 的包只发往已探测确认的路径（见 nat_pmtu_payload）
+    if (P2P_HDR_SIZE + payload_len > P2P_MTU_MAX) return E_INVALID;
 
     uint8_t hdr[4]; int n = 1;
     p2p_pkt_hdr_encode(hdr, type, flags, seq);
@@ -18,7 +19,31 @@ ret_t p2p_udp_send_packet(struct p2p_instance *inst, const struct sockaddr_in *a
     if (payload_len > 0 && payload)
         P_msg_set(&msgs[n++], payload, payload_len);
 
-    return P_msg_send_to(p2p_udp_default_fd(inst), msgs, n, addr);
+    return p2p_udp_send_msgs(inst, addr, msgs, n);
+}
+
+ret_t p2p_udp_send_packet_sock(struct p2p_instance *inst, int cand_sock, const struct sockaddr_in *addr,
+                               uint8_t type, uint8_t flags, uint16_t seq,
+                               const void *payload, int payload_len) {
+
+    if (!cand_sock) return p2p_udp_send_packet(inst, addr, type, flags, seq, payload, payload_len);
+
+    // 端口预测套接字不参与发送合并，直接发出
+    int idx = inst->predict_base + cand_sock - 1;
+    if (!inst->predict_base || cand_sock > NAT_PREDICT_SOCKS || idx >= inst->sock_cnt) return E_NONE_CONTEXT;
+    if (P2P_HDR_SIZE + payload_len > P2P_MTU_MAX) return E_INVALID;
+
+    uint8_t buf[P2P_MTU_MAX];
+    p2p_pkt_hdr_encode(buf, type, flags, seq);
+    if (payload_len > 0 && payload)
+        memcpy(buf + P2P_HDR_SIZE, payload, payload_len);
+
+    return p2p_udp_send_to_sock(inst, idx, addr, buf, P2P_HDR_SIZE + payload_len);
+}
+
+/* 活跃直连路径绑定的发送套接字 */
+static inline int active_sock(const struct p2p_session *s) {
+    return s->active_path >= 0 && s->active_path < s->remote_cand_cnt ? s->remote_cands[s->active_path].sock : 0;
 }
 
 ret_t p2p_turn_send_packet(struct p2p_instance *inst, const struct sockaddr_in *addr,
@@ -35,11 +60,32 @@ ret_t p2p_turn_send_packet(struct p2p_instance *inst, const struct sockaddr_in *
     if (payload_len > 0 && payload)
         P_msg_set(&msgs[n++], payload, payload_len);
 
-    return p2p_turn_send_indication(inst, addr, msgs, n);
+    return p2p_turn_send(inst, addr, msgs, n);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
+/*
+ * 超出当前路径负载上限的 DATA（按更大的路径 MTU 组包后经其他路径发出、或黑洞回退时仍在途的包）
+ * 拆为 P2P_DATA_FLAG_PART 分段：每段 [idx][cnt][chunk] 各自经 p2p_send_packet 加密 / 中转适配，
+ * 接收方收齐后按原序列号交给传输层；任一段丢失由 reliable 层整包重传
+ */
+static int send_data_parts(struct p2p_session *s, const struct sockaddr_in *addr, uint8_t flags, uint16_t seq,
+                           const uint8_t *payload, int payload_len, uint64_t now_ms) {
+    uint8_t part[2 + P2P_DATA_PART_SIZE];
+    int cnt = (payload_len + (int)P2P_DATA_PART_SIZE - 1) / (int)P2P_DATA_PART_SIZE, ret = 0;
+    for (int i = 0; i < cnt; i++) {
+        int off = i * (int)P2P_DATA_PART_SIZE;
+        int n = payload_len - off < (int)P2P_DATA_PART_SIZE ? payload_len - off : (int)P2P_DATA_PART_SIZE;
+        part[0] = (uint8_t)i;
+        part[1] = (uint8_t)cnt;
+        memcpy(part + 2, payload + off, n);
+        int r = p2p_send_packet(s, addr, P2P_PKT_DATA, flags | P2P_DATA_FLAG_PART, seq, part, 2 + n, now_ms);
+        if (r < 0) ret = r;
+    }
+    return ret;
+}
+
 /*
  * p2p_send_packet — 统一发送入口
  *
@@ -50,19 +96,43 @@ ret_t p2p_turn_send_packet(struct p2p_instance *inst, const struct sockaddr_in *
  *   1. DTLS 加密 → encrypt_send → p2p_send_dtls_record
  *   2. TURN 中继（P2P_PATH_RELAY + TURN_ALLOCATED）→ Send Indication
  *   3. Compact 信令转发（P2P_PATH_SIGNALING）→ session_id 封装
- *   4. 直连 → p2p_udp_send_packet
+ *   4. TCP 打洞连接（P2P_PATH_TCP）→ 长度前缀帧
+ *   5. 同主机共享内存（P2P_PATH_SHM）→ 环内长度前缀帧
+ *   6. 直连 → p2p_udp_send_packet
+ *
+ * 包合并（cfg.bundle）开启且处于数据传输阶段时，可合并的包先进入合并缓冲区（见 bundle_push）
  */
+static int send_link(struct p2p_session *s, const struct sockaddr_in *addr,
+                     uint8_t type, uint8_t flags, uint16_t seq,
+                     const void *payload, int payload_len);
+static bool bundle_push(struct p2p_session *s, const struct sockaddr_in *addr,
+                        uint8_t type, uint8_t flags, uint16_t seq, const void *payload, int payload_len);
+
 int p2p_send_packet(struct p2p_session *s, const struct sockaddr_in *addr,
                        uint8_t type, uint8_t flags, uint16_t seq,
                        const void *payload, int payload_len, uint64_t now_ms) {
 
+    /* 超出活跃路径上限的 DATA 分段发送（见 nat_pmtu_payload） */
+    if (type == P2P_PKT_DATA && payload_len > nat_pmtu_payload(s))
+        return send_data_parts(s, addr, flags, seq, (const uint8_t *)payload, payload_len, now_ms);
+
     /* 统计：数据包和非 RTT 追踪的控制包流量 */
     path_manager_on_packet_send(s, s->active_path, seq, now_ms, payload_len, false);
+    P2P_TRACE(s, P2P_TRACE_PKT_TX, type, seq, payload_len, s->active_path, 0, 0, NULL);
+
+    if (s->bundle.open && bundle_push(s, addr, type, flags, seq, payload, payload_len)) return 0;
+    return send_link(s, addr, type, flags, seq, payload, payload_len);
+}
 
-    /* 加密路径: 有 payload 时加密，控制包（CONN/CONN_ACK）无 payload 不加密 */
-    if (payload && s->dtls && s->dtls->is_ready(s)) {
+/* 按活跃路径类型完成加密与中转适配后发出（p2p_send_packet 与合并帧共用） */
+static int send_link(struct p2p_session *s, const struct sockaddr_in *addr,
+                     uint8_t type, uint8_t flags, uint16_t seq,
+                     const void *payload, int payload_len) {
 
-        uint8_t plain[P2P_HDR_SIZE + P2P_MAX_PAYLOAD];
+    /* 加密路径: 仅 DATA/ACK/DGRAM/FEC 及其合并帧加密，控制包（CONN/CONN_ACK 及其能力通告）不加密 */
+    if (payload && (p2p_bundle_type(type) || type == P2P_PKT_BUNDLE) && s->dtls && s->dtls->is_ready(s)) {
+
+        uint8_t plain[P2P_HDR_SIZE + P2P_PMTU_PAYLOAD_MAX];
         p2p_pkt_hdr_encode(plain, type, flags, seq);
         if (payload_len > 0)
             memcpy(plain + P2P_HDR_SIZE, payload, payload_len);
@@ -72,7 +142,7 @@ int p2p_send_packet(struct p2p_session *s, const struct sockaddr_in *addr,
 
     /* TURN 中继路径: 将原始 P2P 包通过 Send Indication 发送 */
     if (s->path_type == P2P_PATH_RELAY) {
-        if (s->inst->turn.state != TURN_ALLOCATED) {
+        if (!p2p_turn_active(s->inst)) {
             print("E:", LA_F("RELAY path but TURN not allocated", LA_F344, 344));
             return -1;
         }
@@ -88,7 +158,158 @@ int p2p_send_packet(struct p2p_session *s, const struct sockaddr_in *addr,
         return s->inst->signaling_relay_fn(s, type, flags, seq, payload, payload_len);
     }
 
-    return p2p_udp_send_packet(s->inst, addr, type, flags, seq, payload, payload_len);
+    if (s->path_type == P2P_PATH_TCP)
+        return p2p_tcp_send_packet(s, type, flags, seq, payload, payload_len);
+
+    if (s->path_type == P2P_PATH_SHM)
+        return p2p_shm_send_packet(s, type, flags, seq, payload, payload_len);
+
+    /* 叠加中继路径: 始终前置 session_id，中转端据此转发、对端据此派发 */
+    if (s->path_type == P2P_PATH_OVERLAY) {
+        uint8_t ms_buf[P2P_SESS_ID_PSZ + P2P_PMTU_PAYLOAD_MAX];
+        if (P2P_SESS_ID_PSZ + payload_len > (int)sizeof(ms_buf)) return -1;
+        nwrite_l(ms_buf, s->id);
+        if (payload_len > 0) memcpy(ms_buf + P2P_SESS_ID_PSZ, payload, payload_len);
+        return p2p_udp_send_packet_sock(s->inst, active_sock(s), addr, type, flags | P2P_FLAG_SESSION, seq,
+                                        ms_buf, P2P_SESS_ID_PSZ + payload_len);
+    }
+
+    return p2p_udp_send_packet_sock(s->inst, active_sock(s), addr, type, flags, seq, payload, payload_len);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/* 合并帧只用于逐包计费的数据报路径（TCP / 共享内存本身按长度成帧，信令中转另有 BULK） */
+static inline bool bundle_path(const struct p2p_session *s) {
+    return s->path_type == P2P_PATH_PUNCH || s->path_type == P2P_PATH_LAN
+        || s->path_type == P2P_PATH_RELAY || s->path_type == P2P_PATH_OVERLAY;
+}
+
+/* 经合并缓冲区的目的路径发出（拼装后活跃路径可能已被 p2p_send_packet_path 临时切换） */
+static int bundle_send(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
+                       const void *payload, int payload_len) {
+    p2p_bundle_t *b = &s->bundle;
+    if (b->path == s->active_path) return send_link(s, &b->addr, type, flags, seq, payload, payload_len);
+
+    int saved_path = s->active_path;
+    p2p_path_type_t saved_type = s->path_type;
+    struct sockaddr_in saved_addr = s->active_addr;
+
+    s->active_path = b->path;
+    s->path_type = p2p_get_path_type(s, b->path);
+    s->active_addr = b->addr;
+    int ret = send_link(s, &s->active_addr, type, flags, seq, payload, payload_len);
+
+    s->active_path = saved_path;
+    s->path_type = saved_type;
+    s->active_addr = saved_addr;
+    return ret;
+}
+
+/* 发出缓冲中的包：只有一个时原样发出，否则合为一个 BUNDLE */
+static void bundle_flush(struct p2p_session *s) {
+    p2p_bundle_t *b = &s->bundle;
+    if (!b->cnt) return;
+
+    if (b->cnt == 1) {
+        p2p_packet_hdr_t hdr;
+        p2p_pkt_hdr_decode(b->buf + P2P_PKT_BUNDLE_FRAME_HDR, &hdr);
+        int off = (int)P2P_PKT_BUNDLE_FRAME_HDR + P2P_HDR_SIZE;
+        bundle_send(s, hdr.type, hdr.flags, hdr.seq, b->buf + off, b->len - off);
+    } else {
+        bundle_send(s, P2P_PKT_BUNDLE, 0, 0, b->buf, b->len);
+        b->sent++;
+        b->frames += (uint64_t)b->cnt;
+    }
+    b->len = b->cnt = 0;
+}
+
+/*
+ * 尝试将包放入合并缓冲区，返回 false 时由调用者直接发出
+ * + 不可合并的包先发出缓冲中的包，保持发送顺序
+ * + 目的路径 / 地址变化或放不下时先发出已缓冲的包
+ * + 缓冲为空时，超过负载上限一半的包直接发出（无法与其他包共用数据报）
+ */
+static bool bundle_push(struct p2p_session *s, const struct sockaddr_in *addr,
+                        uint8_t type, uint8_t flags, uint16_t seq, const void *payload, int payload_len) {
+    p2p_bundle_t *b = &s->bundle;
+
+    if (!p2p_bundle_type(type) || !s->reliable.bundle || !bundle_path(s)) {
+        bundle_flush(s);
+        return false;
+    }
+
+    int need = (int)P2P_PKT_BUNDLE_FRAME_HDR + P2P_HDR_SIZE + payload_len;
+    if (b->cnt && (b->path != s->active_path || !sockaddr_equal(&b->addr, addr) || b->len + need > b->max))
+        bundle_flush(s);
+
+    if (!b->cnt) {
+        int max = nat_pmtu_payload(s);
+        if (need * 2 > max) return false;
+        if (!b->buf && !(b->buf = (uint8_t*)p2p_malloc(P2P_PMTU_PAYLOAD_MAX))) return false;
+        b->max = max;
+        b->path = s->active_path;
+        b->addr = *addr;
+    }
+
+    uint8_t *p = b->buf + b->len;
+    nwrite_s(p, (uint16_t)(P2P_HDR_SIZE + payload_len));
+    p2p_pkt_hdr_encode(p + P2P_PKT_BUNDLE_FRAME_HDR, type, flags, seq);
+    if (payload_len > 0) memcpy(p + P2P_PKT_BUNDLE_FRAME_HDR + P2P_HDR_SIZE, payload, payload_len);
+    b->len += need;
+    b->cnt++;
+    return true;
+}
+
+void p2p_bundle_begin(struct p2p_session *s) {
+    s->bundle.open = s->inst->cfg.bundle;
+}
+
+void p2p_bundle_end(struct p2p_session *s) {
+    bundle_flush(s);
+    s->bundle.open = false;
+}
+
+void p2p_bundle_free(struct p2p_session *s) {
+    p2p_free(s->bundle.buf);
+    memset(&s->bundle, 0, sizeof(s->bundle));
+}
+
+/*
+ * p2p_send_packet_path — 经指定路径发送（多路径调度 / 冗余双发）
+ *
+ * 非活跃路径：临时将活跃路径字段指向目标路径，复用 p2p_send_packet 的加密、TURN/信令中转
+ * 适配与按路径流量统计；发送是同步的，返回前恢复。
+ */
+int p2p_send_packet_path(struct p2p_session *s, int path_idx,
+                         uint8_t type, uint8_t flags, uint16_t seq,
+                         const void *payload, int payload_len, uint64_t now_ms) {
+
+    if (path_idx == s->active_path)
+        return p2p_send_packet(s, &s->active_addr, type, flags, seq, payload, payload_len, now_ms);
+
+    const struct sockaddr_in *addr = p2p_get_path_addr(s, path_idx);
+    if (!addr) return -1;
+
+    int saved_path = s->active_path;
+    p2p_path_type_t saved_type = s->path_type;
+    struct sockaddr_in saved_addr = s->active_addr;
+
+    s->active_path = path_idx;
+    s->path_type = p2p_get_path_type(s, path_idx);
+    s->active_addr = *addr;
+    int ret = p2p_send_packet(s, &s->active_addr, type, flags, seq, payload, payload_len, now_ms);
+
+    s->active_path = saved_path;
+    s->path_type = saved_type;
+    s->active_addr = saved_addr;
+    return ret;
+}
+
+/* 记录前是否需要前置 session_id（见 p2p_send_dtls_record） */
+static inline bool record_sid(struct p2p_session *s) {
+    return s->inst->cfg.multi_session && s->path_type != P2P_PATH_SIGNALING
+        && (s->path_type == P2P_PATH_OVERLAY || !(s->dtls && s->dtls->has_cid && s->dtls->has_cid(s)));
 }
 
 /*
@@ -96,7 +317,7 @@ int p2p_send_packet(struct p2p_session *s, const struct sockaddr_in *addr,
  *
  * 加密模块（MbedTLS / OpenSSL）的 BIO 输出最终调用此函数。
  *
- * 这里 P2P_PKT_CRYPTO 包自身的 flags 和 seq 字段不使用
+ * 这里 P2P_PKT_CRYPTO 包自身的 seq 字段不使用，flags 仅用于多会话模式下携带 session_id
  * 密文所负载的明文的 flags 和 seq 被封装在加密数据中，由加密模块处理
  * 对于 signaling relay 中转添加 session_id 的情况，
  * 信令中转接口（signaling_relay_fn）会自动处理封装，无需本函数关心
@@ -104,13 +325,35 @@ int p2p_send_packet(struct p2p_session *s, const struct sockaddr_in *addr,
 void p2p_send_dtls_record(struct p2p_session *s, const struct sockaddr_in *addr,
                        const void *dtls_record, int record_len) {
 
+    /* TCP 连接 / 共享内存环：按会话独占，不需要 session_id / CID 派发 */
+    if (s->path_type == P2P_PATH_TCP) {
+        p2p_tcp_send_packet(s, P2P_PKT_CRYPTO, 0, 0, dtls_record, record_len);
+        return;
+    }
+    if (s->path_type == P2P_PATH_SHM) {
+        p2p_shm_send_packet(s, P2P_PKT_CRYPTO, 0, 0, dtls_record, record_len);
+        return;
+    }
+
+    /* 多会话且记录不自带 CID：前置 session_id，接收方按 ID 而非来源地址派发（叠加中继路径始终前置，供中转端转发） */
+    uint8_t flags = 0;
+    uint8_t ms_buf[P2P_SESS_ID_PSZ + P2P_PMTU_PAYLOAD_MAX];
+    if (record_sid(s)) {
+        if (P2P_SESS_ID_PSZ + record_len > (int)sizeof(ms_buf)) return;
+        nwrite_l(ms_buf, s->id);
+        memcpy(ms_buf + P2P_SESS_ID_PSZ, dtls_record, record_len);
+        dtls_record = ms_buf;
+        record_len += (int)P2P_SESS_ID_PSZ;
+        flags = P2P_FLAG_SESSION;
+    }
+
     /* TURN 中继: CRYPTO 包通过 Send Indication 发送 */
     if (s->path_type == P2P_PATH_RELAY) {
-        if (s->inst->turn.state != TURN_ALLOCATED) {
+        if (!p2p_turn_active(s->inst)) {
             print("W:", LA_F("RELAY path but TURN not allocated (dtls)", LA_F345, 345));
             return;
         }
-        p2p_turn_send_packet(s->inst, addr, P2P_PKT_CRYPTO, 0, 0, dtls_record, record_len);
+        p2p_turn_send_packet(s->inst, addr, P2P_PKT_CRYPTO, flags, 0, dtls_record, record_len);
         return;
     }
 
@@ -124,5 +367,38 @@ void p2p_send_dtls_record(struct p2p_session *s, const struct sockaddr_in *addr,
         return;
     }
 
-    p2p_udp_send_packet(s->inst, addr, P2P_PKT_CRYPTO, 0, 0, dtls_record, record_len);
+    p2p_udp_send_packet_sock(s->inst, active_sock(s), addr, P2P_PKT_CRYPTO, flags, 0, dtls_record, record_len);
+}
+
+/*
+ * p2p_send_dtls_record_sealed — 发送待封装的记录（内置 AEAD 后端）
+ *
+ * rec 中 seal->in 起的 seal->len 字节为明文，其后预留 tag 空间。
+ * 经默认套接字直连且处于发送合并时，明文连同封装任务入队，flush 前由加密线程池整批封装（cfg.crypto_workers）；
+ * 其余情况就地封装后按 p2p_send_dtls_record 发出
+ */
+void p2p_send_dtls_record_sealed(struct p2p_session *s, const struct sockaddr_in *addr,
+                                 uint8_t *rec, int rec_len, p2p_aead_job_t *seal) {
+
+#ifdef P2P_THREADED
+    if (s->inst->crypto && s->path_type != P2P_PATH_TCP && s->path_type != P2P_PATH_SHM && s->path_type != P2P_PATH_RELAY
+        && s->path_type != P2P_PATH_SIGNALING && !active_sock(s)) {
+
+        bool sid = record_sid(s);
+        uint8_t hdr[P2P_HDR_SIZE + P2P_SESS_ID_PSZ];
+        p2p_pkt_hdr_encode(hdr, P2P_PKT_CRYPTO, sid ? P2P_FLAG_SESSION : 0, 0);
+        if (sid) nwrite_l(hdr + P2P_HDR_SIZE, s->id);
+        int hdr_len = P2P_HDR_SIZE + (sid ? (int)P2P_SESS_ID_PSZ : 0);
+        if (hdr_len + rec_len > P2P_MTU_MAX) return;
+
+        sock_msg_t msgs[2];
+        P_msg_set(&msgs[0], hdr, hdr_len);
+        P_msg_set(&msgs[1], rec, rec_len);
+        ret_t r = p2p_udp_send_sealed(s->inst, addr, msgs, 2, seal, hdr_len + (int)(seal->in - rec));
+        if (r != E_NONE_CONTEXT) return;
+    }
+#endif
+
+    p2p_aead_job_run(seal);
+    p2p_send_dtls_record(s, addr, rec, rec_len);
 }
@@ -29,6 +29,24 @@ static inline int16_t seq_diff(uint16_t a, uint16_t b) {
     return (int16_t)(a - b);
 }
 
+/* seq32_diff: 32 位序列号差值（reliable 层内部序列号，处理回绕） */
+static inline int32_t seq32_diff(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b);
+}
+
+/*
+ * seq_expand: 将线上截断的 16 位序列号还原为 32 位
+ *
+ * 取低 16 位等于 wire、且与参考点 ref 最近（差值在 [-32768, 32767]）的值。
+ *
+ * 示例：
+ *   seq_expand(0x0005, 0x1FFF0) = 0x20005  (低 16 位回绕，进位到高位)
+ *   seq_expand(0xFFF0, 0x20005) = 0x1FFF0  (早于参考点的旧包)
+ */
+static inline uint32_t seq_expand(uint16_t wire, uint32_t ref) {
+    return ref + (uint32_t)(int32_t)seq_diff(wire, (uint16_t)ref);
+}
+
 /* 解析主机名为 IPv4 UDP 地址 */
 static inline ret_t resolve_host(const char *host, uint16_t port, struct sockaddr_in *out) {
     struct addrinfo hints, *res;
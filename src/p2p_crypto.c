@@ -40,12 +40,120 @@ static const uint32_t crc32_table[256] = {
     0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94, 0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
-uint32_t p2p_crc32(const uint8_t *data, int len) {
-    uint32_t crc = 0xffffffff;
+/* 逐字节查表（可移植回退，也用于处理各实现的首尾零散字节） */
+static uint32_t crc32_bytes(uint32_t crc, const uint8_t *data, int len) {
     for (int i = 0; i < len; i++) {
         crc = (crc >> 8) ^ crc32_table[(crc ^ data[i]) & 0xff];
     }
-    return crc ^ 0xffffffff;
+    return crc;
+}
+
+/*
+ * Slice-by-8：每次处理 8 字节，crc32_slice[k] 为多经过 k 个零字节的查表结果
+ * + 按字节拼装 32 位字，与主机字节序无关（小端平台由编译器合并为一次加载）
+ */
+static uint32_t crc32_slice[8][256];
+
+static void crc32_slice_init(void) {
+    for (int i = 0; i < 256; i++) {
+        uint32_t c = crc32_table[i];
+        crc32_slice[0][i] = c;
+        for (int k = 1; k < 8; k++) {
+            c = (c >> 8) ^ crc32_table[c & 0xff];
+            crc32_slice[k][i] = c;
+        }
+    }
+}
+
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t *data, int len) {
+    for (; len >= 8; data += 8, len -= 8) {
+        uint32_t lo = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+        uint32_t hi = (uint32_t)data[4] | (uint32_t)data[5] << 8 | (uint32_t)data[6] << 16 | (uint32_t)data[7] << 24;
+        crc = crc32_slice[7][lo & 0xff] ^ crc32_slice[6][(lo >> 8) & 0xff] ^
+              crc32_slice[5][(lo >> 16) & 0xff] ^ crc32_slice[4][lo >> 24] ^
+              crc32_slice[3][hi & 0xff] ^ crc32_slice[2][(hi >> 8) & 0xff] ^
+              crc32_slice[1][(hi >> 16) & 0xff] ^ crc32_slice[0][hi >> 24];
+    }
+    return crc32_bytes(crc, data, len);
+}
+
+/*
+ * ARMv8 CRC32 扩展（crc32b/crc32x 即 IEEE 802.3 多项式，与 STUN FINGERPRINT 一致）
+ * + 编译目标已含 CRC 扩展时直接使用；否则在 Linux 上按 HWCAP 运行时检测
+ * x86 的 SSE4.2 crc32 指令计算的是 CRC-32C（Castagnoli 多项式），结果不同，不能用于 FINGERPRINT
+ */
+#if defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__ARM_FEATURE_CRC32) || defined(__linux__))
+#define CRC32_ARM 1
+#include <arm_acle.h>
+#if !defined(__ARM_FEATURE_CRC32)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#if defined(__clang__)
+#define CRC32_ARM_TARGET __attribute__((target("crc")))
+#else
+#define CRC32_ARM_TARGET __attribute__((target("+crc")))
+#endif
+#else
+#define CRC32_ARM_TARGET
+#endif
+
+CRC32_ARM_TARGET
+static uint32_t crc32_arm(uint32_t crc, const uint8_t *data, int len) {
+    for (; len > 0 && ((uintptr_t)data & 7); data++, len--) crc = __crc32b(crc, *data);
+    for (; len >= 8; data += 8, len -= 8) {
+        uint64_t v;
+        memcpy(&v, data, 8);
+        crc = __crc32d(crc, v);
+    }
+    for (; len > 0; data++, len--) crc = __crc32b(crc, *data);
+    return crc;
+}
+
+static bool crc32_arm_supported(void) {
+#if defined(__ARM_FEATURE_CRC32)
+    return true;
+#else
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+}
+#endif
+
+/*
+ * 首次调用时选择实现：多线程同时初始化只会写入相同的表项与指针，结果一致；
+ * 指针以 release 语义发布，其他线程看到指针时表项必然可见
+ */
+typedef uint32_t (*crc32_fn)(uint32_t crc, const uint8_t *data, int len);
+static crc32_fn crc32_impl;
+
+#if defined(_MSC_VER)
+#define CRC32_IMPL_LOAD()       (*(crc32_fn volatile *)&crc32_impl)
+#define CRC32_IMPL_STORE(f)     (*(crc32_fn volatile *)&crc32_impl = (f))
+#else
+#define CRC32_IMPL_LOAD()       __atomic_load_n(&crc32_impl, __ATOMIC_ACQUIRE)
+#define CRC32_IMPL_STORE(f)     __atomic_store_n(&crc32_impl, (f), __ATOMIC_RELEASE)
+#endif
+
+static crc32_fn crc32_setup(void) {
+    crc32_fn impl = crc32_slice8;
+#ifdef CRC32_ARM
+    if (crc32_arm_supported()) impl = crc32_arm;
+#endif
+    if (impl == crc32_slice8) crc32_slice_init();
+    CRC32_IMPL_STORE(impl);
+    return impl;
+}
+
+uint32_t p2p_crc32_update(uint32_t crc, const uint8_t *data, int len) {
+    crc32_fn impl = CRC32_IMPL_LOAD();
+    if (!impl) impl = crc32_setup();
+    return impl(crc ^ 0xffffffff, data, len) ^ 0xffffffff;
+}
+
+uint32_t p2p_crc32(const uint8_t *data, int len) {
+    return p2p_crc32_update(0, data, len);
 }
 
 
@@ -156,11 +264,7 @@ void p2p_md5(const uint8_t *data, int len, uint8_t digest[16]) {
 /*
  * SHA1 Implementation (Simplified for internal use)
  */
-typedef struct {
-    uint32_t state[5];
-    uint32_t count[2];
-    unsigned char buffer[64];
-} SHA1_CTX;
+typedef p2p_sha1_ctx_t SHA1_CTX;
 
 #define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
 
@@ -208,6 +312,185 @@ static void SHA1Transform(uint32_t state[5], const unsigned char buffer[64]) {
     state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e;
 }
 
+static void sha1_blocks_ref(uint32_t state[5], const uint8_t *data, size_t n) {
+    for (; n; n--, data += 64) SHA1Transform(state, data);
+}
+
+/*
+ * x86 SHA-NI（sha1rnds4/sha1nexte/sha1msg1/sha1msg2，每条 sha1rnds4 完成 4 轮）
+ * + 状态在寄存器中按 ABCD 逆序（a 在最高 32 位）排列，E 单独放在最高 32 位
+ * + 按 CPUID.7.0:EBX[29]（SHA）与 CPUID.1:ECX[19]（SSE4.1，_mm_extract_epi32）运行时检测
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SHA1_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+
+/* 第 4k..4k+3 轮（k = 3..16）：推进消息调度并完成 4 轮 */
+#define SHA1NI_STEP(ea, eb, m0, m1, m2, m3, f) \
+    ea = _mm_sha1nexte_epu32(ea, m0); eb = abcd; \
+    m1 = _mm_sha1msg2_epu32(m1, m0); abcd = _mm_sha1rnds4_epu32(abcd, ea, f); \
+    m3 = _mm_sha1msg1_epu32(m3, m0); m2 = _mm_xor_si128(m2, m0);
+
+__attribute__((target("sha,sse4.1")))
+static void sha1_blocks_x86(uint32_t state[5], const uint8_t *data, size_t n) {
+    const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1B);
+    __m128i e0 = _mm_set_epi32((int)state[4], 0, 0, 0), e1;
+
+    for (; n; n--, data += 64) {
+        __m128i abcd_save = abcd, e0_save = e0;
+        __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data +  0)), bswap);
+        __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), bswap);
+        __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), bswap);
+        __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), bswap);
+
+        /* 0-11 轮：消息直接取自分组 */
+        e0 = _mm_add_epi32(e0, m0); e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        e1 = _mm_sha1nexte_epu32(e1, m1); e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        m0 = _mm_sha1msg1_epu32(m0, m1);
+        e0 = _mm_sha1nexte_epu32(e0, m2); e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        m1 = _mm_sha1msg1_epu32(m1, m2);
+        m0 = _mm_xor_si128(m0, m2);
+
+        /* 12-67 轮 */
+        SHA1NI_STEP(e1, e0, m3, m0, m1, m2, 0);
+        SHA1NI_STEP(e0, e1, m0, m1, m2, m3, 0);
+        SHA1NI_STEP(e1, e0, m1, m2, m3, m0, 1);
+        SHA1NI_STEP(e0, e1, m2, m3, m0, m1, 1);
+        SHA1NI_STEP(e1, e0, m3, m0, m1, m2, 1);
+        SHA1NI_STEP(e0, e1, m0, m1, m2, m3, 1);
+        SHA1NI_STEP(e1, e0, m1, m2, m3, m0, 1);
+        SHA1NI_STEP(e0, e1, m2, m3, m0, m1, 2);
+        SHA1NI_STEP(e1, e0, m3, m0, m1, m2, 2);
+        SHA1NI_STEP(e0, e1, m0, m1, m2, m3, 2);
+        SHA1NI_STEP(e1, e0, m1, m2, m3, m0, 2);
+        SHA1NI_STEP(e0, e1, m2, m3, m0, m1, 2);
+        SHA1NI_STEP(e1, e0, m3, m0, m1, m2, 3);
+        SHA1NI_STEP(e0, e1, m0, m1, m2, m3, 3);
+
+        /* 68-79 轮：调度收尾 */
+        e1 = _mm_sha1nexte_epu32(e1, m1); e0 = abcd;
+        m2 = _mm_sha1msg2_epu32(m2, m1);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+        m3 = _mm_xor_si128(m3, m1);
+        e0 = _mm_sha1nexte_epu32(e0, m2); e1 = abcd;
+        m3 = _mm_sha1msg2_epu32(m3, m2);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+        e1 = _mm_sha1nexte_epu32(e1, m3); e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+static bool sha1_x86_supported(void) {
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & (1u << 19)) || !(c & (1u << 9))) return false;
+    if (__get_cpuid_max(0, NULL) < 7) return false;
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b & (1u << 29)) != 0;
+}
+#endif
+
+/*
+ * ARMv8 SHA1 扩展（sha1c/sha1p/sha1m 每条完成 4 轮，sha1su0/sha1su1 推进消息调度）
+ * + 编译目标已含该扩展时直接使用；否则在 Linux 上按 HWCAP 运行时检测（同 CRC32）
+ */
+#if defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO) || defined(__linux__))
+#define SHA1_ARM 1
+#include <arm_neon.h>
+#if !defined(__ARM_FEATURE_SHA2) && !defined(__ARM_FEATURE_CRYPTO)
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA1
+#define HWCAP_SHA1 (1 << 5)
+#endif
+#if defined(__clang__)
+#define SHA1_ARM_TARGET __attribute__((target("sha2")))
+#else
+#define SHA1_ARM_TARGET __attribute__((target("+sha2")))
+#endif
+#else
+#define SHA1_ARM_TARGET
+#endif
+
+SHA1_ARM_TARGET
+static void sha1_blocks_arm(uint32_t state[5], const uint8_t *data, size_t n) {
+    static const uint32_t k[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+    uint32x4_t abcd = vld1q_u32(state);
+    uint32_t e = state[4];
+
+    for (; n; n--, data += 64) {
+        uint32x4_t abcd_save = abcd, m[4];
+        uint32_t e_save = e;
+        for (int i = 0; i < 4; i++) m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+
+        /* 每组 4 轮：第 g 组使用 W[4g..4g+3]，g >= 4 时由前 4 组推出 */
+        for (int g = 0; g < 20; g++) {
+            if (g >= 4) m[g & 3] = vsha1su1q_u32(vsha1su0q_u32(m[g & 3], m[(g + 1) & 3], m[(g + 2) & 3]), m[(g + 3) & 3]);
+            uint32x4_t w = vaddq_u32(m[g & 3], vdupq_n_u32(k[g / 5]));
+            uint32_t e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+            if (g < 5) abcd = vsha1cq_u32(abcd, e, w);
+            else if (g < 10 || g >= 15) abcd = vsha1pq_u32(abcd, e, w);
+            else abcd = vsha1mq_u32(abcd, e, w);
+            e = e_next;
+        }
+
+        abcd = vaddq_u32(abcd, abcd_save);
+        e += e_save;
+    }
+
+    vst1q_u32(state, abcd);
+    state[4] = e;
+}
+
+static bool sha1_arm_supported(void) {
+#if defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO)
+    return true;
+#else
+    return (getauxval(AT_HWCAP) & HWCAP_SHA1) != 0;
+#endif
+}
+#endif
+
+/* 首次使用时选择分组压缩实现（发布方式同 crc32_impl） */
+typedef void (*sha1_blocks_fn)(uint32_t state[5], const uint8_t *data, size_t n);
+static sha1_blocks_fn sha1_impl;
+
+#if defined(_MSC_VER)
+#define SHA1_IMPL_LOAD()        (*(sha1_blocks_fn volatile *)&sha1_impl)
+#define SHA1_IMPL_STORE(f)      (*(sha1_blocks_fn volatile *)&sha1_impl = (f))
+#else
+#define SHA1_IMPL_LOAD()        __atomic_load_n(&sha1_impl, __ATOMIC_ACQUIRE)
+#define SHA1_IMPL_STORE(f)      __atomic_store_n(&sha1_impl, (f), __ATOMIC_RELEASE)
+#endif
+
+static sha1_blocks_fn sha1_setup(void) {
+    sha1_blocks_fn impl = sha1_blocks_ref;
+#ifdef SHA1_X86
+    if (sha1_x86_supported()) impl = sha1_blocks_x86;
+#endif
+#ifdef SHA1_ARM
+    if (sha1_arm_supported()) impl = sha1_blocks_arm;
+#endif
+    SHA1_IMPL_STORE(impl);
+    return impl;
+}
+
+static void sha1_blocks(uint32_t state[5], const uint8_t *data, size_t n) {
+    sha1_blocks_fn impl = SHA1_IMPL_LOAD();
+    if (!impl) impl = sha1_setup();
+    impl(state, data, n);
+}
+
 static void SHA1Init(SHA1_CTX* context) {
     context->state[0] = 0x67452301;
     context->state[1] = 0xEFCDAB89;
@@ -224,29 +507,38 @@ static void SHA1Update(SHA1_CTX* context, const unsigned char* data, uint32_t le
     context->count[1] += (len >> 29);
     if ((j + len) > 63) {
         memcpy(&context->buffer[j], data, (i = 64-j));
-        SHA1Transform(context->state, context->buffer);
-        for ( ; i + 63 < len; i += 64) SHA1Transform(context->state, &data[i]);
+        sha1_blocks(context->state, context->buffer, 1);
+        uint32_t nb = (len - i) / 64;
+        if (nb) { sha1_blocks(context->state, &data[i], nb); i += nb * 64; }
         j = 0;
     } else i = 0;
     memcpy(&context->buffer[j], &data[i], len - i);
 }
 
+/* 填充 0x80 与零字节后附 64 位大端比特长度，一次写入缓冲区（至多两个分组） */
 static void SHA1Final(unsigned char digest[20], SHA1_CTX* context) {
-    uint32_t i;
-    unsigned char finalcount[8];
-    for (i = 0; i < 8; i++) finalcount[i] = (unsigned char)((context->count[(i >= 4 ? 0 : 1)] >> ((3-(i & 3)) * 8) ) & 255);
-    SHA1Update(context, (const unsigned char *)"\200", 1);
-    while ((context->count[0] & 504) != 448) SHA1Update(context, (const unsigned char *)"\0", 1);
-    SHA1Update(context, finalcount, 8);
+    uint32_t i, j = (context->count[0] >> 3) & 63;
+    unsigned char *buf = context->buffer;
+    buf[j++] = 0x80;
+    if (j > 56) {
+        memset(buf + j, 0, 64 - j);
+        sha1_blocks(context->state, buf, 1);
+        j = 0;
+    }
+    memset(buf + j, 0, 56 - j);
+    nwrite_l(buf + 56, context->count[1]);
+    nwrite_l(buf + 60, context->count[0]);
+    sha1_blocks(context->state, buf, 1);
     for (i = 0; i < 20; i++) digest[i] = (unsigned char)((context->state[i>>2] >> ((3-(i & 3)) * 8) ) & 255);
 }
 
 /*
  * HMAC-SHA1 Implementation
+ *
+ * 预先吸收 (key ^ ipad)、(key ^ opad) 两个分组并缓存 SHA1 中间状态；
+ * 每条消息只需复制状态后继续 Update/Final，省去每次两个密钥分组的压缩
  */
-void p2p_hmac_sha1(const uint8_t* key, int key_len,
-                   const uint8_t* data, int data_len,
-                   uint8_t* digest) {
+void p2p_hmac_sha1_init(p2p_hmac_sha1_ctx_t *hc, const uint8_t *key, int key_len) {
     SHA1_CTX ctx;
     uint8_t k_ipad[64], k_opad[64];
     uint8_t tk[20];
@@ -270,17 +562,32 @@ void p2p_hmac_sha1(const uint8_t* key, int key_len,
         k_opad[i] ^= 0x5c;
     }
 
-    SHA1Init(&ctx);
-    SHA1Update(&ctx, k_ipad, 64);
+    SHA1Init(&hc->inner);
+    SHA1Update(&hc->inner, k_ipad, 64);
+    SHA1Init(&hc->outer);
+    SHA1Update(&hc->outer, k_opad, 64);
+}
+
+void p2p_hmac_sha1_compute(const p2p_hmac_sha1_ctx_t *hc,
+                           const uint8_t *data, int data_len,
+                           uint8_t digest[20]) {
+    SHA1_CTX ctx = hc->inner;
     SHA1Update(&ctx, data, data_len);
     SHA1Final(digest, &ctx);
 
-    SHA1Init(&ctx);
-    SHA1Update(&ctx, k_opad, 64);
+    ctx = hc->outer;
     SHA1Update(&ctx, digest, 20);
     SHA1Final(digest, &ctx);
 }
 
+void p2p_hmac_sha1(const uint8_t* key, int key_len,
+                   const uint8_t* data, int data_len,
+                   uint8_t* digest) {
+    p2p_hmac_sha1_ctx_t hc;
+    p2p_hmac_sha1_init(&hc, key, key_len);
+    p2p_hmac_sha1_compute(&hc, data, data_len, digest);
+}
+
 
 /* ============================= Base64 ============================= */
 
@@ -351,6 +658,244 @@ int p2p_base64_decode(const char *src, size_t slen, uint8_t *dst, size_t dlen) {
 }
 
 
+/* ======================== ChaCha20-Poly1305 (RFC 8439) ======================== */
+
+static inline uint32_t load32_le(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void store32_le(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+}
+
+#define CHACHA_ROTL(v, n)   (((v) << (n)) | ((v) >> (32 - (n))))
+#define CHACHA_QR(a, b, c, d) \
+    a += b; d ^= a; d = CHACHA_ROTL(d, 16); \
+    c += d; b ^= c; b = CHACHA_ROTL(b, 12); \
+    a += b; d ^= a; d = CHACHA_ROTL(d, 8);  \
+    c += d; b ^= c; b = CHACHA_ROTL(b, 7)
+#define CHACHA_DOUBLE_ROUND(x) \
+    CHACHA_QR(x[0], x[4], x[8],  x[12]); CHACHA_QR(x[1], x[5], x[9],  x[13]); \
+    CHACHA_QR(x[2], x[6], x[10], x[14]); CHACHA_QR(x[3], x[7], x[11], x[15]); \
+    CHACHA_QR(x[0], x[5], x[10], x[15]); CHACHA_QR(x[1], x[6], x[11], x[12]); \
+    CHACHA_QR(x[2], x[7], x[8],  x[13]); CHACHA_QR(x[3], x[4], x[9],  x[14])
+
+/* 初始状态：常量(4) + key(8) + counter(1) + nonce(3) */
+static void chacha_setup(uint32_t st[16], const uint8_t key[32], const uint8_t nonce[12], uint32_t counter) {
+    st[0] = 0x61707865; st[1] = 0x3320646e; st[2] = 0x79622d32; st[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++) st[4 + i] = load32_le(key + 4 * i);
+    st[12] = counter;
+    for (int i = 0; i < 3; i++) st[13 + i] = load32_le(nonce + 4 * i);
+}
+
+/* 单块密钥流（64 字节） */
+static void chacha_block(const uint32_t st[16], uint8_t ks[64]) {
+    uint32_t x[16];
+    memcpy(x, st, sizeof(x));
+    for (int i = 0; i < 10; i++) { CHACHA_DOUBLE_ROUND(x); }
+    for (int i = 0; i < 16; i++) store32_le(ks + 4 * i, x[i] + st[i]);
+}
+
+/*
+ * 四块并行：每个向量的 4 个通道分别是 4 个连续计数器块的同一状态字，
+ * 轮函数全部为通道内运算（加/异或/移位），由编译器映射到 SSE2 / NEON 的 128 位寄存器
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__SSE2__) || defined(__ARM_NEON))
+#define CHACHA_VEC 1
+typedef uint32_t chacha_u32x4 __attribute__((vector_size(16)));
+
+static void chacha_block4(const uint32_t st[16], uint8_t ks[256]) {
+    chacha_u32x4 x[16], o[16];
+    for (int i = 0; i < 16; i++) o[i] = (chacha_u32x4){ st[i], st[i], st[i], st[i] };
+    o[12] += (chacha_u32x4){ 0, 1, 2, 3 };
+    memcpy(x, o, sizeof(x));
+    for (int i = 0; i < 10; i++) { CHACHA_DOUBLE_ROUND(x); }
+    for (int i = 0; i < 16; i++) {
+        chacha_u32x4 v = x[i] + o[i];
+        for (int b = 0; b < 4; b++) store32_le(ks + 64 * b + 4 * i, v[b]);
+    }
+}
+#endif
+
+void p2p_chacha20_xor(const uint8_t key[32], const uint8_t nonce[12], uint32_t counter,
+                      const uint8_t *in, uint8_t *out, size_t len) {
+    uint32_t st[16];
+#ifdef CHACHA_VEC
+    uint8_t ks[256];
+#else
+    uint8_t ks[64];
+#endif
+    chacha_setup(st, key, nonce, counter);
+    while (len > 0) {
+        size_t n;
+#ifdef CHACHA_VEC
+        if (len > 128) {                        // 剩余超过两块时四块并行，否则标量逐块
+            chacha_block4(st, ks);
+            st[12] += 4;
+            n = len < 256 ? len : 256;
+        } else
+#endif
+        {
+            chacha_block(st, ks);
+            st[12]++;
+            n = len < 64 ? len : 64;
+        }
+        for (size_t i = 0; i < n; i++) out[i] = in[i] ^ ks[i];
+        in += n; out += n; len -= n;
+    }
+    memset(ks, 0, sizeof(ks));
+}
+
+/*
+ * Poly1305：26 位分段的 130 位累加器（32 位乘法即可，无需 128 位整数）
+ */
+typedef struct {
+    uint32_t r[5];
+    uint32_t h[5];
+    uint32_t pad[4];
+} poly1305_t;
+
+#define POLY_HIBIT  (1u << 24)                  /* 完整分组末尾隐含的 0x01 字节（2^128） */
+
+static void poly1305_init(poly1305_t *p, const uint8_t key[32]) {
+    // r 按 RFC 8439 钳位
+    p->r[0] = (load32_le(key +  0)     ) & 0x3ffffff;
+    p->r[1] = (load32_le(key +  3) >> 2) & 0x3ffff03;
+    p->r[2] = (load32_le(key +  6) >> 4) & 0x3ffc0ff;
+    p->r[3] = (load32_le(key +  9) >> 6) & 0x3f03fff;
+    p->r[4] = (load32_le(key + 12) >> 8) & 0x00fffff;
+    memset(p->h, 0, sizeof(p->h));
+    for (int i = 0; i < 4; i++) p->pad[i] = load32_le(key + 16 + 4 * i);
+}
+
+/* h = (h + m) * r mod 2^130 - 5，逐个 16 字节分组 */
+static void poly1305_blocks(poly1305_t *p, const uint8_t *m, size_t len, uint32_t hibit) {
+    const uint32_t r0 = p->r[0], r1 = p->r[1], r2 = p->r[2], r3 = p->r[3], r4 = p->r[4];
+    const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = p->h[0], h1 = p->h[1], h2 = p->h[2], h3 = p->h[3], h4 = p->h[4];
+
+    for (; len >= 16; m += 16, len -= 16) {
+        h0 += (load32_le(m +  0)     ) & 0x3ffffff;
+        h1 += (load32_le(m +  3) >> 2) & 0x3ffffff;
+        h2 += (load32_le(m +  6) >> 4) & 0x3ffffff;
+        h3 += (load32_le(m +  9) >> 6) & 0x3ffffff;
+        h4 += (load32_le(m + 12) >> 8) | hibit;
+
+        uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+        uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+        uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+        uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+        uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+        uint32_t c;
+        c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff; d1 += c;
+        c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff; d2 += c;
+        c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff; d3 += c;
+        c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff; d4 += c;
+        c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff; h1 += c;
+    }
+    p->h[0] = h0; p->h[1] = h1; p->h[2] = h2; p->h[3] = h3; p->h[4] = h4;
+}
+
+/* 数据按 16 字节补零后吸收（AEAD 的 pad16 规则） */
+static void poly1305_padded(poly1305_t *p, const uint8_t *m, size_t len) {
+    size_t full = len & ~(size_t)15;
+    poly1305_blocks(p, m, full, POLY_HIBIT);
+    if (len > full) {
+        uint8_t blk[16] = {0};
+        memcpy(blk, m + full, len - full);
+        poly1305_blocks(p, blk, 16, POLY_HIBIT);
+    }
+}
+
+static void poly1305_finish(poly1305_t *p, uint8_t tag[16]) {
+    uint32_t h0 = p->h[0], h1 = p->h[1], h2 = p->h[2], h3 = p->h[3], h4 = p->h[4], c;
+    c = h1 >> 26; h1 &= 0x3ffffff; h2 += c;
+    c = h2 >> 26; h2 &= 0x3ffffff; h3 += c;
+    c = h3 >> 26; h3 &= 0x3ffffff; h4 += c;
+    c = h4 >> 26; h4 &= 0x3ffffff; h0 += c * 5;
+    c = h0 >> 26; h0 &= 0x3ffffff; h1 += c;
+
+    // g = h - (2^130 - 5)；h >= p 时取 g（常数时间选择）
+    uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+    uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+    uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+    uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+    uint32_t g4 = h4 + c - (1u << 26);
+    uint32_t mask = (g4 >> 31) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+
+    // tag = (h + s) mod 2^128
+    uint64_t f;
+    f = (uint64_t)(h0 | (h1 << 26))         + p->pad[0];             store32_le(tag +  0, (uint32_t)f);
+    f = (uint64_t)((h1 >> 6) | (h2 << 20))  + p->pad[1] + (f >> 32); store32_le(tag +  4, (uint32_t)f);
+    f = (uint64_t)((h2 >> 12) | (h3 << 14)) + p->pad[2] + (f >> 32); store32_le(tag +  8, (uint32_t)f);
+    f = (uint64_t)((h3 >> 18) | (h4 << 8))  + p->pad[3] + (f >> 32); store32_le(tag + 12, (uint32_t)f);
+    memset(p, 0, sizeof(*p));
+}
+
+void p2p_poly1305(const uint8_t key[32], const uint8_t *msg, size_t len, uint8_t tag[16]) {
+    poly1305_t p;
+    poly1305_init(&p, key);
+    size_t full = len & ~(size_t)15;
+    poly1305_blocks(&p, msg, full, POLY_HIBIT);
+    if (len > full) {                           // 末尾不足一组：补 0x01 后补零，不再隐含高位
+        uint8_t blk[16] = {0};
+        memcpy(blk, msg + full, len - full);
+        blk[len - full] = 1;
+        poly1305_blocks(&p, blk, 16, 0);
+    }
+    poly1305_finish(&p, tag);
+}
+
+/* MAC = Poly1305(otk, aad || pad16 || ct || pad16 || len(aad) || len(ct))，otk 为计数器 0 的密钥流 */
+static void aead_mac(const uint8_t key[32], const uint8_t nonce[12],
+                     const uint8_t *aad, size_t aad_len,
+                     const uint8_t *ct, size_t len, uint8_t tag[16]) {
+    uint32_t st[16];
+    uint8_t otk[64], lens[16];
+    chacha_setup(st, key, nonce, 0);
+    chacha_block(st, otk);
+
+    poly1305_t p;
+    poly1305_init(&p, otk);
+    poly1305_padded(&p, aad, aad_len);
+    poly1305_padded(&p, ct, len);
+    store32_le(lens + 0, (uint32_t)aad_len); store32_le(lens + 4, (uint32_t)((uint64_t)aad_len >> 32));
+    store32_le(lens + 8, (uint32_t)len);     store32_le(lens + 12, (uint32_t)((uint64_t)len >> 32));
+    poly1305_blocks(&p, lens, 16, POLY_HIBIT);
+    poly1305_finish(&p, tag);
+    memset(otk, 0, sizeof(otk));
+}
+
+void p2p_aead_seal(const uint8_t key[32], const uint8_t nonce[12],
+                   const uint8_t *aad, size_t aad_len,
+                   const uint8_t *in, size_t len, uint8_t *out, uint8_t tag[16]) {
+    p2p_chacha20_xor(key, nonce, 1, in, out, len);
+    aead_mac(key, nonce, aad, aad_len, out, len, tag);
+}
+
+int p2p_aead_open(const uint8_t key[32], const uint8_t nonce[12],
+                  const uint8_t *aad, size_t aad_len,
+                  const uint8_t *in, size_t len, const uint8_t tag[16], uint8_t *out) {
+    uint8_t expect[16], diff = 0;
+    aead_mac(key, nonce, aad, aad_len, in, len, expect);
+    for (int i = 0; i < 16; i++) diff |= expect[i] ^ tag[i];    // 常数时间比较
+    if (diff) return -1;
+    p2p_chacha20_xor(key, nonce, 1, in, out, len);
+    return 0;
+}
+
+void p2p_aead_job_run(p2p_aead_job_t *j) {
+    if (j->open) j->result = (int8_t)p2p_aead_open(j->key, j->nonce, NULL, 0, j->in, (size_t)j->len, j->in + j->len, j->out);
+    else p2p_aead_seal(j->key, j->nonce, NULL, 0, j->in, (size_t)j->len, j->out, j->out + j->len);
+}
+
 /* ============================= DES (简化 XOR) ============================= */
 
 /*
@@ -8,14 +8,72 @@
 /* CRC32 — STUN Fingerprint 校验 */
 uint32_t p2p_crc32(const uint8_t *data, int len);
 
+/* 分段计算 CRC32：crc 初值为 0，逐段传入上一段的结果，与整体计算 p2p_crc32 一致 */
+uint32_t p2p_crc32_update(uint32_t crc, const uint8_t *data, int len);
+
 /* MD5 — TURN long-term credential 密钥派生: key = MD5(user:realm:pass) */
 void p2p_md5(const uint8_t *data, int len, uint8_t digest[16]);
 
-/* HMAC-SHA1 — STUN Message-Integrity 签名 */
+/* SHA1 中间状态 */
+typedef struct {
+    uint32_t state[5];
+    uint32_t count[2];
+    uint8_t  buffer[64];
+} p2p_sha1_ctx_t;
+
+/* HMAC-SHA1 密钥上下文：缓存已吸收 ipad/opad 分组的内外层 SHA1 状态，同一密钥可反复使用 */
+typedef struct {
+    p2p_sha1_ctx_t inner;
+    p2p_sha1_ctx_t outer;
+} p2p_hmac_sha1_ctx_t;
+
+void p2p_hmac_sha1_init(p2p_hmac_sha1_ctx_t *hc, const uint8_t *key, int key_len);
+void p2p_hmac_sha1_compute(const p2p_hmac_sha1_ctx_t *hc,
+                           const uint8_t *data, int data_len,
+                           uint8_t digest[20]);
+
+/* HMAC-SHA1 — STUN Message-Integrity 签名（一次性密钥） */
 void p2p_hmac_sha1(const uint8_t* key, int key_len,
                    const uint8_t* data, int data_len,
                    uint8_t* digest);
 
+/*
+ * ChaCha20-Poly1305 AEAD（RFC 8439）— 内置加密层 p2p_dtls_aead
+ * + in 与 out 可以是同一缓冲区（原地加解密）
+ * + p2p_aead_open 先校验 tag，失败返回 -1 且不写 out
+ */
+#define P2P_AEAD_KEY_LEN    32
+#define P2P_AEAD_NONCE_LEN  12
+#define P2P_AEAD_TAG_LEN    16
+
+void p2p_chacha20_xor(const uint8_t key[32], const uint8_t nonce[12], uint32_t counter,
+                      const uint8_t *in, uint8_t *out, size_t len);
+void p2p_poly1305(const uint8_t key[32], const uint8_t *msg, size_t len, uint8_t tag[16]);
+void p2p_aead_seal(const uint8_t key[32], const uint8_t nonce[12],
+                   const uint8_t *aad, size_t aad_len,
+                   const uint8_t *in, size_t len, uint8_t *out, uint8_t tag[16]);
+int  p2p_aead_open(const uint8_t key[32], const uint8_t nonce[12],
+                   const uint8_t *aad, size_t aad_len,
+                   const uint8_t *in, size_t len, const uint8_t tag[16], uint8_t *out);
+
+/*
+ * AEAD 批处理任务（cfg.crypto_workers 线程池并行执行，见 p2p_crypto_run）
+ * + 封装：明文 in[0..len) 加密到 out（通常 in == out 原地），tag 写在 out + len
+ * + 解开：密文 in[0..len)、tag 位于 in + len，认证通过后明文写入 out
+ * 密钥与 nonce 在建任务时复制，执行期间不访问会话
+ */
+typedef struct p2p_aead_job {
+    uint8_t             key[P2P_AEAD_KEY_LEN];
+    uint8_t             nonce[P2P_AEAD_NONCE_LEN];
+    uint8_t             open;               // 0 = 封装，1 = 解开
+    int8_t              result;             // 解开结果：0 = 认证通过，-1 = 失败
+    int                 len;
+    const uint8_t*      in;
+    uint8_t*            out;
+} p2p_aead_job_t;
+
+void p2p_aead_job_run(p2p_aead_job_t *j);
+
 /* Base64 — pubsub 信令 auth_key 编解码 */
 int p2p_base64_encode(const uint8_t *src, size_t slen, char *dst, size_t dlen);
 int p2p_base64_decode(const char *src, size_t slen, uint8_t *dst, size_t dlen);
@@ -0,0 +1,189 @@
+/*
+ * 异步主机名解析实现，说明见 p2p_dns.h
+ */
+
+#define MOD_TAG "DNS"
+
+#include "p2p_internal.h"
+
+typedef enum {
+    DNS_FREE = 0,
+    DNS_PENDING,                    /* 待解析（排队） */
+    DNS_BUSY,                       /* 解析线程正在查询 */
+    DNS_OK,
+    DNS_FAIL,
+} dns_state_t;
+
+typedef struct {
+    char                host[P2P_DNS_HOST_MAX];
+    dns_state_t         state;
+    bool                valid;      /* addr 有效（含过期后刷新中的旧结果） */
+    struct in_addr      addr;
+    uint64_t            stamp;      /* 结果产生（或登记）时刻，用于过期与淘汰 */
+} dns_entry_t;
+
+static dns_entry_t      g_dns[P2P_DNS_CACHE];
+static uint32_t         g_dns_gen;              /* p2p_dns_flush 递增，作废解析中的查询结果 */
+static volatile long    g_dns_lock;
+
+#if defined(_MSC_VER)
+#define DNS_LOCK()          while (_InterlockedExchange(&g_dns_lock, 1)) {}
+#define DNS_UNLOCK()        _InterlockedExchange(&g_dns_lock, 0)
+#else
+#define DNS_LOCK()          while (__atomic_exchange_n(&g_dns_lock, 1, __ATOMIC_ACQUIRE)) {}
+#define DNS_UNLOCK()        __atomic_store_n(&g_dns_lock, 0, __ATOMIC_RELEASE)
+#endif
+
+/* 系统解析（阻塞，仅在解析线程或同步退化路径中调用） */
+static bool dns_lookup(const char *host, struct in_addr *out) {
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0 || !res) return false;
+    *out = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+    return true;
+}
+
+/* 写入查询结果（持锁） */
+static void dns_store(dns_entry_t *e, bool ok, struct in_addr addr) {
+    if (ok) { e->addr = addr; e->valid = true; }
+    e->state = ok ? DNS_OK : DNS_FAIL;
+    e->stamp = P_tick_ms();
+}
+
+static void dns_report(const char *host, bool ok, struct in_addr addr, uint64_t t0) {
+    char ip[INET_ADDRSTRLEN] = "";
+    if (ok) inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+    if (ok) print("I:", LA_F("resolved %s -> %s (%llu ms)", LA_F612, 612), host, ip, (unsigned long long)tick_diff(P_tick_ms(), t0));
+    else print("W:", LA_F("resolve %s failed", LA_F560, 560), host);
+}
+
+/* 查找或登记条目（持锁）：表满时淘汰最久的非解析中条目 */
+static dns_entry_t *dns_slot(const char *host, uint64_t now) {
+    dns_entry_t *free_slot = NULL, *oldest = NULL;
+    for (int i = 0; i < P2P_DNS_CACHE; i++) {
+        dns_entry_t *e = &g_dns[i];
+        if (e->state == DNS_FREE) { if (!free_slot) free_slot = e; continue; }
+        if (!strcmp(e->host, host)) return e;
+        if (e->state != DNS_BUSY && (!oldest || e->stamp < oldest->stamp)) oldest = e;
+    }
+    dns_entry_t *e = free_slot ? free_slot : oldest;
+    if (!e) return NULL;
+    memset(e, 0, sizeof(*e));
+    strcpy(e->host, host);
+    e->state = DNS_PENDING;
+    e->stamp = now;
+    return e;
+}
+
+#ifdef P2P_THREADED
+
+static bool             g_dns_running;          /* 解析线程运行中 */
+static bool             g_dns_joinable;         /* g_dns_thread 为已启动的线程（退出后待回收） */
+static thd_t            g_dns_thread;
+
+/* 解析线程：逐个处理待解析条目，队列为空即退出（下次有查询时重新启动） */
+static int32_t dns_thread(void *arg) {
+    (void)arg;
+    for (;;) {
+        char host[P2P_DNS_HOST_MAX];
+        DNS_LOCK();
+        dns_entry_t *e = NULL;
+        for (int i = 0; i < P2P_DNS_CACHE && !e; i++)
+            if (g_dns[i].state == DNS_PENDING) e = &g_dns[i];
+        if (!e) {
+            g_dns_running = false;
+            DNS_UNLOCK();
+            return 0;
+        }
+        e->state = DNS_BUSY;                    /* BUSY 条目不会被淘汰或清空，e 在查询期间保持有效 */
+        uint32_t gen = g_dns_gen;
+        memcpy(host, e->host, sizeof(host));
+        DNS_UNLOCK();
+
+        uint64_t t0 = P_tick_ms();
+        struct in_addr addr;
+        bool ok = dns_lookup(host, &addr);
+
+        DNS_LOCK();
+        bool fresh = gen == g_dns_gen;
+        if (fresh) dns_store(e, ok, addr);
+        else e->state = DNS_PENDING;            /* 查询期间网络已变化：结果作废，重新解析 */
+        DNS_UNLOCK();
+        if (fresh) dns_report(host, ok, addr, t0);
+    }
+}
+
+/* 确保解析线程在运行（持锁）：上一个线程已置 running=false 后只剩返回，回收不会等待锁 */
+static bool dns_kick(void) {
+    if (g_dns_running) return true;
+    if (g_dns_joinable) { P_join(g_dns_thread, NULL); g_dns_joinable = false; }
+    if (P_thread(&g_dns_thread, dns_thread, NULL, P_THD_NORMAL, 0) != E_NONE) {
+        print("W:", LA_F("DNS resolver thread unavailable, resolving synchronously", LA_F613, 613));
+        return false;
+    }
+    g_dns_running = g_dns_joinable = true;
+    return true;
+}
+
+#endif /* P2P_THREADED */
+
+int p2p_dns_resolve(const char *host, uint16_t port, struct sockaddr_in *out) {
+
+    memset(out, 0, sizeof(*out));
+    out->sin_family = AF_INET;
+    out->sin_port = htons(port);
+
+    if (!host || !host[0] || strlen(host) >= P2P_DNS_HOST_MAX) return -1;
+    if (inet_pton(AF_INET, host, &out->sin_addr) == 1) return 1;
+
+    uint64_t now = P_tick_ms();
+    DNS_LOCK();
+    dns_entry_t *e = dns_slot(host, now);
+    if (!e) {                                   /* 全部条目都在解析中：不缓存，同步解析 */
+        DNS_UNLOCK();
+        struct in_addr addr;
+        bool ok = dns_lookup(host, &addr);
+        if (ok) out->sin_addr = addr;
+        return ok ? 1 : -1;
+    }
+
+    // 结果过期：重新排队（成功结果在刷新期间继续使用旧地址）
+    if ((e->state == DNS_OK && tick_diff(now, e->stamp) >= P2P_DNS_TTL_MS)
+        || (e->state == DNS_FAIL && tick_diff(now, e->stamp) >= P2P_DNS_NEG_TTL_MS))
+        e->state = DNS_PENDING;
+
+    int ret = e->valid ? 1 : e->state == DNS_FAIL ? -1 : 0;
+    if (e->valid) out->sin_addr = e->addr;
+
+    bool sync = e->state == DNS_PENDING;
+#ifdef P2P_THREADED
+    if (sync) sync = !dns_kick();
+#endif
+    if (sync) e->state = DNS_BUSY;
+    DNS_UNLOCK();
+    if (!sync) return ret;
+
+    // 无解析线程：在调用方线程内同步解析
+    struct in_addr addr;
+    bool ok = dns_lookup(host, &addr);
+    DNS_LOCK();
+    dns_store(e, ok, addr);
+    ret = e->valid ? 1 : -1;
+    if (e->valid) out->sin_addr = e->addr;
+    DNS_UNLOCK();
+    dns_report(host, ok, addr, now);
+    return ret;
+}
+
+void p2p_dns_flush(void) {
+    DNS_LOCK();
+    ++g_dns_gen;
+    for (int i = 0; i < P2P_DNS_CACHE; i++) {
+        if (g_dns[i].state == DNS_BUSY) g_dns[i].valid = false;
+        else memset(&g_dns[i], 0, sizeof(g_dns[i]));
+    }
+    DNS_UNLOCK();
+}
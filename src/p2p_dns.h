@@ -0,0 +1,34 @@
+/*
+ * 异步主机名解析（信令 / STUN / TURN / HTTPS 服务器）
+ *
+ * 进程内共享一张解析结果表，调用方以轮询方式使用：
+ *   p2p_dns_resolve() 立即返回，未就绪时登记查询，由后台解析线程执行系统 getaddrinfo，
+ *   调用方在后续 tick 中以相同参数再次调用取得结果。
+ *   + 数值 IP 不进表，直接转换
+ *   + 成功结果缓存 P2P_DNS_TTL_MS，失败结果缓存 P2P_DNS_NEG_TTL_MS（getaddrinfo 不提供记录 TTL）
+ *   + 成功结果过期后在后台刷新，刷新期间仍返回旧地址；刷新失败保留旧地址
+ *   + p2p_network_changed() 清空结果表（p2p_dns_flush）
+ * 未定义 P2P_THREADED（或解析线程创建失败）时退化为在调用方线程内同步解析，结果同样缓存。
+ */
+
+#ifndef P2P_DNS_H
+#define P2P_DNS_H
+
+#include "predefine.h"
+
+#define P2P_DNS_HOST_MAX        128                 /* 主机名上限（含 '\0'） */
+#define P2P_DNS_CACHE           32                  /* 结果表条目数 */
+#define P2P_DNS_TTL_MS          (5 * 60 * 1000)     /* 成功结果有效期 */
+#define P2P_DNS_NEG_TTL_MS      (30 * 1000)         /* 失败结果有效期 */
+
+/*
+ * 解析 IPv4 地址（非阻塞）
+ * @param out   输出地址（sin_family / sin_port 总是填写，sin_addr 仅在返回 1 时有效）
+ * @return      1 = 已就绪，0 = 解析中（稍后以相同参数重试），-1 = 解析失败
+ */
+int  p2p_dns_resolve(const char *host, uint16_t port, struct sockaddr_in *out);
+
+/* 清空结果表（网络变化后调用）；解析中的查询照常完成 */
+void p2p_dns_flush(void);
+
+#endif /* P2P_DNS_H */
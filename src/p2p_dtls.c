@@ -0,0 +1,124 @@
+/*
+ * DTLS 会话恢复缓存（见 p2p_dtls.h），与具体后端无关
+ */
+
+#define MOD_TAG "DTLS"
+
+#include "p2p_internal.h"
+
+ret_t p2p_dtls_cache_create(struct p2p_instance *inst) {
+
+    p2p_dtls_cache_t *c = (p2p_dtls_cache_t *)p2p_calloc(1, sizeof(*c));
+    if (!c) return E_OUT_OF_MEMORY;
+#ifdef P2P_THREADED
+    if (P_mutex_init(&c->mtx) != 0) { p2p_free(c); return E_OUT_OF_MEMORY; }
+#endif
+    P_rand_bytes(c->ticket_key, sizeof(c->ticket_key));
+    inst->dtls_cache = c;
+    p2p_mem_add(&inst->mem, P2P_MEM_DTLS, sizeof(*c));
+    return E_NONE;
+}
+
+void p2p_dtls_cache_free(struct p2p_instance *inst) {
+
+    p2p_dtls_cache_t *c = inst->dtls_cache;
+    if (!c) return;
+    if (c->backend && c->backend_free) c->backend_free(c->backend);
+#ifdef P2P_THREADED
+    P_mutex_final(&c->mtx);
+#endif
+    memset(c->ticket_key, 0, sizeof(c->ticket_key));
+    p2p_mem_add(&inst->mem, P2P_MEM_DTLS, -(int64_t)sizeof(*c));
+    p2p_free(c);
+    inst->dtls_cache = NULL;
+}
+
+void p2p_dtls_cache_lock(p2p_dtls_cache_t *c) {
+#ifdef P2P_THREADED
+    P_mutex_lock(&c->mtx);
+#else
+    (void)c;
+#endif
+}
+
+void p2p_dtls_cache_unlock(p2p_dtls_cache_t *c) {
+#ifdef P2P_THREADED
+    P_mutex_unlock(&c->mtx);
+#else
+    (void)c;
+#endif
+}
+
+static p2p_dtls_resume_t *cache_find(p2p_dtls_cache_t *c, const char *peer_id) {
+    for (int i = 0; i < P2P_DTLS_RESUME_SLOTS; i++) {
+        if (c->slots[i].peer_id[0] && !strncmp(c->slots[i].peer_id, peer_id, P2P_PEER_ID_MAX))
+            return &c->slots[i];
+    }
+    return NULL;
+}
+
+static void cache_clear(p2p_dtls_resume_t *e) {
+    memset(e->blob, 0, (size_t)e->len);     // 会话含主密钥，释放槽位时擦除
+    e->peer_id[0] = '\0';
+    e->len = 0;
+}
+
+int p2p_dtls_cache_get(struct p2p_instance *inst, const char *peer_id, uint8_t *out, int cap) {
+
+    p2p_dtls_cache_t *c = inst->dtls_cache;
+    if (!c || !peer_id || !peer_id[0]) return 0;
+
+    int len = 0;
+    p2p_dtls_cache_lock(c);
+    p2p_dtls_resume_t *e = cache_find(c, peer_id);
+    if (e) {
+        if (tick_diff(P_tick_ms(), e->stamp) >= P2P_DTLS_RESUME_TTL_MS) cache_clear(e);
+        else if (e->len <= cap) { memcpy(out, e->blob, (size_t)e->len); len = e->len; }
+    }
+    p2p_dtls_cache_unlock(c);
+    return len;
+}
+
+void p2p_dtls_cache_put(struct p2p_instance *inst, const char *peer_id, const uint8_t *blob, int len) {
+
+    p2p_dtls_cache_t *c = inst->dtls_cache;
+    if (!c || !peer_id || !peer_id[0] || len <= 0) return;
+    if (len > P2P_DTLS_RESUME_MAX) {
+        print("W:", LA_F("session too large to cache (%d bytes)", LA_F494, 494), len);
+        return;
+    }
+
+    p2p_dtls_cache_lock(c);
+    p2p_dtls_resume_t *e = cache_find(c, peer_id);
+    if (!e) {
+        // 优先空闲槽位，否则替换最早保存的
+        e = &c->slots[0];
+        for (int i = 0; i < P2P_DTLS_RESUME_SLOTS && e->peer_id[0]; i++) {
+            if (!c->slots[i].peer_id[0] || c->slots[i].stamp < e->stamp) e = &c->slots[i];
+        }
+        cache_clear(e);
+        strncpy(e->peer_id, peer_id, P2P_PEER_ID_MAX - 1);
+        e->peer_id[P2P_PEER_ID_MAX - 1] = '\0';
+    }
+    memcpy(e->blob, blob, (size_t)len);
+    e->len = len;
+    e->stamp = P_tick_ms();
+    p2p_dtls_cache_unlock(c);
+}
+
+void p2p_dtls_cache_drop(struct p2p_instance *inst, const char *peer_id) {
+
+    p2p_dtls_cache_t *c = inst->dtls_cache;
+    if (!c || !peer_id || !peer_id[0]) return;
+
+    p2p_dtls_cache_lock(c);
+    p2p_dtls_resume_t *e = cache_find(c, peer_id);
+    if (e) cache_clear(e);
+    p2p_dtls_cache_unlock(c);
+}
+
+bool p2p_dtls_record_cid(const uint8_t *rec, int len, uint32_t *cid) {
+    if (len < 13 + P2P_DTLS_CID_LEN || rec[0] != P2P_DTLS_CT_CID) return false;
+    *cid = nget_l(rec + 11);
+    return true;
+}
@@ -3,7 +3,7 @@
  *
  * 加密层与传输层正交：
  *   传输轴: reliable(默认) | PseudoTCP | SCTP      — 管可靠性
- *   加密轴: disabled | MbedTLS | OpenSSL            — 管加密
+ *   加密轴: disabled | MbedTLS | OpenSSL | AEAD     — 管加密
  *
  * 协议栈分层：
  *   方案 A（reliable / pseudotcp + DTLS）:
@@ -20,8 +20,10 @@
 #define P2P_DTLS_H
 
 #include <stdint.h>
+#include "p2p_crypto.h"         /* p2p_aead_job_t */
 
 struct p2p_session;
+struct p2p_instance;
 struct sockaddr_in;
 
 /* ============================================================================
@@ -66,8 +68,49 @@ typedef struct p2p_dtls_ops {
      */
     int   (*decrypt_recv)(struct p2p_session *s, const uint8_t *in, int in_len,
                           uint8_t *out, int out_cap);
+
+    /* 可选：握手已协商 Connection ID，出站记录自带 CID（NULL 视为不支持） */
+    int   (*has_cid)(struct p2p_session *s);
+
+    /*
+     * 可选：随 CONN / CONN_ACK 能力通告交换的加密层参数（无独立握手的后端使用，见 RELIABLE_CAP_CRYPTO）
+     *
+     * conn_params 写入本端参数，返回长度（<= P2P_DTLS_PARAMS_MAX）；
+     * on_conn_params 收到对端参数（CONN 可能重传，须可重入）
+     */
+    int   (*conn_params)(const struct p2p_session *s, uint8_t *buf);
+    void  (*on_conn_params)(struct p2p_session *s, const uint8_t *data, int len);
+
+    /*
+     * 可选：加密线程池预解开（cfg.crypto_workers，记录可逐条独立解密的后端实现）
+     * 为收到的记录 in 填写解开任务的密钥、nonce 与密文范围（不检查认证、不推进重放窗口），返回 false 不预解开；
+     * 任务执行后派发到本会话时 s->inst->crypto_rx_cur 指向该任务，decrypt_recv 据此取用明文
+     */
+    bool  (*open_prepare)(struct p2p_session *s, const uint8_t *in, int in_len, p2p_aead_job_t *job);
+
+    /* 可选：每条记录的固定额外字节（路径 MTU 提升后据此计算明文上限，0 = 未知，不提升，见 nat_pmtu_payload） */
+    int   overhead;
 } p2p_dtls_ops_t;
 
+#define P2P_DTLS_PARAMS_MAX     32                          /* CONN 携带的加密层参数上限 */
+
+/* ============================================================================
+ * Connection ID（RFC 9146）
+ * ============================================================================
+ *
+ * 加密上下文只绑定会话，不绑定地址；需要保证的是记录能被派发到正确会话：
+ *   - 后端支持 CID 时，本端 CID 取 s->id（P2P_DTLS_CID_LEN 字节，大端），
+ *     对端发来的 tls12_cid 记录在头部携带它，派发时直接按 CID 查找会话
+ *   - 后端不支持或未协商时，多会话模式下 CRYPTO 包携带 P2P_FLAG_SESSION + session_id
+ * 两者都不依赖来源地址。解密成功（已认证）的记录来自未知地址时，
+ * 直连路径据此更新活跃地址（NAT 重绑定 / 网络迁移），无需重新握手。
+ */
+#define P2P_DTLS_CID_LEN        4                           /* = P2P_SESS_ID_PSZ */
+#define P2P_DTLS_CT_CID         25                          /* tls12_cid 记录的 ContentType */
+
+/* 解析 tls12_cid 记录头中的 CID：[type(1)][version(2)][epoch(2)][seq(6)][cid(4)][length(2)] */
+bool  p2p_dtls_record_cid(const uint8_t *rec, int len, uint32_t *cid);
+
 /* ============================================================================
  * 加密层包类型（定义在 p2pp.h）
  *
@@ -75,6 +118,55 @@ typedef struct p2p_dtls_ops {
  *   P2P_PKT_RELAY_CRYPTO 中继: [P2P_HDR: type=0xA2] [session_id(8B) | DTLS record]
  * ============================================================================ */
 
+/* ============================================================================
+ * 会话恢复缓存（实例级）
+ * ============================================================================
+ *
+ * 重连同一对端时跳过完整握手（RFC 5077 session ticket）：
+ *   - 客户端：握手完成后按 remote_peer_id 保存后端序列化的会话（含 ticket），
+ *     下次 init 时取出并随 ClientHello 提交，服务端接受则走简化握手（1 RTT，无公钥运算）
+ *   - 服务端：ticket 密钥在实例内共享，使后续会话能解开此前会话签发的 ticket
+ *   - 握手失败时丢弃该对端的缓存条目，下次回退完整握手
+ *
+ * 会话上下文各自独立创建与释放，缓存是它们之间唯一的共享状态；
+ * 分片线程下由 mtx 保护（叶子锁，持有期间不获取其他锁）。
+ */
+#define P2P_DTLS_RESUME_SLOTS   8                           /* 缓存的对端数量（满时替换最久未用） */
+#define P2P_DTLS_RESUME_MAX     1024                        /* 单个序列化会话的最大字节数 */
+#define P2P_DTLS_RESUME_TTL_MS  (3600 * 1000)               /* 条目 / ticket 有效期 */
+
+typedef struct {
+    char                peer_id[P2P_PEER_ID_MAX];           // 对端 ID（空 = 空闲槽位）
+    uint64_t            stamp;                              // 保存时刻（ms）
+    int                 len;                                // blob 长度
+    uint8_t             blob[P2P_DTLS_RESUME_MAX];          // 后端序列化的会话
+} p2p_dtls_resume_t;
+
+typedef struct p2p_dtls_cache {
+    p2p_dtls_resume_t   slots[P2P_DTLS_RESUME_SLOTS];
+    uint8_t             ticket_key[48];                     // 服务端 ticket 密钥（创建时随机生成）
+    void*               backend;                            // 后端实例级状态（如 MbedTLS ticket 上下文），按需创建
+    void              (*backend_free)(void *backend);
+#ifdef P2P_THREADED
+    P_mutex_t           mtx;
+#endif
+} p2p_dtls_cache_t;
+
+/* 创建 / 释放（p2p_create / p2p_destroy，仅启用加密层时） */
+ret_t p2p_dtls_cache_create(struct p2p_instance *inst);
+void  p2p_dtls_cache_free(struct p2p_instance *inst);
+
+/* 取出对端的序列化会话（过期条目顺带清除），返回长度，无则为 0 */
+int   p2p_dtls_cache_get(struct p2p_instance *inst, const char *peer_id, uint8_t *out, int cap);
+
+/* 保存 / 丢弃对端的序列化会话 */
+void  p2p_dtls_cache_put(struct p2p_instance *inst, const char *peer_id, const uint8_t *blob, int len);
+void  p2p_dtls_cache_drop(struct p2p_instance *inst, const char *peer_id);
+
+/* 后端访问实例级状态（backend / ticket_key）时的加锁 */
+void  p2p_dtls_cache_lock(p2p_dtls_cache_t *c);
+void  p2p_dtls_cache_unlock(p2p_dtls_cache_t *c);
+
 /* ============================================================================
  * 后端声明
  * ============================================================================ */
@@ -84,5 +176,6 @@ extern const p2p_dtls_ops_t p2p_dtls_mbedtls;
 #ifdef WITH_OPENSSL
 extern const p2p_dtls_ops_t p2p_dtls_openssl;
 #endif
+extern const p2p_dtls_ops_t p2p_dtls_aead;                  /* 内置，零依赖（p2p_dtls_aead.c） */
 
 #endif /* P2P_DTLS_H */
@@ -0,0 +1,243 @@
+/*
+ * 内置 AEAD 加密层（ChaCha20-Poly1305，零依赖，无握手往返）
+ *
+ * 双方以 cfg.auth_key 为共享密钥，各自生成 16 字节会话随机数，随 CONN / CONN_ACK 能力通告交换
+ * （RELIABLE_CAP_CRYPTO），收到对端随机数即就绪，不增加任何握手包：
+ *   PRK    = HKDF-Extract(salt = nonce_lo || nonce_hi, IKM = auth_key)     随机数按字节序排列，两端一致
+ *   K_dir  = HKDF-Expand(PRK, info = 发送方随机数, 36) = key(32) || iv_salt(4)
+ * 两个方向密钥独立：本端发送用 K(local)，接收用 K(peer)，反射回来的记录无法通过认证。
+ *
+ * 记录格式（P2P_PKT_CRYPTO 负载）：[seq(8)][密文][tag(16)]
+ *   - 明文为内层 [type|flags|seq|payload]，nonce = iv_salt(4) || seq(8)
+ *   - seq 每条记录递增，接收端 64 条滑动窗口拒绝重放；仅已认证的记录推进窗口
+ *   - 对端随机数变化（对端重建会话）时重新派生密钥，发送序号从 0 开始
+ *
+ * 每条记录独立加解密（nonce 由序号决定），可交给加密线程池并行执行（cfg.crypto_workers）：
+ * 发送时入队前分配序号（会话内顺序不变），封装延后到发送合并 flush；接收时批量预先解开，
+ * 派发到本层时按到达顺序确认重放窗口后取用明文。
+ *
+ * CONN 本身不加密也不认证：伪造的随机数只会使双方密钥不一致、解密失败，不泄露密钥。
+ * 与 DTLS 不同，没有前向保密：auth_key 泄露后，录下的流量可被解密。
+ */
+
+#define MOD_TAG "AEAD"
+
+#include "p2p_internal.h"
+
+#define AEAD_RAND_LEN       16                                  /* 会话随机数 */
+#define AEAD_SEQ_LEN        8
+#define AEAD_OVERHEAD       (AEAD_SEQ_LEN + P2P_AEAD_TAG_LEN)   /* 每条记录的额外字节 */
+#define AEAD_REPLAY_WIN     64
+
+typedef struct {
+    uint8_t     key[P2P_AEAD_KEY_LEN];
+    uint8_t     iv_salt[4];
+} aead_dir_t;
+
+typedef struct {
+    uint8_t     local_rand[AEAD_RAND_LEN];
+    uint8_t     peer_rand[AEAD_RAND_LEN];
+    int         ready;                  // 已收到对端随机数并派生密钥
+    aead_dir_t  tx, rx;
+    uint64_t    tx_seq;                 // 下一条发送记录的序号
+    uint64_t    rx_top;                 // 已接受的最大序号 + 1（0 = 尚未收到）
+    uint64_t    rx_mask;                // bit i = 序号 rx_top - 1 - i 已接受
+} aead_ctx_t;
+
+/* HKDF-Expand（HMAC-SHA1）：T(i) = HMAC(PRK, T(i-1) || info || i)，取前 36 字节 */
+static void derive_dir(const p2p_hmac_sha1_ctx_t *prk, const uint8_t info[AEAD_RAND_LEN], aead_dir_t *d) {
+    uint8_t okm[40], msg[20 + AEAD_RAND_LEN + 1];
+    for (int i = 0; i < 2; i++) {
+        int n = 0;
+        if (i) { memcpy(msg, okm, 20); n = 20; }
+        memcpy(msg + n, info, AEAD_RAND_LEN); n += AEAD_RAND_LEN;
+        msg[n++] = (uint8_t)(i + 1);
+        p2p_hmac_sha1_compute(prk, msg, n, okm + 20 * i);
+    }
+    memcpy(d->key, okm, sizeof(d->key));
+    memcpy(d->iv_salt, okm + sizeof(d->key), sizeof(d->iv_salt));
+    memset(okm, 0, sizeof(okm));
+    memset(msg, 0, sizeof(msg));
+}
+
+static void derive_keys(const char *auth_key, aead_ctx_t *a) {
+    uint8_t salt[2 * AEAD_RAND_LEN], prk[20];
+    bool local_lo = memcmp(a->local_rand, a->peer_rand, AEAD_RAND_LEN) < 0;
+    memcpy(salt, local_lo ? a->local_rand : a->peer_rand, AEAD_RAND_LEN);
+    memcpy(salt + AEAD_RAND_LEN, local_lo ? a->peer_rand : a->local_rand, AEAD_RAND_LEN);
+    p2p_hmac_sha1(salt, sizeof(salt), (const uint8_t *)auth_key, (int)strlen(auth_key), prk);
+
+    p2p_hmac_sha1_ctx_t hc;
+    p2p_hmac_sha1_init(&hc, prk, sizeof(prk));
+    derive_dir(&hc, a->local_rand, &a->tx);
+    derive_dir(&hc, a->peer_rand, &a->rx);
+    memset(&hc, 0, sizeof(hc));
+    memset(prk, 0, sizeof(prk));
+}
+
+static inline void make_nonce(const aead_dir_t *d, const uint8_t seq[AEAD_SEQ_LEN], uint8_t nonce[P2P_AEAD_NONCE_LEN]) {
+    memcpy(nonce, d->iv_salt, sizeof(d->iv_salt));
+    memcpy(nonce + sizeof(d->iv_salt), seq, AEAD_SEQ_LEN);
+}
+
+/* 序号是否可接受（未超出窗口且未收到过） */
+static bool replay_check(const aead_ctx_t *a, uint64_t seq) {
+    if (seq >= a->rx_top) return true;
+    uint64_t off = a->rx_top - 1 - seq;
+    return off < AEAD_REPLAY_WIN && !((a->rx_mask >> off) & 1);
+}
+
+static void replay_accept(aead_ctx_t *a, uint64_t seq) {
+    if (seq >= a->rx_top) {
+        uint64_t shift = seq + 1 - a->rx_top;
+        a->rx_mask = shift >= AEAD_REPLAY_WIN ? 0 : a->rx_mask << shift;
+        a->rx_mask |= 1;
+        a->rx_top = seq + 1;
+    }
+    else a->rx_mask |= 1ull << (a->rx_top - 1 - seq);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static int aead_init(struct p2p_session *s) {
+    const char *psk = s->inst->cfg.auth_key;
+    if (!psk || !psk[0]) {
+        print("E:", LA_F("%s requires auth_key", LA_F500, 500), "AEAD");
+        return -1;
+    }
+    aead_ctx_t *a = (aead_ctx_t *)p2p_calloc(1, sizeof(*a));
+    if (!a) return -1;
+    P_rand_bytes(a->local_rand, sizeof(a->local_rand));
+    s->dtls_data = a;
+    p2p_mem_add(&s->mem, P2P_MEM_DTLS, sizeof(*a));
+    return 0;
+}
+
+static void aead_close(struct p2p_session *s) {
+    aead_ctx_t *a = (aead_ctx_t *)s->dtls_data;
+    if (!a) return;
+    memset(a, 0, sizeof(*a));
+    p2p_mem_add(&s->mem, P2P_MEM_DTLS, -(int64_t)sizeof(*a));
+    p2p_free(a);
+    s->dtls_data = NULL;
+}
+
+static int aead_is_ready(struct p2p_session *s) {
+    aead_ctx_t *a = (aead_ctx_t *)s->dtls_data;
+    return a && a->ready;
+}
+
+static int aead_conn_params(const struct p2p_session *s, uint8_t *buf) {
+    const aead_ctx_t *a = (const aead_ctx_t *)s->dtls_data;
+    if (!a) return 0;
+    memcpy(buf, a->local_rand, AEAD_RAND_LEN);
+    return AEAD_RAND_LEN;
+}
+
+static void aead_on_conn_params(struct p2p_session *s, const uint8_t *data, int len) {
+    aead_ctx_t *a = (aead_ctx_t *)s->dtls_data;
+    if (!a || len < AEAD_RAND_LEN) return;
+    if (a->ready && !memcmp(a->peer_rand, data, AEAD_RAND_LEN)) return;    // CONN / CONN_ACK 重传
+    if (!memcmp(a->local_rand, data, AEAD_RAND_LEN)) {
+        print("W:", LA_F("%s: peer echoed our own nonce, ignored", LA_F501, 501), "AEAD");
+        return;
+    }
+
+    bool rekey = a->ready;
+    memcpy(a->peer_rand, data, AEAD_RAND_LEN);
+    derive_keys(s->inst->cfg.auth_key, a);
+    a->tx_seq = 0;
+    a->rx_top = 0;
+    a->rx_mask = 0;
+    a->ready = 1;
+    print("I:", LA_F("%s: session keys %s", LA_F502, 502), "AEAD", rekey ? "re-derived (peer restarted)" : "derived");
+}
+
+/*
+ * 加密并发送：明文复制到记录缓冲区后原地封装（就地或由加密线程池在 flush 前执行）
+ */
+static ret_t aead_encrypt_send(struct p2p_session *s, const struct sockaddr_in *addr,
+                               const void *plain, int plain_len) {
+    aead_ctx_t *a = (aead_ctx_t *)s->dtls_data;
+    if (!a || !a->ready) return 0;
+
+    uint8_t rec[AEAD_OVERHEAD + P2P_HDR_SIZE + P2P_PMTU_PAYLOAD_MAX];
+    if (plain_len <= 0 || plain_len > P2P_HDR_SIZE + P2P_PMTU_PAYLOAD_MAX) return -1;
+
+    p2p_aead_job_t job;
+    nwrite_ll(rec, a->tx_seq++);
+    memcpy(rec + AEAD_SEQ_LEN, plain, (size_t)plain_len);
+    memcpy(job.key, a->tx.key, sizeof(job.key));
+    make_nonce(&a->tx, rec, job.nonce);
+    job.open = 0;
+    job.len = plain_len;
+    job.in = job.out = rec + AEAD_SEQ_LEN;
+
+    p2p_send_dtls_record_sealed(s, addr, rec, AEAD_OVERHEAD + plain_len, &job);
+    return plain_len;
+}
+
+/* 预解开：填写解开任务（已超出重放窗口的记录不预解开，派发时照常丢弃） */
+static bool aead_open_prepare(struct p2p_session *s, const uint8_t *in, int in_len, p2p_aead_job_t *j) {
+    aead_ctx_t *a = (aead_ctx_t *)s->dtls_data;
+    if (!a || !a->ready || in_len < AEAD_OVERHEAD + P2P_HDR_SIZE
+        || in_len - AEAD_OVERHEAD > P2P_HDR_SIZE + P2P_PMTU_PAYLOAD_MAX) return false;
+    if (!replay_check(a, nget_ll(in))) return false;
+
+    memcpy(j->key, a->rx.key, sizeof(j->key));
+    make_nonce(&a->rx, in, j->nonce);
+    j->open = 1;
+    j->len = in_len - AEAD_OVERHEAD;
+    j->in = in + AEAD_SEQ_LEN;
+    return true;
+}
+
+static int aead_decrypt_recv(struct p2p_session *s, const uint8_t *in, int in_len,
+                             uint8_t *out, int out_cap) {
+    aead_ctx_t *a = (aead_ctx_t *)s->dtls_data;
+    if (!a || !a->ready) return -1;             // 尚未收到对端随机数
+    if (in_len < AEAD_OVERHEAD + P2P_HDR_SIZE) return -1;
+
+    int len = in_len - AEAD_OVERHEAD;
+    if (len > out_cap) return -1;
+
+    uint64_t seq = nget_ll(in);
+    if (!replay_check(a, seq)) {
+        print("V:", LA_F("%s: replayed or stale record seq=%llu dropped", LA_F503, 503), "AEAD", (unsigned long long)seq);
+        return -1;
+    }
+
+    int rc;
+#ifdef P2P_THREADED
+    // 已由加密线程池预解开（任务指向本条记录且密钥未在此期间重新派生）
+    const p2p_aead_job_t *j = s->inst->crypto_rx_cur;
+    if (j && j->in == in + AEAD_SEQ_LEN && j->len == len && !memcmp(j->key, a->rx.key, sizeof(j->key))) {
+        rc = j->result;
+        if (!rc) memcpy(out, j->out, (size_t)len);
+    } else
+#endif
+    {
+        uint8_t nonce[P2P_AEAD_NONCE_LEN];
+        make_nonce(&a->rx, in, nonce);
+        rc = p2p_aead_open(a->rx.key, nonce, NULL, 0, in + AEAD_SEQ_LEN, (size_t)len, in + AEAD_SEQ_LEN + len, out);
+    }
+    if (rc != 0) {
+        print("V:", LA_F("%s: record authentication failed", LA_F504, 504), "AEAD");
+        return -1;
+    }
+    replay_accept(a, seq);
+    return len;
+}
+
+const p2p_dtls_ops_t p2p_dtls_aead = {
+    .name           = "AEAD-ChaCha20-Poly1305",
+    .init           = aead_init,
+    .close          = aead_close,
+    .is_ready       = aead_is_ready,
+    .encrypt_send   = aead_encrypt_send,
+    .decrypt_recv   = aead_decrypt_recv,
+    .conn_params    = aead_conn_params,
+    .on_conn_params = aead_on_conn_params,
+    .open_prepare   = aead_open_prepare,
+    .overhead       = AEAD_OVERHEAD,
+};
@@ -114,6 +114,11 @@
 #include <mbedtls/ctr_drbg.h>
 #include <mbedtls/error.h>
 #include <mbedtls/debug.h>
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_TICKET_C)
+#include <mbedtls/ssl_ticket.h>
+#include <mbedtls/platform_util.h>
+#define P2P_MBEDTLS_TICKETS
+#endif
 
 /*
  * DTLS 调试回调
@@ -191,6 +196,10 @@ typedef struct {
     mbedtls_entropy_context entropy;     /* 熵源 */
     p2p_dtls_timer_t        timer;       /* 重传定时器 */
     int                     handshake_done;  /* 握手是否完成 */
+    int                     is_server;   /* 服务端角色 */
+    int                     resuming;    /* 客户端已提交缓存的会话（握手失败时丢弃） */
+    int                     cid_set;     /* 已在首次握手前设置本端 CID */
+    int                     cid_active;  /* 握手协商了 CID（出站记录携带对端 CID） */
     uint8_t                 recv_buf[P2P_MTU];  /* 接收缓冲区 */
     int                     recv_len;    /* 缓冲区中的数据长度 */
 } p2p_dtls_ctx_t;
@@ -244,6 +253,150 @@ static int p2p_dtls_recv(void *ctx, unsigned char *buf, size_t len) {
     return (int)to_copy;
 }
 
+/*
+ * ============================================================================
+ * 会话恢复（session ticket）
+ * ============================================================================
+ *
+ * 服务端：ticket 上下文（含密钥与独立的 DRBG）在实例内共享，按需创建；
+ * 读写 ticket 的回调在缓存锁内调用，分片线程下也无需 MBEDTLS_THREADING_C。
+ * 客户端：init 时载入缓存的会话，握手完成后保存新会话。
+ */
+#ifdef P2P_MBEDTLS_TICKETS
+typedef struct {
+    mbedtls_ssl_ticket_context  ticket;
+    mbedtls_ctr_drbg_context    ctr_drbg;
+    mbedtls_entropy_context     entropy;
+} p2p_mbedtls_ticket_t;
+
+static void ticket_free(void *backend) {
+    p2p_mbedtls_ticket_t *tk = (p2p_mbedtls_ticket_t *)backend;
+    mbedtls_ssl_ticket_free(&tk->ticket);
+    mbedtls_ctr_drbg_free(&tk->ctr_drbg);
+    mbedtls_entropy_free(&tk->entropy);
+    p2p_free(tk);
+}
+
+static int ticket_write(void *p, const mbedtls_ssl_session *session, unsigned char *start,
+                        const unsigned char *end, size_t *tlen, uint32_t *lifetime) {
+    p2p_dtls_cache_t *c = (p2p_dtls_cache_t *)p;
+    p2p_dtls_cache_lock(c);
+    int ret = mbedtls_ssl_ticket_write(&((p2p_mbedtls_ticket_t *)c->backend)->ticket,
+                                       session, start, end, tlen, lifetime);
+    p2p_dtls_cache_unlock(c);
+    return ret;
+}
+
+static int ticket_parse(void *p, mbedtls_ssl_session *session, unsigned char *buf, size_t len) {
+    p2p_dtls_cache_t *c = (p2p_dtls_cache_t *)p;
+    p2p_dtls_cache_lock(c);
+    int ret = mbedtls_ssl_ticket_parse(&((p2p_mbedtls_ticket_t *)c->backend)->ticket,
+                                       session, buf, len);
+    p2p_dtls_cache_unlock(c);
+    return ret;
+}
+
+/* 服务端：挂接实例级 ticket 上下文（首次使用时创建） */
+static void resume_conf_server(struct p2p_session *s, p2p_dtls_ctx_t *dtls) {
+    p2p_dtls_cache_t *c = s->inst->dtls_cache;
+    if (!c) return;
+
+    p2p_dtls_cache_lock(c);
+    if (!c->backend) {
+        p2p_mbedtls_ticket_t *tk = p2p_calloc(1, sizeof(*tk));
+        if (tk) {
+            mbedtls_ssl_ticket_init(&tk->ticket);
+            mbedtls_ctr_drbg_init(&tk->ctr_drbg);
+            mbedtls_entropy_init(&tk->entropy);
+            int ret = mbedtls_ctr_drbg_seed(&tk->ctr_drbg, mbedtls_entropy_func, &tk->entropy,
+                                            c->ticket_key, sizeof(c->ticket_key));
+            if (ret == 0) ret = mbedtls_ssl_ticket_setup(&tk->ticket, mbedtls_ctr_drbg_random, &tk->ctr_drbg,
+                                                         MBEDTLS_CIPHER_AES_256_GCM, P2P_DTLS_RESUME_TTL_MS / 1000);
+            if (ret == 0) { c->backend = tk; c->backend_free = ticket_free; }
+            else {
+                print("W:", LA_F("[MbedTLS] ticket setup failed: -0x%x", LA_F496, 496), -ret);
+                ticket_free(tk);
+            }
+        }
+    }
+    int ok = c->backend != NULL;
+    p2p_dtls_cache_unlock(c);
+
+    if (ok) mbedtls_ssl_conf_session_tickets_cb(&dtls->conf, ticket_write, ticket_parse, c);
+}
+
+/* 客户端：提交缓存的会话（ssl_setup 之后） */
+static void resume_load(struct p2p_session *s, p2p_dtls_ctx_t *dtls) {
+    uint8_t blob[P2P_DTLS_RESUME_MAX];
+    int len = p2p_dtls_cache_get(s->inst, s->remote_peer_id, blob, sizeof(blob));
+    if (len <= 0) return;
+
+    mbedtls_ssl_session sess;
+    mbedtls_ssl_session_init(&sess);
+    if (mbedtls_ssl_session_load(&sess, blob, (size_t)len) == 0
+        && mbedtls_ssl_set_session(&dtls->ssl, &sess) == 0) {
+        dtls->resuming = 1;
+        print("I:", LA_F("[MbedTLS] resuming cached session for %s", LA_F497, 497), s->remote_peer_id);
+    } else {
+        p2p_dtls_cache_drop(s->inst, s->remote_peer_id);
+    }
+    mbedtls_ssl_session_free(&sess);
+    mbedtls_platform_zeroize(blob, sizeof(blob));
+}
+
+/* 客户端：握手完成后保存会话（含服务端新签发的 ticket） */
+static void resume_save(struct p2p_session *s, p2p_dtls_ctx_t *dtls) {
+    if (dtls->is_server) return;
+
+    mbedtls_ssl_session sess;
+    mbedtls_ssl_session_init(&sess);
+    uint8_t blob[P2P_DTLS_RESUME_MAX];
+    size_t len = 0;
+    if (mbedtls_ssl_get_session(&dtls->ssl, &sess) == 0
+        && mbedtls_ssl_session_save(&sess, blob, sizeof(blob), &len) == 0) {
+        p2p_dtls_cache_put(s->inst, s->remote_peer_id, blob, (int)len);
+    }
+    mbedtls_ssl_session_free(&sess);
+    mbedtls_platform_zeroize(blob, sizeof(blob));
+}
+#else
+#define resume_conf_server(s, dtls)     ((void)(s), (void)(dtls))
+#define resume_load(s, dtls)            ((void)(s), (void)(dtls))
+#define resume_save(s, dtls)            ((void)(s), (void)(dtls))
+#endif
+
+/*
+ * Connection ID（见 p2p_dtls.h）：本端 CID = s->id，需 MbedTLS 启用 MBEDTLS_SSL_DTLS_CONNECTION_ID；
+ * s->id 可能在会话创建后才确定（如 COMPACT 的 SYNC0_ACK），故推迟到首次握手前设置
+ */
+static void cid_prepare(struct p2p_session *s, p2p_dtls_ctx_t *dtls) {
+    if (dtls->cid_set) return;
+    dtls->cid_set = 1;
+#ifdef MBEDTLS_SSL_DTLS_CONNECTION_ID
+    if (!s->id) return;
+    unsigned char cid[P2P_DTLS_CID_LEN];
+    nwrite_l(cid, s->id);
+    mbedtls_ssl_set_cid(&dtls->ssl, MBEDTLS_SSL_CID_ENABLED, cid, sizeof(cid));
+#else
+    (void)s;
+#endif
+}
+
+/* 握手完成 / 失败的共同处理 */
+static void on_handshake_done(struct p2p_session *s, p2p_dtls_ctx_t *dtls) {
+    dtls->handshake_done = 1;
+#ifdef MBEDTLS_SSL_DTLS_CONNECTION_ID
+    int enabled = MBEDTLS_SSL_CID_DISABLED;
+    if (mbedtls_ssl_get_peer_cid(&dtls->ssl, &enabled, NULL, NULL) == 0)
+        dtls->cid_active = enabled == MBEDTLS_SSL_CID_ENABLED;
+#endif
+    resume_save(s, dtls);
+}
+
+static void on_handshake_failed(struct p2p_session *s, p2p_dtls_ctx_t *dtls) {
+    if (dtls->resuming) p2p_dtls_cache_drop(s->inst, s->remote_peer_id);
+}
+
 /*
  * ============================================================================
  * 初始化 DTLS 传输层
@@ -261,7 +414,7 @@ static int p2p_dtls_recv(void *ctx, unsigned char *buf, size_t len) {
  * @return   0=成功，-1=失败
  */
 static int dtls_init(struct p2p_session *s) {
-    p2p_dtls_ctx_t *dtls = calloc(1, sizeof(p2p_dtls_ctx_t));
+    p2p_dtls_ctx_t *dtls = p2p_calloc(1, sizeof(p2p_dtls_ctx_t));
     if (!dtls) {
         print("E:", LA_F("Failed to allocate DTLS context", LA_F279, 279));
         return -1;
@@ -304,7 +457,8 @@ static int dtls_init(struct p2p_session *s) {
     if (s->inst->cfg.dtls_role == 1)      is_server = 1;
     else if (s->inst->cfg.dtls_role == 2) is_server = 0;
     else /* auto */                 is_server = (s->remote_peer_id[0] == '\0')
-                                              || strcmp(s->inst->local_peer_id, s->remote_peer_id) > 0;
+                                              || strcmp(p2p_session_local_id(s), s->remote_peer_id) > 0;
+    dtls->is_server = is_server;
     print("I:", LA_F("[MbedTLS] DTLS role: %s (mode=%s)", LA_F435, 435),
           is_server ? "server" : "client",
           s->inst->cfg.dtls_role == 0 ? "auto" : "forced");
@@ -324,6 +478,9 @@ static int dtls_init(struct p2p_session *s) {
      *   生产环境应使用证书验证
      */
     mbedtls_ssl_conf_authmode(&dtls->conf, MBEDTLS_SSL_VERIFY_NONE);
+#ifdef MBEDTLS_SSL_DTLS_CONNECTION_ID
+    mbedtls_ssl_conf_cid(&dtls->conf, P2P_DTLS_CID_LEN, MBEDTLS_SSL_UNEXPECTED_CID_IGNORE);
+#endif
     mbedtls_ssl_conf_rng(&dtls->conf, mbedtls_ctr_drbg_random, &dtls->ctr_drbg);
     
     /*
@@ -360,6 +517,7 @@ static int dtls_init(struct p2p_session *s) {
      */
     if (is_server) {
         mbedtls_ssl_conf_dtls_cookies(&dtls->conf, NULL, NULL, NULL);
+        resume_conf_server(s, dtls);
     }
 
     int ret2;
@@ -374,6 +532,10 @@ static int dtls_init(struct p2p_session *s) {
     /* 设置定时器回调（DTLS 重传机制） */
     mbedtls_ssl_set_timer_cb(&dtls->ssl, &dtls->timer, p2p_dtls_set_timer, p2p_dtls_get_timer);
 
+    /* 客户端：对近期连接过的对端提交缓存会话，走简化握手 */
+    if (!is_server) resume_load(s, dtls);
+
+    p2p_mem_add(&s->mem, P2P_MEM_DTLS, sizeof(*dtls));
     return 0;
 
 fail_cleanup:
@@ -381,7 +543,7 @@ fail_cleanup:
     mbedtls_ssl_config_free(&dtls->conf);
     mbedtls_ctr_drbg_free(&dtls->ctr_drbg);
     mbedtls_entropy_free(&dtls->entropy);
-    free(dtls);
+    p2p_free(dtls);
     s->dtls_data = NULL;
     return -1;
 }
@@ -424,14 +586,16 @@ static void dtls_tick(struct p2p_session *s) {
     if (!dtls) return;
 
     if (!dtls->handshake_done) {
+        cid_prepare(s, dtls);
         int ret = mbedtls_ssl_handshake(&dtls->ssl);
         if (ret == 0) {
-            dtls->handshake_done = 1;
+            on_handshake_done(s, dtls);
             print("I:", LA_F("Handshake complete", LA_F301, 301));
         } else if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
             char ebuf[128];
             mbedtls_strerror(ret, ebuf, sizeof(ebuf));
             print("E:", LA_F("Handshake failed: %s (-0x%04x)", LA_F302, 302), ebuf, -ret);
+            on_handshake_failed(s, dtls);
             s->state = P2P_STATE_ERROR;
         }
     }
@@ -458,14 +622,16 @@ static int mbedtls_decrypt_recv(struct p2p_session *s, const uint8_t *in, int in
 
     if (!dtls->handshake_done) {
         /* 握手阶段：驱动状态机 */
+        cid_prepare(s, dtls);
         int ret = mbedtls_ssl_handshake(&dtls->ssl);
         if (ret == 0) {
-            dtls->handshake_done = 1;
+            on_handshake_done(s, dtls);
             print("I:", LA_F("DTLS handshake complete (MbedTLS)", LA_F273, 273));
         } else if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
             char ebuf[128];
             mbedtls_strerror(ret, ebuf, sizeof(ebuf));
             print("E:", LA_F("Handshake failed: %s (-0x%04x)", LA_F302, 302), ebuf, -ret);
+            on_handshake_failed(s, dtls);
         }
         return 0;  /* 握手包，无应用数据 */
     }
@@ -496,7 +662,8 @@ static void dtls_close(struct p2p_session *s) {
     mbedtls_ssl_config_free(&dtls->conf);
     mbedtls_ctr_drbg_free(&dtls->ctr_drbg);
     mbedtls_entropy_free(&dtls->entropy);
-    free(dtls);
+    p2p_mem_add(&s->mem, P2P_MEM_DTLS, -(int64_t)sizeof(*dtls));
+    p2p_free(dtls);
     s->dtls_data = NULL;
 }
 
@@ -515,6 +682,12 @@ static int dtls_is_ready(struct p2p_session *s) {
     return dtls && dtls->handshake_done;
 }
 
+/* 出站记录是否携带 CID（握手完成且对端接受了 CID 扩展） */
+static int dtls_has_cid(struct p2p_session *s) {
+    p2p_dtls_ctx_t *dtls = (p2p_dtls_ctx_t *)s->dtls_data;
+    return dtls && dtls->cid_active;
+}
+
 /*
  * ============================================================================
  * 加密层操作表
@@ -537,4 +710,5 @@ const p2p_dtls_ops_t p2p_dtls_mbedtls = {
     .is_ready     = dtls_is_ready,
     .encrypt_send = mbedtls_encrypt_send,
     .decrypt_recv = mbedtls_decrypt_recv,
+    .has_cid      = dtls_has_cid,
 };
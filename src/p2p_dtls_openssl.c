@@ -13,6 +13,8 @@ typedef struct {
     BIO     *read_bio;
     BIO     *write_bio;
     int      handshake_done;
+    int      is_server;
+    int      resuming;          // 客户端已提交缓存的会话（握手失败时丢弃）
 } p2p_openssl_ctx_t;
 
 static unsigned int psk_client_cb(SSL *ssl, const char *hint, char *identity,
@@ -48,8 +50,56 @@ static void openssl_flush_bio(struct p2p_session *s, BIO *write_bio) {
     }
 }
 
+/*
+ * 会话恢复（session ticket）
+ *
+ * 服务端：各会话的 SSL_CTX 使用实例内共享的 ticket 密钥，此前会话签发的 ticket 可被后续会话解开；
+ * 客户端：init 时提交缓存的会话，握手完成后保存（DER 序列化，含 ticket）
+ */
+static void resume_load(struct p2p_session *s, p2p_openssl_ctx_t *os) {
+    uint8_t blob[P2P_DTLS_RESUME_MAX];
+    int len = p2p_dtls_cache_get(s->inst, s->remote_peer_id, blob, sizeof(blob));
+    if (len <= 0) return;
+
+    const unsigned char *p = blob;
+    SSL_SESSION *sess = d2i_SSL_SESSION(NULL, &p, len);
+    if (sess && SSL_set_session(os->ssl, sess) == 1) {
+        os->resuming = 1;
+        print("I:", LA_F("[OpenSSL] resuming cached session for %s", LA_F498, 498), s->remote_peer_id);
+    } else {
+        p2p_dtls_cache_drop(s->inst, s->remote_peer_id);
+    }
+    if (sess) SSL_SESSION_free(sess);
+    OPENSSL_cleanse(blob, sizeof(blob));
+}
+
+static void on_handshake_done(struct p2p_session *s, p2p_openssl_ctx_t *os) {
+    os->handshake_done = 1;
+    print("I:", LA_F("[OpenSSL] DTLS handshake completed", LA_F436, 436));
+    if (os->is_server) return;
+
+    SSL_SESSION *sess = SSL_get_session(os->ssl);
+    int len = sess ? i2d_SSL_SESSION(sess, NULL) : 0;
+    if (len <= 0 || len > P2P_DTLS_RESUME_MAX) return;
+
+    uint8_t blob[P2P_DTLS_RESUME_MAX];
+    unsigned char *p = blob;
+    if (i2d_SSL_SESSION(sess, &p) == len) p2p_dtls_cache_put(s->inst, s->remote_peer_id, blob, len);
+    OPENSSL_cleanse(blob, sizeof(blob));
+}
+
+/* 握手未完成时检查失败（SSL_do_handshake 返回值 <= 0） */
+static void check_handshake_error(struct p2p_session *s, p2p_openssl_ctx_t *os, int ret) {
+    int err = SSL_get_error(os->ssl, ret);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return;
+    if (os->resuming) {
+        os->resuming = 0;
+        p2p_dtls_cache_drop(s->inst, s->remote_peer_id);
+    }
+}
+
 static int openssl_init(struct p2p_session *s) {
-    p2p_openssl_ctx_t *os = calloc(1, sizeof(p2p_openssl_ctx_t));
+    p2p_openssl_ctx_t *os = p2p_calloc(1, sizeof(p2p_openssl_ctx_t));
     if (!os) {
         print("E:", LA_F("Failed to allocate OpenSSL context", LA_F280, 280));
         return -1;
@@ -59,11 +109,17 @@ static int openssl_init(struct p2p_session *s) {
     os->ctx = SSL_CTX_new(DTLS_method());
     if (!os->ctx) {
         print("E:", LA_F("SSL_CTX_new failed", LA_F371, 371));
-        free(os); s->dtls_data = NULL;
+        p2p_free(os); s->dtls_data = NULL;
         return -1;
     }
     SSL_CTX_set_verify(os->ctx, SSL_VERIFY_NONE, NULL);
 
+    /* 实例共享的 ticket 密钥（名称 16B + HMAC 16B + AES 16B） */
+    if (s->inst->dtls_cache) {
+        SSL_CTX_set_tlsext_ticket_keys(os->ctx, s->inst->dtls_cache->ticket_key,
+                                       sizeof(s->inst->dtls_cache->ticket_key));
+    }
+
     if (s->inst->cfg.auth_key) {
         SSL_CTX_set_psk_client_callback(os->ctx, psk_client_cb);
         SSL_CTX_set_psk_server_callback(os->ctx, psk_server_cb);
@@ -72,7 +128,7 @@ static int openssl_init(struct p2p_session *s) {
     os->ssl = SSL_new(os->ctx);
     if (!os->ssl) {
         print("E:", LA_F("SSL_new failed", LA_F372, 372));
-        SSL_CTX_free(os->ctx); free(os); s->dtls_data = NULL;
+        SSL_CTX_free(os->ctx); p2p_free(os); s->dtls_data = NULL;
         return -1;
     }
     SSL_set_ex_data(os->ssl, 0, s);
@@ -84,7 +140,7 @@ static int openssl_init(struct p2p_session *s) {
         if (os->read_bio) BIO_free(os->read_bio);
         if (os->write_bio) BIO_free(os->write_bio);
         SSL_free(os->ssl); SSL_CTX_free(os->ctx);
-        free(os); s->dtls_data = NULL;
+        p2p_free(os); s->dtls_data = NULL;
         return -1;
     }
     BIO_set_mem_eof_return(os->read_bio, -1);
@@ -99,7 +155,8 @@ static int openssl_init(struct p2p_session *s) {
     if (s->inst->cfg.dtls_role == 1)      is_server = 1;
     else if (s->inst->cfg.dtls_role == 2) is_server = 0;
     else /* auto */                 is_server = (s->remote_peer_id[0] == '\0')
-                                              || strcmp(s->inst->local_peer_id, s->remote_peer_id) > 0;
+                                              || strcmp(p2p_session_local_id(s), s->remote_peer_id) > 0;
+    os->is_server = is_server;
     print("I:", LA_F("[OpenSSL] DTLS role: %s (mode=%s)", LA_F437, 437),
           is_server ? "server" : "client",
           s->inst->cfg.dtls_role == 0 ? "auto" : "forced");
@@ -108,8 +165,10 @@ static int openssl_init(struct p2p_session *s) {
         SSL_set_accept_state(os->ssl);
     } else {
         SSL_set_connect_state(os->ssl);
+        resume_load(s, os);         /* 近期连接过的对端走简化握手 */
     }
 
+    p2p_mem_add(&s->mem, P2P_MEM_DTLS, sizeof(*os));
     return 0;
 }
 
@@ -119,10 +178,8 @@ static void openssl_tick(struct p2p_session *s) {
 
     if (!os->handshake_done) {
         int ret = SSL_do_handshake(os->ssl);
-        if (ret == 1) {
-            os->handshake_done = 1;
-            print("I:", LA_F("[OpenSSL] DTLS handshake completed", LA_F436, 436));
-        }
+        if (ret == 1) on_handshake_done(s, os);
+        else check_handshake_error(s, os, ret);
     }
     openssl_flush_bio(s, os->write_bio);
 }
@@ -164,10 +221,8 @@ static int openssl_decrypt_recv(struct p2p_session *s, const uint8_t *in, int in
 
     if (!os->handshake_done) {
         int ret = SSL_do_handshake(os->ssl);
-        if (ret == 1) {
-            os->handshake_done = 1;
-            print("I:", LA_F("[OpenSSL] DTLS handshake completed", LA_F436, 436));
-        }
+        if (ret == 1) on_handshake_done(s, os);
+        else check_handshake_error(s, os, ret);
         openssl_flush_bio(s, os->write_bio);
         return 0;
     }
@@ -181,7 +236,8 @@ static void openssl_close(struct p2p_session *s) {
     if (!os) return;
     if (os->ssl) SSL_free(os->ssl);
     if (os->ctx) SSL_CTX_free(os->ctx);
-    free(os);
+    p2p_mem_add(&s->mem, P2P_MEM_DTLS, -(int64_t)sizeof(*os));
+    p2p_free(os);
     s->dtls_data = NULL;
 }
 
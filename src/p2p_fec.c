@@ -0,0 +1,135 @@
+/*
+ * P2P 前向纠错实现（XOR 单校验），协议说明见 p2p_fec.h
+ */
+
+#define MOD_TAG "FEC"
+
+#include "p2p_internal.h"
+#include "p2p_fec.h"
+
+#define TASK_FEC                        "FEC"
+
+///////////////////////////////////////////////////////////////////////////////
+
+static void xor_into(uint8_t *dst, const uint8_t *src, int len) {
+    for (int i = 0; i < len; i++) dst[i] ^= src[i];
+}
+
+void fec_reset(struct p2p_session *s) {
+    fec_t *f = &s->fec;
+    p2p_free(f->tx_buf);
+    p2p_free(f->rx_buf);
+    memset(f, 0, sizeof(*f));
+}
+
+int fec_overhead(const struct p2p_session *s) {
+    return s->inst->cfg.fec && s->reliable.fec ? (int)P2P_PKT_FEC_PSZ : 0;
+}
+
+/* 按活跃路径丢包率选取组大小：每组 K 个 DATA + 1 个校验包，0=不发校验包 */
+static int fec_group_size(struct p2p_session *s) {
+    // 信令中转与 TCP 路径本身可靠，不发校验包
+    if (s->path_type != P2P_PATH_PUNCH && s->path_type != P2P_PATH_LAN && s->path_type != P2P_PATH_RELAY) return 0;
+    const path_stats_t *st = p2p_get_path_stats(s, s->active_path);
+    float loss = st ? st->loss_rate : 0.0f;
+    if (loss < FEC_LOSS_MIN) return 0;
+    if (loss >= 0.10f) return 2;
+    if (loss >= 0.05f) return 4;
+    if (loss >= 0.02f) return 8;
+    return FEC_GROUP_MAX;
+}
+
+/* 发出当前组的校验包：[k][len_xor][parity]（tx_buf 首部即预留的负载头） */
+static void parity_send(struct p2p_session *s, uint64_t now) {
+    fec_t *f = &s->fec;
+    f->tx_buf[0] = f->tx_cnt;
+    nwrite_s(f->tx_buf + 1, f->tx_len_xor);
+    p2p_send_packet(s, &s->active_addr, P2P_PKT_FEC, 0, f->tx_first, f->tx_buf,
+                    (int)P2P_PKT_FEC_PSZ + f->tx_max, now);
+    f->parity_sent++;
+    f->tx_cnt = 0;
+}
+
+void fec_on_send(struct p2p_session *s, uint16_t seq, const uint8_t *data, int len, uint64_t now) {
+    fec_t *f = &s->fec;
+    if (!fec_overhead(s)) return;
+
+    // 序号不连续（前一组被窗口或节奏截断）：先结束前一组
+    if (f->tx_cnt && seq != (uint16_t)(f->tx_first + f->tx_cnt)) parity_send(s, now);
+
+    if (!f->tx_cnt) {
+        if (!(f->tx_k = (uint8_t)fec_group_size(s))) return;
+        if (!f->tx_buf && !(f->tx_buf = (uint8_t*)p2p_malloc(P2P_PKT_FEC_PSZ + P2P_PMTU_PAYLOAD_MAX))) return;
+        memset(f->tx_buf + P2P_PKT_FEC_PSZ, 0, P2P_PMTU_PAYLOAD_MAX);
+        f->tx_first = seq;
+        f->tx_len_xor = 0;
+        f->tx_max = 0;
+    }
+
+    // 校验包超出当前路径上限（开启后组包尚未预留）：放弃本组
+    if ((int)P2P_PKT_FEC_PSZ + len > nat_pmtu_payload(s)) { f->tx_cnt = 0; return; }
+
+    xor_into(f->tx_buf + P2P_PKT_FEC_PSZ, data, len);
+    f->tx_len_xor ^= (uint16_t)len;
+    if (len > f->tx_max) f->tx_max = len;
+    if (++f->tx_cnt >= f->tx_k) parity_send(s, now);
+}
+
+void fec_flush(struct p2p_session *s, uint64_t now) {
+    if (s->fec.tx_cnt) parity_send(s, now);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void fec_on_data(struct p2p_session *s, uint16_t seq, const uint8_t *data, int len) {
+    fec_t *f = &s->fec;
+    if (!f->rx_buf || len <= 0 || len > P2P_PMTU_PAYLOAD_MAX) return;
+    int i = seq & (FEC_SPAN - 1);
+    memcpy(f->rx_buf + (size_t)i * P2P_PMTU_PAYLOAD_MAX, data, len);
+    f->rx_seq[i] = seq;
+    f->rx_len[i] = (uint16_t)len;
+}
+
+void fec_on_parity(struct p2p_session *s, uint16_t first, const uint8_t *payload, int len) {
+    fec_t *f = &s->fec;
+    if (len < (int)P2P_PKT_FEC_PSZ) return;
+    int k = payload[0], plen = len - (int)P2P_PKT_FEC_PSZ;
+    if (k < 1 || k > FEC_GROUP_MAX || plen <= 0 || plen > P2P_PMTU_PAYLOAD_MAX) return;
+
+    // 首个校验包：开始保留 DATA 副本（本组无法还原）
+    if (!f->rx_buf) {
+        if (!(f->rx_buf = (uint8_t*)p2p_malloc((size_t)FEC_SPAN * P2P_PMTU_PAYLOAD_MAX))) return;
+        memset(f->rx_len, 0, sizeof(f->rx_len));
+        print("V:", LA_F("%s: peer sends parity, keeping last %d DATA", LA_F599, 599), TASK_FEC, FEC_SPAN);
+        return;
+    }
+
+    // 组内恰好缺一个包才能还原；已全部收到的组直接丢弃
+    int miss = -1;
+    for (int j = 0; j < k; j++) {
+        int i = (first + j) & (FEC_SPAN - 1);
+        if (f->rx_len[i] && f->rx_seq[i] == (uint16_t)(first + j)) continue;
+        if (miss >= 0) return;
+        miss = j;
+    }
+    if (miss < 0) return;
+    uint16_t seq = (uint16_t)(first + miss);
+    if (reliable_recv_has(s, seq)) return;
+
+    uint8_t buf[P2P_PMTU_PAYLOAD_MAX];
+    memcpy(buf, payload + P2P_PKT_FEC_PSZ, plen);
+    int dlen = nget_s(payload + 1);
+    for (int j = 0; j < k; j++) {
+        if (j == miss) continue;
+        int i = (first + j) & (FEC_SPAN - 1);
+        if (f->rx_len[i] > plen) return;                    // 与校验包不一致（序号回绕后的旧副本）
+        xor_into(buf, f->rx_buf + (size_t)i * P2P_PMTU_PAYLOAD_MAX, f->rx_len[i]);
+        dlen ^= f->rx_len[i];
+    }
+    if (dlen <= 0 || dlen > plen) return;
+
+    f->recovered++;
+    print("V:", LA_F("%s: recovered seq=%u from group %u+%d", LA_F600, 600), TASK_FEC, seq, first, k);
+    fec_on_data(s, seq, buf, dlen);
+    reliable_on_data(s, seq, buf, dlen);
+}
@@ -0,0 +1,81 @@
+/*
+ * P2P 前向纠错（cfg.fec，基础 reliable 层 DATA）
+ *
+ * 高 RTT 的有损路径（卫星、移动网络）上 ARQ 每次丢包至少付出一个 RTT。本模块在 DATA 首发时
+ * 按连续序号分组，每组 K 个包之后附发一个 XOR 校验包（P2P_PKT_FEC），接收方组内只丢一个包时
+ * 直接由校验包与其余 K-1 个包还原，不等重传：
+ *
+ *   校验包: 包头 seq = 组内首包序号
+ *           负载 [k(1)][len_xor(2)][parity(N)]
+ *           parity = 组内各 DATA 负载（按最长者补 0）逐字节异或，len_xor = 各负载长度异或
+ *
+ * 分组：
+ *   - K 在组开始时按活跃路径 loss_rate 选取（FEC_LOSS_MIN 以下不发校验包；丢包越高组越小，
+ *     见 fec_group_size），重传与经其他路径发出的副本不参与分组
+ *   - 仅 UDP 路径（直连 / TURN）；信令中转与 TCP 路径本身可靠，不发校验包
+ *   - 本轮发送结束（无待发新包）时未满的组立即发出校验包，突发尾部丢包同样不必等 RTO
+ *   - 双方 CONN 通告 RELIABLE_CAP_FEC（可解码）后才发送；开启后 DATA 组包预留 P2P_PKT_FEC_PSZ，
+ *     使校验包与满载 DATA 同样不超过路径负载上限
+ *
+ * 接收：
+ *   - 收到首个校验包后才开始保留最近 FEC_SPAN 个 DATA 负载副本（按需分配），未启用 FEC 的会话不占内存
+ *   - 校验包到达时组内恰好缺一个包即还原并按原序号交给 reliable 层；缺两个以上由 ARQ 照常恢复
+ *
+ * 只实现 XOR 单校验（每组纠正一个丢包）：随机丢包下它覆盖绝大多数可恢复情形，且编解码仅为
+ * 逐字节异或（编译器可自动向量化）；多校验的 Reed-Solomon 需要整组缓冲与 GF(256) 运算，
+ * 开销与突发丢包收益不成比例，未采用。
+ */
+
+#ifndef P2P_FEC_H
+#define P2P_FEC_H
+
+#include "predefine.h"
+#include <p2pp.h>                /* P2P_PMTU_PAYLOAD_MAX, P2P_PKT_FEC_PSZ */
+
+struct p2p_session;
+
+#define FEC_SPAN                32          /* 接收端保留的最近 DATA 副本数（须 >= FEC_GROUP_MAX 且为 2 的幂） */
+#define FEC_GROUP_MAX           16          /* 组大小上限（低丢包率时） */
+#define FEC_LOSS_MIN            0.01f       /* 活跃路径丢包率低于此值时不发校验包 */
+
+#if FEC_SPAN < FEC_GROUP_MAX || (FEC_SPAN & (FEC_SPAN - 1))
+#error "FEC_SPAN must be a power of two not smaller than FEC_GROUP_MAX"
+#endif
+
+typedef struct {
+    /* 发送端：当前组 */
+    uint8_t*                tx_buf;         // 校验累加缓冲区（P2P_PMTU_PAYLOAD_MAX，首次发送时分配）
+    uint16_t                tx_first;       // 组内首包序号
+    uint16_t                tx_len_xor;     // 组内负载长度异或
+    int                     tx_max;         // 组内最长负载
+    uint8_t                 tx_cnt;         // 已累加包数，0=无进行中的组
+    uint8_t                 tx_k;           // 本组大小
+
+    /* 接收端：最近 FEC_SPAN 个 DATA 负载副本（下标 = seq & (FEC_SPAN-1)） */
+    uint8_t*                rx_buf;         // FEC_SPAN * P2P_PMTU_PAYLOAD_MAX，首个校验包到达时分配
+    uint16_t                rx_seq[FEC_SPAN];
+    uint16_t                rx_len[FEC_SPAN];   // 0=空槽
+
+    /* 统计 */
+    uint32_t                parity_sent;    // 已发出的校验包
+    uint32_t                recovered;      // 由校验包还原的 DATA
+} fec_t;
+
+void fec_reset(struct p2p_session *s);
+
+/* 发送端：本端与对端均启用时 DATA 负载需预留的字节数（否则为 0） */
+int  fec_overhead(const struct p2p_session *s);
+
+/* 发送端：DATA(seq) 首次发出后累加进当前组，组满时发出校验包 */
+void fec_on_send(struct p2p_session *s, uint16_t seq, const uint8_t *data, int len, uint64_t now);
+
+/* 发送端：本轮发送结束，未满的组立即发出校验包 */
+void fec_flush(struct p2p_session *s, uint64_t now);
+
+/* 接收端：收到 DATA(seq) 负载（已去除分段 / 捎带 ACK） */
+void fec_on_data(struct p2p_session *s, uint16_t seq, const uint8_t *data, int len);
+
+/* 接收端：收到校验包（first = 包头 seq） */
+void fec_on_parity(struct p2p_session *s, uint16_t first, const uint8_t *payload, int len);
+
+#endif /* P2P_FEC_H */
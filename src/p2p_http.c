@@ -1,206 +1,781 @@
 /*
- * p2p_http.c — 跨平台最小 HTTPS 客户端实现
+ * p2p_http.c — 跨平台最小 HTTPS 客户端实现（非阻塞）
  *
  * 见 p2p_http.h 中的说明。
+ *
+ * 所有后端共用同一个请求状态机与响应解析：
+ *
+ *   IDLE ──request──> CONNECTING ──> HANDSHAKE ──> SENDING ──> RECEIVING ──> DONE
+ *     ^                 （新建连接）                  ^  （复用保活连接）        │
+ *     │                                              └── IDLE + 保活 ──request─┤
+ *     └──────────────────────────── poll 返回结果 ─────────────────────────────┘
+ *
+ * 复用的保活连接可能已被服务器关闭：尚未收到任何响应字节就断开时，
+ * 自动新建连接并重发一次请求。
  */
 
+#define MOD_TAG "HTTP"
+
+#include "p2p_internal.h"
 #include "p2p_http.h"
 
-/* ============================================================
- * Windows 后端：WinHTTP
- *
- * WinHTTP 是 Windows 系统自带的 HTTP/HTTPS 客户端库，
- * 无需任何第三方依赖，支持 XP SP2 及以上所有 Windows 版本。
- * 通过 #pragma comment 自动链接，不需要在 CMakeLists 中额外指定。
- * ============================================================ */
-#if P_WIN
+#define HTTP_HDR_MAX            8192        /* 响应头上限 */
+
+typedef enum {
+    HTTP_IDLE = 0,
+    HTTP_RESOLVING,                         /* 等待主机名异步解析（p2p_dns_resolve）*/
+    HTTP_CONNECTING,                        /* TCP 非阻塞 connect 进行中 */
+    HTTP_HANDSHAKE,                         /* TLS 握手中 */
+    HTTP_SENDING,                           /* 发送请求 */
+    HTTP_RECEIVING,                         /* 接收响应 */
+    HTTP_DONE,                              /* 结果待取（p2p_http_poll 返回后回到 IDLE）*/
+} http_st;
 
+#if defined(WITH_DTLS)
+#include <mbedtls/ssl.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/x509_crt.h>
+#include <mbedtls/net_sockets.h>
+#elif P_WIN
 #include <winhttp.h>
 #pragma comment(lib, "winhttp.lib")
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+struct p2p_http {
+    http_st             state;
+    int                 result;             /* DONE 时的结果：HTTP 状态码或 < 0 */
+    uint64_t            deadline;           /* 本次请求时限 */
+
+    char                host[128];
+    uint16_t            port;
+    char                ca_file[256];       /* 指定的 CA 证书包（空 = 使用系统证书包）*/
+    bool                insecure;           /* 显式允许找不到 CA 证书包时不校验服务器证书 */
+
+    /* 请求 */
+    char               *tx;
+    int                 tx_len, tx_off;
+
+    /* 响应 */
+    char               *rx;                 /* HTTP_HDR_MAX + P2P_HTTP_RESP_MAX + 1 */
+    int                 rx_len;
+    int                 hdr_len;            /* 0 = 响应头未收完 */
+    int                 status;
+    long                clen;               /* Content-Length（-1 = 无）*/
+    bool                chunked;
+    bool                close;              /* Connection: close */
+    bool                until_eof;          /* 响应体读到连接关闭为止（curl 后端：已由 curl 解码）*/
+    char               *body;
+    int                 body_len;
+    char                etag[P2P_HTTP_ETAG_MAX];
+    long                rl_remaining;       /* X-RateLimit-Remaining（-1 = 未携带）*/
+    long long           rl_reset;           /* X-RateLimit-Reset（Unix 秒）*/
+
+#if defined(WITH_DTLS)
+    sock_t              fd;                 /* 连接（P_INVALID_SOCKET = 无）*/
+    bool                reused;             /* 本次请求复用了保活连接 */
+    uint64_t            idle_since;         /* 保活连接进入空闲的时间 */
+    char                addr_host[128];     /* addr 对应的主机名（解析缓存）*/
+    struct sockaddr_in  addr;
+
+    bool                tls_ok;             /* conf/drbg 初始化成功 */
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config  conf;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_entropy_context  entropy;
+    mbedtls_x509_crt    ca;
+#elif !P_WIN
+    FILE               *fp;                 /* curl 进程的 stdout */
+#endif
+};
+
+/* ============================================================
+ * 公共：URL 拆分与响应解析
+ * ============================================================ */
+
+/* "https://host[:port]/path" → host / port / path（path 指向 url 内部）*/
+static bool url_split(const char *url, char *host, int host_sz, uint16_t *port, const char **path) {
+
+    if (strncmp(url, "https://", 8) != 0) return false;
+    const char *h = url + 8;
+    const char *p = strchr(h, '/');
+    if (!p) p = h + strlen(h);
+    const char *colon = memchr(h, ':', (size_t)(p - h));
+    const char *he = colon ? colon : p;
+    if (he == h || he - h >= host_sz) return false;
+    memcpy(host, h, (size_t)(he - h));
+    host[he - h] = '\0';
+    *port = colon ? (uint16_t)atoi(colon + 1) : 443;
+    *path = *p ? p : "/";
+    return *port != 0;
+}
+
+/* 头部行前缀匹配（name 为小写，大小写不敏感）*/
+static bool hdr_match(const char *line, const char *name) {
+    for (; *name; line++, name++) {
+        if (tolower((unsigned char)*line) != *name) return false;
+    }
+    return true;
+}
+
+/* 跳过头部值前导空白 */
+static const char *hdr_value(const char *line, int name_len) {
+    const char *v = line + name_len;
+    while (*v == ' ' || *v == '\t') v++;
+    return v;
+}
 
 /*
- * 内部实现：所有 HTTP 操作走这一个函数。
- * method    "GET" 或 "PATCH"
- * body      NULL 表示无请求体（GET）
- * resp_buf  NULL 表示不需要响应体（写操作）
+ * chunked 解码：先确认整个 chunked 体已收完（含终止块与 trailer），再原地拼接
+ * @return 1 = 完成（*out_len 为解码后长度），0 = 需要更多数据，-1 = 格式错误
  */
-static int winhttp_request(const char *method,
-                            const char *url,
-                            const char *token,
-                            const char *body,
-                            char       *resp_buf,
-                            int         resp_size)
-{
-    int result = -1;
+static int dechunk(char *b, int len, int *out_len) {
 
-    /* URL → wchar_t */
-    wchar_t w_url[2048] = {0};
-    if (!MultiByteToWideChar(CP_UTF8, 0, url, -1, w_url, 2048)) return -1;
-
-    /* 解析 URL（提取 host、path、port）*/
-    wchar_t w_host[256] = {0};
-    wchar_t w_path[1024] = {0};
-    URL_COMPONENTS uc;
-    memset(&uc, 0, sizeof(uc));
-    uc.dwStructSize      = sizeof(uc);
-    uc.lpszHostName      = w_host;
-    uc.dwHostNameLength  = 256;
-    uc.lpszUrlPath       = w_path;
-    uc.dwUrlPathLength   = 1024;
-    if (!WinHttpCrackUrl(w_url, 0, 0, &uc)) return -1;
-
-    /* 创建 WinHTTP 会话句柄 */
-    HINTERNET hSession = WinHttpOpen(L"p2p/1.0",
-                                      WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
-                                      WINHTTP_NO_PROXY_NAME,
-                                      WINHTTP_NO_PROXY_BYPASS, 0);
-    if (!hSession) return -1;
-
-    /* 建立连接 */
-    INTERNET_PORT port = uc.nPort ? uc.nPort : INTERNET_DEFAULT_HTTPS_PORT;
-    HINTERNET hConnect = WinHttpConnect(hSession, w_host, port, 0);
-    if (!hConnect) { WinHttpCloseHandle(hSession); return -1; }
-
-    /* 创建请求 */
-    wchar_t w_method[16] = {0};
-    MultiByteToWideChar(CP_UTF8, 0, method, -1, w_method, 16);
-    HINTERNET hRequest = WinHttpOpenRequest(hConnect, w_method, w_path,
-                                             NULL,
-                                             WINHTTP_NO_REFERER,
-                                             WINHTTP_DEFAULT_ACCEPT_TYPES,
-                                             WINHTTP_FLAG_SECURE);
-    if (!hRequest) goto cleanup_connect;
-
-    /* Authorization 头 */
-    if (token && token[0]) {
-        char   hdr_a[600];
-        wchar_t hdr_w[600];
-        snprintf(hdr_a, sizeof(hdr_a), "Authorization: token %s\r\n", token);
-        MultiByteToWideChar(CP_UTF8, 0, hdr_a, -1, hdr_w, 600);
-        WinHttpAddRequestHeaders(hRequest, hdr_w, (DWORD)-1,
-                                  WINHTTP_ADDREQ_FLAG_ADD);
-    }
-
-    /* Content-Type 头（有 body 时） */
-    if (body) {
-        WinHttpAddRequestHeaders(hRequest,
-                                  L"Content-Type: application/json\r\n",
-                                  (DWORD)-1, WINHTTP_ADDREQ_FLAG_ADD);
-    }
-
-    /* 发送请求 */
-    DWORD body_len = body ? (DWORD)strlen(body) : 0;
-    if (!WinHttpSendRequest(hRequest,
-                             WINHTTP_NO_ADDITIONAL_HEADERS, 0,
-                             body ? (LPVOID)body : WINHTTP_NO_REQUEST_DATA,
-                             body_len, body_len, 0)) {
-        goto cleanup_request;
-    }
-
-    /* 等待响应 */
-    if (!WinHttpReceiveResponse(hRequest, NULL)) goto cleanup_request;
-
-    /* 读取响应体 */
-    result = 0;
-    if (resp_buf && resp_size > 1) {
-        int total = 0;
-        DWORD avail = 0, nread = 0;
-        while (WinHttpQueryDataAvailable(hRequest, &avail) && avail > 0) {
-            DWORD to_read = avail;
-            if (total + (int)to_read >= resp_size - 1)
-                to_read = (DWORD)(resp_size - total - 1);
-            if (!WinHttpReadData(hRequest, resp_buf + total, to_read, &nread))
-                break;
-            total += (int)nread;
-            if (total >= resp_size - 1) break;
+    /* 第一遍：只校验完整性，不修改缓冲区（数据不全时下次重新扫描）*/
+    int pos = 0;
+    for (;;) {
+        char *eol = NULL;
+        for (int i = pos; i + 1 < len; i++) if (b[i] == '\r' && b[i + 1] == '\n') { eol = b + i; break; }
+        if (!eol) return 0;
+        char *end;
+        long size = strtol(b + pos, &end, 16);
+        if (end == b + pos || size < 0) return -1;
+        pos = (int)(eol - b) + 2;
+        if (size == 0) {
+            /* trailer：逐行跳过直到空行 */
+            for (;;) {
+                eol = NULL;
+                for (int i = pos; i + 1 < len; i++) if (b[i] == '\r' && b[i + 1] == '\n') { eol = b + i; break; }
+                if (!eol) return 0;
+                if (eol == b + pos) break;
+                pos = (int)(eol - b) + 2;
+            }
+            break;
         }
-        resp_buf[total] = '\0';
-        result = total;
+        if (size > len - pos - 2) return size > P2P_HTTP_RESP_MAX ? -1 : 0;
+        pos += (int)size + 2;
     }
 
-cleanup_request:
-    WinHttpCloseHandle(hRequest);
-cleanup_connect:
-    WinHttpCloseHandle(hConnect);
-    WinHttpCloseHandle(hSession);
-    return result;
+    /* 第二遍：原地拼接数据块 */
+    int w = 0;
+    pos = 0;
+    for (;;) {
+        long size = strtol(b + pos, NULL, 16);
+        pos = (int)(strstr(b + pos, "\r\n") - b) + 2;
+        if (size == 0) break;
+        memmove(b + w, b + pos, (size_t)size);
+        w += (int)size;
+        pos += (int)size + 2;
+    }
+    b[w] = '\0';
+    *out_len = w;
+    return 1;
 }
 
-ret_t p2p_http_get(const char *url, const char *token,
-                 char *resp_buf, int resp_size) {
+/*
+ * 解析 rx 中的响应
+ * @param eof  连接已关闭（之后不会再有数据）
+ * @return     1 = 完整，0 = 需要更多数据，-1 = 格式错误
+ */
+static int resp_parse(p2p_http_t *h, bool eof) {
 
-    return winhttp_request("GET", url, token, NULL, resp_buf, resp_size);
-}
+    while (!h->hdr_len) {
+        char *eoh = strstr(h->rx, "\r\n\r\n");
+        if (!eoh) return (eof || h->rx_len >= HTTP_HDR_MAX) ? -1 : 0;
+        if (strncmp(h->rx, "HTTP/", 5) != 0) return -1;
+
+        const char *sp = strchr(h->rx, ' ');
+        h->status = (sp && sp < eoh) ? atoi(sp + 1) : 0;
+        if (h->status < 100 || h->status > 599) return -1;
+        int hdr_len = (int)(eoh + 4 - h->rx);
+
+        /* 1xx 中间响应，或 curl 输出的前置头部块（代理 CONNECT 应答等）：丢弃，解析下一个 */
+        if (h->status < 200 || (h->until_eof && !strncmp(h->rx + hdr_len, "HTTP/", 5))) {
+            h->rx_len -= hdr_len;
+            memmove(h->rx, h->rx + hdr_len, (size_t)h->rx_len + 1);
+            continue;
+        }
+        h->hdr_len = hdr_len;
+
+        h->clen = -1; h->chunked = false; h->close = false; h->etag[0] = '\0';
+        h->rl_remaining = -1; h->rl_reset = 0;
+        for (const char *ln = strstr(h->rx, "\r\n"); ln && ln < eoh; ln = strstr(ln, "\r\n")) {
+            ln += 2;
+            size_t vlen;
+            if (hdr_match(ln, "content-length:")) h->clen = strtol(hdr_value(ln, 15), NULL, 10);
+            else if (hdr_match(ln, "transfer-encoding:")) {
+                const char *v = hdr_value(ln, 18);
+                h->chunked = hdr_match(v, "chunked");
+            }
+            else if (hdr_match(ln, "connection:")) h->close = hdr_match(hdr_value(ln, 11), "close");
+            else if (hdr_match(ln, "x-ratelimit-remaining:")) h->rl_remaining = strtol(hdr_value(ln, 22), NULL, 10);
+            else if (hdr_match(ln, "x-ratelimit-reset:")) h->rl_reset = strtoll(hdr_value(ln, 18), NULL, 10);
+            else if (hdr_match(ln, "etag:")) {
+                const char *v = hdr_value(ln, 5);
+                vlen = strcspn(v, "\r\n");
+                if (vlen < sizeof(h->etag)) { memcpy(h->etag, v, vlen); h->etag[vlen] = '\0'; }
+            }
+        }
+        if (h->until_eof) { h->clen = -1; h->chunked = false; }
+    }
 
-ret_t p2p_http_patch(const char *url, const char *token, const char *body) {
+    char *b = h->rx + h->hdr_len;
+    int blen = h->rx_len - h->hdr_len;
 
-    int r = winhttp_request("PATCH", url, token, body, NULL, 0);
-    return (r >= 0) ? 0 : -1;
+    /* 无响应体的状态 */
+    if (h->status == 204 || h->status == 304) {
+        h->body = b; h->body_len = 0; *b = '\0';
+        return 1;
+    }
+    if (h->chunked) {
+        int r = dechunk(b, blen, &h->body_len);
+        if (r == 0 && eof) return -1;
+        if (r == 1) h->body = b;
+        return r;
+    }
+    if (h->clen >= 0) {
+        if (h->clen > P2P_HTTP_RESP_MAX) return -1;
+        if (blen < h->clen) return eof ? -1 : 0;
+        h->body = b; h->body_len = (int)h->clen; b[h->clen] = '\0';
+        return 1;
+    }
+    /* 无长度信息：读到连接关闭 */
+    if (!eof) return 0;
+    h->close = true;
+    h->body = b; h->body_len = blen;
+    return 1;
 }
 
+/* 重置响应解析状态 */
+static void resp_reset(p2p_http_t *h) {
+    h->rx_len = 0; h->rx[0] = '\0';
+    h->hdr_len = 0; h->status = 0;
+    h->body = h->rx; h->body_len = 0;
+}
+
+/* 结束本次请求（result: HTTP 状态码或 < 0） */
+static void http_finish(p2p_http_t *h, int result);
+
 /* ============================================================
- * Unix 后端（macOS / Linux）：popen + curl
+ * 后端 1：进程内 HTTP/1.1 + MbedTLS（WITH_DTLS）
  *
- * macOS：/usr/bin/curl 随系统预装，保证存在。
- * Linux：curl 在主流发行版中几乎必然预装；
- *        若不存在，popen() 返回 NULL，函数返回 -1。
+ * 非阻塞 TCP + mbedtls_ssl，BIO 回调直接读写套接字，WANT_READ/WANT_WRITE
+ * 时返回等待下次 poll。响应完整且服务器未要求 Connection: close 时保留连接，
+ * 下次请求同一主机直接复用，省去 TCP + TLS 握手的往返。
  *
- * GET  —— popen("curl ... url", "r")，直接从 stdout 读取响应体，
- *          无需临时文件。
- * PATCH—— popen("curl ... -d @- url", "w")，将 body 写入 curl 的
- *          stdin（-d @- 表示从 stdin 读请求体），无需临时文件。
+ * CA 证书：优先使用 p2p_http_create 指定的证书包，否则依次尝试常见系统证书包
+ * （编译期可用 P2P_HTTP_CA_FILE 追加）。全部不可用时创建失败，不会以未校验的连接
+ * 发送 token；仅当调用方显式允许（insecure）时才降级为不校验服务器证书（打印告警）。
  * ============================================================ */
-#else /* !P_WIN */
+#if defined(WITH_DTLS)
+
+#ifndef P2P_HTTP_CA_FILE
+#define P2P_HTTP_CA_FILE        NULL
+#endif
+
+static const char *ca_files[] = {
+    P2P_HTTP_CA_FILE,
+    "/etc/ssl/certs/ca-certificates.crt",   /* Debian / Ubuntu / Alpine */
+    "/etc/pki/tls/certs/ca-bundle.crt",     /* RHEL / CentOS / Fedora */
+    "/etc/ssl/cert.pem",                    /* macOS / OpenBSD */
+    "/usr/local/etc/openssl/cert.pem",      /* Homebrew */
+};
+
+static int bio_send(void *ctx, const unsigned char *buf, size_t len) {
+    p2p_http_t *h = (p2p_http_t *)ctx;
+    ssize_t n;
+    do {
+        n = send(h->fd, (const char *)buf, (int)len, 0);
+    } while (n < 0 && P_sock_is_interrupted());
+    if (n < 0) return P_sock_is_wouldblock() ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_SEND_FAILED;
+    return (int)n;
+}
+
+static int bio_recv(void *ctx, unsigned char *buf, size_t len) {
+    p2p_http_t *h = (p2p_http_t *)ctx;
+    ssize_t n;
+    do {
+        n = recv(h->fd, (char *)buf, (int)len, 0);
+    } while (n < 0 && P_sock_is_interrupted());
+    if (n < 0) return P_sock_is_wouldblock() ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_RECV_FAILED;
+    return (int)n;                          /* 0 = 对端关闭 */
+}
+
+static void conn_close(p2p_http_t *h) {
+    if (h->fd == P_INVALID_SOCKET) return;
+    P_sock_close(h->fd);
+    h->fd = P_INVALID_SOCKET;
+}
+
+/* 新建连接：异步解析（按主机缓存，未就绪时进入 RESOLVING 由 backend_poll 重试）→ 非阻塞 connect */
+static ret_t conn_open(p2p_http_t *h) {
+
+    conn_close(h);
+    h->reused = false;
+
+    if (strcmp(h->addr_host, h->host) != 0) {
+        int r = p2p_dns_resolve(h->host, h->port, &h->addr);
+        if (r < 0) return E_UNKNOWN;
+        if (r == 0) { h->state = HTTP_RESOLVING; return E_NONE; }
+        strncpy(h->addr_host, h->host, sizeof(h->addr_host) - 1);
+    }
+    h->addr.sin_port = htons(h->port);
+
+    h->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (h->fd == P_INVALID_SOCKET) return E_UNKNOWN;
+    if (P_sock_nonblock(h->fd, true) != E_NONE) { conn_close(h); return E_UNKNOWN; }
+
+    if (connect(h->fd, (struct sockaddr *)&h->addr, sizeof(h->addr)) != 0 && !P_sock_is_inprogress()) {
+        print("W:", LA_F("connect %s:%u failed(%d)", LA_F561, 561), h->host, h->port, P_sock_errno());
+        conn_close(h);
+        h->addr_host[0] = '\0';             /* 下次重新解析 */
+        return E_UNKNOWN;
+    }
+
+    mbedtls_ssl_session_reset(&h->ssl);
+    mbedtls_ssl_set_hostname(&h->ssl, h->host);
+    h->state = HTTP_CONNECTING;
+    return E_NONE;
+}
+
+static ret_t backend_init(p2p_http_t *h) {
 
-ret_t p2p_http_get(const char *url, const char *token,
-                 char *resp_buf, int resp_size) {
+    h->fd = P_INVALID_SOCKET;
+    mbedtls_ssl_init(&h->ssl);
+    mbedtls_ssl_config_init(&h->conf);
+    mbedtls_ctr_drbg_init(&h->drbg);
+    mbedtls_entropy_init(&h->entropy);
+    mbedtls_x509_crt_init(&h->ca);
 
-    if (!resp_buf || resp_size <= 1) return -1;
+    static const char pers[] = "p2p_http";
+    if (mbedtls_ctr_drbg_seed(&h->drbg, mbedtls_entropy_func, &h->entropy,
+                              (const unsigned char *)pers, sizeof(pers) - 1) != 0) return E_UNKNOWN;
+    if (mbedtls_ssl_config_defaults(&h->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0) return E_UNKNOWN;
 
-    char cmd[2048];
-    if (token && token[0]) {
-        snprintf(cmd, sizeof(cmd),
-                 "curl -s -m 15 -H 'Authorization: token %s' '%s'",
-                 token, url);
+    bool ca = false;
+    if (h->ca_file[0]) {
+        ca = mbedtls_x509_crt_parse_file(&h->ca, h->ca_file) >= 0 && h->ca.version;
+        if (!ca) print("E:", LA_F("load CA bundle %s failed", LA_F709, 709), h->ca_file);
+    }
+    for (size_t i = 0; i < sizeof(ca_files) / sizeof(ca_files[0]) && !ca && !h->ca_file[0]; i++) {
+        ca = ca_files[i] && mbedtls_x509_crt_parse_file(&h->ca, ca_files[i]) >= 0 && h->ca.version;
+    }
+    if (ca) {
+        mbedtls_ssl_conf_ca_chain(&h->conf, &h->ca, NULL);
+        mbedtls_ssl_conf_authmode(&h->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    } else if (h->insecure) {
+        print("W:", LA_F("no CA bundle found, server certificate will not be verified", LA_F562, 562));
+        mbedtls_ssl_conf_authmode(&h->conf, MBEDTLS_SSL_VERIFY_NONE);
     } else {
-        snprintf(cmd, sizeof(cmd), "curl -s -m 15 '%s'", url);
+        print("E:", LA_F("no CA bundle found, refusing unverified TLS (set tls_ca_file)", LA_F710, 710));
+        return E_NONE_CONTEXT;
+    }
+    mbedtls_ssl_conf_rng(&h->conf, mbedtls_ctr_drbg_random, &h->drbg);
+
+    if (mbedtls_ssl_setup(&h->ssl, &h->conf) != 0) return E_UNKNOWN;
+    mbedtls_ssl_set_bio(&h->ssl, h, bio_send, bio_recv, NULL);
+    h->tls_ok = true;
+    return E_NONE;
+}
+
+static void backend_free(p2p_http_t *h) {
+    conn_close(h);
+    mbedtls_ssl_free(&h->ssl);
+    mbedtls_ssl_config_free(&h->conf);
+    mbedtls_ctr_drbg_free(&h->drbg);
+    mbedtls_entropy_free(&h->entropy);
+    mbedtls_x509_crt_free(&h->ca);
+}
+
+static ret_t backend_start(p2p_http_t *h, const char *method, const char *path,
+                           const char *token, const char *etag, const char *body) {
+
+    if (!h->tls_ok) return E_NONE_CONTEXT;
+
+    size_t body_len = body ? strlen(body) : 0;
+    size_t cap = body_len + strlen(path) + 512 + (token ? strlen(token) : 0) + P2P_HTTP_ETAG_MAX;
+    char *tx = (char *)p2p_realloc(h->tx, cap);
+    if (!tx) return E_OUT_OF_MEMORY;
+    h->tx = tx;
+
+    int n = snprintf(tx, cap,
+                     "%s %s HTTP/1.1\r\n"
+                     "Host: %s\r\n"
+                     "User-Agent: p2p/1.0\r\n"
+                     "Accept: application/vnd.github+json\r\n",
+                     method, path, h->host);
+    if (token && token[0]) n += snprintf(tx + n, cap - (size_t)n, "Authorization: token %s\r\n", token);
+    if (etag && etag[0])   n += snprintf(tx + n, cap - (size_t)n, "If-None-Match: %s\r\n", etag);
+    if (body) n += snprintf(tx + n, cap - (size_t)n,
+                            "Content-Type: application/json\r\nContent-Length: %u\r\n", (unsigned)body_len);
+    else if (strcmp(method, "GET") != 0) n += snprintf(tx + n, cap - (size_t)n, "Content-Length: 0\r\n");
+    n += snprintf(tx + n, cap - (size_t)n, "\r\n");
+    if (body) { memcpy(tx + n, body, body_len); n += (int)body_len; }
+    h->tx_len = n;
+    h->tx_off = 0;
+
+    /* 同一主机的空闲保活连接：直接复用 */
+    if (h->fd != P_INVALID_SOCKET && !strcmp(h->addr_host, h->host) && ntohs(h->addr.sin_port) == h->port
+        && tick_diff(P_tick_ms(), h->idle_since) < P2P_HTTP_KEEPALIVE_MS) {
+        h->reused = true;
+        h->state = HTTP_SENDING;
+        return E_NONE;
+    }
+    return conn_open(h);
+}
+
+/* 复用连接在收到任何响应前失败：新建连接重发一次 */
+static bool retry_fresh(p2p_http_t *h) {
+    if (!h->reused || h->rx_len > 0) return false;
+    print("V:", LA_F("keep-alive connection to %s lost, reconnecting", LA_F563, 563), h->host);
+    h->tx_off = 0;
+    return conn_open(h) == E_NONE;
+}
+
+static void backend_poll(p2p_http_t *h) {
+
+    if (h->state == HTTP_RESOLVING) {
+        if (conn_open(h) != E_NONE) { http_finish(h, -1); return; }
+        if (h->state == HTTP_RESOLVING) return;
     }
 
-    FILE *fp = popen(cmd, "r");
-    if (!fp) return -1;
+    if (h->state == HTTP_CONNECTING) {
+        fd_set wfds;
+        FD_ZERO(&wfds);
+        FD_SET(h->fd, &wfds);
+        struct timeval tv = {0, 0};
+        int ret = select((int)h->fd + 1, NULL, &wfds, NULL, &tv);
+        if (ret == 0) return;
+        int err = 0;
+        socklen_t errlen = sizeof(err);
+        if (ret < 0 || getsockopt(h->fd, SOL_SOCKET, SO_ERROR, (char *)&err, &errlen) < 0 || err != 0) {
+            print("W:", LA_F("connect %s:%u failed(%d)", LA_F564, 564), h->host, h->port, err);
+            h->addr_host[0] = '\0';
+            http_finish(h, -1);
+            return;
+        }
+        h->state = HTTP_HANDSHAKE;
+    }
+
+    if (h->state == HTTP_HANDSHAKE) {
+        int r = mbedtls_ssl_handshake(&h->ssl);
+        if (r == MBEDTLS_ERR_SSL_WANT_READ || r == MBEDTLS_ERR_SSL_WANT_WRITE) return;
+        if (r != 0) {
+            print("W:", LA_F("TLS handshake with %s failed: -0x%04x", LA_F565, 565), h->host, (unsigned)-r);
+            http_finish(h, -1);
+            return;
+        }
+        h->state = HTTP_SENDING;
+    }
+
+    if (h->state == HTTP_SENDING) {
+        while (h->tx_off < h->tx_len) {
+            int r = mbedtls_ssl_write(&h->ssl, (const unsigned char *)h->tx + h->tx_off,
+                                      (size_t)(h->tx_len - h->tx_off));
+            if (r == MBEDTLS_ERR_SSL_WANT_READ || r == MBEDTLS_ERR_SSL_WANT_WRITE) return;
+            if (r < 0) {
+                if (!retry_fresh(h)) http_finish(h, -1);
+                return;
+            }
+            h->tx_off += r;
+        }
+        h->state = HTTP_RECEIVING;
+    }
+
+    if (h->state == HTTP_RECEIVING) {
+        for (;;) {
+            int room = HTTP_HDR_MAX + P2P_HTTP_RESP_MAX - h->rx_len;
+            if (room <= 0) { http_finish(h, -1); return; }
+            int r = mbedtls_ssl_read(&h->ssl, (unsigned char *)h->rx + h->rx_len, (size_t)room);
+            if (r == MBEDTLS_ERR_SSL_WANT_READ || r == MBEDTLS_ERR_SSL_WANT_WRITE) return;
+            bool eof = r == 0 || r == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY;
+            if (r < 0 && !eof) {
+                if (!retry_fresh(h)) http_finish(h, -1);
+                return;
+            }
+            if (eof && retry_fresh(h)) return;
+            if (r > 0) { h->rx_len += r; h->rx[h->rx_len] = '\0'; }
+
+            int p = resp_parse(h, eof);
+            if (p < 0) { http_finish(h, -1); return; }
+            if (p > 0) {
+                if (h->close || eof) conn_close(h);
+                else h->idle_since = P_tick_ms();
+                http_finish(h, h->status);
+                return;
+            }
+            if (eof) { http_finish(h, -1); return; }
+        }
+    }
+}
+
+static void backend_abort(p2p_http_t *h) {
+    conn_close(h);
+}
+
+static void backend_idle(p2p_http_t *h, uint64_t now_ms) {
+    if (h->fd != P_INVALID_SOCKET && tick_diff(now_ms, h->idle_since) >= P2P_HTTP_KEEPALIVE_MS)
+        conn_close(h);
+}
+
+/* ============================================================
+ * 后端 2：Windows（无 MbedTLS）— WinHTTP
+ *
+ * WinHTTP 是 Windows 系统自带的 HTTP/HTTPS 客户端库，无需第三方依赖。
+ * 此后端以同步方式在 p2p_http_request() 内完成整个请求，结果留待
+ * p2p_http_poll() 返回；需要非阻塞行为时请以 WITH_DTLS 构建。
+ * ============================================================ */
+#elif P_WIN
+
+static ret_t backend_init(p2p_http_t *h) { (void)h; return E_NONE; }
+static void  backend_free(p2p_http_t *h) { (void)h; }
+static void  backend_poll(p2p_http_t *h) { (void)h; }
+static void  backend_abort(p2p_http_t *h) { (void)h; }
+static void  backend_idle(p2p_http_t *h, uint64_t now_ms) { (void)h; (void)now_ms; }
+
+static ret_t backend_start(p2p_http_t *h, const char *method, const char *path,
+                           const char *token, const char *etag, const char *body) {
+
+    int result = -1;
+    wchar_t w_host[128] = {0}, w_path[1024] = {0}, w_method[16] = {0};
+    MultiByteToWideChar(CP_UTF8, 0, h->host, -1, w_host, 128);
+    MultiByteToWideChar(CP_UTF8, 0, path, -1, w_path, 1024);
+    MultiByteToWideChar(CP_UTF8, 0, method, -1, w_method, 16);
+
+    HINTERNET hSession = WinHttpOpen(L"p2p/1.0", WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
+                                     WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
+    if (!hSession) { http_finish(h, -1); return E_NONE; }
+    HINTERNET hConnect = WinHttpConnect(hSession, w_host, h->port, 0);
+    HINTERNET hRequest = hConnect ? WinHttpOpenRequest(hConnect, w_method, w_path, NULL,
+                                                       WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES,
+                                                       WINHTTP_FLAG_SECURE) : NULL;
+    if (!hRequest) goto cleanup;
+
+    char   hdr_a[600 + P2P_HTTP_ETAG_MAX];
+    wchar_t hdr_w[600 + P2P_HTTP_ETAG_MAX];
+    int n = snprintf(hdr_a, sizeof(hdr_a), "Accept: application/vnd.github+json\r\n");
+    if (token && token[0]) n += snprintf(hdr_a + n, sizeof(hdr_a) - (size_t)n, "Authorization: token %s\r\n", token);
+    if (etag && etag[0])   n += snprintf(hdr_a + n, sizeof(hdr_a) - (size_t)n, "If-None-Match: %s\r\n", etag);
+    if (body)              snprintf(hdr_a + n, sizeof(hdr_a) - (size_t)n, "Content-Type: application/json\r\n");
+    MultiByteToWideChar(CP_UTF8, 0, hdr_a, -1, hdr_w, (int)(sizeof(hdr_w) / sizeof(hdr_w[0])));
+    WinHttpAddRequestHeaders(hRequest, hdr_w, (DWORD)-1, WINHTTP_ADDREQ_FLAG_ADD);
+
+    DWORD body_len = body ? (DWORD)strlen(body) : 0;
+    if (!WinHttpSendRequest(hRequest, WINHTTP_NO_ADDITIONAL_HEADERS, 0,
+                            body ? (LPVOID)body : WINHTTP_NO_REQUEST_DATA, body_len, body_len, 0)
+        || !WinHttpReceiveResponse(hRequest, NULL)) goto cleanup;
+
+    DWORD status = 0, st_size = sizeof(status);
+    WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+                        WINHTTP_HEADER_NAME_BY_INDEX, &status, &st_size, WINHTTP_NO_HEADER_INDEX);
+
+    wchar_t w_etag[P2P_HTTP_ETAG_MAX];
+    DWORD etag_len = sizeof(w_etag);
+    h->etag[0] = '\0';
+    if (WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_ETAG, WINHTTP_HEADER_NAME_BY_INDEX,
+                            w_etag, &etag_len, WINHTTP_NO_HEADER_INDEX)) {
+        if (!WideCharToMultiByte(CP_UTF8, 0, w_etag, -1, h->etag, (int)sizeof(h->etag), NULL, NULL))
+            h->etag[0] = '\0';
+    }
+
+    DWORD rl = 0, rl_size = sizeof(rl);
+    if (WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_CUSTOM | WINHTTP_QUERY_FLAG_NUMBER, L"X-RateLimit-Remaining",
+                            &rl, &rl_size, WINHTTP_NO_HEADER_INDEX)) h->rl_remaining = (long)rl;
+    rl_size = sizeof(rl);
+    if (WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_CUSTOM | WINHTTP_QUERY_FLAG_NUMBER, L"X-RateLimit-Reset",
+                            &rl, &rl_size, WINHTTP_NO_HEADER_INDEX)) h->rl_reset = (long long)rl;
 
     int total = 0;
-    size_t n;
-    while ((n = fread(resp_buf + total, 1,
-                      (size_t)(resp_size - total - 1), fp)) > 0) {
-        total += (int)n;
-        if (total >= resp_size - 1) break;
+    DWORD avail = 0, nread = 0;
+    while (WinHttpQueryDataAvailable(hRequest, &avail) && avail > 0 && total < P2P_HTTP_RESP_MAX) {
+        if (total + (int)avail > P2P_HTTP_RESP_MAX) avail = (DWORD)(P2P_HTTP_RESP_MAX - total);
+        if (!WinHttpReadData(hRequest, h->rx + total, avail, &nread)) break;
+        total += (int)nread;
+    }
+    h->rx[total] = '\0';
+    h->body = h->rx; h->body_len = total;
+    result = (int)status;
+
+cleanup:
+    if (hRequest) WinHttpCloseHandle(hRequest);
+    if (hConnect) WinHttpCloseHandle(hConnect);
+    WinHttpCloseHandle(hSession);
+    http_finish(h, result);
+    return E_NONE;
+}
+
+/* ============================================================
+ * 后端 3：Unix（无 MbedTLS）— popen + curl
+ *
+ * macOS 预装 /usr/bin/curl；Linux 主流发行版几乎必然预装。
+ * curl 以 -D - 把响应头与（已解码的）响应体一起写到 stdout，
+ * stdout 管道设为非阻塞，poll 时有多少读多少，EOF 后统一解析。
+ * 请求体通过 shell here-document 写入 curl 的 stdin（--data-binary @-），
+ * 因此 popen 只需 "r" 模式，不存在写端阻塞。
+ * ============================================================ */
+#else
+
+static ret_t backend_init(p2p_http_t *h) { h->fp = NULL; return E_NONE; }
+
+static void backend_abort(p2p_http_t *h) {
+    if (!h->fp) return;
+    pclose(h->fp);
+    h->fp = NULL;
+}
+
+static void backend_free(p2p_http_t *h) { backend_abort(h); }
+static void backend_idle(p2p_http_t *h, uint64_t now_ms) { (void)h; (void)now_ms; }
+
+static ret_t backend_start(p2p_http_t *h, const char *method, const char *path,
+                           const char *token, const char *etag, const char *body) {
+
+    /* 参数原样拼入单引号命令行：拒绝含单引号的输入 */
+    if (strchr(path, '\'') || (token && strchr(token, '\'')) || (etag && strpbrk(etag, "'\r\n")))
+        return E_INVALID;
+
+    size_t cap = (body ? strlen(body) : 0) + strlen(path) + 512 + (token ? strlen(token) : 0) + P2P_HTTP_ETAG_MAX
+               + sizeof(h->ca_file);
+    char *cmd = (char *)p2p_realloc(h->tx, cap);
+    if (!cmd) return E_OUT_OF_MEMORY;
+    h->tx = cmd;
+
+    int n = snprintf(cmd, cap, "curl -s -m %d -D - -X %s -H 'Accept: application/vnd.github+json' ",
+                     P2P_HTTP_TIMEOUT_MS / 1000, method);
+    if (h->ca_file[0])     n += snprintf(cmd + n, cap - (size_t)n, "--cacert '%s' ", h->ca_file);
+    if (token && token[0]) n += snprintf(cmd + n, cap - (size_t)n, "-H 'Authorization: token %s' ", token);
+    if (etag && etag[0])   n += snprintf(cmd + n, cap - (size_t)n, "-H 'If-None-Match: %s' ", etag);
+    if (body) n += snprintf(cmd + n, cap - (size_t)n, "-H 'Content-Type: application/json' --data-binary @- ");
+    n += snprintf(cmd + n, cap - (size_t)n, "'https://%s:%u%s'", h->host, h->port, path);
+    if (body) snprintf(cmd + n, cap - (size_t)n, " <<'P2P_HTTP_EOF'\n%s\nP2P_HTTP_EOF\n", body);
+
+    h->fp = popen(cmd, "r");
+    if (!h->fp) return E_UNKNOWN;
+    int fd = fileno(h->fp);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    h->until_eof = true;
+    h->state = HTTP_RECEIVING;
+    return E_NONE;
+}
+
+static void backend_poll(p2p_http_t *h) {
+
+    if (h->state != HTTP_RECEIVING || !h->fp) return;
+
+    int fd = fileno(h->fp);
+    for (;;) {
+        int room = HTTP_HDR_MAX + P2P_HTTP_RESP_MAX - h->rx_len;
+        if (room <= 0) { http_finish(h, -1); return; }
+        ssize_t n = read(fd, h->rx + h->rx_len, (size_t)room);
+        if (n > 0) { h->rx_len += (int)n; h->rx[h->rx_len] = '\0'; continue; }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+        break;                              /* EOF 或错误：curl 已退出 */
     }
-    resp_buf[total] = '\0';
-    pclose(fp);
-    return total;
+
+    int rc = pclose(h->fp);
+    h->fp = NULL;
+    http_finish(h, rc == 0 && resp_parse(h, true) > 0 ? h->status : -1);
 }
 
-ret_t p2p_http_patch(const char *url, const char *token, const char *body) {
+#endif
+
+/* ============================================================
+ * 公共 API
+ * ============================================================ */
+
+static void http_finish(p2p_http_t *h, int result) {
+    if (result < 0) backend_abort(h);
+    h->result = result;
+    h->state = HTTP_DONE;
+}
 
-    if (!body) return -1;
+p2p_http_t *p2p_http_create(const char *ca_file, bool insecure) {
 
-    char cmd[2048];
-    snprintf(cmd, sizeof(cmd),
-             "curl -s -m 15 -X PATCH "
-             "-H 'Authorization: token %s' "
-             "-H 'Content-Type: application/json' "
-             "-d @- '%s' > /dev/null",
-             token ? token : "", url);
+    /* 路径原样拼入 curl 单引号命令行，且须完整保存 */
+    if (ca_file && (strlen(ca_file) >= sizeof(((p2p_http_t *)0)->ca_file) || strchr(ca_file, '\''))) return NULL;
 
-    /* popen "w" 模式：写入 curl 的 stdin，curl 通过 -d @- 读取 */
-    FILE *fp = popen(cmd, "w");
-    if (!fp) return -1;
+    p2p_http_t *h = (p2p_http_t *)p2p_calloc(1, sizeof(*h));
+    if (!h) return NULL;
+    if (ca_file) strcpy(h->ca_file, ca_file);
+    h->insecure = insecure;
+    h->rx = (char *)p2p_malloc(HTTP_HDR_MAX + P2P_HTTP_RESP_MAX + 1);
+    if (!h->rx || backend_init(h) != E_NONE) {
+        p2p_http_free(h);
+        return NULL;
+    }
+    resp_reset(h);
+    return h;
+}
 
-    fputs(body, fp);
-    int rc = pclose(fp);
-    /* pclose 返回 shell 退出码；curl 成功为 0 */
-    return (rc == 0) ? 0 : -1;
+void p2p_http_free(p2p_http_t *h) {
+    if (!h) return;
+    backend_free(h);
+    p2p_free(h->tx);
+    p2p_free(h->rx);
+    p2p_free(h);
 }
 
-#endif /* !P_WIN */
+ret_t p2p_http_request(p2p_http_t *h, const char *method, const char *url,
+                       const char *token, const char *etag, const char *body) {
+
+    if (!h || !method || !url) return E_INVALID;
+    if (h->state != HTTP_IDLE) return E_BUSY;
+
+    char host[sizeof(h->host)];
+    uint16_t port;
+    const char *path;
+    if (!url_split(url, host, (int)sizeof(host), &port, &path)) return E_INVALID;
+    memcpy(h->host, host, sizeof(h->host));
+    h->port = port;
+
+    resp_reset(h);
+    h->etag[0] = '\0';
+    h->rl_remaining = -1;
+    h->rl_reset = 0;
+    h->until_eof = false;
+    h->deadline = P_tick_ms() + P2P_HTTP_TIMEOUT_MS;
+
+    ret_t ret = backend_start(h, method, path, token, etag, body);
+    if (ret != E_NONE) h->state = HTTP_IDLE;
+    return ret;
+}
+
+int p2p_http_poll(p2p_http_t *h, uint64_t now_ms) {
+
+    if (!h) return -1;
+    if (h->state == HTTP_IDLE) { backend_idle(h, now_ms); return 0; }
+
+    if (h->state != HTTP_DONE) {
+        backend_poll(h);
+        if (h->state != HTTP_DONE && now_ms >= h->deadline) {
+            print("W:", LA_F("request to %s timed out", LA_F566, 566), h->host);
+            http_finish(h, -1);
+        }
+        if (h->state != HTTP_DONE) return 0;
+    }
+
+    h->state = HTTP_IDLE;
+    return h->result ? h->result : -1;
+}
+
+bool p2p_http_busy(const p2p_http_t *h) {
+    return h && h->state != HTTP_IDLE;
+}
+
+const char *p2p_http_body(const p2p_http_t *h, int *len) {
+    if (len) *len = h->body_len;
+    return h->body;
+}
+
+const char *p2p_http_etag(const p2p_http_t *h) {
+    return h->etag;
+}
+
+long p2p_http_ratelimit(const p2p_http_t *h, long long *reset) {
+    if (reset) *reset = h->rl_reset;
+    return h->rl_remaining;
+}
@@ -1,22 +1,22 @@
 /*
- * p2p_http — 跨平台最小 HTTPS 客户端
+ * p2p_http — 跨平台最小 HTTPS 客户端（非阻塞）
  *
- * 只实现 PUBSUB 信令所需的两个操作：GET 和 PATCH。
+ * 只实现 PUBSUB 信令所需的操作：GET（可带 If-None-Match 条件请求）和 PATCH。
+ * 请求由 p2p_http_request() 发起，之后在主循环中反复调用 p2p_http_poll() 推进，
+ * 任何一步都不会阻塞调用方。
  *
  * 后端选择（编译期自动）：
- * ┌─────────────────┬──────────────────────────────────────────────────┐
- * │  平台           │  后端                                            │
- * ├─────────────────┼──────────────────────────────────────────────────┤
- * │  Windows        │  WinHTTP（Windows 系统库，零外部依赖）           │
- * │  macOS          │  popen + /usr/bin/curl（系统预装，零外部依赖）   │
- * │  Linux / 其他   │  popen + curl（通常预装；不存在时返回 -1）       │
- * └─────────────────┴──────────────────────────────────────────────────┘
+ *   WITH_DTLS              进程内 HTTP/1.1 + MbedTLS，非阻塞 TCP，连接保活复用
+ *   Unix（无 MbedTLS）     popen + curl，非阻塞读取 curl 的 stdout
+ *   Windows（无 MbedTLS）  WinHTTP（同步，p2p_http_request 内完成）
  *
  * 使用约束：
  *   - 仅支持 HTTPS
- *   - 响应体截断至 resp_size - 1 字节（总是以 '\0' 结尾）
- *   - 不解析 HTTP 状态码（调用方自行判断响应内容）
- *   - 函数均为阻塞调用，建议只在信令线程中调用
+ *   - 每个客户端同一时刻只有一个请求（HTTP/1.1 不做管线化）
+ *   - 响应体上限 P2P_HTTP_RESP_MAX 字节，超出视为失败
+ *   - 主机名经 p2p_dns_resolve 异步解析（进程内缓存），保活期间不重复解析；
+ *     curl / WinHTTP 后端由其自身解析
+ *   - 非线程安全，建议只在信令线程中使用
  */
 
 #ifndef P2P_HTTP_H
@@ -28,31 +28,64 @@
 extern "C" {
 #endif
 
+#define P2P_HTTP_ETAG_MAX       128         /* ETag 缓冲区大小（含 '\0'）*/
+#define P2P_HTTP_RESP_MAX       32768       /* 响应体上限（字节）*/
+#define P2P_HTTP_TIMEOUT_MS     15000       /* 单个请求时限（含建连与握手）*/
+#define P2P_HTTP_KEEPALIVE_MS   60000       /* 空闲保活连接超过该时长后关闭 */
+
+typedef struct p2p_http p2p_http_t;
+
+/*
+ * 创建 / 释放客户端
+ *
+ * @param ca_file   校验服务器证书的 CA 证书包（PEM）路径，NULL 使用系统证书包
+ * @param insecure  MbedTLS 后端找不到可用的 CA 证书包时允许不校验服务器证书；
+ *                  false 时创建失败（返回 NULL），不会以未校验的连接发送 token
+ *
+ * 释放时中止进行中的请求并关闭保活连接。
+ */
+p2p_http_t *p2p_http_create(const char *ca_file, bool insecure);
+void        p2p_http_free(p2p_http_t *h);
+
 /*
- * p2p_http_get — 发起 HTTPS GET 请求
- *
- * @param url        完整 URL（必须以 "https://" 开头）
- * @param token      GitHub token，用于 "Authorization: token <token>" 头；
- *                   传 NULL 或空字符串则不附加 Authorization 头
- * @param resp_buf   响应体输出缓冲区（调用方分配）
- * @param resp_size  缓冲区字节数（含结尾 '\0'）
- * @return           实际写入 resp_buf 的字节数（不含 '\0'）; < 0 表示失败
+ * p2p_http_request — 发起请求（立即返回）
+ *
+ * @param method  "GET" 或 "PATCH"
+ * @param url     完整 URL（必须以 "https://" 开头）
+ * @param token   GitHub token，用于 "Authorization: token <token>" 头；NULL/空串不附加
+ * @param etag    非空时附加 "If-None-Match: <etag>"（条件 GET），NULL/空串不附加
+ * @param body    请求体（Content-Type 固定为 application/json），NULL 表示无请求体
+ * @return        E_NONE: 已发起; E_BUSY: 已有请求进行中; 其他: 失败
  */
-ret_t p2p_http_get(const char *url, const char *token,
-                 char *resp_buf, int resp_size);
+ret_t p2p_http_request(p2p_http_t *h, const char *method, const char *url,
+                       const char *token, const char *etag, const char *body);
 
 /*
- * p2p_http_patch — 发起 HTTPS PATCH 请求
+ * p2p_http_poll — 推进进行中的请求（非阻塞）
  *
- * Content-Type 固定为 application/json。
- * 本函数不读取响应体（信令写入不需要检查返回内容）。
+ * @return  0: 进行中（或空闲）; > 0: 请求完成，值为 HTTP 状态码（如 200/304）;
+ *          < 0: 请求失败（连接、TLS、超时或响应格式错误）
+ *
+ * 非 0 结果只返回一次，之后客户端回到空闲状态；响应体与 ETag 在下一次请求前有效。
+ */
+int         p2p_http_poll(p2p_http_t *h, uint64_t now_ms);
+
+/* 是否有请求进行中 */
+bool        p2p_http_busy(const p2p_http_t *h);
+
+/*
+ * 最近一次完成的请求的响应体（以 '\0' 结尾）与响应 ETag（无则为空串）
+ */
+const char *p2p_http_body(const p2p_http_t *h, int *len);
+const char *p2p_http_etag(const p2p_http_t *h);
+
+/*
+ * 最近一次完成的请求的速率限制余量（GitHub X-RateLimit-Remaining / X-RateLimit-Reset）
  *
- * @param url    完整 URL
- * @param token  GitHub token
- * @param body   JSON 请求体（以 '\0' 结尾的字符串）
- * @return       0:成功; !=0: 失败
+ * @param reset  输出配额重置时间（Unix 秒），可为 NULL
+ * @return       剩余请求数；响应未携带时为 -1
  */
-ret_t p2p_http_patch(const char *url, const char *token, const char *body);
+long        p2p_http_ratelimit(const p2p_http_t *h, long long *reset);
 
 #ifdef __cplusplus
 }
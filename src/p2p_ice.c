@@ -637,6 +637,13 @@ uint64_t p2p_ice_calc_pair_priority(uint32_t controlling_prio, uint32_t controll
  * ============================================================================
  */
 
+/* 候选地址文本：IPv6 别名还原为真实 IPv6 地址 */
+static const char *ice_addr_str(const struct sockaddr_in *a, char *buf, size_t len) {
+    uint8_t ip6[16];
+    if (p2p_udp_v6_real(a, ip6)) return inet_ntop(AF_INET6, ip6, buf, (socklen_t)len);
+    return inet_ntop(AF_INET, &a->sin_addr, buf, (socklen_t)len);
+}
+
 /*
  * 导出单个候选为 WebRTC 格式（无 a= 前缀和 \r\n 后缀）
  *
@@ -664,10 +671,10 @@ int p2p_ice_export_candidate(const p2p_local_candidate_entry_t *cand, char *buf,
     if (cand->type == P2P_CAND_SRFLX || cand->type == P2P_CAND_RELAY) {
         /* Srflx/Relay: 包含 raddr/rport (base_addr) */
         /* inet_ntoa 使用静态缓冲区，不能在同一调用中使用两次 */
-        char addr_str[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &cand->addr.sin_addr, addr_str, sizeof(addr_str));
-        char raddr_str[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &cand->base_addr.sin_addr, raddr_str, sizeof(raddr_str));
+        char addr_str[INET6_ADDRSTRLEN];
+        ice_addr_str(&cand->addr, addr_str, sizeof(addr_str));
+        char raddr_str[INET6_ADDRSTRLEN];
+        ice_addr_str(&cand->base_addr, raddr_str, sizeof(raddr_str));
         n = snprintf(buf, buf_size,
             "candidate:1 1 UDP %u %s %d typ %s raddr %s rport %d",
             cand->priority,                        /* priority */
@@ -679,10 +686,11 @@ int p2p_ice_export_candidate(const p2p_local_candidate_entry_t *cand, char *buf,
         );
     } else {
         /* Host/Prflx: 不包含 raddr/rport */
+        char addr_str[INET6_ADDRSTRLEN];
         n = snprintf(buf, buf_size,
             "candidate:1 1 UDP %u %s %d typ %s",
             cand->priority,                        /* priority */
-            inet_ntoa(cand->addr.sin_addr),        /* IP */
+            ice_addr_str(&cand->addr, addr_str, sizeof(addr_str)),  /* IP */
             ntohs(cand->addr.sin_port),            /* port */
             type_str                               /* type */
         );
@@ -840,10 +848,10 @@ int p2p_ice_export_sdp(const p2p_local_candidate_entry_t *cands, int cnt,
         if (c->type == P2P_CAND_SRFLX || c->type == P2P_CAND_RELAY) {
             /* Srflx/Relay: 包含 raddr/rport (base_addr) */
             /* inet_ntoa 使用静态缓冲区，不能在同一调用中使用两次 */
-            char addr_str[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &c->addr.sin_addr, addr_str, sizeof(addr_str));
-            char raddr_str[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &c->base_addr.sin_addr, raddr_str, sizeof(raddr_str));
+            char addr_str[INET6_ADDRSTRLEN];
+            ice_addr_str(&c->addr, addr_str, sizeof(addr_str));
+            char raddr_str[INET6_ADDRSTRLEN];
+            ice_addr_str(&c->base_addr, raddr_str, sizeof(raddr_str));
             n = snprintf(sdp_buf + offset, buf_size - offset,
                 "a=candidate:%d 1 UDP %u %s %d typ %s raddr %s rport %d\r\n",
                 i + 1,                              /* foundation */
@@ -856,11 +864,12 @@ int p2p_ice_export_sdp(const p2p_local_candidate_entry_t *cands, int cnt,
             );
         } else {
             /* Host/Prflx: 不包含 raddr/rport */
+            char addr_str[INET6_ADDRSTRLEN];
             n = snprintf(sdp_buf + offset, buf_size - offset,
                 "a=candidate:%d 1 UDP %u %s %d typ %s\r\n",
                 i + 1,                              /* foundation */
                 c->priority,                        /* priority */
-                inet_ntoa(c->addr.sin_addr),        /* IP */
+                ice_addr_str(&c->addr, addr_str, sizeof(addr_str)),  /* IP */
                 ntohs(c->addr.sin_port),            /* port */
                 type_str                            /* type */
             );
@@ -945,10 +954,12 @@ int p2p_ice_import_sdp(const char *sdp_text, p2p_remote_candidate_entry_t *cands
             continue;
         }
         
-        /* 解析 IP 地址 */
+        /* 解析 IP 地址（IPv6 地址映射为别名） */
         memset(&c->addr, 0, sizeof(c->addr));
         c->addr.sin_family = AF_INET;
-        if (inet_pton(AF_INET, ip_str, &c->addr.sin_addr) != 1) {
+        uint8_t ip6[16];
+        if (inet_pton(AF_INET, ip_str, &c->addr.sin_addr) != 1
+            && (inet_pton(AF_INET6, ip_str, ip6) != 1 || !p2p_udp_v6_alias(ip6, 0, &c->addr))) {
             print("W:", LA_F("Invalid IP address: %s", LA_F314, 314), ip_str);
             /* 跳到下一行 */
             while (*line && *line != '\n' && *line != '\r') line++;
@@ -963,6 +974,8 @@ int p2p_ice_import_sdp(const char *sdp_text, p2p_remote_candidate_entry_t *cands
         /* 初始化运行时状态 */
         c->last_punch_send_ms = 0;
         path_stats_init(&c->stats, 0);
+        c->check = NAT_CHECK_NONE;
+        c->sock = 0;
         
         count++;
         
@@ -997,11 +1010,15 @@ int p2p_ice_build_connectivity_check(uint8_t *buf, int max_len,
         username[0] = '\0';
     }
     
+    /* 远端密码 → HMAC 上下文；需反复发送检查的调用方可自行持有上下文直接调用 STUN 构建函数 */
+    p2p_hmac_sha1_ctx_t mi;
+    if (remote_pwd) p2p_hmac_sha1_init(&mi, (const uint8_t *)remote_pwd, (int)strlen(remote_pwd));
+
     /* 调用 STUN 模块的 ICE 检查包构建函数 */
     return p2p_stun_build_ice_check(
         buf, max_len, NULL,
         username[0] ? username : NULL,
-        remote_pwd,
+        remote_pwd ? &mi : NULL,
         priority, is_controlling, tie_breaker, use_candidate
     );
 }
@@ -65,6 +65,7 @@
  *     - NAT 模块遍历 remote_cands[]，发送探测包
  *     - 根据配置选择协议：自定义或 ICE-STUN
  *     - Priority 排序、超时重试、路径切换等逻辑在 NAT 模块
+ *     - 检查表按候选对优先级排序、Frozen/Waiting 按 foundation 解冻，每个 Ta（50ms）最多一个检查
  *
  *   【ICE 模块职责】协议转换 + 标准算法
  *     - 提供 SDP 格式转换（与 WebRTC 互通）
@@ -195,8 +196,7 @@
  *
  * 为简化实现，本模块省略了以下 RFC 5245 特性：
  *   - 完整的优先级计算公式（使用固定优先级）
- *   - 候选对排序（Checklist Ordering）
- *   - Frozen/Waiting/In-Progress 状态
+ *   - Failed 状态（未应答的候选对持续重传直至打洞超时）
  *   - ICE Lite 模式
  *   - IPv6 候选
  */
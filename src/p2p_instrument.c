@@ -3,12 +3,265 @@
 //
 #include "p2p_internal.h"
 
+#ifdef P2P_METRICS
+
+/*
+ * 延迟直方图（HDR 风格对数-线性分桶）
+ *
+ *   v < HIST_SUB * 2        桶号 = v（线性，微秒）
+ *   否则 m = msb(v)          桶号 = (m - HIST_SUB_BITS) * HIST_SUB + (v >> (m - HIST_SUB_BITS))
+ *                           即每个 [2^m, 2^(m+1)) 区间按最高 HIST_SUB_BITS+1 位分为 HIST_SUB 个子桶
+ * + 超出 HIST_MAX_BITS 的样本归入最后一个桶（约 2^36 微秒 ≈ 19 小时）
+ * + 全部字段以 relaxed 原子访问：记录端不加锁，查询端读到的是各桶的近似一致快照
+ */
+#define HIST_SUB_BITS           3
+#define HIST_SUB                (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS           36
+#define HIST_BUCKETS            ((HIST_MAX_BITS - HIST_SUB_BITS) * HIST_SUB + HIST_SUB)
+
+typedef struct {
+    uint64_t                count;
+    uint64_t                sum;
+    uint64_t                min;            // 0 = 尚无样本（样本值按 +1 存放）
+    uint64_t                max;
+    uint64_t                bucket[HIST_BUCKETS];
+} p2p_hist_t;
+
+static p2p_hist_t           g_hist[P2P_HIST_NUM];
+
+static int hist_bucket(uint64_t v) {
+    if (v < HIST_SUB * 2) return (int)v;
+    int m = 63 - __builtin_clzll(v);
+    if (m >= HIST_MAX_BITS) return HIST_BUCKETS - 1;
+    return (m - HIST_SUB_BITS) * HIST_SUB + (int)(v >> (m - HIST_SUB_BITS));
+}
+
+/* 桶的取值范围 [lo, lo + width) */
+static uint64_t hist_bucket_lo(int b, uint64_t *width) {
+    if (b < HIST_SUB * 2) { *width = 1; return (uint64_t)b; }
+    int m = b / HIST_SUB + HIST_SUB_BITS - 1;
+    *width = 1ull << (m - HIST_SUB_BITS);
+    return (uint64_t)(b % HIST_SUB + HIST_SUB) << (m - HIST_SUB_BITS);
+}
+
+void p2p_hist_record(int id, uint64_t us) {
+    p2p_hist_t *h = &g_hist[id];
+    __atomic_fetch_add(&h->bucket[hist_bucket(us)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, us, __ATOMIC_RELAXED);
+
+    uint64_t v = us + 1, cur = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    while ((!cur || v < cur) && !__atomic_compare_exchange_n(&h->min, &cur, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+    cur = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (us > cur && !__atomic_compare_exchange_n(&h->max, &cur, us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+int p2p_hist_get(int id, p2p_hist_stat_t *out) {
+
+    if (id < 0 || id >= P2P_HIST_NUM || !out) return -1;
+    const p2p_hist_t *h = &g_hist[id];
+
+    memset(out, 0, sizeof(*out));
+    uint64_t cnt[HIST_BUCKETS], total = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++)
+        total += cnt[b] = __atomic_load_n(&h->bucket[b], __ATOMIC_RELAXED);
+    if (!total) return 0;
+
+    out->count = total;
+    out->sum_us = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+    uint64_t min = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    out->min_us = min ? min - 1 : 0;
+    out->max_us = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+    // 各分位数按累计计数达到 ceil(total * q) 的桶取中点
+    static const uint32_t q[4] = { 500, 900, 990, 999 };
+    uint64_t *pv[4] = { &out->p50_us, &out->p90_us, &out->p99_us, &out->p999_us };
+    uint64_t acc = 0;
+    int k = 0;
+    for (int b = 0; b < HIST_BUCKETS && k < 4; b++) {
+        acc += cnt[b];
+        while (k < 4 && acc * 1000 >= total * q[k]) {
+            uint64_t w, lo = hist_bucket_lo(b, &w);
+            uint64_t v = lo + w / 2;
+            *pv[k++] = v > out->max_us ? out->max_us : v;
+        }
+    }
+    return 0;
+}
+
+void p2p_hist_reset(int id) {
+    for (int i = 0; i < P2P_HIST_NUM; i++) {
+        if (id >= 0 && i != id) continue;
+        p2p_hist_t *h = &g_hist[i];
+        for (int b = 0; b < HIST_BUCKETS; b++) __atomic_store_n(&h->bucket[b], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->sum, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->min, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->max, 0, __ATOMIC_RELAXED);
+    }
+}
+
+static void hist_dump(void) {
+    for (int i = 0; i < P2P_HIST_NUM; i++) {
+        p2p_hist_stat_t st;
+        p2p_hist_get(i, &st);
+        print("I:", LA_F("hist %s: n=%llu avg=%llu min=%llu p50=%llu p90=%llu p99=%llu p999=%llu max=%llu us", LA_F605, 605),
+              p2p_hist_name(i), (unsigned long long)st.count,
+              (unsigned long long)(st.count ? st.sum_us / st.count : 0), (unsigned long long)st.min_us,
+              (unsigned long long)st.p50_us, (unsigned long long)st.p90_us, (unsigned long long)st.p99_us,
+              (unsigned long long)st.p999_us, (unsigned long long)st.max_us);
+    }
+}
+
+#else
+
+int p2p_hist_get(int id, p2p_hist_stat_t *out) { (void)id; (void)out; return -1; }
+void p2p_hist_reset(int id) { (void)id; }
+
+#endif /* P2P_METRICS */
+
+const char *p2p_hist_name(int id) {
+    switch (id) {
+    case P2P_HIST_UPDATE:           return "update";
+    case P2P_HIST_STAGE_RECV:       return "stage_recv";
+    case P2P_HIST_STAGE_SIGNAL:     return "stage_signal";
+    case P2P_HIST_STAGE_SESSIONS:   return "stage_sessions";
+    case P2P_HIST_SEND_ACK:         return "send_ack";
+    case P2P_HIST_SEND_QUEUE:       return "send_queue";
+    default:                        return NULL;
+    }
+}
+
+/*
+ * 运行时调参注册表
+ */
+typedef struct {
+    const char*             name;
+    int                     min, max;
+} tune_info_t;
+
+static const tune_info_t    k_tune[P2P_TUNE_NUM] = {
+    [P2P_TUNE_RTO_MIN_MS]           = { "rto_min_ms",           10, 10000 },
+    [P2P_TUNE_RTO_MAX_MS]           = { "rto_max_ms",           100, 60000 },
+    [P2P_TUNE_SEND_WINDOW]          = { "send_window",          0, RELIABLE_WINDOW_MAX },
+    [P2P_TUNE_PACING_GAIN]          = { "pacing_gain",          50, 400 },
+    [P2P_TUNE_KEEPALIVE_MS]         = { "keepalive_ms",         0, 120000 },
+    [P2P_TUNE_PATH_COOLDOWN_MS]     = { "path_cooldown_ms",     0, 600000 },
+    [P2P_TUNE_PATH_STABILITY_MS]    = { "path_stability_ms",    0, 600000 },
+    [P2P_TUNE_RTO_INIT_MS]          = { "rto_init_ms",          10, 10000 },
+    [P2P_TUNE_TLP]                  = { "tlp",                  0, 1 },
+    [P2P_TUNE_PUNCH_TIMEOUT_MIN_MS] = { "punch_timeout_min_ms", 100, 60000 },
+    [P2P_TUNE_PUNCH_TIMEOUT_MAX_MS] = { "punch_timeout_max_ms", 100, 60000 },
+    [P2P_TUNE_CONN_TIMEOUT_MIN_MS]  = { "conn_timeout_min_ms",  100, 60000 },
+    [P2P_TUNE_CONN_TIMEOUT_MAX_MS]  = { "conn_timeout_max_ms",  100, 60000 },
+};
+
+const int                   p2p_tune_def[P2P_TUNE_NUM] = {
+    [P2P_TUNE_RTO_MIN_MS]           = 50,
+    [P2P_TUNE_RTO_MAX_MS]           = RELIABLE_RTO_MAX,
+    [P2P_TUNE_PACING_GAIN]          = 125,
+    [P2P_TUNE_RTO_INIT_MS]          = RELIABLE_RTO_INIT,
+    [P2P_TUNE_TLP]                  = 1,
+    [P2P_TUNE_PUNCH_TIMEOUT_MIN_MS] = 1500,
+    [P2P_TUNE_PUNCH_TIMEOUT_MAX_MS] = 5000,
+    [P2P_TUNE_CONN_TIMEOUT_MIN_MS]  = 1000,
+    [P2P_TUNE_CONN_TIMEOUT_MAX_MS]  = 3000,
+};
+
+p2p_tune_t                  p2p_tune_proc;
+
+/* 选层：会话 → 实例 → 进程 */
+static p2p_tune_t *tune_layer(p2p_handle_t hdl, p2p_session_t session) {
+    if (session) return &((struct p2p_session*)session)->tune;
+    if (hdl) return &((struct p2p_instance*)hdl)->tune;
+    return &p2p_tune_proc;
+}
+
+int p2p_tune_set(p2p_handle_t hdl, p2p_session_t session, int id, int value) {
+
+    if (id < 0 || id >= P2P_TUNE_NUM) return -1;
+    p2p_tune_t *t = tune_layer(hdl, session);
+
+    // 置位 / 清位由多个线程并发设置不同参数时须原子完成
+    if (value == P2P_TUNE_INHERIT) {
+        __atomic_fetch_and(&t->set, ~(1 << id), __ATOMIC_RELEASE);
+        return 0;
+    }
+    if (value < k_tune[id].min || value > k_tune[id].max) return -1;
+    RING_STORE_REL(&t->val[id], value);
+    __atomic_fetch_or(&t->set, 1 << id, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int p2p_tune_get(p2p_handle_t hdl, p2p_session_t session, int id) {
+
+    if (id < 0 || id >= P2P_TUNE_NUM) return -1;
+    if (session) return p2p_tune((const struct p2p_session*)session, id);
+
+    int v;
+    if (hdl && p2p_tune_pick(&((const struct p2p_instance*)hdl)->tune, id, &v)) return v;
+    if (p2p_tune_pick(&p2p_tune_proc, id, &v)) return v;
+    return p2p_tune_def[id];
+}
+
+const char *p2p_tune_name(int id) {
+    return id >= 0 && id < P2P_TUNE_NUM ? k_tune[id].name : NULL;
+}
+
+int p2p_tune_find(const char *name) {
+    if (!name) return -1;
+    for (int i = 0; i < P2P_TUNE_NUM; i++)
+        if (strcmp(k_tune[i].name, name) == 0) return i;
+    return -1;
+}
+
+/* instrument tag "tune"：txt 为 "name=value"（value 为 -1 时恢复默认）设置进程层，空串输出全部当前值 */
+static void tune_command(const char *txt, int len) {
+
+    char buf[64];
+    if (!txt || len < 0) len = 0;
+    if (len >= (int)sizeof(buf)) len = (int)sizeof(buf) - 1;
+    if (len) memcpy(buf, txt, (size_t)len);
+    buf[len] = '\0';
+
+    int id = -1;
+    const char *eq = strchr(buf, '=');
+    if (eq) {
+        for (int i = 0; i < P2P_TUNE_NUM && id < 0; i++)
+            if (strlen(k_tune[i].name) == (size_t)(eq - buf) && !strncmp(k_tune[i].name, buf, (size_t)(eq - buf))) id = i;
+        if (id >= 0 && p2p_tune_set(NULL, NULL, id, atoi(eq + 1)) != 0) id = -1;
+    }
+    if (len && id < 0) {
+        print("W:", LA_F("tune: bad '%s'", LA_F654, 654), buf);
+        return;
+    }
+
+    for (int i = 0; i < P2P_TUNE_NUM; i++) {
+        if (id >= 0 && i != id) continue;
+        print("I:", LA_F("tune %s=%d", LA_F655, 655), k_tune[i].name, p2p_tune_get(NULL, NULL, i));
+    }
+}
+
 void p2p_instrument(uint16_t rid, uint8_t chn, const char* tag, char *txt, int len) {
 
     // 忽略自己的协同、以及 'X' 通道以外的数据
     if (!rid || chn != 'X') return;
 
     if (strcmp(tag, "host_ice") == 0) {
-        
+
+    }
+    else if (strcmp(tag, "hist") == 0) {
+#ifdef P2P_METRICS
+        hist_dump();
+#else
+        print("W:", LA_F("hist: not compiled in (build with P2P_METRICS)", LA_F606, 606));
+#endif
+    }
+    else if (strcmp(tag, "hist_reset") == 0) {
+        p2p_hist_reset(-1);
+        print("I:", LA_F("hist: reset", LA_F607, 607));
+    }
+    else if (strcmp(tag, "tune") == 0) {
+        tune_command(txt, len);
     }
 }
@@ -67,6 +67,8 @@
 
 #include "predefine.h"
 #include <p2p.h>
+#include "p2p_mem.h"            /* 分配钩子与实例内存区 */
+#include "p2p_dns.h"            /* 异步主机名解析 */
 
 #include "p2p_common.h"         /* pack/unpack_signaling_payload_hdr（服务端也可包含此头） */
 #include "LANG.h"               /* 多语言支持 */
@@ -82,11 +84,21 @@
 #include "p2p_ice.h"            /* ICE 协议 */
 #include "p2p_turn.h"           /* TURN 中继 */
 #include "p2p_tcp_punch.h"      /* TCP 打洞 */
+#include "p2p_shm.h"            /* 同主机共享内存传输 */
+#include "p2p_overlay.h"        /* 叠加中继（经第三方对端） */
+#include "p2p_bulk.h"           /* 可续传分块批量传输 */
 #include "p2p_signal_relay.h"   /* 中继模式信令 */
 #include "p2p_signal_pubsub.h"  /* 发布/订阅模式信令 */
 #include "p2p_signal_compact.h" /* COMPACT 模式信令 */
 #include "p2p_path_manager.h"   /* 多路径管理器 */
+#include "p2p_lan.h"            /* 局域网发现 */
 #include "p2p_probe.h"          /* 信道外可达性探测 */
+#include "p2p_rpc.h"            /* MSG RPC 分片传输 */
+#include "p2p_fec.h"            /* 前向纠错 */
+#include "p2p_netem.h"          /* UDP 网络损伤模拟 */
+#include "p2p_sim.h"            /* 进程内网络模拟（P2P_SIM） */
+#include "p2p_trace.h"          /* 结构化事件追踪 */
+#include "p2p_timer.h"          /* 会话定时器时间轮 */
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -97,43 +109,238 @@ typedef enum {
     P2P_SIG_ST_READY,                           // 已在信令服务器上线，等待对端上线后开始候选同步
 } inst_state_t;
 
+/*
+ * 会话索引：开放寻址哈希表（线性探测 + 删除时后移，无墓碑），容量为 2 的幂
+ */
+typedef struct p2p_sess_index {
+    struct p2p_session**            slots;
+    int                             cap;
+    int                             cnt;
+} p2p_sess_index_t;
+
 typedef struct p2p_sock {
     struct sockaddr_in              local_addr;
     struct sockaddr_in              mapped_addr;
     sock_t                          sock;
-    int                             state;              // 0:idle; 1:bound(无mapped); 2:active(有mapped); -1:invalid
+    int                             state;              // 0:idle; 1:bound(无mapped); 2:active(有mapped); 3:predict(端口预测专用); -1:invalid
+    uint64_t                        mapped_ts;          // mapped_addr 获得时刻（空闲期预收集结果的新鲜度，见 p2p_stun_srflx_refresh）
+    uint32_t                        rxq_ovfl;           // SO_RXQ_OVFL 最近读到的内核累计丢包数
+    struct p2p_udp_iocp_sock*       iocp;               // Windows IOCP 接收上下文（cfg.udp_iocp，NULL = 非阻塞 recvfrom）
+    uint32_t                        uring_id;           // io_uring 多发接收请求标识（cfg.udp_uring，完成项 user_data）
+    uint8_t                         uring;              // io_uring 接收状态：0 未关联（recvmmsg），1 待重新提交，2 在途
 } p2p_sock_t;
 
+/*
+ * 流量计数（p2p_get_stats / p2p_get_instance_stats）
+ * + 会话自身的计数只由会话所属线程写入，应用线程无锁读取
+ * + 实例汇总按分片分块计数（各块基本只有所属分片线程写入，原子加几乎无争用），读取时逐块累加
+ */
+typedef struct {
+    uint64_t                        bytes_sent;
+    uint64_t                        bytes_recv;
+    uint64_t                        packets_sent;
+    uint64_t                        packets_recv;
+    uint64_t                        retransmits;
+} p2p_counters_t;
+
+#if defined(_MSC_VER)
+#define P2P_TLS                 __declspec(thread)
+#else
+#define P2P_TLS                 __thread
+#endif
+
+/*
+ * 粗粒度时钟：每轮处理（p2p_update、分片线程 p2p_worker_update 等）开始时取一次 P_tick_ms 存为线程局部快照，
+ * 本轮内各模块经 p2p_now_ms() 读到同一时刻，不再各自调用 clock_gettime
+ * + 轮次之外（应用线程 API、第三方库回调线程、测试）快照为 0，回退为实时时钟
+ * + 需要精度的 RTT 采样另用 P_tick_us / p2p_rx_time_us
+ */
+extern P2P_TLS uint64_t             p2p_clock_ms;
+
+static inline uint64_t p2p_now_ms(void) {
+    return p2p_clock_ms ? p2p_clock_ms : P_tick_ms();
+}
+
+/* 开始一轮处理：刷新快照并返回，原快照存入 *saved（可嵌套，由 p2p_clock_end 恢复） */
+static inline uint64_t p2p_clock_begin(uint64_t *saved) {
+    *saved = p2p_clock_ms;
+    return p2p_clock_ms = P_tick_ms();
+}
+
+static inline void p2p_clock_end(uint64_t saved) {
+    p2p_clock_ms = saved;
+}
+
+#ifdef P2P_THREADED
+/*
+ * 会话分片线程（cfg.worker_count > 1）
+ *
+ * 主工作线程负责收包、按会话派发以及实例级的信令、TURN、STUN；会话创建时分配到会话数最少的分片，
+ * 此后其收包处理与 tick 都在该分片线程中执行：
+ *   - 时间轮、应用侧唤醒栈、reliable 缓冲区池、发送合并队列均为分片私有
+ *   - 主线程派发的数据包经双缓冲收件箱转交（收件箱满时丢弃，等同 UDP 丢包）
+ *   - 锁顺序：分片锁（按序号递增）→ 实例锁。分片线程始终持本分片锁；
+ *     直连路径上已连接会话的 DATA/ACK/DGRAM 与数据传输 tick 只持分片锁，其余处理（打洞、状态机、路径管理等）另持实例锁
+ *   - 主线程收包派发只持实例锁；信令/TURN/STUN 等控制阶段以及应用侧实例级接口持全部锁
+ */
+#define P2P_WORKER_INBOX        128             // 收件箱单侧容量（包）
+
+typedef struct p2p_rx_item {
+    struct p2p_session*             s;                  // 目标会话（NULL = 会话已关闭，跳过）
+    struct sockaddr_in              from;               // 来源地址
+    int                             len;                // 包长度
+    bool                            stun;               // ICE STUN 包（否则为 P2P 协议包）
+    uint64_t                        rx_us;              // 接收时间（p2p_udp_slot_t.rx_us）
+    uint8_t                         ecn;                // ECN 码点（p2p_udp_slot_t.ecn）
+    uint8_t                         buf[P2P_MTU_MAX + 16];  // 完整数据包
+} p2p_rx_item_t;
+
+typedef struct p2p_worker {
+    struct p2p_instance*            inst;
+    thd_t                           thread;
+    P_mutex_t                       mtx;                // 分片锁：保护本分片的全部会话
+    sock_t                          wake_rd;            // 唤醒描述符（读端）
+    sock_t                          wake_wr;            // 唤醒描述符（写端）
+    p2p_timer_wheel_t               timers;             // 本分片会话时间轮
+    struct p2p_session*             wake_list;          // 应用侧唤醒的本分片会话（无锁栈）
+    reliable_pool_t                 rel_pool;           // 本分片 reliable 缓冲区池
+    p2p_udp_txq_t                   txq;                // 本分片发送合并队列
+    P_mutex_t                       rx_mtx;             // 收件箱锁（叶子锁，持有期间不获取其他锁）
+    p2p_rx_item_t*                  rx_items[2];        // 双缓冲收件箱：主线程写入 rx_items[rx_fill]，分片线程整批取走
+    int                             rx_fill;            // 当前写入侧
+    int                             rx_cnt;             // 写入侧已有的包数
+    uint32_t                        rx_drops;           // 收件箱满丢弃的包数
+    int                             sess_cnt;           // 本分片会话数
+    p2p_counters_t                  stat;               // 本分片会话的流量汇总
+} p2p_worker_t;
+
+/* 当前线程所属的会话分片（主工作线程与应用线程为 NULL） */
+extern P2P_TLS p2p_worker_t*        p2p_worker_self;
+
+/*
+ * 应用侧阻塞等待（p2p_recv_wait / p2p_send_wait / p2p_wait_state），每会话每类一个
+ * + 唤醒描述符在首次等待时打开，会话释放时关闭
+ * + 等待方置 armed 后复查条件再阻塞；驱动会话的线程每轮处理后发现条件满足即清除 armed 并唤醒一次
+ */
+typedef struct p2p_waiter {
+    sock_t                          rd;                 // 唤醒描述符（读端，等待方 poll）
+    sock_t                          wr;                 // 唤醒描述符（写端）
+    int                             armed;              // 等待方已登记，尚未被唤醒
+} p2p_waiter_t;
+#endif
+
+/* 应用侧阻塞等待的条件类别（非线程模式下由调用线程驱动 p2p_update 直至条件成立） */
+enum { P2P_WAIT_RECV = 0, P2P_WAIT_SEND, P2P_WAIT_STATE, P2P_WAIT_KINDS };
+
+/*
+ * 运行时调参（p2p_tune_*，见 p2p.h）：进程 / 实例 / 会话三层，每层按位标记已设置的参数，
+ * 取值时会话层优先、未设置则逐层向上，最后为内置默认值（p2p_tune_def）
+ * + 应用线程写入值后以 release 置位，数据路径以 acquire 读取，无锁
+ */
+typedef struct {
+    int                             val[P2P_TUNE_NUM];
+    int                             set;                // bit i = val[i] 有效
+} p2p_tune_t;
+
+extern p2p_tune_t                   p2p_tune_proc;      // 进程层（instrument 'X' 通道 tag "tune" 亦写入此层）
+extern const int                    p2p_tune_def[P2P_TUNE_NUM];
+
+static inline bool p2p_tune_pick(const p2p_tune_t *t, int id, int *v) {
+    if (!(RING_LOAD_ACQ(&t->set) & (1 << id))) return false;
+    *v = RING_LOAD_ACQ(&t->val[id]);
+    return true;
+}
+
 struct p2p_instance {
     char                            local_peer_id[P2P_PEER_ID_MAX];  // 本端身份标识
     struct p2p_session*             sessions_head;
     struct p2p_session*             sessions_rear;
     int                             connections;        // 当前活跃连接数（session 数量 - disconnect by peer count）
+    int                             hibernated;         // 处于空闲休眠的会话数（原子更新）
+    p2p_counters_t                  stat;               // 主工作线程驱动的会话流量汇总（含已关闭会话，见 p2p_get_instance_stats）
 
     /* ======================== 配置与状态 ======================== */
     p2p_config_t                    cfg;                // 用户配置（STUN 服务器、模式等）
+    char                            server_node[64];    // server_host 为集群节点列表时选中的节点主机名（cfg.server_host 指向此处）
     inst_state_t                    state;              // 连接状态 inst_state_t
 
     /* ======================== Socket 资源 ======================== */
     p2p_sock_t*                     socks;              // UDP 套接字数组（第 0 项为默认自动绑定端口）
     int                             sock_cnt;           // 当前套接字数量
     int                             sock_cap;           // 套接字数组容量
-    sock_t                          tcp_sock;           // TCP 套接字（打洞/回退用）
+    int                             predict_base;       // 端口预测套接字（NAT_PREDICT_SOCKS 个，位于数组末尾）的起始索引，0 = 未打开
+    p2p_udp_slot_t*                 rx_slots;           // 批量接收槽位（P2P_UDP_BATCH_SLOTS 项，按需分配）
+    int                             rx_rr;              // 接收轮转起点（下次从该套接字开始读取）
+    p2p_udp_txq_t                   txq;                // 发送合并队列（主工作线程 / 手动 update）
+    bool                            tx_gso_off;         // UDP GSO 不可用（首次失败后关闭）
+    sock_t                          sock6;              // IPv6 UDP 套接字（cfg.enable_ipv6，sock6_port != 0 时有效）
+    uint16_t                        sock6_port;         // sock6 绑定端口（网络字节序），0 = 未开启
+    int                             sock_buf;           // 已向各套接字请求的内核收发缓冲区字节数（见 p2p_udp_sock_buf_tick）
+    int                             sock_buf_eff;       // 内核实际接收缓冲区字节数（getsockopt 读回，受系统上限截断）
+    uint64_t                        sock_buf_ms;        // 上次按 BDP 检查缓冲区的时间
+    uint32_t                        kernel_drops;       // 内核接收队列溢出丢弃的包数（SO_RXQ_OVFL，原子更新）
+    struct p2p_udp_iocp*            iocp;               // Windows IOCP 完成端口（cfg.udp_iocp，首个套接字关联时创建）
+    struct p2p_udp_uring*           uring;              // Linux io_uring 接收环（cfg.udp_uring，首个套接字关联时创建）
+    bool                            uring_off;          // io_uring 不可用（首次创建失败后不再尝试）
+    uint64_t                        lp_active_ms;       // 最近一次需要正常节奏的活动（cfg.low_power，原子更新，见 p2p_lp_idle）
+    p2p_netem_t*                    netem;              // UDP 网络损伤模拟（P2P_NETEM），NULL = 未开启
+#ifdef P2P_SIM
+    struct p2p_sim_node*            sim;                // 所在虚拟主机（首个套接字打开时关联）
+#endif
+    p2p_trace_t*                    trace;              // 结构化事件追踪（cfg.trace_file），NULL = 未开启
+    p2p_tune_t                      tune;               // 实例层运行时调参（p2p_tune_set）
+    int64_t                         shape_rate;         // 实例总发送限速（字节/秒，0 = 不限；p2p_set_rate_limit_total，原子更新）
+    int64_t                         shape_burst;        // 总限速令牌桶容量（字节，0 = 按 RELIABLE_SHAPE_BURST_MS 推算，按权重分给各会话）
+    uint32_t                        shape_epoch;        // 活跃权重统计的当前周期（now / RELIABLE_SHAPE_EPOCH_MS，原子更新）
+    uint32_t                        shape_cur;          // 当前周期内发送过的会话权重和（原子累加）
+    uint32_t                        shape_prev;         // 上一周期的活跃权重和
+    p2p_arena_t*                    arena;              // 实例内存区（cfg.mem_arena），NULL = 会话对象按全局钩子分配
+    p2p_mem_acct_t                  mem;                // 按组件内存计量（含全部现存会话，p2p_memory_stats）
+    int                             setup_gather_wait;  // 尚未记录 P2P_SETUP_GATHER 的会话数（候选收集完成时补记）
+    uint32_t                        setup_hist_cnt;     // 已完成建连次数（setup_hist 写入位置）
+    int                             setup_hist[P2P_SETUP_HISTORY][P2P_SETUP_NUM];  // 最近建连的里程碑耗时（环形）
+
+    /* ======================== 会话索引 ======================== */
+    p2p_sess_index_t                sess_by_id;         // session_id → 会话（multi_session 收包派发）
+    p2p_sess_index_t                sess_by_addr;       // 活跃路径地址 → 会话（无 session_id 包的回退派发）
+    p2p_overlay_fwd_t               overlay_fwd[P2P_OVERLAY_MAX];  // 叠加中继转发表（cfg.overlay_relay，本端作为中转端）
+    int                             overlay_cnt;        // overlay_fwd 有效项数
+
+    /* ======================== 会话调度 ======================== */
+    p2p_timer_wheel_t               timers;             // 会话定时器时间轮：p2p_update 只处理到期/被唤醒的会话
+    struct p2p_session*             wake_list;          // 应用侧唤醒的会话（无锁栈，p2p_send 等接口压入，工作线程取出）
+
+    /* ======================== 缓冲区池 ======================== */
+    reliable_pool_t                 rel_pool;           // reliable 重传/乱序缓冲区池（各会话共享，仅在途/乱序期间占用）
 
     /* ======================== NAT 检测 ======================== */
     int                             nat_type;           // NAT 类型，即 p2p_nat_type() 返回值，也就是支持负值状态
     stun_ctx_t                      stun_ctx;           // NAT 类型检测上下文（实例级别，全局只检测一次）
+    nat_bind_probe_t                bind_probe;         // NAT 绑定存活期探测（cfg.keepalive_adaptive）
+    nat_hist_t*                     nat_hist;           // 候选类型历史（检查表排序；创建失败时为 NULL，按固定优先级检查）
 
     /* ======================== TURN 中继 ======================== */
-    turn_ctx_t                      turn;               // TURN allocation 上下文（实例级别，共享一个 relay addr）
+    turn_ctx_t                      turn[TURN_MAX_ALLOCS]; // TURN allocation 上下文（实例级别，按服务器 RTT 升序，见 cfg.turn_allocs）
+    turn_probe_t                    turn_probe;         // 多个 TURN 服务器时的启动 RTT 探测
+
+    /* ======================== DTLS 会话恢复 ======================== */
+    p2p_dtls_cache_t*               dtls_cache;         // 按对端缓存的 DTLS 会话（启用加密层时创建，否则为 NULL）
+
+    /* ======================== 路径缓存 ======================== */
+    p2p_path_cache_t*               path_cache;         // 按对端缓存的直连路径（启用路径缓存时创建，否则为 NULL）
+
+    /* ======================== 局域网发现 ======================== */
+    p2p_lan_t*                      lan;                // 组播通告与已发现的局域网对端（cfg.lan_discovery，否则为 NULL）
 
     /* ======================== 异步候选 ======================== */
-    uint16_t                        srflx_count;        // 预期 srflx 候选数量（init 时统计，目前最多 1）
+    uint16_t                        srflx_count;        // 预期 srflx 候选数量（每个参与收集的套接字一个，multi_srflx 时每网卡一个）
     uint16_t                        srflx_active;       // 已生效的 srflx 候选数量
     uint16_t                        turn_pending;       // TURN Allocate 待响应计数
 
     /* ======================== 信令模式和上下文 ======================== */
     p2p_signaling_t                 sig_mode;           // 信令模式
+    bool                            sig_resolving;      // COMPACT/RELAY 信令服务器地址解析中（就绪后上线，见 sig_online）
+    uint32_t                        route_gen;          // 已处理的本机地址集合代次（route_shared_gen，见 p2p_route_refresh）
     union {
         p2p_compact_ctx_t       compact;                // COMPACT 模式信令上下文（实例级别：与服务器的关系）
         p2p_relay_ctx_t         relay;                  // RELAY 模式信令上下文（实例级别：与服务器的 TCP 连接）
@@ -182,11 +389,93 @@ struct p2p_instance {
      */
     thd_t                           thread;             // 工作线程
     P_mutex_t                       mtx;                // 互斥锁
-    int                             thread_running;     // 线程是否运行中
+    int                             thread_running;     // 线程是否运行中（独立线程或已登记到共享执行器）
+    struct p2p_exec_node*           exec;               // 共享执行器登记项（cfg.shared_executor，未登记为 NULL，见 p2p_executor_start）
     int                             quit;               // 退出标志
+    sock_t                          wake_rd;            // 唤醒描述符（读端，参与 poll）
+    sock_t                          wake_wr;            // 唤醒描述符（写端，p2p_send 等接口写入）
+
+    p2p_worker_t*                   workers;            // 会话分片线程（cfg.worker_count - 1 个，未启用为 NULL）
+    int                             worker_cnt;         // 会话分片线程数量
+    p2p_udp_slot_t*                 ctrl_slots;         // 分片模式下延后到控制阶段处理的实例级包（信令/STUN/TURN）
+    int                             ctrl_cnt;           // ctrl_slots 中待处理的包数
+    int                             wait_cnt;           // 各会话已登记的应用侧等待数（为 0 时跳过等待条件检查）
+
+    struct p2p_crypto_pool*         crypto;             // 加密线程池（cfg.crypto_workers，未启用为 NULL，见 p2p_crypto_run）
+    p2p_aead_job_t*                 crypto_rx;          // 批量接收的预解开任务（P2P_UDP_BATCH_SLOTS 项，随线程池分配）
+    const p2p_aead_job_t*           crypto_rx_cur;      // 正在派发的包已预解开时指向其任务（加密层 decrypt_recv 据此取用明文）
 #endif
+
+    uint64_t                        shm_host_id;        // 本机标识（cfg.enable_shm，首次使用时计算，见 p2p_shm_host_id）
+    int                             shm_cnt;            // 主循环等待门铃的共享内存会话数（为 0 时跳过门铃检查）
 };
 
+/*
+ * 低功耗节奏（cfg.low_power）
+ * + 实例空闲：持续 P2P_LP_IDLE_MS 没有会话建连中、没有会话缓冲区中有待收发的数据、信令不在登录中
+ * + 空闲时会话定时器与实例 tick 向上对齐到 P2P_LP_WINDOW_MS 整数倍时刻，NAT 保活、路径探测、
+ *   信令保活、TURN 刷新等周期任务集中在同一唤醒窗口执行；会话与实例的最长调度间隔放宽到 P2P_LP_TICK_MS，
+ *   高级传输层不再按 10ms 节奏 tick
+ * + 任一会话恢复数据收发即刷新 lp_active_ms，其后的调度恢复正常节奏
+ */
+#define P2P_LP_IDLE_MS          3000
+#define P2P_LP_WINDOW_MS        1000
+#define P2P_LP_TICK_MS          5000
+
+static inline void p2p_lp_touch(struct p2p_instance *inst, uint64_t now_ms) {
+    if (inst->cfg.low_power) __atomic_store_n(&inst->lp_active_ms, now_ms, __ATOMIC_RELAXED);
+}
+
+static inline bool p2p_lp_idle(struct p2p_instance *inst, uint64_t now_ms) {
+    if (!inst->cfg.low_power) return false;
+    uint64_t at = __atomic_load_n(&inst->lp_active_ms, __ATOMIC_RELAXED);
+    return now_ms >= at && now_ms - at >= P2P_LP_IDLE_MS;     // 其他线程可能写入略晚的时刻
+}
+
+/* 把 t 毫秒后的唤醒推迟到下一个窗口边界（t <= 0 的即时工作不推迟） */
+static inline int p2p_lp_align(uint64_t now_ms, int t) {
+    if (t <= 0) return t;
+    uint64_t at = (now_ms + (uint64_t)t + P2P_LP_WINDOW_MS - 1) / P2P_LP_WINDOW_MS * P2P_LP_WINDOW_MS;
+    return (int)(at - now_ms);
+}
+
+/* 实例的本机地址表：进程共享的路由上下文（模拟构建为实例所在虚拟主机的地址） */
+static inline const route_ctx_t *p2p_inst_route(struct p2p_instance *inst) {
+#ifdef P2P_SIM
+    return p2p_sim_route(inst);
+#else
+    (void)inst;
+    return route_shared_get();
+#endif
+}
+
+/* 实例级定时任务的最长调度间隔：update_interval_ms，低功耗空闲时放宽 */
+static inline int p2p_tick_interval(struct p2p_instance *inst, uint64_t now_ms) {
+    int ms = inst->cfg.update_interval_ms;
+    return p2p_lp_idle(inst, now_ms) && ms < P2P_LP_TICK_MS ? P2P_LP_TICK_MS : ms;
+}
+
+/*
+ * 包合并（cfg.bundle）：会话数据传输阶段内可合并的包先拼入缓冲区，
+ * 目的路径变化、放不下或阶段结束时作为一个 P2P_PKT_BUNDLE 发出（只有一个包时原样发出）
+ */
+typedef struct {
+    uint8_t*                        buf;                // 拼装缓冲区（首次使用时分配 P2P_PMTU_PAYLOAD_MAX）
+    int                             len;                // 已拼装字节数
+    int                             cnt;                // 已拼装包数
+    int                             max;                // 负载上限（首包入队时按路径取 nat_pmtu_payload）
+    int                             path;               // 目的路径（首包入队时的 active_path）
+    struct sockaddr_in              addr;               // 目的地址
+    bool                            open;               // 处于数据传输阶段（期间可合并的包进入缓冲区）
+    uint64_t                        sent;               // 已发出的合并帧数
+    uint64_t                        frames;             // 经合并帧发出的包数
+} p2p_bundle_t;
+
+/* 可放入合并帧的包类型（数据面，加密时与合并帧一同封装） */
+static inline bool p2p_bundle_type(uint8_t type) {
+    return type == P2P_PKT_DATA || type == P2P_PKT_ACK || type == P2P_PKT_DGRAM || type == P2P_PKT_FEC;
+}
+
 /* ============================================================================
  * p2p_session: P2P 会话主结构体
  * ============================================================================
@@ -209,11 +498,14 @@ struct p2p_session {
 
     char                            remote_peer_id[P2P_PEER_ID_MAX]; // 目标对等体 ID
     bool                            wait_stun_pending;  // 该 session 需要等待 srflx 候选通过 stun 收集完成后再同步
+    bool                            standby;            // 预热会话（p2p_prewarm）：尚未交给应用，不触发状态回调
 
     /* ======================== 多会话标识 ======================== */
     uint32_t                        id;                 // 该会话唯一标识 id（随机非零，发包时携带供对端派发）
                                                         // 仅在 multi_session 模式下有效; 对端收包后据此 ID 路由到对应会话
                                                         // COMPACT 模式下同时用作 signaling session_id（来自 SYNC0_ACK）
+                                                        // 修改必须通过 p2p_session_set_id()，以同步 inst->sess_by_id 索引
+    struct sockaddr_in              index_addr;         // 已登记到 inst->sess_by_addr 的地址（sin_port=0 表示未登记）
     union {
         p2p_compact_session_t   compact;                // COMPACT 模式信令上下文（会话级别：与对端的关系）
         p2p_relay_session_t     relay;                  // RELAY 模式信令上下文（会话级别：与对端的关系）
@@ -232,9 +524,32 @@ struct p2p_session {
 
     nat_ctx_t                       nat;                // NAT 穿透上下文
     reliable_t                      reliable;           // 可靠传输层状态
+    reliable_resume_t               resume;             // 会话续传（跨重连保持字节流，见 reliable_resume_t）
+    p2p_shaper_t                    shaper;             // 发送限速（p2p_set_rate_limit，见 p2p_shaper_t）
     stream_t                        stream;             // 流传输层状态
+    dgram_t                         dgram;              // 不可靠数据报通道
+    stream_t                       *xstreams;           // 多流：1 ~ stream_cnt-1 号流（单流时为 NULL）
+    int                             stream_cnt;         // 本端流数量（cfg.stream_count，至少 1）
+    int                             flush_rr;           // 多流 flush 的轮转起点
+    stream_file_t                   file_tx;            // p2p_send_file 进行中的发送
+    stream_file_t                   file_rx;            // p2p_recv_file 进行中的接收
+    p2p_bulk_link_t                 bulk;               // 批量传输挂接状态（p2p_bulk_attach）
+    bool                            hibernated;         // 空闲休眠中：流与 reliable 层缓冲区已释放（cfg.hibernate_ms，见 p2p_session_thaw）
+    int                             hib_hold;           // 应用侧正在写入流缓冲区的调用数（与 hibernated 互斥，见 session_hold）
+    uint64_t                        data_ts;            // 最近一次有数据收发的时刻（空闲休眠计时）
+    uint64_t                        lz_raw;             // 流压缩：已发出 DATA 的原始字节数（协商压缩后累计，不含重传）
+    uint64_t                        lz_wire;            // 流压缩：上述数据实际占用的负载字节数
     path_manager_t                  path_mgr;           // 路径管理器（多路径并行支持）
     probe_ctx_t                     probe;              // 探测上下文
+    rpc_frag_t                      rpc;                // MSG RPC 分片传输（超过 P2P_MSG_DATA_MAX 的请求/应答）
+    fec_t                           fec;                // 前向纠错（cfg.fec）
+    p2p_bundle_t                    bundle;             // 包合并（cfg.bundle）
+    p2p_tcp_punch_t*                tcp_punch;          // TCP 打洞/连接上下文（cfg.enable_tcp，首次打洞时分配）
+    bool                            tcp_rx;             // 正在处理经 TCP 连接收到的包（地址查找只匹配 TCP 候选）
+    p2p_shm_t*                      shm;                // 同主机共享内存上下文（cfg.enable_shm，首次探测时分配）
+    uint64_t                        rx_us;              // 正在处理的包的接收时间（P_tick_us 时基；0 = 非收包上下文，见 p2p_rx_time_us）
+    uint8_t                         rx_ecn;             // 正在处理的包的 ECN 码点 P2P_UDP_ECN_*（非收包上下文为 0）
+    p2p_overlay_t                   overlay;            // 叠加中继请求状态（p2p_session_via）
 
     bool                            rx_confirmed;       // peer→me 已确认（收到对端包）
     bool                            tx_confirmed;       // me→peer 已确认（对端可收到我的包）
@@ -262,15 +577,18 @@ struct p2p_session {
     uint16_t                        remote_srflx_cnt;   // 对端 srflx 类型候选数量
     uint16_t                        remote_relay_cnt;   // 对端 relay 类型候选数量
     bool                            remote_cand_done;   // 远端候选是否同步完成（由信令层设置，NAT 层判断超时用）
+    p2p_mem_acct_t                  mem;                // 会话名下的按组件内存计量（上级为 inst->mem）
 
     /* ======================== PseudoTCP 拥塞控制 ======================== */
     /*
-     * 类 TCP 拥塞控制算法 (AIMD)：
+     * 类 TCP 拥塞控制（算法见 cc，AIMD / CUBIC）：
      *   - cwnd:     拥塞窗口，控制发送速率
      *   - ssthresh: 慢启动阈值
      *   - dup_acks: 重复 ACK 计数（触发快速重传）
      *   - sack:     选择确认位图
+     *   - w_max 等: CUBIC 三次函数状态
      */
+    const p2p_cc_ops_t*             cc;                 // 拥塞控制算法（NULL = 未启用）
     struct {
         uint32_t                cwnd;                   // 拥塞窗口 (字节/包数)
         uint32_t                ssthresh;               // 慢启动阈值
@@ -279,12 +597,88 @@ struct p2p_session {
         uint64_t                last_ack;               // 上次收到 ACK 的时间戳
         int                     cc_state;               // 拥塞控制状态 TCP_STATE_*
         float                   loss_rate;              // EWMA 丢包率估计（0.0-1.0）
+        uint32_t                w_max;                  // CUBIC：上次拥塞时的窗口 (字节)
+        uint64_t                epoch_start;            // CUBIC：当前拥塞避免阶段起点（0 = 未开始）
+        uint64_t                last_loss;              // CUBIC：上次减窗时间
+        double                  cubic_k;                // CUBIC：窗口回到 w_max 所需时间 (秒)
+        double                  w_est;                  // CUBIC：Reno 友好区估算窗口 (MSS)
+        float                   ecn_alpha;              // ECN L4S：CE 标记比例的 EWMA（DCTCP α）
+        uint32_t                ecn_acked;              // ECN L4S：本观察窗口（1 RTT）内确认的包数
+        uint32_t                ecn_marked;             // ECN L4S：本观察窗口内对端回显的 CE 标记数
+        uint64_t                ecn_win_end;            // ECN L4S：本观察窗口结束时间（0 = 未开始）
     }                               tcp;
 
+    /* BBR 拥塞控制状态（cfg.use_bbr） */
+    bbr_t                           bbr;
+
+    /* ======================== 统计（p2p_get_stats） ======================== */
+    p2p_counters_t                  stat;               // 会话累计流量（所属线程写入）
+    /* 活跃路径快照：path_manager_tick 刷新，读取方不必访问可能扩容的候选数组 */
+    uint32_t                        stat_rtt;           // 综合 RTT（毫秒）
+    float                           stat_loss;          // 丢包率
+    int                             stat_quality;       // path_quality_t
+    uint64_t                        stat_bw;            // 估计带宽（bps）
+    int64_t                         trace_cwnd;         // 最近一次记录的拥塞窗口（cwnd 事件去重）
+    uint64_t                        setup_start;        // p2p_connect 时刻（毫秒）
+    uint64_t                        setup_ts[P2P_SETUP_NUM];  // 建连里程碑时刻（0 = 未到达，见 p2p_setup_mark）
+    bool                            setup_done;         // 已首次进入 CONNECTED / RELAY（里程碑已汇入实例）
+    p2p_tune_t                      tune;               // 会话层运行时调参（p2p_tune_set）
+    p2p_session_opts_t              opts;               // 会话级传输选项（p2p_connect_opts，见 P2P_SOPT）
+
     /* ======================== 定时器 ======================== */
     uint64_t                        last_update;        // 上次调用 p2p_update() 的时间
+    p2p_timer_t                     timer;              // 时间轮节点：到期时刻为各模块下一截止时刻的最小值
+    struct p2p_session*             wake_next;          // inst->wake_list（或所属分片 wake_list）链接
+    int                             wake_req;           // 已压入唤醒栈尚未取出
+    int                             wait_space;         // p2p_send_wait：唤醒所需的 0 号流可写字节数
+    int                             wait_state;         // p2p_wait_state：等待的目标状态
+
+#ifdef P2P_THREADED
+    p2p_worker_t*                   worker;             // 所属会话分片（NULL = 由主工作线程驱动）
+    uint64_t                        ctrl_due;           // 控制面（NAT/路径管理）下一截止时刻：此前分片线程可只执行数据传输 tick
+    p2p_waiter_t                    waiters[P2P_WAIT_KINDS];  // 应用侧阻塞等待（见 p2p_waiter_t）
+#endif
 };
 
+/* 会话生效的传输配置项：p2p_connect_opts 置位的字段优先，否则取实例配置的同名字段 */
+#define P2P_SOPT(s, bit, field) (((s)->opts.set & (bit)) ? (s)->opts.field : (s)->inst->cfg.field)
+
+/* 会话生效的调参值（P2P_TUNE_*） */
+static inline int p2p_tune(const struct p2p_session *s, int id) {
+    int v;
+    if (p2p_tune_pick(&s->tune, id, &v) || p2p_tune_pick(&s->inst->tune, id, &v) || p2p_tune_pick(&p2p_tune_proc, id, &v))
+        return v;
+    return p2p_tune_def[id];
+}
+
+/* 建连握手中：cfg.early_data 时应用可先写入发送缓冲；期间收到的 0-RTT 数据暂留 reliable 层，不交付 */
+static inline bool p2p_session_handshaking(const struct p2p_session *s) {
+    return s->state >= P2P_STATE_SIGNALING && s->state <= P2P_STATE_PUNCHING;
+}
+
+/* 会话所属的时间轮 */
+static inline p2p_timer_wheel_t* p2p_session_wheel(struct p2p_session *s) {
+#ifdef P2P_THREADED
+    if (s->worker) return &s->worker->timers;
+#endif
+    return &s->inst->timers;
+}
+
+/* 会话使用的 reliable 缓冲区池 */
+static inline reliable_pool_t* p2p_session_pool(struct p2p_session *s) {
+#ifdef P2P_THREADED
+    if (s->worker) return &s->worker->rel_pool;
+#endif
+    return &s->inst->rel_pool;
+}
+
+/* 会话的本端 ID（COMPACT 附加身份会话为其身份 ID，否则为实例 ID）*/
+static inline const char* p2p_session_local_id(const struct p2p_session *s) {
+    if (s->inst->sig_mode == P2P_SIGNALING_MODE_COMPACT && s->sig_sess.compact.ident)
+        return s->sig_sess.compact.ident->local_peer_id;
+    return s->inst->local_peer_id;
+}
+
 #define P2P_CAND_PENDING(inst) \
     ((inst)->srflx_active < (inst)->srflx_count || (inst)->turn_pending > 0)
 
@@ -320,6 +714,9 @@ static inline const char* p2p_path_type_str(int type) {
         case P2P_PATH_PUNCH:            return "PUNCH";
         case P2P_PATH_RELAY:            return "RELAY";
         case P2P_PATH_SIGNALING:        return "SIGNALING";
+        case P2P_PATH_TCP:              return "TCP";
+        case P2P_PATH_OVERLAY:          return "OVERLAY";
+        case P2P_PATH_SHM:              return "SHM";
         default:                        return "UNKNOWN";
     }
 }
@@ -335,7 +732,10 @@ typedef enum {
     P2P_CAND_HOST  = 0,                         // 本地网卡地址（Host Candidate）
     P2P_CAND_SRFLX,                             // Server 反射地址（Server Reflexive Candidate）
     P2P_CAND_RELAY,                             // Server 中继地址（Relayed Candidate）
-    P2P_CAND_PRFLX                              // 对端反射地址（Peer Reflexive Candidate）
+    P2P_CAND_PRFLX,                             // 对端反射地址（Peer Reflexive Candidate）
+    P2P_CAND_TCP,                               // TCP 打洞连接（本地登记，不经信令交换，见 p2p_tcp_punch.h）
+    P2P_CAND_OVERLAY,                           // 经第三方已连接对端中转（本地登记，见 p2p_overlay.h）
+    P2P_CAND_SHM                                // 同主机共享内存环（本地登记，地址为合成的 127.0.0.1:0，见 p2p_shm.h）
 } p2p_cand_type_t;
 
 static inline const char* p2p_candidate_type_str(p2p_cand_type_t type) {
@@ -344,6 +744,9 @@ static inline const char* p2p_candidate_type_str(p2p_cand_type_t type) {
         case P2P_CAND_SRFLX:            return "Srflx";
         case P2P_CAND_PRFLX:            return "Prflx";
         case P2P_CAND_RELAY:            return "Relay";
+        case P2P_CAND_TCP:              return "Tcp";
+        case P2P_CAND_OVERLAY:          return "Overlay";
+        case P2P_CAND_SHM:              return "Shm";
         default:                        return "Unknown";
     }
 }
@@ -358,6 +761,40 @@ struct p2p_local_candidate_entry {
     struct sockaddr_in base_addr;               // 基础地址（平台原生 16B）
 };
 
+/* ============================================================================
+ * 会话索引（p2p.c）
+ * ============================================================================ */
+
+/* 设置会话 id 并同步 session_id 索引（id=0 表示移出索引） */
+void p2p_session_set_id(struct p2p_session *s, uint32_t id);
+
+/* 登记会话活跃路径地址到地址索引（addr=NULL 或信令中转地址表示移出索引） */
+void p2p_session_bind_addr(struct p2p_session *s, const struct sockaddr_in *addr);
+
+/* 根据 session_id 查找会话 */
+struct p2p_session* p2p_session_find(struct p2p_instance *inst, uint32_t id);
+
+/* 根据来源地址查找会话 */
+struct p2p_session* p2p_session_find_by_addr(struct p2p_instance *inst, const struct sockaddr_in *addr);
+
+/* 唤醒会话：本次（或下一次）p2p_update 即执行其会话级 tick（工作线程内收包、信令推进等状态变化后调用） */
+void p2p_session_wake(struct p2p_session *s);
+
+/* 空闲休眠检查（cfg.hibernate_ms，会话 tick 末尾持会话锁调用，见 p2p.c） */
+void p2p_session_hibernate(struct p2p_session *s, uint64_t now_ms);
+
+/*
+ * 空闲休眠恢复：重新分配流与 reliable 层缓冲区（持会话锁调用；未休眠时只刷新 data_ts）
+ * + 收到数据面包（nat_proto）、应用侧写入或开始文件发送时调用
+ */
+ret_t p2p_session_thaw(struct p2p_session *s, uint64_t now);
+
+/*
+ * 本机地址变化处理（update_control_send 每轮调用，见 route_shared_poll）
+ * + 地址集合代次与 inst->route_gen 不同时处理一次：重整套接字与 Srflx，向各会话增量同步 Host 候选
+ */
+void p2p_route_refresh(struct p2p_instance *inst, uint64_t now_ms);
+
 /*
  * 重置 session 连接状态
  *
@@ -373,7 +810,9 @@ struct p2p_local_candidate_entry {
  */
 static inline void p2p_session_reset(struct p2p_session *s, bool closing) {
     
-    // 清除远端候选
+    // 清除远端候选（TCP / 共享内存候选随之失效，关闭其连接与映射）
+    p2p_tcp_punch_close(s, false);
+    p2p_shm_close(s, false);
     s->remote_cand_cnt = 0;
     s->remote_host_cnt = 0;
     s->remote_srflx_cnt = 0;
@@ -384,6 +823,7 @@ static inline void p2p_session_reset(struct p2p_session *s, bool closing) {
     s->path_type = P2P_PATH_NONE;
     s->active_path = PATH_IDX_NONE;
     memset(&s->active_addr, 0, sizeof(s->active_addr));
+    p2p_session_bind_addr(s, NULL);
     
     // 重置 SIGNALING 中转地址的统计
     if (s->inst->signaling.active)
@@ -395,10 +835,16 @@ static inline void p2p_session_reset(struct p2p_session *s, bool closing) {
     // 重置探测状态（它依赖信令服务器的 rpc，即基于 session 的数据状态）
     // + 所以 session 关闭或重置，之前的探测也就无效了
     probe_reset(s);
+    nat_bind_probe_release(s);
+    nat_pmtu_release(s);
 
     // 重置可靠传输层（序列号、窗口、重试计数等）
     // + 对端重连时使用新的序列号起点，旧的状态会导致消息被误判为重复或乱序
+    // + 重连准备时先保留发送窗口内的包，双方在 CONN 中出示续传令牌后只重传对端未交付的部分
+    if (closing) { reliable_resume_free(s); s->resume.peer_token = 0; }
+    else reliable_resume_save(s);
     reliable_init(s);
+    fec_reset(s);
 
     // 如果是关闭连接（而非重置）
     if (closing) {
@@ -445,12 +891,18 @@ static inline void p2p_session_reset(struct p2p_session *s, bool closing) {
  */
 struct p2p_remote_candidate_entry {
     p2p_cand_type_t    type;                    // 候选类型
+    path_stats_t       stats;                   // 路径统计信息（开头的热字段与 type 相邻，见 path_stats_t）
     uint32_t           priority;                // 候选优先级
     struct sockaddr_in addr;                    // 传输地址（平台原生 16B）
 
     /* 收发分离状态 */
     uint64_t           last_punch_send_ms;      // 最近一次发送 PUNCH 的时间
-    path_stats_t       stats;                   // 路径统计信息
+
+    /* 检查表（见 p2p_nat.c check_*） */
+    uint64_t           pair_prio;               // 候选对优先级（RFC 8445 §6.1.2.3）
+    uint8_t            check;                   // 检查状态 NAT_CHECK_*
+    uint8_t            sock;                    // 发送套接字：0 = 默认 socks[0]，k = 第 k 个端口预测套接字
+    uint32_t           hist;                    // 候选类型历史得分（高 16 位成功率‰，低 16 位越大越快；见 p2p_nat.h）
 };
 
 /*
@@ -467,6 +919,31 @@ static inline bool p2p_remote_candidate_writable(const p2p_remote_candidate_entr
     return path_is_selectable(c->stats.state);
 }
 
+/*
+ * 当前处理包的接收时间（微秒，P_tick_us 时基），用于 RTT 采样
+ * + 收包上下文中为内核接收时间戳（或读出时刻），不含套接字缓冲区与主线程派发的排队时间
+ * + 非收包上下文（如 TCP 路径、定时器）回退为当前时刻
+ */
+static inline uint64_t p2p_rx_time_us(const struct p2p_session *s) {
+    return s->rx_us ? s->rx_us : P_tick_us();
+}
+
+/*
+ * 微秒 RTT 样本：sent_us（发送时 P_tick_us）到当前包接收时间
+ * + 与毫秒样本 rtt_ms（调用方按 now_ms 计算）不一致时回退为 rtt_ms × 1000：
+ *   接收时间早于 now 至多一个排队时长，两个时钟各差不到 1 tick；超出说明 now 并非实时时钟（如测试注入）
+ */
+#define P2P_RTT_US_SLACK        2000
+
+static inline uint64_t p2p_rtt_us(const struct p2p_session *s, uint64_t sent_us, uint32_t rtt_ms) {
+    uint64_t ms_us = (uint64_t)rtt_ms * 1000;
+    uint64_t rx = p2p_rx_time_us(s), now = P_tick_us();
+    if (!sent_us || rx < sent_us || now < rx) return ms_us;
+    uint64_t us = rx - sent_us;
+    if (ms_us > us + (now - rx) + P2P_RTT_US_SLACK || us > ms_us + P2P_RTT_US_SLACK) return ms_us;
+    return us;
+}
+
 /* ============================================================================
  * 候选地址序列化 / 反序列化
  * ============================================================================ */
@@ -479,7 +956,11 @@ static inline bool p2p_remote_candidate_writable(const p2p_remote_candidate_entr
 static inline int pack_candidate(const p2p_local_candidate_entry_t *c, uint8_t *buf) {
     p2p_candidate_t* w = (p2p_candidate_t*)buf;
     w->type     = (uint8_t)c->type;
-    sockaddr_to_p2p_wire(&c->addr, &w->addr);
+    if (p2p_udp_v6_is_alias(&c->addr)) {                /* IPv6 候选：别名还原为真实地址 */
+        w->addr.port = c->addr.sin_port;
+        p2p_udp_v6_real(&c->addr, w->addr.ip);
+    }
+    else sockaddr_to_p2p_wire(&c->addr, &w->addr);
     w->priority = htonl(c->priority);
     return (int)sizeof(p2p_candidate_t);  /* 23 */
 }
@@ -490,11 +971,14 @@ static inline int pack_candidate(const p2p_local_candidate_entry_t *c, uint8_t *
 static inline int unpack_candidate(p2p_remote_candidate_entry_t *c, const uint8_t *buf) {
     const p2p_candidate_t* w = (p2p_candidate_t*)buf;
     c->type     = (int)w->type;
-    sockaddr_from_p2p_wire(&c->addr, &w->addr);
+    if (p2p_sockaddr_is_ipv4(&w->addr)) sockaddr_from_p2p_wire(&c->addr, &w->addr);
+    else if (!p2p_udp_v6_alias(w->addr.ip, w->addr.port, &c->addr))
+        memset(&c->addr, 0, sizeof(c->addr));          /* 别名表满：置空地址，打洞时发送失败 */
     c->priority = ntohl(w->priority);
 
     c->last_punch_send_ms = 0;
     path_stats_init(&c->stats, 0);  /* 初始化路径统计默认值（rtt_min=9999 等） */
+    c->sock = 0;
 
     return (int)sizeof(p2p_candidate_t);  /* 23 */
 }
@@ -502,15 +986,19 @@ static inline int unpack_candidate(p2p_remote_candidate_entry_t *c, const uint8_
 /* ============================================================================
  * 动态候选数组辅助函数
  *
- * 向 local_cands / remote_cands 追加新候选，容量不足时自动翻倍扩容
+ * 向 local_cands / remote_cands 追加新候选，容量不足时自动翻倍扩容（P2P_FIXED_MEM：容量固定为 P2P_FIXED_CANDS）
  * 返回新候选槽位索引，或负值错误码（E_OUT_OF_MEMORY）
  * ============================================================================ */
 
 static inline ret_t p2p_cand_push_local(struct p2p_session *s) {
+#ifdef P2P_FIXED_MEM
+    if (s->local_cand_cnt >= s->local_cand_cap) return E_OUT_OF_MEMORY;     // 固定容量，不扩容
+#endif
     if (s->local_cand_cnt >= s->local_cand_cap) {
         int nc = s->local_cand_cap > 0 ? s->local_cand_cap * 2 : 8;
-        p2p_local_candidate_entry_t *p = (p2p_local_candidate_entry_t *)realloc(s->local_cands, nc * sizeof(p2p_local_candidate_entry_t));
+        p2p_local_candidate_entry_t *p = (p2p_local_candidate_entry_t *)p2p_arena_realloc(s->inst->arena, s->local_cands, nc * sizeof(p2p_local_candidate_entry_t));
         if (!p) return E_OUT_OF_MEMORY;
+        p2p_mem_add(&s->mem, P2P_MEM_CANDS, (int64_t)(nc - s->local_cand_cap) * sizeof(p2p_local_candidate_entry_t));
         s->local_cands    = p;
         s->local_cand_cap = nc;
     }
@@ -518,23 +1006,40 @@ static inline ret_t p2p_cand_push_local(struct p2p_session *s) {
 }
 
 static inline ret_t p2p_cand_push_remote(struct p2p_session *s) {
+#ifdef P2P_FIXED_MEM
+    if (s->remote_cand_cnt >= s->remote_cand_cap) return E_OUT_OF_MEMORY;
+#endif
     if (s->remote_cand_cnt >= s->remote_cand_cap) {
         int nc = s->remote_cand_cap > 0 ? s->remote_cand_cap * 2 : 8;
-        p2p_remote_candidate_entry_t *p = (p2p_remote_candidate_entry_t *)realloc(s->remote_cands, nc * sizeof(p2p_remote_candidate_entry_t));
+        p2p_remote_candidate_entry_t *p = (p2p_remote_candidate_entry_t *)p2p_arena_realloc(s->inst->arena, s->remote_cands, nc * sizeof(p2p_remote_candidate_entry_t));
         if (!p) return E_OUT_OF_MEMORY;
         if (nc > s->remote_cand_cap) {
             memset(p + s->remote_cand_cap, 0, (nc - s->remote_cand_cap) * sizeof(p2p_remote_candidate_entry_t));
         }
+        p2p_mem_add(&s->mem, P2P_MEM_CANDS, (int64_t)(nc - s->remote_cand_cap) * sizeof(p2p_remote_candidate_entry_t));
         s->remote_cands    = p;
         s->remote_cand_cap = nc;
     }
     return s->remote_cand_cnt++;
 }
 
+/* 查找类型与地址相同的本地候选，返回索引或 -1 */
+static inline int p2p_cand_find_local(const struct p2p_session *s, p2p_cand_type_t type, const struct sockaddr_in *addr) {
+    for (int i = 0; i < s->local_cand_cnt; i++) {
+        if (s->local_cands[i].type == type && sockaddr_equal(&s->local_cands[i].addr, addr)) return i;
+    }
+    return -1;
+}
+
+/* TCP 候选与 UDP 候选可能地址相同（端口保持），按当前收包来源（s->tcp_rx）区分 */
+static inline bool p2p_cand_match_rx(const struct p2p_session *s, const p2p_remote_candidate_entry_t *c) {
+    return (c->type == P2P_CAND_TCP) == s->tcp_rx;
+}
+
 static inline int p2p_find_remote_candidate_by_addr(const struct p2p_session *s, const struct sockaddr_in *addr) {
     if (!s || !addr) return -1;
     for (int i = 0; i < s->remote_cand_cnt; i++) {
-        if (sockaddr_equal(&s->remote_cands[i].addr, addr)) return i;
+        if (sockaddr_equal(&s->remote_cands[i].addr, addr) && p2p_cand_match_rx(s, &s->remote_cands[i])) return i;
     }
     return -1;
 }
@@ -545,14 +1050,18 @@ static inline int p2p_find_remote_candidate_by_addr(const struct p2p_session *s,
 */
 static inline ret_t p2p_remote_cands_reserve(struct p2p_session *s, int need) {
     if (need <= s->remote_cand_cap) return E_NONE;
+#ifdef P2P_FIXED_MEM
+    return E_OUT_OF_MEMORY;                             // 固定容量 P2P_FIXED_CANDS
+#endif
     int nc = s->remote_cand_cap > 0 ? s->remote_cand_cap : 8;
     while (nc < need) nc *= 2;
-    p2p_remote_candidate_entry_t *p = (p2p_remote_candidate_entry_t *)realloc(s->remote_cands, nc * sizeof(p2p_remote_candidate_entry_t));
+    p2p_remote_candidate_entry_t *p = (p2p_remote_candidate_entry_t *)p2p_arena_realloc(s->inst->arena, s->remote_cands, nc * sizeof(p2p_remote_candidate_entry_t));
     if (!p) {
         print("E:", LA_F("Failed to realloc memory for remote candidates (capacity: %d)", LA_F286, 286), nc);
         return E_OUT_OF_MEMORY;
     }
     memset(p + s->remote_cand_cap, 0, (nc - s->remote_cand_cap) * sizeof(p2p_remote_candidate_entry_t));
+    p2p_mem_add(&s->mem, P2P_MEM_CANDS, (int64_t)(nc - s->remote_cand_cap) * sizeof(p2p_remote_candidate_entry_t));
     s->remote_cands    = p;
     s->remote_cand_cap = nc;
     return E_NONE;
@@ -567,25 +1076,44 @@ static inline ret_t p2p_remote_cands_reserve(struct p2p_session *s, int need) {
  * 注意：这些函数需要 p2p_remote_candidate_entry 完整定义，故必须放在结构体之后
  * ============================================================================ */
 
+/*
+ * 设置活跃路径
+ * + 切换到不同路径/地址（故障转移、升级、NAT 重绑定、LOST 恢复）只改变寻址：
+ *   reliable 序号与在途窗口保留，在途包立即经新路径重传，仅重置 RTT/拥塞状态（见 reliable_on_migrate）
+ */
  static inline void p2p_set_active_path(struct p2p_session *s, int path_idx) {
+    int old_path = s->active_path;
+    struct sockaddr_in old_addr = s->active_addr;
+
     if (path_idx == PATH_IDX_SIGNALING) {
         if (!s->inst->signaling.active) return;
         s->active_path = path_idx;
         s->active_addr = s->inst->signaling.addr;
         s->path_type = P2P_PATH_SIGNALING;
+        p2p_session_bind_addr(s, NULL);
     } else if (path_idx >= 0 && path_idx < s->remote_cand_cnt) {
         p2p_remote_candidate_entry_t *e = &s->remote_cands[path_idx];
         s->active_path = path_idx;
         s->active_addr = e->addr;
         if (e->type == P2P_CAND_RELAY) s->path_type = P2P_PATH_RELAY;
+        else if (e->type == P2P_CAND_TCP) s->path_type = P2P_PATH_TCP;
+        else if (e->type == P2P_CAND_OVERLAY) s->path_type = P2P_PATH_OVERLAY;
+        else if (e->type == P2P_CAND_SHM) s->path_type = P2P_PATH_SHM;
         else if (e->stats.is_lan) s->path_type = P2P_PATH_LAN;
         else s->path_type = P2P_PATH_PUNCH;
+        /* OVERLAY 候选地址是中转端地址，收包按 session_id 派发，不登记地址索引 */
+        p2p_session_bind_addr(s, e->type == P2P_CAND_OVERLAY ? NULL : &s->active_addr);
     }
     else {
         s->active_path = PATH_IDX_NONE;
         s->active_addr = (struct sockaddr_in){0};
         s->path_type = P2P_PATH_NONE;
+        p2p_session_bind_addr(s, NULL);
     }
+
+    if (s->active_path >= PATH_IDX_SIGNALING
+        && (s->active_path != old_path || !sockaddr_equal(&s->active_addr, &old_addr)))
+        reliable_on_migrate(s, old_path);
 }
 
 //-----------------------------------------------------------------------------
@@ -598,7 +1126,7 @@ static inline ret_t p2p_reset_path(struct p2p_session *s, int path_idx) {
     } else if (path_idx >= 0 && path_idx < s->remote_cand_cnt) {
         p2p_remote_candidate_entry_t *c = &s->remote_cands[path_idx];
         c->last_punch_send_ms = 0;
-        path_stats_init(&c->stats, 0);
+        path_stats_init(&c->stats, c->type == P2P_CAND_OVERLAY ? P2P_OVERLAY_COST : 0);
     } else return E_INVALID;
 
     /* 如果重置的是活跃路径，切换到下一个最佳路径（可能是 PATH_IDX_NONE） */
@@ -616,6 +1144,12 @@ static inline p2p_path_type_t p2p_get_path_type(struct p2p_session *s, int path_
     p2p_remote_candidate_entry_t *e = &s->remote_cands[path_idx];
     if (e->type == P2P_CAND_RELAY)
         return P2P_PATH_RELAY;
+    if (e->type == P2P_CAND_TCP)
+        return P2P_PATH_TCP;
+    if (e->type == P2P_CAND_OVERLAY)
+        return P2P_PATH_OVERLAY;
+    if (e->type == P2P_CAND_SHM)
+        return P2P_PATH_SHM;
     if (e->stats.is_lan)
         return P2P_PATH_LAN;
     return P2P_PATH_PUNCH;
@@ -629,6 +1163,28 @@ static inline path_stats_t* p2p_get_path_stats(struct p2p_session *s, int path_i
     return NULL;
 }
 
+/* 会话流量计入的实例汇总块（所属分片或实例） */
+static inline p2p_counters_t* p2p_session_counters(struct p2p_session *s) {
+#ifdef P2P_THREADED
+    if (s->worker) return &s->worker->stat;
+#endif
+    return &s->inst->stat;
+}
+
+#define P2P_COUNT(c, field, v)  __atomic_fetch_add(&(c)->field, (uint64_t)(v), __ATOMIC_RELAXED)
+
+/* DATA 重传计数（reason：fast / rto / migrate，同时写入追踪事件） */
+static inline void p2p_count_retx(struct p2p_session *s, uint16_t seq, const char *reason) {
+    s->stat.retransmits++;
+    P2P_COUNT(p2p_session_counters(s), retransmits, 1);
+    P2P_TRACE(s, P2P_TRACE_RETX, 0, seq, 0, 0, 0, 0, reason);
+}
+
+/* 建连里程碑：只记录首次到达的时刻 */
+static inline void p2p_setup_mark(struct p2p_session *s, int m, uint64_t now_ms) {
+    if (!s->setup_ts[m]) s->setup_ts[m] = now_ms ? now_ms : 1;
+}
+
 static inline const struct sockaddr_in* p2p_get_path_addr(struct p2p_session *s, int path_idx) {
     if (path_idx == PATH_IDX_SIGNALING)
         return s->inst->signaling.active ? &s->inst->signaling.addr : NULL;
@@ -638,10 +1194,10 @@ static inline const struct sockaddr_in* p2p_get_path_addr(struct p2p_session *s,
 }
 
 static inline int p2p_find_path_by_addr(struct p2p_session *s, const struct sockaddr_in *addr) {
-    if (s->inst->signaling.active && sockaddr_equal(&s->inst->signaling.addr, addr))
+    if (!s->tcp_rx && s->inst->signaling.active && sockaddr_equal(&s->inst->signaling.addr, addr))
         return PATH_IDX_SIGNALING;
     for (int i = 0; i < s->remote_cand_cnt; i++) {
-        if (sockaddr_equal(&s->remote_cands[i].addr, addr)) return i;
+        if (sockaddr_equal(&s->remote_cands[i].addr, addr) && p2p_cand_match_rx(s, &s->remote_cands[i])) return i;
     }
     return -2;
 }
@@ -660,14 +1216,51 @@ void p2p_connecting(struct p2p_session *s);
 
 void p2p_connected(struct p2p_session *s, uint64_t now_ms);
 
+/* 候选收集完成：为尚未记录 P2P_SETUP_GATHER 的会话补记 */
+void p2p_setup_gathered(struct p2p_instance *inst, uint64_t now_ms);
+
+/* 距下一次需要 p2p_update 的毫秒数（由各会话 NAT / reliable / 路径管理器定时器决定，上限为 update_interval_ms） */
+int p2p_next_timeout(struct p2p_instance *inst, uint64_t now_ms);
+
+/* 收集需要监听的描述符（UDP 套接字、RELAY 信令 TCP、TCP 打洞、TURN TCP/TLS），返回总数（可能大于 max） */
+int p2p_collect_fds(struct p2p_instance *inst, p2p_fd_t *fds, int max);
+
+/* 派发一个经流式连接收到的包（TURN TCP/TLS），与来自 from 的 UDP 包同样处理（控制阶段持实例锁调用） */
+void p2p_dispatch_packet(struct p2p_instance *inst, uint8_t *pkt, int n, const struct sockaddr_in *from, uint64_t now_ms);
+
+#ifdef P2P_THREADED
+/* 分片模式主工作线程：收包并派发到各分片（持实例锁），返回是否有延后到控制阶段的实例级包 */
+bool p2p_update_steer(struct p2p_instance *inst);
+
+/* 分片模式主工作线程：控制阶段（持全部锁），处理延后的实例级包、信令、TURN、STUN 及主线程驱动的会话 */
+void p2p_update_control(struct p2p_instance *inst);
+
+/* 分片线程一轮调度（持分片锁），返回距下一次调度的毫秒数（-1 = 无定时任务） */
+int p2p_worker_update(p2p_worker_t *w);
+#endif
+
 int p2p_send_packet(struct p2p_session *s, const struct sockaddr_in *addr,
                     uint8_t type, uint8_t flags, uint16_t seq,
                     const void *payload, int payload_len, uint64_t now_ms);
 
+/* 经指定路径发送（多路径调度 / 冗余双发）；活跃路径等同 p2p_send_packet */
+int p2p_send_packet_path(struct p2p_session *s, int path_idx,
+                         uint8_t type, uint8_t flags, uint16_t seq,
+                         const void *payload, int payload_len, uint64_t now_ms);
+
+/* 包合并：开始数据传输阶段 / 发出缓冲中的包并结束阶段 / 释放缓冲区（会话销毁） */
+void p2p_bundle_begin(struct p2p_session *s);
+void p2p_bundle_end(struct p2p_session *s);
+void p2p_bundle_free(struct p2p_session *s);
+
 /* 发送原始 DTLS 记录（加密模块的握手/加密输出使用） */
 void p2p_send_dtls_record(struct p2p_session *s, const struct sockaddr_in *addr,
                   const void *dtls_record, int record_len);
 
+/* 发送待封装的记录：可延后时由加密线程池在发送合并 flush 前封装，否则就地封装后发出 */
+void p2p_send_dtls_record_sealed(struct p2p_session *s, const struct sockaddr_in *addr,
+                                 uint8_t *rec, int rec_len, p2p_aead_job_t *seal);
+
 /* ============================================================================
  * 实际链路发送接口（UDP 传输层直接调用）
  * ============================================================================ */
@@ -676,6 +1269,11 @@ ret_t p2p_udp_send_packet(struct p2p_instance *inst, const struct sockaddr_in *a
                           uint8_t type, uint8_t flags, uint16_t seq,
                           const void *payload, int payload_len);
 
+/* 经远端候选绑定的发送套接字发出（端口预测打通的路径必须沿原套接字收发，见 p2p_nat.c） */
+ret_t p2p_udp_send_packet_sock(struct p2p_instance *inst, int cand_sock, const struct sockaddr_in *addr,
+                               uint8_t type, uint8_t flags, uint16_t seq,
+                               const void *payload, int payload_len);
+
 ret_t p2p_turn_send_packet(struct p2p_instance *inst, const struct sockaddr_in *addr,
                            uint8_t type, uint8_t flags, uint16_t seq,
                            const void *payload, int payload_len);
@@ -0,0 +1,285 @@
+/*
+ * 局域网发现（见 p2p_lan.h）
+ */
+
+#define MOD_TAG "LAN"
+
+#include "p2p_internal.h"
+
+static p2p_lan_peer_t *peer_find(p2p_lan_t *l, const char *peer_id, uint64_t now) {
+    for (int i = 0; i < P2P_LAN_PEERS; i++) {
+        p2p_lan_peer_t *p = &l->peers[i];
+        if (!p->peer_id[0] || strncmp(p->peer_id, peer_id, P2P_PEER_ID_MAX)) continue;
+        if (tick_diff(now, p->seen_ms) >= P2P_LAN_TTL_MS) { memset(p, 0, sizeof(*p)); return NULL; }
+        return p;
+    }
+    return NULL;
+}
+
+/* 按 peer_id 取表项：优先已有、其次空闲，否则替换最久未见的 */
+static p2p_lan_peer_t *peer_slot(p2p_lan_t *l, const char *peer_id, uint64_t now) {
+
+    p2p_lan_peer_t *p = peer_find(l, peer_id, now);
+    if (p) return p;
+
+    p = &l->peers[0];
+    for (int i = 0; i < P2P_LAN_PEERS && p->peer_id[0]; i++) {
+        if (!l->peers[i].peer_id[0] || l->peers[i].seen_ms < p->seen_ms) p = &l->peers[i];
+    }
+    memset(p, 0, sizeof(*p));
+    strncpy(p->peer_id, peer_id, P2P_PEER_ID_MAX - 1);
+    return p;
+}
+
+/* 对端的首选地址：与本机某网卡同一子网的 Host 候选，没有则取第一个 */
+static const struct sockaddr_in *peer_addr(struct p2p_instance *inst, const p2p_lan_peer_t *p) {
+    route_ctx_t *rt = (route_ctx_t *)p2p_inst_route(inst);
+    for (int i = 0; rt && i < p->cnt; i++)
+        if (route_check_same_subnet(rt, &p->addrs[i])) return &p->addrs[i];
+    return p->cnt ? &p->addrs[0] : NULL;
+}
+
+/* 各本机网卡加入组播组（地址集合变化后重新加入，已加入的网卡返回错误，忽略即可） */
+static void lan_join(struct p2p_instance *inst) {
+
+    p2p_lan_t *l = inst->lan;
+    const route_ctx_t *rt = p2p_inst_route(inst);
+    l->route_gen = route_shared_gen();
+    if (!rt) return;
+
+    for (int i = 0; i < rt->addr_count; i++) {
+        struct ip_mreq mreq;
+        mreq.imr_multiaddr = l->group.sin_addr;
+        mreq.imr_interface = rt->local_addrs[i].sin_addr;
+        setsockopt(l->sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char *)&mreq, sizeof(mreq));
+    }
+}
+
+/* 构造 ANNOUNCE：want 为正在查找的对端（NULL = 纯通告） */
+static int lan_build(struct p2p_instance *inst, const char *want, uint8_t *buf, int cap) {
+
+    const route_ctx_t *rt = p2p_inst_route(inst);
+    int id_len = (int)strnlen(inst->local_peer_id, P2P_PEER_ID_MAX - 1);
+    int want_len = want ? (int)strnlen(want, P2P_PEER_ID_MAX - 1) : 0;
+    int cnt = rt && inst->sock_cnt > 0 && !inst->cfg.test_ice_host_off ? rt->addr_count : 0;
+    if (cnt > P2P_LAN_ADDRS) cnt = P2P_LAN_ADDRS;
+    const char *key = inst->cfg.auth_key;
+
+    int n = P2P_LAN_HDR_SIZE + id_len + want_len + cnt * 6 + (key ? P2P_LAN_MAC_SIZE : 0);
+    if (n > cap) return -1;
+
+    nwrite_l(buf, P2P_LAN_MAGIC);
+    buf[4] = P2P_LAN_VER;
+    buf[5] = key ? P2P_LAN_FLAG_MAC : 0;
+    buf[6] = (uint8_t)cnt;
+    buf[7] = (uint8_t)id_len;
+    buf[8] = (uint8_t)want_len;
+    n = P2P_LAN_HDR_SIZE;
+    memcpy(buf + n, inst->local_peer_id, id_len); n += id_len;
+    if (want_len) { memcpy(buf + n, want, want_len); n += want_len; }
+
+    // Host 候选：socks[0] 绑定 INADDR_ANY，展开为各网卡地址（与 gather_local_candidates 一致）
+    uint16_t port = cnt ? inst->socks[0].local_addr.sin_port : 0;
+    for (int i = 0; i < cnt; i++) {
+        memcpy(buf + n, &rt->local_addrs[i].sin_addr.s_addr, 4);
+        memcpy(buf + n + 4, &port, 2);
+        n += 6;
+    }
+
+    if (key) {
+        p2p_hmac_sha1((const uint8_t *)key, (int)strlen(key), buf, n, buf + n);
+        n += P2P_LAN_MAC_SIZE;
+    }
+    return n;
+}
+
+/* 在各本机网卡上组播一次通告 */
+static void lan_send(struct p2p_instance *inst, const char *want, uint64_t now) {
+
+    p2p_lan_t *l = inst->lan;
+    uint8_t buf[P2P_LAN_HDR_SIZE + 2 * P2P_PEER_ID_MAX + P2P_LAN_ADDRS * 6 + P2P_LAN_MAC_SIZE];
+    int n = lan_build(inst, want, buf, sizeof(buf));
+    if (n < 0) return;
+
+    const route_ctx_t *rt = p2p_inst_route(inst);
+    for (int i = 0; rt && i < rt->addr_count; i++) {
+        struct in_addr ifa = rt->local_addrs[i].sin_addr;
+        setsockopt(l->sock, IPPROTO_IP, IP_MULTICAST_IF, (const char *)&ifa, sizeof(ifa));
+        sendto(l->sock, (const char *)buf, n, 0, (const struct sockaddr *)&l->group, sizeof(l->group));
+    }
+    l->announce_ms = now;
+}
+
+/* 等待中的会话（尚未开始打洞）向刚发现的对端发起打洞 */
+static void lan_resume(struct p2p_instance *inst, const p2p_lan_peer_t *p) {
+
+    const struct sockaddr_in *addr = peer_addr(inst, p);
+    if (!addr) return;
+
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
+        if (s->nat.state != NAT_INIT || s->nat.resume) continue;
+        if (s->state == P2P_STATE_CLOSED || s->state == P2P_STATE_ERROR) continue;
+        if (strncmp(s->remote_peer_id, p->peer_id, P2P_PEER_ID_MAX)) continue;
+        nat_resume(s, addr, P2P_CAND_HOST);
+    }
+}
+
+static void lan_on_packet(struct p2p_instance *inst, const uint8_t *buf, int len,
+                          const struct sockaddr_in *from, uint64_t now) {
+
+    p2p_lan_t *l = inst->lan;
+    if (len < P2P_LAN_HDR_SIZE || nget_l(buf) != P2P_LAN_MAGIC || buf[4] != P2P_LAN_VER) return;
+
+    int cnt = buf[6], id_len = buf[7], want_len = buf[8];
+    bool mac = (buf[5] & P2P_LAN_FLAG_MAC) != 0;
+    int body = P2P_LAN_HDR_SIZE + id_len + want_len + cnt * 6;
+    if (!id_len || id_len >= P2P_PEER_ID_MAX || want_len >= P2P_PEER_ID_MAX
+        || len < body + (mac ? P2P_LAN_MAC_SIZE : 0)) return;
+
+    // 设置了 auth_key：只接受 MAC 校验通过的通告
+    const char *key = inst->cfg.auth_key;
+    if (key) {
+        uint8_t digest[P2P_LAN_MAC_SIZE];
+        if (!mac) return;
+        p2p_hmac_sha1((const uint8_t *)key, (int)strlen(key), buf, body, digest);
+        if (memcmp(digest, buf + body, P2P_LAN_MAC_SIZE)) {
+            print("W:", LA_F("lan: bad announce MAC from %s:%d", LA_F696, 696),
+                  inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+            return;
+        }
+    }
+
+    char id[P2P_PEER_ID_MAX], want[P2P_PEER_ID_MAX];
+    memcpy(id, buf + P2P_LAN_HDR_SIZE, id_len); id[id_len] = '\0';
+    memcpy(want, buf + P2P_LAN_HDR_SIZE + id_len, want_len); want[want_len] = '\0';
+    if (!strncmp(id, inst->local_peer_id, P2P_PEER_ID_MAX)) return;        // 组播回环的本端通告
+
+    // 以本端为目标的查询：稍后（P2P_LAN_REPLY_MS 内合并）组播应答
+    if (want_len && !strncmp(want, inst->local_peer_id, P2P_PEER_ID_MAX)) l->reply = true;
+
+    if (!cnt) return;
+    if (cnt > P2P_LAN_ADDRS) cnt = P2P_LAN_ADDRS;
+
+    bool fresh = !peer_find(l, id, now);
+    p2p_lan_peer_t *p = peer_slot(l, id, now);
+    const uint8_t *a = buf + P2P_LAN_HDR_SIZE + id_len + want_len;
+    p->cnt = 0;
+    for (int i = 0; i < cnt; i++, a += 6) {
+        struct sockaddr_in *sa = &p->addrs[p->cnt];
+        memset(sa, 0, sizeof(*sa));
+        sa->sin_family = AF_INET;
+        memcpy(&sa->sin_addr.s_addr, a, 4);
+        memcpy(&sa->sin_port, a + 4, 2);
+        if (sa->sin_addr.s_addr && sa->sin_port) p->cnt++;
+    }
+    p->seen_ms = now;
+
+    if (fresh) print("I:", LA_F("lan: peer '%s' seen at %s:%d (%d addrs)", LA_F697, 697),
+                     id, inet_ntoa(from->sin_addr), ntohs(from->sin_port), p->cnt);
+    lan_resume(inst, p);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+ret_t p2p_lan_create(struct p2p_instance *inst) {
+
+    if (inst->cfg.multi_session) return E_NO_SUPPORT;
+
+    p2p_lan_t *l = (p2p_lan_t *)p2p_calloc(1, sizeof(*l));
+    if (!l) return E_OUT_OF_MEMORY;
+
+    l->group.sin_family = AF_INET;
+    l->group.sin_port = htons(P2P_LAN_PORT);
+    inet_pton(AF_INET, P2P_LAN_GROUP, &l->group.sin_addr);
+
+    l->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (l->sock == P_INVALID_SOCKET) { p2p_free(l); return E_EXTERNAL(P_sock_errno()); }
+
+    // 同机多个实例共用组播端口
+    int opt = 1;
+    setsockopt(l->sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt, sizeof(opt));
+#ifdef SO_REUSEPORT
+    setsockopt(l->sock, SOL_SOCKET, SO_REUSEPORT, (const char *)&opt, sizeof(opt));
+#endif
+    setsockopt(l->sock, IPPROTO_IP, IP_MULTICAST_LOOP, (const char *)&opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = l->group.sin_port;
+    if (P_sock_nonblock(l->sock, true) != E_NONE
+        || bind(l->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int e = P_sock_errno();
+        P_sock_close(l->sock);
+        p2p_free(l);
+        return E_EXTERNAL(e);
+    }
+
+    inst->lan = l;
+    lan_join(inst);
+    lan_send(inst, NULL, p2p_now_ms());
+
+    print("I:", LA_F("lan: discovery on %s:%d", LA_F698, 698), P2P_LAN_GROUP, P2P_LAN_PORT);
+    return E_NONE;
+}
+
+void p2p_lan_free(struct p2p_instance *inst) {
+
+    p2p_lan_t *l = inst->lan;
+    if (!l) return;
+    P_sock_close(l->sock);
+    p2p_free(l);
+    inst->lan = NULL;
+}
+
+sock_t p2p_lan_sock(const struct p2p_instance *inst) {
+    return inst->lan ? inst->lan->sock : P_INVALID_SOCKET;
+}
+
+bool p2p_lan_connect(struct p2p_session *s) {
+
+    struct p2p_instance *inst = s->inst;
+    p2p_lan_t *l = inst->lan;
+    if (!l || !s->remote_peer_id[0]) return false;
+
+    uint64_t now = p2p_now_ms();
+    const p2p_lan_peer_t *p = peer_find(l, s->remote_peer_id, now);
+    const struct sockaddr_in *addr = p ? peer_addr(inst, p) : NULL;
+    if (!addr) {
+        lan_send(inst, s->remote_peer_id, now);
+        return false;
+    }
+
+    nat_resume(s, addr, P2P_CAND_HOST);
+    return true;
+}
+
+void p2p_lan_tick_recv(struct p2p_instance *inst, uint64_t now_ms) {
+
+    p2p_lan_t *l = inst->lan;
+    if (!l) return;
+
+    uint8_t buf[512];
+    for (int i = 0; i < P2P_LAN_RX_MAX; i++) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t r = recvfrom(l->sock, (char *)buf, (int)sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
+        if (r < 0) break;
+        lan_on_packet(inst, buf, (int)r, &from, now_ms);
+    }
+}
+
+void p2p_lan_tick_send(struct p2p_instance *inst, uint64_t now_ms) {
+
+    p2p_lan_t *l = inst->lan;
+    if (!l) return;
+
+    if (l->route_gen != route_shared_gen()) lan_join(inst);
+
+    uint64_t since = tick_diff(now_ms, l->announce_ms);
+    if ((l->reply && since >= P2P_LAN_REPLY_MS) || since >= P2P_LAN_ANNOUNCE_MS) {
+        l->reply = false;
+        lan_send(inst, NULL, now_ms);
+    }
+}
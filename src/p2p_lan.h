@@ -0,0 +1,74 @@
+/*
+ * 局域网发现（cfg.lan_discovery）
+ *
+ * 实例在本地各网卡上向 P2P_LAN_GROUP:P2P_LAN_PORT 组播 ANNOUNCE，通告本端 peer_id 与 Host 候选；
+ * 收到的通告按 peer_id 记入实例级表（P2P_LAN_TTL_MS 内有效）。p2p_connect 的对端已在表中时，
+ * 与信令并行立即经 nat_resume 向其同网段 Host 地址打洞（同 0-RTT 重连），局域网内连接不等待信令往返；
+ * 对端尚未出现在表中时，ANNOUNCE 携带 want=对端 ID 作为查询，对端收到后立即组播自己的通告，
+ * 本端收到后再对等待中的会话发起打洞。
+ *
+ * 包格式（UDP，网络字节序）：
+ *   [magic "P2PL"(4)][ver(1)][flags(1)][cnt(1)][id_len(1)][want_len(1)]
+ *   [peer_id(id_len)][want(want_len)][ip(4) port(2)] * cnt [mac(20)]
+ *   flags & P2P_LAN_FLAG_MAC：末尾附 HMAC-SHA1(cfg.auth_key, 之前的全部字节)；
+ *   设置了 auth_key 的实例只接受带正确 MAC 的通告，未设置时不校验（与 PUNCH 本身的信任程度一致）。
+ *
+ * 多会话模式的 PUNCH 需携带信令分配的 session_id，无法先于信令发出，此时不启用。
+ * 表与套接字只在实例锁下访问（p2p_connect 与实例控制阶段）。
+ */
+#ifndef P2P_LAN_H
+#define P2P_LAN_H
+
+#include "predefine.h"
+
+struct p2p_instance;
+struct p2p_session;
+
+#define P2P_LAN_GROUP           "239.255.80.50"     /* 组播组（组织本地范围） */
+#define P2P_LAN_PORT            35850               /* 组播端口 */
+#define P2P_LAN_MAGIC           0x5032504Cu         /* "P2PL" */
+#define P2P_LAN_VER             1
+#define P2P_LAN_FLAG_MAC        0x01                /* 末尾附 HMAC-SHA1 */
+#define P2P_LAN_HDR_SIZE        9                   /* magic + ver + flags + cnt + id_len + want_len */
+#define P2P_LAN_MAC_SIZE        20
+#define P2P_LAN_ADDRS           8                   /* 单个对端记录的 Host 地址上限 */
+#define P2P_LAN_PEERS           32                  /* 表容量（满时替换最久未见的） */
+#define P2P_LAN_ANNOUNCE_MS     5000                /* 周期通告间隔 */
+#define P2P_LAN_TTL_MS          (3 * P2P_LAN_ANNOUNCE_MS)   /* 表项有效期 */
+#define P2P_LAN_REPLY_MS        100                 /* 应答查询的最短间隔（多个查询合并为一次通告） */
+#define P2P_LAN_RX_MAX          16                  /* 每次 tick 最多读取的包数 */
+
+typedef struct {
+    char                peer_id[P2P_PEER_ID_MAX];   // 对端 ID（空 = 空闲）
+    struct sockaddr_in  addrs[P2P_LAN_ADDRS];       // 通告的 Host 候选
+    int                 cnt;
+    uint64_t            seen_ms;                    // 最近一次收到通告的时间
+} p2p_lan_peer_t;
+
+typedef struct p2p_lan {
+    sock_t              sock;                       // 绑定 P2P_LAN_PORT 并加入组播组的套接字
+    struct sockaddr_in  group;                      // 组播目标地址
+    uint32_t            route_gen;                  // 已加入组播组的本机地址集合代次
+    uint64_t            announce_ms;                // 上次组播通告的时间
+    bool                reply;                      // 收到以本端为目标的查询，待应答
+    p2p_lan_peer_t      peers[P2P_LAN_PEERS];
+} p2p_lan_t;
+
+/* 创建（打开组播套接字）/ 释放（p2p_create / p2p_destroy，仅 cfg.lan_discovery 时） */
+ret_t p2p_lan_create(struct p2p_instance *inst);
+void  p2p_lan_free(struct p2p_instance *inst);
+
+/* 组播套接字（加入 p2p_collect_fds；未启用返回 P_INVALID_SOCKET） */
+sock_t p2p_lan_sock(const struct p2p_instance *inst);
+
+/*
+ * p2p_connect：对端已在表中时向其 Host 地址发起打洞并返回 true；
+ * 否则组播查询（want = 对端 ID）并返回 false，对端应答后由 p2p_lan_tick_recv 发起打洞
+ */
+bool  p2p_lan_connect(struct p2p_session *s);
+
+/* 实例控制阶段：读取通告并更新表、对等待中的会话发起打洞 / 周期通告与查询应答 */
+void  p2p_lan_tick_recv(struct p2p_instance *inst, uint64_t now_ms);
+void  p2p_lan_tick_send(struct p2p_instance *inst, uint64_t now_ms);
+
+#endif /* P2P_LAN_H */
@@ -0,0 +1,128 @@
+/*
+ * 内置 LZ 压缩实现（见 p2p_lz.h）
+ */
+
+#include "p2p_lz.h"
+
+#define LEN_EXT         15              /* token 中长度字段的最大值，达到时后跟扩展字节 */
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline int lz_hash(uint32_t v) {
+    return (int)((v * 2654435761u) >> (32 - P2P_LZ_HASH_BITS));
+}
+
+/* 长度扩展字节数 */
+static inline int ext_size(int n) {
+    return n >= LEN_EXT ? (n - LEN_EXT) / 255 + 1 : 0;
+}
+
+static uint8_t *put_ext(uint8_t *op, int n) {
+    for (n -= LEN_EXT; n >= 255; n -= 255) *op++ = 255;
+    *op++ = (uint8_t)n;
+    return op;
+}
+
+/* 写出一个序列（off = 0 为仅字面量的结尾序列） */
+static uint8_t *put_seq(uint8_t *op, const uint8_t *lit, int lit_len, int off, int mlen) {
+    int ml = off ? mlen - P2P_LZ_MIN_MATCH : 0;
+    *op++ = (uint8_t)(((lit_len < LEN_EXT ? lit_len : LEN_EXT) << 4) | (ml < LEN_EXT ? ml : LEN_EXT));
+    if (lit_len >= LEN_EXT) op = put_ext(op, lit_len);
+    memcpy(op, lit, (size_t)lit_len);
+    op += lit_len;
+    if (!off) return op;
+    op[0] = (uint8_t)off;
+    op[1] = (uint8_t)(off >> 8);
+    op += 2;
+    if (ml >= LEN_EXT) op = put_ext(op, ml);
+    return op;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * 贪心单次哈希匹配：每个位置只查哈希表中最近一次出现的 4 字节前缀；
+ * 连续未命中时逐渐加大步长，不可压缩数据快速跳过
+ */
+int p2p_lz_compress(const uint8_t *src, int *src_len, uint8_t *dst, int cap) {
+
+    int n = *src_len < P2P_LZ_RAW_MAX ? *src_len : P2P_LZ_RAW_MAX;
+    uint16_t table[1 << P2P_LZ_HASH_BITS];     // 位置 + 1（0 = 空）
+    memset(table, 0, sizeof(table));
+
+    uint8_t *op = dst;
+    int ip = 0, anchor = 0;
+    while (ip + P2P_LZ_MIN_MATCH <= n) {
+
+        int h = lz_hash(read32(src + ip));
+        int ref = table[h] - 1;
+        table[h] = (uint16_t)(ip + 1);
+        if (ref < 0 || read32(src + ref) != read32(src + ip)) {
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        int mlen = P2P_LZ_MIN_MATCH;
+        while (ip + mlen < n && src[ref + mlen] == src[ip + mlen]) mlen++;
+
+        // 放不下该序列：剩余部分只以字面量结尾
+        int lit = ip - anchor;
+        int need = 1 + ext_size(lit) + lit + 2 + ext_size(mlen - P2P_LZ_MIN_MATCH);
+        if (need > cap - (int)(op - dst)) break;
+
+        op = put_seq(op, src + anchor, lit, ip - ref, mlen);
+        ip += mlen;
+        anchor = ip;
+        if (ip + 2 <= n) table[lz_hash(read32(src + ip - 2))] = (uint16_t)(ip - 1);
+    }
+
+    // 结尾字面量：按剩余容量截断
+    int lit = 0, avail = cap - (int)(op - dst);
+    if (avail > 1) {
+        lit = n - anchor < avail - 1 ? n - anchor : avail - 1;
+        while (lit > 0 && 1 + ext_size(lit) + lit > avail) lit--;
+    }
+    if (lit > 0) op = put_seq(op, src + anchor, lit, 0, 0);
+
+    *src_len = anchor + lit;
+    return (int)(op - dst);
+}
+
+int p2p_lz_decompress(const uint8_t *src, int len, uint8_t *dst, int cap) {
+
+    const uint8_t *ip = src, *end = src + len;
+    uint8_t *op = dst, *oend = dst + cap;
+
+    while (ip < end) {
+        int token = *ip++, b;
+
+        int lit = token >> 4;
+        if (lit == LEN_EXT) {
+            do { if (ip >= end) return -1; lit += b = *ip++; } while (b == 255);
+        }
+        if (lit > end - ip || lit > oend - op) return -1;
+        memcpy(op, ip, (size_t)lit);
+        op += lit;
+        ip += lit;
+        if (ip == end) break;
+
+        if (end - ip < 2) return -1;
+        int off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        int mlen = token & 0x0f;
+        if (mlen == LEN_EXT) {
+            do { if (ip >= end) return -1; mlen += b = *ip++; } while (b == 255);
+        }
+        mlen += P2P_LZ_MIN_MATCH;
+        if (!off || off > op - dst || mlen > oend - op) return -1;
+
+        // 匹配可与输出重叠（off < mlen 时重复前文），逐字节复制
+        const uint8_t *ref = op - off;
+        while (mlen--) *op++ = *ref++;
+    }
+    return (int)(op - dst);
+}
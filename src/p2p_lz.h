@@ -0,0 +1,40 @@
+/*
+ * 内置 LZ 压缩（LZ4 块格式的精简实现，零依赖）
+ *
+ * 序列格式：[token(1)][字面量长度扩展][字面量][offset(2, 小端)][匹配长度扩展]
+ *   - token 高 4 位为字面量长度，低 4 位为匹配长度 - 4，取 15 时后跟逐字节扩展（255 表示继续）
+ *   - 输入在字面量之后结束即为结束，最后一个序列可以没有匹配
+ *
+ * 压缩按输出容量截断：尽量多地消耗输入，使输出恰好放进给定容量（一个 DATA 包），
+ * 由调用方据消耗量推进流偏移；解压对全部长度与偏移做边界检查，格式错误返回 -1。
+ * 单次输入不超过 P2P_LZ_RAW_MAX（匹配偏移 16 位、哈希表存 16 位位置）。
+ */
+
+#ifndef P2P_LZ_H
+#define P2P_LZ_H
+
+#include "predefine.h"
+
+#define P2P_LZ_RAW_MAX          8192            /* 单个压缩块的最大原始字节数 */
+#define P2P_LZ_MIN_MATCH        4               /* 最短匹配 */
+#define P2P_LZ_HASH_BITS        12              /* 哈希表 4096 项 */
+
+/*
+ * 压缩
+ *
+ * @param src       原始数据
+ * @param src_len   [in] 可用的原始字节数（<= P2P_LZ_RAW_MAX），[out] 实际消耗的字节数
+ * @param dst       输出缓冲区
+ * @param cap       输出容量
+ * @return          输出字节数（无法放下任何数据返回 0）
+ */
+int p2p_lz_compress(const uint8_t *src, int *src_len, uint8_t *dst, int cap);
+
+/*
+ * 解压
+ *
+ * @return  解压后的字节数，格式错误或超出 cap 返回 -1
+ */
+int p2p_lz_decompress(const uint8_t *src, int len, uint8_t *dst, int cap);
+
+#endif /* P2P_LZ_H */
@@ -0,0 +1,249 @@
+/*
+ * 内存分配钩子与实例内存区实现，说明见 p2p_mem.h
+ */
+
+#define MOD_TAG "MEM"
+
+#include "p2p_internal.h"
+
+#define ARENA_MAGIC     ((size_t)0x70327061u)       /* "p2pa" */
+
+#ifndef P2P_FIXED_MEM
+
+static void *def_malloc(size_t size, void *ud) { (void)ud; return malloc(size); }
+static void *def_realloc(void *ptr, size_t size, void *ud) { (void)ud; return realloc(ptr, size); }
+static void  def_free(void *ptr, void *ud) { (void)ud; free(ptr); }
+
+#else /* P2P_FIXED_MEM */
+
+/*
+ * 静态块池：每级一段连续的静态存储，按块大小切分，空闲块首部存 next 串成单链表
+ * + 按地址区间即可判定块所属级别，无块头开销；realloc 在本级可容纳时原地返回
+ * + 全局一把自旋锁（临界区只有链表操作）
+ */
+typedef union { void *p; uint64_t u; double d; } pool_align_t;
+
+#define POOL_DEF(sz, cnt)   static pool_align_t pool_mem_##sz[(size_t)(cnt) * (sz) / sizeof(pool_align_t)]
+
+POOL_DEF(64, P2P_FIXED_POOL_64);
+POOL_DEF(256, P2P_FIXED_POOL_256);
+POOL_DEF(1024, P2P_FIXED_POOL_1K);
+POOL_DEF(4096, P2P_FIXED_POOL_4K);
+POOL_DEF(16384, P2P_FIXED_POOL_16K);
+POOL_DEF(32768, P2P_FIXED_POOL_32K);
+POOL_DEF(65536, P2P_FIXED_POOL_64K);
+
+typedef struct {
+    uint8_t*                base;
+    uint32_t                size;
+    uint32_t                total;
+    uint32_t                carved;         // 已切出的块数（首次使用时才串入空闲链表）
+    void*                   free_list;
+    p2p_fixed_pool_stat_t   stat;
+} pool_class_t;
+
+#define POOL_CLASS(sz, cnt) { (uint8_t *)pool_mem_##sz, sz, cnt, 0, NULL, { sz, cnt, 0, 0, 0 } }
+
+static pool_class_t g_pool[P2P_FIXED_POOL_CLASSES] = {
+    POOL_CLASS(64, P2P_FIXED_POOL_64),
+    POOL_CLASS(256, P2P_FIXED_POOL_256),
+    POOL_CLASS(1024, P2P_FIXED_POOL_1K),
+    POOL_CLASS(4096, P2P_FIXED_POOL_4K),
+    POOL_CLASS(16384, P2P_FIXED_POOL_16K),
+    POOL_CLASS(32768, P2P_FIXED_POOL_32K),
+    POOL_CLASS(65536, P2P_FIXED_POOL_64K),
+};
+static volatile long g_pool_lock;
+
+#if defined(_MSC_VER)
+#define POOL_LOCK()         while (_InterlockedExchange(&g_pool_lock, 1)) {}
+#define POOL_UNLOCK()       _InterlockedExchange(&g_pool_lock, 0)
+#else
+#define POOL_LOCK()         while (__atomic_exchange_n(&g_pool_lock, 1, __ATOMIC_ACQUIRE)) {}
+#define POOL_UNLOCK()       __atomic_store_n(&g_pool_lock, 0, __ATOMIC_RELEASE)
+#endif
+
+/* 块所属级别，不属于任何一级返回 NULL */
+static pool_class_t *pool_of(const void *ptr) {
+    const uint8_t *p = (const uint8_t *)ptr;
+    for (int i = 0; i < P2P_FIXED_POOL_CLASSES; i++) {
+        pool_class_t *c = &g_pool[i];
+        if (p >= c->base && p < c->base + (size_t)c->size * c->total) return c;
+    }
+    return NULL;
+}
+
+static void *def_malloc(size_t size, void *ud) {
+
+    (void)ud;
+    void *p = NULL;
+    POOL_LOCK();
+    for (int i = 0; i < P2P_FIXED_POOL_CLASSES && !p; i++) {
+        pool_class_t *c = &g_pool[i];
+        if (size > c->size) continue;
+        if (c->free_list) {
+            p = c->free_list;
+            c->free_list = *(void **)p;
+        }
+        else if (c->carved < c->total) p = c->base + (size_t)c->size * c->carved++;
+        else { c->stat.fails++; continue; }
+        if (++c->stat.used > c->stat.peak) c->stat.peak = c->stat.used;
+    }
+    POOL_UNLOCK();
+    return p;
+}
+
+static void def_free(void *ptr, void *ud) {
+
+    (void)ud;
+    pool_class_t *c = pool_of(ptr);
+    assert(c && ((const uint8_t *)ptr - c->base) % c->size == 0);
+    if (!c) return;
+    POOL_LOCK();
+    *(void **)ptr = c->free_list;
+    c->free_list = ptr;
+    c->stat.used--;
+    POOL_UNLOCK();
+}
+
+static void *def_realloc(void *ptr, size_t size, void *ud) {
+
+    if (!ptr) return def_malloc(size, ud);
+    pool_class_t *c = pool_of(ptr);
+    assert(c);
+    if (!c) return NULL;
+    if (size <= c->size) return ptr;
+
+    void *p = def_malloc(size, ud);
+    if (!p) return NULL;
+    memcpy(p, ptr, c->size);
+    def_free(ptr, ud);
+    return p;
+}
+
+void p2p_fixed_mem_stats(p2p_fixed_pool_stat_t *out) {
+    POOL_LOCK();
+    for (int i = 0; i < P2P_FIXED_POOL_CLASSES; i++) out[i] = g_pool[i].stat;
+    POOL_UNLOCK();
+}
+
+#endif /* P2P_FIXED_MEM */
+
+p2p_allocator_t p2p_allocator = { def_malloc, def_realloc, def_free, NULL };
+
+int p2p_set_allocator(const p2p_allocator_t *a) {
+    if (!a) {
+        p2p_allocator.malloc_fn = def_malloc;
+        p2p_allocator.realloc_fn = def_realloc;
+        p2p_allocator.free_fn = def_free;
+        p2p_allocator.userdata = NULL;
+        return 0;
+    }
+    if (!a->malloc_fn || !a->realloc_fn || !a->free_fn) return -1;
+    p2p_allocator = *a;
+    return 0;
+}
+
+void p2p_mem_release(p2p_mem_acct_t *m) {
+    for (int i = 0; i < P2P_MEM_NUM; i++) {
+        size_t n = __atomic_exchange_n(&m->bytes[i], 0, __ATOMIC_RELAXED);
+        if (n) p2p_mem_add(m->parent, i, -(int64_t)n);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+p2p_arena_t *p2p_arena_create(void) {
+    p2p_arena_t *a = (p2p_arena_t *)p2p_calloc(1, sizeof(*a));
+    if (!a) return NULL;
+    if (P_mutex_init(&a->mtx) != 0) { p2p_free(a); return NULL; }
+    return a;
+}
+
+uint32_t p2p_arena_destroy(p2p_arena_t *a) {
+    if (!a) return 0;
+    uint32_t n = 0;
+    p2p_arena_blk_t *b = a->head;
+    while (b) {
+        p2p_arena_blk_t *next = b->next;
+        p2p_free(b);
+        b = next; n++;
+    }
+    P_mutex_final(&a->mtx);
+    p2p_free(a);
+    return n;
+}
+
+static void arena_link(p2p_arena_t *a, p2p_arena_blk_t *b, size_t size) {
+    b->size = size;
+    b->magic = ARENA_MAGIC;
+    b->prev = NULL;
+    b->next = a->head;
+    if (a->head) a->head->prev = b;
+    a->head = b;
+    a->blocks++;
+    a->bytes += size;
+    if (a->bytes > a->peak) a->peak = a->bytes;
+}
+
+static void arena_unlink(p2p_arena_t *a, p2p_arena_blk_t *b) {
+    if (b->prev) b->prev->next = b->next;
+    else a->head = b->next;
+    if (b->next) b->next->prev = b->prev;
+    a->blocks--;
+    a->bytes -= b->size;
+}
+
+void *p2p_arena_malloc(p2p_arena_t *a, size_t size) {
+    if (!a) return p2p_malloc(size);
+    if (size > (size_t)-1 - sizeof(p2p_arena_blk_t)) return NULL;
+
+    p2p_arena_blk_t *b = (p2p_arena_blk_t *)p2p_malloc(sizeof(*b) + size);
+    if (!b) return NULL;
+    P_mutex_lock(&a->mtx);
+    arena_link(a, b, size);
+    P_mutex_unlock(&a->mtx);
+    return b + 1;
+}
+
+void *p2p_arena_calloc(p2p_arena_t *a, size_t cnt, size_t size) {
+    if (!a) return p2p_calloc(cnt, size);
+    if (size && cnt > (size_t)-1 / size) return NULL;
+    void *p = p2p_arena_malloc(a, cnt * size);
+    if (p) memset(p, 0, cnt * size);
+    return p;
+}
+
+void *p2p_arena_realloc(p2p_arena_t *a, void *ptr, size_t size) {
+    if (!a) return p2p_realloc(ptr, size);
+    if (!ptr) return p2p_arena_malloc(a, size);
+    if (size > (size_t)-1 - sizeof(p2p_arena_blk_t)) return NULL;
+
+    p2p_arena_blk_t *b = (p2p_arena_blk_t *)ptr - 1;
+    assert(b->magic == ARENA_MAGIC);
+
+    // realloc 可能搬移块头：先从链表摘下，完成后按新地址挂回
+    P_mutex_lock(&a->mtx);
+    arena_unlink(a, b);
+    P_mutex_unlock(&a->mtx);
+
+    p2p_arena_blk_t *nb = (p2p_arena_blk_t *)p2p_realloc(b, sizeof(*b) + size);
+    P_mutex_lock(&a->mtx);
+    if (nb) arena_link(a, nb, size);
+    else arena_link(a, b, b->size);                 // 失败：原块保持不变
+    P_mutex_unlock(&a->mtx);
+    return nb ? (void *)(nb + 1) : NULL;
+}
+
+void p2p_arena_free(p2p_arena_t *a, void *ptr) {
+    if (!a) { p2p_free(ptr); return; }
+    if (!ptr) return;
+
+    p2p_arena_blk_t *b = (p2p_arena_blk_t *)ptr - 1;
+    assert(b->magic == ARENA_MAGIC);
+    b->magic = 0;
+    P_mutex_lock(&a->mtx);
+    arena_unlink(a, b);
+    P_mutex_unlock(&a->mtx);
+    p2p_free(b);
+}
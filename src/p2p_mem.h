@@ -0,0 +1,152 @@
+/*
+ * 内存分配钩子与实例内存区
+ *
+ * 库内全部堆分配经 p2p_malloc / p2p_calloc / p2p_realloc / p2p_free，转发到 p2p_set_allocator
+ * 安装的钩子（默认 libc）。第三方库内部分配（mbedtls / OpenSSL / usrsctp）不经过钩子。
+ *
+ * 实例内存区（cfg.mem_arena）：会话生存期对象（会话结构、候选数组、流缓冲区与附加流、reaching 队列节点、
+ * TCP 打洞上下文、RELAY 发送 chunk 块）从实例内存区分配。每块带一个链入实例的块头，
+ *   + 按块计数与字节数精确统计（p2p_instance_stats_t.mem_*）
+ *   + p2p_destroy 最后整体释放仍挂在内存区上的块，不依赖各模块逐一释放
+ * 这些对象会扩容 / 回收复用，因此不是只增不减的 bump 分配器，单块仍可单独释放。
+ * 未启用时 arena 为 NULL，p2p_arena_* 直接等价于 p2p_malloc 等，无块头开销。
+ *
+ * 固定内存构建（-DP2P_FIXED_MEM，MCU / 嵌入式 Linux）：内存上限在链接时确定，不使用系统堆
+ *   + 默认钩子改为静态块池：按大小分级，每级块数由 P2P_FIXED_POOL_<字节> 设定；请求取能容纳的最小一级，
+ *     该级耗尽时取更大一级，全部耗尽返回 NULL（调用方按分配失败处理）。块从不拆分合并，不会产生碎片
+ *   + 会话候选数组按 P2P_FIXED_CANDS 一次分配、不再扩容，RELAY chunk 与 reliable 缓冲区池的扩容粒度、
+ *     收发环形缓冲区默认容量与 reliable 窗口上限相应缩小（见 P2P_RELAY_CHUNK_BLOCK / RELIABLE_POOL_SLAB / RING_SIZE）
+ *   + p2p_set_allocator 仍可改装其他钩子；p2p_fixed_mem_stats 返回各级用量
+ *
+ * 按组件计量（p2p_memory_stats）：各模块在分配 / 释放处按请求字节数增减所属组件的计数（p2p_mem_add），
+ * 会话计数同时累加到实例，读取只取计数、不遍历会话。与实例内存区无关，未启用 cfg.mem_arena 时同样计量；
+ * 不含块头与第三方库内部分配。会话释放时 p2p_mem_release 从实例扣除会话名下余下的字节
+ * （会话结构与候选数组以此随会话一并扣除，不在各释放处逐一扣减）。
+ */
+
+#ifndef P2P_MEM_H
+#define P2P_MEM_H
+
+#include "predefine.h"
+
+#ifdef P2P_FIXED_MEM
+/* 各级块数（块大小依次为 64B / 256B / 1KB / 4KB / 16KB / 32KB / 64KB，合计约 1.3MB） */
+#ifndef P2P_FIXED_POOL_64
+#define P2P_FIXED_POOL_64       256
+#endif
+#ifndef P2P_FIXED_POOL_256
+#define P2P_FIXED_POOL_256      128
+#endif
+#ifndef P2P_FIXED_POOL_1K
+#define P2P_FIXED_POOL_1K       64
+#endif
+#ifndef P2P_FIXED_POOL_4K
+#define P2P_FIXED_POOL_4K       32
+#endif
+#ifndef P2P_FIXED_POOL_16K
+#define P2P_FIXED_POOL_16K      32
+#endif
+#ifndef P2P_FIXED_POOL_32K
+#define P2P_FIXED_POOL_32K      8                   /* 会话结构 */
+#endif
+#ifndef P2P_FIXED_POOL_64K
+#define P2P_FIXED_POOL_64K      4                   /* 实例结构 */
+#endif
+#define P2P_FIXED_POOL_CLASSES  7
+
+/* 每会话本地 / 远端候选数量上限 */
+#ifndef P2P_FIXED_CANDS
+#define P2P_FIXED_CANDS         16
+#endif
+#endif /* P2P_FIXED_MEM */
+
+/* 计量组件（顺序同 p2p_memory_stats_t） */
+enum {
+    P2P_MEM_SESSION = 0,                    // 会话结构
+    P2P_MEM_STREAM,                         // 流收发环形缓冲区与附加流
+    P2P_MEM_RELIABLE,                       // reliable 槽位数组；实例另含共享缓冲区池 slab
+    P2P_MEM_CANDS,                          // 候选数组
+    P2P_MEM_REACHING,                       // 打洞 reaching 队列节点
+    P2P_MEM_TURN,                           // TURN TCP / TLS 连接上下文（实例级）
+    P2P_MEM_DTLS,                           // DTLS 上下文；实例另含会话恢复缓存
+    P2P_MEM_SIGNAL,                         // 信令缓冲区（实例级）
+    P2P_MEM_NUM
+};
+
+typedef struct p2p_mem_acct {
+    struct p2p_mem_acct*    parent;         // 会话 → 所属实例（实例为 NULL）
+    size_t                  bytes[P2P_MEM_NUM];
+} p2p_mem_acct_t;
+
+extern p2p_allocator_t p2p_allocator;
+
+static inline void *p2p_malloc(size_t size) {
+    return p2p_allocator.malloc_fn(size, p2p_allocator.userdata);
+}
+
+static inline void *p2p_realloc(void *ptr, size_t size) {
+    return p2p_allocator.realloc_fn(ptr, size, p2p_allocator.userdata);
+}
+
+static inline void p2p_free(void *ptr) {
+    if (ptr) p2p_allocator.free_fn(ptr, p2p_allocator.userdata);
+}
+
+static inline void *p2p_calloc(size_t cnt, size_t size) {
+    if (size && cnt > (size_t)-1 / size) return NULL;
+    void *p = p2p_malloc(cnt * size);
+    if (p) memset(p, 0, cnt * size);
+    return p;
+}
+
+/* 组件 comp 增减 delta 字节（m 为 NULL 时不计量；各线程并发更新，原子累加） */
+static inline void p2p_mem_add(p2p_mem_acct_t *m, int comp, int64_t delta) {
+    for (; m; m = m->parent) __atomic_add_fetch(&m->bytes[comp], (size_t)delta, __ATOMIC_RELAXED);
+}
+
+/* 从上级扣除 m 名下余下的全部字节并清零（会话释放时） */
+void p2p_mem_release(p2p_mem_acct_t *m);
+
+///////////////////////////////////////////////////////////////////////////////
+
+typedef struct p2p_arena_blk {
+    struct p2p_arena_blk*   prev;
+    struct p2p_arena_blk*   next;
+    size_t                  size;           // 用户可见字节数
+    size_t                  magic;          // 同时把块头补齐到 4 个指针宽度（用户区保持 malloc 对齐）
+} p2p_arena_blk_t;
+
+typedef struct p2p_arena {
+    P_mutex_t               mtx;            // 会话在应用线程创建、在工作线程扩容 / 释放
+    p2p_arena_blk_t*        head;
+    size_t                  bytes;          // 当前用户区字节数
+    size_t                  peak;
+    uint32_t                blocks;
+} p2p_arena_t;
+
+#ifdef P2P_FIXED_MEM
+/* 静态块池某一级的用量 */
+typedef struct {
+    uint32_t                size;           // 块大小
+    uint32_t                total;          // 块数
+    uint32_t                used;           // 借出中的块数
+    uint32_t                peak;
+    uint32_t                fails;          // 本级耗尽（改取更大一级或失败）的次数
+} p2p_fixed_pool_stat_t;
+
+/* 填充 P2P_FIXED_POOL_CLASSES 项 */
+void p2p_fixed_mem_stats(p2p_fixed_pool_stat_t *out);
+#endif
+
+p2p_arena_t* p2p_arena_create(void);
+
+/* 释放仍挂在内存区上的全部块及内存区本身，返回被整体回收的块数 */
+uint32_t p2p_arena_destroy(p2p_arena_t *a);
+
+/* a 为 NULL 时等价于 p2p_malloc / p2p_calloc / p2p_realloc / p2p_free */
+void* p2p_arena_malloc(p2p_arena_t *a, size_t size);
+void* p2p_arena_calloc(p2p_arena_t *a, size_t cnt, size_t size);
+void* p2p_arena_realloc(p2p_arena_t *a, void *ptr, size_t size);
+void  p2p_arena_free(p2p_arena_t *a, void *ptr);
+
+#endif /* P2P_MEM_H */
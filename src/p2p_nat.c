@@ -11,9 +11,13 @@
 #include "p2p_probe.h"
 
 #define PUNCH_INTERVAL_MS       500         /* 打洞间隔 */
-#define PUNCH_TIMEOUT_MS        5000        /* 打洞超时 */
+#define PUNCH_TIMEOUT_MS        5000        /* 0-RTT 重连探测超时（打洞超时按 RTT 缩放，见 punch_timeout） */
+#define PUNCH_TIMEOUT_RTTS      8           /* 打洞超时：参考 RTT 的倍数 */
+#define PUNCH_RACE_DELAY_MS     300         /* 竞速连接：直连路径先行时间的上限，之后中继开始承载数据 */
+#define PUNCH_RACE_MIN_MS       100         /* 竞速连接：直连路径先行时间的下限 */
+#define PUNCH_RACE_RTTS         4           /* 竞速连接：先行时间为参考 RTT 的倍数 */
 #define CONN_INTERVAL_MS        500         /* CONN 握手间隔 */
-#define CONN_TIMEOUT_MS         3000        /* CONN 握手超时 */
+#define CONN_TIMEOUT_RTTS       6           /* CONN 握手超时：参考 RTT 的倍数 */
 #define PING_INTERVAL_MS        5000        /* 心跳间隔（调整为5秒，适配path_manager 10秒超时）*/
 #define PONG_TIMEOUT_MS         30000       /* 心跳超时 */
 #define REACHING_RELAY_INTERVAL_MS  300     /* reaching 信令中转间隔（0.3秒，避免频繁中转） */
@@ -35,6 +39,12 @@ static int upsert_prflx(struct p2p_session *s, const struct sockaddr_in *from) {
     int idx = p2p_find_remote_candidate_by_addr(s, from);
     if (idx >= 0) return idx;
 
+    // 来源是本实例另一会话的活跃地址：对端经该会话的对端中转（叠加中继），登记为 OVERLAY 候选
+    if (s->inst->cfg.multi_session) {
+        struct p2p_session *via = p2p_session_find_by_addr(s->inst, from);
+        if (via && via != s) return p2p_overlay_cand_add(s, via);
+    }
+
     if (s->inst->cfg.test_ice_prflx_off) {
         print("I:", LA_F("%s: remote %s cand<%s:%d> (disabled)\n", LA_F203, 203),
               TASK_SYNC_REMOTE, "prflx", inet_ntoa(from->sin_addr), ntohs(from->sin_port));
@@ -57,6 +67,8 @@ static int upsert_prflx(struct p2p_session *s, const struct sockaddr_in *from) {
     // 收发分离状态初始化
     c->last_punch_send_ms = 0;
     path_stats_init(&c->stats, 0);
+    c->check = NAT_CHECK_NONE;
+    c->sock = 0;
 
     print("I:", LA_F("%s: remote %s cand[%d]<%s:%d> accepted\n", LA_F205, 205),
           TASK_SYNC_REMOTE, "prflx", idx, inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port));
@@ -64,6 +76,15 @@ static int upsert_prflx(struct p2p_session *s, const struct sockaddr_in *from) {
     return idx;
 }
 
+/*
+ * 本端是否为 controlling 角色（与 DTLS 自动角色一致：peer_id 较小的一端）
+ * + ICE-lite 端始终为 controlled
+ */
+static inline bool nat_is_controlling(const struct p2p_session *s) {
+    return !s->inst->cfg.ice_lite
+        && s->remote_peer_id[0] && strcmp(p2p_session_local_id(s), s->remote_peer_id) < 0;
+}
+
 /*
  * 清理 reaching 队列
  *
@@ -77,66 +98,109 @@ static void clear_reaching_queue(nat_ctx_t *n) {
     while (n->reaching_head) {
         node = n->reaching_head;
         n->reaching_head = node->next;
-        free(node);
+        p2p_mem_add(n->mem, P2P_MEM_REACHING, -(int64_t)sizeof(*node));
+        p2p_arena_free(n->arena, node);
     }
     n->reaching_rear = NULL;
     while(n->reaching_recycle) {
         node = n->reaching_recycle; n->reaching_recycle = node->next;
-        free(node);
+        p2p_mem_add(n->mem, P2P_MEM_REACHING, -(int64_t)sizeof(*node));
+        p2p_arena_free(n->arena, node);
     }
 }
 
 /*
- * 通过候选路径发送数据包
+ * 经指定套接字发送数据包（多会话前缀 + TURN relay / 直连）
  *
- * 自动处理 TURN relay 和直连的区别。
- *
- * @param s           会话对象
- * @param cand_idx    候选索引（必须 >= 0）
- * @param type        包类型
- * @param flags       包标志
- * @param seq         包序列号
- * @param payload     负载数据
- * @param payload_len 负载长度
- * @param now_ms      当前时间（毫秒）
- * @param rt_track    是否需要 RoundTrip 追踪
+ * @param cand_idx    候选索引（仅用于日志，端口预测探测为 -1）
+ * @param sock        发送套接字（见 p2p_remote_candidate_entry.sock）
+ * @param relay       是否经 TURN relay 发送
  */
-static void cand_send_packet(struct p2p_session *s, int cand_idx, uint8_t type, uint16_t seq,
-                             const uint8_t *payload, int payload_len, uint64_t now_ms, bool rt_track) {
+static ret_t sock_send_packet(struct p2p_session *s, int cand_idx, int sock, bool relay,
+                              const struct sockaddr_in *addr, uint8_t type, uint8_t flags, uint16_t seq,
+                              const uint8_t *payload, int payload_len) {
 
-    assert(cand_idx >= 0 && cand_idx < s->remote_cand_cnt);
-    const struct sockaddr_in *addr = &s->remote_cands[cand_idx].addr;
+    /* TCP 候选：连接本身属于本会话，无需 session_id 前缀 */
+    if (cand_idx >= 0 && s->remote_cands[cand_idx].type == P2P_CAND_TCP)
+        return p2p_tcp_send_packet(s, type, flags, seq, payload, payload_len);
+
+    /* 共享内存候选：环本身属于本会话，同样无需前缀 */
+    if (cand_idx >= 0 && s->remote_cands[cand_idx].type == P2P_CAND_SHM)
+        return p2p_shm_send_packet(s, type, flags, seq, payload, payload_len);
 
     /* 多会话模式：在所有 P2P 包前添加 local_id 头部 */
-    uint8_t flags = 0;
     uint8_t ms_buf[P2P_SESS_ID_PSZ + P2P_MAX_PAYLOAD];
     if (s->inst->cfg.multi_session) {
         if (P2P_SESS_ID_PSZ + payload_len > P2P_MAX_PAYLOAD) {
             print("E:", LA_F("%s: cand[%d] payload too large for multi_session (%d)", LA_F123, 123),
                   TASK_NAT, cand_idx, payload_len);
-            return;
+            return E_INVALID;
         }
         nwrite_l(ms_buf, s->id);
         if (payload_len > 0 && payload)
             memcpy(ms_buf + P2P_SESS_ID_PSZ, payload, payload_len);
         payload     = ms_buf;
         payload_len += (int)P2P_SESS_ID_PSZ;
-        flags       = P2P_FLAG_SESSION;
+        flags      |= P2P_FLAG_SESSION;
     }
 
-    ret_t ret;
-    if (s->remote_cands[cand_idx].type == P2P_CAND_RELAY)
-        ret = p2p_turn_send_packet(s->inst, addr, type, flags, seq, payload, payload_len);
-    else ret = p2p_udp_send_packet(s->inst, addr, type, flags, seq, payload, payload_len);
+    if (relay) return p2p_turn_send_packet(s->inst, addr, type, flags, seq, payload, payload_len);
+    return p2p_udp_send_packet_sock(s->inst, sock, addr, type, flags, seq, payload, payload_len);
+}
+
+/*
+ * 通过候选路径发送数据包
+ *
+ * 自动处理 TURN relay 和直连的区别。
+ *
+ * @param s           会话对象
+ * @param cand_idx    候选索引（必须 >= 0）
+ * @param type        包类型
+ * @param flags       包标志
+ * @param seq         包序列号
+ * @param payload     负载数据
+ * @param payload_len 负载长度
+ * @param now_ms      当前时间（毫秒）
+ * @param rt_track    是否需要 RoundTrip 追踪
+ * @return            sock_send_packet 的结果
+ */
+static ret_t cand_send_packet(struct p2p_session *s, int cand_idx, uint8_t type, uint8_t flags, uint16_t seq,
+                             const uint8_t *payload, int payload_len, uint64_t now_ms, bool rt_track) {
+
+    assert(cand_idx >= 0 && cand_idx < s->remote_cand_cnt);
+    const p2p_remote_candidate_entry_t *c = &s->remote_cands[cand_idx];
+    const struct sockaddr_in *addr = &c->addr;
 
+    ret_t ret = sock_send_packet(s, cand_idx, c->sock, c->type == P2P_CAND_RELAY,
+                                 addr, type, flags, seq, payload, payload_len);
     if (ret < 0) {
         print("E:", LA_F("%s: cand[%d]<%s:%d> send packet failed(%d)", LA_F124, 124),
               TASK_NAT, cand_idx, inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), ret);
-        return;
+        return ret;
     }
 
     /* 统计：流量统计 + 可选 RTT 追踪（PUNCH=true，其他控制包=false） */
     path_manager_on_packet_send(s, cand_idx, seq, now_ms, 0, rt_track);
+    return ret;
+}
+
+/*
+ * 构造 REACH 负载：回显 target_addr；PUNCH 携带时间戳时追加 [echo_ts | hold | ts]
+ *
+ * @param recv_us  收到 PUNCH 的时间（P_tick_us），hold = 发送时刻 - recv_us
+ * @return         负载长度
+ */
+static int reach_build(uint8_t *buf, const struct sockaddr_in *target, bool ts, uint32_t echo_ts, uint64_t recv_us) {
+
+    memcpy(buf, &target->sin_addr.s_addr, 4);
+    memcpy(buf + 4, &target->sin_port, 2);
+    if (!ts) return P2P_PKT_REACH_PSZ;
+
+    uint64_t now_us = P_tick_us();
+    nwrite_l(buf + 6, echo_ts);
+    nwrite_l(buf + 10, (uint32_t)(now_us > recv_us ? now_us - recv_us : 0));
+    nwrite_l(buf + 14, (uint32_t)now_us);
+    return P2P_PKT_REACH_TS_PSZ;
 }
 
 /*
@@ -159,20 +223,19 @@ static void flush_reaching_queue(struct p2p_session *s, int writable_path, uint6
         n->reaching_head = node->next;
         if (!n->reaching_head) n->reaching_rear = NULL;
 
-        // 构造 REACH 负载：回显 target_addr
-        uint8_t ack_payload[P2P_PKT_REACH_PSZ];
-        memcpy(ack_payload, &node->target.sin_addr.s_addr, 4);
-        memcpy(ack_payload + 4, &node->target.sin_port, 2);
+        // 构造 REACH 负载：回显 target_addr（+ 时间戳）
+        uint8_t ack_payload[P2P_PKT_REACH_TS_PSZ];
+        int ack_len = reach_build(ack_payload, &node->target, node->ts, node->echo_ts, node->recv_us);
 
         if (writable_path == PATH_IDX_SIGNALING) { assert(s->inst->signaling_relay_fn);
 
-            s->inst->signaling_relay_fn(s, P2P_PKT_REACH, 0, node->seq, ack_payload, sizeof(ack_payload));
+            s->inst->signaling_relay_fn(s, P2P_PKT_REACH, 0, node->seq, ack_payload, ack_len);
 
             print("V:", LA_F("%s: reaching cand[%d] via signaling relay, seq=%u", LA_F192, 192),
                   TASK_NAT, node->cand_idx, node->seq);
         } 
         else {
-            cand_send_packet(s, writable_path, P2P_PKT_REACH, node->seq, ack_payload, P2P_PKT_REACH_PSZ, now_ms, false);
+            cand_send_packet(s, writable_path, P2P_PKT_REACH, 0, node->seq, ack_payload, ack_len, now_ms, false);
 
             const struct sockaddr_in *addr = &s->remote_cands[writable_path].addr;
             print("V:", LA_F("%s: reaching cand[%d] via path[%d] to %s:%d, seq=%u", LA_F191, 191),
@@ -180,11 +243,13 @@ static void flush_reaching_queue(struct p2p_session *s, int writable_path, uint6
                   inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), node->seq);
         }
 
-        free(node);
+        p2p_mem_add(n->mem, P2P_MEM_REACHING, -(int64_t)sizeof(*node));
+        p2p_arena_free(n->arena, node);
     }
     while(n->reaching_recycle) {
         node = n->reaching_recycle; n->reaching_recycle = node->next;
-        free(node);
+        p2p_mem_add(n->mem, P2P_MEM_REACHING, -(int64_t)sizeof(*node));
+        p2p_arena_free(n->arena, node);
     }
 }
 
@@ -195,10 +260,11 @@ static void flush_reaching_queue(struct p2p_session *s, int writable_path, uint6
  *
  * 协议：P2P_PKT_PUNCH (0x01)
  * 包头: [type=0x01 | flags=0 | seq=发送方序列号(2B)]
- * 负载: [target_addr(4B, network order) | target_port(2B, network order)]
+ * 负载: [target_addr(4B, network order) | target_port(2B, network order) | ts(4B)]
  *
  * PUNCH 携带目标地址，接收方在 PUNCH_ACK 中回显。
  * 发送方通过 PUNCH_ACK 确认特定出口路径是 writable。
+ * ts 由新版本对端在 REACH 中回显（RTT 测量）；对端回显过之后 PUNCH 不再入 pending 队列。
  */
 static void nat_send_punch(struct p2p_session *s, const char *reason,
                            struct p2p_remote_candidate_entry *entry, uint64_t now) {
@@ -214,14 +280,22 @@ static void nat_send_punch(struct p2p_session *s, const char *reason,
         entry->stats.state = PATH_STATE_PROBING;
     }
 
-    // 构造负载: [target_addr(4B) | target_port(2B)]
-    uint8_t payload[P2P_PKT_PUNCH_PSZ];
+    // 构造负载: [target_addr(4B) | target_port(2B) | ts(4B)]
+    uint8_t payload[P2P_PKT_PUNCH_TS_PSZ];
+    uint32_t ts = (uint32_t)P_tick_us();
     memcpy(payload, &entry->addr.sin_addr.s_addr, 4);  // network order
     memcpy(payload + 4, &entry->addr.sin_port, 2);     // network order
+    nwrite_l(payload + 6, ts);
+
+    // 积极提名：controlling 端打洞阶段的每个检查都携带提名，对端收到即确认该路径
+    uint8_t flags = 0;
+    if (n->state == NAT_PUNCHING && s->inst->cfg.ice_aggressive && nat_is_controlling(s))
+        flags = P2P_PUNCH_FLAG_NOMINATE;
 
-    // PUNCH 是唯一需要 per-packet RTT 的 NAT 控制包，rt_track=true
-    cand_send_packet(s, send_path, P2P_PKT_PUNCH, n->punch_seq,
-                     payload, sizeof(payload), now, true);
+    // PUNCH 是唯一需要 per-packet RTT 的 NAT 控制包：对端回显时间戳后只计数，否则 rt_track=true 入 pending 队列
+    if (cand_send_packet(s, send_path, P2P_PKT_PUNCH, flags, n->punch_seq,
+                         payload, sizeof(payload), now, !n->ts_echo) >= 0 && n->ts_echo)
+        path_manager_on_echo_send(s, send_path, ts, now);
 
     print("V:", LA_F("%s sent to %s:%d for %s, seq=%d, path=%d", LA_F59, 59),
           PROTO, inet_ntoa(entry->addr.sin_addr), ntohs(entry->addr.sin_port),
@@ -235,7 +309,8 @@ static void nat_send_punch(struct p2p_session *s, const char *reason,
  *
  * 协议：P2P_PKT_CONN (0x03)
  * 包头: [type=0x03 | flags=0 | seq=conn_seq(2B)]
- * 负载: 无
+ * 负载: [session_id(多会话)][caps(1) | window(2) | ack_freq(1) | ack_delay(1) | streams(1)]（reliable 能力通告）
+ *       [len(1) | params(len)]（可选，caps & RELIABLE_CAP_CRYPTO，加密层参数）
  *
  * 在双向连通确认后（rx_confirmed && tx_confirmed）发送，
  * 通知对端可以开始数据传输。
@@ -244,14 +319,14 @@ static void nat_send_conn(struct p2p_session *s, uint64_t now) {
     const char* PROTO = "CONN";
     nat_ctx_t *n = &s->nat;
 
-    /* 多会话模式且非信令中转路径：携带 local_id */
+    /* 多会话模式且非信令中转路径：携带 local_id；尾部附带 reliable 能力通告 */
+    uint8_t buf[P2P_SESS_ID_PSZ + RELIABLE_CAPS_MAX_PSZ];
     if (s->inst->cfg.multi_session && s->path_type != P2P_PATH_SIGNALING) {
-        uint8_t sid_buf[P2P_SESS_ID_PSZ];
-        nwrite_l(sid_buf, s->id);
-        p2p_send_packet(s, &s->active_addr, P2P_PKT_CONN, P2P_FLAG_SESSION, 0,
-                        sid_buf, (int)P2P_SESS_ID_PSZ, now);
+        nwrite_l(buf, s->id);
+        int len = (int)P2P_SESS_ID_PSZ + reliable_write_caps(s, buf + P2P_SESS_ID_PSZ);
+        p2p_send_packet(s, &s->active_addr, P2P_PKT_CONN, P2P_FLAG_SESSION, 0, buf, len, now);
     } else {
-        p2p_send_packet(s, &s->active_addr, P2P_PKT_CONN, 0, 0, NULL, 0, now);
+        p2p_send_packet(s, &s->active_addr, P2P_PKT_CONN, 0, 0, buf, reliable_write_caps(s, buf), now);
     }
 
     if (s->path_type == P2P_PATH_SIGNALING) {
@@ -269,14 +344,14 @@ static void nat_send_conn_ack(struct p2p_session *s, uint64_t now) {
     
     if (instrument_option(P2P_INST_OPT_NAT_CONN_ACK_OFF)) return;
 
-    /* 多会话模式且非信令中转路径：携带 local_id */
+    /* 多会话模式且非信令中转路径：携带 local_id；尾部附带 reliable 能力通告 */
+    uint8_t buf[P2P_SESS_ID_PSZ + RELIABLE_CAPS_MAX_PSZ];
     if (s->inst->cfg.multi_session && s->path_type != P2P_PATH_SIGNALING) {
-        uint8_t sid_buf[P2P_SESS_ID_PSZ];
-        nwrite_l(sid_buf, s->id);
-        p2p_send_packet(s, &s->active_addr, P2P_PKT_CONN_ACK, P2P_FLAG_SESSION, 0,
-                        sid_buf, (int)P2P_SESS_ID_PSZ, now);
+        nwrite_l(buf, s->id);
+        int len = (int)P2P_SESS_ID_PSZ + reliable_write_caps(s, buf + P2P_SESS_ID_PSZ);
+        p2p_send_packet(s, &s->active_addr, P2P_PKT_CONN_ACK, P2P_FLAG_SESSION, 0, buf, len, now);
     } else {
-        p2p_send_packet(s, &s->active_addr, P2P_PKT_CONN_ACK, 0, 0, NULL, 0, now);
+        p2p_send_packet(s, &s->active_addr, P2P_PKT_CONN_ACK, 0, 0, buf, reliable_write_caps(s, buf), now);
     }
 
     if (s->path_type == P2P_PATH_SIGNALING) {
@@ -287,92 +362,1205 @@ static void nat_send_conn_ack(struct p2p_session *s, uint64_t now) {
     }
 }
 
-///////////////////////////////////////////////////////////////////////////////
-
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * 初始化打洞上下文
+ */
+void nat_init(nat_ctx_t *n) {
+    memset(n, 0, sizeof(*n));
+    n->state = NAT_INIT;
+}
+
+void nat_reset(nat_ctx_t *n) {
+
+    // 清空 reaching 队列
+    clear_reaching_queue(n);
+    struct p2p_arena *arena = n->arena;
+    struct p2p_mem_acct *mem = n->mem;
+    nat_init(n);
+    n->arena = arena;
+    n->mem = mem;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * 执行双向确认后的状态转换
+ *
+ * 当 rx_confirmed 和 tx_confirmed 都为 true 时调用此函数，
+ * 执行进入 NAT_CONNECTING 状态的操作。
+ *
+ * 前置条件（由调用方保证）：
+ *   - n->state == NAT_PUNCHING
+ *   - s->rx_confirmed && s->tx_confirmed
+ *
+ * @param s          会话对象
+ * @param path_idx   路径索引（-1=SIGNALING, >=0=候选）
+ * @param now        当前时间戳
+ * @param reason     日志原因（如 "batch relay", "trickle relay", "relay+punch"）
+ */
+static void bidirectional_confirmed(struct p2p_session *s, int cand_path, uint64_t now, const char *reason) {
+    nat_ctx_t *n = &s->nat;
+    
+    // 设置活跃路径（用于 nat_send_conn）
+    p2p_set_active_path(s, cand_path);
+
+    nat_send_conn(s, now);
+
+    // 双向确认完成，进入 CONNECTING 状态
+    n->state = NAT_CONNECTING;
+    n->conn_start_ms = now;
+    p2p_setup_mark(s, P2P_SETUP_REACH, now);
+    
+    print("I:", LA_F("%s: PUNCHING → CONNECTING (%s%s)", LA_F86, 86),
+          TASK_NAT, reason, cand_path == PATH_IDX_SIGNALING ? ", signaling" : "");
+}
+
+/*
+ * 处理 relay 候选
+ *
+ * relay 候选不需要打洞，直接激活路径。首次激活时设置 tx_confirmed 并检查双向确认。
+ *
+ * @param s         会话对象
+ * @param cand_idx  relay 候选索引
+ * @param now       当前时间戳
+ * @param reason    日志原因（如 "batch relay", "trickle relay"）
+ */
+static void relay_confirmed(struct p2p_session *s, int cand_idx, uint64_t now, const char *reason) {
+
+    nat_ctx_t *n = &s->nat;
+    
+    // relay 候选：激活路径
+    path_manager_set_path_state(s, cand_idx, PATH_STATE_ACTIVE);
+    
+    // 首次设置 tx_confirmed（从 false → true）
+    if (!s->tx_confirmed) { s->tx_confirmed = true;
+
+        print("I:", LA_F("%s: path[%d] relay UP", LA_F172, 172), 
+              TASK_PATH, cand_idx);
+        
+        // 首次确认 tx，flush reaching queue
+        flush_reaching_queue(s, cand_idx, now);
+        
+        // 检查双向确认：
+        //   正常场景：批量模式首次启动，rx_confirmed 为 false，不会触发
+        //   特殊场景：对端先启动，本端在 nat_on_punch() 中已设置 rx_confirmed=true，会触发
+        // 
+        // 注意：即使触发了双向确认进入 CONNECTING，也不跳出循环，继续向剩余候选发送 PUNCH
+        // 目的：发现所有可能路径、测量所有 RTT、提供路径冗余
+        if (s->rx_confirmed && n->state == NAT_PUNCHING) {
+            bidirectional_confirmed(s, cand_idx, now, reason);
+        }
+    }
+}
+
+/*
+ * 处理被提名的路径（对端积极提名，或本端为 ICE-lite）
+ *
+ * 对端的检查刚经该路径到达，本端回包沿其 NAT 映射原路返回，因此无需等待本端检查的 REACH，
+ * 直接确认双向并开始 CONN 握手（握手本身仍会重传/超时，路径实际不可写时不会误判连接成功）。
+ * 相比常规流程（对端 PUNCH → 本端 PUNCH → REACH → CONN），本端提前一个 RTT 发出 CONN。
+ *
+ * 前置条件（由调用方保证）：
+ *   - n->state == NAT_PUNCHING
+ *   - 该路径已激活（PATH_STATE_ACTIVE）
+ */
+static void nominate_confirmed(struct p2p_session *s, int cand_idx, uint64_t now) {
+
+    nat_ctx_t *n = &s->nat;
+
+    if (!s->tx_confirmed) { s->tx_confirmed = true;
+
+        print("I:", LA_F("%s: path tx UP (nominated)", LA_F507, 507), TASK_NAT);
+        flush_reaching_queue(s, cand_idx, now);
+    }
+
+    // 对方已进入 CONNECTING：直接回复 CONN_ACK 并进入 CONNECTED
+    if (n->peer_connecting) {
+
+        n->peer_connecting = false;
+        p2p_set_active_path(s, cand_idx);
+        nat_send_conn_ack(s, now);
+
+        n->state = NAT_CONNECTED;
+        n->last_keepalive_send_ms = now;
+        p2p_connected(s, now);
+
+        print("I:", LA_F("%s: PUNCHING → %s (peer CONNECTING)", LA_F84, 84), TASK_NAT, "CONNECTED");
+    }
+    else bidirectional_confirmed(s, cand_idx, now, "nominated");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * 候选类型历史（见 p2p_nat.h nat_hist_t）
+ *
+ * 得分 = 成功率（‰）<< 16 | (0xFFFF - 平均耗时)：成功率相同时打通更快的类型优先；
+ * 无历史的类型取中性值，排在历史上打通过的类型之后、只失败过的类型之前。
+ */
+#define NAT_HIST_WINDOW         32          /* 检查次数达到后次数减半（近期结果占主导） */
+
+ret_t nat_hist_create(struct p2p_instance *inst) {
+
+    nat_hist_t *h = (nat_hist_t *)p2p_calloc(1, sizeof(*h));
+    if (!h) return E_OUT_OF_MEMORY;
+#ifdef P2P_THREADED
+    if (P_mutex_init(&h->mtx) != 0) { p2p_free(h); return E_OUT_OF_MEMORY; }
+#endif
+    inst->nat_hist = h;
+    return E_NONE;
+}
+
+void nat_hist_free(struct p2p_instance *inst) {
+
+    nat_hist_t *h = inst->nat_hist;
+    if (!h) return;
+#ifdef P2P_THREADED
+    P_mutex_final(&h->mtx);
+#endif
+    p2p_free(h);
+    inst->nat_hist = NULL;
+}
+
+/* 分组键：本端首个 srflx 候选的 /24 网段 + NAT 类型 */
+static void hist_key(const struct p2p_session *s, uint32_t *net, int *nat_type) {
+
+    *net = 0;
+    for (int i = 0; i < s->local_cand_cnt; i++) {
+        if (s->local_cands[i].type != P2P_CAND_SRFLX) continue;
+        *net = s->local_cands[i].addr.sin_addr.s_addr & htonl(0xFFFFFF00u);
+        break;
+    }
+    *nat_type = s->inst->nat_type > 0 ? s->inst->nat_type : 0;
+}
+
+static nat_hist_entry_t *hist_find(nat_hist_t *h, uint32_t net, int nat_type) {
+    for (int i = 0; i < NAT_HIST_SLOTS; i++) {
+        if (h->slots[i].stamp && h->slots[i].net == net && h->slots[i].nat_type == nat_type) return &h->slots[i];
+    }
+    return NULL;
+}
+
+/* 取分组槽位：优先已有、其次空闲，否则替换最早更新的 */
+static nat_hist_entry_t *hist_slot(nat_hist_t *h, uint32_t net, int nat_type) {
+
+    nat_hist_entry_t *e = hist_find(h, net, nat_type);
+    if (e) return e;
+
+    e = &h->slots[0];
+    for (int i = 0; i < NAT_HIST_SLOTS && e->stamp; i++) {
+        if (!h->slots[i].stamp || h->slots[i].stamp < e->stamp) e = &h->slots[i];
+    }
+    memset(e, 0, sizeof(*e));
+    e->net = net;
+    e->nat_type = nat_type;
+    return e;
+}
+
+static uint32_t hist_score(const struct p2p_session *s, p2p_cand_type_t type) {
+
+    nat_hist_t *h = s->inst->nat_hist;
+    if (!h || (int)type >= NAT_HIST_TYPES) return NAT_HIST_NEUTRAL;
+
+    uint32_t net; int nat_type;
+    hist_key(s, &net, &nat_type);
+
+    uint32_t score = NAT_HIST_NEUTRAL;
+#ifdef P2P_THREADED
+    P_mutex_lock(&h->mtx);
+#endif
+    const nat_hist_entry_t *e = hist_find(h, net, nat_type);
+    if (e && e->tries[type]) {
+        score = ((uint32_t)e->wins[type] * 1000 / e->tries[type]) << 16;
+        if (e->wins[type]) score |= 0xFFFF - (e->ms[type] < 0xFFFF ? e->ms[type] : 0xFFFF);
+    }
+#ifdef P2P_THREADED
+    P_mutex_unlock(&h->mtx);
+#endif
+    return score;
+}
+
+void nat_hist_record(struct p2p_session *s, bool connected, uint64_t now) {
+
+    nat_ctx_t *n = &s->nat;
+    nat_hist_t *h = s->inst->nat_hist;
+    if (!h || n->hist_done) return;
+
+    // 本轮已发出检查的候选类型；0-RTT 重连、仅有 TCP / 共享内存路径等未经检查表的连接不计入
+    unsigned tried = 0;
+    for (int i = 0; i < s->remote_cand_cnt; i++) {
+        const p2p_remote_candidate_entry_t *c = &s->remote_cands[i];
+        if (c->check >= NAT_CHECK_IN_PROGRESS && (int)c->type < NAT_HIST_TYPES) tried |= 1u << c->type;
+    }
+    int win = connected && s->active_path >= 0 && s->active_path < s->remote_cand_cnt
+            ? (int)s->remote_cands[s->active_path].type : -1;
+    if (win >= NAT_HIST_TYPES) win = -1;
+    else if (win >= 0) tried |= 1u << win;
+    if (!tried) return;
+    n->hist_done = true;
+
+    uint32_t net; int nat_type;
+    hist_key(s, &net, &nat_type);
+    uint32_t ms = (uint32_t)tick_diff(now, n->punch_start);
+    if (!ms) ms = 1;
+
+#ifdef P2P_THREADED
+    P_mutex_lock(&h->mtx);
+#endif
+    nat_hist_entry_t *e = hist_slot(h, net, nat_type);
+    for (int t = 0; t < NAT_HIST_TYPES; t++) {
+        if (!(tried & (1u << t))) continue;
+        if (e->tries[t] >= NAT_HIST_WINDOW) { e->tries[t] /= 2; e->wins[t] /= 2; }
+        e->tries[t]++;
+    }
+    if (win >= 0) {
+        e->wins[win]++;
+        e->ms[win] = e->ms[win] ? (e->ms[win] * 3 + ms) / 4 : ms;
+    }
+    e->stamp = now ? now : 1;
+#ifdef P2P_THREADED
+    P_mutex_unlock(&h->mtx);
+#endif
+
+    struct in_addr a; a.s_addr = net;
+    print("V:", LA_F("%s: cand history net=%s/24 nat=%d tried=0x%x win=%s %u ms", LA_F673, 673), TASK_NAT,
+          inet_ntoa(a), nat_type, tried, win >= 0 ? p2p_candidate_type_str((p2p_cand_type_t)win) : "none", ms);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * 连通性检查调度（RFC 8445 §6.1.4）
+ *
+ * 远端候选即检查表：每个候选与本端组成一个候选对，按候选对优先级排序，
+ * 每个 Ta 节拍最多发出一个 PUNCH，避免候选数量多时瞬间突发大量打洞包。
+ *   - 排序：候选类型历史得分（本网络上打通过的类型优先）> 候选对优先级；
+ *     首拍并行检查历史得分高于中性值的前 NAT_HIST_BURST 个候选对
+ *   - 同一 NAT 之后（双方公网 IP 相同，见 check_same_nat）：host 候选得分置顶，首拍并行检查至多 NAT_SAME_NAT_BURST 个
+ *   - 选择顺序：触发检查 > 最高优先级 WAITING > 最高优先级 FROZEN > 到期重传
+ *   - 同 foundation 的候选对先只检查一个，成功后解冻其余
+ *   - remote_cands[] 的下标即路径索引，不能排序，因此每拍线性扫描
+ */
+#define NAT_CHECK_TA_MS         50          /* 检查节拍 Ta（RFC 8445 §14.2 默认 50ms） */
+
+/* foundation：同一候选类型与 IP（同一 NAT 映射/同一主机）的候选对，检查结果高度相关 */
+static inline bool check_same_foundation(const p2p_remote_candidate_entry_t *a,
+                                         const p2p_remote_candidate_entry_t *b) {
+    return a->type == b->type && a->addr.sin_addr.s_addr == b->addr.sin_addr.s_addr;
+}
+
+/* 候选未携带优先级（COMPACT 信令、PRFLX）时按候选类型补算 */
+static inline uint32_t check_cand_prio(p2p_cand_type_t type, uint32_t priority) {
+    return priority ? priority : p2p_ice_calc_priority((p2p_ice_cand_type_t)type, 65535, 1);
+}
+
+/* 检查顺序：历史得分高者优先，其次候选对优先级 */
+static inline bool check_before(const p2p_remote_candidate_entry_t *a, const p2p_remote_candidate_entry_t *b) {
+    return a->hist != b->hist ? a->hist > b->hist : a->pair_prio > b->pair_prio;
+}
+
+/*
+ * 双方是否位于同一 NAT 之后：本端公网地址（srflx 候选 / COMPACT 服务器观察到的地址）与对端 srflx 候选同 IP
+ * + 多数 NAT 不支持回环（hairpin），srflx 互打常常失败；而双方的 host 地址即使不在同一子网，
+ *   通常也可经内网路由直达，应先于 srflx 检查
+ */
+static bool check_same_nat(const struct p2p_session *s) {
+
+    for (int i = 0; i < s->remote_cand_cnt; i++) {
+
+        const p2p_remote_candidate_entry_t *c = &s->remote_cands[i];
+        if (c->type != P2P_CAND_SRFLX || !c->addr.sin_addr.s_addr) continue;
+
+        if (s->inst->sig_mode == P2P_SIGNALING_MODE_COMPACT
+            && s->inst->sig_ctx.compact.public_addr.sin_addr.s_addr == c->addr.sin_addr.s_addr) return true;
+        for (int j = 0; j < s->local_cand_cnt; j++) {
+            if (s->local_cands[j].type == P2P_CAND_SRFLX
+                && s->local_cands[j].addr.sin_addr.s_addr == c->addr.sin_addr.s_addr) return true;
+        }
+    }
+    return false;
+}
+
+/* 加入检查表：计算候选对优先级与历史得分，并按 foundation 决定初始状态 */
+static void check_add(struct p2p_session *s, int idx) {
+
+    p2p_remote_candidate_entry_t *c = &s->remote_cands[idx];
+
+    // 所有 PUNCH 经同一 socket 发出，本端取最高的本地候选优先级
+    uint32_t local_prio = 0;
+    for (int i = 0; i < s->local_cand_cnt; i++) {
+        if (s->local_cands[i].priority > local_prio) local_prio = s->local_cands[i].priority;
+    }
+    local_prio = check_cand_prio(P2P_CAND_HOST, local_prio);
+
+    c->pair_prio = p2p_ice_calc_pair_priority(local_prio, check_cand_prio(c->type, c->priority),
+                                              nat_is_controlling(s));
+    c->hist = s->nat.same_nat && c->type == P2P_CAND_HOST ? NAT_HIST_SAME_NAT : hist_score(s, c->type);
+
+    c->check = NAT_CHECK_WAITING;
+    for (int i = 0; i < s->remote_cand_cnt; i++) {
+
+        p2p_remote_candidate_entry_t *o = &s->remote_cands[i];
+        if (i == idx || o->check == NAT_CHECK_NONE || !check_same_foundation(c, o)) continue;
+
+        if (o->check == NAT_CHECK_SUCCEEDED) { c->check = NAT_CHECK_WAITING; break; }
+        if (o->check == NAT_CHECK_IN_PROGRESS) c->check = NAT_CHECK_FROZEN;
+        else if (o->check == NAT_CHECK_WAITING && c->check == NAT_CHECK_WAITING) {
+            // 同 foundation 只保留优先级最高的一个 WAITING
+            if (o->pair_prio >= c->pair_prio) c->check = NAT_CHECK_FROZEN;
+            else o->check = NAT_CHECK_FROZEN;
+        }
+    }
+}
+
+/* 同步检查表：新候选入表；路径已可写的候选对标记成功并解冻同 foundation 的候选对 */
+static void check_update(struct p2p_session *s) {
+
+    // 首次发现同一 NAT：已入表的 host 候选一并提到最前
+    if (!s->nat.same_nat && check_same_nat(s)) { s->nat.same_nat = true;
+
+        print("I:", LA_F("%s: peer shares public address, probing host candidates first", LA_F684, 684), TASK_NAT);
+        for (int i = 0; i < s->remote_cand_cnt; i++) {
+            if (s->remote_cands[i].type == P2P_CAND_HOST) s->remote_cands[i].hist = NAT_HIST_SAME_NAT;
+        }
+        s->nat.last_check_ms = 0;               // 下一拍按首拍并行检查
+    }
+
+    for (int i = 0; i < s->remote_cand_cnt; i++) {
+        if (s->remote_cands[i].check == NAT_CHECK_NONE) check_add(s, i);
+    }
+
+    for (int i = 0; i < s->remote_cand_cnt; i++) {
+
+        p2p_remote_candidate_entry_t *c = &s->remote_cands[i];
+        if (c->check == NAT_CHECK_SUCCEEDED || !p2p_remote_candidate_writable(c)) continue;
+
+        c->check = NAT_CHECK_SUCCEEDED;
+        for (int j = 0; j < s->remote_cand_cnt; j++) {
+            p2p_remote_candidate_entry_t *o = &s->remote_cands[j];
+            if (o->check == NAT_CHECK_FROZEN && check_same_foundation(c, o)) o->check = NAT_CHECK_WAITING;
+        }
+    }
+}
+
+/* 选出下一个要检查的候选对，无则返回 -1 */
+static int check_next(struct p2p_session *s, uint64_t now) {
+
+    nat_ctx_t *n = &s->nat;
+
+    int trig = n->check_trigger - 1;
+    n->check_trigger = 0;
+    if (trig >= 0 && trig < s->remote_cand_cnt && s->remote_cands[trig].check <= NAT_CHECK_WAITING)
+        return trig;
+
+    int waiting = -1, frozen = -1, retry = -1;
+    for (int i = 0; i < s->remote_cand_cnt; i++) {
+
+        const p2p_remote_candidate_entry_t *c = &s->remote_cands[i];
+        switch (c->check) {
+            case NAT_CHECK_WAITING:
+                if (waiting < 0 || check_before(c, &s->remote_cands[waiting])) waiting = i;
+                break;
+            case NAT_CHECK_FROZEN:
+                if (frozen < 0 || check_before(c, &s->remote_cands[frozen])) frozen = i;
+                break;
+            default:
+                // 已检查的候选对：到期重传（持续探测用于双向确认和 RTT 测量），最久未发送者优先
+                if (tick_diff(now, c->last_punch_send_ms) >= PUNCH_INTERVAL_MS
+                    && (retry < 0 || c->last_punch_send_ms < s->remote_cands[retry].last_punch_send_ms)) retry = i;
+                break;
+        }
+    }
+
+    if (waiting >= 0) return waiting;
+    // 没有 WAITING 时解冻优先级最高的 FROZEN（RFC 8445 §6.1.4.2），避免同 foundation 候选长期得不到检查
+    if (frozen >= 0) return frozen;
+    if (instrument_option(P2P_INST_OPT_RETRY_OFF)) return -1;
+    return retry;
+}
+
+/*
+ * 按 Ta 节拍调度一次检查
+ *
+ * @return  是否发送了 PUNCH
+ */
+static bool check_schedule(struct p2p_session *s, uint64_t now) {
+
+    nat_ctx_t *n = &s->nat;
+    if (s->inst->cfg.ice_lite) return false;    // ICE-lite 只响应检查
+    if (n->punch_hold) {
+        if (now < n->punch_hold) return false;
+        n->punch_hold = 0;
+        n->punch_start = now;
+    }
+    if (n->last_check_ms && tick_diff(now, n->last_check_ms) < NAT_CHECK_TA_MS) return false;
+
+    check_update(s);
+
+    // 首拍并行检查历史上打通过的候选类型（同一 NAT 之后为全部 host 候选），其后每拍一个
+    int burst = n->last_check_ms ? 1 : n->same_nat ? NAT_SAME_NAT_BURST : NAT_HIST_BURST, sent = 0;
+    while (sent < burst) {
+
+        int idx = check_next(s, now);
+        if (idx < 0) break;
+
+        p2p_remote_candidate_entry_t *c = &s->remote_cands[idx];
+        if (sent && (c->check != NAT_CHECK_WAITING || c->hist <= NAT_HIST_NEUTRAL)) break;
+        if (c->check <= NAT_CHECK_WAITING) c->check = NAT_CHECK_IN_PROGRESS;
+
+        nat_send_punch(s, LA_W("punch", LA_W7, 7), c, now);
+        sent++;
+    }
+    if (!sent) return false;
+
+    n->last_check_ms = now;
+    return true;
+}
+
+/* 重新开始打洞时清空检查表 */
+static void check_reset(struct p2p_session *s) {
+
+    for (int i = 0; i < s->remote_cand_cnt; i++) s->remote_cands[i].check = NAT_CHECK_NONE;
+    s->nat.last_check_ms = 0;
+    s->nat.check_trigger = 0;
+    s->nat.hist_done = false;
+    s->nat.predict = false;
+    s->nat.predict_next = 0;
+    s->nat.last_predict_ms = 0;
+}
+
+/* 下一次检查的到期时间（nat_next_timeout 使用），0 = 无待发检查 */
+static uint64_t check_next_due(const struct p2p_session *s, uint64_t now) {
+
+    const nat_ctx_t *n = &s->nat;
+    if (s->inst->cfg.ice_lite) return 0;
+    uint64_t due = 0;
+    for (int i = 0; i < s->remote_cand_cnt; i++) {
+
+        const p2p_remote_candidate_entry_t *c = &s->remote_cands[i];
+        uint64_t t;
+        if (c->check <= NAT_CHECK_WAITING) t = now;
+        else if (!instrument_option(P2P_INST_OPT_RETRY_OFF)) t = c->last_punch_send_ms + PUNCH_INTERVAL_MS;
+        else continue;
+        if (!due || t < due) due = t;
+    }
+    if (n->check_trigger) due = now;
+    if (!due) return 0;
+
+    if (n->punch_hold && due < n->punch_hold) due = n->punch_hold;
+
+    if (n->last_check_ms && due < n->last_check_ms + NAT_CHECK_TA_MS) due = n->last_check_ms + NAT_CHECK_TA_MS;
+    return due;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * RTT 缩放的打洞 / CONN / 竞速超时
+ *
+ * 参考 RTT：候选路径上已测得的 RTT（REACH / PUNCH 回显）取最小；尚无时取信令服务器 RTT 的 2 倍
+ * （服务器中转的往返不短于双方直连，按两端到服务器的距离相当估算）。
+ * 失败的路径因此在数个 RTT 内放弃，近距离的对端不必等满固定超时才转入信令中转；
+ * 无任何 RTT 样本时取上限（即原固定超时）。
+ *   - 打洞：PUNCH_TIMEOUT_RTTS 个 RTT + 每个候选一个 Ta + 一次 PUNCH 重传间隔，限制在 P2P_TUNE_PUNCH_TIMEOUT_*
+ *   - CONN：CONN_TIMEOUT_RTTS 个 RTT + 一次 CONN 重发间隔，限制在 P2P_TUNE_CONN_TIMEOUT_*
+ *   - 竞速（cfg.path_race）：PUNCH_RACE_RTTS 个 RTT，限制在 [PUNCH_RACE_MIN_MS, PUNCH_RACE_DELAY_MS]
+ */
+static uint32_t nat_ref_rtt(const struct p2p_session *s) {
+
+    uint32_t rtt = UINT32_MAX;
+    for (int i = 0; i < s->remote_cand_cnt; i++) {
+        uint32_t r = get_effective_rtt(&s->remote_cands[i].stats);
+        if (r < rtt) rtt = r;
+    }
+    if (rtt == UINT32_MAX && s->inst->signaling.active) {
+        uint32_t r = get_effective_rtt(&s->inst->signaling.stats);
+        if (r < UINT32_MAX / 2) rtt = r * 2;
+    }
+    return rtt == UINT32_MAX ? 0 : rtt;
+}
+
+/* 参考 RTT 的 rtts 倍 + base，限制在 [lo, hi]（下限优先）；rtt = 0（无样本）取 hi */
+static uint64_t rtt_scaled(uint32_t rtt, uint64_t base, int rtts, int lo, int hi) {
+    uint64_t t = rtt ? (uint64_t)rtt * rtts + base : (uint64_t)hi;
+    if (t > (uint64_t)hi) t = (uint64_t)hi;
+    if (t < (uint64_t)lo) t = (uint64_t)lo;
+    return t;
+}
+
+static uint64_t punch_timeout(const struct p2p_session *s) {
+    return rtt_scaled(nat_ref_rtt(s), (uint64_t)NAT_CHECK_TA_MS * s->remote_cand_cnt + PUNCH_INTERVAL_MS,
+                      PUNCH_TIMEOUT_RTTS, p2p_tune(s, P2P_TUNE_PUNCH_TIMEOUT_MIN_MS),
+                      p2p_tune(s, P2P_TUNE_PUNCH_TIMEOUT_MAX_MS));
+}
+
+static uint64_t conn_timeout(const struct p2p_session *s) {
+    return rtt_scaled(nat_ref_rtt(s), CONN_INTERVAL_MS, CONN_TIMEOUT_RTTS,
+                      p2p_tune(s, P2P_TUNE_CONN_TIMEOUT_MIN_MS), p2p_tune(s, P2P_TUNE_CONN_TIMEOUT_MAX_MS));
+}
+
+static uint64_t race_delay(const struct p2p_session *s) {
+    return rtt_scaled(nat_ref_rtt(s), 0, PUNCH_RACE_RTTS, PUNCH_RACE_MIN_MS, PUNCH_RACE_DELAY_MS);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * 对称 NAT 端口预测
+ *
+ * 本端为对称 NAT（COMPACT NAT_PROBE 检测）时，每个目的地址都会得到新的映射端口，常规检查往往无法打通。
+ * 打洞 NAT_PREDICT_DELAY_MS 后写方向仍未确认，则以对端 srflx 为基准：
+ *   - 以本端观测到的映射增量（探测端口映射 - 主端口映射）为步长，探测 NAT_PREDICT_PORTS 个预测端口
+ *   - 同一组端口再从 NAT_PREDICT_SOCKS 个额外套接字发出（生日策略：每个套接字产生一个新映射，
+ *     提高双方映射相遇的概率）
+ * 探测 seq = NAT_PREDICT_SEQ | j，对端 REACH 回显 seq 与 target，据此将命中的端口登记为 PRFLX 候选，
+ * 并绑定发出该探测的套接字（candidate.sock），此后该路径沿原套接字收发。
+ */
+#define NAT_PREDICT_DELAY_MS    1000        /* 常规检查先行的时间 */
+#define NAT_PREDICT_BURST       8           /* 每个 Ta 节拍的探测数 */
+#define NAT_PREDICT_SEQ         0xF000      /* 探测 seq 标记，低 12 位为探测序号 j */
+#define NAT_PREDICT_TOTAL       ((1 + NAT_PREDICT_SOCKS) * NAT_PREDICT_PORTS)
+
+/* 预测步长：映射增量超出预测范围（随机分配）时按 +1 */
+static int16_t predict_step(const struct p2p_instance *inst) {
+    int d = inst->sig_mode == P2P_SIGNALING_MODE_COMPACT ? inst->sig_ctx.compact.nat_port_delta : 0;
+    return (int16_t)(d && d >= -NAT_PREDICT_PORTS && d <= NAT_PREDICT_PORTS ? d : 1);
+}
+
+/* 探测序号 j 的目标地址：基准端口 + 步长 ×（j % PORTS），发送套接字为 j / PORTS */
+static void predict_addr_of(const nat_ctx_t *n, int j, struct sockaddr_in *to) {
+    *to = n->predict_addr;
+    to->sin_port = htons((uint16_t)(ntohs(n->predict_addr.sin_port) + n->predict_step * (j % NAT_PREDICT_PORTS)));
+}
+
+/* 是否需要端口预测（本端对称 NAT、打洞中且写方向未确认） */
+static inline bool predict_wanted(const struct p2p_session *s) {
+    return !s->inst->cfg.ice_lite && s->inst->nat_type == P2P_NAT_SYMMETRIC
+        && s->nat.state == NAT_PUNCHING && !s->tx_confirmed && !s->nat.punch_hold;
+}
+
+/* 按需打开预测套接字（位于 socks 数组末尾，state = 3 不参与 STUN 收集） */
+static bool predict_open(struct p2p_instance *inst) {
+
+    if (inst->predict_base) return true;
+
+    int base = inst->sock_cnt;
+    for (int k = 0; k < NAT_PREDICT_SOCKS; k++) {
+        if (p2p_udp_open(inst, NULL, 0) != E_NONE) {
+            while (inst->sock_cnt > base) p2p_udp_close(inst, inst->sock_cnt - 1);
+            return false;
+        }
+        inst->socks[inst->sock_cnt - 1].state = 3/*predict*/;
+    }
+    inst->predict_base = base;
+    return true;
+}
+
+void nat_predict_close(struct p2p_instance *inst) {
+
+    if (!inst->predict_base) return;
+    // 由高到低关闭：其后可能还有绑定探测套接字（见 bind_probe_tick）
+    for (int k = NAT_PREDICT_SOCKS - 1; k >= 0; k--) {
+        if (inst->predict_base + k < inst->sock_cnt) p2p_udp_close(inst, inst->predict_base + k);
+    }
+    inst->predict_base = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * NAT 绑定存活期探测（见 p2p_nat.h nat_bind_probe_t、p2pp.h P2P_PKT_BIND_PROBE）
+ *
+ * gap 序列：每个探测会话先以 BIND_GAP_CAL_MS 校验对端支持，之后从 BIND_GAP_MIN_MS 起逐轮翻倍，
+ * 首次失效后在 [ok, fail] 间二分，区间收敛到 BIND_GAP_RES_MS 或 gap 达到 BIND_GAP_MAX_MS 即结束。
+ * ECHO / REPLY 丢包与映射失效无法区分：每轮 ECHO 最多发 BIND_ECHO_TRIES 次，全部无应答才判定失效；
+ * 重发时映射已多空闲了若干秒，成功仍只按 gap 计，结果偏保守。
+ */
+#define BIND_GAP_CAL_MS         500         /* 校验轮：几乎不空闲，必然存活 */
+#define BIND_GAP_MIN_MS         15000
+#define BIND_GAP_MAX_MS         600000      /* 超过 10 分钟即视为足够长 */
+#define BIND_GAP_RES_MS         5000        /* 二分收敛精度 */
+#define BIND_REPLY_WAIT_MS      2000
+#define BIND_ECHO_TRIES         3
+#define KEEPALIVE_MIN_MS        1000
+#define KEEPALIVE_MAX_MS        120000      /* 自适应保活上限，同时限制断线检测时延（见 nat_tick） */
+
+uint32_t nat_keepalive_ms(const struct p2p_session *s) {
+
+    int fixed = p2p_tune(s, P2P_TUNE_KEEPALIVE_MS);
+    if (fixed > 0) return fixed < KEEPALIVE_MIN_MS ? KEEPALIVE_MIN_MS : (uint32_t)fixed;
+
+    uint32_t life = s->inst->bind_probe.lifetime_ms;
+    if (!s->inst->cfg.keepalive_adaptive || !life || s->path_type != P2P_PATH_PUNCH) return PING_INTERVAL_MS;
+
+    uint32_t k = life / 2;
+    return k < KEEPALIVE_MIN_MS ? KEEPALIVE_MIN_MS : k > KEEPALIVE_MAX_MS ? KEEPALIVE_MAX_MS : k;
+}
+
+/* 探测套接字在 socks 中的索引（端口预测套接字的开关会移动索引，按端口查找） */
+static int bind_sock_idx(const struct p2p_instance *inst) {
+    if (!inst->bind_probe.port) return -1;
+    for (int i = inst->sock_cnt - 1; i > 0; i--) {
+        if (inst->socks[i].state == 4/*bind probe*/ && inst->socks[i].local_addr.sin_port == inst->bind_probe.port)
+            return i;
+    }
+    return -1;
+}
+
+void nat_bind_probe_close(struct p2p_instance *inst) {
+
+    nat_bind_probe_t *bp = &inst->bind_probe;
+    int idx = bind_sock_idx(inst);
+    if (idx > 0) p2p_udp_close(inst, idx);
+    bp->port = 0;
+    bp->owner = NULL;
+    bp->phase = 0;
+}
+
+void nat_bind_probe_release(struct p2p_session *s) {
+    // 已测得的 [ok, fail] 区间保留，由下一个直连会话继续
+    if (s->inst->bind_probe.owner == s) nat_bind_probe_close(s->inst);
+}
+
+/* 构造 [session_id(多会话)][op] 负载 */
+static int bind_payload(const struct p2p_session *s, uint8_t op, uint8_t *buf, uint8_t *flags) {
+    int n = 0;
+    *flags = 0;
+    if (s->inst->cfg.multi_session) {
+        nwrite_l(buf, s->id);
+        n = (int)P2P_SESS_ID_PSZ;
+        *flags = P2P_FLAG_SESSION;
+    }
+    buf[n++] = op;
+    return n;
+}
+
+/* 满足探测条件：打洞直连（非端口预测套接字、非 IPv6）的已连接会话 */
+static bool bind_probe_eligible(const struct p2p_session *s) {
+    if (!s->inst->cfg.keepalive_adaptive || s->nat.bind_probe_off) return false;
+    if (s->nat.state != NAT_CONNECTED || s->path_type != P2P_PATH_PUNCH) return false;
+    if (s->active_path < 0 || s->active_path >= s->remote_cand_cnt) return false;
+    const p2p_remote_candidate_entry_t *c = &s->remote_cands[s->active_path];
+    return !c->sock && !p2p_udp_v6_is_alias(&c->addr);
+}
+
+static void bind_send_echo(struct p2p_session *s, uint64_t now) {
+    nat_bind_probe_t *bp = &s->inst->bind_probe;
+    uint8_t buf[P2P_SESS_ID_PSZ + 1], flags;
+    int len = bind_payload(s, P2P_BIND_OP_ECHO, buf, &flags);
+    p2p_udp_send_packet(s->inst, &s->active_addr, P2P_PKT_BIND_PROBE, flags, bp->seq, buf, len);
+    bp->echo_ms = now;
+    bp->tries++;
+}
+
+/* 一轮结束：区间收敛则记录结果并关闭探测套接字，否则下一拍开始新一轮 */
+static void bind_probe_advance(struct p2p_session *s) {
+
+    struct p2p_instance *inst = s->inst;
+    nat_bind_probe_t *bp = &inst->bind_probe;
+
+    bp->phase = 0;
+    if (bp->ok_ms < BIND_GAP_MAX_MS && (!bp->fail_ms || bp->fail_ms - bp->ok_ms > BIND_GAP_RES_MS)) return;
+
+    bp->lifetime_ms = bp->ok_ms;
+    nat_bind_probe_close(inst);
+    print("I:", LA_F("%s: NAT binding lifetime >= %u ms, keepalive interval %u ms", LA_F527, 527),
+          TASK_NAT, bp->lifetime_ms, nat_keepalive_ms(s));
+}
+
+static void bind_probe_tick(struct p2p_session *s, uint64_t now) {
+
+    struct p2p_instance *inst = s->inst;
+    nat_bind_probe_t *bp = &inst->bind_probe;
+
+    if (bp->lifetime_ms || (bp->owner && bp->owner != s)) return;
+    if (!bind_probe_eligible(s)) {
+        if (bp->owner == s) nat_bind_probe_close(inst);         // 路径切换或连接异常：中止本轮
+        return;
+    }
+
+    if (!bp->owner) {
+        // 探测套接字 state = 4：不参与 STUN 收集，也不作为候选
+        if (p2p_udp_open(inst, NULL, 0) != E_NONE) { s->nat.bind_probe_off = true; return; }
+        inst->socks[inst->sock_cnt - 1].state = 4/*bind probe*/;
+        bp->port = inst->socks[inst->sock_cnt - 1].local_addr.sin_port;
+        bp->owner = s;
+        bp->phase = 0;
+        bp->verified = false;
+    }
+
+    switch (bp->phase) {
+
+    case 0: {   // 新一轮：从探测套接字发出 OPEN，建立独立映射
+        if (!bp->verified) bp->gap_ms = BIND_GAP_CAL_MS;
+        else if (!bp->fail_ms) bp->gap_ms = bp->ok_ms < BIND_GAP_MIN_MS ? BIND_GAP_MIN_MS : bp->ok_ms * 2;
+        else bp->gap_ms = (bp->ok_ms + bp->fail_ms) / 2;
+        if (bp->gap_ms > BIND_GAP_MAX_MS) bp->gap_ms = BIND_GAP_MAX_MS;
+        if (++bp->seq == 0) bp->seq = 1;
+
+        uint8_t pkt[P2P_HDR_SIZE + P2P_SESS_ID_PSZ + 1], flags;
+        int len = bind_payload(s, P2P_BIND_OP_OPEN, pkt + P2P_HDR_SIZE, &flags);
+        p2p_pkt_hdr_encode(pkt, P2P_PKT_BIND_PROBE, flags, bp->seq);
+        p2p_udp_send_to_sock(inst, bind_sock_idx(inst), &s->active_addr, pkt, P2P_HDR_SIZE + len);
+
+        bp->open_ms = now;
+        bp->tries = 0;
+        bp->phase = 1;
+        print("V:", LA_F("%s: binding probe #%u, idle gap %u ms", LA_F528, 528), TASK_NAT, bp->seq, bp->gap_ms);
+        break;
+    }
+
+    case 1:     // 空闲 gap 后经主路径请求对端回复
+        if (tick_diff(now, bp->open_ms) >= bp->gap_ms) {
+            bind_send_echo(s, now);
+            bp->phase = 2;
+        }
+        break;
+
+    case 2:
+        if (tick_diff(now, bp->echo_ms) < BIND_REPLY_WAIT_MS) break;
+        if (bp->tries < BIND_ECHO_TRIES) { bind_send_echo(s, now); break; }
+
+        if (!bp->verified) {
+            print("W:", LA_F("%s: peer does not answer binding probe, adaptive keepalive off for this session", LA_F529, 529), TASK_NAT);
+            s->nat.bind_probe_off = true;
+            nat_bind_probe_close(inst);
+            break;
+        }
+        bp->fail_ms = bp->gap_ms;
+        print("V:", LA_F("%s: binding expired within %u ms idle", LA_F530, 530), TASK_NAT, bp->gap_ms);
+        bind_probe_advance(s);
+        break;
+    }
+}
+
+static uint64_t bind_probe_next_due(const struct p2p_session *s) {
+    const nat_bind_probe_t *bp = &s->inst->bind_probe;
+    if (bp->owner != s) return 0;
+    if (bp->phase == 1) return bp->open_ms + bp->gap_ms;
+    if (bp->phase == 2) return bp->echo_ms + BIND_REPLY_WAIT_MS;
+    return 0;
+}
+
+/*
+ * 协议：P2P_PKT_BIND_PROBE (0x10)，见 p2pp.h
+ */
+static void nat_on_bind_probe(struct p2p_session *s, uint16_t seq, const uint8_t *payload, int payload_len,
+                              const struct sockaddr_in *from) {
+
+    if (payload_len < 1) return;
+    nat_ctx_t *n = &s->nat;
+
+    switch (payload[0]) {
+
+    case P2P_BIND_OP_OPEN:
+        n->bind_peer = *from;
+        n->bind_peer_seq = seq;
+        break;
+
+    case P2P_BIND_OP_ECHO:
+        if (seq == n->bind_peer_seq && n->bind_peer.sin_port) {
+            // 沿本端活跃路径的发送套接字回复，使对端 NAT 看到的来源与 OPEN 的目标一致
+            int sock = s->active_path >= 0 && s->active_path < s->remote_cand_cnt ? s->remote_cands[s->active_path].sock : 0;
+            uint8_t buf[P2P_SESS_ID_PSZ + 1], flags;
+            int len = bind_payload(s, P2P_BIND_OP_REPLY, buf, &flags);
+            p2p_udp_send_packet_sock(s->inst, sock, &n->bind_peer, P2P_PKT_BIND_PROBE, flags, seq, buf, len);
+        }
+        break;
+
+    case P2P_BIND_OP_REPLY: {
+        nat_bind_probe_t *bp = &s->inst->bind_probe;
+        if (bp->owner != s || bp->phase != 2 || seq != bp->seq) break;
+
+        if (!bp->verified) bp->verified = true;
+        else if (bp->gap_ms > bp->ok_ms) bp->ok_ms = bp->gap_ms;
+        print("V:", LA_F("%s: binding alive after %u ms idle", LA_F531, 531), TASK_NAT, bp->gap_ms);
+        bind_probe_advance(s);
+        break;
+    }
+    }
+}
+
+/*
+ * 路径 MTU 探测（DPLPMTUD / RFC 8899，cfg.pmtu_discovery，见 p2pp.h P2P_PKT_PMTU_PROBE）
+ *
+ * 每条直连路径独立搜索，结果记在 path_stats_t.pmtu：
+ *   校验轮以 P2P_MTU 确认对端支持 → 直接尝试 P2P_MTU_MAX（LAN / 数据中心路径多数一次确认）→
+ *   失败后在 [pmtu, pmtu_fail) 间二分，区间收敛到 PMTU_SEARCH_RES 内即结束；
+ *   结束 PMTU_RAISE_MS 后重新向上搜索（路由变化后路径 MTU 可能变大）。
+ * 探测包丢失与尺寸超限无法区分：每个尺寸最多发 PMTU_PROBE_TRIES 次，全部无应答才判定超限。
+ * 超过基础负载的 DATA 反复超时（黑洞：路由变化后路径 MTU 变小）时回退到 P2P_MTU，见 nat_pmtu_fallback。
+ */
+#define PMTU_PROBE_WAIT_MS      1000
+#define PMTU_PROBE_TRIES        3
+#define PMTU_SEARCH_RES         16          /* 二分收敛精度（字节） */
+#define PMTU_RAISE_MS           600000      /* RFC 8899 PMTU_RAISE_TIMER */
+#define PMTU_PART_MAX           16          /* DATA 分段数上限（part_map 位宽） */
+
+#if P2P_PMTU_PAYLOAD_MAX > PMTU_PART_MAX * P2P_DATA_PART_SIZE
+#error "P2P_MTU_MAX too large for P2P_DATA_FLAG_PART reassembly"
+#endif
+
+/* 满足探测条件：直连 UDP（非 IPv6、非 TCP 候选）的已连接会话 */
+static bool pmtu_eligible(const struct p2p_session *s) {
+    if (!s->inst->cfg.pmtu_discovery || s->nat.pmtu_off) return false;
+    if (s->nat.state != NAT_CONNECTED || (s->path_type != P2P_PATH_PUNCH && s->path_type != P2P_PATH_LAN)) return false;
+    if (s->active_path < 0 || s->active_path >= s->remote_cand_cnt) return false;
+    const p2p_remote_candidate_entry_t *c = &s->remote_cands[s->active_path];
+    return c->type != P2P_CAND_TCP && !p2p_udp_v6_is_alias(&c->addr);
+}
+
+/* 构造 [session_id(多会话)][op][size] 负载 */
+static int pmtu_payload(const struct p2p_session *s, uint8_t op, uint16_t size, uint8_t *buf, uint8_t *flags) {
+    int n = bind_payload(s, op, buf, flags);
+    nwrite_s(buf + n, size);
+    return n + 2;
+}
+
+static void pmtu_send_probe(struct p2p_session *s, path_stats_t *st, uint64_t now) {
+    uint8_t buf[P2P_PMTU_PAYLOAD_MAX], flags;
+    int n = pmtu_payload(s, P2P_PMTU_OP_PROBE, st->pmtu_probe, buf, &flags);
+    memset(buf + n, 0, st->pmtu_probe - P2P_HDR_SIZE - n);
+    p2p_udp_send_packet_sock(s->inst, s->remote_cands[s->active_path].sock, &s->active_addr,
+                             P2P_PKT_PMTU_PROBE, flags, s->nat.pmtu_seq, buf, st->pmtu_probe - P2P_HDR_SIZE);
+    st->pmtu_ms = now;
+    st->pmtu_tries++;
+}
+
+/* 选择下一个探测尺寸并发出；区间已收敛则结束本轮搜索 */
+static void pmtu_advance(struct p2p_session *s, path_stats_t *st, uint64_t now) {
+    int hi = st->pmtu_fail ? st->pmtu_fail : P2P_MTU_MAX + 1;
+    st->pmtu_probe = 0;
+    st->pmtu_ms = now;
+    if (st->pmtu && hi - st->pmtu <= PMTU_SEARCH_RES) {
+        print("I:", LA_F("%s: path[%d] MTU %u bytes, data payload %d", LA_F594, 594),
+              TASK_NAT, s->active_path, st->pmtu, nat_pmtu_payload(s));
+        return;
+    }
+    st->pmtu_probe = !st->pmtu ? P2P_MTU : st->pmtu_fail ? (uint16_t)((st->pmtu + hi) / 2) : P2P_MTU_MAX;
+    st->pmtu_tries = 0;
+    if (++s->nat.pmtu_seq == 0) s->nat.pmtu_seq = 1;
+    pmtu_send_probe(s, st, now);
+}
+
+static void pmtu_tick(struct p2p_session *s, uint64_t now) {
+
+    if (!pmtu_eligible(s)) return;
+    path_stats_t *st = &s->remote_cands[s->active_path].stats;
+
+    if (!st->pmtu_probe) {
+        // 未探测的新路径立即开始；已收敛的路径到期后重新向上搜索
+        if (!st->pmtu) pmtu_advance(s, st, now);
+        else if (st->pmtu < P2P_MTU_MAX && tick_diff(now, st->pmtu_ms) >= PMTU_RAISE_MS) {
+            st->pmtu_fail = 0;
+            pmtu_advance(s, st, now);
+        }
+        return;
+    }
+
+    if (tick_diff(now, st->pmtu_ms) < PMTU_PROBE_WAIT_MS) return;
+    if (st->pmtu_tries < PMTU_PROBE_TRIES) { pmtu_send_probe(s, st, now); return; }
+
+    if (!st->pmtu) {
+        print("W:", LA_F("%s: peer does not answer PMTU probe, path MTU stays %d", LA_F595, 595), TASK_NAT, P2P_MTU);
+        s->nat.pmtu_off = true;
+        st->pmtu_probe = 0;
+        return;
+    }
+    print("V:", LA_F("%s: path[%d] PMTU probe %u bytes lost", LA_F596, 596), TASK_NAT, s->active_path, st->pmtu_probe);
+    st->pmtu_fail = st->pmtu_probe;
+    pmtu_advance(s, st, now);
+}
+
+static uint64_t pmtu_next_due(const struct p2p_session *s) {
+    if (!pmtu_eligible(s)) return 0;
+    const path_stats_t *st = &s->remote_cands[s->active_path].stats;
+    if (st->pmtu_probe) return st->pmtu_ms + PMTU_PROBE_WAIT_MS;
+    if (!st->pmtu) return 1;                    // 立即开始
+    return st->pmtu < P2P_MTU_MAX ? st->pmtu_ms + PMTU_RAISE_MS : 0;
+}
+
+/*
+ * 协议：P2P_PKT_PMTU_PROBE (0x11)，见 p2pp.h
+ */
+static void nat_on_pmtu_probe(struct p2p_session *s, uint8_t flags, uint16_t seq, const uint8_t *payload, int payload_len,
+                              const struct sockaddr_in *from, uint64_t now) {
+
+    if (payload_len < (int)P2P_PKT_PMTU_PROBE_PSZ) return;
+    uint16_t size = nget_s(payload + 1);
+
+    switch (payload[0]) {
+
+    case P2P_PMTU_OP_PROBE: {
+        // 只回带尺寸，不填充；沿本端活跃路径的发送套接字回复
+        int got = P2P_HDR_SIZE + payload_len + ((flags & P2P_FLAG_SESSION) ? (int)P2P_SESS_ID_PSZ : 0);
+        if (got < size) break;                          // 经中转被截断或伪造
+        int sock = s->active_path >= 0 && s->active_path < s->remote_cand_cnt ? s->remote_cands[s->active_path].sock : 0;
+        uint8_t buf[P2P_SESS_ID_PSZ + P2P_PKT_PMTU_PROBE_PSZ], flags;
+        int len = pmtu_payload(s, P2P_PMTU_OP_ACK, size, buf, &flags);
+        p2p_udp_send_packet_sock(s->inst, sock, from, P2P_PKT_PMTU_PROBE, flags, seq, buf, len);
+        break;
+    }
+
+    case P2P_PMTU_OP_ACK: {
+        if (!pmtu_eligible(s)) break;
+        path_stats_t *st = &s->remote_cands[s->active_path].stats;
+        if (!st->pmtu_probe || seq != s->nat.pmtu_seq || size != st->pmtu_probe) break;
+
+        print("V:", LA_F("%s: path[%d] PMTU probe %u bytes acked", LA_F597, 597), TASK_NAT, s->active_path, size);
+        if (size > st->pmtu) st->pmtu = size;
+        pmtu_advance(s, st, now);
+        break;
+    }
+    }
+}
+
+int nat_pmtu_payload(const struct p2p_session *s) {
+
+    if (s->path_type != P2P_PATH_PUNCH && s->path_type != P2P_PATH_LAN) return P2P_MAX_PAYLOAD;
+    if (s->active_path < 0 || s->active_path >= s->remote_cand_cnt) return P2P_MAX_PAYLOAD;
+    int mtu = s->remote_cands[s->active_path].stats.pmtu;
+    if (mtu <= P2P_MTU) return P2P_MAX_PAYLOAD;
+
+    // 加密：明文包整体封装为 CRYPTO 记录，扣除外层包头、记录开销与多会话前缀；开销未知的后端不提升
+    if (s->dtls) {
+        if (!s->dtls->overhead) return P2P_MAX_PAYLOAD;
+        mtu -= P2P_HDR_SIZE + s->dtls->overhead + (s->inst->cfg.multi_session ? (int)P2P_SESS_ID_PSZ : 0);
+    }
+    return mtu - P2P_HDR_SIZE > P2P_MAX_PAYLOAD ? mtu - P2P_HDR_SIZE : P2P_MAX_PAYLOAD;
+}
+
+void nat_pmtu_fallback(struct p2p_session *s, int path_idx, uint64_t now) {
+
+    if (path_idx == PATH_IDX_NONE) path_idx = s->active_path;
+    if (path_idx < 0 || path_idx >= s->remote_cand_cnt) return;
+    path_stats_t *st = &s->remote_cands[path_idx].stats;
+    if (st->pmtu <= P2P_MTU) return;
+
+    print("W:", LA_F("%s: path[%d] large packets time out, path MTU %u → %d", LA_F598, 598),
+          TASK_NAT, path_idx, st->pmtu, P2P_MTU);
+    st->pmtu_fail = st->pmtu;
+    st->pmtu = P2P_MTU;
+    st->pmtu_probe = 0;
+    st->pmtu_ms = now;                          // PMTU_RAISE_MS 后再向上搜索
+}
+
+void nat_pmtu_release(struct p2p_session *s) {
+    nat_ctx_t *n = &s->nat;
+    if (n->part_buf) reliable_pool_put(p2p_session_pool(s), n->part_buf);
+    n->part_buf = NULL;
+    n->part_map = 0;
+}
+
+/*
+ * DATA 分段重组（P2P_DATA_FLAG_PART，见 p2pp.h）
+ * + 只保留一个重组上下文：分段通常连续到达，其他序列号的分段到达即放弃当前重组（由发送方整包重传）
+ *
+ * @return  收齐后的原负载长度（数据在 n->part_buf），0 = 尚未收齐或分段非法
+ */
+static int data_part_merge(struct p2p_session *s, uint16_t seq, const uint8_t *payload, int payload_len) {
+
+    nat_ctx_t *n = &s->nat;
+    if (payload_len < 3) return 0;
+    int idx = payload[0], cnt = payload[1], chunk = payload_len - 2;
+    if (cnt < 2 || cnt > PMTU_PART_MAX || idx >= cnt || chunk > (int)P2P_DATA_PART_SIZE
+        || (idx < cnt - 1 && chunk != (int)P2P_DATA_PART_SIZE)
+        || idx * (int)P2P_DATA_PART_SIZE + chunk > P2P_PMTU_PAYLOAD_MAX) return 0;
+
+    if (!n->part_buf && !(n->part_buf = reliable_pool_get(p2p_session_pool(s)))) return 0;
+    if (!n->part_map || n->part_seq != seq || n->part_cnt != cnt) {
+        n->part_seq = seq;
+        n->part_cnt = (uint8_t)cnt;
+        n->part_map = 0;
+    }
+    memcpy(n->part_buf + idx * P2P_DATA_PART_SIZE, payload + 2, chunk);
+    n->part_map |= (uint16_t)(1u << idx);
+    if (idx == cnt - 1) n->part_len = idx * (int)P2P_DATA_PART_SIZE + chunk;
+    if (n->part_map != (uint16_t)((1u << cnt) - 1)) return 0;
+
+    n->part_map = 0;
+    return n->part_len;
+}
+
+/*
+ * 按 Ta 节拍发送一批预测探测；一轮探测完成后间隔 PUNCH_INTERVAL_MS 重新开始
+ *
+ * @return  是否发送了探测
+ */
+static bool predict_schedule(struct p2p_session *s, uint64_t now) {
+
+    nat_ctx_t *n = &s->nat;
+    if (!predict_wanted(s) || tick_diff(now, n->punch_start) < NAT_PREDICT_DELAY_MS) return false;
+
+    if (!n->predict) {
+
+        int idx = -1;
+        for (int i = 0; i < s->remote_cand_cnt; i++) {
+            if (s->remote_cands[i].type == P2P_CAND_SRFLX) { idx = i; break; }
+        }
+        if (idx < 0) return false;
+
+        n->predict = true;
+        n->predict_addr = s->remote_cands[idx].addr;
+        n->predict_step = predict_step(s->inst);
+        n->predict_next = 1;                    // j = 0 即 srflx 本身，由常规检查负责
+        n->last_predict_ms = 0;
+
+        if (!predict_open(s->inst)) {
+            print("W:", LA_F("%s: open predict sockets failed, predicting via default socket", LA_F511, 511), TASK_NAT);
+        }
+        print("I:", LA_F("%s: symmetric NAT, predicting ports of %s:%d (step %d)", LA_F512, 512),
+              TASK_NAT, inet_ntoa(n->predict_addr.sin_addr), ntohs(n->predict_addr.sin_port), n->predict_step);
+    }
+
+    if (n->predict_next >= NAT_PREDICT_TOTAL) {
+        if (tick_diff(now, n->last_predict_ms) < PUNCH_INTERVAL_MS) return false;
+        n->predict_next = 1;
+    }
+    else if (n->last_predict_ms && tick_diff(now, n->last_predict_ms) < NAT_CHECK_TA_MS) return false;
+
+    // 预测套接字不可用时只从默认套接字探测
+    int total = s->inst->predict_base ? NAT_PREDICT_TOTAL : NAT_PREDICT_PORTS;
+    for (int b = 0; b < NAT_PREDICT_BURST && n->predict_next < total; b++, n->predict_next++) {
+
+        int j = n->predict_next;
+        struct sockaddr_in to;
+        predict_addr_of(n, j, &to);
+
+        uint8_t payload[P2P_PKT_PUNCH_PSZ];
+        memcpy(payload, &to.sin_addr.s_addr, 4);
+        memcpy(payload + 4, &to.sin_port, 2);
+        sock_send_packet(s, -1, j / NAT_PREDICT_PORTS, false, &to, P2P_PKT_PUNCH, 0,
+                         (uint16_t)(NAT_PREDICT_SEQ | j), payload, sizeof(payload));
+    }
+    if (n->predict_next >= total) n->predict_next = NAT_PREDICT_TOTAL;
+
+    n->last_predict_ms = now;
+    return true;
+}
+
+/* 下一批预测探测的到期时间，0 = 无 */
+static uint64_t predict_next_due(const struct p2p_session *s) {
+
+    const nat_ctx_t *n = &s->nat;
+    if (!predict_wanted(s)) return 0;
+    if (!n->predict) {
+        for (int i = 0; i < s->remote_cand_cnt; i++) {
+            if (s->remote_cands[i].type == P2P_CAND_SRFLX) return n->punch_start + NAT_PREDICT_DELAY_MS;
+        }
+        return 0;
+    }
+    return n->last_predict_ms + (n->predict_next >= NAT_PREDICT_TOTAL ? PUNCH_INTERVAL_MS : NAT_CHECK_TA_MS);
+}
+
 /*
- * 初始化打洞上下文
+ * REACH 回显的 target 不是已知候选时，检查是否命中了预测探测
+ *
+ * @return  新登记的 PRFLX 候选索引，-1 = 不是预测探测
  */
-void nat_init(nat_ctx_t *n) {
-    memset(n, 0, sizeof(*n));
-    n->state = NAT_INIT;
-}
+static int predict_accept(struct p2p_session *s, uint16_t seq, const struct sockaddr_in *target) {
 
-void nat_reset(nat_ctx_t *n) {
+    const nat_ctx_t *n = &s->nat;
+    if (!n->predict || (seq & 0xF000) != NAT_PREDICT_SEQ) return -1;
 
-    // 清空 reaching 队列
-    clear_reaching_queue(n);
-    nat_init(n);
+    int j = seq & 0x0FFF, sock = j / NAT_PREDICT_PORTS;
+    if (j >= NAT_PREDICT_TOTAL || (sock && !s->inst->predict_base)) return -1;
+
+    struct sockaddr_in to;
+    predict_addr_of(n, j, &to);
+    if (!sockaddr_equal(&to, target)) return -1;
+
+    int idx = upsert_prflx(s, target);
+    if (idx < 0) return -1;
+    s->remote_cands[idx].sock = (uint8_t)sock;
+
+    print("I:", LA_F("%s: predicted port hit cand[%d]<%s:%d> via sock %d", LA_F513, 513),
+          TASK_NAT, idx, inet_ntoa(target->sin_addr), ntohs(target->sin_port), sock);
+    return idx;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
 /*
- * 执行双向确认后的状态转换
- *
- * 当 rx_confirmed 和 tx_confirmed 都为 true 时调用此函数，
- * 执行进入 NAT_CONNECTING 状态的操作。
- *
- * 前置条件（由调用方保证）：
- *   - n->state == NAT_PUNCHING
- *   - s->rx_confirmed && s->tx_confirmed
+ * 0-RTT 重连（见 p2p_path_cache.c）
  *
- * @param s          会话对象
- * @param path_idx   路径索引（-1=SIGNALING, >=0=候选）
- * @param now        当前时间戳
- * @param reason     日志原因（如 "batch relay", "trickle relay", "relay+punch"）
+ * nat_resume 后每 NAT_RESUME_INTERVAL_MS 向缓存地址发送 PUNCH，不依赖信令与候选交换；
+ * 对端 REACH 回显该地址时登记为候选并进入 PUNCHING，此后按常规流程完成双向确认和 CONN 握手。
+ * NAT_RESUME_TIMEOUT_MS 内未应答（对端网络已变化）则作废缓存条目，连接继续走信令流程。
  */
-static void bidirectional_confirmed(struct p2p_session *s, int cand_path, uint64_t now, const char *reason) {
+#define NAT_RESUME_INTERVAL_MS  200         /* 缓存路径探测间隔 */
+#define NAT_RESUME_TIMEOUT_MS   PUNCH_TIMEOUT_MS
+
+static void resume_send(struct p2p_session *s, uint64_t now) {
+
     nat_ctx_t *n = &s->nat;
-    
-    // 设置活跃路径（用于 nat_send_conn）
-    p2p_set_active_path(s, cand_path);
+    if (++n->punch_seq == 0) n->punch_seq = 1;
 
-    nat_send_conn(s, now);
+    uint8_t payload[P2P_PKT_PUNCH_PSZ];
+    memcpy(payload, &n->resume_addr.sin_addr.s_addr, 4);
+    memcpy(payload + 4, &n->resume_addr.sin_port, 2);
+    sock_send_packet(s, -1, 0, false, &n->resume_addr, P2P_PKT_PUNCH, 0, n->punch_seq, payload, sizeof(payload));
+    n->last_resume_ms = now;
+}
 
-    // 双向确认完成，进入 CONNECTING 状态
-    n->state = NAT_CONNECTING;
-    n->conn_start_ms = now;
-    
-    print("I:", LA_F("%s: PUNCHING → CONNECTING (%s%s)", LA_F86, 86),
-          TASK_NAT, reason, cand_path == PATH_IDX_SIGNALING ? ", signaling" : "");
+void nat_resume(struct p2p_session *s, const struct sockaddr_in *addr, int cand_type) {
+
+    nat_ctx_t *n = &s->nat;
+    uint64_t now = p2p_now_ms();
+
+    n->resume = true;
+    n->resume_addr = *addr;
+    n->resume_type = (uint8_t)cand_type;
+    n->resume_start = now;
+
+    print("I:", LA_F("%s: resume cached path %s:%d (%s)", LA_F515, 515), TASK_NAT,
+          inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), p2p_candidate_type_str((p2p_cand_type_t)cand_type));
+
+    resume_send(s, now);
+    p2p_session_wake(s);
 }
 
-/*
- * 处理 relay 候选
- *
- * relay 候选不需要打洞，直接激活路径。首次激活时设置 tx_confirmed 并检查双向确认。
- *
- * @param s         会话对象
- * @param cand_idx  relay 候选索引
- * @param now       当前时间戳
- * @param reason    日志原因（如 "batch relay", "trickle relay"）
- */
-static void relay_confirmed(struct p2p_session *s, int cand_idx, uint64_t now, const char *reason) {
+static void resume_tick(struct p2p_session *s, uint64_t now) {
 
     nat_ctx_t *n = &s->nat;
-    
-    // relay 候选：激活路径
-    path_manager_set_path_state(s, cand_idx, PATH_STATE_ACTIVE);
-    
-    // 首次设置 tx_confirmed（从 false → true）
-    if (!s->tx_confirmed) { s->tx_confirmed = true;
 
-        print("I:", LA_F("%s: path[%d] relay UP", LA_F172, 172), 
-              TASK_PATH, cand_idx);
-        
-        // 首次确认 tx，flush reaching queue
-        flush_reaching_queue(s, cand_idx, now);
-        
-        // 检查双向确认：
-        //   正常场景：批量模式首次启动，rx_confirmed 为 false，不会触发
-        //   特殊场景：对端先启动，本端在 nat_on_punch() 中已设置 rx_confirmed=true，会触发
-        // 
-        // 注意：即使触发了双向确认进入 CONNECTING，也不跳出循环，继续向剩余候选发送 PUNCH
-        // 目的：发现所有可能路径、测量所有 RTT、提供路径冗余
-        if (s->rx_confirmed && n->state == NAT_PUNCHING) {
-            bidirectional_confirmed(s, cand_idx, now, reason);
-        }
+    // 已经由其他路径连通，或打洞已失败：停止探测（缓存条目在下次连通时更新）
+    if (n->state >= NAT_CONNECTING || n->state == NAT_CLOSED) { n->resume = false; return; }
+
+    if (tick_diff(now, n->resume_start) >= NAT_RESUME_TIMEOUT_MS) {
+        n->resume = false;
+        print("W:", LA_F("%s: cached path %s:%d unreachable, dropped", LA_F516, 516), TASK_NAT,
+              inet_ntoa(n->resume_addr.sin_addr), ntohs(n->resume_addr.sin_port));
+        p2p_path_cache_drop(s->inst, s->remote_peer_id);
+        return;
+    }
+
+    if (tick_diff(now, n->last_resume_ms) >= NAT_RESUME_INTERVAL_MS) resume_send(s, now);
+}
+
+/* REACH 回显了缓存地址：登记候选，尚未打洞时进入 PUNCHING（后续由 nat_on_reach 完成双向确认） */
+static void resume_accept(struct p2p_session *s, uint64_t now) {
+
+    nat_ctx_t *n = &s->nat;
+    n->resume = false;
+
+    int idx = p2p_find_remote_candidate_by_addr(s, &n->resume_addr);
+    if (idx < 0 && (idx = upsert_prflx(s, &n->resume_addr)) >= 0)
+        s->remote_cands[idx].type = n->resume_type;
+
+    if (n->state < NAT_PUNCHING) {
+        n->state = NAT_PUNCHING;
+        n->punch_start = now;
+        p2p_connecting(s);
+        s->tx_confirmed = false;
+        check_reset(s);
     }
+
+    print("I:", LA_F("%s: cached path %s:%d confirmed (%llu ms)", LA_F519, 519), TASK_NAT,
+          inet_ntoa(n->resume_addr.sin_addr), ntohs(n->resume_addr.sin_port),
+          (unsigned long long)tick_diff(now, n->resume_start));
 }
 
 /*
@@ -390,11 +1578,17 @@ static void relay_confirmed(struct p2p_session *s, int cand_idx, uint64_t now, c
  *   - nat_punch(s, -1)      批量启动所有 remote_cands 的打洞
  *   - nat_punch(s, idx)     向单个候选追加打洞（Trickle ICE）
  */
+void nat_probe(struct p2p_session *s, int idx, uint64_t now_ms) {
+    if (idx < 0 || idx >= s->remote_cand_cnt) return;
+    nat_send_punch(s, LA_W("prewarm", LA_W534, 534), &s->remote_cands[idx], now_ms);
+}
+
 ret_t nat_punch(struct p2p_session *s, int idx) {
 
     P_check(s != NULL, return E_INVALID;)
     
     nat_ctx_t *n = &s->nat;
+    p2p_session_wake(s);    // 打洞定时由会话 tick 驱动
 
     /* ========== 首次批量或重新启动模式：idx == -1 ========== */
 
@@ -407,7 +1601,7 @@ ret_t nat_punch(struct p2p_session *s, int idx) {
         }
         
         n->state = NAT_PUNCHING;
-        n->punch_start = P_tick_ms();
+        n->punch_start = p2p_now_ms();
         p2p_connecting(s);  // 首次进入打洞状态，递增 connections 并启动 STUN 收集
         
         // 这里只重置 tx_confirmed，保留 rx_confirmed 原值（需要考虑对端先启动打洞的场景）
@@ -419,23 +1613,24 @@ ret_t nat_punch(struct p2p_session *s, int idx) {
 
         print("I:", LA_F("%s: batch punch start (%d cands)", LA_F121, 121), TASK_NAT, s->remote_cand_cnt);
 
-        // 遍历所有候选：relay 直接激活路径，所有候选都发送 PUNCH 包（用于双向确认和 RTT 测量）
+        // 遍历所有候选：relay 直接激活路径；所有候选（包括 relay）都进入检查表，按优先级逐个发送 PUNCH
+        // + 一个情况是，如果双方都只有 relay 候选，则需要一个 PUNCH 包开启双向确认，此外也可用于 RTT 测量
+        check_reset(s);
         for (int i = 0; i < s->remote_cand_cnt; i++) {
 
             print("V:", LA_F("%s: punch cand[%d] %s:%d (%s)", LA_F184, 184), TASK_NAT, i,
                   inet_ntoa(s->remote_cands[i].addr.sin_addr), ntohs(s->remote_cands[i].addr.sin_port),
                   p2p_candidate_type_str((p2p_cand_type_t)s->remote_cands[i].type));
 
-            // relay 候选：直接激活路径（不需要打洞），但也发 PUNCH 
-            // + 一个情况是，如果双方都只有 relay 候选，则需要一个 PUNCH 包开启双向确认，此外也可用于 RTT 测量
-            if (s->remote_cands[i].type == P2P_CAND_RELAY) {
+            // relay / TCP / 共享内存候选：直接激活路径（不需要打洞，TCP 连接建立或双方映射即已双向连通）
+            if (s->remote_cands[i].type == P2P_CAND_RELAY || s->remote_cands[i].type == P2P_CAND_TCP
+                || s->remote_cands[i].type == P2P_CAND_SHM) {
                 relay_confirmed(s, i, n->punch_start, "batch relay");
             }
-            
-            // 所有候选（包括 relay）都发送 PUNCH 包
-            nat_send_punch(s, LA_W("punch", LA_W7, 7), &s->remote_cands[i], n->punch_start);
         }
-        
+
+        // 立即发出最高优先级的检查，其余由 nat_tick 按 Ta 节拍调度
+        check_schedule(s, n->punch_start);
         return E_NONE;
     }
     
@@ -446,7 +1641,7 @@ ret_t nat_punch(struct p2p_session *s, int idx) {
         return E_OUT_OF_RANGE;
     }
 
-    uint64_t now = P_tick_ms();
+    uint64_t now = p2p_now_ms();
     p2p_remote_candidate_entry_t *entry = &s->remote_cands[idx];
 
     // 首次或重新启动时初始化状态（INIT/CLOSED）
@@ -457,6 +1652,7 @@ ret_t nat_punch(struct p2p_session *s, int idx) {
 
         // 只重置 tx_confirmed，保留 rx_confirmed 原值（需要考虑对端先启动打洞的场景）
         s->tx_confirmed = false;
+        check_reset(s);
 
         print("I:", LA_F("%s: trickle punch start", LA_F244, 244), TASK_NAT);
     }
@@ -469,13 +1665,28 @@ ret_t nat_punch(struct p2p_session *s, int idx) {
     if (entry->type == P2P_CAND_RELAY) {
         relay_confirmed(s, idx, now, "trickle relay");
     }
+    else if (entry->type == P2P_CAND_TCP) {
+        relay_confirmed(s, idx, now, "tcp");
+    }
+    else if (entry->type == P2P_CAND_SHM) {
+        relay_confirmed(s, idx, now, "shm");
+    }
     
-    // 所有候选（包括 relay）都发送 PUNCH 包（用于双向确认和 RTT 测量）
-    nat_send_punch(s, LA_W("punch", LA_W7, 7), entry, now);
+    // 所有候选（包括 relay）都进入检查表（用于双向确认和 RTT 测量），按 Ta 节拍发送 PUNCH
+    check_schedule(s, now);
 
     return E_NONE;
 }
 
+void nat_punch_hold(struct p2p_session *s, uint64_t until) {
+
+    nat_ctx_t *n = &s->nat;
+    if (n->state > NAT_PUNCHING || (n->state == NAT_PUNCHING && !n->punch_hold)) return;    // 已起跑
+
+    n->punch_hold = until ? until : 1;
+    if (n->state == NAT_PUNCHING) p2p_session_wake(s);   // 起跑时刻由会话 tick 驱动
+}
+
 /*
  * 发送 FIN 包通知对端主动断开连接
  *
@@ -494,15 +1705,15 @@ void nat_send_fin(struct p2p_session *s) {
     if (s->active_path < 0) return;
     assert(s->path_type != P2P_PATH_SIGNALING);
 
-    uint64_t now = P_tick_ms();
-    cand_send_packet(s, s->active_path, P2P_PKT_FIN, 0, NULL, 0, now, false);
+    uint64_t now = p2p_now_ms();
+    cand_send_packet(s, s->active_path, P2P_PKT_FIN, 0, 0, NULL, 0, now, false);
 
     print("V:", LA_F("%s sent to %s:%d", LA_F57, 57),
           PROTO, inet_ntoa(s->active_addr.sin_addr), ntohs(s->active_addr.sin_port));
 
     for (int i = 2; i--;) {
         P_usleep(50 * 1000); // 50ms 间隔重发
-        cand_send_packet(s, s->active_path, P2P_PKT_FIN, 0, NULL, 0, now, false);
+        cand_send_packet(s, s->active_path, P2P_PKT_FIN, 0, 0, NULL, 0, now, false);
     }
 }
 
@@ -516,11 +1727,15 @@ void nat_send_fin(struct p2p_session *s) {
  *
  * 注意：ICE connectivity check 要求有效路径必须是可双向通讯的
  */
-void nat_on_stun_packet(struct p2p_session *s, uint16_t msg_type, const uint8_t *buf, int len, 
-                       const struct sockaddr_in *from, uint64_t now) {
+void nat_on_stun_packet(struct p2p_session *s, uint16_t msg_type, const uint8_t *buf, int len,
+                       const struct p2p_stun_attrs *attrs, const struct sockaddr_in *from, uint64_t now) {
+
+    p2p_stun_attrs_t local;
+    if (!attrs) { p2p_stun_attrs_parse(buf, len, &local); attrs = &local; }
 
     // 前提是包含 ICE 属性
-    assert(p2p_stun_has_ice_attrs(buf, len));
+    assert(attrs->intact && attrs->ice);
+    p2p_session_wake(s);
 
     // 获取候选路径，或添加为 peer-reflexive 候选（ICE 标准支持自动添加）
     int path_idx = upsert_prflx(s, from);
@@ -554,10 +1769,30 @@ void nat_on_stun_packet(struct p2p_session *s, uint16_t msg_type, const uint8_t
         path_manager_on_packet_recv(s, path_idx, now, len, false, 0);
 
         // 标记 peer→me 方向 打通
-        if (s->rx_confirmed) return;
-        s->rx_confirmed = true;
-        print("I:", LA_F("%s: path rx UP (%s:%d)", LA_F167, 167),
-              TASK_NAT, inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+        if (!s->rx_confirmed) { s->rx_confirmed = true;
+
+            print("I:", LA_F("%s: path rx UP (%s:%d)", LA_F167, 167),
+                  TASK_NAT, inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+        }
+
+        // 提名（RFC 8445 §7.3.1.5）：controlling 端携带 USE-CANDIDATE，或本端为 ICE-lite
+        // + 已原路回复 Binding Response，ICE 模式没有 CONN 握手，该路径直接作为活跃路径
+        if (n->state != NAT_PUNCHING || path_idx < 0 || !s->inst->cfg.use_ice) return;
+        if (!s->inst->cfg.ice_lite && !attrs->off[STUN_AI_USE_CANDIDATE]) return;
+
+        path_manager_set_path_state(s, path_idx, PATH_STATE_ACTIVE);
+        print("I:", LA_F("%s: path[%d] UP (nominated, %s:%d)", LA_F508, 508),
+              TASK_PATH, path_idx, inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+
+        s->tx_confirmed = true;
+        flush_reaching_queue(s, path_idx, now);
+        p2p_set_active_path(s, path_idx);
+
+        n->state = NAT_CONNECTED;
+        n->last_keepalive_send_ms = now;
+        p2p_connected(s, now);
+
+        print("I:", LA_F("%s: PUNCHING → %s (nominated)", LA_F509, 509), TASK_NAT, "CONNECTED");
     }
     // Binding Response（对端回复我们的 connectivity check）
     else if (msg_type == 0x0101) {
@@ -627,8 +1862,9 @@ void nat_on_stun_packet(struct p2p_session *s, uint16_t msg_type, const uint8_t
  * 处理 PUNCH 包
  *
  * 协议：P2P_PKT_PUNCH (0x01)
- * 负载: [target_addr(4B) | target_port(2B)]
+ * 负载: [target_addr(4B) | target_port(2B) | ts(4B, 可选)]
  *   target_addr 是发送方发送 PUNCH 的目标地址，接收方在 PUNCH_ACK 中回显。
+ *   携带 ts 时 REACH 追加 [echo_ts | hold | ts]（见 reach_build）。
  *
  * 流程:
  *   1. 标记 peer→me 方向打通，即 rx_confirmed（能收到说明路径入方向通）
@@ -639,7 +1875,7 @@ void nat_on_stun_packet(struct p2p_session *s, uint16_t msg_type, const uint8_t
  *      此时设置 rx_confirmed=true，等待本端调用 nat_punch() 启动时保留此状态
  *
  */
-static void nat_on_punch(struct p2p_session *s, uint16_t seq,
+static void nat_on_punch(struct p2p_session *s, uint8_t flags, uint16_t seq,
                   const uint8_t *payload, int payload_len,
                   const struct sockaddr_in *from, uint64_t now) {
     const char* PROTO = "PUNCH";
@@ -673,19 +1909,39 @@ static void nat_on_punch(struct p2p_session *s, uint16_t seq,
     print("V:", LA_F("%s: accepted as cand[%d], target=%s:%d", LA_F104, 104),
           PROTO, cand_idx, inet_ntoa(target_addr.sin_addr), ntohs(target_addr.sin_port));
 
+    // 对端已起跑：不再等待约定时刻，立即应答并开始检查
+    if (n->punch_hold) { n->punch_hold = 0; n->punch_start = now; }
+
+    // 触发检查（RFC 8445 §7.3.1.4）：对端已向此地址打洞，该候选对尚未检查时下一拍优先检查
+    if (n->state == NAT_PUNCHING && s->remote_cands[cand_idx].check <= NAT_CHECK_WAITING)
+        n->check_trigger = cand_idx + 1;
+
+    // 提名（USE-CANDIDATE）：对端积极提名该路径，或本端为 ICE-lite（首个到达的检查即为提名）
+    // + 先激活路径，使下面的 REACH 原路返回
+    bool nominated = n->state == NAT_PUNCHING
+                  && ((flags & P2P_PUNCH_FLAG_NOMINATE) || s->inst->cfg.ice_lite);
+    if (nominated && !path_is_selectable(s->remote_cands[cand_idx].stats.state)) {
+
+        path_manager_set_path_state(s, cand_idx, PATH_STATE_ACTIVE);
+        print("I:", LA_F("%s: path[%d] UP (nominated, %s:%d)", LA_F508, 508),
+              TASK_PATH, cand_idx, inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+    }
+
     // ---------- 发送 REACH（收发分离策略） ----------
     {   const char* PROTO2 = "REACH";
 
-        // 构造 REACH 负载：回显 target_addr
-        uint8_t ack_payload[P2P_PKT_REACH_PSZ];
-        memcpy(ack_payload, &target_addr.sin_addr.s_addr, 4);
-        memcpy(ack_payload + 4, &target_addr.sin_port, 2);
+        // 构造 REACH 负载：回显 target_addr（+ 时间戳）
+        bool has_ts = payload_len >= (int)P2P_PKT_PUNCH_TS_PSZ;
+        uint32_t echo_ts = has_ts ? nget_l(payload + 6) : 0;
+        uint64_t recv_us = p2p_rx_time_us(s);
+        uint8_t ack_payload[P2P_PKT_REACH_TS_PSZ];
+        int ack_len = reach_build(ack_payload, &target_addr, has_ts, echo_ts, recv_us);
 
         // 来源路径已激活，直接原路回复
         if (!instrument_option(P2P_INST_OPT_NAT_REACH_BACKWARD_OFF)
             && path_is_selectable(s->remote_cands[cand_idx].stats.state)) {
 
-            cand_send_packet(s, cand_idx, P2P_PKT_REACH, seq, ack_payload, P2P_PKT_REACH_PSZ, now, false);
+            cand_send_packet(s, cand_idx, P2P_PKT_REACH, 0, seq, ack_payload, ack_len, now, false);
             print("V:", LA_F("%s sent to %s:%d (writable), echo_seq=%u", LA_F58, 58),
                   PROTO2, inet_ntoa(from->sin_addr), ntohs(from->sin_port), seq);
         }
@@ -697,7 +1953,7 @@ static void nat_on_punch(struct p2p_session *s, uint16_t seq,
                 && (!instrument_option(P2P_INST_OPT_NAT_REACH_BACKWARD_OFF) || best_path != cand_idx)
                 && best_path >= 0 && path_is_selectable(s->remote_cands[best_path].stats.state)) {
 
-                cand_send_packet(s, best_path, P2P_PKT_REACH, seq, ack_payload, P2P_PKT_REACH_PSZ, now, false);
+                cand_send_packet(s, best_path, P2P_PKT_REACH, 0, seq, ack_payload, ack_len, now, false);
                 print("V:", LA_F("%s sent via best path[%d] to %s:%d, echo_seq=%u", LA_F60, 60),
                       PROTO2, best_path,
                       inet_ntoa(s->remote_cands[best_path].addr.sin_addr),
@@ -708,7 +1964,7 @@ static void nat_on_punch(struct p2p_session *s, uint16_t seq,
 
                 // 尝试原路发送
                 if (!instrument_option(P2P_INST_OPT_NAT_REACH_BACKWARD_OFF)) {
-                    cand_send_packet(s, cand_idx, P2P_PKT_REACH, seq, ack_payload, P2P_PKT_REACH_PSZ, now, false);
+                    cand_send_packet(s, cand_idx, P2P_PKT_REACH, 0, seq, ack_payload, ack_len, now, false);
                     print("V:", LA_F("%s_ACK sent to %s:%d (try), echo_seq=%u", LA_F256, 256),
                           PROTO, inet_ntoa(from->sin_addr), ntohs(from->sin_port), seq);
                 }
@@ -731,16 +1987,20 @@ static void nat_on_punch(struct p2p_session *s, uint16_t seq,
                     if (!existing) {
                         punch_reaching_t *node = n->reaching_recycle;
                         if (node) n->reaching_recycle = node->next;
-                        else { node = (punch_reaching_t *)malloc(sizeof(punch_reaching_t));
+                        else { node = (punch_reaching_t *)p2p_arena_malloc(n->arena, sizeof(punch_reaching_t));
                             if (!node) {
                                 print("E:", LA_F("%s: reaching alloc OOM", LA_F189, 189), TASK_NAT);
                                 return;
                             }
+                            p2p_mem_add(n->mem, P2P_MEM_REACHING, sizeof(punch_reaching_t));
                         }
                         
                         node->seq = seq;
                         node->target = target_addr;
                         node->cand_idx = cand_idx;
+                        node->ts = has_ts;
+                        node->echo_ts = echo_ts;
+                        node->recv_us = recv_us;
                         node->next = NULL;
                         
                         // 获取当前候选的优先级
@@ -779,6 +2039,9 @@ static void nat_on_punch(struct p2p_session *s, uint16_t seq,
                                 TASK_NAT, cand_idx, existing->seq, seq);
 
                         existing->seq = seq;
+                        existing->ts = has_ts;
+                        existing->echo_ts = echo_ts;
+                        existing->recv_us = recv_us;
                     }
 
                 } // if (!instrument_option(P2P_INST_OPT_NAT_REACH_FORWARD_OFF))
@@ -790,14 +2053,18 @@ static void nat_on_punch(struct p2p_session *s, uint16_t seq,
     path_manager_on_packet_recv(s, cand_idx, now, 0, false, 0);
 
     // 标记 peer→me 方向 打通
-    if (s->rx_confirmed) return;
-    s->rx_confirmed = true;
-    print("I:", LA_F("%s: path rx UP (%s:%d)", LA_F167, 167),
-            TASK_NAT, inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+    if (!s->rx_confirmed) { s->rx_confirmed = true;
+
+        print("I:", LA_F("%s: path rx UP (%s:%d)", LA_F167, 167),
+              TASK_NAT, inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+    }
+    else if (!nominated) return;
+
+    if (nominated) nominate_confirmed(s, cand_idx, now);
 
     // 检查双向确认：
     // + relay 候选会导致 tx_confirmed=true；但肯定还未收到 REACH，因为任何入方式的包都会导致 rx_confirmed=true
-    if (s->tx_confirmed && n->state == NAT_PUNCHING) {
+    else if (s->tx_confirmed && n->state == NAT_PUNCHING) {
         bidirectional_confirmed(s, cand_idx, now, "relay + on punch");
     }
 }
@@ -808,9 +2075,10 @@ static void nat_on_punch(struct p2p_session *s, uint16_t seq,
  * 收到 REACH 证明 me→peer 方向联通，且 seq 用于精确 RTT 测量。
  *
  * 协议：P2P_PKT_REACH (0x02)
- * 负载: [target_addr(4B) | target_port(2B)]
+ * 负载: [target_addr(4B) | target_port(2B) | echo_ts(4B) | hold(4B) | ts(4B)]
  *   target_addr 是我方发送 PUNCH 时携带的目标地址，被对方回显。
  *   通过匹配 target_addr 可以确认特定出口路径是 writable。
+ *   后三个字段仅新版本对端携带：有则按回显时间戳测 RTT，否则按 seq 匹配 pending 队列。
  */
 static void nat_on_reach(struct p2p_session *s, uint16_t seq,
                          const uint8_t *payload, int payload_len,
@@ -854,7 +2122,10 @@ static void nat_on_reach(struct p2p_session *s, uint16_t seq,
     memcpy(&target_addr.sin_port, payload + 4, 2);
 
     // 查找匹配 target_addr 的 candidate
+    if (n->resume && sockaddr_equal(&target_addr, &n->resume_addr)) resume_accept(s, now);
+
     int target_path = p2p_find_remote_candidate_by_addr(s, &target_addr);
+    if (target_path < 0) target_path = predict_accept(s, seq, &target_addr);
     if (target_path < 0) {
         print("W:", LA_F("%s: unknown target cand %s:%d", LA_F252, 252),
               PROTO, inet_ntoa(target_addr.sin_addr), ntohs(target_addr.sin_port));
@@ -878,7 +2149,14 @@ static void nat_on_reach(struct p2p_session *s, uint16_t seq,
     //   路径选择时会降权处理（+30% 惩罚）
     // 
     // 只有直连路径才需要 RTT 测量和统计更新（信令转发的 REACH 不更新 cand_idx 统计）
-    if (path_idx >= 0) {
+    if (path_idx >= 0 && payload_len >= (int)P2P_PKT_REACH_TS_PSZ) {
+        // 时间戳回显：RTT 由回显字段直接算出，此后本会话的 PUNCH 不再入 pending 队列
+        n->ts_echo = true;
+        path_manager_on_packet_recv(s, path_idx, now, 0, false, 0);
+        path_manager_on_echo(s, path_idx, target_path, seq,
+                             nget_l(payload + 6), nget_l(payload + 10), nget_l(payload + 14));
+    }
+    else if (path_idx >= 0) {
         // PUNCH_ACK 控制包不计入流量统计（size=0），hdr->seq > 0 时完成 RoundTrip 测量
         path_manager_on_packet_recv(s, path_idx, now, 0, seq > 0, seq);
     }
@@ -956,7 +2234,7 @@ static void nat_on_reach(struct p2p_session *s, uint16_t seq,
  *
  * 协议：P2P_PKT_CONN (0x03)
  * 包头: [type=0x03 | flags=0 | seq=对方conn_seq(2B)]
- * 负载: 无
+ * 负载: [caps(1) | window(2) | ack_freq(1) | ack_delay(1) | streams(1)]（可选，reliable 能力通告，由 nat_proto 交给 reliable_on_caps）
  * 
  * 收到 CONN 后，立即回复 CONN_ACK 并进入 NAT_CONNECTED 状态。
  */
@@ -1033,7 +2311,7 @@ static void nat_on_conn(struct p2p_session *s, uint16_t seq,
  *
  * 协议：P2P_PKT_CONN_ACK (0x04)
  * 包头: [type=0x04 | flags=0 | seq=echo conn_seq(2B)]
- * 负载: 无
+ * 负载: [caps(1) | window(2) | ack_freq(1) | ack_delay(1) | streams(1)]（可选，同 CONN）
  * 
  * 收到 CONN_ACK 后，停止发送 CONN，进入 NAT_CONNECTED 状态。
  */
@@ -1081,11 +2359,12 @@ static void nat_on_conn_ack(struct p2p_session *s, uint16_t seq,
 }
 
 /*
- * 处理 DATA 数据包（P2P_PKT_DATA）
+ * 处理数据包（P2P_PKT_DATA / P2P_PKT_DGRAM）的链路层部分
+ *
+ * @return  true = 来自已连接的已知路径，可交给上层
  */
-static void nat_on_data(struct p2p_session *s, uint16_t seq, int data_len,
+static bool nat_on_data(struct p2p_session *s, const char *PROTO, uint16_t seq, int data_len,
                         const struct sockaddr_in *from, uint64_t now) {
-    const char* PROTO = "DATA";
     nat_ctx_t *n = &s->nat;
 
     if (n->state < NAT_CONNECTING) {
@@ -1095,7 +2374,7 @@ static void nat_on_data(struct p2p_session *s, uint16_t seq, int data_len,
             print("E:", LA_F("Ignore %s pkt from %s:%d, valid state(%d)", LA_F306, 306), PROTO,
                   inet_ntoa(from->sin_addr), ntohs(from->sin_port), n->state);
         }
-        return;
+        return false;
     }
 
     // 数据包肯定来自已知候选路径
@@ -1104,11 +2383,11 @@ static void nat_on_data(struct p2p_session *s, uint16_t seq, int data_len,
     if (path_idx < PATH_IDX_SIGNALING) {
         print("E:", LA_F("Ignore %s pkt from unknown path %s:%d", LA_F307, 307), PROTO,
               inet_ntoa(from->sin_addr), ntohs(from->sin_port));
-        return;
+        return false;
     }
 
-    printf(LA_F("Recv %s pkt from %s:%d, seq=%u, len=%d", LA_F356, 356),
-           PROTO, inet_ntoa(from->sin_addr), ntohs(from->sin_port), seq, data_len - P2P_HDR_SIZE);
+    if (P2P_LOG_ON(VERBOSE)) printf(LA_F("Recv %s pkt from %s:%d, seq=%u, len=%d", LA_F356, 356),
+                                    PROTO, inet_ntoa(from->sin_addr), ntohs(from->sin_port), seq, data_len - P2P_HDR_SIZE);
     
     n->last_recv_time = now;
 
@@ -1135,8 +2414,12 @@ static void nat_on_data(struct p2p_session *s, uint16_t seq, int data_len,
               prev_state == NAT_CONNECTING ? "CONNECTING" : "PUNCHING",
               n->state == NAT_RELAY ? "RELAY" : "CONNECTED");
     }
+    return true;
 }
 
+/*
+ * 处理 ACK 包（P2P_PKT_ACK）
+ */
 /*
  * 处理 ACK 包（P2P_PKT_ACK）
  */
@@ -1146,14 +2429,15 @@ static void nat_on_data_ack(struct p2p_session *s, uint16_t ack_seq, uint32_t sa
     nat_ctx_t *n = &s->nat;
 
     // 收到 DATA ACK 说明自己至少曾经发送过数据包，也就是之前肯定已经是 connected 状态了
-    if (n->state < NAT_LOST) {
+    // + 或 cfg.early_data 下处于 CONNECTING，CONN 之后已提前发出数据
+    if (n->state < NAT_LOST && !(n->state == NAT_CONNECTING && s->inst->cfg.early_data)) {
         print("E:", LA_F("Ignore %s pkt from %s:%d, not connected", LA_F303, 303), PROTO,
               inet_ntoa(from->sin_addr), ntohs(from->sin_port));
         return;
     }
 
-    printf(LA_F("Recv %s pkt from %s:%d, ack_seq=%u, sack=0x%08x", LA_F355, 355),
-           PROTO, inet_ntoa(from->sin_addr), ntohs(from->sin_port), ack_seq, sack);
+    if (P2P_LOG_ON(VERBOSE)) printf(LA_F("Recv %s pkt from %s:%d, ack_seq=%u, sack=0x%08x", LA_F355, 355),
+                                    PROTO, inet_ntoa(from->sin_addr), ntohs(from->sin_port), ack_seq, sack);
 
     n->last_recv_time = now;
 
@@ -1164,6 +2448,38 @@ static void nat_on_data_ack(struct p2p_session *s, uint16_t ack_seq, uint32_t sa
     }
 }
 
+/*
+ * 把 ACK 负载（独立 ACK 或 DATA 捎带）交给 reliable 层
+ * 负载: [ack_seq(2B) | sack(4B)][rwnd(4B)，flags & P2P_ACK_FLAG_RWND][ce(4B)，flags & P2P_ACK_FLAG_ECN][扩展 SACK 区段]，
+ *       调用方已校验最小长度
+ */
+static void ack_apply(struct p2p_session *s, uint8_t flags, const uint8_t *payload, int payload_len, uint64_t now) {
+
+    // reliable 内部会更新 RTT
+    int old_srtt = s->reliable.srtt;
+    reliable_on_ack(s, nget_s(payload), nget_l(payload + 2), now);
+
+    // 扩展 ACK：接收窗口 + 位图之外的 SACK 区段
+    int ext = (int)P2P_PKT_ACK_PSZ;
+    if ((flags & P2P_ACK_FLAG_RWND) && payload_len >= ext + 4) {
+        reliable_on_rwnd(s, nget_l(payload + ext));
+        ext += 4;
+    }
+    if ((flags & P2P_ACK_FLAG_ECN) && payload_len >= ext + 4) {
+        reliable_on_ecn(s, nget_l(payload + ext), now);
+        ext += 4;
+    }
+    if (payload_len > ext)
+        reliable_on_sack_ranges(s, payload + ext, payload_len - ext, now);
+
+    // 这里检测 rtt 变化后同步到路径管理器
+    // + 多路径时 SRTT 混合了各路径样本，改由 path_manager_mp_on_ack 按路径更新
+    if (s->reliable.srtt != old_srtt && s->reliable.srtt > 0 && s->active_path >= -1
+        && !path_manager_mp_enabled(s)) {
+        path_manager_on_data_rtt(s, s->active_path, (uint32_t)s->reliable.srtt);
+    }
+}
+
 /*
  * 协议：P2P_PKT_FIN (0x30)
  * 包头: [type=0x30 | flags=0 | seq=0]
@@ -1202,8 +2518,18 @@ void nat_proto(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
                const uint8_t *payload, int payload_len,
                const struct sockaddr_in *from, uint64_t now) { (void) flags;
 
+    // 收包后本轮即执行该会话的 tick（投递数据、回 ACK、推进状态机）
+    p2p_session_wake(s);
+    P2P_TRACE(s, P2P_TRACE_PKT_RX, type, seq, payload_len, 0, 0, 0, NULL);
+
+    // 数据面包：刷新空闲计时，休眠中的会话先恢复缓冲区（失败则丢弃，由对端重传）
+    if (type == P2P_PKT_DATA || type == P2P_PKT_ACK || type == P2P_PKT_BULK
+        || type == P2P_PKT_FEC || type == P2P_PKT_CRYPTO || type == P2P_PKT_BUNDLE) {
+        if (p2p_session_thaw(s, now) != E_NONE) return;
+    }
+
     /* 解密输出缓冲区 */
-    uint8_t dec_buf[P2P_HDR_SIZE + P2P_MAX_PAYLOAD];
+    uint8_t dec_buf[P2P_HDR_SIZE + P2P_PMTU_PAYLOAD_MAX];
                 
     switch (type) {
 
@@ -1220,14 +2546,32 @@ void nat_proto(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
             break;
         }
 
+        // 已认证的记录来自未知地址：直连路径的对端 NAT 重绑定或网络迁移，
+        // + 加密会话与地址无关，直接把活跃路径切到新地址，无需重新握手
+        if ((s->path_type == P2P_PATH_PUNCH || s->path_type == P2P_PATH_LAN)
+            && (s->nat.state == NAT_CONNECTED || s->nat.state == NAT_LOST)
+            && p2p_find_path_by_addr(s, from) < PATH_IDX_SIGNALING) {
+            int idx = upsert_prflx(s, from);
+            if (idx >= 0) {
+                print("I:", LA_F("%s: peer migrated to %s:%d, path[%d] → path[%d]", LA_F499, 499), TASK_CRYPTO,
+                      inet_ntoa(from->sin_addr), ntohs(from->sin_port), s->active_path, idx);
+                path_manager_set_path_state(s, idx, PATH_STATE_ACTIVE);
+                p2p_set_active_path(s, idx);        // 旧地址已不可达，立即切换（不走防抖）
+                path_manager_switch_reset(s, now);
+            }
+        }
+
         // 解析解密后的内层 P2P 包头
         p2p_packet_hdr_t hdr;
         p2p_pkt_hdr_decode(dec_buf, &hdr);
-        seq = hdr.seq; //flags = hdr.flags;
+        seq = hdr.seq; flags = hdr.flags;
         payload = dec_buf + P2P_HDR_SIZE;
         payload_len = dec_len - P2P_HDR_SIZE;
         if (hdr.type == P2P_PKT_DATA) goto handle_data;
         if (hdr.type == P2P_PKT_ACK) goto handle_ack;
+        if (hdr.type == P2P_PKT_DGRAM) goto handle_dgram;
+        if (hdr.type == P2P_PKT_FEC) goto handle_fec;
+        if (hdr.type == P2P_PKT_BUNDLE) goto handle_bundle;
         break;
     }
 
@@ -1240,20 +2584,124 @@ void nat_proto(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
      */
     case P2P_PKT_DATA: handle_data:
 
-        nat_on_data(s, seq, P2P_HDR_SIZE + payload_len, from, now);
+        nat_on_data(s, "DATA", seq, P2P_HDR_SIZE + payload_len, from, now);
+
+        // 大包分段（P2P_DATA_FLAG_PART）：收齐后按原 DATA 处理
+        if (flags & P2P_DATA_FLAG_PART) {
+            if (!(payload_len = data_part_merge(s, seq, payload, payload_len))) break;
+            payload = s->nat.part_buf;
+        }
+
+        // 捎带 ACK（P2P_DATA_FLAG_ACK）：前置的 [aflags][ack_seq][sack][rwnd?][ce?] 按 ACK 处理，其余为 DATA 负载
+        if (flags & P2P_DATA_FLAG_ACK) {
+            int alen = payload_len > 0 ? 1 + (int)P2P_PKT_ACK_PSZ + ((payload[0] & P2P_ACK_FLAG_RWND) ? 4 : 0)
+                                       + ((payload[0] & P2P_ACK_FLAG_ECN) ? 4 : 0) : 1;
+            if (payload_len < alen) {
+                print("E:", LA_F("%s: bad payload(%d)\n", LA_F117, 117), TASK_DATA, payload_len);
+                if (flags & P2P_DATA_FLAG_PART) nat_pmtu_release(s);
+                break;
+            }
+            if (s->nat.state >= NAT_LOST && !(s->trans && s->trans->on_packet))
+                ack_apply(s, payload[0], payload + 1, alen - 1, now);
+            payload += alen;
+            payload_len -= alen;
+        }
 
         // 高级传输层或基础 reliable 层
+        // 冗余副本（P2P_DATA_FLAG_DUP）：另一路径的同序号包已先到则静默丢弃
         if (s->trans && s->trans->on_packet)
             s->trans->on_packet(s, payload, payload_len);
-        else if (payload_len > 0)
+        else if (payload_len > 0 && !((flags & P2P_DATA_FLAG_DUP) && reliable_recv_has(s, seq))) {
+            fec_on_data(s, seq, payload, payload_len);
             reliable_on_data(s, seq, payload, payload_len);
+        }
+
+        if (flags & P2P_DATA_FLAG_PART) nat_pmtu_release(s);
+        break;
+
+    /*
+     * 协议：P2P_PKT_BULK (0x24)
+     * 包头: [type=0x24 | flags=见下 | seq=首个包的序列号(2B)]
+     * 负载: [len(2B) | data(len)] * n，依次为 seq, seq+1, ... 的 DATA 负载
+     * 说明：仅经 RELAY 信令 TCP 中转（见 p2p_transport.h BULK 批量帧），拆开后按 DATA 交给 reliable 层
+     */
+    case P2P_PKT_BULK:
+
+        if (s->trans && s->trans->on_packet) {
+            print("E:", LA_F("%s: protocol mismatch, recv PKT_BULK on trans=%s", LA_F558, 558),
+                  TASK_DATA, s->trans->name);
+            break;
+        }
+        nat_on_data(s, "BULK", seq, P2P_HDR_SIZE + payload_len, from, now);
+
+        for (int off = 0; off + 2 <= payload_len; seq++) {
+            int len = nget_s(payload + off); off += 2;
+            if (len <= 0 || len > P2P_PMTU_PAYLOAD_MAX || off + len > payload_len) {
+                print("E:", LA_F("%s: bad payload(%d)\n", LA_F117, 117), TASK_DATA, payload_len);
+                break;
+            }
+            reliable_on_data(s, seq, payload + off, len);
+            off += len;
+        }
+        break;
+
+    /*
+     * 协议：P2P_PKT_FEC (0x25)
+     * 包头: [type=0x25 | flags=见下 | seq=组内首包序列号(2B)]
+     * 负载: [k(1B) | len_xor(2B) | parity(N)]
+     * 说明：seq 起 k 个 DATA 的 XOR 校验，组内只缺一个包时还原后交给 reliable 层（见 p2p_fec.h）
+     */
+    case P2P_PKT_FEC: handle_fec:
+
+        if (s->trans && s->trans->on_packet) break;
+        if (nat_on_data(s, "FEC", seq, P2P_HDR_SIZE + payload_len, from, now))
+            fec_on_parity(s, seq, payload, payload_len);
+        break;
+
+    /*
+     * 协议：P2P_PKT_DGRAM (0x23)
+     * 包头: [type=0x23 | flags=见下 | seq=发送方递增序号(2B)]
+     * 负载 (flags & 0x01 == 0): [data(N)]
+     * 负载 (flags & 0x01 == 1): [session_id(8)][data(N)]
+     * 说明：不可靠数据报，不经 reliable 层（不 ACK、不重传、不保序），直接交给应用
+     */
+    case P2P_PKT_DGRAM: handle_dgram:
+
+        if (nat_on_data(s, "DGRAM", seq, P2P_HDR_SIZE + payload_len, from, now))
+            dgram_deliver(s, payload, payload_len);
+        break;
+
+    /*
+     * 协议：P2P_PKT_BUNDLE (0x26)
+     * 包头: [type=0x26 | flags=0 | seq=0]
+     * 负载: [len(2B) | pkt(len)] * n，pkt 为完整的 DATA/ACK/DGRAM/FEC 包（hdr(4) + 负载）
+     * 说明：发送方 cfg.bundle 合并的数据面包（见 p2p_bundle_t），逐个按原类型处理；
+     *       加密会话整体封装在 CRYPTO 内，内层包不再单独解密
+     */
+    case P2P_PKT_BUNDLE: handle_bundle:
 
+        for (int off = 0; off < payload_len; ) {
+            int len = off + (int)P2P_PKT_BUNDLE_FRAME_HDR <= payload_len ? nget_s(payload + off) : 0;
+            off += (int)P2P_PKT_BUNDLE_FRAME_HDR;
+            if (len < P2P_HDR_SIZE || off + len > payload_len) {
+                print("E:", LA_F("%s: bad payload(%d)\n", LA_F117, 117), "BUNDLE", payload_len);
+                break;
+            }
+            p2p_packet_hdr_t inner;
+            p2p_pkt_hdr_decode(payload + off, &inner);
+            if (p2p_bundle_type(inner.type))
+                nat_proto(s, inner.type, inner.flags, inner.seq, payload + off + P2P_HDR_SIZE,
+                          len - P2P_HDR_SIZE, from, now);
+            off += len;
+        }
         break;
 
     /*
      * 协议：P2P_PKT_ACK (0x21)
      * 包头: [type=0x21 | flags=见下 | seq=序列号(2B)]
      * 负载 (flags & 0x01 == 0): [ack_seq(2B) | sack(4B)]
+     *   + flags & P2P_ACK_FLAG_RWND 时紧跟 [rwnd(4B)]（接收窗口字节数）
+     *   + 协商 EXT_SACK 后可追加 [n(1B) | (start(2B) count(2B)) * n]（位图之外的 SACK 区段）
      * 负载 (flags & 0x01 == 1): [session_id(8)][ack_seq(2B) | sack(4B)]
      * 说明：ACK 仅基础 reliable 层使用，DTLS/SCTP 有自己的确认机制
      */
@@ -1275,20 +2723,8 @@ void nat_proto(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
             break;
         }
 
-        uint16_t ack_seq = nget_s(payload);
-        uint32_t sack; nread_l(&sack, payload + 2);
-
-        nat_on_data_ack(s, ack_seq, sack, from, now);
-
-        // reliable 内部会更新 RTT
-        int old_srtt = s->reliable.srtt;
-        reliable_on_ack(s, ack_seq, sack, now);
-
-        // 这里检测 rtt 变化后同步到路径管理器
-        if (s->reliable.srtt != old_srtt && s->reliable.srtt > 0 && s->active_path >= -1) {
-            path_manager_on_data_rtt(s, s->active_path, (uint32_t)s->reliable.srtt);
-        }
-
+        nat_on_data_ack(s, nget_s(payload), nget_l(payload + 2), from, now);
+        ack_apply(s, flags, payload, payload_len, now);
         break;
     }
 
@@ -1298,7 +2734,7 @@ void nat_proto(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
 
     // NAT 打洞/保活包
     case P2P_PKT_PUNCH:
-        nat_on_punch(s, seq, payload, payload_len, from, now);
+        nat_on_punch(s, flags, seq, payload, payload_len, from, now);
         break;
     // NAT 打洞/保活包
     case P2P_PKT_REACH:
@@ -1307,10 +2743,12 @@ void nat_proto(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
         break;
 
     case P2P_PKT_CONN:
+        reliable_on_caps(s, payload, payload_len);
         nat_on_conn(s, seq, from, now);
         break;
 
     case P2P_PKT_CONN_ACK:
+        reliable_on_caps(s, payload, payload_len);
         nat_on_conn_ack(s, seq, from, now);
         break;
 
@@ -1318,6 +2756,18 @@ void nat_proto(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
         nat_on_fin(s, from);
         break;
 
+    case P2P_PKT_BIND_PROBE:
+        nat_on_bind_probe(s, seq, payload, payload_len, from);
+        break;
+
+    case P2P_PKT_PMTU_PROBE:
+        nat_on_pmtu_probe(s, flags, seq, payload, payload_len, from, now);
+        break;
+
+    case P2P_PKT_SHM:
+        p2p_shm_on_packet(s, payload, payload_len, now);
+        break;
+
     default:
         print("W:", LA_F("%s: unexpected type 0x%02x\n", LA_F251, 251), "PROTO", type);
         break;
@@ -1326,6 +2776,61 @@ void nat_proto(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
 
 ///////////////////////////////////////////////////////////////////////////////
 
+/* 中继模式的重试打洞间隔：竞速连接在原打洞超时前保持正常打洞节奏，之后降频 */
+/* 连接超时：至少 PONG_TIMEOUT_MS，保活间隔拉长后放宽到 3 个间隔 */
+static inline uint64_t pong_timeout(const struct p2p_session *s) {
+    uint64_t t = (uint64_t)nat_keepalive_ms(s) * 3;
+    return t > PONG_TIMEOUT_MS ? t : PONG_TIMEOUT_MS;
+}
+
+static inline uint64_t relay_retry_interval(const struct p2p_session *s, uint64_t now_ms) {
+    const nat_ctx_t *n = &s->nat;
+    if (n->race_start && tick_diff(now_ms, n->race_start) < punch_timeout(s)) return PUNCH_INTERVAL_MS;
+    return PUNCH_INTERVAL_MS * 4;
+}
+
+/* 合并定时器：返回 next 与 (due - now) 中较早者 */
+static inline int timer_min(int next, uint64_t due, uint64_t now_ms) {
+    int remain = due > now_ms ? (int)(due - now_ms) : 0;
+    return next < 0 || remain < next ? remain : next;
+}
+
+int nat_next_timeout(const struct p2p_session *s, uint64_t now_ms) {
+
+    const nat_ctx_t *n = &s->nat;
+    int next = -1;
+
+    switch (n->state) {
+        case NAT_PUNCHING:
+            if (s->remote_cand_done && n->punching) next = timer_min(next, n->punch_start + punch_timeout(s), now_ms);
+            { uint64_t due = check_next_due(s, now_ms); if (due) next = timer_min(next, due, now_ms); }
+            { uint64_t due = predict_next_due(s); if (due) next = timer_min(next, due, now_ms); }
+            break;
+        case NAT_CONNECTING:
+            next = timer_min(next, n->conn_start_ms + conn_timeout(s), now_ms);
+            next = timer_min(next, n->last_conn_send_ms + CONN_INTERVAL_MS, now_ms);
+            break;
+        case NAT_CONNECTED:
+            if (n->last_recv_time) next = timer_min(next, n->last_recv_time + pong_timeout(s), now_ms);
+            next = timer_min(next, n->last_keepalive_send_ms + nat_keepalive_ms(s), now_ms);
+            { uint64_t due = bind_probe_next_due(s); if (due) next = timer_min(next, due, now_ms); }
+            { uint64_t due = pmtu_next_due(s); if (due) next = timer_min(next, due, now_ms); }
+            break;
+        case NAT_RELAY:
+            if (s->remote_cand_cnt) next = timer_min(next, n->last_retry_send_ms + relay_retry_interval(s, now_ms), now_ms);
+            break;
+        default:
+            break;
+    }
+
+    if ((n->state == NAT_PUNCHING || n->state == NAT_LOST) && n->reaching_head)
+        next = timer_min(next, n->last_reaching_send_ms + REACHING_RELAY_INTERVAL_MS, now_ms);
+
+    if (n->resume) next = timer_min(next, n->last_resume_ms + NAT_RESUME_INTERVAL_MS, now_ms);
+
+    return next;
+}
+
 /*
  * 周期调用，发送打洞包和心跳
  */
@@ -1333,6 +2838,8 @@ void nat_tick(struct p2p_session *s, uint64_t now_ms) {
 
     nat_ctx_t *n = &s->nat;
 
+    if (n->resume) resume_tick(s, now_ms);
+
     switch (n->state) {
 
         case NAT_PUNCHING:
@@ -1343,11 +2850,15 @@ void nat_tick(struct p2p_session *s, uint64_t now_ms) {
                 // 首次 ICE 候选交换完成后，重置 punch 超时计时，以便准确计算打洞超时
                 if (!n->punching) { n->punching = 1; n->punch_start = now_ms; }
 
-                // 如果打洞超时
+                // 如果打洞超时（按 RTT 缩放，见 punch_timeout）
                 // + 注意，即使此时 remote_cand_cnt == 0（没有任何候选），也得等到超时后再 fallback
                 //   因为这个过程可能会出现 prflx candidate 地址
+                // + 竞速连接：直连先行 race_delay 后仍只有信令中转可用，即提前 fallback，打洞转入后台（NAT_RELAY 重试）
                 else if (!instrument_option(P2P_INST_OPT_TIMEOUT_OFF)
-                         && tick_diff(now_ms, n->punch_start) >= PUNCH_TIMEOUT_MS) {
+                         && (tick_diff(now_ms, n->punch_start) >= punch_timeout(s)
+                             || (s->inst->cfg.path_race && n->punching > 0
+                                 && tick_diff(now_ms, n->punch_start) >= race_delay(s)
+                                 && path_manager_select_best_path(s) == PATH_IDX_SIGNALING))) {
 
                     // 如果没有信令中转服务可用
                     // + 最佳路径只有在没有任何其他可用路径后，且存在信令中转服务时，才会返回 PATH_IDX_SIGNALING
@@ -1358,16 +2869,25 @@ void nat_tick(struct p2p_session *s, uint64_t now_ms) {
 
                         n->state = NAT_CLOSED;          // 标记为已关闭（打洞失败）
                         clear_reaching_queue(n);        // 清理 reaching queue
+                        nat_hist_record(s, false, now_ms);
                         break;
                     }
 
                     // 信令服务中转支持读写
                     assert(path_manager_select_best_path(s) == PATH_IDX_SIGNALING);
+                    if (tick_diff(now_ms, n->punch_start) < punch_timeout(s)) {
+                        n->race_start = n->punch_start;
+                        print("I:", LA_F("%s: no direct path after %llu ms, racing on signaling relay", LA_F522, 522),
+                              TASK_NAT, (unsigned long long)tick_diff(now_ms, n->punch_start));
+                    }
+                    else {
+                        print("W:", LA_F("%s: punch timeout, fallback punching using signaling relay", LA_F186, 186), TASK_NAT);
+                        nat_hist_record(s, false, now_ms);
+                    }
+
                     n->punching = -1;                   // 标记为正在进行 relay punching
                     n->punch_start = now_ms;            // 重置打洞开始时间，进入 relay punching 阶段
 
-                    print("W:", LA_F("%s: punch timeout, fallback punching using signaling relay", LA_F186, 186), TASK_NAT);
-
                     // 如果之前没有写路径
                     if (!s->tx_confirmed) { s->tx_confirmed = true;
 
@@ -1388,6 +2908,7 @@ void nat_tick(struct p2p_session *s, uint64_t now_ms) {
                         s->active_path = PATH_IDX_SIGNALING;
                         s->active_addr = s->inst->signaling.addr;
                         s->path_type = P2P_PATH_SIGNALING;
+                        p2p_session_bind_addr(s, NULL);
 
                         n->state = NAT_RELAY;
                         n->last_keepalive_send_ms = now_ms;
@@ -1400,37 +2921,28 @@ void nat_tick(struct p2p_session *s, uint64_t now_ms) {
                 }
             }
             else if (!instrument_option(P2P_INST_OPT_TIMEOUT_OFF) 
-                     && tick_diff(now_ms, n->punch_start) >= PUNCH_TIMEOUT_MS) {
+                     && tick_diff(now_ms, n->punch_start) >= punch_timeout(s)) {
 
                 print("V:", LA_F("%s: timeout but ICE exchange not done yet (%" PRIu64 " ms elapsed, mode=%d), waiting for more candidates", LA_F240, 240),
                         TASK_NAT, tick_diff(now_ms, n->punch_start), s->inst->sig_mode);
             }
 
-            // 周期性向所有候选发送打洞包（包括 relay）
-            if (!instrument_option(P2P_INST_OPT_RETRY_OFF)) {
-
-                int sent_cnt = 0;
-                for (int i = 0; i < s->remote_cand_cnt; i++) {
-
-                    if (tick_diff(now_ms, s->remote_cands[i].last_punch_send_ms) >= PUNCH_INTERVAL_MS) {
-
-                        nat_send_punch(s, LA_W("punch", LA_W7, 7), &s->remote_cands[i], now_ms);
-                        sent_cnt++;
-                    }
-                }
-                if (sent_cnt) {
+            // 按检查表调度打洞（包括 relay）：每个 Ta 节拍最多一个 PUNCH，已检查的候选对按 PUNCH_INTERVAL 重传
+            if (check_schedule(s, now_ms)) {
 
-                    print("V:", LA_F("%s: punching %d/%d candidates (elapsed: %" PRIu64 " ms)", LA_F187, 187),
-                        TASK_NAT, sent_cnt, s->remote_cand_cnt, tick_diff(now_ms, n->punch_start));
-                }
+                print("V:", LA_F("%s: punching %d/%d candidates (elapsed: %" PRIu64 " ms)", LA_F187, 187),
+                    TASK_NAT, 1, s->remote_cand_cnt, tick_diff(now_ms, n->punch_start));
             }
+
+            // 本端对称 NAT：常规检查之外追加端口预测探测
+            predict_schedule(s, now_ms);
             break;
 
         case NAT_CONNECTING:
 
             // 超时检查
             if (!instrument_option(P2P_INST_OPT_TIMEOUT_OFF) 
-                && tick_diff(now_ms, n->conn_start_ms) >= CONN_TIMEOUT_MS) {
+                && tick_diff(now_ms, n->conn_start_ms) >= conn_timeout(s)) {
                 
                 print("E:", LA_F("%s: CONN timeout after %" PRIu64 "ms", LA_F77, 77),
                       TASK_NAT, tick_diff(now_ms, n->conn_start_ms));
@@ -1453,9 +2965,9 @@ void nat_tick(struct p2p_session *s, uint64_t now_ms) {
 
         case NAT_CONNECTED:
 
-            // 超时检查
+            // 超时检查（保活间隔拉长后按 3 个间隔判定，避免空闲连接被误判丢失）
             if (!instrument_option(P2P_INST_OPT_TIMEOUT_OFF) 
-                && (n->last_recv_time && tick_diff(now_ms, n->last_recv_time) >= PONG_TIMEOUT_MS)) {
+                && (n->last_recv_time && tick_diff(now_ms, n->last_recv_time) >= pong_timeout(s))) {
 
                 print("W:", LA_F("%s: CONNECTED → LOST (no response %" PRIu64 "ms)\n", LA_F78, 78),
                       TASK_NAT, tick_diff(now_ms, n->last_recv_time));
@@ -1466,18 +2978,31 @@ void nat_tick(struct p2p_session *s, uint64_t now_ms) {
 
             // 向所有可写候选发送保活包（复用 PUNCH 包）
             // + 包括 relay：需要测量 relay 路径的 RTT 和质量，供 path_manager 选路使用
-            if (!instrument_option(P2P_INST_OPT_NAT_ALIVE_PUNCH_OFF) 
-                && tick_diff(now_ms, n->last_keepalive_send_ms) >= PING_INTERVAL_MS) {
+            bind_probe_tick(s, now_ms);
+            pmtu_tick(s, now_ms);
 
-                int alive_cnt = 0;
+            if (!instrument_option(P2P_INST_OPT_NAT_ALIVE_PUNCH_OFF) 
+                && tick_diff(now_ms, n->last_keepalive_send_ms) >= nat_keepalive_ms(s)) {
+
+                // + 最近半个保活周期内有数据 ACK 被动 RTT 样本的路径跳过本轮：数据收发已刷新 NAT 映射并测得 RTT
+                //   （相邻两次出站间隔仍不超过 1.5 个保活周期）
+                // + 活跃 / 次优 / 恢复中的路径每轮探测，其余按质量疏探测（见 P2P_PROBE_SPARSE）
+                int alive_cnt = 0, skip_cnt = 0;
+                uint32_t window = nat_keepalive_ms(s) / 2;
+                int backup = path_manager_select_backup_path(s);
+                uint32_t round = n->keepalive_round++;
                 for (int i = 0; i < s->remote_cand_cnt; i++) {
-                    if (path_is_selectable(s->remote_cands[i].stats.state)) {
-                        nat_send_punch(s, LA_W("alive", LA_W1, 1), &s->remote_cands[i], now_ms);
-                        alive_cnt++;
-                    }
+                    path_stats_t *st = &s->remote_cands[i].stats;
+                    if (!path_is_selectable(st->state)) continue;
+                    st->probe_period = (i == s->active_path || i == backup || st->state == PATH_STATE_RECOVERING) ? 1
+                                     : st->state == PATH_STATE_DEGRADED ? P2P_PROBE_SPARSE * 2 : P2P_PROBE_SPARSE;
+                    if ((round + (uint32_t)i) % st->probe_period) { skip_cnt++; continue; }
+                    if (path_manager_rtt_fresh(s, i, now_ms, window)) { skip_cnt++; continue; }
+                    nat_send_punch(s, LA_W("alive", LA_W1, 1), &s->remote_cands[i], now_ms);
+                    alive_cnt++;
                 }
+                if (alive_cnt || skip_cnt) n->last_keepalive_send_ms = now_ms;
                 if (alive_cnt) {
-                    n->last_keepalive_send_ms = now_ms;
                     print("V:", LA_F("%s: keep-alive sent (%d cands)", LA_F153, 153), TASK_NAT, alive_cnt);
                 }
             }
@@ -1491,9 +3016,10 @@ void nat_tick(struct p2p_session *s, uint64_t now_ms) {
             // 中继模式下周期性尝试直连（打洞）
             if (s->remote_cand_cnt 
                 && !instrument_option(P2P_INST_OPT_NAT_ALIVE_PUNCH_OFF) 
-                && tick_diff(now_ms, n->last_retry_send_ms) >= PUNCH_INTERVAL_MS * 4) {
+                && tick_diff(now_ms, n->last_retry_send_ms) >= relay_retry_interval(s, now_ms)) {
 
                 for (int i = 0; i < s->remote_cand_cnt; i++) {
+                    if (path_is_dead(&s->remote_cands[i].stats)) continue;
                     nat_send_punch(s, LA_W("retry", LA_W9, 9), &s->remote_cands[i], now_ms);
                 }
                 n->last_retry_send_ms = now_ms;
@@ -1585,15 +3111,15 @@ void nat_tick(struct p2p_session *s, uint64_t now_ms) {
         
         n->last_reaching_send_ms = now_ms;
 
-        // 构造 REACH 负载：[target_addr(6)]
-        uint8_t reach_payload[P2P_PKT_REACH_PSZ];
-        memcpy(reach_payload, &n->reaching_head->target.sin_addr.s_addr, 4);
-        memcpy(reach_payload + 4, &n->reaching_head->target.sin_port, 2);
+        // 构造 REACH 负载：[target_addr(6)] [+ echo_ts/hold/ts(12)]
+        const punch_reaching_t *head = n->reaching_head;
+        uint8_t reach_payload[P2P_PKT_REACH_TS_PSZ];
+        int reach_len = reach_build(reach_payload, &head->target, head->ts, head->echo_ts, head->recv_us);
         
         // 策略 1：信令中转模式（如果服务器支持）
         if (s->inst->signaling_relay_fn) {
 
-            ret_t ret = s->inst->signaling_relay_fn(s, P2P_PKT_REACH, 0, n->reaching_head->seq, reach_payload, P2P_PKT_REACH_PSZ);
+            ret_t ret = s->inst->signaling_relay_fn(s, P2P_PKT_REACH, 0, n->reaching_head->seq, reach_payload, reach_len);
             if (ret == E_NONE) {
 
                 // 发送成功，将节点出队并释放
@@ -1621,7 +3147,7 @@ void nat_tick(struct p2p_session *s, uint64_t now_ms) {
                 // 跳过 target 地址（已原路发送）
                 if (sockaddr_equal(&s->remote_cands[i].addr, &n->reaching_head->target)) continue;
 
-                cand_send_packet(s, i, P2P_PKT_REACH, n->reaching_head->seq, reach_payload, P2P_PKT_REACH_PSZ, now_ms, false);
+                cand_send_packet(s, i, P2P_PKT_REACH, 0, n->reaching_head->seq, reach_payload, reach_len, now_ms, false);
                 broadcast_cnt++;
             }
             
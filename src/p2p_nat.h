@@ -18,6 +18,65 @@
 
 /* 前向声明 */
 struct p2p_session;
+struct p2p_instance;
+struct p2p_stun_attrs;
+
+/* 对称 NAT 端口预测（见 p2p_nat.c predict_*） */
+#define NAT_PREDICT_SOCKS       4           /* 额外打开的预测套接字数（生日策略：每个套接字产生一个新映射） */
+#define NAT_PREDICT_PORTS       16          /* 每个套接字探测的预测端口数 */
+
+/*
+ * NAT 绑定存活期探测（cfg.keepalive_adaptive，见 p2p_nat.c bind_probe_*）
+ *
+ * 实例级：本端 NAT 的映射超时是环境属性，同一时刻只由一个打洞直连的会话执行探测。
+ * 每轮：探测套接字向对端发 OPEN（建立独立映射）→ 空闲 gap → 经主路径请求对端 ECHO →
+ *       对端向 OPEN 的来源地址回 REPLY，收到即说明该映射空闲 gap 后仍存活。
+ */
+typedef struct {
+    struct p2p_session* owner;              // 正在探测的会话（NULL = 无）
+    uint16_t            port;               // 探测套接字本地端口（网络字节序）
+    uint16_t            seq;                // 本轮序号
+    uint8_t             phase;              // 0 = 空闲，1 = OPEN 已发、等待 gap，2 = ECHO 已发、等待 REPLY
+    uint8_t             tries;              // 本轮 ECHO 发送次数
+    bool                verified;           // 当前探测会话的对端已应答过（校验轮通过）
+    uint32_t            gap_ms;             // 本轮空闲间隔
+    uint32_t            ok_ms;              // 已确认存活的最大间隔（0 = 尚无）
+    uint32_t            fail_ms;            // 已确认失效的最小间隔（0 = 尚无）
+    uint64_t            open_ms;            // 本轮 OPEN 发送时间
+    uint64_t            echo_ms;            // 最近一次 ECHO 发送时间
+    uint32_t            lifetime_ms;        // 探测结果：映射存活期下限（0 = 未完成）
+} nat_bind_probe_t;
+
+/*
+ * 候选类型历史（实例级，见 p2p_nat.c hist_*）
+ *
+ * 按本端网络（srflx 地址 /24）与 NAT 类型分组，记录每轮打洞中各类远端候选的检查次数、打通次数与耗时
+ * （所有 PUNCH 经同一套接字发出，候选对的类型由远端候选类型决定）。
+ * 检查表先按历史得分、再按候选对优先级排序；首拍并行检查得分高于中性值的前 NAT_HIST_BURST 个候选对。
+ * 仅保存在内存中，随实例释放；分片线程下由 mtx 保护（叶子锁）。
+ */
+#define NAT_HIST_SLOTS          16          /* 网络分组数（满时替换最早更新的） */
+#define NAT_HIST_TYPES          4           /* 统计的候选类型：Host / Srflx / Relay / Prflx */
+#define NAT_HIST_BURST          3           /* 首拍最多并行检查的候选对数 */
+#define NAT_HIST_NEUTRAL        (500u << 16)    /* 无历史的候选类型得分（成功率 50%，耗时未知） */
+#define NAT_HIST_SAME_NAT       UINT32_MAX      /* 双方位于同一 NAT 之后时 host 候选的得分（高于任何历史） */
+#define NAT_SAME_NAT_BURST      8               /* 同一 NAT 之后：首拍最多并行检查的 host 候选对数 */
+
+typedef struct {
+    uint32_t            net;                // 本端 srflx 地址 /24（网络字节序，0 = 尚无 srflx）
+    int                 nat_type;           // 本端 NAT 类型（inst->nat_type，检测未完成按 0）
+    uint16_t            tries[NAT_HIST_TYPES];  // 检查过该类型候选的打洞轮次
+    uint16_t            wins[NAT_HIST_TYPES];   // 其中经该类型候选打通的轮次
+    uint32_t            ms[NAT_HIST_TYPES];     // 打通耗时（毫秒，1/4 EWMA）
+    uint64_t            stamp;              // 最近更新时间（0 = 空闲槽位）
+} nat_hist_entry_t;
+
+typedef struct nat_hist {
+    nat_hist_entry_t    slots[NAT_HIST_SLOTS];
+#ifdef P2P_THREADED
+    P_mutex_t           mtx;
+#endif
+} nat_hist_t;
 
 /* 打洞状态 */
 enum {
@@ -31,11 +90,27 @@ enum {
     NAT_RELAY                                   // 中继模式：打洞超时失败。此时仍周期发送 PUNCH 尝试重连
 };
 
+/*
+ * 候选对检查状态（RFC 8445 §6.1.2.6），记录在 remote_cands[i].check
+ * + 同一 foundation（候选类型 + IP）同时只解冻一个候选对，其余保持 FROZEN，
+ *   该 foundation 有候选对成功后才解冻其余候选对
+ */
+enum {
+    NAT_CHECK_NONE = 0,                         // 尚未加入检查表
+    NAT_CHECK_FROZEN,                           // 冻结：等待同 foundation 的候选对先出结果
+    NAT_CHECK_WAITING,                          // 等待：可被调度发送首个检查
+    NAT_CHECK_IN_PROGRESS,                      // 已发送检查，等待应答（按 PUNCH_INTERVAL 重传）
+    NAT_CHECK_SUCCEEDED                         // 路径已可写
+};
+
 /* reaching 队列节点（NAT 内部使用，单向链表） */
 typedef struct punch_reaching {
     uint16_t                   seq;             // PUNCH seq（需要 echo）
     struct sockaddr_in         target;          // PUNCH 携带的 target_addr（需要 echo）
     int                        cand_idx;        // 来源候选索引
+    bool                       ts;              // PUNCH 携带时间戳（REACH 需回显 echo_ts/hold）
+    uint32_t                   echo_ts;         // PUNCH.ts
+    uint64_t                   recv_us;         // 收到 PUNCH 的时间（P_tick_us，计算 hold）
     struct punch_reaching*     next;            // 下一个节点
 } punch_reaching_t;
 
@@ -51,10 +126,31 @@ typedef struct {
                                                 //  -1: remote_cand_done == true 且超时后，如果存在信令中转服务，
                                                 //      则允许继续打洞一个超时周期。也就是在 relay 模式下进行握手
     uint64_t            punch_start;            // 打洞开始时间（计算打洞超时）
+    uint64_t            punch_hold;             // 暂缓起跑至此时刻（服务器协调的同时起跑，0 = 不等待），到期前不发 PUNCH
     uint16_t            punch_seq;              // 本地 PUNCH 包序列号（自增）
+    uint64_t            last_check_ms;          // 上次调度检查的时间（按 Ta 节拍，每拍最多一个 PUNCH）
+    int                 check_trigger;          // 触发检查（收到对端 PUNCH 的候选索引 + 1，0 = 无）
+    bool                hist_done;              // 本轮打洞结果已计入候选类型历史
+    bool                same_nat;               // 双方公网地址相同（同一 NAT 之后）：host 候选优先并行检查
+
+    /* 对称 NAT 端口预测 */
+    bool                predict;                // 已启动端口预测（锁定 predict_addr）
+    int16_t             predict_step;           // 预测端口步长（本端 NAT 映射增量）
+    uint16_t            predict_next;           // 本轮下一个探测序号 j（套接字 j / PORTS，端口偏移 j % PORTS）
+    struct sockaddr_in  predict_addr;           // 预测基准：对端 srflx 候选地址
+    uint64_t            last_predict_ms;        // 上次发送预测探测的时间
+
+    /* 0-RTT 重连（路径缓存） */
+    bool                resume;                 // 正在探测缓存路径（NAT 状态可仍为 INIT）
+    uint8_t             resume_type;            // 缓存路径的候选类型
+    struct sockaddr_in  resume_addr;            // 缓存路径的对端地址
+    uint64_t            resume_start;           // 开始探测的时间
+    uint64_t            last_resume_ms;         // 上次发送探测的时间
     
     /* reaching 队列（原路径处于非 writable 状态时缓存 REACH） */
     punch_reaching_t*   reaching_recycle;   
+    struct p2p_arena*   arena;                  // reaching 节点所在的实例内存区（NULL = 全局分配，nat_reset 保留）
+    struct p2p_mem_acct* mem;                   // reaching 节点计入的会话内存计量（NULL = 不计量，nat_reset 保留）
     punch_reaching_t*   reaching_head;          // 队列头指针（最早的在前）
     punch_reaching_t*   reaching_rear;          // 队列尾指针（最新的在后）
     uint64_t            last_reaching_send_ms;  // 上次通过信令发送的时间
@@ -66,7 +162,26 @@ typedef struct {
 
     /* 保活和重试计时器 */
     uint64_t            last_keepalive_send_ms; // NAT_CONNECTED: 上次发送保活包的时间
+    uint32_t            keepalive_round;        // NAT_CONNECTED: 保活轮次（疏探测路径按 probe_period 取模，见 P2P_PROBE_SPARSE）
+    bool                ts_echo;                // 对端回显过 PUNCH 时间戳：RTT 改用回显测量，PUNCH 不再入 pending 队列
     uint64_t            last_retry_send_ms;     // NAT_RELAY: 上次发送重试打洞的时间
+    uint64_t            race_start;             // 竞速连接（path_race）：中继先行时的打洞开始时间（0 = 未竞速）
+
+    /* 绑定存活期探测：应答端记录对端探测套接字的映射地址 */
+    struct sockaddr_in  bind_peer;              // 对端 OPEN 的来源地址
+    uint16_t            bind_peer_seq;          // 对端 OPEN 的序号
+    bool                bind_probe_off;         // 对端不应答探测（旧版本），本会话不再发起
+
+    /* 路径 MTU 探测（cfg.pmtu_discovery，各路径结果见 path_stats_t.pmtu） */
+    uint16_t            pmtu_seq;               // 探测编号
+    bool                pmtu_off;               // 对端不应答探测（旧版本），本会话不再发起
+
+    /* DATA 分段重组（P2P_DATA_FLAG_PART） */
+    uint8_t*            part_buf;               // 重组缓冲区（池缓冲区，NULL = 无）
+    uint16_t            part_seq;               // 重组中的序列号
+    uint16_t            part_map;               // 已收分段位图（0 = 无重组）
+    uint8_t             part_cnt;               // 分段总数
+    int                 part_len;               // 原负载长度（末段到达后确定）
 
 } nat_ctx_t;
 
@@ -77,6 +192,42 @@ void nat_init(nat_ctx_t *n);
 
 void nat_reset(nat_ctx_t *n);
 
+/*
+ * 关闭端口预测套接字（所有 session 关闭后由 session_deactivate 调用）
+ */
+void nat_predict_close(struct p2p_instance *inst);
+
+/*
+ * 当前会话的保活间隔（毫秒）：cfg.keepalive_adaptive 且探测完成时，打洞直连路径取映射存活期的一半
+ */
+uint32_t nat_keepalive_ms(const struct p2p_session *s);
+
+/*
+ * 结束绑定存活期探测：release 在会话重置时调用（仅当该会话为探测者），close 在所有会话关闭后调用
+ */
+void nat_bind_probe_release(struct p2p_session *s);
+void nat_bind_probe_close(struct p2p_instance *inst);
+
+/*
+ * 路径 MTU（cfg.pmtu_discovery，见 p2p_nat.c pmtu_*）
+ *
+ * nat_pmtu_payload:  活跃路径上单个 DATA 的负载上限（未确认的路径为 P2P_MAX_PAYLOAD），
+ *                    流层按此组包，p2p_send_packet 对超出的 DATA 按 P2P_DATA_FLAG_PART 分段
+ * nat_pmtu_fallback: 大包反复超时（路径 MTU 黑洞）时将路径回退到 P2P_MTU（path_idx 为 PATH_IDX_NONE 时取活跃路径）
+ * nat_pmtu_release:  归还分段重组缓冲区（会话重置时调用）
+ */
+int  nat_pmtu_payload(const struct p2p_session *s);
+void nat_pmtu_fallback(struct p2p_session *s, int path_idx, uint64_t now);
+void nat_pmtu_release(struct p2p_session *s);
+
+/*
+ * 候选类型历史：create / free 于 p2p_create / p2p_destroy
+ * record 记录本轮打洞结果（connected = 已打通，winner 为活跃路径的候选类型；否则为超时失败），每轮只记一次
+ */
+ret_t nat_hist_create(struct p2p_instance *inst);
+void  nat_hist_free(struct p2p_instance *inst);
+void  nat_hist_record(struct p2p_session *s, bool connected, uint64_t now);
+
 /*
  * 周期调用，发送打洞包和心跳
  *
@@ -85,6 +236,13 @@ void nat_reset(nat_ctx_t *n);
  */
 void nat_tick(struct p2p_session *s, uint64_t now_ms);
 
+/*
+ * 距下一次 NAT 定时任务（打洞、CONN 重发、保活、超时检测）的毫秒数
+ *
+ * @return         >=0 剩余毫秒数；-1 当前状态无定时任务
+ */
+int nat_next_timeout(const struct p2p_session *s, uint64_t now_ms);
+
 //-----------------------------------------------------------------------------
 
 /*
@@ -99,12 +257,38 @@ void nat_tick(struct p2p_session *s, uint64_t now_ms);
  *   - nat_punch(s, idx)     向单个候选追加打洞（Trickle ICE）
  *
  * 语义：
- *   - 批量模式（idx==-1）：进入 PUNCHING 状态，向所有候选并发打洞
+ *   - 批量模式（idx==-1）：进入 PUNCHING 状态，按候选对优先级逐个调度检查（每 Ta 一个）
  *   - 单候选模式（idx>=0）：追加打洞，若当前是 RELAY 状态则自动重启
  *   - 根据候选的 last_punch_send_ms 自动管理打洞时序
  */
 ret_t nat_punch(struct p2p_session *s, int idx);
 
+/*
+ * 暂缓打洞起跑：until 之前检查表不发送 PUNCH（服务器协调的同时起跑，见 SIG_PKT_PUNCH_AT）
+ *
+ * 语义：
+ *   - 打洞尚未启动：设置首轮等待上限，随后的 nat_punch(s, -1) 进入 PUNCHING 但暂不发送
+ *   - 等待中：改为 until（服务器提示的起跑时刻）
+ *   - 已起跑：忽略
+ *   - 等待期间收到对端 PUNCH 立即起跑；起跑时重置 punch_start，打洞超时从首个 PUNCH 起算
+ */
+void nat_punch_hold(struct p2p_session *s, uint64_t until);
+
+/*
+ * 向单个候选发一次 RoundTrip 探测（PUNCH，计入路径 RTT），用于预热备用路径
+ */
+void nat_probe(struct p2p_session *s, int idx, uint64_t now_ms);
+
+/*
+ * 0-RTT 重连：与信令交换并行，立即向缓存路径打洞
+ *
+ * @param addr       缓存的对端地址
+ * @param cand_type  登记候选时使用的类型（P2P_CAND_HOST / P2P_CAND_PRFLX）
+ *
+ * 对端 REACH 回显该地址即登记为候选并进入 PUNCHING；超时未应答则作废缓存条目。
+ */
+void nat_resume(struct p2p_session *s, const struct sockaddr_in *addr, int cand_type);
+
 /*
  * 发送 FIN 包（主动断开 NAT 连接）
  *
@@ -129,10 +313,11 @@ void nat_proto(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
  * @param s           会话对象
  * @param buf         STUN 包数据
  * @param len         包长度
+ * @param attrs       派发入口已解析的属性索引（NULL 则内部解析）
  * @param from        来源地址
  */
-void nat_on_stun_packet(struct p2p_session *s, uint16_t msg_type, const uint8_t *buf, int len, 
-                       const struct sockaddr_in *from, uint64_t now);
+void nat_on_stun_packet(struct p2p_session *s, uint16_t msg_type, const uint8_t *buf, int len,
+                       const struct p2p_stun_attrs *attrs, const struct sockaddr_in *from, uint64_t now);
 
 
 ///////////////////////////////////////////////////////////////////////////////
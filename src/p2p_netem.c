@@ -0,0 +1,319 @@
+/*
+ * UDP 网络损伤模拟实现，参数与语义见 p2p_netem.h
+ */
+
+#define MOD_TAG "NETEM"
+
+#include "p2p_internal.h"
+#include "p2p_netem.h"
+
+struct netem_pkt {
+    uint64_t                due_us;
+    uint32_t                ord;
+    int                     sock_idx;
+    struct sockaddr_in      addr;           // tx: 目标地址；rx: 来源地址
+    int                     len;
+    uint8_t                 data[];
+};
+
+#if defined(_MSC_VER)
+#define NETEM_LOCK(ne)      while (_InterlockedExchange(&(ne)->lock, 1)) {}
+#define NETEM_UNLOCK(ne)    _InterlockedExchange(&(ne)->lock, 0)
+#else
+#define NETEM_LOCK(ne)      while (__atomic_exchange_n(&(ne)->lock, 1, __ATOMIC_ACQUIRE)) {}
+#define NETEM_UNLOCK(ne)    __atomic_store_n(&(ne)->lock, 0, __ATOMIC_RELEASE)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// 随机数与时延分布
+
+static uint64_t rnd64(p2p_netem_dir_t *d) {                  // xorshift64*
+    d->rng ^= d->rng >> 12; d->rng ^= d->rng << 25; d->rng ^= d->rng >> 27;
+    return d->rng * 2685821657736338717ull;
+}
+
+/* [0, 1) 均匀分布 */
+static double rnd_unit(p2p_netem_dir_t *d) {
+    return (double)(rnd64(d) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static bool rnd_hit(p2p_netem_dir_t *d, float p) {
+    return p > 0 && rnd_unit(d) < p;
+}
+
+/* 本包时延：固定时延 + 抖动（正态分布取 12 个均匀分布之和近似，无需 libm） */
+static int64_t delay_sample(p2p_netem_dir_t *d) {
+    const p2p_netem_param_t *p = &d->param;
+    int64_t us = p->delay_us;
+    if (p->jitter_us > 0) {
+        double z;
+        if (p->normal) { z = -6.0; for (int i = 0; i < 12; i++) z += rnd_unit(d); }
+        else z = rnd_unit(d) * 2.0 - 1.0;
+        us += (int64_t)(z * p->jitter_us);
+    }
+    return us > 0 ? us : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 到期时刻最小堆
+
+static bool pkt_before(const netem_pkt_t *a, const netem_pkt_t *b) {
+    return a->due_us != b->due_us ? a->due_us < b->due_us : (int32_t)(a->ord - b->ord) < 0;
+}
+
+static bool heap_push(p2p_netem_dir_t *d, netem_pkt_t *p) {
+    if (d->cnt == d->cap) {
+        int cap = d->cap ? d->cap * 2 : 64;
+        netem_pkt_t **h = (netem_pkt_t **)p2p_realloc(d->heap, sizeof(*h) * (size_t)cap);
+        if (!h) return false;
+        d->heap = h; d->cap = cap;
+    }
+    int i = d->cnt++;
+    while (i > 0) {
+        int up = (i - 1) / 2;
+        if (!pkt_before(p, d->heap[up])) break;
+        d->heap[i] = d->heap[up];
+        i = up;
+    }
+    d->heap[i] = p;
+    return true;
+}
+
+/* 弹出已到期的堆顶，无则返回 NULL */
+static netem_pkt_t *heap_pop_due(p2p_netem_dir_t *d, uint64_t now_us) {
+    if (!d->cnt || d->heap[0]->due_us > now_us) return NULL;
+    netem_pkt_t *top = d->heap[0], *last = d->heap[--d->cnt];
+    int i = 0;
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= d->cnt) break;
+        if (c + 1 < d->cnt && pkt_before(d->heap[c + 1], d->heap[c])) c++;
+        if (!pkt_before(d->heap[c], last)) break;
+        d->heap[i] = d->heap[c];
+        i = c;
+    }
+    if (d->cnt) d->heap[i] = last;
+    return top;
+}
+
+static void dir_clear(p2p_netem_dir_t *d) {
+    for (int i = 0; i < d->cnt; i++) p2p_free(d->heap[i]);
+    p2p_free(d->heap);
+    d->heap = NULL;
+    d->cnt = d->cap = 0;
+}
+
+/* 按本方向参数决定丢弃 / 复制 / 时延后入队 */
+static void dir_enqueue(p2p_netem_dir_t *d, int sock_idx, const struct sockaddr_in *addr,
+                        const void *data, int len, uint64_t now_us) {
+    const p2p_netem_param_t *p = &d->param;
+    d->in++;
+    if (rnd_hit(d, p->loss)) { d->dropped++; return; }
+
+    int copies = rnd_hit(d, p->dup) ? 2 : 1;
+    if (copies > 1) d->duplicated++;
+
+    for (int c = 0; c < copies; c++) {
+        if (d->cnt >= p->limit) { d->dropped++; continue; }
+
+        uint64_t due = now_us;
+        if (p->rate_kbps > 0) {
+            if (d->link_free_us < now_us) d->link_free_us = now_us;
+            d->link_free_us += (uint64_t)len * 8000u / (uint64_t)p->rate_kbps;
+            due = d->link_free_us;
+        }
+        if (rnd_hit(d, p->reorder)) d->reordered++;
+        else due += (uint64_t)delay_sample(d);
+
+        netem_pkt_t *pkt = (netem_pkt_t *)p2p_malloc(sizeof(*pkt) + (size_t)len);
+        if (!pkt) { d->dropped++; continue; }
+        pkt->due_us = due;
+        pkt->ord = d->ord++;
+        pkt->sock_idx = sock_idx;
+        pkt->addr = *addr;
+        pkt->len = len;
+        memcpy(pkt->data, data, (size_t)len);
+        if (!heap_push(d, pkt)) { p2p_free(pkt); d->dropped++; }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 配置解析
+
+static bool parse_ratio(const char *v, float *out) {
+    char *end;
+    double x = strtod(v, &end);
+    if (end == v) return false;
+    if (*end == '%') { x /= 100.0; end++; }
+    if (*end || x < 0 || x > 1) return false;
+    *out = (float)x;
+    return true;
+}
+
+static bool parse_ms(const char *v, int *out_us) {
+    char *end;
+    double x = strtod(v, &end);
+    if (end == v || *end || x < 0 || x > 600000) return false;
+    *out_us = (int)(x * 1000.0);
+    return true;
+}
+
+static bool parse_int(const char *v, long max, long *out) {
+    char *end;
+    long x = strtol(v, &end, 10);
+    if (end == v || *end || x < 0 || x > max) return false;
+    *out = x;
+    return true;
+}
+
+/* 设置一个键；dirs 为要设置的方向（1 或 2 个） */
+static bool apply_kv(p2p_netem_param_t **dirs, int nd, const char *k, const char *v, uint64_t *seed) {
+    long n;
+    for (int i = 0; i < nd; i++) { p2p_netem_param_t *p = dirs[i];
+        if      (!strcmp(k, "loss"))    { if (!parse_ratio(v, &p->loss)) return false; }
+        else if (!strcmp(k, "reorder")) { if (!parse_ratio(v, &p->reorder)) return false; }
+        else if (!strcmp(k, "dup"))     { if (!parse_ratio(v, &p->dup)) return false; }
+        else if (!strcmp(k, "delay"))   { if (!parse_ms(v, &p->delay_us)) return false; }
+        else if (!strcmp(k, "jitter"))  { if (!parse_ms(v, &p->jitter_us)) return false; }
+        else if (!strcmp(k, "rate"))    { if (!parse_int(v, 100000000L, &n)) return false; p->rate_kbps = (int)n; }
+        else if (!strcmp(k, "limit"))   { if (!parse_int(v, 1000000L, &n) || !n) return false; p->limit = (int)n; }
+        else if (!strcmp(k, "dist")) {
+            if (!strcmp(v, "normal")) p->normal = true;
+            else if (!strcmp(v, "uniform")) p->normal = false;
+            else return false;
+        }
+        else if (!strcmp(k, "seed"))    { if (!parse_int(v, 0x7FFFFFFFL, &n)) return false; *seed = (uint64_t)n; }
+        else return false;
+    }
+    return true;
+}
+
+static bool param_on(const p2p_netem_param_t *p) {
+    return p->loss > 0 || p->reorder > 0 || p->dup > 0 || p->delay_us > 0 || p->jitter_us > 0 || p->rate_kbps > 0;
+}
+
+ret_t p2p_netem_config(struct p2p_instance *inst, const char *spec) {
+
+    P_check(inst, return E_INVALID;)
+    if (!spec || !*spec) { p2p_netem_free(inst); return E_NONE; }
+
+    p2p_netem_param_t tx, rx;
+    memset(&tx, 0, sizeof(tx));
+    tx.limit = NETEM_LIMIT_DEFAULT;
+    rx = tx;
+    uint64_t seed = 1;
+
+    char buf[256];
+    if (strlen(spec) >= sizeof(buf)) return E_INVALID;
+    strcpy(buf, spec);
+
+    for (char *kv = buf, *next; kv && *kv; kv = next) {
+        if ((next = strchr(kv, ','))) *next++ = '\0';
+        char *v = strchr(kv, '=');
+        if (!v) return E_INVALID;
+        *v++ = '\0';
+
+        p2p_netem_param_t *dirs[2] = { &tx, &rx };
+        int nd = 2;
+        if (!strncmp(kv, "tx.", 3)) { kv += 3; nd = 1; }
+        else if (!strncmp(kv, "rx.", 3)) { kv += 3; dirs[0] = &rx; nd = 1; }
+        if (!apply_kv(dirs, nd, kv, v, &seed)) {
+            print("E:", LA_F("%s: bad option '%s=%s'", LA_F601, 601), MOD_TAG, kv, v);
+            return E_INVALID;
+        }
+    }
+
+    p2p_netem_t *ne = inst->netem;
+    if (!ne && !(ne = (p2p_netem_t *)p2p_calloc(1, sizeof(*ne)))) return E_OUT_OF_MEMORY;
+
+    NETEM_LOCK(ne);
+    ne->tx.param = tx; ne->tx.on = param_on(&tx);
+    ne->rx.param = rx; ne->rx.on = param_on(&rx);
+    // 两个方向的随机序列由同一种子派生、互不相关
+    ne->tx.rng = seed * 0x9E3779B97F4A7C15ull | 1;
+    ne->rx.rng = (seed ^ 0x5851F42D4C957F2Dull) * 0x9E3779B97F4A7C15ull | 1;
+    NETEM_UNLOCK(ne);
+    inst->netem = ne;
+
+    print("W:", LA_F("%s: impairment on (seed=%d): tx loss=%.3f delay=%dms rate=%dkbps, rx loss=%.3f delay=%dms rate=%dkbps", LA_F602, 602),
+          MOD_TAG, (int)seed, tx.loss, tx.delay_us / 1000, tx.rate_kbps, rx.loss, rx.delay_us / 1000, rx.rate_kbps);
+    return E_NONE;
+}
+
+void p2p_netem_free(struct p2p_instance *inst) {
+    p2p_netem_t *ne = inst->netem;
+    if (!ne) return;
+    inst->netem = NULL;
+    dir_clear(&ne->tx);
+    dir_clear(&ne->rx);
+    p2p_free(ne);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+int p2p_netem_send(struct p2p_instance *inst, int sock_idx, const struct sockaddr_in *addr,
+                   const void *data, int len) {
+    p2p_netem_t *ne = inst->netem;
+    NETEM_LOCK(ne);
+    dir_enqueue(&ne->tx, sock_idx, addr, data, len, P_tick_us());
+    NETEM_UNLOCK(ne);
+
+    // 无时延的包（仅丢包 / 复制）立即发出，不等下一轮 update
+    p2p_netem_flush(inst);
+    return len;
+}
+
+void p2p_netem_flush(struct p2p_instance *inst) {
+    p2p_netem_t *ne = inst->netem;
+    if (!ne || !ne->tx.cnt) return;
+
+    uint64_t now = P_tick_us();
+    for (;;) {
+        NETEM_LOCK(ne);
+        netem_pkt_t *p = heap_pop_due(&ne->tx, now);
+        NETEM_UNLOCK(ne);
+        if (!p) break;
+        // 套接字可能已关闭（索引越界），直接丢弃
+        if (p->sock_idx < inst->sock_cnt) p2p_udp_send_raw(inst, p->sock_idx, &p->addr, p->data, p->len);
+        p2p_free(p);
+    }
+}
+
+int p2p_netem_recv(struct p2p_instance *inst, struct p2p_udp_slot *slots, int cnt, int max) {
+    p2p_netem_t *ne = inst->netem;
+    uint64_t now = P_tick_us();
+
+    NETEM_LOCK(ne);
+    for (int i = 0; i < cnt; i++)
+        dir_enqueue(&ne->rx, slots[i].sock_idx, &slots[i].from, slots[i].buf, slots[i].len, now);
+
+    int n = 0;
+    netem_pkt_t *p;
+    while (n < max && (p = heap_pop_due(&ne->rx, now)) != NULL) {
+        p2p_udp_slot_t *slot = &slots[n++];
+        slot->from = p->addr;
+        slot->sock_idx = p->sock_idx;
+        slot->len = p->len;
+        slot->rx_us = now;                  // 延迟释放的包以释放时刻为接收时间
+        slot->ecn = 0;
+        memcpy(slot->buf, p->data, (size_t)p->len);
+        p2p_free(p);
+    }
+    NETEM_UNLOCK(ne);
+    return n;
+}
+
+int p2p_netem_next_timeout(struct p2p_instance *inst) {
+    p2p_netem_t *ne = inst->netem;
+    if (!ne) return -1;
+
+    NETEM_LOCK(ne);
+    uint64_t due = UINT64_MAX;
+    if (ne->tx.cnt) due = ne->tx.heap[0]->due_us;
+    if (ne->rx.cnt && ne->rx.heap[0]->due_us < due) due = ne->rx.heap[0]->due_us;
+    NETEM_UNLOCK(ne);
+    if (due == UINT64_MAX) return -1;
+
+    uint64_t now = P_tick_us();
+    return due <= now ? 0 : (int)((due - now + 999) / 1000);
+}
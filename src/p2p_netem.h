@@ -0,0 +1,95 @@
+/*
+ * UDP 网络损伤模拟（确定性 netem，用于性能测试中复现丢包、乱序、抖动与限速）
+ *
+ * 位于 p2p_udp 收发边界之后：发出的包（p2p_udp_send_to_sock / p2p_udp_send_msgs）进入 tx 队列，
+ * 读到的包（p2p_udp_recv_batch / p2p_udp_recv_from）进入 rx 队列，按各自方向的参数丢弃、复制、
+ * 延迟后再真正发出 / 交付。未启用时 inst->netem 为 NULL，收发路径只多一次指针判断。
+ * + 无需 root / tc：CI 中的基准与测试可直接复现弱网
+ * + 确定性：每个方向独立的随机数序列（由 seed 派生），同样的收发序列得到同样的丢弃 / 复制 / 乱序决定
+ *   （时延按真实时钟排队，到期时刻仍受调度影响）
+ *
+ * 启用：设置环境变量 P2P_NETEM（p2p_create 时读取），或内部调用 p2p_netem_config
+ *   spec = "key=value,..."，键加 tx. / rx. 前缀只作用于发送 / 接收方向，否则两个方向同时设置：
+ *     loss=0.02        丢包率（也可写 2%）
+ *     delay=20         固定时延（毫秒，可带小数）
+ *     jitter=5         时延抖动（毫秒）：dist=uniform 时均匀分布于 ±jitter，dist=normal 时为标准差
+ *     dist=uniform     抖动分布 uniform / normal
+ *     reorder=0.01     以该概率不经时延直接排到队首（越过队列中的包，与 tc netem 的 reorder 语义相同）
+ *     dup=0.001        重复：以该概率额外入队一份副本
+ *     rate=1000        带宽上限（kbit/s，0=不限）：包按长度串行化，排在前一个包之后
+ *     limit=1000       队列包数上限（满时尾部丢弃）
+ *     seed=1           随机种子（默认 1）
+ *   例：P2P_NETEM="delay=20,jitter=5,loss=1%,tx.rate=8000,seed=7"
+ *
+ * 限制：只作用于 UDP（TCP 打洞与 RELAY 信令连接不受影响）；启用后发送端绕过 sendmmsg / GSO 合并。
+ */
+
+#ifndef P2P_NETEM_H
+#define P2P_NETEM_H
+
+#include "predefine.h"
+
+struct p2p_instance;
+struct p2p_udp_slot;
+
+#define NETEM_LIMIT_DEFAULT     1000        /* 默认队列包数上限 */
+
+/* 单方向参数 */
+typedef struct {
+    float                   loss;           // 丢包率
+    float                   reorder;        // 越过时延直接发出的比例
+    float                   dup;            // 复制比例
+    int                     delay_us;       // 固定时延
+    int                     jitter_us;      // 抖动幅度（均匀 ±jitter / 正态标准差）
+    bool                    normal;         // 抖动分布：true=正态，false=均匀
+    int                     rate_kbps;      // 带宽上限，0=不限
+    int                     limit;          // 队列包数上限
+} p2p_netem_param_t;
+
+typedef struct netem_pkt netem_pkt_t;
+
+/* 单方向状态：按到期时刻排序的最小堆 */
+typedef struct {
+    p2p_netem_param_t       param;
+    bool                    on;             // 任一参数非零
+    uint64_t                rng;
+    uint64_t                link_free_us;   // 限速：链路空闲时刻
+    uint32_t                ord;            // 入队序号（同到期时刻保持先后）
+    netem_pkt_t**           heap;
+    int                     cnt, cap;
+
+    /* 统计 */
+    uint32_t                in;             // 进入的包
+    uint32_t                dropped;        // 丢弃（含队列满）
+    uint32_t                duplicated;
+    uint32_t                reordered;
+} p2p_netem_dir_t;
+
+typedef struct p2p_netem {
+    p2p_netem_dir_t         tx, rx;
+    volatile long           lock;           // tx 可能来自会话分片线程，两个方向共用一把自旋锁
+} p2p_netem_t;
+
+/* 解析 spec 并启用（spec 为 NULL 或空串时关闭并释放队列）；格式错误返回 E_INVALID，原配置不变 */
+ret_t p2p_netem_config(struct p2p_instance *inst, const char *spec);
+
+/* 关闭并释放队列（未发出的包丢弃） */
+void p2p_netem_free(struct p2p_instance *inst);
+
+/* 发送方向：数据包入 tx 队列（可能被丢弃），返回 len，与真实网络上的成功发送不可区分 */
+int  p2p_netem_send(struct p2p_instance *inst, int sock_idx, const struct sockaddr_in *addr,
+                    const void *data, int len);
+
+/* 发送方向：发出 tx 队列中已到期的包 */
+void p2p_netem_flush(struct p2p_instance *inst);
+
+/*
+ * 接收方向：slots[0..cnt) 为刚从套接字读到的包，全部进入 rx 队列；
+ * 之后把已到期的包（最多 max 个）写回 slots，返回写回数量
+ */
+int  p2p_netem_recv(struct p2p_instance *inst, struct p2p_udp_slot *slots, int cnt, int max);
+
+/* 两个队列中最早到期的包距今毫秒数，无排队包返回 -1 */
+int  p2p_netem_next_timeout(struct p2p_instance *inst);
+
+#endif /* P2P_NETEM_H */
@@ -0,0 +1,215 @@
+/*
+ * 叠加中继（经第三方对端中转，见 p2p_overlay.h 与 p2pp.h P2P_PKT_OVERLAY）
+ */
+
+#define MOD_TAG "OVERLAY"
+
+#include "p2p_internal.h"
+
+/* 可作为中转腿的会话：已连接在直连 UDP 路径上 */
+static bool leg_ok(const struct p2p_session *s) {
+    return s->state == P2P_STATE_CONNECTED
+        && (s->path_type == P2P_PATH_PUNCH || s->path_type == P2P_PATH_LAN)
+        && s->active_path >= 0 && s->active_path < s->remote_cand_cnt;
+}
+
+/* 腿会话活跃路径的发送套接字 */
+static inline int leg_sock(const struct p2p_session *s) {
+    return s->remote_cands[s->active_path].sock;
+}
+
+/* 经 s 的活跃路径发送 OVERLAY 控制包：[op][sess_id][peer_len][peer_id]（peer 为 NULL 时不含后两项） */
+static void send_ctl(struct p2p_session *s, uint8_t op, uint32_t id, const char *peer, uint64_t now_ms) {
+    uint8_t buf[P2P_PKT_OVERLAY_PSZ + 1 + P2P_PEER_ID_MAX];
+    int len = P2P_PKT_OVERLAY_PSZ;
+    buf[0] = op;
+    nwrite_l(buf + 1, id);
+    if (peer) {
+        int plen = (int)strnlen(peer, P2P_PEER_ID_MAX);
+        buf[len++] = (uint8_t)plen;
+        memcpy(buf + len, peer, plen);
+        len += plen;
+    }
+    p2p_send_packet(s, &s->active_addr, P2P_PKT_OVERLAY, 0, 0, buf, len, now_ms);
+}
+
+static void send_req(struct p2p_session *s, uint64_t now_ms) {
+    p2p_overlay_t *o = &s->overlay;
+    o->req_ms = now_ms;
+    if (!o->acked) o->tries++;
+    send_ctl(o->via, P2P_OVERLAY_OP_REQ, s->id, s->remote_peer_id, now_ms);
+}
+
+static void fwd_remove(struct p2p_instance *inst, int i) {
+    inst->overlay_fwd[i] = inst->overlay_fwd[--inst->overlay_cnt];
+}
+
+ret_t p2p_overlay_request(struct p2p_session *s, struct p2p_session *via, uint64_t now_ms) {
+
+    p2p_overlay_t *o = &s->overlay;
+    if (!via) {
+        memset(o, 0, sizeof(*o));
+        return E_NONE;
+    }
+    if (!s->inst->cfg.multi_session || via == s || via->inst != s->inst || !s->id || !leg_ok(via))
+        return E_INVALID;
+
+    o->via = via;
+    o->tries = 0;
+    o->acked = false;
+    send_req(s, now_ms);
+    print("I:", LA_F("request relay via %s for %s (ses_id=%u)", LA_F618, 618), via->remote_peer_id, s->remote_peer_id, s->id);
+    return E_NONE;
+}
+
+int p2p_overlay_cand_add(struct p2p_session *s, struct p2p_session *via) {
+
+    if (!leg_ok(via)) return E_NONE_CONTEXT;
+
+    int idx = p2p_find_remote_candidate_by_addr(s, &via->active_addr);
+    if (idx < 0) {
+        if ((idx = p2p_cand_push_remote(s)) < 0) return idx;
+        p2p_remote_candidate_entry_t *c = &s->remote_cands[idx];
+        c->addr = via->active_addr;
+        c->priority = 0;
+        c->last_punch_send_ms = 0;
+        c->check = NAT_CHECK_NONE;
+        path_stats_init(&c->stats, P2P_OVERLAY_COST);
+    } else if (s->remote_cands[idx].type == P2P_CAND_OVERLAY) {
+        s->remote_cands[idx].sock = (uint8_t)leg_sock(via);
+        return idx;
+    } else {
+        // 先经 PRFLX 学到的同一地址：改为 OVERLAY，地址不再作为派发依据
+        s->remote_cands[idx].stats.cost_score = P2P_OVERLAY_COST;
+        if (idx == s->active_path) p2p_session_bind_addr(s, NULL);
+    }
+
+    p2p_remote_candidate_entry_t *c = &s->remote_cands[idx];
+    c->type = P2P_CAND_OVERLAY;
+    c->sock = (uint8_t)leg_sock(via);
+    print("I:", LA_F("%s: cand[%d]<%s:%d> via %s", LA_F619, 619), s->remote_peer_id, idx,
+          inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port), via->remote_peer_id);
+    return idx;
+}
+
+/* 中转端：登记 s（请求方腿）与 peer_id 对应会话之间的转发 */
+static uint8_t on_req(struct p2p_session *s, uint32_t id, const char *peer, int plen, uint64_t now_ms) {
+
+    struct p2p_instance *inst = s->inst;
+    if (!inst->cfg.overlay_relay || !inst->cfg.multi_session || !leg_ok(s) || !id) return P2P_OVERLAY_OP_NAK;
+    if (p2p_session_find(inst, id)) return P2P_OVERLAY_OP_NAK;     // 本端自己的会话，不转发
+
+    struct p2p_session *b = NULL;
+    for (struct p2p_session *ss = inst->sessions_head; ss; ss = ss->next) {
+        if (ss != s && !strncmp(ss->remote_peer_id, peer, plen) && !ss->remote_peer_id[plen]) { b = ss; break; }
+    }
+    if (!b || !leg_ok(b)) return P2P_OVERLAY_OP_NAK;
+
+    p2p_overlay_fwd_t *f = NULL;
+    for (int i = 0; i < inst->overlay_cnt; i++) {
+        if (inst->overlay_fwd[i].id == id) { f = &inst->overlay_fwd[i]; break; }
+    }
+    if (!f) {
+        if (inst->overlay_cnt >= P2P_OVERLAY_MAX) {
+            print("W:", LA_F("relay table full, ses_id=%u rejected", LA_F620, 620), id);
+            return P2P_OVERLAY_OP_NAK;
+        }
+        f = &inst->overlay_fwd[inst->overlay_cnt++];
+        print("I:", LA_F("relaying ses_id=%u between %s and %s", LA_F621, 621), id, s->remote_peer_id, b->remote_peer_id);
+    }
+    f->id = id;
+    f->leg[0] = s;
+    f->leg[1] = b;
+    f->last_ms = now_ms;
+    return P2P_OVERLAY_OP_ACK;
+}
+
+void p2p_overlay_on_packet(struct p2p_session *s, const uint8_t *payload, int len, uint64_t now_ms) {
+
+    if (len < (int)P2P_PKT_OVERLAY_PSZ) return;
+    uint8_t op = payload[0];
+    uint32_t id = nget_l(payload + 1);
+
+    if (op == P2P_OVERLAY_OP_REQ) {
+        if (len < (int)P2P_PKT_OVERLAY_PSZ + 1) return;
+        int plen = payload[P2P_PKT_OVERLAY_PSZ];
+        if (!plen || plen >= P2P_PEER_ID_MAX || len < (int)P2P_PKT_OVERLAY_PSZ + 1 + plen) return;
+        send_ctl(s, on_req(s, id, (const char *)payload + P2P_PKT_OVERLAY_PSZ + 1, plen, now_ms), id, NULL, now_ms);
+        return;
+    }
+
+    // 请求端：应答须来自发出请求的中转会话
+    struct p2p_session *t = p2p_session_find(s->inst, id);
+    if (!t || t->overlay.via != s) return;
+
+    if (op == P2P_OVERLAY_OP_NAK) {
+        print("W:", LA_F("relay via %s refused for %s", LA_F622, 622), s->remote_peer_id, t->remote_peer_id);
+        memset(&t->overlay, 0, sizeof(t->overlay));
+        return;
+    }
+    if (op != P2P_OVERLAY_OP_ACK) return;
+
+    bool first = !t->overlay.acked;
+    t->overlay.acked = true;
+    int idx = p2p_overlay_cand_add(t, s);
+    if (first && idx >= 0) nat_punch(t, idx);
+}
+
+bool p2p_overlay_forward(struct p2p_instance *inst, uint32_t id, const uint8_t *pkt, int n,
+                         const struct sockaddr_in *from, uint64_t now_ms) {
+
+    for (int i = 0; i < inst->overlay_cnt; i++) { p2p_overlay_fwd_t *f = &inst->overlay_fwd[i];
+        if (f->id != id) continue;
+
+        for (int k = 0; k < 2; k++) {
+            struct p2p_session *out = f->leg[k ^ 1];
+            if (!sockaddr_equal(from, &f->leg[k]->active_addr)) continue;
+            if (!leg_ok(out)) return true;
+
+            p2p_packet_hdr_t hdr;
+            p2p_pkt_hdr_decode(pkt, &hdr);
+            f->last_ms = now_ms;
+            p2p_udp_send_packet_sock(inst, leg_sock(out), &out->active_addr, hdr.type, hdr.flags, hdr.seq,
+                                     pkt + P2P_HDR_SIZE, n - P2P_HDR_SIZE);
+            return true;
+        }
+        return true;    // 来源不是任一腿的活跃地址
+    }
+    return false;
+}
+
+void p2p_overlay_tick(struct p2p_instance *inst, uint64_t now_ms) {
+
+    // 请求端：未确认时按间隔重发，确认后每半个空闲期刷新一次（中转端表项据此续期或重建）
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) { p2p_overlay_t *o = &s->overlay;
+        if (!o->via) continue;
+        uint64_t gap = o->acked ? P2P_OVERLAY_IDLE_MS / 2 : P2P_OVERLAY_RETRY_MS;
+        if (tick_diff(now_ms, o->req_ms) < gap) continue;
+        if (!o->acked && o->tries >= P2P_OVERLAY_TRIES) {
+            print("W:", LA_F("relay via %s not answered, giving up", LA_F623, 623), o->via->remote_peer_id);
+            memset(o, 0, sizeof(*o));
+            continue;
+        }
+        if (leg_ok(o->via)) send_req(s, now_ms);
+        else o->req_ms = now_ms;
+    }
+
+    // 中转端：空闲或任一腿不再直连的表项
+    for (int i = inst->overlay_cnt - 1; i >= 0; i--) { p2p_overlay_fwd_t *f = &inst->overlay_fwd[i];
+        if (tick_diff(now_ms, f->last_ms) >= P2P_OVERLAY_IDLE_MS || !leg_ok(f->leg[0]) || !leg_ok(f->leg[1])) {
+            print("V:", LA_F("relay ses_id=%u expired", LA_F624, 624), f->id);
+            fwd_remove(inst, i);
+        }
+    }
+}
+
+void p2p_overlay_unlink(struct p2p_session *s) {
+
+    struct p2p_instance *inst = s->inst;
+    for (struct p2p_session *ss = inst->sessions_head; ss; ss = ss->next) {
+        if (ss->overlay.via == s) memset(&ss->overlay, 0, sizeof(ss->overlay));
+    }
+    for (int i = inst->overlay_cnt - 1; i >= 0; i--) {
+        if (inst->overlay_fwd[i].leg[0] == s || inst->overlay_fwd[i].leg[1] == s) fwd_remove(inst, i);
+    }
+}
@@ -0,0 +1,67 @@
+/*
+ * 叠加中继（经第三方对端中转，协议见 p2pp.h P2P_PKT_OVERLAY）
+ *
+ * A、B 无法直连而二者都与 C 直连时，由 C 在两条直连腿之间原样转发 A↔B 会话的包，
+ * 代替 TURN / 信令服务器中转：
+ *   - 请求端（A，p2p_session_via）：经 A↔C 会话发出 REQ，C 确认后以 C 的地址登记
+ *     P2P_CAND_OVERLAY 候选（发送套接字同 A↔C 的活跃路径），照常打洞检查、测 RTT，
+ *     按路径类型 P2P_PATH_OVERLAY 参与选路（中继类候选，优先于 TURN）
+ *   - 中转端（C，cfg.overlay_relay）：登记 sess_id → 两条腿会话的转发表，C 本地无此会话 ID 的包
+ *     来自一条腿的活跃地址时转发到另一条腿
+ *   - 对端（B）：收到携带 A↔B 会话 ID、来源为 B↔C 会话地址的包时，自动登记 OVERLAY 候选
+ *
+ * 经 OVERLAY 路径的包始终携带 session_id（C 据此转发、B 据此派发），候选地址不登记地址索引。
+ * 三方均须为 multi_session 实例；表项、请求均由控制阶段（持全部会话锁）处理。
+ */
+#ifndef P2P_OVERLAY_H
+#define P2P_OVERLAY_H
+
+#include "predefine.h"
+
+struct p2p_session;
+struct p2p_instance;
+
+#define P2P_OVERLAY_MAX          16         /* 中转端转发表项上限 */
+#define P2P_OVERLAY_IDLE_MS      30000      /* 转发表项无流量超时 */
+#define P2P_OVERLAY_RETRY_MS     1000       /* 请求未确认时的重发间隔 */
+#define P2P_OVERLAY_TRIES        5          /* 请求最多发送次数 */
+#define P2P_OVERLAY_COST         2          /* OVERLAY 路径成本分（无服务器成本，但占用第三方带宽；TURN 为 8+） */
+
+/* 中转端转发表项 */
+typedef struct {
+    uint32_t            id;                     // 被中转会话 ID（A↔B）
+    struct p2p_session* leg[2];                 // 两条腿会话（C↔A、C↔B）
+    uint64_t            last_ms;                // 最近一次转发（或登记）时间
+} p2p_overlay_fwd_t;
+
+/* 请求端状态（会话级） */
+typedef struct {
+    struct p2p_session* via;                    // 中转会话（NULL = 未请求）
+    uint64_t            req_ms;                 // 最近一次发出 REQ 的时间
+    uint8_t             tries;                  // 已发送 REQ 次数
+    bool                acked;                  // 中转端已确认
+} p2p_overlay_t;
+
+/* 请求 via 的对端为 s 中转（p2p_session_via；via = NULL 取消） */
+ret_t p2p_overlay_request(struct p2p_session *s, struct p2p_session *via, uint64_t now_ms);
+
+/* 处理 OVERLAY 控制包（s 为收包会话，payload 不含多会话 session_id） */
+void  p2p_overlay_on_packet(struct p2p_session *s, const uint8_t *payload, int len, uint64_t now_ms);
+
+/*
+ * 中转端：按转发表转发携带 session_id = id 的包（pkt/n 为完整包）。
+ * 返回 true 表示该 ID 在转发表中（已转发或因来源不符丢弃），调用方不再处理
+ */
+bool  p2p_overlay_forward(struct p2p_instance *inst, uint32_t id, const uint8_t *pkt, int n,
+                          const struct sockaddr_in *from, uint64_t now_ms);
+
+/* 以 via 的活跃地址登记（或将同地址候选转为）s 的 OVERLAY 候选，返回候选索引，失败返回负值 */
+int   p2p_overlay_cand_add(struct p2p_session *s, struct p2p_session *via);
+
+/* 控制阶段：请求重发、转发表过期 */
+void  p2p_overlay_tick(struct p2p_instance *inst, uint64_t now_ms);
+
+/* 会话释放前：清除引用该会话的请求与转发表项 */
+void  p2p_overlay_unlink(struct p2p_session *s);
+
+#endif /* P2P_OVERLAY_H */
@@ -0,0 +1,172 @@
+/*
+ * 路径缓存（0-RTT 重连，见 p2p.h p2p_path_hint_t 与 p2p_path_manager.h）
+ *
+ * 文件格式（path_cache_file，每行一个对端，整体重写）：
+ *   <ip>:<port> <local_port> <path_type> <stamp> <peer_id>
+ * peer_id 放在行尾，可包含空格。
+ */
+
+#define MOD_TAG "PATH"
+
+#include "p2p_internal.h"
+
+static p2p_path_entry_t *cache_find(p2p_path_cache_t *c, const char *peer_id) {
+    for (int i = 0; i < P2P_PATH_CACHE_SLOTS; i++) {
+        if (c->slots[i].peer_id[0] && !strncmp(c->slots[i].peer_id, peer_id, P2P_PEER_ID_MAX))
+            return &c->slots[i];
+    }
+    return NULL;
+}
+
+/* 按 peer_id 取槽位：优先已有、其次空闲，否则替换最早记录的 */
+static p2p_path_entry_t *cache_slot(p2p_path_cache_t *c, const char *peer_id) {
+
+    p2p_path_entry_t *e = cache_find(c, peer_id);
+    if (e) return e;
+
+    e = &c->slots[0];
+    for (int i = 0; i < P2P_PATH_CACHE_SLOTS && e->peer_id[0]; i++) {
+        if (!c->slots[i].peer_id[0] || c->slots[i].hint.stamp < e->hint.stamp) e = &c->slots[i];
+    }
+    memset(e, 0, sizeof(*e));
+    strncpy(e->peer_id, peer_id, P2P_PEER_ID_MAX - 1);
+    return e;
+}
+
+static void cache_load(p2p_path_cache_t *c, const char *path) {
+
+    FILE *fp = fopen(path, "r");
+    if (!fp) return;                            // 首次运行，文件尚不存在
+
+    char line[64 + P2P_PEER_ID_MAX], ip[16];
+    unsigned port, local_port, type; unsigned long long stamp;
+    int n = 0;
+    while (fgets(line, sizeof(line), fp)) {
+
+        int off = 0;
+        if (sscanf(line, "%15[0-9.]:%u %u %u %llu %n", ip, &port, &local_port, &type, &stamp, &off) != 5 || !off)
+            continue;
+        char *id = line + off;
+        id[strcspn(id, "\r\n")] = '\0';
+
+        struct in_addr a;
+        if (!id[0] || port > 65535 || local_port > 65535 || inet_pton(AF_INET, ip, &a) != 1) continue;
+
+        p2p_path_entry_t *e = cache_slot(c, id);
+        e->hint.remote_ip = a.s_addr;
+        e->hint.remote_port = htons((uint16_t)port);
+        e->hint.local_port = (uint16_t)local_port;
+        e->hint.path_type = (uint8_t)type;
+        e->hint.stamp = stamp;
+        n++;
+    }
+    fclose(fp);
+
+    print("I:", LA_F("path cache: %d entries loaded from %s", LA_F517, 517), n, path);
+}
+
+static void cache_store(const p2p_path_cache_t *c, const char *path) {
+
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        print("W:", LA_F("path cache: write %s failed", LA_F518, 518), path);
+        return;
+    }
+    for (int i = 0; i < P2P_PATH_CACHE_SLOTS; i++) {
+        const p2p_path_entry_t *e = &c->slots[i];
+        if (!e->peer_id[0]) continue;
+        struct in_addr a; a.s_addr = e->hint.remote_ip;
+        fprintf(fp, "%s:%u %u %u %llu %s\n", inet_ntoa(a), ntohs(e->hint.remote_port),
+                e->hint.local_port, e->hint.path_type, (unsigned long long)e->hint.stamp, e->peer_id);
+    }
+    fclose(fp);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+ret_t p2p_path_cache_create(struct p2p_instance *inst) {
+
+    p2p_path_cache_t *c = (p2p_path_cache_t *)p2p_calloc(1, sizeof(*c));
+    if (!c) return E_OUT_OF_MEMORY;
+#ifdef P2P_THREADED
+    if (P_mutex_init(&c->mtx) != 0) { p2p_free(c); return E_OUT_OF_MEMORY; }
+#endif
+    if (inst->cfg.path_cache_file) cache_load(c, inst->cfg.path_cache_file);
+    inst->path_cache = c;
+    return E_NONE;
+}
+
+void p2p_path_cache_free(struct p2p_instance *inst) {
+
+    p2p_path_cache_t *c = inst->path_cache;
+    if (!c) return;
+#ifdef P2P_THREADED
+    P_mutex_final(&c->mtx);
+#endif
+    p2p_free(c);
+    inst->path_cache = NULL;
+}
+
+bool p2p_path_cache_get(struct p2p_instance *inst, const char *peer_id, p2p_path_hint_t *hint) {
+
+    p2p_path_cache_t *c = inst->path_cache;
+    if (!c || !peer_id || !peer_id[0]) return false;
+
+    if (inst->cfg.on_path_load && inst->cfg.on_path_load(peer_id, hint, inst->cfg.userdata)) return true;
+
+    bool found = false;
+#ifdef P2P_THREADED
+    P_mutex_lock(&c->mtx);
+#endif
+    p2p_path_entry_t *e = cache_find(c, peer_id);
+    if (e) {
+        if ((uint64_t)time(NULL) - e->hint.stamp >= P2P_PATH_CACHE_TTL_S) memset(e, 0, sizeof(*e));
+        else { *hint = e->hint; found = true; }
+    }
+#ifdef P2P_THREADED
+    P_mutex_unlock(&c->mtx);
+#endif
+    return found;
+}
+
+void p2p_path_cache_put(struct p2p_instance *inst, const char *peer_id, const p2p_path_hint_t *hint) {
+
+    p2p_path_cache_t *c = inst->path_cache;
+    if (!c || !peer_id || !peer_id[0]) return;
+
+#ifdef P2P_THREADED
+    P_mutex_lock(&c->mtx);
+#endif
+    p2p_path_entry_t *e = cache_slot(c, peer_id);
+    // 路径不变时只刷新内存中的时间戳，文件按 P2P_PATH_CACHE_FLUSH_S 间隔刷新
+    bool changed = e->hint.remote_ip != hint->remote_ip || e->hint.remote_port != hint->remote_port
+                || e->hint.local_port != hint->local_port || e->hint.path_type != hint->path_type
+                || hint->stamp - e->hint.stamp >= P2P_PATH_CACHE_FLUSH_S;
+    e->hint = *hint;
+    if (changed && inst->cfg.path_cache_file) cache_store(c, inst->cfg.path_cache_file);
+#ifdef P2P_THREADED
+    P_mutex_unlock(&c->mtx);
+#endif
+
+    if (inst->cfg.on_path_save) inst->cfg.on_path_save(peer_id, hint, inst->cfg.userdata);
+}
+
+void p2p_path_cache_drop(struct p2p_instance *inst, const char *peer_id) {
+
+    p2p_path_cache_t *c = inst->path_cache;
+    if (!c || !peer_id || !peer_id[0]) return;
+
+#ifdef P2P_THREADED
+    P_mutex_lock(&c->mtx);
+#endif
+    p2p_path_entry_t *e = cache_find(c, peer_id);
+    if (e) {
+        memset(e, 0, sizeof(*e));
+        if (inst->cfg.path_cache_file) cache_store(c, inst->cfg.path_cache_file);
+    }
+#ifdef P2P_THREADED
+    P_mutex_unlock(&c->mtx);
+#endif
+
+    if (inst->cfg.on_path_save) inst->cfg.on_path_save(peer_id, NULL, inst->cfg.userdata);
+}
@@ -60,6 +60,8 @@
  *   数据流：on_packet_send 记录 seq→时间到 pending_packets[] 环形队列（最多32）→
  *   on_packet_ack 计算 RTT 并写入 rt_samples[10] 滑动窗口 → update_metrics
  *   更新 EWMA。path_manager_tick 扫描超时包并递增丢包计数。
+ *   对端回显 PUNCH 时间戳后改走 on_echo_send / on_echo：RTT 直接由回显字段算出，
+ *   丢包按每路径两个计数窗口统计，不再占用 pending 队列。
  *
  *   要点：计数器(sent/lost/timeouts) 只在 send/loss/recv 中修改，
  *         update_metrics 只做指标计算，避免双重计数。
@@ -98,6 +100,7 @@
 /* 前向声明 */
 static void update_metrics(path_stats_t *p);
 static void update_quality(path_stats_t *p);
+static void rt_direct_sample(path_stats_t *p, uint32_t rtt_us);
 
 /* 默认参数 */
 #define DEFAULT_PROBE_INTERVAL_MS       1000    /* 1秒探测间隔 */
@@ -160,13 +163,17 @@ int path_manager_init(struct p2p_session *s, p2p_path_strategy_t strategy) {
     pm->turn_config.use_as_last_resort = true;
 
     /* 按路径类型初始化独立阈值（rtt_ms, loss, cooldown_ms, stability_ms） */
-    pm->thresholds[P2P_PATH_NONE]      = (path_threshold_config_t){50,   0.05f, 5000, 2000};
-    pm->thresholds[P2P_PATH_LAN]       = (path_threshold_config_t){20,   0.02f, 1000, 1000}; /* 积极切回 LAN */
-    pm->thresholds[P2P_PATH_PUNCH]     = (path_threshold_config_t){50,   0.05f, 3000, 2000}; /* 标准阈值 */
-    pm->thresholds[P2P_PATH_RELAY]     = (path_threshold_config_t){100,  0.10f, 5000, 3000}; /* 保守，有成本 */
-    pm->thresholds[P2P_PATH_SIGNALING] = (path_threshold_config_t){200,  0.15f, 8000, 4000}; /* 最终降级，极保守 */
-    
-    pm->start_time_ms = P_tick_ms();
+    pm->thresholds[P2P_PATH_NONE]      = (path_threshold_config_t){50,   0.05f, 5000, 2000, 0.0f};
+    pm->thresholds[P2P_PATH_LAN]       = (path_threshold_config_t){20,   0.02f, 1000, 1000, 0.3f}; /* 积极切回 LAN */
+    pm->thresholds[P2P_PATH_PUNCH]     = (path_threshold_config_t){50,   0.05f, 3000, 2000, 0.3f}; /* 标准阈值 */
+    pm->thresholds[P2P_PATH_RELAY]     = (path_threshold_config_t){100,  0.10f, 5000, 3000, 0.4f}; /* 保守，有成本 */
+    pm->thresholds[P2P_PATH_SIGNALING] = (path_threshold_config_t){200,  0.15f, 8000, 4000, 0.0f}; /* 最终降级，极保守 */
+    pm->thresholds[P2P_PATH_TCP]       = (path_threshold_config_t){100,  0.10f, 5000, 3000, 0.4f}; /* 与 TURN 同等保守 */
+    pm->thresholds[P2P_PATH_OVERLAY]   = (path_threshold_config_t){80,   0.08f, 4000, 2500, 0.3f}; /* 多一跳，介于直连与 TURN 之间 */
+    pm->thresholds[P2P_PATH_SHM]       = (path_threshold_config_t){10,   0.01f,  500,  500, 0.3f}; /* 本机内存拷贝，最积极切回 */
+    pm->prewarm_path = PATH_IDX_NONE;
+    
+    pm->start_time_ms = p2p_now_ms();
     
     return 0;
 }
@@ -188,7 +195,7 @@ void path_manager_reset(struct p2p_session *s) {
     /* 重置统计信息 */
     pm->total_switches = 0;
     pm->total_failovers = 0;
-    pm->start_time_ms = P_tick_ms();
+    pm->start_time_ms = p2p_now_ms();
     
     /* 清空待跟踪包队列 */
     memset(pm->pending_packets, 0, sizeof(pm->pending_packets));
@@ -203,6 +210,8 @@ void path_manager_reset(struct p2p_session *s) {
     /* 重置防抖动 */
     pm->debounce_timer_ms = 0;
     pm->pending_switch_path = -2;
+    pm->prewarm_path = PATH_IDX_NONE;
+    pm->prewarm_ms = 0;
 }
 
 /*
@@ -227,6 +236,7 @@ void path_stats_init(path_stats_t *st, int cost_score) {
     st->rt_rtt_direct_rttvar = 0;       /* 未测量：等待首次测量后初始化 */
     st->rt_rtt_cross = 0;               /* 未测量：等待跨路径测量 */
     st->data_rtt = 0;                   /* 未测量：等待数据层 SRTT */
+    st->data_rtt_ms = 0;                /* 无被动样本：等待数据 ACK */
     
     st->rtt_ms = 100;       /* 初始估计 100ms（避免新路径被忽略） */
     st->rtt_min = 9999;     /* 等待首次测量 */
@@ -323,7 +333,7 @@ static int select_path_connection_first(struct p2p_session *s) {
                 best_direct = i;
             }
         } else {
-            /* 中继类候选（既非 TURN 也非直连） */
+            /* 中继类候选（既非 TURN 也非直连，如 TCP 打洞连接、叠加中继） */
             if (st->rtt_ms < best_relay_rtt) {
                 best_relay_rtt = st->rtt_ms;
                 best_relay_cand = i;
@@ -365,12 +375,20 @@ static int select_path_connection_first(struct p2p_session *s) {
 /*
  * 策略 2: PERFORMANCE_FIRST（传输效率优先）
  *   综合评分：0.5×RTT + 0.3×丢包 + 0.2×抖动，中继成本打折
+ *   有数据层带宽样本时加入带宽项（相对已测最大带宽）
  */
 static int select_path_performance_first(struct p2p_session *s) {
     path_manager_t *pm = &s->path_mgr;
     int best_path = -2;
     float best_score = -1.0f;
 
+    /* 已测得带宽的路径中的最大值（带宽评分基准，0=均未测量） */
+    uint64_t max_bw = 0;
+    for (int i = 0; i < s->remote_cand_cnt; i++) {
+        path_stats_t *st = &s->remote_cands[i].stats;
+        if (path_is_selectable(st->state) && st->bandwidth_bps > max_bw) max_bw = st->bandwidth_bps;
+    }
+
     /* 评估所有候选 */
     for (int i = 0; i < s->remote_cand_cnt; i++) {
         path_stats_t *st = &s->remote_cands[i].stats;
@@ -385,7 +403,14 @@ static int select_path_performance_first(struct p2p_session *s) {
         float rtt_score = 1.0f - fminf((float)st->rtt_ms / 500.0f, 1.0f);
         float loss_score = 1.0f - st->loss_rate;
         float jitter_score = 1.0f - fminf((float)st->rtt_variance / 100.0f, 1.0f);
-        float score = 0.5f * rtt_score + 0.3f * loss_score + 0.2f * jitter_score;
+        float score;
+        if (max_bw > 0) {
+            /* 有数据层带宽样本：0.4×RTT + 0.25×丢包 + 0.15×抖动 + 0.2×带宽（未测量按 0.5） */
+            float bw_score = st->bandwidth_bps ? (float)st->bandwidth_bps / (float)max_bw : 0.5f;
+            score = 0.4f * rtt_score + 0.25f * loss_score + 0.15f * jitter_score + 0.2f * bw_score;
+        } else {
+            score = 0.5f * rtt_score + 0.3f * loss_score + 0.2f * jitter_score;
+        }
 
         /* 成本惩罚：中继/TURN 路径打八折 */
         if (type != P2P_PATH_LAN && type != P2P_PATH_PUNCH) score *= 0.8f;
@@ -408,7 +433,7 @@ static int select_path_performance_first(struct p2p_session *s) {
 
 /*
  * 策略 3: HYBRID（混合模式）
- *   平衡延迟和成本：直连良好用直连，中继显著更优时才切换
+ *   平衡延迟和成本：直连良好用直连，中继显著更优（延迟/丢包/吞吐）时才切换
  */
 static int select_path_hybrid(struct p2p_session *s) {
     path_manager_t *pm = &s->path_mgr;
@@ -417,8 +442,10 @@ static int select_path_hybrid(struct p2p_session *s) {
     int best_turn = -2;
     uint32_t direct_rtt = UINT32_MAX;
     float direct_loss = 1.0f;
+    uint64_t direct_bw = 0;
     uint32_t relay_rtt = UINT32_MAX;
     float relay_loss = 1.0f;
+    uint64_t relay_bw = 0;
 
     uint32_t turn_rtt = UINT32_MAX;
 
@@ -437,6 +464,7 @@ static int select_path_hybrid(struct p2p_session *s) {
             if (st->rtt_ms < direct_rtt) {
                 direct_rtt = st->rtt_ms;
                 direct_loss = st->loss_rate;
+                direct_bw = st->bandwidth_bps;
                 best_direct = i;
             }
         } else {
@@ -444,6 +472,7 @@ static int select_path_hybrid(struct p2p_session *s) {
             if (st->rtt_ms < relay_rtt) {
                 relay_rtt = st->rtt_ms;
                 relay_loss = st->loss_rate;
+                relay_bw = st->bandwidth_bps;
                 best_relay = i;
             }
         }
@@ -466,10 +495,12 @@ static int select_path_hybrid(struct p2p_session *s) {
 
         /* 中继显著更好且自身质量可接受时才切换 */
         /* 中继丢包率阈值：使用配置值的2倍（允许中继有额外开销） */
+        /* 两者都有带宽样本且中继吞吐达直连 2 倍以上，同样视为显著更好 */
         bool relay_acceptable = relay_loss < thr->loss_threshold * 2.0f;
+        bool relay_faster = direct_bw > 0 && relay_bw > direct_bw * 2;
         if (relay_acceptable && 
             (relay_rtt + thr->rtt_threshold_ms < direct_rtt ||
-             direct_loss > thr->loss_threshold))
+             direct_loss > thr->loss_threshold || relay_faster))
             return best_relay;
 
         /* 差距不大：优先直连（节省成本） */
@@ -491,10 +522,20 @@ static int select_path_hybrid(struct p2p_session *s) {
     return -2; /* 无可用路径 */
 }
 
+/* 可用的同主机共享内存路径（不经网络、成本最低，任何策略下都优先） */
+static int select_path_shm(struct p2p_session *s) {
+    for (int i = 0; i < s->remote_cand_cnt; i++) {
+        if (s->remote_cands[i].type == P2P_CAND_SHM && path_is_selectable(s->remote_cands[i].stats.state)) return i;
+    }
+    return -2;
+}
+
 /*
  * 选择最佳路径（根据策略分发）
  */
 int path_manager_select_best_path(struct p2p_session *s) {
+    int shm = select_path_shm(s);
+    if (shm >= 0) return shm;
     switch (s->path_mgr.strategy) {
         default:
         case P2P_PATH_STRATEGY_CONNECTION_FIRST:
@@ -506,6 +547,60 @@ int path_manager_select_best_path(struct p2p_session *s) {
     }
 }
 
+int path_manager_select_backup_path(struct p2p_session *s) {
+    path_stats_t *cur = p2p_get_path_stats(s, s->active_path);
+    if (!cur) return PATH_IDX_NONE;
+
+    // 活跃路径暂置为不可选，其余路径按同一策略竞选（选择过程无副作用，随即恢复）
+    path_state_t saved = cur->state;
+    cur->state = PATH_STATE_FAILED;
+    int idx = path_manager_select_best_path(s);
+    cur->state = saved;
+    return idx == s->active_path ? PATH_IDX_NONE : idx;
+}
+
+bool path_manager_quality_falling(struct p2p_session *s) {
+    path_stats_t *p = p2p_get_path_stats(s, s->active_path);
+    if (!p) return false;
+    return p->state == PATH_STATE_DEGRADED || p->quality_trend < -P2P_REDUNDANT_TREND;
+}
+
+int path_manager_predict(struct p2p_session *s, uint64_t now_ms) {
+    path_manager_t *pm = &s->path_mgr;
+    path_stats_t *cur = p2p_get_path_stats(s, s->active_path);
+    if (!s->inst->cfg.path_predictive || !cur) return PATH_IDX_NONE;
+
+    float thr = pm->thresholds[s->path_type].trend_threshold;
+    if (thr <= 0.0f || (cur->state != PATH_STATE_DEGRADED && cur->quality_trend >= -thr)) {
+        pm->prewarm_path = PATH_IDX_NONE;
+        return PATH_IDX_NONE;
+    }
+
+    int b = path_manager_select_backup_path(s);
+    if (b == PATH_IDX_NONE) return PATH_IDX_NONE;
+    if (b != pm->prewarm_path) {
+        print("V:", "path_manager: active path[%d] trend=%.2f, prewarm backup path[%d]",
+              s->active_path, cur->quality_trend, b);
+        pm->prewarm_path = b;
+        pm->prewarm_ms = 0;
+    }
+    if (b >= 0 && (!pm->prewarm_ms || tick_diff(now_ms, pm->prewarm_ms) >= P2P_PREWARM_INTERVAL_MS)) {
+        nat_probe(s, b, now_ms);
+        pm->prewarm_ms = now_ms;
+    }
+
+    // 首个劣化迹象即切换：备用路径须已有测量、自身未恶化，且不慢于活跃路径的最新样本
+    path_stats_t *bs = p2p_get_path_stats(s, b);
+    uint32_t brtt = get_effective_rtt(bs);
+    if (brtt == UINT32_MAX || bs->quality_trend < -thr) return PATH_IDX_NONE;
+    if (cur->state != PATH_STATE_DEGRADED) {
+        uint32_t crtt = get_effective_rtt(cur);
+        if (cur->rt_rtt_direct > crtt) crtt = cur->rt_rtt_direct;
+        if (brtt > crtt) return PATH_IDX_NONE;
+    }
+    return b;
+}
+
 /*
  * 检查是否应该防抖（避免频繁切换）
  *   三级检查：冷却期 → 频率检测 → 稳定窗口
@@ -516,7 +611,8 @@ static bool should_debounce_switch(struct p2p_session *s, int target_path, uint6
     
     // 1. 冷却期检查：根据目标路径类型取对应的冷却时间
     p2p_path_type_t target_type = p2p_get_path_type(s, target_path);
-    uint64_t cooldown = pm->thresholds[target_type].cooldown_ms;
+    uint64_t cooldown = (uint64_t)p2p_tune(s, P2P_TUNE_PATH_COOLDOWN_MS);
+    if (cooldown == 0) cooldown = pm->thresholds[target_type].cooldown_ms;
     if (cooldown == 0) cooldown = DEFAULT_COOLDOWN_MS;
     if (tick_diff(now_ms, pm->last_switch_time) < cooldown) {
         return true;
@@ -528,10 +624,16 @@ static bool should_debounce_switch(struct p2p_session *s, int target_path, uint6
         return true;
     }
     
+    // 预测式切换的目标已在预热中确认可用：不再等待稳定窗口
+    if (s->inst->cfg.path_predictive && target_path == pm->prewarm_path) {
+        return false;
+    }
+
     // 3. 稳定窗口检查：根据目标路径类型取对应的稳定窗口
-    uint32_t stability_ms = pm->thresholds[target_type].stability_window_ms > 0
-                          ? pm->thresholds[target_type].stability_window_ms
-                          : DEFAULT_STABILITY_WINDOW_MS;
+    uint32_t stability_ms = (uint32_t)p2p_tune(s, P2P_TUNE_PATH_STABILITY_MS);
+    if (stability_ms == 0) stability_ms = pm->thresholds[target_type].stability_window_ms > 0
+                                        ? pm->thresholds[target_type].stability_window_ms
+                                        : DEFAULT_STABILITY_WINDOW_MS;
 
     if (pm->pending_switch_path >= -1) {
 
@@ -567,6 +669,7 @@ static void record_switch(struct p2p_session *s, int from_path, int to_path,
     rec->to_path = to_path;
     rec->timestamp_ms = now_ms;
     rec->reason = reason ? reason : "unknown";
+    P2P_TRACE(s, P2P_TRACE_PATH, 0, 0, from_path, to_path, 0, 0, rec->reason);
 
     path_stats_t *fs = p2p_get_path_stats(s, from_path);
     if (fs) {
@@ -670,12 +773,13 @@ int path_manager_set_path_state(struct p2p_session *s, int path_idx, path_state_
     
     // 设置路径为有效时，需要将 last_recv_ms 初始化为当前时刻（避免无法正确触发超时）
     if (state == PATH_STATE_ACTIVE && stats->last_recv_ms == 0) {
-        stats->last_recv_ms = P_tick_ms();
+        stats->last_recv_ms = p2p_now_ms();
     }
+    if (path_is_selectable(state)) stats->fail_rounds = 0;
     
     // 如果路径变为 FAILED，记录当前时间戳（health_check 会基于此判断是否进入 RECOVERING）
     if (state == PATH_STATE_FAILED && stats->state != PATH_STATE_FAILED) {
-        stats->state_timestamp_ms = P_tick_ms();
+        stats->state_timestamp_ms = p2p_now_ms();
     }
     
     stats->state = state;
@@ -687,16 +791,17 @@ int path_manager_set_path_state(struct p2p_session *s, int path_idx, path_state_
  */
 int path_manager_set_threshold(struct p2p_session *s, int path_type,
                                 uint32_t rtt_ms, float loss_rate,
-                                uint64_t cooldown_ms, uint32_t stability_ms) {
+                                uint64_t cooldown_ms, uint32_t stability_ms, float trend) {
     path_manager_t *pm = &s->path_mgr;
 
-    // 有效类型范围：P2P_PATH_NONE(0) ~ P2P_PATH_SIGNALING(4)
-    if (path_type < P2P_PATH_NONE || path_type > P2P_PATH_SIGNALING) return -1;
+    // 有效类型范围：P2P_PATH_NONE(0) ~ P2P_PATH_SHM(7)
+    if (path_type < P2P_PATH_NONE || path_type > P2P_PATH_SHM) return -1;
 
     pm->thresholds[path_type].rtt_threshold_ms  = rtt_ms;
     pm->thresholds[path_type].loss_threshold    = loss_rate;
     pm->thresholds[path_type].cooldown_ms       = cooldown_ms;
     pm->thresholds[path_type].stability_window_ms = stability_ms;
+    pm->thresholds[path_type].trend_threshold   = trend;
 
     return 0;
 }
@@ -761,7 +866,7 @@ int path_manager_get_switch_frequency(struct p2p_session *s, uint64_t window_ms)
     path_manager_t *pm = &s->path_mgr;
     if (pm->switch_history_count == 0) return 0;
     
-    uint64_t now = P_tick_ms();
+    uint64_t now = p2p_now_ms();
     uint64_t cutoff_time = (now > window_ms) ? tick_diff(now, window_ms) : 0;
     
     int count = 0;
@@ -852,6 +957,11 @@ int path_manager_on_packet_send(struct p2p_session *s, int path_idx, uint32_t se
     sta->last_send_ms = now_ms;
     sta->total_packets_sent++;
     if (size > 0) sta->total_bytes_sent += size;
+    s->stat.packets_sent++;
+    s->stat.bytes_sent += size;
+    p2p_counters_t *c = p2p_session_counters(s);
+    P2P_COUNT(c, packets_sent, 1);
+    P2P_COUNT(c, bytes_sent, size);
     
     // RTT 追踪：仅需要 per-packet RTT 的控制包（PUNCH/ALIVE）加入队列
     if (!rt_track) return 0;
@@ -916,6 +1026,7 @@ int path_manager_on_sig_alive_send(struct p2p_instance *inst, uint64_t now_ms) {
     int tail = (pm->pending_head + pm->pending_count) % MAX_PENDING_PACKETS;
     packet_track_t *track = &pm->pending_packets[tail];
     track->sent_time_ms = now_ms;
+    track->sent_us = P_tick_us();
     pm->pending_count++;
 
     return 0;
@@ -930,9 +1041,21 @@ int path_manager_on_packet_recv(struct p2p_session *s, int path_idx, uint64_t no
     sta->last_recv_ms = now_ms;
     sta->total_packets_recv++;
     if (size > 0) sta->total_bytes_recv += size;
+    s->stat.packets_recv++;
+    s->stat.bytes_recv += size;
+    p2p_counters_t *c = p2p_session_counters(s);
+    P2P_COUNT(c, packets_recv, 1);
+    P2P_COUNT(c, bytes_recv, size);
     
     // 重置路径连续超时次数
     sta->consecutive_timeouts = 0;
+
+    // 已判定失效的路径又收到对端的包：重新进入恢复探测
+    if (path_is_dead(sta)) {
+        sta->state = PATH_STATE_RECOVERING;
+        sta->state_timestamp_ms = now_ms;
+        sta->fail_rounds = 0;
+    }
     
     // 如果不是 RoundTrip 确认包，直接返回
     if (!rt_ack) return 0;
@@ -949,7 +1072,7 @@ int path_manager_on_packet_recv(struct p2p_session *s, int path_idx, uint64_t no
         if (track->seq != seq) continue;
         
         int send_path = track->path_idx;                    // PUNCH 发送路径
-        uint64_t sent_ms = track->sent_time_ms;
+        uint64_t sent_ms = track->sent_time_ms, sent_us = track->sent_us;
         track->sent_time_ms = 0;                            // 标记为已消费（应答）
 
         // 窗口滑动，推进队首跳过连续空洞
@@ -959,8 +1082,9 @@ int path_manager_on_packet_recv(struct p2p_session *s, int path_idx, uint64_t no
             pm->pending_count--;
         }
         
-        // 计算 RTT（round trip time）
-        uint32_t rtt = (uint32_t)tick_diff(now_ms, sent_ms);
+        // 计算 RTT（round trip time）：微秒精度（内核接收时间戳），毫秒取整用于日志与跨路径记录
+        uint32_t rtt_us = (uint32_t)p2p_rtt_us(s, sent_us, (uint32_t)tick_diff(now_ms, sent_ms));
+        uint32_t rtt = (rtt_us + 500) / 1000;
         
         // ========== 关键：判断是否原路返回 ==========
         bool is_roundtrip = (send_path == path_idx);
@@ -971,43 +1095,7 @@ int path_manager_on_packet_recv(struct p2p_session *s, int path_idx, uint64_t no
             if (is_roundtrip) {
                 // ========== 原路返回：精确测量，进行 EWMA 平滑 ==========
                 
-                // 记录原始测量值
-                send_stats->rt_rtt_direct = rtt;
-                
-                // EWMA 平滑算法（TCP-style smoothed RTT）
-                if (send_stats->rt_rtt_direct_srtt == 0) {
-                    // 首次测量：初始化
-                    send_stats->rt_rtt_direct_srtt = rtt;
-                    send_stats->rt_rtt_direct_rttvar = rtt / 2;
-                } else {
-                    // 后续测量：应用 EWMA
-                    // SRTT = (1-α) * SRTT + α * RTT
-                    // RTTVAR = (1-β) * RTTVAR + β * |SRTT - RTT|
-                    int32_t err = (int32_t)rtt - (int32_t)send_stats->rt_rtt_direct_srtt;
-                    int32_t new_srtt = (int32_t)send_stats->rt_rtt_direct_srtt + (int32_t)(ALPHA * (float)err);
-                    send_stats->rt_rtt_direct_srtt = new_srtt > 0 ? (uint32_t)new_srtt : send_stats->rt_rtt_direct_srtt;
-                    
-                    int32_t var_err = abs(err) - (int32_t)send_stats->rt_rtt_direct_rttvar;
-                    int32_t new_rttvar = (int32_t)send_stats->rt_rtt_direct_rttvar + (int32_t)(BETA * (float)var_err);
-                    send_stats->rt_rtt_direct_rttvar = new_rttvar > 0 ? (uint32_t)new_rttvar : 1;  // 最小值1
-                }
-                
-                // 更新 RTT 样本缓冲区（用于统计分析）
-                send_stats->rt_samples[send_stats->rt_sample_idx] = rtt;
-                send_stats->rt_sample_idx = (send_stats->rt_sample_idx + 1) % RTT_SAMPLE_COUNT;
-                if (send_stats->rt_sample_count < RTT_SAMPLE_COUNT) {
-                    send_stats->rt_sample_count++;
-                }
-                
-                // 更新 min/max RTT
-                if (rtt < send_stats->rtt_min) send_stats->rtt_min = rtt;
-                if (rtt > send_stats->rtt_max) send_stats->rtt_max = rtt;
-                
-                // 重置连续超时计数
-                send_stats->consecutive_timeouts = 0;
-                
-                // 更新综合指标（rtt_ms, rtt_variance, loss_rate）
-                update_metrics(send_stats);
+                rt_direct_sample(send_stats, rtt_us);
                 
                 // 调试日志
                 print("V:", "path_manager: RTT path[%d] = %u ms (direct, srtt=%u, var=%u, seq=%u)",
@@ -1036,6 +1124,90 @@ int path_manager_on_packet_recv(struct p2p_session *s, int path_idx, uint64_t no
     return -1; /* 未找到对应发送记录 */
 }
 
+void path_manager_on_echo_send(struct p2p_session *s, int path_idx, uint32_t ts_us, uint64_t now_ms) {
+
+    path_stats_t *sta = p2p_get_path_stats(s, path_idx);
+    if (!sta) return;
+
+    sta->rt_packets_sent++;
+    if (!sta->rt_echo_win_ms) {
+        sta->rt_echo_win_ms = now_ms;
+        sta->rt_echo_win_us[0] = sta->rt_echo_win_us[1] = ts_us;
+    }
+    if (sta->rt_echo_sent[0] < UINT16_MAX) sta->rt_echo_sent[0]++;
+}
+
+/* 轮换回显计数窗口：上一窗口的探测已至少等待 PROBE_LOSS_TIMEOUT，未回显的计为丢包 */
+static void echo_window_tick(path_stats_t *p, uint64_t now_ms) {
+
+    if (!p->rt_echo_win_ms || tick_diff(now_ms, p->rt_echo_win_ms) < PROBE_LOSS_TIMEOUT_MS) return;
+
+    int lost = (int)p->rt_echo_sent[1] - (int)p->rt_echo_acked[1];
+    if (lost > 0) {
+        p->rt_packets_lost += (uint64_t)lost;
+        p->total_packets_lost += (uint64_t)lost;
+        p->consecutive_timeouts += lost;
+        update_metrics(p);
+    }
+    p->rt_echo_sent[1] = p->rt_echo_sent[0];
+    p->rt_echo_acked[1] = p->rt_echo_acked[0];
+    p->rt_echo_win_us[1] = p->rt_echo_win_us[0];
+    p->rt_echo_sent[0] = p->rt_echo_acked[0] = 0;
+    p->rt_echo_win_us[0] = (uint32_t)P_tick_us();
+    p->rt_echo_win_ms = now_ms;
+}
+
+int path_manager_on_echo(struct p2p_session *s, int path_idx, int send_path, uint16_t seq,
+                         uint32_t echo_ts, uint32_t hold_us, uint32_t peer_ts) {
+
+    path_stats_t *send_stats = p2p_get_path_stats(s, send_path);
+    path_stats_t *recv_stats = p2p_get_path_stats(s, path_idx);
+    if (!send_stats || !recv_stats) return -1;
+
+    // 切换到回显测量之前已入队的同 seq 记录：直接清除，避免超时计为丢包或重复采样
+    path_manager_t *pm = &s->path_mgr;
+    for (int k = 0; k < pm->pending_count; k++) {
+        packet_track_t *track = &pm->pending_packets[(pm->pending_head + k) % MAX_PENDING_PACKETS];
+        if (track->sent_time_ms && track->seq == seq) track->sent_time_ms = 0;
+    }
+    while (pm->pending_count > 0 &&
+           pm->pending_packets[pm->pending_head].sent_time_ms == 0) {
+        pm->pending_head = (pm->pending_head + 1) % MAX_PENDING_PACKETS;
+        pm->pending_count--;
+    }
+
+    // 归属发送窗口（迟于上一窗口的回显已按丢包计过，不再计数）
+    int w = (int32_t)(echo_ts - send_stats->rt_echo_win_us[0]) >= 0 ? 0
+          : (int32_t)(echo_ts - send_stats->rt_echo_win_us[1]) >= 0 ? 1 : -1;
+    if (w >= 0 && send_stats->rt_echo_acked[w] < send_stats->rt_echo_sent[w]) send_stats->rt_echo_acked[w]++;
+
+    // 反向单程延迟：两端时钟差恒定，相对最小值的增量即为反向路径排队
+    uint32_t rx = (uint32_t)p2p_rx_time_us(s);
+    int32_t owd = (int32_t)(rx - peer_ts);
+    if (!recv_stats->rt_rev_owd_set || owd < recv_stats->rt_rev_owd_min) {
+        recv_stats->rt_rev_owd_min = owd;
+        recv_stats->rt_rev_owd_set = true;
+    }
+    recv_stats->rt_rev_queue_us = (uint32_t)(owd - recv_stats->rt_rev_owd_min);
+
+    // RTT = 往返总时间 - 对端停留时间
+    int32_t rtt_us = (int32_t)(rx - echo_ts - hold_us);
+    if (rtt_us <= 0 || rtt_us > (int32_t)PROBE_LOSS_TIMEOUT_MS * 1000) return -1;
+    uint32_t rtt = ((uint32_t)rtt_us + 500) / 1000;
+
+    if (send_path == path_idx) {
+        rt_direct_sample(send_stats, (uint32_t)rtt_us);
+        print("V:", "path_manager: RTT path[%d] = %u ms (echo, srtt=%u, hold=%u us, rev_queue=%u us)",
+              send_path, rtt, send_stats->rt_rtt_direct_srtt, hold_us, recv_stats->rt_rev_queue_us);
+    } else {
+        send_stats->rt_rtt_cross = rtt;
+        update_metrics(send_stats);
+        print("V:", "path_manager: RTT path[%d] = %u ms (echo, cross-path from path_idx=%d)",
+              send_path, rtt, path_idx);
+    }
+    return (int)rtt;
+}
+
 int path_manager_on_sig_alive_recv(struct p2p_instance *inst, uint64_t now_ms) {
 
     assert(inst->signaling.active);
@@ -1059,7 +1231,7 @@ int path_manager_on_sig_alive_recv(struct p2p_instance *inst, uint64_t now_ms) {
         if (track->sent_time_ms == 0) continue;             // 跳过已消费（应答）的槽位
         //if (track->seq != seq) continue;
 
-        uint64_t sent_ms = track->sent_time_ms;
+        uint64_t sent_ms = track->sent_time_ms, sent_us = track->sent_us;
         track->sent_time_ms = 0;                            // 标记为已消费（应答）
 
         // 窗口滑动，推进队首跳过连续空洞
@@ -1069,48 +1241,19 @@ int path_manager_on_sig_alive_recv(struct p2p_instance *inst, uint64_t now_ms) {
             pm->pending_count--;
         }
 
-        // 计算 RTT（round trip time）
+        // 计算 RTT（round trip time）：实例级包在控制阶段处理，无会话接收时间，以当前时刻为准
         uint32_t rtt = (uint32_t)tick_diff(now_ms, sent_ms);
-
-        // 更新发送路径的 RTT 统计（按原路/跨路径分别记录）
-
-        // 记录原始测量值
-        sta->rt_rtt_direct = rtt;
-
-        // EWMA 平滑算法（TCP-style smoothed RTT）
-        if (sta->rt_rtt_direct_srtt == 0) {
-            // 首次测量：初始化
-            sta->rt_rtt_direct_srtt = rtt;
-            sta->rt_rtt_direct_rttvar = rtt / 2;
-        } else {
-            // 后续测量：应用 EWMA
-            // SRTT = (1-α) * SRTT + α * RTT
-            // RTTVAR = (1-β) * RTTVAR + β * |SRTT - RTT|
-            int32_t err = (int32_t)rtt - (int32_t)sta->rt_rtt_direct_srtt;
-            int32_t new_srtt = (int32_t)sta->rt_rtt_direct_srtt + (int32_t)(ALPHA * (float)err);
-            sta->rt_rtt_direct_srtt = new_srtt > 0 ? (uint32_t)new_srtt : sta->rt_rtt_direct_srtt;
-
-            int32_t var_err = abs(err) - (int32_t)sta->rt_rtt_direct_rttvar;
-            int32_t new_rttvar = (int32_t)sta->rt_rtt_direct_rttvar + (int32_t)(BETA * (float)var_err);
-            sta->rt_rtt_direct_rttvar = new_rttvar > 0 ? (uint32_t)new_rttvar : 1;  // 最小值1
-        }
-
-        // 更新 RTT 样本缓冲区（用于统计分析）
-        sta->rt_samples[sta->rt_sample_idx] = rtt;
-        sta->rt_sample_idx = (sta->rt_sample_idx + 1) % RTT_SAMPLE_COUNT;
-        if (sta->rt_sample_count < RTT_SAMPLE_COUNT) {
-            sta->rt_sample_count++;
+        uint32_t rtt_us = (uint32_t)rtt * 1000;
+        uint64_t now_us = P_tick_us();
+        if (sent_us && now_us >= sent_us && now_us - sent_us <= rtt_us + P2P_RTT_US_SLACK
+            && now_us - sent_us + P2P_RTT_US_SLACK >= rtt_us) {
+            rtt_us = (uint32_t)(now_us - sent_us);
+            rtt = (rtt_us + 500) / 1000;
         }
 
-        // 更新 min/max RTT
-        if (rtt < sta->rtt_min) sta->rtt_min = rtt;
-        if (rtt > sta->rtt_max) sta->rtt_max = rtt;
-
-        // 重置连续超时计数
-        sta->consecutive_timeouts = 0;
+        // 更新发送路径的 RTT 统计（按原路/跨路径分别记录）
 
-        // 更新综合指标（rtt_ms, rtt_variance, loss_rate）
-        update_metrics(sta);
+        rt_direct_sample(sta, rtt_us);
 
         // 调试日志
         print("V:", "path_manager: RTT path[SIG] = %u ms (direct, srtt=%u, var=%u, seq=%u)",
@@ -1139,6 +1282,20 @@ int path_manager_on_data_rtt(struct p2p_session *s, int path_idx, uint32_t rtt_m
     return 0;
 }
 
+int path_manager_on_ack_rtt(struct p2p_session *s, int path_idx, uint32_t rtt_us, uint64_t now_ms) {
+    path_stats_t *p = p2p_get_path_stats(s, path_idx);
+    if (!p) return -1;
+
+    rt_direct_sample(p, rtt_us);
+    p->data_rtt_ms = now_ms;
+    return 0;
+}
+
+bool path_manager_rtt_fresh(struct p2p_session *s, int path_idx, uint64_t now_ms, uint32_t window_ms) {
+    path_stats_t *p = p2p_get_path_stats(s, path_idx);
+    return p && p->data_rtt_ms && tick_diff(now_ms, p->data_rtt_ms) < window_ms;
+}
+
 int path_manager_on_data_loss_rate(struct p2p_session *s, int path_idx, float loss_rate) {
     path_stats_t *p = p2p_get_path_stats(s, path_idx);
     if (!p) return -1;
@@ -1156,6 +1313,74 @@ int path_manager_on_data_loss_rate(struct p2p_session *s, int path_idx, float lo
     return 0;
 }
 
+int path_manager_on_data_rate(struct p2p_session *s, int path_idx, uint64_t rate_bps, bool app_limited) {
+    path_stats_t *p = p2p_get_path_stats(s, path_idx);
+    if (!p) return -1;
+
+    if (rate_bps >= p->bandwidth_bps)
+        p->bandwidth_bps = rate_bps;
+    else if (!app_limited)
+        p->bandwidth_bps = (p->bandwidth_bps * 7 + rate_bps) / 8;
+    return 0;
+}
+
+/* 内部函数：记录一个原路 RTT 样本（PUNCH/REACH、SIG ALIVE 或数据 ACK，rtt_us 为微秒）
+ *
+ * EWMA 平滑（TCP-style）：
+ *   SRTT   = (1-α) * SRTT + α * RTT
+ *   RTTVAR = (1-β) * RTTVAR + β * |SRTT - RTT|
+ * 以微秒精度平滑（rt_srtt_us / rt_rttvar_us），毫秒字段为其取整：亚毫秒级的 LAN 路径也能区分抖动
+ */
+static void rt_direct_sample(path_stats_t *p, uint32_t rtt_us) {
+
+    uint32_t rtt = (rtt_us + 500) / 1000;
+
+    // 记录原始测量值
+    p->rt_rtt_direct = rtt;
+
+    // 毫秒字段被外部改写（重置、恢复）：以其为准重新同步微秒值
+    uint32_t var_ms = (p->rt_rttvar_us + 500) / 1000;
+    if ((p->rt_srtt_us + 500) / 1000 != p->rt_rtt_direct_srtt
+        || (var_ms ? var_ms : 1) != p->rt_rtt_direct_rttvar) {
+        p->rt_srtt_us = p->rt_rtt_direct_srtt * 1000;
+        p->rt_rttvar_us = p->rt_rtt_direct_rttvar * 1000;
+    }
+
+    if (p->rt_srtt_us == 0) {
+        // 首次测量：初始化
+        p->rt_srtt_us = rtt_us;
+        p->rt_rttvar_us = rtt_us / 2;
+    } else {
+        int32_t err = (int32_t)rtt_us - (int32_t)p->rt_srtt_us;
+        int32_t new_srtt = (int32_t)p->rt_srtt_us + (int32_t)(ALPHA * (float)err);
+        p->rt_srtt_us = new_srtt > 0 ? (uint32_t)new_srtt : p->rt_srtt_us;
+
+        int32_t var_err = abs(err) - (int32_t)p->rt_rttvar_us;
+        int32_t new_rttvar = (int32_t)p->rt_rttvar_us + (int32_t)(BETA * (float)var_err);
+        p->rt_rttvar_us = new_rttvar > 0 ? (uint32_t)new_rttvar : 1;
+    }
+    p->rt_rtt_direct_srtt = (p->rt_srtt_us + 500) / 1000;
+    p->rt_rtt_direct_rttvar = (p->rt_rttvar_us + 500) / 1000;
+    if (!p->rt_rtt_direct_rttvar) p->rt_rtt_direct_rttvar = 1;      // 毫秒方差最小值 1
+
+    // 更新 RTT 样本缓冲区（用于统计分析）
+    p->rt_samples[p->rt_sample_idx] = rtt;
+    p->rt_sample_idx = (p->rt_sample_idx + 1) % RTT_SAMPLE_COUNT;
+    if (p->rt_sample_count < RTT_SAMPLE_COUNT) {
+        p->rt_sample_count++;
+    }
+
+    // 更新 min/max RTT
+    if (rtt < p->rtt_min) p->rtt_min = rtt;
+    if (rtt > p->rtt_max) p->rtt_max = rtt;
+
+    // 重置连续超时计数
+    p->consecutive_timeouts = 0;
+
+    // 更新综合指标（rtt_ms, rtt_variance, loss_rate）
+    update_metrics(p);
+}
+
 /* 内部函数：实时更新路径综合指标（RTT/丢包率）
  * 
  * 此函数负责更新路径的综合 RTT 和丢包率，用于路径选择和质量评估。
@@ -1189,7 +1414,7 @@ static void update_metrics(path_stats_t *p) {
 static void update_quality(path_stats_t *p) {
 
     // 节流保护，避免过度计算（每秒最多更新一次） 
-    uint64_t now_ms = P_tick_ms();
+    uint64_t now_ms = p2p_now_ms();
     if (tick_diff(now_ms, p->last_quality_check_ms) < QUALITY_UPDATE_INTERVAL_MS) return;
     p->last_quality_check_ms = now_ms;
     
@@ -1278,6 +1503,8 @@ static void health_check_one_path(struct p2p_session *s, path_stats_t *sta,
     /* ---- 1. ACTIVE / DEGRADED 超时检测 ---- */
     if (sta->state == PATH_STATE_ACTIVE || sta->state == PATH_STATE_DEGRADED) {
         uint64_t timeout = sta->is_lan ? LAN_TIMEOUT_MS : WAN_TIMEOUT_MS;
+        if (!sta->is_lan && nat_keepalive_ms(s) > timeout) timeout = nat_keepalive_ms(s);  // 自适应保活：空闲时按保活间隔计
+        if (sta->probe_period > 1) timeout *= sta->probe_period;                            // 疏探测路径按探测周期放宽
 
         if (sta->last_recv_ms) {
             if ((int)(tick_diff(now_ms, sta->last_recv_ms) / timeout) >= FAILED_TIMEOUT_COUNT) {
@@ -1317,9 +1544,10 @@ static void health_check_one_path(struct p2p_session *s, path_stats_t *sta,
             sta->state = PATH_STATE_ACTIVE;
     }
 
-    /* ---- 3. FAILED → RECOVERING：30 秒后探测恢复 ---- */
-    if (sta->state == PATH_STATE_FAILED) {
-        if (sta->state_timestamp_ms > 0 && tick_diff(now_ms, sta->state_timestamp_ms) > FAILED_TO_RECOVERING_MS) {
+    /* ---- 3. FAILED → RECOVERING：30 秒后探测恢复，每轮恢复失败等待翻倍，失效路径不再恢复 ---- */
+    if (sta->state == PATH_STATE_FAILED && !path_is_dead(sta)) {
+        if (sta->state_timestamp_ms > 0
+            && tick_diff(now_ms, sta->state_timestamp_ms) > ((uint64_t)FAILED_TO_RECOVERING_MS << sta->fail_rounds)) {
             sta->state = PATH_STATE_RECOVERING;
 
             sta->consecutive_timeouts = 0;                        // 重置连续超时计数
@@ -1337,12 +1565,15 @@ static void health_check_one_path(struct p2p_session *s, path_stats_t *sta,
         if (elapsed > RECOVERING_TIMEOUT_MS) {
             sta->state = PATH_STATE_FAILED;
             sta->state_timestamp_ms = now_ms;
+            if (++sta->fail_rounds == P2P_PROBE_DEAD_ROUNDS)
+                print("V:", "path_manager: path[%d] dead after %d failed recoveries, probing stopped", path_idx, P2P_PROBE_DEAD_ROUNDS);
         } 
         // 收到数据且最近 2 秒内有活动 → 恢复成功
         else if (sta->last_recv_ms > recovering_start &&
                    tick_diff(now_ms, sta->last_recv_ms) < RECOVERING_ACTIVITY_MS) {
             
             sta->state = PATH_STATE_ACTIVE;
+            sta->fail_rounds = 0;
         }
     }
 }
@@ -1385,8 +1616,21 @@ void path_manager_tick(struct p2p_session *s, uint64_t now_ms) {
     }
     // 检查所有候选路径
     for (int i = 0; i < s->remote_cand_cnt; i++) {
+        echo_window_tick(&s->remote_cands[i].stats, now_ms);
         health_check_one_path(s, &s->remote_cands[i].stats, i, now_ms);
     }
+
+    // 刷新活跃路径快照（p2p_get_stats）
+    const path_stats_t *act = p2p_get_path_stats(s, s->active_path);
+    s->stat_rtt = act ? act->rtt_ms : 0;
+    s->stat_loss = act ? act->loss_rate : 0.0f;
+    s->stat_quality = act ? (int)act->quality : PATH_QUALITY_BAD;
+    s->stat_bw = act ? act->bandwidth_bps : 0;
+}
+
+int path_manager_next_timeout(const path_manager_t *pm, uint64_t now_ms) {
+    uint64_t due = pm->last_health_check_ms + pm->health_check_interval_ms;
+    return due > now_ms ? (int)(due - now_ms) : 0;
 }
 
 void path_manager_signaling_tick(struct p2p_instance *inst, uint64_t now_ms) {
@@ -1424,3 +1668,101 @@ void path_manager_signaling_tick(struct p2p_instance *inst, uint64_t now_ms) {
     // todo 好像该操作是用于不同路径间的检测
     // health_check_one_path(s, &s->inst->signaling.stats, PATH_IDX_SIGNALING, now_ms);
 }
+
+/* ==========================================================================
+ *                                  多路径调度
+ * ========================================================================== */
+
+/* 路径可承载多路径 DATA：已双向确认（ACTIVE）的直连候选；活跃路径始终可用 */
+static bool mp_usable(const struct p2p_session *s, int i) {
+    const p2p_remote_candidate_entry_t *c = &s->remote_cands[i];
+    if (c->type == P2P_CAND_RELAY || c->type == P2P_CAND_TCP || c->type == P2P_CAND_OVERLAY || c->type == P2P_CAND_SHM) return false;
+    return i == s->active_path || c->stats.state == PATH_STATE_ACTIVE;
+}
+
+/* 路径首次承载多路径 DATA 时初始化窗口（部分候选来源不经 path_stats_init），慢启动无上限 */
+static path_stats_t *mp_path(struct p2p_session *s, int i) {
+    if (i < 0 || i >= s->remote_cand_cnt) return NULL;
+    path_stats_t *p = &s->remote_cands[i].stats;
+    if (!p->mp_cwnd) {
+        p->mp_cwnd = P2P_MP_INIT_CWND;
+        p->mp_ssthresh = INT64_MAX;
+    }
+    return p;
+}
+
+bool path_manager_mp_enabled(const struct p2p_session *s) {
+    return s->inst->cfg.multipath && !s->trans && !s->dtls && !s->inst->cfg.multi_session
+        && s->nat.state == NAT_CONNECTED && s->active_path >= 0 && s->active_path < s->remote_cand_cnt
+        && (s->path_type == P2P_PATH_PUNCH || s->path_type == P2P_PATH_LAN);
+}
+
+int path_manager_mp_pick(struct p2p_session *s, int len, bool force) {
+
+    int best = PATH_IDX_NONE, usable = 0;
+    uint32_t best_rtt = UINT32_MAX;
+    for (int i = 0; i < s->remote_cand_cnt; i++) {
+        if (!mp_usable(s, i)) continue;
+        usable++;
+
+        const path_stats_t *p = mp_path(s, i);
+        if (!force && p->mp_inflight > 0 && p->mp_inflight + len > p->mp_cwnd) continue;
+
+        uint32_t rtt = p->mp_srtt ? p->mp_srtt : get_effective_rtt(p);
+        if (best == PATH_IDX_NONE || rtt < best_rtt) { best = i; best_rtt = rtt; }
+    }
+
+    // 仅一条可用路径：等同单路径传输，不受路径窗口限制
+    return usable < 2 ? s->active_path : best;
+}
+
+void path_manager_mp_on_send(struct p2p_session *s, int path_idx, int len) {
+    path_stats_t *p = mp_path(s, path_idx);
+    if (!p) return;
+    p->mp_inflight += len;
+    p->mp_sent++;
+}
+
+void path_manager_mp_on_ack(struct p2p_session *s, int path_idx, int len, int rtt_ms) {
+    path_stats_t *p = mp_path(s, path_idx);
+    if (!p) return;
+
+    p->mp_inflight -= len;
+    if (p->mp_inflight < 0) p->mp_inflight = 0;
+
+    // 慢启动按字节增长，拥塞避免每 RTT 约增一个包；上限为整个发送窗口
+    if (p->mp_cwnd < p->mp_ssthresh) p->mp_cwnd += len;
+    else p->mp_cwnd += (int64_t)P2P_MAX_PAYLOAD * len / p->mp_cwnd;
+    int64_t cap = (int64_t)s->reliable.window * P2P_MAX_PAYLOAD;
+    if (cap > 0 && p->mp_cwnd > cap) p->mp_cwnd = cap;
+
+    if (rtt_ms >= 0) {
+        p->mp_srtt = p->mp_srtt ? (7 * p->mp_srtt + (uint32_t)rtt_ms) / 8 : (uint32_t)rtt_ms;
+        if (!p->mp_srtt) p->mp_srtt = 1;
+        path_manager_on_data_rtt(s, path_idx, p->mp_srtt);
+    }
+}
+
+void path_manager_mp_on_loss(struct p2p_session *s, int path_idx, int len, uint64_t sent_ms, uint64_t now_ms) {
+    path_stats_t *p = mp_path(s, path_idx);
+    if (!p) return;
+
+    p->mp_inflight -= len;
+    if (p->mp_inflight < 0) p->mp_inflight = 0;
+    p->mp_lost++;
+    p->total_packets_lost++;
+
+    // 同一拥塞事件（减窗后才发出的包除外）只减窗一次
+    if (!p->mp_recover_ts || sent_ms > p->mp_recover_ts) {
+        int64_t old = p->mp_cwnd;
+        p->mp_ssthresh = p->mp_cwnd / 2;
+        if (p->mp_ssthresh < P2P_MP_MIN_CWND) p->mp_ssthresh = P2P_MP_MIN_CWND;
+        p->mp_cwnd = p->mp_ssthresh;
+        p->mp_recover_ts = now_ms;
+        print("V:", "path_manager: path[%d] data loss, cwnd %lld -> %lld",
+              path_idx, (long long)old, (long long)p->mp_cwnd);
+    }
+
+    if (p->mp_sent > 0)
+        path_manager_on_data_loss_rate(s, path_idx, (float)p->mp_lost / (float)p->mp_sent);
+}
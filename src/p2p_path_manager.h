@@ -9,6 +9,7 @@
 
 /* 前向声明 */
 struct p2p_session;
+struct p2p_instance;
 
 /* 路径选择策略 */
 typedef enum {
@@ -64,10 +65,22 @@ typedef enum {
  * 路径统计信息
  */
 typedef struct {
-    /* 路径状态 */
+    /* 热字段：路径选择（select_path_*）与健康检查（health_check_one_path）逐候选读取，
+     * 集中在结构体开头（候选条目中紧随 type），扫描候选时每条路径只触及一个缓存行；
+     * 其后为测量源、样本历史与计数器等冷数据 */
     path_state_t        state;                      // 路径状态
-    
-    /* 性能指标（用于路径选择）
+    uint32_t            rtt_ms;                     // 当前综合 RTT（毫秒，自动选择最优，见下方 RTT 测量分层策略）
+    uint32_t            rtt_variance;               // 综合延迟抖动
+    float               loss_rate;                  // 综合丢包率（0.0-1.0），取 RoundTrip 和 data 两层的最大值
+    uint64_t            bandwidth_bps;              // 估计带宽（bps）
+    int                 cost_score;                 // 成本估算：0=免费(LAN/PUNCH), 1-10=中继成本
+    bool                is_lan;                     // 是否为 LAN 路径（同子网直连）
+    uint8_t             probe_period;               // 连接后保活探测周期倍数（由 nat_tick 每轮设定，0 = 按 1 计，见 P2P_PROBE_SPARSE）
+    uint8_t             fail_rounds;                // 连续恢复失败轮数（达到 P2P_PROBE_DEAD_ROUNDS 即不再探测）
+    uint64_t            last_recv_ms;               // 最后接收时间
+    uint64_t            state_timestamp_ms;         // 状态变更时间戳（FAILED/RECOVERING）
+
+    /* 测量源（综合为上方 rtt_ms / rtt_variance）
      * 
      * RTT 测量分层策略（混合模式）：
      *   1. RoundTrip 层原路返回测量：
@@ -91,21 +104,18 @@ typedef struct {
     uint32_t            rt_rtt_direct;              // RoundTrip 层原路最新测量（0=未测量）
     uint32_t            rt_rtt_direct_srtt;         // RoundTrip 层原路 EWMA 平滑值（路径选择用）
     uint32_t            rt_rtt_direct_rttvar;       // RoundTrip 层原路 RTT 方差（抖动评估用）
+    uint32_t            rt_srtt_us;                 // 上述 EWMA 的微秒精度值（毫秒字段由其取整；被外部改写时重新同步）
+    uint32_t            rt_rttvar_us;               // 上述方差的微秒精度值
     uint32_t            rt_rtt_cross;               // RoundTrip 层跨路径测量（0=未测量，仅参考）
     uint32_t            data_rtt;                   // 数据层 SRTT（0=未测量，最可靠）
+    uint64_t            data_rtt_ms;                // 最近一次数据 ACK 原路样本时间（0=无，见 path_manager_on_ack_rtt）
     
-    uint32_t            rtt_ms;                     // 当前综合 RTT（毫秒，自动选择最优）
     uint32_t            rtt_min;                    // 最小 RTT（基线）
     uint32_t            rtt_max;                    // 最大 RTT
-    uint32_t            rtt_variance;               // 综合延迟抖动
-    float               loss_rate;                  // 综合丢包率（0.0-1.0），取 RoundTrip 和 data 两层的最大值
     float               data_loss_rate;             // 数据层丢包率（来自 reliable/SCTP/DTLS 传输层）
-    uint64_t            bandwidth_bps;              // 估计带宽（bps）
     
     /* 健康检查 */
-    uint64_t            last_recv_ms;               // 最后接收时间
     uint64_t            last_send_ms;               // 最后发送时间
-    uint64_t            state_timestamp_ms;         // 状态变更时间戳（FAILED/RECOVERING）
     int                 consecutive_timeouts;       // 连续超时次数
     
     /* RoundTrip 层统计（用于 RoundTrip 层丢包率计算） */
@@ -113,7 +123,16 @@ typedef struct {
     int                 rt_sample_idx;              // 当前样本索引
     int                 rt_sample_count;            // 有效样本数
     uint64_t            rt_packets_sent;            // RoundTrip 包发送数（PUNCH/ALIVE，rt_track=true）
-    uint64_t            rt_packets_lost;            // RoundTrip 包丢包数（pending 队列超时）
+    uint64_t            rt_packets_lost;            // RoundTrip 包丢包数（pending 队列超时 / 回显窗口未确认）
+
+    /* 时间戳回显（对端回显 PUNCH.ts 后不再占用 pending 队列，见 path_manager_on_echo） */
+    uint64_t            rt_echo_win_ms;             // 当前计数窗口起点（0 = 本路径尚未发出带时间戳的探测）
+    uint32_t            rt_echo_win_us[2];          // [0]=当前 / [1]=上一窗口起点（P_tick_us 低 32 位，用于按 echo_ts 归属）
+    uint16_t            rt_echo_sent[2];            // 窗口内发出的带时间戳探测数
+    uint16_t            rt_echo_acked[2];           // 其中已收到回显的数（上一窗口轮换时 sent-acked 计为丢包）
+    int32_t             rt_rev_owd_min;             // 反向单程延迟最小值（微秒，含两端时钟差）
+    bool                rt_rev_owd_set;             // rt_rev_owd_min 已有样本
+    uint32_t            rt_rev_queue_us;            // 最近一次反向路径排队延迟估计（单程延迟 - 最小值）
     
     /* 流量统计 */
     uint64_t            total_bytes_sent;           // 总发送字节数（所有包）
@@ -128,10 +147,25 @@ typedef struct {
     float               quality_score;              // 质量评分（0.0-1.0）
     float               quality_trend;              // 质量趋势（-1.0=恶化, 0=稳定, 1.0=改善）
     int                 stability_score;            // 稳定性评分（0-100）
-    
-    /* 成本估算（用于策略决策） */
-    int                 cost_score;                 // 0=免费(LAN/PUNCH), 1-10=中继成本
-    bool                is_lan;                     // 是否为 LAN 路径（同子网直连）
+
+    /* 多路径调度（cfg.multipath，仅数据层，见 path_manager_mp_pick） */
+    int64_t             mp_cwnd;                    // 本路径拥塞窗口（字节）
+    int64_t             mp_ssthresh;                // 慢启动阈值（字节）
+    int64_t             mp_inflight;                // 本路径在途字节
+    uint64_t            mp_recover_ts;              // 最近一次减窗时间（此前发出的包丢失不再重复减窗）
+    uint32_t            mp_srtt;                    // 本路径数据层 SRTT（毫秒，0=未测量）
+    uint64_t            mp_sent;                    // 本路径发出的 DATA 包数（含重传）
+    uint64_t            mp_lost;                    // 本路径判定丢失的 DATA 包数
+    uint64_t            mp_rack_ts;                 // 本路径 RACK：最近发送的已确认包的发送时间
+    uint32_t            mp_rack_seq;                //   及其序列号
+    int                 mp_rack_rtt;                //   及其 RTT
+
+    /* 路径 MTU（cfg.pmtu_discovery，仅直连 UDP 路径探测，见 p2p_nat.c pmtu_*） */
+    uint16_t            pmtu;                       // 已确认的 UDP 负载上限（含包头，0 = 未确认，按 P2P_MTU）
+    uint16_t            pmtu_fail;                  // 最小的失败探测尺寸（0 = 尚无）
+    uint16_t            pmtu_probe;                 // 在途探测尺寸（0 = 无）
+    uint8_t             pmtu_tries;                 // 当前尺寸已发次数
+    uint64_t            pmtu_ms;                    // 最近一次探测发送 / 本轮搜索结束时间
 } path_stats_t;
 
 //-----------------------------------------------------------------------------
@@ -141,6 +175,7 @@ typedef struct {
 typedef struct {
     uint32_t            seq;                        // 数据包序列号
     uint64_t            sent_time_ms;               // 发送时间戳
+    uint64_t            sent_us;                    // 发送时间戳（微秒，P_tick_us；RTT 与内核接收时间戳配合）
     int                 path_idx;                   // 发送路径索引
 } packet_track_t;
 
@@ -175,12 +210,16 @@ typedef struct {
  *   [P2P_PATH_PUNCH]     标准阈值
  *   [P2P_PATH_RELAY]     保守阈值，避免不必要的 TURN 切换
  *   [P2P_PATH_SIGNALING] 最大阈值，SIGNALING 转发作为最终手段
+ *   [P2P_PATH_TCP]       保守阈值（同 TURN），TCP 队头阻塞下 RTT 波动较大
+ *   [P2P_PATH_OVERLAY]   介于 PUNCH 与 TURN 之间，第三方对端中转（多一跳）
+ *   [P2P_PATH_SHM]       最小阈值，同主机共享内存（可用时任何策略下都优先选用）
  */
 typedef struct {
     uint32_t            rtt_threshold_ms;           // RTT 阈值：新路径需比当前快至少此值才触发切换
     float               loss_threshold;             // 丢包率阈值：超过则触发切换
     uint64_t            cooldown_ms;                // 切换冷却时间
     uint32_t            stability_window_ms;        // 稳定窗口：切向此类型路径前需观察的时长
+    float               trend_threshold;            // 预测式切换：活跃路径 quality_trend < -此值即预热并准备切换（0=不预测）
 } path_threshold_config_t;
 
 /*
@@ -237,8 +276,12 @@ typedef struct {
     /* TURN 策略配置（TURN 是候选，此配置用于策略调整） */
     turn_config_t       turn_config;                // TURN 配置
 
-    /* 按路径类型的切换阈值（下标为 p2p_path_type_t：0=NONE 1=LAN 2=PUNCH 3=RELAY 4=SIGNALING） */
-    path_threshold_config_t thresholds[5];
+    /* 按路径类型的切换阈值（下标为 p2p_path_type_t：0=NONE 1=LAN 2=PUNCH 3=RELAY 4=SIGNALING 5=TCP 6=OVERLAY 7=SHM） */
+    path_threshold_config_t thresholds[8];
+
+    /* 预测式切换（cfg.path_predictive，见 path_manager_predict） */
+    int                 prewarm_path;               // 正在预热的备用路径（PATH_IDX_NONE=未预热）
+    uint64_t            prewarm_ms;                 // 最近一次预热探测时间
 } path_manager_t;
 
 /*
@@ -249,6 +292,20 @@ static inline bool path_is_selectable(path_state_t state) {
     return state >= PATH_STATE_ACTIVE;
 }
 
+/*
+ * 连接后的探测分级（NAT_CONNECTED 保活与 NAT_RELAY 重试打洞，见 nat_tick）
+ * + 活跃路径、次优路径（path_manager_select_backup_path）与恢复中的路径每个保活周期探测
+ * + 其余可选路径每 P2P_PROBE_SPARSE 个周期探测一次，DEGRADED 再减半；健康检查的无响应超时按同一倍数放宽
+ * + FAILED 后的恢复探测间隔逐轮翻倍，连续 P2P_PROBE_DEAD_ROUNDS 轮恢复失败即判定失效：不再探测，
+ *   直到该路径再次收到对端的包
+ */
+#define P2P_PROBE_SPARSE        4
+#define P2P_PROBE_DEAD_ROUNDS   3
+
+static inline bool path_is_dead(const path_stats_t *st) {
+    return st->state == PATH_STATE_FAILED && st->fail_rounds >= P2P_PROBE_DEAD_ROUNDS;
+}
+
 /* 辅助工具：枚举值转字符串（用于日志） */
 const char* path_state_str(path_state_t state);
 const char* path_quality_str(path_quality_t quality);
@@ -325,6 +382,7 @@ int path_manager_configure_turn(struct p2p_session *s,
  *
  *   Group 2 — 数据层（data, 面向当前活跃路径）：
  *     path_manager_on_packet_recv / path_manager_on_data_rtt / path_manager_on_data_loss_rate
+ *     / path_manager_on_data_rate
  *     用于 DATA 传输包的接收统计、RTT 同步和数据层丢包率上报。
  *     RTT 来自 reliable 层 SRTT 或高级传输层 get_stats。
  *     丢包率来自高级传输层 get_stats（基础 reliable 层无聚合丢包计数）。
@@ -368,6 +426,25 @@ int path_manager_on_sig_alive_send(struct p2p_instance *inst, uint64_t now_ms);
 int path_manager_on_packet_recv(struct p2p_session *s, int path_idx, uint64_t now_ms, uint32_t size, bool rt_ack, uint32_t seq);
 int path_manager_on_sig_alive_recv(struct p2p_instance *inst, uint64_t now_ms);
 
+/*
+ * 时间戳回显测量（PUNCH.ts / REACH.echo_ts，见 p2pp.h）
+ *
+ * 发送侧 path_manager_on_echo_send 只计数（代替 rt_track 入队），每 PROBE_LOSS_TIMEOUT
+ * 轮换一次计数窗口，上一窗口未回显的探测计为丢包；任意探测速率下状态大小固定。
+ * 接收侧 path_manager_on_echo 由回显字段直接得到 RTT，并记录反向路径排队延迟。
+ *
+ * @param path_idx   REACH 到达路径
+ * @param send_path  PUNCH 发出路径（由回显的 target_addr 得到）
+ * @param seq        REACH 回显的 seq（清理切换前已入 pending 队列的记录）
+ * @param echo_ts    回显的 PUNCH.ts
+ * @param hold_us    对端收到 PUNCH 到发出 REACH 的间隔
+ * @param peer_ts    对端发送 REACH 时的时钟
+ * @return           测量的 RTT 毫秒数，样本无效返回 -1
+ */
+void path_manager_on_echo_send(struct p2p_session *s, int path_idx, uint32_t ts_us, uint64_t now_ms);
+int path_manager_on_echo(struct p2p_session *s, int path_idx, int send_path, uint16_t seq,
+                         uint32_t echo_ts, uint32_t hold_us, uint32_t peer_ts);
+
 /* ---- Group 2: 数据层统计（活跃路径 DATA 包） ---- */
 
 /*
@@ -382,6 +459,23 @@ int path_manager_on_sig_alive_recv(struct p2p_instance *inst, uint64_t now_ms);
  */
 int path_manager_on_data_rtt(struct p2p_session *s, int path_idx, uint32_t rtt_ms);
 
+/*
+ * 上报单个数据 ACK 的 RTT 样本（被动测量，来自 reliable 层非重传包的累积确认）
+ *
+ * DATA 经活跃路径发出、ACK 原路返回，样本与 PUNCH/REACH 原路测量等价，
+ * 按同样的 EWMA 计入 rt_rtt_direct_srtt，并记录样本时间 data_rtt_ms。
+ * 样本新鲜期间 NAT 保活不再向该路径发探测（见 path_manager_rtt_fresh）。
+ *
+ * @param rtt_us    往返延迟（微秒，见 p2p_rtt_us）
+ * @return          0=成功，-1=失败
+ */
+int path_manager_on_ack_rtt(struct p2p_session *s, int path_idx, uint32_t rtt_us, uint64_t now_ms);
+
+/*
+ * 路径在最近 window_ms 内是否有被动 RTT 样本（有则本轮可省去主动探测）
+ */
+bool path_manager_rtt_fresh(struct p2p_session *s, int path_idx, uint64_t now_ms, uint32_t window_ms);
+
 /*
  * 上报数据层丢包率（来自高级传输层 get_stats）
  *
@@ -396,6 +490,21 @@ int path_manager_on_data_rtt(struct p2p_session *s, int path_idx, uint32_t rtt_m
  */
 int path_manager_on_data_loss_rate(struct p2p_session *s, int path_idx, float loss_rate);
 
+/*
+ * 上报数据层交付速率样本（来自 reliable 层，每个 ACK 一次）
+ *
+ * 带宽估计 bandwidth_bps 取近期样本的衰减最大值：更高样本立即采纳，
+ * 更低样本按 1/8 权重缓慢拉低。受应用层限制的样本（发送端无数据可发）
+ * 只反映应用速率，仅在高于当前估计时采纳。
+ *
+ * @param s           会话指针
+ * @param path_idx    路径索引（-1=SIGNALING, >=0=候选索引）
+ * @param rate_bps    交付速率样本（bps）
+ * @param app_limited 样本是否受应用层限制
+ * @return            0=成功，-1=失败
+ */
+int path_manager_on_data_rate(struct p2p_session *s, int path_idx, uint64_t rate_bps, bool app_limited);
+
 /* ---- 辅助函数 ---- */
 
 /*
@@ -443,6 +552,11 @@ static inline uint32_t get_effective_rtt(const path_stats_t *p) {
 void path_manager_tick(struct p2p_session *s, uint64_t now_ms);
 void path_manager_signaling_tick(struct p2p_instance *inst, uint64_t now_ms);
 
+/*
+ * 距下一次健康检查的毫秒数（供事件驱动的工作线程计算等待时长）
+ */
+int path_manager_next_timeout(const path_manager_t *pm, uint64_t now_ms);
+
 /* ============================================================================
  * 操作执行
  * ============================================================================ */
@@ -456,6 +570,34 @@ void path_manager_signaling_tick(struct p2p_instance *inst, uint64_t now_ms);
  */
 int path_manager_select_best_path(struct p2p_session *s);
 
+/*
+ * 计算次优路径（冗余双发的第二条路径）
+ * + 按同一策略在除活跃路径外的路径中选取（活跃路径暂视为不可选），
+ *   如直连活跃时 TURN 不再受 last_resort 限制而可被选中
+ *
+ * @return  次优路径索引，或 PATH_IDX_NONE（无活跃路径或无其他可用路径）
+ */
+int path_manager_select_backup_path(struct p2p_session *s);
+
+/*
+ * 活跃路径质量是否正在恶化：质量趋势低于 -P2P_REDUNDANT_TREND，或已处于 DEGRADED
+ * + P2P_REDUNDANT_AUTO 模式据此启用冗余双发
+ */
+#define P2P_REDUNDANT_TREND     0.1f
+bool path_manager_quality_falling(struct p2p_session *s);
+
+/*
+ * 预测式切换（cfg.path_predictive，每次会话 tick 调用）
+ * + 活跃路径 quality_trend 低于其类型的 -trend_threshold（或已 DEGRADED）时，选出次优路径并预热：
+ *   每 P2P_PREWARM_INTERVAL_MS 发一次 RoundTrip 探测刷新其 RTT；TURN 权限与加密状态本已与路径无关
+ * + 次优路径已测得 RTT、自身趋势未恶化且不慢于活跃路径最新样本（活跃路径已 DEGRADED 时不比较）时返回它，
+ *   由调用方经 path_manager_switch_path 切换：此时跳过稳定窗口，冷却期与频率限制照常生效
+ *
+ * @return  建议切换的目标路径，或 PATH_IDX_NONE
+ */
+#define P2P_PREWARM_INTERVAL_MS 500
+int path_manager_predict(struct p2p_session *s, uint64_t now_ms);
+
 /*
  * 切换到指定目标路径
  * + 相比于直接 p2p_set_active_path（硬切）支持防抖逻辑策略
@@ -510,16 +652,17 @@ int path_manager_set_path_state(struct p2p_session *s, int path_idx, path_state_
  * 设置不同类型路径的切换阈值
  *
  * @param s             会话指针
- * @param path_type     路径类型（P2P_PATH_LAN/PUNCH/RELAY/SIGNALING）
+ * @param path_type     路径类型（P2P_PATH_LAN/PUNCH/RELAY/SIGNALING/TCP/OVERLAY/SHM）
  * @param rtt_ms        RTT 阈值（毫秒）
  * @param loss_rate     丢包率阈值（0.0-1.0）
  * @param cooldown_ms   切换冷却时间（毫秒）
  * @param stability_ms  稳定窗口（毫秒）
+ * @param trend         预测式切换的趋势阈值（0.0-1.0，0=此类型路径不预测，仅 cfg.path_predictive 时生效）
  * @return              0=成功，-1=失败
  */
 int path_manager_set_threshold(struct p2p_session *s, int path_type,
                                uint32_t rtt_ms, float loss_rate,
-                               uint64_t cooldown_ms, uint32_t stability_ms);
+                               uint64_t cooldown_ms, uint32_t stability_ms, float trend);
 
 /*
  * 获取路径质量等级
@@ -581,5 +724,70 @@ int path_manager_get_turn_stats(struct p2p_session *s,
                                  uint64_t *total_bytes_recv,
                                  uint32_t *avg_rtt_ms);
 
+/* ============================================================================
+ * 多路径调度（cfg.multipath）
+ * ============================================================================
+ *
+ * 基础 reliable 层首次发送 DATA 时逐包选路：在可用直连路径（ACTIVE，非 TURN）中取 RTT 最低、
+ * 且本路径拥塞窗口未满者（minRTT 调度）；全部已满则本轮停止首发。重传不受路径窗口限制。
+ * 每个包记录发送路径，确认/丢失按路径归账：per-path cwnd（Reno 式慢启动 + 拥塞避免，每 RTT 至多减窗一次）、
+ * SRTT 与数据层丢包率（同步到 data_rtt / data_loss_rate）。
+ * 接收端乱序由 reliable 接收窗口重排；RACK 只与同一路径上的确认比较，慢路径的包不会因快路径的确认被误判丢失。
+ * 可用直连路径不足两条时退化为单路径（仅活跃路径，不受路径窗口限制）。
+ */
+#define P2P_MP_INIT_CWND    (10 * P2P_MAX_PAYLOAD)      /* 路径初始拥塞窗口 */
+#define P2P_MP_MIN_CWND     (2 * P2P_MAX_PAYLOAD)       /* 减窗下限 */
+
+/* 当前会话是否按多路径调度（cfg.multipath 且已直连，基础 reliable 层、无加密、非 multi_session） */
+bool path_manager_mp_enabled(const struct p2p_session *s);
+
+/*
+ * 为 len 字节的 DATA 选择发送路径
+ *
+ * @param force  true = 忽略路径拥塞窗口（重传）
+ * @return       路径索引；所有路径窗口已满返回 PATH_IDX_NONE
+ */
+int  path_manager_mp_pick(struct p2p_session *s, int len, bool force);
+
+/* DATA 在 path_idx 上发出 / 被确认（rtt_ms < 0 = 重传包，无有效样本）/ 判定丢失（sent_ms 为该次发送时间） */
+void path_manager_mp_on_send(struct p2p_session *s, int path_idx, int len);
+void path_manager_mp_on_ack(struct p2p_session *s, int path_idx, int len, int rtt_ms);
+void path_manager_mp_on_loss(struct p2p_session *s, int path_idx, int len, uint64_t sent_ms, uint64_t now_ms);
+
+/* ============================================================================
+ * 路径缓存（实例级，p2p_path_cache.c）
+ * ============================================================================
+ *
+ * 按 remote_peer_id 记录最后可用的直连路径（p2p_connected 时更新），
+ * p2p_connect 时取出交给 nat_resume 立即打洞；打洞超时未应答则作废。
+ * 分片线程下由 mtx 保护（叶子锁，持有期间不获取其他锁）。
+ */
+#define P2P_PATH_CACHE_SLOTS    16                          /* 缓存的对端数量（满时替换最早记录的） */
+#define P2P_PATH_CACHE_TTL_S    (7 * 24 * 3600)             /* 条目有效期 */
+#define P2P_PATH_CACHE_FLUSH_S  3600                        /* 路径不变时刷新文件时间戳的间隔 */
+
+typedef struct {
+    char                peer_id[P2P_PEER_ID_MAX];           // 对端 ID（空 = 空闲槽位）
+    p2p_path_hint_t     hint;
+} p2p_path_entry_t;
+
+typedef struct p2p_path_cache {
+    p2p_path_entry_t    slots[P2P_PATH_CACHE_SLOTS];
+#ifdef P2P_THREADED
+    P_mutex_t           mtx;
+#endif
+} p2p_path_cache_t;
+
+/* 创建（读取 path_cache_file）/ 释放（p2p_create / p2p_destroy，仅启用路径缓存时） */
+ret_t p2p_path_cache_create(struct p2p_instance *inst);
+void  p2p_path_cache_free(struct p2p_instance *inst);
+
+/* 取出对端的缓存路径（优先 on_path_load；过期条目顺带清除） */
+bool  p2p_path_cache_get(struct p2p_instance *inst, const char *peer_id, p2p_path_hint_t *hint);
+
+/* 记录 / 作废对端的缓存路径（同时通知 on_path_save） */
+void  p2p_path_cache_put(struct p2p_instance *inst, const char *peer_id, const p2p_path_hint_t *hint);
+void  p2p_path_cache_drop(struct p2p_instance *inst, const char *peer_id);
+
 ///////////////////////////////////////////////////////////////////////////////
 #endif /* P2P_PATH_MANAGER_H */
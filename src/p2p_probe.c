@@ -116,7 +116,7 @@ void probe_compact_on_response(struct p2p_session *s, uint16_t sid) {
     if (ctx->mode.compact.sid != sid) return;
 
     ctx->state = P2P_PROBE_STATE_SUCCESS;
-    ctx->complete_ms = P_tick_ms();
+    ctx->complete_ms = p2p_now_ms();
 
     print("I:", LA_F("%s: peer reachable via signaling (RTT: %" PRIu64 " ms)", LA_F178, 178), TASK_RELAY_PROBE, 
           tick_diff(ctx->complete_ms, ctx->start_ms));
@@ -133,7 +133,7 @@ void probe_relay_on_turn_success(struct p2p_session *s) {
     if (ctx->mode.relay.step != PROBE_RELAY_STEP_TURN_ALLOC) return;
 
     ctx->mode.relay.step = PROBE_RELAY_STEP_ADDR_EXCHANGE;
-    ctx->start_ms = P_tick_ms();
+    ctx->start_ms = p2p_now_ms();
     print("I:", LA_S("%s: TURN allocated, starting address exchange", LA_S22, 22), TASK_RELAY_PROBE);
 }
 
@@ -145,11 +145,11 @@ void probe_relay_on_exchange_done(struct p2p_session *s, bool success) {
 
     if (success) {
         ctx->mode.relay.step = PROBE_RELAY_STEP_UDP_PROBE;
-        ctx->start_ms = P_tick_ms();
+        ctx->start_ms = p2p_now_ms();
         print("I:", LA_S("%s: address exchange success, sending UDP probe", LA_S17, 17), TASK_RELAY_PROBE);
     } else {
         ctx->state = P2P_PROBE_STATE_PEER_OFFLINE;
-        ctx->complete_ms = P_tick_ms();
+        ctx->complete_ms = p2p_now_ms();
         print("W:", LA_S("%s: address exchange failed: peer OFFLINE", LA_S16, 16), TASK_RELAY_PROBE);
     }
 }
@@ -160,7 +160,7 @@ void probe_relay_on_udp_response(struct p2p_session *s) {
     if (ctx->state != P2P_PROBE_STATE_RUNNING) return;
     if (ctx->mode.relay.step != PROBE_RELAY_STEP_UDP_PROBE) return;
 
-    uint64_t now_ms = P_tick_ms();
+    uint64_t now_ms = p2p_now_ms();
     uint64_t rtt    = tick_diff(now_ms, ctx->start_ms);
 
     ctx->state = P2P_PROBE_STATE_SUCCESS;
@@ -202,11 +202,12 @@ static void probe_compact_tick(struct p2p_session *s, uint64_t now_ms) {
         // 发送 msg=0 空包（服务器会自动 echo 回复）
         case PROBE_COMPACT_PHASE_SENDING: {
 
-            print("I:", LA_F("%s: sent MSG(msg=0, sid=%u)", LA_F217, 217), TASK_RELAY_PROBE, ctx->mode.compact.sid);
-            ret_t ret = p2p_signal_compact_request(s, 0, NULL, 0);
-            if (ret != E_NONE) {
+            uint16_t sid = 0;
+            ret_t ret = p2p_signal_compact_request(s, 0, NULL, 0, &sid);
+            if (ret == E_NONE) {
+                print("I:", LA_F("%s: sent MSG(msg=0, sid=%u)", LA_F217, 217), TASK_RELAY_PROBE, sid);
                 ctx->mode.compact.phase = PROBE_COMPACT_PHASE_WAIT_ECHO;
-                ctx->mode.compact.sid   = s->sig_sess.compact.req_sid;
+                ctx->mode.compact.sid   = sid;
                 ctx->start_ms           = now_ms;
             } else { print("W:", LA_F("%s: send failed(%d)", LA_F215, 215), TASK_RELAY_PROBE, ret);
                 ctx->state = P2P_PROBE_STATE_READY;
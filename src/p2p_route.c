@@ -12,6 +12,13 @@
 #else
 #   include <ifaddrs.h>
 #   include <net/if.h>
+#   if defined(__linux__)
+#       include <linux/netlink.h>
+#       include <linux/rtnetlink.h>
+#   elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+#       include <net/route.h>
+#       define ROUTE_PF_ROUTE 1
+#   endif
 #endif
 
 /* 子网掩码前缀长度计算：GCC/Clang 使用内建指令，其他编译器使用位运算 */
@@ -28,40 +35,220 @@ static int mask_to_prefix(uint32_t mask_net) {
 
 ///////////////////////////////////////////////////////////////////////////////
 
-static route_ctx_t      g_ctx;
+/*
+ * 共享上下文双缓冲：重新枚举的结果写入非当前槽位后再切换 g_cur，
+ * 已取得旧指针的读者在下一次变化（至少 ROUTE_SETTLE_MS 之后）之前仍可安全读取
+ */
+static route_ctx_t      g_slot[2];
+static route_ctx_t*     g_cur = &g_slot[0];
 static int              g_ref = 0;
+static uint32_t         g_gen;                  /* 地址集合代次（route_shared_gen） */
+static uint64_t         g_dirty;                /* 最近一次变化通知时刻，0 = 无待处理通知 */
+static volatile long    g_lock;
+
+#if defined(_MSC_VER)
+#define ROUTE_LOCK()        while (_InterlockedExchange(&g_lock, 1)) {}
+#define ROUTE_TRYLOCK()     (!_InterlockedExchange(&g_lock, 1))
+#define ROUTE_UNLOCK()      _InterlockedExchange(&g_lock, 0)
+#else
+#define ROUTE_LOCK()        while (__atomic_exchange_n(&g_lock, 1, __ATOMIC_ACQUIRE)) {}
+#define ROUTE_TRYLOCK()     (!__atomic_exchange_n(&g_lock, 1, __ATOMIC_ACQUIRE))
+#define ROUTE_UNLOCK()      __atomic_store_n(&g_lock, 0, __ATOMIC_RELEASE)
+#endif
+
+/* 可作为 Host 候选的 IPv6 地址：排除未指定、环回、链路本地（fe80::/10）、组播与 IPv4-mapped */
+static bool ip6_usable(const uint8_t a[16]) {
+    static const uint8_t zero[16] = {0};
+    if (!memcmp(a, zero, 15) && (a[15] == 0 || a[15] == 1)) return false;
+    if (a[0] == 0xFE && (a[1] & 0xC0) == 0x80) return false;
+    if (a[0] == 0xFF) return false;
+    if (!memcmp(a, zero, 10) && a[10] == 0xFF && a[11] == 0xFF) return false;
+    return true;
+}
 
 static void route_final(route_ctx_t *rt) {
-    if (rt->local_addrs) free(rt->local_addrs);
+    if (rt->local_addrs) p2p_free(rt->local_addrs);
+    if (rt->local_addrs6) p2p_free(rt->local_addrs6);
     memset(rt, 0, sizeof(*rt));
 }
 
+/* 两次枚举的地址集合是否相同（按枚举顺序比较，顺序变化视为变化） */
+static bool route_same(const route_ctx_t *a, const route_ctx_t *b) {
+    if (a->addr_count != b->addr_count || a->addr6_count != b->addr6_count) return false;
+    for (int i = 0; i < a->addr_count; i++) {
+        if (a->local_addrs[i].sin_addr.s_addr != b->local_addrs[i].sin_addr.s_addr
+            || a->local_masks[i] != b->local_masks[i]) return false;
+    }
+    return !a->addr6_count || !memcmp(a->local_addrs6, b->local_addrs6, 16 * (size_t)a->addr6_count);
+}
+
+//-----------------------------------------------------------------------------
+
+/*
+ * 系统地址变化通知（非阻塞，由 route_shared_poll 读取）
+ *   Linux      netlink：RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR
+ *   macOS/BSD  PF_ROUTE 路由套接字：只关心 RTM_NEWADDR / RTM_DELADDR / RTM_IFINFO
+ *   Windows    NotifyAddrChange 重叠通知（事件置位即有变化，读取后重新登记）
+ * 通知只作为重新枚举的触发，不解析具体地址；其他平台或打开失败时仅依赖 route_shared_notify
+ */
+#if P_WIN
+
+static HANDLE           g_watch_h;
+static OVERLAPPED       g_watch_ov;
+
+static bool watch_open(void) {
+    memset(&g_watch_ov, 0, sizeof(g_watch_ov));
+    if (!(g_watch_ov.hEvent = WSACreateEvent())) return false;
+    if (NotifyAddrChange(&g_watch_h, &g_watch_ov) != ERROR_IO_PENDING) {
+        WSACloseEvent(g_watch_ov.hEvent);
+        g_watch_ov.hEvent = NULL;
+        return false;
+    }
+    return true;
+}
+
+static void watch_close(void) {
+    if (!g_watch_ov.hEvent) return;
+    CancelIPChangeNotify(&g_watch_ov);
+    WSACloseEvent(g_watch_ov.hEvent);
+    g_watch_ov.hEvent = NULL;
+}
+
+static bool watch_drain(void) {
+    if (!g_watch_ov.hEvent || WaitForSingleObject(g_watch_ov.hEvent, 0) != WAIT_OBJECT_0) return false;
+    WSAResetEvent(g_watch_ov.hEvent);
+    if (NotifyAddrChange(&g_watch_h, &g_watch_ov) != ERROR_IO_PENDING) watch_close();
+    return true;
+}
+
+#else
+
+static sock_t           g_watch = P_INVALID_SOCKET;
+
+static bool watch_open(void) {
+#if defined(__linux__)
+    g_watch = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+    if (g_watch == P_INVALID_SOCKET) return false;
+    struct sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+    if (bind(g_watch, (struct sockaddr *)&sa, sizeof(sa)) < 0) goto fail;
+#elif defined(ROUTE_PF_ROUTE)
+    g_watch = socket(PF_ROUTE, SOCK_RAW, AF_UNSPEC);
+    if (g_watch == P_INVALID_SOCKET) return false;
+#else
+    return false;
+#endif
+    if (P_sock_nonblock(g_watch, true) != E_NONE) goto fail;
+    return true;
+fail:
+    P_sock_close(g_watch);
+    g_watch = P_INVALID_SOCKET;
+    return false;
+}
+
+static void watch_close(void) {
+    if (g_watch == P_INVALID_SOCKET) return;
+    P_sock_close(g_watch);
+    g_watch = P_INVALID_SOCKET;
+}
+
+static bool watch_drain(void) {
+    if (g_watch == P_INVALID_SOCKET) return false;
+    bool changed = false;
+    uint8_t buf[4096];
+    for (;;) {
+        ssize_t n = recv(g_watch, (char *)buf, sizeof(buf), 0);
+        if (n < 0) {
+            if (errno == ENOBUFS) { changed = true; continue; }     // 接收队列溢出：通知已丢失，按变化处理
+            break;
+        }
+        if (n == 0) break;
+#if defined(ROUTE_PF_ROUTE)
+        if (n < (ssize_t)sizeof(struct rt_msghdr)) continue;
+        int type = ((const struct rt_msghdr *)buf)->rtm_type;      // 各类路由消息头部前几个字段布局一致
+        if (type == RTM_NEWADDR || type == RTM_DELADDR || type == RTM_IFINFO) changed = true;
+#else
+        changed = true;
+#endif
+    }
+    return changed;
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+
 ret_t route_shared_acquire(void) {
+
+    ROUTE_LOCK();
     if (g_ref > 0) {
         g_ref++;
+        ROUTE_UNLOCK();
         return E_NONE;
     }
 
-    ret_t ret = route_detect_local(&g_ctx);
+    ret_t ret = route_detect_local(g_cur);
     if (ret < 0) {
-        route_final(&g_ctx);
+        route_final(g_cur);
+        ROUTE_UNLOCK();
         return ret;
     }
 
+    if (!watch_open()) print("W:", LA_F("Address change notification unavailable", LA_F615, 615));
+    g_dirty = 0;
     g_ref = 1;
+    ROUTE_UNLOCK();
     return E_NONE;
 }
 
 void route_shared_release(void) {
-    if (g_ref <= 0) return;
-    g_ref--;
-    if (g_ref == 0) {
-        route_final(&g_ctx);
+    ROUTE_LOCK();
+    if (g_ref > 0 && --g_ref == 0) {
+        watch_close();
+        route_final(&g_slot[0]);
+        route_final(&g_slot[1]);
+        g_cur = &g_slot[0];
     }
+    ROUTE_UNLOCK();
 }
 
 const route_ctx_t *route_shared_get(void) {
-    return g_ref > 0 ? &g_ctx : NULL;
+    return g_ref > 0 ? __atomic_load_n(&g_cur, __ATOMIC_ACQUIRE) : NULL;
+}
+
+uint32_t route_shared_gen(void) {
+    return __atomic_load_n(&g_gen, __ATOMIC_ACQUIRE);
+}
+
+void route_shared_notify(void) {
+    ROUTE_LOCK();
+    if (!g_dirty) g_dirty = P_tick_ms();
+    ROUTE_UNLOCK();
+}
+
+bool route_shared_poll(uint64_t now) {
+
+    if (g_ref <= 0 || !ROUTE_TRYLOCK()) return false;
+    if (g_ref <= 0) { ROUTE_UNLOCK(); return false; }
+
+    // 地址变化通常成批到达（链路 up → 地址 → 路由）：每次通知重新计时，静默 ROUTE_SETTLE_MS 后才枚举
+    if (watch_drain()) g_dirty = now ? now : 1;
+    if (!g_dirty || tick_diff(now, g_dirty) < ROUTE_SETTLE_MS) { ROUTE_UNLOCK(); return false; }
+    g_dirty = 0;
+
+    route_ctx_t *next = g_cur == &g_slot[0] ? &g_slot[1] : &g_slot[0];
+    route_final(next);                          // 上上代结果，读者早已不再持有
+    bool changed = route_detect_local(next) >= 0 && !route_same(next, g_cur);
+    if (changed) {
+        __atomic_store_n(&g_cur, next, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&g_gen, 1, __ATOMIC_RELEASE);
+        print("I:", LA_F("Local addresses changed (gen=%u)", LA_F616, 616), g_gen);
+    }
+    else route_final(next);
+    ROUTE_UNLOCK();
+    return changed;
 }
 
 // 检测获取本地所有有效的网络地址
@@ -70,24 +257,25 @@ ret_t route_detect_local(route_ctx_t *rt) {
     printf("%s", LA_S("Detecting local network addresses", LA_S27, 27));
 
     rt->addr_count = 0;
+    rt->addr6_count = 0;
 
 #if P_WIN
-    /* Windows: 使用 GetAdaptersAddresses 枚举 IPv4 地址 */
+    /* Windows: 使用 GetAdaptersAddresses 枚举 IPv4 / IPv6 地址 */
     ULONG bufLen = 15000;
     PIP_ADAPTER_ADDRESSES pAddrs = NULL;
     DWORD ret;
 
     do {
-        pAddrs = (PIP_ADAPTER_ADDRESSES)malloc(bufLen);
+        pAddrs = (PIP_ADAPTER_ADDRESSES)p2p_malloc(bufLen);
         if (!pAddrs) return -1;
-        ret = GetAdaptersAddresses(AF_INET,
+        ret = GetAdaptersAddresses(AF_UNSPEC,
                 GAA_FLAG_SKIP_ANYCAST | GAA_FLAG_SKIP_MULTICAST |
                 GAA_FLAG_SKIP_DNS_SERVER,
                 NULL, pAddrs, &bufLen);
-        if (ret == ERROR_BUFFER_OVERFLOW) { free(pAddrs); pAddrs = NULL; }
+        if (ret == ERROR_BUFFER_OVERFLOW) { p2p_free(pAddrs); pAddrs = NULL; }
     } while (ret == ERROR_BUFFER_OVERFLOW);
 
-    if (ret != NO_ERROR) { free(pAddrs); return -1; }
+    if (ret != NO_ERROR) { p2p_free(pAddrs); return -1; }
 
     for (PIP_ADAPTER_ADDRESSES a = pAddrs; a != NULL; a = a->Next) {
         if (a->OperStatus != IfOperStatusUp) continue;                                              /* 接口未启动 */
@@ -98,8 +286,8 @@ ret_t route_detect_local(route_ctx_t *rt) {
         }
     }
 
-    rt->local_addrs = malloc((sizeof(struct sockaddr_in) + sizeof(uint32_t)) * rt->addr_count);
-    if (!rt->local_addrs) { free(pAddrs); return -1; }
+    rt->local_addrs = p2p_malloc((sizeof(struct sockaddr_in) + sizeof(uint32_t)) * rt->addr_count);
+    if (!rt->local_addrs) { p2p_free(pAddrs); return -1; }
     rt->local_masks = (uint32_t *)(rt->local_addrs + rt->addr_count);
 
     int i=0;
@@ -114,7 +302,26 @@ ret_t route_detect_local(route_ctx_t *rt) {
         }
     }
 
-    free(pAddrs);
+    int n6 = 0;
+    for (PIP_ADAPTER_ADDRESSES a = pAddrs; a != NULL; a = a->Next) {
+        if (a->OperStatus != IfOperStatusUp || a->IfType == IF_TYPE_SOFTWARE_LOOPBACK) continue;
+        for (PIP_ADAPTER_UNICAST_ADDRESS ua = a->FirstUnicastAddress; ua != NULL; ua = ua->Next) {
+            const struct sockaddr_in6 *sa6 = (const struct sockaddr_in6 *)ua->Address.lpSockaddr;
+            if (sa6->sin6_family == AF_INET6 && ip6_usable((const uint8_t *)&sa6->sin6_addr)) n6++;
+        }
+    }
+    if (n6 && (rt->local_addrs6 = p2p_malloc(16 * (size_t)n6)) != NULL) {
+        for (PIP_ADAPTER_ADDRESSES a = pAddrs; a != NULL; a = a->Next) {
+            if (a->OperStatus != IfOperStatusUp || a->IfType == IF_TYPE_SOFTWARE_LOOPBACK) continue;
+            for (PIP_ADAPTER_UNICAST_ADDRESS ua = a->FirstUnicastAddress; ua != NULL; ua = ua->Next) {
+                const struct sockaddr_in6 *sa6 = (const struct sockaddr_in6 *)ua->Address.lpSockaddr;
+                if (sa6->sin6_family != AF_INET6 || !ip6_usable((const uint8_t *)&sa6->sin6_addr)) continue;
+                memcpy(rt->local_addrs6[rt->addr6_count++], &sa6->sin6_addr, 16);
+            }
+        }
+    }
+
+    p2p_free(pAddrs);
 #else
     /* POSIX: 使用 getifaddrs */
     struct ifaddrs *ifa_list, *ifa;
@@ -128,7 +335,7 @@ ret_t route_detect_local(route_ctx_t *rt) {
         ++rt->addr_count;
     }
 
-    rt->local_addrs = malloc((sizeof(struct sockaddr_in) + sizeof(uint32_t)) * rt->addr_count);
+    rt->local_addrs = p2p_malloc((sizeof(struct sockaddr_in) + sizeof(uint32_t)) * rt->addr_count);
     if (!rt->local_addrs) return -1;
     rt->local_masks = (uint32_t *)(rt->local_addrs + rt->addr_count);
 
@@ -143,11 +350,31 @@ ret_t route_detect_local(route_ctx_t *rt) {
         rt->local_masks[i++] = ((struct sockaddr_in *)ifa->ifa_netmask)->sin_addr.s_addr;   // 计算子网掩码
     }
 
+    // IPv6：同一地址可能出现在多个接口条目中，按地址去重
+    int n6 = 0;
+    for (ifa = ifa_list; ifa != NULL; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET6) continue;
+        if ((ifa->ifa_flags & IFF_LOOPBACK) || !(ifa->ifa_flags & IFF_UP)) continue;
+        if (ip6_usable((const uint8_t *)&((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr)) n6++;
+    }
+    if (n6 && (rt->local_addrs6 = p2p_malloc(16 * (size_t)n6)) != NULL) {
+        for (ifa = ifa_list; ifa != NULL; ifa = ifa->ifa_next) {
+            if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET6) continue;
+            if ((ifa->ifa_flags & IFF_LOOPBACK) || !(ifa->ifa_flags & IFF_UP)) continue;
+            const uint8_t *a6 = (const uint8_t *)&((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr;
+            if (!ip6_usable(a6)) continue;
+            int k = 0;
+            while (k < rt->addr6_count && memcmp(rt->local_addrs6[k], a6, 16)) k++;
+            if (k == rt->addr6_count) memcpy(rt->local_addrs6[rt->addr6_count++], a6, 16);
+        }
+    }
+
     freeifaddrs(ifa_list);
 #endif
 
     print("I:", LA_F("Local address detection done: %d address(es)", LA_F318, 318), rt->addr_count);
-    if (p2p_log_level == P2P_LOG_LEVEL_VERBOSE) {
+    if (rt->addr6_count) print("I:", LA_F("Local IPv6 address detection done: %d address(es)", LA_F526, 526), rt->addr6_count);
+    if (P2P_LOG_ON(VERBOSE)) {
         for (i = 0; i < rt->addr_count; i++) {
             print("V:", LA_F("  [%d] %s/%d", LA_F36, 36), i,
                   inet_ntoa(rt->local_addrs[i].sin_addr), mask_to_prefix(rt->local_masks[i]));
@@ -10,19 +10,37 @@ typedef struct {
     struct sockaddr_in* local_addrs;
     uint32_t*           local_masks;
     int                 addr_count;
+    uint8_t           (*local_addrs6)[16];      // 全局单播 / ULA IPv6 地址（不含链路本地与环回）
+    int                 addr6_count;
 } route_ctx_t;
 
+#define ROUTE_SETTLE_MS         200         /* 地址变化通知静默该时长后才重新枚举（变化通常成批到达） */
+
 /*
  * 全局共享路由模块生命周期（进程内共享）
  *
- * - route_shared_acquire: 引用+1；首次调用时执行本地网卡探测
- * - route_shared_release: 引用-1；归零时释放缓存
- * - route_shared_get: 获取只读共享上下文（未 acquire 时返回 NULL）
+ * - route_shared_acquire: 引用+1；首次调用时执行本地网卡探测，并订阅系统地址变化通知
+ * - route_shared_release: 引用-1；归零时释放缓存、关闭通知
+ * - route_shared_get: 获取只读共享上下文（未 acquire 时返回 NULL）；地址变化后返回新的上下文，
+ *   已取得的旧上下文在下一次变化前保持有效，调用方不应跨 update 持有
  */
 ret_t route_shared_acquire(void);
 void route_shared_release(void);
 const route_ctx_t *route_shared_get(void);
 
+/*
+ * 地址变化检测（netlink / PF_ROUTE / NotifyAddrChange）
+ *
+ * - route_shared_poll: 读取变化通知，静默 ROUTE_SETTLE_MS 后重新枚举；地址集合确有变化时
+ *   发布新上下文、递增代次并返回 true（同一次变化只对一个调用方返回 true）。
+ *   非阻塞：其他线程正在检测时直接返回 false
+ * - route_shared_gen: 当前地址集合代次，各实例据此判断是否已处理最近一次变化
+ * - route_shared_notify: 手动登记一次变化（系统通知不可用时由 p2p_network_changed 触发）
+ */
+bool route_shared_poll(uint64_t now);
+uint32_t route_shared_gen(void);
+void route_shared_notify(void);
+
 //-----------------------------------------------------------------------------
 
 /*
@@ -0,0 +1,661 @@
+/*
+ * P2P MSG RPC 分片传输实现
+ *
+ * 内部按 signaling_mode 分发到 COMPACT / RELAY 的 request/response，会话连通后改经
+ * reliable 层直连发送；每个分片即一个普通 RPC，重传、去重、窗口沿用所经路径的机制，
+ * 本模块只负责路径选择、切片、重组、拉取与整体超时。协议说明见 p2p_rpc.h。
+ */
+
+#define MOD_TAG "RPC"
+
+#include "p2p_internal.h"
+#include "p2p_rpc.h"
+#include "p2p_signal_compact.h"
+#include "p2p_signal_relay.h"
+
+#define TASK_FRAG                       "RPC FRAG"
+#define TASK_DIRECT                     "RPC DIRECT"
+
+///////////////////////////////////////////////////////////////////////////////
+
+static ret_t sig_request(struct p2p_session *s, const uint8_t *frame, int len, uint16_t *sid) {
+    return rpc_send_request(s, P2P_MSG_FRAG, frame, len, sid);
+}
+
+static ret_t sig_response(struct p2p_session *s, uint16_t sid, const uint8_t *frame, int len) {
+    return rpc_send_response(s, sid, P2P_MSG_FRAG, frame, len);
+}
+
+static uint32_t max_size(struct p2p_session *s) {
+    int m = s->inst->cfg.rpc_max_size;
+    if (m <= 0) return RPC_FRAG_DEFAULT_MAX;
+    return m > RPC_FRAG_LIMIT ? RPC_FRAG_LIMIT : (uint32_t)m;
+}
+
+static uint16_t frag_count(uint32_t total) {
+    return (uint16_t)((total + RPC_FRAG_CHUNK - 1) / RPC_FRAG_CHUNK);
+}
+
+static int frag_len(uint32_t total, uint16_t idx) {
+    uint32_t off = (uint32_t)idx * RPC_FRAG_CHUNK;
+    return total - off > RPC_FRAG_CHUNK ? RPC_FRAG_CHUNK : (int)(total - off);
+}
+
+/* 写帧头，返回帧头长度 */
+static int frame_hdr(uint8_t *p, uint8_t kind, uint16_t xid, uint16_t idx, uint32_t total, uint8_t code) {
+    p[0] = kind;
+    nwrite_s(p + 1, xid);
+    nwrite_s(p + 3, idx);
+    nwrite_l(p + 5, total);
+    p[9] = code;
+    return RPC_FRAG_HDR;
+}
+
+typedef struct {
+    uint8_t kind, code; uint16_t xid, idx; uint32_t total;
+    const uint8_t *chunk; int chunk_len;
+} frame_t;
+
+static bool frame_parse(const uint8_t *data, int len, frame_t *f) {
+    if (!data || len < RPC_FRAG_HDR) return false;
+    f->kind  = data[0];
+    f->xid   = nget_s(data + 1);
+    f->idx   = nget_s(data + 3);
+    f->total = nget_l(data + 5);
+    f->code  = data[9];
+    f->chunk = data + RPC_FRAG_HDR;
+    f->chunk_len = len - RPC_FRAG_HDR;
+    return true;
+}
+
+/* DATA 帧的分片序号与长度是否与总长一致 */
+static bool frame_chunk_ok(const frame_t *f) {
+    return f->total > 0 && f->idx < frag_count(f->total) && f->chunk_len == frag_len(f->total, f->idx);
+}
+
+static rpc_frag_flight_t *flight_find(rpc_frag_t *ctx, uint16_t sid) {
+    for (int i = 0; i < P2P_RPC_WINDOW_MAX; i++)
+        if (ctx->flight[i].sid == sid) return &ctx->flight[i];
+    return NULL;
+}
+
+static void deliver(struct p2p_session *s, uint16_t sid, uint8_t code, const void *data, int len) {
+    if (s->inst->cfg.on_response)
+        s->inst->cfg.on_response((p2p_session_t)s, sid, code, data, len, s->inst->cfg.userdata);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static void tx_fail(struct p2p_session *s, uint8_t code) {
+    rpc_frag_t *ctx = &s->rpc;
+    uint16_t sid = ctx->tx_sid;
+    p2p_free(ctx->tx_buf); ctx->tx_buf = NULL;
+
+    print("W:", LA_F("%s: request (sid=%u) failed, code=%u\n", LA_F579, 579), TASK_FRAG, sid, code);
+    deliver(s, sid, code, NULL, -1);
+}
+
+static void dl_fail(struct p2p_session *s, uint8_t code) {
+    rpc_frag_t *ctx = &s->rpc;
+    uint16_t sid = ctx->dl_sid;
+    p2p_free(ctx->dl_buf); ctx->dl_buf = NULL;
+    p2p_free(ctx->dl_map); ctx->dl_map = NULL;
+
+    print("W:", LA_F("%s: response (sid=%u) pull failed, code=%u\n", LA_F580, 580), TASK_FRAG, sid, code);
+    deliver(s, sid, code, NULL, -1);
+}
+
+/* 在窗口允许的范围内继续发送请求分片、拉取应答分片 */
+static void pump(struct p2p_session *s, uint64_t now) {
+    rpc_frag_t *ctx = &s->rpc;
+    uint8_t frame[P2P_MSG_DATA_MAX];
+
+    while (ctx->tx_buf && ctx->tx_next < frag_count(ctx->tx_len)) {
+        rpc_frag_flight_t *f = flight_find(ctx, 0);
+        if (!f) break;
+
+        uint16_t idx = ctx->tx_next, sid = 0;
+        int n = frame_hdr(frame, RPC_FRAG_DATA, ctx->tx_xid, idx, ctx->tx_len, ctx->tx_msg);
+        int cl = frag_len(ctx->tx_len, idx);
+        memcpy(frame + n, ctx->tx_buf + (size_t)idx * RPC_FRAG_CHUNK, (size_t)cl);
+
+        // 窗口已满（或信令暂不可用）时停下，等待应答或下次 tick；长期无进展由整体超时结束
+        if (sig_request(s, frame, n + cl, &sid) != E_NONE) break;
+
+        f->sid = sid; f->idx = idx; f->xid = ctx->tx_xid; f->pull = 0; f->send_ms = now;
+        ctx->tx_next++;
+    }
+
+    while (ctx->dl_buf && ctx->dl_next < frag_count(ctx->dl_len)) {
+        rpc_frag_flight_t *f = flight_find(ctx, 0);
+        if (!f) break;
+
+        uint16_t idx = ctx->dl_next, sid = 0;
+        int n = frame_hdr(frame, RPC_FRAG_PULL, ctx->dl_xid, idx, ctx->dl_len, 0);
+
+        if (sig_request(s, frame, n, &sid) != E_NONE) break;
+
+        f->sid = sid; f->idx = idx; f->xid = ctx->dl_xid; f->pull = 1; f->send_ms = now;
+        ctx->dl_next++;
+    }
+}
+
+/* A 端收到大应答的首片（DATA idx=0）：数据不超过一片时直接交付，否则开始拉取 */
+static void dl_start(struct p2p_session *s, uint16_t sid, const frame_t *fr, uint64_t now) {
+    rpc_frag_t *ctx = &s->rpc;
+
+    if (fr->kind != RPC_FRAG_DATA || fr->idx != 0 || !frame_chunk_ok(fr)) {
+        print("E:", LA_F("%s: bad response frame (sid=%u)\n", LA_F581, 581), TASK_FRAG, sid);
+        deliver(s, sid, P2P_MSG_ERR_FRAG, NULL, -1);
+        return;
+    }
+    if (fr->total <= RPC_FRAG_CHUNK) {
+        deliver(s, sid, fr->code, fr->chunk, fr->chunk_len);
+        return;
+    }
+    if (fr->total > max_size(s) || ctx->dl_buf) {
+        print("W:", LA_F("%s: response (sid=%u, len=%u) rejected, %s\n", LA_F582, 582),
+              TASK_FRAG, sid, fr->total, ctx->dl_buf ? "another pull in progress" : "exceeds rpc_max_size");
+        deliver(s, sid, P2P_MSG_ERR_FRAG, NULL, -1);
+        return;
+    }
+
+    ctx->dl_buf = (uint8_t*)p2p_malloc(fr->total);
+    ctx->dl_map = (uint8_t*)p2p_calloc((size_t)(frag_count(fr->total) + 7) / 8, 1);
+    if (!ctx->dl_buf || !ctx->dl_map) {
+        p2p_free(ctx->dl_buf); ctx->dl_buf = NULL;
+        p2p_free(ctx->dl_map); ctx->dl_map = NULL;
+        deliver(s, sid, P2P_MSG_ERR_FRAG, NULL, -1);
+        return;
+    }
+    memcpy(ctx->dl_buf, fr->chunk, (size_t)fr->chunk_len);
+    ctx->dl_map[0] = 1;
+    ctx->dl_len  = fr->total;
+    ctx->dl_sid  = sid;
+    ctx->dl_xid  = fr->xid;
+    ctx->dl_code = fr->code;
+    ctx->dl_next = 1;
+    ctx->dl_got  = 1;
+    ctx->dl_ms   = now;
+
+    print("V:", LA_F("%s: pulling response (sid=%u, len=%u)\n", LA_F583, 583), TASK_FRAG, sid, fr->total);
+    pump(s, now);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void rpc_init(rpc_frag_t *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void rpc_reset(struct p2p_session *s) {
+    rpc_frag_t *ctx = &s->rpc;
+    p2p_free(ctx->tx_buf);
+    p2p_free(ctx->dl_buf); p2p_free(ctx->dl_map);
+    p2p_free(ctx->rx_buf); p2p_free(ctx->rx_map);
+    p2p_free(ctx->up_buf);
+    for (int i = 0; i < P2P_RPC_WINDOW_MAX && ctx->dpend[i]; i++) p2p_free(ctx->dpend[i]);
+    rpc_init(ctx);
+}
+
+ret_t rpc_request(struct p2p_session *s, uint8_t msg, const void *data, int len, uint16_t *sid_out) {
+    rpc_frag_t *ctx = &s->rpc;
+
+    P_check(data && len > RPC_FRAG_CHUNK, return E_INVALID;)
+    if ((uint32_t)len > max_size(s)) {
+        print("E:", LA_F("%s: request len=%d exceeds rpc_max_size=%u\n", LA_F584, 584), TASK_FRAG, len, max_size(s));
+        return E_INVALID;
+    }
+    if (ctx->tx_buf) return E_BUSY;                                                 // 同时只发一个大请求
+
+    rpc_frag_flight_t *f = flight_find(ctx, 0);
+    if (!f) return E_BUSY;
+
+    uint8_t frame[P2P_MSG_DATA_MAX]; uint16_t sid = 0;
+    uint16_t xid = ++ctx->tx_seq;
+    if (xid == 0) xid = ++ctx->tx_seq;
+
+    // 首片同步发出：失败直接返回错误（不触发回调），成功后其 sid 即整个请求的 sid
+    int n = frame_hdr(frame, RPC_FRAG_DATA, xid, 0, (uint32_t)len, msg);
+    memcpy(frame + n, data, RPC_FRAG_CHUNK);
+    uint8_t *buf = (uint8_t*)p2p_malloc((size_t)len);
+    if (!buf) return E_OUT_OF_MEMORY;
+
+    ret_t ret = sig_request(s, frame, n + RPC_FRAG_CHUNK, &sid);
+    if (ret != E_NONE) { p2p_free(buf); return ret; }
+
+    memcpy(buf, data, (size_t)len);
+    uint64_t now = p2p_now_ms();
+    ctx->tx_buf   = buf;
+    ctx->tx_len   = (uint32_t)len;
+    ctx->tx_xid   = xid;
+    ctx->tx_sid   = sid;
+    ctx->tx_msg   = msg;
+    ctx->tx_next  = 1;
+    ctx->tx_acked = 0;
+    ctx->tx_ms    = now;
+    f->sid = sid; f->idx = 0; f->xid = xid; f->pull = 0; f->send_ms = now;
+
+    print("V:", LA_F("%s: request (sid=%u) len=%d in %u fragments\n", LA_F585, 585), TASK_FRAG, sid, len, frag_count((uint32_t)len));
+    pump(s, now);
+    if (sid_out) *sid_out = sid;
+    return E_NONE;
+}
+
+bool rpc_holds(struct p2p_session *s, uint16_t sid) {
+    return s->rpc.rx_sid && (sid == 0 || sid == s->rpc.rx_sid);
+}
+
+ret_t rpc_response(struct p2p_session *s, uint16_t sid, uint8_t code, const void *data, int len) {
+    rpc_frag_t *ctx = &s->rpc;
+
+    P_check(len >= 0 && (len == 0 || data), return E_INVALID;)
+    if ((uint32_t)len > max_size(s)) {
+        print("E:", LA_F("%s: response len=%d exceeds rpc_max_size=%u\n", LA_F586, 586), TASK_FRAG, len, max_size(s));
+        return E_INVALID;
+    }
+
+    // 超过一片的部分缓存供 A 端拉取；同时只缓存一个
+    uint8_t *buf = NULL;
+    if (len > RPC_FRAG_CHUNK) {
+        if (ctx->up_buf) return E_BUSY;
+        if (!(buf = (uint8_t*)p2p_malloc((size_t)len))) return E_OUT_OF_MEMORY;
+        memcpy(buf, data, (size_t)len);
+    }
+
+    uint16_t xid = ++ctx->up_seq;
+    if (xid == 0) xid = ++ctx->up_seq;
+
+    uint8_t frame[P2P_MSG_DATA_MAX];
+    int cl = len > RPC_FRAG_CHUNK ? RPC_FRAG_CHUNK : len;
+    int n = frame_hdr(frame, RPC_FRAG_DATA, xid, 0, (uint32_t)len, code);
+    if (cl > 0) memcpy(frame + n, data, (size_t)cl);
+
+    bool held = rpc_holds(s, sid);
+    ret_t ret = sig_response(s, held ? ctx->rx_sid : sid, frame, n + cl);
+    if (ret != E_NONE) { p2p_free(buf); return ret; }
+    if (held) ctx->rx_sid = 0;
+
+    if (buf) {
+        ctx->up_buf    = buf;
+        ctx->up_len    = (uint32_t)len;
+        ctx->up_xid    = xid;
+        ctx->up_code   = code;
+        ctx->up_served = 0;
+        ctx->up_ms     = p2p_now_ms();
+    }
+    return E_NONE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static void reply(struct p2p_session *s, uint16_t sid, uint8_t kind, const frame_t *fr) {
+    uint8_t frame[RPC_FRAG_HDR];
+    int n = frame_hdr(frame, kind, fr->xid, fr->idx, fr->total, 0);
+    sig_response(s, sid, frame, n);
+}
+
+/* PULL：返回缓存大应答的指定分片，全部拉取后释放缓存 */
+static void on_pull(struct p2p_session *s, uint16_t sid, const frame_t *fr, uint64_t now) {
+    rpc_frag_t *ctx = &s->rpc;
+
+    if (!ctx->up_buf || fr->xid != ctx->up_xid || fr->idx == 0 || fr->idx >= frag_count(ctx->up_len)) {
+        print("W:", LA_F("%s: pull rejected (xid=%u idx=%u)\n", LA_F587, 587), TASK_FRAG, fr->xid, fr->idx);
+        reply(s, sid, RPC_FRAG_REJECT, fr);
+        return;
+    }
+
+    uint8_t frame[P2P_MSG_DATA_MAX];
+    int cl = frag_len(ctx->up_len, fr->idx);
+    int n = frame_hdr(frame, RPC_FRAG_DATA, ctx->up_xid, fr->idx, ctx->up_len, ctx->up_code);
+    memcpy(frame + n, ctx->up_buf + (size_t)fr->idx * RPC_FRAG_CHUNK, (size_t)cl);
+    if (sig_response(s, sid, frame, n + cl) != E_NONE) return;
+
+    ctx->up_ms = now;
+    if (++ctx->up_served >= frag_count(ctx->up_len) - 1) {
+        p2p_free(ctx->up_buf); ctx->up_buf = NULL;
+    }
+}
+
+void rpc_on_request(struct p2p_session *s, uint16_t sid, const uint8_t *data, int len) {
+    rpc_frag_t *ctx = &s->rpc;
+    uint64_t now = p2p_now_ms();
+
+    frame_t fr;
+    if (!frame_parse(data, len, &fr)) {
+        static const frame_t none;
+        reply(s, sid, RPC_FRAG_REJECT, &none);
+        return;
+    }
+    if (fr.kind == RPC_FRAG_PULL) { on_pull(s, sid, &fr, now); return; }
+
+    if (fr.kind != RPC_FRAG_DATA || !frame_chunk_ok(&fr) || fr.total > max_size(s)) {
+        print("W:", LA_F("%s: request fragment rejected (xid=%u idx=%u total=%u)\n", LA_F588, 588),
+              TASK_FRAG, fr.xid, fr.idx, fr.total);
+        reply(s, sid, RPC_FRAG_REJECT, &fr);
+        return;
+    }
+
+    // 分片可能乱序到达，任一分片都可开启重组（每片都携带 xid 与总长）
+    if (!ctx->rx_buf || ctx->rx_xid != fr.xid || ctx->rx_len != fr.total) {
+        p2p_free(ctx->rx_buf); p2p_free(ctx->rx_map);
+        ctx->rx_buf = (uint8_t*)p2p_malloc(fr.total);
+        ctx->rx_map = (uint8_t*)p2p_calloc((size_t)(frag_count(fr.total) + 7) / 8, 1);
+        if (!ctx->rx_buf || !ctx->rx_map) {
+            p2p_free(ctx->rx_buf); ctx->rx_buf = NULL;
+            p2p_free(ctx->rx_map); ctx->rx_map = NULL;
+            reply(s, sid, RPC_FRAG_REJECT, &fr);
+            return;
+        }
+        ctx->rx_len = fr.total;
+        ctx->rx_xid = fr.xid;
+        ctx->rx_msg = fr.code;
+        ctx->rx_got = 0;
+    }
+    ctx->rx_ms = now;
+
+    uint8_t bit = (uint8_t)(1u << (fr.idx & 7));
+    if (!(ctx->rx_map[fr.idx >> 3] & bit)) {
+        ctx->rx_map[fr.idx >> 3] |= bit;
+        memcpy(ctx->rx_buf + (size_t)fr.idx * RPC_FRAG_CHUNK, fr.chunk, (size_t)fr.chunk_len);
+        ctx->rx_got++;
+    }
+    if (ctx->rx_got < frag_count(ctx->rx_len)) {
+        reply(s, sid, RPC_FRAG_ACK, &fr);
+        return;
+    }
+
+    // 收齐：以最后到达分片的 sid 交给应用，回复经 rpc_response 以帧格式返回
+    uint8_t *buf = ctx->rx_buf; uint32_t total = ctx->rx_len; uint8_t msg = ctx->rx_msg;
+    ctx->rx_buf = NULL;
+    p2p_free(ctx->rx_map); ctx->rx_map = NULL;
+    if (ctx->rx_sid) {
+        print("W:", LA_F("%s: request (sid=%u) overrides unanswered request (sid=%u)\n", LA_F589, 589),
+              TASK_FRAG, sid, ctx->rx_sid);
+    }
+    ctx->rx_sid = sid;
+
+    print("V:", LA_F("%s: request reassembled (sid=%u) msg=%u len=%u\n", LA_F590, 590), TASK_FRAG, sid, msg, total);
+
+    if (msg == 0) rpc_response(s, sid, 0, buf, (int)total);                         // echo
+    else if (s->inst->cfg.on_request)
+        s->inst->cfg.on_request((p2p_session_t)s, sid, msg, buf, (int)total, s->inst->cfg.userdata);
+    p2p_free(buf);
+}
+
+void rpc_on_response(struct p2p_session *s, uint16_t sid, uint8_t code, const uint8_t *data, int len) {
+    rpc_frag_t *ctx = &s->rpc;
+    uint64_t now = p2p_now_ms();
+    frame_t fr;
+
+    rpc_frag_flight_t *f = sid ? flight_find(ctx, sid) : NULL;
+    if (!f) {
+        // 普通请求的大应答
+        if (len >= 0 && code == P2P_MSG_FRAG && frame_parse(data, len, &fr)) dl_start(s, sid, &fr, now);
+        else deliver(s, sid, code, data, len);
+        return;
+    }
+    rpc_frag_flight_t fl = *f;
+    f->sid = 0;
+
+    bool ok = len >= 0 && code == P2P_MSG_FRAG && frame_parse(data, len, &fr);
+
+    if (fl.pull) {
+        if (!ctx->dl_buf || fl.xid != ctx->dl_xid) return;                          // 已放弃的拉取
+        if (len < 0) { dl_fail(s, code); return; }
+        if (!ok || fr.kind != RPC_FRAG_DATA || fr.xid != ctx->dl_xid || fr.idx != fl.idx
+            || fr.total != ctx->dl_len || !frame_chunk_ok(&fr)) { dl_fail(s, P2P_MSG_ERR_FRAG); return; }
+
+        uint8_t bit = (uint8_t)(1u << (fr.idx & 7));
+        if (!(ctx->dl_map[fr.idx >> 3] & bit)) {
+            ctx->dl_map[fr.idx >> 3] |= bit;
+            memcpy(ctx->dl_buf + (size_t)fr.idx * RPC_FRAG_CHUNK, fr.chunk, (size_t)fr.chunk_len);
+            ctx->dl_got++;
+        }
+        ctx->dl_ms = now;
+
+        if (ctx->dl_got == frag_count(ctx->dl_len)) {
+            uint8_t *buf = ctx->dl_buf;
+            ctx->dl_buf = NULL;
+            p2p_free(ctx->dl_map); ctx->dl_map = NULL;
+            print("I:", LA_F("%s: response complete (sid=%u) len=%u\n", LA_F591, 591), TASK_FRAG, ctx->dl_sid, ctx->dl_len);
+            deliver(s, ctx->dl_sid, ctx->dl_code, buf, (int)ctx->dl_len);
+            p2p_free(buf);
+            return;
+        }
+        pump(s, now);
+        return;
+    }
+
+    if (!ctx->tx_buf || fl.xid != ctx->tx_xid) return;                              // 已结束的请求
+    if (len < 0) { tx_fail(s, code); return; }
+    if (!ok || fr.kind == RPC_FRAG_REJECT || fr.kind == RPC_FRAG_PULL) {
+        print("W:", LA_F("%s: fragment %u rejected by peer\n", LA_F592, 592), TASK_FRAG, fl.idx);
+        tx_fail(s, P2P_MSG_ERR_FRAG);
+        return;
+    }
+    if (fr.kind == RPC_FRAG_ACK) {
+        ctx->tx_acked++;
+        ctx->tx_ms = now;
+        pump(s, now);
+        return;
+    }
+
+    // 最终应答：请求发送完成，应答按大应答处理（剩余在途分片的应答随后到达时丢弃）
+    uint16_t app_sid = ctx->tx_sid;
+    p2p_free(ctx->tx_buf); ctx->tx_buf = NULL;
+    dl_start(s, app_sid, &fr, now);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/* 直连通道可用：会话已连通、应用数据经本端 reliable 层发送，且对端能解析 RPC 帧 */
+static bool direct_up(struct p2p_session *s) {
+    if (s->state != P2P_STATE_CONNECTED && s->state != P2P_STATE_RELAY) return false;
+    if (s->trans && (s->trans->send_data || (s->trans->is_ready && !s->trans->is_ready(s)))) return false;
+    return s->reliable.rpc;
+}
+
+/* 与信令 RPC 共用 sid 计数器：两条路径的 sid 不重复，on_response 按 sid 即可匹配 */
+static uint16_t direct_sid(struct p2p_session *s) {
+    uint16_t *seq;
+    switch (s->inst->sig_mode) {
+        case P2P_SIGNALING_MODE_COMPACT: seq = &s->sig_sess.compact.rpc_next_sid; break;
+        case P2P_SIGNALING_MODE_RELAY:   seq = &s->sig_sess.relay.rpc_next_sid; break;
+        default:                         seq = &s->rpc.dsid; break;
+    }
+    uint16_t sid = ++*seq;
+    if (sid == 0) sid = ++*seq;
+    return sid;
+}
+
+/* 组 DATA 包：[offset=0][P2P_FRAG_RPC][kind][sid][code][data]，返回包长 */
+static int direct_pkt(uint8_t *pkt, uint8_t kind, uint16_t sid, uint8_t code, const void *data, int len) {
+    nwrite_l(pkt, 0);
+    pkt[4] = P2P_FRAG_RPC;
+    uint8_t *p = pkt + P2P_DATA_HDR_SIZE;
+    p[0] = kind;
+    nwrite_s(p + 1, sid);
+    p[3] = code;
+    if (len > 0) memcpy(p + RPC_DIRECT_HDR, data, (size_t)len);
+    return P2P_DATA_HDR_SIZE + RPC_DIRECT_HDR + len;
+}
+
+/* 交给 reliable 层（高优先级：不排在流数据之后），窗口已满返回 false */
+static bool direct_push(struct p2p_session *s, const uint8_t *pkt, int len) {
+    if (reliable_window_avail(s) <= 0 || reliable_send_pkt(s, pkt, len) != 0) return false;
+    reliable_set_prio(s, P2P_PRIO_HIGH);
+    return true;
+}
+
+/* 按序补发暂存的应答包 */
+static void direct_flush(struct p2p_session *s) {
+    rpc_frag_t *ctx = &s->rpc;
+    int n = 0;
+    while (n < P2P_RPC_WINDOW_MAX && ctx->dpend[n] && direct_push(s, ctx->dpend[n], ctx->dpend_len[n])) {
+        p2p_free(ctx->dpend[n]);
+        n++;
+    }
+    if (!n) return;
+    for (int i = n; i < P2P_RPC_WINDOW_MAX; i++) {
+        ctx->dpend[i - n] = ctx->dpend[i];
+        ctx->dpend_len[i - n] = ctx->dpend_len[i];
+    }
+    for (int i = P2P_RPC_WINDOW_MAX - n; i < P2P_RPC_WINDOW_MAX; i++) ctx->dpend[i] = NULL;
+}
+
+static int rpc_window(struct p2p_session *s) {
+    int window = s->inst->cfg.rpc_window;
+    return window <= 0 || window > P2P_RPC_WINDOW_MAX ? P2P_RPC_WINDOW_MAX : window;
+}
+
+ret_t rpc_send_request(struct p2p_session *s, uint8_t msg, const void *data, int len, uint16_t *sid_out) {
+    rpc_frag_t *ctx = &s->rpc;
+
+    P_check(len >= 0 && len <= P2P_MSG_DATA_MAX && (len == 0 || data), return E_INVALID;)
+
+    // 直连：空闲槽位数受 cfg.rpc_window 限制（无服务器窗口）；不可用或已满时改走信令层
+    if (direct_up(s)) {
+        int slot = -1, active = 0;
+        for (int i = 0; i < P2P_RPC_WINDOW_MAX; i++) {
+            if (ctx->dreq[i]) active++;
+            else if (slot < 0) slot = i;
+        }
+        if (active < rpc_window(s) && slot >= 0) {
+            uint8_t pkt[P2P_DATA_HDR_SIZE + RPC_DIRECT_HDR + P2P_MSG_DATA_MAX];
+            uint16_t sid = direct_sid(s);
+            if (direct_push(s, pkt, direct_pkt(pkt, RPC_DIRECT_REQ, sid, msg, data, len))) {
+                ctx->dreq[slot] = sid;
+                ctx->dreq_ms[slot] = p2p_now_ms();
+                if (sid_out) *sid_out = sid;
+                return E_NONE;
+            }
+        }
+    }
+
+    switch (s->inst->sig_mode) {
+        case P2P_SIGNALING_MODE_COMPACT: return p2p_signal_compact_request(s, msg, data, len, sid_out);
+        case P2P_SIGNALING_MODE_RELAY:   return p2p_signal_relay_request(s, msg, data, len, sid_out);
+        default: return direct_up(s) ? E_BUSY : E_NO_SUPPORT;
+    }
+}
+
+ret_t rpc_send_response(struct p2p_session *s, uint16_t sid, uint8_t code, const void *data, int len) {
+    rpc_frag_t *ctx = &s->rpc;
+
+    P_check(len >= 0 && len <= P2P_MSG_DATA_MAX && (len == 0 || data), return E_INVALID;)
+
+    int i = 0;
+    while (i < P2P_RPC_WINDOW_MAX && ctx->dresp[i] && sid && ctx->dresp[i] != sid) i++;
+    if (i >= P2P_RPC_WINDOW_MAX || !ctx->dresp[i]) {
+        switch (s->inst->sig_mode) {
+            case P2P_SIGNALING_MODE_COMPACT: return p2p_signal_compact_response(s, sid, code, data, len);
+            case P2P_SIGNALING_MODE_RELAY:   return p2p_signal_relay_response(s, sid, code, data, len);
+            default: return E_INVALID;                                              // 无待回复请求
+        }
+    }
+
+    // 经直连到达的请求：对端信令层无此 sid，只能经直连回复
+    sid = ctx->dresp[i];
+    for (; i + 1 < P2P_RPC_WINDOW_MAX; i++) ctx->dresp[i] = ctx->dresp[i + 1];
+    ctx->dresp[P2P_RPC_WINDOW_MAX - 1] = 0;
+    if (!direct_up(s)) return E_NONE_CONTEXT;
+
+    uint8_t pkt[P2P_DATA_HDR_SIZE + RPC_DIRECT_HDR + P2P_MSG_DATA_MAX];
+    int n = direct_pkt(pkt, RPC_DIRECT_RESP, sid, code, data, len);
+    if (!ctx->dpend[0] && direct_push(s, pkt, n)) return E_NONE;
+
+    // 窗口已满（或已有暂存）：按序暂存，由 rpc_tick 补发
+    int k = 0;
+    while (k < P2P_RPC_WINDOW_MAX && ctx->dpend[k]) k++;
+    if (k >= P2P_RPC_WINDOW_MAX) return E_BUSY;
+    if (!(ctx->dpend[k] = (uint8_t*)p2p_malloc((size_t)n))) return E_OUT_OF_MEMORY;
+    memcpy(ctx->dpend[k], pkt, (size_t)n);
+    ctx->dpend_len[k] = n;
+    return E_NONE;
+}
+
+void rpc_on_direct(struct p2p_session *s, const uint8_t *data, int len) {
+    rpc_frag_t *ctx = &s->rpc;
+
+    if (len < RPC_DIRECT_HDR) return;
+    uint8_t kind = data[0], code = data[3];
+    uint16_t sid = nget_s(data + 1);
+    const uint8_t *body = data + RPC_DIRECT_HDR;
+    int body_len = len - RPC_DIRECT_HDR;
+    if (!sid) return;
+
+    if (kind == RPC_DIRECT_RESP) {
+        int i = 0;
+        while (i < P2P_RPC_WINDOW_MAX && ctx->dreq[i] != sid) i++;
+        if (i >= P2P_RPC_WINDOW_MAX) {
+            print("V:", LA_F("%s: stale response ignored (sid=%u)\n", LA_F678, 678), TASK_DIRECT, sid);
+            return;
+        }
+        ctx->dreq[i] = 0;
+        rpc_on_response(s, sid, code, body, body_len);
+        return;
+    }
+    if (kind != RPC_DIRECT_REQ) return;
+
+    // reliable 层已去重，到达即新请求；待回复列表已满时顶替最早的一个
+    if (ctx->dresp[P2P_RPC_WINDOW_MAX - 1]) {
+        print("W:", LA_F("%s: new request (sid=%u) overrides pending request (sid=%u)\n", LA_F679, 679),
+              TASK_DIRECT, sid, ctx->dresp[0]);
+        memmove(ctx->dresp, ctx->dresp + 1, sizeof(ctx->dresp) - sizeof(ctx->dresp[0]));
+        ctx->dresp[P2P_RPC_WINDOW_MAX - 1] = 0;
+    }
+    int i = 0;
+    while (ctx->dresp[i]) i++;
+    ctx->dresp[i] = sid;
+
+    if (code == P2P_MSG_FRAG) { rpc_on_request(s, sid, body, body_len); return; }
+    if (code == 0) { rpc_send_response(s, sid, 0, body, body_len); return; }       // echo
+
+    print("V:", LA_F("%s: request accepted (sid=%u) msg=%u len=%d\n", LA_F680, 680), TASK_DIRECT, sid, code, body_len);
+    if (s->inst->cfg.on_request)
+        s->inst->cfg.on_request((p2p_session_t)s, sid, code, body, body_len, s->inst->cfg.userdata);
+}
+
+void rpc_tick(struct p2p_session *s, uint64_t now_ms) {
+    rpc_frag_t *ctx = &s->rpc;
+
+    // 直连请求：会话已关闭时对端不再应答；超时未应答（连接中断期间 reliable 层状态可能已重置）
+    for (int i = 0; i < P2P_RPC_WINDOW_MAX; i++) {
+        uint16_t sid = ctx->dreq[i];
+        if (!sid) continue;
+        bool closed = s->state <= P2P_STATE_ERROR;
+        if (!closed && tick_diff(now_ms, ctx->dreq_ms[i]) < RPC_DIRECT_TIMEOUT_MS) continue;
+        ctx->dreq[i] = 0;
+        print("W:", LA_F("%s: %s timeout (sid=%u)\n", LA_F593, 593), TASK_DIRECT, "request", sid);
+        rpc_on_response(s, sid, closed ? P2P_MSG_ERR_PEER_OFFLINE : P2P_MSG_ERR_TIMEOUT, NULL, -1);
+    }
+    if (ctx->dpend[0] && direct_up(s)) direct_flush(s);
+
+    // 丢弃已结束传输的残留在途记录（信令层自身超时后不再有应答）
+    for (int i = 0; i < P2P_RPC_WINDOW_MAX; i++) {
+        rpc_frag_flight_t *f = &ctx->flight[i];
+        if (!f->sid) continue;
+        bool live = f->pull ? (ctx->dl_buf && f->xid == ctx->dl_xid) : (ctx->tx_buf && f->xid == ctx->tx_xid);
+        if (!live && tick_diff(now_ms, f->send_ms) >= RPC_FRAG_TIMEOUT_MS) f->sid = 0;
+    }
+
+    if (ctx->tx_buf && tick_diff(now_ms, ctx->tx_ms) >= RPC_FRAG_TIMEOUT_MS) {
+        print("W:", LA_F("%s: %s timeout (sid=%u)\n", LA_F593, 593), TASK_FRAG, "request", ctx->tx_sid);
+        tx_fail(s, P2P_MSG_ERR_FRAG);
+    }
+    if (ctx->dl_buf && tick_diff(now_ms, ctx->dl_ms) >= RPC_FRAG_TIMEOUT_MS) {
+        print("W:", LA_F("%s: %s timeout (sid=%u)\n", LA_F593, 593), TASK_FRAG, "pull", ctx->dl_sid);
+        dl_fail(s, P2P_MSG_ERR_FRAG);
+    }
+    if (ctx->rx_buf && tick_diff(now_ms, ctx->rx_ms) >= RPC_FRAG_TIMEOUT_MS) {
+        p2p_free(ctx->rx_buf); ctx->rx_buf = NULL;
+        p2p_free(ctx->rx_map); ctx->rx_map = NULL;
+    }
+    if (ctx->up_buf && tick_diff(now_ms, ctx->up_ms) >= RPC_FRAG_TIMEOUT_MS) {
+        p2p_free(ctx->up_buf); ctx->up_buf = NULL;
+    }
+
+    // 窗口可能被普通请求占用后释放，这里补充发送
+    if (ctx->tx_buf || ctx->dl_buf) pump(s, now_ms);
+}
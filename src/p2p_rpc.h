@@ -0,0 +1,162 @@
+/*
+ * P2P MSG RPC 分片传输（超过 P2P_MSG_DATA_MAX 的请求 / 应答）
+ *
+ * 单个 MSG_REQ/MSG_RESP 受 UDP 负载限制（P2P_MSG_DATA_MAX），更大的数据
+ * 由本模块在两端点之间拆分为多个普通 RPC 传输，服务器无需感知（端到端）：
+ *
+ * 大请求（A → B）：
+ *   A 把数据切片，每片作为一个 msg=P2P_MSG_FRAG 的请求，在 rpc_window 内并发发出
+ *   （窗口满时暂停，收到应答后继续，即以 RPC 窗口做流控）；
+ *   B 按帧内传输编号（xid）重组，中间分片回 ACK，收齐后以最后到达分片的 sid
+ *   触发 on_request(sid, msg, 完整数据)；应用对该 sid 的回复走大应答流程。
+ *
+ * 大应答（B → A）：
+ *   B 以 code=P2P_MSG_FRAG 回复首片（帧内携带应用 code 与总长），其余分片缓存在 B 端；
+ *   A 收到后以 PULL 请求逐片拉取（同样受窗口流控），收齐后触发 on_response。
+ *   对分片请求与普通请求都适用。
+ *
+ * 分片帧（作为 RPC data 承载）：
+ *   [kind(1)][xid(2)][idx(2)][total(4)][code(1)][chunk(N)]
+ *   请求: kind=DATA 时 code 为应用 msg；kind=PULL 时无 chunk，xid 为 B 端分配的应答编号
+ *   应答: kind=ACK/REJECT 无 chunk；kind=DATA 时 code 为应用应答码，xid 为应答编号
+ *
+ * 限制：
+ *   - 每会话同时最多一个发出中的大请求、一个接收中的大请求、一个缓存中的大应答
+ *   - 数据总长不超过 cfg.rpc_max_size（默认 RPC_FRAG_DEFAULT_MAX，上限 RPC_FRAG_LIMIT）
+ *   - 任一分片失败或 RPC_FRAG_TIMEOUT_MS 内无进展，整个 RPC 以
+ *     on_response(len=-1, msg=P2P_MSG_ERR_FRAG 或底层错误码) 结束
+ *
+ * 直连通道（会话已连通后不经服务器）：
+ *   会话处于 CONNECTED / RELAY、应用数据经本端 reliable 层发送且对端通告 RELIABLE_CAP2_RPC 时，
+ *   请求 / 应答作为带 P2P_FRAG_RPC 的 DATA 包交给 reliable 层（重传、去重、有序由其保证），
+ *   接收端在 stream_deliver 中截获，不写入任何流，也不受流队头阻塞影响：
+ *     [offset=0(4)][P2P_FRAG_RPC(1)][kind(1)][sid(2)][msg/code(1)][data(N ≤ P2P_MSG_DATA_MAX)]
+ *   - sid 与信令 RPC 共用一个计数器（ICE / PUBSUB 模式为本模块自有），A 端无需区分应答来自哪条路径
+ *   - 请求：直连不可用或 reliable 窗口已满时改走信令层；直连请求 RPC_DIRECT_TIMEOUT_MS 内未获应答
+ *     以 on_response(len=-1, msg=P2P_MSG_ERR_TIMEOUT) 结束，会话关闭时以 P2P_MSG_ERR_PEER_OFFLINE 结束
+ *   - 应答：经直连到达的请求一律经直连回复，窗口已满时暂存（至多 P2P_RPC_WINDOW_MAX 个），由 rpc_tick 补发
+ *   - 分片传输的每个分片同样按上述规则选择路径
+ */
+
+#ifndef P2P_RPC_H
+#define P2P_RPC_H
+
+#include "predefine.h"
+#include <p2pp.h>                /* P2P_MSG_DATA_MAX, P2P_RPC_WINDOW_MAX */
+
+struct p2p_session;
+
+#define RPC_FRAG_HDR            10                                  /* 分片帧头 */
+#define RPC_FRAG_CHUNK          (P2P_MSG_DATA_MAX - RPC_FRAG_HDR)   /* 每片数据 */
+#define RPC_FRAG_DEFAULT_MAX    (64 * 1024)                         /* cfg.rpc_max_size 默认值 */
+#define RPC_FRAG_LIMIT          (4 * 1024 * 1024)                   /* cfg.rpc_max_size 上限 */
+#define RPC_FRAG_TIMEOUT_MS     30000                               /* 分片传输无进展超时 */
+#define RPC_DIRECT_HDR          4                                   /* 直连帧头：kind(1) + sid(2) + msg/code(1) */
+#define RPC_DIRECT_TIMEOUT_MS   15000                               /* 直连请求等待应答超时 */
+
+/* 分片帧类型 */
+enum {
+    RPC_FRAG_DATA = 0,                  // 请求/应答：携带数据分片
+    RPC_FRAG_PULL,                      // 请求：拉取大应答的指定分片
+    RPC_FRAG_ACK,                       // 应答：请求分片已收到
+    RPC_FRAG_REJECT                     // 应答：超出上限 / 重组上下文不存在
+};
+
+/* 直连帧类型 */
+enum {
+    RPC_DIRECT_REQ = 0,
+    RPC_DIRECT_RESP
+};
+
+/* 在途分片 RPC（sid → 所属传输） */
+typedef struct {
+    uint16_t                sid;        // 底层 RPC sid，0=空闲
+    uint16_t                idx;        // 分片序号
+    uint16_t                xid;        // 所属传输（tx_xid 或 dl_xid，用于识别已结束传输的残留应答）
+    uint8_t                 pull;       // 1=拉取应答分片，0=发送请求分片
+    uint64_t                send_ms;
+} rpc_frag_flight_t;
+
+typedef struct {
+    rpc_frag_flight_t       flight[P2P_RPC_WINDOW_MAX];
+
+    /* A 端：发出中的大请求 */
+    uint8_t*                tx_buf;     // NULL=空闲
+    uint32_t                tx_len;
+    uint16_t                tx_xid;     // 帧内传输编号（本端分配）
+    uint16_t                tx_seq;     // 传输编号分配
+    uint16_t                tx_sid;     // 首片 sid，即 p2p_request 返回值与 on_response 的 sid
+    uint16_t                tx_next;    // 下一个待发分片
+    uint16_t                tx_acked;   // 已确认分片数
+    uint8_t                 tx_msg;
+    uint64_t                tx_ms;      // 最近进展时间
+
+    /* A 端：拉取中的大应答 */
+    uint8_t*                dl_buf;     // NULL=空闲
+    uint8_t*                dl_map;     // 已收分片位图
+    uint32_t                dl_len;
+    uint16_t                dl_sid;     // 回调给应用的 sid
+    uint16_t                dl_xid;     // B 端应答编号
+    uint16_t                dl_next;    // 下一个待拉取分片
+    uint16_t                dl_got;
+    uint8_t                 dl_code;
+    uint64_t                dl_ms;
+
+    /* B 端：接收中的大请求 */
+    uint8_t*                rx_buf;     // NULL=空闲
+    uint8_t*                rx_map;
+    uint32_t                rx_len;
+    uint16_t                rx_xid;
+    uint16_t                rx_got;
+    uint16_t                rx_sid;     // 收齐后等待应用回复的 sid，0=重组中
+    uint8_t                 rx_msg;
+    uint64_t                rx_ms;
+
+    /* B 端：缓存中的大应答（供 PULL） */
+    uint8_t*                up_buf;     // NULL=空闲
+    uint32_t                up_len;
+    uint16_t                up_xid;
+    uint16_t                up_seq;     // 应答编号分配
+    uint16_t                up_served;  // 已被拉取的分片数（不含首片）
+    uint8_t                 up_code;
+    uint64_t                up_ms;
+
+    /* 直连通道 */
+    uint16_t                dreq[P2P_RPC_WINDOW_MAX];       // A 端：在途直连请求的 sid，0=空闲
+    uint64_t                dreq_ms[P2P_RPC_WINDOW_MAX];
+    uint16_t                dresp[P2P_RPC_WINDOW_MAX];      // B 端：经直连到达、待回复的 sid，按到达顺序（0=结束）
+    uint8_t*                dpend[P2P_RPC_WINDOW_MAX];      // B 端：窗口已满时暂存的应答包，按生成顺序（NULL=结束）
+    int                     dpend_len[P2P_RPC_WINDOW_MAX];
+    uint16_t                dsid;                           // 无信令 RPC 的模式下的 sid 分配
+} rpc_frag_t;
+
+void rpc_init(rpc_frag_t *ctx);
+void rpc_reset(struct p2p_session *s);
+void rpc_tick(struct p2p_session *s, uint64_t now_ms);
+
+/* A 端：发起超过 P2P_MSG_DATA_MAX 的请求，*sid_out 为 on_response 使用的 sid */
+ret_t rpc_request(struct p2p_session *s, uint8_t msg, const void *data, int len, uint16_t *sid_out);
+
+/* A 端：发起不超过 P2P_MSG_DATA_MAX 的请求，直连可用时经 reliable 层，否则经信令层 */
+ret_t rpc_send_request(struct p2p_session *s, uint8_t msg, const void *data, int len, uint16_t *sid_out);
+
+/* B 端：回复不超过 P2P_MSG_DATA_MAX 的应答，经直连到达的请求经直连回复，否则经信令层
+ * （sid=0 时优先回复直连通道上最早到达的请求） */
+ret_t rpc_send_response(struct p2p_session *s, uint16_t sid, uint8_t code, const void *data, int len);
+
+/* 收到 P2P_FRAG_RPC 的 DATA 包（已去掉 DATA 子头） */
+void rpc_on_direct(struct p2p_session *s, const uint8_t *data, int len);
+
+/* B 端：sid 是否为已收齐、等待回复的大请求（sid=0 表示是否存在） */
+bool rpc_holds(struct p2p_session *s, uint16_t sid);
+
+/* B 端：回复大请求，或以超过 P2P_MSG_DATA_MAX 的数据回复任意请求 */
+ret_t rpc_response(struct p2p_session *s, uint16_t sid, uint8_t code, const void *data, int len);
+
+/* B 端：信令层收到 msg=P2P_MSG_FRAG 的请求（已登记到响应槽） */
+void rpc_on_request(struct p2p_session *s, uint16_t sid, const uint8_t *data, int len);
+
+/* A 端：信令层收到应答 / 失败，分片相关的在本模块消化，其余转交 cfg.on_response */
+void rpc_on_response(struct p2p_session *s, uint16_t sid, uint8_t code, const uint8_t *data, int len);
+
+#endif /* P2P_RPC_H */
@@ -0,0 +1,481 @@
+
+#define MOD_TAG "SHM"
+
+#include "p2p_internal.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#endif
+
+#define SHM_MAGIC       0x50325348u         /* "P2SH" */
+
+/* 单向 SPSC 环：head 只由生产端写、tail 只由消费端写，分处不同缓存行 */
+struct p2p_shm_ring {
+    uint32_t            magic;
+    uint32_t            size;                   // 数据区容量（P2P_SHM_RING_SIZE）
+    uint32_t            closed;                 // 任一端关闭后置 1
+    uint32_t            sleeping;               // 消费端已取空并等待门铃
+    uint8_t             pad0[48];
+    uint32_t            head;                   // 写位置（自由增长，按 size 取模）
+    uint8_t             pad1[60];
+    uint32_t            tail;                   // 读位置
+    uint8_t             pad2[60];
+    uint8_t             data[P2P_SHM_RING_SIZE];
+};
+
+/* 本端共享内存候选地址（合成地址，端口 0 不与任何 UDP 候选冲突，也不登记地址索引） */
+static void shm_addr(struct sockaddr_in *a) {
+    memset(a, 0, sizeof(*a));
+    a->sin_family = AF_INET;
+    a->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+static uint64_t fnv1a(uint64_t h, const void *p, size_t n) {
+    const uint8_t *b = (const uint8_t *)p;
+    while (n--) { h ^= *b++; h *= 0x100000001b3ull; }
+    return h;
+}
+
+uint64_t p2p_shm_host_id(struct p2p_instance *inst) {
+
+    if (inst->shm_host_id) return inst->shm_host_id;
+
+    uint64_t h = 0xcbf29ce484222325ull;
+#ifndef _WIN32
+    // boot_id 区分同名主机与容器重启；读不到时退回 gethostid
+    char buf[256];
+    FILE *f = fopen("/proc/sys/kernel/random/boot_id", "r");
+    if (f) {
+        size_t n = fread(buf, 1, sizeof(buf), f);
+        fclose(f);
+        h = fnv1a(h, buf, n);
+    } else {
+        long id = gethostid();
+        h = fnv1a(h, &id, sizeof(id));
+    }
+    if (gethostname(buf, sizeof(buf)) == 0) { buf[sizeof(buf) - 1] = 0; h = fnv1a(h, buf, strlen(buf)); }
+    // 共享内存段以 0600 创建：不同用户的进程无法互相映射，不视为同机
+    uid_t uid = getuid();
+    h = fnv1a(h, &uid, sizeof(uid));
+#endif
+    return inst->shm_host_id = h ? h : 1;
+}
+
+#ifdef _WIN32
+
+void  p2p_shm_tick(struct p2p_session *s, uint64_t now_ms) { (void)s; (void)now_ms; }
+int   p2p_shm_next_timeout(const struct p2p_session *s, uint64_t now_ms) { (void)s; (void)now_ms; return -1; }
+void  p2p_shm_on_packet(struct p2p_session *s, const uint8_t *payload, int len, uint64_t now_ms) {
+    (void)s; (void)payload; (void)len; (void)now_ms;
+}
+ret_t p2p_shm_send_packet(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
+                          const void *payload, int payload_len) {
+    (void)s; (void)type; (void)flags; (void)seq; (void)payload; (void)payload_len;
+    return 0;
+}
+bool  p2p_shm_pending(const struct p2p_session *s) { (void)s; return false; }
+void  p2p_shm_bell_drain(struct p2p_session *s) { (void)s; }
+void  p2p_shm_close(struct p2p_session *s, bool free_ctx) {
+    if (free_ctx && s->shm) { p2p_arena_free(s->inst->arena, s->shm); s->shm = NULL; }
+}
+
+#else /* !_WIN32 */
+
+typedef char shm_bell_fits[sizeof(struct sockaddr_un) <= sizeof(((p2p_shm_t *)0)->peer_bell) ? 1 : -1];
+
+/* 会话由主循环驱动时才挂门铃（工作线程分片的会话由其线程轮询） */
+static bool shm_bell_ok(const struct p2p_session *s) {
+#ifdef P2P_THREADED
+    return !s->worker;
+#else
+    (void)s;
+    return true;
+#endif
+}
+
+/* 门铃地址：Linux 用抽象命名空间，其他平台用临时目录下的套接字文件 */
+static socklen_t bell_addr(const char *name, struct sockaddr_un *a) {
+    memset(a, 0, sizeof(*a));
+    a->sun_family = AF_UNIX;
+#ifdef __linux__
+    int n = snprintf(a->sun_path + 1, sizeof(a->sun_path) - 1, "p2p-shm%s", name);
+    return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + n);
+#else
+    snprintf(a->sun_path, sizeof(a->sun_path), "/tmp/p2p-shm%s.sock", name + 1);
+    return (socklen_t)sizeof(*a);
+#endif
+}
+
+static void bell_open(struct p2p_session *s, p2p_shm_t *c) {
+
+    if (c->bell != P_INVALID_SOCKET) return;
+
+    sock_t sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (sock == P_INVALID_SOCKET) return;
+    P_sock_nonblock(sock, true);
+
+    struct sockaddr_un a;
+    socklen_t alen = bell_addr(c->rx_name, &a);
+    if (bind(sock, (struct sockaddr *)&a, alen) < 0) { P_sock_close(sock); return; }
+    c->bell = sock;
+    if ((c->bell_wait = shm_bell_ok(s))) __atomic_add_fetch(&s->inst->shm_cnt, 1, __ATOMIC_RELAXED);
+}
+
+static void bell_close(struct p2p_session *s, p2p_shm_t *c) {
+
+    if (c->bell == P_INVALID_SOCKET) return;
+    P_sock_close(c->bell);
+    c->bell = P_INVALID_SOCKET;
+    if (c->bell_wait) __atomic_sub_fetch(&s->inst->shm_cnt, 1, __ATOMIC_RELAXED);
+    c->bell_wait = false;
+#ifndef __linux__
+    struct sockaddr_un a;
+    bell_addr(c->rx_name, &a);
+    unlink(a.sun_path);
+#endif
+}
+
+static p2p_shm_ring_t *ring_map(const char *name, int oflag) {
+
+    int fd = shm_open(name, oflag, 0600);
+    if (fd < 0) return NULL;
+
+    p2p_shm_ring_t *r = NULL;
+    struct stat st;
+    if (oflag & O_CREAT) {
+        if (ftruncate(fd, sizeof(*r)) < 0) { close(fd); shm_unlink(name); return NULL; }
+    } else if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*r)) {
+        close(fd);
+        return NULL;
+    }
+    void *p = mmap(NULL, sizeof(*r), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) { if (oflag & O_CREAT) shm_unlink(name); return NULL; }
+    return (p2p_shm_ring_t *)p;
+}
+
+static void ring_unmap(p2p_shm_ring_t **r) {
+    if (!*r) return;
+    RING_STORE_REL(&(*r)->closed, 1);
+    munmap(*r, sizeof(**r));
+    *r = NULL;
+}
+
+/* 创建本端接收环与门铃（段名随机，创建者在会话关闭时删除名字，对端映射后也会立即删除） */
+static bool rx_create(struct p2p_session *s, p2p_shm_t *c) {
+
+    if (c->rx) return true;
+
+    uint32_t rnd[2] = { P_rand32(), P_rand32() };
+    snprintf(c->rx_name, sizeof(c->rx_name), "/p2p-%08x%08x", rnd[0], rnd[1]);
+    if (!(c->rx = ring_map(c->rx_name, O_RDWR | O_CREAT | O_EXCL))) {
+        print("W:", LA_F("create %s failed(%d)", LA_F663, 663), c->rx_name, errno);
+        return false;
+    }
+    c->rx->size = P2P_SHM_RING_SIZE;
+    RING_STORE_REL(&c->rx->magic, SHM_MAGIC);
+    bell_open(s, c);
+    return true;
+}
+
+/* 映射对端接收环作为发送环 */
+static bool tx_attach(p2p_shm_t *c, const char *name) {
+
+    if (name[0] != '/' || strchr(name + 1, '/')) return false;
+
+    p2p_shm_ring_t *r = ring_map(name, O_RDWR);
+    if (!r) return false;
+    shm_unlink(name);                           // 双方均已映射，名字不再需要
+    if (RING_LOAD_ACQ(&r->magic) != SHM_MAGIC || r->size != P2P_SHM_RING_SIZE || r->closed) {
+        munmap(r, sizeof(*r));
+        return false;
+    }
+    c->tx = r;
+
+    struct sockaddr_un a;
+    c->peer_bell_len = (int)bell_addr(name, &a);
+    memcpy(c->peer_bell, &a, sizeof(a));
+    return true;
+}
+
+/* 收发两个环就绪：登记（或复用）共享内存候选并交给 NAT 层确认 */
+static void shm_established(struct p2p_session *s, p2p_shm_t *c) {
+
+    struct sockaddr_in addr;
+    shm_addr(&addr);
+
+    int idx = -1;
+    for (int i = 0; i < s->remote_cand_cnt; i++) {
+        if (s->remote_cands[i].type == P2P_CAND_SHM) { idx = i; break; }
+    }
+    if (idx < 0 && (idx = p2p_cand_push_remote(s)) < 0) return;
+
+    p2p_remote_candidate_entry_t *r = &s->remote_cands[idx];
+    r->type = P2P_CAND_SHM;
+    r->priority = p2p_ice_calc_priority(P2P_ICE_CAND_HOST, 65535, 1);
+    r->addr = addr;
+    r->last_punch_send_ms = 0;
+    path_stats_init(&r->stats, 0);
+    r->check = NAT_CHECK_NONE;
+    r->sock = 0;
+    c->path = idx;
+
+    print("I:", LA_F("same-host peer, shared memory path[%d] (%s)", LA_F664, 664), idx, c->rx_name);
+    nat_punch(s, idx);
+}
+
+/* 释放映射与门铃；路径已登记时重置为不可用（活跃时由路径管理器切换） */
+static void shm_drop(struct p2p_session *s, p2p_shm_t *c, const char *reason) {
+
+    if (c->rx) shm_unlink(c->rx_name);
+    ring_unmap(&c->rx);
+    ring_unmap(&c->tx);
+    bell_close(s, c);
+    c->peer_bell_len = 0;
+    c->offered = false;
+
+    int idx = c->path;
+    c->path = -1;
+    if (!reason || idx < 0 || idx >= s->remote_cand_cnt || s->remote_cands[idx].type != P2P_CAND_SHM) return;
+
+    print("W:", LA_F("path[%d] lost: %s", LA_F543, 543), idx, reason);
+    p2p_reset_path(s, idx);
+    s->remote_cands[idx].stats.state = PATH_STATE_FAILED;
+}
+
+/* 发送 HELLO/OFFER：[session_id(多会话)][op][host_id(8)]，OFFER 追加 [name_len(1)][name] */
+static void shm_send(struct p2p_session *s, p2p_shm_t *c, uint8_t op, uint64_t now) {
+
+    uint8_t buf[P2P_SESS_ID_PSZ + P2P_PKT_SHM_PSZ + 1 + P2P_SHM_NAME_MAX];
+    uint8_t flags = 0;
+    int n = 0;
+    if (s->inst->cfg.multi_session && s->path_type != P2P_PATH_SIGNALING) {
+        nwrite_l(buf, s->id);
+        n = (int)P2P_SESS_ID_PSZ;
+        flags = P2P_FLAG_SESSION;
+    }
+    buf[n++] = op;
+    nwrite_ll(buf + n, p2p_shm_host_id(s->inst)); n += 8;
+    if (op == P2P_SHM_OP_OFFER) {
+        int len = (int)strlen(c->rx_name);
+        buf[n++] = (uint8_t)len;
+        memcpy(buf + n, c->rx_name, len); n += len;
+        c->offered = true;
+    }
+    p2p_send_packet(s, &s->active_addr, P2P_PKT_SHM, flags, 0, buf, n, now);
+}
+
+static p2p_shm_t *shm_ctx(struct p2p_session *s) {
+
+    p2p_shm_t *c = s->shm;
+    if (c) return c;
+    if (!(c = (p2p_shm_t *)p2p_arena_calloc(s->inst->arena, 1, sizeof(*c)))) return NULL;
+    c->bell = P_INVALID_SOCKET;
+    c->path = -1;
+    return s->shm = c;
+}
+
+void p2p_shm_on_packet(struct p2p_session *s, const uint8_t *payload, int len, uint64_t now_ms) {
+
+    if (!s->inst->cfg.enable_shm || len < (int)P2P_PKT_SHM_PSZ) return;
+
+    p2p_shm_t *c = shm_ctx(s);
+    if (!c || c->failed) return;
+
+    uint8_t op = payload[0];
+    if (nget_ll(payload + 1) != p2p_shm_host_id(s->inst)) {
+        c->failed = true;                       // 对端不在本机：停止 HELLO
+        return;
+    }
+
+    if (op == P2P_SHM_OP_HELLO) {
+        // 对端尚未映射本端接收环（或 OFFER 丢失）：创建并（重新）告知段名
+        if (rx_create(s, c)) shm_send(s, c, P2P_SHM_OP_OFFER, now_ms);
+        return;
+    }
+    if (op != P2P_SHM_OP_OFFER || len < (int)P2P_PKT_SHM_PSZ + 1) return;
+
+    int name_len = payload[P2P_PKT_SHM_PSZ];
+    if (name_len <= 0 || name_len >= P2P_SHM_NAME_MAX || len < (int)P2P_PKT_SHM_PSZ + 1 + name_len || c->tx) return;
+
+    char name[P2P_SHM_NAME_MAX];
+    memcpy(name, payload + P2P_PKT_SHM_PSZ + 1, name_len);
+    name[name_len] = 0;
+
+    if (!rx_create(s, c) || !tx_attach(c, name)) {
+        print("W:", LA_F("attach %s failed, staying on %s", LA_F665, 665), name, p2p_path_type_str(s->path_type));
+        shm_drop(s, c, NULL);
+        c->failed = true;
+        return;
+    }
+    if (!c->offered) shm_send(s, c, P2P_SHM_OP_OFFER, now_ms);
+    shm_established(s, c);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static void ring_copy_in(p2p_shm_ring_t *r, uint32_t pos, const uint8_t *src, int n) {
+    uint32_t off = pos & (P2P_SHM_RING_SIZE - 1), first = P2P_SHM_RING_SIZE - off;
+    if (first > (uint32_t)n) first = (uint32_t)n;
+    memcpy(r->data + off, src, first);
+    if ((uint32_t)n > first) memcpy(r->data, src + first, n - first);
+}
+
+static void ring_copy_out(const p2p_shm_ring_t *r, uint32_t pos, uint8_t *dst, int n) {
+    uint32_t off = pos & (P2P_SHM_RING_SIZE - 1), first = P2P_SHM_RING_SIZE - off;
+    if (first > (uint32_t)n) first = (uint32_t)n;
+    memcpy(dst, r->data + off, first);
+    if ((uint32_t)n > first) memcpy(dst + first, r->data, n - first);
+}
+
+ret_t p2p_shm_send_packet(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
+                          const void *payload, int payload_len) {
+
+    p2p_shm_t *c = s->shm;
+    p2p_shm_ring_t *r = c ? c->tx : NULL;
+    if (!r || RING_LOAD_ACQ(&r->closed)) return 0;
+
+    int len = P2P_HDR_SIZE + payload_len;
+    if (payload_len < 0 || len > P2P_MTU) return E_INVALID;
+
+    uint32_t head = r->head, tail = RING_LOAD_ACQ(&r->tail);
+    int total = P2P_SHM_FRAME_HDR + len;
+    if (P2P_SHM_RING_SIZE - (head - tail) < (uint32_t)total) {
+        print("V:", LA_F("ring full, frame dropped (type=%u)", LA_F666, 666), type);
+        return E_BUSY;
+    }
+
+    uint8_t hdr[P2P_SHM_FRAME_HDR + P2P_HDR_SIZE];
+    nwrite_s(hdr, (uint16_t)len);
+    p2p_pkt_hdr_encode(hdr + P2P_SHM_FRAME_HDR, type, flags, seq);
+    ring_copy_in(r, head, hdr, (int)sizeof(hdr));
+    if (payload_len > 0 && payload) ring_copy_in(r, head + sizeof(hdr), (const uint8_t *)payload, payload_len);
+    RING_STORE_REL(&r->head, head + (uint32_t)total);
+
+    // 与消费端「置 sleeping → 再查 head」配对：两侧都先写后读（全序屏障），不会同时错过对方
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (c->bell != P_INVALID_SOCKET && RING_LOAD_ACQ(&r->sleeping) && __atomic_exchange_n(&r->sleeping, 0, __ATOMIC_ACQ_REL)) {
+        uint8_t b = 0;
+        sendto(c->bell, (const char *)&b, 1, 0, (const struct sockaddr *)c->peer_bell, (socklen_t)c->peer_bell_len);
+    }
+    return len;
+}
+
+/* 一帧即 UDP 路径上的一个完整 P2P 包，按共享内存候选地址交给 NAT 层 */
+static void ring_dispatch(struct p2p_session *s, const uint8_t *pkt, int len, uint64_t now) {
+
+    p2p_packet_hdr_t hdr;
+    p2p_pkt_hdr_decode(pkt, &hdr);
+    if (hdr.type >= 0x80) return;               // 信令包不经共享内存路径
+
+    const uint8_t *payload = pkt + P2P_HDR_SIZE; int payload_len = len - P2P_HDR_SIZE;
+
+    // 环本身属于本会话，session_id 前缀无需校验
+    if (hdr.flags & P2P_FLAG_SESSION) {
+        if (payload_len < (int)P2P_SESS_ID_PSZ) return;
+        payload     += P2P_SESS_ID_PSZ;
+        payload_len -= (int)P2P_SESS_ID_PSZ;
+    }
+
+    struct sockaddr_in from;
+    shm_addr(&from);
+    nat_proto(s, hdr.type, hdr.flags, hdr.seq, payload, payload_len, &from, now);
+}
+
+/* 取出接收环中的全部帧；挂门铃时取空后置 sleeping 并复查，避免遗漏并发写入 */
+static void ring_drain(struct p2p_session *s, p2p_shm_t *c, uint64_t now) {
+
+    p2p_shm_ring_t *r = c->rx;
+    uint8_t pkt[P2P_MTU];
+
+    for (;;) {
+        uint32_t tail = r->tail, head = RING_LOAD_ACQ(&r->head);
+        while (head - tail >= P2P_SHM_FRAME_HDR) {
+
+            uint8_t lb[P2P_SHM_FRAME_HDR];
+            ring_copy_out(r, tail, lb, P2P_SHM_FRAME_HDR);
+            int len = nget_s(lb);
+            if (len < P2P_HDR_SIZE || len > P2P_MTU || head - tail < (uint32_t)(P2P_SHM_FRAME_HDR + len)) {
+                shm_drop(s, c, "bad frame");
+                return;
+            }
+            ring_copy_out(r, tail + P2P_SHM_FRAME_HDR, pkt, len);
+            tail += P2P_SHM_FRAME_HDR + (uint32_t)len;
+            RING_STORE_REL(&r->tail, tail);
+
+            ring_dispatch(s, pkt, len, now);
+            if (c->rx != r) return;             // 会话重置已关闭共享内存路径
+        }
+        if (!c->bell_wait) return;
+
+        RING_STORE_REL(&r->sleeping, 1);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (RING_LOAD_ACQ(&r->head) == tail) return;
+        RING_STORE_REL(&r->sleeping, 0);
+    }
+}
+
+void p2p_shm_tick(struct p2p_session *s, uint64_t now_ms) {
+
+    p2p_shm_t *c = s->shm;
+
+    if (c && c->path >= 0) {
+        // 对端关闭（进程退出或会话重置）：两侧环均已置 closed
+        if (RING_LOAD_ACQ(&c->rx->closed) || RING_LOAD_ACQ(&c->tx->closed)) {
+            shm_drop(s, c, "closed by peer");
+            c->failed = true;
+            return;
+        }
+        ring_drain(s, c, now_ms);
+        return;
+    }
+
+    // 直连 UDP 路径建立后探测对端是否同机（对端不在本机或不支持时少量重发后放弃）
+    if (s->nat.state != NAT_CONNECTED || (s->path_type != P2P_PATH_LAN && s->path_type != P2P_PATH_PUNCH)) return;
+    if (c && (c->failed || c->tx || c->hello_cnt >= P2P_SHM_HELLO_MAX || now_ms < c->hello_ms)) return;
+    if (!c && !(c = shm_ctx(s))) return;
+
+    c->hello_cnt++;
+    c->hello_ms = now_ms + P2P_SHM_HELLO_MS;
+    shm_send(s, c, P2P_SHM_OP_HELLO, now_ms);
+}
+
+int p2p_shm_next_timeout(const struct p2p_session *s, uint64_t now_ms) {
+
+    const p2p_shm_t *c = s->shm;
+    if (c && c->path >= 0) return c->bell_wait ? P2P_SHM_IDLE_MS : P2P_SHM_POLL_MS;
+    if (s->nat.state != NAT_CONNECTED || (s->path_type != P2P_PATH_LAN && s->path_type != P2P_PATH_PUNCH)) return -1;
+    if (!c) return 0;
+    if (c->failed || c->tx || c->hello_cnt >= P2P_SHM_HELLO_MAX) return -1;
+    return c->hello_ms > now_ms ? (int)(c->hello_ms - now_ms) : 0;
+}
+
+bool p2p_shm_pending(const struct p2p_session *s) {
+    const p2p_shm_t *c = s->shm;
+    return c && c->path >= 0 && RING_LOAD_ACQ(&c->rx->head) != c->rx->tail;
+}
+
+void p2p_shm_bell_drain(struct p2p_session *s) {
+    p2p_shm_t *c = s->shm;
+    if (!c || c->bell == P_INVALID_SOCKET) return;
+    uint8_t b[16];
+    while (recv(c->bell, (char *)b, sizeof(b), 0) > 0) {}
+}
+
+void p2p_shm_close(struct p2p_session *s, bool free_ctx) {
+
+    p2p_shm_t *c = s->shm;
+    if (!c) return;
+
+    shm_drop(s, c, NULL);
+    c->failed = false;
+    c->hello_cnt = 0;
+    c->hello_ms = 0;
+
+    if (free_ctx) { p2p_arena_free(s->inst->arena, c); s->shm = NULL; }
+}
+
+#endif /* _WIN32 */
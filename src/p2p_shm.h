@@ -0,0 +1,75 @@
+/*
+ * 同主机共享内存传输（同机对端的旁路路径，cfg.enable_shm）
+ *
+ * 发现：直连 UDP 路径建立后双方经 P2P_PKT_SHM 交换主机标识（boot_id + 主机名 + uid 的哈希），
+ * 一致时各自创建一个 POSIX 共享内存段作为本端接收环（SPSC），经 OFFER 告知段名，
+ * 对端映射后作为自己的发送环。双方都持有收发两个环后登记为 P2P_CAND_SHM 远端候选
+ * （路径类型 P2P_PATH_SHM，成本最低），与 TCP 候选一样直接确认、由 PUNCH 保活测 RTT，
+ * 路径管理器在其可用时优先选用。
+ *
+ * 环帧格式：[len(2)][P2P 包(len)]，P2P 包即 UDP 路径上的完整包（4 字节头 + 负载）；环满时丢弃整帧（等同丢包）。
+ *
+ * 唤醒：消费端取空环后置 sleeping，生产端写入后见 sleeping 才经 AF_UNIX 数据报门铃通知
+ * （Linux 抽象命名空间，名字由段名派生）；门铃描述符加入 p2p_collect_fds，由主循环取出后调度会话。
+ * 工作线程分片的会话不等待门铃，按 P2P_SHM_POLL_MS 轮询。
+ * 任一端关闭时在两个环上置 closed，对端随即使路径失效。Windows 暂不支持（接口为空实现）。
+ */
+#ifndef P2P_SHM_H
+#define P2P_SHM_H
+
+#include "predefine.h"
+
+struct p2p_session;
+struct p2p_instance;
+
+#define P2P_SHM_RING_SIZE   (1024 * 1024)   /* 单向环数据区容量（2 的幂） */
+#define P2P_SHM_FRAME_HDR   2               /* 帧头：len(2) */
+#define P2P_SHM_NAME_MAX    32              /* 段名最大长度（含前导 '/'） */
+#define P2P_SHM_HELLO_MS    1000            /* HELLO 重发间隔 */
+#define P2P_SHM_HELLO_MAX   5               /* HELLO 最多发送次数（对端不在同机或不支持时放弃） */
+#define P2P_SHM_POLL_MS     10              /* 无门铃时的收包轮询间隔 */
+#define P2P_SHM_IDLE_MS     100             /* 有门铃时的兜底轮询间隔 */
+
+typedef struct p2p_shm_ring p2p_shm_ring_t;
+
+typedef struct {
+    p2p_shm_ring_t*     rx;                     // 本端创建的接收环（NULL = 未创建）
+    p2p_shm_ring_t*     tx;                     // 映射的对端接收环（NULL = 未映射）
+    char                rx_name[P2P_SHM_NAME_MAX];
+    sock_t              bell;                   // 本端门铃（兼作向对端门铃发送的套接字）
+    bool                bell_wait;              // 本端门铃由主循环等待（否则按 P2P_SHM_POLL_MS 轮询）
+    uint8_t             peer_bell[112];         // 对端门铃地址（struct sockaddr_un）
+    int                 peer_bell_len;          // 0 = 对端无门铃
+    bool                offered;                // 已发出 OFFER
+    bool                failed;                 // 本会话放弃共享内存（主机标识不一致或映射失败）
+    int                 hello_cnt;
+    uint64_t            hello_ms;               // 下次发送 HELLO 的时间
+    int                 path;                   // 对应 remote_cands 索引（-1 = 未登记）
+} p2p_shm_t;
+
+/* 本机标识（boot_id + 主机名 + uid 的 FNV-1a 哈希，首次调用时计算并缓存在实例中） */
+uint64_t p2p_shm_host_id(struct p2p_instance *inst);
+
+/* 会话 tick：发送 HELLO、收取环中的帧、检测对端关闭（cfg.enable_shm 时由会话 tick 调用） */
+void  p2p_shm_tick(struct p2p_session *s, uint64_t now_ms);
+
+/* 距下次需要 tick 的毫秒数（-1 = 无需调度） */
+int   p2p_shm_next_timeout(const struct p2p_session *s, uint64_t now_ms);
+
+/* 处理 P2P_PKT_SHM 控制包（payload 已去除多会话 session_id 前缀） */
+void  p2p_shm_on_packet(struct p2p_session *s, const uint8_t *payload, int len, uint64_t now_ms);
+
+/* 经共享内存环发送一个 P2P 包（未映射时静默丢弃并返回 0，环满时返回 E_BUSY） */
+ret_t p2p_shm_send_packet(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
+                          const void *payload, int payload_len);
+
+/* 本端接收环非空（主循环据此调度挂门铃的会话） */
+bool  p2p_shm_pending(const struct p2p_session *s);
+
+/* 取出门铃中积压的通知（不阻塞） */
+void  p2p_shm_bell_drain(struct p2p_session *s);
+
+/* 关闭映射与门铃并通知对端（会话重置）；free = true 时同时释放上下文（会话销毁） */
+void  p2p_shm_close(struct p2p_session *s, bool free_ctx);
+
+#endif /* P2P_SHM_H */
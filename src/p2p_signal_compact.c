@@ -12,11 +12,14 @@
 #define ONLINE_INTERVAL_MS              1000    /* ONLINE/SYNC0 重发间隔 */
 #define SYNC_INTERVAL_MS                500     /* SYNC 重发间隔 */
 #define MAX_SIG_ATTEMPTS                10      /* 最大 ONLINE/SYNC0 重发次数 */
-#define REGISTER_KEEPALIVE_INTERVAL_MS  20000   /* ONLINE 状态保活重注册间隔（防服务器超时清除槽位） */
+#define REGISTER_KEEPALIVE_INTERVAL_MS  20000   /* ONLINE 状态保活重注册间隔（防服务器超时清除槽位），服务器未通告时使用 */
+#define ALIVE_MIN_MS                    5000    /* 服务器通告的 ALIVE 间隔下限 */
+#define ALIVE_MAX_MS                    120000  /* 服务器通告的 ALIVE 间隔上限 */
 #define TRICKLE_BATCH_MS                1000    /* TURN trickle 攒批窗口（多个 TURN 响应在此窗口内合并为一个包） */
 #define MAX_CANDS_PER_PACKET            10      /* 每个 SYNC 包最大候选数 */
 #define NAT_PROBE_MAX_RETRIES           3       /* NAT_PROBE 最大发送次数 */
 #define NAT_PROBE_INTERVAL_MS           1000    /* NAT_PROBE 重发间隔 */
+#define PUNCH_AT_WAIT_MS                1000    /* 等待服务器同时起跑提示（PUNCH_AT）的上限，超过则自行起跑 */
 
 #define MSG_REQ_INTERVAL_MS             500     /* MSG_REQ 重发间隔 */
 #define MSG_REQ_MAX_RETRIES             5       /* MSG_REQ 最大重发次数，超出后报超时失败 */
@@ -49,6 +52,60 @@ static inline err_t udp_send(struct p2p_instance *inst, const char* PROTO,
     return E_NONE;
 }
 
+/*
+ * 追加一个对端候选（网络格式）到 remote_cands[]，调用方须已预留空间
+ * 与已有候选地址相同时不重复入表（prflx 升级为信令通告的类型），返回其索引；被过滤时返回 -1
+ */
+static int accept_remote_candidate(struct p2p_session *s, const uint8_t *buf) {
+
+    p2p_remote_candidate_entry_t *c;
+    int idx;
+
+    unpack_candidate(c = &s->remote_cands[idx = s->remote_cand_cnt], buf);
+    int dup_idx = p2p_find_remote_candidate_by_addr(s, &c->addr);
+    if (dup_idx >= 0) {
+        if (s->remote_cands[dup_idx].type == P2P_CAND_PRFLX && c->type != P2P_CAND_PRFLX) {
+            s->remote_cands[dup_idx].type = c->type;
+            s->remote_cands[dup_idx].priority = c->priority;
+            print("I:", LA_F("%s: promoted prflx cand[%d]<%s:%d> → %s\n", LA_F182, 182),
+                  TASK_SYNC_REMOTE, dup_idx, inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port),
+                  p2p_candidate_type_str(c->type));
+        } else {
+            print("V:", LA_F("%s: duplicate remote cand<%s:%d> from signaling, skipped\n", LA_F127, 127),
+                  TASK_SYNC_REMOTE, inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port));
+        }
+        return dup_idx;
+    }
+
+    const char* type_str; uint16_t* cand_cnt_ptr; bool opt_off = false;
+    if (c->type == P2P_CAND_HOST) { type_str = "host"; cand_cnt_ptr = &s->remote_host_cnt; opt_off = s->inst->cfg.test_ice_host_off; }
+    else if (c->type == P2P_CAND_SRFLX) { type_str = "srflx"; cand_cnt_ptr = &s->remote_srflx_cnt; opt_off = s->inst->cfg.test_ice_srflx_off; }
+    else if (c->type == P2P_CAND_RELAY) { type_str = "relay"; cand_cnt_ptr = &s->remote_relay_cnt; opt_off = s->inst->cfg.test_ice_relay_off; }
+    else { --s->remote_cand_cnt;
+        print("E:", LA_F("%s: unexpected remote cand type %d, skipped\n", LA_F249, 249),
+              TASK_SYNC_REMOTE, c->type);
+        return -1;
+    }
+
+    if (opt_off) {
+        print("I:", LA_F("%s: remote %s cand[%d]<%s:%d> (disabled)\n", LA_F204, 204),
+              TASK_SYNC_REMOTE, type_str, idx, inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port));
+        return -1;
+    }
+
+    ++s->remote_cand_cnt; ++*cand_cnt_ptr;
+
+    print("I:", LA_F("%s: remote %s cand[%d]<%s:%d> accepted\n", LA_F205, 205),
+          TASK_SYNC_REMOTE, type_str, idx, inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port));
+
+    if (s->sig_sess.compact.state < SIG_COMPACT_SESS_WAIT_SYNC0_ACK) return idx;
+
+    if (nat_punch(s, idx) != E_NONE)
+        print("E:", LA_F("%s: punch remote cand[%d]<%s:%d> failed\n", LA_F185, 185),
+              TASK_SYNC_REMOTE, idx, inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port));
+    return idx;
+}
+
 /*
  * 解析 SYNC 负载，追加到 session 的 remote_cands[]
  * 注意：这里对方的候选列表顺序并未按对方原始顺序排序，而是 FIFO 追加到 remote_cands[] 中
@@ -58,6 +115,7 @@ static inline err_t udp_send(struct p2p_instance *inst, const char* PROTO,
 static void unpack_remote_candidates(struct p2p_session *s, const uint8_t *payload, int cand_cnt) {
 
     assert(cand_cnt && s->remote_cand_cnt + cand_cnt <= s->remote_cand_cap);
+    p2p_setup_mark(s, P2P_SETUP_REMOTE_CAND, p2p_now_ms());
 
     int offset = P2P_SESS_ID_PSZ + 2;  // 第一个 candidates 列表的起始位置
     p2p_remote_candidate_entry_t*c;
@@ -100,51 +158,8 @@ static void unpack_remote_candidates(struct p2p_session *s, const uint8_t *paylo
         s->remote_cand_cnt = 1;
     }
 
-    for (int i = 0, idx; i < cand_cnt; i++, offset += (int)sizeof(p2p_candidate_t)) {
-
-        unpack_candidate(c = &s->remote_cands[idx = s->remote_cand_cnt], payload + offset);
-        int dup_idx = p2p_find_remote_candidate_by_addr(s, &c->addr);
-        if (dup_idx >= 0) {
-            if (s->remote_cands[dup_idx].type == P2P_CAND_PRFLX && c->type != P2P_CAND_PRFLX) {
-                s->remote_cands[dup_idx].type = c->type;
-                s->remote_cands[dup_idx].priority = c->priority;
-                print("I:", LA_F("%s: promoted prflx cand[%d]<%s:%d> → %s\n", LA_F182, 182),
-                      TASK_SYNC_REMOTE, dup_idx, inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port),
-                      p2p_candidate_type_str(c->type));
-            } else {
-                print("V:", LA_F("%s: duplicate remote cand<%s:%d> from signaling, skipped\n", LA_F127, 127),
-                      TASK_SYNC_REMOTE, inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port));
-            }
-            continue;
-        }
-
-        const char* type_str; uint16_t* cand_cnt_ptr; bool opt_off = false;
-        if (c->type == P2P_CAND_HOST) { type_str = "host"; cand_cnt_ptr = &s->remote_host_cnt; opt_off = s->inst->cfg.test_ice_host_off; }
-        else if (c->type == P2P_CAND_SRFLX) { type_str = "srflx"; cand_cnt_ptr = &s->remote_srflx_cnt; opt_off = s->inst->cfg.test_ice_srflx_off; }
-        else if (c->type == P2P_CAND_RELAY) { type_str = "relay"; cand_cnt_ptr = &s->remote_relay_cnt; opt_off = s->inst->cfg.test_ice_relay_off; }
-        else { --s->remote_cand_cnt;
-            print("E:", LA_F("%s: unexpected remote cand type %d, skipped\n", LA_F249, 249),
-                  TASK_SYNC_REMOTE, c->type);
-            continue;
-        }
-
-        if (opt_off) {
-            print("I:", LA_F("%s: remote %s cand[%d]<%s:%d> (disabled)\n", LA_F204, 204),
-                  TASK_SYNC_REMOTE, type_str, idx, inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port));
-            continue;
-        }
-
-        ++s->remote_cand_cnt; ++*cand_cnt_ptr;
-
-        print("I:", LA_F("%s: remote %s cand[%d]<%s:%d> accepted\n", LA_F205, 205),
-              TASK_SYNC_REMOTE, type_str, idx, inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port));
-
-        if (s->sig_sess.compact.state < SIG_COMPACT_SESS_WAIT_SYNC0_ACK) continue;
-
-        if (nat_punch(s, idx) != E_NONE)
-            print("E:", LA_F("%s: punch remote cand[%d]<%s:%d> failed\n", LA_F185, 185),
-                  TASK_SYNC_REMOTE, idx, inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port));
-    }
+    for (int i = 0; i < cand_cnt; i++, offset += (int)sizeof(p2p_candidate_t))
+        accept_remote_candidate(s, payload + offset);
 }
 
 /* 一个 SYNC 包所承载的候选数量（单位）
@@ -206,17 +221,19 @@ static int pack_local_candidates(struct p2p_session *s, uint16_t seq, uint8_t *p
 /*
  * 向信令服务器发送 ONLINE（上线登录）请求
  *
- * 包头: [type=SIG_PKT_ONLINE | flags=0 | seq=0]
+ * 包头: [type=SIG_PKT_ONLINE | flags=0 或 SIG_ONLINE_FLAG_SYNC0 | seq=0]
  * 负载: [local_peer_id(32)][instance_id(4)]
+ *       [remote_peer_id(32)][candidate_count(1)][candidates(N*23)]    ← 仅 SIG_ONLINE_FLAG_SYNC0
  *   - instance_id: 本次 connect() 的实例 ID（网络字节序，32位，必须非 0）
- * 注：候选地址通过后续 SYNC0 包单独提交
+ * 注：主身份已有等待上线的会话时，捎带其 SYNC0（不含 auth_key），服务器登录后立即配对；
+ *     服务器未受理（ONLINE_ACK 不含 SIG_ONACK_FLAG_SYNC0）时，候选仍通过后续 SYNC0 包单独提交
  */
 static void send_online(struct p2p_instance *inst, p2p_compact_ctx_t *sig_ctx, uint64_t now) {
     const char* PROTO = "ONLINE";
 
     assert(sig_ctx->state == SIG_COMPACT_WAIT_ONLINE_ACK);
 
-    uint8_t payload[SIG_PKT_ONLINE_PSZ];
+    uint8_t payload[P2P_MAX_PAYLOAD];
 
     // local_peer_id（32 字节，超过部分截断，不足部分补零）
     int n = (int)strlen(sig_ctx->local_peer_id);
@@ -229,10 +246,100 @@ static void send_online(struct p2p_instance *inst, p2p_compact_ctx_t *sig_ctx, u
     // instance_id（4 字节大端序）
     nwrite_l(payload + n, sig_ctx->instance_id); n += 4;
 
-    err_t err = udp_send(inst, PROTO, SIG_PKT_ONLINE, 0, 0, payload, n, now);
+    // 捎带首个等待上线的主身份会话的 SYNC0（上次捎带的会话仍在等待时优先沿用，保持与 ACK 对应）
+    struct p2p_session *w = NULL;
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
+        p2p_compact_session_t *ss = &s->sig_sess.compact;
+        if (ss->ident || ss->state != SIG_COMPACT_SESS_WAIT_ONLINE || !ss->remote_peer_id[0]) continue;
+        if (!w) w = s;
+        if (!strncmp(ss->remote_peer_id, sig_ctx->online_sync0_peer, P2P_PEER_ID_MAX)) { w = s; break; }
+    }
+    uint8_t flags = 0;
+    if (w) {
+        p2p_compact_session_t *ss = &w->sig_sess.compact;
+        memset(payload + n, 0, P2P_PEER_ID_MAX);
+        memcpy(payload + n, ss->remote_peer_id, strnlen(ss->remote_peer_id, P2P_PEER_ID_MAX));
+        n += P2P_PEER_ID_MAX;
+
+        int cand_cnt = (int)SYNC_CAND_UNIT;
+        if (w->local_cand_cnt < cand_cnt) cand_cnt = w->local_cand_cnt;
+        payload[n++] = (uint8_t)cand_cnt;
+        for (int i = 0; i < cand_cnt; i++) n += pack_candidate(&w->local_cands[i], payload + n);
+
+        memcpy(sig_ctx->online_sync0_peer, ss->remote_peer_id, P2P_PEER_ID_MAX);
+        sig_ctx->online_sync0_cnt = (uint8_t)cand_cnt;
+        flags = SIG_ONLINE_FLAG_SYNC0;
+    }
+    else sig_ctx->online_sync0_peer[0] = 0;
+
+    err_t err = udp_send(inst, PROTO, SIG_PKT_ONLINE, 0, flags, payload, n, now);
     if (err != E_NONE) return;
 
-    print("V:", LA_F("%s sent, inst_id=%u\n", LA_F63, 63), PROTO, sig_ctx->instance_id);
+    if (w) print("V:", LA_F("%s sent, inst_id=%u, +SYNC0 remote='%.32s' cands=%d\n", LA_F700, 700),
+                 PROTO, sig_ctx->instance_id, sig_ctx->online_sync0_peer, sig_ctx->online_sync0_cnt);
+    else print("V:", LA_F("%s sent, inst_id=%u\n", LA_F63, 63), PROTO, sig_ctx->instance_id);
+}
+
+/* 会话所属身份的 auth_key（主身份或附加身份）*/
+static inline uint64_t sess_auth_key(struct p2p_session *s) {
+    p2p_compact_ident_t *id = s->sig_sess.compact.ident;
+    return id ? id->auth_key : s->inst->sig_ctx.compact.auth_key;
+}
+
+/* 附加身份发包：同 udp_send，但只记入该身份的发送时间（不推迟主身份的保活）*/
+static err_t ident_send(struct p2p_instance *inst, p2p_compact_ident_t *id, const char* PROTO,
+                        uint8_t type, uint8_t* payload, int payload_len, uint64_t now) {
+
+    ret_t ret = p2p_udp_send_packet(inst, &inst->sig_ctx.compact.server_addr,
+                                    type, 0, 0, payload, payload_len);
+    if (ret < 0) {
+        print("E:", LA_F("[C] %s send failed(%d)\n", LA_F429, 429), PROTO, E_EXT_CODE(ret));
+        return ret;
+    }
+
+    printf(LA_F("[C] %s send, seq=0, flags=0x%02x, len=%d\n", LA_F432, 432),
+           PROTO, 0, payload_len);
+
+    id->last_send_time = now;
+    return E_NONE;
+}
+
+static p2p_compact_ident_t *ident_by_inst(p2p_compact_ctx_t *sig_ctx, uint32_t instance_id) {
+    for (int i = 0; i < sig_ctx->ident_cnt; i++) {
+        if (sig_ctx->idents[i]->instance_id == instance_id) return sig_ctx->idents[i];
+    }
+    return NULL;
+}
+
+/* 附加身份的 ONLINE（负载格式同 send_online）*/
+static void ident_send_online(struct p2p_instance *inst, p2p_compact_ident_t *id, uint64_t now) {
+    const char* PROTO = "ONLINE";
+
+    uint8_t payload[SIG_PKT_ONLINE_PSZ];
+    memset(payload, 0, P2P_PEER_ID_MAX);
+    memcpy(payload, id->local_peer_id, strnlen(id->local_peer_id, P2P_PEER_ID_MAX - 1));
+    nwrite_l(payload + P2P_PEER_ID_MAX, id->instance_id);
+
+    if (ident_send(inst, id, PROTO, SIG_PKT_ONLINE, payload, (int) sizeof(payload), now) != E_NONE) return;
+
+    print("V:", LA_F("%s sent, ident='%s' inst_id=%u\n", LA_F637, 637), PROTO, id->local_peer_id, id->instance_id);
+}
+
+/* 附加身份开始登录（主身份上线后调用；每次登录生成新的 instance_id）*/
+static void ident_start(struct p2p_instance *inst, p2p_compact_ident_t *id, uint64_t now) {
+
+    p2p_compact_ctx_t *sig_ctx = &inst->sig_ctx.compact;
+
+    uint32_t rid = id->instance_id;
+    while (rid == id->instance_id || !rid || rid == sig_ctx->instance_id || ident_by_inst(sig_ctx, rid))
+        rid = P_rand32();
+    id->instance_id = rid;
+    id->auth_key = 0;
+
+    id->state = SIG_COMPACT_WAIT_ONLINE_ACK;
+    id->sig_attempts = 1;
+    id->online_backoff_ms = 0;
+    ident_send_online(inst, id, now);
 }
 
 /*
@@ -250,15 +357,16 @@ static void send_sync0(struct p2p_instance *inst, struct p2p_session *s, uint64_
     assert(s->inst == inst && !s->id);
 
     p2p_compact_ctx_t *sig_ctx = &inst->sig_ctx.compact;
-    assert(sig_ctx->auth_key != 0);
+    uint64_t auth_key = sess_auth_key(s);
+    assert(auth_key != 0);
 
     p2p_compact_session_t *sess_ctx = &s->sig_sess.compact;
     assert(sess_ctx->state == SIG_COMPACT_SESS_WAIT_SYNC0_ACK);
 
     uint8_t payload[P2P_MAX_PAYLOAD]; int n = 0;
 
-    // auth_key
-    nwrite_ll(payload, sig_ctx->auth_key); n += SIG_AUTH_KEY_PSZ;
+    // auth_key（会话所属身份的令牌）
+    nwrite_ll(payload, auth_key); n += SIG_AUTH_KEY_PSZ;
 
     // remote_peer_id（P2P_PEER_ID_MAX 字节，不足补零）
     int len = (int)strnlen(sess_ctx->remote_peer_id, P2P_PEER_ID_MAX);
@@ -281,7 +389,7 @@ static void send_sync0(struct p2p_instance *inst, struct p2p_session *s, uint64_
     if (err != E_NONE) return;
 
     print("V:", LA_F("%s sent, auth_key=%" PRIu64 ", remote='%.32s', cands=%d\n", LA_F62, 62),
-          PROTO, sig_ctx->auth_key, sess_ctx->remote_peer_id, cand_cnt);
+          PROTO, auth_key, sess_ctx->remote_peer_id, cand_cnt);
 
     sess_ctx->sync_send_time = now;
 }
@@ -350,7 +458,7 @@ static void send_rest_candidates_and_fin(struct p2p_session *s, uint64_t now) {
 
     // 首批发完后，如果还有异步候选收集未完成，启动攒批计时器
     if (s->inst->srflx_active < s->inst->srflx_count || s->inst->turn_pending)
-        sess_ctx->trickle_last_pack_time = P_tick_ms();
+        sess_ctx->trickle_last_pack_time = p2p_now_ms();
 
     sess_ctx->sync_send_time = now;
 }
@@ -387,7 +495,7 @@ static void send_trickle_candidates(struct p2p_session *s) {
     uint8_t flags = 0;
     int payload_len = pack_local_candidates(s, seq, payload, &flags);
 
-    uint64_t now = P_tick_ms();
+    uint64_t now = p2p_now_ms();
     err_t err = udp_send(s->inst, PROTO, SIG_PKT_SYNC, seq, flags, payload, payload_len, now);
     if (err != E_NONE) return;
 
@@ -397,6 +505,51 @@ static void send_trickle_candidates(struct p2p_session *s) {
     sess_ctx->trickle_last_pack_time = s->inst->srflx_active < s->inst->srflx_count || s->inst->turn_pending ? now : 0;
 }
 
+/*
+ * 发送在途的增量 SYNC（delta_ops[0]），首发与重传共用
+ *
+ * 包头: [type=SIG_PKT_SYNC | flags=SIG_SYNC_FLAG_DELTA | seq=version]
+ * 负载: [session_id(P2P_SESS_ID_PSZ)][version(1)][op_count(1)][ops(N*24)]
+ */
+static void send_delta(struct p2p_session *s, uint64_t now) {
+    const char* PROTO = "SYNC(delta)";
+
+    p2p_compact_session_t *sess_ctx = &s->sig_sess.compact;
+    int cnt = sess_ctx->delta_cnt[0];
+    assert(cnt > 0 && sess_ctx->delta_ver);
+
+    uint8_t payload[SIG_PKT_SYNC_DELTA_PSZ(SIG_SYNC_DELTA_MAX)];
+    nwrite_l(payload, s->id);
+    payload[P2P_SESS_ID_PSZ] = sess_ctx->delta_ver;
+    payload[P2P_SESS_ID_PSZ + 1] = (uint8_t)cnt;
+    memcpy(payload + P2P_SESS_ID_PSZ + 2, sess_ctx->delta_ops[0], cnt * SIG_SYNC_DELTA_OPSZ);
+
+    sess_ctx->delta_send_time = now;
+    sess_ctx->delta_attempts++;
+
+    err_t err = udp_send(s->inst, PROTO, SIG_PKT_SYNC, sess_ctx->delta_ver, SIG_SYNC_FLAG_DELTA,
+                         payload, (int)SIG_PKT_SYNC_DELTA_PSZ(cnt), now);
+    if (err != E_NONE) return;
+
+    print("V:", LA_F("%s sent (ses_id=%u), ver=%u, ops=%d\n", LA_F547, 547), PROTO, s->id, sess_ctx->delta_ver, cnt);
+}
+
+/* 在途增量包已确认（或放弃）：攒批中的记录作为下一版本发出 */
+static void delta_next(struct p2p_session *s, uint64_t now) {
+
+    p2p_compact_session_t *sess_ctx = &s->sig_sess.compact;
+    sess_ctx->delta_cnt[0] = 0;
+    if (!sess_ctx->delta_cnt[1]) return;
+
+    memcpy(sess_ctx->delta_ops[0], sess_ctx->delta_ops[1], sess_ctx->delta_cnt[1] * SIG_SYNC_DELTA_OPSZ);
+    sess_ctx->delta_cnt[0] = sess_ctx->delta_cnt[1];
+    sess_ctx->delta_cnt[1] = 0;
+
+    if (++sess_ctx->delta_ver == 0) sess_ctx->delta_ver = 1;
+    sess_ctx->delta_attempts = 0;
+    send_delta(s, now);
+}
+
 /*
  * 周期将未确认的 SYNC 包重发给对方
  *
@@ -444,25 +597,24 @@ static void resend_candidates_and_fin(struct p2p_session *s, uint64_t now) {
  *   - msg: 消息 ID（1字节，用户自定义）
  *   - data: 消息数据（可选）
  */
-static void send_rpc_req(struct p2p_session *s, uint64_t now) {
+static void send_rpc_req(struct p2p_session *s, p2p_compact_rpc_req_t *r, uint64_t now) {
     const char* PROTO = "MSG_REQ";
 
-    p2p_compact_session_t *sess_ctx = &s->sig_sess.compact;
-
     uint8_t payload[P2P_SESS_ID_PSZ + 3 + P2P_MSG_DATA_MAX]; int n = 0;
     nwrite_l(payload + n, s->id); n += P2P_SESS_ID_PSZ;
-    nwrite_s(payload + n, sess_ctx->req_sid); n += 2;
-    payload[n++] = sess_ctx->req_msg;
-    if (sess_ctx->req_data_len > 0) {
-        memcpy(payload + n, sess_ctx->req_data, (size_t)sess_ctx->req_data_len);
-        n += sess_ctx->req_data_len;
+    nwrite_s(payload + n, r->sid); n += 2;
+    payload[n++] = r->msg;
+    if (r->data_len > 0) {
+        memcpy(payload + n, r->data, (size_t)r->data_len);
+        n += r->data_len;
     }
 
+    r->send_time = now;
     err_t err = udp_send(s->inst, PROTO, SIG_PKT_MSG_REQ, 0, 0, payload, n, now);
     if (err != E_NONE) return;
 
     print("V:", LA_F("%s sent (ses_id=%u), sid=%u msg=%u size=%d\n", LA_F53, 53),
-          PROTO, s->id, sess_ctx->req_sid, sess_ctx->req_msg, sess_ctx->req_data_len);
+          PROTO, s->id, r->sid, r->msg, r->data_len);
 }
 
 /*
@@ -475,25 +627,49 @@ static void send_rpc_req(struct p2p_session *s, uint64_t now) {
  *   - code: 响应码
  *   - data: 响应数据
  */
-static void send_rpc_resp(struct p2p_session *s, uint64_t now) {
+static void send_rpc_resp(struct p2p_session *s, p2p_compact_rpc_resp_t *r, uint64_t now) {
     const char* PROTO = "MSG_RESP";
-
-    p2p_compact_session_t *sess_ctx = &s->sig_sess.compact;
+    (void)s;
 
     uint8_t payload[P2P_SESS_ID_PSZ + 2 + 1 + P2P_MSG_DATA_MAX]; int n = 0;
-    nwrite_l(payload, sess_ctx->resp_session_id); n = P2P_SESS_ID_PSZ;
-    nwrite_s(payload + n, sess_ctx->resp_sid); n += 2;
-    payload[n++] = sess_ctx->resp_code;
-    if (sess_ctx->resp_data_len > 0) {
-        memcpy(payload + n, sess_ctx->resp_data, (size_t)sess_ctx->resp_data_len);
-        n += sess_ctx->resp_data_len;
+    nwrite_l(payload, r->session_id); n = P2P_SESS_ID_PSZ;
+    nwrite_s(payload + n, r->sid); n += 2;
+    payload[n++] = r->code;
+    if (r->data_len > 0) {
+        memcpy(payload + n, r->data, (size_t)r->data_len);
+        n += r->data_len;
     }
 
+    r->send_time = now;
     err_t err = udp_send(s->inst, PROTO, SIG_PKT_MSG_RESP, 0, 0, payload, n, now);
     if (err != E_NONE) return;
 
     print("V:", LA_F("%s: sent (ses_id=%u), sid=%u code=%u size=%d\n", LA_F216, 216),
-          PROTO, sess_ctx->resp_sid, sess_ctx->resp_code, sess_ctx->resp_data_len);
+          PROTO, r->session_id, r->sid, r->code, r->data_len);
+}
+
+/* 按 sid 查找请求槽 / 响应槽（sid=0 查找空闲槽）*/
+static p2p_compact_rpc_req_t *rpc_req_find(p2p_compact_session_t *sess_ctx, uint16_t sid) {
+    for (int i = 0; i < P2P_RPC_WINDOW_MAX; i++)
+        if (sess_ctx->reqs[i].sid == sid) return &sess_ctx->reqs[i];
+    return NULL;
+}
+
+static p2p_compact_rpc_resp_t *rpc_resp_find(p2p_compact_session_t *sess_ctx, uint16_t sid) {
+    for (int i = 0; i < P2P_RPC_WINDOW_MAX; i++)
+        if (sess_ctx->resps[i].sid == sid) return &sess_ctx->resps[i];
+    return NULL;
+}
+
+/* 最早到达的挂起请求（等待用户回应，state=0），p2p_response 未指定 sid 时回复该请求 */
+static p2p_compact_rpc_resp_t *rpc_resp_oldest(p2p_compact_session_t *sess_ctx, bool pending_only) {
+    p2p_compact_rpc_resp_t *oldest = NULL;
+    for (int i = 0; i < P2P_RPC_WINDOW_MAX; i++) {
+        p2p_compact_rpc_resp_t *r = &sess_ctx->resps[i];
+        if (!r->sid || (pending_only && r->state != 0)) continue;
+        if (!oldest || r->send_time < oldest->send_time) oldest = r;
+    }
+    return oldest;
 }
 
 /*
@@ -553,13 +729,99 @@ static void reset_peer(p2p_compact_session_t *sess_ctx) {
     sess_ctx->remote_candidates_done = 0;
     sess_ctx->remote_addr_notify_seq = 0;
 
+    // 清理增量同步状态（重新配对时完整列表已包含此前的变更）
+    sess_ctx->delta_ver = 0;
+    sess_ctx->delta_cnt[0] = sess_ctx->delta_cnt[1] = 0;
+    sess_ctx->delta_attempts = 0;
+    sess_ctx->remote_delta_ver = 0;
+
     // 清理 MSG RPC 状态
     sess_ctx->rpc_last_sid = 0;
-    sess_ctx->req_sid = 0;
-    sess_ctx->req_state = 0;
-    sess_ctx->resp_sid = 0;
-    sess_ctx->resp_state = 0;
-    sess_ctx->resp_session_id = 0;
+    sess_ctx->rpc_seen = 0;
+    for (int i = 0; i < P2P_RPC_WINDOW_MAX; i++) {
+        sess_ctx->reqs[i].sid = 0;
+        sess_ctx->resps[i].sid = 0;
+    }
+}
+
+/*
+ * 启动 NAT 打洞（批量）
+ * + 服务器支持 PUNCH_AT 时先暂缓起跑：进入 PUNCHING 但不发 PUNCH，等服务器按双方 RTT 约定的同一时刻
+ *   再发出首个 PUNCH，两端的 PUNCH 在网络中交叉，先到的一方不会撞上对端尚未打开的 NAT 映射
+ */
+static void compact_punch_start(struct p2p_session *s) {
+
+    if (s->inst->sig_ctx.compact.feature_punch_at && s->nat.state < NAT_PUNCHING)
+        nat_punch_hold(s, p2p_now_ms() + PUNCH_AT_WAIT_MS);
+    nat_punch(s, -1/* all candidates */);
+}
+
+/*
+ * 身份上线后：为其名下等待上线的会话发出 SYNC0（ident=NULL 为主身份）
+ * + piggyback：服务器已受理 ONLINE 捎带的 SYNC0，对应会话直接等待 SYNC0_ACK（重传计时从 ONLINE 发出时起算）
+ */
+static void sync0_waiting_sessions(struct p2p_instance *inst, p2p_compact_ident_t *ident, bool piggyback) {
+
+    p2p_compact_ctx_t *sig_ctx = &inst->sig_ctx.compact;
+
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
+        p2p_compact_session_t *sess_ctx = &s->sig_sess.compact;
+        if (sess_ctx->ident != ident) continue;
+
+        // 上线完成之前，session 肯定处于 WAIT SYNCABLE 阶段
+        assert(sess_ctx->remote_peer_id[0] && sess_ctx->state == SIG_COMPACT_SESS_WAIT_ONLINE);
+
+        sess_ctx->state = SIG_COMPACT_SESS_WAIT_SYNC0_ACK;
+        if (piggyback && !strncmp(sess_ctx->remote_peer_id, sig_ctx->online_sync0_peer, P2P_PEER_ID_MAX)) {
+            piggyback = false;
+            sess_ctx->candidates_cached = sig_ctx->online_sync0_cnt < sig_ctx->max_candidates
+                                        ? sig_ctx->online_sync0_cnt : sig_ctx->max_candidates;
+            sess_ctx->sync_send_time = sig_ctx->last_send_time;
+            print("I:", LA_F("ONLINE: auth_key acquired, SYNC0 accepted with ONLINE\n", LA_F701, 701));
+        } else {
+            send_sync0(inst, s, p2p_now_ms());
+            print("I:", LA_F("ONLINE: auth_key acquired, auto SYNC0 sent\n", LA_F328, 328));
+        }
+        sess_ctx->sync_attempts = 1;
+
+        // 根据服务器能力设置探测状态
+        if (sig_ctx->feature_msg) {
+            s->probe.state = P2P_PROBE_STATE_READY;
+        } else {
+            s->probe.state = P2P_PROBE_STATE_NO_SUPPORT;
+        }
+    }
+}
+
+/* 附加身份的 ONLINE_ACK（服务器能力、公网地址与主身份相同，只取 auth_key）*/
+static void ident_on_online_ack(struct p2p_instance *inst, p2p_compact_ident_t *id, uint8_t flags,
+                                const uint8_t *payload) {
+    const char* PROTO = "ONLINE_ACK";
+
+    if (id->state != SIG_COMPACT_WAIT_ONLINE_ACK) {
+        print("V:", LA_F("%s: ignored in state=%d\n", LA_F142, 142), PROTO, (int)id->state);
+        return;
+    }
+
+    uint64_t ack_auth_key = nget_ll(payload + 4);
+    if (ack_auth_key == 0) {
+        if (flags & SIG_ONACK_FLAG_BACKOFF) {
+            id->online_backoff_ms = nget_s(payload + SIG_PKT_ONLINE_ACK_PSZ - 2);
+            id->last_send_time = p2p_now_ms();
+            if (id->sig_attempts > 0) id->sig_attempts--;
+            print("W:", LA_F("%s: rate limited by server, retry in %u ms\n", LA_F574, 574), PROTO, (unsigned)id->online_backoff_ms);
+            return;
+        }
+        print("E:", LA_F("%s: server rejected (no slot)\n", LA_F218, 218), PROTO);
+        return;
+    }
+
+    id->auth_key = ack_auth_key;
+    id->online_backoff_ms = 0;
+    id->state = SIG_COMPACT_ONLINE;
+    print("I:", LA_F("%s: identity '%s' online, auth_key=%" PRIu64 "\n", LA_F683, 683), PROTO, id->local_peer_id, id->auth_key);
+
+    sync0_waiting_sessions(inst, id, false);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -568,29 +830,48 @@ static void reset_peer(p2p_compact_session_t *sess_ctx) {
  * 处理 ONLINE_ACK，服务器上线确认
  *
  * 包头: [type=SIG_PKT_ONLINE_ACK | flags=见下 | seq=0]
- * 负载: [auth_key(SIG_AUTH_KEY_PSZ) | instance_id(4) | max_candidates(1) | public_ip(4) | public_port(2) | probe_port(2)]
+ * 负载: [auth_key(SIG_AUTH_KEY_PSZ) | instance_id(4) | max_candidates(1) | public_ip(4) | public_port(2) | probe_port(2) | [rpc_window(1)]]
  *   - auth_key: 客户端-服务器认证令牌（0=服务器拒绝登录，无可用槽位）
  *   - max_candidates: 服务器缓存的最大候选数量（0=不支持缓存）
  *   - public_ip/port: 客户端的公网地址（服务器观察到的 UDP 源地址）
  *   - probe_port: NAT 探测端口（0=不支持探测）
  *   - flags: SIG_ONACK_FLAG_RELAY (0x01) 表示服务器支持中继
+ *            SIG_ONACK_FLAG_SYNC0 (0x10) 表示已受理 ONLINE 捎带的 SYNC0，该会话不再单独发送
  */
 void compact_on_online_ack(struct p2p_instance *inst, uint16_t seq, uint8_t flags,
                               const uint8_t *payload, int len) {
-    (void)seq; (void)len;
+    (void)seq;
     const char* PROTO = "ONLINE_ACK";
 
     // instance_id 先于 auth_key，可在验证state前快速过滤过期 ACK
     uint32_t ack_instance_id = 0;
     nread_l(&ack_instance_id, payload + 0);
 
+    p2p_compact_ctx_t *sig_ctx = &inst->sig_ctx.compact;
+
+    // 附加身份的 ACK（按回显的 instance_id 区分）
+    p2p_compact_ident_t *id = ident_by_inst(sig_ctx, ack_instance_id);
+    if (id) {
+        ident_on_online_ack(inst, id, flags, payload);
+        return;
+    }
+
     uint64_t ack_auth_key = nget_ll(payload + 4);
     if (ack_auth_key == 0) {
+
+        // 被限流：按服务器给出的间隔继续重试（不计入重试次数）
+        if ((flags & SIG_ONACK_FLAG_BACKOFF) && sig_ctx->state == SIG_COMPACT_WAIT_ONLINE_ACK
+            && ack_instance_id == sig_ctx->instance_id) {
+            sig_ctx->online_backoff_ms = nget_s(payload + SIG_PKT_ONLINE_ACK_PSZ - 2);
+            sig_ctx->last_send_time = p2p_now_ms();
+            if (sig_ctx->sig_attempts > 0) sig_ctx->sig_attempts--;
+            print("W:", LA_F("%s: rate limited by server, retry in %u ms\n", LA_F574, 574), PROTO, (unsigned)sig_ctx->online_backoff_ms);
+            return;
+        }
         print("E:", LA_F("%s: server rejected (no slot)\n", LA_F218, 218), PROTO);
         return;
     }
 
-    p2p_compact_ctx_t *sig_ctx = &inst->sig_ctx.compact;
     if (sig_ctx->state != SIG_COMPACT_WAIT_ONLINE_ACK) {
         print("V:", LA_F("%s: ignored in state=%d\n", LA_F142, 142), PROTO, (int)sig_ctx->state);
         return;
@@ -605,9 +886,11 @@ void compact_on_online_ack(struct p2p_instance *inst, uint16_t seq, uint8_t flag
 
     // ONLINE_ACK 下发 auth_key（客户端-服务器认证令牌）
     sig_ctx->auth_key = ack_auth_key;
+    sig_ctx->online_backoff_ms = 0;
 
     sig_ctx->feature_relay = (flags & SIG_ONACK_FLAG_RELAY) != 0;      // 服务器是否支持数据中继转发
     sig_ctx->feature_msg   = (flags & SIG_ONACK_FLAG_MSG) != 0;        // 服务器是否支持 MSG RPC
+    sig_ctx->feature_punch_at = (flags & SIG_ONACK_FLAG_PUNCH_AT) != 0; // 服务器是否协调双方同时起跑
     sig_ctx->max_candidates = payload[12];  // payload: [instance_id(4)][auth_key(SIG_AUTH_KEY_PSZ)][max(1)][ip(4)][port(2)][probe(2)]
 
     // 解析自己的公网地址（服务器主端口探测到的 UDP 源地址）
@@ -619,6 +902,13 @@ void compact_on_online_ack(struct p2p_instance *inst, uint16_t seq, uint8_t flag
     // 解析服务器提供的 NAT 探测端口，0 表示服务器不支持
     nread_s(&sig_ctx->probe_port, payload + 19);
 
+    // 可选尾字节：每会话并发 RPC 窗口（旧服务器不带，按停等即 1 处理）
+    sig_ctx->rpc_window = len > (int)SIG_PKT_ONLINE_ACK_PSZ ? payload[SIG_PKT_ONLINE_ACK_PSZ] : 1;
+    sig_ctx->alive_s = 0;
+    if (len >= (int)SIG_PKT_ONLINE_ACK_PSZ + 3) nread_s(&sig_ctx->alive_s, payload + SIG_PKT_ONLINE_ACK_PSZ + 1);
+    if (sig_ctx->rpc_window == 0) sig_ctx->rpc_window = 1;
+    if (sig_ctx->rpc_window > P2P_RPC_WINDOW_MAX) sig_ctx->rpc_window = P2P_RPC_WINDOW_MAX;
+
     print("V:", LA_F("%s: accepted, public=%s:%d auth_key=%" PRIu64 " max_cands=%d probe_port=%d relay=%s msg=%s\n", LA_F110, 110),
           PROTO, inet_ntoa(sig_ctx->public_addr.sin_addr), ntohs(sig_ctx->public_addr.sin_port),
           sig_ctx->auth_key, sig_ctx->max_candidates, sig_ctx->probe_port,
@@ -647,27 +937,16 @@ void compact_on_online_ack(struct p2p_instance *inst, uint16_t seq, uint8_t flag
         inst->nat_type = P2P_NAT_DETECTING;
         print("I:", LA_F("%s: started, sending first probe\n", LA_F227, 227), TASK_NAT_PROBE);
         sig_ctx->nat_probe_retries = 0/* 初始化启动探测 */;
-        send_nat_probe(inst, P_tick_ms());
+        send_nat_probe(inst, p2p_now_ms());
     }
     else inst->nat_type = P2P_NAT_UNDETECTABLE;
 
-    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
-        p2p_compact_session_t *sess_ctx = &s->sig_sess.compact;
-
-        // 上线完成之前，session 肯定处于 WAIT SYNCABLE 阶段
-        assert(sess_ctx->remote_peer_id[0] && sess_ctx->state == SIG_COMPACT_SESS_WAIT_ONLINE);
-
-        sess_ctx->state = SIG_COMPACT_SESS_WAIT_SYNC0_ACK;
-        send_sync0(inst, s, P_tick_ms());
-        sess_ctx->sync_attempts = 1;
-        print("I:", LA_F("ONLINE: auth_key acquired, auto SYNC0 sent\n", LA_F328, 328));
+    sync0_waiting_sessions(inst, NULL, (flags & SIG_ONACK_FLAG_SYNC0) != 0);
+    sig_ctx->online_sync0_peer[0] = 0;
 
-        // 根据服务器能力设置探测状态
-        if (sig_ctx->feature_msg) {
-            s->probe.state = P2P_PROBE_STATE_READY;
-        } else {
-            s->probe.state = P2P_PROBE_STATE_NO_SUPPORT;
-        }
+    // 主身份上线后，附加身份依次登录
+    for (int i = 0; i < sig_ctx->ident_cnt; i++) {
+        if (sig_ctx->idents[i]->state == SIG_COMPACT_INIT) ident_start(inst, sig_ctx->idents[i], p2p_now_ms());
     }
 }
 
@@ -675,9 +954,10 @@ void compact_on_online_ack(struct p2p_instance *inst, uint16_t seq, uint8_t flag
  * 处理 ALIVE_ACK，服务器保活确认
  *
  * 包头: [type=SIG_PKT_ALIVE_ACK | flags=0 | seq=0]
- * 负载: 无
+ * 负载: [alive_s(2)，可选]
+ *   - alive_s: 服务器按负载与本端报告的绑定存活期建议的 ALIVE 间隔（秒）
  */
-void compact_on_alive_ack(struct p2p_instance *inst) {
+void compact_on_alive_ack(struct p2p_instance *inst, const uint8_t *payload, int len) {
     const char* PROTO = "ALIVE_ACK";
 
     p2p_compact_ctx_t *sig_ctx = &inst->sig_ctx.compact;
@@ -689,8 +969,15 @@ void compact_on_alive_ack(struct p2p_instance *inst) {
 
     print("V:", LA_F("%s: accepted\n", LA_F111, 111), PROTO);
 
+    if (len >= (int)SIG_PKT_ALIVE_ACK_EXT_PSZ) {
+        uint16_t alive_s; nread_s(&alive_s, payload);
+        if (alive_s != sig_ctx->alive_s)
+            print("I:", LA_F("%s: keepalive interval %u s advised by server\n", LA_F685, 685), PROTO, alive_s);
+        sig_ctx->alive_s = alive_s;
+    }
+
     // 确认服务器未掉线
-    uint64_t now = P_tick_ms();
+    uint64_t now = p2p_now_ms();
     sig_ctx->last_recv_time = now;
 
     // 通知路径管理器：ALIVE_ACK 确认（seq=0），完成 RoundTrip 测量
@@ -718,7 +1005,7 @@ void compact_on_sync0_ack(struct p2p_session *s, const uint8_t *payload, int len
     {
         uint8_t ack_payload[SIG_PKT_SYNC0_ACK_C2S_PSZ];
         nwrite_l(ack_payload, s->id);
-        udp_send(s->inst, PROTO, SIG_PKT_SYNC0_ACK, 0, 0, ack_payload, sizeof(ack_payload), P_tick_ms());
+        udp_send(s->inst, PROTO, SIG_PKT_SYNC0_ACK, 0, 0, ack_payload, sizeof(ack_payload), p2p_now_ms());
     }
 
     if (sess_ctx->state != SIG_COMPACT_SESS_WAIT_SYNC0_ACK) return;
@@ -729,6 +1016,7 @@ void compact_on_sync0_ack(struct p2p_session *s, const uint8_t *payload, int len
 
     assert(s->state == P2P_STATE_SIGNALING);
     s->state = P2P_STATE_WAITING;
+    p2p_setup_mark(s, P2P_SETUP_SIGNALED, p2p_now_ms());
 
     sess_ctx->state = SIG_COMPACT_SESS_WAIT_PEER;
     if (!online) {
@@ -743,10 +1031,10 @@ void compact_on_sync0_ack(struct p2p_session *s, const uint8_t *payload, int len
 
     sess_ctx->state = SIG_COMPACT_SESS_SYNCING;
     print("I:", LA_F("%s: entered, peer online in SYNC0_ACK\n", LA_F134, 134), TASK_SYNC);
-    send_rest_candidates_and_fin(s, P_tick_ms());
+    send_rest_candidates_and_fin(s, p2p_now_ms());
 
     // 启动 NAT 打洞（即使当前没有候选也要启动，以便打洞超时后 fallback 到信令中转）
-    nat_punch(s, -1/* all candidates */);
+    compact_punch_start(s);
 }
 
 /*
@@ -759,16 +1047,27 @@ void compact_on_sync0_ack(struct p2p_session *s, const uint8_t *payload, int len
  */
 void compact_on_sync_ack(struct p2p_session *s, uint16_t seq, uint8_t flags,
                          const uint8_t *payload, int len, uint64_t now) {
-    (void)flags; (void)payload; (void)len; (void)now;
+    (void)payload; (void)len;
     const char* PROTO = "SYNC_ACK";
 
+    p2p_compact_session_t *sess_ctx = &s->sig_sess.compact;
+
+    // 增量 SYNC 的确认：seq 为其版本号
+    if (flags & SIG_SYNC_FLAG_DELTA) {
+        if (!sess_ctx->delta_cnt[0] || seq != sess_ctx->delta_ver) {
+            print("V:", LA_F("%s: ignored stale delta ack ver=%u (current=%u)\n", LA_F548, 548), PROTO, seq, sess_ctx->delta_ver);
+            return;
+        }
+        print("V:", LA_F("%s: delta ver=%u acked\n", LA_F549, 549), PROTO, seq);
+        delta_next(s, now);
+        return;
+    }
+
     if (seq == 0 || seq > 16) {
         print("E:", LA_F("%s: invalid ack_seq=%u\n", LA_F144, 144), PROTO, seq);
         return;
     }
 
-    p2p_compact_session_t *sess_ctx = &s->sig_sess.compact;
-
     uint16_t bit = (uint16_t)(1u << (seq - 1));
     if ((sess_ctx->candidates_mask & bit) == 0) {
         print("E:", LA_F("%s: unexpected ack_seq=%u mask=0x%04x\n", LA_F247, 247),
@@ -832,7 +1131,7 @@ void compact_on_peer_sync0(struct p2p_session *s,
     if (sess_ctx->state == SIG_COMPACT_SESS_WAIT_PEER) {
         sess_ctx->state = SIG_COMPACT_SESS_SYNCING;
         print("I:", LA_F("%s: entered, %s arrived\n", LA_F133, 133), TASK_SYNC, PROTO);
-        send_rest_candidates_and_fin(s, P_tick_ms());
+        send_rest_candidates_and_fin(s, p2p_now_ms());
     }
 
     bool new_seq = false;
@@ -856,7 +1155,7 @@ void compact_on_peer_sync0(struct p2p_session *s,
     // 注：Bob 在 SYNC0_ACK(online=1) 时已设置 peer_online，但 punch 尚未启动，需在此触发
     if (s->nat.state < NAT_PUNCHING) {
         print("I:", LA_F("%s: peer online, starting NAT punch\n", LA_F177, 177), PROTO);
-        nat_punch(s, -1/* all candidates */);
+        compact_punch_start(s);
     }
 
     if (new_seq) {
@@ -865,6 +1164,10 @@ void compact_on_peer_sync0(struct p2p_session *s,
         if (sess_ctx->remote_candidates_0 && sess_ctx->remote_candidates_mask &&
             (sess_ctx->remote_candidates_done & sess_ctx->remote_candidates_mask) == sess_ctx->remote_candidates_mask) {
 
+            if (!s->remote_cand_done) {
+                P2P_TRACE(s, P2P_TRACE_SIG, 0, 0, 0, 0, 0, 0, "cands_done");
+                p2p_setup_mark(s, P2P_SETUP_CANDS_DONE, p2p_now_ms());
+            }
             s->remote_cand_done = true;
 
             print("I:", LA_F("%s: sync complete (ses_id=%u, mask=0x%04x)\n", LA_F231, 231),
@@ -885,6 +1188,74 @@ void compact_on_peer_sync0(struct p2p_session *s,
 }
 
 
+/*
+ * 处理对端的增量 SYNC（候选增删），应用后以 SYNC_ACK(flags=DELTA, seq=version) 确认
+ *
+ * 包头: [type=SIG_PKT_SYNC | flags=SIG_SYNC_FLAG_DELTA | seq=version]
+ * 负载: [session_id(P2P_SESS_ID_PSZ)][version(1)][op_count(1)][ops(N*24)]
+ *   - ADD: 按地址去重后入表并打洞；此前被 DEL 的同地址候选重新启用
+ *   - DEL: 按地址定位，重置并标记路径失效（保留表项，索引不变）
+ */
+static void compact_on_peer_delta(struct p2p_session *s, uint16_t seq,
+                                  const uint8_t *payload, int len, uint64_t now) {
+    const char* PROTO = "SYNC(delta)";
+
+    p2p_compact_session_t *sess_ctx = &s->sig_sess.compact;
+    uint8_t ver = payload[P2P_SESS_ID_PSZ];
+    int op_cnt = payload[P2P_SESS_ID_PSZ + 1];
+    if (!ver || seq != ver || len < (int)SIG_PKT_SYNC_DELTA_PSZ(op_cnt)) {
+        print("E:", LA_F("%s: bad payload(len=%d ver=%u ops=%d)\n", LA_F550, 550), PROTO, len, ver, op_cnt);
+        return;
+    }
+
+    if (sess_ctx->remote_delta_ver == 0 || uint8_circle_newer(ver, sess_ctx->remote_delta_ver)) {
+
+        const uint8_t *op = payload + P2P_SESS_ID_PSZ + 2;
+        for (int i = 0; i < op_cnt; i++, op += SIG_SYNC_DELTA_OPSZ) {
+
+            p2p_remote_candidate_entry_t tmp;
+            unpack_candidate(&tmp, op + 1);
+            int idx = p2p_find_remote_candidate_by_addr(s, &tmp.addr);
+
+            if (op[0] == SIG_SYNC_DELTA_ADD) {
+
+                if (idx >= 0 && s->remote_cands[idx].stats.state == PATH_STATE_FAILED) {
+                    print("I:", LA_F("%s: remote cand[%d]<%s:%d> re-added\n", LA_F551, 551),
+                          TASK_SYNC_REMOTE, idx, inet_ntoa(tmp.addr.sin_addr), ntohs(tmp.addr.sin_port));
+                    p2p_reset_path(s, idx);
+                    s->remote_cands[idx].check = NAT_CHECK_NONE;
+                    if (nat_punch(s, idx) != E_NONE)
+                        print("E:", LA_F("%s: punch remote cand[%d]<%s:%d> failed\n", LA_F185, 185),
+                              TASK_SYNC_REMOTE, idx, inet_ntoa(tmp.addr.sin_addr), ntohs(tmp.addr.sin_port));
+                    continue;
+                }
+                if (p2p_remote_cands_reserve(s, s->remote_cand_cnt + 1) != E_NONE) {
+                    print("E:", LA_F("Failed to reserve remote candidates (cnt=1)\n", LA_F289, 289));
+                    break;
+                }
+                accept_remote_candidate(s, op + 1);
+            }
+            else if (op[0] == SIG_SYNC_DELTA_DEL) {
+
+                if (idx < 0) continue;      // 未曾同步到（或已被过滤）的候选
+                print("I:", LA_F("%s: remote cand[%d]<%s:%d> removed\n", LA_F552, 552),
+                      TASK_SYNC_REMOTE, idx, inet_ntoa(tmp.addr.sin_addr), ntohs(tmp.addr.sin_port));
+                p2p_reset_path(s, idx);
+                s->remote_cands[idx].check = NAT_CHECK_NONE;
+                s->remote_cands[idx].stats.state = PATH_STATE_FAILED;
+            }
+            else print("W:", LA_F("%s: unknown delta op %u, skipped\n", LA_F553, 553), PROTO, op[0]);
+        }
+        sess_ctx->remote_delta_ver = ver;
+    }
+    else print("V:", LA_F("%s: ignored old ver=%u (current=%u)\n", LA_F554, 554), PROTO, ver, sess_ctx->remote_delta_ver);
+
+    uint8_t ack_payload[P2P_SESS_ID_PSZ];
+    nwrite_l(ack_payload, s->id);
+    if (udp_send(s->inst, PROTO, SIG_PKT_SYNC_ACK, ver, SIG_SYNC_FLAG_DELTA, ack_payload, sizeof(ack_payload), now) != E_NONE) return;
+    print("V:", LA_F("%s sent (ses_id=%u), seq=%u\n", LA_F52, 52), "SYNC_ACK", s->id, ver);
+}
+
 /*
  * 包头: [type=SIG_PKT_SYNC | flags=见下 | seq=序列号]
  * 负载: [session_id(P2P_SESS_ID_PSZ) | base_index(1) | candidate_count(1) | candidates(N*7)]
@@ -900,6 +1271,11 @@ void compact_on_peer_sync(struct p2p_session *s, uint16_t seq, uint8_t flags,
                           uint64_t now) {
     const char* PROTO = "SYNC";
 
+    if (flags & SIG_SYNC_FLAG_DELTA) {
+        compact_on_peer_delta(s, seq, payload, len, now);
+        return;
+    }
+
     if (seq > 16) {
         print("E:", LA_F("%s: invalid seq=%u\n", LA_F149, 149), PROTO, seq);
         return;
@@ -921,7 +1297,7 @@ void compact_on_peer_sync(struct p2p_session *s, uint16_t seq, uint8_t flags,
     if (sess_ctx->state == SIG_COMPACT_SESS_WAIT_PEER) {
         sess_ctx->state = SIG_COMPACT_SESS_SYNCING;
         print("I:", LA_F("%s: entered early, %s arrived before SYNC0\n", LA_F132, 132), TASK_SYNC, PROTO);
-        send_rest_candidates_and_fin(s, P_tick_ms());
+        send_rest_candidates_and_fin(s, p2p_now_ms());
     }
 
     bool new_seq = false;
@@ -982,7 +1358,10 @@ void compact_on_peer_sync(struct p2p_session *s, uint16_t seq, uint8_t flags,
         sockaddr_init_with_net(&c->addr, (uint32_t *) (payload + P2P_SESS_ID_PSZ + 3),
                                (uint16_t *) (payload + P2P_SESS_ID_PSZ + 7));
         c->last_punch_send_ms = 0;
+        c->check = NAT_CHECK_NONE;      // 地址变化：重新加入检查表
+        c->sock = 0;
         if (s->remote_cand_cnt == 0) s->remote_cand_cnt = 1;
+        p2p_setup_mark(s, P2P_SETUP_REMOTE_CAND, p2p_now_ms());
 
         // Trickle candidates：NAT 打洞已启动时，立即探测最新地址
         if (s->nat.state == NAT_PUNCHING || s->nat.state == NAT_RELAY) {
@@ -1018,7 +1397,7 @@ void compact_on_peer_sync(struct p2p_session *s, uint16_t seq, uint8_t flags,
     // 无论 peer_online 之前是否已设置，只要 NAT 打洞还未启动就启动
     if (s->nat.state < NAT_PUNCHING) {
         print("I:", LA_F("%s: peer online, starting NAT punch\n", LA_F177, 177), PROTO);
-        nat_punch(s, -1/* all candidates */);
+        compact_punch_start(s);
     }
 
     if (new_seq) {
@@ -1029,6 +1408,10 @@ void compact_on_peer_sync(struct p2p_session *s, uint16_t seq, uint8_t flags,
             (sess_ctx->remote_candidates_done & sess_ctx->remote_candidates_mask) == sess_ctx->remote_candidates_mask) {
 
             // 标记远程候选交换完成（供 NAT 层判断打洞超时使用）
+            if (!s->remote_cand_done) {
+                P2P_TRACE(s, P2P_TRACE_SIG, 0, 0, 0, 0, 0, 0, "cands_done");
+                p2p_setup_mark(s, P2P_SETUP_CANDS_DONE, p2p_now_ms());
+            }
             s->remote_cand_done = true;
 
             print("I:", LA_F("%s: sync complete (ses_id=%u, mask=0x%04x)\n", LA_F231, 231),
@@ -1079,7 +1462,7 @@ void compact_on_fin(struct p2p_session *s, uint16_t seq, uint8_t flags,
     //   auth_key 不需要重置，因为它是 client↔server 的认证令牌，对端断开不影响与服务器的关系
     //   session_id 对应 client↔peer 会话，对端断开后将在下一轮 SYNC0_ACK 中重新获得
     sess_ctx->state = SIG_COMPACT_SESS_WAIT_PEER;
-    s->id = 0;
+    p2p_session_set_id(s, 0);
 
     // 清除双方协商信息
     reset_peer(sess_ctx);
@@ -1090,6 +1473,32 @@ void compact_on_fin(struct p2p_session *s, uint16_t seq, uint8_t flags,
     // + 这里将信令层的 peer close 转换为 NAT 层的 closed 状态，主循环会统一以 NAT 层的 NAT_CLOSED 状态机变更为准
     //   并统一调用 p2p_session_reset
     s->nat.state = NAT_CLOSED;
+    p2p_session_wake(s);
+}
+
+/*
+ * 处理 PUNCH_AT，服务器协调的同时起跑提示
+ *
+ * 包头: [type=SIG_PKT_PUNCH_AT | flags=0 | seq=0]
+ * 负载: [session_id(P2P_SESS_ID_PSZ)][delay_ms(2)]
+ *   - delay_ms: 收到后再等待的毫秒数，服务器按到两端的 RTT 估计使双方同一时刻发出首个 PUNCH
+ */
+void compact_on_punch_at(struct p2p_session *s, uint16_t seq, uint8_t flags,
+                         const uint8_t *payload, int len, uint64_t now) {
+    (void)seq; (void)flags; (void)len;
+    const char* PROTO = "PUNCH_AT";
+
+    uint16_t delay;
+    nread_s(&delay, payload + P2P_SESS_ID_PSZ);
+    if (delay > PUNCH_AT_WAIT_MS) delay = PUNCH_AT_WAIT_MS;
+
+    if (!s->nat.punch_hold) {
+        print("V:", LA_F("%s: ignored, punch already started (nat=%d)\n", LA_F681, 681), PROTO, (int)s->nat.state);
+        return;
+    }
+
+    print("V:", LA_F("%s: punch in %u ms (ses_id=%u)\n", LA_F682, 682), PROTO, delay, s->id);
+    nat_punch_hold(s, now + delay);
 }
 
 /*
@@ -1106,7 +1515,7 @@ void compact_on_fin(struct p2p_session *s, uint16_t seq, uint8_t flags,
  */
 void compact_on_request(struct p2p_session *s, uint16_t seq, uint8_t flags,
                         const uint8_t *payload, int len, uint64_t now) {
-    (void)seq; (void)now;
+    (void)seq;
     const char* PROTO = "MSG_REQ";
 
     // 客户端收到 req 肯定都是 Server 转发过来，而不是对方直接发来的原始请求
@@ -1123,35 +1532,44 @@ void compact_on_request(struct p2p_session *s, uint16_t seq, uint8_t flags,
     const uint8_t *req_data = payload + P2P_SESS_ID_PSZ + 3;
     int req_len = len - (int)SIG_PKT_MSG_REQ_MIN_PSZ;
 
-    /* 判断是否是新请求（使用循环序列号比较）：
-     * 1. 如果正在处理请求且 sid 相同 → 忽略重复包
-     * 2. 如果 sid <= last_sid（旧请求）→ 忽略
-     * 3. 如果 sid > last_sid（新请求）→ 处理（可能覆盖正在处理的旧请求）*/
-    if (sess_ctx->resp_state == 1 && sess_ctx->resp_sid == sid) {
+    /* 判断是否是新请求（流水线下多个 sid 并发，乱序到达）：
+     * 1. 该 sid 仍在响应槽中（等待用户回应或 RESP_ACK）→ 忽略重复包
+     * 2. 该 sid 已接受过，或落后 last_sid 超过位图范围 → 忽略
+     * 3. 否则为新请求；槽位用尽时顶替最早的一个 */
+    if (sid == 0 || rpc_resp_find(sess_ctx, sid)) {
         print("V:", LA_F("%s: duplicate request ignored (sid=%u, already processing)\n", LA_F130, 130), PROTO, sid);
         return;
     }
 
-    // 忽略旧请求（sid <= last_sid）
-    if (sess_ctx->rpc_last_sid != 0 && !uint16_circle_newer(sid, sess_ctx->rpc_last_sid)) {
+    uint16_t last_sid = sess_ctx->rpc_last_sid;
+    if (!p2p_rpc_sid_accept(&sess_ctx->rpc_last_sid, &sess_ctx->rpc_seen, sid)) {
         print("V:", LA_F("%s: old request ignored (sid=%u <= last_sid=%u)\n", LA_F166, 166),
-              PROTO, sid, sess_ctx->rpc_last_sid);
+              PROTO, sid, last_sid);
         return;
     }
 
-    // 如果正在处理旧请求但收到新请求（sid > last_sid），则覆盖旧请求
-    if (sess_ctx->resp_state == 1) {
+    p2p_compact_rpc_resp_t *r = rpc_resp_find(sess_ctx, 0);
+    if (!r) {
+        r = rpc_resp_oldest(sess_ctx, false);
         print("W:", LA_F("%s: new request (sid=%u) overrides pending request (sid=%u)\n", LA_F155, 155),
-              PROTO, sid, sess_ctx->resp_sid);
+              PROTO, sid, r->sid);
     }
 
-    sess_ctx->resp_sid         = sid;
-    sess_ctx->resp_session_id  = session_id;
+    r->sid        = sid;
+    r->state      = 0/* waiting user */;
+    r->session_id = session_id;
+    r->send_time  = now;
+
+    // 分片传输的分片 / 拉取请求，由 rpc 模块应答
+    if (msg == P2P_MSG_FRAG) {
+        rpc_on_request(s, sid, req_data, req_len);
+        return;
+    }
 
     // msg=0: 默认自动 echo 回复（无需应用层介入）
     if (msg == 0) {
         print("V:", LA_F("%s msg=0 accepted (ses_id=%u), echo reply sid=%u len=%d\n", LA_F46, 46), PROTO, s->id, sid, req_len);
-        p2p_signal_compact_response(s, 0, req_data, req_len);
+        p2p_signal_compact_response(s, sid, 0, req_data, req_len);
         return;
     }
 
@@ -1183,44 +1601,39 @@ void compact_on_request_ack(struct p2p_session *s, uint16_t seq, uint8_t flags,
     uint16_t sid = nget_s(payload + P2P_SESS_ID_PSZ);
     uint8_t status = payload[P2P_SESS_ID_PSZ + 2];
 
-    if (sess_ctx->req_sid != sid) {
-        print("V:", LA_F("%s: ignored for sid=%u (current sid=%u)\n", LA_F140, 140), PROTO, sid, sess_ctx->req_sid);
+    p2p_compact_rpc_req_t *r = sid ? rpc_req_find(sess_ctx, sid) : NULL;
+    if (!r) {
+        print("V:", LA_F("%s: ignored for sid=%u (not pending)\n", LA_F575, 575), PROTO, sid);
         return;
     }
-    if (sess_ctx->req_state != 1/* waiting REQ_ACK */) {
-        print("V:", LA_F("%s: ignored in invalid state=%d\n", LA_F141, 141), PROTO, (int)sess_ctx->req_state);
+    if (r->state != 1/* waiting REQ_ACK */) {
+        print("V:", LA_F("%s: ignored in invalid state=%d\n", LA_F141, 141), PROTO, (int)r->state);
         return;
     }
 
     // msg=0 data=0 是 probe 保留的空 RPC，短路处理，不走应用层
-    if (sess_ctx->req_msg == 0 && sess_ctx->req_data_len == 0) {
+    if (r->msg == 0 && r->data_len == 0) {
         probe_compact_on_req_ack(s, sid, status);
-        if (status == 0)
-            sess_ctx->req_state = 2/* waiting RESP */;
-        else {
-            sess_ctx->req_state = 0;
-            sess_ctx->req_sid   = 0;
-        }
+        if (status == 0) r->state = 2/* waiting RESP */;
+        else r->sid = 0;
         return;
     }
 
     // 成功：服务器已收到请求并开始向对端中转，停止重发，等待 MSG_RESP
     if (status == 0) {
-        sess_ctx->req_state = 2/* waiting RESP */;
-        print("V:", LA_F("%s accepted (ses_id=%u), waiting for response (sid=%u)\n", LA_F45, 45), PROTO, s->id, sess_ctx->req_sid);
+        r->state = 2/* waiting RESP */;
+        print("V:", LA_F("%s accepted (ses_id=%u), waiting for response (sid=%u)\n", LA_F45, 45), PROTO, s->id, sid);
     }
     // 对端不在线：请求失败，通知上层
     else {
 
-        uint16_t saved_id  = sess_ctx->req_sid;
-        uint8_t  saved_msg = sess_ctx->req_msg;
-        sess_ctx->req_state  = 0;
-        sess_ctx->req_sid = 0;
+        uint16_t saved_id  = r->sid;
+        uint8_t  saved_msg = r->msg;
+        r->sid = 0;
 
         print("W:", LA_F("%s: RPC fail due to peer offline (sid=%u)\n", LA_F92, 92), PROTO, saved_id);
 
-        if (s->inst->cfg.on_response)
-            s->inst->cfg.on_response((p2p_session_t)s, saved_id, saved_msg, NULL, -1, s->inst->cfg.userdata);
+        rpc_on_response(s, saved_id, saved_msg, NULL, -1);
     }
 }
 
@@ -1269,18 +1682,18 @@ void compact_on_response(struct p2p_session *s, uint16_t seq, uint8_t flags,
         }
     }
 
-    // 仅命中当前挂起请求时，才需要继续解析响应内容
-    if (!(sess_ctx->req_state == 2/* waiting RESP */ && sess_ctx->req_sid == sid)) {
-        print("V:", LA_F("%s: duplicate/irrelevant response acked (sid=%u, current sid=%u, state=%d)\n", LA_F131, 131),
-              PROTO, sid, sess_ctx->req_sid, (int)sess_ctx->req_state);
+    // 仅命中挂起请求时，才需要继续解析响应内容
+    // 注：REQ_ACK 丢失时 RESP 可能先到（state=1），同样视为完成
+    p2p_compact_rpc_req_t *r = sid ? rpc_req_find(sess_ctx, sid) : NULL;
+    if (!r) {
+        print("V:", LA_F("%s: duplicate/irrelevant response acked (sid=%u)\n", LA_F577, 577), PROTO, sid);
         return;
     }
 
     // msg=0 data=0 是 probe 保留的空 RPC，短路处理，不走应用层
-    if (sess_ctx->req_msg == 0 && sess_ctx->req_data_len == 0) {
+    if (r->msg == 0 && r->data_len == 0) {
         probe_compact_on_response(s, sid);
-        sess_ctx->req_state = 0;
-        sess_ctx->req_sid   = 0;
+        r->sid = 0;
         return;
     }
 
@@ -1308,8 +1721,7 @@ void compact_on_response(struct p2p_session *s, uint16_t seq, uint8_t flags,
     print("V:", LA_F("%s accepted (ses_id=%u), sid=%u code=%u len=%u\n", LA_F42, 42),
           PROTO, s->id, sid, res_code, res_size);
 
-    sess_ctx->req_state  = 0;
-    sess_ctx->req_sid = 0;
+    r->sid = 0;
 
     /* 根据 flags 输出不同的日志 */
     if (flags & SIG_MSG_FLAG_PEER_OFFLINE) {
@@ -1322,8 +1734,7 @@ void compact_on_response(struct p2p_session *s, uint16_t seq, uint8_t flags,
         print("I:", LA_F("%s: RPC complete (sid=%u)\n", LA_F91, 91), PROTO, sid);
     }
 
-    if (s->inst->cfg.on_response)
-        s->inst->cfg.on_response((p2p_session_t)s, sid, res_code, res_data, res_size, s->inst->cfg.userdata);
+    rpc_on_response(s, sid, res_code, res_data, res_size);
 }
 
 /*
@@ -1343,24 +1754,20 @@ void compact_on_response_ack(struct p2p_session *s, uint16_t seq, uint8_t flags,
     p2p_compact_session_t *sess_ctx = &s->sig_sess.compact;
 
     uint16_t sid = nget_s(payload + P2P_SESS_ID_PSZ);
-    if (sess_ctx->resp_sid != sid) {
-        print("V:", LA_F("%s: ignored for sid=%u (current sid=%u)\n", LA_F140, 140), PROTO, sid, sess_ctx->resp_sid);
+    p2p_compact_rpc_resp_t *r = sid ? rpc_resp_find(sess_ctx, sid) : NULL;
+    if (!r) {
+        print("V:", LA_F("%s: ignored for sid=%u (not pending)\n", LA_F575, 575), PROTO, sid);
         return;
     }
-    if (sess_ctx->resp_state != 1/* waiting RESP_ACK */) {
-        print("V:", LA_F("%s: ignored in invalid state=%d\n", LA_F141, 141), PROTO, (int)sess_ctx->resp_state);
+    if (r->state != 1/* waiting RESP_ACK */) {
+        print("V:", LA_F("%s: ignored in invalid state=%d\n", LA_F141, 141), PROTO, (int)r->state);
         return;
     }
 
-    // 记录最后完成的 sid
     print("V:", LA_F("%s accepted (ses_id=%u), sid=%u\n", LA_F44, 44), PROTO, s->id, sid);
 
-    sess_ctx->rpc_last_sid = sess_ctx->resp_sid;
-
-    // 成功：Server 已收到 B 的 MSG_RESP，结束 RESP 重发
-    sess_ctx->resp_sid = 0;
-    sess_ctx->resp_state = 0;
-    sess_ctx->resp_session_id = 0;
+    // 成功：Server 已收到 B 的 MSG_RESP，结束 RESP 重发（sid 已记入 rpc_seen，重复的 REQ 不会再触发回调）
+    r->sid = 0;
 
     print("I:", LA_F("%s: RPC finished (sid=%u)\n", LA_F94, 94), PROTO, sid);
 }
@@ -1397,10 +1804,11 @@ void compact_on_nat_probe_ack(struct p2p_instance *inst, uint16_t seq,
 
     // 端口一致性：主端口映射端口 == 探测端口映射端口 → 锥形，否则 → 对称
     sig_ctx->nat_is_port_consistent = (probe_mapped.sin_port == sig_ctx->public_addr.sin_port) ? 1 : 0;
+    sig_ctx->nat_port_delta = (int16_t)(ntohs(probe_mapped.sin_port) - ntohs(sig_ctx->public_addr.sin_port));
 
     // 检测 OPEN：公网地址 IP 与任意本地地址相同（无 NAT）
     int is_open = 0;
-    const route_ctx_t *rt = route_shared_get();
+    const route_ctx_t *rt = p2p_inst_route(inst);
     for (int i = 0; rt && i < rt->addr_count; i++) {
         if (sig_ctx->public_addr.sin_addr.s_addr == rt->local_addrs[i].sin_addr.s_addr) {
             is_open = 1;
@@ -1422,6 +1830,29 @@ void compact_on_nat_probe_ack(struct p2p_instance *inst, uint16_t seq,
 }
 
 
+/*
+ * 按服务器下发 SYNC0 / SYNC0_ACK 中的对端 ID 定位会话
+ * inst_ofs 处可选的 instance_id 尾部（SIG_PKT_INST_ID_PSZ）指明接收方身份；
+ * 不带尾部（旧服务器）或无法识别时取首个匹配
+ */
+static struct p2p_session *peer_session(struct p2p_instance *inst, const uint8_t *payload, int len, int inst_ofs) {
+
+    p2p_compact_ctx_t *sig_ctx = &inst->sig_ctx.compact;
+
+    bool tagged = false; p2p_compact_ident_t *ident = NULL;
+    if (len >= inst_ofs + (int)SIG_PKT_INST_ID_PSZ) {
+        uint32_t instance_id = nget_l(payload + inst_ofs);
+        ident = ident_by_inst(sig_ctx, instance_id);
+        tagged = ident || instance_id == sig_ctx->instance_id;
+    }
+
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
+        if (strncmp(s->sig_sess.compact.remote_peer_id, (const char *)payload, P2P_PEER_ID_MAX - 1)) continue;
+        if (!tagged || s->sig_sess.compact.ident == ident) return s;
+    }
+    return NULL;
+}
+
 void p2p_signal_compact_proto(struct p2p_instance *inst, uint8_t type, uint8_t flags, uint16_t seq,
                               uint8_t *payload, int payload_len, uint64_t now) {
 
@@ -1446,7 +1877,7 @@ void p2p_signal_compact_proto(struct p2p_instance *inst, uint8_t type, uint8_t f
 
             printf(LA_F("[C] %s recv\n", LA_F428, 428), PROTO);
 
-            compact_on_alive_ack(inst);
+            compact_on_alive_ack(inst, payload, payload_len);
             break;
         }
 
@@ -1478,10 +1909,7 @@ void p2p_signal_compact_proto(struct p2p_instance *inst, uint8_t type, uint8_t f
                 break;
             }
 
-            struct p2p_session *s = inst->sessions_head;
-            for (; s; s = s->next) {
-                if (strncmp(s->sig_sess.compact.remote_peer_id, (const char *)payload, P2P_PEER_ID_MAX - 1) == 0) break;
-            }
+            struct p2p_session *s = peer_session(inst, payload, payload_len, (int)SIG_PKT_SYNC0_ACK_PSZ);
             if (!s) {
                 print("W:", LA_F("%s: no session for peer_id=%.*s\n", LA_F161, 161),
                     PROTO, (int)(P2P_PEER_ID_MAX - 1), (const char *)payload);
@@ -1494,7 +1922,7 @@ void p2p_signal_compact_proto(struct p2p_instance *inst, uint8_t type, uint8_t f
             }
 
             // 会话初始化：首次收到 session_id 时绑定
-            if (!s->id) s->id = session_id;
+            if (!s->id) p2p_session_set_id(s, session_id);
             else if (s->id != session_id) {
                 print("W:", LA_F("%s: session_id changed (old=%u new=%u)\n", LA_F225, 225),
                       PROTO, s->id, session_id);
@@ -1520,10 +1948,8 @@ void p2p_signal_compact_proto(struct p2p_instance *inst, uint8_t type, uint8_t f
                 break;
             }
 
-            struct p2p_session *s = inst->sessions_head;
-            for (; s; s = s->next) {
-                if (strncmp(s->sig_sess.compact.remote_peer_id, (const char *)payload, P2P_PEER_ID_MAX - 1) == 0) break;
-            }
+            int inst_ofs = (int)SIG_PKT_SYNC0_S2C_PSZ(payload[P2P_PEER_ID_MAX + P2P_SESS_ID_PSZ + 1]);
+            struct p2p_session *s = peer_session(inst, payload, payload_len, inst_ofs);
             if (!s) {
                 print("W:", LA_F("%s: no session for peer_id=%.*s\n", LA_F161, 161),
                     PROTO, (int)(P2P_PEER_ID_MAX - 1), (const char *)payload);
@@ -1547,13 +1973,13 @@ void p2p_signal_compact_proto(struct p2p_instance *inst, uint8_t type, uint8_t f
                       PROTO, s->id, session_id);
 
                 if (s->state >= P2P_STATE_LOST) {
-                    if (s->inst->cfg.on_state) s->inst->cfg.on_state((p2p_session_t)s, s->state, P2P_STATE_CLOSED, s->inst->cfg.userdata);
+                    if (s->inst->cfg.on_state && !s->standby) s->inst->cfg.on_state((p2p_session_t)s, s->state, P2P_STATE_CLOSED, s->inst->cfg.userdata);
                 }
 
                 reset_peer(&s->sig_sess.compact);
                 p2p_session_reset(s, false);
 
-                s->id = session_id;
+                p2p_session_set_id(s, session_id);
                 s->sig_sess.compact.state = SIG_COMPACT_SESS_WAIT_PEER;
                 s->state = P2P_STATE_WAITING;
             }
@@ -1571,6 +1997,7 @@ void p2p_signal_compact_proto(struct p2p_instance *inst, uint8_t type, uint8_t f
         case SIG_PKT_SYNC:         PROTO = "SYNC";      payload_min = SIG_PKT_SYNC_PSZ(0);              handler = compact_on_peer_sync; break;
         case SIG_PKT_SYNC_ACK:     PROTO = "SYNC_ACK";  payload_min = SIG_PKT_SYNC_ACK_PSZ;             handler = compact_on_sync_ack; break;
         case SIG_PKT_FIN:          PROTO = "FIN";       payload_min = SIG_PKT_FIN_PSZ;                  handler = compact_on_fin; break;
+        case SIG_PKT_PUNCH_AT:     PROTO = "PUNCH_AT";  payload_min = SIG_PKT_PUNCH_AT_PSZ;             handler = compact_on_punch_at; break;
         case SIG_PKT_MSG_REQ:      PROTO = "REQ";       payload_min = SIG_PKT_MSG_REQ_MIN_PSZ;          handler = compact_on_request; break;
         case SIG_PKT_MSG_REQ_ACK:  PROTO = "REQ_ACK";   payload_min = SIG_PKT_MSG_REQ_ACK_PSZ;          handler = compact_on_request_ack; break;
         case SIG_PKT_MSG_RESP:     PROTO = "RESP";      payload_min = (uint16_t)(P2P_SESS_ID_PSZ + 2u); handler = compact_on_response; break;
@@ -1612,7 +2039,7 @@ void p2p_signal_compact_proto(struct p2p_instance *inst, uint8_t type, uint8_t f
 
     } while(0);
 
-    sig_ctx->last_recv_time = P_tick_ms();
+    sig_ctx->last_recv_time = p2p_now_ms();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1642,8 +2069,9 @@ ret_t p2p_signal_compact_online(struct p2p_instance *inst, const char *local_pee
     sig_ctx->local_peer_id[P2P_PEER_ID_MAX - 1] = '\0';
 
     sig_ctx->state = SIG_COMPACT_WAIT_ONLINE_ACK;
-    send_online(inst, sig_ctx, P_tick_ms());
+    send_online(inst, sig_ctx, p2p_now_ms());
     sig_ctx->sig_attempts = 1;
+    sig_ctx->online_backoff_ms = 0;
 
     return E_NONE;
 }
@@ -1654,32 +2082,112 @@ ret_t p2p_signal_compact_online(struct p2p_instance *inst, const char *local_pee
  * 包头: [type=SIG_PKT_OFFLINE | flags=0 | seq=0]
  * 负载: [auth_key(SIG_AUTH_KEY_PSZ)]
  */
+static void idents_free(p2p_compact_ctx_t *sig_ctx) {
+    for (int i = 0; i < sig_ctx->ident_cnt; i++) p2p_free(sig_ctx->idents[i]);
+    p2p_free(sig_ctx->idents);
+    sig_ctx->idents = NULL;
+    sig_ctx->ident_cnt = 0;
+}
+
 ret_t p2p_signal_compact_offline(struct p2p_instance *inst) {
     const char* PROTO = "OFFLINE";
 
     p2p_compact_ctx_t *sig_ctx = &inst->sig_ctx.compact;
-    if (sig_ctx->state == SIG_COMPACT_INIT) return E_NONE;
+
+    // 附加身份只在主身份上线后登录，主身份未上线时直接释放
+    if (sig_ctx->state == SIG_COMPACT_INIT) { idents_free(sig_ctx); return E_NONE; }
 
     // fixme: 这需要异步等待，如果直接用 remote peer_id 则可以避免异步等待
-    if (!sig_ctx->auth_key) return E_NONE_CONTEXT;          // 尚未完成上线（auth_key 未分配）
+    if (!sig_ctx->auth_key) { idents_free(sig_ctx); return E_NONE_CONTEXT; }   // 尚未完成上线（auth_key 未分配）
 
     uint8_t payload[SIG_PKT_OFFLINE_PSZ];
     nwrite_ll(payload, sig_ctx->auth_key);
 
     err_t err = udp_send(inst, PROTO, SIG_PKT_OFFLINE, 0, 0, payload, (int) sizeof(payload), 0);
-    if (err != E_NONE) return err;
+    if (err != E_NONE) { idents_free(sig_ctx); return err; }
 
-    for (int n = 2; n--;) { // 最多重试 2 次，确保服务器收到注销请求
+    for (int n = 3; n--;) { // 附加身份与主身份同轮发送，主身份最多重试 2 次，确保服务器收到注销请求
+        for (int i = 0; i < sig_ctx->ident_cnt; i++) {
+            if (!sig_ctx->idents[i]->auth_key) continue;
+            nwrite_ll(payload, sig_ctx->idents[i]->auth_key);
+            p2p_udp_send_packet(inst, &sig_ctx->server_addr, SIG_PKT_OFFLINE, 0, 0, payload, (int) sizeof(payload));
+        }
+        if (!n) break;
         P_usleep(50 * 1000);
+        nwrite_ll(payload, sig_ctx->auth_key);
         p2p_udp_send_packet(inst, &sig_ctx->server_addr, SIG_PKT_OFFLINE, 0, 0, payload, (int) sizeof(payload));
     }
 
     print("V:", LA_F("%s sent, inst_id=%u\n", LA_F63, 63), PROTO, sig_ctx->instance_id);
 
+    idents_free(sig_ctx);
     p2p_signal_compact_init(sig_ctx);
     return E_NONE;
 }
 
+ret_t p2p_signal_compact_ident_add(struct p2p_instance *inst, const char *local_peer_id) {
+
+    P_check(local_peer_id && local_peer_id[0], return E_INVALID;)
+
+    p2p_compact_ctx_t *sig_ctx = &inst->sig_ctx.compact;
+    if (!strncmp(inst->local_peer_id, local_peer_id, P2P_PEER_ID_MAX - 1)
+        || p2p_signal_compact_ident_find(inst, local_peer_id)) return E_BUSY;
+
+    p2p_compact_ident_t **v = (p2p_compact_ident_t **)p2p_realloc(sig_ctx->idents, (size_t)(sig_ctx->ident_cnt + 1) * sizeof(*v));
+    if (!v) return E_OUT_OF_MEMORY;
+    sig_ctx->idents = v;
+
+    p2p_compact_ident_t *id = (p2p_compact_ident_t *)p2p_calloc(1, sizeof(*id));
+    if (!id) return E_OUT_OF_MEMORY;
+    strncpy(id->local_peer_id, local_peer_id, P2P_PEER_ID_MAX - 1);
+    id->state = SIG_COMPACT_INIT;
+    sig_ctx->idents[sig_ctx->ident_cnt++] = id;
+
+    print("I:", LA_F("identity '%s' added (%d extra)\n", LA_F638, 638), id->local_peer_id, sig_ctx->ident_cnt);
+
+    // 主身份已上线则立即登录，否则等待主身份的 ONLINE_ACK
+    if (sig_ctx->state == SIG_COMPACT_ONLINE) ident_start(inst, id, p2p_now_ms());
+    return E_NONE;
+}
+
+ret_t p2p_signal_compact_ident_remove(struct p2p_instance *inst, const char *local_peer_id) {
+    const char* PROTO = "OFFLINE";
+
+    p2p_compact_ctx_t *sig_ctx = &inst->sig_ctx.compact;
+    p2p_compact_ident_t *id = p2p_signal_compact_ident_find(inst, local_peer_id);
+    if (!id) return E_NONE_CONTEXT;
+
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
+        if (s->sig_sess.compact.ident == id) return E_BUSY;
+    }
+
+    if (id->state == SIG_COMPACT_ONLINE && id->auth_key) {
+        uint8_t payload[SIG_PKT_OFFLINE_PSZ];
+        nwrite_ll(payload, id->auth_key);
+        if (ident_send(inst, id, PROTO, SIG_PKT_OFFLINE, payload, (int) sizeof(payload), p2p_now_ms()) == E_NONE)
+            print("V:", LA_F("%s sent, ident='%s' inst_id=%u\n", LA_F639, 639), PROTO, id->local_peer_id, id->instance_id);
+    }
+
+    for (int i = 0; i < sig_ctx->ident_cnt; i++) {
+        if (sig_ctx->idents[i] != id) continue;
+        sig_ctx->idents[i] = sig_ctx->idents[--sig_ctx->ident_cnt];
+        break;
+    }
+    print("I:", LA_F("identity '%s' removed\n", LA_F640, 640), id->local_peer_id);
+    p2p_free(id);
+    return E_NONE;
+}
+
+p2p_compact_ident_t *p2p_signal_compact_ident_find(struct p2p_instance *inst, const char *local_peer_id) {
+
+    if (!local_peer_id) return NULL;
+    p2p_compact_ctx_t *sig_ctx = &inst->sig_ctx.compact;
+    for (int i = 0; i < sig_ctx->ident_cnt; i++) {
+        if (!strncmp(sig_ctx->idents[i]->local_peer_id, local_peer_id, P2P_PEER_ID_MAX - 1)) return sig_ctx->idents[i];
+    }
+    return NULL;
+}
+
 /*
  * 建立与对端的会话（发送 SYNC0，建立 client↔peer 关系，获取 session_id）
  *
@@ -1688,16 +2196,18 @@ ret_t p2p_signal_compact_offline(struct p2p_instance *inst) {
  *   - auth_key:        ONLINE_ACK 中分配的客户端令牌
  *   - remote_peer_id:  目标对端 ID（32 字节，不足补零）
  *   - candidates:      首批本地候选（最多 candidates_cached 个）
- * 注：若状态为 WAIT_ONLINE_ACK，仅存储 remote_peer_id，SYNC0 在收到 ONLINE_ACK 后自动触发
+ * 注：若状态为 WAIT_ONLINE_ACK，存储 remote_peer_id 并补发捎带 SYNC0 的 ONLINE；
+ *     服务器未受理捎带时，SYNC0 在收到 ONLINE_ACK 后自动触发
  */
 ret_t p2p_signal_compact_connect(struct p2p_session *s, const char *remote_peer_id) {
 
     P_check(remote_peer_id && remote_peer_id[0], return E_INVALID;)
 
     p2p_compact_ctx_t *sig_ctx = &s->inst->sig_ctx.compact;
-    if (sig_ctx->state == SIG_COMPACT_INIT) {
-        return E_NONE_CONTEXT;  // 还没调用 online()
+    if (sig_ctx->state == SIG_COMPACT_INIT && !s->inst->sig_resolving) {
+        return E_NONE_CONTEXT;  // 还没调用 online()（服务器地址解析中则先登记，上线后自动同步）
     }
+    p2p_compact_ident_t *ident = s->sig_sess.compact.ident;
 
     p2p_compact_session_t *ssss_ctx = &s->sig_sess.compact;
 
@@ -1709,14 +2219,21 @@ ret_t p2p_signal_compact_connect(struct p2p_session *s, const char *remote_peer_
     strncpy(ssss_ctx->remote_peer_id, remote_peer_id, P2P_PEER_ID_MAX - 1);
     ssss_ctx->remote_peer_id[P2P_PEER_ID_MAX - 1] = '\0';
 
-    // ONLINE_ACK 已收到，且无需等待 stun 返回的异步候选，则立即发 SYNC0
-    if (sig_ctx->state == SIG_COMPACT_ONLINE) {
+    // 所属身份的 ONLINE_ACK 已收到，且无需等待 stun 返回的异步候选，则立即发 SYNC0
+    if ((ident ? ident->state : sig_ctx->state) == SIG_COMPACT_ONLINE) {
 
         ssss_ctx->state = SIG_COMPACT_SESS_WAIT_SYNC0_ACK;
-        send_sync0(s->inst, s, P_tick_ms());
+        send_sync0(s->inst, s, p2p_now_ms());
         ssss_ctx->sync_attempts = 1;
     }
-    else ssss_ctx->state = SIG_COMPACT_SESS_WAIT_ONLINE;
+    else {
+        ssss_ctx->state = SIG_COMPACT_SESS_WAIT_ONLINE;
+
+        // 主身份的 ONLINE 已发出但尚未确认（且未被限流）：立即补发一次，捎带本会话的 SYNC0，省去登录后的一次往返
+        if (!ident && sig_ctx->state == SIG_COMPACT_WAIT_ONLINE_ACK && !sig_ctx->online_sync0_peer[0]
+            && !sig_ctx->online_backoff_ms)
+            send_online(s->inst, sig_ctx, p2p_now_ms());
+    }
 
     return E_NONE;
 }
@@ -1743,12 +2260,10 @@ ret_t p2p_signal_compact_disconnect(struct p2p_session *s) {
         return E_NONE;
     }
 
-    p2p_compact_ctx_t *sig_ctx = &s->inst->sig_ctx.compact;
-
     uint8_t payload[SIG_PKT_OFFLINE_PSZ];
-    nwrite_ll(payload, sig_ctx->auth_key);
+    nwrite_ll(payload, sess_auth_key(s));
 
-    err_t err = udp_send(s->inst, PROTO, SIG_PKT_OFFLINE, 0, 0, payload, (int) sizeof(payload), P_tick_ms());
+    err_t err = udp_send(s->inst, PROTO, SIG_PKT_OFFLINE, 0, 0, payload, (int) sizeof(payload), p2p_now_ms());
     if (err != E_NONE) return err;
 
     print("V:", LA_F("%s sent (ses_id=%u)\n", LA_F56, 56), PROTO, s->id);
@@ -1757,7 +2272,7 @@ ret_t p2p_signal_compact_disconnect(struct p2p_session *s) {
     reset_peer(sess_ctx);
     memset(sess_ctx->remote_peer_id, 0, sizeof(sess_ctx->remote_peer_id));
 
-    s->id = 0;
+    p2p_session_set_id(s, 0);
     return E_NONE;
 }
 
@@ -1777,9 +2292,10 @@ void p2p_signal_compact_trickle_candidate(struct p2p_session *s) {
     p2p_compact_session_t *sess_ctx = &s->sig_sess.compact;
     if (!s->id || sess_ctx->state < SIG_COMPACT_SESS_SYNCING) return;
 
+    // 候选同步已完成（FIN 已确认）或 seq 窗口用尽：改以增量 SYNC 通知新增候选
     uint16_t seq = sess_ctx->trickle_seq_next;
-    if (seq > 16) {
-        print("W:", LA_F("SYNC(trickle): seq overflow, cannot trickle more\n", LA_F375, 375));
+    if (sess_ctx->state == SIG_COMPACT_SESS_READY || seq > 16) {
+        p2p_signal_compact_delta_candidate(s, &s->local_cands[s->local_cand_cnt - 1], false);
         return;
     }
 
@@ -1787,7 +2303,7 @@ void p2p_signal_compact_trickle_candidate(struct p2p_session *s) {
     sess_ctx->trickle_queue[seq]++;
 
     // 攒批间隔控制（固定窗口策略）
-    uint64_t now = P_tick_ms();
+    uint64_t now = p2p_now_ms();
     if (sess_ctx->trickle_last_pack_time && tick_diff(now, sess_ctx->trickle_last_pack_time) < TRICKLE_BATCH_MS) {
         print("V:", LA_F("SYNC(trickle): batching, queued %d cand(s) for seq=%u\n", LA_F374, 374),
               sess_ctx->trickle_queue[seq], seq);
@@ -1797,6 +2313,45 @@ void p2p_signal_compact_trickle_candidate(struct p2p_session *s) {
     send_trickle_candidates(s);
 }
 
+/*
+ * 本地候选增删的增量通知
+ *
+ * 包头: [type=SIG_PKT_SYNC | flags=SIG_SYNC_FLAG_DELTA | seq=version]
+ * 负载: [session_id(P2P_SESS_ID_PSZ)][version(1)][op_count(1)][ops(N*24)]
+ *   - op: [SIG_SYNC_DELTA_ADD/DEL(1)][candidate(23)]
+ * 注：停等发送，在途版本未确认前的变更攒入下一版本；同一地址的多次变更只保留最新一次
+ */
+void p2p_signal_compact_delta_candidate(struct p2p_session *s, const p2p_local_candidate_entry_t *c, bool removed) {
+
+    p2p_compact_session_t *sess_ctx = &s->sig_sess.compact;
+    if (!s->id || sess_ctx->state < SIG_COMPACT_SESS_SYNCING) return;     // 对端未在线：重新配对时按完整列表同步
+
+    uint8_t rec[SIG_SYNC_DELTA_OPSZ];
+    rec[0] = (uint8_t)(removed ? SIG_SYNC_DELTA_DEL : SIG_SYNC_DELTA_ADD);
+    pack_candidate(c, rec + 1);
+
+    uint8_t *ops = sess_ctx->delta_ops[1];
+    int i = 0;
+    for (; i < sess_ctx->delta_cnt[1]; i++) {
+        const p2p_candidate_t *w = (const p2p_candidate_t *)(ops + i * SIG_SYNC_DELTA_OPSZ + 1);
+        if (!memcmp(&w->addr, &((const p2p_candidate_t *)(rec + 1))->addr, sizeof(w->addr))) break;
+    }
+    if (i == sess_ctx->delta_cnt[1]) {
+        if (i >= SIG_SYNC_DELTA_MAX) {
+            print("W:", LA_F("%s: delta queue full, cand<%s:%d> change dropped\n", LA_F555, 555),
+                  TASK_SYNC, inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port));
+            return;
+        }
+        sess_ctx->delta_cnt[1]++;
+    }
+    memcpy(ops + i * SIG_SYNC_DELTA_OPSZ, rec, SIG_SYNC_DELTA_OPSZ);
+
+    print("I:", LA_F("%s: delta %s cand<%s:%d> (ses_id=%u)\n", LA_F556, 556),
+          TASK_SYNC, removed ? "del" : "add", inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port), s->id);
+
+    if (!sess_ctx->delta_cnt[0]) delta_next(s, p2p_now_ms());
+}
+
 /*
  * 通过 COMPACT 信令中转发送数据包（通用接口）
  *
@@ -1825,7 +2380,7 @@ ret_t p2p_signal_compact_relay(struct p2p_session *s,
 
     err_t err = udp_send(s->inst, "RELAY", type, seq,
                         flags | P2P_FLAG_SESSION | SIG_FLAG_RELAY,
-                        relay_payload, (int)P2P_SESS_ID_PSZ + payload_len, P_tick_ms());
+                        relay_payload, (int)P2P_SESS_ID_PSZ + payload_len, p2p_now_ms());
     if (err != E_NONE) return err;
 
     print("V:", LA_F("RELAY sent (ses_id=%u), type=0x%02x seq=%u flags=0x%02x", LA_F347, 347),
@@ -1843,9 +2398,11 @@ ret_t p2p_signal_compact_relay(struct p2p_session *s,
  *   - sid:        RPC 序列号（非零，循环自增，用于匹配响应）
  *   - msg:        应用层消息类型（1 字节，应用自定义）
  *   - data:       消息数据（可选，最多 P2P_MSG_DATA_MAX 字节）
+ *
+ * 在途请求数受 min(cfg.rpc_window, 服务器 ONLINE_ACK 通告的窗口) 限制。
  */
 ret_t p2p_signal_compact_request(struct p2p_session *s,
-                                 uint8_t msg, const void *data, int len) {
+                                 uint8_t msg, const void *data, int len, uint16_t *sid_out) {
 
     p2p_compact_session_t *sess_ctx = &s->sig_sess.compact;
 
@@ -1858,21 +2415,28 @@ ret_t p2p_signal_compact_request(struct p2p_session *s,
         return E_NO_SUPPORT;
     }
 
-    if (sess_ctx->req_state != 0) return E_BUSY;                                     // 已有挂起请求
+    int window = s->inst->cfg.rpc_window;
+    if (window <= 0 || window > P2P_RPC_WINDOW_MAX) window = P2P_RPC_WINDOW_MAX;
+    if (window > sig_ctx->rpc_window) window = sig_ctx->rpc_window;
 
-    // 生成非零（循环）序列号
-    static uint16_t _sid_base = 0;
-    uint16_t sid = ++_sid_base;
-    if (sid == 0) sid = ++_sid_base;
+    int active = 0;
+    for (int i = 0; i < P2P_RPC_WINDOW_MAX; i++) if (sess_ctx->reqs[i].sid) active++;
+    if (active >= window) return E_BUSY;                                            // 窗口已满
 
-    sess_ctx->req_state     = 1/* waiting REQ_ACK */;
-    sess_ctx->req_sid       = sid;
-    sess_ctx->req_msg       = msg;
-    sess_ctx->req_data_len  = len;
-    if (len > 0) memcpy(sess_ctx->req_data, data, (size_t)len);
+    // 生成非零（循环）序列号；对端按 sid 去重，所以同一会话内必须单调
+    uint16_t sid = ++sess_ctx->rpc_next_sid;
+    if (sid == 0) sid = ++sess_ctx->rpc_next_sid;
 
-    send_rpc_req(s, P_tick_ms());
-    sess_ctx->req_retries = 0;
+    p2p_compact_rpc_req_t *r = rpc_req_find(sess_ctx, 0);
+    r->sid      = sid;
+    r->state    = 1/* waiting REQ_ACK */;
+    r->msg      = msg;
+    r->data_len = len;
+    r->retries  = 0;
+    if (len > 0) memcpy(r->data, data, (size_t)len);
+
+    send_rpc_req(s, r, p2p_now_ms());
+    if (sid_out) *sid_out = sid;
     return E_NONE;
 }
 
@@ -1885,27 +2449,30 @@ ret_t p2p_signal_compact_request(struct p2p_session *s,
  *   - sid:        RPC 序列号，必须与对应 MSG_REQ 的 sid 一致
  *   - code:       响应码（1 字节，应用自定义）
  *   - data:       响应数据（可选，最多 P2P_MSG_DATA_MAX 字节）
+ *
+ * sid=0 时回复最早到达、尚未回复的请求。
  */
-ret_t p2p_signal_compact_response(struct p2p_session *s,
+ret_t p2p_signal_compact_response(struct p2p_session *s, uint16_t sid,
                                   uint8_t code, const void *data, int len) {
     const char* PROTO = "MSG_RESP";
 
     P_check(len >= 0 && len <= P2P_MSG_DATA_MAX, return E_INVALID;)
     P_check(len == 0 || data, return E_INVALID;)
     p2p_compact_session_t *sess_ctx = &s->sig_sess.compact;
-    if (!sess_ctx->resp_sid) {
+    p2p_compact_rpc_resp_t *r = sid ? rpc_resp_find(sess_ctx, sid) : rpc_resp_oldest(sess_ctx, true);
+    if (!r || r->state != 0/* waiting user */) {
         print("E:", LA_F("%s: no rpc request\n", LA_F158, 158), PROTO);
         return E_INVALID;
     }
 
     // 缓存响应数据用于重发
-    sess_ctx->resp_state    = 1/* waiting RESP_ACK */;
-    sess_ctx->resp_code     = code;
-    sess_ctx->resp_data_len = len;
-    if (len > 0) memcpy(sess_ctx->resp_data, data, (size_t)len);
+    r->state    = 1/* waiting RESP_ACK */;
+    r->code     = code;
+    r->data_len = len;
+    r->retries  = 0;
+    if (len > 0) memcpy(r->data, data, (size_t)len);
 
-    send_rpc_resp(s, P_tick_ms());
-    sess_ctx->resp_retries = 0;
+    send_rpc_resp(s, r, p2p_now_ms());
     return E_NONE;
 }
 
@@ -1926,7 +2493,8 @@ void p2p_signal_compact_tick_recv(struct p2p_instance *inst, uint64_t now) {
     // REGISTERING 状态：定期重发 ONLINE
     if (sig_ctx->state == SIG_COMPACT_WAIT_ONLINE_ACK) {
 
-        if (tick_diff(now, sig_ctx->last_send_time) >= ONLINE_INTERVAL_MS) {
+        if (tick_diff(now, sig_ctx->last_send_time) >= (sig_ctx->online_backoff_ms > ONLINE_INTERVAL_MS
+                                                        ? sig_ctx->online_backoff_ms : ONLINE_INTERVAL_MS)) {
 
             // 超时检查
             if (sig_ctx->sig_attempts++ < MAX_SIG_ATTEMPTS) {
@@ -1949,12 +2517,25 @@ void p2p_signal_compact_tick_recv(struct p2p_instance *inst, uint64_t now) {
     }
     assert(sig_ctx->state == SIG_COMPACT_ONLINE);
 
+    // 附加身份：定期重发 ONLINE（规则同主身份，超时后置为 ERROR 不再重试）
+    for (int i = 0; i < sig_ctx->ident_cnt; i++) { p2p_compact_ident_t *id = sig_ctx->idents[i];
+        if (id->state != SIG_COMPACT_WAIT_ONLINE_ACK) continue;
+        if (tick_diff(now, id->last_send_time) < (id->online_backoff_ms > ONLINE_INTERVAL_MS
+                                                  ? id->online_backoff_ms : ONLINE_INTERVAL_MS)) continue;
+        if (id->sig_attempts++ < MAX_SIG_ATTEMPTS) ident_send_online(inst, id, now);
+        else {
+            print("W:", LA_F("%s: identity '%s' timeout, max(%d) attempts reached\n", LA_F641, 641),
+                  TASK_ONLINE, id->local_peer_id, MAX_SIG_ATTEMPTS);
+            id->state = SIG_COMPACT_ERROR;
+        }
+    }
+
     for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
         p2p_compact_session_t *sess_ctx = &s->sig_sess.compact;
 
-        // 前面已经确保完成上线、且无需等待 stun 完成对公网候选的收集，所以不应再有 WAIT SYNCABLE 的会话存在了
-        assert(sess_ctx->state != SIG_COMPACT_SESS_WAIT_ONLINE);
-        if (sess_ctx->state == SIG_COMPACT_SESS_SUSPENDED) continue;
+        // 主身份已上线、且无需等待 stun 完成对公网候选的收集，只有所属附加身份尚未上线的会话仍处于 WAIT SYNCABLE
+        assert(sess_ctx->state != SIG_COMPACT_SESS_WAIT_ONLINE || sess_ctx->ident);
+        if (sess_ctx->state == SIG_COMPACT_SESS_SUSPENDED || sess_ctx->state == SIG_COMPACT_SESS_WAIT_ONLINE) continue;
 
         // WAIT_SYNC0_ACK 状态：SYNC0 重传
         if (sess_ctx->state == SIG_COMPACT_SESS_WAIT_SYNC0_ACK) {
@@ -1999,54 +2580,66 @@ void p2p_signal_compact_tick_recv(struct p2p_instance *inst, uint64_t now) {
             }
         }
 
-        // 当前（请求端）处于等待（服务器返回的）REQ_ACK 的阶段
-        if (sess_ctx->req_state == 1/* waiting REQ_ACK */) {
+        // 增量 SYNC 重传（停等）；达到最大次数后放弃该版本，继续发送攒批记录
+        if (sess_ctx->delta_cnt[0] && sess_ctx->state >= SIG_COMPACT_SESS_SYNCING
+            && tick_diff(now, sess_ctx->delta_send_time) >= SYNC_INTERVAL_MS) {
+
+            if (sess_ctx->delta_attempts < MAX_SIG_ATTEMPTS) send_delta(s, now);
+            else {
+                print("W:", LA_F("%s: delta ver=%u unacked after %d attempts, dropped\n", LA_F557, 557),
+                      TASK_SYNC, sess_ctx->delta_ver, MAX_SIG_ATTEMPTS);
+                delta_next(s, now);
+            }
+        }
+
+        // 各请求槽独立重传：（请求端）处于等待（服务器返回的）REQ_ACK 的阶段
+        for (int i = 0; i < P2P_RPC_WINDOW_MAX; i++) {
+            p2p_compact_rpc_req_t *r = &sess_ctx->reqs[i];
+            if (!r->sid || r->state != 1/* waiting REQ_ACK */) continue;
 
-            if (tick_diff(now, sess_ctx->req_send_time) >= MSG_REQ_INTERVAL_MS) {
+            if (tick_diff(now, r->send_time) >= MSG_REQ_INTERVAL_MS) {
 
                 /* 超时失败 */
-                if (sess_ctx->req_retries++ < MSG_REQ_MAX_RETRIES) {
+                if (r->retries++ < MSG_REQ_MAX_RETRIES) {
 
                     print("I:", LA_F("%s: retry(%d/%d) req (sid=%u)\n", LA_F212, 212),
-                          TASK_RPC, sess_ctx->req_retries, MSG_REQ_MAX_RETRIES, sess_ctx->req_sid);
+                          TASK_RPC, r->retries, MSG_REQ_MAX_RETRIES, r->sid);
 
-                    send_rpc_req(s, now);
+                    send_rpc_req(s, r, now);
                 }
                 else {
 
-                    uint16_t sid = sess_ctx->req_sid;
-                    uint8_t  msg = sess_ctx->req_msg;
-                    sess_ctx->req_sid = 0;
-                    sess_ctx->req_state = 0;
+                    uint16_t sid = r->sid;
+                    uint8_t  msg = r->msg;
+                    r->sid = 0;
 
                     print("W:", LA_F("%s: %s timeout after %d retries (sid=%u)\n", LA_F74, 74),
                           TASK_RPC, "req", MSG_REQ_MAX_RETRIES, sid);
 
-                    if (s->inst->cfg.on_response)
-                        s->inst->cfg.on_response((p2p_session_t)s, sid, msg, NULL, -1, s->inst->cfg.userdata);
+                    rpc_on_response(s, sid, msg, NULL, -1);
                 }
             }
         }
 
-        // 当前（响应端）处于等待（服务器返回的）RESP_ACK 的阶段
-        if (sess_ctx->resp_state == 1/* waiting RESP_ACK */) {
+        // 各响应槽独立重传：（响应端）处于等待（服务器返回的）RESP_ACK 的阶段
+        for (int i = 0; i < P2P_RPC_WINDOW_MAX; i++) {
+            p2p_compact_rpc_resp_t *r = &sess_ctx->resps[i];
+            if (!r->sid || r->state != 1/* waiting RESP_ACK */) continue;
 
-            if (tick_diff(now, sess_ctx->resp_send_time) >= MSG_REQ_INTERVAL_MS) {
+            if (tick_diff(now, r->send_time) >= MSG_REQ_INTERVAL_MS) {
 
                 /* 超时失败（与 A 端对称，使用相同的超时配置） */
-                if (sess_ctx->resp_retries++ < MSG_REQ_MAX_RETRIES) {
+                if (r->retries++ < MSG_REQ_MAX_RETRIES) {
 
                     print("I:", LA_F("%s: retry(%d/%d) resp (sid=%u)\n", LA_F213, 213),
-                          TASK_RPC, sess_ctx->resp_retries, MSG_REQ_MAX_RETRIES, sess_ctx->resp_sid);
+                          TASK_RPC, r->retries, MSG_REQ_MAX_RETRIES, r->sid);
 
-                    send_rpc_resp(s, now);
+                    send_rpc_resp(s, r, now);
                 }
                 else {
 
-                    uint16_t sid = sess_ctx->resp_sid;
-                    sess_ctx->resp_sid = 0;
-                    sess_ctx->resp_state = 0;
-                    sess_ctx->resp_session_id = 0;
+                    uint16_t sid = r->sid;
+                    r->sid = 0;
 
                     print("W:", LA_F("%s: %s timeout after %d retries (sid=%u)\n", LA_F74, 74),
                           TASK_RPC, "resp", MSG_REQ_MAX_RETRIES, sid);
@@ -2057,6 +2650,21 @@ void p2p_signal_compact_tick_recv(struct p2p_instance *inst, uint64_t now) {
     } // for (struct p2p_session *s = inst->sessions_head; s; s = s->next)
 }
 
+/*
+ * ALIVE 间隔：服务器通告值（限制在 [ALIVE_MIN_MS, ALIVE_MAX_MS]，未通告为 REGISTER_KEEPALIVE_INTERVAL_MS），
+ * 且不超过本端测得的 NAT 绑定存活期的一半（服务器的通告可能早于本端报告测量结果）
+ */
+static uint32_t alive_interval_ms(const struct p2p_instance *inst) {
+
+    uint32_t ms = inst->sig_ctx.compact.alive_s ? inst->sig_ctx.compact.alive_s * 1000u : REGISTER_KEEPALIVE_INTERVAL_MS;
+    if (ms < ALIVE_MIN_MS) ms = ALIVE_MIN_MS;
+    if (ms > ALIVE_MAX_MS) ms = ALIVE_MAX_MS;
+
+    uint32_t half = inst->bind_probe.lifetime_ms / 2;
+    if (half >= ALIVE_MIN_MS && ms > half) ms = half;
+    return ms;
+}
+
 /*
  * 信令输出（推送阶段）— on submit/on complete
  * > 继续提交发送缓存中的数据
@@ -2069,24 +2677,43 @@ void p2p_signal_compact_tick_recv(struct p2p_instance *inst, uint64_t now) {
 void p2p_signal_compact_tick_send(struct p2p_instance *inst, uint64_t now) {
 
     p2p_compact_ctx_t *sig_ctx = &inst->sig_ctx.compact;
-    if (sig_ctx->state != SIG_COMPACT_ONLINE || sig_ctx->sig_sessions) return;
+    if (sig_ctx->state != SIG_COMPACT_ONLINE) return;
+
+    uint32_t interval = alive_interval_ms(inst);
+    uint16_t bind_life_s = (uint16_t)(inst->bind_probe.lifetime_ms / 1000u > 0xFFFF ? 0xFFFF : inst->bind_probe.lifetime_ms / 1000u);
+
+    // 附加身份各自保活（服务器按 auth_key 维持各自的注册）
+    for (int i = 0; i < sig_ctx->ident_cnt; i++) { p2p_compact_ident_t *id = sig_ctx->idents[i];
+        if (id->state != SIG_COMPACT_ONLINE || tick_diff(now, id->last_send_time) < interval) continue;
+
+        uint8_t payload[SIG_PKT_ALIVE_EXT_PSZ];
+        nwrite_ll(payload, id->auth_key);
+        nwrite_s(payload + SIG_AUTH_KEY_PSZ, bind_life_s);
+        if (ident_send(inst, id, "ALIVE", SIG_PKT_ALIVE, payload, (int) sizeof(payload), now) == E_NONE
+            && inst->signaling.active) {
+            path_manager_on_sig_alive_send(inst, now);      // 每个 ALIVE 各有一个 ALIVE_ACK，RTT 测量仍一一对应
+        }
+    }
+    if (sig_ctx->sig_sessions) return;
 
-    if (tick_diff(now, sig_ctx->last_send_time) >= REGISTER_KEEPALIVE_INTERVAL_MS) {
+    if (tick_diff(now, sig_ctx->last_send_time) >= interval) {
 
         /*
          * 发送 ALIVE 保活包
          *
          * 包头: [type=SIG_PKT_ALIVE | flags=0 | seq=0]
-         * 负载: [auth_key(SIG_AUTH_KEY_PSZ)]
+         * 负载: [auth_key(SIG_AUTH_KEY_PSZ)][bind_life_s(2)]
          *   - auth_key: 客户端-服务器认证令牌（来自 ONLINE_ACK）
-         * 说明: 保活包，维持服务器上的注册状态
+         *   - bind_life_s: 本端测得的 NAT 绑定存活期（秒，0=未知）
+         * 说明: 保活包，维持服务器上的注册状态；间隔按服务器通告（见 alive_interval_ms）
          */
         {   const char* PROTO = "ALIVE";
 
             if (sig_ctx->auth_key) {
 
-                uint8_t payload[SIG_PKT_ALIVE_PSZ];
+                uint8_t payload[SIG_PKT_ALIVE_EXT_PSZ];
                 nwrite_ll(payload, sig_ctx->auth_key);
+                nwrite_s(payload + SIG_AUTH_KEY_PSZ, bind_life_s);
 
                 err_t err = udp_send(inst, PROTO, SIG_PKT_ALIVE, 0, 0, payload, (int) sizeof(payload), now);
                 if (err == E_NONE) {
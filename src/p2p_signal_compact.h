@@ -63,6 +63,18 @@
  * 收到 ONLINE_ACK 后自动触发 SYNC0（懒触发，与 RELAY 模式一致）。
  *
  * ============================================================================
+ * 附加本端身份（p2p_identity_add）
+ * ============================================================================
+ *
+ * 一个实例可代表多个本端 ID（网关代理大量设备）：各身份共用实例的套接字、服务器地址、
+ * NAT 探测与 TURN 分配，仅各自独立 ONLINE 登录（独立 instance_id / auth_key）并各自保活。
+ *   - 附加身份在主身份上线后登录，ONLINE_ACK 按回显的 instance_id 匹配所属身份
+ *   - 会话经 p2p_connect_as 绑定身份（sig_sess.compact.ident），SYNC0 携带该身份的 auth_key
+ *   - 服务器下发的 SYNC0 / SYNC0_ACK 尾部回显接收方 instance_id，
+ *     不同身份连接同一对端时据此定位会话（旧服务器不带，按对端 ID 首个匹配）
+ *   - 需 multi_session：各会话的包均携带 session_id 派发
+ *
+ * ============================================================================
  * NAT 类型探测（可选）
  * ============================================================================
  *
@@ -86,6 +98,8 @@
  *   - HOST/公网候选随 ONLINE 首批嵌入上传（embedded candidates）
  *   - STUN/TURN 候选后续 trickle 补发
  *   - count=0 + FIN flag 标识发送结束
+ *   - 同步完成（或 seq 窗口用尽）后的候选增删以增量 SYNC（SIG_SYNC_FLAG_DELTA）发送：
+ *     每个变更一条 ADD/DEL 记录，按版本号停等确认，在途期间的新变更攒入下一版本
  *
  * 候选列表统一存储在 p2p_session 中，本模块只负责打包和发送。
  */
@@ -125,7 +139,10 @@ typedef struct {
     uint64_t            last_send_time;                     /* 上次发送时间 */
     uint64_t            last_recv_time;                     /* 上次收到时间 */
     int                 sig_attempts;                       /* ONLINE 总共尝试次数 */
+    uint16_t            online_backoff_ms;                  /* 服务器限流提示的 ONLINE 重发间隔（0=默认 ONLINE_INTERVAL_MS）*/
     int                 sig_sessions;                       /* 正在使用信令服务器的会话（sync0/sync），该值不为 0 则无需 keep-alive */
+    char                online_sync0_peer[P2P_PEER_ID_MAX]; /* 最近一次 ONLINE 捎带 SYNC0 的对端 ID（空=未捎带）*/
+    uint8_t             online_sync0_cnt;                   /* 捎带的首批候选数量 */
 
     /* 和服务器的会话 */
     char                local_peer_id[P2P_PEER_ID_MAX];     /* 本端 ID */
@@ -136,6 +153,9 @@ typedef struct {
     uint8_t             max_candidates;                     /* 服务器允许缓存的最大候选数量 */
     bool                feature_relay;                      /* 服务器是否支持中继 */
     bool                feature_msg;                        /* 服务器是否支持 RPC */
+    bool                feature_punch_at;                   /* 服务器是否下发同时打洞起跑提示（PUNCH_AT）*/
+    uint8_t             rpc_window;                         /* 服务器允许的每会话并发 RPC 数（ONLINE_ACK 尾字节，旧服务器为 1）*/
+    uint16_t            alive_s;                            /* 服务器建议的 ALIVE 间隔（秒，ONLINE_ACK / ALIVE_ACK 通告，0=默认）*/
     struct sockaddr_in  public_addr;                        /* 本端的公网地址（服务器主端口探测到的）*/
     uint16_t            probe_port;                         /* NAT 探测端口（0=不支持探测）*/
 
@@ -144,9 +164,27 @@ typedef struct {
     uint64_t            nat_probe_send_time;                /* NAT_PROBE 最后发送时间（独立于 SYNC 重传定时器）*/
     int16_t             nat_probe_retries;                  /* 失败重试次数（不包括首次执行）*/
     uint8_t             nat_is_port_consistent;             /* NAT 是否端口一致性（1=是，0=否）*/
+    int16_t             nat_port_delta;                     /* 映射端口增量：探测端口映射 - 主端口映射（对称 NAT 端口预测步长）*/
+
+    /* 附加本端身份（p2p_identity_add，共用本上下文的服务器地址与探测结果）*/
+    struct p2p_compact_ident **idents;
+    int                 ident_cnt;
 
 } p2p_compact_ctx_t;
 
+/* 附加本端身份（与主身份共用 p2p_compact_ctx_t 中的服务器地址、能力与 NAT 探测结果）*/
+typedef struct p2p_compact_ident {
+    char                local_peer_id[P2P_PEER_ID_MAX];     /* 本端 ID */
+    p2p_compact_st      state;                              /* INIT=等待主身份上线，WAIT_ONLINE_ACK，ONLINE */
+    uint32_t            instance_id;                        /* 本身份 ONLINE 的实例 ID（非零）*/
+    uint64_t            auth_key;                           /* 本身份的客户端-服务器认证令牌（0=尚未分配）*/
+    int                 sig_attempts;                       /* ONLINE 总共尝试次数 */
+    uint16_t            online_backoff_ms;                  /* 服务器限流提示的 ONLINE 重发间隔（0=默认）*/
+    uint64_t            last_send_time;                     /* 本身份上次发送 ONLINE / ALIVE 的时间 */
+} p2p_compact_ident_t;
+
+#define SIG_SYNC_DELTA_MAX      8               /* 单个增量 SYNC 包的最大记录数 */
+
 typedef enum {
     SIG_COMPACT_SESS_SUSPENDED = 0,                         /* 挂起的 session，连接过程超时挂起。报错逻辑统一在 p2p_compact_ctx_t 中处理 */
     SIG_COMPACT_SESS_WAIT_ONLINE,                           /* 执行 connect() 创建了 session，但信令服务还未完成在线登录 */
@@ -156,10 +194,34 @@ typedef enum {
     SIG_COMPACT_SESS_READY                                  /* 已完成向对方发送包括 FIN 在内的所有候选队列包，并得到确认 */
 } p2p_compact_sess_st;
 
+/* MSG RPC 请求槽（A 端），sid=0 表示空闲 */
+typedef struct {
+    uint16_t            sid;                                /* rpc 序列号 */
+    uint8_t             state;                              /* 1=等待 REQ_ACK 2=等待 RESP */
+    uint8_t             msg;                                /* 请求的消息 ID */
+    int                 data_len;                           /* 请求数据长度 */
+    uint64_t            send_time;                          /* MSG_REQ 最后发送时间 */
+    int                 retries;                            /* 失败重试次数（不包括首次执行）*/
+    uint8_t             data[P2P_MSG_DATA_MAX];             /* 请求数据（重传用）*/
+} p2p_compact_rpc_req_t;
+
+/* MSG RPC 响应槽（B 端），sid=0 表示空闲 */
+typedef struct {
+    uint16_t            sid;                                /* rpc 序列号 */
+    uint8_t             state;                              /* 0=等待用户回应 1=等待 RESP_ACK */
+    uint8_t             code;                               /* 缓存的响应码 */
+    uint32_t            session_id;                         /* 请求所属 session id */
+    int                 data_len;                           /* 缓存的响应长度 */
+    uint64_t            send_time;                          /* MSG_RESP 最后发送时间（state=0 时为请求到达时间）*/
+    int                 retries;                            /* 失败重试次数（不包括首次执行）*/
+    uint8_t             data[P2P_MSG_DATA_MAX];             /* 缓存的响应数据 */
+} p2p_compact_rpc_resp_t;
+
 /* COMPACT 信令上下文 */
 typedef struct {
 
     p2p_compact_sess_st state;                              /* 会话状态 */
+    p2p_compact_ident_t *ident;                             /* 所属附加身份（NULL = 实例主身份，见 p2p_connect_as）*/
     uint64_t            sync_send_time;                     /* 上次 SYNC0/SYNC 发送时间（用于重传控制）*/
     int                 sync_attempts;                      /* SYNC0/SYNC 总共尝试次数 */
 
@@ -179,27 +241,21 @@ typedef struct {
     uint16_t            remote_candidates_done;             /* 对端候选队列 seq 窗口完成 mask，表示已收到过且确认过的 seq（即对端已应用） */
     uint8_t             remote_addr_notify_seq;             /* 最近一次已应用的地址变更通知序号（1..255，0=从未收到）*/
 
-    /* MSG RPC 上下文管理 */
-    uint16_t            rpc_last_sid;                       /* 最后完成的 sid（用于判断新旧请求，支持循环）*/
-
-    /* MSG RPC（A 端：发送请求） */
-    uint8_t             req_state;                          /* 0=空闲 1=等待 REQ_ACK 2=等待 RESP */
-    uint16_t            req_sid;                            /* 当前挂起的 rpc 序列号（0=无挂起）*/
-    uint8_t             req_msg;                            /* 挂起请求的消息 ID */
-    uint8_t             req_data[P2P_MSG_DATA_MAX];         /* 挂起请求的数据缓冲区 */
-    int                 req_data_len;                       /* 挂起请求的数据长度 */
-    uint64_t            req_send_time;                      /* MSG_REQ 最后发送时间 */
-    int                 req_retries;                        /* 失败重试次数（不包括首次执行）*/
-
-    /* MSG RPC（B 端：接收中转的请求，等待用户回应） */
-    uint8_t             resp_state;                         /* 0=空闲 1=等待 RESP_ACK */
-    uint16_t            resp_sid;                           /* 待回应的 rpc 序列号（0=无）*/
-    uint64_t            resp_session_id;                    /* 待回应的 rpc 所属 session id */
-    uint8_t             resp_code;                          /* 缓存的响应码 */
-    uint8_t             resp_data[P2P_MSG_DATA_MAX];        /* 缓存的响应数据 */
-    int                 resp_data_len;                      /* 缓存的响应长度 */
-    uint64_t            resp_send_time;                     /* MSG_RESP 最后发送时间 */
-    int                 resp_retries;                       /* 失败重试次数（不包括首次执行）*/
+    /* 增量候选同步（SIG_SYNC_FLAG_DELTA）*/
+    uint8_t             delta_ver;                          /* 最近发出的增量版本号（1..255 循环，0=从未发送）*/
+    uint8_t             delta_cnt[2];                       /* [0]=在途（待确认）记录数，[1]=攒批中记录数 */
+    uint8_t             delta_ops[2][SIG_SYNC_DELTA_MAX * SIG_SYNC_DELTA_OPSZ];   /* 记录：[op(1)][candidate(23)] */
+    uint64_t            delta_send_time;                    /* 在途增量包最近发送时间 */
+    int                 delta_attempts;                     /* 在途增量包已发送次数 */
+    uint8_t             remote_delta_ver;                   /* 最近已应用的对端增量版本号（0=从未收到）*/
+
+    /* MSG RPC 上下文管理（流水线：A/B 两端各最多 P2P_RPC_WINDOW_MAX 个 sid 同时进行）*/
+    uint16_t            rpc_next_sid;                       /* A 端：上一个分配的 sid（循环自增，跳过 0）*/
+    uint16_t            rpc_last_sid;                       /* B 端：已接受的最大 sid（用于判断新旧请求，支持循环）*/
+    uint32_t            rpc_seen;                           /* B 端：rpc_last_sid 之前 32 个 sid 的接受位图（p2p_rpc_sid_accept）*/
+
+    p2p_compact_rpc_req_t  reqs[P2P_RPC_WINDOW_MAX];        /* A 端：在途请求 */
+    p2p_compact_rpc_resp_t resps[P2P_RPC_WINDOW_MAX];       /* B 端：待回应 / 待确认的响应 */
 
 } p2p_compact_session_t;
 
@@ -262,6 +318,23 @@ ret_t p2p_signal_compact_online(struct p2p_instance *inst, const char *local_pee
  */
 ret_t p2p_signal_compact_offline(struct p2p_instance *inst);
 
+/*
+ * 附加本端身份：登记后在主身份上线时（已上线则立即）发送该身份的 ONLINE
+ *
+ * @return E_NONE=成功，E_BUSY=ID 已存在（含主身份），E_INVALID=ID 为空，E_OUT_OF_MEMORY
+ */
+ret_t p2p_signal_compact_ident_add(struct p2p_instance *inst, const char *local_peer_id);
+
+/*
+ * 移除附加身份：已上线时发送该身份的 OFFLINE
+ *
+ * @return E_NONE=成功，E_NONE_CONTEXT=不存在，E_BUSY=仍有会话绑定该身份
+ */
+ret_t p2p_signal_compact_ident_remove(struct p2p_instance *inst, const char *local_peer_id);
+
+/* 按本端 ID 查找附加身份（主身份与未登记的 ID 返回 NULL）*/
+p2p_compact_ident_t *p2p_signal_compact_ident_find(struct p2p_instance *inst, const char *local_peer_id);
+
 //-----------------------------------------------------------------------------
 
 /*
@@ -292,6 +365,14 @@ ret_t p2p_signal_compact_disconnect(struct p2p_session *s);
  */
 void p2p_signal_compact_trickle_candidate(struct p2p_session *s);
 
+/*
+ * 本地候选增删的增量通知（SYNC + SIG_SYNC_FLAG_DELTA）
+ *
+ * 对端在线（SYNCING 及之后）时以一条 ADD/DEL 记录通知对端，未确认前的后续变更攒批合并；
+ * 候选同步完成后的 trickle 新增候选也经此发送
+ */
+void p2p_signal_compact_delta_candidate(struct p2p_session *s, const p2p_local_candidate_entry_t *c, bool removed);
+
 /*
  * 通过 COMPACT 信令中转发送 REACH 包（NAT 打洞冷启动握手）
  *
@@ -314,21 +395,23 @@ ret_t p2p_signal_compact_relay(struct p2p_session *s,
  * @param msg   应用层消息类型（1 字节，应用自定义）
  * @param data  请求数据（最多 P2P_MSG_DATA_MAX 字节）
  * @param len   数据长度
- * @return      0=已加入发送队列，-1=失败（不支持/已有挂起/参数错误/未注册）
+ * @param sid_out 输出分配的 sid（可为 NULL）
+ * @return      0=已加入发送队列，<0=失败（不支持/窗口已满/参数错误/未注册）
  */
 ret_t p2p_signal_compact_request(struct p2p_session *s,
-                                 uint8_t msg, const void *data, int len);
+                                 uint8_t msg, const void *data, int len, uint16_t *sid_out);
 
 /*
  * 回复对端的 MSG 请求（B 端）。
  *
  * @param s     会话对象
+ * @param sid   待回复请求的 sid（0=最早到达的待回复请求）
  * @param code  应用层消息类型（1 字节，应用自定义）
  * @param data  回复数据（最多 P2P_MSG_DATA_MAX 字节）
  * @param len   数据长度
  * @return      0=已加入发送队列，-1=失败（参数错误/无挂起请求）
  */
-ret_t p2p_signal_compact_response(struct p2p_session *s,
+ret_t p2p_signal_compact_response(struct p2p_session *s, uint16_t sid,
                                   uint8_t code, const void *data, int len);
 
 //-----------------------------------------------------------------------------
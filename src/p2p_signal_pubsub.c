@@ -13,6 +13,7 @@
 #include "p2p_http.h"
 #include "p2p_crypto.h"
 #include "p2p_ice.h"
+#include "p2p_lz.h"
 
 /* 日志标签（对齐 RELAY/COMPACT 风格）*/
 static const char *TASK_PUBLISH = "PUBLISH";
@@ -22,94 +23,397 @@ static const char *TASK_POLL    = "POLL";
  * 内部辅助函数
  * ============================================================================ */
 
+/*
+ * 请求入队（队列满时丢弃并返回 -1，body 所有权在成功时转移给队列）
+ */
+static int job_push(p2p_signal_pubsub_ctx_t *ctx, struct p2p_session *s, p2p_pubsub_done_fn done,
+                    const char *gist_id, const char *filename, char *body, int a0, int a1) {
+
+    if (ctx->job_cnt >= P2P_PUBSUB_JOB_MAX) {
+        print("W:", LA_F("%s: request queue full, dropping %s %s", LA_F567, 567),
+              TASK_PUBLISH, body ? "PATCH" : "GET", filename);
+        return -1;
+    }
+
+    p2p_pubsub_job_t *j = &ctx->jobs[(ctx->job_head + ctx->job_cnt) % P2P_PUBSUB_JOB_MAX];
+    memset(j, 0, sizeof(*j));
+    j->s = s;
+    j->done = done;
+    strncpy(j->gist_id, gist_id, sizeof(j->gist_id) - 1);
+    strncpy(j->filename, filename, sizeof(j->filename) - 1);
+    j->body = body;
+    j->arg[0] = a0;
+    j->arg[1] = a1;
+    ctx->job_cnt++;
+    if (s) s->sig_sess.pubsub.jobs++;
+    return 0;
+}
+
+/* 取消会话的全部请求：未发起的直接丢弃，进行中的完成后不再回调 */
+static void job_cancel(p2p_signal_pubsub_ctx_t *ctx, struct p2p_session *s) {
+    for (int i = 0; i < ctx->job_cnt; i++) {
+        p2p_pubsub_job_t *j = &ctx->jobs[(ctx->job_head + i) % P2P_PUBSUB_JOB_MAX];
+        if (j->s == s) { j->s = NULL; j->done = NULL; }
+    }
+    s->sig_sess.pubsub.jobs = 0;
+}
+
  /*
- * 写入发布板指定文件（PATCH Gist）
+ * 写入发布板指定文件（PATCH Gist，入队后异步执行）
  *
  * @param ctx      实例上下文
+ * @param s        所属会话
  * @param gist_id  Gist ID
  * @param filename 文件名（peer_id）
  * @param content  写入内容
- * @return         0=成功
+ * @param done     完成回调（r: 0=成功，-1=失败），可为 NULL
+ * @return         0=已入队
  */
-static int gist_write(p2p_signal_pubsub_ctx_t *ctx, const char *gist_id, const char *filename, const char *content) {
-    char url[256];
-    snprintf(url, sizeof(url), "https://api.github.com/gists/%s", gist_id);
+static int gist_write(p2p_signal_pubsub_ctx_t *ctx, struct p2p_session *s, const char *gist_id,
+                      const char *filename, const char *content, p2p_pubsub_done_fn done, int a0, int a1) {
 
     size_t content_len = strlen(content);
     size_t fname_len = strlen(filename);
     size_t body_sz = content_len + fname_len + 128;
-    char *body = (char *)malloc(body_sz);
+    char *body = (char *)p2p_malloc(body_sz);
     if (!body) return -1;
 
     snprintf(body, body_sz,
              "{\"files\":{\"%.64s\":{\"content\":\"%s\"}}}", filename, content);
 
-    int ret = p2p_http_patch(url, ctx->auth_token, body);
-    free(body);
-    return ret;
+    if (job_push(ctx, s, done, gist_id, filename, body, a0, a1) < 0) {
+        p2p_free(body);
+        return -1;
+    }
+    return 0;
 }
 
 /*
- * 读取发布板指定文件（GET Gist）
+ * 读取发布板指定文件（条件 GET Gist，入队后异步执行）
  *
- * @param ctx       实例上下文
- * @param gist_id   Gist ID
- * @param filename  文件名（peer_id）
- * @param out       输出内容缓冲区
- * @param out_sz    缓冲区大小
- * @return          0=成功且有内容，-1=失败或无内容
+ * @param done     完成回调（r: 0=内容有变化，1=内容与上次相同，-1=失败或无内容）
+ * @return         0=已入队
  */
-static int gist_poll(p2p_signal_pubsub_ctx_t *ctx, const char *gist_id, const char *filename, char *out, int out_sz) {
+static int gist_poll(p2p_signal_pubsub_ctx_t *ctx, struct p2p_session *s, const char *gist_id,
+                     const char *filename, p2p_pubsub_done_fn done) {
+    return job_push(ctx, s, done, gist_id, filename, NULL, 0, 0);
+}
 
-    snprintf(out, out_sz, "https://api.github.com/gists/%s", gist_id);
+/*
+ * 信箱所在的 Gist：分片列表中按 peer_id 选出的一项（与 p2p_cluster_pick 同一规则，各端结果一致）
+ */
+static void gist_shard(const p2p_signal_pubsub_ctx_t *ctx, const char *peer_id, char *out, size_t out_sz) {
+
+    size_t len;
+    int off = p2p_cluster_pick(ctx->gist_shards, peer_id, P2P_PEER_ID_MAX, &len);
+    if (off < 0) { snprintf(out, out_sz, "%s", ctx->local_gist_id); return; }
+    while (len && ctx->gist_shards[off] == ' ') { off++; len--; }
+    while (len && ctx->gist_shards[off + len - 1] == ' ') len--;
+    if (len >= out_sz) len = out_sz - 1;
+    memcpy(out, ctx->gist_shards + off, len);
+    out[len] = '\0';
+}
 
-    static char resp[32768];
-    int got = p2p_http_get(out, ctx->auth_token, resp, (int)sizeof(resp));
-    if (got <= 0) {
-        return -1;
+/*
+ * 取 gist/文件 对应的条件 GET 缓存槽位：优先已有、其次空闲，否则替换最久未用的
+ */
+static p2p_pubsub_cache_t *cache_slot(p2p_signal_pubsub_ctx_t *ctx, const char *gist_id, const char *filename) {
+
+    p2p_pubsub_cache_t *e = &ctx->cache[0];
+    for (int i = 0; i < P2P_PUBSUB_CACHE_SLOTS; i++) {
+        p2p_pubsub_cache_t *c = &ctx->cache[i];
+        if (c->gist_id[0] && !strcmp(c->gist_id, gist_id) && !strncmp(c->filename, filename, P2P_PEER_ID_MAX))
+            return c;
+        if (e->gist_id[0] && (!c->gist_id[0] || c->used < e->used)) e = c;
     }
+    memset(e, 0, sizeof(*e));
+    strncpy(e->gist_id, gist_id, sizeof(e->gist_id) - 1);
+    strncpy(e->filename, filename, sizeof(e->filename) - 1);
+    return e;
+}
+
+/*
+ * 从 Gist JSON（API 响应或 PATCH 请求体）中提取指定文件的 content 字段并反转义
+ *
+ * @return  0=成功，-1=无该文件
+ */
+static int json_file_content(const char *json, const char *filename, char *out, int out_sz) {
 
-    /* 从 Gist API 响应中提取指定文件的 content 字段 */
-    int ret = -1;
+    out[0] = '\0';
     char file_key[256];
     snprintf(file_key, sizeof(file_key), "\"%.64s\"", filename);
-    const char *file_sec = strstr(resp, file_key);
-    if (file_sec) {
-        const char *cnt_key = strstr(file_sec, "\"content\"");
-        if (cnt_key) {
-            const char *cs = strchr(cnt_key + 9, '\"');
-            if (cs) {
-                cs++;  /* skip opening quote */
-                char *dst = out;
-                const char *end = out + out_sz - 1;
-                const char *p = cs;
-                while (*p && dst < end) {
-                    if (*p == '\\') {
-                        p++;
-                        switch (*p) {
-                            case 'n':  *dst++ = '\n'; p++; break;
-                            case '\\': *dst++ = '\\'; p++; break;
-                            case '"':  *dst++ = '"';  p++; break;
-                            case '/':  *dst++ = '/';  p++; break;
-                            case 'r':  *dst++ = '\r'; p++; break;
-                            case 't':  *dst++ = '\t'; p++; break;
-                            default:   *dst++ = '\\'; *dst++ = *p++; break;
-                        }
-                    } else if (*p == '"') {
-                        break;
-                    } else {
-                        *dst++ = *p++;
-                    }
-                }
-                *dst = '\0';
-                ret = 0;
+    const char *file_sec = strstr(json, file_key);
+    if (!file_sec) return -1;
+    const char *cnt_key = strstr(file_sec, "\"content\"");
+    if (!cnt_key) return -1;
+    const char *cs = strchr(cnt_key + 9, '\"');
+    if (!cs) return -1;
+
+    cs++;  /* skip opening quote */
+    char *dst = out;
+    const char *end = out + out_sz - 1;
+    const char *p = cs;
+    while (*p && dst < end) {
+        if (*p == '\\') {
+            p++;
+            switch (*p) {
+                case 'n':  *dst++ = '\n'; p++; break;
+                case '\\': *dst++ = '\\'; p++; break;
+                case '"':  *dst++ = '"';  p++; break;
+                case '/':  *dst++ = '/';  p++; break;
+                case 'r':  *dst++ = '\r'; p++; break;
+                case 't':  *dst++ = '\t'; p++; break;
+                default:   *dst++ = '\\'; *dst++ = *p++; break;
             }
+        } else if (*p == '"') {
+            break;
+        } else {
+            *dst++ = *p++;
         }
     }
+    *dst = '\0';
+    return 0;
+}
+
+/*
+ * 从 GET 响应中提取文件内容
+ *
+ * 304 时回放缓存内容；200 时从 Gist API 响应中重新提取并更新缓存。
+ *
+ * @param status    p2p_http_poll 的完成结果（HTTP 状态码或 <0）
+ * @param out       输出内容缓冲区
+ * @param out_sz    缓冲区大小
+ * @return          0=成功且内容有变化，1=成功但内容与上次相同，-1=失败或无内容
+ */
+static int gist_extract(p2p_signal_pubsub_ctx_t *ctx, const p2p_pubsub_job_t *job, int status,
+                        char *out, int out_sz) {
+
+    p2p_pubsub_cache_t *c = cache_slot(ctx, job->gist_id, job->filename);
+    c->used = p2p_now_ms();
+
+    out[0] = '\0';
+    if (status == 304 && c->etag[0]) {
+        snprintf(out, out_sz, "%s", c->content);
+        return (int)strlen(out) < 10 ? -1 : 1;
+    }
+    if (status < 200 || status >= 300) {
+        return -1;
+    }
+    int ret = json_file_content(p2p_http_body(ctx->http, NULL), job->filename, out, out_sz);
+
+    /* 更新缓存：内容与上次相同视为无变化（含其他文件被改写导致 ETag 变化的情况）*/
+    bool same = !strcmp(c->content, out);
+    if (!same) snprintf(c->content, sizeof(c->content), "%s", out);
+    snprintf(c->etag, sizeof(c->etag), "%s", p2p_http_etag(ctx->http));
 
     /* 内容过短视为空 */
     if (ret == 0 && (int)strlen(out) < 10) return -1;
-    return ret;
+    return ret == 0 && same ? 1 : ret;
+}
+
+/* ----------------------------------------------------------------------------
+ * WebSocket 推送：写入即广播帧，收到的帧更新本地缓存，读取直接命中缓存
+ * ---------------------------------------------------------------------------- */
+
+/* 推送模式读取：返回值语义同 gist_extract */
+static int push_read(p2p_signal_pubsub_ctx_t *ctx, const p2p_pubsub_job_t *job, char *out, int out_sz) {
+
+    p2p_pubsub_cache_t *c = cache_slot(ctx, job->gist_id, job->filename);
+    c->used = p2p_now_ms();
+
+    snprintf(out, out_sz, "%s", c->content);
+    if ((int)strlen(out) < 10) return -1;
+    int r = c->pushed ? 0 : 1;
+    c->pushed = false;
+    return r;
+}
+
+/*
+ * 应用一帧推送（也用于本端写入的写穿）：只保留与本端相关的文件，
+ * 内容有变化时唤醒关注该文件的会话立即读取
+ */
+static void push_apply(struct p2p_instance *inst, const char *msg) {
+    p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
+
+    /* {"gist":"<gist_id>","files":{"<peer_id>":... */
+    char gist[128], file[P2P_PEER_ID_MAX];
+    const char *g = strstr(msg, "\"gist\":\"");
+    if (!g) return;
+    g += 8;
+    const char *ge = strchr(g, '"');
+    if (!ge || ge - g >= (int)sizeof(gist)) return;
+    memcpy(gist, g, (size_t)(ge - g)); gist[ge - g] = '\0';
+
+    const char *f = strstr(ge, "\"files\":{\"");
+    if (!f) return;
+    f += 10;
+    const char *fe = strchr(f, '"');
+    if (!fe || fe - f >= (int)sizeof(file)) return;
+    memcpy(file, f, (size_t)(fe - f)); file[fe - f] = '\0';
+
+    bool mine = !strcmp(gist, ctx->local_gist_id) && !strcmp(file, ctx->local_peer_id);
+    bool wanted = mine;
+    for (struct p2p_session *s = inst->sessions_head; s && !wanted; s = s->next) {
+        p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
+        wanted = !strcmp(gist, sess->remote_gist_id) && !strcmp(file, sess->remote_peer_id);
+    }
+    if (!wanted) return;
+
+    char content[4096];
+    if (json_file_content(f - 1, file, content, (int)sizeof(content)) < 0) return;
+
+    p2p_pubsub_cache_t *c = cache_slot(ctx, gist, file);
+    c->used = p2p_now_ms();
+    if (!strcmp(c->content, content)) return;
+    snprintf(c->content, sizeof(c->content), "%s", content);
+    c->pushed = true;
+
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
+        p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
+        if (mine || (!strcmp(gist, sess->remote_gist_id) && !strcmp(file, sess->remote_peer_id))) {
+            sess->last_poll = 0;
+            sess->poll_idle = 0;
+        }
+    }
+}
+
+#ifdef WITH_WSLAY
+static void ws_on_open(ws_client_t *c, void *user_data) {
+    (void)c;
+    struct p2p_instance *inst = (struct p2p_instance *)user_data;
+    print("I:", LA_F("%s: push channel ws://%s:%u open", LA_F568, 568),
+          TASK_PUBLISH, inst->sig_ctx.pubsub.ws_host, inst->sig_ctx.pubsub.ws_port);
+}
+
+static void ws_on_message(ws_client_t *c, ws_msg_type_t type, const uint8_t *data, size_t len, void *user_data) {
+    (void)c;
+    if (type != WS_MSG_TEXT || len == 0) return;
+    char *msg = (char *)p2p_malloc(len + 1);
+    if (!msg) return;
+    memcpy(msg, data, len);
+    msg[len] = '\0';
+    push_apply((struct p2p_instance *)user_data, msg);
+    p2p_free(msg);
+}
+
+/* 驱动推送连接：收发帧，断开后按 P2P_PUBSUB_WS_RETRY_MS 重连 */
+static void ws_pump(struct p2p_instance *inst, uint64_t now) {
+    p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
+
+    ws_client_state_t st = ws_client_state(ctx->ws);
+    if (ctx->ws && st != WS_CLIENT_CLOSED && st != WS_CLIENT_ERROR) {
+        ws_client_update(ctx->ws);
+        return;
+    }
+    if (ctx->ws_retry && tick_diff(now, ctx->ws_retry) < P2P_PUBSUB_WS_RETRY_MS) return;
+
+    // 推送服务器地址异步解析：就绪前不创建客户端，也不占用重连退避
+    struct sockaddr_in addr;
+    if (p2p_dns_resolve(ctx->ws_host, ctx->ws_port, &addr) == 0) return;
+    ctx->ws_retry = now;
+
+    if (ctx->ws) {
+        print("W:", LA_F("%s: push channel lost, reconnecting", LA_F569, 569), TASK_PUBLISH);
+        ws_client_destroy(ctx->ws);
+    }
+    ws_client_cfg_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.on_open = ws_on_open;
+    cfg.on_message = ws_on_message;
+    cfg.user_data = inst;
+    ctx->ws = ws_client_create(&cfg);
+    if (ctx->ws && ws_client_connect(ctx->ws, ctx->ws_host, ctx->ws_port, P2P_PUBSUB_WS_PATH) == 0)
+        ws_client_update(ctx->ws);
+}
+
+/*
+ * 推送模式执行队首请求
+ *
+ * @return  0: 等待连接; 200: 完成（读取命中缓存 / 帧已入发送队列）; <0: 失败
+ */
+static int ws_job(struct p2p_instance *inst, const p2p_pubsub_job_t *j, uint64_t now) {
+    p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
+
+    if (!j->body) return 200;
+    if (!ctx->job_active) { ctx->job_active = true; ctx->job_start = now; }
+    if (ws_client_state(ctx->ws) != WS_CLIENT_OPEN)
+        return tick_diff(now, ctx->job_start) >= P2P_HTTP_TIMEOUT_MS ? -1 : 0;
+
+    /* {"files":...} → {"gist":"<gist_id>","files":...} */
+    size_t n = strlen(j->body) + strlen(j->gist_id) + 16;
+    char *msg = (char *)p2p_malloc(n);
+    if (!msg) return -1;
+    snprintf(msg, n, "{\"gist\":\"%s\",%s", j->gist_id, j->body + 1);
+    int ret = ws_client_send_text(ctx->ws, msg);
+    if (ret == 0) {
+        push_apply(inst, msg);      /* 写穿：本端读取得到刚写入的内容，与 Gist 语义一致 */
+        ws_client_update(ctx->ws);
+    }
+    p2p_free(msg);
+    return ret == 0 ? 200 : -1;
+}
+#endif
+
+/*
+ * 推进请求队列（非阻塞）
+ *
+ * 队首请求未发起则发起，已发起则推进；完成后出队并回调，继续处理下一个。
+ * 所有请求共用 ctx->http 的保活连接，依次执行。
+ */
+static void pubsub_pump(struct p2p_instance *inst, uint64_t now) {
+    p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
+#ifdef WITH_WSLAY
+    if (ctx->push) ws_pump(inst, now);
+#endif
+    if (!ctx->http && !ctx->push) return;
+
+    while (ctx->job_cnt > 0) {
+        p2p_pubsub_job_t *j = &ctx->jobs[ctx->job_head];
+        int st;
+
+        if (!ctx->job_active && !j->s) {
+            st = -1;                                         /* 已取消且未发起：直接丢弃 */
+        }
+#ifdef WITH_WSLAY
+        else if (ctx->push) {
+            st = ws_job(inst, j, now);
+            if (st == 0) return;                             /* 等待推送连接 */
+        }
+#endif
+        else {
+            if (!ctx->job_active) {
+                char url[256];
+                snprintf(url, sizeof(url), "https://api.github.com/gists/%s", j->gist_id);
+                const char *etag = j->body ? NULL : cache_slot(ctx, j->gist_id, j->filename)->etag;
+                ctx->job_active = p2p_http_request(ctx->http, j->body ? "PATCH" : "GET", url,
+                                                   ctx->auth_token, etag, j->body) == E_NONE;
+            }
+            st = ctx->job_active ? p2p_http_poll(ctx->http, now) : -1;
+            if (st == 0) return;                             /* 进行中 */
+
+            /* 记录配额余量（304 也携带），供 trickle 攒批限速 */
+            long long reset;
+            long remaining = st > 0 ? p2p_http_ratelimit(ctx->http, &reset) : -1;
+            if (remaining >= 0 && reset > 0) { ctx->rl_remaining = remaining; ctx->rl_reset = reset; }
+        }
+        ctx->job_active = false;
+
+        /* 先出队再回调：回调中可继续入队 */
+        p2p_pubsub_job_t job = *j;
+        ctx->job_head = (ctx->job_head + 1) % P2P_PUBSUB_JOB_MAX;
+        ctx->job_cnt--;
+        if (job.s) job.s->sig_sess.pubsub.jobs--;
+
+        char content[4096];
+        int r;
+        if (job.body) r = (st >= 200 && st < 300) ? 0 : -1;
+        else if (!job.s) r = -1;
+        else r = ctx->push ? push_read(ctx, &job, content, (int)sizeof(content))
+                           : gist_extract(ctx, &job, st, content, (int)sizeof(content));
+
+        if (job.s && job.done) job.done(inst, job.s, &job, r, (!job.body && r >= 0) ? content : NULL);
+        p2p_free(job.body);
+    }
 }
 
 /*
@@ -129,14 +433,87 @@ static void derive_key(const char *auth_key, uint8_t key_out[8]) {
 }
 
 /*
- * Base64 解码 → DES 解密 → SDP 解析候选列表并注入会话
+ * 候选消息（候选协议的解析结果，见下方协议说明）
+ */
+typedef struct {
+    int         ver;
+    bool        delta;                      // 增量格式（false = 旧的全量格式）
+    uint32_t    tag;                        // 发布方会话标签
+    int         base, cnt;                  // 携带发布方第 [base, cnt) 个候选
+    uint32_t    ack_tag;                    // 发布方已应用的本端候选：本端标签与数量
+    int         ack_cnt;
+    const char *blob;                       // Base64 密文（可为空串）
+} cand_msg_t;
+
+static bool cand_parse(const char *content, cand_msg_t *m) {
+    memset(m, 0, sizeof(*m));
+    const char *colon = strchr(content, ':');
+    if (!colon) return false;
+    m->blob = colon + 1;
+    if (content[0] != 'D') {
+        m->ver = atoi(content);
+        return true;
+    }
+    unsigned tag, ack_tag;
+    if (sscanf(content + 1, "%d,%x,%d,%d,%x,%d:", &m->ver, &tag, &m->base, &m->cnt,
+               &ack_tag, &m->ack_cnt) != 6) return false;
+    if (m->base < 0 || m->cnt < m->base || m->ack_cnt < 0) return false;
+    m->delta = true;
+    m->tag = tag;
+    m->ack_tag = ack_tag;
+    return true;
+}
+
+/*
+ * 编码本端候选 [base, cnt)：SDP 导出 → LZ 压缩 → DES 加密 → Base64
+ *
+ * 导出全部候选再跳过前 base 行，使 foundation（按序号生成）与全量发布一致。
+ * base == cnt 时输出空串。
+ *
+ * @return  Base64 长度，失败返回 -1
+ */
+static int cand_encode(struct p2p_session *s, const uint8_t key[8], int base, int cnt, char *b64, int b64_sz) {
+    b64[0] = '\0';
+    if (base >= cnt) return 0;
+
+    char sdp_buf[4096];
+    int sdp_len = p2p_ice_export_sdp(s->local_cands, cnt, sdp_buf, (int)sizeof(sdp_buf),
+                                      true, NULL, NULL, NULL);
+    if (sdp_len <= 0) return -1;
+
+    const char *p = sdp_buf;
+    for (int i = 0; i < base && p; i++) {
+        p = strstr(p, "\r\n");
+        if (p) p += 2;
+    }
+    if (!p || !*p) return -1;
+    int txt_len = sdp_len - (int)(p - sdp_buf);
+
+    uint8_t raw[2 + sizeof(sdp_buf) + sizeof(sdp_buf) / 64 + 16];
+    int consumed = txt_len;
+    int lz_len = p2p_lz_compress((const uint8_t *)p, &consumed, raw + 2, (int)sizeof(raw) - 2);
+    if (lz_len <= 0 || consumed != txt_len) return -1;
+    raw[0] = (uint8_t)(lz_len >> 8);
+    raw[1] = (uint8_t)lz_len;
+
+    int padded = (2 + lz_len + 7) & ~7;
+    memset(raw + 2 + lz_len, 0, (size_t)(padded - 2 - lz_len));
+
+    uint8_t enc[sizeof(raw)];
+    p2p_des_encrypt(key, raw, (size_t)padded, enc);
+    return p2p_base64_encode(enc, (size_t)padded, b64, b64_sz);
+}
+
+/*
+ * Base64 解码 → DES 解密 →（增量格式）LZ 解压 → SDP 解析候选列表并注入会话
  *
  * @param s       会话（注入 remote_cands）
  * @param key     DES 密钥
  * @param b64     Base64 编码的密文
+ * @param lz      明文为 [长度(2)][LZ 压缩块]
  * @return        新增的候选数量
  */
-static int unpack_remote_candidates(struct p2p_session *s, const uint8_t key[8], const char *b64) {
+static int unpack_remote_candidates(struct p2p_session *s, const uint8_t key[8], const char *b64, bool lz) {
     /* Base64 解码 */
     uint8_t enc_buf[4096];
     size_t enc_len = (size_t)p2p_base64_decode(b64, strlen(b64), enc_buf, sizeof(enc_buf));
@@ -146,15 +523,31 @@ static int unpack_remote_candidates(struct p2p_session *s, const uint8_t key[8],
     }
 
     /* DES 解密 */
-    uint8_t *dec = (uint8_t *)calloc(1, enc_len + 1);  /* +1 for NUL */
+    uint8_t *dec = (uint8_t *)p2p_calloc(1, enc_len + 1);  /* +1 for NUL */
     if (!dec) return 0;
     p2p_des_decrypt(key, enc_buf, enc_len, dec);
     dec[enc_len] = '\0';  /* 确保 NUL 终止（SDP 是文本）*/
 
+    /* LZ 解压 */
+    const char *sdp = (const char *)dec;
+    char txt[4096];
+    if (lz) {
+        int lz_len = enc_len >= 2 ? (dec[0] << 8) | dec[1] : -1;
+        int n = lz_len >= 0 && (size_t)lz_len + 2 <= enc_len
+              ? p2p_lz_decompress(dec + 2, lz_len, (uint8_t *)txt, (int)sizeof(txt) - 1) : -1;
+        if (n < 0) {
+            p2p_free(dec);
+            print("W:", LA_F("Candidate decompress failed", LA_F657, 657));
+            return 0;
+        }
+        txt[n] = '\0';
+        sdp = txt;
+    }
+
     /* SDP 解析 */
     p2p_remote_candidate_entry_t tmp_cands[32];
-    int parsed = p2p_ice_import_sdp((const char *)dec, tmp_cands, 32);
-    free(dec);
+    int parsed = p2p_ice_import_sdp(sdp, tmp_cands, 32);
+    p2p_free(dec);
 
     if (parsed <= 0) {
         print("W:", LA_F("SDP import failed or empty", LA_F262, 262));
@@ -177,7 +570,52 @@ static int unpack_remote_candidates(struct p2p_session *s, const uint8_t key[8],
               idx, inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port));
         added++;
     }
+    if (added) p2p_setup_mark(s, P2P_SETUP_REMOTE_CAND, p2p_now_ms());
+
+    return added;
+}
+
+/*
+ * 处理对端消息中搭载的 ack：推进本端下一次发布的 base；
+ * ack 落后于上次发布的 base（对端丢失了已应用的候选）→ 需要从 ack 处重新发布
+ */
+static void cand_take_ack(p2p_pubsub_session_t *sess, const cand_msg_t *m) {
+    int ack = m->delta && sess->sync_tag && m->ack_tag == sess->sync_tag ? m->ack_cnt : 0;
+    if (ack > sess->candidate_synced_count) ack = sess->candidate_synced_count;
+    if (ack < sess->sync_base) sess->republish = true;
+    sess->peer_ack = ack;
+}
+
+/* 消息中的候选是否已全部应用过 */
+static bool cand_seen(const p2p_pubsub_session_t *sess, const cand_msg_t *m) {
+    if (m->ver != sess->remote_sync_ver) return false;
+    return !m->delta || (m->tag == sess->remote_tag && m->cnt <= sess->remote_cnt);
+}
+
+/*
+ * 应用对端候选消息
+ *
+ * @return  新增的候选数量；增量与已应用部分不衔接时返回 -1（并安排刷新本端 ack）
+ */
+static int cand_apply(struct p2p_instance *inst, struct p2p_session *s, const cand_msg_t *m) {
+    p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
+
+    if (m->delta && m->base > 0 && (m->tag != sess->remote_tag || m->base > sess->remote_cnt)) {
+        print("W:", LA_F("%s: candidate delta gap (base=%d, have=%d), requesting resend", LA_F658, 658),
+              TASK_POLL, m->base, m->tag == sess->remote_tag ? sess->remote_cnt : 0);
+        if (sess->ack_sent_tag != sess->remote_tag || sess->ack_sent_cnt != sess->remote_cnt)
+            sess->republish = true;
+        return -1;
+    }
+
+    uint8_t key[8];
+    derive_key(inst->sig_ctx.pubsub.auth_key, key);
 
+    int added = m->blob[0] ? unpack_remote_candidates(s, key, m->blob, m->delta) : 0;
+    if (m->delta) {
+        if (m->tag != sess->remote_tag) { sess->remote_tag = m->tag; sess->remote_cnt = 0; }
+        if (m->cnt > sess->remote_cnt) sess->remote_cnt = m->cnt;
+    }
     return added;
 }
 
@@ -202,14 +640,18 @@ static int unpack_remote_candidates(struct p2p_session *s, const uint8_t key[8],
  *   - 示例: "OFFER:a1b2c3d4e5f6a1b2c3d4e5f6a1b2c3d4:bob"
  *
  * 候选协议（双方 → 自己的 Gist）：
- *   version(ascii_decimal) ":" base64( des_ecb( sdp_candidates ) )
- *   - version: 1,2,3... = trickle 增量版本；0 = 全部发送完成
- *   - sdp_candidates: p2p_ice_export_sdp() 输出的 "a=candidate:..." 文本
+ *   "D" version "," tag "," base "," cnt "," ack_tag "," ack_cnt ":" base64( des_ecb( lz( sdp_candidates ) ) )
+ *   - version: 1,2,3... = trickle 版本；0 = 全部发送完成
+ *   - tag:     本端会话标签（十六进制），base/cnt: 携带本端第 [base, cnt) 个候选（base = 对端 ack）
+ *   - ack_tag/ack_cnt: 本端已应用的对端候选（对端 tag 与累计数量）
+ *   - sdp_candidates: p2p_ice_export_sdp() 输出的 "a=candidate:..." 文本（跳过前 base 行）
+ *   - lz:      [压缩长度(2, 大端)] p2p_lz_compress() 输出
  *   - des_ecb: DES ECB 模式，密钥 = derive_key(auth_key) → 8 字节
  *              明文按 8 字节块对齐（补零）
- *   - base64: 标准 Base64 编码
- *   - 示例: "2:ABCDef..." (第 2 次 trickle)
- *   - 示例: "0:ABCDef..." (全部完成)
+ *   - base64: 标准 Base64 编码（base == cnt 时为空）
+ *   - 示例: "D2,5f3a91c7,0,3,0,0:ABCDef..." (第 2 次 trickle，对端尚未确认)
+ *   - 示例: "D0,5f3a91c7,3,4,81d0e2b5,2:ABCDef..." (全部完成，只携带第 4 个候选)
+ *   - 兼容旧格式 version ":" base64( des_ecb( sdp_candidates ) )（全量、未压缩）
  *
  * 操作矩阵：
  *   函数                 角色   HTTP          文件(peer_id)   写入内容
@@ -217,10 +659,26 @@ static int unpack_remote_candidates(struct p2p_session *s, const uint8_t key[8],
  *   poll_offer()         SUB    GET local     local_peer      检测 "OFFER:*"
  *   sync0_offer()        PUB    GET+PATCH     remote_peer     "OFFER:<gist_id>:<peer_id>"
  *   poll_answer()        PUB    GET remote    remote_peer     检测候选/ONLINE/OFFER
- *   sync_candidates()    双方   PATCH local   local_peer      "<ver>:" Base64(DES(SDP))
+ *   sync_candidates()    双方   PATCH local   local_peer      "D<ver>,...:" Base64(DES(LZ(SDP 增量)))
  *   poll_candidates()    双方   GET remote    remote_peer     解码候选
  * ============================================================================ */
 
+/*
+ * 自适应轮询：刚有活动（内容变化、本端写入）时按 P2P_PUBSUB_POLL_FAST_MS 快速轮询，
+ * 每次无变化（304 或内容相同）间隔翻倍，直到该阶段原有的上限 max_ms。
+ * 条件 GET 使空闲轮询只产生不计速率限制的 304，快速阶段的额外请求代价很低。
+ */
+static uint64_t poll_interval(const p2p_pubsub_session_t *sess, uint64_t max_ms) {
+    uint64_t iv = (uint64_t)P2P_PUBSUB_POLL_FAST_MS << sess->poll_idle;
+    return iv < max_ms ? iv : max_ms;
+}
+
+/* 记录一次轮询结果（gist_poll 返回值）：0 = 有变化，其他 = 空闲 */
+static void poll_mark(p2p_pubsub_session_t *sess, int r) {
+    if (r == 0) sess->poll_idle = 0;
+    else if (sess->poll_idle < 16) sess->poll_idle++;
+}
+
 /*
  * SUB: 写入心跳到自己的 Gist
  *
@@ -231,6 +689,20 @@ static int unpack_remote_candidates(struct p2p_session *s, const uint8_t key[8],
  *
  * connect() 时立即调用，tick_send 每 P2P_PUBSUB_HEARTBEAT_SEC 秒刷新。
  */
+static void on_sub(struct p2p_instance *inst, struct p2p_session *s,
+                   const p2p_pubsub_job_t *job, int r, const char *content) {
+    (void)inst; (void)job; (void)content;
+    p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
+
+    if (r == 0) {
+        sess->poll_idle = 0;
+        print("I:", LA_F("%s: heartbeat written", LA_F260, 260), TASK_PUBLISH);
+    } else {
+        sess->last_sub = 0;                 /* 下次轮询后立即重试 */
+        print("W:", LA_F("%s: heartbeat write failed", LA_F439, 439), TASK_PUBLISH);
+    }
+}
+
 static void sync0_sub(struct p2p_instance *inst, struct p2p_session *s, uint64_t now) {
     p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
     p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
@@ -241,12 +713,8 @@ static void sync0_sub(struct p2p_instance *inst, struct p2p_session *s, uint64_t
     print("I:", LA_F("%s: writing heartbeat (gist=%s) %s", LA_F423, 423),
           TASK_PUBLISH, ctx->local_gist_id, ts_str);
 
-    if (gist_write(ctx, ctx->local_gist_id, ctx->local_peer_id, ts_str) == 0) {
+    if (gist_write(ctx, s, ctx->local_gist_id, ctx->local_peer_id, ts_str, on_sub, 0, 0) == 0)
         sess->last_sub = now;
-        print("I:", LA_F("%s: heartbeat written", LA_F260, 260), TASK_PUBLISH);
-    } else {
-        print("W:", LA_F("%s: heartbeat write failed", LA_F439, 439), TASK_PUBLISH);
-    }
 }
 
 /*
@@ -258,18 +726,18 @@ static void sync0_sub(struct p2p_instance *inst, struct p2p_session *s, uint64_t
  *   - 提取 peer_id     → remote_peer_id
  *   - → SYNCING
  */
-static bool poll_offer(struct p2p_instance *inst, struct p2p_session *s) {
-    p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
+static void on_offer(struct p2p_instance *inst, struct p2p_session *s,
+                     const p2p_pubsub_job_t *job, int r, const char *content) {
+    (void)job;
     p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
 
-    char content[4096];
-    if (gist_poll(ctx, ctx->local_gist_id, ctx->local_peer_id, content, (int)sizeof(content)) != 0) {
+    poll_mark(sess, r);
+    if (r < 0) {
         print("V:", LA_F("%s: mailbox empty, waiting", LA_F142, 142), TASK_POLL);
-        return false;
     }
 
     /* 检查是否是 offer: "OFFER:<gist_id>:<peer_id>" */
-    if (strncmp(content, "OFFER:", 6) == 0) {
+    if (r >= 0 && strncmp(content, "OFFER:", 6) == 0) {
         const char *pub_gist_id = content + 6;
         /* 分离 gist_id 和 peer_id */
         const char *colon = strchr(pub_gist_id, ':');
@@ -294,9 +762,18 @@ static bool poll_offer(struct p2p_instance *inst, struct p2p_session *s) {
             print("I:", LA_F("%s: received offer from %s (peer=%s) → SYNCING", LA_F351, 351),
                   TASK_POLL, sess->remote_gist_id, sess->remote_peer_id);
         }
-        return true;
+        return;
     }
-    return false;
+
+    // 没有 offer，检查心跳是否需要刷新
+    uint64_t now = p2p_now_ms();
+    if (tick_diff(now, sess->last_sub) >= (uint64_t)P2P_PUBSUB_HEARTBEAT_SEC * 1000)
+        sync0_sub(inst, s, now);
+}
+
+static void poll_offer(struct p2p_instance *inst, struct p2p_session *s) {
+    p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
+    gist_poll(ctx, s, ctx->local_gist_id, ctx->local_peer_id, on_offer);
 }
 
 /*
@@ -311,52 +788,68 @@ static bool poll_offer(struct p2p_instance *inst, struct p2p_session *s) {
  * connect() 时立即调用（resend=false）。
  * poll_answer() 检测到 ONLINE 竞争时立即调用（resend=true，跳过心跳检测）。
  */
-static void sync0_offer(struct p2p_instance *inst, struct p2p_session *s, bool resend) {
-    p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
+static void on_probe(struct p2p_instance *inst, struct p2p_session *s,
+                     const p2p_pubsub_job_t *job, int r, const char *probe) {
+    (void)inst; (void)job;
     p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
 
-    /* 首次发送时：清除本端 Gist 文件（防止对端读到上一轮残留的 SDP ver=0）
-     * resend 时跳过（文件已在首次发送时清除）*/
-    if (!resend) {
-        gist_write(ctx, ctx->local_gist_id, ctx->local_peer_id, "CLEAR");
-
-        char probe[4096];
-        if (gist_poll(ctx, sess->remote_gist_id, sess->remote_peer_id, probe, (int)sizeof(probe)) == 0) {
-            if (strncmp(probe, "ONLINE:", 7) == 0) {
-                time_t sub_ts = (time_t)strtoll(probe + 7, NULL, 10);
-                time_t now_sec = time(NULL);
-                long long age = (long long)(now_sec - sub_ts);
-                if (age > P2P_PUBSUB_HEARTBEAT_SEC) {
-                    print("W:", LA_F("%s: SUB heartbeat stale (%llds ago, threshold %ds), may be offline",
-                        LA_F351, 351), TASK_POLL, age, P2P_PUBSUB_HEARTBEAT_SEC);
-                } else {
-                    print("I:", LA_F("%s: SUB online (heartbeat %llds ago), early nat_punch", LA_F351, 351),
-                        TASK_POLL, age);
-                    nat_punch(s, -1);  /* 提前启动 STUN 收集，nat_punch 幂等（state>=PUNCHING 时跳过）*/
-                }
+    if (r >= 0) {
+        if (strncmp(probe, "ONLINE:", 7) == 0) {
+            time_t sub_ts = (time_t)strtoll(probe + 7, NULL, 10);
+            time_t now_sec = time(NULL);
+            long long age = (long long)(now_sec - sub_ts);
+            if (age > P2P_PUBSUB_HEARTBEAT_SEC) {
+                print("W:", LA_F("%s: SUB heartbeat stale (%llds ago, threshold %ds), may be offline",
+                    LA_F351, 351), TASK_POLL, age, P2P_PUBSUB_HEARTBEAT_SEC);
             } else {
-                print("W:", LA_F("%s: SUB gist not ONLINE (content: %.20s...)", LA_F351, 351),
-                    TASK_POLL, probe);
+                print("I:", LA_F("%s: SUB online (heartbeat %llds ago), early nat_punch", LA_F351, 351),
+                    TASK_POLL, age);
+                nat_punch(s, -1);  /* 提前启动 STUN 收集，nat_punch 幂等（state>=PUNCHING 时跳过）*/
             }
         } else {
-            print("W:", LA_F("%s: cannot read SUB gist %s", LA_F351, 351),
-                  TASK_POLL, sess->remote_gist_id);
+            print("W:", LA_F("%s: SUB gist not ONLINE (content: %.20s...)", LA_F351, 351),
+                TASK_POLL, probe);
         }
-    }  /* !resend */
+    } else {
+        print("W:", LA_F("%s: cannot read SUB gist %s", LA_F351, 351),
+              TASK_POLL, sess->remote_gist_id);
+    }
+}
 
-    /* 构造 offer: "OFFER:<local_gist_id>:<peer_id>" */
-    char offer[256];
-    snprintf(offer, sizeof(offer), "OFFER:%s:%s", ctx->local_gist_id, ctx->local_peer_id);
+static void on_offer_sent(struct p2p_instance *inst, struct p2p_session *s,
+                          const p2p_pubsub_job_t *job, int r, const char *content) {
+    (void)content;
+    p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
 
-    if (gist_write(ctx, sess->remote_gist_id, sess->remote_peer_id, offer) == 0) {
+    if (r == 0) {
         sess->offer_sent = 1;  /* 已写入，待确认 */
+        sess->poll_idle = 0;
         print("I:", LA_F("%s: offer %s (my gist=%s)", LA_F260, 260),
-              TASK_PUBLISH, resend ? "resent" : "sent", ctx->local_gist_id);
+              TASK_PUBLISH, job->arg[0] ? "resent" : "sent", inst->sig_ctx.pubsub.local_gist_id);
     } else {
         print("W:", LA_F("%s: send offer failed", LA_F439, 439), TASK_PUBLISH);
     }
 }
 
+static void sync0_offer(struct p2p_instance *inst, struct p2p_session *s, bool resend) {
+    p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
+    p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
+
+    /* 首次发送时：清除本端 Gist 文件（防止对端读到上一轮残留的 SDP ver=0），并探测 SUB 心跳
+     * resend 时跳过（文件已在首次发送时清除）*/
+    if (!resend) {
+        gist_write(ctx, s, ctx->local_gist_id, ctx->local_peer_id, "CLEAR", NULL, 0, 0);
+        gist_poll(ctx, s, sess->remote_gist_id, sess->remote_peer_id, on_probe);
+    }
+
+    /* 构造 offer: "OFFER:<local_gist_id>:<peer_id>" */
+    char offer[256];
+    snprintf(offer, sizeof(offer), "OFFER:%s:%s", ctx->local_gist_id, ctx->local_peer_id);
+
+    if (gist_write(ctx, s, sess->remote_gist_id, sess->remote_peer_id, offer, on_offer_sent, resend, 0) != 0)
+        print("W:", LA_F("%s: send offer failed", LA_F439, 439), TASK_PUBLISH);
+}
+
 
 /*
  * GET remote_gist
@@ -368,12 +861,13 @@ static void sync0_offer(struct p2p_instance *inst, struct p2p_session *s, bool r
  *   "OFFER:*"  → SUB 尚未响应
  *   其他        → 解码候选 → SYNCING
  */
-static void poll_answer(struct p2p_instance *inst, struct p2p_session *s) {
-    p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
+static void on_answer(struct p2p_instance *inst, struct p2p_session *s,
+                      const p2p_pubsub_job_t *job, int r, const char *content) {
+    (void)job;
     p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
 
-    char content[4096];
-    if (gist_poll(ctx, sess->remote_gist_id, sess->remote_peer_id, content, (int)sizeof(content)) != 0) {
+    poll_mark(sess, r);
+    if (r < 0) {
         print("V:", LA_F("%s: SUB gist empty, waiting", LA_F142, 142), TASK_POLL);
         return;
     }
@@ -395,10 +889,11 @@ static void poll_answer(struct p2p_instance *inst, struct p2p_session *s) {
         return;
     }
 
-    /* SUB 已响应，内容是候选数据: "<ver>:<b64>" */
-    char *colon = strchr(content, ':');
-    if (!colon) return;
-    int ver = atoi(content);
+    /* SUB 已响应，内容是候选数据 */
+    cand_msg_t m;
+    if (!cand_parse(content, &m)) return;
+    int ver = m.ver;
+    cand_take_ack(sess, &m);
 
     /* 首次 poll 就读到 ver=0（终版）：上一轮残留，跳过 */
     if (ver == 0 && sess->remote_sync_ver == -1) {
@@ -409,14 +904,15 @@ static void poll_answer(struct p2p_instance *inst, struct p2p_session *s) {
     }
     sess->remote_sync_ver = ver;
 
-    uint8_t key[8];
-    derive_key(ctx->auth_key, key);
-
-    int added = unpack_remote_candidates(s, key, colon + 1);
+    int added = cand_apply(inst, s, &m);
     if (added > 0) {
         print("I:", LA_F("%s: SUB responded with %d candidates (ver=%d)", LA_F351, 351),
               TASK_POLL, added, ver);
         if (ver == 0) {
+            if (!s->remote_cand_done) {
+                P2P_TRACE(s, P2P_TRACE_SIG, 0, 0, 0, 0, 0, 0, "cands_done");
+                p2p_setup_mark(s, P2P_SETUP_CANDS_DONE, p2p_now_ms());
+            }
             s->remote_cand_done = true;
         }
         nat_punch(s, -1);
@@ -430,72 +926,107 @@ static void poll_answer(struct p2p_instance *inst, struct p2p_session *s) {
     }
 }
 
+static void poll_answer(struct p2p_instance *inst, struct p2p_session *s) {
+    p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
+    gist_poll(&inst->sig_ctx.pubsub, s, sess->remote_gist_id, sess->remote_peer_id, on_answer);
+}
+
+/*
+ * 自适应 trickle 攒批窗口
+ *
+ *   - 待发布的候选中有 host 候选：立即发布（局域网对端据此即可直连，不值得等待）
+ *   - 推送模式：写入只是一帧 WebSocket，不攒批
+ *   - 其余（srflx/relay）：基础窗口 P2P_PUBSUB_TRICKLE_BATCH_MS；若 GitHub 报告的配额
+ *     （扣除 P2P_PUBSUB_RL_RESERVE 轮询保留）不足以在重置前按此频率写入，则按
+ *     "距重置时间 / 可用配额" 放大，上限 P2P_PUBSUB_TRICKLE_MAX_MS
+ */
+static uint64_t trickle_window(struct p2p_instance *inst, struct p2p_session *s) {
+    p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
+    p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
+
+    if (ctx->push) return 0;
+    for (int i = sess->candidate_synced_count; i < s->local_cand_cnt; i++)
+        if (s->local_cands[i].type == P2P_CAND_HOST) return 0;
+
+    uint64_t win = P2P_PUBSUB_TRICKLE_BATCH_MS;
+    if (ctx->rl_reset) {
+        long long left = ctx->rl_reset - (long long)time(NULL);
+        if (left > 0) {
+            long spare = ctx->rl_remaining - P2P_PUBSUB_RL_RESERVE;
+            uint64_t gap = spare > 0 ? (uint64_t)left * 1000 / (uint64_t)spare : P2P_PUBSUB_TRICKLE_MAX_MS;
+            if (gap > win) win = gap;
+        }
+    }
+    return win < P2P_PUBSUB_TRICKLE_MAX_MS ? win : P2P_PUBSUB_TRICKLE_MAX_MS;
+}
+
 /*
  * SYNCING: 发布本端候选到自己的 Gist
  *
  * PATCH local_gist
- * 内容: version ":" base64( des_ecb( sdp_text ) )
- *   - version:  >=1 trickle 增量, 0=全部完成
- *   - sdp_text: p2p_ice_export_sdp(candidates_only=true) 输出的 "a=candidate:..." 文本
- *   - des_ecb:  密钥 derive_key(auth_key)，明文按 8 字节块对齐（补零）
- *   - base64:   标准 Base64 编码
+ * 内容: "D" version "," tag "," base "," cnt "," ack_tag "," ack_cnt ":" base64( des_ecb( lz( sdp_text ) ) )
+ *   - version:  >=1 trickle, 0=全部完成
+ *   - base:     对端已确认的本端候选数（peer_ack），只携带其后的候选
+ *   - ack_*:    本端已应用的对端候选，供对端推进它的 base
+ *   - sdp_text: cand_encode() 输出（见协议说明）
  *
- * tick_send: 有新候选时 trickle 发布（ver>=1），候选收集完毕时发终版（ver=0）。
+ * tick_send: 有新候选时 trickle 发布（ver>=1），候选收集完毕时发终版（ver=0）；
+ * republish（对端 ack 回退 / 本端 ack 需刷新）时在 SYNCING 或 READY 下重写一次。
  * 本端发布 ver=0 成功 → READY（与 relay/compact 一致，只关注本端同步完成）
  */
+static void on_candidates_sent(struct p2p_instance *inst, struct p2p_session *s,
+                               const p2p_pubsub_job_t *job, int r, const char *content) {
+    (void)inst; (void)content;
+    p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
+    int ver = job->arg[0], cnt = job->arg[1];
+
+    if (r == 0) {
+        sess->candidate_synced_count = cnt;
+        sess->poll_idle = 0;              /* 本端有更新，对端很可能随即响应 */
+        print("I:", LA_F("%s: published %d candidates (ver=%d)", LA_F260, 260),
+              TASK_PUBLISH, cnt, ver);
+
+        if (ver == 0) {
+            sess->local_sync_ver = 0;
+            sess->state = SIG_PUBSUB_SESS_READY;
+            print("I:", LA_F("%s: → READY", LA_F475, 475), TASK_PUBLISH);
+        }
+    } else {
+        print("W:", LA_F("%s: PATCH failed", LA_F439, 439), TASK_PUBLISH);
+    }
+}
+
 static void sync_candidates(struct p2p_instance *inst, struct p2p_session *s) {
     p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
     p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
 
     uint8_t key[8];
     derive_key(ctx->auth_key, key);
+    if (!sess->sync_tag) sess->sync_tag = P_rand32() | 1;
 
-    /* SDP 导出 → DES 加密 → Base64 编码 */
+    /* 只发布对端尚未确认的候选 [base, cnt) */
     int cnt = s->local_cand_cnt;
-    char sdp_buf[4096];
-    int sdp_len = p2p_ice_export_sdp(s->local_cands, cnt, sdp_buf, (int)sizeof(sdp_buf),
-                                      true, NULL, NULL, NULL);
-    if (sdp_len <= 0) return;
-
-    int padded = (sdp_len + 7) & ~7;
-    uint8_t *raw = (uint8_t *)calloc(1, (size_t)padded);
-    if (!raw) return;
-    memcpy(raw, sdp_buf, (size_t)sdp_len);
-
-    uint8_t *enc = (uint8_t *)malloc((size_t)padded);
-    if (!enc) { free(raw); return; }
-
-    p2p_des_encrypt(key, raw, (size_t)padded, enc);
-    free(raw);
-
+    int base = sess->peer_ack < cnt ? sess->peer_ack : cnt;
     char b64[4096];
-    int b64_len = p2p_base64_encode(enc, (size_t)padded, b64, (int)sizeof(b64));
-    free(enc);
-    if (b64_len <= 0) return;
+    int b64_len = cand_encode(s, key, base, cnt, b64, (int)sizeof(b64));
+    if (b64_len < 0) return;
 
-    /* 版本号: >=1 trickle 增量, 0=全部完成 */
+    /* 版本号: >=1 trickle, 0=全部完成 */
     bool final = !P2P_CAND_PENDING(inst);
     int ver = final ? 0 : ++sess->local_sync_ver;
 
     char payload[4200];
-    snprintf(payload, sizeof(payload), "%d:%s", ver, b64);
+    snprintf(payload, sizeof(payload), "D%d,%x,%d,%d,%x,%d:%s", ver, (unsigned)sess->sync_tag, base, cnt,
+             (unsigned)sess->remote_tag, sess->remote_cnt, b64);
+    sess->sync_base = base;
+    sess->ack_sent_tag = sess->remote_tag;
+    sess->ack_sent_cnt = sess->remote_cnt;
+    sess->republish = false;
 
     print("I:", LA_F("%s: publishing %d candidates (ver=%d) to local gist", LA_F423, 423),
-          TASK_PUBLISH, s->local_cand_cnt, ver);
+          TASK_PUBLISH, cnt - base, ver);
 
-    if (gist_write(ctx, ctx->local_gist_id, ctx->local_peer_id, payload) == 0) {
-        sess->candidate_synced_count = s->local_cand_cnt;
-        print("I:", LA_F("%s: published %d candidates (ver=%d)", LA_F260, 260),
-              TASK_PUBLISH, s->local_cand_cnt, ver);
-
-        if (final) {
-            sess->local_sync_ver = 0;
-            sess->state = SIG_PUBSUB_SESS_READY;
-            print("I:", LA_F("%s: → READY", LA_F475, 475), TASK_PUBLISH);
-        }
-    } else {
-        print("W:", LA_F("%s: PATCH failed", LA_F439, 439), TASK_PUBLISH);
-    }
+    gist_write(ctx, s, ctx->local_gist_id, ctx->local_peer_id, payload, on_candidates_sent, ver, cnt);
 }
 
 /*
@@ -506,12 +1037,13 @@ static void sync_candidates(struct p2p_instance *inst, struct p2p_session *s) {
  *   "OFFER:*"     → 跳过（对端尚未发布候选）
  *   "<ver>:<b64>" → 解码候选，ver==0 表示对端全部完成
  */
-static void poll_candidates(struct p2p_instance *inst, struct p2p_session *s) {
-    p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
+static void on_candidates(struct p2p_instance *inst, struct p2p_session *s,
+                          const p2p_pubsub_job_t *job, int r, const char *content) {
+    (void)job;
     p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
 
-    char content[4096];
-    if (gist_poll(ctx, sess->remote_gist_id, sess->remote_peer_id, content, (int)sizeof(content)) != 0) {
+    poll_mark(sess, r);
+    if (r < 0) {
         print("V:", LA_F("%s: GET %s — empty or failed", LA_F142, 142), TASK_POLL, sess->remote_gist_id);
         return;
     }
@@ -519,11 +1051,12 @@ static void poll_candidates(struct p2p_instance *inst, struct p2p_session *s) {
     /* 跳过 offer 内容（可能是 PUB 还没发布候选）*/
     if (strncmp(content, "OFFER:", 6) == 0) return;
 
-    /* 解析版本号: "<ver>:<b64>" */
-    char *colon = strchr(content, ':');
-    if (!colon) return;
-    int ver = atoi(content);
-    if (ver == sess->remote_sync_ver) return;  /* 同版本已处理 */
+    /* 解析候选消息，先处理搭载的 ack（即使候选本身已应用过）*/
+    cand_msg_t m;
+    if (!cand_parse(content, &m)) return;
+    int ver = m.ver;
+    cand_take_ack(sess, &m);
+    if (cand_seen(sess, &m)) return;           /* 已处理 */
 
     /* 首次 poll 就读到 ver=0（终版）：上一轮残留，跳过 */
     if (ver == 0 && sess->remote_sync_ver == -1) {
@@ -534,10 +1067,8 @@ static void poll_candidates(struct p2p_instance *inst, struct p2p_session *s) {
     }
     sess->remote_sync_ver = ver;
 
-    uint8_t key[8];
-    derive_key(ctx->auth_key, key);
-
-    int added = unpack_remote_candidates(s, key, colon + 1);
+    int added = cand_apply(inst, s, &m);
+    if (added < 0) return;
     if (added > 0) {
         print("I:", LA_F("%s: received %d candidates (ver=%d) from %s", LA_F351, 351),
               TASK_POLL, added, ver, sess->remote_gist_id);
@@ -545,10 +1076,19 @@ static void poll_candidates(struct p2p_instance *inst, struct p2p_session *s) {
 
     /* ver==0: 对端全部候选发送完成 */
     if (ver == 0) {
+        if (!s->remote_cand_done) {
+            P2P_TRACE(s, P2P_TRACE_SIG, 0, 0, 0, 0, 0, 0, "cands_done");
+            p2p_setup_mark(s, P2P_SETUP_CANDS_DONE, p2p_now_ms());
+        }
         s->remote_cand_done = true;
     }
 }
 
+static void poll_candidates(struct p2p_instance *inst, struct p2p_session *s) {
+    p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
+    gist_poll(&inst->sig_ctx.pubsub, s, sess->remote_gist_id, sess->remote_peer_id, on_candidates);
+}
+
 /* ============================================================================
  * 公共 API 实现
  * ============================================================================ */
@@ -562,11 +1102,20 @@ static void reset_peer(p2p_pubsub_session_t *sess) {
     sess->remote_peer_id[0]   = '\0';
     sess->candidate_synced_count = 0;
     sess->last_poll           = 0;
+    sess->poll_idle           = 0;
     sess->last_sync           = 0;
     sess->remote_sync_ver     = -1;
     sess->last_sub            = 0;
     sess->offer_sent          = 0;
     sess->local_sync_ver      = 0;
+    sess->sync_tag            = 0;
+    sess->sync_base           = 0;
+    sess->peer_ack            = 0;
+    sess->republish           = false;
+    sess->ack_sent_tag        = 0;
+    sess->ack_sent_cnt        = 0;
+    sess->remote_tag          = 0;
+    sess->remote_cnt          = 0;
 }
 
 /* ============================================================================
@@ -583,21 +1132,62 @@ ret_t p2p_signal_pubsub_online(struct p2p_instance *inst, const char *local_peer
         return E_INVALID;
     }
 
+    /* cfg.server_host 非空：WebSocket 推送，否则轮询 GitHub Gist */
+    if (inst->cfg.server_host && inst->cfg.server_host[0]) {
+#ifdef WITH_WSLAY
+        ctx->push = true;
+        strncpy(ctx->ws_host, inst->cfg.server_host, sizeof(ctx->ws_host) - 1);
+        ctx->ws_port = inst->cfg.server_port;
+        ctx->ws_retry = 0;                                  /* 首次 tick 立即连接 */
+        if (!gist_id) gist_id = "p2p";
+#else
+        print("E:", LA_F("ONLINE: WebSocket push requires WITH_WSLAY", LA_F570, 570));
+        return E_NO_SUPPORT;
+#endif
+    }
+    else if (!ctx->http && !(ctx->http = p2p_http_create(inst->cfg.tls_ca_file, inst->cfg.tls_insecure)))
+        return E_NONE_CONTEXT;                              /* 无可用 CA 证书包时不以未校验的连接发送 gh_token */
+
+    if (strlen(gist_id) >= sizeof(ctx->gist_shards)) {
+        print("E:", LA_F("ONLINE: gist list too long (%d > %d)", LA_F686, 686), (int)strlen(gist_id), (int)sizeof(ctx->gist_shards) - 1);
+        return E_INVALID;
+    }
+
     strncpy(ctx->local_peer_id, local_peer_id, P2P_PEER_ID_MAX - 1);
-    strncpy(ctx->auth_token, token, sizeof(ctx->auth_token) - 1);
-    strncpy(ctx->local_gist_id, gist_id, sizeof(ctx->local_gist_id) - 1);
+    if (token) strncpy(ctx->auth_token, token, sizeof(ctx->auth_token) - 1);
+    strcpy(ctx->gist_shards, gist_id);
+    gist_shard(ctx, ctx->local_peer_id, ctx->local_gist_id, sizeof(ctx->local_gist_id));
 
     if (inst->cfg.auth_key)
         strncpy(ctx->auth_key, inst->cfg.auth_key, sizeof(ctx->auth_key) - 1);
 
     ctx->state = SIG_PUBSUB_ONLINE;
 
-    print("I:", LA_F("ONLINE: local_gist=%s peer=%s", LA_F320, 320), gist_id, local_peer_id);
+    print("I:", LA_F("ONLINE: local_gist=%s peer=%s", LA_F320, 320), ctx->local_gist_id, local_peer_id);
     return E_NONE;
 }
 
 ret_t p2p_signal_pubsub_offline(struct p2p_instance *inst) {
     p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
+
+    /* 丢弃未完成的请求，关闭保活连接 */
+    for (int i = 0; i < ctx->job_cnt; i++)
+        p2p_free(ctx->jobs[(ctx->job_head + i) % P2P_PUBSUB_JOB_MAX].body);
+    ctx->job_head = ctx->job_cnt = 0;
+    ctx->job_active = false;
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) s->sig_sess.pubsub.jobs = 0;
+    p2p_http_free(ctx->http);
+    ctx->http = NULL;
+#ifdef WITH_WSLAY
+    if (ctx->ws) {
+        ws_client_close(ctx->ws, 1000);
+        ws_client_update(ctx->ws);                          /* 尽力送出 Close 帧 */
+        ws_client_destroy(ctx->ws);
+        ctx->ws = NULL;
+    }
+#endif
+    ctx->push = false;
+
     ctx->state = SIG_PUBSUB_INIT;
     print("I:", LA_F("OFFLINE", LA_F268, 268));
     return E_NONE;
@@ -619,8 +1209,10 @@ ret_t p2p_signal_pubsub_connect(struct p2p_session *s, const char *remote_addr)
         if (remote_addr && remote_addr[0]) {
             /* 重构 target 地址并比较 */
             const char *slash = strchr(remote_addr, '/');
-            const char *cmp_gist = slash ? remote_addr : ctx->local_gist_id;
-            size_t cmp_gist_len = slash ? (size_t)(slash - remote_addr) : strlen(ctx->local_gist_id);
+            char shard[sizeof(sess->remote_gist_id)];
+            if (!slash) gist_shard(ctx, remote_addr, shard, sizeof(shard));
+            const char *cmp_gist = slash ? remote_addr : shard;
+            size_t cmp_gist_len = slash ? (size_t)(slash - remote_addr) : strlen(shard);
             const char *cmp_peer = slash ? slash + 1 : remote_addr;
             if (strncmp(sess->remote_gist_id, cmp_gist, cmp_gist_len) == 0
                 && sess->remote_gist_id[cmp_gist_len] == '\0'
@@ -638,7 +1230,7 @@ ret_t p2p_signal_pubsub_connect(struct p2p_session *s, const char *remote_addr)
         sess->state = SIG_PUBSUB_SESS_WAIT_OFFER;
         print("I:", LA_F("CONNECT SUB: waiting for offer (gist=%s/%s)", 0, 0),
               ctx->local_gist_id, ctx->local_peer_id);
-        sync0_sub(s->inst, s, P_tick_ms());
+        sync0_sub(s->inst, s, p2p_now_ms());
     }
     // PUB 模式：解析对方地址，主动发起
     else {
@@ -654,9 +1246,8 @@ ret_t p2p_signal_pubsub_connect(struct p2p_session *s, const char *remote_addr)
             strncpy(sess->remote_peer_id, slash + 1, sizeof(sess->remote_peer_id) - 1);
             sess->remote_peer_id[sizeof(sess->remote_peer_id) - 1] = '\0';
         } else {
-            /* 无 "/"：同 gist 模式，remote_gist = local_gist */
-            strncpy(sess->remote_gist_id, ctx->local_gist_id, sizeof(sess->remote_gist_id) - 1);
-            sess->remote_gist_id[sizeof(sess->remote_gist_id) - 1] = '\0';
+            /* 无 "/"：同 gist 模式，remote_gist = 分片列表中对端所属的 Gist（不分片时即 local_gist）*/
+            gist_shard(ctx, remote_addr, sess->remote_gist_id, sizeof(sess->remote_gist_id));
             strncpy(sess->remote_peer_id, remote_addr, sizeof(sess->remote_peer_id) - 1);
             sess->remote_peer_id[sizeof(sess->remote_peer_id) - 1] = '\0';
         }
@@ -672,6 +1263,7 @@ ret_t p2p_signal_pubsub_connect(struct p2p_session *s, const char *remote_addr)
 
 void p2p_signal_pubsub_disconnect(struct p2p_session *s) {
     p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
+    job_cancel(&s->inst->sig_ctx.pubsub, s);
     if (!sess->remote_gist_id[0]) return;
 
     sess->state             = SIG_PUBSUB_SESS_IDLE;
@@ -695,7 +1287,7 @@ void p2p_signal_pubsub_stun_ready(struct p2p_session *s) {
     /* 首次发布：有候选则立即同步，否则等 tick_send */
     if (s->local_cand_cnt > 0 || !P2P_CAND_PENDING(s->inst)) {
         sync_candidates(s->inst, s);
-        sess->last_sync = P_tick_ms();
+        sess->last_sync = p2p_now_ms();
     }
 }
 
@@ -703,8 +1295,8 @@ void p2p_signal_pubsub_trickle_candidate(struct p2p_session *s) {
     p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
     if (sess->state != SIG_PUBSUB_SESS_SYNCING) return;
 
-    /* 还没进入 trickle 阶段（首次 sync 尚未执行）*/
-    if (!sess->last_sync) return;
+    /* 还没进入 trickle 阶段（首次 sync 尚未执行）或上一次发布尚未完成（由 tick_send 补发）*/
+    if (!sess->last_sync || sess->jobs) return;
 
     /* 无新候选 */
     if (sess->candidate_synced_count >= s->local_cand_cnt) return;
@@ -712,14 +1304,14 @@ void p2p_signal_pubsub_trickle_candidate(struct p2p_session *s) {
     /* 候选收集全部完成 → 立即发终版（绕过攒批）*/
     if (!P2P_CAND_PENDING(s->inst)) {
         sync_candidates(s->inst, s);
-        sess->last_sync = P_tick_ms();
+        sess->last_sync = p2p_now_ms();
         return;
     }
 
-    /* 攒批窗口到期 → 发 trickle */
-    if (tick_diff(P_tick_ms(), sess->last_sync) >= P2P_PUBSUB_TRICKLE_BATCH_MS) {
+    /* 攒批窗口到期（host 候选窗口为 0）→ 发 trickle */
+    if (tick_diff(p2p_now_ms(), sess->last_sync) >= trickle_window(s->inst, s)) {
         sync_candidates(s->inst, s);
-        sess->last_sync = P_tick_ms();
+        sess->last_sync = p2p_now_ms();
     }
 }
 
@@ -734,21 +1326,22 @@ void p2p_signal_pubsub_tick_recv(struct p2p_instance *inst, uint64_t now) {
     p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
     if (ctx->state < SIG_PUBSUB_ONLINE) return;
 
+    /* 先收取已完成的 HTTP 响应（回调推进状态机）*/
+    pubsub_pump(inst, now);
+
     for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
         p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
 
+        // 上一个操作的请求尚未完成
+        if (sess->jobs) continue;
+
         // SUB 等待 offer 阶段
         if (sess->state == SIG_PUBSUB_SESS_WAIT_OFFER) {
 
             // 定时监测是否收到 offer
-            if (tick_diff(now, sess->last_poll) < P2P_PUBSUB_POLL_MAILBOX_MS) continue;
+            if (tick_diff(now, sess->last_poll) < poll_interval(sess, P2P_PUBSUB_POLL_MAILBOX_MS)) continue;
             sess->last_poll = now;
-            if (!poll_offer(inst, s)) {
-
-                // 没有 offer，检查心跳是否需要刷新
-                if (tick_diff(now, sess->last_sub) >= (uint64_t)P2P_PUBSUB_HEARTBEAT_SEC * 1000)
-                    sync0_sub(inst, s, now);
-            }
+            poll_offer(inst, s);            /* 没有 offer 时由回调刷新心跳 */
             continue;
         }
 
@@ -759,7 +1352,7 @@ void p2p_signal_pubsub_tick_recv(struct p2p_instance *inst, uint64_t now) {
             // 定时监测是否收到确认或 SUB 响应
             uint64_t interval = (sess->offer_sent == 1)
                 ? P2P_PUBSUB_POLL_CONFIRM_MS    /* 待确认，快速检测和 sub 的心跳写操作的竞争 */
-                : P2P_PUBSUB_POLL_SYNC_MS;      /* 已确认，等待 SUB 响应 */
+                : poll_interval(sess, P2P_PUBSUB_POLL_SYNC_MS);     /* 已确认，等待 SUB 响应 */
             if (tick_diff(now, sess->last_poll) < interval) continue;
             sess->last_poll = now;
             poll_answer(inst, s);
@@ -767,7 +1360,7 @@ void p2p_signal_pubsub_tick_recv(struct p2p_instance *inst, uint64_t now) {
         }
 
         if (sess->state >= SIG_PUBSUB_SESS_SYNCING && sess->remote_sync_ver != 0) {
-            if (tick_diff(now, sess->last_poll) < P2P_PUBSUB_POLL_SYNC_MS) continue;
+            if (tick_diff(now, sess->last_poll) < poll_interval(sess, P2P_PUBSUB_POLL_SYNC_MS)) continue;
             sess->last_poll = now;
             poll_candidates(inst, s);
         }
@@ -784,20 +1377,25 @@ void p2p_signal_pubsub_tick_send(struct p2p_instance *inst, uint64_t now) {
     for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
         p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
 
-        if (sess->state == SIG_PUBSUB_SESS_SYNCING) {
+        if (sess->jobs) continue;
+        if (sess->state == SIG_PUBSUB_SESS_SYNCING ||
+            (sess->state == SIG_PUBSUB_SESS_READY && sess->republish)) {
 
-            /* 触发: 有新候选未发布 || 已发 trickle 但收集完毕需发终版(ver=0) */
+            /* 触发: 有新候选未发布 || 已发 trickle 但收集完毕需发终版(ver=0) || 需重写 */
             bool need_trickle = sess->candidate_synced_count < s->local_cand_cnt;
             bool need_final = !need_trickle && sess->local_sync_ver > 0 && !P2P_CAND_PENDING(inst);
-            if (!need_trickle && !need_final) continue;
+            if (!need_trickle && !need_final && !sess->republish) continue;
 
-            /* trickle 攒批：等待窗口到期再发，final 立即发 */
-            if (need_trickle && sess->last_sync &&
-                tick_diff(now, sess->last_sync) < P2P_PUBSUB_TRICKLE_BATCH_MS) continue;
+            /* trickle 攒批：等待窗口到期再发（窗口见 trickle_window），final / 重写立即发 */
+            if (need_trickle && !sess->republish && sess->last_sync &&
+                tick_diff(now, sess->last_sync) < trickle_window(inst, s)) continue;
             sync_candidates(inst, s);
             sess->last_sync = now;
         }
     }
+
+    /* 发起本轮入队的请求 */
+    pubsub_pump(inst, now);
 }
 
 /* ============================================================================
@@ -826,14 +1424,23 @@ p2p_log_callback_t p2p_log_callback = (p2p_log_callback_t)-1;
 p2p_log_level_t    p2p_log_level    = P2P_LOG_LEVEL_DEBUG;
 bool               p2p_log_pre_tag  = false;
 uint16_t           p2p_instrument_base = 0;
+P2P_TLS uint64_t   p2p_clock_ms = 0;
 
 ret_t nat_punch(struct p2p_session *s, int idx) { (void)s; (void)idx; return 0; }
 void path_stats_init(path_stats_t *st, int cost_score) { (void)st; (void)cost_score; }
+void p2p_trace_emit(struct p2p_instance *inst, uint32_t sess, int ev, int type, int seq,
+                    int a, int b, int c, int d, const char *str) {
+    (void)inst; (void)sess; (void)ev; (void)type; (void)seq; (void)a; (void)b; (void)c; (void)d; (void)str;
+}
+bool p2p_udp_v6_alias(const uint8_t ip6[16], uint16_t port, struct sockaddr_in *out) {
+    (void)ip6; (void)port; (void)out; return false;
+}
+bool p2p_udp_v6_real(const struct sockaddr_in *alias, uint8_t ip6[16]) { (void)alias; (void)ip6; return false; }
 int p2p_stun_build_ice_check(uint8_t *buf, int max_len, uint8_t tsx_id[12],
-                             const char *username, const char *password,
+                             const char *username, const p2p_hmac_sha1_ctx_t *mi,
                              uint32_t priority, int is_controlling,
                              uint64_t tie_breaker, int use_candidate) {
-    (void)buf; (void)max_len; (void)tsx_id; (void)username; (void)password;
+    (void)buf; (void)max_len; (void)tsx_id; (void)username; (void)mi;
     (void)priority; (void)is_controlling; (void)tie_breaker; (void)use_candidate;
     return 0;
 }
@@ -863,8 +1470,8 @@ static bool env_ready(void) {
 /* 创建一组可用于测试的 instance + session（calloc 保证全零初始化） */
 static void setup_with_peer(struct p2p_instance **out_inst, struct p2p_session **out_s,
                              const char *peer_id) {
-    struct p2p_instance *inst = calloc(1, sizeof(*inst));
-    struct p2p_session  *s    = calloc(1, sizeof(*s));
+    struct p2p_instance *inst = p2p_calloc(1, sizeof(*inst));
+    struct p2p_session  *s    = p2p_calloc(1, sizeof(*s));
     s->inst = inst;
     inst->sessions_head = s;
 
@@ -875,6 +1482,7 @@ static void setup_with_peer(struct p2p_instance **out_inst, struct p2p_session *
     strncpy(ctx->auth_key, env_key ? env_key : "testkey1", sizeof(ctx->auth_key) - 1);
     ctx->state = SIG_PUBSUB_ONLINE;
 
+    ctx->http = p2p_http_create(NULL, false);
     s->sig_sess.pubsub.remote_sync_ver = -1;
 
     *out_inst = inst;
@@ -886,10 +1494,45 @@ static void setup(struct p2p_instance **out_inst, struct p2p_session **out_s) {
 }
 
 static void teardown(struct p2p_instance *inst, struct p2p_session *s) {
-    free(s->local_cands);
-    free(s->remote_cands);
-    free(s);
-    free(inst);
+    p2p_signal_pubsub_offline(inst);
+    p2p_free(s->local_cands);
+    p2p_free(s->remote_cands);
+    p2p_free(s);
+    p2p_free(inst);
+}
+
+/* 推进请求队列直到全部完成（每个请求受 P2P_HTTP_TIMEOUT_MS 限制，不会无限等待）*/
+static void run_jobs(struct p2p_instance *inst) {
+    while (inst->sig_ctx.pubsub.job_cnt > 0) {
+        pubsub_pump(inst, P_tick_ms());
+        if (inst->sig_ctx.pubsub.job_cnt > 0) P_usleep(10 * 1000);
+    }
+}
+
+static int  test_r;
+static char test_content[4096];
+
+static void test_done(struct p2p_instance *inst, struct p2p_session *s,
+                      const p2p_pubsub_job_t *job, int r, const char *content) {
+    (void)inst; (void)s; (void)job;
+    test_r = r;
+    snprintf(test_content, sizeof(test_content), "%s", content ? content : "");
+}
+
+/* 同步写入 / 读取（测试用：入队后等待完成）*/
+static int test_write(struct p2p_instance *inst, struct p2p_session *s, const char *file, const char *content) {
+    test_r = -2;
+    gist_write(&inst->sig_ctx.pubsub, s, env_gist, file, content, test_done, 0, 0);
+    run_jobs(inst);
+    return test_r;
+}
+
+static int test_read(struct p2p_instance *inst, struct p2p_session *s, const char *file, char *buf, int sz) {
+    test_r = -2;
+    gist_poll(&inst->sig_ctx.pubsub, s, env_gist, file, test_done);
+    run_jobs(inst);
+    snprintf(buf, sz, "%s", test_content);
+    return test_r;
 }
 
 /* --- 测试用例 --- */
@@ -901,20 +1544,290 @@ TEST(init) {
     ASSERT_EQ(ctx.local_peer_id[0], '\0');
 }
 
+/* 自适应轮询退避与条件 GET 缓存槽位（纯本地）*/
+TEST(poll_backoff) {
+    p2p_pubsub_session_t sess;
+    memset(&sess, 0, sizeof(sess));
+
+    ASSERT_EQ(poll_interval(&sess, P2P_PUBSUB_POLL_MAILBOX_MS), P2P_PUBSUB_POLL_FAST_MS);
+    poll_mark(&sess, 1);
+    ASSERT_EQ(poll_interval(&sess, P2P_PUBSUB_POLL_MAILBOX_MS), 2 * P2P_PUBSUB_POLL_FAST_MS);
+    for (int i = 0; i < 40; i++) poll_mark(&sess, -1);
+    ASSERT_EQ(poll_interval(&sess, P2P_PUBSUB_POLL_MAILBOX_MS), P2P_PUBSUB_POLL_MAILBOX_MS);
+    ASSERT_EQ(poll_interval(&sess, P2P_PUBSUB_POLL_SYNC_MS), P2P_PUBSUB_POLL_SYNC_MS);
+    poll_mark(&sess, 0);
+    ASSERT_EQ(poll_interval(&sess, P2P_PUBSUB_POLL_SYNC_MS), P2P_PUBSUB_POLL_FAST_MS);
+
+    p2p_signal_pubsub_ctx_t ctx;
+    p2p_signal_pubsub_init(&ctx);
+    p2p_pubsub_cache_t *a = cache_slot(&ctx, "g1", "alice");
+    p2p_pubsub_cache_t *b = cache_slot(&ctx, "g1", "bob");
+    ASSERT(a != b);
+    ASSERT(cache_slot(&ctx, "g1", "alice") == a);
+
+    /* 槽位用尽时替换最久未用的 */
+    a->used = 10; b->used = 5;
+    cache_slot(&ctx, "g2", "x")->used = 20;
+    cache_slot(&ctx, "g3", "x")->used = 30;
+    p2p_pubsub_cache_t *e = cache_slot(&ctx, "g4", "x");
+    ASSERT(e == b);
+    ASSERT(cache_slot(&ctx, "g1", "alice") == a);
+}
+
+/* Gist 分片：按 peer_id 确定性地散列到列表中的一项，单个 ID 即不分片（纯本地）*/
+TEST(gist_shards) {
+    p2p_signal_pubsub_ctx_t ctx;
+    p2p_signal_pubsub_init(&ctx);
+    char g[128], g2[128];
+
+    strcpy(ctx.gist_shards, "solo");
+    gist_shard(&ctx, "alice", g, sizeof(g));
+    ASSERT(strcmp(g, "solo") == 0);
+
+    strcpy(ctx.gist_shards, "g0, g1, g2");
+    int hits[3] = {0};
+    for (int i = 0; i < 60; i++) {
+        char peer[16]; snprintf(peer, sizeof(peer), "peer%d", i);
+        gist_shard(&ctx, peer, g, sizeof(g));
+        gist_shard(&ctx, peer, g2, sizeof(g2));
+        ASSERT(strcmp(g, g2) == 0);
+        ASSERT(g[0] == 'g' && g[1] >= '0' && g[1] <= '2' && g[2] == '\0');
+        hits[g[1] - '0']++;
+    }
+    ASSERT(hits[0] && hits[1] && hits[2]);
+
+    /* 追加分片：原归属其他分片的对等体不迁移 */
+    char before[60][8];
+    for (int i = 0; i < 60; i++) {
+        char peer[16]; snprintf(peer, sizeof(peer), "peer%d", i);
+        gist_shard(&ctx, peer, before[i], sizeof(before[i]));
+    }
+    strcpy(ctx.gist_shards, "g0, g1, g2, g3");
+    for (int i = 0; i < 60; i++) {
+        char peer[16]; snprintf(peer, sizeof(peer), "peer%d", i);
+        gist_shard(&ctx, peer, g, sizeof(g));
+        ASSERT(strcmp(g, "g3") == 0 || strcmp(g, before[i]) == 0);
+    }
+}
+
+/* 请求队列：满队拒绝、按会话计数、取消后的请求不发起也不回调（纯本地）*/
+TEST(job_queue) {
+    struct p2p_instance inst;
+    struct p2p_session s;
+    memset(&inst, 0, sizeof(inst));
+    memset(&s, 0, sizeof(s));
+    s.inst = &inst;
+    inst.sessions_head = &s;
+    p2p_signal_pubsub_ctx_t *ctx = &inst.sig_ctx.pubsub;
+    ctx->http = p2p_http_create(NULL, false);
+    ASSERT(ctx->http != NULL);
+
+    for (int i = 0; i < P2P_PUBSUB_JOB_MAX; i++)
+        ASSERT_EQ(gist_poll(ctx, &s, "g", "f", test_done), 0);
+    ASSERT_EQ(gist_write(ctx, &s, "g", "f", "overflow", test_done, 0, 0), -1);
+    ASSERT_EQ(s.sig_sess.pubsub.jobs, P2P_PUBSUB_JOB_MAX);
+
+    job_cancel(ctx, &s);
+    ASSERT_EQ(s.sig_sess.pubsub.jobs, 0);
+    ASSERT_EQ(ctx->job_cnt, P2P_PUBSUB_JOB_MAX);
+
+    test_r = -2;
+    pubsub_pump(&inst, P_tick_ms());
+    ASSERT_EQ(ctx->job_cnt, 0);
+    ASSERT(!p2p_http_busy(ctx->http));
+    ASSERT_EQ(test_r, -2);
+
+    /* 下线时释放未完成请求的请求体 */
+    ASSERT_EQ(gist_write(ctx, &s, "g", "f", "pending", NULL, 0, 0), 0);
+    p2p_signal_pubsub_offline(&inst);
+    ASSERT_EQ(ctx->job_cnt, 0);
+    ASSERT_EQ(s.sig_sess.pubsub.jobs, 0);
+    ASSERT(ctx->http == NULL);
+}
+
+/* WebSocket 推送缓存：只保留相关文件，新内容唤醒会话，读取区分有无变化（纯本地）*/
+TEST(push_cache) {
+    struct p2p_instance inst;
+    struct p2p_session s;
+    memset(&inst, 0, sizeof(inst));
+    memset(&s, 0, sizeof(s));
+    s.inst = &inst;
+    inst.sessions_head = &s;
+    p2p_signal_pubsub_ctx_t *ctx = &inst.sig_ctx.pubsub;
+    p2p_pubsub_session_t *sess = &s.sig_sess.pubsub;
+    strcpy(ctx->local_gist_id, "g");
+    strcpy(ctx->local_peer_id, "alice");
+    strcpy(sess->remote_gist_id, "g");
+    strcpy(sess->remote_peer_id, "bob");
+    sess->last_poll = 1234;
+    sess->poll_idle = 5;
+
+    p2p_pubsub_job_t job;
+    memset(&job, 0, sizeof(job));
+    strcpy(job.gist_id, "g");
+    strcpy(job.filename, "bob");
+    char buf[4096];
+    ASSERT_EQ(push_read(ctx, &job, buf, sizeof(buf)), -1);
+
+    push_apply(&inst, "{\"gist\":\"g\",\"files\":{\"bob\":{\"content\":\"1:candidates_b64\"}}}");
+    ASSERT_EQ(sess->last_poll, 0);
+    ASSERT_EQ(sess->poll_idle, 0);
+    ASSERT_EQ(push_read(ctx, &job, buf, sizeof(buf)), 0);
+    ASSERT(strcmp(buf, "1:candidates_b64") == 0);
+    ASSERT_EQ(push_read(ctx, &job, buf, sizeof(buf)), 1);
+
+    /* 重复内容（如中继回显）不算变化 */
+    sess->last_poll = 1234;
+    push_apply(&inst, "{\"gist\":\"g\",\"files\":{\"bob\":{\"content\":\"1:candidates_b64\"}}}");
+    ASSERT_EQ(sess->last_poll, 1234);
+    ASSERT_EQ(push_read(ctx, &job, buf, sizeof(buf)), 1);
+
+    /* 与本端无关的文件不占缓存 */
+    push_apply(&inst, "{\"gist\":\"g\",\"files\":{\"carol\":{\"content\":\"OFFER:x:y_padding\"}}}");
+    strcpy(job.filename, "carol");
+    ASSERT_EQ(push_read(ctx, &job, buf, sizeof(buf)), -1);
+
+    /* 本端信箱 */
+    push_apply(&inst, "{\"gist\":\"g\",\"files\":{\"alice\":{\"content\":\"OFFER:g:bob\"}}}");
+    strcpy(job.filename, "alice");
+    ASSERT_EQ(push_read(ctx, &job, buf, sizeof(buf)), 0);
+    ASSERT(strcmp(buf, "OFFER:g:bob") == 0);
+}
+
+/* 自适应 trickle 窗口：host 立即、srflx 攒批、配额紧张时放大（纯本地）*/
+TEST(trickle_window) {
+    struct p2p_instance inst;
+    struct p2p_session s;
+    p2p_local_candidate_entry_t cands[3];
+    memset(&inst, 0, sizeof(inst));
+    memset(&s, 0, sizeof(s));
+    memset(cands, 0, sizeof(cands));
+    s.inst = &inst;
+    s.local_cands = cands;
+    s.local_cand_cnt = 2;
+    cands[0].type = P2P_CAND_HOST;
+    cands[1].type = P2P_CAND_SRFLX;
+    cands[2].type = P2P_CAND_RELAY;
+    p2p_signal_pubsub_ctx_t *ctx = &inst.sig_ctx.pubsub;
+    p2p_pubsub_session_t *sess = &s.sig_sess.pubsub;
+
+    ASSERT_EQ(trickle_window(&inst, &s), 0);                 /* host 未发布 */
+    sess->candidate_synced_count = 1;
+    ASSERT_EQ(trickle_window(&inst, &s), P2P_PUBSUB_TRICKLE_BATCH_MS);
+
+    /* 配额充足：不放大 */
+    ctx->rl_remaining = 4000;
+    ctx->rl_reset = (long long)time(NULL) + 1800;
+    ASSERT_EQ(trickle_window(&inst, &s), P2P_PUBSUB_TRICKLE_BATCH_MS);
+
+    /* 重置前只剩 100 次可用（扣除保留）：1800s / 100 = 18s → 上限 */
+    ctx->rl_remaining = P2P_PUBSUB_RL_RESERVE + 100;
+    ASSERT_EQ(trickle_window(&inst, &s), P2P_PUBSUB_TRICKLE_MAX_MS);
+    ctx->rl_remaining = P2P_PUBSUB_RL_RESERVE + 600;
+    uint64_t w = trickle_window(&inst, &s);
+    ASSERT(w > P2P_PUBSUB_TRICKLE_BATCH_MS && w < P2P_PUBSUB_TRICKLE_MAX_MS);
+    ctx->rl_remaining = 0;
+    ASSERT_EQ(trickle_window(&inst, &s), P2P_PUBSUB_TRICKLE_MAX_MS);
+
+    /* 新到 relay 候选仍攒批；推送模式不攒批 */
+    s.local_cand_cnt = 3;
+    ASSERT_EQ(trickle_window(&inst, &s), P2P_PUBSUB_TRICKLE_MAX_MS);
+    ctx->push = true;
+    ASSERT_EQ(trickle_window(&inst, &s), 0);
+}
+
 /*
  * gist_roundtrip: 写入→读回 验证基础 HTTP 通道
  */
+/* 候选增量：编码/解析、ack 推进 base、重复与缺口处理（纯本地）*/
+static void cand_fill(p2p_local_candidate_entry_t *c, const char *ip, int port) {
+    c->type = P2P_CAND_HOST;
+    c->addr.sin_family = AF_INET;
+    c->addr.sin_port = htons((uint16_t)port);
+    inet_pton(AF_INET, ip, &c->addr.sin_addr);
+    c->priority = p2p_ice_calc_priority(P2P_ICE_CAND_HOST, 65535, 1);
+}
+
+TEST(cand_delta) {
+    static struct p2p_instance inst_a, inst_b;
+    static struct p2p_session s_a, s_b;
+    p2p_local_candidate_entry_t cands[3];
+    p2p_remote_candidate_entry_t rcands[8];
+    memset(cands, 0, sizeof(cands));
+    s_a.inst = &inst_a; s_b.inst = &inst_b;
+    s_a.local_cands = cands;
+    s_b.remote_cands = rcands; s_b.remote_cand_cap = 8;
+    strcpy(inst_a.sig_ctx.pubsub.auth_key, "testkey1");
+    strcpy(inst_b.sig_ctx.pubsub.auth_key, "testkey1");
+    p2p_pubsub_session_t *pa = &s_a.sig_sess.pubsub, *pb = &s_b.sig_sess.pubsub;
+    pa->remote_sync_ver = pb->remote_sync_ver = -1;
+    pa->sync_tag = 0xa1; pb->sync_tag = 0xb2;
+    cand_fill(&cands[0], "192.168.1.10", 1000);
+    cand_fill(&cands[1], "192.168.1.11", 1001);
+    cand_fill(&cands[2], "10.0.0.12", 1002);
+
+    uint8_t key[8];
+    derive_key("testkey1", key);
+    char b64[4096], payload[4200];
+
+    /* A 首次发布 2 个候选 → B 全部应用，ack = (a1, 2) */
+    s_a.local_cand_cnt = 2;
+    ASSERT(cand_encode(&s_a, key, 0, 2, b64, sizeof(b64)) > 0);
+    snprintf(payload, sizeof(payload), "D1,a1,0,2,0,0:%s", b64);
+    on_candidates(&inst_b, &s_b, NULL, 0, payload);
+    ASSERT_EQ(s_b.remote_cand_cnt, 2);
+    ASSERT_EQ(pb->remote_tag, 0xa1);
+    ASSERT_EQ(pb->remote_cnt, 2);
+
+    /* 同一内容再次读到：不重复处理 */
+    on_candidates(&inst_b, &s_b, NULL, 0, payload);
+    ASSERT_EQ(s_b.remote_cand_cnt, 2);
+
+    /* B 的文件搭载 ack → A 的下一次发布从 2 开始，且比全量短 */
+    pa->candidate_synced_count = 2;
+    on_candidates(&inst_a, &s_a, NULL, 0, "D1,b2,0,0,a1,2:");
+    ASSERT_EQ(pa->peer_ack, 2);
+    ASSERT(!pa->republish);
+    s_a.local_cand_cnt = 3;
+    int full = cand_encode(&s_a, key, 0, 3, b64, sizeof(b64));
+    int delta = cand_encode(&s_a, key, 2, 3, b64, sizeof(b64));
+    ASSERT(delta > 0 && delta < full);
+    snprintf(payload, sizeof(payload), "D0,a1,2,3,b2,0:%s", b64);
+    on_candidates(&inst_b, &s_b, NULL, 0, payload);
+    ASSERT_EQ(s_b.remote_cand_cnt, 3);
+    ASSERT_EQ(ntohs(rcands[2].addr.sin_port), 1002);
+    ASSERT_EQ(pb->remote_cnt, 3);
+    ASSERT(s_b.remote_cand_done);
+
+    /* 增量与已应用部分不衔接（其他会话标签）：不应用，安排刷新 ack */
+    cand_msg_t m;
+    ASSERT(cand_parse("D3,c3,2,3,0,0:", &m));
+    ASSERT_EQ(cand_apply(&inst_b, &s_b, &m), -1);
+    ASSERT(pb->republish);
+
+    /* 对端 ack 回退到上次发布的 base 之下 → 重新发布 */
+    pa->sync_base = 2;
+    on_candidates(&inst_a, &s_a, NULL, 0, "D2,b2,0,0,ffff,0:");
+    ASSERT_EQ(pa->peer_ack, 0);
+    ASSERT(pa->republish);
+
+    /* 旧格式与非法格式 */
+    ASSERT(cand_parse("7:QUJD", &m));
+    ASSERT(!m.delta);
+    ASSERT_EQ(m.ver, 7);
+    ASSERT(!cand_parse("D1,a1,3,2,0,0:", &m));
+    ASSERT(!cand_parse("D1,a1:", &m));
+}
+
 TEST(gist_roundtrip) {
     if (!env_ready()) { printf("SKIP (no env)\n"); return; }
     struct p2p_instance *inst; struct p2p_session *s;
     setup(&inst, &s);
-    p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
-
-    int ret = gist_write(ctx, env_gist, "test_pub", "TEST_ROUNDTRIP:hello");
+    int ret = test_write(inst, s, "test_pub", "TEST_ROUNDTRIP:hello");
     ASSERT_EQ(ret, 0);
 
     char buf[4096];
-    ret = gist_poll(ctx, env_gist, "test_pub", buf, sizeof(buf));
+    ret = test_read(inst, s, "test_pub", buf, sizeof(buf));
     ASSERT_EQ(ret, 0);
     ASSERT(strncmp(buf, "TEST_ROUNDTRIP:hello", 20) == 0);
 
@@ -928,12 +1841,11 @@ TEST(heartbeat_write) {
     if (!env_ready()) { printf("SKIP (no env)\n"); return; }
     struct p2p_instance *inst; struct p2p_session *s;
     setup(&inst, &s);
-    p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
-
     sync0_sub(inst, s, P_tick_ms());
+    run_jobs(inst);
 
     char buf[4096];
-    int ret = gist_poll(ctx, env_gist, "test_pub", buf, sizeof(buf));
+    int ret = test_read(inst, s, "test_pub", buf, sizeof(buf));
     ASSERT_EQ(ret, 0);
     ASSERT(strncmp(buf, "ONLINE:", 7) == 0);
     /* 检查 peer_id 出现在末尾 */
@@ -949,22 +1861,22 @@ TEST(offer_write) {
     if (!env_ready()) { printf("SKIP (no env)\n"); return; }
     struct p2p_instance *inst; struct p2p_session *s;
     setup(&inst, &s);
-    p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
     p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
 
     /* 先写入心跳，让 sync0_offer 读到有效内容（同一个 gist 充当 remote） */
-    gist_write(ctx, env_gist, "remote_sub", "ONLINE:9999999999:remote_sub");
+    test_write(inst, s, "remote_sub", "ONLINE:9999999999:remote_sub");
 
     sess->is_pub = true;
     strncpy(sess->remote_gist_id, env_gist, sizeof(sess->remote_gist_id) - 1);
     strncpy(sess->remote_peer_id, "remote_sub", sizeof(sess->remote_peer_id) - 1);
     sync0_offer(inst, s, false);
+    run_jobs(inst);
 
     ASSERT_EQ(sess->offer_sent, 1);
 
     /* 读回验证 offer 格式 */
     char buf[4096];
-    int ret = gist_poll(ctx, env_gist, "remote_sub", buf, sizeof(buf));
+    int ret = test_read(inst, s, "remote_sub", buf, sizeof(buf));
     ASSERT_EQ(ret, 0);
     ASSERT(strncmp(buf, "OFFER:", 6) == 0);
     ASSERT(strstr(buf, env_gist) != NULL);       /* 包含本端 gist id */
@@ -980,7 +1892,6 @@ TEST(offer_detect) {
     if (!env_ready()) { printf("SKIP (no env)\n"); return; }
     struct p2p_instance *inst; struct p2p_session *s;
     setup(&inst, &s);
-    p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
     p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
 
     sess->is_pub = false;
@@ -989,10 +1900,10 @@ TEST(offer_detect) {
     /* 模拟 PUB 端写入 offer（用同一个 gist，remote_gist 写个假 ID 区分） */
     char fake_offer[256];
     snprintf(fake_offer, sizeof(fake_offer), "OFFER:%s:remote_pub", "fake_remote_gist_id_0123456789ab");
-    gist_write(ctx, env_gist, "test_pub", fake_offer);
+    test_write(inst, s, "test_pub", fake_offer);
 
-    bool found = poll_offer(inst, s);
-    ASSERT(found);
+    poll_offer(inst, s);
+    run_jobs(inst);
     ASSERT(strcmp(sess->remote_gist_id, "fake_remote_gist_id_0123456789ab") == 0);
     ASSERT(strcmp(sess->remote_peer_id, "remote_pub") == 0);
     /* nat_punch 是 fake，不涉及 WAIT_STUN → 应进入 SYNCING */
@@ -1017,7 +1928,7 @@ TEST(candidate_roundtrip) {
     sess_a->state = SIG_PUBSUB_SESS_SYNCING;
 
     /* 注入一个 host 候选 */
-    s_a->local_cands = calloc(4, sizeof(p2p_local_candidate_entry_t));
+    s_a->local_cands = p2p_calloc(4, sizeof(p2p_local_candidate_entry_t));
     s_a->local_cand_cap = 4;
     s_a->local_cand_cnt = 1;
     s_a->local_cands[0].type = P2P_CAND_HOST;
@@ -1032,6 +1943,7 @@ TEST(candidate_roundtrip) {
     inst_a->turn_pending = 0;
 
     sync_candidates(inst_a, s_a);
+    run_jobs(inst_a);
     ASSERT_EQ(sess_a->state, SIG_PUBSUB_SESS_READY);  /* final → READY */
 
     /* --- B 端：读取候选 --- */
@@ -1043,10 +1955,11 @@ TEST(candidate_roundtrip) {
     strncpy(sess_b->remote_peer_id, "test_pub", sizeof(sess_b->remote_peer_id) - 1);
 
     /* 分配远端候选缓冲 */
-    s_b->remote_cands = calloc(16, sizeof(p2p_remote_candidate_entry_t));
+    s_b->remote_cands = p2p_calloc(16, sizeof(p2p_remote_candidate_entry_t));
     s_b->remote_cand_cap = 16;
 
     poll_candidates(inst_b, s_b);
+    run_jobs(inst_b);
 
     ASSERT_GE(s_b->remote_cand_cnt, 1);
     ASSERT_EQ(s_b->remote_cands[0].type, P2P_CAND_HOST);
@@ -1064,7 +1977,6 @@ TEST(poll_answer_heartbeat_resend) {
     if (!env_ready()) { printf("SKIP (no env)\n"); return; }
     struct p2p_instance *inst; struct p2p_session *s;
     setup(&inst, &s);
-    p2p_signal_pubsub_ctx_t *ctx = &inst->sig_ctx.pubsub;
     p2p_pubsub_session_t *sess = &s->sig_sess.pubsub;
 
     sess->is_pub = true;
@@ -1074,16 +1986,17 @@ TEST(poll_answer_heartbeat_resend) {
     strncpy(sess->remote_peer_id, "remote_sub", sizeof(sess->remote_peer_id) - 1);
 
     /* 写入心跳，模拟 offer 被覆盖 */
-    gist_write(ctx, env_gist, "remote_sub", "ONLINE:9999999999:remote_sub");
+    test_write(inst, s, "remote_sub", "ONLINE:9999999999:remote_sub");
 
     poll_answer(inst, s);
+    run_jobs(inst);
 
     /* poll_answer 检测到 ONLINE → 重发 offer */
     ASSERT_EQ(sess->offer_sent, 1);  /* resend 后 offer_sent=1 */
 
     /* 验证现在又是 offer */
     char buf[4096];
-    gist_poll(ctx, env_gist, "remote_sub", buf, sizeof(buf));
+    test_read(inst, s, "remote_sub", buf, sizeof(buf));
     ASSERT(strncmp(buf, "OFFER:", 6) == 0);
 
     teardown(inst, s);
@@ -1109,22 +2022,21 @@ TEST(same_gist_e2e) {
     /* === 创建 alice (SUB) 和 bob (PUB) === */
     struct p2p_instance *inst_a; struct p2p_session *s_a;
     setup_with_peer(&inst_a, &s_a, "alice");
-    p2p_signal_pubsub_ctx_t *ctx_a = &inst_a->sig_ctx.pubsub;
     p2p_pubsub_session_t *sess_a = &s_a->sig_sess.pubsub;
 
     struct p2p_instance *inst_b; struct p2p_session *s_b;
     setup_with_peer(&inst_b, &s_b, "bob");
-    p2p_signal_pubsub_ctx_t *ctx_b = &inst_b->sig_ctx.pubsub;
     p2p_pubsub_session_t *sess_b = &s_b->sig_sess.pubsub;
 
     /* === 步骤 1: alice (SUB) 写心跳 === */
     sess_a->is_pub = false;
     sess_a->state = SIG_PUBSUB_SESS_WAIT_OFFER;
     sync0_sub(inst_a, s_a, P_tick_ms());
+    run_jobs(inst_a);
 
     /* 验证心跳写到了 gist/alice */
     char buf[4096];
-    int ret = gist_poll(ctx_b, env_gist, "alice", buf, sizeof(buf));
+    int ret = test_read(inst_b, s_b, "alice", buf, sizeof(buf));
     ASSERT_EQ(ret, 0);
     ASSERT(strncmp(buf, "ONLINE:", 7) == 0);
     ASSERT(strstr(buf, ":alice") != NULL);
@@ -1137,10 +2049,11 @@ TEST(same_gist_e2e) {
     strncpy(sess_b->remote_gist_id, env_gist, sizeof(sess_b->remote_gist_id) - 1);
     strncpy(sess_b->remote_peer_id, "alice", sizeof(sess_b->remote_peer_id) - 1);
     sync0_offer(inst_b, s_b, false);
+    run_jobs(inst_b);
     ASSERT_EQ(sess_b->offer_sent, 1);
 
     /* 验证 alice 的文件被覆写为 offer */
-    ret = gist_poll(ctx_a, env_gist, "alice", buf, sizeof(buf));
+    ret = test_read(inst_a, s_a, "alice", buf, sizeof(buf));
     ASSERT_EQ(ret, 0);
     ASSERT(strncmp(buf, "OFFER:", 6) == 0);
     ASSERT(strstr(buf, ":bob") != NULL);
@@ -1149,8 +2062,8 @@ TEST(same_gist_e2e) {
     sleep(1);
 
     /* === 步骤 3: alice 检测 offer → SYNCING === */
-    bool found = poll_offer(inst_a, s_a);
-    ASSERT(found);
+    poll_offer(inst_a, s_a);
+    run_jobs(inst_a);
     ASSERT(strcmp(sess_a->remote_gist_id, env_gist) == 0);
     ASSERT(strcmp(sess_a->remote_peer_id, "bob") == 0);
     ASSERT_EQ(sess_a->state, SIG_PUBSUB_SESS_SYNCING);
@@ -1161,7 +2074,7 @@ TEST(same_gist_e2e) {
 
     /* === 步骤 4: alice 发布候选到 gist/alice === */
     sess_a->state = SIG_PUBSUB_SESS_SYNCING;
-    s_a->local_cands = calloc(4, sizeof(p2p_local_candidate_entry_t));
+    s_a->local_cands = p2p_calloc(4, sizeof(p2p_local_candidate_entry_t));
     s_a->local_cand_cap = 4;
     s_a->local_cand_cnt = 1;
     s_a->local_cands[0].type = P2P_CAND_HOST;
@@ -1172,6 +2085,7 @@ TEST(same_gist_e2e) {
     inst_a->srflx_count = 0; inst_a->srflx_active = 0; inst_a->turn_pending = 0;
 
     sync_candidates(inst_a, s_a);
+    run_jobs(inst_a);
     ASSERT_EQ(sess_a->state, SIG_PUBSUB_SESS_READY);
     printf("  [4] alice published candidates → READY ok\n");
 
@@ -1181,11 +2095,12 @@ TEST(same_gist_e2e) {
     sess_b->state = SIG_PUBSUB_SESS_OFFERING;
     sess_b->offer_sent = 2;  /* 已确认 */
 
-    s_b->remote_cands = calloc(16, sizeof(p2p_remote_candidate_entry_t));
+    s_b->remote_cands = p2p_calloc(16, sizeof(p2p_remote_candidate_entry_t));
     s_b->remote_cand_cap = 16;
 
     /* poll_answer 检测到候选数据 → SYNCING */
     poll_answer(inst_b, s_b);
+    run_jobs(inst_b);
     ASSERT_GE(s_b->remote_cand_cnt, 1);
     ASSERT_EQ(ntohs(s_b->remote_cands[0].addr.sin_port), 10001);
     ASSERT(sess_b->state >= SIG_PUBSUB_SESS_SYNCING);
@@ -1195,7 +2110,7 @@ TEST(same_gist_e2e) {
 
     /* === 步骤 6: bob 发布候选到 gist/bob === */
     sess_b->state = SIG_PUBSUB_SESS_SYNCING;
-    s_b->local_cands = calloc(4, sizeof(p2p_local_candidate_entry_t));
+    s_b->local_cands = p2p_calloc(4, sizeof(p2p_local_candidate_entry_t));
     s_b->local_cand_cap = 4;
     s_b->local_cand_cnt = 1;
     s_b->local_cands[0].type = P2P_CAND_HOST;
@@ -1206,16 +2121,18 @@ TEST(same_gist_e2e) {
     inst_b->srflx_count = 0; inst_b->srflx_active = 0; inst_b->turn_pending = 0;
 
     sync_candidates(inst_b, s_b);
+    run_jobs(inst_b);
     ASSERT_EQ(sess_b->state, SIG_PUBSUB_SESS_READY);
     printf("  [6] bob published candidates → READY ok\n");
 
     sleep(1);
 
     /* === 步骤 7: alice 读 gist/bob 获取候选 === */
-    s_a->remote_cands = calloc(16, sizeof(p2p_remote_candidate_entry_t));
+    s_a->remote_cands = p2p_calloc(16, sizeof(p2p_remote_candidate_entry_t));
     s_a->remote_cand_cap = 16;
 
     poll_candidates(inst_a, s_a);
+    run_jobs(inst_a);
     ASSERT_GE(s_a->remote_cand_cnt, 1);
     ASSERT_EQ(ntohs(s_a->remote_cands[0].addr.sin_port), 20002);
     ASSERT(s_a->remote_cand_done);
@@ -1240,6 +2157,12 @@ int main(void) {
         printf("  ⚠ P2P_TEST_TOKEN / P2P_TEST_GIST not set — Gist tests will SKIP\n\n");
 
     RUN_TEST(init);
+    RUN_TEST(poll_backoff);
+    RUN_TEST(gist_shards);
+    RUN_TEST(job_queue);
+    RUN_TEST(push_cache);
+    RUN_TEST(trickle_window);
+    RUN_TEST(cand_delta);
     RUN_TEST(gist_roundtrip);       if (env_ready()) sleep(1);
     RUN_TEST(heartbeat_write);      if (env_ready()) sleep(1);
     RUN_TEST(offer_write);          if (env_ready()) sleep(1);
@@ -12,6 +12,13 @@
  * 地址模型：每个对等体的信箱地址为 <gist_id>/<peer_id>，对应 Gist 中的一个文件。
  * 同一个 Gist 可以承载多个对等体（不同文件名），也可以每人各自一个 Gist。
  *
+ * 分片：GET 一次下载整个 Gist，共享 Gist 的轮询开销随对等体数量线性增长。
+ * cfg.gist_id 可为逗号分隔的 Gist 列表 "g1,g2,..."（各端配置同一字符串），
+ * 每个对等体的信箱按 peer_id 以 rendezvous hashing（p2p_cluster_pick）落在其中一个 Gist：
+ *   - 本端信箱 = 列表中 local_peer_id 所属的 Gist，SUB 只轮询这一个分片
+ *   - connect("peer_id") 的对端信箱 = 列表中 peer_id 所属的 Gist
+ *   - 每个分片承载约 N/分片数 个对等体；扩容时追加 Gist，只有归属新分片的对等体迁移
+ *
  * 标准 P2P 信令方案均依赖专用服务器（COMPACT 模式的 UDP 服务器、
  * RELAY 模式的 TCP 长连接服务器）。PUBSUB 模式通过第三方 HTTP 存储
  * 服务（GitHub Gist）实现去中心化的信令交换：
@@ -114,15 +121,25 @@
  *
  *   心跳：        "ONLINE:<unix_timestamp>:<peer_id>"  （SUB 上线标识，每 5 分钟刷新）
  *   Offer：      "OFFER:<pub_gist_id>:<pub_peer_id>"  （SUB 据此知道 PUB 的发布板和身份）
- *   候选列表：    Base64(DES(SDP 候选文本))            （加密候选）
+ *   候选列表：    "D<ver>,<tag>,<base>,<cnt>,<ack_tag>,<ack_cnt>:" Base64(DES(LZ(SDP 候选文本)))
+ *
+ * 候选列表为增量：只携带对端尚未确认的第 [base, cnt) 个候选，确认信息搭载在双方各自的文件中：
+ *   - tag:     发布方本轮会话的随机标签（十六进制），区分上一轮残留
+ *   - ack_*:   发布方已应用的对端候选（对端的 tag 与累计数量），对端据此把下一次发布的 base 推进到 ack_cnt
+ *   - 订阅方只应用 base == 0 或与已应用部分衔接（同 tag 且 base <= 已应用数）的增量；
+ *     出现缺口时重写自己的文件刷新 ack，发布方见 ack 回退即从 ack 处重新发布
+ *   - 旧格式 "<ver>:" Base64(DES(SDP 候选文本))（全量、未压缩）仍可解析
  *
  * 加密编码流程（候选列表）：
  *
  *   候选数组
  *     |
- *     v  p2p_ice_export_sdp(candidates_only=true)
+ *     v  p2p_ice_export_sdp(candidates_only=true)，跳过前 base 行
  *   SDP 文本（a=candidate:... 行）
  *     |
+ *     v  p2p_lz_compress()，前置 2 字节大端压缩长度
+ *   压缩块
+ *     |
  *     v  p2p_des_encrypt(key)
  *   DES 加密密文（ECB 模式，8 字节块对齐）
  *     |
@@ -137,6 +154,9 @@
  *   DES 密文
  *     |
  *     v  p2p_des_decrypt(key)
+ *   压缩块
+ *     |
+ *     v  p2p_lz_decompress()
  *   SDP 文本
  *     |
  *     v  p2p_ice_import_sdp()
@@ -149,11 +169,30 @@
  *           头部：Authorization: token {github_token}
  *                 Content-Type: application/json
  *           体：  {"files":{"p2p_signal.json":{"content":"<内容>"}}}
+ *
+ * ============================================================================
+ * WebSocket 推送（cfg.server_host 非空，需 WITH_WSLAY）
+ * ============================================================================
+ *
+ * 会话状态机与数据格式不变，只替换"存储"：写入不再 PATCH Gist，而是经持久
+ * WebSocket 发给中继（p2p_server --ws 或任何兼容实现），中继转发给所有连接；
+ * 各端把与自己相关的文件（本端信箱、各会话对端）的最新内容保存在本地缓存，
+ * 读取直接命中缓存。信令延迟从秒级轮询降为一个 RTT。
+ *
+ *   帧格式（Text）：{"gist":"<gist_id>","files":{"<peer_id>":{"content":"<内容>"}}}
+ *                  即 Gist PATCH 请求体加上 "gist" 字段，gist_id 此时仅作命名空间
+ *
+ * 中继要求：把收到的 Text 帧转发给其他连接（回显给发送方亦可）；
+ * 可选：按 gist/文件保留最后一帧，新连接建立时补发（使晚加入方能读到心跳）。
  */
 #ifndef P2P_SIGNAL_PUBSUB_H
 #define P2P_SIGNAL_PUBSUB_H
 
 #include "predefine.h"
+#include "p2p_http.h"
+#ifdef WITH_WSLAY
+#include "ws_client.h"
+#endif
 
 /* 轮询间隔（毫秒）*/
 #ifndef P2P_PUBSUB_POLL_MAILBOX_MS
@@ -165,8 +204,32 @@
 #ifndef P2P_PUBSUB_POLL_CONFIRM_MS
 #define P2P_PUBSUB_POLL_CONFIRM_MS  300     /* offer 确认轮询（心跳竞争期） */
 #endif
+#ifndef P2P_PUBSUB_POLL_FAST_MS
+#define P2P_PUBSUB_POLL_FAST_MS     300     /* 活动后的快速轮询（内容无变化时逐次翻倍，上限为 SYNC/MAILBOX）*/
+#endif
+#ifndef P2P_PUBSUB_CACHE_SLOTS
+#define P2P_PUBSUB_CACHE_SLOTS      4       /* 条件 GET 缓存槽位数（按 gist/文件，LRU 替换）*/
+#endif
+#ifndef P2P_PUBSUB_JOB_MAX
+#define P2P_PUBSUB_JOB_MAX          16      /* HTTP 请求队列长度（所有会话共用一条保活连接，依次执行）*/
+#endif
+#ifndef P2P_PUBSUB_WS_RETRY_MS
+#define P2P_PUBSUB_WS_RETRY_MS      3000    /* WebSocket 推送连接断开后的重连间隔 */
+#endif
+#ifndef P2P_PUBSUB_WS_PATH
+#define P2P_PUBSUB_WS_PATH          "/"     /* WebSocket 推送中继的路径 */
+#endif
 #ifndef P2P_PUBSUB_TRICKLE_BATCH_MS
-#define P2P_PUBSUB_TRICKLE_BATCH_MS 1000    /* trickle 攒批窗口（毫秒）*/
+#define P2P_PUBSUB_TRICKLE_BATCH_MS 1000    /* trickle 攒批基础窗口（srflx/relay 候选；host 候选立即发布）*/
+#endif
+#ifndef P2P_PUBSUB_TRICKLE_MAX_MS
+#define P2P_PUBSUB_TRICKLE_MAX_MS   10000   /* 配额紧张时放大后的攒批窗口上限 */
+#endif
+#ifndef P2P_PUBSUB_RL_RESERVE
+#define P2P_PUBSUB_RL_RESERVE       100     /* 为轮询保留的 GitHub 配额（不分给 trickle PATCH）*/
+#endif
+#ifndef P2P_PUBSUB_GIST_LIST_MAX
+#define P2P_PUBSUB_GIST_LIST_MAX    1024    /* Gist 分片列表（cfg.gist_id，逗号分隔）最大长度 */
 #endif
 #ifndef P2P_PUBSUB_HEARTBEAT_SEC
 #define P2P_PUBSUB_HEARTBEAT_SEC    300     /* SUB 心跳刷新间隔（秒） */
@@ -174,6 +237,29 @@
 
 struct p2p_session;
 struct p2p_instance;
+struct p2p_pubsub_job;
+
+/*
+ * 请求完成回调
+ *
+ * @param r        GET: 0=内容有变化，1=内容与上次相同，-1=失败或无内容; PATCH: 0=成功，-1=失败
+ * @param content  GET 成功时为提取出的文件内容，否则为 NULL
+ */
+typedef void (*p2p_pubsub_done_fn)(struct p2p_instance *inst, struct p2p_session *s,
+                                   const struct p2p_pubsub_job *job, int r, const char *content);
+
+/*
+ * HTTP 请求队列项：信令操作不再同步等待 HTTP 往返，而是入队后由 tick 推进，
+ * 完成时回调对应的协议处理函数
+ */
+typedef struct p2p_pubsub_job {
+    struct p2p_session *s;                              /* 所属会话（NULL = 无/已取消）*/
+    p2p_pubsub_done_fn  done;                           /* 完成回调（NULL = 不关心结果）*/
+    char                gist_id[128];
+    char                filename[P2P_PEER_ID_MAX];
+    char               *body;                           /* PATCH 请求体（NULL = GET）*/
+    int                 arg[2];                         /* 回调参数（由发起方定义）*/
+} p2p_pubsub_job_t;
 
 /* ============================================================================
  * PUBSUB 实例上下文（instance 级别）
@@ -185,6 +271,19 @@ typedef enum {
     SIG_PUBSUB_ONLINE,                                  /* 已上线 */
 } p2p_pubsub_st;
 
+/*
+ * 条件 GET 缓存：记录 ETag 与上次提取的文件内容，
+ * 304 Not Modified 时直接回放，无需重新下载和解析整个 Gist。
+ */
+typedef struct {
+    char                gist_id[128];                   /* 空 = 空闲槽位 */
+    char                filename[P2P_PEER_ID_MAX];
+    char                etag[P2P_HTTP_ETAG_MAX];
+    char                content[4096];                  /* 上次提取的文件内容 */
+    uint64_t            used;                           /* 最近使用时间（LRU）*/
+    bool                pushed;                         /* 推送模式：收到新内容，尚未被读取 */
+} p2p_pubsub_cache_t;
+
 typedef struct {
     /* 基础状态 */
     p2p_pubsub_st       state;                          /* 信令状态 */
@@ -193,7 +292,28 @@ typedef struct {
     char                local_peer_id[P2P_PEER_ID_MAX]; /* 本端名称 */
     char                auth_token[128];                /* GitHub Personal Access Token */
     char                auth_key[64];                   /* DES 加密密钥 */
-    char                local_gist_id[128];             /* 本端发布板 Gist ID */
+    char                local_gist_id[128];             /* 本端发布板 Gist ID（分片时为 local_peer_id 所属的分片）*/
+    char                gist_shards[P2P_PUBSUB_GIST_LIST_MAX]; /* Gist 分片列表（逗号分隔，单个 ID 即不分片）*/
+
+    p2p_pubsub_cache_t  cache[P2P_PUBSUB_CACHE_SLOTS];  /* 条件 GET 缓存 */
+
+    /* 非阻塞 HTTP */
+    p2p_http_t         *http;                           /* 到 api.github.com 的客户端（保活复用）*/
+    p2p_pubsub_job_t    jobs[P2P_PUBSUB_JOB_MAX];       /* 请求队列（环形，队首为进行中的请求）*/
+    int                 job_head, job_cnt;
+    bool                job_active;                     /* 队首请求已发起 */
+    uint64_t            job_start;                      /* 推送模式：队首写入开始等待连接的时间 */
+    long                rl_remaining;                   /* GitHub 报告的剩余配额（rl_reset = 0 时未知）*/
+    long long           rl_reset;                       /* 配额重置时间（Unix 秒）*/
+
+    /* WebSocket 推送（替代 Gist 轮询）*/
+    bool                push;                           /* 推送模式：写入经 WebSocket 广播，读取命中本地缓存 */
+#ifdef WITH_WSLAY
+    ws_client_t        *ws;
+    char                ws_host[128];
+    uint16_t            ws_port;
+    uint64_t            ws_retry;                       /* 上次发起连接的时间 */
+#endif
 
 } p2p_signal_pubsub_ctx_t;
 
@@ -214,6 +334,8 @@ typedef struct {
     bool                is_pub;                         /* true=PUB（主动方） false=SUB（被动方）*/
     p2p_pubsub_sess_st  state;                          /* 会话状态 */
     uint64_t            last_poll;                      /* 上次轮询时间戳 */
+    int                 poll_idle;                      /* 连续无变化的轮询次数（自适应退避，0 = 刚有活动）*/
+    int                 jobs;                           /* 队列中属于本会话的请求数（> 0 时不再发起新操作）*/
 
     uint64_t            last_sub;                       /* SUB: 上次写入订阅的时间 (now_ms)，0=未发送 */
     int                 offer_sent;                     /* PUB: 0=未发送, 1=已写入(待确认), 2=已确认 */
@@ -225,9 +347,17 @@ typedef struct {
     int                 local_sync_ver;                 /* 本端发布版本 (>=1 trickle, 0=final) */
     int                 candidate_synced_count;         /* 已发布的候选数量 */
     uint64_t            last_sync;                      /* 上次发布候选的时间 (now_ms) */
+    uint32_t            sync_tag;                       /* 本轮会话标签（首次发布时随机生成，0=未生成）*/
+    int                 sync_base;                      /* 上次发布的增量起点 */
+    int                 peer_ack;                       /* 对端已确认应用的本端候选数 */
+    bool                republish;                      /* 需要重写发布（对端 ack 回退或本端 ack 需刷新）*/
+    uint32_t            ack_sent_tag;                   /* 上次发布时携带的 ack（避免重复刷新）*/
+    int                 ack_sent_cnt;
 
     /* 轮询状态 */
     int                 remote_sync_ver;                /* 对端最后处理版本 (-1=未收到, 0=全部完成) */
+    uint32_t            remote_tag;                     /* 已应用的对端增量所属标签 */
+    int                 remote_cnt;                     /* 已应用的对端候选数（即本端 ack）*/
 
 } p2p_pubsub_session_t;
 
@@ -261,11 +391,14 @@ void p2p_signal_pubsub_tick_send(struct p2p_instance *inst, uint64_t now);
 /*
  * 实例上线（配置 token 和 gist_id）
  *
+ * inst->cfg.server_host 非空时使用 WebSocket 推送（连接 server_host:server_port），
+ * 此时 token 不使用、gist_id 可为 NULL（默认命名空间 "p2p"）。
+ *
  * @param inst          P2P 实例
  * @param local_peer_id 本端名称
  * @param token         GitHub Personal Access Token
- * @param gist_id       本端发布板 Gist ID
- * @return              E_NONE=成功
+ * @param gist_id       本端发布板 Gist ID，或逗号分隔的分片列表（按 peer_id 选择信箱所在的 Gist）
+ * @return              E_NONE=成功，E_INVALID=分片列表过长
  */
 ret_t p2p_signal_pubsub_online(struct p2p_instance *inst, const char *local_peer_id,
                                 const char *token, const char *gist_id);
@@ -295,7 +428,8 @@ void p2p_signal_pubsub_trickle_candidate(struct p2p_session *s);
  * @param s           P2P 会话
  * @param remote_addr 对端地址，格式：
  *                    - "gist_id/peer_id" — 不同 Gist（PUB 模式）
- *                    - "peer_id"         — 同 Gist（PUB 模式，remote_gist = local_gist）
+ *                    - "peer_id"         — 同 Gist（PUB 模式，remote_gist = local_gist；
+ *                                          分片时为列表中 peer_id 所属的 Gist）
  *                    - NULL              — SUB 模式（等待 offer）
  * @return            E_NONE=成功
  */
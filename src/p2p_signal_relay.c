@@ -27,6 +27,11 @@
 #define MOD_TAG "RELAY"
 
 #include "p2p_internal.h"
+#include "p2p_thread.h"
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
 
 #define TASK_ONLINE                     "ONLINE"
 #define TASK_TOUCH                      "TOUCH"
@@ -47,6 +52,36 @@
  * 辅助函数
  */
 
+/* 聚合发送（sock_msg_t 在 POSIX 下为 struct iovec，Windows 下为 WSABUF），返回值同 send() */
+static ssize_t tcp_sendv(sock_t fd, const sock_msg_t *iov, int cnt) {
+#ifdef _WIN32
+    DWORD sent = 0;
+    if (WSASend(fd, (LPWSABUF)iov, (DWORD)cnt, &sent, 0, NULL, NULL) != 0) return -1;
+    return (ssize_t)sent;
+#else
+    return writev(fd, iov, cnt);
+#endif
+}
+
+/*
+ * TCP 发送策略（P2P_RELAY_TCP_NODELAY）
+ * + TCP_NODELAY：控制小帧（SYNC、MSG_REQ 等）立即发出，不与服务器的延迟 ACK 相互等待
+ * + 一次 tick 需多次 writev 才能发完队列时，先 cork（Linux TCP_CORK / BSD TCP_NOPUSH）合并成满段，
+ *   发完 uncork 立即推出尾段
+ */
+static bool tcp_cork(sock_t fd, bool on) {
+#if P2P_RELAY_TCP_NODELAY && defined(TCP_CORK)
+    int v = on ? 1 : 0;
+    return setsockopt(fd, IPPROTO_TCP, TCP_CORK, (const char *)&v, sizeof(v)) == 0;
+#elif P2P_RELAY_TCP_NODELAY && defined(TCP_NOPUSH)
+    int v = on ? 1 : 0;
+    return setsockopt(fd, IPPROTO_TCP, TCP_NOPUSH, (const char *)&v, sizeof(v)) == 0;
+#else
+    (void)fd; (void)on;
+    return false;
+#endif
+}
+
 /*
  * 将消息加入发送队列
  *
@@ -56,56 +91,424 @@
  * @param payload_len 负载长度
  * @return            0=成功，-1=内存分配失败
  */
-static ret_t tcp_send(p2p_relay_ctx_t *ctx, const char* PROTO,
-                    uint8_t type, const uint8_t *payload, int payload_len,
-                    uint64_t now) {
-
-    // 分配 sending chunk
-    p2p_send_chunk_t *chunk;
-    if (ctx->chunk_recycled) {
-        chunk = ctx->chunk_recycled;
-        ctx->chunk_recycled = chunk->next;
-    } else {        
-        chunk = (p2p_send_chunk_t *)malloc(sizeof(p2p_send_chunk_t));
-        if (!chunk) {
+/*
+ * 将消息加入发送队列（负载为 head + payload 两段，省去调用方拼接）
+ * + 超出单个 chunk 的大帧（BULK 大帧模式）依次占用多个 chunk，独立连接按队列顺序 writev 发出
+ *
+ * @return            0=成功，-1=内存分配失败
+ */
+static ret_t tcp_send_ex(p2p_relay_ctx_t *ctx, const char* PROTO, uint8_t type,
+                         const uint8_t *head, int head_len, const uint8_t *payload, int payload_len,
+                         uint64_t now) {
+
+    const int CAP = (int)sizeof(((p2p_send_chunk_t *)0)->data);
+    int total = (int)sizeof(p2p_relay_hdr_t) + head_len + payload_len;
+    int need = (total + CAP - 1) / CAP;
+
+    // 分配 sending chunk（池空时按块扩容，整块 chunk 挂入回收链表）
+    int avail = 0;
+    for (p2p_send_chunk_t *c = ctx->chunk_recycled; c && avail < need; c = c->next) avail++;
+    while (avail < need) {
+        p2p_send_chunk_block_t *blk = (p2p_send_chunk_block_t *)p2p_arena_malloc(ctx->arena, sizeof(p2p_send_chunk_block_t));
+        if (!blk) {
             print("E:", LA_F("[R] %s%s qsend failed(OOM)\n", LA_F440, 440), type == P2P_RLY_PACKET ? "PKT-" : "" , PROTO);
             return E_OUT_OF_MEMORY;  // 内存分配失败
         }
+        p2p_mem_add(ctx->mem, P2P_MEM_SIGNAL, sizeof(p2p_send_chunk_block_t));
+        blk->next = ctx->chunk_blocks;
+        ctx->chunk_blocks = blk;
+        for (int i = P2P_RELAY_CHUNK_BLOCK - 1; i >= 0; i--) {
+            blk->chunks[i].next = ctx->chunk_recycled;
+            ctx->chunk_recycled = &blk->chunks[i];
+        }
+        avail += P2P_RELAY_CHUNK_BLOCK;
     }
-    chunk->len = 0;
-    chunk->next = NULL;
 
-    // 填充包头和 payload
-    p2p_relay_hdr_t *hdr = (p2p_relay_hdr_t *)chunk->data;
-    hdr->type = type;
-    hdr->size = htons((uint16_t)payload_len);
-    if (payload_len > 0) {
-        memcpy(chunk->data + sizeof(p2p_relay_hdr_t), payload, (size_t)payload_len);
-    }
+    // 填充包头和 payload（按 chunk 容量切分），逐个加入发送队列
+    p2p_relay_hdr_t hdr;
+    hdr.type = type;
+    hdr.size = htons((uint16_t)(head_len + payload_len));
+    const uint8_t *src[3] = { (const uint8_t *)&hdr, head, payload };
+    int src_len[3] = { (int)sizeof(hdr), head_len, payload_len };
+    for (int k = 0, off = 0;; ) {
 
-    // 待发送数据长度
-    chunk->len = (int)sizeof(p2p_relay_hdr_t) + payload_len;
+        while (k < 3 && off == src_len[k]) { k++; off = 0; }
+        if (k == 3) break;
 
-    // 加入发送队列
-    chunk->next = NULL;    
-    if (ctx->send_queue_rear) {
-        ctx->send_queue_rear->next = chunk;
-        ctx->send_queue_rear = chunk;
-    } else {
-        ctx->send_queue_head = chunk;
-        ctx->send_queue_rear = chunk;
+        p2p_send_chunk_t *chunk = ctx->chunk_recycled;
+        ctx->chunk_recycled = chunk->next;
+        chunk->len = 0;
+        while (k < 3 && chunk->len < CAP) {
+            int n = src_len[k] - off < CAP - chunk->len ? src_len[k] - off : CAP - chunk->len;
+            if (n > 0) memcpy(chunk->data + chunk->len, src[k] + off, (size_t)n);
+            chunk->len += n; off += n;
+            if (off == src_len[k]) { k++; off = 0; }
+        }
+
+        // 加入发送队列
+        chunk->next = NULL;
+        if (ctx->send_queue_rear) {
+            ctx->send_queue_rear->next = chunk;
+            ctx->send_queue_rear = chunk;
+        } else {
+            ctx->send_queue_head = chunk;
+            ctx->send_queue_rear = chunk;
+        }
+        ++ctx->send_queue_len;
     }
-    ++ctx->send_queue_len;
 
     ctx->last_send_time = now;
 
     printf(LA_F("[R] %s%s qsend(%d), len=%u\n", LA_F441, 441), type == P2P_RLY_PACKET ? "PKT-" : "" , PROTO,
-           ctx->send_queue_len, sizeof(p2p_relay_hdr_t) + payload_len);
+           ctx->send_queue_len, total);
+
+
+    return E_NONE;
+}
+
+/*
+ * 将消息加入发送队列
+ *
+ * @param ctx         信令上下文
+ * @param type        消息类型
+ * @param payload     负载数据
+ * @param payload_len 负载长度
+ * @return            0=成功，-1=内存分配失败
+ */
+static inline ret_t tcp_send(p2p_relay_ctx_t *ctx, const char* PROTO,
+                             uint8_t type, const uint8_t *payload, int payload_len,
+                             uint64_t now) {
+    return tcp_send_ex(ctx, PROTO, type, NULL, 0, payload, payload_len, now);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * 共享连接（cfg.relay_mux）
+ *
+ * 同进程内连接同一服务器的实例共用一条 TCP 连接，每个实例是其上的一个登录（P2P_RLY_MUX，见 p2pp.h）：
+ * + 首个登录按独立连接方式上线（0 号登录，不发 MUX 帧）；其 ONLINE_ACK 通告 P2P_RLY_FEATURE_MUX 后
+ *   其余登录才在该连接上 ONLINE，否则（旧服务器）等待中的登录退回各自的独立连接
+ * + 读取由任一实例的 tick 驱动：按 SELECT 将帧分拣到所属登录的 mux_rx（唤醒其线程），各实例在自己的 tick 中派发
+ * + 发送：实例把发送队列中的整帧（登录切换时前置 SELECT）拷入连接发送缓冲再尽力发出，不同登录的帧不会交错
+ * + 保活由连接承担：连接空闲达到心跳间隔时才由当时 tick 的实例发送 ALIVE
+ * + 连接断开时其上所有登录进入 ERROR（与独立连接断开相同）
+ * + 锁：注册表 g_links_lock → 连接 link->lock（短临界区，仅非阻塞收发与拷贝）
+ */
+typedef enum {
+    LINK_CONNECTING = 0,                                /* TCP 连接建立中 */
+    LINK_UP,                                            /* 已连接 */
+    LINK_DEAD                                           /* 已断开（等待全部登录退出后释放）*/
+} relay_link_st;
+
+typedef struct p2p_relay_link {
+    struct p2p_relay_link*  next;                       /* 注册表链表 */
+    struct sockaddr_in      server;
+    sock_t                  sockfd;
+    relay_link_st           state;
+    int8_t                  mux;                        /* 服务器支持复用：-1 未知（首个 ONLINE_ACK 前），0 否，1 是 */
+    int                     refs;                       /* 登录数 */
+    volatile long           lock;
+    p2p_relay_ctx_t*        logins[P2P_RELAY_MUX_LOGINS]; /* 按登录号索引 */
+
+    /* 接收：整帧读入 rx_buf 后分拣 */
+    uint16_t                rx_id;                      /* 当前接收登录号 */
+    int                     rx_len;
+    uint8_t                 rx_buf[sizeof(p2p_relay_hdr_t) + P2P_RLY_PAYLOAD_MAX];
+
+    /* 发送缓冲 */
+    int32_t                 tx_id;                      /* 当前发送登录号（-1 = 下一帧须先 SELECT）*/
+    int                     tx_len;
+    int                     tx_off;                     /* 已发出字节数 */
+    uint64_t                last_send;                  /* 最近一次有帧写入的时刻（保活判定）*/
+    uint8_t                 tx_buf[P2P_RELAY_MUX_TX_MAX];
+} p2p_relay_link_t;
+
+static p2p_relay_link_t*    g_links;
+static volatile long        g_links_lock;
+
+#if defined(_MSC_VER)
+#define SPIN_LOCK(l)        while (_InterlockedExchange(&(l), 1)) {}
+#define SPIN_UNLOCK(l)      _InterlockedExchange(&(l), 0)
+#else
+#define SPIN_LOCK(l)        while (__atomic_exchange_n(&(l), 1, __ATOMIC_ACQUIRE)) {}
+#define SPIN_UNLOCK(l)      __atomic_store_n(&(l), 0, __ATOMIC_RELEASE)
+#endif
+
+#define LINK_MUX_FRAME      ((int)sizeof(p2p_relay_hdr_t) + P2P_RLY_MUX_PSZ)
+
+/* 创建非阻塞 TCP socket 并发起连接；返回 0=已连接，1=进行中，-1=失败（已关闭） */
+static int tcp_connect(sock_t *out, const struct sockaddr_in *server) {
+
+    sock_t fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == P_INVALID_SOCKET) {
+        print("E:", LA_F("[R] Failed to create TCP socket\n", LA_F444, 444));
+        return -1;
+    }
+    if (P_sock_nonblock(fd, true) != E_NONE) {
+        print("E:", LA_F("[R] Failed to set socket non-blocking\n", LA_F445, 445));
+        P_sock_close(fd);
+        return -1;
+    }
+#if P2P_RELAY_TCP_NODELAY && defined(TCP_NODELAY)
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&nodelay, sizeof(nodelay));
+#endif
+
+    print("I:", LA_F("[R] Connecting to %s:%d\n", LA_F442, 442),
+          inet_ntoa(server->sin_addr), ntohs(server->sin_port));
+
+    if (connect(fd, (const struct sockaddr *)server, sizeof(*server)) == 0) { *out = fd; return 0; }
+    if (P_sock_is_inprogress()) { *out = fd; return 1; }
+
+    print("E:", LA_F("[R] TCP connect failed(%d)\n", LA_F446, 446), P_sock_errno());
+    P_sock_close(fd);
+    return -1;
+}
+
+/* 连接断开：其上的登录在各自下次 tick 时进入 ERROR（持 link->lock） */
+static void link_down(p2p_relay_link_t *link) {
+    if (link->sockfd != P_INVALID_SOCKET) P_sock_close(link->sockfd);
+    link->sockfd = P_INVALID_SOCKET;
+    link->state = LINK_DEAD;
+    link->tx_len = link->tx_off = 0;
+}
+
+/* 写入 SELECT / CLOSE 帧（持 link->lock，调用方保证缓冲有空间） */
+static void link_put_mux(p2p_relay_link_t *link, uint16_t id, uint8_t op) {
+    uint8_t *p = link->tx_buf + link->tx_len;
+    p[0] = P2P_RLY_MUX;
+    nwrite_s(p + 1, P2P_RLY_MUX_PSZ);
+    nwrite_s(p + sizeof(p2p_relay_hdr_t), id);
+    p[sizeof(p2p_relay_hdr_t) + 2] = op;
+    link->tx_len += LINK_MUX_FRAME;
+    if (op == P2P_RLY_MUX_SELECT) link->tx_id = id;
+}
+
+/* 尽力发出发送缓冲（持 link->lock） */
+static void link_flush(p2p_relay_link_t *link) {
+
+    while (link->state == LINK_UP && link->tx_off < link->tx_len) {
+        ssize_t n = send(link->sockfd, (const char *)link->tx_buf + link->tx_off, link->tx_len - link->tx_off, 0);
+        if (n > 0) { link->tx_off += (int)n; continue; }
+        if (n < 0 && P_sock_is_wouldblock()) return;
+
+        if (!n) print("E:", LA_F("[R] TCP connection closed during send\n", LA_F451, 451));
+        else print("E:", LA_F("[R] TCP send error(%d)\n", LA_F453, 453), P_sock_errno());
+        link_down(link);
+        return;
+    }
+    link->tx_off = link->tx_len = 0;
+}
+
+/* 一个完整帧：MUX 帧切换接收登录，其余追加到所属登录的 mux_rx（持 link->lock） */
+static void link_deliver(p2p_relay_link_t *link, const uint8_t *frame, int len) {
+
+    if (frame[0] == P2P_RLY_MUX) {
+        const uint8_t *p = frame + sizeof(p2p_relay_hdr_t);
+        uint16_t id = nget_s(p);
+        if (len != LINK_MUX_FRAME || id >= P2P_RELAY_MUX_LOGINS) return;
+        if (p[2] == P2P_RLY_MUX_SELECT) link->rx_id = id;
+        else if (p[2] == P2P_RLY_MUX_CLOSE && link->logins[id]) link->logins[id]->mux_kicked = true;
+        return;
+    }
+
+    p2p_relay_ctx_t *ctx = link->logins[link->rx_id];
+    if (!ctx || ctx->mux_kicked) return;
+
+    if (ctx->mux_rx_len + len > ctx->mux_rx_cap) {
+        int cap = ctx->mux_rx_cap ? ctx->mux_rx_cap * 2 : 4096;
+        while (cap < ctx->mux_rx_len + len) cap *= 2;
+        uint8_t *buf = cap <= P2P_RELAY_MUX_RX_MAX ? (uint8_t *)p2p_realloc(ctx->mux_rx, (size_t)cap) : NULL;
+        if (!buf) {
+            print("E:", LA_F("[R] MUX login %u rx backlog overflow (%d bytes), closing login\n", LA_F659, 659), (unsigned)link->rx_id, ctx->mux_rx_len);
+            ctx->mux_kicked = true;
+            return;
+        }
+        p2p_mem_add(ctx->mem, P2P_MEM_SIGNAL, cap - ctx->mux_rx_cap);
+        ctx->mux_rx = buf;
+        ctx->mux_rx_cap = cap;
+    }
+    bool wake = !ctx->mux_rx_len;
+    memcpy(ctx->mux_rx + ctx->mux_rx_len, frame, (size_t)len);
+    ctx->mux_rx_len += len;
+
+#ifdef P2P_THREADED
+    // 其他实例的帧：唤醒其工作线程（非线程模式由 p2p_next_timeout 返回 0 提示尽快 update）
+    if (wake && ctx->owner->cfg.threaded) p2p_thread_wakeup(ctx->owner);
+#else
+    (void)wake;
+#endif
+}
+
+/* 推进连接：完成非阻塞 connect，读取并分拣全部可读帧（持 link->lock） */
+static void link_pump(p2p_relay_link_t *link) {
+
+    if (link->state == LINK_CONNECTING) {
+        fd_set wfds;
+        FD_ZERO(&wfds);
+        FD_SET(link->sockfd, &wfds);
+        struct timeval tv = {0, 0};
+        int ret = select((int)link->sockfd + 1, NULL, &wfds, NULL, &tv);
+        if (ret > 0 && FD_ISSET(link->sockfd, &wfds)) {
+            print("I:", LA_F("[R] TCP connected, sending ONLINE\n", LA_F449, 449));
+            link->state = LINK_UP;
+        } else if (ret < 0) {
+            print("E:", LA_F("[R] TCP connect select failed(%d)\n", LA_F447, 447), P_sock_errno());
+            link_down(link);
+        }
+        return;
+    }
+
+    const int H = (int)sizeof(p2p_relay_hdr_t);
+    while (link->state == LINK_UP) {
+
+        // 先读包头，再按包头长度读负载
+        int want = link->rx_len < H ? H : H + nget_s(link->rx_buf + 1);
+        ssize_t n = recv(link->sockfd, (char *)link->rx_buf + link->rx_len, want - link->rx_len, 0);
+        if (n > 0) { link->rx_len += (int)n;
+
+            if (link->rx_len < H) continue;
+            int size = nget_s(link->rx_buf + 1);
+            int limit = link->rx_buf[0] == P2P_RLY_PACKET ? (int)P2P_RLY_PAYLOAD_MAX : P2P_MAX_PAYLOAD;
+            if (size > limit) {
+                print("E:", LA_F("[R] payload size %u exceeds limit %u\n", LA_F455, 455), size, limit);
+                link_down(link);
+                return;
+            }
+            if (link->rx_len == H + size) {
+                link_deliver(link, link->rx_buf, link->rx_len);
+                link->rx_len = 0;
+            }
+            continue;
+        }
+
+        if (n == 0) {
+            print("I:", LA_F("[R] TCP connection closed by peer\n", LA_F450, 450));
+            link_down(link);
+        }
+        else if (!P_sock_is_wouldblock()) {
+            print("E:", LA_F("[R] TCP recv error(%d)\n", LA_F452, 452), P_sock_errno());
+            link_down(link);
+        }
+        return;
+    }
+}
 
+/* 加入（或新建）到 server 的共享连接，分配登录号 */
+static ret_t link_join(struct p2p_instance *inst, const struct sockaddr_in *server) {
 
+    p2p_relay_ctx_t *ctx = &inst->sig_ctx.relay;
+
+    SPIN_LOCK(g_links_lock);
+    p2p_relay_link_t *link;
+    for (link = g_links; link; link = link->next) {
+        if (link->server.sin_addr.s_addr == server->sin_addr.s_addr && link->server.sin_port == server->sin_port
+            && link->state != LINK_DEAD && link->mux != 0 && link->refs < P2P_RELAY_MUX_LOGINS) break;
+    }
+    if (!link) {
+        if (!(link = (p2p_relay_link_t *)p2p_calloc(1, sizeof(*link)))) {
+            SPIN_UNLOCK(g_links_lock);
+            return E_OUT_OF_MEMORY;
+        }
+        int rc = tcp_connect(&link->sockfd, server);
+        if (rc < 0) {
+            SPIN_UNLOCK(g_links_lock);
+            p2p_free(link);
+            return E_UNKNOWN;
+        }
+        link->server = *server;
+        link->state = rc == 0 ? LINK_UP : LINK_CONNECTING;
+        link->mux = -1;
+        link->next = g_links;
+        g_links = link;
+    }
+
+    SPIN_LOCK(link->lock);
+    uint16_t id = 0;
+    while (link->logins[id]) id++;
+    link->logins[id] = ctx;
+    link->refs++;
+    ctx->link = link;
+    ctx->owner = inst;
+    ctx->mux_id = id;
+    ctx->mux_kicked = false;
+    SPIN_UNLOCK(link->lock);
+    SPIN_UNLOCK(g_links_lock);
+
+    print("V:", LA_F("[R] MUX joined shared link as login %u (refs=%d)\n", LA_F660, 660), (unsigned)id, link->refs);
     return E_NONE;
 }
 
+/* 退出共享连接：通知服务器注销本登录，最后一个登录退出时关闭连接 */
+static void link_leave(p2p_relay_ctx_t *ctx) {
+
+    p2p_relay_link_t *link = ctx->link;
+    if (!link) return;
+
+    SPIN_LOCK(g_links_lock);
+    SPIN_LOCK(link->lock);
+    link->logins[ctx->mux_id] = NULL;
+    bool last = --link->refs == 0;
+    if (last) {
+        p2p_relay_link_t **pp = &g_links;
+        while (*pp != link) pp = &(*pp)->next;
+        *pp = link->next;
+        link_down(link);
+    }
+    else if (link->state != LINK_DEAD) {
+        if (link->mux == 1) {
+            if (link->tx_len + LINK_MUX_FRAME <= P2P_RELAY_MUX_TX_MAX) link_put_mux(link, ctx->mux_id, P2P_RLY_MUX_CLOSE);
+            if (link->tx_id == ctx->mux_id) link->tx_id = -1;   // 登录号可能被复用：后续帧重新选择
+            link_flush(link);
+        }
+        // 首个登录在服务器能力确认前退出：无法确认能否复用，等待中的登录退回独立连接
+        else if (link->mux < 0 && ctx->mux_id == 0) {
+            link->mux = 0;
+            link_down(link);
+        }
+    }
+    SPIN_UNLOCK(link->lock);
+    SPIN_UNLOCK(g_links_lock);
+    if (last) p2p_free(link);
+
+    p2p_mem_add(ctx->mem, P2P_MEM_SIGNAL, -(int64_t)ctx->mux_rx_cap);
+    p2p_free(ctx->mux_rx);
+    ctx->mux_rx = NULL;
+    ctx->mux_rx_len = ctx->mux_rx_cap = 0;
+    ctx->mux_kicked = false;
+    ctx->link = NULL;
+}
+
+/* 连接失败 / 致命错误：关闭连接（共享连接上只退出本登录），进入 ERROR 状态 */
+/* 首个登录收到 ONLINE_ACK：记录服务器能否复用 */
+static void link_set_mux(p2p_relay_link_t *link, bool mux) {
+    SPIN_LOCK(link->lock);
+    if (link->mux < 0) link->mux = mux ? 1 : 0;
+    SPIN_UNLOCK(link->lock);
+}
+
+sock_t p2p_signal_relay_sock(const p2p_relay_ctx_t *ctx, bool *connecting) {
+
+    if (!ctx->link) {
+        *connecting = ctx->state == SIG_RELAY_CONNECTING;
+        return ctx->sockfd;
+    }
+    p2p_relay_link_t *link = ctx->link;
+    SPIN_LOCK(link->lock);
+    sock_t fd = link->sockfd;
+    *connecting = link->state == LINK_CONNECTING;
+    SPIN_UNLOCK(link->lock);
+    return fd;
+}
+
+static void relay_fail(p2p_relay_ctx_t *ctx) {
+    if (ctx->link) link_leave(ctx);
+    else if (ctx->sockfd != P_INVALID_SOCKET) P_sock_close(ctx->sockfd);
+    ctx->sockfd = P_INVALID_SOCKET;
+    ctx->state = SIG_RELAY_ERROR;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 /*
@@ -128,6 +531,7 @@ static void unpack_remote_candidates(struct p2p_session *s, const uint8_t *paylo
     }
 
     p2p_relay_session_t *sess_ctx = &s->sig_sess.relay;
+    if (cand_cnt) p2p_setup_mark(s, P2P_SETUP_REMOTE_CAND, p2p_now_ms());
 
     // 解析候选列表
     p2p_remote_candidate_entry_t *c; int offset = 1;
@@ -427,16 +831,14 @@ static void handle_status(struct p2p_instance *inst, uint8_t type, uint8_t code,
         print("E:", LA_F("%s: req_type=%u code=%u\n", LA_F209, 209),
               PROTO, (unsigned)type, (unsigned)code);
 
-    P_sock_close(inst->sig_ctx.relay.sockfd);
-    inst->sig_ctx.relay.sockfd = P_INVALID_SOCKET;
-    inst->sig_ctx.relay.state = SIG_RELAY_ERROR;
+    relay_fail(&inst->sig_ctx.relay);
 }
 
 /*
  * 处理 ONLINE_ACK
  *
  * 包头: [type(P2P_RLY_ONLINE_ACK) | size(2)]
- * 负载: [features(1)][candidate_sync_max(1)]
+ * 负载: [features(1)][candidate_sync_max(1)][rpc_window(1)，可选]
  */
 static void handle_online_ack(struct p2p_instance *inst, const uint8_t *payload, int len, uint64_t now) {
     const char *PROTO = "ONLINE_ACK";
@@ -455,7 +857,13 @@ static void handle_online_ack(struct p2p_instance *inst, const uint8_t *payload,
     uint8_t features = payload[0];
     sig_ctx->feature_relay = (features & P2P_RLY_FEATURE_RELAY) != 0;
     sig_ctx->feature_msg = (features & P2P_RLY_FEATURE_MSG) != 0;
+    sig_ctx->feature_bulk = (features & P2P_RLY_FEATURE_BULK) != 0;
+    sig_ctx->feature_bulk_large = sig_ctx->feature_bulk && (features & P2P_RLY_FEATURE_BULK_LARGE);
+    if (sig_ctx->link && !sig_ctx->mux_id) link_set_mux(sig_ctx->link, (features & P2P_RLY_FEATURE_MUX) != 0);
     sig_ctx->candidate_sync_max = (len >= (int)P2P_RLY_ONLINE_ACK_PSZ) ? payload[1] : 0;
+    sig_ctx->rpc_window = (len > (int)P2P_RLY_ONLINE_ACK_PSZ) ? payload[2] : 1;   // 旧服务器不带，按停等处理
+    if (sig_ctx->rpc_window == 0) sig_ctx->rpc_window = 1;
+    if (sig_ctx->rpc_window > P2P_RPC_WINDOW_MAX) sig_ctx->rpc_window = P2P_RPC_WINDOW_MAX;
 
     const char* def = "";
     if (!sig_ctx->candidate_sync_max) { def = "(default)";
@@ -547,7 +955,7 @@ static void handle_session_status(struct p2p_session *s, uint8_t type, uint8_t c
     if (code == P2P_RLY_ERR_BUSY) {
 
         if (type == P2P_RLY_SYNC || type == P2P_RLY_SYNC0) {
-            if (sess_ctx->trickle_last_time) sess_ctx->trickle_last_time = P_tick_ms();
+            if (sess_ctx->trickle_last_time) sess_ctx->trickle_last_time = p2p_now_ms();
             print("V:", LA_F("%s: sync busy, will retry\n", LA_F229, 229), PROTO);
         }
         else if (type == P2P_RLY_PACKET) {
@@ -561,6 +969,7 @@ static void handle_session_status(struct p2p_session *s, uint8_t type, uint8_t c
 
         if (type == P2P_RLY_PACKET) {
             sess_ctx->awaiting_relay_ready = false;
+            p2p_session_wake(s);            // 待发的 BULK 帧 / 数据包立即推进
             print("V:", LA_F("%s: relay ready, flow control released\n", LA_F202, 202), PROTO);
         }
     }
@@ -581,9 +990,7 @@ static void handle_session_status(struct p2p_session *s, uint8_t type, uint8_t c
         print("E:", LA_F("%s: fatal error code=%u, entering ERROR state\n", LA_F137, 137),
                 PROTO, (unsigned)code);
 
-        P_sock_close(inst->sig_ctx.relay.sockfd);
-        inst->sig_ctx.relay.sockfd = P_INVALID_SOCKET;
-        inst->sig_ctx.relay.state = SIG_RELAY_ERROR;
+        relay_fail(&inst->sig_ctx.relay);
     }
 }
 
@@ -604,6 +1011,7 @@ static void handle_sync0_ack(struct p2p_session *s, const uint8_t *payload, uint
     sess_ctx->state = SIG_RELAY_SESS_WAIT_PEER;
     assert(s->state == P2P_STATE_SIGNALING);
     s->state = P2P_STATE_WAITING;
+    p2p_setup_mark(s, P2P_SETUP_SIGNALED, p2p_now_ms());
 
     // 如果对端未在线
     if (!payload[0]) {
@@ -708,13 +1116,13 @@ static void handle_sync_ack(struct p2p_session *s, const uint8_t *payload, int l
         else if (sess_ctx->candidate_syncing_base < (uint16_t)s->local_cand_cnt &&
                  ((s->local_cand_cnt - sess_ctx->candidate_syncing_base >= s->inst->sig_ctx.relay.candidate_sync_max) ||
                   !sess_ctx->trickle_last_time ||
-                  (P_tick_ms() - sess_ctx->trickle_last_time) >= P2P_RELAY_TRICKLE_BATCH_MS)) {
+                  (p2p_now_ms() - sess_ctx->trickle_last_time) >= P2P_RELAY_TRICKLE_BATCH_MS)) {
 
             send_sync(s, now);
         }
         // 还有候选待收集但当前已全部发完，进入攒批等待
         else if (!sess_ctx->trickle_last_time) {
-            sess_ctx->trickle_last_time = P_tick_ms(); s->inst->sig_ctx.relay.trickle_sessions++;
+            sess_ctx->trickle_last_time = p2p_now_ms(); s->inst->sig_ctx.relay.trickle_sessions++;
         }
     }
 }
@@ -752,6 +1160,10 @@ static void handle_peer_sync(struct p2p_session *s, const uint8_t *payload, int
     unpack_remote_candidates(s, payload, (int)base_len);
 
     if (has_fin) {
+        if (!s->remote_cand_done) {
+            P2P_TRACE(s, P2P_TRACE_SIG, 0, 0, 0, 0, 0, 0, "cands_done");
+            p2p_setup_mark(s, P2P_SETUP_CANDS_DONE, p2p_now_ms());
+        }
         s->remote_cand_done = true;
         print("I:", LA_F("%s: sync done\n", LA_F233, 233), TASK_SYNC_REMOTE);
     }
@@ -775,7 +1187,7 @@ static void handle_relay_fin(struct p2p_session *s, const uint8_t *payload, int
     print("I:", LA_F("%s: session suspend(st=%s)\n", LA_F224, 224),
           TASK_TOUCH, "WAIT_PEER");
     sess_ctx->state = SIG_RELAY_SESS_WAIT_PEER;
-    s->id = 0;
+    p2p_session_set_id(s, 0);
 
     reset_peer(sess_ctx, &s->inst->sig_ctx.relay);
 
@@ -783,6 +1195,7 @@ static void handle_relay_fin(struct p2p_session *s, const uint8_t *payload, int
     // RELAY FIN 经 TCP 可靠传输，等同于 NAT FIN；即使 NAT FIN（UDP）丢失也能正确触发断开
     if (s->nat.state > NAT_CLOSED) {
         s->nat.state = NAT_CLOSED;
+        p2p_session_wake(s);
     }
 }
 
@@ -824,24 +1237,42 @@ static void handle_relay_req(struct p2p_session *s, const uint8_t *payload, int
     uint8_t  msg = payload[2]; const uint8_t *req_data = payload + 3; int req_len = len - 3;
 
     // 去重：忽略正在处理的相同请求
-    if (sess_ctx->resp_sid == sid) {
-        print("V:", LA_F("%s: duplicate request ignored (sid=%u)\n", LA_F129, 129), TASK_RPC, sid);
-        return;
+    int n = 0;
+    while (n < P2P_RPC_WINDOW_MAX && sess_ctx->resp_sid[n]) {
+        if (sess_ctx->resp_sid[n] == sid) {
+            print("V:", LA_F("%s: duplicate request ignored (sid=%u)\n", LA_F129, 129), TASK_RPC, sid);
+            return;
+        }
+        n++;
     }
 
-    // 忽略旧请求
-    if (sess_ctx->rpc_last_sid != 0 && !uint16_circle_newer(sid, sess_ctx->rpc_last_sid)) {
+    // 忽略已接受过的请求（乱序到达的较小 sid 只要未出现过仍是新请求）
+    uint16_t last_sid = sess_ctx->rpc_last_sid;
+    if (!p2p_rpc_sid_accept(&sess_ctx->rpc_last_sid, &sess_ctx->rpc_seen, sid)) {
         print("V:", LA_F("%s: old request ignored (sid=%u <= last_sid=%u)\n", LA_F166, 166),
-              TASK_RPC, sid, sess_ctx->rpc_last_sid);
+              TASK_RPC, sid, last_sid);
         return;
     }
 
-    sess_ctx->resp_sid = sid;
+    // 按到达顺序追加；槽位用尽时丢弃最早的待回应请求
+    if (n == P2P_RPC_WINDOW_MAX) {
+        print("W:", LA_F("%s: new request (sid=%u) overrides pending request (sid=%u)\n", LA_F155, 155),
+              TASK_RPC, sid, sess_ctx->resp_sid[0]);
+        memmove(sess_ctx->resp_sid, sess_ctx->resp_sid + 1, sizeof(sess_ctx->resp_sid[0]) * (P2P_RPC_WINDOW_MAX - 1));
+        n--;
+    }
+    sess_ctx->resp_sid[n] = sid;
+
+    // 分片传输的分片 / 拉取请求，由 rpc 模块应答
+    if (msg == P2P_MSG_FRAG) {
+        rpc_on_request(s, sid, req_data, req_len);
+        return;
+    }
 
     // msg=0: 自动 echo 回复
     if (msg == 0) {
         print("V:", LA_F("%s msg=0: echo reply (sid=%u)\n", LA_F47, 47), TASK_RPC, sid);
-        p2p_signal_relay_response(s, 0, req_data, req_len);
+        p2p_signal_relay_response(s, sid, 0, req_data, req_len);
         return;
     }
 
@@ -865,12 +1296,14 @@ static void handle_relay_resp(struct p2p_session *s, const uint8_t *payload, int
     uint16_t sid  = nget_s(payload);
     uint8_t  code = payload[2]; const uint8_t *res_data = payload + 3; int res_len = len - 3;
 
-    // 仅命中当前挂起请求
-    if (!(sess_ctx->req_state == 1 && sess_ctx->req_sid == sid)) {
-        print("E:", LA_F("%s: irrelevant response (sid=%u, current sid=%u, state=%d)\n", LA_F152, 152),
-              TASK_RPC, sid, sess_ctx->req_sid, (int)sess_ctx->req_state);
+    // 仅命中挂起请求
+    int i = 0;
+    while (i < P2P_RPC_WINDOW_MAX && (!sid || sess_ctx->req_sid[i] != sid)) i++;
+    if (i == P2P_RPC_WINDOW_MAX) {
+        print("E:", LA_F("%s: irrelevant response (sid=%u)\n", LA_F578, 578), TASK_RPC, sid);
         return;
     }
+    sess_ctx->req_sid[i] = 0;
 
     // 错误响应
     if (code >= P2P_MSG_ERR_PEER_OFFLINE) {
@@ -879,21 +1312,13 @@ static void handle_relay_resp(struct p2p_session *s, const uint8_t *payload, int
         else
             print("W:", LA_F("%s: timeout (sid=%u)\n", LA_F238, 238), TASK_RPC, sid);
 
-        sess_ctx->req_state = 0;
-        sess_ctx->req_sid   = 0;
-
-        if (s->inst->cfg.on_response)
-            s->inst->cfg.on_response((p2p_session_t)s, sid, code, NULL, -1, s->inst->cfg.userdata);
+        rpc_on_response(s, sid, code, NULL, -1);
         return;
     }
 
     print("V:", LA_F("%s: complete (ses_id=%u), sid=%u code=%u\n", LA_F125, 125), TASK_RPC, s->id, sid, code);
 
-    sess_ctx->req_state = 0;
-    sess_ctx->req_sid   = 0;
-
-    if (s->inst->cfg.on_response)
-        s->inst->cfg.on_response((p2p_session_t)s, sid, code, res_data, res_len, s->inst->cfg.userdata);
+    rpc_on_response(s, sid, code, res_data, res_len);
 }
 
 /*
@@ -1018,7 +1443,7 @@ static void dispatch_proto(struct p2p_instance *inst, uint64_t now) {
             }
 
             assert(!s->id);
-            s->id = session_id;
+            p2p_session_set_id(s, session_id);
 
             handle_sync0_ack(s, ptr + P2P_SESS_ID_PSZ, now);
 
@@ -1065,7 +1490,7 @@ static void dispatch_proto(struct p2p_instance *inst, uint64_t now) {
 
                 // 通知业务层连接断开（session 被对方重置）
                 if (s->state >= P2P_STATE_LOST) {
-                    if (s->inst->cfg.on_state) s->inst->cfg.on_state((p2p_session_t)s, s->state, P2P_STATE_CLOSED, s->inst->cfg.userdata);
+                    if (s->inst->cfg.on_state && !s->standby) s->inst->cfg.on_state((p2p_session_t)s, s->state, P2P_STATE_CLOSED, s->inst->cfg.userdata);
                 }
 
                 // 重置 p2p 会话
@@ -1073,7 +1498,7 @@ static void dispatch_proto(struct p2p_instance *inst, uint64_t now) {
 
                 // 初始化 p2p 新会话状态
                 uint32_t old_id = s->id;
-                s->id = session_id;
+                p2p_session_set_id(s, session_id);
                 s->state = P2P_STATE_WAITING;
 
                 sess_ctx->state = SIG_RELAY_SESS_WAIT_PEER;
@@ -1146,20 +1571,16 @@ static void dispatch_proto(struct p2p_instance *inst, uint64_t now) {
             return;
         }
 
-        uint32_t session_id = nget_l(sig_ctx->payload);
+        const uint8_t *payload = sig_ctx->hdr.size > sizeof(sig_ctx->payload) ? sig_ctx->payload_large : sig_ctx->payload;
+        uint32_t session_id = nget_l(payload);
         if (!session_id) {
             print("W:", LA_F("%s: missing session_id in payload\n", LA_F154, 154), PROTO);
             return;
         }
 
-        struct p2p_session* s = inst->sessions_head;
-        for(; s; s = s->next) {
-            if (s->id == session_id) {
-                handler(s, sig_ctx->payload + P2P_SESS_ID_PSZ, (int)(sig_ctx->hdr.size - P2P_SESS_ID_PSZ), now);
-                break;
-            }
-        }
-        if (!s) {
+        struct p2p_session* s = p2p_session_find(inst, session_id);
+        if (s) handler(s, payload + P2P_SESS_ID_PSZ, (int)(sig_ctx->hdr.size - P2P_SESS_ID_PSZ), now);
+        else {
             print("W:", LA_F("%s: no session for session_id=%u\n", LA_F163, 163),
                   PROTO, session_id);
             return;
@@ -1167,11 +1588,33 @@ static void dispatch_proto(struct p2p_instance *inst, uint64_t now) {
 
     } while(0);
 
-    sig_ctx->last_recv_time = P_tick_ms();
+    sig_ctx->last_recv_time = p2p_now_ms();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
+/* 独立连接：发起 TCP 连接（立即连通时直接发送 ONLINE） */
+static ret_t relay_connect(struct p2p_instance *inst) {
+
+    p2p_relay_ctx_t *sig_ctx = &inst->sig_ctx.relay;
+
+    int rc = tcp_connect(&sig_ctx->sockfd, &sig_ctx->server_addr);
+    if (rc < 0) return E_UNKNOWN;
+
+    // 连接立即成功（少见）
+    if (rc == 0) {
+        print("I:", LA_F("[R] TCP connected immediately, sending ONLINE\n", LA_F448, 448));
+        sig_ctx->state = SIG_RELAY_WAIT_ONLINE_ACK;
+        send_online(inst, p2p_now_ms());
+    }
+    // 连接进行中
+    else {
+        sig_ctx->state = SIG_RELAY_CONNECTING;
+        sig_ctx->last_send_time = p2p_now_ms();
+    }
+    return E_NONE;
+}
+
 ret_t p2p_signal_relay_online(struct p2p_instance *inst, const char *local_peer_id,
                               const struct sockaddr_in *server) {
 
@@ -1189,47 +1632,16 @@ ret_t p2p_signal_relay_online(struct p2p_instance *inst, const char *local_peer_
     strncpy(sig_ctx->local_peer_id, local_peer_id, P2P_PEER_ID_MAX - 1);
     sig_ctx->local_peer_id[P2P_PEER_ID_MAX - 1] = '\0';
 
-    // 创建 TCP socket
-    sig_ctx->sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sig_ctx->sockfd == P_INVALID_SOCKET) {
-        print("E:", LA_F("[R] Failed to create TCP socket\n", LA_F444, 444));
-        return E_UNKNOWN;
-    }
-
-    // 设置非阻塞
-    if (P_sock_nonblock(sig_ctx->sockfd, true) != E_NONE) {
-        print("E:", LA_F("[R] Failed to set socket non-blocking\n", LA_F445, 445));
-        P_sock_close(sig_ctx->sockfd);
-        sig_ctx->sockfd = P_INVALID_SOCKET;
-        return E_UNKNOWN;
-    }
-
-    // 连接到服务器
-    print("I:", LA_F("[R] Connecting to %s:%d\n", LA_F442, 442),
-          inet_ntoa(server->sin_addr), ntohs(server->sin_port));
-
-    int ret = connect(sig_ctx->sockfd, (struct sockaddr *)&sig_ctx->server_addr,
-                      sizeof(sig_ctx->server_addr));
-
-    // 连接立即成功（少见）
-    if (ret == 0) {
-        print("I:", LA_F("[R] TCP connected immediately, sending ONLINE\n", LA_F448, 448));
-        sig_ctx->state = SIG_RELAY_WAIT_ONLINE_ACK;
-        send_online(inst, P_tick_ms());
-    }
-    // 连接进行中
-    else if (P_sock_is_inprogress()) {
+    // 共享连接：加入进程内到该服务器的连接，连接建立（且服务器确认可复用）后由 tick 发送 ONLINE
+    if (inst->cfg.relay_mux) {
+        ret_t ret = link_join(inst, server);
+        if (ret != E_NONE) return ret;
         sig_ctx->state = SIG_RELAY_CONNECTING;
-        sig_ctx->last_send_time = P_tick_ms();
-    }
-    else {
-        print("E:", LA_F("[R] TCP connect failed(%d)\n", LA_F446, 446), P_sock_errno());
-        P_sock_close(sig_ctx->sockfd);
-        sig_ctx->sockfd = P_INVALID_SOCKET;
-        return E_UNKNOWN;
+        sig_ctx->last_send_time = p2p_now_ms();
+        return E_NONE;
     }
 
-    return E_NONE;
+    return relay_connect(inst);
 }
 
 ret_t p2p_signal_relay_offline(struct p2p_instance *inst) {
@@ -1237,25 +1649,30 @@ ret_t p2p_signal_relay_offline(struct p2p_instance *inst) {
     p2p_relay_ctx_t *sig_ctx = &inst->sig_ctx.relay;
     if (sig_ctx->state == SIG_RELAY_INIT) return E_NONE;
 
-    if (sig_ctx->sockfd != P_INVALID_SOCKET) {
+    if (sig_ctx->link) link_leave(sig_ctx);
+    else if (sig_ctx->sockfd != P_INVALID_SOCKET) {
         P_sock_close(sig_ctx->sockfd);
     }
 
-    // 清理发送队列
-    p2p_send_chunk_t *chunk;
-    while ((chunk = sig_ctx->send_queue_head)) {
-        sig_ctx->send_queue_head = chunk->next;
-        free(chunk);
+    // 销毁 chunk 池（发送队列与回收链表中的 chunk 均位于池内存块中，整块释放）
+    p2p_send_chunk_block_t *blk;
+    while ((blk = sig_ctx->chunk_blocks)) {
+        sig_ctx->chunk_blocks = blk->next;
+        p2p_mem_add(sig_ctx->mem, P2P_MEM_SIGNAL, -(int64_t)sizeof(*blk));
+        p2p_arena_free(sig_ctx->arena, blk);
     }
+    sig_ctx->send_queue_head = sig_ctx->send_queue_rear = NULL;
+    sig_ctx->chunk_recycled = NULL;
     sig_ctx->send_queue_len = 0;
+    if (sig_ctx->payload_large) p2p_mem_add(sig_ctx->mem, P2P_MEM_SIGNAL, -(int64_t)P2P_RLY_PAYLOAD_LARGE_MAX);
+    if (sig_ctx->bulk_buf) p2p_mem_add(sig_ctx->mem, P2P_MEM_SIGNAL, -(int64_t)P2P_PKT_BULK_LARGE_MAX);
+    p2p_free(sig_ctx->payload_large);
+    p2p_free(sig_ctx->bulk_buf);
 
-    // 销毁 chunk 池（释放所有回收池中的 chunk）
-    while ((chunk = sig_ctx->chunk_recycled)) {
-        sig_ctx->chunk_recycled = chunk->next;
-        free(chunk);
-    }
-
+    p2p_mem_acct_t *mem = sig_ctx->mem;
     p2p_signal_relay_init(sig_ctx);
+    sig_ctx->arena = inst->arena;
+    sig_ctx->mem = mem;
     return E_NONE;
 }
 
@@ -1275,8 +1692,8 @@ void p2p_signal_relay_stun_ready(struct p2p_session *s) {
         // 同步发送首批候选（如果有）
         assert(sess_ctx->candidate_syncing_base == 0);
         if (s->local_cand_cnt || !s->inst->turn_pending)
-            send_sync(s, P_tick_ms());
-        else { sess_ctx->trickle_last_time = P_tick_ms(); s->inst->sig_ctx.relay.trickle_sessions++; }
+            send_sync(s, p2p_now_ms());
+        else { sess_ctx->trickle_last_time = p2p_now_ms(); s->inst->sig_ctx.relay.trickle_sessions++; }
     }
 }
 
@@ -1304,13 +1721,13 @@ void p2p_signal_relay_trickle_candidate(struct p2p_session *s) {
         if (s->inst->srflx_active >= s->inst->srflx_count && !s->inst->turn_pending) {
 
             sess_ctx->trickle_last_time = 0; s->inst->sig_ctx.relay.trickle_sessions--;
-            send_sync(s, P_tick_ms());
+            send_sync(s, p2p_now_ms());
         }
         // 或已经积累了足够的候选；又或者距离上次发送已经超过攒批时间窗口了
         else if ((s->local_cand_cnt - sess_ctx->candidate_syncing_base >= s->inst->sig_ctx.relay.candidate_sync_max) ||
-                 (P_tick_ms() - sess_ctx->trickle_last_time) >= P2P_RELAY_TRICKLE_BATCH_MS) {
+                 (p2p_now_ms() - sess_ctx->trickle_last_time) >= P2P_RELAY_TRICKLE_BATCH_MS) {
 
-            send_sync(s, P_tick_ms());
+            send_sync(s, p2p_now_ms());
         }
     }
     // todo: >SIG_RELAY_SESS_SYNCING 用于动态更新 srflx 地址的变更
@@ -1323,8 +1740,8 @@ ret_t p2p_signal_relay_connect(struct p2p_session *s, const char *remote_peer_id
     P_check(remote_peer_id && remote_peer_id[0], return E_INVALID;)
 
     p2p_relay_ctx_t *sig_ctx = &s->inst->sig_ctx.relay;
-    if (sig_ctx->state == SIG_RELAY_INIT) {
-        return E_NONE_CONTEXT;
+    if (sig_ctx->state == SIG_RELAY_INIT && !s->inst->sig_resolving) {
+        return E_NONE_CONTEXT;      // 还没调用 online()（服务器地址解析中则先登记，上线后自动同步）
     }
 
     p2p_relay_session_t *sess_ctx = &s->sig_sess.relay;
@@ -1341,7 +1758,7 @@ ret_t p2p_signal_relay_connect(struct p2p_session *s, const char *remote_peer_id
     // 已上线：立即发送 SYNC0；否则等待 ONLINE_ACK 后自动触发
     if (sig_ctx->state == SIG_RELAY_ONLINE) {
         sess_ctx->state = SIG_RELAY_SESS_WAIT_SYNC0_ACK;
-        send_sync0(s->inst, s, P_tick_ms());
+        send_sync0(s->inst, s, p2p_now_ms());
     }
     else sess_ctx->state = SIG_RELAY_SESS_WAIT_ONLINE;
 
@@ -1376,7 +1793,7 @@ ret_t p2p_signal_relay_disconnect(struct p2p_session *s) {
     memset(sess_ctx->remote_peer_id, 0, sizeof(sess_ctx->remote_peer_id));
 
     // 清理会话状态
-    s->id = 0;
+    p2p_session_set_id(s, 0);
     return E_NONE;
 }
 
@@ -1411,6 +1828,8 @@ ret_t p2p_signal_relay_packet(struct p2p_session *s,
         case P2P_PKT_DATA:     proto = "DATA";     break;
         case P2P_PKT_ACK:      proto = "ACK";      break;
         case P2P_PKT_CRYPTO:   proto = "CRYPTO";   break;
+        case P2P_PKT_DGRAM:    proto = "DGRAM";    break;
+        case P2P_PKT_BULK:     proto = "BULK";     break;
         case P2P_PKT_REACH:    proto = "REACH";    break;
         case P2P_PKT_CONN:     proto = "CONN";     break;
         case P2P_PKT_CONN_ACK: proto = "CONN_ACK"; break;
@@ -1420,19 +1839,21 @@ ret_t p2p_signal_relay_packet(struct p2p_session *s,
     }
 
     // 构造负载: [session_id(4)][P2P hdr(4)][payload]
-    uint8_t relay_payload[P2P_MAX_PAYLOAD];
+    // + BULK 大帧仅发给通告 P2P_RLY_FEATURE_BULK（大帧模式 P2P_RLY_FEATURE_BULK_LARGE）的服务器
+    uint8_t head[P2P_RLY_PACKET_PSZ(0)];
     int total_len = P2P_SESS_ID_PSZ + P2P_HDR_SIZE + payload_len;
-    if (total_len > P2P_MAX_PAYLOAD) {
-        print("E:", LA_F("%s: pkt payload exceeds limit (%d > %d)\n", LA_F179, 179), TASK_RELAY, proto, total_len, P2P_MAX_PAYLOAD);
+    int limit = type != P2P_PKT_BULK || !sig_ctx->feature_bulk ? P2P_MAX_PAYLOAD
+              : p2p_signal_relay_bulk_large(s->inst) ? (int)P2P_RLY_PAYLOAD_LARGE_MAX : (int)P2P_RLY_PAYLOAD_MAX;
+    if (total_len > limit) {
+        print("E:", LA_F("%s: pkt payload exceeds limit (%d > %d)\n", LA_F179, 179), TASK_RELAY, total_len, limit);
         return E_OUT_OF_CAPACITY;
     }
 
-    nwrite_l(relay_payload, s->id);
-    p2p_pkt_hdr_encode(relay_payload + P2P_SESS_ID_PSZ, type, flags, seq);
-    if (payload_len > 0 && payload)
-        memcpy(relay_payload + P2P_SESS_ID_PSZ + P2P_HDR_SIZE, payload, payload_len);
+    nwrite_l(head, s->id);
+    p2p_pkt_hdr_encode(head + P2P_SESS_ID_PSZ, type, flags, seq);
 
-    ret_t ret = tcp_send(sig_ctx, proto, P2P_RLY_PACKET, relay_payload, total_len, P_tick_ms());
+    ret_t ret = tcp_send_ex(sig_ctx, proto, P2P_RLY_PACKET, head, (int)sizeof(head),
+                            (const uint8_t *)payload, payload_len, p2p_now_ms());
     if (ret != E_NONE) return ret;
 
     sess_ctx->awaiting_relay_ready = true;
@@ -1443,12 +1864,27 @@ ret_t p2p_signal_relay_packet(struct p2p_session *s,
     return E_NONE;
 }
 
+bool p2p_signal_relay_bulk_large(const struct p2p_instance *inst) {
+    const p2p_relay_ctx_t *sig_ctx = &inst->sig_ctx.relay;
+    return inst->sig_mode == P2P_SIGNALING_MODE_RELAY && sig_ctx->feature_bulk_large && !sig_ctx->link;
+}
+
+uint8_t* p2p_signal_relay_bulk_buf(struct p2p_instance *inst) {
+    p2p_relay_ctx_t *sig_ctx = &inst->sig_ctx.relay;
+    if (!p2p_signal_relay_bulk_large(inst)) return NULL;
+    if (!sig_ctx->bulk_buf && (sig_ctx->bulk_buf = (uint8_t *)p2p_malloc(P2P_PKT_BULK_LARGE_MAX)))
+        p2p_mem_add(sig_ctx->mem, P2P_MEM_SIGNAL, P2P_PKT_BULK_LARGE_MAX);
+    return sig_ctx->bulk_buf;
+}
+
 /*
  * 通过 RELAY 服务器向对端发起 RPC 请求
  * 负载: [session_id(4)][sid(2)][msg(1)][data(N)]
+ *
+ * 在途请求数受 min(cfg.rpc_window, 服务器 ONLINE_ACK 通告的窗口) 限制。
  */
 ret_t p2p_signal_relay_request(struct p2p_session *s,
-                               uint8_t msg, const void *data, int len) {
+                               uint8_t msg, const void *data, int len, uint16_t *sid_out) {
 
     p2p_relay_session_t *sess_ctx = &s->sig_sess.relay;
 
@@ -1461,16 +1897,20 @@ ret_t p2p_signal_relay_request(struct p2p_session *s,
         return E_NO_SUPPORT;
     }
 
-    if (sess_ctx->req_state != 0) return E_BUSY;
+    int window = s->inst->cfg.rpc_window;
+    if (window <= 0 || window > P2P_RPC_WINDOW_MAX) window = P2P_RPC_WINDOW_MAX;
+    if (window > sig_ctx->rpc_window) window = sig_ctx->rpc_window;
 
-    // 生成非零循环序列号
-    static uint16_t _sid_base = 0;
-    uint16_t sid = ++_sid_base;
-    if (sid == 0) sid = ++_sid_base;
+    int slot = -1, active = 0;
+    for (int i = 0; i < P2P_RPC_WINDOW_MAX; i++) {
+        if (sess_ctx->req_sid[i]) active++;
+        else if (slot < 0) slot = i;
+    }
+    if (active >= window) return E_BUSY;
 
-    sess_ctx->req_state = 1/* waiting REQ_ACK */;
-    sess_ctx->req_sid   = sid;
-    sess_ctx->req_msg   = msg;
+    // 生成非零循环序列号（对端按 sid 去重，同一会话内必须单调）
+    uint16_t sid = ++sess_ctx->rpc_next_sid;
+    if (sid == 0) sid = ++sess_ctx->rpc_next_sid;
 
     uint8_t payload[P2P_MAX_PAYLOAD]; int n = 0;
     nwrite_l(payload + n, s->id); n += P2P_SESS_ID_PSZ;
@@ -1481,38 +1921,43 @@ ret_t p2p_signal_relay_request(struct p2p_session *s,
         n += len;
     }
 
-    ret_t ret = tcp_send(sig_ctx, "REQ", P2P_RLY_REQ, payload, n, P_tick_ms());
-    if (ret != E_NONE) {
-        sess_ctx->req_state = 0;
-        sess_ctx->req_sid   = 0;
-        return ret;
-    }
+    ret_t ret = tcp_send(sig_ctx, "REQ", P2P_RLY_REQ, payload, n, p2p_now_ms());
+    if (ret != E_NONE) return ret;
+
+    sess_ctx->req_sid[slot] = sid;
+    sess_ctx->req_msg[slot] = msg;
 
     print("I:", LA_F("%s req (ses_id=%u), sid=%u msg=%u len=%d\n", LA_F48, 48), TASK_RPC,
           s->id, sid, msg, len);
+    if (sid_out) *sid_out = sid;
     return E_NONE;
 }
 
 /*
  * 通过 RELAY 服务器向请求方回复 RPC 响应
  * 负载: [session_id(4)][sid(2)][code(1)][data(N)]
+ *
+ * sid=0 时回复最早到达的待回应请求。
  */
-ret_t p2p_signal_relay_response(struct p2p_session *s,
+ret_t p2p_signal_relay_response(struct p2p_session *s, uint16_t sid,
                                 uint8_t code, const void *data, int len) {
 
 
     P_check(len >= 0 && len <= P2P_MSG_DATA_MAX, return E_INVALID;)
     P_check(len == 0 || data, return E_INVALID;)
     p2p_relay_session_t *sess_ctx = &s->sig_sess.relay;
-    if (!sess_ctx->resp_sid) {
+    int i = 0;
+    if (sid) while (i < P2P_RPC_WINDOW_MAX && sess_ctx->resp_sid[i] && sess_ctx->resp_sid[i] != sid) i++;
+    if (i == P2P_RPC_WINDOW_MAX || !sess_ctx->resp_sid[i]) {
         print("E:", LA_F("%s: no pending request\n", LA_F157, 157), TASK_RPC);
         return E_INVALID;
     }
+    sid = sess_ctx->resp_sid[i];
 
     // 构造
     uint8_t payload[P2P_MAX_PAYLOAD]; int n = 0;
     nwrite_l(payload + n, s->id); n += P2P_SESS_ID_PSZ;
-    nwrite_s(payload + n, sess_ctx->resp_sid); n += 2;
+    nwrite_s(payload + n, sid); n += 2;
     payload[n++] = code;
     if (len > 0 && data) {
         memcpy(payload + n, data, (size_t)len);
@@ -1520,24 +1965,170 @@ ret_t p2p_signal_relay_response(struct p2p_session *s,
     }
 
     p2p_relay_ctx_t *sig_ctx = &s->inst->sig_ctx.relay;
-    ret_t ret = tcp_send(sig_ctx, "RESP", P2P_RLY_RESP, payload, n, P_tick_ms());
+    ret_t ret = tcp_send(sig_ctx, "RESP", P2P_RLY_RESP, payload, n, p2p_now_ms());
     if (ret != E_NONE) return ret;
 
     print("I:", LA_F("%s resp (ses_id=%u), sid=%u code=%u len=%d\n", LA_F51, 51), TASK_RPC,
-          s->id, sess_ctx->resp_sid, code, len);
+          s->id, sid, code, len);
 
-    // 标记请求已处理
-    sess_ctx->rpc_last_sid = sess_ctx->resp_sid;
-    sess_ctx->resp_sid = 0;
+    // 标记请求已处理（sid 已记入 rpc_seen），保持其余待回应请求的到达顺序
+    memmove(sess_ctx->resp_sid + i, sess_ctx->resp_sid + i + 1, sizeof(sess_ctx->resp_sid[0]) * (size_t)(P2P_RPC_WINDOW_MAX - 1 - i));
+    sess_ctx->resp_sid[P2P_RPC_WINDOW_MAX - 1] = 0;
     return E_NONE;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
 
+/*
+ * 共享连接上的本登录：推进连接，派发分拣给本登录的帧，推进上线流程
+ * @return true = 已上线流程中（继续协议状态维护），false = 等待连接 / 已退出
+ */
+static bool link_recv(struct p2p_instance *inst, uint64_t now) {
+
+    p2p_relay_ctx_t *sig_ctx = &inst->sig_ctx.relay;
+    p2p_relay_link_t *link = sig_ctx->link;
+
+    SPIN_LOCK(link->lock);
+    link_pump(link);
+    relay_link_st st = link->state; int8_t mux = link->mux; bool kicked = sig_ctx->mux_kicked;
+    uint8_t *buf = sig_ctx->mux_rx; int len = sig_ctx->mux_rx_len, cap = sig_ctx->mux_rx_cap;
+    sig_ctx->mux_rx = NULL;
+    sig_ctx->mux_rx_len = sig_ctx->mux_rx_cap = 0;
+    SPIN_UNLOCK(link->lock);
+
+    // 派发（处理中进入 ERROR 则已退出连接，丢弃其余帧）
+    for (int off = 0; off < len && sig_ctx->link; ) {
+        memcpy(&sig_ctx->hdr, buf + off, sizeof(p2p_relay_hdr_t));
+        sig_ctx->hdr.size = ntohs(sig_ctx->hdr.size);
+        off += (int)sizeof(p2p_relay_hdr_t);
+        memcpy(sig_ctx->payload, buf + off, sig_ctx->hdr.size);
+        off += sig_ctx->hdr.size;
+        dispatch_proto(inst, now);
+    }
+
+    // 缓冲留给下一批（期间未产生新缓冲时）
+    if (sig_ctx->link) {
+        SPIN_LOCK(link->lock);
+        if (!sig_ctx->mux_rx) { sig_ctx->mux_rx = buf; sig_ctx->mux_rx_cap = cap; buf = NULL; }
+        SPIN_UNLOCK(link->lock);
+    }
+    p2p_free(buf);
+    if (!sig_ctx->link) return false;
+
+    if (sig_ctx->state == SIG_RELAY_CONNECTING) {
+
+        // 服务器不支持复用：退回独立连接
+        if (sig_ctx->mux_id && !mux) {
+            print("I:", LA_F("[R] server does not support MUX, using a dedicated connection\n", LA_F661, 661));
+            link_leave(sig_ctx);
+            if (relay_connect(inst) != E_NONE) sig_ctx->state = SIG_RELAY_ERROR;
+            return false;
+        }
+        if (st == LINK_DEAD) { relay_fail(sig_ctx); return false; }
+
+        // 首个登录连通即上线；其余登录等首个登录确认服务器可复用
+        if (st == LINK_UP && (!sig_ctx->mux_id || mux > 0)) {
+            sig_ctx->state = SIG_RELAY_WAIT_ONLINE_ACK;
+            send_online(inst, now);
+        }
+        return false;
+    }
+
+    if (kicked) {
+        print("E:", LA_F("[R] MUX login %u closed by server\n", LA_F662, 662), (unsigned)sig_ctx->mux_id);
+        relay_fail(sig_ctx);
+        return false;
+    }
+    if (st == LINK_DEAD) { relay_fail(sig_ctx); return false; }
+    return true;
+}
+
+/*
+ * 共享连接上的本登录：发送队列中的整帧移入连接发送缓冲（登录切换时前置 SELECT）并尽力发出
+ */
+static void link_send(p2p_relay_ctx_t *sig_ctx, uint64_t now) {
+
+    p2p_relay_link_t *link = sig_ctx->link;
+
+    SPIN_LOCK(link->lock);
+    if (link->state == LINK_UP) {
+
+        if (link->tx_off) {
+            memmove(link->tx_buf, link->tx_buf + link->tx_off, (size_t)(link->tx_len - link->tx_off));
+            link->tx_len -= link->tx_off;
+            link->tx_off = 0;
+        }
+
+        p2p_send_chunk_t *chunk;
+        while ((chunk = sig_ctx->send_queue_head)) {
+            int sel = link->tx_id != (int32_t)sig_ctx->mux_id ? LINK_MUX_FRAME : 0;
+            if (link->tx_len + sel + chunk->len > P2P_RELAY_MUX_TX_MAX) break;     // 缓冲满：留待下次 tick
+            if (sel) link_put_mux(link, sig_ctx->mux_id, P2P_RLY_MUX_SELECT);
+            memcpy(link->tx_buf + link->tx_len, chunk->data, (size_t)chunk->len);
+            link->tx_len += chunk->len;
+            link->last_send = now;
+
+            if (!((sig_ctx->send_queue_head = chunk->next)))
+                sig_ctx->send_queue_rear = NULL;
+            --sig_ctx->send_queue_len;
+            chunk->next = sig_ctx->chunk_recycled;
+            sig_ctx->chunk_recycled = chunk;
+        }
+        link_flush(link);
+    }
+    if (link->state == LINK_DEAD) sig_ctx->mux_kicked = true;    // 下次 tick_recv 进入 ERROR
+    SPIN_UNLOCK(link->lock);
+}
+
+/* 共享连接是否空闲达到心跳间隔（任一登录的发送都算作连接活跃） */
+static bool link_idle(p2p_relay_link_t *link, uint64_t now) {
+    SPIN_LOCK(link->lock);
+    bool idle = tick_diff(now, link->last_send) > P2P_RELAY_HEARTBEAT_INTERVAL_MS;
+    SPIN_UNLOCK(link->lock);
+    return idle;
+}
+
+/* 协议状态维护：ONLINE_ACK 超时、trickle 攒批发送 */
+static void tick_maintain(struct p2p_instance *inst, uint64_t now) {
+
+    p2p_relay_ctx_t *sig_ctx = &inst->sig_ctx.relay;
+
+    // 服务器应答超时检查
+    if (sig_ctx->state == SIG_RELAY_WAIT_ONLINE_ACK) {
+        if (tick_diff(now, sig_ctx->last_send_time) > P2P_RELAY_ACK_TIMEOUT_MS) {
+            print("E:", LA_F("[R] %s timeout\n", LA_F439, 439), "ONLINE_ACK");
+            relay_fail(sig_ctx);
+        }
+        return;
+    }
+
+    if (!sig_ctx->trickle_sessions) return;
+
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
+        p2p_relay_session_t *sess_ctx = &s->sig_sess.relay;
+
+        // SYNCING: 攒批等待模式（上一批已确认 && 有新候选）
+        if (sess_ctx->state == SIG_RELAY_SESS_SYNCING && sess_ctx->trickle_last_time &&
+            sess_ctx->candidate_synced_count == sess_ctx->candidate_syncing_base &&
+            sess_ctx->candidate_syncing_base < (uint16_t) s->local_cand_cnt) {
+            send_sync(s, now);
+            sess_ctx->trickle_last_time = now;
+        }
+    }
+}
+
+
 void p2p_signal_relay_tick_recv(struct p2p_instance *inst, uint64_t now) {
 
     p2p_relay_ctx_t *sig_ctx = &inst->sig_ctx.relay;
+
+    // 共享连接：推进连接并派发分拣给本登录的帧
+    if (sig_ctx->link) {
+        if (sig_ctx->state >= SIG_RELAY_CONNECTING && link_recv(inst, now)) tick_maintain(inst, now);
+        return;
+    }
+
     if (sig_ctx->state < SIG_RELAY_CONNECTING ||
         sig_ctx->sockfd == P_INVALID_SOCKET) {
         return;
@@ -1560,9 +2151,7 @@ void p2p_signal_relay_tick_recv(struct p2p_instance *inst, uint64_t now) {
             send_online(inst, now);
         } else if (ret < 0) {
             print("E:", LA_F("[R] TCP connect select failed(%d)\n", LA_F447, 447), P_sock_errno());
-            P_sock_close(sig_ctx->sockfd);
-            sig_ctx->sockfd = P_INVALID_SOCKET;
-            sig_ctx->state = SIG_RELAY_ERROR;
+            relay_fail(sig_ctx);
         }
         return;
     }
@@ -1586,15 +2175,23 @@ void p2p_signal_relay_tick_recv(struct p2p_instance *inst, uint64_t now) {
                     memcpy(&sig_ctx->hdr, sig_ctx->hdr_buf, sizeof(p2p_relay_hdr_t));
                     sig_ctx->hdr.size = ntohs(sig_ctx->hdr.size);
 
-                    // 验证 payload 大小
-                    if (sig_ctx->hdr.size > P2P_MAX_PAYLOAD) {
+                    // 验证 payload 大小（大帧模式的 PACKET 读入 payload_large）
+                    int limit = sig_ctx->hdr.type != P2P_RLY_PACKET ? P2P_MAX_PAYLOAD
+                              : p2p_signal_relay_bulk_large(inst) ? (int)P2P_RLY_PAYLOAD_LARGE_MAX : (int)P2P_RLY_PAYLOAD_MAX;
+                    if (sig_ctx->hdr.size > limit) {
                         print("E:", LA_F("[R] payload size %u exceeds limit %u\n", LA_F455, 455),
-                              sig_ctx->hdr.size, P2P_MAX_PAYLOAD);
-                        P_sock_close(sig_ctx->sockfd);
-                        sig_ctx->sockfd = P_INVALID_SOCKET;
-                        sig_ctx->state = SIG_RELAY_ERROR;
+                              sig_ctx->hdr.size, limit);
+                        relay_fail(sig_ctx);
                         return;
                     }
+                    if (sig_ctx->hdr.size > sizeof(sig_ctx->payload) && !sig_ctx->payload_large) {
+                        if (!(sig_ctx->payload_large = (uint8_t *)p2p_malloc(P2P_RLY_PAYLOAD_LARGE_MAX))) {
+                            print("E:", LA_F("[R] OOM for large frame (%u bytes)\n", LA_F671, 671), sig_ctx->hdr.size);
+                            relay_fail(sig_ctx);
+                            return;
+                        }
+                        p2p_mem_add(sig_ctx->mem, P2P_MEM_SIGNAL, P2P_RLY_PAYLOAD_LARGE_MAX);
+                    }
 
                     // 切换到读取 payload
                     if (sig_ctx->hdr.size > 0) {
@@ -1612,7 +2209,8 @@ void p2p_signal_relay_tick_recv(struct p2p_instance *inst, uint64_t now) {
         else {
 
             // 读取 payload
-            n = recv(sig_ctx->sockfd, (char *)sig_ctx->payload + sig_ctx->offset, sig_ctx->hdr.size - sig_ctx->offset, 0);
+            uint8_t *buf = sig_ctx->hdr.size > sizeof(sig_ctx->payload) ? sig_ctx->payload_large : sig_ctx->payload;
+            n = recv(sig_ctx->sockfd, (char *)buf + sig_ctx->offset, sig_ctx->hdr.size - sig_ctx->offset, 0);
             if (n > 0) { sig_ctx->offset += n;
                 
                 if (sig_ctx->offset == sig_ctx->hdr.size) {
@@ -1627,56 +2225,25 @@ void p2p_signal_relay_tick_recv(struct p2p_instance *inst, uint64_t now) {
 
         if (n == 0) { // 连接关闭            
             print("I:", LA_F("[R] TCP connection closed by peer\n", LA_F450, 450));
-            P_sock_close(sig_ctx->sockfd);
-            sig_ctx->sockfd = P_INVALID_SOCKET;
-            sig_ctx->state = SIG_RELAY_ERROR;
+            relay_fail(sig_ctx);
             return;
         }
         else if (!P_sock_is_wouldblock()) {   // 出现错误
             print("E:", LA_F("[R] TCP recv error(%d)\n", LA_F452, 452), P_sock_errno());
-            P_sock_close(sig_ctx->sockfd);
-            sig_ctx->sockfd = P_INVALID_SOCKET;
-            sig_ctx->state = SIG_RELAY_ERROR;
+            relay_fail(sig_ctx);
             return;
         }
-        break; // WOULDBLOCK: 退出 recv 循环，继续执行下方协议状态维护
+        break; // WOULDBLOCK: 退出 recv 循环，继续执行协议状态维护
     }
 
-    // ====================================================================
-    // 协议状态维护
-    // ====================================================================
-
-    // 服务器应答超时检查
-    if (sig_ctx->state == SIG_RELAY_WAIT_ONLINE_ACK) {
-        if (tick_diff(now, sig_ctx->last_send_time) > P2P_RELAY_ACK_TIMEOUT_MS) {
-            print("E:", LA_F("[R] %s timeout\n", LA_F439, 439), "ONLINE_ACK");
-            P_sock_close(sig_ctx->sockfd);
-            sig_ctx->sockfd = P_INVALID_SOCKET;
-            sig_ctx->state = SIG_RELAY_ERROR;
-        }
-        return;
-    }
-
-    if (!sig_ctx->trickle_sessions) return;
-
-    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
-        p2p_relay_session_t *sess_ctx = &s->sig_sess.relay;
-
-        // SYNCING: 攒批等待模式（上一批已确认 && 有新候选）
-        if (sess_ctx->state == SIG_RELAY_SESS_SYNCING && sess_ctx->trickle_last_time &&
-            sess_ctx->candidate_synced_count == sess_ctx->candidate_syncing_base &&
-            sess_ctx->candidate_syncing_base < (uint16_t) s->local_cand_cnt) {
-            send_sync(s, now);
-            sess_ctx->trickle_last_time = now;
-        }
-    }
+    tick_maintain(inst, now);
 }
 
 void p2p_signal_relay_tick_send(struct p2p_instance *inst, uint64_t now) {
 
     p2p_relay_ctx_t *sig_ctx = &inst->sig_ctx.relay;
     if (sig_ctx->state <= SIG_RELAY_CONNECTING ||
-        sig_ctx->sockfd == P_INVALID_SOCKET) {
+        (!sig_ctx->link && sig_ctx->sockfd == P_INVALID_SOCKET)) {
         return;
     }
 
@@ -1684,61 +2251,68 @@ void p2p_signal_relay_tick_send(struct p2p_instance *inst, uint64_t now) {
     // 协议状态维护
     // ====================================================================
 
-    // 心跳保活
+    // 心跳保活（共享连接按连接空闲计，只需一个登录发送）
     if (sig_ctx->state >= SIG_RELAY_ONLINE) {
-        if (tick_diff(now, sig_ctx->last_send_time) > P2P_RELAY_HEARTBEAT_INTERVAL_MS) {
+        if (sig_ctx->link ? link_idle(sig_ctx->link, now)
+                          : tick_diff(now, sig_ctx->last_send_time) > P2P_RELAY_HEARTBEAT_INTERVAL_MS) {
             send_alive(inst, now);
         }
     }
 
+    // 共享连接：整帧移入连接发送缓冲
+    if (sig_ctx->link) { link_send(sig_ctx, now); return; }
+
     // ====================================================================
     // 推进发送队列（循环发送直到队列为空或 socket WOULDBLOCK）
     // ====================================================================
     
+    bool corked = sig_ctx->send_queue_len > P2P_RELAY_SEND_IOV && tcp_cork(sig_ctx->sockfd, true);
     while (sig_ctx->send_queue_head) {
 
-        p2p_send_chunk_t *chunk = sig_ctx->send_queue_head;
-        ssize_t n = send(sig_ctx->sockfd, (const char *)(chunk->data + sig_ctx->send_offset),
-                         chunk->len - sig_ctx->send_offset, 0);
+        // 聚合队列中的待发 chunk，一次系统调用发出（首个 chunk 从 send_offset 开始）
+        sock_msg_t iov[P2P_RELAY_SEND_IOV]; int cnt = 0, total = 0;
+        for (p2p_send_chunk_t *c = sig_ctx->send_queue_head; c && cnt < P2P_RELAY_SEND_IOV; c = c->next) {
+            int off = cnt ? 0 : sig_ctx->send_offset;
+            P_msg_set(&iov[cnt++], c->data + off, c->len - off);
+            total += c->len - off;
+        }
+        ssize_t n = tcp_sendv(sig_ctx->sockfd, iov, cnt);
+
+        if (n > 0) {
 
-        if (n > 0) { sig_ctx->send_offset += (int)n;
-            
-            // chunk 发送完成
-            if (sig_ctx->send_offset == chunk->len) {
+            // 出队已完整发出的 chunk 并回收到池，剩余字节记入 send_offset
+            bool partial = n < total;
+            int left = (int)n + sig_ctx->send_offset;
+            p2p_send_chunk_t *chunk;
+            while ((chunk = sig_ctx->send_queue_head) && left >= chunk->len) {
+                left -= chunk->len;
                 if (!((sig_ctx->send_queue_head = chunk->next)))
                     sig_ctx->send_queue_rear = NULL;
-                sig_ctx->send_offset = 0;  // 重置偏移，准备发送下一个 chunk
                 --sig_ctx->send_queue_len;
-                
-                // 回收到池
+
                 chunk->next = sig_ctx->chunk_recycled;
                 sig_ctx->chunk_recycled = chunk;
-
-                // 继续发送下一个 chunk
-                continue;
             }
-            
-            // chunk 部分发送，继续尝试
+            sig_ctx->send_offset = left;
+
+            // 部分发送：内核发送缓冲区已满，等下次 tick
+            if (partial) break;
             continue;
-            
-        } 
+        }
         else if (!n) {  // 连接关闭
 
             print("E:", LA_F("[R] TCP connection closed during send\n", LA_F451, 451));
-            P_sock_close(sig_ctx->sockfd);
-            sig_ctx->sockfd = P_INVALID_SOCKET;
-            sig_ctx->state = SIG_RELAY_ERROR;
+            relay_fail(sig_ctx);
             return;
         }
         else if (!P_sock_is_wouldblock()) { // 出现错误
 
             print("E:", LA_F("[R] TCP send error(%d)\n", LA_F453, 453), P_sock_errno());
-            P_sock_close(sig_ctx->sockfd);
-            sig_ctx->sockfd = P_INVALID_SOCKET;
-            sig_ctx->state = SIG_RELAY_ERROR;
+            relay_fail(sig_ctx);
             
             // 错误时出队并回收当前 chunk
             // fixme: 是全部回收，还是只回收当前 chunk？
+            p2p_send_chunk_t *chunk = sig_ctx->send_queue_head;
             sig_ctx->send_queue_head = chunk->next;
             if (!sig_ctx->send_queue_head) {
                 sig_ctx->send_queue_rear = NULL;
@@ -1751,7 +2325,9 @@ void p2p_signal_relay_tick_send(struct p2p_instance *inst, uint64_t now) {
 
             return;            
         }
+        else break;     // WOULDBLOCK
     }
+    if (corked) tcp_cork(sig_ctx->sockfd, false);   // 出错分支已关闭 socket，无需 uncork
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -48,6 +48,7 @@
  *   - DATA:          P2P 失败后的数据包中继（可选）
  *   - ACK:           P2P 失败后的确认包中继（可选）
  *   - CRYPTO:        P2P 失败后的加密包中继（可选）
+ *   - MUX:           连接复用的登录选择 / 关闭（cfg.relay_mux，同进程实例共享一条 TCP 连接，可选）
  *
  * 协议详细格式参见 p2pp.h（RELAY 模式信令协议）。
  *
@@ -132,6 +133,7 @@
 
 /* 前向声明 */
 struct p2p_session;
+struct p2p_relay_link;                                  /* 进程内共享连接（cfg.relay_mux，见 p2p_signal_relay.c）*/
 
 /* ============================================================================
  * RELAY 模式参数配置
@@ -141,6 +143,18 @@ struct p2p_session;
 #define P2P_RELAY_ACK_TIMEOUT_MS            5000        /* ACK 响应超时（毫秒）*/
 #define P2P_RELAY_TRICKLE_BATCH_MS          1000        /* Trickle 攒批窗口（毫秒）*/
 #define P2P_RELAY_MAX_CANDS_PER_PACKET      10          /* 每包最大候选数 */
+#ifndef P2P_FIXED_MEM
+#define P2P_RELAY_CHUNK_BLOCK               16          /* chunk 池每次扩容的 chunk 数（一次分配）*/
+#else
+#define P2P_RELAY_CHUNK_BLOCK               3           /* 固定内存构建：一块不超过 16KB 级 */
+#endif
+#define P2P_RELAY_SEND_IOV                  64          /* 每次聚合发送的最大 chunk 数（不超过 IOV_MAX）*/
+#ifndef P2P_RELAY_TCP_NODELAY
+#define P2P_RELAY_TCP_NODELAY               1           /* 1=关闭 Nagle，队列超过一次聚合发送时 cork 合并；0=保留 Nagle */
+#endif
+#define P2P_RELAY_MUX_LOGINS                1024        /* 一条共享连接承载的登录数上限（超出另建连接）*/
+#define P2P_RELAY_MUX_TX_MAX                (64 * 1024) /* 共享连接发送缓冲（字节）*/
+#define P2P_RELAY_MUX_RX_MAX                (1024 * 1024) /* 单个登录待处理接收帧上限（实例长期不 tick 时退出该登录）*/
 
 /* ============================================================================
  * TCP 接收状态机
@@ -157,11 +171,17 @@ typedef enum {
 
 /* 发送 chunk（固定大小的内存块）*/
 typedef struct p2p_send_chunk {
-    uint8_t data[P2P_MTU];                              /* 数据缓冲区 (1200 字节) */
+    uint8_t data[sizeof(p2p_relay_hdr_t) + P2P_RLY_PAYLOAD_MAX]; /* 数据缓冲区（可容纳 BULK 大帧）*/
     int len;                                            /* 有效数据长度 */
     struct p2p_send_chunk *next;                        /* 链表指针（用于队列和回收池）*/
 } p2p_send_chunk_t;
 
+/* chunk 池内存块（P2P_RELAY_CHUNK_BLOCK 个 chunk 一次分配，连接下线时整块释放）*/
+typedef struct p2p_send_chunk_block {
+    struct p2p_send_chunk_block *next;
+    p2p_send_chunk_t chunks[P2P_RELAY_CHUNK_BLOCK];
+} p2p_send_chunk_block_t;
+
 /* ============================================================================
  * RELAY 实例上下文（instance 级别：与服务器的 TCP 连接）
  * ============================================================================ */
@@ -191,12 +211,16 @@ typedef struct {
     uint8_t             candidate_sync_max;             /* 服务器允许的单包最大候选数（0=使用本地默认）*/
     bool                feature_relay;                  /* 支持数据包中继 */
     bool                feature_msg;                    /* 支持 RPC 机制 */
+    uint8_t             rpc_window;                     /* 每会话并发 RPC 数（ONLINE_ACK 尾字节，旧服务器为 1）*/
+    bool                feature_bulk;                   /* 支持 BULK 大帧（P2P_RLY_PAYLOAD_MAX）*/
+    bool                feature_bulk_large;             /* 支持 BULK 大帧模式（P2P_RLY_PAYLOAD_LARGE_MAX）*/
 
     /* TCP 接收状态机 */
     relay_recv_state_t  recv_state;                     /* 接收状态 */
     uint8_t             hdr_buf[sizeof(p2p_relay_hdr_t)]; /* 包头缓冲区 */
     p2p_relay_hdr_t     hdr;                            /* 解析后的包头 */
-    uint8_t             payload[P2P_MAX_PAYLOAD];       /* 负载缓冲区（固定 1196 字节）*/
+    uint8_t             payload[P2P_RLY_PAYLOAD_MAX];   /* 负载缓冲区（PACKET 可为 BULK 大帧）*/
+    uint8_t            *payload_large;                  /* 大帧模式负载缓冲区（P2P_RLY_PAYLOAD_LARGE_MAX，首个大帧到达时分配）*/
     uint16_t            offset;                         /* 当前读取偏移 */
 
     /* 发送队列 */
@@ -205,8 +229,22 @@ typedef struct {
     int                send_queue_len;                  /* 发送队列长度（chunk 数）*/
     int                send_offset;                    /* 当前 chunk 的已发送偏移 */
 
-    /* 发送 chunk 回收池（动态内存 + 链表）*/
+    /* 发送 chunk 回收池（按块分配 + 链表）*/
     p2p_send_chunk_t   *chunk_recycled;                 /* chunk 回收链表头 */
+    p2p_send_chunk_block_t *chunk_blocks;               /* 已分配的内存块链表 */
+    struct p2p_arena   *arena;                          /* chunk 块所在的实例内存区（NULL = 全局分配） */
+    struct p2p_mem_acct *mem;                           /* 缓冲区计入的实例内存计量（P2P_MEM_SIGNAL，NULL = 不计量） */
+    uint8_t            *bulk_buf;                       /* 大帧模式 BULK 组帧缓冲（P2P_PKT_BULK_LARGE_MAX，按需分配）*/
+
+    /* 共享连接（cfg.relay_mux）：sockfd 保持无效，收发经 link；
+     * 连接上读到的本登录帧由读取方追加到 mux_rx（[hdr][payload]...），本实例 tick 时派发 */
+    struct p2p_relay_link *link;                        /* 所属共享连接（NULL = 独立连接）*/
+    struct p2p_instance *owner;                         /* 所属实例（读取方唤醒用）*/
+    uint16_t            mux_id;                         /* 登录号（0 = 连接的首个登录）*/
+    bool                mux_kicked;                     /* 服务器关闭了本登录（MUX CLOSE）或接收积压超限 */
+    uint8_t            *mux_rx;                         /* 待派发的接收帧 */
+    int                 mux_rx_len;
+    int                 mux_rx_cap;
 
 } p2p_relay_ctx_t;
 
@@ -237,12 +275,13 @@ typedef struct {
     /* 数据中继流控 */
     bool                awaiting_relay_ready;            /* 等待 DATA/ACK/CRYPTO 转发确认（READY）*/
 
-    /* MSG RPC 上下文管理 */
-    uint16_t            rpc_last_sid;                   /* 最后完成的 sid（用于判断新旧请求，支持循环）*/
-    uint8_t             req_state;                      /* A端: 0=空闲 1=等待 RESP */
-    uint16_t            req_sid;                        /* A端: 当前挂起的 RPC 序列号（0=无挂起）*/
-    uint8_t             req_msg;                        /* A端: 挂起请求的消息 ID */
-    uint16_t            resp_sid;                       /* B端: 待回应的 RPC 序列号（0=无）*/
+    /* MSG RPC 上下文管理（流水线：最多 P2P_RPC_WINDOW_MAX 个 sid 同时进行）*/
+    uint16_t            rpc_next_sid;                   /* A端: 上一个分配的 sid（循环自增，跳过 0）*/
+    uint16_t            req_sid[P2P_RPC_WINDOW_MAX];    /* A端: 等待 RESP 的 sid（0=空闲槽）*/
+    uint8_t             req_msg[P2P_RPC_WINDOW_MAX];    /* A端: 对应请求的消息 ID */
+    uint16_t            rpc_last_sid;                   /* B端: 已接受的最大 sid（用于判断新旧请求，支持循环）*/
+    uint32_t            rpc_seen;                       /* B端: rpc_last_sid 之前 32 个 sid 的接受位图（p2p_rpc_sid_accept）*/
+    uint16_t            resp_sid[P2P_RPC_WINDOW_MAX];   /* B端: 待回应的 sid，按到达顺序排列（0=结束）*/
 
 } p2p_relay_session_t;
 
@@ -310,6 +349,14 @@ ret_t p2p_signal_relay_online(struct p2p_instance *inst, const char *local_peer_
  */
 ret_t p2p_signal_relay_offline(struct p2p_instance *inst);
 
+/*
+ * 当前用于轮询的信令 socket（共享连接时为连接的 socket）
+ *
+ * @param connecting  输出：非阻塞 connect 是否进行中（需等待可写）
+ * @return            P_INVALID_SOCKET = 无
+ */
+sock_t p2p_signal_relay_sock(const p2p_relay_ctx_t *ctx, bool *connecting);
+
 //-----------------------------------------------------------------------------
 
 /*
@@ -360,7 +407,7 @@ ret_t p2p_signal_relay_disconnect(struct p2p_session *s);
  *       如果 awaiting_relay_ready 为 true，返回 E_BUSY。
  *
  * @param s           P2P 会话
- * @param type        包类型（P2P_PKT_DATA / P2P_PKT_ACK / P2P_PKT_CRYPTO）
+ * @param type        包类型（P2P_PKT_DATA / P2P_PKT_ACK / P2P_PKT_CRYPTO；服务器支持时可为 P2P_PKT_BULK）
  * @param flags       包标志
  * @param seq         序列号
  * @param payload     负载数据
@@ -371,6 +418,19 @@ ret_t p2p_signal_relay_packet(struct p2p_session *s,
                               uint8_t type, uint8_t flags, uint16_t seq,
                               const void *payload, uint16_t payload_len);
 
+/*
+ * BULK 大帧模式（P2P_RLY_FEATURE_BULK_LARGE）
+ *
+ * 服务器通告大帧模式且本实例使用独立连接时可收发负载达 P2P_PKT_BULK_LARGE_MAX 的 BULK 帧；
+ * 共享连接按整帧拷入 P2P_RELAY_MUX_TX_MAX 发送缓冲，不承载大帧。
+ *
+ * p2p_signal_relay_bulk_large: 本实例可收发大帧（CONN 能力据此通告 RELIABLE_CAP2_BULK_LARGE）
+ * p2p_signal_relay_bulk_buf:   大帧组帧缓冲（P2P_PKT_BULK_LARGE_MAX 字节，实例内各会话共用，首次调用时分配）；
+ *                              不支持大帧或 OOM 时返回 NULL
+ */
+bool     p2p_signal_relay_bulk_large(const struct p2p_instance *inst);
+uint8_t* p2p_signal_relay_bulk_buf(struct p2p_instance *inst);
+
 /*
  * 通过 RELAY 服务器向对端发起 RPC 请求
  *
@@ -378,21 +438,23 @@ ret_t p2p_signal_relay_packet(struct p2p_session *s,
  * @param msg  消息类型（0=echo，>0=应用自定义）
  * @param data 请求数据
  * @param len  数据长度
- * @return     E_NONE=成功，E_BUSY=已有挂起请求，其他=错误码
+ * @param sid_out 输出分配的 sid（可为 NULL）
+ * @return     E_NONE=成功，E_BUSY=在途请求已达窗口，其他=错误码
  */
 ret_t p2p_signal_relay_request(struct p2p_session *s,
-                               uint8_t msg, const void *data, int len);
+                               uint8_t msg, const void *data, int len, uint16_t *sid_out);
 
 /*
  * 通过 RELAY 服务器向请求方回复 RPC 响应
  *
  * @param s    P2P 会话
+ * @param sid  待回复请求的 sid（0=最早到达的待回复请求）
  * @param code 响应码
  * @param data 响应数据
  * @param len  数据长度
  * @return     E_NONE=成功，其他=错误码
  */
-ret_t p2p_signal_relay_response(struct p2p_session *s,
+ret_t p2p_signal_relay_response(struct p2p_session *s, uint16_t sid,
                                 uint8_t code, const void *data, int len);
 
 
@@ -0,0 +1,836 @@
+/*
+ * 进程内确定性网络模拟实现，拓扑与语义见 p2p_sim.h
+ */
+
+#define MOD_TAG "SIM"
+
+#include "p2p_internal.h"
+#include "p2p_sim.h"
+
+#ifdef P2P_SIM
+
+#define SIM_PUBLIC_NET          0xC6120000u     /* 198.18.0.0/15 */
+#define SIM_PUBLIC_MAX          0x1FFFE
+#define SIM_PRIVATE_NET         0x0A000000u     /* 10.0.0.0/8：10.(nat>>8).(nat&255).(idx+2) */
+#define SIM_NAT_MAX             0x10000
+#define SIM_NAT_PORTS           (65536 - P2P_SIM_NAT_PORT_BASE)
+#define SIM_RXQ_MAX             1024            /* 每实例待收包上限 */
+#define SIM_TICK_ROUNDS         8               /* 同一时刻内零时延往返的最大轮数 */
+
+enum { SIM_EV_PKT = 0, SIM_EV_SIGNAL, SIM_EV_TIMER };
+enum { SIM_PUB_NAT = 0, SIM_PUB_HOST, SIM_PUB_STUN };
+
+/*
+ * 事件：包（hop 0 = 网络中，到期时做入向转换与路由；hop 1 = 已过接收方链路，到期交付）、信令消息，
+ * 或实例定时器（每实例一个，常驻，由 p2p_sim_run 按 p2p_next_timeout_ms 重排）
+ */
+typedef struct sim_ev {
+    uint64_t                due_us;
+    uint32_t                ord;
+    int                     pos;            // 堆中下标（-1 = 不在堆中）
+    uint8_t                 kind;
+    uint8_t                 hop;
+    int                     src_nat;        // 发送方所在 NAT（-1 = 公网）：私网目的地址只在同一 NAT 内可达
+    struct sockaddr_in      from;           // 接收方看到的来源地址（已做出向转换）
+    struct sockaddr_in      to;             // 目的地址（入向转换后为主机地址）
+    struct p2p_sim_node*    node;           // 目的实例（hop 1 / SIGNAL / TIMER；实例解除关联时置 NULL）
+    p2p_session_t           sess;           // SIGNAL：目的会话
+    int                     len;
+    uint8_t                 data[];
+} sim_ev_t;
+
+typedef struct {
+    uint32_t                ip;
+    uint16_t                port;
+} sim_ep_t;
+
+/* NAT 映射：外部端口为 P2P_SIM_NAT_PORT_BASE + 下标 */
+typedef struct {
+    sim_ep_t                in;             // 内部端点
+    sim_ep_t                dst;            // 对称型：映射所属的目的地址
+    uint64_t                last_us;        // 最近一次出向流量
+    sim_ep_t*               perms;          // 内部端点发送过的目的地址（入向过滤依据）
+    int                     perm_cnt, perm_cap;
+    bool                    live;
+} sim_map_t;
+
+typedef struct {
+    p2p_sim_nat_type_t      type;
+    uint32_t                pub_ip;
+    uint64_t                ttl_us;
+    sim_map_t*              maps;
+    int                     map_cnt, map_cap;
+    int                     hosts[P2P_SIM_HOSTS_PER_NAT];   // 私网地址末字节 - 2 → 主机编号
+    int                     host_cnt;
+} sim_nat_t;
+
+typedef struct {
+    uint16_t                port;
+    struct p2p_sim_node*    node;
+} sim_bind_t;
+
+typedef struct {
+    int                     nat;
+    p2p_sim_link_t          link;
+    sim_bind_t*             binds;
+    int                     bind_cnt, bind_cap;
+    uint16_t                next_port;
+    struct sockaddr_in      addr;           // 主机地址（route 表唯一项）
+    uint32_t                mask;
+    route_ctx_t             route;
+} sim_host_t;
+
+struct p2p_sim_node {
+    struct p2p_instance*    inst;
+    int                     host;
+    sim_ev_t**              rxq;            // 环形接收队列
+    int                     rx_head, rx_cnt;
+    sim_ev_t*               timer;          // 定时器事件
+    bool                    ready;          // 在待处理列表中（有新包、信令到达或定时器到期）
+    bool                    driven;         // 由 p2p_sim_run 驱动
+};
+
+/* 信令配对（按会话指针开放寻址；任一端实例解除关联后 peer 置 NULL，表项保留供同一地址的新会话覆盖） */
+typedef struct {
+    p2p_session_t           sess, peer;
+    struct p2p_sim_node*    node;           // sess 所属实例
+    struct p2p_sim_node*    peer_node;      // peer 所属实例
+    int                     delay_ms;
+} sim_pair_t;
+
+typedef struct {
+    uint8_t                 kind;
+    int                     idx;
+} sim_pub_t;
+
+static struct {
+    uint64_t                now_us;
+    uint64_t                rng;
+    uint32_t                ord;
+    int                     selected;
+    sim_nat_t*              nats;
+    int                     nat_cnt, nat_cap;
+    sim_host_t**            hosts;
+    int                     host_cnt, host_cap;
+    sim_pub_t*              pubs;           // 公网地址 SIM_PUBLIC_NET + 1 + k 的归属
+    int                     pub_cnt, pub_cap;
+    sim_ev_t**              heap;
+    int                     ev_cnt, ev_cap;
+    sim_pair_t*             pairs;
+    int                     pair_cnt, pair_cap;
+    struct p2p_sim_node**   ready;          // 待处理实例（p2p_sim_run 只处理这些实例，不逐一扫描）
+    int                     ready_cnt, ready_cap;
+    p2p_sim_stats_t         st;
+} g_sim = { .now_us = P2P_SIM_EPOCH_US, .rng = 0x9E3779B97F4A7C15ull };
+
+/* 数组扩容（元素数达到容量时翻倍） */
+static bool grow(void **arr, int *cap, int cnt, size_t elem) {
+    if (cnt < *cap) return true;
+    int n = *cap ? *cap * 2 : 16;
+    void *p = p2p_realloc(*arr, elem * (size_t)n);
+    if (!p) return false;
+    *arr = p;
+    *cap = n;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 随机数
+
+static uint64_t rnd64(void) {                               // xorshift64*
+    g_sim.rng ^= g_sim.rng >> 12; g_sim.rng ^= g_sim.rng << 25; g_sim.rng ^= g_sim.rng >> 27;
+    return g_sim.rng * 2685821657736338717ull;
+}
+
+static double rnd_unit(void) {
+    return (double)(rnd64() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static bool rnd_hit(float p) {
+    return p > 0 && rnd_unit() < p;
+}
+
+/* 单段链路时延：固定时延 + 均匀分布 ±jitter */
+static uint64_t link_delay(const p2p_sim_link_t *l) {
+    int64_t us = (int64_t)l->delay_ms * 1000;
+    if (l->jitter_ms > 0) us += (int64_t)((rnd_unit() * 2.0 - 1.0) * l->jitter_ms * 1000);
+    return us > 0 ? (uint64_t)us : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 事件最小堆（到期时刻，同时刻按入队顺序）
+
+static bool ev_before(const sim_ev_t *a, const sim_ev_t *b) {
+    return a->due_us != b->due_us ? a->due_us < b->due_us : (int32_t)(a->ord - b->ord) < 0;
+}
+
+static void heap_place(int i, sim_ev_t *e) {
+    g_sim.heap[i] = e;
+    e->pos = i;
+}
+
+static void heap_up(int i, sim_ev_t *e) {
+    while (i > 0) {
+        int up = (i - 1) / 2;
+        if (!ev_before(e, g_sim.heap[up])) break;
+        heap_place(i, g_sim.heap[up]);
+        i = up;
+    }
+    heap_place(i, e);
+}
+
+static void heap_down(int i, sim_ev_t *e) {
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= g_sim.ev_cnt) break;
+        if (c + 1 < g_sim.ev_cnt && ev_before(g_sim.heap[c + 1], g_sim.heap[c])) c++;
+        if (!ev_before(g_sim.heap[c], e)) break;
+        heap_place(i, g_sim.heap[c]);
+        i = c;
+    }
+    heap_place(i, e);
+}
+
+/* 入堆（失败时事件仍归调用方） */
+static bool heap_push(sim_ev_t *e) {
+    if (!grow((void **)&g_sim.heap, &g_sim.ev_cap, g_sim.ev_cnt, sizeof(*g_sim.heap))) return false;
+    e->ord = g_sim.ord++;
+    heap_up(g_sim.ev_cnt++, e);
+    return true;
+}
+
+static void heap_remove(sim_ev_t *e) {
+    int i = e->pos;
+    sim_ev_t *last = g_sim.heap[--g_sim.ev_cnt];
+    e->pos = -1;
+    if (last == e) return;
+    if (i > 0 && ev_before(last, g_sim.heap[(i - 1) / 2])) heap_up(i, last);
+    else heap_down(i, last);
+}
+
+static sim_ev_t *heap_pop_due(uint64_t now_us) {
+    if (!g_sim.ev_cnt || g_sim.heap[0]->due_us > now_us) return NULL;
+    sim_ev_t *top = g_sim.heap[0];
+    heap_remove(top);
+    return top;
+}
+
+static sim_ev_t *ev_new(uint8_t kind, const void *data, int len) {
+    sim_ev_t *e = (sim_ev_t *)p2p_calloc(1, sizeof(*e) + (size_t)len);
+    if (!e) return NULL;
+    e->kind = kind;
+    e->len = len;
+    memcpy(e->data, data, (size_t)len);
+    return e;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 地址
+
+static int pub_alloc(uint8_t kind, int idx, uint32_t *ip) {
+    if (g_sim.pub_cnt >= SIM_PUBLIC_MAX
+        || !grow((void **)&g_sim.pubs, &g_sim.pub_cap, g_sim.pub_cnt, sizeof(*g_sim.pubs))) return -1;
+    g_sim.pubs[g_sim.pub_cnt].kind = kind;
+    g_sim.pubs[g_sim.pub_cnt].idx = idx;
+    *ip = htonl(SIM_PUBLIC_NET + 1 + (uint32_t)g_sim.pub_cnt);
+    return g_sim.pub_cnt++;
+}
+
+static const sim_pub_t *pub_find(uint32_t ip) {
+    uint32_t k = ntohl(ip) - SIM_PUBLIC_NET - 1;
+    return k < (uint32_t)g_sim.pub_cnt ? &g_sim.pubs[k] : NULL;
+}
+
+static inline bool ip_private(uint32_t ip) {
+    return (ntohl(ip) & 0xFF000000u) == SIM_PRIVATE_NET;
+}
+
+/* 私网地址所属主机（不存在返回 -1） */
+static int private_host(uint32_t ip, int *nat) {
+    uint32_t h = ntohl(ip);
+    int n = (int)((h >> 8) & 0xFFFF), k = (int)(h & 0xFF) - 2;
+    *nat = n;
+    if (n >= g_sim.nat_cnt || k < 0 || k >= g_sim.nats[n].host_cnt) return -1;
+    return g_sim.nats[n].hosts[k];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// NAT
+
+static bool ep_eq(const sim_ep_t *e, uint32_t ip, uint16_t port) {
+    return e->ip == ip && e->port == port;
+}
+
+static inline bool map_alive(const sim_nat_t *n, const sim_map_t *m) {
+    return m->live && g_sim.now_us - m->last_us <= n->ttl_us;
+}
+
+static void map_drop(sim_map_t *m) {
+    p2p_free(m->perms);
+    memset(m, 0, sizeof(*m));
+}
+
+/* 出向转换：查找或创建映射，刷新空闲计时并登记目的地址许可，返回外部端口（<0 端口耗尽） */
+static int nat_out(sim_nat_t *n, const struct sockaddr_in *from, const struct sockaddr_in *to) {
+
+    bool sym = n->type == P2P_SIM_NAT_SYMMETRIC;
+    uint32_t dip = to->sin_addr.s_addr;
+    uint16_t dport = to->sin_port;
+
+    sim_map_t *m = NULL;
+    for (int i = 0; i < n->map_cnt; i++) {
+        sim_map_t *x = &n->maps[i];
+        if (!x->live || !ep_eq(&x->in, from->sin_addr.s_addr, from->sin_port)) continue;
+        if (sym && !ep_eq(&x->dst, dip, dport)) continue;
+        if (!map_alive(n, x)) { map_drop(x); continue; }   // 过期映射作废，同一端点重新分配外部端口
+        m = x;
+        break;
+    }
+    if (!m) {
+        if (n->map_cnt >= SIM_NAT_PORTS
+            || !grow((void **)&n->maps, &n->map_cap, n->map_cnt, sizeof(*n->maps))) return -1;
+        m = &n->maps[n->map_cnt++];
+        memset(m, 0, sizeof(*m));
+        m->in.ip = from->sin_addr.s_addr;
+        m->in.port = from->sin_port;
+        if (sym) { m->dst.ip = dip; m->dst.port = dport; }
+        m->live = true;
+    }
+    m->last_us = g_sim.now_us;
+
+    int i = 0;
+    while (i < m->perm_cnt && !ep_eq(&m->perms[i], dip, dport)) i++;
+    if (i == m->perm_cnt && grow((void **)&m->perms, &m->perm_cap, m->perm_cnt, sizeof(*m->perms))) {
+        m->perms[m->perm_cnt].ip = dip;
+        m->perms[m->perm_cnt++].port = dport;
+    }
+    return P2P_SIM_NAT_PORT_BASE + (int)(m - n->maps);
+}
+
+/* 入向转换：映射有效且来源获许可时把目的地址改写为内部端点 */
+static bool nat_in(sim_nat_t *n, sim_ev_t *e) {
+
+    int k = (int)ntohs(e->to.sin_port) - P2P_SIM_NAT_PORT_BASE;
+    if (k < 0 || k >= n->map_cnt || !map_alive(n, &n->maps[k])) return false;
+
+    sim_map_t *m = &n->maps[k];
+    if (n->type != P2P_SIM_NAT_FULL_CONE) {
+        bool any_port = n->type == P2P_SIM_NAT_RESTRICTED;
+        int i = 0;
+        while (i < m->perm_cnt && !(m->perms[i].ip == e->from.sin_addr.s_addr
+                                    && (any_port || m->perms[i].port == e->from.sin_port))) i++;
+        if (i == m->perm_cnt) return false;
+    }
+    e->to.sin_addr.s_addr = m->in.ip;
+    e->to.sin_port = m->in.port;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 收发
+
+/*
+ * 包进入网络：经发送方链路（h 为 NULL 表示虚拟服务器，无接入链路），发送方位于 NAT 后且目的不在本 NAT 私网时做出向转换
+ */
+static void net_emit(sim_host_t *h, const struct sockaddr_in *from, const struct sockaddr_in *to,
+                     const void *data, int len) {
+
+    uint64_t delay = 0;
+    if (h) {
+        if (rnd_hit(h->link.loss)) { g_sim.st.lost++; return; }
+        delay = link_delay(&h->link);
+    }
+
+    struct sockaddr_in src = *from;
+    int src_nat = h ? h->nat : -1;
+    if (src_nat >= 0) {
+        int nat;
+        bool local = ip_private(to->sin_addr.s_addr) && (private_host(to->sin_addr.s_addr, &nat), nat == src_nat);
+        if (!local) {
+            sim_nat_t *n = &g_sim.nats[src_nat];
+            int port = nat_out(n, from, to);
+            if (port < 0) { g_sim.st.filtered++; return; }
+            src.sin_addr.s_addr = n->pub_ip;
+            src.sin_port = htons((uint16_t)port);
+        }
+    }
+
+    sim_ev_t *e = ev_new(SIM_EV_PKT, data, len);
+    if (!e) { g_sim.st.lost++; return; }
+    e->due_us = g_sim.now_us + delay;
+    e->src_nat = src_nat;
+    e->from = src;
+    e->to = *to;
+    if (!heap_push(e)) { g_sim.st.lost++; p2p_free(e); }
+}
+
+/* 虚拟 STUN 服务器：Binding 请求回复来源地址；要求改变响应地址的请求不应答 */
+static void stun_answer(sim_ev_t *e) {
+
+    const uint8_t *b = e->data;
+    if (e->len < 20 || nget_s(b) != STUN_BINDING_REQUEST || nget_l(b + 4) != STUN_MAGIC) return;
+
+    for (int off = 20; off + 4 <= e->len; ) {
+        int alen = nget_s(b + off + 2);
+        if (nget_s(b + off) == STUN_ATTR_CHANGE_REQUEST && alen >= 4 && off + 8 <= e->len
+            && (nget_l(b + off + 4) & 0x06)) return;
+        off += 4 + ((alen + 3) & ~3);
+    }
+
+    uint8_t resp[128];
+    int n = p2p_stun_build_binding_response(resp, sizeof(resp), b + 8, &e->from, NULL);
+    if (n <= 0) return;
+    g_sim.st.stun++;
+    net_emit(NULL, &e->to, &e->from, resp, n);
+}
+
+/* hop 0 到期：解析目的地址（入向转换 / 私网可达性），经接收方链路后排入交付 */
+static void net_route(sim_ev_t *e) {
+
+    uint32_t ip = e->to.sin_addr.s_addr;
+    int host = -1, nat;
+
+    if (ip_private(ip)) {
+        host = private_host(ip, &nat);
+        if (nat != e->src_nat) host = -1;               // 其他 NAT 的私网地址不可达
+    }
+    else {
+        const sim_pub_t *p = pub_find(ip);
+        if (p && p->kind == SIM_PUB_STUN) {
+            if (ntohs(e->to.sin_port) == P2P_SIM_STUN_PORT) stun_answer(e);
+            else g_sim.st.unreachable++;
+            p2p_free(e);
+            return;
+        }
+        if (p && p->kind == SIM_PUB_NAT) {
+            if (!nat_in(&g_sim.nats[p->idx], e)) { g_sim.st.filtered++; p2p_free(e); return; }
+            host = private_host(e->to.sin_addr.s_addr, &nat);
+        }
+        else if (p) host = p->idx;
+    }
+
+    sim_host_t *h = host >= 0 ? g_sim.hosts[host] : NULL;
+    struct p2p_sim_node *node = NULL;
+    for (int i = 0; h && i < h->bind_cnt; i++) {
+        if (h->binds[i].port == e->to.sin_port) { node = h->binds[i].node; break; }
+    }
+    if (!node) { g_sim.st.unreachable++; p2p_free(e); return; }
+    if (rnd_hit(h->link.loss)) { g_sim.st.lost++; p2p_free(e); return; }
+
+    e->hop = 1;
+    e->node = node;
+    e->due_us += link_delay(&h->link);
+    if (!heap_push(e)) { g_sim.st.lost++; p2p_free(e); }
+}
+
+/* 实例加入待处理列表（列表扩容失败时由定时器事件兜底） */
+static void node_ready(struct p2p_sim_node *nd) {
+    if (nd->ready || !grow((void **)&g_sim.ready, &g_sim.ready_cap, g_sim.ready_cnt, sizeof(*g_sim.ready))) return;
+    g_sim.ready[g_sim.ready_cnt++] = nd;
+    nd->ready = true;
+}
+
+static void node_rx_push(struct p2p_sim_node *nd, sim_ev_t *e) {
+
+    if (!nd->rxq) nd->rxq = (sim_ev_t **)p2p_malloc(sizeof(*nd->rxq) * SIM_RXQ_MAX);
+    if (!nd->rxq || nd->rx_cnt >= SIM_RXQ_MAX) { g_sim.st.overflow++; p2p_free(e); return; }
+    nd->rxq[(nd->rx_head + nd->rx_cnt++) % SIM_RXQ_MAX] = e;
+    node_ready(nd);
+}
+
+static void signal_deliver(sim_ev_t *e) {
+    if (e->node) {
+        p2p_import_ice_sdp(e->sess, (const char *)e->data);
+        node_ready(e->node);
+        g_sim.st.signals++;
+    }
+    p2p_free(e);
+}
+
+/* 处理所有已到期的事件 */
+static void net_deliver(void) {
+    sim_ev_t *e;
+    while ((e = heap_pop_due(g_sim.now_us)) != NULL) {
+        if (e->kind == SIM_EV_TIMER) node_ready(e->node);
+        else if (e->kind == SIM_EV_SIGNAL) signal_deliver(e);
+        else if (!e->hop) net_route(e);
+        else if (e->node) node_rx_push(e->node, e);
+        else { g_sim.st.unreachable++; p2p_free(e); }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 信令
+
+static sim_pair_t *pair_slot(p2p_session_t sess, bool add) {
+
+    if (add && (g_sim.pair_cnt + 1) * 2 > g_sim.pair_cap) {
+        int cap = g_sim.pair_cap ? g_sim.pair_cap * 2 : 64;
+        sim_pair_t *t = (sim_pair_t *)p2p_calloc((size_t)cap, sizeof(*t));
+        if (!t) return NULL;
+        for (int i = 0; i < g_sim.pair_cap; i++) {
+            if (!g_sim.pairs[i].sess) continue;
+            uint32_t k = (uint32_t)((uintptr_t)g_sim.pairs[i].sess * 0x9E3779B97F4A7C15ull >> 32);
+            while (t[k & (cap - 1)].sess) k++;
+            t[k & (cap - 1)] = g_sim.pairs[i];
+        }
+        p2p_free(g_sim.pairs);
+        g_sim.pairs = t;
+        g_sim.pair_cap = cap;
+    }
+    if (!g_sim.pair_cap) return NULL;
+
+    uint32_t k = (uint32_t)((uintptr_t)sess * 0x9E3779B97F4A7C15ull >> 32);
+    for (;; k++) {
+        sim_pair_t *p = &g_sim.pairs[k & (g_sim.pair_cap - 1)];
+        if (p->sess == sess) return p;
+        if (!p->sess) {
+            if (!add) return NULL;
+            p->sess = sess;
+            g_sim.pair_cnt++;
+            return p;
+        }
+    }
+}
+
+static void signal_push(p2p_session_t to, const char *text, int len, int delay_ms) {
+    struct p2p_session *s = (struct p2p_session *)to;
+    if (!s->inst->sim) return;
+    sim_ev_t *e = (sim_ev_t *)p2p_calloc(1, sizeof(*e) + (size_t)len + 1);
+    if (!e) return;
+    e->kind = SIM_EV_SIGNAL;
+    e->due_us = g_sim.now_us + (uint64_t)delay_ms * 1000;
+    e->node = s->inst->sim;
+    e->sess = to;
+    e->len = len;
+    memcpy(e->data, text, (size_t)len);
+    if (!heap_push(e)) p2p_free(e);
+}
+
+void p2p_sim_signal(p2p_session_t a, p2p_session_t b, int delay_ms) {
+
+    P_check(a && b, return;)
+    if (delay_ms < 0) delay_ms = 0;
+
+    p2p_session_t ends[2] = { a, b };
+    for (int i = 0; i < 2; i++) {
+        sim_pair_t *p = pair_slot(ends[i], true);
+        if (!p) return;
+        p->peer = ends[!i];
+        p->node = ((struct p2p_session *)ends[i])->inst->sim;
+        p->peer_node = ((struct p2p_session *)ends[!i])->inst->sim;
+        p->delay_ms = delay_ms;
+    }
+
+    char sdp[4096];
+    for (int i = 0; i < 2; i++) {
+        int n = p2p_export_ice_sdp(ends[i], sdp, sizeof(sdp), true, NULL, NULL, NULL);
+        if (n > 0) signal_push(ends[!i], sdp, n, delay_ms);
+    }
+}
+
+void p2p_sim_on_ice_candidate(p2p_session_t session, const char *candidate, void *userdata) {
+    (void)userdata;
+    if (!candidate) return;
+
+    sim_pair_t *p = pair_slot(session, false);
+    if (!p || !p->peer) return;
+
+    char line[300];
+    int n = snprintf(line, sizeof(line), "a=%s\r\n", candidate);
+    if (n > 0 && n < (int)sizeof(line)) signal_push(p->peer, line, n, p->delay_ms);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 拓扑
+
+void p2p_sim_reset(uint64_t seed) {
+
+    for (int i = 0; i < g_sim.ev_cnt; i++) p2p_free(g_sim.heap[i]);
+    p2p_free(g_sim.heap);
+    for (int i = 0; i < g_sim.nat_cnt; i++) {
+        for (int k = 0; k < g_sim.nats[i].map_cnt; k++) p2p_free(g_sim.nats[i].maps[k].perms);
+        p2p_free(g_sim.nats[i].maps);
+    }
+    p2p_free(g_sim.nats);
+    for (int i = 0; i < g_sim.host_cnt; i++) {
+        p2p_free(g_sim.hosts[i]->binds);
+        p2p_free(g_sim.hosts[i]);
+    }
+    p2p_free(g_sim.hosts);
+    p2p_free(g_sim.pubs);
+    p2p_free(g_sim.pairs);
+    p2p_free(g_sim.ready);
+
+    memset(&g_sim, 0, sizeof(g_sim));
+    g_sim.now_us = P2P_SIM_EPOCH_US;
+    g_sim.rng = (seed ? seed : 1) * 0x9E3779B97F4A7C15ull | 1;
+}
+
+int p2p_sim_nat_add(p2p_sim_nat_type_t type, int ttl_ms) {
+
+    if ((unsigned)type > P2P_SIM_NAT_SYMMETRIC || g_sim.nat_cnt >= SIM_NAT_MAX
+        || !grow((void **)&g_sim.nats, &g_sim.nat_cap, g_sim.nat_cnt, sizeof(*g_sim.nats))) return -1;
+
+    sim_nat_t *n = &g_sim.nats[g_sim.nat_cnt];
+    memset(n, 0, sizeof(*n));
+    if (pub_alloc(SIM_PUB_NAT, g_sim.nat_cnt, &n->pub_ip) < 0) return -1;
+    n->type = type;
+    n->ttl_us = (uint64_t)(ttl_ms > 0 ? ttl_ms : P2P_SIM_NAT_TTL_MS) * 1000;
+    return g_sim.nat_cnt++;
+}
+
+int p2p_sim_host_add(int nat, const p2p_sim_link_t *link) {
+
+    if (nat >= g_sim.nat_cnt || (nat >= 0 && g_sim.nats[nat].host_cnt >= P2P_SIM_HOSTS_PER_NAT)
+        || !grow((void **)&g_sim.hosts, &g_sim.host_cap, g_sim.host_cnt, sizeof(*g_sim.hosts))) return -1;
+
+    sim_host_t *h = (sim_host_t *)p2p_calloc(1, sizeof(*h));
+    if (!h) return -1;
+    h->nat = nat < 0 ? -1 : nat;
+    if (link) h->link = *link;
+    h->next_port = P2P_SIM_HOST_PORT_BASE;
+    h->addr.sin_family = AF_INET;
+
+    int id = g_sim.host_cnt;
+    if (nat >= 0) {
+        sim_nat_t *n = &g_sim.nats[nat];
+        h->addr.sin_addr.s_addr = htonl(SIM_PRIVATE_NET | (uint32_t)nat << 8 | (uint32_t)(n->host_cnt + 2));
+        h->mask = htonl(0xFFFFFF00u);
+        n->hosts[n->host_cnt++] = id;
+    }
+    else {
+        if (pub_alloc(SIM_PUB_HOST, id, &h->addr.sin_addr.s_addr) < 0) { p2p_free(h); return -1; }
+        h->mask = 0xFFFFFFFFu;
+    }
+    h->route.local_addrs = &h->addr;
+    h->route.local_masks = &h->mask;
+    h->route.addr_count = 1;
+
+    g_sim.hosts[g_sim.host_cnt++] = h;
+    return id;
+}
+
+void p2p_sim_host_link(int host, const p2p_sim_link_t *link) {
+    P_check(host >= 0 && host < g_sim.host_cnt && link, return;)
+    g_sim.hosts[host]->link = *link;
+}
+
+uint32_t p2p_sim_host_ip(int host) {
+    return host >= 0 && host < g_sim.host_cnt ? g_sim.hosts[host]->addr.sin_addr.s_addr : 0;
+}
+
+void p2p_sim_host_select(int host) {
+    g_sim.selected = host;
+}
+
+ret_t p2p_sim_stun_add(struct sockaddr_in *addr) {
+    P_check(addr, return E_INVALID;)
+    memset(addr, 0, sizeof(*addr));
+    if (pub_alloc(SIM_PUB_STUN, 0, &addr->sin_addr.s_addr) < 0) return E_OUT_OF_CAPACITY;
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(P2P_SIM_STUN_PORT);
+    return E_NONE;
+}
+
+void p2p_sim_get_stats(p2p_sim_stats_t *st) {
+    if (st) *st = g_sim.st;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 虚拟时钟与驱动
+
+uint64_t p2p_sim_tick_us(void) {
+    return g_sim.now_us;
+}
+
+void p2p_sim_advance(uint64_t us) {
+    g_sim.now_us += us;
+}
+
+/* 执行一次 p2p_update 并按实例下一次超时重排其定时器 */
+static void node_update(struct p2p_sim_node *nd) {
+
+    p2p_update((p2p_handle_t)nd->inst);
+
+    // 库内时钟为毫秒粒度：定时器对齐到毫秒边界，同一毫秒内到期的实例在同一步中处理
+    sim_ev_t *t = nd->timer;
+    if (t->pos >= 0) heap_remove(t);
+    t->due_us = (g_sim.now_us / 1000 + (uint64_t)p2p_next_timeout_ms((p2p_handle_t)nd->inst)) * 1000;
+    if (!heap_push(t)) node_ready(nd);
+}
+
+void p2p_sim_run(p2p_handle_t *hdls, int n, int duration_ms) {
+
+    uint64_t end = g_sim.now_us + (uint64_t)(duration_ms > 0 ? duration_ms : 0) * 1000;
+
+    // 首次驱动的实例立即处理一次，之后由定时器事件、包与信令到达唤醒
+    for (int i = 0; i < n; i++) {
+        struct p2p_instance *inst = (struct p2p_instance *)hdls[i];
+        struct p2p_sim_node *nd = inst ? inst->sim : NULL;
+        if (nd && !nd->driven) { nd->driven = true; node_ready(nd); }
+    }
+
+    for (;;) {
+
+        // 同一时刻内反复处理：零时延链路上的请求 / 应答在本时刻内完成
+        for (int round = 0; round < SIM_TICK_ROUNDS; round++) {
+            net_deliver();
+            if (!g_sim.ready_cnt) break;
+
+            // update 只向事件堆投递（发包、Trickle 候选），不改动待处理列表
+            int w = 0;
+            for (int i = 0; i < g_sim.ready_cnt; i++) {
+                struct p2p_sim_node *nd = g_sim.ready[i];
+                if (!nd->driven) { nd->ready = false; continue; }
+                node_update(nd);
+                if (nd->rx_cnt) g_sim.ready[w++] = nd;  // 超出单轮接收预算的包留待下一轮
+                else nd->ready = false;
+            }
+            g_sim.ready_cnt = w;
+            if (!g_sim.ev_cnt || g_sim.heap[0]->due_us > g_sim.now_us) break;
+        }
+        if (g_sim.now_us >= end) break;
+
+        // 推进到下一个事件；仍有待处理实例或事件已到期时至少前进 1ms，避免空转
+        uint64_t next = end;
+        if (g_sim.ev_cnt && g_sim.heap[0]->due_us < next) next = g_sim.heap[0]->due_us;
+        if (next <= g_sim.now_us || g_sim.ready_cnt) next = g_sim.now_us + 1000;
+        g_sim.now_us = next < end ? next : end;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// p2p_udp 接口
+
+/* 实例首次使用时关联到 p2p_sim_host_select 选定的主机 */
+static struct p2p_sim_node *node_get(struct p2p_instance *inst) {
+
+    if (inst->sim) return inst->sim;
+    if (!g_sim.host_cnt && p2p_sim_host_add(-1, NULL) < 0) return NULL;
+
+    struct p2p_sim_node *nd = (struct p2p_sim_node *)p2p_calloc(1, sizeof(*nd));
+    if (!nd) return NULL;
+    if (!(nd->timer = (sim_ev_t *)p2p_calloc(1, sizeof(*nd->timer)))) { p2p_free(nd); return NULL; }
+    nd->timer->kind = SIM_EV_TIMER;
+    nd->timer->pos = -1;
+    nd->timer->node = nd;
+    nd->inst = inst;
+    nd->host = g_sim.selected >= 0 && g_sim.selected < g_sim.host_cnt ? g_sim.selected : 0;
+    return inst->sim = nd;
+}
+
+const route_ctx_t *p2p_sim_route(struct p2p_instance *inst) {
+    static const route_ctx_t empty;
+    struct p2p_sim_node *nd = node_get(inst);
+    return nd ? &g_sim.hosts[nd->host]->route : &empty;
+}
+
+ret_t p2p_sim_open(struct p2p_instance *inst, struct p2p_sock *ps, uint16_t port) {
+
+    struct p2p_sim_node *nd = node_get(inst);
+    if (!nd) return E_OUT_OF_MEMORY;
+    sim_host_t *h = g_sim.hosts[nd->host];
+
+    // port = 0：自动分配（从 P2P_SIM_HOST_PORT_BASE 起顺序取未占用端口）
+    bool any = !port;
+    for (int tries = 0; tries < 65536; tries++) {
+        if (any) { port = h->next_port++; if (!h->next_port) h->next_port = P2P_SIM_HOST_PORT_BASE; }
+        int i = 0;
+        while (i < h->bind_cnt && h->binds[i].port != htons(port)) i++;
+        if (i == h->bind_cnt) break;
+        if (!any) return E_BUSY;
+    }
+    if (!grow((void **)&h->binds, &h->bind_cap, h->bind_cnt, sizeof(*h->binds))) return E_OUT_OF_MEMORY;
+    h->binds[h->bind_cnt].port = htons(port);
+    h->binds[h->bind_cnt++].node = nd;
+
+    ps->local_addr = h->addr;
+    ps->local_addr.sin_port = htons(port);
+    return E_NONE;
+}
+
+void p2p_sim_close(struct p2p_instance *inst, struct p2p_sock *ps) {
+
+    struct p2p_sim_node *nd = inst->sim;
+    if (!nd) return;
+    sim_host_t *h = g_sim.hosts[nd->host];
+    for (int i = 0; i < h->bind_cnt; i++) {
+        if (h->binds[i].node != nd || h->binds[i].port != ps->local_addr.sin_port) continue;
+        h->binds[i] = h->binds[--h->bind_cnt];
+        return;
+    }
+}
+
+void p2p_sim_detach(struct p2p_instance *inst) {
+
+    struct p2p_sim_node *nd = inst->sim;
+    if (!nd) return;
+    inst->sim = NULL;
+
+    sim_host_t *h = g_sim.hosts[nd->host];
+    for (int i = h->bind_cnt; i--;) {
+        if (h->binds[i].node == nd) h->binds[i] = h->binds[--h->bind_cnt];
+    }
+    if (nd->timer->pos >= 0) heap_remove(nd->timer);
+    p2p_free(nd->timer);
+    for (int i = 0; i < g_sim.ev_cnt; i++) {
+        if (g_sim.heap[i]->node == nd) g_sim.heap[i]->node = NULL;
+    }
+    for (int i = 0; nd->ready && i < g_sim.ready_cnt; i++) {
+        if (g_sim.ready[i] == nd) { g_sim.ready[i] = g_sim.ready[--g_sim.ready_cnt]; break; }
+    }
+    for (int i = 0; i < g_sim.pair_cap; i++) {
+        sim_pair_t *p = &g_sim.pairs[i];
+        if (p->node == nd || p->peer_node == nd) p->peer = NULL;
+    }
+    while (nd->rx_cnt) {
+        p2p_free(nd->rxq[nd->rx_head]);
+        nd->rx_head = (nd->rx_head + 1) % SIM_RXQ_MAX;
+        nd->rx_cnt--;
+    }
+    p2p_free(nd->rxq);
+    p2p_free(nd);
+}
+
+int p2p_sim_send(struct p2p_instance *inst, int sock_idx, const struct sockaddr_in *addr,
+                 const void *data, int len) {
+
+    struct p2p_sim_node *nd = inst->sim;
+    if (!nd || sock_idx < 0 || sock_idx >= inst->sock_cnt || len <= 0 || len > P2P_MTU_MAX + 16) return E_INVALID;
+
+    g_sim.st.sent++;
+    net_emit(g_sim.hosts[nd->host], &inst->socks[sock_idx].local_addr, addr, data, len);
+    return len;
+}
+
+int p2p_sim_recv(struct p2p_instance *inst, struct p2p_udp_slot *slots, int max) {
+
+    struct p2p_sim_node *nd = inst->sim;
+    if (!nd) return 0;
+
+    int n = 0;
+    while (n < max && nd->rx_cnt) {
+        sim_ev_t *e = nd->rxq[nd->rx_head];
+        nd->rx_head = (nd->rx_head + 1) % SIM_RXQ_MAX;
+        nd->rx_cnt--;
+
+        // 套接字按绑定端口定位（关闭套接字会使后续下标前移）
+        int i = 0;
+        while (i < inst->sock_cnt && inst->socks[i].local_addr.sin_port != e->to.sin_port) i++;
+        if (i == inst->sock_cnt) { g_sim.st.unreachable++; p2p_free(e); continue; }
+
+        p2p_udp_slot_t *slot = &slots[n++];
+        slot->from = e->from;
+        slot->sock_idx = i;
+        slot->len = e->len;
+        slot->rx_us = g_sim.now_us;
+        slot->ecn = 0;
+        memcpy(slot->buf, e->data, (size_t)e->len);
+        p2p_free(e);
+        g_sim.st.delivered++;
+    }
+    return n;
+}
+
+#endif /* P2P_SIM */
@@ -0,0 +1,132 @@
+/*
+ * 进程内确定性网络模拟（模拟构建 P2P_SIM，用于规模与弱网场景的基准）
+ *
+ * 模拟构建中 p2p_udp_* 不再使用真实套接字：每个实例绑定到一台虚拟主机，收发经进程内虚拟网络，
+ * 时钟（P_tick_ms / P_tick_us）为虚拟时钟，只由 p2p_sim_advance / p2p_sim_run 推进，
+ * 数千个对端可在单线程内快于真实时间地模拟。
+ *
+ * 拓扑：
+ *   - NAT：p2p_sim_nat_add 创建，公网地址取自 198.18.0.0/15（RFC 2544 基准地址段），
+ *     按类型决定映射与过滤：
+ *       FULL_CONE        映射与目的无关，任意来源可经映射进入
+ *       RESTRICTED       映射与目的无关，只接受本端发送过的 IP
+ *       PORT_RESTRICTED  映射与目的无关，只接受本端发送过的 IP:端口
+ *       SYMMETRIC        每个目的 IP:端口一个映射（外部端口顺序分配），过滤同 PORT_RESTRICTED
+ *     映射只由出向流量刷新，空闲超过 ttl_ms 后失效；支持回环（向本 NAT 公网地址发送）
+ *   - 主机：p2p_sim_host_add 创建，位于 NAT 之后时地址为 10.n.h（同一 NAT 下的主机可直达），
+ *     否则为公网地址；每台主机一条接入链路（丢包率、单向时延、抖动），一个包依次经过两端的接入链路
+ *   - STUN：p2p_sim_stun_add 登记虚拟 STUN 服务器，对 Binding 请求回复观察到的（NAT 转换后的）来源地址；
+ *     只有单一地址，带 CHANGE-REQUEST 的请求（NAT 类型检测 Test II/III）不应答，驱动应设置 cfg.skip_stun_test
+ *   - 信令：ICE 模式（P2P_SIGNALING_MODE_ICE）下的进程内信令服务：p2p_sim_signal 把双方已收集的候选
+ *     在信令时延后交给对端，之后 p2p_sim_on_ice_candidate（设为 cfg.on_ice_candidate）按同样时延转发 Trickle 候选
+ *
+ * 确定性：丢包与抖动取自 p2p_sim_reset 的种子派生的随机序列，同样的脚本与收发序列得到同样的结果。
+ * 限制：单线程驱动（cfg.threaded = false）；不模拟 TCP（TCP 打洞、RELAY 信令）、TURN、IPv6 与共享内存路径；
+ *       COMPACT / RELAY 信令服务器为独立程序，不在进程内运行。
+ */
+#ifndef P2P_SIM_H
+#define P2P_SIM_H
+
+#include "predefine.h"
+#include "p2p_route.h"
+
+#ifdef P2P_SIM
+
+struct p2p_instance;
+struct p2p_sock;
+struct p2p_udp_slot;
+
+#define P2P_SIM_EPOCH_US        10000000ull     /* 虚拟时钟起点（非 0：0 在库内表示"未设置"） */
+#define P2P_SIM_NAT_TTL_MS      30000           /* 默认映射空闲失效时间 */
+#define P2P_SIM_NAT_PORT_BASE   20000           /* NAT 外部端口分配起点 */
+#define P2P_SIM_HOST_PORT_BASE  40000           /* 主机端口自动分配起点 */
+#define P2P_SIM_HOSTS_PER_NAT   250             /* 每个 NAT 下的主机数上限 */
+#define P2P_SIM_STUN_PORT       3478
+
+typedef enum {
+    P2P_SIM_NAT_FULL_CONE = 0,
+    P2P_SIM_NAT_RESTRICTED,
+    P2P_SIM_NAT_PORT_RESTRICTED,
+    P2P_SIM_NAT_SYMMETRIC,
+} p2p_sim_nat_type_t;
+
+/* 接入链路（每个包按发送方与接收方两段链路各自判定丢包、累加时延） */
+typedef struct {
+    float                   loss;           // 丢包率
+    int                     delay_ms;       // 单向时延
+    int                     jitter_ms;      // 抖动幅度（均匀分布 ±jitter）
+} p2p_sim_link_t;
+
+typedef struct {
+    uint64_t                sent;           // 进入虚拟网络的包
+    uint64_t                delivered;      // 交付到实例的包
+    uint64_t                lost;           // 链路丢包
+    uint64_t                filtered;       // 被 NAT 过滤（无映射、映射过期或来源未获许可）
+    uint64_t                unreachable;    // 目的地址无主机 / 端口未绑定
+    uint64_t                overflow;       // 接收队列满（模拟套接字接收缓冲区溢出）
+    uint64_t                stun;           // 虚拟 STUN 服务器应答数
+    uint64_t                signals;        // 信令服务转发的候选消息数
+} p2p_sim_stats_t;
+
+/* 清空拓扑、在途包与信令队列，虚拟时钟回到起点；已创建的实例须先销毁 */
+void     p2p_sim_reset(uint64_t seed);
+
+/* 创建 NAT，返回 NAT 编号（<0 失败）；ttl_ms = 0 取 P2P_SIM_NAT_TTL_MS */
+int      p2p_sim_nat_add(p2p_sim_nat_type_t type, int ttl_ms);
+
+/* 创建主机（nat < 0 为公网主机），返回主机编号（<0 失败）；link 为 NULL 时为无损零时延链路 */
+int      p2p_sim_host_add(int nat, const p2p_sim_link_t *link);
+
+/* 修改主机接入链路（运行中生效，用于脚本化的网络劣化） */
+void     p2p_sim_host_link(int host, const p2p_sim_link_t *link);
+
+/* 主机地址（网络字节序；NAT 后的主机为私网地址） */
+uint32_t p2p_sim_host_ip(int host);
+
+/* 之后 p2p_create 的实例绑定到该主机（默认 0 号主机，未创建时自动创建一台公网主机） */
+void     p2p_sim_host_select(int host);
+
+/* 登记虚拟 STUN 服务器（公网地址），addr 输出其地址，以点分形式填入 cfg.stun_server / stun_port */
+ret_t    p2p_sim_stun_add(struct sockaddr_in *addr);
+
+/* 进程内信令：a、b 当前已收集的候选在 delay_ms 后交给对端，并登记为一对以便转发 Trickle 候选 */
+void     p2p_sim_signal(p2p_session_t a, p2p_session_t b, int delay_ms);
+
+/* cfg.on_ice_candidate 回调：把新候选按配对时的信令时延转发给对端 */
+void     p2p_sim_on_ice_candidate(p2p_session_t session, const char *candidate, void *userdata);
+
+/* 虚拟时钟 */
+uint64_t p2p_sim_tick_us(void);
+void     p2p_sim_advance(uint64_t us);
+
+/*
+ * 驱动实例直到虚拟时钟前进 duration_ms：到期或有包到达的实例执行 p2p_update，
+ * 然后把时钟直接推进到下一个事件（实例定时器、包到达、信令消息），至少 1ms
+ */
+void     p2p_sim_run(p2p_handle_t *hdls, int n, int duration_ms);
+
+void     p2p_sim_get_stats(p2p_sim_stats_t *st);
+
+/* ---- p2p_udp 内部接口 ---- */
+
+/* 在实例所在主机上绑定虚拟端口（port = 0 自动分配），填写 ps->local_addr */
+ret_t    p2p_sim_open(struct p2p_instance *inst, struct p2p_sock *ps, uint16_t port);
+
+/* 解除虚拟端口绑定 */
+void     p2p_sim_close(struct p2p_instance *inst, struct p2p_sock *ps);
+
+/* 解除实例与主机的关联，丢弃待收包（p2p_udp_close_all 调用） */
+void     p2p_sim_detach(struct p2p_instance *inst);
+
+/* 从 socks[sock_idx] 发出（进入虚拟网络，按链路与 NAT 规则投递），返回 len */
+int      p2p_sim_send(struct p2p_instance *inst, int sock_idx, const struct sockaddr_in *addr,
+                      const void *data, int len);
+
+/* 取出已到达本实例的包（最多 max 个），返回数量 */
+int      p2p_sim_recv(struct p2p_instance *inst, struct p2p_udp_slot *slots, int max);
+
+/* 实例所在主机的地址表（Host 候选收集与本机地址判断使用） */
+const route_ctx_t *p2p_sim_route(struct p2p_instance *inst);
+
+#endif /* P2P_SIM */
+#endif /* P2P_SIM_H */
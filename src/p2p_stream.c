@@ -45,18 +45,23 @@
  *       - 0x01 = FIRST（首片）
  *       - 0x02 = LAST（末片）
  *       - 0x03 = WHOLE（完整消息，单片）
+ *       - 0x08 = LZ（负载为压缩块，见 p2p_lz.h；offset 仍按原始字节计）
  *   - Payload Data:       应用数据
  *
  * ============================================================================
  * Nagle 算法
  * ============================================================================
  *
- * 当 nagle=true 时，小数据会在发送缓冲区累积，直到：
+ * 当 nagle=true 时，不足一个包的尾部数据会在发送缓冲区累积，直到：
  *   - 累积数据量 >= P2P_STREAM_PAYLOAD（一个完整包）
- *   - 或应用显式调用 flush
+ *   - 或等待超过 nagle_delay（cfg.nagle_delay_ms，默认 2ms）
+ *   - 或应用显式调用 p2p_flush
+ *
+ * cork（p2p_send_flags 的 P2P_SEND_MORE）：应用声明后续还有数据，
+ * 尾部同样暂缓，直到一次不带该标志的发送、p2p_flush 或等待超过 STREAM_CORK_MAX_MS。
  *
  * 优点：减少小包数量，提高网络效率
- * 缺点：增加延迟，不适合实时应用
+ * 缺点：增加至多 nagle_delay 的延迟
  *
  * ============================================================================
  * 环形缓冲区
@@ -73,48 +78,195 @@
  *
  *   - head: 下一个读取位置
  *   - tail: 下一个写入位置
- *   - 数据量 = (tail - head + RING_SIZE) % RING_SIZE
- *   - 空闲量 = RING_SIZE - 1 - 数据量
+ *   - 数据量 = (tail - head) & (size - 1)，size 为 2 的幂
+ *   - 空闲量 = size - 1 - 数据量
+ *   - 容量按需从 base 扩容到 max（cfg.send_buf_size / recv_buf_size / buf_max_size），
+ *     空闲 RING_SHRINK_IDLE_MS 后收缩回 base
  */
 
+#define MOD_TAG "STREAM"
+
+/* pread / pwrite 需要 POSIX 扩展 */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "p2p_internal.h"
+#include "p2p_lz.h"
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 /* ============================================================================
  * 环形缓冲区操作
  * ============================================================================ */
 
+/* 向上取 2 的幂（不小于 RING_MIN_SIZE） */
+static int ring_pow2(int n) {
+    int size = RING_MIN_SIZE;
+    while (size < n && size < (1 << 30)) size <<= 1;
+    return size;
+}
+
 /*
- * 写入数据到环形缓冲区
- *
- * 将数据写入环形缓冲区尾部。如果空间不足，只写入能容纳的部分。
+ * 初始化环形缓冲区
  *
  * @param r     环形缓冲区
- * @param data  待写入数据
- * @param len   数据长度
- * @return      实际写入的字节数
+ * @param size  初始容量（<= 0 取 RING_SIZE，向上取 2 的幂）
+ * @param max   扩容上限（<= 0 取 RING_MAX_SIZE，不小于初始容量）
+ * @return      E_NONE 或 E_OUT_OF_MEMORY
  */
-int ring_write(ringbuf_t *r, const void *data, int len) {
+ret_t ring_init(ringbuf_t *r, int size, int max) {
+    return ring_init_in(r, size, max, NULL, NULL);
+}
+
+/* 同 ring_init，data 从实例内存区 arena 分配（扩容 / 收缩同），容量计入 mem */
+ret_t ring_init_in(ringbuf_t *r, int size, int max, struct p2p_arena *arena, struct p2p_mem_acct *mem) {
+    memset(r, 0, sizeof(*r));
+    r->arena = arena;
+    r->mem = mem;
+    size = ring_pow2(size > 0 ? size : RING_SIZE);
+    max = ring_pow2(max > 0 ? max : RING_MAX_SIZE);
+    if (max < size) max = size;
+
+    if (!(r->data = (uint8_t*)p2p_arena_malloc(arena, size))) return E_OUT_OF_MEMORY;
+    p2p_mem_add(mem, P2P_MEM_STREAM, size);
+    r->size = r->base = size;
+    r->max = max;
+    return E_NONE;
+}
+
+void ring_release(ringbuf_t *r) {
+    if (r->data) p2p_mem_add(r->mem, P2P_MEM_STREAM, -(int64_t)r->size);
+    p2p_arena_free(r->arena, r->data);
+    memset(r, 0, sizeof(*r));
+}
+
+/* 重新分配为 size 字节，已有数据（含未发布的 wip）搬移到开头（调用方保证独占） */
+static ret_t ring_realloc(ringbuf_t *r, int size) {
+    int used = ring_used(r);
+    uint8_t *data = (uint8_t*)p2p_arena_malloc(r->arena, size);
+    if (!data) return E_OUT_OF_MEMORY;
+
+    int len = used + r->wip;
+    int first = r->size - r->head;
+    if (first > len) first = len;
+    memcpy(data, r->data + r->head, first);
+    if (first < len) memcpy(data + first, r->data, len - first);
+    p2p_arena_free(r->arena, r->data);
+    p2p_mem_add(r->mem, P2P_MEM_STREAM, (int64_t)size - r->size);
+    r->data = data;
+    r->size = size;
+    r->head = 0;
+    r->tail = used;
+    return E_NONE;
+}
+
+/*
+ * 扩容以容纳 len 字节新数据（不超过 max）
+ *
+ * @return  扩容后的空闲字节数（可能仍小于 len）
+ */
+int ring_reserve(ringbuf_t *r, int len) {
     int avail = ring_free(r);
-    if (len > avail) len = avail;
-    if (len <= 0) return 0;
+    if (avail >= len || r->size >= r->max) return avail;
 
-    const uint8_t *src = (const uint8_t *)data;
-    
+    int size = ring_pow2(ring_used(r) + r->wip + len + 1);
+    if (size > r->max) size = r->max;
+    if (size > r->size && ring_realloc(r, size) != E_NONE) {
+        print("W:", LA_F("ring grow to %d failed", LA_F481, 481), size);
+    }
+    return ring_free(r);
+}
+
+/* 收缩回初始容量（保留已有数据，数据较多时只收缩到能容纳的大小） */
+void ring_shrink(ringbuf_t *r) {
+    if (r->size <= r->base) return;
+    int size = ring_pow2(ring_used(r) + r->wip + 1);
+    if (size < r->base) size = r->base;
+    if (size < r->size) ring_realloc(r, size);
+}
+
+/*
+ * 空闲休眠：释放空缓冲区的 data，保留 base / max（调用方保证为空且两端均未在访问）
+ * + size 置 0 后 ring_used 恒为 0、ring_free 为负，读写两端都不会访问 data
+ */
+void ring_hibernate(ringbuf_t *r) {
+    if (r->data) p2p_mem_add(r->mem, P2P_MEM_STREAM, -(int64_t)r->size);
+    p2p_arena_free(r->arena, r->data);
+    r->data = NULL;
+    r->size = r->head = r->tail = r->wip = 0;
+}
+
+/* 恢复为初始容量的空缓冲区（未休眠时直接返回） */
+ret_t ring_thaw(ringbuf_t *r) {
+    if (r->data) return E_NONE;
+    if (!(r->data = (uint8_t*)p2p_arena_malloc(r->arena, r->base))) return E_OUT_OF_MEMORY;
+    p2p_mem_add(r->mem, P2P_MEM_STREAM, r->base);
+    r->size = r->base;
+    return E_NONE;
+}
+
+/* 从 pos 处写入 len 字节（调用方保证空间足够），不发布写指针 */
+static void ring_copy_in(ringbuf_t *r, int pos, const uint8_t *src, int len) {
     /* 计算到缓冲区末尾的连续空间 */
-    int first = RING_SIZE - r->tail;
+    int first = r->size - pos;
     if (first > len) first = len;
     
     /* 第一段：写到缓冲区末尾 */
-    memcpy(r->data + r->tail, src, first);
+    memcpy(r->data + pos, src, first);
     
     /* 第二段：回绕到缓冲区开头（如果需要） */
     if (first < len)
         memcpy(r->data, src + first, len - first);
+}
+
+/*
+ * 写入数据到环形缓冲区
+ *
+ * 将数据写入环形缓冲区尾部。如果空间不足，只写入能容纳的部分。
+ *
+ * @param r     环形缓冲区
+ * @param data  待写入数据
+ * @param len   数据长度
+ * @return      实际写入的字节数
+ */
+int ring_write(ringbuf_t *r, const void *data, int len) {
+    int tail = r->tail, mask = r->size - 1;
+    int avail = mask - ((tail - RING_LOAD_ACQ(&r->head)) & mask);
+    if (len > avail) len = avail;
+    if (len <= 0) return 0;
+
+    ring_copy_in(r, tail, (const uint8_t *)data, len);
     
-    r->tail = (r->tail + len) % RING_SIZE;
+    /* 数据写入完成后再发布写指针 */
+    RING_STORE_REL(&r->tail, (tail + len) & mask);
     return len;
 }
 
+/*
+ * 聚集写入：依次写入各段直到空间用尽，全部拷贝完成后一次发布写指针
+ * + 消费者要么看不到本次数据，要么看到连续的整段，不会在段边界提前切包
+ */
+int ring_writev(ringbuf_t *r, const p2p_iovec_t *iov, int cnt) {
+    int tail = r->tail, mask = r->size - 1;
+    int avail = mask - ((tail - RING_LOAD_ACQ(&r->head)) & mask);
+
+    int total = 0;
+    for (int i = 0; i < cnt && total < avail; i++) {
+        int len = iov[i].len;
+        if (len <= 0 || !iov[i].base) continue;
+        if (len > avail - total) len = avail - total;
+        ring_copy_in(r, (tail + total) & mask, (const uint8_t *)iov[i].base, len);
+        total += len;
+    }
+    if (total > 0) RING_STORE_REL(&r->tail, (tail + total) & mask);
+    return total;
+}
+
 /*
  * 从环形缓冲区读取数据
  *
@@ -126,24 +278,26 @@ int ring_write(ringbuf_t *r, const void *data, int len) {
  * @return     实际读取的字节数
  */
 int ring_read(ringbuf_t *r, void *buf, int len) {
-    int avail = ring_used(r);
+    int head = r->head, mask = r->size - 1;
+    int avail = (RING_LOAD_ACQ(&r->tail) - head) & mask;
     if (len > avail) len = avail;
     if (len <= 0) return 0;
 
     uint8_t *dst = (uint8_t *)buf;
     
     /* 计算从 head 到缓冲区末尾的连续数据 */
-    int first = RING_SIZE - r->head;
+    int first = r->size - head;
     if (first > len) first = len;
     
     /* 第一段：读到缓冲区末尾 */
-    memcpy(dst, r->data + r->head, first);
+    memcpy(dst, r->data + head, first);
     
     /* 第二段：回绕到缓冲区开头（如果需要） */
     if (first < len)
         memcpy(dst + first, r->data, len - first);
     
-    r->head = (r->head + len) % RING_SIZE;
+    /* 数据拷贝完成后再释放空间 */
+    RING_STORE_REL(&r->head, (head + len) & mask);
     return len;
 }
 
@@ -158,14 +312,15 @@ int ring_read(ringbuf_t *r, void *buf, int len) {
  * @return     实际读取的字节数
  */
 int ring_peek(const ringbuf_t *r, void *buf, int len) {
-    int avail = ring_used(r);
+    int head = r->head, mask = r->size - 1;
+    int avail = (RING_LOAD_ACQ(&r->tail) - head) & mask;
     if (len > avail) len = avail;
     if (len <= 0) return 0;
 
     uint8_t *dst = (uint8_t *)buf;
-    int first = RING_SIZE - r->head;
+    int first = r->size - head;
     if (first > len) first = len;
-    memcpy(dst, r->data + r->head, first);
+    memcpy(dst, r->data + head, first);
     if (first < len)
         memcpy(dst + first, r->data, len - first);
     return len;
@@ -179,10 +334,24 @@ int ring_peek(const ringbuf_t *r, void *buf, int len) {
  * @param r    环形缓冲区
  * @param len  要跳过的字节数
  */
+/*
+ * 零拷贝读取：返回 head 起不回绕的连续可读字节数，*ptr 指向该区段
+ * + 数据回绕时只返回到缓冲区末尾的部分，消费后再次调用取得剩余部分
+ */
+int ring_peek_ptr(const ringbuf_t *r, const uint8_t **ptr) {
+    int head = r->head, mask = r->size - 1;
+    int avail = (RING_LOAD_ACQ(&r->tail) - head) & mask;
+    if (avail <= 0) return 0;
+    int first = r->size - head;
+    *ptr = r->data + head;
+    return avail < first ? avail : first;
+}
+
 void ring_skip(ringbuf_t *r, int len) {
-    int avail = ring_used(r);
+    int head = r->head, mask = r->size - 1;
+    int avail = (RING_LOAD_ACQ(&r->tail) - head) & mask;
     if (len > avail) len = avail;
-    r->head = (r->head + len) % RING_SIZE;
+    RING_STORE_REL(&r->head, (head + len) & mask);
 }
 
 /* ============================================================================
@@ -192,12 +361,64 @@ void ring_skip(ringbuf_t *r, int len) {
 /*
  * 初始化流上下文
  *
- * @param st     流上下文
- * @param nagle  是否启用 Nagle 算法（1=启用，0=禁用）
+ * @param st         流上下文
+ * @param nagle      是否启用 Nagle 算法（1=启用，0=禁用）
+ * @param send_size  发送缓冲区初始容量（0=默认 RING_SIZE）
+ * @param recv_size  接收缓冲区初始容量（0=默认 RING_SIZE）
+ * @param max_size   两个缓冲区的扩容上限（0=默认 RING_MAX_SIZE）
+ * @return           E_NONE 或 E_OUT_OF_MEMORY
  */
-void stream_init(stream_t *st, int nagle) {
+ret_t stream_init(stream_t *st, int nagle, int send_size, int recv_size, int max_size) {
+    return stream_init_in(st, NULL, NULL, nagle, send_size, recv_size, max_size);
+}
+
+/* 同 stream_init，收发缓冲区从实例内存区 arena 分配并计入 mem */
+ret_t stream_init_in(stream_t *st, struct p2p_arena *arena, struct p2p_mem_acct *mem, int nagle, int send_size, int recv_size, int max_size) {
     memset(st, 0, sizeof(*st));
     st->nagle = nagle;
+    st->nagle_delay = STREAM_NAGLE_DELAY_MS;
+    if (ring_init_in(&st->send_ring, send_size, max_size, arena, mem) != E_NONE ||
+        ring_init_in(&st->recv_ring, recv_size, max_size, arena, mem) != E_NONE) {
+        stream_free(st);
+        return E_OUT_OF_MEMORY;
+    }
+    return E_NONE;
+}
+
+void stream_free(stream_t *st) {
+    ring_release(&st->send_ring);
+    ring_release(&st->recv_ring);
+}
+
+/* 流上没有任何待发、待读或组装中的数据（进入空闲休眠的前提） */
+bool stream_drained(const stream_t *st) {
+    return !ring_used(&st->send_ring) && !ring_used(&st->recv_ring)
+        && !st->send_ring.wip && !st->recv_ring.wip && !st->recv_need
+        && !st->send_msg_left && !st->recv_msg_open && !st->nagle_ts;
+}
+
+void stream_hibernate(stream_t *st) {
+    ring_hibernate(&st->send_ring);
+    ring_hibernate(&st->recv_ring);
+}
+
+ret_t stream_thaw(stream_t *st) {
+    if (ring_thaw(&st->send_ring) != E_NONE || ring_thaw(&st->recv_ring) != E_NONE) return E_OUT_OF_MEMORY;
+    return E_NONE;
+}
+
+/*
+ * 应用侧空闲检测：缓冲区已扩容、当前为空且超过 RING_SHRINK_IDLE_MS 未见数据
+ * + 未扩容时直接返回，不读取时钟
+ */
+bool stream_ring_idle(const ringbuf_t *r, uint64_t *active_ts) {
+    if (r->size <= r->base) return false;
+    uint64_t now = p2p_now_ms();
+    if (ring_used(r) > 0 || !*active_ts) {
+        *active_ts = now;
+        return false;
+    }
+    return tick_diff(now, *active_ts) >= RING_SHRINK_IDLE_MS;
 }
 
 /*
@@ -212,7 +433,14 @@ void stream_init(stream_t *st, int nagle) {
  */
 int stream_write(stream_t *st, const void *buf, int len) {
     int n = ring_write(&st->send_ring, buf, len);
-    st->pending_bytes += n;
+    if (n > 0) stream_queue_mark(st);
+    return n;
+}
+
+/* 聚集写入字节流（语义同 stream_write，各段按顺序拼接） */
+int stream_writev(stream_t *st, const p2p_iovec_t *iov, int cnt) {
+    int n = ring_writev(&st->send_ring, iov, cnt);
+    if (n > 0) stream_queue_mark(st);
     return n;
 }
 
@@ -230,114 +458,842 @@ int stream_read(stream_t *st, void *buf, int len) {
     return ring_read(&st->recv_ring, buf, len);
 }
 
+/* 零拷贝读取：借出接收缓冲区中的连续区段，返回长度（无数据返回 0） */
+int stream_peek(stream_t *st, const void **ptr) {
+    return ring_peek_ptr(&st->recv_ring, (const uint8_t **)ptr);
+}
+
+/* 归还 stream_peek 借出区段的前 len 字节 */
+void stream_consume(stream_t *st, int len) {
+    ring_skip(&st->recv_ring, len);
+}
+
+/*
+ * 消息模式写入：[len][data] 作为一次写入发布，空间不足时不写入任何字节
+ *
+ * @return  len（已写入），0（缓冲区空间不足，稍后重试）
+ */
+int stream_write_msg(stream_t *st, const void *buf, int len) {
+    return stream_write_msg_at(st, buf, len, 0);
+}
+
+/*
+ * 限时消息写入：deadline 非 0 时记录为 [len | STREAM_MSG_DEADLINE][deadline(4)][data]
+ *
+ * @param deadline  到期时刻（见 stream_deadline），0 = 不限时（同 stream_write_msg）
+ * @return          len（已写入），0（缓冲区空间不足，稍后重试）
+ */
+int stream_write_msg_at(stream_t *st, const void *buf, int len, uint32_t deadline) {
+    int hlen = STREAM_MSG_HDR_SIZE + (deadline ? STREAM_MSG_DEADLINE_SIZE : 0);
+    if (ring_free(&st->send_ring) < hlen + len) return 0;
+    uint8_t hdr[STREAM_MSG_HDR_SIZE + STREAM_MSG_DEADLINE_SIZE];
+    nwrite_l(hdr, (uint32_t)len | (deadline ? STREAM_MSG_DEADLINE : 0));
+    nwrite_l(hdr + STREAM_MSG_HDR_SIZE, deadline);
+    p2p_iovec_t iov[2] = { { hdr, hlen }, { buf, len } };
+    ring_writev(&st->send_ring, iov, 2);
+    stream_queue_mark(st);
+    return len;
+}
+
+/*
+ * 消息模式发送侧：位于消息边界时取出下一条消息的头部，到期的整条消息直接丢弃
+ * + send_msg_deadline 随之更新为该消息的到期时刻
+ *
+ * @return  消息长度（头部已移出 send_ring），无完整头部返回 -1
+ */
+int stream_msg_begin(stream_t *st, uint64_t now) {
+    for (;;) {
+        uint8_t hdr[STREAM_MSG_HDR_SIZE + STREAM_MSG_DEADLINE_SIZE];
+        if (ring_peek(&st->send_ring, hdr, STREAM_MSG_HDR_SIZE) < STREAM_MSG_HDR_SIZE) return -1;
+        uint32_t v = nget_l(hdr);
+        int hlen = STREAM_MSG_HDR_SIZE, mlen = (int)(v & ~STREAM_MSG_DEADLINE);
+        uint32_t deadline = 0;
+        if (v & STREAM_MSG_DEADLINE) {
+            hlen += STREAM_MSG_DEADLINE_SIZE;
+            if (ring_peek(&st->send_ring, hdr, hlen) < hlen) return -1;
+            deadline = nget_l(hdr + STREAM_MSG_HDR_SIZE);
+        }
+        ring_skip(&st->send_ring, hlen);
+        stream_queue_sent(st, hlen);
+        if (!stream_deadline_passed(deadline, now)) {
+            st->send_msg_deadline = deadline;
+            return mlen;
+        }
+        ring_skip(&st->send_ring, mlen);
+        stream_queue_sent(st, mlen);
+        st->msg_expired++;
+        if (P2P_LOG_ON(VERBOSE)) print("V:", LA_F("expired message dropped before send, len=%d", LA_F688, 688), mlen);
+    }
+}
+
+/* 取出一条 [len(4)][data] 记录；len 不足时返回记录长度（> len）且保留 */
+static int ring_read_msg(ringbuf_t *r, void *buf, int len) {
+    uint8_t hdr[STREAM_MSG_HDR_SIZE];
+    if (ring_peek(r, hdr, STREAM_MSG_HDR_SIZE) < STREAM_MSG_HDR_SIZE) return 0;
+    int mlen = (int)nget_l(hdr);
+    if (mlen > len) return mlen;
+
+    ring_skip(r, STREAM_MSG_HDR_SIZE);
+    ring_read(r, buf, mlen);
+    return mlen;
+}
+
+/*
+ * 消息模式读取：取出一条完整消息
+ *
+ * @return  消息长度；无消息返回 0；len 不足以容纳时返回消息长度（> len）且消息保留
+ */
+int stream_read_msg(stream_t *st, void *buf, int len) {
+    return ring_read_msg(&st->recv_ring, buf, len);
+}
+
+/* 尾部暂缓上限：cork 时 STREAM_CORK_MAX_MS，Nagle 时 nagle_delay，均未启用返回 0 */
+static int stream_hold_limit(const stream_t *st) {
+    if (st->msg_mode) return 0;
+    if (RING_LOAD_ACQ(&st->cork)) return STREAM_CORK_MAX_MS;
+    return st->nagle ? st->nagle_delay : 0;
+}
+
+/*
+ * 距可以 flush 的毫秒数（供 p2p_next_timeout 计算唤醒时间）
+ *
+ * @return  -1 = 无待发数据，0 = 可立即发送，>0 = 尾部暂缓剩余时间
+ */
+int stream_flush_timeout(const struct p2p_session *s, const stream_t *st, uint64_t now) {
+    int queued = ring_used(&st->send_ring);
+    if (queued == 0) return -1;
+    if (RING_LOAD_ACQ(&st->flush_req) != st->flush_done || queued >= stream_mss(st, nat_pmtu_payload(s) - fec_overhead(s))) return 0;
+
+    int limit = stream_hold_limit(st);
+    if (!limit || !st->nagle_ts) return 0;
+    uint64_t waited = tick_diff(now, st->nagle_ts);
+    return waited >= (uint64_t)limit ? 0 : limit - (int)waited;
+}
+
+/* 编码 DATA 子头，返回子头长度 */
+static int stream_hdr_write(const stream_t *st, uint8_t *pkt, uint8_t fflags) {
+    nwrite_l(pkt, st->send_offset);
+    if (!st->sid) {
+        pkt[4] = fflags;
+        return P2P_DATA_HDR_SIZE;
+    }
+    pkt[4] = fflags | P2P_FRAG_SID;
+    pkt[5] = (uint8_t)st->sid;
+    return P2P_DATA_SID_HDR_SIZE;
+}
+
+/*
+ * 压缩组包：从 send_ring 取至多 avail 字节压缩写入 out（容量 cap），尽量多地装满一个包
+ *
+ * @param wire  输出压缩后的字节数
+ * @return      消耗的原始字节数；数据过少或压缩无收益返回 0（调用方按原样组包）
+ */
+static int stream_pack_lz(struct p2p_session *s, stream_t *st, uint8_t *out, int cap, int avail, int *wire) {
+    if (!s->reliable.lz || avail < STREAM_LZ_MIN) return 0;
+    if (st->lz_skip > 0) { st->lz_skip--; return 0; }
+
+    uint8_t raw[P2P_LZ_RAW_MAX];
+    int used = ring_peek(&st->send_ring, raw, avail < P2P_LZ_RAW_MAX ? avail : P2P_LZ_RAW_MAX);
+    int n = p2p_lz_compress(raw, &used, out, cap);
+    if (n <= 0 || used <= n) {
+        st->lz_skip = STREAM_LZ_BACKOFF;
+        return 0;
+    }
+    *wire = n;
+    return used;
+}
+
+/* 压缩率统计（原样组包的数据按 1:1 计入） */
+static inline void stream_lz_account(struct p2p_session *s, int raw, int wire) {
+    if (!s->reliable.lz) return;
+    s->lz_raw += (uint64_t)raw;
+    s->lz_wire += (uint64_t)wire;
+}
+
+/*
+ * 发出不携带数据的 P2P_FRAG_SKIP 包：对端丢弃组装中的消息，推进 skip_len 字节偏移
+ * + 仅在对端通告 RELIABLE_CAP2_SKIP 时发送；窗口已满时不发（对端在下一条消息首片到达时同样丢弃）
+ */
+static void stream_send_skip(struct p2p_session *s, stream_t *st, uint32_t skip_len) {
+    if (!s->reliable.skip || reliable_window_avail(s) <= 0) return;
+    uint8_t *pkt = reliable_send_buf(s);
+    if (!pkt) return;
+    int hdr = stream_hdr_write(st, pkt, P2P_FRAG_SKIP);
+    nwrite_l(pkt + hdr, skip_len);
+    reliable_send_commit(s, hdr + (int)P2P_FRAG_SKIP_PSZ);
+    reliable_set_prio(s, RING_LOAD_ACQ(&st->prio));
+}
+
+/* 消息模式 flush：逐条切片，包不跨消息边界；最多发出 max_pkts 个包 */
+static int stream_flush_msgs(struct p2p_session *s, stream_t *st, int max_pkts) {
+    int flushed = 0;
+    uint64_t now = p2p_now_ms();
+
+    while (max_pkts-- > 0 && reliable_window_avail(s) > 0) {
+        /* 位于消息边界：取下一条未到期消息的长度 */
+        if (!st->send_msg_left) {
+            int mlen = stream_msg_begin(st, now);
+            if (mlen < 0) break;
+            if (mlen <= 0) continue;
+            st->send_msg_left = mlen;
+            st->send_msg_first = 1;
+        }
+        /* 已切出部分分片的消息到期：剩余部分丢弃，通知对端关闭组装 */
+        else if (stream_deadline_passed(st->send_msg_deadline, now)) {
+            ring_skip(&st->send_ring, st->send_msg_left);
+            stream_queue_sent(st, st->send_msg_left);
+            st->send_msg_left = 0;
+            st->msg_expired++;
+            stream_send_skip(s, st, 0);
+            continue;
+        }
+
+        uint8_t *pkt = reliable_send_buf(s);
+        if (!pkt) break;
+
+        int mss = stream_mss(st, nat_pmtu_payload(s) - fec_overhead(s)), hdr = stream_hdr_size(st), wire;
+        int chunk = stream_pack_lz(s, st, pkt + hdr, mss, st->send_msg_left, &wire);
+        uint8_t fflags = chunk ? P2P_FRAG_LZ : 0;
+        if (!chunk) {
+            chunk = wire = st->send_msg_left < mss ? st->send_msg_left : mss;
+            ring_peek(&st->send_ring, pkt + hdr, chunk);
+        }
+        if (st->send_msg_first) fflags |= P2P_FRAG_FIRST;
+        if (chunk == st->send_msg_left) fflags |= P2P_FRAG_LAST;
+        stream_hdr_write(st, pkt, fflags);
+        reliable_send_commit(s, hdr + wire);
+        reliable_set_redundant(s, RING_LOAD_ACQ(&st->redundant));
+        reliable_set_prio(s, RING_LOAD_ACQ(&st->prio));
+        if (st->send_msg_deadline) reliable_set_deadline(s, st->send_msg_deadline, chunk);
+        stream_lz_account(s, chunk, wire);
+
+        ring_skip(&st->send_ring, chunk);
+        stream_queue_sent(st, chunk);
+        st->send_offset += chunk;
+        st->send_msg_left -= chunk;
+        st->send_msg_first = 0;
+        flushed += chunk;
+    }
+
+    if (!ring_used(&st->send_ring)) st->flush_done = RING_LOAD_ACQ(&st->flush_req);
+    return flushed;
+}
+
 /*
  * 刷新发送缓冲区到可靠层
  *
  * 将发送缓冲区中的字节流切分为数据包，发送到可靠传输层。
  *
  * 处理流程：
- *   1. 检查缓冲区数据量
- *   2. 如果启用 Nagle 且数据不足一个包，等待更多数据
+ *   1. 检查缓冲区数据量与 flush 请求
+ *   2. 启用 Nagle/cork 时只发送完整包，不足一包的尾部等待更多数据，
+ *      超过暂缓上限后再发出
  *   3. 循环切分数据：
- *      a. 取最多 P2P_STREAM_PAYLOAD 字节
+ *      a. 取最多 P2P_STREAM_PAYLOAD 字节（协商流压缩时取压缩后恰好装满一个包的字节数）
  *      b. 编码 DATA 子头（偏移量 + 分片标志）
- *      c. 发送到可靠层
+ *      c. 直接写入可靠层发送槽位的池缓冲区（无中间包缓冲），提交成功后才从缓冲区移除
  *   4. 更新流偏移量
  *
- * @param s   会话对象
- * @return    实际发送的字节数
+ * @param s         会话对象
+ * @param st        流
+ * @param max_pkts  最多发出的包数（多流轮转时每轮每流 1 个）
+ * @param cap       最多发出的字节数（文件传输前只发出调用前写入的数据，不做暂缓）
+ * @return          实际发送的字节数
  */
-int stream_flush_to_reliable(struct p2p_session *s) {
-    stream_t *st = &s->stream;
+static int stream_flush_ring(struct p2p_session *s, stream_t *st, int max_pkts, int cap) {
 
+    int flush_req = RING_LOAD_ACQ(&st->flush_req);
     int total_queued = ring_used(&st->send_ring);
-    if (total_queued == 0) return 0;
-
-    /* Nagle 算法：数据不足一个完整包时，等待累积 */
-    if (st->nagle && total_queued < P2P_STREAM_PAYLOAD)
+    bool capped = total_queued > cap;
+    if (capped) total_queued = cap;
+    if (total_queued == 0) {
+        if (capped) return 0;
+        st->nagle_ts = 0;
+        st->flush_done = flush_req;
         return 0;
+    }
+
+    /* Nagle / cork：尾部不足一个完整包时，在暂缓上限内等待累积 */
+    int sendable = total_queued;
+    int limit = capped || flush_req != st->flush_done ? 0 : stream_hold_limit(st);
+    int mss = stream_mss(st, nat_pmtu_payload(s) - fec_overhead(s));
+    int tail = total_queued % mss;
+    if (limit && tail) {
+        uint64_t now = p2p_now_ms();
+        if (!st->nagle_ts) st->nagle_ts = now;
+        if (tick_diff(now, st->nagle_ts) < (uint64_t)limit) sendable -= tail;
+    }
 
     int first = 1;      /* 是否为首片 */
     int flushed = 0;    /* 已发送字节数 */
 
-    /* 循环发送，直到缓冲区空或窗口满 */
-    while (ring_used(&st->send_ring) > 0 && reliable_window_avail(s) > 0) {
-        int remaining = ring_used(&st->send_ring);
-        int chunk = remaining;
-        if (chunk > P2P_STREAM_PAYLOAD)
-            chunk = P2P_STREAM_PAYLOAD;
-
-        int is_last = (remaining <= P2P_STREAM_PAYLOAD) ? 1 : 0;
-
-        /* 编码 DATA 子头 */
-        uint8_t pkt[P2P_MAX_PAYLOAD];
-        
-        /* 流偏移量（4 字节，大端序） */
-        nwrite_l(pkt, st->send_offset);
-
-        /* 分片标志 */
-        uint8_t fflags = 0;
-        if (first)   fflags |= P2P_FRAG_FIRST;  /* 首片 */
-        if (is_last) fflags |= P2P_FRAG_LAST;   /* 末片 */
-        pkt[4] = fflags;
+    /* 循环发送，直到可发数据发完或窗口满 */
+    int hdr = stream_hdr_size(st);
+    while (flushed < sendable && max_pkts-- > 0 && reliable_window_avail(s) > 0) {
+        int remaining = sendable - flushed;
 
-        /* 复制流数据到包体 */
-        ring_read(&st->send_ring, pkt + P2P_DATA_HDR_SIZE, chunk);
+        /* 借出下一个发送槽位的缓冲区，在其中原地组包 */
+        uint8_t *pkt = reliable_send_buf(s);
+        if (!pkt) break;  /* 发送窗口已满或内存不足，停止发送（数据保留在缓冲区） */
 
-        /* 发送到可靠层 */
-        if (reliable_send_pkt(s, pkt, P2P_DATA_HDR_SIZE + chunk) < 0)
-            break;  /* 发送窗口已满，停止发送 */
+        /* 流数据压缩或直接拷入子头之后的包体 */
+        int wire;
+        int chunk = stream_pack_lz(s, st, pkt + hdr, mss, remaining, &wire);
+        uint8_t fflags = chunk ? P2P_FRAG_LZ : 0;
+        if (!chunk) {
+            chunk = wire = remaining < mss ? remaining : mss;
+            ring_peek(&st->send_ring, pkt + hdr, chunk);
+        }
+
+        /* 编码 DATA 子头：流偏移量（4 字节，大端序）+ 分片标志 [+ sid]，提交到可靠层 */
+        if (first)              fflags |= P2P_FRAG_FIRST;  /* 首片 */
+        if (chunk == remaining) fflags |= P2P_FRAG_LAST;   /* 末片 */
+        stream_hdr_write(st, pkt, fflags);
+        reliable_send_commit(s, hdr + wire);
+        reliable_set_redundant(s, RING_LOAD_ACQ(&st->redundant));
+        reliable_set_prio(s, RING_LOAD_ACQ(&st->prio));
+        stream_lz_account(s, chunk, wire);
 
+        ring_skip(&st->send_ring, chunk);
+        stream_queue_sent(st, chunk);
         st->send_offset += chunk;
-        st->pending_bytes -= chunk;
         first = 0;
         flushed += chunk;
     }
 
+    /* 尾部已发出：结束暂缓计时；完整包发出后剩余尾部为新数据，重新计时 */
+    if (capped) return flushed;
+    if (flushed == total_queued) {
+        st->nagle_ts = 0;
+        st->flush_done = flush_req;
+    } else if (flushed > 0 && flushed == sendable) {
+        st->nagle_ts = 0;
+    }
+
     return flushed;
 }
 
+/* ============================================================================
+ * 发送背压（cfg.on_writable / cfg.send_lowat）
+ *
+ * 应用侧写入后待发送字节超过低水位（或本次写入未被全部接受）即登记 writable_wait；
+ * 工作线程每轮发送后检查，降到低水位及以下时清除登记并回调一次，生产者据此按实际排空速率写入。
+ * 清除与回调在登记之后：回调期间（或之后）的写入重新超过低水位会再次登记，不会漏掉通知
+ * ============================================================================ */
+
+/* 低水位：cfg.send_lowat，未设置时取 send_ring 初始容量 */
+static inline int stream_lowat(const struct p2p_session *s, const stream_t *st) {
+    return s->inst->cfg.send_lowat > 0 ? s->inst->cfg.send_lowat : st->send_ring.base;
+}
+
+void stream_writable_arm(struct p2p_session *s, stream_t *st, bool short_write) {
+    if (!s->inst->cfg.on_writable || RING_LOAD_ACQ(&st->writable_wait)) return;
+    if (short_write || ring_used(&st->send_ring) > stream_lowat(s, st)) RING_STORE_REL(&st->writable_wait, 1);
+}
+
+void stream_writable_poll(struct p2p_session *s) {
+    if (!s->inst->cfg.on_writable) return;
+    for (int i = 0; i < s->stream_cnt; i++) {
+        stream_t *st = stream_get(s, i);
+        if (!RING_LOAD_ACQ(&st->writable_wait) || ring_used(&st->send_ring) > stream_lowat(s, st)) continue;
+        RING_STORE_REL(&st->writable_wait, 0);
+        s->inst->cfg.on_writable((p2p_session_t)s, i, ring_space(&st->send_ring), s->inst->cfg.userdata);
+    }
+}
+
+/* ============================================================================
+ * 文件收发
+ * ============================================================================ */
+
+static int file_pread(int fd, void *buf, int len, int64_t off) {
+#if defined(_WIN32)
+    if (_lseeki64(fd, off, SEEK_SET) < 0) return -1;
+    return _read(fd, buf, (unsigned)len);
+#else
+    return (int)pread(fd, buf, (size_t)len, (off_t)off);
+#endif
+}
+
+static int file_pwrite(int fd, const void *buf, int len, int64_t off) {
+#if defined(_WIN32)
+    if (_lseeki64(fd, off, SEEK_SET) < 0) return -1;
+    return _write(fd, buf, (unsigned)len);
+#else
+    return (int)pwrite(fd, buf, (size_t)len, (off_t)off);
+#endif
+}
+
+/* 结束一次文件传输并回调（ret = E_NONE 完成，否则为错误） */
+static void stream_file_end(struct p2p_session *s, int dir, ret_t ret) {
+    stream_file_t *f = dir == P2P_FILE_SEND ? &s->file_tx : &s->file_rx;
+    f->fd = -1;
+    if (s->inst->cfg.on_file_done && !s->bulk.b)
+        s->inst->cfg.on_file_done((p2p_session_t)s, dir, ret, s->inst->cfg.userdata);
+}
+
+static void stream_file_progress(struct p2p_session *s, int dir) {
+    stream_file_t *f = dir == P2P_FILE_SEND ? &s->file_tx : &s->file_rx;
+    if (s->inst->cfg.on_file_progress && !s->bulk.b)
+        s->inst->cfg.on_file_progress((p2p_session_t)s, dir, f->done, f->total, s->inst->cfg.userdata);
+}
+
+/* 文件数据直接 pread 到发送槽位的包体，不经 send_ring */
+static int stream_flush_file(struct p2p_session *s, stream_t *st, int max_pkts) {
+    stream_file_t *f = &s->file_tx;
+    int hdr = stream_hdr_size(st), mss = stream_mss(st, nat_pmtu_payload(s) - fec_overhead(s));
+    int flushed = 0;
+
+    while (f->done < f->total && max_pkts-- > 0 && reliable_window_avail(s) > 0) {
+        uint8_t *pkt = reliable_send_buf(s);
+        if (!pkt) break;
+
+        int64_t left = f->total - f->done;
+        int n = file_pread(f->fd, pkt + hdr, left < mss ? (int)left : mss, f->offset);
+        if (n <= 0) {
+            ret_t ret = n < 0 ? E_EXTERNAL(errno) : E_OUT_OF_RANGE;    // 0 = 文件短于请求长度
+            print("E:", LA_F("file read failed at %lld (ret=%d), transfer aborted", LA_F492, 492), (long long)f->offset, n);
+            stream_file_end(s, P2P_FILE_SEND, ret);
+            return flushed;
+        }
+
+        if (s->bulk.b) f->crc = p2p_crc32_update(f->crc, pkt + hdr, n);
+        stream_hdr_write(st, pkt, (f->done == 0 ? P2P_FRAG_FIRST : 0) | (n == left ? P2P_FRAG_LAST : 0));
+        reliable_send_commit(s, hdr + n);
+        f->last_seq = s->reliable.send_seq - 1;
+        st->send_offset += n;
+        f->offset += n;
+        f->done += n;
+        flushed += n;
+    }
+
+    if (flushed) stream_file_progress(s, P2P_FILE_SEND);
+    return flushed;
+}
+
+/*
+ * 单条流的 flush：消息模式逐条切片；0 号流有文件发送时依次发出此前写入的数据、文件数据，
+ * 文件全部提交后恢复发送 send_ring
+ */
+static int stream_flush_one(struct p2p_session *s, stream_t *st, int max_pkts) {
+    if (st->msg_mode) return stream_flush_msgs(s, st, max_pkts);
+
+    stream_file_t *f = &s->file_tx;
+    if (st != &s->stream || f->fd < 0 || f->done >= f->total)
+        return stream_flush_ring(s, st, max_pkts, INT32_MAX);
+
+    int n = 0;
+    if (f->pre) {
+        n = stream_flush_ring(s, st, max_pkts, f->pre);
+        f->pre -= n;
+        if (f->pre || (n > 0 && max_pkts <= 1)) return n;
+    }
+    return n + stream_flush_file(s, st, max_pkts);
+}
+
+/* 发送侧文件传输完成判定：全部提交且最后一个文件包已被确认 */
+static void stream_file_check(struct p2p_session *s) {
+    stream_file_t *f = &s->file_tx;
+    if (f->fd < 0 || f->done < f->total) return;
+    if (seq32_diff(s->reliable.send_base, f->last_seq) > 0) stream_file_end(s, P2P_FILE_SEND, E_NONE);
+}
+
+/*
+ * 接收侧开始文件传输时由应用侧调用（持会话锁）：recv_ring 中尚未读出的数据先写入文件
+ *
+ * @return  写入的字节数，写入失败返回 -1（传输已结束）
+ */
+int stream_file_recv_ring(struct p2p_session *s) {
+    stream_file_t *f = &s->file_rx;
+    const uint8_t *ptr;
+    int total = 0, n;
+
+    while (f->done < f->total && (n = ring_peek_ptr(&s->stream.recv_ring, &ptr)) > 0) {
+        if (n > f->total - f->done) n = (int)(f->total - f->done);
+        if (file_pwrite(f->fd, ptr, n, f->offset) != n) {
+            stream_file_end(s, P2P_FILE_RECV, E_EXTERNAL(errno));
+            return -1;
+        }
+        if (s->bulk.b) f->crc = p2p_crc32_update(f->crc, ptr, n);
+        ring_skip(&s->stream.recv_ring, n);
+        f->offset += n;
+        f->done += n;
+        total += n;
+    }
+    if (f->done >= f->total) stream_file_end(s, P2P_FILE_RECV, E_NONE);
+    return total;
+}
+
+/* 按编号取流（0 号流即 s->stream），越界返回 NULL */
+stream_t *stream_get(struct p2p_session *s, int sid) {
+    if (sid == 0) return &s->stream;
+    if (sid < 0 || sid >= s->stream_cnt) return NULL;
+    return &s->xstreams[sid - 1];
+}
+
+/* 一轮：按轮转起点让 prio 类别的各流各发出 1 个包，返回发送的字节数 */
+static int stream_flush_class(struct p2p_session *s, int prio) {
+    int n = 0;
+    for (int i = 0; i < s->stream_cnt && reliable_window_avail(s) > 0; i++) {
+        stream_t *st = stream_get(s, (s->flush_rr + i) % s->stream_cnt);
+        if (RING_LOAD_ACQ(&st->prio) == prio) n += stream_flush_one(s, st, 1);
+    }
+    return n;
+}
+
+/*
+ * 刷新全部流到可靠层
+ * + 单流直接发送；多流时按优先级类别调度（p2p_stream_priority），同类别各流每轮各发 1 个包：
+ *   高优先级流先排空，窗口仍有余量时每 P2P_PRIO_WEIGHT 轮普通流搭配 1 轮批量流，
+ *   批量流量不会饿死，也不与普通流量平分窗口
+ * + 轮转起点每次调用后移一位，共享的发送窗口不被同类别中单条大流量流独占
+ *
+ * @return  实际发送的字节数
+ */
+int stream_flush_to_reliable(struct p2p_session *s) {
+    stream_file_check(s);
+    if (s->stream_cnt <= 1) return stream_flush_one(s, &s->stream, INT32_MAX);
+
+    int total = 0, n;
+    do {
+        n = stream_flush_class(s, P2P_PRIO_HIGH);
+        total += n;
+    } while (n > 0 && reliable_window_avail(s) > 0);
+
+    while (reliable_window_avail(s) > 0) {
+        n = 0;
+        for (int w = 0; w < P2P_PRIO_WEIGHT; w++) {
+            int m = stream_flush_class(s, P2P_PRIO_NORMAL);
+            if (m <= 0) break;
+            n += m;
+        }
+        n += stream_flush_class(s, P2P_PRIO_BULK);
+        total += n;
+        if (n <= 0) break;
+    }
+
+    s->flush_rr = (s->flush_rr + 1) % s->stream_cnt;
+    return total;
+}
+
+/*
+ * 消息模式投递：分片写入 wip 区，末片到达后补写长度并发布
+ * + 整条消息超出 recv_ring 上限时丢弃（其余分片一并跳过），否则空间不足返回 -1 等待扩容
+ * + 回调模式下首末同片的完整消息直接以 data 回调，不经 recv_ring 拷贝
+ * + 亦供原生多流传输层（SCTP）按消息块投递，fflags 由传输层的消息边界换算
+ */
+int stream_deliver_msg(struct p2p_session *s, stream_t *st, uint8_t fflags,
+                              const uint8_t *data, int data_len) {
+    ringbuf_t *r = &st->recv_ring;
+
+    if (fflags & P2P_FRAG_FIRST) {
+        if (st->recv_msg_open)
+            print("W:", LA_F("message truncated by peer, %d bytes discarded", LA_F486, 486), r->wip);
+        r->wip = 0;
+        st->recv_msg_open = 0;
+    } else if (!st->recv_msg_open) {
+        st->recv_offset += data_len;
+        return 0;   /* 丢弃中的消息或无首片的孤立分片（偏移照常推进，多流提前交付据此判定） */
+    }
+
+    if ((fflags & P2P_FRAG_WHOLE) == P2P_FRAG_WHOLE && s->inst->cfg.on_message) {
+        st->recv_offset += data_len;
+        s->inst->cfg.on_message((p2p_session_t)s, data, data_len, s->inst->cfg.userdata);
+        return data_len;
+    }
+
+    int need = (st->recv_msg_open ? 0 : STREAM_MSG_HDR_SIZE) + data_len;
+    if (need > ring_free(r)) {
+        if (r->wip + need > r->max - 1) {
+            print("W:", LA_F("message exceeds recv buffer max %d, dropped", LA_F487, 487), r->max);
+            r->wip = 0;
+            st->recv_msg_open = 0;
+            st->recv_offset += data_len;
+            return 0;
+        }
+        /* 回调模式下应用侧不读 recv_ring，由工作线程（已持实例锁）直接扩容 */
+        if (s->inst->cfg.on_message) {
+            if (ring_reserve(r, need) < need) return -1;
+        } else {
+            if (r->size < r->max && st->recv_need < need) RING_STORE_REL(&st->recv_need, need);
+            return -1;
+        }
+    }
+
+    /* 回调模式下消息不发布，recv_ring 始终为空：每条消息从头写入，回调时必然连续 */
+    bool cb = s->inst->cfg.on_message != NULL;
+    if (!st->recv_msg_open) {
+        if (cb) r->head = r->tail = 0;
+        st->recv_msg_open = 1;
+        r->wip = STREAM_MSG_HDR_SIZE;
+    }
+    int mask = r->size - 1;
+    ring_copy_in(r, (r->tail + r->wip) & mask, data, data_len);
+    r->wip += data_len;
+    st->recv_offset += data_len;
+    if (!(fflags & P2P_FRAG_LAST)) return data_len;
+
+    /* 末片：补写长度后发布整条消息 */
+    int mlen = r->wip - STREAM_MSG_HDR_SIZE;
+    uint8_t hdr[STREAM_MSG_HDR_SIZE];
+    nwrite_l(hdr, (uint32_t)mlen);
+    ring_copy_in(r, r->tail, hdr, STREAM_MSG_HDR_SIZE);
+    int tail = r->tail;
+    st->recv_msg_open = 0;
+    r->wip = 0;
+
+    if (cb)
+        s->inst->cfg.on_message((p2p_session_t)s, r->data + tail + STREAM_MSG_HDR_SIZE, mlen,
+                                s->inst->cfg.userdata);
+    else
+        RING_STORE_REL(&r->tail, (tail + STREAM_MSG_HDR_SIZE + mlen) & mask);
+    return data_len;
+}
+
+/*
+ * 将一个按序 DATA 包的有效载荷写入接收缓冲区
+ *
+ * 剥离 DATA 子头后整包写入；放不下时不写入任何字节，并在可扩容时记录 recv_need，
+ * 由应用侧扩容后再投递。
+ *
+ * @param s    会话对象
+ * @param pkt  DATA 包（含子头）
+ * @param len  包长度
+ * @return     写入的字节数（格式错误的包按 0 丢弃），空间不足返回 -1
+ */
+/* 解析 DATA 子头：返回所属流并输出子头长度，格式错误或流不存在返回 NULL */
+static stream_t *stream_hdr_parse(struct p2p_session *s, const uint8_t *pkt, int len, int *hdr) {
+    if (len < P2P_DATA_HDR_SIZE) return NULL;
+    if (!(pkt[4] & P2P_FRAG_SID)) {
+        *hdr = P2P_DATA_HDR_SIZE;
+        return &s->stream;
+    }
+    if (len < P2P_DATA_SID_HDR_SIZE) return NULL;
+    *hdr = P2P_DATA_SID_HDR_SIZE;
+    return stream_get(s, pkt[5]);
+}
+
+int stream_deliver(struct p2p_session *s, const uint8_t *pkt, int len) {
+
+    /* MSG RPC 帧不属于任何流，交给 rpc 模块（见 p2p_rpc.h） */
+    if (len >= P2P_DATA_HDR_SIZE && (pkt[4] & P2P_FRAG_RPC)) {
+        rpc_on_direct(s, pkt + P2P_DATA_HDR_SIZE, len - P2P_DATA_HDR_SIZE);
+        return 0;
+    }
+
+    /* 验证包长度并定位所属流（未协商的流号按格式错误丢弃） */
+    int hdr;
+    stream_t *st = stream_hdr_parse(s, pkt, len, &hdr);
+    if (!st) return 0;  /* 格式错误，跳过 */
+
+    const uint8_t *data = pkt + hdr;
+    int data_len = len - hdr;
+
+    /* 发送方放弃的过期消息分片：推进偏移（与原分片一致，多流提前交付据此判定），丢弃组装中的消息 */
+    if (pkt[4] & P2P_FRAG_SKIP) {
+        if (data_len >= (int)P2P_FRAG_SKIP_PSZ) st->recv_offset += nget_l(data);
+        if (st->recv_msg_open) {
+            if (P2P_LOG_ON(VERBOSE)) print("V:", LA_F("expired message skipped by peer, %d bytes discarded", LA_F689, 689),
+                                           st->recv_ring.wip);
+            st->recv_ring.wip = 0;
+            st->recv_msg_open = 0;
+        }
+        return 0;
+    }
+
+    /* 压缩块先解压（放不下时下次投递重新解压） */
+    uint8_t raw[P2P_LZ_RAW_MAX];
+    if (pkt[4] & P2P_FRAG_LZ) {
+        data_len = p2p_lz_decompress(data, data_len, raw, sizeof(raw));
+        if (data_len < 0) {
+            print("W:", LA_F("corrupt compressed DATA (%d bytes), dropped", LA_F491, 491), len);
+            return 0;
+        }
+        data = raw;
+    }
+    if (st->msg_mode) return stream_deliver_msg(s, st, pkt[4], data, data_len);
+
+    /* 文件接收：按序数据先写入文件，超出部分进入 recv_ring（放不下时整包暂留，文件部分不重复写入） */
+    stream_file_t *f = &s->file_rx;
+    int fn = 0;
+    if (st == &s->stream && f->fd >= 0) {
+        fn = f->total - f->done < data_len ? (int)(f->total - f->done) : data_len;
+        if (data_len - fn > ring_free(&st->recv_ring)) fn = 0;
+    }
+    if (fn > 0) {
+        if (file_pwrite(f->fd, data, fn, f->offset) != fn) {
+            ret_t ret = E_EXTERNAL(errno);
+            print("E:", LA_F("file write failed at %lld, transfer aborted", LA_F493, 493), (long long)f->offset);
+            stream_file_end(s, P2P_FILE_RECV, ret);
+            fn = 0;
+        } else {
+            if (s->bulk.b) f->crc = p2p_crc32_update(f->crc, data, fn);
+            f->offset += fn;
+            f->done += fn;
+            st->recv_offset += fn;
+            data += fn;
+            data_len -= fn;
+            stream_file_progress(s, P2P_FILE_RECV);
+            if (f->done >= f->total) stream_file_end(s, P2P_FILE_RECV, E_NONE);
+        }
+    }
+
+    if (data_len > ring_free(&st->recv_ring)) {
+        if (st->recv_ring.size < st->recv_ring.max && st->recv_need < data_len)
+            RING_STORE_REL(&st->recv_need, data_len);
+        return -1;
+    }
+
+    /* 提取并写入有效载荷 */
+    int n = data_len > 0 ? ring_write(&st->recv_ring, data, data_len) : 0;
+    st->recv_offset += n;
+    return fn + n;
+}
+
+/*
+ * 多流提前交付判定：包的流偏移恰为所属流的下一个期望偏移
+ * + 同一条流的包按序列号顺序分配偏移，偏移匹配即说明该流此前的数据均已交付，
+ *   越过其他流的空洞交付不会打乱本流顺序
+ * + MSG RPC 帧与流数据无顺序关系，总可提前交付
+ */
+int stream_deliver_ready(struct p2p_session *s, const uint8_t *pkt, int len) {
+    if (len >= P2P_DATA_HDR_SIZE && (pkt[4] & P2P_FRAG_RPC)) return 1;
+    int hdr;
+    stream_t *st = stream_hdr_parse(s, pkt, len, &hdr);
+    return st && nget_l(pkt) == st->recv_offset;
+}
+
 /*
  * 从可靠层接收数据到流缓冲区
  *
  * 从可靠传输层获取有序数据包，剥离 DATA 子头，
  * 将有效载荷写入接收环形缓冲区。
+ * （无空洞时按序包已在 reliable_on_data 中直接投递，这里只处理曾乱序或曾因空间不足暂留的包）
  *
  * 处理流程：
- *   1. 循环从可靠层出队数据包
- *   2. 验证包长度（至少包含 DATA 子头）
- *   3. 剥离子头，写入接收缓冲区
- *   4. 更新接收偏移量
+ *   1. 循环借出可靠层的下一个有序包（不拷贝）
+ *   2. 经 stream_deliver 写入接收缓冲区，不足时停止（记录 recv_need）
+ *   3. 写入成功后归还可靠层槽位
  *
  * @param s   会话对象
  * @return    接收的总字节数
  */
 int stream_feed_from_reliable(struct p2p_session *s) {
-    stream_t *st = &s->stream;
-    
     int total = 0;
-    uint8_t pkt[P2P_MAX_PAYLOAD];
+    const uint8_t *pkt;
     int pkt_len;
 
-    /* 循环处理所有可用的有序数据包 */
-    while (reliable_recv_pkt(s, pkt, &pkt_len) == 0) {
-        /* 验证最小包长度 */
-        if (pkt_len < P2P_DATA_HDR_SIZE) continue;  /* 格式错误，跳过 */
-
-        /* 
-         * 解析流偏移和分片标志（预留，用于将来的顺序验证）
-         * uint32_t off = (pkt[0]<<24)|(pkt[1]<<16)|(pkt[2]<<8)|pkt[3];
-         * uint8_t fflags = pkt[4];
-         */
-
-        /* 提取并写入有效载荷 */
-        int data_len = pkt_len - P2P_DATA_HDR_SIZE;
-        if (data_len > 0) {
-            int n = ring_write(&st->recv_ring, pkt + P2P_DATA_HDR_SIZE, data_len);
-            total += n;
-            st->recv_offset += n;
-        }
+    /* 循环处理所有可用的有序数据包；接收缓冲区放不下时暂留 reliable 层，请求应用侧扩容 */
+    while ((pkt = reliable_recv_ptr(s, &pkt_len)) != NULL) {
+        int n = stream_deliver(s, pkt, pkt_len);
+        if (n < 0) break;
+        reliable_recv_drop(s);
+        total += n;
     }
 
     return total;
 }
+
+/* ============================================================================
+ * 不可靠数据报通道
+ * ============================================================================ */
+
+ret_t dgram_init(dgram_t *d) {
+    memset(d, 0, sizeof(*d));
+    if (ring_init(&d->send_ring, DGRAM_BUF_SIZE, DGRAM_BUF_SIZE) != E_NONE ||
+        ring_init(&d->recv_ring, DGRAM_BUF_SIZE, DGRAM_BUF_SIZE) != E_NONE) {
+        dgram_free(d);
+        return E_OUT_OF_MEMORY;
+    }
+    return E_NONE;
+}
+
+void dgram_free(dgram_t *d) {
+    ring_release(&d->send_ring);
+    ring_release(&d->recv_ring);
+}
+
+/*
+ * 应用侧写入一条数据报
+ *
+ * @param lifetime_ms  生存期（<= 0 不限时）：超过该时长仍未发出（如 DTLS 握手中、中继限流）则丢弃
+ * @return             len（已排队），0（缓冲区已满）
+ */
+int dgram_write(dgram_t *d, const void *buf, int len, int lifetime_ms) {
+    if (ring_free(&d->send_ring) < DGRAM_SEND_HDR_SIZE + len) return 0;
+
+    uint32_t deadline = stream_deadline(lifetime_ms, p2p_now_ms());
+
+    uint8_t hdr[DGRAM_SEND_HDR_SIZE];
+    nwrite_l(hdr, (uint32_t)len);
+    nwrite_l(hdr + 4, deadline);
+    p2p_iovec_t iov[2] = { { hdr, DGRAM_SEND_HDR_SIZE }, { buf, len } };
+    ring_writev(&d->send_ring, iov, 2);
+    return len;
+}
+
+/*
+ * 应用侧读取一条数据报
+ *
+ * @return  数据报长度；无数据报返回 0；len 不足以容纳时返回其长度（> len）且保留
+ */
+int dgram_read(dgram_t *d, void *buf, int len) {
+    return ring_read_msg(&d->recv_ring, buf, len);
+}
+
+/*
+ * 工作线程：发出排队的数据报
+ * + 加密会话在 DTLS 就绪前不发（避免明文外泄），期间到期的数据报直接丢弃
+ * + 发送失败（中继限流等）时保留当前数据报，下次 update 重试
+ *
+ * @return  发出的数据报数
+ */
+int dgram_flush(struct p2p_session *s, uint64_t now) {
+    dgram_t *d = &s->dgram;
+    bool ready = !s->dtls || s->dtls->is_ready(s);
+    uint8_t buf[DGRAM_SEND_HDR_SIZE + P2P_DGRAM_MAX];
+    int sent = 0;
+
+    d->blocked = 0;
+    while (ring_peek(&d->send_ring, buf, DGRAM_SEND_HDR_SIZE) == DGRAM_SEND_HDR_SIZE) {
+        int len = (int)nget_l(buf);
+        uint32_t deadline = nget_l(buf + 4);
+
+        if (stream_deadline_passed(deadline, now)) {
+            ring_skip(&d->send_ring, DGRAM_SEND_HDR_SIZE + len);
+            d->expired++;
+            continue;
+        }
+        if (!ready) { d->blocked = 1; break; }
+
+        ring_peek(&d->send_ring, buf, DGRAM_SEND_HDR_SIZE + len);
+        if (p2p_send_packet(s, &s->active_addr, P2P_PKT_DGRAM, 0, d->send_seq,
+                            buf + DGRAM_SEND_HDR_SIZE, len, now) < 0) {
+            d->blocked = 1;
+            break;
+        }
+        ring_skip(&d->send_ring, DGRAM_SEND_HDR_SIZE + len);
+        d->send_seq++;
+        sent++;
+    }
+    return sent;
+}
+
+/* 工作线程：收到一条数据报，有回调时直接回调，否则放入 recv_ring（满则丢弃） */
+void dgram_deliver(struct p2p_session *s, const uint8_t *data, int len) {
+    dgram_t *d = &s->dgram;
+    if (len <= 0) return;
+
+    if (s->inst->cfg.on_dgram) {
+        s->inst->cfg.on_dgram((p2p_session_t)s, data, len, s->inst->cfg.userdata);
+        return;
+    }
+
+    if (ring_free(&d->recv_ring) < STREAM_MSG_HDR_SIZE + len) {
+        d->dropped++;
+        return;
+    }
+    uint8_t hdr[STREAM_MSG_HDR_SIZE];
+    nwrite_l(hdr, (uint32_t)len);
+    p2p_iovec_t iov[2] = { { hdr, STREAM_MSG_HDR_SIZE }, { data, len } };
+    ring_writev(&d->recv_ring, iov, 2);
+}
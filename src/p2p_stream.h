@@ -9,10 +9,16 @@
  * 流层分片常量
  * ============================================================================ */
 
-/* DATA 子包头 (5 bytes, 作为负载数据的一部分) */
+/* DATA 子包头 (5 bytes, 作为负载数据的一部分；多流时非 0 号流再追加 sid(1)) */
 #define P2P_FRAG_FIRST          0x01
 #define P2P_FRAG_LAST           0x02
 #define P2P_FRAG_WHOLE          0x03                // FIRST | LAST
+#define P2P_FRAG_SID            0x04                // 子头之后携带 sid(1)；未设置为 0 号流（与单流对端兼容）
+#define P2P_FRAG_LZ             0x08                // 负载为 LZ 压缩块（见 p2p_lz.h），解压后为 offset 起的原始数据
+#define P2P_FRAG_RPC            0x10                // 负载为 MSG RPC 帧（见 p2p_rpc.h），不属于任何流、不占流偏移
+#define P2P_FRAG_SKIP           0x20                // 负载为 [skip_len(4)]：发送方放弃的过期消息分片（见 p2p_send_msg_ttl），
+                                                    // 接收方推进 skip_len 字节流偏移并丢弃组装中的消息（CONN 协商 RELIABLE_CAP2_SKIP）
+#define P2P_FRAG_SKIP_PSZ       4u
 
 typedef struct {
     uint32_t stream_offset;                         // 网络字节序
@@ -20,50 +26,274 @@ typedef struct {
 } p2p_data_hdr_t;
 
 #define P2P_DATA_HDR_SIZE       5
-#define P2P_STREAM_PAYLOAD      (P2P_MAX_PAYLOAD - P2P_DATA_HDR_SIZE)  /* 1191 */
+#define P2P_DATA_SID_HDR_SIZE   6                                       /* offset(4) + flags(1) + sid(1) */
+#define P2P_STREAM_PAYLOAD      (P2P_MAX_PAYLOAD - P2P_DATA_HDR_SIZE)  /* 1191（未探测路径 MTU 时） */
 
 ///////////////////////////////////////////////////////////////////////////////
 
-#define RING_SIZE  (64 * 1024)   /* 64 KB */
+#ifndef P2P_FIXED_MEM
+#define RING_SIZE           (64 * 1024)         /* 默认初始容量 64 KB */
+#define RING_MAX_SIZE       (4 * 1024 * 1024)   /* 默认扩容上限 4 MB */
+#else
+#define RING_SIZE           (8 * 1024)          /* 固定内存构建：默认初始容量 8 KB */
+#define RING_MAX_SIZE       (32 * 1024)         /* 固定内存构建：默认扩容上限 32 KB */
+#endif
+#define RING_MIN_SIZE       4096                /* 最小容量 */
+#define RING_SHRINK_IDLE_MS 5000                /* 空闲超过该时长收缩回初始容量 */
+
+/*
+ * 单生产者/单消费者（SPSC）无锁环形缓冲区
+ * + head 只由消费者写、tail 只由生产者写，另一方以 acquire 语义读取，
+ *   数据拷贝完成后以 release 语义发布指针，双方无需加锁
+ * + 容量为 2 的幂，下标以 size - 1 掩码回绕
+ * + 扩容/收缩（ring_reserve / ring_shrink）会重新分配 data，调用方须保证两端均未在访问
+ */
+#if defined(_MSC_VER)
+#define RING_LOAD_ACQ(p)        (*(volatile const int *)(p))    /* MSVC volatile 默认具备 acquire/release 语义 */
+#define RING_STORE_REL(p, v)    (*(volatile int *)(p) = (v))
+#else
+#define RING_LOAD_ACQ(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RING_STORE_REL(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
 
 typedef struct {
-    uint8_t  data[RING_SIZE];
-    int      head;              /* 读指针 */
-    int      tail;              /* 写指针 */
+    uint8_t *data;
+    int      size;              /* 当前容量（2 的幂） */
+    int      head;              /* 读指针（消费者写） */
+    int      tail;              /* 写指针（生产者写） */
+    int      base;              /* 初始容量（空闲收缩目标） */
+    int      max;               /* 扩容上限 */
+    int      wip;               /* 生产者已写入 tail 之后、尚未发布的字节数（消息组装中），扩容时一并搬移 */
+    struct p2p_arena *arena;    /* data 所在的实例内存区（NULL = 全局分配） */
+    struct p2p_mem_acct *mem;   /* data 计入的内存计量（P2P_MEM_STREAM，NULL = 不计量） */
 } ringbuf_t;
 
 static inline int ring_used(const ringbuf_t *r) {
-    return (r->tail - r->head + RING_SIZE) % RING_SIZE;
+    return (RING_LOAD_ACQ(&r->tail) - RING_LOAD_ACQ(&r->head)) & (r->size - 1);
 }
 
 static inline int ring_free(const ringbuf_t *r) {
-    return RING_SIZE - 1 - ring_used(r);
+    return r->size - 1 - ring_used(r) - r->wip;
+}
+
+/* 生产者当前可写入的字节数（含按需扩容到 max 的余量，见 ring_reserve） */
+static inline int ring_space(const ringbuf_t *r) {
+    return (r->max > r->size ? r->max : r->size) - 1 - ring_used(r) - r->wip;
 }
 
+ret_t ring_init(ringbuf_t *r, int size, int max);
+ret_t ring_init_in(ringbuf_t *r, int size, int max, struct p2p_arena *arena, struct p2p_mem_acct *mem);
+void ring_release(ringbuf_t *r);
+int  ring_reserve(ringbuf_t *r, int len);
+void ring_shrink(ringbuf_t *r);
+void ring_hibernate(ringbuf_t *r);
+ret_t ring_thaw(ringbuf_t *r);
+
 int  ring_write(ringbuf_t *r, const void *data, int len);
+int  ring_writev(ringbuf_t *r, const p2p_iovec_t *iov, int cnt);
 int  ring_read(ringbuf_t *r, void *buf, int len);
 int  ring_peek(const ringbuf_t *r, void *buf, int len);
+int  ring_peek_ptr(const ringbuf_t *r, const uint8_t **ptr);
 void ring_skip(ringbuf_t *r, int len);
 
 ///////////////////////////////////////////////////////////////////////////////
 
+#define STREAM_NAGLE_DELAY_MS   2               /* Nagle 默认最长暂缓 */
+#define STREAM_MSG_HDR_SIZE     4               /* 消息模式：环形缓冲区中每条消息前的长度字段 */
+#define STREAM_MSG_DEADLINE     0x80000000u     /* 消息模式 send_ring：长度字段最高位置位时其后为 deadline(4) */
+#define STREAM_MSG_DEADLINE_SIZE 4              /* deadline：到期时刻 tick 低 32 位（见 stream_deadline_passed） */
+#define STREAM_CORK_MAX_MS      200             /* P2P_SEND_MORE 最长暂缓（同 Linux TCP_CORK） */
+#define STREAM_LZ_MIN           64              /* 流压缩：不足该字节数的数据不尝试压缩 */
+#define STREAM_LZ_BACKOFF       16              /* 流压缩：一次无收益后按原样发送的包数 */
+
+/*
+ * 线程模型（threaded 模式）：
+ *   send_ring: 应用线程（p2p_send）生产，工作线程（p2p_update）消费
+ *   recv_ring: 工作线程生产，应用线程（p2p_recv）消费
+ * 两个方向均为 SPSC，数据路径不需要实例锁；待发送字节数即 ring_used(&send_ring)
+ */
 typedef struct stream {
     ringbuf_t send_ring;
     ringbuf_t recv_ring;
+    int       sid;            /* 流编号（0 号流即 s->stream，其余见 s->xstreams） */
     uint32_t  send_offset;    /* 下一个要发送的字节偏移量 */
     uint32_t  recv_offset;    /* 下一个期望的字节偏移量 */
     int       nagle;          /* Nagle 批处理启用 */
-    int       pending_bytes;  /* send_ring 中待发送的字节数 */
+    int       nagle_delay;    /* Nagle 尾部最长暂缓时间 (毫秒) */
+    uint64_t  nagle_ts;       /* 工作线程：当前尾部开始暂缓的时间（0 = 无） */
+    int       cork;           /* 应用侧写：P2P_SEND_MORE 期间为 1，尾部暂缓 */
+    int       flush_req;      /* 应用侧写：p2p_flush 请求计数 */
+    int       flush_done;     /* 工作线程：已完成的 flush 请求计数（不等于 flush_req 时立即发出全部数据） */
+    int       recv_need;      /* 工作线程写：recv_ring 放不下下一个包时所需空间，由应用侧扩容后清零 */
+    uint64_t  send_active_ts; /* 应用侧最近一次看到 send_ring 非空的时间（空闲收缩计时） */
+    uint64_t  recv_active_ts; /* 应用侧最近一次看到 recv_ring 非空的时间 */
+
+    /* 消息模式：两个环形缓冲区均按 [len(4)][data] 存放整条消息，DATA 子头 FIRST/LAST 标记消息首尾 */
+    int       msg_mode;
+    int       send_msg_left;  /* 工作线程：当前消息尚未切片的字节数（0 = 位于消息边界） */
+    int       send_msg_first; /* 工作线程：下一片是当前消息的首片 */
+    int       recv_msg_open;  /* 工作线程：正在 recv_ring 的 wip 区组装一条消息（0 时非首片分片丢弃） */
+    uint32_t  send_msg_deadline; /* 工作线程：当前消息的到期时刻（0 = 不限时） */
+    uint32_t  msg_expired;    /* 工作线程：到期未发出（或未确认）而丢弃的消息数 */
+
+    int       lz_skip;        /* 工作线程：流压缩无收益后剩余的跳过包数 */
+    int       writable_wait;  /* 应用侧写 1、工作线程清 0：待发送字节超过低水位，降回后回调 on_writable（见 stream_writable_poll） */
+    int       redundant;      /* 应用侧写：冗余双发模式 P2P_REDUNDANT_*，组包时记入可靠层条目 */
+    int       unordered;      /* 应用侧写：无序交付（仅原生多流传输层，见 p2p_stream_unordered） */
+    int       prio;           /* 应用侧写：优先级类别 P2P_PRIO_*，决定多流 flush 顺序并记入可靠层条目 */
+#ifdef P2P_METRICS
+    uint64_t  queue_ts;       /* 排队时延采样：采样写入的时刻（应用侧发布，0 = 采样槽空闲，由工作线程归还） */
+    int       queue_left;     /* 排队时延采样：采样写入末字节之前（含）尚在 send_ring 中的字节数 */
+#endif
 } stream_t;
 
 /* Forward declarations */
 struct p2p_session;
 
-void stream_init(struct stream *st, int nagle);
+/* 到期时刻（tick 低 32 位，0 = 不限时）已过：按 32 位回绕比较，生存期须远小于 2^31 毫秒 */
+static inline bool stream_deadline_passed(uint32_t deadline, uint64_t now) {
+    return deadline && (int32_t)((uint32_t)now - deadline) >= 0;
+}
+
+/* 生存期 → 到期时刻（lifetime_ms <= 0 为 0 = 不限时，恰为 0 的时刻取 1） */
+static inline uint32_t stream_deadline(int lifetime_ms, uint64_t now) {
+    uint32_t deadline = 0;
+    if (lifetime_ms > 0 && !(deadline = (uint32_t)(now + (uint64_t)lifetime_ms))) deadline = 1;
+    return deadline;
+}
+
+/* DATA 子头长度与单包最大数据量（非 0 号流多 1 字节 sid；payload_max 为活跃路径的 DATA 负载上限，见 nat_pmtu_payload） */
+static inline int stream_hdr_size(const stream_t *st) {
+    return st->sid ? P2P_DATA_SID_HDR_SIZE : P2P_DATA_HDR_SIZE;
+}
+static inline int stream_mss(const stream_t *st, int payload_max) {
+    return payload_max - stream_hdr_size(st);
+}
+
+/*
+ * send_ring 排队时延采样（P2P_METRICS，直方图 P2P_HIST_SEND_QUEUE）
+ *
+ * 同一时刻只追踪一个采样点：应用侧写入后若采样槽空闲，记下当前排队字节数（至本次写入末字节）
+ * 与时刻；工作线程每从 send_ring 取出字节即扣减，末字节离开 send_ring（组包提交可靠层或交给传输层）时
+ * 记录时延并归还采样槽。
+ * 持续满载时 send_ring 不会变空，按出队字节计数仍能持续采样
+ */
+#ifdef P2P_METRICS
+static inline void stream_queue_mark(stream_t *st) {
+    if (__atomic_load_n(&st->queue_ts, __ATOMIC_ACQUIRE)) return;
+    st->queue_left = ring_used(&st->send_ring);
+    __atomic_store_n(&st->queue_ts, P_tick_us(), __ATOMIC_RELEASE);
+}
+
+static inline void stream_queue_sent(stream_t *st, int n) {
+    uint64_t ts = __atomic_load_n(&st->queue_ts, __ATOMIC_ACQUIRE);
+    if (!ts || (st->queue_left -= n) > 0) return;
+    P2P_HIST(P2P_HIST_SEND_QUEUE, P_tick_us() - ts);
+    __atomic_store_n(&st->queue_ts, 0, __ATOMIC_RELEASE);
+}
+#else
+#define stream_queue_mark(st)       ((void)0)
+#define stream_queue_sent(st, n)    ((void)0)
+#endif
+
+/*
+ * 消息模式（cfg.message_mode）：
+ *   发送：p2p_send_msg 将 [len][data] 一次写入 send_ring；flush 时每条消息独立切片，
+ *         首片带 P2P_FRAG_FIRST、末片带 P2P_FRAG_LAST，一个包不跨两条消息，不做 Nagle 合并
+ *   接收：分片按序写入 recv_ring 中 tail 之后的 wip 区，末片到达后补写长度并一次发布，
+ *         应用侧只会看到完整消息；设置 cfg.on_message 时整条消息直接回调，不进入 p2p_recv_msg
+ *   限时（p2p_send_msg_ttl）：send_ring 记录为 [len | STREAM_MSG_DEADLINE][deadline(4)][data]，
+ *         到期仍未切片的消息整条丢弃（已切出部分分片的，剩余部分丢弃并发出 P2P_FRAG_SKIP 关闭对端组装）；
+ *         已提交可靠层的分片到期未确认时改写为 P2P_FRAG_SKIP（见 reliable_expire），不再重传数据
+ *
+ * 多流（cfg.stream_count > 1）：
+ *   每条流有独立的收发缓冲区与字节偏移，共享 reliable 层的序列号空间、拥塞窗口与接收窗口；
+ *   flush 时各流按包轮转，接收时空洞之后的包若恰是其所属流的下一段数据（offset 匹配）即提前交付，
+ *   一条流上的丢包不阻塞其他流
+ *
+ * 流压缩（cfg.compress，CONN 协商 RELIABLE_CAP_LZ）：
+ *   flush 时从 send_ring 取至多 P2P_LZ_RAW_MAX 字节压缩，尽量多地装满一个包，带 P2P_FRAG_LZ 发出；
+ *   offset 与分片标志仍按原始字节计，压缩无收益时按原样组包并暂停尝试 STREAM_LZ_BACKOFF 个包。
+ *   接收窗口仍按包负载字节计，解压后放不下时与普通包一样暂留 reliable 层
+ *
+ * 扩容/收缩的线程约定（threaded 模式）：
+ *   工作线程只在实例锁内访问环形缓冲区，因此重分配一律由应用侧（p2p_send / p2p_recv）
+ *   持实例锁执行；工作线程发现 recv_ring 不足时只记录 recv_need，数据暂留在 reliable 层
+ */
+/*
+ * 文件收发（p2p_send_file / p2p_recv_file，仅 0 号流、字节流模式）
+ *   发送：先发出调用前已写入 send_ring 的 pre 字节，随后按窗口逐包从文件 pread 到包体，
+ *         文件发完前之后写入的数据留在 send_ring；最后一个文件包被确认后完成
+ *   接收：此后按序到达的流数据（含调用时 recv_ring 中未读的数据）直接写入文件，超出 total 的部分照常进入 recv_ring
+ *   文件读写与回调均在工作线程中进行；描述符由应用持有，不随会话关闭
+ *   会话挂接批量传输（p2p_bulk.h）时由其驱动逐块收发，沿途累计 crc，不回调 on_file_*
+ */
+typedef struct stream_file {
+    int       fd;             /* 文件描述符（-1 = 无传输） */
+    int64_t   offset;         /* 文件中的下一个读写位置 */
+    int64_t   total;          /* 传输总字节数 */
+    int64_t   done;           /* 已提交 reliable（发送）/ 已写入文件（接收）的字节数 */
+    int       pre;            /* 发送：文件之前须先发出的 send_ring 字节数 */
+    uint32_t  last_seq;       /* 发送：最后一个文件包的序列号 */
+    uint32_t  crc;            /* 批量传输（s->bulk 挂接时）：已读出 / 已写入数据的 CRC32 */
+} stream_file_t;
+
+ret_t stream_init(struct stream *st, int nagle, int send_size, int recv_size, int max_size);
+ret_t stream_init_in(struct stream *st, struct p2p_arena *arena, struct p2p_mem_acct *mem, int nagle, int send_size, int recv_size, int max_size);
+void stream_free(struct stream *st);
+bool stream_ring_idle(const ringbuf_t *r, uint64_t *active_ts);
+bool stream_drained(const struct stream *st);
+void stream_hibernate(struct stream *st);
+ret_t stream_thaw(struct stream *st);
 int  stream_write(struct stream *st, const void *buf, int len);
+int  stream_writev(struct stream *st, const p2p_iovec_t *iov, int cnt);
 int  stream_read(struct stream *st, void *buf, int len);
+int  stream_peek(struct stream *st, const void **ptr);
+void stream_consume(struct stream *st, int len);
+int  stream_deliver(struct p2p_session *s, const uint8_t *pkt, int len);
+int  stream_write_msg(struct stream *st, const void *buf, int len);
+int  stream_write_msg_at(struct stream *st, const void *buf, int len, uint32_t deadline);
+int  stream_msg_begin(struct stream *st, uint64_t now);
+int  stream_read_msg(struct stream *st, void *buf, int len);
+int  stream_deliver_msg(struct p2p_session *s, struct stream *st, uint8_t fflags, const uint8_t *data, int data_len);
+int  stream_deliver_ready(struct p2p_session *s, const uint8_t *pkt, int len);
+struct stream *stream_get(struct p2p_session *s, int sid);
 int  stream_flush_to_reliable(struct p2p_session *s);
+int  stream_flush_timeout(const struct p2p_session *s, const struct stream *st, uint64_t now);
 int  stream_feed_from_reliable(struct p2p_session *s);
+int  stream_file_recv_ring(struct p2p_session *s);
+void stream_writable_arm(struct p2p_session *s, struct stream *st, bool short_write);
+void stream_writable_poll(struct p2p_session *s);
+
+///////////////////////////////////////////////////////////////////////////////
+
+#define DGRAM_BUF_SIZE          (16 * 1024)     /* 数据报收发缓冲区容量（固定，不扩容） */
+#define DGRAM_SEND_HDR_SIZE     8               /* send_ring 每条前缀：len(4) + deadline(4) */
+
+/*
+ * 不可靠数据报通道（P2P_PKT_DGRAM）
+ *
+ * 与 stream 并列、不经 reliable 层：无确认、无重传、不保序，由 p2p_send_packet
+ * 统一处理 session_id、加密与路径选择。
+ *   - send_ring（应用侧生产，工作线程消费）：[len(4)][deadline(4)][data]，
+ *     deadline 为到期时刻 tick 低 32 位（0 = 不限时），工作线程发出前检查，过期即丢弃
+ *   - recv_ring（工作线程生产，应用侧消费）：[len(4)][data]，放不下时丢弃
+ */
+typedef struct dgram {
+    ringbuf_t send_ring;
+    ringbuf_t recv_ring;
+    uint16_t  send_seq;       /* 工作线程：DGRAM 包头 seq（仅用于日志/抓包区分） */
+    int       blocked;        /* 工作线程：上次 flush 因路径不可发而中止，等待下次 update 重试 */
+    uint32_t  expired;        /* 工作线程：生存期到期未发出而丢弃的数据报数 */
+    uint32_t  dropped;        /* 工作线程：接收缓冲区满而丢弃的数据报数 */
+} dgram_t;
+
+ret_t dgram_init(dgram_t *d);
+void dgram_free(dgram_t *d);
+int  dgram_write(dgram_t *d, const void *buf, int len, int lifetime_ms);
+int  dgram_read(dgram_t *d, void *buf, int len);
+int  dgram_flush(struct p2p_session *s, uint64_t now);
+void dgram_deliver(struct p2p_session *s, const uint8_t *data, int len);
 
 ///////////////////////////////////////////////////////////////////////////////
 
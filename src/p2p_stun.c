@@ -25,15 +25,79 @@
 
 #include "p2p_internal.h"
 
-bool p2p_stun_init(stun_ctx_t *ctx, const char *stun_server, uint16_t stun_port) {
+static void stun_add_host(stun_ctx_t *ctx, const char *host, uint16_t port) {
+    if (ctx->host_cnt >= STUN_SERVERS_MAX || strlen(host) >= sizeof(ctx->hosts[0])) {
+        print("E:", LA_F("Failed to resolve STUN server %s", LA_F290, 290), host);
+        return;
+    }
+    strcpy(ctx->hosts[ctx->host_cnt], host);
+    ctx->ports[ctx->host_cnt++] = port;
+}
+
+/* 尚有服务器未得出解析结果 */
+static inline bool stun_resolving(const stun_ctx_t *ctx) {
+    return ctx->host_done != (1u << ctx->host_cnt) - 1;
+}
+
+/*
+ * 拉取异步解析结果，就绪的服务器追加到 servers[]
+ * + 主服务器（hosts[0]）先确定：其就绪前不追加其他服务器，保证 servers[0] 为 stun_server（共享检测以它为键）
+ * @return 本次新增的服务器数
+ */
+static int stun_resolve_poll(stun_ctx_t *ctx) {
+
+    int added = 0;
+    for (int i = 0; i < ctx->host_cnt; i++) {
+        if (ctx->host_done & (1u << i)) continue;
+        if (i > 0 && !(ctx->host_done & 1u)) break;
+
+        int r = p2p_dns_resolve(ctx->hosts[i], ctx->ports[i], &ctx->servers[ctx->server_cnt]);
+        if (r == 0) continue;
+        ctx->host_done |= 1u << i;
+        if (r < 0) {
+            print("E:", LA_F("Failed to resolve STUN server %s", LA_F290, 290), ctx->hosts[i]);
+            continue;
+        }
+        if (!ctx->server_cnt) ctx->server_addr = ctx->servers[0];
+        ctx->server_cnt++;
+        added++;
+    }
+    return added;
+}
+
+bool p2p_stun_init(stun_ctx_t *ctx, const char *stun_server, uint16_t stun_port, const char *stun_servers) {
 
     if (!stun_server || !stun_server[0]) return false;
 
-    if (resolve_host(stun_server, stun_port, &ctx->server_addr) < 0) {
-        print("E:", LA_F("Failed to resolve STUN server %s", LA_F290, 290), stun_server);
-        return false;
+    ctx->host_cnt = 0;
+    ctx->host_done = 0;
+    ctx->server_cnt = 0;
+    stun_add_host(ctx, stun_server, stun_port);
+
+    // 额外服务器："host[:port],host[:port],..."
+    for (const char *p = stun_servers; p && *p && ctx->host_cnt < STUN_SERVERS_MAX; ) {
+
+        while (*p == ' ') p++;
+        size_t n = strcspn(p, ",");
+        char host[128];
+        if (n > 0 && n < sizeof(host)) {
+            memcpy(host, p, n);
+            while (n > 0 && host[n - 1] == ' ') n--;
+            host[n] = '\0';
+
+            uint16_t port = stun_port;
+            char *colon = strchr(host, ':');
+            if (colon) { *colon = '\0'; port = (uint16_t)atoi(colon + 1); }
+
+            if (host[0]) stun_add_host(ctx, host, port);
+        }
+        p += n;
+        while (*p && *p != ',') p++;
+        if (*p == ',') p++;
     }
 
+    if (!ctx->host_cnt) return false;
+    stun_resolve_poll(ctx);             // 数值地址与缓存命中立即就绪
     return true;
 }
 
@@ -237,23 +301,123 @@ int p2p_stun_build_binding_request(uint8_t *buf, int max_len,
     return offset;
 }
 
+void p2p_stun_srflx_refresh(struct p2p_instance *inst, uint64_t now) {
+
+    if (!inst->cfg.stun_server || inst->cfg.test_ice_srflx_off || inst->connections > 0) return;
+
+    // 空闲期无流量维持 NAT 映射：超过新鲜期的映射地址作废
+    int start_idx = (inst->sig_mode == P2P_SIGNALING_MODE_COMPACT) ? 1 : 0;
+    for (int i = start_idx; i < inst->sock_cnt; i++) {
+        if (inst->socks[i].state != 2/*active*/ || tick_diff(now, inst->socks[i].mapped_ts) < STUN_SRFLX_FRESH_MS)
+            continue;
+        inst->socks[i].state = 1/*bound*/;
+        assert(inst->srflx_active > 0);
+        --inst->srflx_active;
+    }
+
+    // 立即补收集（不等到 p2p_connecting），缩短候选交换前的等待
+    if (inst->srflx_active < inst->srflx_count) p2p_stun_collect(inst);
+}
+
+void p2p_stun_route_changed(struct p2p_instance *inst) {
+
+    const route_ctx_t *rt = p2p_inst_route(inst);
+    if (!rt) return;
+
+    // 预测 / 探测套接字的映射随出口失效；先关闭，多路套接字即位于数组末尾
+    nat_predict_close(inst);
+    nat_bind_probe_close(inst);
+
+    // 多路 srflx 套接字：关闭绑定在已消失地址上的
+    for (int i = inst->sock_cnt - 1; i >= 1; i--) {
+        int r = 0;
+        while (r < rt->addr_count && rt->local_addrs[r].sin_addr.s_addr != inst->socks[i].local_addr.sin_addr.s_addr) r++;
+        if (r == rt->addr_count) p2p_udp_close(inst, i);
+    }
+
+    // 为新地址补开，不挤占端口预测与绑定探测的预留容量（见 p2p_create）
+    int multi_max = inst->sock_cap - 1 - NAT_PREDICT_SOCKS - 1;
+    for (int r = 0; inst->cfg.multi_srflx && r < rt->addr_count && inst->sock_cnt - 1 < multi_max; r++) {
+        int i = 1;
+        while (i < inst->sock_cnt && inst->socks[i].local_addr.sin_addr.s_addr != rt->local_addrs[r].sin_addr.s_addr) i++;
+        if (i == inst->sock_cnt) p2p_udp_open(inst, &rt->local_addrs[r], 0);
+    }
+
+    // 映射地址全部作废
+    for (int i = 0; i < inst->sock_cnt; i++) inst->socks[i].state = 1/*bound*/;
+    inst->srflx_active = 0;
+    if (!inst->cfg.stun_server) return;
+
+    stun_ctx_t *ctx = &inst->stun_ctx;
+    ctx->collect_time = 0;
+    inst->srflx_count = 0;
+    if (!inst->cfg.test_ice_srflx_off && (ctx->server_cnt || stun_resolving(ctx))) {
+        inst->srflx_count = (uint16_t)inst->sock_cnt;
+        if (inst->sig_mode == P2P_SIGNALING_MODE_COMPACT) --inst->srflx_count;
+    }
+
+    // 重新检测 NAT 类型（检测中的结果基于旧出口，同样作废）
+    inst->nat_type = P2P_NAT_UNKNOWN;
+    p2p_stun_nat_detect_start(inst, ctx->as_candidate);
+    if (inst->srflx_active < inst->srflx_count) p2p_stun_collect(inst);
+}
+
+/*
+ * 向所有尚无映射地址的套接字并行发送 collect 请求（各套接字独立，一个网卡发送失败不影响其余）
+ * @return 成功发出请求的套接字数，-1 = 构造请求失败
+ */
+static int stun_collect_send(struct p2p_instance *inst, uint64_t now) {
+
+    stun_ctx_t *ctx = &inst->stun_ctx;
+    uint8_t req[512];
+
+    int len = p2p_stun_build_binding_request(req, sizeof(req), NULL, NULL, NULL);
+    if (len <= 0) {
+        print("E:", LA_F("Failed to build STUN request", LA_F284, 284));
+        return -1;
+    }
+
+    // COMPACT 模式下 sock[0] 的 srflx 由信令服务器自动收集，仅需收集 socks[1..N]
+    // sock 0 需等 NAT 检测完成（Test I 已顺带收集 sock 0 的 srflx）
+    int start_idx = (inst->sig_mode == P2P_SIGNALING_MODE_COMPACT) ? 1 : 0, sent = 0;
+
+    // 同一请求（同一事务 ID）并行发往所有服务器：首个响应生成 Srflx，其余在 handle_packet 中忽略
+    ctx->collect_send_ms = now;
+    for (int i = start_idx; i < inst->sock_cnt; i++) {
+        if (i == 0 && inst->nat_type == P2P_NAT_DETECTING) continue;
+        if (inst->socks[i].state >= 2/*active*/) continue;
+        bool ok = false;
+        for (int k = 0; k < ctx->server_cnt; k++) {
+            ret_t ret = p2p_udp_send_to_sock(inst, i, &ctx->servers[k], req, len);
+            if (ret > 0) ok = true;
+            else print("E:", LA_F("Failed to send STUN request: %d", LA_F293, 293), ret);
+        }
+        if (ok) sent++;
+    }
+    return sent;
+}
+
 bool p2p_stun_collect(struct p2p_instance *inst) {
 
     P_check(inst->cfg.stun_server && inst->srflx_active < inst->srflx_count, return false;)
 
     stun_ctx_t *ctx = &inst->stun_ctx; 
 
+    // 服务器地址尚在解析：就绪后由 stun_resolve_tick 补发
+    if (!ctx->server_cnt) {
+        if (!stun_resolving(ctx)) return false;
+        ctx->collect_wait = true;
+        return true;
+    }
+
     // 幂等：如果已在收集中（未超时），不重复发送
-    uint64_t now = P_tick_ms();
+    uint64_t now = p2p_now_ms();
     if (ctx->collect_time && tick_diff(now, ctx->collect_time) < STUN_TEST_TIMEOUT_MS)
         return true;
 
-    // COMPACT 模式下 sock[0] 的 srflx 由信令服务器自动收集，仅需收集 socks[1..N]
-    // 其他模式下所有 sock 都需要收集
-    int start_idx = (inst->sig_mode == P2P_SIGNALING_MODE_COMPACT) ? 1 : 0;
-
     // 检查是否有需要收集的 sock（state < 2 表示尚无有效 mapped_addr）
-    // sock 0 需等 NAT 检测完成（Test I 已顺带收集 sock 0 的 srflx）
+    // COMPACT 模式下 sock[0] 由信令服务器收集；sock 0 需等 NAT 检测完成
+    int start_idx = (inst->sig_mode == P2P_SIGNALING_MODE_COMPACT) ? 1 : 0;
     bool need_collect = false;
     for (int i = start_idx; i < inst->sock_cnt; i++) {
         if (i == 0 && inst->nat_type == P2P_NAT_DETECTING) continue;
@@ -262,27 +426,15 @@ bool p2p_stun_collect(struct p2p_instance *inst) {
             break;
         }
     }
-    if (need_collect) { uint8_t req[512];
-
-        int len = p2p_stun_build_binding_request(req, sizeof(req), NULL, NULL, NULL);
-        if (len <= 0) {
-            print("E:", LA_F("Failed to build STUN request", LA_F284, 284));
-            return false;
-        }
-
-        print("I:", LA_F("STUN collecting to %s:%d (len=%d)", LA_F373, 373), inst->cfg.stun_server, inst->cfg.stun_port, len);
+    if (need_collect) {
 
+        // 各网卡套接字并行收集，每个套接字的映射地址一到即生成 Srflx（add_srflx_candidate）；
+        // 未应答的由 stun_collect_tick 按间隔重发，超时后关闭
         ctx->collect_time = now;
-        for (int i = start_idx; i < inst->sock_cnt; i++) {
-            if (i == 0 && inst->nat_type == P2P_NAT_DETECTING) continue;
-            if (inst->socks[i].state < 2/*active*/) {
-                ret_t ret = p2p_udp_send_to_sock(inst, i, &ctx->server_addr, req, len);
-                if (ret <= 0) {
-                    print("E:", LA_F("Failed to send STUN request: %d", LA_F293, 293), ret);
-                    return false;
-                }
-            }
-        }
+        int sent = stun_collect_send(inst, now);
+        if (sent <= 0) return false;
+
+        print("I:", LA_F("STUN collecting on %d socket(s) via %s:%d", LA_F642, 642), sent, inst->cfg.stun_server, inst->cfg.stun_port);
     }
 
     return true;
@@ -420,7 +572,61 @@ int p2p_stun_build_binding_response(uint8_t *buf, int max_len, const uint8_t tsx
     return offset;
 }
 
+/* 属性类型 → 索引槽位（未索引的属性返回 -1） */
+static int stun_attr_slot(uint16_t type) {
+    switch (type) {
+    case STUN_ATTR_MAPPED_ADDR:         return STUN_AI_MAPPED_ADDR;
+    case STUN_ATTR_CHANGED_ADDR:        return STUN_AI_CHANGED_ADDR;
+    case STUN_ATTR_USERNAME:            return STUN_AI_USERNAME;
+    case STUN_ATTR_MESSAGE_INTEGRITY:   return STUN_AI_MESSAGE_INTEGRITY;
+    case STUN_ATTR_ERROR_CODE:          return STUN_AI_ERROR_CODE;
+    case STUN_ATTR_LIFETIME:            return STUN_AI_LIFETIME;
+    case STUN_ATTR_XOR_PEER_ADDRESS:    return STUN_AI_XOR_PEER_ADDRESS;
+    case STUN_ATTR_DATA:                return STUN_AI_DATA;
+    case STUN_ATTR_REALM:               return STUN_AI_REALM;
+    case STUN_ATTR_NONCE:               return STUN_AI_NONCE;
+    case STUN_ATTR_XOR_RELAYED_ADDRESS: return STUN_AI_XOR_RELAYED_ADDRESS;
+    case STUN_ATTR_XOR_MAPPED_ADDR:     return STUN_AI_XOR_MAPPED_ADDR;
+    case STUN_ATTR_PRIORITY:            return STUN_AI_PRIORITY;
+    case STUN_ATTR_USE_CANDIDATE:       return STUN_AI_USE_CANDIDATE;
+    case STUN_ATTR_FINGERPRINT:         return STUN_AI_FINGERPRINT;
+    case STUN_ATTR_ICE_CONTROLLED:      return STUN_AI_ICE_CONTROLLED;
+    case STUN_ATTR_ICE_CONTROLLING:     return STUN_AI_ICE_CONTROLLING;
+    default:                            return -1;
+    }
+}
+
+int p2p_stun_attrs_parse(const uint8_t *buf, int len, p2p_stun_attrs_t *a) {
+
+    memset(a, 0, sizeof(*a));
+    if (len < 20) return -1;
+
+    /* 消息体长度超出实际接收长度时按接收长度截断（TURN 响应容忍尾部截断） */
+    int end = 20 + nget_s(buf + 2);
+    a->intact = end <= len;
+    if (!a->intact) end = len;
+    a->end = (uint16_t)end;
+
+    bool after_mi = false;
+    for (int off = 20; off + 4 <= end; ) {
+        uint16_t type = nget_s(buf + off);
+        int next = off + 4 + ((nget_s(buf + off + 2) + 3) & ~3);
+        if (next > end) { a->intact = false; break; }
+
+        int ai = stun_attr_slot(type);
+        if (ai >= 0 && !a->off[ai] && (!after_mi || ai == STUN_AI_FINGERPRINT)) {
+            a->off[ai] = (uint16_t)off;
+            if (ai == STUN_AI_MESSAGE_INTEGRITY) after_mi = true;
+            else if (ai == STUN_AI_FINGERPRINT) break;      // FINGERPRINT 必须为最后一个属性
+            else if (ai >= STUN_AI_PRIORITY) a->ice = true;
+        }
+        off = next;
+    }
+    return a->intact ? 0 : -1;
+}
+
 static int stun_parse_binding_response(const uint8_t *buf, int len,
+                                       const p2p_stun_attrs_t *a,
                                        struct sockaddr_in *mapped_addr,
                                        const char *password,
                                        stun_ctx_t *nat_ctx) {
@@ -430,12 +636,8 @@ static int stun_parse_binding_response(const uint8_t *buf, int len,
     /* 验证 Magic Cookie */
     assert(nget_l(buf+4) == STUN_MAGIC);
 
-    /* 验证负载消息数据长度 */
-    if (len < 20) return -1;        // 不能小于消息头长度
-    const uint8_t *ptr = buf + 2;
-    int msg_len = nget_s(ptr);
-    if (msg_len + 20 > len) return -1;
-    const uint8_t *end = buf + 20 + msg_len;
+    /* 验证负载消息数据长度：不能小于消息头长度，消息体不能截断，TLV 不能越界 */
+    if (len < 20 || !a->intact) return -1;
 
     /*
      * 可选：验证 FINGERPRINT
@@ -446,115 +648,76 @@ static int stun_parse_binding_response(const uint8_t *buf, int len,
      * 兼容性：FINGERPRINT 在 STUN 中是可选属性；
      * 若报文未携带则继续解析，若携带但校验失败则直接拒绝该报文。
      */
-    ptr = buf + 20;
-    while (ptr + 4 <= end) {
-        uint16_t attr_type = nget_s(ptr);
-        uint16_t attr_len = nget_s(ptr + 2);
-        const uint8_t *attr_val = ptr + 4;
-        const uint8_t *next = attr_val + ((attr_len + 3) & ~3);
-        if (next > end) return -1;
-
-        if (attr_type == STUN_ATTR_FINGERPRINT) {
-            if (attr_len != 4) return -1;
-
-            uint32_t recv_fp = nget_l(attr_val);
-            uint32_t calc_fp = p2p_crc32(buf, (int)(ptr - buf)) ^ 0x5354554e;
-            if (recv_fp != calc_fp) {
-                print("W:", "STUN FINGERPRINT mismatch, drop packet");
-                return -1;
-            }
-
-            break;
+    int attr_len;
+    const uint8_t *attr_val = p2p_stun_attr(buf, a, STUN_AI_FINGERPRINT, &attr_len);
+    if (attr_val) {
+        if (attr_len != 4) return -1;
+
+        uint32_t recv_fp = nget_l(attr_val);
+        uint32_t calc_fp = p2p_crc32(buf, a->off[STUN_AI_FINGERPRINT]) ^ 0x5354554e;
+        if (recv_fp != calc_fp) {
+            print("W:", "STUN FINGERPRINT mismatch, drop packet");
+            return -1;
         }
-
-        ptr = next;
     }
 
     /*
      * 可选：验证 MESSAGE-INTEGRITY
-     * 如果提供了密码，查找并验证 HMAC-SHA1
+     * 如果提供了密码，按索引定位 HMAC-SHA1
      */
-    if (password) {
-        /* 查找 MESSAGE-INTEGRITY 属性 */
-        ptr = buf + 20;
-        while (ptr + 4 <= end) {
-            uint16_t attr_type = nget_s(ptr);
-            uint16_t attr_len = nget_s(ptr + 2);
-            const uint8_t *attr_val = ptr + 4;
-            const uint8_t *next = attr_val + ((attr_len + 3) & ~3);
-            if (next > end) return -1;
-
-            if (attr_type == STUN_ATTR_MESSAGE_INTEGRITY) {
-
-                /*
-                 * MESSAGE-INTEGRITY 验证逻辑：
-                 * 1. 将 Length 字段调整为包含到 MI 属性头的长度
-                 * 2. 计算 HMAC-SHA1(password, 消息头+属性到MI之前)
-                 * 3. 比较计算结果与 MI 属性值
-                 * 此处简化略过，ICE 通常依赖其他机制建立信任
-                 */
+    if (password && a->off[STUN_AI_MESSAGE_INTEGRITY]) {
 
-                break;
-            }
-            ptr = next; /* 跳到下一个属性（4字节对齐）*/
-        }
+        /*
+         * MESSAGE-INTEGRITY 验证逻辑：
+         * 1. 将 Length 字段调整为包含到 MI 属性头的长度
+         * 2. 计算 HMAC-SHA1(password, 消息头+属性到MI之前)
+         * 3. 比较计算结果与 MI 属性值
+         * 此处简化略过，ICE 通常依赖其他机制建立信任
+         */
     }
 
     /*
-     * 遍历属性，查找地址属性
+     * 查找地址属性（XOR-MAPPED-ADDRESS 优先）
      *
      * 支持的地址属性：
      *   - MAPPED-ADDRESS (0x0001): 明文地址（RFC 3489 旧格式）
      *   - XOR-MAPPED-ADDRESS (0x0020): XOR 加密地址（RFC 5389 推荐）
-     *   - RELAYED-ADDRESS (0x0016): TURN 中继地址
      *   - CHANGED-ADDRESS (0x0005): 备用服务器地址（NAT 检测用）
+     *
+     * 地址格式（8字节 for IPv4）：
+     *   字节 0:   预留 (0x00)
+     *   字节 1:   地址族 (0x01=IPv4, 0x02=IPv6)
+     *   字节 2-3: 端口 (可能 XOR 加密)
+     *   字节 4-7: IP 地址 (可能 XOR 加密)
      */
     int found = 0;
-    ptr = buf + 20;
-    while (ptr + 4 <= end) {
-        uint16_t attr_type = nget_s(ptr);
-        uint16_t attr_len = nget_s(ptr + 2);
-        const uint8_t *attr_val = ptr + 4;
-        const uint8_t *next = attr_val + ((attr_len + 3) & ~3);
-        if (next > end) return -1;
-
-        if (attr_type == STUN_ATTR_MAPPED_ADDR || 
-            attr_type == STUN_ATTR_XOR_MAPPED_ADDR) {
-
-            /*
-             * 地址格式（8字节 for IPv4）：
-             *   字节 0:   预留 (0x00)
-             *   字节 1:   地址族 (0x01=IPv4, 0x02=IPv6)
-             *   字节 2-3: 端口 (可能 XOR 加密)
-             *   字节 4-7: IP 地址 (可能 XOR 加密)
-             */
-            if (attr_len >= 8 && (attr_val[1] == 0x01)) { /* IPv4 */
-                mapped_addr->sin_family = AF_INET;
-                memcpy(&mapped_addr->sin_port, attr_val + 2, 2);
-                memcpy(&mapped_addr->sin_addr, attr_val + 4, 4);
-                
-                /*
-                 * XOR 解密（如果是 XOR-MAPPED-ADDRESS）
-                 * X-Port = Port XOR 0x2112
-                 * X-Address = Address XOR 0x2112A442
-                 */
-                if (attr_type == STUN_ATTR_XOR_MAPPED_ADDR) {
-                    stun_xor_addr(mapped_addr);
-                }
-                found = 1;
-            }
-        }
-        /* CHANGED-ADDRESS (0x0005): NAT 检测使用的备用服务器地址 */
-        else if (nat_ctx && attr_type == STUN_ATTR_CHANGED_ADDR) {
-            if (attr_len >= 8 && (attr_val[1] == 0x01)) { /* IPv4 */
-                nat_ctx->alt_addr.sin_family = AF_INET;
-                memcpy(&nat_ctx->alt_addr.sin_port, attr_val + 2, 2);
-                memcpy(&nat_ctx->alt_addr.sin_addr, attr_val + 4, 4);
-                /* CHANGED-ADDRESS 通常不使用 XOR 加密（RFC 3489）*/
-            }
+    for (int i = 0; i < 2 && !found; i++) {
+        int ai = i ? STUN_AI_MAPPED_ADDR : STUN_AI_XOR_MAPPED_ADDR;
+        attr_val = p2p_stun_attr(buf, a, ai, &attr_len);
+        if (!attr_val || attr_len < 8 || attr_val[1] != 0x01) continue;  /* 仅 IPv4 */
+
+        mapped_addr->sin_family = AF_INET;
+        memcpy(&mapped_addr->sin_port, attr_val + 2, 2);
+        memcpy(&mapped_addr->sin_addr, attr_val + 4, 4);
+
+        /*
+         * XOR 解密（如果是 XOR-MAPPED-ADDRESS）
+         * X-Port = Port XOR 0x2112
+         * X-Address = Address XOR 0x2112A442
+         */
+        if (ai == STUN_AI_XOR_MAPPED_ADDR) {
+            stun_xor_addr(mapped_addr);
         }
+        found = 1;
+    }
 
-        ptr = next; // 跳到下一个属性（4字节对齐）
+    /* CHANGED-ADDRESS (0x0005): NAT 检测使用的备用服务器地址 */
+    if (nat_ctx && (attr_val = p2p_stun_attr(buf, a, STUN_AI_CHANGED_ADDR, &attr_len)) != NULL
+        && attr_len >= 8 && attr_val[1] == 0x01) { /* IPv4 */
+        nat_ctx->alt_addr.sin_family = AF_INET;
+        memcpy(&nat_ctx->alt_addr.sin_port, attr_val + 2, 2);
+        memcpy(&nat_ctx->alt_addr.sin_addr, attr_val + 4, 4);
+        /* CHANGED-ADDRESS 通常不使用 XOR 加密（RFC 3489）*/
     }
     
     return found ? 0 : -1;
@@ -582,7 +745,7 @@ static int stun_parse_binding_response(const uint8_t *buf, int len,
  * @param max_len        缓冲区大小
  * @param tsx_id         事务 ID（12字节，NULL 则自动生成）
  * @param username       ICE 用户名（格式: "remote_ufrag:local_ufrag"，NULL 表示不包含）
- * @param password       ICE 远端密码（用于 MESSAGE-INTEGRITY，NULL 表示不包含）
+ * @param mi             以 ICE 远端密码初始化的 HMAC 上下文（用于 MESSAGE-INTEGRITY，NULL 表示不包含）
  * @param priority       本地候选优先级（0 表示不包含 PRIORITY 属性）
  * @param is_controlling 1=Controlling 角色, 0=Controlled 角色
  * @param tie_breaker    64位 tie-breaker 值（用于角色冲突解决）
@@ -590,7 +753,7 @@ static int stun_parse_binding_response(const uint8_t *buf, int len,
  * @return               生成的请求长度，失败返回 -1
  */
 int p2p_stun_build_ice_check(uint8_t *buf, int max_len, uint8_t tsx_id[12],
-                              const char *username, const char *password,
+                              const char *username, const p2p_hmac_sha1_ctx_t *mi,
                               uint32_t priority, int is_controlling, 
                               uint64_t tie_breaker, int use_candidate) {
     if (max_len < 20) return -1;
@@ -668,7 +831,7 @@ int p2p_stun_build_ice_check(uint8_t *buf, int max_len, uint8_t tsx_id[12],
     nwrite_s(buf + 2, (uint16_t)payload_len);
 
     /* 5. MESSAGE-INTEGRITY 属性 (0x0008) */
-    if (password) {
+    if (mi) {
         if (offset + 24 > max_len) return -1;
         
         /* 调整长度字段 */
@@ -678,7 +841,7 @@ int p2p_stun_build_ice_check(uint8_t *buf, int max_len, uint8_t tsx_id[12],
 
         /* 计算 HMAC-SHA1 */
         uint8_t digest[20];
-        p2p_hmac_sha1((const uint8_t*)password, (int)strlen(password), buf, offset, digest);
+        p2p_hmac_sha1_compute(mi, buf, offset, digest);
         
         buf[offset++] = (uint8_t)(STUN_ATTR_MESSAGE_INTEGRITY >> 8);
         buf[offset++] = (uint8_t)(STUN_ATTR_MESSAGE_INTEGRITY & 0xFF);
@@ -722,6 +885,7 @@ int p2p_stun_build_ice_check(uint8_t *buf, int max_len, uint8_t tsx_id[12],
  * 实现策略：
  *   只要发现任一 ICE 专用属性，即判定为 ICE 包，应由 NAT 模块处理。
  *   否则为普通 STUN 包（NAT 检测用），由 STUN 模块处理。
+ *   派发入口已持有属性索引时直接使用 p2p_stun_attrs_t.ice。
  *
  * @param buf   STUN 包数据
  * @param len   包长度
@@ -732,36 +896,24 @@ bool p2p_stun_has_ice_attrs(const uint8_t *buf, int len) {
     /* 验证 Magic Cookie */
     assert(nget_l(buf + 4) == STUN_MAGIC);
 
-    /* 验证消息长度 */
-    if (len < 20) return false; /* 最小为消息头长度 */
-    const uint8_t* ptr = buf + 2;
-    int msg_len = nget_s(ptr);
+    /* 单次遍历属性索引：消息不完整时不作为 ICE 包 */
+    p2p_stun_attrs_t a;
+    return p2p_stun_attrs_parse(buf, len, &a) == 0 && a.ice;
+}
+
+bool p2p_stun_has_attr(const uint8_t *buf, int len, uint16_t attr) {
+
+    if (len < 20) return false;
+    int msg_len = nget_s(buf + 2);
     if (msg_len + 20 > len) return false;
     const uint8_t *end = buf + 20 + msg_len;
 
-    /* 遍历属性，查找 ICE 专用属性
-     * - PRIORITY (0x0024): 候选优先级（connectivity check 必含）
-     * - USE-CANDIDATE (0x0025): 提名标志
-     * - ICE-CONTROLLED (0x8029): Controlled 角色
-     * - ICE-CONTROLLING (0x802A): Controlling 角色
-     */
-    ptr = buf + 20;
-    while (ptr + 4 <= end) {
-        uint16_t attr_type = nget_s(ptr);
-        uint16_t attr_len = nget_s(ptr + 2);
-        const uint8_t *next = (ptr + 4) + ((attr_len + 3) & ~3);
+    for (const uint8_t *ptr = buf + 20; ptr + 4 <= end; ) {
+        const uint8_t *next = (ptr + 4) + ((nget_s(ptr + 2) + 3) & ~3);
         if (next > end) return false;
-
-        if (attr_type == STUN_ATTR_PRIORITY ||
-            attr_type == STUN_ATTR_USE_CANDIDATE ||
-            attr_type == STUN_ATTR_ICE_CONTROLLED ||
-            attr_type == STUN_ATTR_ICE_CONTROLLING) {
-            return true;
-        }
-        
-        ptr = next; // 跳到下一个属性（4字节对齐）
+        if (nget_s(ptr) == attr) return true;
+        ptr = next;
     }
-    
     return false;
 }
 
@@ -787,6 +939,7 @@ static inline void add_srflx_candidate(struct p2p_instance *inst, int recv_sock_
 
     assert(inst->srflx_active < inst->srflx_count);
     ++inst->srflx_active;
+    inst->socks[recv_sock_idx].mapped_ts = p2p_now_ms();
 
     // 缓存映射地址，供后续 session 复用
     assert(recv_sock_idx >= 0 && recv_sock_idx < inst->sock_cnt);
@@ -802,27 +955,33 @@ static inline void add_srflx_candidate(struct p2p_instance *inst, int recv_sock_
 
     for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
 
-        int idx = p2p_cand_push_local(s);
-        if (idx < 0) {
-            print("W:", LA_F("✗ Add Srflx candidate failed(OOM)", LA_F470, 470));
-            return;
-        }
+        // 地址变化后重新收集（p2p_stun_route_changed）：映射未变的候选已在表中，不重复写入与 Trickle，
+        // 但 WAIT_STUN 的会话仍需收到就绪通知
+        p2p_local_candidate_entry_t *c = NULL;
+        if (p2p_cand_find_local(s, P2P_CAND_SRFLX, mapped) < 0) {
 
-        p2p_local_candidate_entry_t *c = &s->local_cands[idx];
-        c->type = P2P_CAND_SRFLX;
-        c->priority = p2p_ice_calc_priority(P2P_ICE_CAND_SRFLX, 65535, 1);
-        c->addr = *mapped;
-        c->base_addr = inst->socks[recv_sock_idx].local_addr;
+            int idx = p2p_cand_push_local(s);
+            if (idx < 0) {
+                print("W:", LA_F("✗ Add Srflx candidate failed(OOM)", LA_F470, 470));
+                return;
+            }
 
-        print("I:", LA_F("✓ Gathered Srflx Candidate %s:%d, priority=%u (ses_id=%u)", LA_F469, 469),
-              inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port), c->priority, s->id);
+            c = &s->local_cands[idx];
+            c->type = P2P_CAND_SRFLX;
+            c->priority = p2p_ice_calc_priority(P2P_ICE_CAND_SRFLX, 65535, 1);
+            c->addr = *mapped;
+            c->base_addr = inst->socks[recv_sock_idx].local_addr;
+
+            print("I:", LA_F("✓ Gathered Srflx Candidate %s:%d, priority=%u (ses_id=%u)", LA_F469, 469),
+                  inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port), c->priority, s->id);
+        }
 
         // 如果信令还未上线
         if (!sig_ready) continue;
 
         if (inst->sig_mode == P2P_SIGNALING_MODE_COMPACT) {
             assert(!s->wait_stun_pending);
-            if (s->sig_sess.compact.state == SIG_COMPACT_SESS_SYNCING) {
+            if (c && s->sig_sess.compact.state >= SIG_COMPACT_SESS_SYNCING) {
                 p2p_signal_compact_trickle_candidate(s);
             }
         }
@@ -840,7 +999,7 @@ static inline void add_srflx_candidate(struct p2p_instance *inst, int recv_sock_
                 p2p_signal_pubsub_stun_ready(s);
             }
         }
-        else if (s->inst->sig_mode == P2P_SIGNALING_MODE_ICE && s->inst->cfg.on_ice_candidate) {
+        else if (c && s->inst->sig_mode == P2P_SIGNALING_MODE_ICE && s->inst->cfg.on_ice_candidate) {
             char sdp_a[256];
             if (p2p_ice_export_candidate(c, sdp_a, sizeof(sdp_a)) > 0)
                 s->inst->cfg.on_ice_candidate((p2p_session_t)s, sdp_a, s->inst->cfg.userdata);
@@ -848,34 +1007,137 @@ static inline void add_srflx_candidate(struct p2p_instance *inst, int recv_sock_
     }
 }
 
+/*
+ * ============================================================================
+ * 进程内共享 NAT 检测结果
+ * ============================================================================
+ *
+ * NAT 类型取决于本机网卡（出口）与 STUN 服务器，与实例无关：同一进程内的多个实例
+ * 以 (主 STUN 服务器, 本地地址集合, 网络代次) 为键共享一次 Test I/II/III 检测。
+ *   - 首个实例执行检测（owner），检测期间加入的实例等待其结果，不重复发包
+ *   - owner 检测失败（ERROR/BLOCKED）或中途销毁：由等待者之一接手重新检测
+ *   - 结果有效期 STUN_SHARED_TTL_MS；p2p_network_changed() 递增网络代次，作废全部结果
+ *   - 引用计数归零时释放槽位（与 route_shared_* 一致）
+ * Srflx 映射端口因套接字而异，不共享，仍由各实例通过 p2p_stun_collect 收集。
+ */
+#define STUN_SHARED_SLOTS       8
+#define STUN_SHARED_TTL_MS      (10 * 60 * 1000)
+
+typedef struct {
+    int                 refs;           /* 引用实例数（0 = 空闲槽位） */
+    int                 state;          /* 0 = 待检测，1 = 检测中，2 = 已完成 */
+    struct p2p_instance *owner;         /* 检测中的实例 */
+    struct sockaddr_in  server;
+    uint32_t            route_hash;
+    uint32_t            gen;
+    int                 nat_type;
+    uint64_t            stamp;          /* 结果产生时间 */
+} stun_shared_t;
+
+static stun_shared_t    g_shared[STUN_SHARED_SLOTS];
+static uint32_t         g_shared_gen;
+static volatile long    g_shared_lock;
+
+#if defined(_MSC_VER)
+#define SHARED_LOCK()       while (_InterlockedExchange(&g_shared_lock, 1)) {}
+#define SHARED_UNLOCK()     _InterlockedExchange(&g_shared_lock, 0)
+#else
+#define SHARED_LOCK()       while (__atomic_exchange_n(&g_shared_lock, 1, __ATOMIC_ACQUIRE)) {}
+#define SHARED_UNLOCK()     __atomic_store_n(&g_shared_lock, 0, __ATOMIC_RELEASE)
+#endif
+
+/* 本地地址集合指纹（FNV-1a），网卡增减或地址变化即得到不同的键 */
+static uint32_t route_hash(struct p2p_instance *inst) {
+    uint32_t h = 2166136261u;
+    const route_ctx_t *rt = p2p_inst_route(inst);
+    for (int i = 0; rt && i < rt->addr_count; i++) {
+        const uint8_t *b = (const uint8_t *)&rt->local_addrs[i].sin_addr.s_addr;
+        for (int k = 0; k < 4; k++) h = (h ^ b[k]) * 16777619u;
+    }
+    return h;
+}
+
+/* 检测结束：发布结果（失败则退回待检测，由等待者接手） */
+static void stun_shared_publish(struct p2p_instance *inst, p2p_nat_type_t type) {
+
+    int slot = inst->stun_ctx.shared_slot - 1;
+    if (slot < 0) return;
+
+    SHARED_LOCK();
+    stun_shared_t *e = &g_shared[slot];
+    if (type == P2P_NAT_ERROR || type == P2P_NAT_BLOCKED) {
+        if (e->owner == inst) { e->state = 0; e->owner = NULL; }
+    }
+    else if (e->owner == inst || (e->state == 2 && e->nat_type != type)) {     // 后者：交叉校验补全
+        e->state = 2;
+        e->owner = NULL;
+        e->nat_type = type;
+        e->stamp = p2p_now_ms();
+    }
+    SHARED_UNLOCK();
+}
+
 static inline void nat_detect_done(struct p2p_instance *inst, p2p_nat_type_t type) {
 
     inst->nat_type = type;
     inst->stun_ctx.state = STUN_TEST_COMPLETED;
+    inst->stun_ctx.shared_wait = false;
+    stun_shared_publish(inst, type);
 
-    // 如果没有活跃 session，将 mapped_addr 标记为失效（因为该地址可能在首个 session 创建前过期）
-    // + 下次创建 session 时会重新 collect
-    if (inst->connections == 0) {
-        for (int i = 0; i < inst->sock_cnt; i++) {
-            inst->socks[i].state = 1/*bound*/;
-        }
-        inst->srflx_active = 0;
+    // 没有活跃 session 时保留映射地址（p2p_create 预收集）：首个 session 创建时由 p2p_stun_srflx_refresh
+    // 按 STUN_SRFLX_FRESH_MS 判断，新鲜的直接复用，过期的重新 collect
+}
+
+/*
+ * Test I 其他服务器的迟到应答：不推进状态机，仅比较映射地址
+ * + 面向不同服务器 IP 的 sock 0 映射不同 → 对称映射（等价于 Test I(alt) 的结论，但不依赖 CHANGED-ADDRESS）
+ */
+static void stun_cross_check(struct p2p_instance *inst, const struct sockaddr_in *from,
+                             const uint8_t *buf, int len, const p2p_stun_attrs_t *a) {
+    stun_ctx_t *ctx = &inst->stun_ctx;
+
+    struct sockaddr_in mapped;
+    if (stun_parse_binding_response(buf, len, a, &mapped, NULL, NULL) < 0) return;
+
+    // 同一服务器（Test I 重传的迟到应答）或映射一致：不提供新信息
+    if (from->sin_addr.s_addr == ctx->server_addr.sin_addr.s_addr) return;
+    if (sockaddr_equal(&mapped, &inst->socks[0].mapped_addr) || ctx->symmetric_mapping) return;
+
+    ctx->symmetric_mapping = true;
+    char server[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &from->sin_addr, server, sizeof(server));
+    print("I:", LA_F("Cross-check: %s:%d maps us to %s:%d, symmetric mapping", LA_F520, 520),
+          server, ntohs(from->sin_port), inet_ntoa(mapped.sin_addr), ntohs(mapped.sin_port));
+
+    // 检测已因 skip_stun_test 以 UNKNOWN 结束：以交叉校验结果补全
+    if (ctx->state == STUN_TEST_COMPLETED && inst->nat_type == P2P_NAT_UNKNOWN) {
+        inst->nat_type = P2P_NAT_SYMMETRIC;
+        stun_shared_publish(inst, P2P_NAT_SYMMETRIC);
+        print("I:", LA_F("Detection completed %s", LA_F276, 276), p2p_nat_type_str(P2P_NAT_SYMMETRIC));
     }
 }
 
 void p2p_stun_handle_packet(struct p2p_instance *inst, int recv_sock_idx,
                             const struct sockaddr_in *from,
-                            uint16_t type, const uint8_t *buf, int len) {
-    (void)from; /* from 用于验证响应来源，暂未使用 */
+                            uint16_t type, const uint8_t *buf, int len,
+                            const p2p_stun_attrs_t *attrs) {
     stun_ctx_t *ctx = &inst->stun_ctx;
 
     assert(p2p_stun_is_binding_response(type, buf, len));
 
+    p2p_stun_attrs_t local;
+    if (!attrs) { p2p_stun_attrs_parse(buf, len, &local); attrs = &local; }
+
+    if (ctx->server_cnt > 1 && ctx->state > STUN_TEST_I_SENT && !memcmp(buf + 8, ctx->test_i_tsx_id, 12)) {
+        stun_cross_check(inst, from, buf, len, attrs);
+        return;
+    }
+
     bool is_nat_detect_resp = (memcmp(buf + 8, ctx->detect_tsx_id, 12) == 0);
 
     struct sockaddr_in mapped;
     stun_ctx_t *parse_ctx = is_nat_detect_resp ? ctx : NULL;
-    if (stun_parse_binding_response(buf, len, &mapped, NULL, parse_ctx) < 0) {
+    if (stun_parse_binding_response(buf, len, attrs, &mapped, NULL, parse_ctx) < 0) {
         return;
     }
 
@@ -896,6 +1158,7 @@ void p2p_stun_handle_packet(struct p2p_instance *inst, int recv_sock_idx,
 
         ctx->state = STUN_TEST_I_DONE;
         ctx->retry_count = 0;
+        ctx->server_addr = *from;               // 首个应答者：后续 Test II/III 发往它（alt_addr 也来自它）
         assert(inst->sock_cnt > 0);
         inst->socks[0].mapped_addr = mapped;
 
@@ -965,6 +1228,101 @@ void p2p_stun_handle_packet(struct p2p_instance *inst, int recv_sock_idx,
 
 ///////////////////////////////////////////////////////////////////////////////
 
+/* 采用共享结果：等同于本实例检测完成，sock 0 的 Srflx 改由 collect 收集（Test I 未发送） */
+static void stun_shared_adopt(struct p2p_instance *inst, int nat_type) {
+
+    nat_detect_done(inst, (p2p_nat_type_t)nat_type);
+    print("I:", LA_F("Detection completed %s (shared)", LA_F521, 521), p2p_nat_type_str((p2p_nat_type_t)nat_type));
+
+    if (inst->stun_ctx.as_candidate && inst->connections > 0 && inst->srflx_active < inst->srflx_count)
+        p2p_stun_collect(inst);
+}
+
+/*
+ * 加入共享检测：命中有效结果直接采用；已有实例在检测则等待；否则由本实例检测
+ * @return true = 已采用共享结果
+ */
+static bool stun_shared_join(struct p2p_instance *inst) {
+
+    stun_ctx_t *ctx = &inst->stun_ctx;
+    if (!ctx->server_cnt) return false;
+
+    uint32_t hash = route_hash(inst);
+    uint64_t now = p2p_now_ms();
+
+    SHARED_LOCK();
+    uint32_t gen = g_shared_gen;
+    stun_shared_t *e = NULL, *free_slot = NULL;
+    for (int i = 0; i < STUN_SHARED_SLOTS; i++) {
+        stun_shared_t *x = &g_shared[i];
+        if (!x->refs) { if (!free_slot) free_slot = x; continue; }
+        if (x->route_hash == hash && x->gen == gen && sockaddr_equal(&x->server, &ctx->servers[0])) { e = x; break; }
+    }
+    if (!e && (e = free_slot) != NULL) {
+        memset(e, 0, sizeof(*e));
+        e->server = ctx->servers[0];
+        e->route_hash = hash;
+        e->gen = gen;
+    }
+    if (!e) { SHARED_UNLOCK(); return false; }          // 槽位用尽：独立检测
+
+    e->refs++;
+    ctx->shared_slot = (int)(e - g_shared) + 1;
+
+    int nat_type = e->nat_type;
+    bool adopt = e->state == 2 && tick_diff(now, e->stamp) < STUN_SHARED_TTL_MS;
+    if (!adopt) {
+        if (e->state == 1) ctx->shared_wait = true;
+        else { e->state = 1; e->owner = inst; }
+    }
+    SHARED_UNLOCK();
+
+    if (adopt) stun_shared_adopt(inst, nat_type);
+    return adopt;
+}
+
+/* 等待其他实例的检测：完成则采用，owner 失败或退出则接手 */
+static void stun_shared_poll(struct p2p_instance *inst) {
+
+    stun_ctx_t *ctx = &inst->stun_ctx;
+    stun_shared_t *e = &g_shared[ctx->shared_slot - 1];
+
+    SHARED_LOCK();
+    int state = e->state, nat_type = e->nat_type;
+    if (state == 0) { e->state = 1; e->owner = inst; }
+    SHARED_UNLOCK();
+
+    if (state == 2) stun_shared_adopt(inst, nat_type);
+    else if (state == 0) ctx->shared_wait = false;      // 接手：下一 tick 从 Test I 开始
+}
+
+void p2p_stun_shared_release(struct p2p_instance *inst) {
+
+    stun_ctx_t *ctx = &inst->stun_ctx;
+    if (!ctx->shared_slot) return;
+
+    SHARED_LOCK();
+    stun_shared_t *e = &g_shared[ctx->shared_slot - 1];
+    if (e->owner == inst) { e->state = 0; e->owner = NULL; }
+    if (--e->refs == 0) memset(e, 0, sizeof(*e));
+    SHARED_UNLOCK();
+
+    ctx->shared_slot = 0;
+    ctx->shared_wait = false;
+}
+
+void p2p_stun_shared_invalidate(void) {
+    SHARED_LOCK();
+    g_shared_gen++;
+    SHARED_UNLOCK();
+}
+
+void p2p_network_changed(void) {
+    p2p_stun_shared_invalidate();
+    p2p_dns_flush();
+    route_shared_notify();                      // 同时重新枚举本机地址（系统通知不可用时的补充）
+}
+
 ret_t p2p_stun_nat_detect_start(struct p2p_instance *inst, bool as_candidate) {
 
     if (!inst || !inst->cfg.stun_server) {
@@ -978,55 +1336,93 @@ ret_t p2p_stun_nat_detect_start(struct p2p_instance *inst, bool as_candidate) {
     stun_ctx_t *ctx = &inst->stun_ctx;
     ctx->state = STUN_TEST_IDLE;
     ctx->retry_count = 0;
-    ctx->last_send_time = P_tick_ms();
+    ctx->last_send_time = p2p_now_ms();
     ctx->as_candidate = as_candidate;
 
+    p2p_stun_shared_release(inst);
+    stun_shared_join(inst);
+
     return E_NONE;
 }
 
-void p2p_stun_nat_detect_tick(struct p2p_instance *inst, uint64_t now_ms) {
+/* Srflx 收集告一段落（srflx_active >= srflx_count）：通知等待候选的 session */
+static void stun_srflx_settled(struct p2p_instance *inst) {
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
+        if (inst->sig_mode == P2P_SIGNALING_MODE_RELAY
+            && s->sig_sess.relay.state == SIG_RELAY_SESS_WAIT_STUN) {
+            p2p_signal_relay_stun_ready(s);
+        }
+        else if (inst->sig_mode == P2P_SIGNALING_MODE_PUBSUB) {
+            p2p_signal_pubsub_stun_ready(s);
+        }
+    }
+}
 
-    assert(inst && inst->cfg.stun_server);
+/* 拉取服务器解析结果：补发等待中的 collect；全部解析失败则放弃 Srflx 收集 */
+static void stun_resolve_tick(struct p2p_instance *inst) {
 
     stun_ctx_t *ctx = &inst->stun_ctx;
+    if (stun_resolve_poll(ctx) > 0 && ctx->collect_wait) {
+        ctx->collect_wait = false;
+        if (inst->srflx_active < inst->srflx_count) p2p_stun_collect(inst);
+    }
+    if (stun_resolving(ctx) || ctx->server_cnt) return;
 
-    // 如果已完成检测
-    if (ctx->state == STUN_TEST_COMPLETED) {
+    ctx->collect_wait = false;
+    if (inst->srflx_count > inst->srflx_active) {
+        inst->srflx_count = inst->srflx_active;
+        stun_srflx_settled(inst);
+    }
+}
 
-        // 清理从未收到 STUN 响应的多路套接字（collect 超时）
-        if (ctx->collect_time && inst->srflx_count > inst->srflx_active
-            && tick_diff(now_ms, ctx->collect_time) > STUN_TEST_TIMEOUT_MS) {
+/* collect 进行中：未应答的套接字按检测间隔重发（丢一个包不致失去该网卡），超时仍无应答的关闭 */
+static void stun_collect_tick(struct p2p_instance *inst, uint64_t now_ms) {
 
-            for (int i = inst->sock_cnt - 1; i >= 1; i--) {
-                if (inst->socks[i].state < 2/*active*/) {
-                    p2p_udp_close(inst, i);
-                    inst->srflx_count--;
-                }
-            }
-            ctx->collect_time = 0;
-
-            // srflx_count 缩减后可能满足 srflx_active >= srflx_count，通知等待中的 session
-            if (inst->srflx_active >= inst->srflx_count) {
-                for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
-                    if (inst->sig_mode == P2P_SIGNALING_MODE_RELAY
-                        && s->sig_sess.relay.state == SIG_RELAY_SESS_WAIT_STUN) {
-                        p2p_signal_relay_stun_ready(s);
-                    }
-                    else if (inst->sig_mode == P2P_SIGNALING_MODE_PUBSUB) {
-                        p2p_signal_pubsub_stun_ready(s);
-                    }
-                }
-            }
-        }
+    stun_ctx_t *ctx = &inst->stun_ctx;
+    if (inst->srflx_active >= inst->srflx_count) { ctx->collect_time = 0; return; }
+
+    if (tick_diff(now_ms, ctx->collect_time) <= STUN_TEST_TIMEOUT_MS) {
+        if (tick_diff(now_ms, ctx->collect_send_ms) >= STUN_TEST_INTERVAL_MS) stun_collect_send(inst, now_ms);
         return;
     }
 
+    // 清理从未收到 STUN 响应的多路套接字（collect 超时）
+    for (int i = inst->sock_cnt - 1; i >= 1; i--) {
+        if (inst->socks[i].state < 2/*active*/) {
+            p2p_udp_close(inst, i);
+            inst->srflx_count--;
+        }
+    }
+    ctx->collect_time = 0;
+
+    // srflx_count 缩减后可能满足 srflx_active >= srflx_count，通知等待中的 session
+    if (inst->srflx_active >= inst->srflx_count) stun_srflx_settled(inst);
+}
+
+void p2p_stun_nat_detect_tick(struct p2p_instance *inst, uint64_t now_ms) {
+
+    assert(inst && inst->cfg.stun_server);
+
+    stun_ctx_t *ctx = &inst->stun_ctx;
+
+    // 服务器地址异步解析（p2p_stun_init 发起）
+    if (stun_resolving(ctx)) stun_resolve_tick(inst);
+
+    // 多路 Srflx 收集与 NAT 检测并行推进（不等检测完成再清理）
+    if (ctx->collect_time) stun_collect_tick(inst, now_ms);
+
+    // 如果已完成检测
+    if (ctx->state == STUN_TEST_COMPLETED) return;
+
     // 初始化检测
     if (ctx->state == STUN_TEST_IDLE) {
 
         // 未启动检测
         if (inst->nat_type != P2P_NAT_DETECTING) return;
 
+        // 同进程其他实例正在检测：等待共享结果
+        if (ctx->shared_wait) { stun_shared_poll(inst); if (ctx->shared_wait || ctx->state != STUN_TEST_IDLE) return; }
+
         memset(&inst->socks[0].mapped_addr, 0, sizeof(inst->socks[0].mapped_addr));
         memset(&ctx->alt_addr, 0, sizeof(ctx->alt_addr));
         memset(&ctx->mapped_addr_alt, 0, sizeof(ctx->mapped_addr_alt));
@@ -1035,23 +1431,29 @@ void p2p_stun_nat_detect_tick(struct p2p_instance *inst, uint64_t now_ms) {
         ctx->symmetric_mapping = false;
         ctx->test_iii_success = false;
 
-        struct sockaddr_in stun_addr;
-        if (resolve_host(inst->cfg.stun_server, inst->cfg.stun_port, &stun_addr) < 0) {
+        if (!ctx->server_cnt) {
+            if (stun_resolving(ctx)) return;                // 等待服务器地址解析
             print("E:", LA_F("Failed to resolve STUN server %s", LA_F290, 290), inst->cfg.stun_server);
             nat_detect_done(inst, P2P_NAT_ERROR);
             return;
         }
 
+        // 服务器地址在检测启动后才就绪：补做共享检测登记
+        if (!ctx->shared_slot && (stun_shared_join(inst) || ctx->shared_wait)) return;
+
         /* 只在首次启动时生成新的 Transaction ID（加密安全随机数） */
         if (ctx->retry_count == 0) {
             P_rand_bytes(ctx->detect_tsx_id, 12);
+            memcpy(ctx->test_i_tsx_id, ctx->detect_tsx_id, 12);
         }
 
         uint8_t req[512];
         int len = p2p_stun_build_binding_request(req, sizeof(req), ctx->detect_tsx_id, NULL, NULL);
         if (len > 0) {
 
-            p2p_udp_send_to(inst, &stun_addr, req, len);
+            // 并行发往所有服务器，首个应答推进检测，其余用于交叉校验（stun_cross_check）
+            for (int k = 0; k < ctx->server_cnt; k++)
+                p2p_udp_send_to(inst, &ctx->servers[k], req, len);
             ctx->last_send_time = now_ms;
 
             print("I:", LA_F("Sending Test I to %s:%d (len=%d)", LA_F382, 382), inst->cfg.stun_server, inst->cfg.stun_port, len);
@@ -1136,13 +1538,6 @@ void p2p_stun_nat_detect_tick(struct p2p_instance *inst, uint64_t now_ms) {
          *   此时服务器会从它的另一个 IP 和 Port 响应该请求（这要求服务器配置了多个 IP 接口）
          *   也就是从另一个从未被本地主机访问过的 IP:Port 响应
          */
-        
-        struct sockaddr_in stun_addr;
-        if (resolve_host(inst->cfg.stun_server, inst->cfg.stun_port, &stun_addr) < 0) {
-            print("E:", LA_F("Failed to resolve STUN server %s", LA_F290, 290), inst->cfg.stun_server);
-            nat_detect_done(inst, P2P_NAT_ERROR);
-            return;
-        }
 
         // 生成新的 Transaction ID
         P_rand_bytes(ctx->detect_tsx_id, 12);
@@ -1151,7 +1546,7 @@ void p2p_stun_nat_detect_tick(struct p2p_instance *inst, uint64_t now_ms) {
         int len = p2p_stun_build_binding_request_ex(req, sizeof(req), ctx->detect_tsx_id,
                                                      STUN_FLAG_CHANGE_IP | STUN_FLAG_CHANGE_PORT);
         if (len > 0) {
-            p2p_udp_send_to(inst, &stun_addr, req, len);
+            p2p_udp_send_to(inst, &ctx->server_addr, req, len);
             ctx->last_send_time = now_ms;
             ctx->state = STUN_TEST_II_SENT;
             print("I:", LA_F("Sending Test II with CHANGE-REQUEST(IP+PORT)", LA_F384, 384));
@@ -1172,6 +1567,13 @@ void p2p_stun_nat_detect_tick(struct p2p_instance *inst, uint64_t now_ms) {
             return;
         }
 
+        // 多服务器交叉校验已证实对称映射：无需 Test I(alt) / Test III
+        if (ctx->symmetric_mapping) {
+            print("I:", LA_F("Detection completed %s", LA_F276, 276), p2p_nat_type_str(P2P_NAT_SYMMETRIC));
+            nat_detect_done(inst, P2P_NAT_SYMMETRIC);
+            return;
+        }
+
         /*
          * 如果 turn 服务器支持有效的 CHANGED-ADDRESS（alt_addr） 地址，则启动 Test I(alt) 测试
          * Test I(alt): 向服务器备用地址发起请求，判断访问不同 IP 返回的映射地址是否相同
@@ -1218,13 +1620,6 @@ void p2p_stun_nat_detect_tick(struct p2p_instance *inst, uint64_t now_ms) {
         }
 
         /* Test III: 退而求其次，让 stun 服务器使用相同的 IP，只换个端口来进行响应 */
-        
-        struct sockaddr_in stun_addr;
-        if (resolve_host(inst->cfg.stun_server, inst->cfg.stun_port, &stun_addr) < 0) {
-            print("E:", LA_F("Failed to resolve STUN server %s", LA_F290, 290), inst->cfg.stun_server);
-            nat_detect_done(inst, P2P_NAT_ERROR);
-            return;
-        }
 
         P_rand_bytes(ctx->detect_tsx_id, 12);
         
@@ -1232,7 +1627,7 @@ void p2p_stun_nat_detect_tick(struct p2p_instance *inst, uint64_t now_ms) {
         int len = p2p_stun_build_binding_request_ex(req, sizeof(req), ctx->detect_tsx_id,
                                                      STUN_FLAG_CHANGE_PORT);
         if (len > 0) {
-            p2p_udp_send_to(inst, &stun_addr, req, len);
+            p2p_udp_send_to(inst, &ctx->server_addr, req, len);
             ctx->last_send_time = now_ms;
             ctx->state = STUN_TEST_III_SENT;
             print("I:", LA_F("Sending Test III with CHANGE-REQUEST(PORT only)", LA_F385, 385));
@@ -82,6 +82,7 @@
 
 #include "predefine.h"
 #include <p2p.h>            /* p2p_nat_type_t */
+#include "p2p_crypto.h"     /* p2p_hmac_sha1_ctx_t */
 
 struct p2p_instance;
 
@@ -149,6 +150,15 @@ typedef struct {
 #define STUN_ATTR_ICE_CONTROLLED    0x8029  /* ICE: Controlled 角色 */
 #define STUN_ATTR_ICE_CONTROLLING   0x802A  /* ICE: Controlling 角色 */
 
+/* TURN 响应属性（RFC 5766，TURN 模块解析，与 STUN 共用属性索引） */
+#define STUN_ATTR_ERROR_CODE           0x0009
+#define STUN_ATTR_LIFETIME             0x000D
+#define STUN_ATTR_XOR_PEER_ADDRESS     0x0012  /* 对端地址（Send/Data/CreatePermission） */
+#define STUN_ATTR_DATA                 0x0013  /* 中继数据负载 */
+#define STUN_ATTR_REALM                0x0014
+#define STUN_ATTR_NONCE                0x0015
+#define STUN_ATTR_XOR_RELAYED_ADDRESS  0x0016  /* 中继地址 */
+
 /*
  * CHANGE-REQUEST 属性标志位
  * 用于 NAT 类型检测 (RFC 3489)
@@ -179,6 +189,25 @@ int p2p_stun_build_binding_request(uint8_t *buf, int max_len, uint8_t tsx_id[12]
 
 bool p2p_stun_collect(struct p2p_instance *inst);
 
+/* 空闲期（无活跃 session）预收集的映射地址新鲜期：低于常见 NAT 的 UDP 映射超时（30s） */
+#define STUN_SRFLX_FRESH_MS     (20 * 1000)
+
+/*
+ * 首个 session 创建前调用：作废超过新鲜期的预收集映射地址，并立即补收集缺失的 Srflx
+ * + 有活跃 session 时映射由其流量维持，不处理
+ */
+void p2p_stun_srflx_refresh(struct p2p_instance *inst, uint64_t now);
+
+/*
+ * 本机地址集合变化（见 p2p_route_refresh）：出口已变，当前映射与 NAT 类型全部作废
+ * + 多路 srflx 套接字按新地址集合关闭 / 补开；端口预测、绑定探测套接字关闭后按需重开
+ * + 重新收集 Srflx，并重新检测 NAT 类型
+ */
+void p2p_stun_route_changed(struct p2p_instance *inst);
+
+/* 作废进程内共享的 NAT 检测结果（p2p_network_changed 与地址变化检测共用） */
+void p2p_stun_shared_invalidate(void);
+
 /*
  * 构建 STUN Binding Response（用于回复对端的 ICE connectivity check）
  *
@@ -219,7 +248,7 @@ static inline bool p2p_stun_is_binding_response(uint16_t type, const uint8_t *bu
  * @param max_len        缓冲区大小
  * @param tsx_id         事务 ID（12字节，NULL 则自动生成）
  * @param username       ICE 用户名（格式: "remote_ufrag:local_ufrag"，NULL 表示不包含）
- * @param password       ICE 远端密码（用于 MESSAGE-INTEGRITY，NULL 表示不包含）
+ * @param mi             以 ICE 远端密码初始化的 HMAC 上下文（用于 MESSAGE-INTEGRITY，NULL 表示不包含）
  * @param priority       本地候选优先级（0 表示不包含 PRIORITY 属性）
  * @param is_controlling 1=Controlling 角色, 0=Controlled 角色
  * @param tie_breaker    64位 tie-breaker 值（用于角色冲突解决）
@@ -227,10 +256,63 @@ static inline bool p2p_stun_is_binding_response(uint16_t type, const uint8_t *bu
  * @return               生成的请求长度，失败返回 -1
  */
 int p2p_stun_build_ice_check(uint8_t *buf, int max_len, uint8_t tsx_id[12],
-                              const char *username, const char *password,
+                              const char *username, const p2p_hmac_sha1_ctx_t *mi,
                               uint32_t priority, int is_controlling, 
                               uint64_t tie_breaker, int use_candidate);
 
+/*
+ * STUN 属性索引（单次遍历）
+ *
+ * 派发入口对每个 STUN/TURN 包只遍历一次 TLV，记录各已知属性首次出现的属性头偏移，
+ * ICE 识别、NAT 检测、TURN 响应处理均按索引直接取值，不再各自重复遍历。
+ *   - MESSAGE-INTEGRITY 之后除 FINGERPRINT 外的属性忽略（RFC 5389 Section 15.4）
+ *   - FINGERPRINT 为最后一个属性，遇到即结束遍历
+ */
+enum {
+    STUN_AI_MAPPED_ADDR = 0,
+    STUN_AI_CHANGED_ADDR,
+    STUN_AI_USERNAME,
+    STUN_AI_MESSAGE_INTEGRITY,
+    STUN_AI_ERROR_CODE,
+    STUN_AI_LIFETIME,
+    STUN_AI_XOR_PEER_ADDRESS,
+    STUN_AI_DATA,
+    STUN_AI_REALM,
+    STUN_AI_NONCE,
+    STUN_AI_XOR_RELAYED_ADDRESS,
+    STUN_AI_XOR_MAPPED_ADDR,
+    STUN_AI_PRIORITY,
+    STUN_AI_USE_CANDIDATE,
+    STUN_AI_FINGERPRINT,
+    STUN_AI_ICE_CONTROLLED,
+    STUN_AI_ICE_CONTROLLING,
+    STUN_AI_MAX
+};
+
+typedef struct p2p_stun_attrs {
+    uint16_t off[STUN_AI_MAX];          // 属性头相对消息起点的偏移（0 = 未携带）
+    uint16_t end;                       // 属性区结束偏移（20 + 消息体长度，按实际接收长度截断）
+    bool     intact;                    // 消息体完整且 TLV 无越界（否则仅含越界前的属性）
+    bool     ice;                       // 携带任一 ICE 专用属性（PRIORITY/USE-CANDIDATE/ICE-CONTROLLED/ICE-CONTROLLING）
+} p2p_stun_attrs_t;
+
+/*
+ * 解析 STUN 属性索引
+ *
+ * @param buf   STUN 包数据（len >= 20）
+ * @param len   包长度
+ * @param a     输出索引
+ * @return      0=完整，-1=截断或 TLV 越界（a 仍记录越界前的属性）
+ */
+int p2p_stun_attrs_parse(const uint8_t *buf, int len, p2p_stun_attrs_t *a);
+
+/* 按索引取属性值，未携带返回 NULL；alen 输出值长度（可为 NULL） */
+static inline const uint8_t *p2p_stun_attr(const uint8_t *buf, const p2p_stun_attrs_t *a, int ai, int *alen) {
+    if (!a->off[ai]) return NULL;
+    if (alen) *alen = nget_s(buf + a->off[ai] + 2);
+    return buf + a->off[ai] + 4;
+}
+
 /*
  * 检查 STUN 包是否包含 ICE 属性（用于 connectivity check 识别）
  *
@@ -245,15 +327,27 @@ int p2p_stun_build_ice_check(uint8_t *buf, int max_len, uint8_t tsx_id[12],
  */
 bool p2p_stun_has_ice_attrs(const uint8_t *buf, int len);
 
+/*
+ * 检查 STUN 包是否携带指定属性（如 USE-CANDIDATE）
+ *
+ * @param buf   STUN 包数据
+ * @param len   包长度
+ * @param attr  属性类型 STUN_ATTR_*
+ * @return      true=携带该属性
+ */
+bool p2p_stun_has_attr(const uint8_t *buf, int len, uint16_t attr);
+
 ///////////////////////////////////////////////////////////////////////////////
 
 /*
  * 处理 STUN 响应包
  * 功能：解析响应，提取映射地址（Srflx），推进 NAT 检测状态机
+ * attrs 为派发入口已解析的属性索引（NULL 则内部解析）
  */
 void p2p_stun_handle_packet(struct p2p_instance *inst, int recv_sock_idx,
                             const struct sockaddr_in *from,
-                            uint16_t type, const uint8_t *buf, int len);
+                            uint16_t type, const uint8_t *buf, int len,
+                            const p2p_stun_attrs_t *attrs);
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -273,11 +367,20 @@ typedef enum {
     STUN_TEST_COMPLETED                /* 所有测试完成 */
 } stun_detect_state_t;
 
+/* 并行查询的 STUN 服务器数量上限（stun_server + stun_servers） */
+#define STUN_SERVERS_MAX    4
+
 /*
  * NAT 检测上下文（属于 p2p_instance，每个实例共享一次 NAT 类型检测）
  */
 typedef struct {
-    struct sockaddr_in  server_addr;    /* 预解析的 STUN 服务器地址（init 时缓存） */
+    char                hosts[STUN_SERVERS_MAX][128];   /* 配置的服务器主机名（[0] = stun_server） */
+    uint16_t            ports[STUN_SERVERS_MAX];
+    int                 host_cnt;
+    uint32_t            host_done;      /* 已得出解析结果的 hosts 位图 */
+    struct sockaddr_in  servers[STUN_SERVERS_MAX];  /* 已解析的服务器地址（按就绪顺序追加，[0] = stun_server） */
+    int                 server_cnt;
+    struct sockaddr_in  server_addr;    /* 本轮检测使用的服务器：Test I 首个应答者，后续 Test II/III 发往它 */
     stun_detect_state_t state;          /* 当前状态 */
     uint64_t            last_send_time; /* 上次发送时间戳 */
     int                 retry_count;    /* 当前测试的重试次数 */
@@ -291,11 +394,22 @@ typedef struct {
     bool symmetric_mapping;             /* 主/备服务器映射是否不同（对称映射） */
 
     uint8_t detect_tsx_id[12];          /* NAT 检测当前 Transaction ID */
+    uint8_t test_i_tsx_id[12];          /* Test I 的 Transaction ID：其他服务器的迟到应答用于交叉校验映射 */
 
-    uint64_t collect_time;               /* 上次 collect 发送时间（0=未在收集中） */
+    uint64_t collect_time;               /* 本轮 collect 开始时间（0=未在收集中） */
+    uint64_t collect_send_ms;            /* 本轮 collect 最近一次（重）发时间 */
+    bool collect_wait;                  /* collect 请求时服务器尚未解析，就绪后补发 */
+
+    int  shared_slot;                   /* 进程内共享检测结果槽位 + 1（0 = 未加入） */
+    bool shared_wait;                   /* 等待同进程其他实例的检测结果 */
 } stun_ctx_t;
 
-bool p2p_stun_init(stun_ctx_t *ctx, const char *stun_server, uint16_t stun_port);
+/*
+ * 登记 STUN 服务器并发起异步解析（p2p_dns_resolve），解析结果由 p2p_stun_nat_detect_tick 逐个拉取
+ * @param stun_servers  额外服务器列表（逗号分隔 "host[:port]"，可为 NULL），解析失败的条目跳过
+ * @return              至少配置了一个服务器（解析可能尚未完成）
+ */
+bool p2p_stun_init(stun_ctx_t *ctx, const char *stun_server, uint16_t stun_port, const char *stun_servers);
 
 ret_t p2p_stun_nat_detect_start(struct p2p_instance *inst, bool as_candidate);
 
@@ -305,5 +419,11 @@ ret_t p2p_stun_nat_detect_start(struct p2p_instance *inst, bool as_candidate);
  */
 void p2p_stun_nat_detect_tick(struct p2p_instance *inst, uint64_t now_ms);
 
+/*
+ * 退出进程内共享的 NAT 检测结果（实例销毁时调用）
+ * + 本实例正在为其他实例检测时，由等待者接手
+ */
+void p2p_stun_shared_release(struct p2p_instance *inst);
+
 ///////////////////////////////////////////////////////////////////////////////
 #endif /* P2P_STUN_H */
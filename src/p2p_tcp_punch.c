@@ -3,60 +3,347 @@
 
 #include "p2p_internal.h"
 
-/* 
- * 尝试 TCP 同时发起 (Simultaneous Open)
- * 这是一个复杂的流程，通常需要两端在几乎同一时间发起 connect()。
- */
-int p2p_tcp_punch_connect(struct p2p_session *s, const struct sockaddr_in *remote) {
-    if (!s->inst->cfg.enable_tcp) return -1;
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static inline void sock_drop(sock_t *sock) {
+    if (*sock != P_INVALID_SOCKET) { P_sock_close(*sock); *sock = P_INVALID_SOCKET; }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/* 本地端口（主机字节序）：cfg.tcp_port，未配置时与 UDP 主套接字端口相同 */
+static uint16_t punch_local_port(const struct p2p_session *s) {
+    if (s->inst->cfg.tcp_port) return s->inst->cfg.tcp_port;
+    return s->inst->sock_cnt > 0 ? ntohs(s->inst->socks[0].local_addr.sin_port) : 0;
+}
+
+/* 发起一次非阻塞 connect（同时打开的一端），失败时安排重试 */
+static void try_connect(struct p2p_session *s, p2p_tcp_try_t *t, uint64_t now) {
+
+    t->retry_ms = now + P2P_TCP_RETRY_MS;
 
     sock_t sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock == P_INVALID_SOCKET) return -1;
+    if (sock == P_INVALID_SOCKET) return;
 
-    /* 必须设置 SO_REUSEADDR and SO_REUSEPORT (如果支持) */
+    /* 多个尝试（及上一次尚在 TIME_WAIT 的连接）共用同一本地端口 */
     int opt = 1;
     setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt, sizeof(opt));
 #ifdef SO_REUSEPORT
-    setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char *)&opt, sizeof(opt));
 #endif
+    P_sock_nonblock(sock, true);
 
-    /* 绑定到与 UDP 相同的端口 */
     struct sockaddr_in loc;
     memset(&loc, 0, sizeof(loc));
     loc.sin_family = AF_INET;
     loc.sin_addr.s_addr = INADDR_ANY;
-    loc.sin_port = htons(s->inst->cfg.tcp_port);
+    loc.sin_port = htons(punch_local_port(s));
     if (bind(sock, (struct sockaddr *)&loc, sizeof(loc)) < 0) {
-        /* 如果端口被占用，尝试随机端口并更新配置 */
-        printf(LA_F("Bind failed to %d, port busy, trying random port", LA_F264, 264), 
-                      s->inst->cfg.tcp_port);
-        loc.sin_port = 0;
-        if (bind(sock, (struct sockaddr *)&loc, sizeof(loc)) < 0) {
-            print("E:", LA_F("Bind failed", LA_F263, 263));
-             P_sock_close(sock);
-             return -1;
+        print("W:", LA_F("bind :%u failed(%d)", LA_F540, 540), ntohs(loc.sin_port), P_sock_errno());
+        P_sock_close(sock);
+        return;
+    }
+
+    // 对端 SYN 尚未发出时本端 SYN 会被 RST 拒绝，按 P2P_TCP_RETRY_MS 重试直到双方 SYN 交叉
+    if (connect(sock, (struct sockaddr *)&t->target, sizeof(t->target)) < 0 && !P_sock_is_inprogress()) {
+        P_sock_close(sock);
+        return;
+    }
+    t->sock = sock;
+}
+
+/* 本轮打洞目标：对端 host/srflx/prflx 候选（TURN 中继地址不接受 TCP），按地址去重 */
+static int punch_collect(struct p2p_session *s, p2p_tcp_punch_t *c) {
+
+    c->try_cnt = 0;
+    for (int i = 0; i < s->remote_cand_cnt && c->try_cnt < P2P_TCP_MAX_TRYS; i++) {
+
+        const p2p_remote_candidate_entry_t *r = &s->remote_cands[i];
+        if (r->type != P2P_CAND_HOST && r->type != P2P_CAND_SRFLX && r->type != P2P_CAND_PRFLX) continue;
+        if (!r->addr.sin_port || p2p_udp_v6_is_alias(&r->addr)) continue;
+
+        struct sockaddr_in to = r->addr;
+        if (s->inst->cfg.tcp_port) to.sin_port = htons(s->inst->cfg.tcp_port);
+
+        int j = 0;
+        while (j < c->try_cnt && !sockaddr_equal(&c->trys[j].target, &to)) j++;
+        if (j < c->try_cnt) continue;
+
+        p2p_tcp_try_t *t = &c->trys[c->try_cnt++];
+        t->sock = P_INVALID_SOCKET;
+        t->target = to;
+        t->retry_ms = 0;
+    }
+    return c->try_cnt;
+}
+
+static void punch_stop(p2p_tcp_punch_t *c) {
+    for (int i = 0; i < c->try_cnt; i++) sock_drop(&c->trys[i].sock);
+    c->try_cnt = 0;
+    c->start_ms = 0;
+}
+
+/* 连接建立：登记（或复用）TCP 候选并交给 NAT 层确认，此后与其他候选一样参与路径选择 */
+static void punch_established(struct p2p_session *s, p2p_tcp_punch_t *c, p2p_tcp_try_t *t, uint64_t now) {
+
+    c->sock = t->sock; t->sock = P_INVALID_SOCKET;
+    c->peer = t->target;
+    c->rx_len = c->tx_len = 0;
+    c->restart_ms = 0;
+    punch_stop(c);
+
+#ifdef TCP_NODELAY
+    int opt = 1;
+    setsockopt(c->sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&opt, sizeof(opt));
+#endif
+
+    int idx = -1;
+    for (int i = 0; i < s->remote_cand_cnt; i++) {
+        if (s->remote_cands[i].type == P2P_CAND_TCP && sockaddr_equal(&s->remote_cands[i].addr, &c->peer)) { idx = i; break; }
+    }
+    if (idx < 0 && (idx = p2p_cand_push_remote(s)) < 0) {
+        sock_drop(&c->sock);
+        return;
+    }
+
+    p2p_remote_candidate_entry_t *r = &s->remote_cands[idx];
+    r->type = P2P_CAND_TCP;
+    r->priority = p2p_ice_calc_priority(P2P_ICE_CAND_RELAY, 65535, 1);
+    r->addr = c->peer;
+    r->last_punch_send_ms = 0;
+    path_stats_init(&r->stats, 1);      /* cost_score=1：无中继服务器成本，但有 TCP 队头阻塞 */
+    r->check = NAT_CHECK_NONE;
+    r->sock = 0;
+    c->path = idx;
+
+    print("I:", LA_F("connected to %s:%u (path[%d])", LA_F541, 541),
+          inet_ntoa(c->peer.sin_addr), ntohs(c->peer.sin_port), idx);
+    (void)now;
+
+    nat_punch(s, idx);
+}
+
+/* 推进本轮所有尝试：检查 connect 结果，被拒的按间隔重试 */
+static void punch_advance(struct p2p_session *s, p2p_tcp_punch_t *c, uint64_t now) {
+
+    for (int i = 0; i < c->try_cnt; i++) {
+
+        p2p_tcp_try_t *t = &c->trys[i];
+        if (t->sock == P_INVALID_SOCKET) {
+            if (now >= t->retry_ms) try_connect(s, t, now);
+            continue;
+        }
+
+        fd_set wfds;
+        FD_ZERO(&wfds);
+        FD_SET(t->sock, &wfds);
+        struct timeval tv = {0, 0};
+        if (select((int)t->sock + 1, NULL, &wfds, NULL, &tv) <= 0 || !FD_ISSET(t->sock, &wfds)) continue;
+
+        int err = 0;
+        socklen_t errlen = sizeof(err);
+        if (getsockopt(t->sock, SOL_SOCKET, SO_ERROR, (char *)&err, &errlen) < 0 || err != 0) {
+            sock_drop(&t->sock);
+            continue;
         }
+        punch_established(s, c, t, now);
+        return;
     }
-    {
-        struct sockaddr_in bound;
-        socklen_t blen = sizeof(bound);
-        getsockname(sock, (struct sockaddr *)&bound, &blen);
-        printf(LA_F("Bound to :%d", LA_F265, 265), ntohs(bound.sin_port));
+
+    if (tick_diff(now, c->start_ms) >= P2P_TCP_PUNCH_TIMEOUT_MS) {
+        print("W:", LA_F("punch round timed out, retry in %ds", LA_F542, 542), P2P_TCP_RESTART_MS / 1000);
+        punch_stop(c);
+        c->restart_ms = now + P2P_TCP_RESTART_MS;
     }
+}
 
-    /* 设置为非阻塞 */
-    P_sock_nonblock(sock, true);
+///////////////////////////////////////////////////////////////////////////////
 
-    /* 进行三次握手的"同时发起"尝试 */
-    print("I:", LA_F("Attempting Simultaneous Open to %s:%d", LA_F259, 259),
-                 inet_ntoa(remote->sin_addr), ntohs(remote->sin_port));
-    
-    int ret = connect(sock, (struct sockaddr *)remote, sizeof(*remote));
-    if (ret < 0 && !P_sock_is_inprogress()) {
-        P_sock_close(sock);
-        return -1;
+/* 连接断开：关闭套接字，TCP 候选路径重置为不可用（活跃时由路径管理器切换），稍后重新打洞 */
+static void conn_lost(struct p2p_session *s, p2p_tcp_punch_t *c, const char *reason, uint64_t now) {
+
+    sock_drop(&c->sock);
+    c->rx_len = c->tx_len = 0;
+    c->restart_ms = now + P2P_TCP_RESTART_MS;
+
+    int idx = c->path;
+    c->path = -1;
+    if (idx < 0 || idx >= s->remote_cand_cnt || s->remote_cands[idx].type != P2P_CAND_TCP) return;
+
+    print("W:", LA_F("path[%d] lost: %s", LA_F543, 543), idx, reason);
+    p2p_reset_path(s, idx);
+    s->remote_cands[idx].stats.state = PATH_STATE_FAILED;
+}
+
+/* 一帧即 UDP 路径上的一个完整 P2P 包，按 TCP 候选地址交给 NAT 层 */
+static void conn_dispatch(struct p2p_session *s, p2p_tcp_punch_t *c, const uint8_t *pkt, int len, uint64_t now) {
+
+    p2p_packet_hdr_t hdr;
+    p2p_pkt_hdr_decode(pkt, &hdr);
+    if (hdr.type >= 0x80) return;               // 信令包不经 TCP 路径
+
+    const uint8_t *payload = pkt + P2P_HDR_SIZE; int payload_len = len - P2P_HDR_SIZE;
+
+    // TCP 连接本身属于本会话，session_id 前缀无需校验
+    if (hdr.flags & P2P_FLAG_SESSION) {
+        if (payload_len < (int)P2P_SESS_ID_PSZ) return;
+        payload     += P2P_SESS_ID_PSZ;
+        payload_len -= (int)P2P_SESS_ID_PSZ;
+    }
+
+    struct sockaddr_in from = c->peer;
+    s->tcp_rx = true;
+    nat_proto(s, hdr.type, hdr.flags, hdr.seq, payload, payload_len, &from, now);
+    s->tcp_rx = false;
+}
+
+/* 解析接收缓冲区中的完整帧；返回 false 表示连接已关闭（帧非法，或处理过程中被重置） */
+static bool conn_parse(struct p2p_session *s, p2p_tcp_punch_t *c, uint64_t now) {
+
+    sock_t sock = c->sock;
+    int off = 0;
+    while (c->rx_len - off >= P2P_TCP_FRAME_HDR) {
+
+        int len = nget_s(c->rx + off);
+        if (len < P2P_HDR_SIZE || len > P2P_MTU) {
+            conn_lost(s, c, "bad frame", now);
+            return false;
+        }
+        if (c->rx_len - off < P2P_TCP_FRAME_HDR + len) break;
+
+        conn_dispatch(s, c, c->rx + off + P2P_TCP_FRAME_HDR, len, now);
+        if (c->sock != sock) return false;      // 会话重置已关闭连接（缓冲区已清空）
+        off += P2P_TCP_FRAME_HDR + len;
+    }
+    if (off) {
+        memmove(c->rx, c->rx + off, c->rx_len - off);
+        c->rx_len -= off;
+    }
+    return true;
+}
+
+static void conn_flush(struct p2p_session *s, p2p_tcp_punch_t *c, uint64_t now) {
+
+    if (!c->tx_len) return;
+    ssize_t n = send(c->sock, (const char *)c->tx, c->tx_len, MSG_NOSIGNAL);
+    if (n < 0) {
+        if (!P_sock_is_wouldblock()) conn_lost(s, c, "send error", now);
+        return;
     }
+    memmove(c->tx, c->tx + n, c->tx_len - (int)n);
+    c->tx_len -= (int)n;
+}
+
+static void conn_tick(struct p2p_session *s, p2p_tcp_punch_t *c, uint64_t now) {
+
+    for (;;) {
+        ssize_t n = recv(c->sock, (char *)c->rx + c->rx_len, (int)sizeof(c->rx) - c->rx_len, 0);
+        if (n > 0) {
+            c->rx_len += (int)n;
+            if (!conn_parse(s, c, now)) return;
+            continue;
+        }
+        if (n == 0) { conn_lost(s, c, "closed by peer", now); return; }
+        if (!P_sock_is_wouldblock()) { conn_lost(s, c, "recv error", now); return; }
+        break;
+    }
+    conn_flush(s, c, now);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void p2p_tcp_punch_tick(struct p2p_session *s, uint64_t now_ms) {
+
+    p2p_tcp_punch_t *c = s->tcp_punch;
+
+    // 发送出错时只关闭了套接字（避免在发送路径中重置路径），在此补做清理
+    if (c && c->sock == P_INVALID_SOCKET && c->path >= 0) conn_lost(s, c, "send error", now_ms);
+
+    if (c && c->sock != P_INVALID_SOCKET) { conn_tick(s, c, now_ms); return; }
+    if (c && c->start_ms) { punch_advance(s, c, now_ms); return; }
+
+    // 候选交换完成、NAT 层开始打洞后才发起（与 UDP 打洞同时进行）
+    if (s->nat.state < NAT_PUNCHING || !s->remote_cand_cnt) return;
+    if (c && now_ms < c->restart_ms) return;
+
+    if (!c) {
+        if (!(c = (p2p_tcp_punch_t *)p2p_arena_calloc(s->inst->arena, 1, sizeof(*c)))) return;
+        c->sock = P_INVALID_SOCKET;
+        c->path = -1;
+        s->tcp_punch = c;
+    }
+    if (!punch_collect(s, c)) {                 // 对端只有中继候选
+        c->restart_ms = now_ms + P2P_TCP_RESTART_MS;
+        return;
+    }
+
+    c->start_ms = now_ms;
+    print("I:", LA_F("punch round: %d targets from :%u", LA_F544, 544), c->try_cnt, punch_local_port(s));
+    for (int i = 0; i < c->try_cnt; i++) {
+        print("V:", LA_F("Attempting Simultaneous Open to %s:%d", LA_F259, 259),
+              inet_ntoa(c->trys[i].target.sin_addr), ntohs(c->trys[i].target.sin_port));
+        try_connect(s, &c->trys[i], now_ms);
+    }
+}
+
+int p2p_tcp_punch_next_timeout(const struct p2p_session *s, uint64_t now_ms) {
+
+    const p2p_tcp_punch_t *c = s->tcp_punch;
+    if (!c) return s->nat.state >= NAT_PUNCHING && s->remote_cand_cnt ? 0 : -1;
+    if (c->sock != P_INVALID_SOCKET || c->start_ms || c->path >= 0) return P2P_TCP_POLL_MS;
+    if (s->nat.state < NAT_PUNCHING || !s->remote_cand_cnt) return -1;
+    return c->restart_ms > now_ms ? (int)(c->restart_ms - now_ms) : 0;
+}
+
+ret_t p2p_tcp_send_packet(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
+                          const void *payload, int payload_len) {
+
+    p2p_tcp_punch_t *c = s->tcp_punch;
+    if (!c || c->sock == P_INVALID_SOCKET) return 0;
+
+    int len = P2P_HDR_SIZE + payload_len;
+    if (payload_len < 0 || len > P2P_MTU) return E_INVALID;
+
+    uint8_t frame[P2P_TCP_FRAME_HDR + P2P_MTU];
+    nwrite_s(frame, (uint16_t)len);
+    p2p_pkt_hdr_encode(frame + P2P_TCP_FRAME_HDR, type, flags, seq);
+    if (payload_len > 0 && payload) memcpy(frame + P2P_TCP_FRAME_HDR + P2P_HDR_SIZE, payload, payload_len);
+
+    int total = P2P_TCP_FRAME_HDR + len, off = 0;
+
+    // 无积压时直接写入内核缓冲区，未写完的剩余部分（及后续帧）进入积压，保持帧边界连续
+    if (!c->tx_len) {
+        ssize_t n = send(c->sock, (const char *)frame, total, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (!P_sock_is_wouldblock()) { sock_drop(&c->sock); return 0; }
+            n = 0;
+        }
+        if ((off = (int)n) == total) return len;
+    }
+
+    // 积压满时丢弃整帧（等同 UDP 丢包，由上层重传）
+    if (c->tx_len + total - off > (int)sizeof(c->tx)) {
+        print("V:", LA_F("tx backlog full, frame dropped (type=%u)", LA_F545, 545), type);
+        return E_BUSY;
+    }
+    memcpy(c->tx + c->tx_len, frame + off, total - off);
+    c->tx_len += total - off;
+    p2p_session_wake(s);
+    return len;
+}
+
+void p2p_tcp_punch_close(struct p2p_session *s, bool free_ctx) {
+
+    p2p_tcp_punch_t *c = s->tcp_punch;
+    if (!c) return;
+
+    punch_stop(c);
+    sock_drop(&c->sock);
+    c->rx_len = c->tx_len = 0;
+    c->path = -1;
+    c->restart_ms = 0;
 
-    s->inst->tcp_sock = sock;
-    return 0;
+    if (free_ctx) { p2p_arena_free(s->inst->arena, c); s->tcp_punch = NULL; }
 }
@@ -1,5 +1,15 @@
 /*
- * TCP 打洞实现
+ * TCP 打洞实现（UDP 受限网络的回退路径）
+ *
+ * 同时打开（Simultaneous Open）：双方在打洞阶段各自从同一本地端口（SO_REUSEADDR/PORT）
+ * 向对端候选地址反复发起非阻塞 connect，双方 SYN 在 NAT 上交叉后连接建立，无需监听端。
+ *   - 本地端口：cfg.tcp_port，为 0 时与 UDP 主套接字端口相同
+ *   - 目标端口：cfg.tcp_port，为 0 时与对端 UDP 候选端口相同（端口保持型 NAT / 同一局域网）
+ *
+ * 连接建立后登记为 P2P_CAND_TCP 远端候选（路径类型 P2P_PATH_TCP），与 UDP 候选一样参与
+ * NAT 层确认、保活测 RTT 和路径管理器选路（按中继类候选与 TURN 竞争）。
+ *
+ * 帧格式：[len(2)][P2P 包(len)]，P2P 包即 UDP 路径上的完整包（4 字节头 + 负载）。
  */
 #ifndef P2P_TCP_PUNCH_H
 #define P2P_TCP_PUNCH_H
@@ -8,6 +18,47 @@
 
 struct p2p_session;
 
-int p2p_tcp_punch_connect(struct p2p_session *s, const struct sockaddr_in *remote);
+#define P2P_TCP_MAX_TRYS         4          /* 每轮同时尝试的目标数 */
+#define P2P_TCP_RETRY_MS         500        /* connect 被拒（对端 SYN 尚未发出）后的重试间隔 */
+#define P2P_TCP_PUNCH_TIMEOUT_MS 15000      /* 单轮打洞时限 */
+#define P2P_TCP_RESTART_MS       30000      /* 一轮失败（或连接断开）后再次发起的间隔 */
+#define P2P_TCP_POLL_MS          10         /* 连接建立后的收包轮询间隔 */
+#define P2P_TCP_FRAME_HDR        2          /* 帧头：len(2) */
+#define P2P_TCP_TX_BUF           (4 * (P2P_TCP_FRAME_HDR + P2P_MTU))    /* 发送积压上限，满时丢弃整帧 */
+
+typedef struct {
+    sock_t              sock;                   // connect 套接字（P_INVALID_SOCKET = 等待重试）
+    struct sockaddr_in  target;                 // 目标地址
+    uint64_t            retry_ms;               // 下次重试时间
+} p2p_tcp_try_t;
+
+typedef struct {
+    p2p_tcp_try_t       trys[P2P_TCP_MAX_TRYS]; // 本轮打洞目标
+    int                 try_cnt;
+    uint64_t            start_ms;               // 本轮开始时间（0 = 本轮未进行）
+    uint64_t            restart_ms;             // 允许再次发起的时间（失败/断开后推迟 P2P_TCP_RESTART_MS）
+
+    sock_t              sock;                   // 已建立的连接（P_INVALID_SOCKET = 无）
+    struct sockaddr_in  peer;                   // 连接对端地址（即 TCP 候选地址）
+    int                 path;                   // 对应 remote_cands 索引（-1 = 未登记；sock 已关闭而 path >= 0 表示待清理）
+
+    uint8_t             rx[2 * (P2P_TCP_FRAME_HDR + P2P_MTU)];
+    int                 rx_len;
+    uint8_t             tx[P2P_TCP_TX_BUF];
+    int                 tx_len;
+} p2p_tcp_punch_t;
+
+/* 会话 tick：发起/推进同时打开、收发帧（cfg.enable_tcp 时由会话 tick 调用） */
+void  p2p_tcp_punch_tick(struct p2p_session *s, uint64_t now_ms);
+
+/* 距下次需要 tick 的毫秒数（-1 = 无需调度） */
+int   p2p_tcp_punch_next_timeout(const struct p2p_session *s, uint64_t now_ms);
+
+/* 经 TCP 连接发送一个 P2P 包（无连接时静默丢弃并返回 0，积压满时返回 E_BUSY） */
+ret_t p2p_tcp_send_packet(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
+                          const void *payload, int payload_len);
+
+/* 关闭连接与所有尝试（会话重置）；free = true 时同时释放上下文（会话销毁） */
+void  p2p_tcp_punch_close(struct p2p_session *s, bool free_ctx);
 
 #endif /* P2P_TCP_PUNCH_H */
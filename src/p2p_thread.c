@@ -1,30 +1,961 @@
+/* pthread_setaffinity_np 需要 GNU 扩展 */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
 
 #ifdef P2P_THREADED
 
 #include "p2p_internal.h"
+#include "p2p_thread.h"
 
+#ifdef _WIN32
+#define poll WSAPoll
+#else
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+# if defined(__linux__)
+#include <sys/eventfd.h>
+#include <pthread.h>
+# endif
+#endif
+
+#define THREAD_MAX_POLL_FDS     32          /* 参与 poll 的最大描述符数量 */
+
+/* cfg.latency_mode 空闲退避：连续空轮询次数达到阈值后依次改为让出 CPU、短睡眠 */
+#define THREAD_SPIN_POLLS       2000        /* 忙轮询次数 */
+#define THREAD_YIELD_POLLS      200         /* 之后让出 CPU 的次数 */
+#define THREAD_NAP_MS           1           /* 最后阶段每次睡眠上限（有包到达即返回） */
+
+#define THREAD_IOCP_SLICE_MS    10          /* cfg.udp_iocp：有完成端口之外的描述符时每片等待时长 */
+
+#define CRYPTO_MIN_JOBS         4           /* 加密线程池：批次少于此数时就地执行；每多此数唤醒一个线程 */
+
+static inline void thread_yield(void) {
+#if defined(_WIN32)
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+/* 当前线程绑定到 cfg.thread_cpu_mask */
+static void thread_pin(uint64_t mask) {
+
+    if (!mask) return;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < 64 && i < CPU_SETSIZE; i++) if (mask >> i & 1) CPU_SET(i, &set);
+    int e = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (e) print("W:", LA_F("set thread affinity 0x%llx failed(%d)", LA_F626, 626), (unsigned long long)mask, e);
+#elif defined(_WIN32)
+    if (!SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)mask))
+        print("W:", LA_F("set thread affinity 0x%llx failed(%d)", LA_F626, 626), (unsigned long long)mask, (int)GetLastError());
+#else
+    print("W:", LA_F("thread affinity not supported on this platform", LA_F627, 627));
+#endif
+}
+
+static inline int thread_prio(const struct p2p_instance *inst) {
+    return inst->cfg.thread_priority ? inst->cfg.thread_priority : P_THD_NORMAL;
+}
+
+/*
+ * 唤醒描述符
+ *
+ * Linux 使用 eventfd，其他 POSIX 平台使用非阻塞 pipe，
+ * Windows 下 WSAPoll 仅支持 socket，使用绑定回环地址的 UDP socket 向自身发送
+ */
+static ret_t wake_open(sock_t *rd, sock_t *wr) {
+
+#if defined(_WIN32)
+    sock_t fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == P_INVALID_SOCKET) return E_EXTERNAL(P_sock_errno());
+
+    struct sockaddr_in addr; memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || getsockname(fd, (struct sockaddr *)&addr, &len) != 0
+        || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        int e = P_sock_errno();
+        P_sock_close(fd);
+        return E_EXTERNAL(e);
+    }
+    P_sock_nonblock(fd, true);
+    *rd = *wr = fd;
+#elif defined(__linux__)
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) return E_EXTERNAL(errno);
+    *rd = *wr = fd;
+#else
+    int fds[2];
+    if (pipe(fds) != 0) return E_EXTERNAL(errno);
+    for (int i = 0; i < 2; i++) fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+    *rd = fds[0];
+    *wr = fds[1];
+#endif
+    return E_NONE;
+}
+
+static void wake_close(sock_t *rd, sock_t *wr) {
+
+#if defined(_WIN32)
+    if (*rd != P_INVALID_SOCKET) P_sock_close(*rd);
+#else
+    if (*rd != P_INVALID_SOCKET) close(*rd);
+    if (*wr != *rd && *wr != P_INVALID_SOCKET) close(*wr);
+#endif
+    *rd = *wr = P_INVALID_SOCKET;
+}
+
+/* 清空唤醒描述符中累积的信号 */
+static void wake_drain(sock_t rd) {
+
+    char buf[64];
+#if defined(_WIN32)
+    while (recv(rd, buf, sizeof(buf), 0) > 0) {}
+#else
+    while (read(rd, buf, sizeof(buf)) > 0) {}
+#endif
+}
+
+static void wake_signal(sock_t wr) {
+
+    if (wr == P_INVALID_SOCKET) return;
+#if defined(_WIN32)
+    send(wr, "", 1, 0);
+#elif defined(__linux__)
+    uint64_t one = 1;
+    ssize_t r = write(wr, &one, sizeof(one)); (void)r;
+#else
+    ssize_t r = write(wr, "", 1); (void)r;
+#endif
+}
+
+void p2p_thread_wakeup(struct p2p_instance *inst) {
+    wake_signal(inst->wake_wr);
+    p2p_udp_iocp_wakeup(inst);
+}
+
+void p2p_worker_wakeup(p2p_worker_t *w) {
+    wake_signal(w->wake_wr);
+}
+
+ret_t p2p_waiter_open(p2p_waiter_t *w) {
+    if (w->rd != P_INVALID_SOCKET) return E_NONE;
+    return wake_open(&w->rd, &w->wr);
+}
+
+void p2p_waiter_close(p2p_waiter_t *w) {
+    wake_close(&w->rd, &w->wr);
+}
+
+void p2p_waiter_signal(p2p_waiter_t *w) {
+    wake_signal(w->wr);
+}
+
+void p2p_waiter_block(p2p_waiter_t *w, int ms) {
+    struct pollfd fd;
+    fd.fd = w->rd; fd.events = POLLIN; fd.revents = 0;
+    if (poll(&fd, 1, ms) > 0 && (fd.revents & POLLIN))
+        wake_drain(w->rd);
+}
+
+/*
+ * 收集需要等待的描述符：唤醒描述符 + p2p_collect_fds（UDP 套接字、RELAY 信令 TCP、TCP 打洞）
+ * + *udp_cnt 返回其中 UDP 套接字的数量（紧随唤醒描述符之后）
+ */
+static int collect_fds(struct p2p_instance *inst, struct pollfd *fds, int max, int *udp_cnt) {
+
+    p2p_fd_t pfds[THREAD_MAX_POLL_FDS];
+
+    fds[0].fd = inst->wake_rd; fds[0].events = POLLIN; fds[0].revents = 0;
+
+    int cnt = p2p_collect_fds(inst, pfds, max - 1);
+    if (cnt > max - 1) cnt = max - 1;
+    for (int i = 0; i < cnt; i++) {
+        fds[1 + i].fd = (sock_t)pfds[i].fd;
+        fds[1 + i].events = (short)(((pfds[i].events & P2P_FD_READ) ? POLLIN : 0)
+                                    | ((pfds[i].events & P2P_FD_WRITE) ? POLLOUT : 0));
+        fds[1 + i].revents = 0;
+    }
+
+    int n = p2p_udp_poll_fds(inst, NULL, 0);
+    *udp_cnt = n < cnt ? n : cnt;
+
+    return 1 + cnt;
+}
+
+/*
+ * 低延迟模式等待（替代阻塞于 poll）：至多 ms 毫秒，返回 poll 结果
+ * + 非阻塞 poll 忙轮询；*idle 为连续空轮询次数（有事件时清零），超过阈值后依次退避为让出 CPU、短睡眠
+ */
+static int busy_wait(struct p2p_instance *inst, struct pollfd *fds, int nfds, int ms, int *idle) {
+
+    uint64_t end = P_tick_ms() + (uint64_t)ms;
+    for (;;) {
+        int r = poll(fds, (unsigned)nfds, 0);
+        if (r == 0 && *idle >= THREAD_SPIN_POLLS + THREAD_YIELD_POLLS) {
+            uint64_t now = P_tick_ms();
+            int left = now < end ? (int)(end - now) : 0;
+            r = poll(fds, (unsigned)nfds, left < THREAD_NAP_MS ? left : THREAD_NAP_MS);
+        }
+        if (r != 0) { if (r > 0) *idle = 0; return r; }
+        if (inst->quit || P_tick_ms() >= end) return 0;
+        if (++*idle >= THREAD_SPIN_POLLS) thread_yield();
+    }
+}
+
+#ifdef _WIN32
+/*
+ * IOCP 接收（cfg.udp_iocp）时的等待：至多 ms 毫秒，返回值同 poll
+ * + UDP 包与 p2p_thread_wakeup 经完成端口到达（投递的接收取走数据，UDP 套接字在 poll 中不再就绪）
+ * + 信令 TCP、TCP 打洞、IPv6 套接字不在完成端口上：存在时按 THREAD_IOCP_SLICE_MS 分片等待，
+ *   每片后非阻塞 poll 全部描述符一次
+ * + cfg.latency_mode 下每片为 0（忙轮询完成端口），空闲退避同 busy_wait
+ */
+static int iocp_wait(struct p2p_instance *inst, struct pollfd *fds, int nfds, int nudp, int ms, int *idle) {
+
+    bool others = nfds > 1 + nudp || inst->sock6_port;
+    for (int i = 0; i < inst->sock_cnt && !others; i++)
+        others = inst->socks[i].sock != P_INVALID_SOCKET && !inst->socks[i].iocp;     // 关联失败的套接字
+    uint64_t end = P_tick_ms() + (uint64_t)ms;
+    for (;;) {
+        uint64_t now = P_tick_ms();
+        int left = now < end ? (int)(end - now) : 0;
+        int slice = others && left > THREAD_IOCP_SLICE_MS ? THREAD_IOCP_SLICE_MS : left;
+        if (inst->cfg.latency_mode)
+            slice = *idle < THREAD_SPIN_POLLS + THREAD_YIELD_POLLS ? 0 : (slice < THREAD_NAP_MS ? slice : THREAD_NAP_MS);
+
+        int r = p2p_udp_iocp_wait(inst, slice);
+        if (r < 0) r = poll(fds, (unsigned)nfds, slice);
+        else if (r > 0) {
+            if (r & P2P_UDP_IOCP_WAKE) fds[0].revents |= POLLIN;
+        }
+        else if (others) r = poll(fds, (unsigned)nfds, 0);
+
+        if (r != 0) { if (r > 0) *idle = 0; return r; }
+        if (inst->quit || P_tick_ms() >= end) return 0;
+        if (inst->cfg.latency_mode && ++*idle >= THREAD_SPIN_POLLS) thread_yield();
+    }
+}
+#endif
+
+/*
+ * 工作线程主循环
+ *
+ * 每轮 p2p_update 后计算最近的协议定时器到期时间，阻塞于 poll 等待：
+ *   - 任一套接字可读（数据包到达）
+ *   - p2p_send / p2p_connect 等接口写入唤醒描述符
+ *   - 定时器到期（最长 update_interval_ms）
+ * + cfg.latency_mode 下以 busy_wait 忙轮询代替阻塞等待；cfg.udp_iocp（Windows）下等待完成端口（iocp_wait）
+ *
+ * 会话分片模式下每轮分为两步：
+ *   - 收包派发：只持实例锁，数据包复制到所属分片的收件箱，分片线程并行处理
+ *   - 控制阶段：持全部锁，仅在有延后的实例级包、唤醒、信令描述符就绪或距上次超过 update_interval_ms 时执行
+ */
 static int32_t p2p_thread_func(void *arg) {
     struct p2p_instance *inst = (struct p2p_instance *)arg;
+    struct pollfd fds[THREAD_MAX_POLL_FDS];
+    uint64_t last_ctrl = 0;
+    bool ctrl = true;
+    int idle = 0;
+
+    thread_pin(inst->cfg.thread_cpu_mask);
+
+    while (!inst->quit) {
+        int ms, nfds, nudp;
+
+        if (!inst->worker_cnt) {
+            P_mutex_lock(&inst->mtx);
+            p2p_update((p2p_handle_t)inst);
+            ms = p2p_next_timeout(inst, P_tick_ms());
+            nfds = collect_fds(inst, fds, THREAD_MAX_POLL_FDS, &nudp);
+            P_mutex_unlock(&inst->mtx);
+        }
+        else {
+            P_mutex_lock(&inst->mtx);
+            if (p2p_update_steer(inst)) ctrl = true;
+            P_mutex_unlock(&inst->mtx);
+
+            uint64_t now = P_tick_ms();
+            int interval = p2p_tick_interval(inst, now);
+            if (ctrl || tick_diff(now, last_ctrl) >= (uint64_t)interval) {
+                p2p_thread_lock_all(inst);
+                p2p_update_control(inst);
+                p2p_thread_unlock_all(inst);
+                last_ctrl = now;
+                ctrl = false;
+            }
+
+            P_mutex_lock(&inst->mtx);
+            now = P_tick_ms();
+            ms = p2p_next_timeout(inst, now);
+            int left = interval - (int)tick_diff(now, last_ctrl);
+            if (left < ms) ms = p2p_lp_idle(inst, now) ? p2p_lp_align(now, left) : left;
+            nfds = collect_fds(inst, fds, THREAD_MAX_POLL_FDS, &nudp);
+            P_mutex_unlock(&inst->mtx);
+        }
+
+        if (inst->quit) break;
+        if (ms <= 0) continue;
+
+        int r;
+#ifdef _WIN32
+        if (p2p_udp_iocp_on(inst)) r = iocp_wait(inst, fds, nfds, nudp, ms, &idle);
+        else
+#endif
+        r = inst->cfg.latency_mode ? busy_wait(inst, fds, nfds, ms, &idle) : poll(fds, (unsigned)nfds, ms);
+        if (r > 0) {
+            if (fds[0].revents & POLLIN) { wake_drain(inst->wake_rd); ctrl = true; }
+            // 信令 TCP、TCP 打洞等非 UDP 描述符就绪：需要控制阶段处理
+            for (int i = 1 + nudp; i < nfds; i++) if (fds[i].revents) ctrl = true;
+        }
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 会话分片线程
+///////////////////////////////////////////////////////////////////////////////
+
+P2P_TLS p2p_worker_t *p2p_worker_self = NULL;
+
+/*
+ * 分片线程主循环：持分片锁执行一轮调度，之后阻塞等待
+ *   - 主线程投递数据包（收件箱由空变为非空时唤醒）
+ *   - 应用侧唤醒本分片会话、主线程控制阶段推进本分片会话
+ *   - 本分片时间轮最早到期时刻
+ */
+static int32_t p2p_worker_func(void *arg) {
+    p2p_worker_t *w = (p2p_worker_t *)arg;
+    struct p2p_instance *inst = w->inst;
+
+    p2p_worker_self = w;
+    thread_pin(inst->cfg.thread_cpu_mask);
 
     while (!inst->quit) {
-        P_mutex_lock(&inst->mtx);
-        p2p_update((p2p_handle_t)inst);
-        P_mutex_unlock(&inst->mtx);
+        P_mutex_lock(&w->mtx);
+        int ms = p2p_worker_update(w);
+        P_mutex_unlock(&w->mtx);
 
-        int ms = inst->cfg.update_interval_ms;
-        if (ms <= 0) ms = 10;
-        P_usleep((unsigned int)ms * 1000);
+        if (inst->quit) break;
+        if (!ms) continue;
+
+        struct pollfd fd;
+        fd.fd = w->wake_rd; fd.events = POLLIN; fd.revents = 0;
+        if (poll(&fd, 1, ms) > 0 && (fd.revents & POLLIN))
+            wake_drain(w->wake_rd);
     }
 
     return 0;
 }
 
+static void workers_free(struct p2p_instance *inst, int cnt) {
+
+    for (int i = 0; i < cnt; i++) {
+        p2p_worker_t *w = &inst->workers[i];
+        wake_close(&w->wake_rd, &w->wake_wr);
+        P_mutex_final(&w->rx_mtx);
+        P_mutex_final(&w->mtx);
+        p2p_free(w->rx_items[0]);
+        p2p_free(w->rx_items[1]);
+        p2p_free(w->txq.slots);
+        p2p_free(w->txq.seals);
+        reliable_pool_trim(&w->rel_pool);
+    }
+    p2p_free(inst->workers);
+    inst->workers = NULL;
+    inst->worker_cnt = 0;
+    p2p_free(inst->ctrl_slots);
+    inst->ctrl_slots = NULL;
+    inst->ctrl_cnt = 0;
+}
+
+/* 停止已启动的 cnt 个分片线程（inst->quit 已置位） */
+static void workers_join(struct p2p_instance *inst, int cnt) {
+
+    for (int i = 0; i < cnt; i++) {
+        p2p_worker_wakeup(&inst->workers[i]);
+        P_join(inst->workers[i].thread, NULL);
+    }
+}
+
+static ret_t workers_start(struct p2p_instance *inst, int cnt) {
+
+    inst->workers = (p2p_worker_t *)p2p_calloc((size_t)cnt, sizeof(p2p_worker_t));
+    inst->ctrl_slots = (p2p_udp_slot_t *)p2p_malloc(sizeof(p2p_udp_slot_t) * P2P_UDP_BATCH_SLOTS);
+    if (!inst->workers || !inst->ctrl_slots) { workers_free(inst, 0); return E_OUT_OF_MEMORY; }
+
+    ret_t ret = E_NONE;
+    int inited = 0, started = 0;
+    for (; inited < cnt; inited++) {
+        p2p_worker_t *w = &inst->workers[inited];
+        w->inst = inst;
+        w->rel_pool.mem = &inst->mem;
+        w->wake_rd = w->wake_wr = P_INVALID_SOCKET;
+        p2p_timer_wheel_init(&w->timers, P_tick_ms());
+        w->rx_items[0] = (p2p_rx_item_t *)p2p_malloc(sizeof(p2p_rx_item_t) * P2P_WORKER_INBOX);
+        w->rx_items[1] = (p2p_rx_item_t *)p2p_malloc(sizeof(p2p_rx_item_t) * P2P_WORKER_INBOX);
+        if (!w->rx_items[0] || !w->rx_items[1]) {
+            p2p_free(w->rx_items[0]); p2p_free(w->rx_items[1]);
+            ret = E_OUT_OF_MEMORY;
+            break;
+        }
+        if (P_mutex_init(&w->mtx) != 0) { p2p_free(w->rx_items[0]); p2p_free(w->rx_items[1]); ret = E_UNKNOWN; break; }
+        if (P_mutex_init(&w->rx_mtx) != 0) {
+            P_mutex_final(&w->mtx); p2p_free(w->rx_items[0]); p2p_free(w->rx_items[1]);
+            ret = E_UNKNOWN;
+            break;
+        }
+        if ((ret = wake_open(&w->wake_rd, &w->wake_wr)) != E_NONE) {
+            P_mutex_final(&w->rx_mtx); P_mutex_final(&w->mtx); p2p_free(w->rx_items[0]); p2p_free(w->rx_items[1]);
+            break;
+        }
+    }
+    inst->worker_cnt = inited;
+
+    if (ret == E_NONE) {
+        for (; started < cnt; started++) {
+            if ((ret = P_thread(&inst->workers[started].thread, p2p_worker_func,
+                                &inst->workers[started], thread_prio(inst), 0)) != E_NONE) break;
+        }
+    }
+
+    if (ret != E_NONE) {
+        inst->quit = 1;
+        workers_join(inst, started);
+        inst->quit = 0;
+        workers_free(inst, inited);
+        return ret;
+    }
+
+    print("I:", LA_F("Started %d session worker threads", LA_F490, 490), cnt);
+    return E_NONE;
+}
+
+void p2p_thread_lock_all(struct p2p_instance *inst) {
+    for (int i = 0; i < inst->worker_cnt; i++) P_mutex_lock(&inst->workers[i].mtx);
+    P_mutex_lock(&inst->mtx);
+}
+
+void p2p_thread_unlock_all(struct p2p_instance *inst) {
+    P_mutex_unlock(&inst->mtx);
+    for (int i = inst->worker_cnt - 1; i >= 0; i--) P_mutex_unlock(&inst->workers[i].mtx);
+}
+
+void p2p_thread_assign(struct p2p_instance *inst, struct p2p_session *s) {
+
+    if (!inst->worker_cnt) return;
+
+    p2p_worker_t *best = &inst->workers[0];
+    for (int i = 1; i < inst->worker_cnt; i++)
+        if (inst->workers[i].sess_cnt < best->sess_cnt) best = &inst->workers[i];
+    best->sess_cnt++;
+    s->worker = best;
+}
+
+void p2p_thread_detach(struct p2p_session *s) {
+
+    p2p_worker_t *w = s->worker;
+    if (!w) return;
+
+    // 分片线程整批处理另一侧收件箱时持分片锁，调用方持全部锁，此时只有写入侧可能残留本会话的包
+    P_mutex_lock(&w->rx_mtx);
+    p2p_rx_item_t *items = w->rx_items[w->rx_fill];
+    for (int i = 0; i < w->rx_cnt; i++)
+        if (items[i].s == s) items[i].s = NULL;
+    P_mutex_unlock(&w->rx_mtx);
+
+    w->sess_cnt--;
+    s->worker = NULL;
+}
+
+void p2p_worker_post(p2p_worker_t *w, struct p2p_session *s, bool stun,
+                     const uint8_t *pkt, int len, const struct sockaddr_in *from, uint64_t rx_us, uint8_t ecn) {
+
+    if (len <= 0 || len > (int)sizeof(((p2p_rx_item_t*)0)->buf)) return;
+
+    P_mutex_lock(&w->rx_mtx);
+    if (w->rx_cnt >= P2P_WORKER_INBOX) {
+        w->rx_drops++;
+        P_mutex_unlock(&w->rx_mtx);
+        return;
+    }
+    p2p_rx_item_t *it = &w->rx_items[w->rx_fill][w->rx_cnt];
+    it->s = s;
+    it->from = *from;
+    it->len = len;
+    it->stun = stun;
+    it->rx_us = rx_us;
+    it->ecn = ecn;
+    memcpy(it->buf, pkt, (size_t)len);
+    bool first = w->rx_cnt++ == 0;
+    P_mutex_unlock(&w->rx_mtx);
+
+    // 收件箱由空变为非空时唤醒：分片线程每轮整批取走，无需逐包通知
+    if (first) p2p_worker_wakeup(w);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 加密线程池
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * 同一时刻只执行一个批次：提交方登记批次后唤醒所需数量的线程并自身参与，各方在锁内逐个领取任务，
+ * 全部完成后提交方撤下批次；池忙时（其他分片线程的批次未完成）新提交就地执行，不排队
+ */
+typedef struct crypto_thread {
+    struct p2p_crypto_pool* pool;
+    thd_t                   thread;
+    sock_t                  wake_rd;            // 唤醒描述符（每线程一个，提交方只唤醒所需数量的线程）
+    sock_t                  wake_wr;
+} crypto_thread_t;
+
+typedef struct p2p_crypto_pool {
+    P_mutex_t               mtx;                // 保护 jobs / cnt / next（叶子锁）
+    p2p_aead_job_t*         jobs;               // 当前批次（NULL = 空闲）
+    int                     cnt;
+    int                     next;               // 下一个待领取的任务
+    int                     done;               // 已完成的任务数（原子）
+    int                     quit;               // 线程退出标志
+    int                     thread_cnt;
+    crypto_thread_t         threads[P2P_MAX_CRYPTO_WORKERS];
+    p2p_aead_job_t          rx_jobs[P2P_UDP_BATCH_SLOTS];
+    uint8_t                 rx_plain[P2P_UDP_BATCH_SLOTS][P2P_HDR_SIZE + P2P_PMTU_PAYLOAD_MAX];
+} p2p_crypto_pool_t;
+
+/* 领取并执行当前批次的任务，直到没有可领取的任务 */
+static void crypto_work(p2p_crypto_pool_t *p) {
+
+    for (;;) {
+        P_mutex_lock(&p->mtx);
+        p2p_aead_job_t *j = p->jobs && p->next < p->cnt ? &p->jobs[p->next++] : NULL;
+        P_mutex_unlock(&p->mtx);
+        if (!j) return;
+        p2p_aead_job_run(j);
+        __atomic_add_fetch(&p->done, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static int32_t p2p_crypto_func(void *arg) {
+    crypto_thread_t *t = (crypto_thread_t *)arg;
+    p2p_crypto_pool_t *p = t->pool;
+
+    while (!__atomic_load_n(&p->quit, __ATOMIC_ACQUIRE)) {
+        struct pollfd fd;
+        fd.fd = t->wake_rd; fd.events = POLLIN; fd.revents = 0;
+        if (poll(&fd, 1, -1) > 0 && (fd.revents & POLLIN)) wake_drain(t->wake_rd);
+        crypto_work(p);
+    }
+    return 0;
+}
+
+void p2p_crypto_stop(struct p2p_instance *inst) {
+
+    p2p_crypto_pool_t *p = inst->crypto;
+    if (!p) return;
+
+    __atomic_store_n(&p->quit, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < p->thread_cnt; i++) {
+        wake_signal(p->threads[i].wake_wr);
+        P_join(p->threads[i].thread, NULL);
+    }
+    for (int i = 0; i < P2P_MAX_CRYPTO_WORKERS; i++) wake_close(&p->threads[i].wake_rd, &p->threads[i].wake_wr);
+    P_mutex_final(&p->mtx);
+    p2p_free(p);
+    inst->crypto = NULL;
+    inst->crypto_rx = NULL;
+    inst->crypto_rx_cur = NULL;
+}
+
+/* 启动加密线程池；只有内置 AEAD 后端的记录可逐条独立加解密，其他后端不启用 */
+ret_t p2p_crypto_start(struct p2p_instance *inst) {
+
+    int cnt = inst->cfg.crypto_workers;
+    if (cnt <= 0 || inst->cfg.dtls_backend != 3) return E_NONE;
+    if (cnt > P2P_MAX_CRYPTO_WORKERS) cnt = P2P_MAX_CRYPTO_WORKERS;
+
+    p2p_crypto_pool_t *p = (p2p_crypto_pool_t *)p2p_calloc(1, sizeof(*p));
+    if (!p) return E_OUT_OF_MEMORY;
+    for (int i = 0; i < P2P_MAX_CRYPTO_WORKERS; i++) {
+        p->threads[i].pool = p;
+        p->threads[i].wake_rd = p->threads[i].wake_wr = P_INVALID_SOCKET;
+    }
+    if (P_mutex_init(&p->mtx) != 0) { p2p_free(p); return E_UNKNOWN; }
+    for (int i = 0; i < P2P_UDP_BATCH_SLOTS; i++) p->rx_jobs[i].out = p->rx_plain[i];
+    inst->crypto = p;
+
+    ret_t ret = E_NONE;
+    for (; p->thread_cnt < cnt; p->thread_cnt++) {
+        crypto_thread_t *t = &p->threads[p->thread_cnt];
+        if ((ret = wake_open(&t->wake_rd, &t->wake_wr)) != E_NONE) break;
+        if ((ret = P_thread(&t->thread, p2p_crypto_func, t, thread_prio(inst), 0)) != E_NONE) break;
+    }
+    if (ret != E_NONE) {
+        p2p_crypto_stop(inst);
+        return ret;
+    }
+
+    inst->crypto_rx = p->rx_jobs;
+    print("I:", LA_F("Started %d crypto worker threads", LA_F656, 656), cnt);
+    return E_NONE;
+}
+
+void p2p_crypto_run(struct p2p_instance *inst, p2p_aead_job_t *jobs, int cnt) {
+
+    p2p_crypto_pool_t *p = inst->crypto;
+    if (p && cnt >= CRYPTO_MIN_JOBS) {
+        P_mutex_lock(&p->mtx);
+        bool idle = !p->jobs;
+        if (idle) { p->jobs = jobs; p->cnt = cnt; p->next = 0; p->done = 0; }
+        P_mutex_unlock(&p->mtx);
+
+        if (idle) {
+            int wake = cnt / CRYPTO_MIN_JOBS;
+            if (wake > p->thread_cnt) wake = p->thread_cnt;
+            for (int i = 0; i < wake; i++) wake_signal(p->threads[i].wake_wr);
+            crypto_work(p);
+            while (__atomic_load_n(&p->done, __ATOMIC_ACQUIRE) < cnt) thread_yield();
+            P_mutex_lock(&p->mtx);
+            p->jobs = NULL;
+            P_mutex_unlock(&p->mtx);
+            return;
+        }
+    }
+    for (int i = 0; i < cnt; i++) p2p_aead_job_run(&jobs[i]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 共享执行器（p2p_executor_start / cfg.shared_executor）
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * 领导者 / 跟随者模型，全部线程对等：
+ *   - 就绪队列非空：取出一个实例执行一轮（持实例锁 p2p_update，收集下一轮的描述符与到期时间）
+ *   - 否则若无线程在 poll：成为轮询者，合并全部空闲实例的描述符（含各实例唤醒描述符）与执行器唤醒描述符，
+ *     阻塞至最近的到期时间；返回后就绪 / 到期的实例进入就绪队列
+ *   - 否则阻塞于任务描述符，等待轮询者交出就绪实例
+ * + 实例同时只处于一个状态（空闲 / 就绪 / 执行中），因此同一实例的调度串行
+ * + 实例执行完一轮后唤醒轮询者重新合并描述符；next_timeout 为 0 时直接回到就绪队列
+ */
+#define EXEC_IDLE       0           /* 描述符参与合并 poll */
+#define EXEC_READY      1           /* 在就绪队列中 */
+#define EXEC_BUSY       2           /* 某个线程正在执行 */
+
+typedef struct p2p_exec_node {
+    struct p2p_instance*            inst;
+    struct p2p_exec_node*           next;               // 登记链表
+    struct p2p_exec_node*           rnext;              // 就绪队列
+    struct pollfd                   fds[THREAD_MAX_POLL_FDS];   // 上一轮收集的描述符（fds[0] 为实例唤醒描述符）
+    int                             nfds;
+    uint64_t                        due;                // 下一轮最迟执行时间
+    int                             state;              // EXEC_*
+    bool                            polled;             // 描述符在当前轮询者的合并集合中
+    bool                            gone;               // 正在移出：不再合并与入队
+} exec_node_t;
+
+static struct {
+    P_mutex_t                       mtx;
+    int                             running;
+    int                             quit;
+    int                             thread_cnt;
+    thd_t                           threads[P2P_MAX_EXECUTOR_THREADS];
+    bool                            polling;            // 已有线程担任轮询者
+    sock_t                          wake_rd, wake_wr;   // 唤醒轮询者（登记变化、实例执行完一轮）
+    sock_t                          work_rd, work_wr;   // 唤醒跟随者（就绪队列非空、轮询者空缺）
+    exec_node_t*                    nodes;
+    exec_node_t*                    ready;
+    exec_node_t*                    ready_tail;
+    struct pollfd*                  pfds;               // 轮询者的合并集合
+    exec_node_t**                   powner;             // pfds[i] 所属实例（NULL = 执行器唤醒描述符）
+    int                             pcap;
+} g_exec = { .wake_rd = P_INVALID_SOCKET, .wake_wr = P_INVALID_SOCKET,
+             .work_rd = P_INVALID_SOCKET, .work_wr = P_INVALID_SOCKET };
+
+static void exec_push(exec_node_t *n) {
+    n->state = EXEC_READY;
+    n->rnext = NULL;
+    if (g_exec.ready_tail) g_exec.ready_tail->rnext = n; else g_exec.ready = n;
+    g_exec.ready_tail = n;
+}
+
+static exec_node_t *exec_pop(void) {
+    exec_node_t *n = g_exec.ready;
+    if (!n) return NULL;
+    g_exec.ready = n->rnext;
+    if (!g_exec.ready) g_exec.ready_tail = NULL;
+    n->state = EXEC_BUSY;
+    return n;
+}
+
+static void exec_unqueue(exec_node_t *n) {
+    for (exec_node_t **pp = &g_exec.ready; *pp; pp = &(*pp)->rnext) {
+        if (*pp != n) continue;
+        *pp = n->rnext;
+        if (g_exec.ready_tail == n) {
+            g_exec.ready_tail = NULL;
+            for (exec_node_t *p = g_exec.ready; p; p = p->rnext) g_exec.ready_tail = p;
+        }
+        break;
+    }
+    n->state = EXEC_IDLE;
+}
+
+/* 执行实例的一轮调度（不持执行器锁） */
+static void exec_service(exec_node_t *n) {
+    struct p2p_instance *inst = n->inst;
+    int nudp;
+
+    if (n->fds[0].revents & POLLIN) wake_drain(inst->wake_rd);
+    P_mutex_lock(&inst->mtx);
+    if (!inst->quit) p2p_update((p2p_handle_t)inst);
+    uint64_t now = P_tick_ms();
+    int ms = p2p_next_timeout(inst, now);
+    n->nfds = collect_fds(inst, n->fds, THREAD_MAX_POLL_FDS, &nudp);
+    P_mutex_unlock(&inst->mtx);
+    n->due = now + (uint64_t)(ms > 0 ? ms : 0);
+}
+
+/* 合并空闲实例的描述符（持执行器锁），返回描述符数；*ms 返回最近到期的等待时长 */
+static int exec_gather(uint64_t now, int *ms) {
+    int need = 1;
+    for (exec_node_t *n = g_exec.nodes; n; n = n->next) if (n->state == EXEC_IDLE && !n->gone) need += n->nfds;
+    if (need > g_exec.pcap) {
+        int cap = need + 64;
+        struct pollfd *p = (struct pollfd *)p2p_realloc(g_exec.pfds, sizeof(*p) * (size_t)cap);
+        if (p) g_exec.pfds = p;
+        exec_node_t **o = p ? (exec_node_t **)p2p_realloc(g_exec.powner, sizeof(*o) * (size_t)cap) : NULL;
+        if (o) { g_exec.powner = o; g_exec.pcap = cap; }
+    }
+
+    int cnt = 0;
+    g_exec.pfds[cnt].fd = g_exec.wake_rd; g_exec.pfds[cnt].events = POLLIN; g_exec.pfds[cnt].revents = 0;
+    g_exec.powner[cnt++] = NULL;
+
+    *ms = -1;
+    for (exec_node_t *n = g_exec.nodes; n; n = n->next) {
+        if (n->state != EXEC_IDLE || n->gone) continue;
+        if (cnt + n->nfds > g_exec.pcap) { *ms = 0; break; }     // 扩容失败：本轮不合并，稍后重试
+        int left = n->due > now ? (int)(n->due - now) : 0;
+        if (*ms < 0 || left < *ms) *ms = left;
+        n->polled = true;
+        for (int i = 0; i < n->nfds; i++) {
+            g_exec.pfds[cnt] = n->fds[i];
+            g_exec.pfds[cnt].revents = 0;
+            g_exec.powner[cnt++] = n;
+        }
+    }
+    return cnt;
+}
+
+/* 轮询返回后（持执行器锁）：描述符就绪或已到期的实例进入就绪队列 */
+static void exec_scatter(int cnt, uint64_t now) {
+    for (exec_node_t *n = g_exec.nodes; n; n = n->next) if (n->polled) n->fds[0].revents = 0;
+    for (int i = 1; i < cnt; i++) {
+        exec_node_t *n = g_exec.powner[i];
+        if (!g_exec.pfds[i].revents) continue;
+        // 实例唤醒描述符的就绪状态交给 exec_service 清空
+        if (g_exec.pfds[i].fd == n->inst->wake_rd) n->fds[0].revents = g_exec.pfds[i].revents;
+        if (n->state == EXEC_IDLE && !n->gone) exec_push(n);
+    }
+    for (exec_node_t *n = g_exec.nodes; n; n = n->next) {
+        if (!n->polled) continue;
+        n->polled = false;
+        if (n->state == EXEC_IDLE && !n->gone && n->due <= now) exec_push(n);
+    }
+}
+
+static int32_t p2p_executor_func(void *arg) {
+    (void)arg;
+
+    P_mutex_lock(&g_exec.mtx);
+    while (!g_exec.quit) {
+        exec_node_t *n = exec_pop();
+        if (n) {
+            // 还有就绪实例或轮询者空缺：交给下一个空闲线程
+            if (g_exec.ready || !g_exec.polling) wake_signal(g_exec.work_wr);
+            P_mutex_unlock(&g_exec.mtx);
+
+            exec_service(n);
+
+            P_mutex_lock(&g_exec.mtx);
+            if (n->due <= P_tick_ms() && !n->gone) exec_push(n);
+            else { n->state = EXEC_IDLE; wake_signal(g_exec.wake_wr); }
+            continue;
+        }
+
+        if (!g_exec.polling) {
+            g_exec.polling = true;
+            int ms, cnt = exec_gather(P_tick_ms(), &ms);
+            P_mutex_unlock(&g_exec.mtx);
+
+            int r = poll(g_exec.pfds, (unsigned)cnt, ms);
+            if (r > 0 && (g_exec.pfds[0].revents & POLLIN)) wake_drain(g_exec.wake_rd);
+
+            P_mutex_lock(&g_exec.mtx);
+            exec_scatter(r > 0 ? cnt : 0, P_tick_ms());
+            g_exec.polling = false;
+            continue;
+        }
+
+        P_mutex_unlock(&g_exec.mtx);
+        struct pollfd fd;
+        fd.fd = g_exec.work_rd; fd.events = POLLIN; fd.revents = 0;
+        if (poll(&fd, 1, -1) > 0 && (fd.revents & POLLIN)) wake_drain(g_exec.work_rd);
+        P_mutex_lock(&g_exec.mtx);
+    }
+    P_mutex_unlock(&g_exec.mtx);
+
+    return 0;
+}
+
+static void exec_close(void) {
+    wake_close(&g_exec.wake_rd, &g_exec.wake_wr);
+    wake_close(&g_exec.work_rd, &g_exec.work_wr);
+    p2p_free(g_exec.pfds); g_exec.pfds = NULL;
+    p2p_free(g_exec.powner); g_exec.powner = NULL;
+    g_exec.pcap = 0;
+    P_mutex_final(&g_exec.mtx);
+}
+
+void p2p_executor_stop(void) {
+    if (!g_exec.running) return;
+
+    P_mutex_lock(&g_exec.mtx);
+    g_exec.quit = 1;
+    P_mutex_unlock(&g_exec.mtx);
+    for (int i = 0; i < g_exec.thread_cnt; i++) {
+        wake_signal(g_exec.wake_wr);
+        wake_signal(g_exec.work_wr);
+    }
+    for (int i = 0; i < g_exec.thread_cnt; i++) P_join(g_exec.threads[i], NULL);
+    g_exec.thread_cnt = 0;
+    g_exec.running = 0;
+    exec_close();
+}
+
+int p2p_executor_start(int threads) {
+    if (g_exec.running || threads <= 0 || threads > P2P_MAX_EXECUTOR_THREADS) return -1;
+
+    if (P_mutex_init(&g_exec.mtx) != 0) return -1;
+    g_exec.quit = 0;
+    g_exec.polling = false;
+    g_exec.nodes = g_exec.ready = g_exec.ready_tail = NULL;
+    g_exec.pcap = 32;
+    g_exec.pfds = (struct pollfd *)p2p_malloc(sizeof(*g_exec.pfds) * (size_t)g_exec.pcap);
+    g_exec.powner = (exec_node_t **)p2p_malloc(sizeof(*g_exec.powner) * (size_t)g_exec.pcap);
+    if (!g_exec.pfds || !g_exec.powner
+        || wake_open(&g_exec.wake_rd, &g_exec.wake_wr) != E_NONE
+        || wake_open(&g_exec.work_rd, &g_exec.work_wr) != E_NONE) {
+        exec_close();
+        return -1;
+    }
+    g_exec.running = 1;
+    for (; g_exec.thread_cnt < threads; g_exec.thread_cnt++) {
+        if (P_thread(&g_exec.threads[g_exec.thread_cnt], p2p_executor_func, NULL, P_THD_NORMAL, 0) != E_NONE) {
+            p2p_executor_stop();
+            return -1;
+        }
+    }
+
+    print("I:", LA_F("Started shared executor with %d threads", LA_F675, 675), threads);
+    return 0;
+}
+
+/* 实例登记到共享执行器（p2p_thread_start 调用，实例锁与唤醒描述符已就绪） */
+static ret_t exec_register(struct p2p_instance *inst) {
+
+    exec_node_t *n = (exec_node_t *)p2p_calloc(1, sizeof(*n));
+    if (!n) return E_OUT_OF_MEMORY;
+    n->inst = inst;
+    n->fds[0].fd = inst->wake_rd; n->fds[0].events = POLLIN;
+    n->nfds = 1;
+
+    P_mutex_lock(&g_exec.mtx);
+    n->next = g_exec.nodes;
+    g_exec.nodes = n;
+    exec_push(n);                               // 立即执行第一轮
+    P_mutex_unlock(&g_exec.mtx);
+    wake_signal(g_exec.wake_wr);
+    wake_signal(g_exec.work_wr);
+
+    inst->exec = n;
+    return E_NONE;
+}
+
+/* 实例移出共享执行器：等待正在执行的一轮与包含其描述符的 poll 结束 */
+static void exec_unregister(struct p2p_instance *inst) {
+
+    exec_node_t *n = inst->exec;
+    P_mutex_lock(&g_exec.mtx);
+    n->gone = true;
+    for (;;) {
+        if (n->state == EXEC_READY) exec_unqueue(n);
+        if (n->state == EXEC_IDLE && !n->polled) break;
+        P_mutex_unlock(&g_exec.mtx);
+        wake_signal(g_exec.wake_wr);
+        thread_yield();
+        P_mutex_lock(&g_exec.mtx);
+    }
+    for (exec_node_t **pp = &g_exec.nodes; *pp; pp = &(*pp)->next)
+        if (*pp == n) { *pp = n->next; break; }
+    P_mutex_unlock(&g_exec.mtx);
+
+    p2p_free(n);
+    inst->exec = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
 ret_t p2p_thread_start(struct p2p_instance *inst) {
     inst->quit = 0;
+    inst->wake_rd = inst->wake_wr = P_INVALID_SOCKET;
     if (P_mutex_init(&inst->mtx) != 0)
         return -1;
-    ret_t ret = P_thread(&inst->thread, p2p_thread_func, inst, P_THD_NORMAL, 0);
+    ret_t ret = wake_open(&inst->wake_rd, &inst->wake_wr);
+    if (ret != E_NONE) {
+        P_mutex_final(&inst->mtx);
+        return ret;
+    }
+
+    // 共享执行器：只服务单线程调度、阻塞于 poll 的实例
+    if (inst->cfg.shared_executor) {
+        if (!g_exec.running)
+            print("W:", LA_F("shared executor not running, starting own thread", LA_F676, 676));
+        else if (inst->cfg.worker_count > 1 || inst->cfg.latency_mode || p2p_udp_iocp_on(inst))
+            print("I:", LA_F("worker_count/latency_mode/udp_iocp need own thread, not using shared executor", LA_F677, 677));
+        else if ((ret = p2p_crypto_start(inst)) != E_NONE || (ret = exec_register(inst)) != E_NONE) {
+            p2p_crypto_stop(inst);
+            wake_close(&inst->wake_rd, &inst->wake_wr);
+            P_mutex_final(&inst->mtx);
+            return ret;
+        }
+        else {
+            inst->thread_running = 1;
+            return E_NONE;
+        }
+    }
+    if ((ret = p2p_crypto_start(inst)) != E_NONE
+        || (inst->cfg.worker_count > 1 && (ret = workers_start(inst, inst->cfg.worker_count - 1)) != E_NONE)) {
+        p2p_crypto_stop(inst);
+        wake_close(&inst->wake_rd, &inst->wake_wr);
+        P_mutex_final(&inst->mtx);
+        return ret;
+    }
+    ret = P_thread(&inst->thread, p2p_thread_func, inst, thread_prio(inst), 0);
     if (ret != E_NONE) {
+        inst->quit = 1;
+        workers_join(inst, inst->worker_cnt);
+        inst->quit = 0;
+        p2p_crypto_stop(inst);
+        workers_free(inst, inst->worker_cnt);
+        wake_close(&inst->wake_rd, &inst->wake_wr);
         P_mutex_final(&inst->mtx);
         return ret;
     }
@@ -36,9 +967,25 @@ void p2p_thread_stop(struct p2p_instance *inst) {
     if (!inst->thread_running) return;
 
     inst->quit = 1;
-    P_join(inst->thread, NULL);
+    p2p_thread_wakeup(inst);
+    if (inst->exec) exec_unregister(inst);
+    else P_join(inst->thread, NULL);
+    workers_join(inst, inst->worker_cnt);
+    p2p_crypto_stop(inst);
+    wake_close(&inst->wake_rd, &inst->wake_wr);
     P_mutex_final(&inst->mtx);
     inst->thread_running = 0;
 }
 
+void p2p_thread_release(struct p2p_instance *inst) {
+    if (inst->workers) workers_free(inst, inst->worker_cnt);
+}
+
+#else /* !P2P_THREADED */
+
+#include "p2p_internal.h"
+
+int p2p_executor_start(int threads) { (void)threads; return -1; }
+void p2p_executor_stop(void) {}
+
 #endif /* P2P_THREADED */
@@ -1,14 +1,53 @@
-
 #ifndef P2P_THREAD_H
 #define P2P_THREAD_H
 
 #ifdef P2P_THREADED
 
 struct p2p_instance;
+struct p2p_session;
 
 ret_t  p2p_thread_start(struct p2p_instance *inst);
 void p2p_thread_stop(struct p2p_instance *inst);
 
+/* 释放会话分片资源（p2p_thread_stop 之后、全部会话释放之后调用） */
+void p2p_thread_release(struct p2p_instance *inst);
+
+/* 唤醒阻塞等待中的工作线程（任意线程可调用） */
+void p2p_thread_wakeup(struct p2p_instance *inst);
+
+/* 获取/释放全部锁：各分片锁（按序号递增）+ 实例锁 */
+void p2p_thread_lock_all(struct p2p_instance *inst);
+void p2p_thread_unlock_all(struct p2p_instance *inst);
+
+/* 新会话分配到会话数最少的分片（未启用分片时不做任何事；持实例锁调用） */
+void p2p_thread_assign(struct p2p_instance *inst, struct p2p_session *s);
+
+/* 会话移出所属分片：清除收件箱中残留的包（持全部锁调用） */
+void p2p_thread_detach(struct p2p_session *s);
+
+/* 唤醒会话分片线程（任意线程可调用） */
+void p2p_worker_wakeup(p2p_worker_t *w);
+
+/* 应用侧阻塞等待（p2p_waiter_t）：打开 / 关闭唤醒描述符，唤醒等待方，阻塞至被唤醒或超时（ms < 0 无限） */
+ret_t p2p_waiter_open(p2p_waiter_t *w);
+void p2p_waiter_close(p2p_waiter_t *w);
+void p2p_waiter_signal(p2p_waiter_t *w);
+void p2p_waiter_block(p2p_waiter_t *w, int ms);
+
+/* 主线程收包派发：复制数据包到分片收件箱（持实例锁调用） */
+void p2p_worker_post(p2p_worker_t *w, struct p2p_session *s, bool stun,
+                     const uint8_t *pkt, int len, const struct sockaddr_in *from, uint64_t rx_us, uint8_t ecn);
+
+/* 启动 / 停止加密线程池（cfg.crypto_workers，仅 dtls_backend = 3；由 p2p_thread_start / p2p_thread_stop 调用） */
+ret_t p2p_crypto_start(struct p2p_instance *inst);
+void p2p_crypto_stop(struct p2p_instance *inst);
+
+/*
+ * 执行一批 AEAD 任务（任意线程调用，返回时全部完成）
+ * + 加密线程池空闲且批次足够大时分发到池中并行执行，调用线程同时参与；否则在调用线程内逐个执行
+ */
+void p2p_crypto_run(struct p2p_instance *inst, p2p_aead_job_t *jobs, int cnt);
+
 #endif /* P2P_THREADED */
 
 #endif /* P2P_THREAD_H */
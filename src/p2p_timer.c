@@ -0,0 +1,161 @@
+/*
+ * 分层时间轮实现（见 p2p_timer.h）
+ */
+
+#include "p2p_timer.h"
+
+#define L0_MASK         (TIMER_L0_SIZE - 1)
+#define LN_MASK         (TIMER_LN_SIZE - 1)
+#define L1_SPAN         ((uint64_t)1 << (TIMER_L0_BITS + TIMER_LN_BITS))       /* 第 1 层总跨度（ms） */
+#define L2_SPAN         ((uint64_t)1 << (TIMER_L0_BITS + 2 * TIMER_LN_BITS))   /* 第 2 层总跨度（ms） */
+#define L1_SLOT(t)      (TIMER_L0_SIZE + (int)(((t) >> TIMER_L0_BITS) & LN_MASK))
+#define L2_SLOT(t)      (TIMER_L0_SIZE + TIMER_LN_SIZE + (int)(((t) >> (TIMER_L0_BITS + TIMER_LN_BITS)) & LN_MASK))
+
+static void list_link(p2p_timer_t **head, p2p_timer_t *t) {
+    t->next = *head;
+    if (t->next) t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+}
+
+static void list_unlink(p2p_timer_t *t) {
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+/* 第 0 层自 idx 起首个非空槽位，无则为 -1 */
+static int l0_next(const p2p_timer_wheel_t *w, int idx) {
+    for (int i = idx >> 6; i < TIMER_L0_SIZE / 64; i++) {
+        uint64_t bits = w->l0_map[i];
+        if (i == idx >> 6) bits &= ~(uint64_t)0 << (idx & 63);
+        if (!bits) continue;
+        int n = 0;
+        while (!(bits & 1)) { bits >>= 1; n++; }
+        return i * 64 + n;
+    }
+    return -1;
+}
+
+/* 按距时间轮当前时刻的跨度选择层级与槽位 */
+static void wheel_link(p2p_timer_wheel_t *w, p2p_timer_t *t) {
+    uint64_t expire = t->expire < w->now ? w->now : t->expire;
+    uint64_t delta = expire - w->now;
+    int slot;
+
+    if (delta < TIMER_L0_SIZE) {
+        slot = (int)(expire & L0_MASK);
+        w->l0_map[slot >> 6] |= (uint64_t)1 << (slot & 63);
+    } else if (delta < L1_SPAN) {
+        slot = L1_SLOT(expire);
+    } else {
+        if (delta >= L2_SPAN) expire = w->now + L2_SPAN - 1;
+        slot = L2_SLOT(expire);
+    }
+
+    list_link(&w->slots[slot], t);
+    t->slot = slot;
+    w->count++;
+}
+
+static void wheel_unlink(p2p_timer_wheel_t *w, p2p_timer_t *t) {
+    int slot = t->slot;
+    list_unlink(t);
+    t->slot = TIMER_SLOT_NONE;
+    w->count--;
+    if (slot < TIMER_L0_SIZE && !w->slots[slot])
+        w->l0_map[slot >> 6] &= ~((uint64_t)1 << (slot & 63));
+}
+
+/* 高层槽位整体下放：按真实到期时间重新挂入 */
+static void cascade(p2p_timer_wheel_t *w, int slot) {
+    p2p_timer_t *t = w->slots[slot], *next;
+    w->slots[slot] = NULL;
+    for (; t; t = next) {
+        next = t->next;
+        t->next = NULL;
+        t->pprev = NULL;
+        t->slot = TIMER_SLOT_NONE;
+        w->count--;
+        wheel_link(w, t);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void p2p_timer_wheel_init(p2p_timer_wheel_t *w, uint64_t now) {
+    memset(w, 0, sizeof(*w));
+    w->now = now;
+}
+
+void p2p_timer_add(p2p_timer_wheel_t *w, p2p_timer_t *t, uint64_t expire) {
+    p2p_timer_del(w, t);
+    t->expire = expire;
+    if (expire >= w->now) wheel_link(w, t);
+    else {
+        // 所在时刻已处理过：直接到期
+        list_link(&w->due, t);
+        t->slot = TIMER_SLOT_DUE;
+    }
+}
+
+void p2p_timer_del(p2p_timer_wheel_t *w, p2p_timer_t *t) {
+    if (t->slot == TIMER_SLOT_NONE) return;
+    if (t->slot == TIMER_SLOT_DUE) {
+        list_unlink(t);
+        t->slot = TIMER_SLOT_NONE;
+    }
+    else wheel_unlink(w, t);
+}
+
+/*
+ * 逐毫秒推进，但第 0 层按位图直接跳到下一个非空槽位；
+ * 跳跃不越过 256ms 块边界，保证高层槽位按时下放
+ */
+void p2p_timer_advance(p2p_timer_wheel_t *w, uint64_t now) {
+
+    while (w->now <= now) {
+
+        if (!w->count) { w->now = now + 1; break; }
+
+        int idx = (int)(w->now & L0_MASK);
+        if (!idx) {
+            if (!(w->now & (L1_SPAN - 1))) cascade(w, L2_SLOT(w->now));
+            cascade(w, L1_SLOT(w->now));
+        }
+
+        // 当前槽位的定时器全部到期
+        p2p_timer_t *t;
+        while ((t = w->slots[idx]) != NULL) {
+            wheel_unlink(w, t);
+            list_link(&w->due, t);
+            t->slot = TIMER_SLOT_DUE;
+        }
+
+        uint64_t next = (w->now | L0_MASK) + 1;
+        int n = idx < L0_MASK ? l0_next(w, idx + 1) : -1;
+        if (n >= 0) next = (w->now & ~(uint64_t)L0_MASK) + (uint64_t)n;
+        w->now = next < now + 1 ? next : now + 1;
+    }
+}
+
+p2p_timer_t *p2p_timer_pop(p2p_timer_wheel_t *w) {
+    p2p_timer_t *t = w->due;
+    if (!t) return NULL;
+    list_unlink(t);
+    t->slot = TIMER_SLOT_NONE;
+    return t;
+}
+
+int p2p_timer_next_timeout(const p2p_timer_wheel_t *w, uint64_t now) {
+
+    if (w->due) return 0;
+    if (!w->count) return -1;
+
+    // 第 0 层本块内的首个非空槽位即精确到期时刻；否则以下一次下放（块边界）为准
+    int n = l0_next(w, (int)(w->now & L0_MASK));
+    uint64_t at = n >= 0 ? (w->now & ~(uint64_t)L0_MASK) + (uint64_t)n : (w->now | L0_MASK) + 1;
+    if (at <= now) return 0;
+    return at - now > INT32_MAX ? INT32_MAX : (int)(at - now);
+}
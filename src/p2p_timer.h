@@ -0,0 +1,64 @@
+/*
+ * 分层时间轮（实例级会话定时器）
+ *
+ * 每个会话挂一个定时器节点，到期时间为其各模块（NAT、路径管理、reliable、流、传输层）
+ * 下一截止时刻的最小值。p2p_update 只处理到期或被提前唤醒的会话，空闲会话不再逐轮扫描。
+ *
+ *   - 第 0 层 256 槽，精度 1ms（跨度 256ms），按占用位图跳过空槽
+ *   - 第 1、2 层各 64 槽，粒度逐层 x64（跨度约 16s / 17min），跨越边界时逐级下放（cascade）
+ *   - 超出总跨度的定时器挂在第 2 层最远槽位，下放时按真实到期时间重新挂入
+ *   - 到期节点移入 due 链表，由调用方逐个取出；节点可随时删除或重新调度
+ */
+
+#ifndef P2P_TIMER_H
+#define P2P_TIMER_H
+
+#include "predefine.h"
+
+#define TIMER_L0_BITS       8
+#define TIMER_LN_BITS       6
+#define TIMER_L0_SIZE       (1 << TIMER_L0_BITS)
+#define TIMER_LN_SIZE       (1 << TIMER_LN_BITS)
+#define TIMER_SLOTS         (TIMER_L0_SIZE + 2 * TIMER_LN_SIZE)
+#define TIMER_SLOT_DUE      TIMER_SLOTS                     /* 已到期，位于 due 链表 */
+#define TIMER_SLOT_NONE     (-1)                            /* 未挂入 */
+
+typedef struct p2p_timer {
+    struct p2p_timer       *next;
+    struct p2p_timer      **pprev;              // 指向前驱的 next（或链表头）
+    uint64_t                expire;             // 到期时刻（ms）
+    int                     slot;               // 所在槽位（TIMER_SLOT_NONE = 未挂入）
+} p2p_timer_t;
+
+typedef struct p2p_timer_wheel {
+    uint64_t                now;                // 下一个待处理的时刻（ms），此前的槽位均已处理
+    int                     count;              // 挂入时间轮（不含 due）的定时器数量
+    uint64_t                l0_map[TIMER_L0_SIZE / 64]; // 第 0 层槽位占用位图
+    p2p_timer_t            *slots[TIMER_SLOTS]; // 0~255 为第 0 层，之后依次为第 1、2 层
+    p2p_timer_t            *due;                // 已到期待处理的定时器
+} p2p_timer_wheel_t;
+
+static inline void p2p_timer_node_init(p2p_timer_t *t) {
+    t->next = NULL; t->pprev = NULL; t->slot = TIMER_SLOT_NONE;
+}
+
+static inline bool p2p_timer_pending(const p2p_timer_t *t) {
+    return t->slot != TIMER_SLOT_NONE;
+}
+
+void p2p_timer_wheel_init(p2p_timer_wheel_t *w, uint64_t now);
+
+/* 调度（或重新调度）到 expire；时间轮已推进过的时刻直接进入 due */
+void p2p_timer_add(p2p_timer_wheel_t *w, p2p_timer_t *t, uint64_t expire);
+void p2p_timer_del(p2p_timer_wheel_t *w, p2p_timer_t *t);
+
+/* 推进到 now（含），把到期定时器移入 due 链表 */
+void p2p_timer_advance(p2p_timer_wheel_t *w, uint64_t now);
+
+/* 取出一个已到期的定时器（无则为 NULL） */
+p2p_timer_t *p2p_timer_pop(p2p_timer_wheel_t *w);
+
+/* 距下一个可能到期的时刻的毫秒数（有已到期为 0，空时间轮为 -1；高层只给出下放时刻，可能偏早） */
+int p2p_timer_next_timeout(const p2p_timer_wheel_t *w, uint64_t now);
+
+#endif /* P2P_TIMER_H */
@@ -0,0 +1,166 @@
+/*
+ * 结构化事件追踪实现，事件与格式见 p2p_trace.h
+ *
+ * 环形缓冲区为有界多生产者队列：每个槽位带序号 turn，生产者 CAS 推进 head 占位后写入记录，
+ * 再以 release 语义发布 turn；消费者按 tail 顺序读取 turn 已发布的槽位，读完把 turn 推进一圈归还。
+ */
+
+#define MOD_TAG "TRACE"
+
+#include "p2p_internal.h"
+#include "p2p_trace.h"
+
+#define RING_MASK   (P2P_TRACE_RING - 1)
+
+#if P2P_TRACE_RING & RING_MASK
+#error "P2P_TRACE_RING must be a power of two"
+#endif
+
+ret_t p2p_trace_open(struct p2p_instance *inst, const char *path) {
+
+    P_check(inst && path && *path, return E_INVALID;)
+
+    p2p_trace_t *t = (p2p_trace_t *)p2p_calloc(1, sizeof(*t));
+    if (!t) return E_OUT_OF_MEMORY;
+    if (!(t->ring = (p2p_trace_ev_t *)p2p_calloc(P2P_TRACE_RING, sizeof(*t->ring)))) { p2p_free(t); return E_OUT_OF_MEMORY; }
+    if (!(t->fp = fopen(path, "a"))) {
+        print("W:", LA_F("%s: cannot open '%s'", LA_F603, 603), MOD_TAG, path);
+        p2p_free(t->ring); p2p_free(t);
+        return E_UNKNOWN;
+    }
+    for (uint32_t i = 0; i < P2P_TRACE_RING; i++) t->ring[i].turn = i;
+
+    inst->trace = t;
+    print("I:", LA_F("%s: writing events to '%s'", LA_F604, 604), MOD_TAG, path);
+    return E_NONE;
+}
+
+void p2p_trace_close(struct p2p_instance *inst) {
+    p2p_trace_t *t = inst->trace;
+    if (!t) return;
+    p2p_trace_flush(inst);
+    inst->trace = NULL;
+    fclose(t->fp);
+    p2p_free(t->ring);
+    p2p_free(t);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void p2p_trace_emit(struct p2p_instance *inst, uint32_t sess, int ev, int type, int seq,
+                    int a, int b, int c, int d, const char *str) {
+
+    p2p_trace_t *t = inst->trace;
+    p2p_trace_ev_t *e;
+    uint32_t pos = __atomic_load_n(&t->head, __ATOMIC_RELAXED);
+    for (;;) {
+        e = &t->ring[pos & RING_MASK];
+        int32_t dif = (int32_t)(__atomic_load_n(&e->turn, __ATOMIC_ACQUIRE) - pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&t->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        }
+        else if (dif < 0) {                                 // 一整圈之前的事件尚未被取走：缓冲区满
+            __atomic_fetch_add(&t->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else pos = __atomic_load_n(&t->head, __ATOMIC_RELAXED);
+    }
+
+    e->ts_us = P_tick_us();
+    e->ev = (uint8_t)ev;
+    e->type = (uint8_t)type;
+    e->seq = (uint16_t)seq;
+    e->sess = sess;
+    e->a = a; e->b = b; e->c = c; e->d = d;
+    e->str = str;
+    __atomic_store_n(&e->turn, pos + 1, __ATOMIC_RELEASE);
+}
+
+void p2p_trace_cwnd(struct p2p_session *s, int64_t cwnd, int64_t ssthresh) {
+    if (!s->inst->trace || cwnd == s->trace_cwnd) return;
+    s->trace_cwnd = cwnd;
+    P2P_TRACE(s, P2P_TRACE_CWND, 0, 0, cwnd > INT32_MAX ? INT32_MAX : (int)cwnd,
+              ssthresh > INT32_MAX ? INT32_MAX : (int)ssthresh, 0, 0, NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static const char *pkt_name(int type) {
+    switch (type) {
+    case P2P_PKT_PUNCH:         return "PUNCH";
+    case P2P_PKT_REACH:         return "REACH";
+    case P2P_PKT_CONN:          return "CONN";
+    case P2P_PKT_CONN_ACK:      return "CONN_ACK";
+    case P2P_PKT_FIN:           return "FIN";
+    case P2P_PKT_BIND_PROBE:    return "BIND_PROBE";
+    case P2P_PKT_PMTU_PROBE:    return "PMTU_PROBE";
+    case P2P_PKT_DATA:          return "DATA";
+    case P2P_PKT_ACK:           return "ACK";
+    case P2P_PKT_CRYPTO:        return "CRYPTO";
+    case P2P_PKT_DGRAM:         return "DGRAM";
+    case P2P_PKT_BULK:          return "BULK";
+    case P2P_PKT_FEC:           return "FEC";
+    case P2P_PKT_BUNDLE:        return "BUNDLE";
+    default:                    return NULL;
+    }
+}
+
+static void ev_write(FILE *fp, const p2p_trace_ev_t *e) {
+
+    fprintf(fp, "{\"t\":%llu,\"s\":%u,", (unsigned long long)e->ts_us, e->sess);
+    switch (e->ev) {
+    case P2P_TRACE_PKT_TX:
+    case P2P_TRACE_PKT_RX: {
+        const char *name = pkt_name(e->type);
+        fprintf(fp, "\"ev\":\"%s\",", e->ev == P2P_TRACE_PKT_TX ? "pkt_tx" : "pkt_rx");
+        if (name) fprintf(fp, "\"type\":\"%s\",", name);
+        else fprintf(fp, "\"type\":%u,", e->type);
+        fprintf(fp, "\"seq\":%u,\"len\":%d", e->seq, e->a);
+        if (e->ev == P2P_TRACE_PKT_TX) fprintf(fp, ",\"path\":%d", e->b);
+        break;
+    }
+    case P2P_TRACE_RTT:
+        fprintf(fp, "\"ev\":\"rtt\",\"rtt\":%d,\"srtt\":%d,\"rttvar\":%d,\"rto\":%d", e->a, e->b, e->c, e->d);
+        break;
+    case P2P_TRACE_CWND:
+        fprintf(fp, "\"ev\":\"cwnd\",\"cwnd\":%d,\"ssthresh\":%d", e->a, e->b);
+        break;
+    case P2P_TRACE_RETX:
+        fprintf(fp, "\"ev\":\"retx\",\"seq\":%u,\"reason\":\"%s\"", e->seq, e->str ? e->str : "");
+        break;
+    case P2P_TRACE_PATH:
+        fprintf(fp, "\"ev\":\"path\",\"from\":%d,\"to\":%d,\"reason\":\"%s\"", e->a, e->b, e->str ? e->str : "");
+        break;
+    case P2P_TRACE_STATE:
+        fprintf(fp, "\"ev\":\"state\",\"from\":%d,\"to\":%d", e->a, e->b);
+        break;
+    case P2P_TRACE_SIG:
+        fprintf(fp, "\"ev\":\"sig\",\"what\":\"%s\"", e->str ? e->str : "");
+        break;
+    default:
+        fprintf(fp, "\"ev\":%u", e->ev);
+        break;
+    }
+    fputs("}\n", fp);
+}
+
+void p2p_trace_flush(struct p2p_instance *inst) {
+    p2p_trace_t *t = inst->trace;
+    if (!t) return;
+
+    int n = 0;
+    for (;; t->tail++, n++) {
+        p2p_trace_ev_t *e = &t->ring[t->tail & RING_MASK];
+        if (__atomic_load_n(&e->turn, __ATOMIC_ACQUIRE) != t->tail + 1) break;
+        ev_write(t->fp, e);
+        __atomic_store_n(&e->turn, t->tail + P2P_TRACE_RING, __ATOMIC_RELEASE);
+    }
+
+    uint32_t dropped = __atomic_load_n(&t->dropped, __ATOMIC_RELAXED);
+    if (dropped != t->dropped_out) {
+        t->dropped_out = dropped;
+        fprintf(t->fp, "{\"t\":%llu,\"ev\":\"dropped\",\"n\":%u}\n", (unsigned long long)P_tick_us(), dropped);
+        n++;
+    }
+    if (n) fflush(t->fp);
+}
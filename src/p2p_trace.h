@@ -0,0 +1,89 @@
+/*
+ * 结构化事件追踪（cfg.trace_file，NDJSON，用于离线分析连接耗时与吞吐）
+ *
+ * 建连耗时异常或吞吐骤降时，自由文本日志难以还原时间线。启用后关键事件以定长记录写入实例级无锁
+ * 环形缓冲区（多生产者：主工作线程、会话分片线程、应用线程），由主工作线程在每轮 update 的控制阶段
+ * 取出并格式化，每行一个 JSON 对象追加到文件：
+ *
+ *   {"t":<微秒>,"s":<会话 id>,"ev":"<事件>",...}
+ *
+ *   事件        附加字段
+ *   pkt_tx      type seq len path              经 p2p_send_packet 发出的 P2P 包（超出路径上限的 DATA 按分段记录）
+ *   pkt_rx      type seq len                   nat_proto 收到的 P2P 包（CRYPTO 为解密前）
+ *   rtt         rtt srtt rttvar rto            reliable 层 RTT 样本（毫秒）
+ *   cwnd        cwnd ssthresh                  拥塞窗口变化（字节，PseudoTCP / BBR）
+ *   retx        seq reason                     DATA 重传：fast（RACK）/ rto / migrate（路径迁移重发）
+ *   path        from to reason                 路径切换（路径索引，-1 = 信令中转）
+ *   state       from to                        会话状态变化（P2P_STATE_*）
+ *   sig         what                           信令里程碑：punch_start / cands_done / nat_connected
+ *   dropped     n                              缓冲区满丢弃的累计事件数（有新增时输出）
+ *
+ * + 未启用时 inst->trace 为 NULL，埋点只多一次指针判断；启用后每个事件为一次 CAS 与定长写入，
+ *   格式化与文件写入不在收发路径上
+ * + 缓冲区满（主工作线程阻塞或事件过密）时丢弃新事件，不阻塞生产者
+ */
+
+#ifndef P2P_TRACE_H
+#define P2P_TRACE_H
+
+#include "predefine.h"
+
+struct p2p_instance;
+struct p2p_session;
+
+#define P2P_TRACE_RING          8192        /* 环形缓冲区事件数（2 的幂） */
+
+enum {
+    P2P_TRACE_PKT_TX = 1,
+    P2P_TRACE_PKT_RX,
+    P2P_TRACE_RTT,
+    P2P_TRACE_CWND,
+    P2P_TRACE_RETX,
+    P2P_TRACE_PATH,
+    P2P_TRACE_STATE,
+    P2P_TRACE_SIG,
+};
+
+/* 定长事件记录（str 只能指向静态字符串） */
+typedef struct {
+    uint32_t                turn;           // 槽位序号：== 写入位置时可写，== 写入位置 + 1 时可读
+    uint8_t                 ev;             // P2P_TRACE_*
+    uint8_t                 type;           // 包类型
+    uint16_t                seq;
+    uint32_t                sess;           // 会话 id
+    int32_t                 a, b, c, d;     // 事件相关数值，含义见文件头表格
+    const char*             str;
+    uint64_t                ts_us;
+} p2p_trace_ev_t;
+
+typedef struct p2p_trace {
+    FILE*                   fp;
+    p2p_trace_ev_t*         ring;
+    uint32_t                head;           // 生产者写入位置（CAS 推进）
+    uint32_t                tail;           // 消费者读取位置（仅主工作线程）
+    uint32_t                dropped;        // 缓冲区满丢弃的事件数
+    uint32_t                dropped_out;    // 已输出到文件的丢弃数
+} p2p_trace_t;
+
+/* 打开追踪文件（追加写入）并分配缓冲区 */
+ret_t p2p_trace_open(struct p2p_instance *inst, const char *path);
+
+/* 输出剩余事件并关闭 */
+void  p2p_trace_close(struct p2p_instance *inst);
+
+/* 消费者：取出全部已写入事件并格式化到文件（主工作线程，update 控制阶段与关闭时） */
+void  p2p_trace_flush(struct p2p_instance *inst);
+
+/* 生产者：写入一个事件，缓冲区满时丢弃 */
+void  p2p_trace_emit(struct p2p_instance *inst, uint32_t sess, int ev, int type, int seq,
+                     int a, int b, int c, int d, const char *str);
+
+/* 拥塞窗口与上次记录不同时写入 cwnd 事件 */
+void  p2p_trace_cwnd(struct p2p_session *s, int64_t cwnd, int64_t ssthresh);
+
+/* 会话事件埋点：未启用追踪时只有一次指针判断 */
+#define P2P_TRACE(s, ev, type, seq, a, b, c, d, str) do { \
+    if ((s)->inst->trace) p2p_trace_emit((s)->inst, (s)->id, (ev), (type), (seq), (a), (b), (c), (d), (str)); \
+} while (0)
+
+#endif /* P2P_TRACE_H */
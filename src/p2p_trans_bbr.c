@@ -0,0 +1,227 @@
+
+#define MOD_TAG "BBR"
+
+#include "p2p_internal.h"
+
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * BBR（Bottleneck Bandwidth and RTT）拥塞控制
+ *
+ * 与 PseudoTCP 的 AIMD 不同，BBR 不把丢包当作拥塞信号，而是根据交付速率样本
+ * 对链路建模：
+ *   - btl_bw:  瓶颈带宽 = 最近 BBR_BW_ROUNDS 轮交付速率的最大值
+ *   - min_rtt: 最小 RTT = 最近 BBR_MIN_RTT_WIN_MS 内 RTT 样本的最小值
+ *   - BDP = btl_bw * min_rtt
+ *
+ * 发送控制：
+ *   - 速率 pacing_rate = pacing_gain * btl_bw（通过 reliable 令牌桶执行）
+ *   - 窗口 cwnd = cwnd_gain * BDP（限制在途字节数）
+ *
+ * 状态机：
+ *   STARTUP ──满管──→ DRAIN ──在途≤BDP──→ PROBE_BW ⇄ PROBE_RTT（min_rtt 过期）
+ *
+ * 重传、RACK 丢包检测、ACK 等机制完全复用基础 reliable 层。
+ */
+
+#define MSS                 P2P_MAX_PAYLOAD
+#define BBR_UNIT            1000        /* 增益千分比基准 */
+#define BBR_HIGH_GAIN       2885        /* 2/ln2：STARTUP 每轮速率翻倍 */
+#define BBR_DRAIN_GAIN      347         /* 1/BBR_HIGH_GAIN */
+#define BBR_CWND_GAIN       2000        /* PROBE_BW 窗口增益 */
+#define BBR_MIN_RTT_WIN_MS  10000       /* min_rtt 有效期 */
+#define BBR_PROBE_RTT_MS    200         /* PROBE_RTT 持续时间 */
+#define BBR_MIN_CWND        (4 * MSS)   /* 最小窗口 */
+#define BBR_INIT_CWND       (10 * MSS)  /* 初始窗口（IW10） */
+#define BBR_FULL_BW_THRESH  1250        /* 带宽增长不足 25% 视为满管 */
+#define BBR_FULL_BW_ROUNDS  3
+
+/* PROBE_BW 增益周期：探测 → 排空 → 6 轮巡航 */
+static const int bbr_cycle_gain[8] = { 1250, 750, 1000, 1000, 1000, 1000, 1000, 1000 };
+
+static int64_t bbr_bdp(const bbr_t *b, int gain) {
+    if (!b->btl_bw || !b->min_rtt) return BBR_INIT_CWND;
+    return b->btl_bw * b->min_rtt / 1000 * gain / BBR_UNIT;
+}
+
+static void bbr_enter(struct p2p_session *s, bbr_state_t state, uint64_t now) {
+    bbr_t *b = &s->bbr;
+    b->state = state;
+    switch (state) {
+    case BBR_STARTUP:
+        b->pacing_gain = BBR_HIGH_GAIN;
+        b->cwnd_gain = BBR_HIGH_GAIN;
+        break;
+    case BBR_DRAIN:
+        b->pacing_gain = BBR_DRAIN_GAIN;
+        b->cwnd_gain = BBR_HIGH_GAIN;
+        break;
+    case BBR_PROBE_BW:
+        b->cycle_idx = 2;               // 从巡航阶段开始，避免刚排空又立即加速
+        b->cycle_ts = now;
+        b->pacing_gain = bbr_cycle_gain[b->cycle_idx];
+        b->cwnd_gain = BBR_CWND_GAIN;
+        break;
+    case BBR_PROBE_RTT:
+        b->pacing_gain = BBR_UNIT;
+        b->cwnd_gain = BBR_UNIT;
+        b->prior_cwnd = b->cwnd;
+        b->probe_rtt_done_ts = 0;
+        break;
+    }
+    print("V:", LA_F("BBR state=%d btl_bw=%lld B/s min_rtt=%d cwnd=%lld", LA_F478, 478),
+          (int)state, (long long)b->btl_bw, b->min_rtt, (long long)b->cwnd);
+}
+
+static void bbr_init_state(struct p2p_session *s) {
+    bbr_t *b = &s->bbr;
+    memset(b, 0, sizeof(*b));
+    b->cwnd = BBR_INIT_CWND;
+    bbr_enter(s, BBR_STARTUP, 0);
+}
+
+/* 轮次与瓶颈带宽（取最近 BBR_BW_ROUNDS 轮的最大交付速率） */
+static bool bbr_update_bw(struct p2p_session *s) {
+    bbr_t *b = &s->bbr;
+    const reliable_t *r = &s->reliable;
+
+    bool round_start = false;
+    if (r->rs_prior >= b->next_round_dlv) {
+        b->next_round_dlv = r->delivered;
+        b->round_cnt++;
+        b->bw_round[b->round_cnt % BBR_BW_ROUNDS] = 0;
+        round_start = true;
+    }
+
+    int64_t *slot = &b->bw_round[b->round_cnt % BBR_BW_ROUNDS];
+    if (r->rs_rate > *slot) *slot = r->rs_rate;
+
+    b->btl_bw = 0;
+    for (int i = 0; i < BBR_BW_ROUNDS; i++)
+        if (b->bw_round[i] > b->btl_bw) b->btl_bw = b->bw_round[i];
+    return round_start;
+}
+
+/* STARTUP 满管检测：连续 3 轮带宽增长不足 25% */
+static void bbr_check_full_pipe(bbr_t *b, bool round_start) {
+    if (b->full_pipe || !round_start) return;
+    if (b->btl_bw >= b->full_bw * BBR_FULL_BW_THRESH / BBR_UNIT) {
+        b->full_bw = b->btl_bw;
+        b->full_bw_cnt = 0;
+        return;
+    }
+    if (++b->full_bw_cnt >= BBR_FULL_BW_ROUNDS) b->full_pipe = true;
+}
+
+void p2p_bbr_on_ack(struct p2p_session *s, uint64_t now) {
+    bbr_t *b = &s->bbr;
+    reliable_t *r = &s->reliable;
+    if (!b->cwnd) return;   // 未初始化
+
+    int64_t acked = (int64_t)(r->delivered - b->last_delivered);
+    b->last_delivered = r->delivered;
+
+    bool round_start = bbr_update_bw(s);
+
+    // min_rtt：新低或过期时更新；过期则进入 PROBE_RTT
+    bool rtt_expired = b->min_rtt && tick_diff(now, b->min_rtt_ts) > BBR_MIN_RTT_WIN_MS;
+    if (r->rs_rtt >= 0 && (!b->min_rtt || r->rs_rtt < b->min_rtt || rtt_expired)) {
+        b->min_rtt = r->rs_rtt > 0 ? r->rs_rtt : 1;
+        b->min_rtt_ts = now;
+    }
+
+    int64_t inflight = reliable_inflight_bytes(s);
+    switch (b->state) {
+    case BBR_STARTUP:
+        bbr_check_full_pipe(b, round_start);
+        if (b->full_pipe) bbr_enter(s, BBR_DRAIN, now);
+        break;
+    case BBR_DRAIN:
+        if (inflight <= bbr_bdp(b, BBR_UNIT)) bbr_enter(s, BBR_PROBE_BW, now);
+        break;
+    case BBR_PROBE_BW:
+        if (tick_diff(now, b->cycle_ts) > (uint64_t)b->min_rtt) {
+            b->cycle_idx = (b->cycle_idx + 1) % 8;
+            b->cycle_ts = now;
+            b->pacing_gain = bbr_cycle_gain[b->cycle_idx];
+        }
+        break;
+    case BBR_PROBE_RTT:
+        if (!b->probe_rtt_done_ts && inflight <= BBR_MIN_CWND)
+            b->probe_rtt_done_ts = now + BBR_PROBE_RTT_MS;
+        else if (b->probe_rtt_done_ts && now >= b->probe_rtt_done_ts) {
+            b->min_rtt_ts = now;
+            if (b->cwnd < b->prior_cwnd) b->cwnd = b->prior_cwnd;
+            bbr_enter(s, b->full_pipe ? BBR_PROBE_BW : BBR_STARTUP, now);
+        }
+        break;
+    }
+    if (b->state != BBR_PROBE_RTT && rtt_expired)
+        bbr_enter(s, BBR_PROBE_RTT, now);
+
+    // 窗口：满管前随交付量增长，之后向目标 cwnd_gain * BDP 收敛
+    int64_t target = bbr_bdp(b, b->cwnd_gain);
+    if (b->full_pipe) b->cwnd = b->cwnd + acked < target ? b->cwnd + acked : target;
+    else if (b->cwnd < target || !b->btl_bw) b->cwnd += acked;
+    if (b->state == BBR_PROBE_RTT && b->cwnd > BBR_MIN_CWND) b->cwnd = BBR_MIN_CWND;
+    if (b->cwnd < BBR_MIN_CWND) b->cwnd = BBR_MIN_CWND;
+
+    // 速率：STARTUP 中不降速（样本可能受应用层限制而偏低）
+    int64_t rate = b->btl_bw * b->pacing_gain / BBR_UNIT;
+    if (rate > 0 && (b->full_pipe || rate > r->pace_rate)) r->pace_rate = rate;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static int bbr_init(struct p2p_session *s) {
+    bbr_init_state(s);
+    s->reliable.pace_rate = 0;      // 首个样本前不限速，由初始窗口约束突发
+    return 0;
+}
+
+static void bbr_close(struct p2p_session *s) {
+    memset(&s->bbr, 0, sizeof(s->bbr));
+    s->reliable.pace_rate = 0;
+}
+
+/* 路径迁移：瓶颈带宽与 min_rtt 属于旧路径，从 STARTUP 重建模型 */
+static void bbr_migrate(struct p2p_session *s) {
+    bbr_init(s);
+}
+
+static void bbr_tick(struct p2p_session *s) {
+    // 会话重置（reliable_init）后交付计数归零，同步重建模型
+    if (s->reliable.delivered < s->bbr.last_delivered) bbr_init(s);
+    reliable_tick_cwnd(s, s->bbr.cwnd);
+}
+
+static int bbr_is_ready(struct p2p_session *s) {
+    return (s->state == P2P_STATE_CONNECTED || s->state == P2P_STATE_RELAY);
+}
+
+/*
+ * 获取传输层统计
+ * 丢包不参与 BBR 控制，这里按 RACK/RTO 重传无从区分，上报 0
+ */
+static int bbr_get_stats(struct p2p_session *s, uint32_t *rtt_ms, float *loss_rate) {
+    if (s->reliable.srtt <= 0) return -1;
+    *rtt_ms = (uint32_t)s->reliable.srtt;
+    *loss_rate = 0.0f;
+    return 0;
+}
+
+/*
+ * BBR 传输层实现
+ * + send_data 为空：应用数据经 stream_flush_to_reliable 按 DATA 子头分片进入 reliable 层
+ */
+const p2p_trans_ops_t p2p_trans_bbr = {
+    .name = "BBR",
+    .init = bbr_init,
+    .close = bbr_close,
+    .send_data = NULL,
+    .tick = bbr_tick,
+    .on_packet = NULL,    /* 复用基础 reliable 层的收包逻辑 */
+    .is_ready = bbr_is_ready,
+    .get_stats = bbr_get_stats,
+    .on_migrate = bbr_migrate
+};
@@ -8,110 +8,104 @@
 /*
  * PseudoTCP（拥塞控制）逻辑
  * 
- * 本模块实现类TCP的拥塞控制算法，管理可靠层的窗口大小和定时策略。
+ * 本模块实现类TCP的拥塞控制传输，管理可靠层的窗口大小和定时策略。
  * 
  * 核心概念：
  * - cwnd (拥塞窗口): 发送方允许发送的最大字节数
  * - ssthresh (慢启动阈值): 区分慢启动和拥塞避免阶段的阈值
  * - MSS (最大分段大小): 单个数据包的最大负载
  * 
- * AIMD (加性增乘性减) 算法：
- * - 收到 ACK 时：cwnd 线性增加（加性增）
- * - 检测到丢包时：cwnd 减半（乘性减）
+ * 窗口增减策略由可插拔算法 s->cc 决定（见 p2p_cc.c）：
+ * - AIMD：收到 ACK 时 cwnd 线性增加，丢包时重置
+ * - CUBIC：cwnd 按距上次丢包时间的三次函数增长，丢包时乘 0.7
  */
 
-#define MSS 1200                /* 最大分段大小，单位：字节 */
-#define INITIAL_CWND (2 * MSS)  /* 初始拥塞窗口 */
-#define MIN_CWND (2 * MSS)      /* 最小拥塞窗口 */
-
-static void p2p_pseudotcp_init(struct p2p_session *s) {
-    s->tcp.cwnd = INITIAL_CWND;
-    s->tcp.ssthresh = 65535;
-    s->tcp.dup_acks = 0;
-    s->tcp.cc_state = 0; /* 慢启动阶段 */
-    s->tcp.loss_rate = 0.0f;
-}
+#define MSS P2P_CC_MSS          /* 最大分段大小，单位：字节 */
 
 /* 
- * 收到累积 ACK 时调用
- * 
- * 实现 AIMD 逻辑：
- * - 慢启动阶段 (cwnd < ssthresh): cwnd 每收到一个 ACK 增加 1 MSS（指数增长）
- * - 拥塞避免阶段 (cwnd >= ssthresh): cwnd 每 RTT 增加约 1 MSS（线性增长）
+ * 收到累积 ACK 时调用（按 1 MSS 计；reliable 层实际按确认字节数驱动 s->cc）
  */
 void p2p_pseudotcp_on_ack(struct p2p_session *s, uint16_t ack_seq) {
     (void)ack_seq;
-    if (s->tcp.cwnd == 0) return;  /* not in pseudoTCP mode — avoid div/0 */
-    if (s->tcp.cwnd < s->tcp.ssthresh) {
-        /* 慢启动：指数增长 */
-        s->tcp.cwnd += MSS;
-    } else {
-        /* 拥塞避免：线性增长 */
-        s->tcp.cwnd += (MSS * MSS) / s->tcp.cwnd;
-    }
-    s->tcp.dup_acks = 0;
-    s->tcp.last_ack = P_tick_ms();
-    s->tcp.loss_rate *= 0.98f;  /* EWMA 衰减：收到 ACK → 丢包率趋向 0 */
-}
-
-/* 
- * 检测到丢包时调用（超时或三次重复 ACK）
- * 
- * 乘性减策略：
- * - ssthresh 设为当前 cwnd 的一半
- * - cwnd 重置为最小值
- */
-void p2p_pseudotcp_on_loss(struct p2p_session *s) {
-    s->tcp.ssthresh = s->tcp.cwnd / 2;
-    if (s->tcp.ssthresh < MIN_CWND) s->tcp.ssthresh = MIN_CWND;
-    s->tcp.cwnd = MIN_CWND;
-    s->tcp.dup_acks = 0;
-    s->tcp.loss_rate = s->tcp.loss_rate * 0.98f + 0.02f;  /* EWMA 上报：检测到丢包 */
-    print("W:", LA_F("congestion detected, new ssthresh: %u, cwnd: %u", LA_F461, 461), s->tcp.ssthresh, s->tcp.cwnd);
+    if (s->cc) s->cc->on_ack(s, MSS, p2p_now_ms());
 }
 
 /*
  * 执行拥塞感知的重传
  * 
- * 根据当前拥塞窗口大小限制在途数据包数量，
- * 并在超时时触发重传。
+ * 根据当前拥塞窗口大小限制在途字节数，
+ * 并在超时时触发重传（重传不受 cwnd 限制，避免窗口被已丢失的包占满而停滞）。
  */
 static void p2p_pseudotcp_tick(struct p2p_session *s) {
     reliable_t *r = &s->reliable;
-    uint64_t now = P_tick_ms();
+    uint64_t now = p2p_now_ms();
 
     /* 
-     * 在 PseudoTCP 模式下，根据 cwnd 限制在途数据包数量
-     * 在途字节数 = 未确认数据包数 * MSS（近似值）
+     * 在 PseudoTCP 模式下，根据 cwnd 限制在途字节数
+     * 在途字节数 = 已发出且未确认数据包的实际长度之和（小包不按 MSS 计）
      */
-    int in_flight = r->send_count * MSS;
-
-    for (int i = 0; i < RELIABLE_WINDOW; i++) {
-        uint16_t seq = r->send_base + i;
-        if (seq_diff(seq, r->send_seq) >= 0) break;
-
-        int idx = seq % RELIABLE_WINDOW;
-        retx_entry_t *e = &r->send_buf[idx];
-        if (e->acked) continue;
-
-        /* 窗口检查：超过 cwnd 则停止发送 */
-        if (in_flight >= (int)s->tcp.cwnd) break;
-
-        if (e->send_time == 0 || tick_diff(now, e->send_time) >= (uint64_t)r->rto) {
-            /* 发送/重传数据包 */
-            p2p_send_packet(s, &s->active_addr, P2P_PKT_DATA, 0, e->seq, e->data, e->len, now);
-            
-            if (e->send_time != 0) {
-                /* 通过超时检测到丢包 */
-                p2p_pseudotcp_on_loss(s);
-                r->rto = (r->rto * 3) / 2; /* RTO 退避，每次增加 50% */
-            }
-            
-            e->send_time = now;
-            e->retx_count++;
-        }
+    int64_t in_flight = reliable_inflight_bytes(s);
+    int64_t cwnd = s->cc->cwnd(s);
+    int64_t rwnd = reliable_rwnd_avail(s);
+    p2p_trace_cwnd(s, cwnd, s->tcp.ssthresh);
+
+    r->pace_rate = s->cc->pacing_rate ? s->cc->pacing_rate(s) : 0;
+    r->pace_blocked = false;
+    r->rwnd_blocked = false;
+    bool cwnd_limited = false;
+
+    /* 超时重传：共享 RTO 下超时的包按发送先后排在发送顺序链表头部，遇到未超时的包即停止 */
+    for (int id = r->sent_head, n = r->send_count; id && n > 0; n--) {
+        retx_entry_t *e = &r->send_buf[id - 1];
+        id = e->sent_next;
+        if (tick_diff(now, e->send_time) < (uint64_t)r->rto) break;
+        reliable_expire(s, e, now);
+
+        /* 发送节奏：令牌耗尽则等待下次唤醒 */
+        if (!reliable_pace_take(s, P2P_HDR_SIZE + e->len, now)) break;
+
+        reliable_rate_on_send(r, e, now);
+        p2p_send_packet(s, &s->active_addr, P2P_PKT_DATA, 0, e->seq, e->data, e->len, now);
+
+        /* 通过超时检测到丢包（重传包已计入在途） */
+        s->cc->on_loss(s, now);
+        r->rto = (r->rto * 3) / 2; /* RTO 退避，每次增加 50% */
+        e->retx_count++;
+        p2p_count_retx(s, e->seq, "rto");
+        e->send_time = now;
+        e->rto = r->rto;
+        reliable_on_sent(r, e);
     }
+
+    /* 首次发送：从首个未发送条目开始（未发送的包都在队尾） */
+    uint32_t end = r->send_base + (uint32_t)r->window;
+    for (uint32_t seq = reliable_unsent_first(s); !r->pace_blocked; seq++) {
+        if (seq32_diff(seq, r->send_seq) >= 0 || seq32_diff(seq, end) >= 0) break;
+
+        retx_entry_t *e = &r->send_buf[seq & (r->window - 1)];
+        if (e->acked || e->send_time) continue;
+        reliable_expire(s, e, now);
+
+        /* 窗口检查：新包超过 cwnd 则停止发送 */
+        if (in_flight >= cwnd) { cwnd_limited = true; break; }
+        /* 对端接收窗口不足（零窗口探测除外）同样停止 */
+        if (rwnd < e->len && !reliable_rwnd_probe(s, rwnd, now)) break;
+        if (!reliable_pace_take(s, P2P_HDR_SIZE + e->len, now)) break;
+
+        reliable_rate_on_send(r, e, now);
+        p2p_send_packet(s, &s->active_addr, P2P_PKT_DATA, 0, e->seq, e->data, e->len, now);
+        e->retx_count = 0;
+        in_flight += e->len;
+        rwnd -= e->len;
+        e->send_time = now;
+        e->rto = r->rto;
+        reliable_on_sent(r, e);
+    }
+
+    /* 所有包均已发出：后续样本受应用层限制 */
+    if (!cwnd_limited && !r->pace_blocked) reliable_mark_app_limited(s);
 }
+
 /*
  * 获取传输层统计
  * PseudoTCP 复用基础 reliable 层，直接读取其 SRTT
@@ -127,14 +121,12 @@ static int pseudotcp_get_stats(struct p2p_session *s, uint32_t *rtt_ms, float *l
  * PseudoTCP 传输层实现
  */
 static int pseudotcp_init(struct p2p_session *s) {
-    p2p_pseudotcp_init(s);
+    s->cc = p2p_cc_find(P2P_SOPT(s, P2P_SOPT_CC, cc_algo));
+    s->cc->init(s);
+    print("I:", LA_F("congestion control: %s", LA_F480, 480), s->cc->name);
     return 0;
 }
 
-static int pseudotcp_send(struct p2p_session *s, const void *buf, int len) {
-    return reliable_send_pkt(s, buf, len);
-}
-
 static void pseudotcp_tick(struct p2p_session *s) {
     p2p_pseudotcp_tick(s);
     reliable_tick_ack(s);
@@ -146,19 +138,30 @@ static int pseudotcp_is_ready(struct p2p_session *s) {
 
 static void pseudotcp_close(struct p2p_session *s) {
     /* PseudoTCP 无动态资源，重置拥塞控制状态即可 */
-    s->tcp.cwnd = 0;
-    s->tcp.ssthresh = 0;
-    s->tcp.dup_acks = 0;
-    s->tcp.cc_state = 0;
+    memset(&s->tcp, 0, sizeof(s->tcp));
+    s->cc = NULL;
+    s->reliable.pace_rate = 0;
 }
 
+/* 路径迁移：拥塞窗口从初始值重新探测（在途包由 reliable_on_migrate 重传） */
+static void pseudotcp_migrate(struct p2p_session *s) {
+    memset(&s->tcp, 0, sizeof(s->tcp));
+    s->cc->init(s);
+    s->reliable.pace_rate = 0;
+}
+
+/*
+ * + send_data 为空：与 BBR 相同，应用数据经 stream_flush_to_reliable 按 DATA 子头分片进入 reliable 层
+ *   （直接写入 reliable 的原始字节缺少流头，接收端 stream_deliver 无法解析）
+ */
 const p2p_trans_ops_t p2p_trans_pseudotcp = {
     .name = "PseudoTCP",
     .init = pseudotcp_init,
     .close = pseudotcp_close,
-    .send_data = pseudotcp_send,
+    .send_data = NULL,
     .tick = pseudotcp_tick,
     .on_packet = NULL,    /* 复用基础 reliable 层的收包逻辑 */
     .is_ready = pseudotcp_is_ready,
-    .get_stats = pseudotcp_get_stats
+    .get_stats = pseudotcp_get_stats,
+    .on_migrate = pseudotcp_migrate
 };
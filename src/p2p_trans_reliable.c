@@ -10,254 +10,1771 @@
 // Implementation
 ///////////////////////////////////////////////////////////////////////////////
 
-static inline int seq_in_window(uint16_t seq, uint16_t base, int window) {
-    int16_t d = seq_diff(seq, base);
+/*
+ * 序列号：内部为 32 位（send_seq / send_base / recv_base 等单调递增，高速长连接不会在窗口内回绕），
+ * 线上 DATA / ACK / SACK 只携带低 16 位，收到时以 seq_expand 相对 recv_base / send_base 还原。
+ * 还原要求真实值与参考点相距不足 2^15：窗口上限 RELIABLE_WINDOW_MAX 远小于此，
+ * 超出 [参考点 - 窗口, 参考点 + 窗口) 的包（滞留的旧包或伪造包）还原后落在窗口外被丢弃
+ */
+
+/* 环形缓冲区槽位（window 为 2 的幂） */
+#define SLOT(r, seq)    ((uint32_t)(seq) & ((r)->window - 1))
+
+static inline int seq_in_window(uint32_t seq, uint32_t base, int window) {
+    int32_t d = seq32_diff(seq, base);
     return d >= 0 && d < window;
 }
 
-void reliable_init(struct p2p_session *s) {
+/* 配置窗口 → [RELIABLE_WINDOW, RELIABLE_WINDOW_MAX] 内的 2 的幂 */
+static int window_normalize(int w) {
+    if (w > RELIABLE_WINDOW_MAX) w = RELIABLE_WINDOW_MAX;
+    int p = RELIABLE_WINDOW;
+    while (p < w) p <<= 1;
+    return p;
+}
+
+/* 首个 RTT 样本前的 RTO：P2P_TUNE_RTO_INIT_MS，限制在 RTO 上下限内 */
+static int rto_init(const struct p2p_session *s) {
+    int rto = p2p_tune(s, P2P_TUNE_RTO_INIT_MS);
+    int rto_min = p2p_tune(s, P2P_TUNE_RTO_MIN_MS), rto_max = p2p_tune(s, P2P_TUNE_RTO_MAX_MS);
+    if (rto < rto_min) rto = rto_min;
+    if (rto > rto_max) rto = rto_max;
+    return rto;
+}
+
+/* 请求对端的最长延迟 ACK (毫秒，见 reliable_write_caps) */
+static int ack_delay_req(const struct p2p_session *s) {
+    const p2p_config_t *cfg = &s->inst->cfg;
+    int delay = cfg->ack_delay_ms > 0 ? cfg->ack_delay_ms : RELIABLE_ACK_DELAY;
+    return delay > RELIABLE_ACK_DELAY_MAX ? RELIABLE_ACK_DELAY_MAX : delay;
+}
+
+/*
+ * 缓冲区池
+ * + slab 布局：[next 指针（对齐到 POOL_STRIDE）][buf 0][buf 1]...[buf N-1]
+ * + 空闲缓冲区首部复用为链表 next 指针
+ */
+#define POOL_STRIDE     ((P2P_PMTU_PAYLOAD_MAX + 15) & ~15)     /* 可容纳探测确认后的大包 */
+
+uint8_t *reliable_pool_get(reliable_pool_t *pool) {
+    if (!pool->free_list) {
+        uint8_t *slab = (uint8_t*)p2p_malloc((size_t)POOL_STRIDE * (RELIABLE_POOL_SLAB + 1));
+        if (!slab) {
+            print("E:", LA_F("Reliable pool grow failed total=%d", LA_F475, 475), pool->total);
+            return NULL;
+        }
+        p2p_mem_add(pool->mem, P2P_MEM_RELIABLE, (int64_t)POOL_STRIDE * (RELIABLE_POOL_SLAB + 1));
+        *(void**)slab = pool->slabs;
+        pool->slabs = slab;
+        for (int i = RELIABLE_POOL_SLAB; i >= 1; i--) {
+            uint8_t *buf = slab + (size_t)POOL_STRIDE * i;
+            *(void**)buf = pool->free_list;
+            pool->free_list = buf;
+        }
+        pool->total += RELIABLE_POOL_SLAB;
+    }
+    uint8_t *buf = (uint8_t*)pool->free_list;
+    pool->free_list = *(void**)buf;
+    pool->used++;
+    return buf;
+}
+
+void reliable_pool_put(reliable_pool_t *pool, uint8_t *buf) {
+    *(void**)buf = pool->free_list;
+    pool->free_list = buf;
+    pool->used--;
+}
+
+void reliable_pool_trim(reliable_pool_t *pool) {
+    if (pool->used > 0) return;
+    while (pool->slabs) {
+        void *next = *(void**)pool->slabs;
+        p2p_mem_add(pool->mem, P2P_MEM_RELIABLE, -(int64_t)POOL_STRIDE * (RELIABLE_POOL_SLAB + 1));
+        p2p_free(pool->slabs);
+        pool->slabs = next;
+    }
+    pool->free_list = NULL;
+    pool->total = 0;
+}
+
+/* 归还会话持有的全部池缓冲区（在途重传条目 + 乱序/待读数据） */
+static void release_bufs(struct p2p_session *s) {
     reliable_t *r = &s->reliable;
+    reliable_pool_t *pool = p2p_session_pool(s);
+    for (int i = 0; i < r->window; i++) {
+        if (r->send_buf[i].data) { reliable_pool_put(pool, r->send_buf[i].data); r->send_buf[i].data = NULL; }
+        if (r->recv_data[i]) { reliable_pool_put(pool, r->recv_data[i]); r->recv_data[i] = NULL; }
+    }
+}
+
+/* 槽位 e 已持有 len 字节的包：以 send_seq 入队，待下次 tick 首发 */
+static void send_enqueue(reliable_t *r, retx_entry_t *e, int len) {
+    e->len = len;
+    e->seq = r->send_seq;
+    e->send_time = 0;       // 0 = 尚未发送，将在下次 tick 时发送
+    e->retx_count = -1;     // -1 = 初始为待处理发送
+    e->acked = 0;
+    e->path = PATH_IDX_NONE;
+    e->redundant = P2P_REDUNDANT_OFF;
+    e->prio = P2P_PRIO_NORMAL;
+    e->bulk = false;
+    e->deadline = 0;
+    e->raw_len = 0;
+
+    r->send_seq++;
+    r->send_count++;
+}
+
+/*
+ * 在途包索引（只含已发出、未确认的条目；槽位数组清零即为空）
+ * + 截止时间堆：按 due 排列，堆顶为最早到期的超时重传
+ * + 发送顺序链表：按最近一次发送时间排列，头部为最早发出的包（RACK 与共享 RTO 的超时判定按此顺序单调）
+ * + send_next：首个未发送条目，首发只从这里开始
+ */
+#define HEAP_DUE(r, i)  ((r)->send_buf[(r)->retx_heap[i]].due)
+
+static void heap_set(reliable_t *r, int i, int slot) {
+    r->retx_heap[i] = slot;
+    r->send_buf[slot].heap_pos = i + 1;
+}
+
+static void heap_up(reliable_t *r, int i) {
+    int slot = r->retx_heap[i];
+    uint64_t due = r->send_buf[slot].due;
+    while (i > 0) {
+        int p = (i - 1) / 2;
+        if (HEAP_DUE(r, p) <= due) break;
+        heap_set(r, i, r->retx_heap[p]);
+        i = p;
+    }
+    heap_set(r, i, slot);
+}
+
+static void heap_down(reliable_t *r, int i) {
+    int slot = r->retx_heap[i], n = r->retx_heap_cnt;
+    uint64_t due = r->send_buf[slot].due;
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= n) break;
+        if (c + 1 < n && HEAP_DUE(r, c + 1) < HEAP_DUE(r, c)) c++;
+        if (HEAP_DUE(r, c) >= due) break;
+        heap_set(r, i, r->retx_heap[c]);
+        i = c;
+    }
+    heap_set(r, i, slot);
+}
+
+void reliable_retx_update(reliable_t *r, retx_entry_t *e) {
+    e->due = e->send_time + (uint64_t)e->rto;
+    if (!e->heap_pos) {
+        int i = r->retx_heap_cnt++;
+        heap_set(r, i, (int)(e - r->send_buf));
+        heap_up(r, i);
+        return;
+    }
+    heap_up(r, e->heap_pos - 1);
+    heap_down(r, e->heap_pos - 1);
+}
+
+static void sent_unlink(reliable_t *r, retx_entry_t *e) {
+    int id = (int)(e - r->send_buf) + 1;
+    if (!e->sent_prev && r->sent_head != id) return;    // 不在链表中
+    if (e->sent_prev) r->send_buf[e->sent_prev - 1].sent_next = e->sent_next;
+    else r->sent_head = e->sent_next;
+    if (e->sent_next) r->send_buf[e->sent_next - 1].sent_prev = e->sent_prev;
+    else r->sent_tail = e->sent_prev;
+    e->sent_prev = e->sent_next = 0;
+}
+
+void reliable_on_sent(reliable_t *r, retx_entry_t *e) {
+    int id = (int)(e - r->send_buf) + 1;
+    sent_unlink(r, e);
+    e->sent_prev = r->sent_tail;
+    if (r->sent_tail) r->send_buf[r->sent_tail - 1].sent_next = id;
+    else r->sent_head = id;
+    r->sent_tail = id;
+    reliable_retx_update(r, e);
+}
+
+/* 条目已确认：移出堆与发送顺序链表 */
+static void retx_remove(reliable_t *r, retx_entry_t *e) {
+    sent_unlink(r, e);
+    if (!e->heap_pos) return;
+    int i = e->heap_pos - 1, last = --r->retx_heap_cnt;
+    e->heap_pos = 0;
+    if (i == last) return;
+    int slot = r->retx_heap[last];
+    heap_set(r, i, slot);
+    heap_up(r, i);
+    heap_down(r, r->send_buf[slot].heap_pos - 1);
+}
+
+/* 发送端占用的序列号区间终点（send_seq，受槽位数限制） */
+static uint32_t send_end(const reliable_t *r) {
+    int n = (int)(r->send_seq - r->send_base);
+    return r->send_base + (uint32_t)(n < r->window ? n : r->window);
+}
+
+static uint32_t unsent_first(const reliable_t *r) {
+    uint32_t q = r->send_next, end = send_end(r);
+    if (seq32_diff(q, r->send_base) < 0 || seq32_diff(q, end) > 0) q = r->send_base;
+    for (; seq32_diff(q, end) < 0; q++) {
+        const retx_entry_t *e = &r->send_buf[SLOT(r, q)];
+        if (!e->acked && !e->send_time) break;
+    }
+    return q;
+}
+
+uint32_t reliable_unsent_first(struct p2p_session *s) {
+    reliable_t *r = &s->reliable;
+    return r->send_next = unsent_first(r);
+}
+
+/* 槽位数组的字节数（按窗口分配，见 reliable_init） */
+static int64_t slots_size(int window) {
+    return (int64_t)window * (sizeof(retx_entry_t) + sizeof(int) * 2 + 1 + sizeof(uint8_t*));
+}
+
+/* 释放槽位数组（全部分配成功时才计入内存计量，见 slots_alloc） */
+static void slots_free(struct p2p_session *s) {
+    reliable_t *r = &s->reliable;
+    if (r->send_buf && r->retx_heap && r->recv_bitmap && r->recv_data && r->recv_lens)
+        p2p_mem_add(&s->mem, P2P_MEM_RELIABLE, -slots_size(r->window));
+    p2p_free(r->send_buf);    r->send_buf = NULL;
+    p2p_free(r->retx_heap);   r->retx_heap = NULL;
+    p2p_free(r->recv_bitmap); r->recv_bitmap = NULL;
+    p2p_free(r->recv_data);   r->recv_data = NULL;
+    p2p_free(r->recv_lens);   r->recv_lens = NULL;
+}
+
+/* 按 window 分配空的槽位数组，任一失败时全部释放 */
+static bool slots_alloc(struct p2p_session *s, int window) {
+    reliable_t *r = &s->reliable;
+    r->send_buf    = (retx_entry_t*)p2p_calloc(window, sizeof(retx_entry_t));
+    r->retx_heap   = (int*)p2p_malloc(sizeof(int) * window);
+    r->recv_bitmap = (uint8_t*)p2p_calloc(window, 1);
+    r->recv_data   = (uint8_t**)p2p_calloc(window, sizeof(uint8_t*));
+    r->recv_lens   = (int*)p2p_malloc(sizeof(int) * window);
+    if (!r->send_buf || !r->retx_heap || !r->recv_bitmap || !r->recv_data || !r->recv_lens) {
+        slots_free(s);
+        return false;
+    }
+    p2p_mem_add(&s->mem, P2P_MEM_RELIABLE, slots_size(window));
+    return true;
+}
+
+void reliable_free(struct p2p_session *s) {
+    reliable_t *r = &s->reliable;
+    if (r->send_buf && r->recv_data) release_bufs(s);
+    slots_free(s);
+    r->window = 0;
+
+    // 最后一个持有缓冲区的会话释放后回收 slab
+    reliable_pool_trim(p2p_session_pool(s));
+}
+
+ret_t reliable_init(struct p2p_session *s) {
+    reliable_t *r = &s->reliable;
+    int window = window_normalize(P2P_SOPT(s, P2P_SOPT_WINDOW, reliable_window));
+
+    // 窗口大小不变时复用槽位数组（会话重置路径因此不会失败），仅归还池缓冲区
+    if (r->window != window || !r->send_buf) {
+        reliable_free(s);
+        if (!slots_alloc(s, window)) {
+            print("E:", LA_F("Reliable buffers alloc failed win=%d", LA_F473, 473), window);
+            return E_OUT_OF_MEMORY;
+        }
+    }
+
+    else release_bufs(s);
+
+    retx_entry_t *send_buf = r->send_buf;
+    int *retx_heap = r->retx_heap;
+    uint8_t *recv_bitmap = r->recv_bitmap;
+    uint8_t **recv_data = r->recv_data;
+    int *recv_lens = r->recv_lens;
+
     memset(r, 0, sizeof(*r));
-    r->rto = RELIABLE_RTO_INIT;
+    r->window = window;
+    r->send_window = RELIABLE_WINDOW;   // 对端能力未知前按旧版窗口发送
+    r->ack_freq = 1;                    // 对端未请求前：每次 update 有新数据即 ACK
+    r->peer_rwnd = RELIABLE_RWND_INIT;  // 仅在协商 RWND 后生效
+    r->peer_streams = 1;
+    r->send_buf = send_buf;
+    r->retx_heap = retx_heap;
+    r->recv_bitmap = recv_bitmap;
+    r->recv_data = recv_data;
+    r->recv_lens = recv_lens;
+    memset(r->send_buf, 0, sizeof(retx_entry_t) * window);
+    memset(r->recv_bitmap, 0, window);
+
+    r->rto = rto_init(s);
     r->srtt = 0;
     r->rttvar = 0;
+    r->srtt_us = 0;
+    r->rttvar_us = 0;
     printf(LA_F("Reliable transport initialized rto=%d win=%d", LA_F362, 362),
-                RELIABLE_RTO_INIT, RELIABLE_WINDOW);
+                r->rto, window);
+    return E_NONE;
+}
+
+/*
+ * 空闲休眠：没有在途包、乱序包与待发 ACK 时可释放槽位数组，序列号、RTT 与协商状态保留
+ */
+bool reliable_drained(const struct p2p_session *s) {
+    const reliable_t *r = &s->reliable;
+    return r->send_count == 0 && r->send_seq == r->send_base && r->recv_next == r->recv_base
+        && r->recv_bytes == 0 && !r->need_ack && r->ack_pending == 0;
+}
+
+void reliable_hibernate(struct p2p_session *s) {
+    slots_free(s);
+    reliable_pool_trim(p2p_session_pool(s));
+}
+
+/* 按原窗口重新分配空的槽位数组（未休眠时直接返回） */
+ret_t reliable_thaw(struct p2p_session *s) {
+    reliable_t *r = &s->reliable;
+    if (r->send_buf) return E_NONE;
+    r->retx_heap_cnt = r->sent_head = r->sent_tail = 0;
+    if (!slots_alloc(s, r->window)) {
+        reliable_pool_trim(p2p_session_pool(s));
+        print("E:", LA_F("Reliable buffers alloc failed win=%d", LA_F473, 473), r->window);
+        return E_OUT_OF_MEMORY;
+    }
+    return E_NONE;
+}
+
+/*
+ * 能力通告：[caps(1)][window(2)][ack_freq(1)][ack_delay(1)][streams(1)]
+ * + 追加在 CONN / CONN_ACK 负载尾部，旧版对端不解析 CONN 负载，自然忽略
+ * + 加密层提供 conn_params 时再附 [len(1)][params]，并置 RELIABLE_CAP_CRYPTO
+ * + 最后附扩展能力字节 [caps2(1)]
+ */
+int reliable_write_caps(const struct p2p_session *s, uint8_t *buf) {
+    const p2p_config_t *cfg = &s->inst->cfg;
+    int freq = cfg->ack_freq > 0 ? cfg->ack_freq : RELIABLE_ACK_FREQ;
+    int delay = ack_delay_req(s);
+    if (freq > 255) freq = 255;
+
+    buf[0] = RELIABLE_CAP_EXT_SACK | RELIABLE_CAP_RWND | RELIABLE_CAP_BULK | RELIABLE_CAP_ACK_DATA | RELIABLE_CAP_FEC
+             | RELIABLE_CAP_ECN | (cfg->compress ? RELIABLE_CAP_LZ : 0);
+    nwrite_s(buf + 1, (uint16_t)s->reliable.window);
+    buf[3] = (uint8_t)freq;
+    buf[4] = (uint8_t)delay;
+    buf[5] = (uint8_t)s->stream_cnt;
+
+    int n = RELIABLE_CAPS_PSZ;
+    if (s->dtls && s->dtls->conn_params) {
+        int plen = s->dtls->conn_params(s, buf + n + 1);
+        if (plen > 0) {
+            buf[0] |= RELIABLE_CAP_CRYPTO;
+            buf[n] = (uint8_t)plen;
+            n += 1 + plen;
+        }
+    }
+    buf[n++] = RELIABLE_CAP2_BUNDLE | RELIABLE_CAP2_RPC | RELIABLE_CAP2_SKIP | (p2p_signal_relay_bulk_large(s->inst) ? RELIABLE_CAP2_BULK_LARGE : 0);
+
+    // 续传令牌：本端令牌、所知的对端令牌与各流已交付的接收偏移
+    if (s->resume.token) {
+        buf[n - 1] |= RELIABLE_CAP2_RESUME;
+        nwrite_l(buf + n, s->resume.token);
+        nwrite_l(buf + n + 4, s->resume.peer_token);
+        buf[n + 8] = (uint8_t)s->stream_cnt;
+        for (int i = 0; i < s->stream_cnt; i++)
+            nwrite_l(buf + n + 9 + 4 * i, stream_get((struct p2p_session*)s, i)->recv_offset);
+        n += RELIABLE_RESUME_PSZ(s->stream_cnt);
+    }
+    return n;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 会话续传
+///////////////////////////////////////////////////////////////////////////////
+
+void reliable_resume_free(struct p2p_session *s) {
+    reliable_resume_t *rs = &s->resume;
+    for (int i = 0; i < rs->cnt; i++) reliable_pool_put(p2p_session_pool(s), rs->pkts[i]);
+    p2p_free(rs->pkts); rs->pkts = NULL;
+    p2p_free(rs->lens); rs->lens = NULL;
+    rs->cnt = 0;
+    rs->pending = false;
+}
+
+/*
+ * 重连准备：保留 [send_base, send_seq) 内仍持有缓冲区的包（未确认，或已 SACK 而对端尚未累积确认）
+ * + 对端令牌未知、非基础 reliable 层或已休眠时不保留
+ * + 已按序收到但因接收缓冲区满暂留 reliable 层的包先交付流，否则续传后对端不会再发
+ */
+void reliable_resume_save(struct p2p_session *s) {
+    reliable_t *r = &s->reliable;
+    reliable_resume_t *rs = &s->resume;
+    reliable_resume_free(s);
+    if (!rs->peer_token || s->trans || !r->send_buf) return;
+
+    stream_feed_from_reliable(s);
+
+    int n = (int)(r->send_seq - r->send_base);
+    if (n > 0) {
+        rs->pkts = (uint8_t**)p2p_malloc(sizeof(uint8_t*) * n);
+        rs->lens = (int*)p2p_malloc(sizeof(int) * n);
+        if (!rs->pkts || !rs->lens) {
+            print("E:", LA_F("resume buffers alloc failed, %d packets dropped", LA_F691, 691), n);
+            reliable_resume_free(s);
+            return;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        retx_entry_t *e = &r->send_buf[SLOT(r, r->send_base + i)];
+        if (!e->data) continue;
+        rs->pkts[rs->cnt] = e->data;
+        rs->lens[rs->cnt++] = e->len;
+        e->data = NULL;
+    }
+    rs->pending = true;
+    print("I:", LA_F("session reset, %d packets retained for resume", LA_F692, 692), rs->cnt);
+}
+
+/*
+ * 对端令牌 [token(4)][peer_token(4)][cnt(1)][recv_offset(4) * cnt]
+ * + 双方令牌互相匹配：按对端接收偏移丢弃已交付的包，其余以新序列号按原顺序入队
+ * + 流的首个重传包偏移与对端接收偏移不符说明中间数据已无从重传（对端暂留包超出接收缓冲区），告警后继续
+ */
+static void resume_on_caps(struct p2p_session *s, const uint8_t *data, int len) {
+    reliable_t *r = &s->reliable;
+    reliable_resume_t *rs = &s->resume;
+    uint32_t token = nget_l(data), echo = nget_l(data + 4);
+    int cnt = data[8];
+    if (RELIABLE_RESUME_PSZ(cnt) > len) cnt = 0;
+
+    bool match = token == rs->peer_token && echo == rs->token;
+    rs->peer_token = token;
+    if (!rs->pending) return;
+    if (!match || r->send_seq != 0) {
+        print("W:", LA_F("resume token mismatch, %d retained packets dropped", LA_F693, 693), rs->cnt);
+        reliable_resume_free(s);
+        return;
+    }
+
+    uint32_t seen = 0;
+    int kept = 0;
+    for (int i = 0; i < rs->cnt; i++) {
+        uint8_t *pkt = rs->pkts[i];
+        int sid = (pkt[4] & P2P_FRAG_SID) ? pkt[5] : 0;
+        bool keep = !(pkt[4] & P2P_FRAG_RPC) && sid < cnt && sid < s->stream_cnt
+                    && seq32_diff(nget_l(pkt), nget_l(data + 9 + 4 * sid)) >= 0
+                    && (int)(r->send_seq - r->send_base) < r->window;
+        if (!keep) { reliable_pool_put(p2p_session_pool(s), pkt); continue; }
+
+        if (!(seen & (1u << sid)) && nget_l(pkt) != nget_l(data + 9 + 4 * sid))
+            print("W:", LA_F("resume gap on stream %d: peer at %u, resending from %u", LA_F694, 694),
+                  sid, nget_l(data + 9 + 4 * sid), nget_l(pkt));
+        seen |= 1u << sid;
+
+        retx_entry_t *e = &r->send_buf[SLOT(r, r->send_seq)];
+        if (e->data) reliable_pool_put(p2p_session_pool(s), e->data);   // 未提交的借出缓冲区
+        e->data = pkt;
+        send_enqueue(r, e, rs->lens[i]);
+        kept++;
+    }
+    rs->cnt = 0;
+    reliable_resume_free(s);
+    print("I:", LA_F("session resumed, %d packets requeued", LA_F695, 695), kept);
+}
+
+void reliable_on_caps(struct p2p_session *s, const uint8_t *data, int len) {
+    reliable_t *r = &s->reliable;
+    if (len < RELIABLE_CAPS_MIN_PSZ) return;   // 旧版对端：保持 RELIABLE_WINDOW + 32 位 SACK
+
+    // 对端的 ACK 频率请求：作用于本端回给对端的 ACK
+    if (len >= RELIABLE_CAPS_ACK_PSZ) {
+        r->ack_freq = data[3] > 0 ? data[3] : 1;
+        r->ack_delay = data[4] < RELIABLE_ACK_DELAY_MAX ? data[4] : RELIABLE_ACK_DELAY_MAX;
+        print("V:", LA_F("Peer requested ACK every %d pkts or %d ms", LA_F477, 477),
+              r->ack_freq, r->ack_delay);
+    }
+
+    int peer_window = nget_s(data + 1);
+    if (peer_window < 1) peer_window = 1;
+    r->send_window = peer_window < r->window ? peer_window : r->window;
+    r->ext_sack = (data[0] & RELIABLE_CAP_EXT_SACK) != 0;
+    r->ext_rwnd = (data[0] & RELIABLE_CAP_RWND) != 0;
+    r->peer_streams = len >= RELIABLE_CAPS_PSZ && data[5] > 1 ? data[5] : 1;
+    r->lz = s->inst->cfg.compress && (data[0] & RELIABLE_CAP_LZ);
+    r->bulk = (data[0] & RELIABLE_CAP_BULK) != 0;
+    r->ack_data = (data[0] & RELIABLE_CAP_ACK_DATA) != 0;
+    r->fec = (data[0] & RELIABLE_CAP_FEC) != 0;
+    r->ecn_echo = (data[0] & RELIABLE_CAP_ECN) != 0;
+
+    // 扩展能力字节：位于基础能力（及加密层参数）之后
+    int plen = len > RELIABLE_CAPS_PSZ ? data[RELIABLE_CAPS_PSZ] : 0;
+    int ext = RELIABLE_CAPS_PSZ + ((data[0] & RELIABLE_CAP_CRYPTO) ? 1 + plen : 0);
+    r->bundle = ext < len && (data[ext] & RELIABLE_CAP2_BUNDLE);
+    r->bulk_large = ext < len && (data[ext] & RELIABLE_CAP2_BULK_LARGE);
+    r->rpc = ext < len && (data[ext] & RELIABLE_CAP2_RPC);
+    r->skip = ext < len && (data[ext] & RELIABLE_CAP2_SKIP);
+    if (ext < len && (data[ext] & RELIABLE_CAP2_RESUME) && ext + 1 + RELIABLE_RESUME_PSZ(0) <= len)
+        resume_on_caps(s, data + ext + 1, len - ext - 1);
+    else reliable_resume_free(s);
+    print("V:", LA_F("Reliable peer caps=0x%02x win=%d, send window=%d", LA_F474, 474),
+          data[0], peer_window, r->send_window);
+
+    // 加密层参数（无握手的后端据此派生密钥）
+    if (!s->dtls || !s->dtls->on_conn_params) return;
+    if ((data[0] & RELIABLE_CAP_CRYPTO) && plen > 0 && RELIABLE_CAPS_PSZ + 1 + plen <= len)
+        s->dtls->on_conn_params(s, data + RELIABLE_CAPS_PSZ + 1, plen);
+    else
+        print("W:", LA_F("Peer sent no %s params, traffic stays unencrypted", LA_F505, 505), s->dtls->name);
+}
+
+/* 生效的发送窗口：协商值，P2P_TUNE_SEND_WINDOW 设置时取较小值 */
+static int send_window(const struct p2p_session *s) {
+    int w = s->reliable.send_window, t = p2p_tune(s, P2P_TUNE_SEND_WINDOW);
+    return t > 0 && t < w ? t : w;
 }
 
 int reliable_window_avail(const struct p2p_session *s) {
     const reliable_t *r = &s->reliable;
-    return RELIABLE_WINDOW - r->send_count;
+    // 按序列号跨度（而非 send_count）计算：SACK 确认的空洞不能释放 send_base 之前的槽位
+    return send_window(s) - (int)(r->send_seq - r->send_base);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 接收窗口
+///////////////////////////////////////////////////////////////////////////////
+
+/* recv_ring 按扩容上限还能容纳的字节数（放不下时由应用侧按 recv_need 扩容；多流取各流之和） */
+static int recv_space(const struct p2p_session *s) {
+    int space = 0;
+    for (int i = 0; i < (s->stream_cnt > 0 ? s->stream_cnt : 1); i++) {
+        const ringbuf_t *ring = &stream_get((struct p2p_session*)s, i)->recv_ring;
+        int n = ring->max - 1 - ring_used(ring) - ring->wip;
+        if (n > 0) space += n;
+    }
+    return space;
 }
 
 /*
- * 将数据包排队进行可靠传输
- * 成功返回 0，窗口已满返回 -1
- * Queue a packet for reliable delivery.
- * Returns 0 on success, -1 if window is full.
+ * 通告窗口相对累积 ACK：扣除 ack_seq 之前已按序缓冲、尚未交付 stream 的字节
+ * + 乱序包位于 ack_seq 之后，已计入发送方的在途字节，这里不重复扣除
  */
-int reliable_send_pkt(struct p2p_session *s, const uint8_t *data, int len) {
+int reliable_recv_window(const struct p2p_session *s) {
+    const reliable_t *r = &s->reliable;
+    int space = recv_space(s);
+    for (uint32_t q = r->recv_base;
+         (int)(q - r->recv_base) < r->window && r->recv_bitmap[SLOT(r, q)]; q++)
+        space -= r->recv_lens[SLOT(r, q)];
+    return space > 0 ? space : 0;
+}
+
+/* 窗口曾关闭或接近关闭，且应用读出数据后已可容纳若干包：应主动通告 */
+static bool rwnd_update_due(const struct p2p_session *s) {
+    const reliable_t *r = &s->reliable;
+    return r->ext_rwnd && r->rwnd_adv < RELIABLE_RWND_UPDATE &&
+           reliable_recv_window(s) >= r->rwnd_adv + RELIABLE_RWND_UPDATE;
+}
+
+void reliable_on_rwnd(struct p2p_session *s, uint32_t rwnd) {
+    reliable_t *r = &s->reliable;
+    r->peer_rwnd = rwnd < INT32_MAX ? (int)rwnd : INT32_MAX;
+    r->persist_ts = 0;
+}
+
+void reliable_on_ecn(struct p2p_session *s, uint32_t ce, uint64_t now) {
+    reliable_t *r = &s->reliable;
+    uint32_t delta = ce - r->ecn_ce_tx;
+    if (!delta || delta > 0x80000000u) return;          // 无新标记，或乱序到达的旧 ACK
+    r->ecn_ce_tx = ce;
+    if (s->cc && s->cc->on_ce && s->inst->cfg.ecn) s->cc->on_ce(s, delta, now);
+}
+
+/* 对端累积 ACK 之后已发出的字节数（SACK 已确认的包仍占用对端缓冲，一并计入） */
+int64_t reliable_rwnd_avail(const struct p2p_session *s) {
+    const reliable_t *r = &s->reliable;
+    if (!r->ext_rwnd) return INT64_MAX;
+    int64_t bytes = 0;
+    int inflight = (int)(r->send_seq - r->send_base);
+    for (int i = 0; i < inflight && i < r->window; i++) {
+        const retx_entry_t *e = &r->send_buf[SLOT(r, r->send_base + i)];
+        if (e->send_time) bytes += e->len;
+    }
+    return r->peer_rwnd - bytes;
+}
+
+/*
+ * 零窗口探测：只有在途包全部确认（其 ACK 已带回最新窗口）后才计时，
+ * 超过 RTO 仍未收到窗口更新（可能丢失）时放行一个新包，之后由该包的重传计时继续探测
+ */
+bool reliable_rwnd_probe(struct p2p_session *s, int64_t rwnd, uint64_t now) {
     reliable_t *r = &s->reliable;
-    if (r->send_count >= RELIABLE_WINDOW) {
+    r->rwnd_blocked = true;
+    if (rwnd < r->peer_rwnd) return false;
+    if (!r->persist_ts) { r->persist_ts = now; return false; }
+    if ((int)tick_diff(now, r->persist_ts) < r->rto) return false;
+    r->persist_ts = 0;
+    print("V:", LA_F("zero window probe rwnd=%d", LA_F483, 483), r->peer_rwnd);
+    return true;
+}
+
+/*
+ * RACK：记录最近发送（发送时间最新，同毫秒按序列号）的已确认包
+ * + 重传包的确认无法区分对应哪次发送，不参与更新
+ */
+static void rack_on_delivered(reliable_t *r, const retx_entry_t *e, uint64_t now) {
+    if (e->send_time == 0 || e->retx_count > 0) return;
+    if (r->rack_ts && (e->send_time < r->rack_ts ||
+        (e->send_time == r->rack_ts && seq32_diff(e->seq, r->rack_seq) < 0))) return;
+    r->rack_ts = e->send_time;
+    r->rack_seq = e->seq;
+    r->rack_rtt = (int)tick_diff(now, e->send_time);
+}
+
+/* 多路径调度发出的包所在路径的统计（RACK 与丢包按路径归账），未按路径调度返回 NULL */
+static path_stats_t *mp_stats(const struct p2p_session *s, const retx_entry_t *e) {
+    if (e->path < 0 || e->path >= s->remote_cand_cnt) return NULL;
+    return &s->remote_cands[e->path].stats;
+}
+
+/* 多路径：同一路径内的 RACK 状态（各路径 RTT 不同，跨路径比较发送时间会误判） */
+static void mp_rack_on_delivered(const struct p2p_session *s, const retx_entry_t *e, uint64_t now) {
+    path_stats_t *p = mp_stats(s, e);
+    if (!p || e->send_time == 0 || e->retx_count > 0) return;
+    if (p->mp_rack_ts && (e->send_time < p->mp_rack_ts ||
+        (e->send_time == p->mp_rack_ts && seq32_diff(e->seq, p->mp_rack_seq) < 0))) return;
+    p->mp_rack_ts = e->send_time;
+    p->mp_rack_seq = e->seq;
+    p->mp_rack_rtt = (int)tick_diff(now, e->send_time);
+}
+
+/*
+ * RACK：在最近确认包之前发出的未确认包，距判定丢失的剩余毫秒数（<=0 即已丢失）
+ * 返回 false 表示该包不适用（尚无确认，或该包发送晚于最近确认包）
+ */
+static bool rack_check(const struct p2p_session *s, const retx_entry_t *e, uint64_t now, int *remain) {
+    const reliable_t *r = &s->reliable;
+    uint64_t rack_ts = r->rack_ts; uint32_t rack_seq = r->rack_seq;
+    int rack_rtt = r->rack_rtt, srtt = r->srtt;
+    if (e->bulk) return false;                  // TCP 中转不乱序丢包，只按超时兜底
+    const path_stats_t *p = mp_stats(s, e);
+    if (p) {
+        rack_ts = p->mp_rack_ts; rack_seq = p->mp_rack_seq;
+        rack_rtt = p->mp_rack_rtt; srtt = (int)p->mp_srtt;
+    }
+    if (!rack_ts) return false;
+    if (e->send_time > rack_ts ||
+        (e->send_time == rack_ts && seq32_diff(e->seq, rack_seq) >= 0)) return false;
+    int reo_wnd = srtt / 4;
+    if (reo_wnd < RELIABLE_REO_WND_MIN) reo_wnd = RELIABLE_REO_WND_MIN;
+    *remain = rack_rtt + reo_wnd - (int)tick_diff(now, e->send_time);
+    return true;
+}
+
+/*
+ * 交付速率采样（参考 draft-cheng-iccrg-delivery-rate-estimation）
+ * + 包发出时快照累计交付量 (dlv_bytes, dlv_ts) 及最近已交付包的发送时间，被确认时：
+ *   rate = (delivered - dlv_bytes) / max(send_elapsed, ack_elapsed)
+ *   取发送/确认两段间隔的较大者，避免 ACK 压缩或突发发送导致高估
+ * + 每次 ACK 取其中最新发出的已交付包生成一个样本
+ * + 发送端无数据可发时发出的包标记 app_limited，其样本只反映应用层速率
+ */
+void reliable_rate_on_send(reliable_t *r, retx_entry_t *e, uint64_t now) {
+    if (!r->delivered_ts) r->delivered_ts = now;
+    if (!r->first_sent_ts) r->first_sent_ts = now;
+    e->dlv_bytes = r->delivered;
+    e->dlv_ts = r->delivered_ts;
+    e->dlv_sent_ts = r->first_sent_ts;
+    e->app_limited = r->app_limited != 0;
+}
+
+static void rate_on_delivered(reliable_t *r, const retx_entry_t *e, uint64_t now) {
+    if (e->send_time == 0) return;
+    r->delivered += (uint64_t)e->len;
+    r->delivered_ts = now;
+    if (r->app_limited && r->delivered > r->app_limited) r->app_limited = 0;
+    if (!r->rs_pending || e->dlv_bytes >= r->rs_prior) {
+        r->rs_prior = e->dlv_bytes;
+        r->rs_prior_ts = e->dlv_ts;
+        r->rs_send_elapsed = tick_diff(e->send_time, e->dlv_sent_ts);
+        r->rs_app_limited = e->app_limited;
+        r->rs_rtt = e->retx_count == 0 ? (int)tick_diff(now, e->send_time) : -1;
+        r->rs_pending = true;
+        r->first_sent_ts = e->send_time;
+    }
+}
+
+/* ACK 处理结束：生成交付速率样本并通知拥塞控制模块与路径管理器 */
+static void rate_sample(struct p2p_session *s, uint64_t now) {
+    reliable_t *r = &s->reliable;
+    if (!r->rs_pending) return;
+    r->rs_pending = false;
+
+    uint64_t interval = tick_diff(now, r->rs_prior_ts);
+    if (r->rs_send_elapsed > interval) interval = r->rs_send_elapsed;
+    if (interval == 0) interval = 1;
+    r->rs_rate = (int64_t)((r->delivered - r->rs_prior) * 1000 / interval);
+
+    if (s->trans == &p2p_trans_bbr) p2p_bbr_on_ack(s, now);
+
+    // 多路径时交付速率为各路径之和，不归入活跃路径的带宽估计
+    if (s->active_path >= -1 && !path_manager_mp_enabled(s))
+        path_manager_on_data_rate(s, s->active_path, (uint64_t)r->rs_rate * 8, r->rs_app_limited);
+}
+
+static void on_delivered(struct p2p_session *s, retx_entry_t *e, uint64_t now) {
+    reliable_t *r = &s->reliable;
+    retx_remove(r, e);
+    r->ack_rx_ts = now;
+    r->tlp_out = false;
+    rack_on_delivered(r, e, now);
+    rate_on_delivered(r, e, now);
+    if (e->retx_count == 0 && e->send_time) P2P_HIST(P2P_HIST_SEND_ACK, tick_diff(now, e->send_time) * 1000);
+    if (e->path >= 0) {
+        mp_rack_on_delivered(s, e, now);
+        path_manager_mp_on_ack(s, e->path, e->len,
+                               e->retx_count == 0 && e->send_time ? (int)tick_diff(now, e->send_time) : -1);
+    }
+}
+
+/*
+ * 发送节奏（令牌桶）
+ * + 速率 = 1.25 * cwnd / SRTT（字节/秒），1.25 倍增益为 cwnd 增长留出余量（P2P_TUNE_PACING_GAIN 可调）
+ * + 无 RTT 样本前不限速（与 TCP 初始窗口一致）
+ * + 拥塞控制模块设置 pace_rate 后按其速率发送，不依赖 cfg.pacing
+ */
+static bool pace_active(const struct p2p_session *s) {
+    return s->reliable.pace_rate > 0 ||
+           (P2P_SOPT(s, P2P_SOPT_CC, pacing) == P2P_PACING_TOKEN_BUCKET && s->reliable.srtt > 0);
+}
+
+static int64_t pace_rate(const struct p2p_session *s) {
+    const reliable_t *r = &s->reliable;
+    if (r->pace_rate > 0) return r->pace_rate;
+    int64_t cwnd = s->tcp.cwnd > 0 ? (int64_t)s->tcp.cwnd
+                                   : (int64_t)send_window(s) * P2P_MAX_PAYLOAD;
+    return cwnd * p2p_tune(s, P2P_TUNE_PACING_GAIN) / 100 * 1000 / r->srtt;
+}
+
+static void pace_refill(struct p2p_session *s, uint64_t now) {
+    reliable_t *r = &s->reliable;
+    int64_t rate = pace_rate(s);
+    int64_t burst = rate * RELIABLE_PACE_BURST_MS / 1000;
+    if (burst < 2 * P2P_MAX_PAYLOAD) burst = 2 * P2P_MAX_PAYLOAD;
+
+    if (!r->pace_ts) {
+        r->pace_ts = now;
+        r->pace_tokens = burst;
+        return;
+    }
+    uint64_t elapsed = tick_diff(now, r->pace_ts);
+    if (elapsed == 0) return;
+    r->pace_tokens += rate * (int64_t)elapsed / 1000;
+    if (r->pace_tokens > burst) r->pace_tokens = burst;
+    r->pace_ts = now;
+}
+
+/*
+ * 发送限速（p2p_set_rate_limit / p2p_set_rate_limit_total）
+ * + 会话令牌桶：按 rate 补充，容量 burst（未指定时为 RELIABLE_SHAPE_BURST_MS 的积累量）
+ * + 实例总限速：每 RELIABLE_SHAPE_EPOCH_MS 为一个统计周期，发过包的会话把权重计入本周期活跃权重和，
+ *   份额速率 = 总速率 * 权重 / max(上一周期, 本周期) 活跃权重和；空闲会话不占份额，
+ *   其余会话下一周期即分得全部总速率。权重和原子更新，适用于多个工作分片并发发送
+ * + 两桶均有令牌才允许发包，之后各扣除包长（允许透支一个包）
+ */
+static int64_t shape_burst(int64_t rate, int64_t burst) {
+    if (burst <= 0) burst = rate * RELIABLE_SHAPE_BURST_MS / 1000;
+    return burst < 2 * P2P_MAX_PAYLOAD ? 2 * P2P_MAX_PAYLOAD : burst;
+}
+
+static void shape_refill(int64_t *tokens, uint64_t *ts, int64_t rate, int64_t burst, uint64_t now) {
+    if (!*ts) {
+        *ts = now;
+        *tokens = burst;
+        return;
+    }
+    uint64_t elapsed = tick_diff(now, *ts);
+    if (elapsed == 0) return;
+    *tokens += rate * (int64_t)elapsed / 1000;
+    if (*tokens > burst) *tokens = burst;
+    *ts = now;
+}
+
+static int shape_bucket_wait(int64_t tokens, uint64_t ts, int64_t rate, uint64_t now) {
+    if (rate <= 0 || tokens > 0) return -1;
+    int64_t need = ((1 - tokens) * 1000 + rate - 1) / rate;
+    int64_t wait = need - (int64_t)tick_diff(now, ts);
+    return wait > 0 ? (int)wait : 0;
+}
+
+/* 本会话在实例总限速下的份额速率（实例不限速返回 0），并把本会话计入当前周期的活跃权重和 */
+static int64_t shape_share_rate(struct p2p_session *s, uint64_t now) {
+    struct p2p_instance *inst = s->inst;
+    p2p_shaper_t *sh = &s->shaper;
+    int64_t total = __atomic_load_n(&inst->shape_rate, __ATOMIC_RELAXED);
+    if (total <= 0) return 0;
+
+    uint32_t w = __atomic_load_n(&sh->weight, __ATOMIC_RELAXED);
+    if (!w) w = 1;
+    uint32_t ep = (uint32_t)(now / RELIABLE_SHAPE_EPOCH_MS);
+    uint32_t old = __atomic_load_n(&inst->shape_epoch, __ATOMIC_ACQUIRE);
+    if (old != ep && __atomic_compare_exchange_n(&inst->shape_epoch, &old, ep, false,
+                                                 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        // 新周期：本周期累计转为上一周期（中间有空闲周期时上一周期为 0）
+        uint32_t cur = __atomic_exchange_n(&inst->shape_cur, 0, __ATOMIC_ACQ_REL);
+        __atomic_store_n(&inst->shape_prev, ep == old + 1 ? cur : 0, __ATOMIC_RELEASE);
+    }
+    if (sh->epoch != ep) {
+        sh->epoch = ep;
+        __atomic_add_fetch(&inst->shape_cur, w, __ATOMIC_RELAXED);
+    }
+    uint32_t prev = __atomic_load_n(&inst->shape_prev, __ATOMIC_RELAXED);
+    uint32_t cur = __atomic_load_n(&inst->shape_cur, __ATOMIC_RELAXED);
+    uint32_t sum = prev > cur ? prev : cur;
+    if (sum < w) sum = w;
+    return total * w / sum;
+}
+
+static bool shape_take(struct p2p_session *s, int len, uint64_t now) {
+    p2p_shaper_t *sh = &s->shaper;
+    int64_t rate = __atomic_load_n(&sh->rate, __ATOMIC_RELAXED);
+    int64_t share = shape_share_rate(s, now);
+    sh->share_rate = share;
+    if (rate <= 0 && share <= 0) return true;
+
+    if (rate > 0) {
+        shape_refill(&sh->tokens, &sh->ts, rate,
+                     shape_burst(rate, __atomic_load_n(&sh->burst, __ATOMIC_RELAXED)), now);
+        if (sh->tokens <= 0) return false;
+    }
+    if (share > 0) {
+        int64_t total = __atomic_load_n(&s->inst->shape_rate, __ATOMIC_RELAXED);
+        int64_t burst = shape_burst(total, __atomic_load_n(&s->inst->shape_burst, __ATOMIC_RELAXED));
+        shape_refill(&sh->share_tokens, &sh->share_ts, share, shape_burst(share, burst * share / total), now);
+        if (sh->share_tokens <= 0) return false;
+    }
+    if (rate > 0) sh->tokens -= len;
+    if (share > 0) sh->share_tokens -= len;
+    return true;
+}
+
+static int shape_wait(const struct p2p_session *s, uint64_t now) {
+    const p2p_shaper_t *sh = &s->shaper;
+    int a = shape_bucket_wait(sh->tokens, sh->ts, __atomic_load_n(&sh->rate, __ATOMIC_RELAXED), now);
+    int b = shape_bucket_wait(sh->share_tokens, sh->share_ts, sh->share_rate, now);
+    return a > b ? a : b;
+}
+
+bool reliable_pace_take(struct p2p_session *s, int len, uint64_t now) {
+    reliable_t *r = &s->reliable;
+    bool pace = pace_active(s);
+
+    if (pace) {
+        pace_refill(s, now);
+        if (r->pace_tokens <= 0) {
+            r->pace_blocked = true;
+            return false;
+        }
+    }
+    if (!shape_take(s, len, now)) {
+        r->pace_blocked = true;
+        return false;
+    }
+    if (pace) r->pace_tokens -= len;   // 允许透支一个包，下次补充时偿还
+    return true;
+}
+
+int reliable_pace_wait(const struct p2p_session *s, uint64_t now) {
+    const reliable_t *r = &s->reliable;
+    if (!r->pace_blocked) return -1;
+
+    int wait = shape_wait(s, now);
+    if (pace_active(s) && r->pace_tokens <= 0) {
+        int64_t rate = pace_rate(s);
+        int64_t need = ((1 - r->pace_tokens) * 1000 + rate - 1) / rate;
+        int64_t pw = need - (int64_t)tick_diff(now, r->pace_ts);
+        if (pw < 0) pw = 0;
+        if (pw > wait) wait = (int)pw;
+    }
+    return wait;
+}
+
+/* 选择性确认单个包（仅限 [send_base, send_seq) 内的在途包） */
+static void sack_mark(struct p2p_session *s, uint32_t seq, uint64_t now) {
+    reliable_t *r = &s->reliable;
+    if (!seq_in_window(seq, r->send_base, (int)(r->send_seq - r->send_base))) return;
+    retx_entry_t *e = &r->send_buf[SLOT(r, seq)];
+    if (!e->acked) {
+        on_delivered(s, e, now);
+        e->acked = 1;
+        r->send_count--;
+        // 可续传时缓冲区保留到累积确认：对端可能尚未交付流，重连后仍需重传
+        if (!s->resume.peer_token) {
+            reliable_pool_put(p2p_session_pool(s), e->data);
+            e->data = NULL;
+        }
+    }
+}
+
+/*
+ * 借出下一个发送槽位的池缓冲区（P2P_PMTU_PAYLOAD_MAX 字节），调用方原地写入后以 reliable_send_commit 提交
+ * + 未提交的缓冲区留在槽位上，下次借出时复用，会话重置/释放时随槽位一并归还
+ * 窗口已满或内存不足返回 NULL
+ */
+uint8_t *reliable_send_buf(struct p2p_session *s) {
+    reliable_t *r = &s->reliable;
+    if (reliable_window_avail(s) <= 0) {
         print("W:", LA_F("Send window full, dropping packet send_count=%d", LA_F378, 378), r->send_count);
+        return NULL;
+    }
+    retx_entry_t *e = &r->send_buf[SLOT(r, r->send_seq)];
+    if (!e->data) e->data = reliable_pool_get(p2p_session_pool(s));
+    return e->data;
+}
+
+/*
+ * 提交 reliable_send_buf 借出的缓冲区中已写入的 len 字节
+ * 成功返回 0，未借出或长度非法返回 -1
+ */
+int reliable_send_commit(struct p2p_session *s, int len) {
+    reliable_t *r = &s->reliable;
+    retx_entry_t *e = &r->send_buf[SLOT(r, r->send_seq)];
+    if (!e->data || reliable_window_avail(s) <= 0) return -1;
+    if (len > P2P_PMTU_PAYLOAD_MAX) {
+        print("W:", LA_F("Packet too large len=%d max=%d", LA_F338, 338), len, P2P_PMTU_PAYLOAD_MAX);
         return -1;
     }
+
+    send_enqueue(r, e, len);
+    if (P2P_LOG_ON(VERBOSE)) print("V:", LA_F("Packet queued seq=%u len=%d inflight=%d", LA_F337, 337),
+                                             e->seq, len, r->send_count);
+    return 0;
+}
+
+void reliable_set_redundant(struct p2p_session *s, int mode) {
+    reliable_t *r = &s->reliable;
+    if (!r->send_count) return;
+    r->send_buf[SLOT(r, r->send_seq - 1)].redundant = mode;
+}
+
+void reliable_set_prio(struct p2p_session *s, int prio) {
+    reliable_t *r = &s->reliable;
+    if (!r->send_count) return;
+    r->send_buf[SLOT(r, r->send_seq - 1)].prio = prio;
+    if (prio == P2P_PRIO_HIGH) r->high_end = r->send_seq;
+}
+
+void reliable_set_deadline(struct p2p_session *s, uint32_t deadline, int raw_len) {
+    reliable_t *r = &s->reliable;
+    if (!r->send_count) return;
+    retx_entry_t *e = &r->send_buf[SLOT(r, r->send_seq - 1)];
+    e->deadline = deadline;
+    e->raw_len = raw_len;
+}
+
+/*
+ * 过期消息分片不再（重）发：保留序列号与流偏移，负载替换为 [skip_len(4)]
+ * + 序列号空洞由 SKIP 包填补，对端累积 ACK 照常推进；对端推进同样多的偏移并丢弃组装中的消息
+ * + 改写后的包不再过期，按普通包调度（零负载，重传开销可忽略）
+ */
+bool reliable_expire(struct p2p_session *s, retx_entry_t *e, uint64_t now) {
+    if (!e->deadline || !s->reliable.skip || !stream_deadline_passed(e->deadline, now)) return false;
+    uint8_t *pkt = e->data;
+    int hdr = (pkt[4] & P2P_FRAG_SID) ? P2P_DATA_SID_HDR_SIZE : P2P_DATA_HDR_SIZE;
+    pkt[4] = (uint8_t)((pkt[4] & P2P_FRAG_SID) | P2P_FRAG_SKIP);
+    nwrite_l(pkt + hdr, (uint32_t)e->raw_len);
+    e->len = hdr + (int)P2P_FRAG_SKIP_PSZ;
+    e->deadline = 0;
+    if (P2P_LOG_ON(VERBOSE)) print("V:", LA_F("expired message fragment seq=%u replaced by skip (%d bytes)", LA_F690, 690),
+                                         e->seq, e->raw_len);
+    return true;
+}
+
+/*
+ * 将数据包排队进行可靠传输（拷贝到池缓冲区）
+ * 成功返回 0，窗口已满返回 -1
+ * Queue a packet for reliable delivery.
+ * Returns 0 on success, -1 if window is full.
+ */
+int reliable_send_pkt(struct p2p_session *s, const uint8_t *data, int len) {
     if (len > P2P_MAX_PAYLOAD) {
         print("W:", LA_F("Packet too large len=%d max=%d", LA_F338, 338), len, P2P_MAX_PAYLOAD);
         return -1;
     }
-
-    int idx = r->send_seq % RELIABLE_WINDOW;
-    retx_entry_t *e = &r->send_buf[idx];
-    memcpy(e->data, data, len);
-    e->len = len;
-    e->seq = r->send_seq;
-    e->send_time = 0;       // 0 = 尚未发送，将在下次 tick 时发送
-    e->retx_count = -1;     // -1 = 初始为待处理发送
-    e->acked = 0;
-
-    r->send_seq++;
-    r->send_count++;
-    print("V:", LA_F("Packet queued seq=%u len=%d inflight=%d", LA_F337, 337),
-                    e->seq, len, r->send_count);
-    return 0;
+    uint8_t *buf = reliable_send_buf(s);
+    if (!buf) return -1;
+    memcpy(buf, data, len);
+    return reliable_send_commit(s, len);
 }
 
 /*
  * 出队下一个按序接收的数据包
  * 成功返回 0，无可用数据返回 -1
  */
-int reliable_recv_pkt(struct p2p_session *s, uint8_t *buf, int *out_len) {
-    reliable_t *r = &s->reliable;
-    int idx = r->recv_base % RELIABLE_WINDOW;
-    if (!r->recv_bitmap[idx]) return -1;
+int reliable_recv_peek(const struct p2p_session *s) {
+    const reliable_t *r = &s->reliable;
+    int idx = SLOT(r, r->recv_base);
+    return r->recv_bitmap[idx] ? r->recv_lens[idx] : -1;
+}
 
-    memcpy(buf, r->recv_data[idx], r->recv_lens[idx]);
+/* 借出下一个按序包（不出队），无可读包返回 NULL */
+const uint8_t *reliable_recv_ptr(const struct p2p_session *s, int *out_len) {
+    const reliable_t *r = &s->reliable;
+    int idx = SLOT(r, r->recv_base);
+    if (!r->recv_bitmap[idx]) return NULL;
     *out_len = r->recv_lens[idx];
+    return r->recv_data[idx];
+}
+
+/* recv_base 越过已提前交付（多流）的槽位 */
+static void recv_advance(reliable_t *r) {
+    int idx;
+    while (r->recv_bitmap[idx = SLOT(r, r->recv_base)] == 2) {
+        r->recv_bitmap[idx] = 0;
+        r->recv_base++;
+    }
+}
+
+/* 出队下一个按序包并归还其缓冲区 */
+void reliable_recv_drop(struct p2p_session *s) {
+    reliable_t *r = &s->reliable;
+    int idx = SLOT(r, r->recv_base);
+    if (!r->recv_bitmap[idx]) return;
+
+    r->recv_bytes -= r->recv_lens[idx];
     r->recv_bitmap[idx] = 0;
+    reliable_pool_put(p2p_session_pool(s), r->recv_data[idx]);
+    r->recv_data[idx] = NULL;
     r->recv_base++;
+    recv_advance(r);
+}
+
+int reliable_recv_pkt(struct p2p_session *s, uint8_t *buf, int *out_len) {
+    const uint8_t *data = reliable_recv_ptr(s, out_len);
+    if (!data) return -1;
+    memcpy(buf, data, *out_len);
+    reliable_recv_drop(s);
     return 0;
 }
 
+/* 多流：空洞之后的包若恰是其所属流的下一段数据，越过空洞直接交付，消除跨流队头阻塞 */
+static bool deliver_early(struct p2p_session *s, const uint8_t *pkt, int len) {
+    return s->stream_cnt > 1 && !p2p_session_handshaking(s)
+        && stream_deliver_ready(s, pkt, len) && stream_deliver(s, pkt, len) >= 0;
+}
+
+/* 提前交付后，已缓冲的同流后续包可能也已就绪：按序列号顺序扫描一遍（同流偏移随序列号递增） */
+static void deliver_ahead(struct p2p_session *s) {
+    reliable_t *r = &s->reliable;
+    for (uint32_t q = r->recv_base; seq32_diff(r->recv_next, q) > 0; q++) {
+        int idx = SLOT(r, q);
+        if (r->recv_bitmap[idx] != 1 || !deliver_early(s, r->recv_data[idx], r->recv_lens[idx])) continue;
+        r->recv_bytes -= r->recv_lens[idx];
+        reliable_pool_put(p2p_session_pool(s), r->recv_data[idx]);
+        r->recv_data[idx] = NULL;
+        r->recv_lens[idx] = 0;
+        r->recv_bitmap[idx] = 2;
+    }
+    recv_advance(r);
+}
+
+/* 已交付（落后于 recv_base）或已缓存的包 */
+bool reliable_recv_has(const struct p2p_session *s, uint16_t wire_seq) {
+    const reliable_t *r = &s->reliable;
+    uint32_t seq = seq_expand(wire_seq, r->recv_base);
+    if (seq32_diff(seq, r->recv_base) < 0) return true;
+    return seq_in_window(seq, r->recv_base, r->window) && r->recv_bitmap[SLOT(r, seq)];
+}
+
 /*
  * 处理传入的 DATA 数据包
  */
-int reliable_on_data(struct p2p_session *s, uint16_t seq, const uint8_t *payload, int len) {
+int reliable_on_data(struct p2p_session *s, uint16_t wire_seq, const uint8_t *payload, int len) {
     reliable_t *r = &s->reliable;
-    if (!seq_in_window(seq, r->recv_base, RELIABLE_WINDOW)) {
-        printf(LA_F("Out-of-window packet discarded seq=%u base=%u", LA_F333, 333),
-                      seq, r->recv_base);
+    uint32_t seq = seq_expand(wire_seq, r->recv_base);
+
+    // 途中被标记拥塞（CE）：计数经下一个 ACK 回显，立即 ACK 让发送方尽快减窗
+    if (s->rx_ecn == P2P_UDP_ECN_CE) {
+        r->ecn_ce_rx++;
+        r->need_ack = true;
+    }
+    if (!seq_in_window(seq, r->recv_base, r->window)) {
+        if (P2P_LOG_ON(VERBOSE)) printf(LA_F("Out-of-window packet discarded seq=%u base=%u", LA_F333, 333),
+                                               seq, r->recv_base);
         r->need_ack = true;  // 发送 ACK 告知发送方当前 recv_base，以防第一个 ACK 丢包
         return 0;  // 超出窗口，忽略
     }
 
-    int idx = seq % RELIABLE_WINDOW;
-    if (!r->recv_bitmap[idx]) {
+    int idx = SLOT(r, seq);
+    if (r->recv_bitmap[idx]) {
+        r->need_ack = true;  // 重复包：之前的 ACK 可能丢失，立即重发
+        return 1;
+    }
+
+    // 无空洞的按序包：直接写入 stream 接收缓冲区，不经过重排槽位
+    // + 建连握手中到达的 0-RTT 数据进入槽位暂留，CONNECTED 之后由 stream_feed_from_reliable 交付
+    bool early = false;
+    if (seq == r->recv_base && !p2p_session_handshaking(s) && stream_deliver(s, payload, len) >= 0) {
+        r->recv_base++;
+        recv_advance(r);
+        if (P2P_LOG_ON(VERBOSE)) print("V:", LA_F("Data delivered in order seq=%u len=%d", LA_F485, 485), seq, len);
+    } else if (seq != r->recv_base && deliver_early(s, payload, len)) {
+        r->recv_lens[idx] = 0;
+        r->recv_bitmap[idx] = 2;
+        early = true;
+        if (P2P_LOG_ON(VERBOSE)) print("V:", LA_F("Data delivered ahead of gap seq=%u len=%d base=%u", LA_F489, 489),
+                                       seq, len, r->recv_base);
+    } else {
+        // 超出接收窗口（recv_ring 已满或将满）：丢弃且不确认，回带当前窗口的 ACK
+        if (r->ext_rwnd && r->recv_bytes + len > recv_space(s)) {
+            if (P2P_LOG_ON(VERBOSE)) print("V:", LA_F("Receive window full, dropping seq=%u buffered=%d", LA_F484, 484),
+                                           seq, r->recv_bytes);
+            r->need_ack = true;
+            return 0;
+        }
+
+        // 缓冲区池耗尽：丢弃且不 ACK，由发送方重传
+        if (!(r->recv_data[idx] = reliable_pool_get(p2p_session_pool(s)))) return 0;
         memcpy(r->recv_data[idx], payload, len);
         r->recv_lens[idx] = len;
+        r->recv_bytes += len;
         r->recv_bitmap[idx] = 1;
-        r->need_ack = true;  // 标记需要发送 ACK
-        print("V:", LA_F("Data stored in recv buffer seq=%u len=%d base=%u", LA_F274, 274),
-                        seq, len, r->recv_base);
+        if (P2P_LOG_ON(VERBOSE)) print("V:", LA_F("Data stored in recv buffer seq=%u len=%d base=%u", LA_F274, 274),
+                                                 seq, len, r->recv_base);
     }
 
+    // ACK 频率：按序包累计；出现空洞或填补空洞（乱序）立即 ACK
+    if (r->ack_pending++ == 0) r->ack_first_ts = p2p_now_ms();
+    int32_t d = seq32_diff(seq, r->recv_next);
+    if (d >= 0) r->recv_next = seq + 1;
+    if (d != 0 || r->ack_pending >= r->ack_freq) r->need_ack = true;
+
+    if (early) deliver_ahead(s);
+
     return 1;  // 应当发送 ACK
 }
 
+/* 延迟 ACK 是否到期（累计的按序包已等待超过 ack_delay） */
+static bool ack_delay_expired(const reliable_t *r, uint64_t now) {
+    return r->ack_pending > 0 && (int)tick_diff(now, r->ack_first_ts) >= r->ack_delay;
+}
+
 /*
  * 处理传入的 ACK
  * ACK 载荷格式：[ ack_seq: u16 | sack_bits: u32 ]  (6 字节)
+ *   + 协商 EXT_SACK 后可追加 [n: u8][ start: u16 | count: u16 ] * n，见 reliable_on_sack_ranges
  * ack_seq = 累积确认（所有 < ack_seq 的都已确认）
  * sack_bits = ack_seq 之后的选择性确认位图
  */
-int reliable_on_ack(struct p2p_session *s, uint16_t ack_seq, uint32_t sack_bits, uint64_t now) {
+int reliable_on_ack(struct p2p_session *s, uint16_t wire_ack, uint32_t sack_bits, uint64_t now) {
     reliable_t *r = &s->reliable;
 
+    // 还原为 32 位：超出已发送范围的累积 ACK（伪造或还原歧义）整体丢弃，早于 send_base 的旧 ACK 只起 SACK 作用
+    uint32_t ack_seq = seq_expand(wire_ack, r->send_base);
+    if (seq32_diff(ack_seq, r->send_seq) > 0) {
+        if (P2P_LOG_ON(VERBOSE)) printf(LA_F("ACK beyond send_seq ignored ack_seq=%u send_seq=%u", LA_F687, 687),
+                                               ack_seq, r->send_seq);
+        return -1;
+    }
+
     // 根据累积 ACK 推进 send_base
-    while (seq_diff(ack_seq, r->send_base) > 0) {
-        int idx = r->send_base % RELIABLE_WINDOW;
-        retx_entry_t *e = &r->send_buf[idx];
+    while (seq32_diff(ack_seq, r->send_base) > 0) {
+        retx_entry_t *e = &r->send_buf[SLOT(r, r->send_base)];
         if (!e->acked) {
+            on_delivered(s, e, now);
             e->acked = 1;
             r->send_count--;
+            reliable_pool_put(p2p_session_pool(s), e->data);
+            e->data = NULL;
 
-            // PseudoTCP：在 ACK 时更新窗口（仅当启用拥塞控制时，避免 cwnd=0 除零崩溃）
-            if (s->inst->cfg.use_pseudotcp)
-                p2p_pseudotcp_on_ack(s, ack_seq);
+            // 拥塞控制：按本包实际字节数更新窗口（仅当传输层启用了拥塞算法）
+            if (s->cc) s->cc->on_ack(s, (uint32_t)e->len, now);
 
             // 更新 RTT 估算（仅针对非重传数据包）
             if (e->retx_count == 0 && e->send_time > 0) {
-                int rtt = (int)tick_diff(now, e->send_time);
-                if (r->srtt == 0) {
-                    r->srtt = rtt;
-                    r->rttvar = rtt / 2;
+                // 微秒精度样本（接收时间取内核时间戳，不含套接字缓冲区排队），平滑后取整为毫秒字段
+                int64_t rtt_us = (int64_t)p2p_rtt_us(s, e->send_us, (uint32_t)tick_diff(now, e->send_time));
+                int rtt = (int)((rtt_us + 500) / 1000);
+                if ((r->srtt_us + 500) / 1000 != r->srtt || (r->rttvar_us + 500) / 1000 != r->rttvar) {
+                    r->srtt_us = (int64_t)r->srtt * 1000;       // 毫秒字段被外部改写：以其为准
+                    r->rttvar_us = (int64_t)r->rttvar * 1000;
+                }
+                if (r->srtt_us == 0) {
+                    r->srtt_us = rtt_us;
+                    r->rttvar_us = rtt_us / 2;
                 } else {
-                    r->rttvar = (3 * r->rttvar + abs(r->srtt - rtt)) / 4;
-                    r->srtt = (7 * r->srtt + rtt) / 8;
+                    int64_t err = r->srtt_us - rtt_us;
+                    r->rttvar_us = (3 * r->rttvar_us + (err < 0 ? -err : err)) / 4;
+                    r->srtt_us = (7 * r->srtt_us + rtt_us) / 8;
                 }
-                r->rto = r->srtt + 4 * r->rttvar;
-                if (r->rto < 50) r->rto = 50;
-                if (r->rto > RELIABLE_RTO_MAX) r->rto = RELIABLE_RTO_MAX;
-                printf(LA_F("RTT updated rtt=%dms srtt=%d rttvar=%d rto=%d", LA_F349, 349),
-                              rtt, r->srtt, r->rttvar, r->rto);
+                r->srtt = (int)((r->srtt_us + 500) / 1000);
+                r->rttvar = (int)((r->rttvar_us + 500) / 1000);
+                r->rto = (int)((r->srtt_us + 4 * r->rttvar_us + 500) / 1000);
+                int rto_min = p2p_tune(s, P2P_TUNE_RTO_MIN_MS), rto_max = p2p_tune(s, P2P_TUNE_RTO_MAX_MS);
+                if (r->rto < rto_min) r->rto = rto_min;
+                if (r->rto > rto_max) r->rto = rto_max;
+                P2P_TRACE(s, P2P_TRACE_RTT, 0, e->seq, rtt, r->srtt, r->rttvar, r->rto, NULL);
+                if (P2P_LOG_ON(VERBOSE)) printf(LA_F("RTT updated rtt=%dms srtt=%d rttvar=%d rto=%d", LA_F349, 349),
+                                                       rtt, r->srtt, r->rttvar, r->rto);
+                if (s->cc && s->cc->on_rtt_sample) s->cc->on_rtt_sample(s, rtt, now);
+
+                // 被动路径测量：ACK 经活跃路径返回，仅活跃路径上发出的包构成原路样本
+                if (s->active_path >= 0 && (e->path == PATH_IDX_NONE || e->path == s->active_path))
+                    path_manager_on_ack_rtt(s, s->active_path, (uint32_t)rtt_us, now);
             }
         }
+        else if (e->data) {     // 已 SACK、为续传保留的缓冲区
+            reliable_pool_put(p2p_session_pool(s), e->data);
+            e->data = NULL;
+        }
         r->send_base++;
     }
-    printf(LA_F("ACK processed ack_seq=%u send_base=%u inflight=%d", LA_F257, 257),
-                  ack_seq, r->send_base, r->send_count);
+    if (P2P_LOG_ON(VERBOSE)) printf(LA_F("ACK processed ack_seq=%u send_base=%u inflight=%d", LA_F257, 257),
+                                           ack_seq, r->send_base, r->send_count);
 
     // SACK 位图：第 i 位 = ack_seq + 1 + i
     for (int i = 0; i < 32; i++) {
-        if (sack_bits & (1u << i)) {
-            uint16_t sack_seq = ack_seq + 1 + i;
-            if (seq_in_window(sack_seq, r->send_base, RELIABLE_WINDOW)) {
-                int idx = sack_seq % RELIABLE_WINDOW;
-                if (!r->send_buf[idx].acked) {
-                    r->send_buf[idx].acked = 1;
-                    r->send_count--;
-                }
-            }
-        }
+        if (sack_bits & (1u << i))
+            sack_mark(s, ack_seq + 1 + i, now);
     }
 
+    rate_sample(s, now);
+    return 0;
+}
+
+/*
+ * 处理扩展 ACK 的 SACK 区段
+ * 格式：[n: u8][ start: u16 | count: u16 ] * n
+ * 区段覆盖 32 位位图之外（ack_seq + 33 起）已收到的包，仅在双方协商 EXT_SACK 后出现
+ */
+int reliable_on_sack_ranges(struct p2p_session *s, const uint8_t *data, int len, uint64_t now) {
+    reliable_t *r = &s->reliable;
+    if (len < 1) return 0;
+
+    int n = data[0];
+    if (len < 1 + n * 4) return -1;
+
+    for (int b = 0; b < n; b++) {
+        uint32_t start = seq_expand(nget_s(data + 1 + b * 4), r->send_base);
+        int count = nget_s(data + 3 + b * 4);
+        if (count > r->window) count = r->window;
+        for (int k = 0; k < count; k++)
+            sack_mark(s, start + k, now);
+    }
+
+    rate_sample(s, now);
     return 0;
 }
 
 /*
  * 根据当前接收状态构建 ACK 载荷
+ * + 协商 RWND 后在位图之后追加 rwnd(4)，并设置 *flags |= P2P_ACK_FLAG_RWND
  */
-static int build_ack_payload(const reliable_t *r, uint8_t *buf) {
+static int build_ack_payload(reliable_t *r, const struct p2p_session *s, uint8_t *buf, uint8_t *flags) {
+    const int window = r->window;
     // 累积 ACK：从 recv_base 向前扫描已缓冲（已接收但应用层可能尚未消费）的连续包
     // 注：recv_base 只在应用层消费包时推进（reliable_recv_pkt），但发送 ACK 需要基于
     //     已接收入缓冲区的包，不能等应用层消费后再 ACK，否则 ack_seq 会滞后一帧
-    uint16_t ack_seq = r->recv_base;
-    while (r->recv_bitmap[ack_seq % RELIABLE_WINDOW] &&
-           (uint16_t)(ack_seq - r->recv_base) < RELIABLE_WINDOW) {
+    uint32_t ack_seq = r->recv_base;
+    while ((int)(ack_seq - r->recv_base) < window &&
+           r->recv_bitmap[SLOT(r, ack_seq)]) {
         ack_seq++;
     }
-    nwrite_s(buf, ack_seq);
+    nwrite_s(buf, (uint16_t)ack_seq);
 
     // SACK 位图：第 i 位 = ack_seq + 1 + i（与发送方解读一致）
-    // 注：循环上限用 RELIABLE_WINDOW-1 而非 RELIABLE_WINDOW，避免环形缓冲区回绕导致漏报已确认包
+    // 注：只扫描 [recv_base, recv_base + window) 内的槽位，避免环形缓冲区回绕导致误报
     uint32_t sack = 0;
-    for (int i = 0; i < 32 && i < RELIABLE_WINDOW - 1; i++) {
-        int idx = (ack_seq + 1 + i) % RELIABLE_WINDOW;
-        if (r->recv_bitmap[idx])
+    for (int i = 0; i < 32; i++) {
+        uint32_t q = ack_seq + 1 + i;
+        if ((int)(q - r->recv_base) >= window) break;
+        if (r->recv_bitmap[SLOT(r, q)])
             sack |= (1u << i);
     }
     nwrite_l(buf + 2, sack);
 
-    return 6;
+    int len = (int)P2P_PKT_ACK_PSZ;
+    if (r->ext_rwnd) {
+        r->rwnd_adv = reliable_recv_window(s);
+        nwrite_l(buf + len, (uint32_t)r->rwnd_adv);
+        *flags |= P2P_ACK_FLAG_RWND;
+        len += 4;
+    }
+    if (r->ecn_echo && r->ecn_ce_rx) {
+        nwrite_l(buf + len, r->ecn_ce_rx);
+        *flags |= P2P_ACK_FLAG_ECN;
+        len += 4;
+    }
+    if (!r->ext_sack) return len;
+
+    // 扩展 SACK：位图之外的已收区段 [n][start count]*n，无区段时不追加
+    int n = 0;
+    uint8_t *blk = buf + len + 1;
+    uint32_t q = ack_seq + 33;
+    while ((int)(q - r->recv_base) < window && n < RELIABLE_SACK_BLOCKS) {
+        if (!r->recv_bitmap[SLOT(r, q)]) { q++; continue; }
+        uint32_t start = q;
+        while ((int)(q - r->recv_base) < window && r->recv_bitmap[SLOT(r, q)]) q++;
+        nwrite_s(blk, (uint16_t)start);
+        nwrite_s(blk + 2, (uint16_t)(q - start));
+        blk += 4; n++;
+    }
+    if (n == 0) return len;
+    buf[len] = (uint8_t)n;
+    return len + 1 + n * 4;
 }
 
 /*
  * 周期性 tick：重传 + 发送 ACK + 刷新待处理数据
- * 仅在需要时发送 ACK
+ * 仅在需要时发送 ACK：立即 ACK（达到 ack_freq / 乱序）或延迟 ACK 到期
  */
 void reliable_tick_ack(struct p2p_session *s) {
     reliable_t *r = &s->reliable;
-    if (!r->need_ack) return;  // 没有新数据时不发 ACK，避免空闲时 100 ACK/s 洪泛
+    uint64_t now = p2p_now_ms();
+    // 没有新数据时不发 ACK，避免空闲时 100 ACK/s 洪泛
+    // 窗口重新打开时即使没有新数据也要更新，否则对端只能靠零窗口探测恢复
+    if (!r->need_ack && !ack_delay_expired(r, now) && !rwnd_update_due(s)) return;
     r->need_ack = false;
-    uint8_t ack_payload[6];
-    build_ack_payload(r, ack_payload);
+    r->ack_pending = 0;
+    uint8_t ack_payload[P2P_PKT_ACK_PSZ + 8 + 1 + RELIABLE_SACK_BLOCKS * 4];
+    uint8_t flags = 0;
+    int ack_len = build_ack_payload(r, s, ack_payload, &flags);
     uint16_t ack_seq = nget_s(ack_payload);
     uint32_t sack = nget_l(ack_payload + 2);
-    printf(LA_F("send ACK ack_seq=%u sack=0x%08x recv_base=%u to %s:%d", LA_F465, 465),
-                  ack_seq, sack, r->recv_base,
-                  inet_ntoa(s->active_addr.sin_addr),
-                  ntohs(s->active_addr.sin_port));
-    uint64_t now = P_tick_ms();
-    p2p_send_packet(s, &s->active_addr, P2P_PKT_ACK, 0, 0, ack_payload, 6, now);
+    if (P2P_LOG_ON(VERBOSE)) printf(LA_F("send ACK ack_seq=%u sack=0x%08x recv_base=%u to %s:%d", LA_F465, 465),
+                                           ack_seq, sack, r->recv_base,
+                                           inet_ntoa(s->active_addr.sin_addr),
+                                           ntohs(s->active_addr.sin_port));
+    p2p_send_packet(s, &s->active_addr, P2P_PKT_ACK, flags, 0, ack_payload, ack_len, now);
 }
 
 /*
  * 周期 tick：发送/重传数据包 + 发 ACK
  *
  * 每次 p2p_update 调用一次，负责：
- *   1. 首次发送队列中 send_time==0 的包
- *   2. 对超过 RTO 未确认的包进行指数退避重传
- *   3. 和 reliable_tick_ack 一起发送 ACK
+ *   1. RACK 判定丢失的包立即快速重传（不退避）
+ *   2. 对超过自身 RTO 未确认的包重传，仅该包指数退避
+ *   3. 首次发送队列中 send_time==0 的包
+ *   4. 和 reliable_tick_ack 一起发送 ACK
+ * 启用发送节奏时，每次发送/重传前向令牌桶申请，令牌耗尽即停止本轮发送
+ * 只检查到期的条目（见在途包索引），没有到期条目时与窗口大小无关
  */
 void reliable_tick(struct p2p_session *s) {
+    reliable_tick_cwnd(s, INT64_MAX);
+}
+
+int64_t reliable_inflight_bytes(const struct p2p_session *s) {
+    const reliable_t *r = &s->reliable;
+    int64_t bytes = 0;
+    for (int id = r->sent_head, n = r->send_count; id && n > 0; n--) {
+        const retx_entry_t *e = &r->send_buf[id - 1];
+        bytes += e->len;
+        id = e->sent_next;
+    }
+    return bytes;
+}
+
+void reliable_mark_app_limited(struct p2p_session *s) {
+    reliable_t *r = &s->reliable;
+    if ((int)(r->send_seq - r->send_base) >= send_window(s)) return;  // 受发送窗口限制
+    if (r->rwnd_blocked) return;                                            // 受对端接收窗口限制
+    r->app_limited = r->delivered + (uint64_t)reliable_inflight_bytes(s);
+    if (!r->app_limited) r->app_limited = 1;
+}
+
+/*
+ * 捎带 ACK：有待发 ACK 且对端支持时，在 buf 中构造 [aflags][ack_seq][sack][rwnd?] 并清除待发状态
+ * + 只携带累积确认 + 位图；需要扩展 SACK 区段或放不下 len 字节的 DATA 时返回 0，由独立 ACK 发送
+ */
+static int ack_piggyback(struct p2p_session *s, int len, uint8_t *buf) {
     reliable_t *r = &s->reliable;
-    uint64_t now = P_tick_ms();
+    if (!r->ack_data || len + (int)P2P_DATA_ACK_MAX > nat_pmtu_payload(s)) return 0;
+    if (!r->need_ack && !r->ack_pending && !rwnd_update_due(s)) return 0;
 
-    /* 遍历所有未确认的发送条目 */
-    int window = (uint16_t)(r->send_seq - r->send_base);
-    for (int i = 0; i < window && i < RELIABLE_WINDOW; i++) {
-        int idx = (r->send_base + i) % RELIABLE_WINDOW;
-        retx_entry_t *e = &r->send_buf[idx];
-        if (e->acked) continue;
+    uint8_t ack[P2P_PKT_ACK_PSZ + 8 + 1 + RELIABLE_SACK_BLOCKS * 4];
+    uint8_t flags = 0;
+    int rwnd_adv = r->rwnd_adv;
+    int n = build_ack_payload(r, s, ack, &flags);
+    if (n > (int)P2P_PKT_ACK_PSZ + ((flags & P2P_ACK_FLAG_RWND) ? 4 : 0) + ((flags & P2P_ACK_FLAG_ECN) ? 4 : 0)) {
+        r->rwnd_adv = rwnd_adv;         // 未发出的通告不算数
+        return 0;
+    }
 
-        if (e->send_time == 0) {
-            /* 首次发送 */
-            p2p_send_packet(s, &s->active_addr, P2P_PKT_DATA, 0, e->seq, e->data, e->len, now);
-            e->send_time = now;
-            e->retx_count = 0;
-        } else if ((int)tick_diff(now, e->send_time) >= r->rto) {
-            /* 超时重传 + 指数退避 */
-            p2p_send_packet(s, &s->active_addr, P2P_PKT_DATA, 0, e->seq, e->data, e->len, now);
+    r->need_ack = false;
+    r->ack_pending = 0;
+    buf[0] = flags;
+    memcpy(buf + 1, ack, n);
+    return 1 + n;
+}
+
+/*
+ * 发出一个 DATA 包：path 为 PATH_IDX_NONE 时走活跃路径，否则经多路径调度选定的路径并按路径记账
+ * + 经活跃路径发出时捎带待发的 ACK（见 p2p_transport.h 捎带 ACK）
+ */
+static void data_send(struct p2p_session *s, retx_entry_t *e, int path, uint64_t now) {
+    uint8_t buf[P2P_DATA_ACK_MAX + P2P_PMTU_PAYLOAD_MAX];
+    const uint8_t *data = e->data;
+    int len = e->len, n;
+    uint8_t flags = 0;
+    if ((path == PATH_IDX_NONE || path == s->active_path) && (n = ack_piggyback(s, e->len, buf)) > 0) {
+        memcpy(buf + n, e->data, e->len);
+        data = buf;
+        len += n;
+        flags = P2P_DATA_FLAG_ACK;
+    }
+
+    if (path == PATH_IDX_NONE) {
+        p2p_send_packet(s, &s->active_addr, P2P_PKT_DATA, flags, e->seq, data, len, now);
+    } else {
+        p2p_send_packet_path(s, path, P2P_PKT_DATA, flags, e->seq, data, len, now);
+        path_manager_mp_on_send(s, path, e->len);
+    }
+    e->path = path;
+}
+
+/*
+ * 冗余双发：本包所属流要求双发时，经次优路径再发一份（标记 P2P_DATA_FLAG_DUP，不计入拥塞/节奏）
+ * + *dup 为本轮 tick 缓存的次优路径（PATH_IDX_NONE - 1 = 尚未计算）
+ */
+static void data_send_dup(struct p2p_session *s, const retx_entry_t *e, int *dup, uint64_t now) {
+    if (e->redundant == P2P_REDUNDANT_OFF) return;
+    if (e->redundant == P2P_REDUNDANT_AUTO && !path_manager_quality_falling(s)) return;
+
+    if (*dup == PATH_IDX_NONE - 1) *dup = path_manager_select_backup_path(s);
+    if (*dup == PATH_IDX_NONE || *dup == e->path) return;
+    p2p_send_packet_path(s, *dup, P2P_PKT_DATA, P2P_DATA_FLAG_DUP, e->seq, e->data, e->len, now);
+}
+
+/* 重传选路：丢失先归账到上次发送的路径，多路径时再选当前 RTT 最低的路径（不受路径窗口限制） */
+static int retx_path(struct p2p_session *s, const retx_entry_t *e, bool mp, uint64_t now) {
+    if (e->path >= 0) path_manager_mp_on_loss(s, e->path, e->len, e->send_time, now);
+    return mp ? path_manager_mp_pick(s, e->len, true) : PATH_IDX_NONE;
+}
+
+/*
+ * 尾部丢失探测（TLP）：最后发出的未确认包作为探测对象
+ * + 探测超时 PTO = 2 * SRTT，仅 1 个包在途时再加对端的延迟 ACK，不低于 RELIABLE_TLP_MIN
+ * + 计时起点取该包发出与最近一次新确认到达中较晚者；PTO 不早于该包 RTO 时交给超时重传
+ * + 返回 true 表示需要探测：*last 为探测对象，*remain 为距探测到期的毫秒数（<= 0 应立即探测）
+ */
+static bool tlp_check(const struct p2p_session *s, uint64_t now, retx_entry_t **last, int *remain) {
+    const reliable_t *r = &s->reliable;
+    if (r->tlp_out || r->srtt <= 0 || !p2p_tune(s, P2P_TUNE_TLP)) return false;
+
+    int inflight = (int)(r->send_seq - r->send_base);
+    if (inflight > r->window) inflight = r->window;
+    retx_entry_t *e = NULL;
+    for (int i = inflight - 1; i >= 0; i--) {
+        retx_entry_t *x = &r->send_buf[SLOT(r, r->send_base + i)];
+        if (!x->acked && x->send_time) { e = x; break; }
+    }
+    if (!e || e->bulk) return false;
+
+    int pto = 2 * r->srtt;
+    if (r->send_count == 1) pto += ack_delay_req(s);
+    if (pto < RELIABLE_TLP_MIN) pto = RELIABLE_TLP_MIN;
+
+    uint64_t ref = r->ack_rx_ts > e->send_time ? r->ack_rx_ts : e->send_time;
+    if ((int)tick_diff(ref + pto, e->send_time) >= e->rto) return false;
+    *last = e;
+    *remain = pto - (int)tick_diff(now, ref);
+    return true;
+}
+
+/* 活跃路径为支持 BULK 的 RELAY 信令中转（见 p2p_transport.h BULK 批量帧） */
+static bool bulk_path(const struct p2p_session *s) {
+    return s->reliable.bulk && s->path_type == P2P_PATH_SIGNALING
+        && s->inst->sig_mode == P2P_SIGNALING_MODE_RELAY && s->inst->sig_ctx.relay.feature_bulk
+        && !path_manager_mp_enabled(s) && !(s->dtls && s->dtls->is_ready((struct p2p_session *)s));
+}
+
+/*
+ * 将从 send_base 起首个待发包开始的连续新包合为一个 BULK 帧发出（受 cwnd / 对端接收窗口限制）
+ * + 中转忙（等待 READY）或发送失败时不标记发出，包留待下一帧
+ * + 返回 true 表示因 cwnd 受限而停止
+ */
+static bool bulk_send(struct p2p_session *s, int64_t cwnd, int64_t *in_bytes, int64_t *rwnd, uint64_t now) {
+    reliable_t *r = &s->reliable;
+    if (s->sig_sess.relay.awaiting_relay_ready) return false;
+
+    // 双方均支持大帧模式时在实例共用的大缓冲中组帧
+    uint8_t small[P2P_PKT_BULK_MAX], *buf = r->bulk_large ? p2p_signal_relay_bulk_buf(s->inst) : NULL;
+    int max = buf ? (int)P2P_PKT_BULK_LARGE_MAX : (int)P2P_PKT_BULK_MAX;
+    if (!buf) buf = small;
+
+    int n = 0, cnt = 0, first = -1;
+    bool cwnd_limited = false;
+    int inflight = (int)(send_end(r) - r->send_base);
+    for (int i = (int)(r->send_next - r->send_base); i < inflight; i++) {
+        retx_entry_t *e = &r->send_buf[SLOT(r, r->send_base + i)];
+        if (e->acked || e->send_time) { if (first >= 0) break; continue; }
+        if (n + 2 + e->len > max) break;
+        if (*in_bytes >= cwnd) { cwnd_limited = true; break; }
+        if (*rwnd < e->len) { r->rwnd_blocked = true; break; }
+        if (first < 0) first = i;
+        nwrite_s(buf + n, (uint16_t)e->len);
+        memcpy(buf + n + 2, e->data, e->len);
+        n += 2 + e->len;
+        cnt++;
+        *in_bytes += e->len;
+        *rwnd -= e->len;
+    }
+    if (!cnt) return cwnd_limited;
+
+    uint16_t seq = (uint16_t)(r->send_base + first);
+    if (p2p_send_packet(s, &s->active_addr, P2P_PKT_BULK, 0, seq, buf, n, now) < 0) return cwnd_limited;
+
+    for (int i = first; i < first + cnt; i++) {
+        retx_entry_t *e = &r->send_buf[SLOT(r, r->send_base + i)];
+        reliable_rate_on_send(r, e, now);
+        e->send_time = now;
+        e->send_us = P_tick_us();
+        e->rto = RELIABLE_BULK_RTO;
+        e->retx_count = 0;
+        e->path = PATH_IDX_NONE;
+        e->bulk = true;
+        reliable_on_sent(r, e);
+    }
+    if (P2P_LOG_ON(VERBOSE)) print("V:", LA_F("bulk frame sent seq=%u pkts=%d len=%d", LA_F559, 559), seq, cnt, n);
+    return cwnd_limited;
+}
+
+/*
+ * 受拥塞窗口限制的 tick（供 BBR 等拥塞控制模块使用）
+ * + cwnd 只限制新包首次发送；丢失包的重传不受限，以免窗口被已丢失的包占满而停滞
+ */
+void reliable_tick_cwnd(struct p2p_session *s, int64_t cwnd) {
+    reliable_t *r = &s->reliable;
+    uint64_t now = p2p_now_ms();
+    int64_t in_bytes = cwnd < INT64_MAX ? reliable_inflight_bytes(s) : 0;
+    int64_t rwnd = reliable_rwnd_avail(s);
+    bool cwnd_limited = false;
+    bool mp = path_manager_mp_enabled(s);
+    bool bulk = bulk_path(s);
+    int dup = PATH_IDX_NONE - 1;
+    int rto_max = p2p_tune(s, P2P_TUNE_RTO_MAX_MS);
+    if (cwnd < INT64_MAX) p2p_trace_cwnd(s, cwnd, 0);
+
+    r->pace_blocked = false;
+    r->rwnd_blocked = false;
+    r->send_next = unsent_first(r);
+    if (bulk) cwnd_limited = bulk_send(s, cwnd, &in_bytes, &rwnd, now);
+
+    /* RACK 快速重传：之后发出的包已确认，本包视为丢失
+       + 发送顺序链表头部为最早发出的包；单路径时剩余时间随发送时间单调，遇到未到期或晚于参考包的条目即停止
+       + 多路径各路径参考包不同，遍历全部在途包；BULK 帧中的包不做 RACK */
+    if (!bulk && (mp || r->rack_ts)) {
+        for (int id = r->sent_head, n = r->send_count; id && n > 0; n--) {
+            retx_entry_t *e = &r->send_buf[id - 1];
+            id = e->sent_next;
+            int remain;
+            if (!rack_check(s, e, now, &remain)) {
+                if (!mp && !e->bulk && e->send_time > r->rack_ts) break;
+                continue;
+            }
+            if (remain > 0) { if (mp) continue; break; }
+            reliable_expire(s, e, now);
+            if (!reliable_pace_take(s, P2P_HDR_SIZE + e->len, now)) break;
+            reliable_rate_on_send(r, e, now);
+            data_send(s, e, retx_path(s, e, mp, now), now);
+            data_send_dup(s, e, &dup, now);
             e->send_time = now;
+            e->send_us = P_tick_us();
             e->retx_count++;
-            r->rto = r->rto * 2;
-            if (r->rto > RELIABLE_RTO_MAX) r->rto = RELIABLE_RTO_MAX;
-            print("W:", LA_F("retry seq=%u retx=%d rto=%d", LA_F472, 472),
-                         e->seq, e->retx_count, r->rto);
+            reliable_on_sent(r, e);
+            p2p_count_retx(s, e->seq, "fast");
+            if (P2P_LOG_ON(VERBOSE)) print("V:", LA_F("fast retransmit seq=%u retx=%d rack_seq=%u", LA_F476, 476),
+                                                  e->seq, e->retx_count, r->rack_seq);
+        }
+    }
+
+    /* 超时重传 + 本包指数退避：只弹出截止时间已到的堆顶（截止时间被改写推迟的条目按实际值重新入堆） */
+    while (r->retx_heap_cnt && !r->pace_blocked && HEAP_DUE(r, 0) <= now) {
+        retx_entry_t *e = &r->send_buf[r->retx_heap[0]];
+        if ((int)tick_diff(now, e->send_time) < e->rto) { reliable_retx_update(r, e); continue; }
+        reliable_expire(s, e, now);
+        if (!reliable_pace_take(s, P2P_HDR_SIZE + e->len, now)) break;
+        // 超过基础负载的包再次超时：可能是路径 MTU 黑洞（路由变化），回退后本包按分段重传
+        if (e->len > P2P_MAX_PAYLOAD && e->retx_count >= 1) nat_pmtu_fallback(s, e->path, now);
+        reliable_rate_on_send(r, e, now);
+        data_send(s, e, retx_path(s, e, mp, now), now);
+        data_send_dup(s, e, &dup, now);
+        e->send_time = now;
+        e->send_us = P_tick_us();
+        e->retx_count++;
+        p2p_count_retx(s, e->seq, "rto");
+        e->rto = e->rto * 2;
+        if (e->rto > rto_max) e->rto = e->bulk ? RELIABLE_BULK_RTO : rto_max;
+        reliable_on_sent(r, e);
+        print("W:", LA_F("retry seq=%u retx=%d rto=%d", LA_F472, 472),
+                     e->seq, e->retx_count, e->rto);
+    }
+
+    /* 首次发送（BULK 模式下由 bulk_send 成帧发出）：从首个未发送条目开始
+       + 高优先级条目先调度：high_end 之前先只发 P2P_PRIO_HIGH 条目，再从头发其余条目（节奏/窗口受限时高优先级包先得到配额） */
+    uint32_t end = send_end(r);
+    bool hi = seq32_diff(r->high_end, r->send_next) > 0 && seq32_diff(r->high_end, end) <= 0, full = false;
+    for (int pass = hi ? 0 : 1; pass < 2 && !bulk && !full && !r->pace_blocked; pass++) {
+        uint32_t stop = pass ? end : r->high_end;
+        for (uint32_t q = r->send_next; seq32_diff(q, stop) < 0; q++) {
+            retx_entry_t *e = &r->send_buf[SLOT(r, q)];
+            if (e->acked || e->send_time) continue;
+            if (!pass && e->prio != P2P_PRIO_HIGH) continue;
+            reliable_expire(s, e, now);
+            if (in_bytes >= cwnd) { cwnd_limited = full = true; break; }
+            if (rwnd < e->len && !reliable_rwnd_probe(s, rwnd, now)) continue;
+            int path = mp ? path_manager_mp_pick(s, e->len, false) : PATH_IDX_NONE;
+            if (mp && path == PATH_IDX_NONE) { cwnd_limited = true; continue; }   // 各路径窗口均已满
+            if (!reliable_pace_take(s, P2P_HDR_SIZE + e->len, now)) break;
+            reliable_rate_on_send(r, e, now);
+            data_send(s, e, path, now);
+            data_send_dup(s, e, &dup, now);
+            fec_on_send(s, e->seq, e->data, e->len, now);
+            e->send_time = now;
+            e->send_us = P_tick_us();
+            e->rto = r->rto;
+            e->retx_count = 0;
+            reliable_on_sent(r, e);
+            in_bytes += e->len;
+            rwnd -= e->len;
         }
     }
 
+    /* 尾部丢失探测：重发最后一个包，不判定丢失、不退避 RTO */
+    retx_entry_t *last;
+    int tlp;
+    if (!r->pace_blocked && tlp_check(s, now, &last, &tlp) && tlp <= 0
+        && reliable_pace_take(s, P2P_HDR_SIZE + last->len, now)) {
+        reliable_rate_on_send(r, last, now);
+        data_send(s, last, mp ? path_manager_mp_pick(s, last->len, true) : PATH_IDX_NONE, now);
+        data_send_dup(s, last, &dup, now);
+        last->send_time = now;
+        last->send_us = P_tick_us();
+        last->retx_count++;
+        reliable_on_sent(r, last);
+        r->tlp_out = true;
+        p2p_count_retx(s, last->seq, "tlp");
+        if (P2P_LOG_ON(VERBOSE)) print("V:", LA_F("tail loss probe seq=%u srtt=%d", LA_F672, 672),
+                                              last->seq, r->srtt);
+    }
+
+    /* 所有包均已发出：后续样本受应用层限制，未满的 FEC 组随之结束 */
+    if (!cwnd_limited && !r->pace_blocked) {
+        reliable_mark_app_limited(s);
+        if (!r->rwnd_blocked) fec_flush(s, now);
+    }
+
     /* 发送 ACK */
     reliable_tick_ack(s);
 }
 
+/*
+ * 路径迁移：序号与在途窗口保留，字节流不因故障转移中断
+ * + 旧路径上的在途包大概率已丢失，不等 RTO 立即经新路径重传（不退避，不计入丢包）
+ * + 多路径时仅重传原先经旧路径发出的包，其余路径上的在途包不受影响
+ * + RTT/RACK/节奏状态属于旧路径，清零后由新路径的首批样本重建
+ */
+void reliable_on_migrate(struct p2p_session *s, int old_path) {
+    reliable_t *r = &s->reliable;
+    uint64_t now = p2p_now_ms();
+
+    r->srtt = 0;
+    r->rttvar = 0;
+    r->srtt_us = 0;
+    r->rttvar_us = 0;
+    r->rto = rto_init(s);
+    r->rack_ts = 0;
+    r->rack_rtt = 0;
+    r->pace_tokens = 0;
+    r->pace_ts = 0;
+    if (s->trans && s->trans->on_migrate) s->trans->on_migrate(s);
+
+    int n = 0, inflight = (int)(r->send_seq - r->send_base);
+    for (int i = 0; i < inflight && i < r->window; i++) {
+        retx_entry_t *e = &r->send_buf[SLOT(r, r->send_base + i)];
+        if (e->acked || e->send_time == 0) continue;
+        if (e->path >= 0 && e->path != old_path) continue;
+        reliable_rate_on_send(r, e, now);
+        data_send(s, e, PATH_IDX_NONE, now);
+        e->send_time = now;
+        e->send_us = P_tick_us();
+        e->rto = r->rto;
+        e->retx_count++;
+        reliable_on_sent(r, e);
+        p2p_count_retx(s, e->seq, "migrate");
+        n++;
+    }
+    if (n) print("I:", LA_F("path migrated: %d in-flight packets resent", LA_F532, 532), n);
+}
+
+/*
+ * 计算下一次需要 reliable_tick 的时间
+ * + 供事件驱动的工作线程计算阻塞等待时长
+ */
+int reliable_next_timeout(const struct p2p_session *s, uint64_t now) {
+    const reliable_t *r = &s->reliable;
+    if (r->need_ack || ack_delay_expired(r, now) || rwnd_update_due(s)) return 0;
+
+    // 有包到期待发但被发送节奏暂停：按令牌补充时间唤醒（亚 tick）
+    int pace = reliable_pace_wait(s, now);
+    if (pace < 0) pace = 0;
+
+    // 延迟 ACK 到期时间
+    int next = r->ack_pending > 0 ? r->ack_delay - (int)tick_diff(now, r->ack_first_ts) : -1;
+
+    // 待首发的包（BULK 模式中转忙时等待 STATUS(READY)，到达即唤醒）
+    bool bulk = bulk_path(s);
+    if (seq32_diff(unsent_first(r), send_end(r)) < 0 && !(bulk && s->sig_sess.relay.awaiting_relay_ready)) {
+        // 受对端接收窗口限制：等待窗口更新（ACK 到达即唤醒），或零窗口探测到期
+        if (!r->rwnd_blocked) return pace;
+        if (r->persist_ts) {
+            int persist = r->rto - (int)tick_diff(now, r->persist_ts);
+            if (persist <= 0) return pace;
+            if (next < 0 || persist < next) next = persist;
+        }
+    }
+
+    // 超时重传：堆顶为最早到期的在途包
+    if (r->retx_heap_cnt) {
+        uint64_t due = HEAP_DUE(r, 0);
+        if (due <= now) return pace;
+        int remain = (int)(due - now);
+        if (next < 0 || remain < next) next = remain;
+    }
+
+    // RACK：与 reliable_tick_cwnd 相同，单路径只需看最早发出的适用条目
+    bool mp = path_manager_mp_enabled(s);
+    if (!bulk && (mp || r->rack_ts)) {
+        for (int id = r->sent_head, n = r->send_count; id && n > 0; n--) {
+            const retx_entry_t *e = &r->send_buf[id - 1];
+            id = e->sent_next;
+            int rack;
+            if (!rack_check(s, e, now, &rack)) {
+                if (!mp && !e->bulk && e->send_time > r->rack_ts) break;
+                continue;
+            }
+            if (rack <= 0) return pace;
+            if (next < 0 || rack < next) next = rack;
+            if (!mp) break;
+        }
+    }
+
+    // 尾部丢失探测到期时间
+    retx_entry_t *last;
+    int tlp;
+    if (tlp_check(s, now, &last, &tlp)) {
+        if (tlp <= 0) return pace;
+        if (next < 0 || tlp < next) next = tlp;
+    }
+    return next;
+}
+
 /*
  * 注：reliable 作为基础传输层，由 p2p.c 和高级传输层直接调用：
- *   - reliable_init()        → p2p_create() 初始化
- *   - reliable_send_pkt()    → stream_flush_to_reliable()
+ *   - reliable_init()        → p2p_connect() / 会话重置时初始化（reliable_free() 于会话释放时）
+ *   - reliable_on_caps()     → 收到 CONN / CONN_ACK 时协商窗口与扩展 SACK
+ *   - reliable_send_buf() / reliable_send_commit() → stream_flush_to_reliable()（原地组包）
  *   - reliable_tick_ack()    → PseudoTCP tick 中调用
  *   - reliable_on_data()     → p2p_update() 接收 DATA 包
- *   - reliable_on_ack()      → p2p_update() 接收 ACK 包
+ *   - reliable_on_ack()      → p2p_update() 接收 ACK 包（接收窗口 → reliable_on_rwnd()，扩展区段 → reliable_on_sack_ranges()）
  *
  * 不再暴露为 p2p_trans_ops_t 对象，避免不必要的 VTable 间接调用。
  */
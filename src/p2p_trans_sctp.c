@@ -127,7 +127,14 @@
  *   - 使用 AF_CONN 虚拟地址族，SCTP 数据包封装在 UDP 中传输
  *   - 单线程模式使用 usrsctp_init_nothreads + usrsctp_handle_timers
  *   - 多线程模式使用 usrsctp_init（usrsctp 内部管理定时器线程）
- *   - 接收使用 upcall 回调，将数据写入 stream.recv_ring
+ *   - 会话的各流一一映射为 SCTP 原生流（sid 相同），流间无队头阻塞
+ *   - 发送：flush 直接从各流 send_ring 的连续区段发出（SCTP_EXPLICIT_EOR），
+ *           消息模式下一条消息可分多次写入，末段带 SCTP_EOR，边界与 p2p_send_msg 一致；
+ *           发送缓冲区满时数据留在 send_ring，不丢弃
+ *   - 接收：receive_cb 模式，usrsctp 交出的消息缓冲区不再经中转缓冲区：
+ *           回调模式（cfg.on_message）下完整消息直接以该缓冲区回调（零拷贝），
+ *           否则一次拷贝写入所属流的 recv_ring；放不下时缓冲区按流挂起，空间释放后续投
+ *   - 无序交付：p2p_stream_unordered 置位的流以 SCTP_UNORDERED 发送
  */
 
 #define MOD_TAG "SCTP"
@@ -148,6 +155,23 @@
 /* usrsctp 全局初始化引用计数（多个 session 共享同一个 usrsctp 实例） */
 static int g_sctp_ref_count = 0;
 
+/*
+ * 挂起的接收块：recv_ring 放不下时保留 usrsctp 交出的缓冲区（不拷贝），按流排队
+ */
+typedef struct sctp_rx {
+    struct sctp_rx *next;
+    uint8_t        *data;       /* usrsctp 分配的缓冲区（free 释放） */
+    int             len;
+    int             off;        /* 字节流模式：已写入 recv_ring 的字节数 */
+    uint8_t         fflags;     /* 消息模式：P2P_FRAG_FIRST / P2P_FRAG_LAST */
+} sctp_rx_t;
+
+typedef struct {
+    sctp_rx_t     *head, *tail;
+    int            bytes;       /* 挂起字节数（超过该流 recv_ring 上限时丢弃新块） */
+    int            open;        /* 消息模式：当前消息已收到首块、末块（MSG_EOR）未到 */
+} sctp_rxq_t;
+
 /*
  * SCTP 上下文结构
  */
@@ -155,6 +179,7 @@ typedef struct {
     struct socket *sock;        /* usrsctp socket 句柄 */
     int            state;       /* 0=未连接, 1=连接中, 2=已连接 */
     uint64_t       last_tick;   /* 上次 handle_timers 时间戳 (ms) */
+    sctp_rxq_t     rxq[P2P_MAX_STREAMS];
 } p2p_sctp_ctx_t;
 
 /* ============================================================================
@@ -166,71 +191,129 @@ static int p2p_sctp_out(void *addr, void *buffer, size_t length, uint8_t tos, ui
 
     if (!s || length > P2P_MTU) return -1;
 
-    uint64_t now = P_tick_ms();
+    uint64_t now = p2p_now_ms();
     p2p_send_packet(s, &s->active_addr, P2P_PKT_DATA, 0, 0, buffer, (int)length, now);
     return 0;
 }
 
 /* ============================================================================
- * Upcall 回调：usrsctp 有数据可读时调用
+ * 接收投递：usrsctp 缓冲区 → stream
  * ============================================================================ */
-static void sctp_upcall(struct socket *sock, void *arg, int flags) {
-    struct p2p_session *s = (struct p2p_session *)arg;
-    (void)flags;
-    if (!s) return;
-    p2p_sctp_ctx_t *ctx = (p2p_sctp_ctx_t *)s->trans_data;
-    if (!ctx) return;
 
-    int events = usrsctp_get_events(sock);
+/* 投递一个接收块，返回 0 = 已全部消费，-1 = 空间不足（字节流模式下已写入的部分记入 e->off） */
+static int sctp_rx_deliver(struct p2p_session *s, stream_t *st, sctp_rx_t *e) {
 
-    /* 处理可读事件 */
-    if (events & SCTP_EVENT_READ) {
-        for (;;) {
-            uint8_t buf[P2P_MTU];
-            struct sockaddr_conn from;
-            socklen_t fromlen = sizeof(from);
-            struct sctp_rcvinfo rcvinfo;
-            socklen_t infolen = sizeof(rcvinfo);
-            unsigned int infotype = 0;
-            int msg_flags = 0;
-
-            ssize_t n = usrsctp_recvv(sock, buf, sizeof(buf),
-                                      (struct sockaddr *)&from, &fromlen,
-                                      &rcvinfo, &infolen, &infotype, &msg_flags);
-            if (n <= 0) break;
+    if (st->msg_mode) return stream_deliver_msg(s, st, e->fflags, e->data, e->len) < 0 ? -1 : 0;
 
-            if (msg_flags & MSG_NOTIFICATION) {
-                /* 处理 SCTP 事件通知 */
-                union sctp_notification *notif = (union sctp_notification *)buf;
-                if ((size_t)n >= sizeof(notif->sn_header)) {
-                    switch (notif->sn_header.sn_type) {
-                    case SCTP_ASSOC_CHANGE: {
-                        struct sctp_assoc_change *sac = &notif->sn_assoc_change;
-                        if (sac->sac_state == SCTP_COMM_UP) {
-                            ctx->state = 2;
-                            print("I:", LA_S("[SCTP] association established", LA_S23, 23));
-                        } else if (sac->sac_state == SCTP_COMM_LOST ||
-                                   sac->sac_state == SCTP_SHUTDOWN_COMP ||
-                                   sac->sac_state == SCTP_CANT_STR_ASSOC) {
-                            ctx->state = 0;
-                            print("W:", LA_F("[SCTP] association lost/shutdown (state=%u)", LA_F456, 456),
-                                  sac->sac_state);
-                        }
-                        break;
-                    }
-                    default:
-                        break;
-                    }
-                }
-                continue;
-            }
+    ringbuf_t *r = &st->recv_ring;
+    int n = e->len - e->off, room = ring_free(r);
+    if (n > room) {
+        if (r->size < r->max && st->recv_need < n) RING_STORE_REL(&st->recv_need, n);
+        n = room;
+    }
+    if (n > 0) {
+        ring_write(r, e->data + e->off, n);
+        st->recv_offset += n;
+        e->off += n;
+    }
+    return e->off < e->len ? -1 : 0;
+}
 
-            /* 应用数据 → stream recv_ring */
-            ring_write(&s->stream.recv_ring, buf, (int)n);
+/* 按序续投挂起的接收块（tick 中调用，应用读走数据或扩容后继续） */
+static void sctp_rx_drain(struct p2p_session *s, p2p_sctp_ctx_t *ctx) {
+
+    for (int sid = 0; sid < s->stream_cnt && sid < P2P_MAX_STREAMS; sid++) {
+        sctp_rxq_t *q = &ctx->rxq[sid];
+        stream_t *st = stream_get(s, sid);
+        sctp_rx_t *e;
+        while ((e = q->head) != NULL && sctp_rx_deliver(s, st, e) == 0) {
+            q->head = e->next;
+            if (!q->head) q->tail = NULL;
+            q->bytes -= e->len;
+            free(e->data);
+            p2p_free(e);
         }
     }
 }
 
+static void sctp_rx_free(p2p_sctp_ctx_t *ctx) {
+    for (int sid = 0; sid < P2P_MAX_STREAMS; sid++) {
+        sctp_rx_t *e = ctx->rxq[sid].head;
+        while (e) {
+            sctp_rx_t *next = e->next;
+            free(e->data);
+            p2p_free(e);
+            e = next;
+        }
+        memset(&ctx->rxq[sid], 0, sizeof(ctx->rxq[sid]));
+    }
+}
+
+static void sctp_on_notification(p2p_sctp_ctx_t *ctx, const union sctp_notification *notif, size_t n) {
+
+    if (n < sizeof(notif->sn_header)) return;
+    if (notif->sn_header.sn_type != SCTP_ASSOC_CHANGE) return;
+
+    const struct sctp_assoc_change *sac = &notif->sn_assoc_change;
+    if (sac->sac_state == SCTP_COMM_UP) {
+        ctx->state = 2;
+        print("I:", LA_S("[SCTP] association established", LA_S23, 23));
+    } else if (sac->sac_state == SCTP_COMM_LOST ||
+               sac->sac_state == SCTP_SHUTDOWN_COMP ||
+               sac->sac_state == SCTP_CANT_STR_ASSOC) {
+        ctx->state = 0;
+        print("W:", LA_F("[SCTP] association lost/shutdown (state=%u)", LA_F456, 456),
+              sac->sac_state);
+    }
+}
+
+/* ============================================================================
+ * 接收回调：usrsctp 交出一条消息（或超出部分交付点的消息片段），缓冲区归本模块所有
+ * （由 usrsctp 以 libc malloc 分配，须以 free 释放，不经 p2p_free）
+ * ============================================================================ */
+static int sctp_receive(struct socket *sock, union sctp_sockstore addr, void *data, size_t datalen,
+                        struct sctp_rcvinfo rcv, int flags, void *ulp_info) {
+    struct p2p_session *s = (struct p2p_session *)ulp_info;
+    (void)sock; (void)addr;
+    p2p_sctp_ctx_t *ctx = s ? (p2p_sctp_ctx_t *)s->trans_data : NULL;
+    if (!ctx) { free(data); return 1; }
+
+    /* data 为空：关联已关闭 */
+    if (!data) { ctx->state = 0; return 1; }
+
+    if (flags & MSG_NOTIFICATION) {
+        sctp_on_notification(ctx, (const union sctp_notification *)data, datalen);
+        free(data);
+        return 1;
+    }
+
+    /* 按 SCTP 流号投递到对应 stream（未协商的流号丢弃） */
+    stream_t *st = rcv.rcv_sid < P2P_MAX_STREAMS ? stream_get(s, rcv.rcv_sid) : NULL;
+    if (!st || !datalen) { free(data); return 1; }
+
+    sctp_rxq_t *q = &ctx->rxq[rcv.rcv_sid];
+    sctp_rx_t e = { NULL, (uint8_t *)data, (int)datalen, 0, 0 };
+    if (!q->open) e.fflags |= P2P_FRAG_FIRST;
+    if (flags & MSG_EOR) e.fflags |= P2P_FRAG_LAST;
+    q->open = !(flags & MSG_EOR);
+
+    /* 无挂起块时直接投递，成功即释放 usrsctp 缓冲区 */
+    if (!q->head && sctp_rx_deliver(s, st, &e) == 0) { free(data); return 1; }
+
+    if (q->bytes + e.len > st->recv_ring.max) {
+        print("W:", LA_F("[SCTP] stream %d backlog full, %d bytes dropped", LA_F546, 546), rcv.rcv_sid, e.len - e.off);
+        free(data);
+        return 1;
+    }
+    sctp_rx_t *p = (sctp_rx_t *)p2p_malloc(sizeof(*p));
+    if (!p) { free(data); return 1; }
+    *p = e;
+    if (q->tail) q->tail->next = p; else q->head = p;
+    q->tail = p;
+    q->bytes += e.len;
+    return 1;
+}
+
 /* ============================================================================
  * 订阅 SCTP 事件通知
  * ============================================================================ */
@@ -257,7 +340,7 @@ static void sctp_subscribe_events(struct socket *sock) {
  * 初始化 SCTP 传输层
  * ============================================================================ */
 static int sctp_init(struct p2p_session *s) {
-    p2p_sctp_ctx_t *ctx = calloc(1, sizeof(p2p_sctp_ctx_t));
+    p2p_sctp_ctx_t *ctx = p2p_calloc(1, sizeof(p2p_sctp_ctx_t));
     if (!ctx) return -1;
     s->trans_data = ctx;
 
@@ -279,7 +362,7 @@ static int sctp_init(struct p2p_session *s) {
     /* 创建 SCTP socket（AF_CONN: 应用管理传输，非内核协议栈） */
     struct socket *sock = usrsctp_socket(
         AF_CONN, SOCK_STREAM, IPPROTO_SCTP,
-        NULL,   /* receive_cb = NULL，使用 upcall 模式 */
+        sctp_receive,   /* receive_cb 模式：消息缓冲区直接交给本模块 */
         NULL,   /* send_cb */
         0,      /* sb_threshold */
         s       /* ulp_info */
@@ -290,9 +373,6 @@ static int sctp_init(struct p2p_session *s) {
     }
     ctx->sock = sock;
 
-    /* 设置 upcall（数据可读时回调） */
-    usrsctp_set_upcall(sock, sctp_upcall, s);
-
     /* 设为非阻塞 */
     usrsctp_set_non_blocking(sock, 1);
 
@@ -300,12 +380,13 @@ static int sctp_init(struct p2p_session *s) {
     int on = 1;
     usrsctp_setsockopt(sock, IPPROTO_SCTP, SCTP_NODELAY, &on, sizeof(on));
     usrsctp_setsockopt(sock, IPPROTO_SCTP, SCTP_RECVRCVINFO, &on, sizeof(on));
+    usrsctp_setsockopt(sock, IPPROTO_SCTP, SCTP_EXPLICIT_EOR, &on, sizeof(on));   /* 消息可分段写入，SCTP_EOR 结束 */
 
     /* 配置初始流参数 */
     struct sctp_initmsg initmsg;
     memset(&initmsg, 0, sizeof(initmsg));
-    initmsg.sinit_num_ostreams  = 1;     /* P2P 只需 1 条流 */
-    initmsg.sinit_max_instreams = 1;
+    initmsg.sinit_num_ostreams  = (uint16_t)s->stream_cnt;  /* 与会话流一一对应 */
+    initmsg.sinit_max_instreams = (uint16_t)s->stream_cnt;
     initmsg.sinit_max_attempts  = 3;
     initmsg.sinit_max_init_timeo = 5000; /* 5 秒 */
     usrsctp_setsockopt(sock, IPPROTO_SCTP, SCTP_INITMSG,
@@ -355,7 +436,7 @@ static int sctp_init(struct p2p_session *s) {
         goto fail;
     }
 
-    ctx->last_tick = P_tick_ms();
+    ctx->last_tick = p2p_now_ms();
     print("I:", LA_S("[SCTP] usrsctp initialized, connecting...", LA_S24, 24));
     return 0;
 
@@ -367,7 +448,7 @@ fail:
     usrsctp_deregister_address(s);
     g_sctp_ref_count--;
     if (g_sctp_ref_count == 0) usrsctp_finish();
-    free(ctx);
+    p2p_free(ctx);
     s->trans_data = NULL;
     return -1;
 }
@@ -375,15 +456,14 @@ fail:
 /* ============================================================================
  * 发送数据
  * ============================================================================ */
-static int sctp_send(struct p2p_session *s, const void *buf, int len) {
-    p2p_sctp_ctx_t *ctx = (p2p_sctp_ctx_t *)s->trans_data;
-    if (!ctx || !ctx->sock || ctx->state != 2) return -1;
+/* 写入一段数据：snd_flags 含 SCTP_EOR 时结束当前消息；返回接受的字节数，发送缓冲区满返回 0 */
+static int sctp_sendv(p2p_sctp_ctx_t *ctx, int sid, const void *buf, int len, uint16_t snd_flags) {
 
     struct sctp_sendv_spa spa;
     memset(&spa, 0, sizeof(spa));
     spa.sendv_flags = SCTP_SEND_SNDINFO_VALID;
-    spa.sendv_sndinfo.snd_sid = 0;             /* 流 0 */
-    spa.sendv_sndinfo.snd_flags = SCTP_EOR;    /* 完整消息 */
+    spa.sendv_sndinfo.snd_sid = (uint16_t)sid;
+    spa.sendv_sndinfo.snd_flags = snd_flags;
     spa.sendv_sndinfo.snd_ppid = PPID_BINARY;
 
     ssize_t sent = usrsctp_sendv(ctx->sock, buf, (size_t)len,
@@ -398,6 +478,53 @@ static int sctp_send(struct p2p_session *s, const void *buf, int len) {
     return (int)sent;
 }
 
+static int sctp_send_stream(struct p2p_session *s, int sid, const void *buf, int len) {
+    p2p_sctp_ctx_t *ctx = (p2p_sctp_ctx_t *)s->trans_data;
+    if (!ctx || !ctx->sock || ctx->state != 2) return -1;
+    return sctp_sendv(ctx, sid, buf, len, SCTP_EOR);    /* 完整消息 */
+}
+
+/*
+ * 从各流 send_ring 直接发送（零中转）
+ * + 取 ring_peek_ptr 的连续区段交给 usrsctp，接受多少消费多少，其余留待下次
+ * + 消息模式：跳过 [len(4)] 头后按 send_msg_left 分段，末段带 SCTP_EOR；
+ *   字节流模式：每段即一条消息
+ */
+static void sctp_flush(struct p2p_session *s) {
+    p2p_sctp_ctx_t *ctx = (p2p_sctp_ctx_t *)s->trans_data;
+    if (!ctx || !ctx->sock || ctx->state != 2) return;
+
+    for (int sid = 0; sid < s->stream_cnt; sid++) {
+        stream_t *st = stream_get(s, sid);
+        uint16_t uo = RING_LOAD_ACQ(&st->unordered) ? SCTP_UNORDERED : 0;
+        for (;;) {
+            if (st->msg_mode && !st->send_msg_left) {
+                /* 到期未发出的消息整条丢弃（已交给 SCTP 的部分由其自行重传） */
+                int mlen = stream_msg_begin(st, p2p_now_ms());
+                if (mlen < 0) break;
+                st->send_msg_left = mlen;
+                continue;   /* 重新判断：空消息（SCTP 不发送零长度消息）直接跳过 */
+            }
+            const uint8_t *p;
+            int n = ring_peek_ptr(&st->send_ring, &p);
+            if (st->msg_mode && n > st->send_msg_left) n = st->send_msg_left;
+            if (n <= 0) break;
+
+            uint16_t eor = (!st->msg_mode || n == st->send_msg_left) ? SCTP_EOR : 0;
+            int sent = sctp_sendv(ctx, sid, p, n, eor | uo);
+            if (sent <= 0) break;   /* 发送缓冲区满或出错：数据留在 send_ring */
+            ring_skip(&st->send_ring, sent);
+            stream_queue_sent(st, sent);
+            st->send_offset += sent;
+            if (st->msg_mode) st->send_msg_left -= sent;
+        }
+    }
+}
+
+static int sctp_send(struct p2p_session *s, const void *buf, int len) {
+    return sctp_send_stream(s, 0, buf, len);
+}
+
 /* ============================================================================
  * 周期性处理
  * ============================================================================ */
@@ -405,9 +532,12 @@ static void sctp_tick(struct p2p_session *s) {
     p2p_sctp_ctx_t *ctx = (p2p_sctp_ctx_t *)s->trans_data;
     if (!ctx) return;
 
+    /* 续投因 recv_ring 不足而挂起的接收块 */
+    sctp_rx_drain(s, ctx);
+
 #ifndef P2P_THREADED
     /* 单线程模式：手动驱动 usrsctp 定时器 */
-    uint64_t now = P_tick_ms();
+    uint64_t now = p2p_now_ms();
     uint32_t elapsed = (uint32_t)tick_diff(now, ctx->last_tick);
     if (elapsed > 0) {
         usrsctp_handle_timers(elapsed);
@@ -465,7 +595,8 @@ static void sctp_close(struct p2p_session *s) {
         usrsctp_finish();
     }
 
-    free(ctx);
+    sctp_rx_free(ctx);
+    p2p_free(ctx);
     s->trans_data = NULL;
 }
 
@@ -485,6 +616,8 @@ const p2p_trans_ops_t p2p_trans_sctp = {
     .init      = sctp_init,
     .close     = sctp_close,
     .send_data = sctp_send,
+    .send_stream = sctp_send_stream,
+    .flush     = sctp_flush,
     .tick      = sctp_tick,
     .on_packet = sctp_on_packet,
     .is_ready  = sctp_is_ready,
@@ -29,88 +29,495 @@
  *   SRTT    = (1-α) * SRTT + α * RTT_sample    (α = 1/8)
  *   RTTVAR  = (1-β) * RTTVAR + β * |SRTT - RTT_sample|  (β = 1/4)
  *   RTO     = SRTT + max(G, 4 * RTTVAR)        (G = 时钟粒度)
+ *
+ * 丢包检测：
+ *   - RACK（RFC 8985）：若某包之后发送的包已被确认（累积或 SACK），且该包发出已超过
+ *     rack_rtt + reo_wnd，判定为丢失并立即快速重传，不退避 RTO
+ *   - 尾部丢失探测（TLP，RFC 8985 §7）：最后发出的包约 2×SRTT 无任何 ACK 时重发该包（不退避 RTO），
+ *     尾部丢包之后没有包的确认可触发 RACK，否则只能等 RTO；新的确认到达前只探测一次（P2P_TUNE_TLP 可关闭）
+ *   - 超时：每个包独立计时（e->rto），仅该包超时才指数退避，不影响窗口内其他包
+ *
+ * 发送节奏（cfg.pacing = P2P_PACING_TOKEN_BUCKET）：
+ *   令牌桶以 1.25 * cwnd / SRTT 字节/毫秒补充，每发一包扣除包长，令牌耗尽即暂停发送，
+ *   事件驱动线程按 reliable_pace_wait 的亚 tick 时长唤醒后继续。无 RTT 样本前不限速。
+ *   cwnd 取 PseudoTCP 拥塞窗口，基础 reliable 层取 send_window * P2P_MAX_PAYLOAD；
+ *   拥塞控制模块（如 BBR）可通过 pace_rate 直接指定速率。
+ *
+ * ACK 频率（由对端在 CONN 中请求，未请求时每次 update 有新数据即 ACK）：
+ *   - 按序新包累计达到 ack_freq 个，或最早未确认包到达已超过 ack_delay 毫秒，发送 ACK
+ *   - 乱序（出现空洞或填补空洞）、重复包、窗口外包：立即 ACK，保证发送方快速重传
+ *
+ * 接收窗口（双方 CONN 通告 RELIABLE_CAP_RWND 后启用）：
+ *   - 接收方在 ACK 中携带 rwnd = recv_ring 可容纳字节数（按扩容上限）- 已按序缓冲但尚未交付的字节数
+ *   - 发送方新包首发须满足 ack_seq 之后已发出字节数 + 包长 <= rwnd（重传不受限）
+ *   - 接收方缓冲后会超出 recv_ring 可用空间的包直接丢弃（不确认），只回带当前窗口的 ACK
+ *   - 窗口关闭且无在途包时，发送方每 RTO 发出一个探测包；应用读出数据使窗口重新打开时，
+ *     接收方主动发送窗口更新
+ *   - 多流时 recv_ring 取全部流之和（流共享同一窗口，同 SCTP a_rwnd）
+ *
+ * 捎带 ACK（双方 CONN 通告 RELIABLE_CAP_ACK_DATA）：
+ *   - 有待发 ACK 时，经活跃路径发出的 DATA（首发或重传）把累积确认 + 位图（+ rwnd）前置于负载，
+ *     本轮不再单独发 ACK；双向交互的小包流量因此每个方向少一半包
+ *   - 需要扩展 SACK 区段（乱序 / 丢包时）或加上后超出路径负载上限时，照常发送独立 ACK
+ *
+ * ECN 回显（双方 CONN 通告 RELIABLE_CAP_ECN）：
+ *   - 接收方累计收到的带 CE 标记的 DATA 包数，非 0 后每个 ACK（独立或捎带）携带该计数（P2P_ACK_FLAG_ECN），
+ *     收到 CE 标记的包时立即 ACK
+ *   - 发送方按计数增量调用拥塞控制 on_ce（cfg.ecn 开启时，见 p2p_cc.c），在丢包之前减窗
+ *
+ * 多流接收：recv_bitmap 为 2 的槽位表示该包已越过空洞提前交付给所属流（无缓冲区），
+ *   recv_base 推进到这些槽位时直接跳过
+ *
+ * BULK 批量帧（活跃路径为 RELAY 信令 TCP 中转，双方通告 RELIABLE_CAP_BULK，服务器通告
+ *   P2P_RLY_FEATURE_BULK，且未加密）：
+ *   - 连续的待发新包合为一个 P2P_PKT_BULK 帧（<= P2P_PKT_BULK_MAX），每收到 STATUS(READY) 发一帧，
+ *     中转忙时新包留在队列中不算发出（不因 E_BUSY 丢包重传）
+ *   - 序号、接收窗口与 ACK 照常，接收方逐个交给 reliable_on_data；TCP 链路已可靠，帧内包不做
+ *     RACK 快速重传，仅按 RELIABLE_BULK_RTO 兜底（中转连接中断时），迁出该路径时照常重传在途包
+ *   - 大帧模式：服务器通告 P2P_RLY_FEATURE_BULK_LARGE，双方均为独立中转连接且通告
+ *     RELIABLE_CAP2_BULK_LARGE 时，单帧可达 P2P_PKT_BULK_LARGE_MAX（约 64 KB），服务器逐帧的
+ *     包头、缓冲与调度开销摊到约 50 个满载 DATA 上
  */
 
-#define RELIABLE_WINDOW   32      /* 滑动窗口大小（最大未确认数据包数） */
-#define RELIABLE_RTO_INIT 200     /* 初始 RTO (毫秒) */
+#define RELIABLE_WINDOW   32      /* 默认滑动窗口大小（最大未确认数据包数；未协议协商的对端固定按此值） */
+#ifndef P2P_FIXED_MEM
+#define RELIABLE_WINDOW_MAX 16384 /* 可配置窗口上限（<= 2^14：线上 16 位序列号相对 recv_base/send_base 还原，须远小于 2^15） */
+#else
+#define RELIABLE_WINDOW_MAX 256   /* 固定内存构建：窗口上限（重传槽位数组在 16KB 级以内） */
+#endif
+#define RELIABLE_RTO_INIT 200     /* 初始 RTO (毫秒，P2P_TUNE_RTO_INIT_MS 可调) */
 #define RELIABLE_RTO_MAX  2000    /* 最大 RTO (毫秒) */
+#define RELIABLE_REO_WND_MIN 2    /* RACK 最小乱序容忍窗口 (毫秒，默认 srtt/4) */
+#define RELIABLE_TLP_MIN     10   /* 尾部丢失探测的最短等待 (毫秒) */
+#define RELIABLE_ACK_FREQ    2    /* 默认请求对端每 N 个按序包 ACK 一次 */
+#define RELIABLE_ACK_DELAY   10   /* 默认请求对端的最长延迟 ACK (毫秒) */
+#define RELIABLE_ACK_DELAY_MAX 25 /* 对端请求的延迟上限 (毫秒，须远小于最小 RTO 50ms) */
+#define RELIABLE_PACE_BURST_MS 2  /* 令牌桶容量：按速率积累的最长时间 (毫秒，至少 2 个包) */
+#define RELIABLE_SHAPE_BURST_MS 100 /* 发送限速未指定 burst 时的令牌桶容量：按限速积累的最长时间 (毫秒，至少 2 个包) */
+#define RELIABLE_SHAPE_EPOCH_MS 100 /* 实例总限速的活跃权重统计周期 (毫秒) */
+#define RELIABLE_SACK_BLOCKS 16   /* 扩展 ACK 中 SACK 区段的最大数量 */
+#ifndef P2P_FIXED_MEM
+#define RELIABLE_POOL_SLAB   64   /* 缓冲区池每次扩容的缓冲区数 */
+#else
+#define RELIABLE_POOL_SLAB   8    /* 固定内存构建：一个 slab 不超过 16KB 级 */
+#endif
+#define RELIABLE_RWND_INIT   4096 /* 首个窗口通告前假定的对端接收窗口 (字节，= RING_MIN_SIZE) */
+#define RELIABLE_RWND_UPDATE (2 * P2P_MAX_PAYLOAD)  /* 通告窗口低于该值且可增长该值时主动发送窗口更新 */
+#define RELIABLE_BULK_RTO    5000 /* BULK 帧中包的兜底重传超时 (毫秒，不退避) */
+
+/*
+ * 能力协商（CONN / CONN_ACK 负载尾部 [caps(1)][window(2)][ack_freq(1)][ack_delay(1)][streams(1)]）
+ * + ack_freq / ack_delay 是发送方对"对端如何 ACK 我的数据"的请求
+ * + streams = 本端流数量；双方取较小值，缺省（旧版对端）为 1，非 0 号流的 DATA 只发给支持的对端
+ * + 其后（及可选的加密层参数之后）附扩展能力字节 caps2，旧版对端不读取
+ */
+#define RELIABLE_CAP_EXT_SACK 0x01  /* 支持扩展 ACK（位图之外的区段 SACK） */
+#define RELIABLE_CAP_RWND     0x02  /* 支持接收窗口通告（ACK 携带 rwnd，见 P2P_ACK_FLAG_RWND） */
+#define RELIABLE_CAP_LZ       0x04  /* 开启流压缩（cfg.compress），双方均通告时 DATA 可带 P2P_FRAG_LZ */
+#define RELIABLE_CAP_CRYPTO   0x08  /* 尾部附带加密层参数 [len(1)][params(len)]，见 p2p_dtls_ops_t.conn_params */
+#define RELIABLE_CAP_BULK     0x10  /* 可接收 P2P_PKT_BULK 批量帧（RELAY 信令中转路径） */
+#define RELIABLE_CAP_ACK_DATA 0x20  /* 可解析 DATA 捎带的 ACK（P2P_DATA_FLAG_ACK） */
+#define RELIABLE_CAP_FEC      0x40  /* 可解码 P2P_PKT_FEC 校验包（对端开启 cfg.fec 时向本端发送，见 p2p_fec.h） */
+#define RELIABLE_CAP_ECN      0x80  /* 可解析 ACK 中的 CE 计数回显（P2P_ACK_FLAG_ECN） */
+#define RELIABLE_CAP2_BUNDLE  0x01  /* caps2：可拆解 P2P_PKT_BUNDLE 合并帧 */
+#define RELIABLE_CAP2_BULK_LARGE 0x02  /* caps2：可接收大帧模式 BULK（<= P2P_PKT_BULK_LARGE_MAX，见 p2p_signal_relay_bulk_large） */
+#define RELIABLE_CAP2_RPC     0x04  /* caps2：可接收经 DATA 承载的 MSG RPC 帧（P2P_FRAG_RPC，见 p2p_rpc.h） */
+#define RELIABLE_CAP2_SKIP    0x08  /* caps2：可解析过期消息的 P2P_FRAG_SKIP 通知（见 p2p_send_msg_ttl） */
+#define RELIABLE_CAP2_RESUME  0x10  /* caps2：其后附续传令牌 [token(4)][peer_token(4)][cnt(1)][recv_offset(4) * cnt]，见 reliable_resume_t */
+#define RELIABLE_CAPS_PSZ     6     /* caps(1) + window(2) + ack_freq(1) + ack_delay(1) + streams(1) */
+#define RELIABLE_CAPS_ACK_PSZ 5     /* caps(1) + window(2) + ack_freq(1) + ack_delay(1)（不含流数量的格式） */
+#define RELIABLE_CAPS_MIN_PSZ 3     /* caps(1) + window(2)（不含 ACK 频率请求的早期格式） */
+#define RELIABLE_RESUME_PSZ(n) (9 + 4 * (n))  /* 续传令牌：token(4) + peer_token(4) + cnt(1) + 各流接收偏移 */
+#define RELIABLE_CAPS_MAX_PSZ (RELIABLE_CAPS_PSZ + 1 + P2P_DTLS_PARAMS_MAX + 1 + RELIABLE_RESUME_PSZ(P2P_MAX_STREAMS))  /* 含加密层参数、caps2 与续传令牌 */
+
+/*
+ * reliable_pool_t: 实例级缓冲区池（会话分片模式下每个分片一个，见 p2p_session_pool）
+ *
+ * 以 slab（RELIABLE_POOL_SLAB 个 P2P_PMTU_PAYLOAD_MAX 缓冲区）为单位按需扩容，
+ * 空闲缓冲区串成单链表复用。重传条目在发送时借出、确认时归还；
+ * 乱序/待读数据在收到时借出、交付 stream 后归还。
+ * 空闲会话不占用缓冲区；全部归还后由 reliable_pool_trim 释放 slab。
+ * 仅在驱动会话的线程内访问，不加锁。
+ */
+typedef struct reliable_pool {
+    void        *free_list;                             /* 空闲缓冲区链表（缓冲区首部存 next） */
+    void        *slabs;                                 /* slab 链表（slab 首部存 next） */
+    int          total;                                 /* 已分配缓冲区数 */
+    int          used;                                  /* 借出中的缓冲区数 */
+    struct p2p_mem_acct *mem;                           /* slab 计入的实例内存计量（NULL = 不计量） */
+} reliable_pool_t;
 
 /*
  * retx_entry_t: 重传队列条目
  *
  * 存储待确认数据包的完整信息，用于超时重传。
+ * data 从实例缓冲区池借出，仅在途期间非 NULL。
  */
 typedef struct {
-    uint8_t  data[P2P_MAX_PAYLOAD];  /* 数据包内容 */
+    uint8_t *data;                    /* 数据包内容（池缓冲区） */
     int      len;                     /* 数据包长度 */
-    uint16_t seq;                     /* 序列号 */
+    uint32_t seq;                     /* 序列号（32 位，线上只携带低 16 位） */
     uint64_t send_time;               /* 发送时间戳 (毫秒) */
+    uint64_t send_us;                 /* 发送时间戳 (微秒，P_tick_us；RTT 与内核接收时间戳配合) */
+    int      rto;                     /* 本包重传超时 (毫秒，发出时取 r->rto，超时后独立退避) */
+    uint64_t dlv_bytes;               /* 发出时的累计已交付字节数（交付速率采样） */
+    uint64_t dlv_ts;                  /* 发出时的最近交付时间 (毫秒) */
+    uint64_t dlv_sent_ts;             /* 发出时最近已交付包的发送时间（发送间隔起点） */
+    bool     app_limited;             /* 发出时发送端受应用层限制（无待发数据） */
     int      retx_count;              /* 已重传次数 */
     int      acked;                   /* 是否已确认 (1=已确认) */
+    int      path;                    /* 最近一次发送的路径（多路径调度，PATH_IDX_NONE = 未按路径调度） */
+    int      redundant;               /* 冗余双发模式 P2P_REDUNDANT_*（来自所属流） */
+    int      prio;                    /* 优先级类别 P2P_PRIO_*（来自所属流） */
+    bool     bulk;                    /* 经 BULK 帧发出（不做 RACK 快速重传，超时取 RELIABLE_BULK_RTO） */
+    uint32_t deadline;                /* 所属消息的过期时间（p2p_now_ms 低 32 位，0 = 不过期） */
+    int      raw_len;                 /* 承载的消息字节数（未压缩，改写为 SKIP 时通告给对端） */
+    uint64_t due;                     /* 超时重传截止时间（send_time + rto，截止时间堆的键） */
+    int      heap_pos;                /* 在截止时间堆中的位置 + 1（0 = 不在堆中：未发送或已确认） */
+    int      sent_prev, sent_next;    /* 发送顺序链表的前后槽位 + 1（0 = 无） */
 } retx_entry_t;
 
 /*
  * reliable_s: 可靠传输层状态
  *
  * 实现基于序列号的可靠传输，包含发送端和接收端状态。
+ * 槽位数组按 window 大小动态分配（环形，下标 = seq & (window-1)），
+ * 窗口大小不变时 reliable_init 复用；数据缓冲区按需从 inst->rel_pool 借出。
  */
 typedef struct reliable {
+    int          window;                                /* 本地缓冲区槽位数（2 的幂） */
+    int          send_window;                           /* 发送窗口上限 = min(本地, 对端通告)，未协商时为 RELIABLE_WINDOW */
+    bool         ext_sack;                              /* 对端支持扩展 ACK（区段 SACK） */
+    bool         ext_rwnd;                              /* 对端支持接收窗口通告 */
+    int          peer_streams;                          /* 对端流数量（未通告为 1），本端只向 sid 小于它的流发送 */
+    bool         lz;                                    /* 双方均开启流压缩 */
+    bool         bulk;                                  /* 对端可接收 BULK 批量帧 */
+    bool         ack_data;                              /* 对端可解析 DATA 捎带的 ACK */
+    bool         fec;                                   /* 对端可解码 FEC 校验包 */
+    bool         ecn_echo;                              /* 对端可解析 ACK 中的 CE 计数回显 */
+    bool         bundle;                                /* 对端可拆解 BUNDLE 合并帧 */
+    bool         bulk_large;                            /* 对端可接收大帧模式 BULK */
+    bool         rpc;                                   /* 对端可接收直连通道上的 MSG RPC 帧 */
+    bool         skip;                                  /* 对端可解析过期消息的 SKIP 通知 */
+    uint32_t     ecn_ce_rx;                             /* 收到的带 CE 标记的 DATA 包累计数（回显给对端） */
+    uint32_t     ecn_ce_tx;                             /* 对端最近一次回显的 CE 累计数 */
+
     /* ======================== 发送端状态 ======================== */
-    uint16_t     send_seq;                              /* 下一个待分配的序列号 */
-    uint16_t     send_base;                             /* 最小未确认的序列号 */
-    retx_entry_t send_buf[RELIABLE_WINDOW];             /* 发送缓冲区（环形） */
+    uint32_t     send_seq;                              /* 下一个待分配的序列号（32 位，见 seq_expand） */
+    uint32_t     send_base;                             /* 最小未确认的序列号 */
+    uint32_t     high_end;                              /* 最近一个高优先级条目的序列号 + 1（tick 先调度此前的高优先级包） */
+    retx_entry_t *send_buf;                             /* 发送缓冲区（环形，window 个槽位） */
     int          send_count;                            /* 缓冲区中待确认数据包数 */
+    uint32_t     send_next;                             /* 首个未发送条目的序列号（此前的条目均已发出或确认，按需推进） */
+    int          *retx_heap;                            /* 在途包按 due 排列的最小堆（槽位下标，window 个容量） */
+    int          retx_heap_cnt;                         /* 堆中条目数 */
+    int          sent_head, sent_tail;                  /* 在途包按最近一次发送时间排列的链表（槽位 + 1，0 = 空） */
+    int          peer_rwnd;                             /* 对端通告的接收窗口 (字节，相对其累积 ACK) */
+    uint64_t     persist_ts;                            /* 窗口关闭且无在途包的起始时间（零窗口探测计时），0 = 未关闭 */
+    bool         rwnd_blocked;                          /* 上次 tick 因对端接收窗口暂停了新包 */
 
     /* ======================== 接收端状态 ======================== */
-    uint16_t     recv_base;                             /* 下一个期望的序列号 */
-    uint8_t      recv_bitmap[RELIABLE_WINDOW];          /* 接收位图（标记已收到的包） */
-    uint8_t      recv_data[RELIABLE_WINDOW][P2P_MAX_PAYLOAD]; /* 乱序数据缓存 */
-    int          recv_lens[RELIABLE_WINDOW];            /* 各槽位数据长度 */
-    bool         need_ack;                              /* 收到新数据，需要发送 ACK */
+    uint32_t     recv_base;                             /* 下一个期望的序列号（32 位，线上序列号相对其还原） */
+    uint8_t      *recv_bitmap;                          /* 接收位图（标记已收到的包） */
+    uint8_t      **recv_data;                           /* 乱序/待读数据（池缓冲区，空槽为 NULL） */
+    int          *recv_lens;                            /* 各槽位数据长度 */
+    uint32_t     recv_next;                             /* 已收到的最高序列号 + 1（判断乱序） */
+    bool         need_ack;                              /* 需要立即发送 ACK（达到 ack_freq 或乱序） */
+    int          ack_pending;                           /* 自上次 ACK 以来收到的新包数 */
+    uint64_t     ack_first_ts;                          /* 其中最早一个的到达时间 (毫秒) */
+    int          ack_freq;                              /* 对端请求：每 N 个按序包 ACK 一次 */
+    int          ack_delay;                             /* 对端请求：最长延迟 ACK (毫秒) */
+    int          recv_bytes;                            /* 已缓冲（含乱序）尚未交付 stream 的字节数 */
+    int          rwnd_adv;                              /* 最近一次通告的接收窗口 (字节；应用线程只读) */
 
     /* ======================== RTT 估计 ======================== */
     int          srtt;                                  /* 平滑 RTT (毫秒) */
     int          rttvar;                                /* RTT 方差 */
     int          rto;                                   /* 当前重传超时 (毫秒) */
+    int64_t      srtt_us;                               /* srtt 的微秒精度值（srtt/rttvar 由其取整；被外部改写时重新同步） */
+    int64_t      rttvar_us;                             /* rttvar 的微秒精度值 */
+
+    /* ======================== RACK 丢包检测 ======================== */
+    uint64_t     rack_ts;                               /* 最近一个被确认包的发送时间（按发送时间最新） */
+    uint32_t     rack_seq;                              /* 该包序列号（同一毫秒内按序列号区分先后） */
+    int          rack_rtt;                              /* 该包的 RTT 样本 (毫秒)，0 = 尚无确认 */
+    uint64_t     ack_rx_ts;                             /* 最近一次有新交付的 ACK 到达时间（TLP 计时起点之一） */
+    bool         tlp_out;                               /* 已发出尾部探测，等待新的确认 */
+
+    /* ======================== 交付速率采样 ======================== */
+    uint64_t     delivered;                             /* 累计已交付（被确认）字节数 */
+    uint64_t     delivered_ts;                          /* 最近一次交付的时间 (毫秒) */
+    uint64_t     rs_prior;                              /* 本次 ACK 中最新发送的已交付包的 dlv_bytes */
+    uint64_t     rs_prior_ts;                           /* 该包的 dlv_ts */
+    int          rs_rtt;                                /* 该包的 RTT 样本 (毫秒，重传包为 -1) */
+    bool         rs_pending;                            /* 本次 ACK 有新交付，待生成样本 */
+    uint64_t     rs_send_elapsed;                       /* 该包与其发出时最近已交付包的发送间隔 (毫秒) */
+    bool         rs_app_limited;                        /* 该样本受应用层限制（只能作为下限参考） */
+    int64_t      rs_rate;                               /* 最近一次交付速率样本 (字节/秒) */
+    uint64_t     first_sent_ts;                         /* 最近已交付包的发送时间 */
+    uint64_t     app_limited;                           /* 非 0：累计交付量超过该值前发出的包受应用层限制 */
+
+    /* ======================== 发送节奏（令牌桶） ======================== */
+    int64_t      pace_rate;                             /* 指定发送速率 (字节/秒，>0 时覆盖 cwnd/SRTT 推算) */
+    int64_t      pace_tokens;                           /* 可发送字节数（允许透支一个包） */
+    uint64_t     pace_ts;                               /* 上次补充令牌时间 (毫秒) */
+    bool         pace_blocked;                          /* 上次 tick 因令牌耗尽暂停了发送 */
 } reliable_t;
 
+/*
+ * reliable_resume_t: 会话续传（跨完整重连保持字节流）
+ *
+ * 会话经信令重新建立（p2p_session_reset 重连准备）时 reliable 层序列号从头开始，流偏移与接收缓冲区保留。
+ * 重置前把发送窗口内的 DATA 包（含已 SACK、对端可能尚未交付流的包）保留下来；
+ * 重连的 CONN / CONN_ACK 双方互换令牌，对端记得本端令牌且本端记得对端令牌时，
+ * 按对端通告的各流接收偏移丢弃已交付的包，其余按原顺序以新序列号重新入队，只重传未交付的尾部。
+ * 令牌不匹配（对端进程重启）或旧版对端：保留的包丢弃，与未续传时相同。
+ * 仅基础 reliable 层（s->trans 为 NULL）；独立于 reliable_t，不随 reliable_init 清零。
+ */
+typedef struct {
+    uint32_t     token;                                 /* 本端令牌（会话对象创建时随机生成，重连不变） */
+    uint32_t     peer_token;                            /* 对端令牌（最近一次 CONN 交换所得，0 = 未知，不续传） */
+    uint8_t    **pkts;                                  /* 重置时保留的 DATA 包（池缓冲区，按原序列号顺序） */
+    int         *lens;                                  /* 各包长度 */
+    int          cnt;                                   /* 保留的包数 */
+    bool         pending;                               /* 已保留，等待对端在 CONN 中出示令牌 */
+} reliable_resume_t;
+
+/*
+ * p2p_shaper_t: 会话发送限速（p2p_set_rate_limit / p2p_set_rate_weight）
+ *
+ * 在发送节奏（reliable_pace_take）处检查：会话令牌桶与实例总限速（p2p_set_rate_limit_total）下
+ * 按权重分得的份额桶都有令牌才允许发包，与拥塞控制推算的节奏取较严者。
+ * 限速参数由应用线程原子写入，令牌状态只由会话所在线程访问；独立于 reliable_t，不随重连清零。
+ */
+typedef struct {
+    int64_t      rate;                                  /* 会话限速 (字节/秒，0 = 不限) */
+    int64_t      burst;                                 /* 会话令牌桶容量 (字节，0 = 按 RELIABLE_SHAPE_BURST_MS 推算) */
+    int64_t      tokens;                                /* 会话令牌桶可发送字节数（允许透支一个包） */
+    uint64_t     ts;                                    /* 会话令牌桶上次补充时间 (毫秒，0 = 未开始) */
+    uint32_t     weight;                                /* 实例总限速下的分享权重（0 视为 1） */
+    uint32_t     epoch;                                 /* 最近一次计入实例活跃权重和的统计周期 */
+    int64_t      share_rate;                            /* 最近一次计算出的份额速率 (字节/秒，0 = 实例不限速) */
+    int64_t      share_tokens;                          /* 份额桶可发送字节数 */
+    uint64_t     share_ts;                              /* 份额桶上次补充时间 (毫秒) */
+} p2p_shaper_t;
+
 /* ------------------------------ p2p_trans_reliable.c ------------------------------ */
 /*
  * 可靠传输层：实现 ARQ 重传机制
  */
 
-/* 初始化 reliable 模块 */
-void reliable_init(struct p2p_session *s);
+/* 从缓冲区池借出一个 P2P_PMTU_PAYLOAD_MAX 缓冲区（内存不足返回 NULL） */
+uint8_t *reliable_pool_get(reliable_pool_t *pool);
+
+/* 归还缓冲区 */
+void reliable_pool_put(reliable_pool_t *pool, uint8_t *buf);
+
+/* 无借出缓冲区时释放全部 slab */
+void reliable_pool_trim(reliable_pool_t *pool);
+
+/* 初始化 reliable 模块（按 cfg.reliable_window 分配槽位，失败返回 E_OUT_OF_MEMORY） */
+ret_t reliable_init(struct p2p_session *s);
+
+/* 归还池缓冲区并释放槽位数组 */
+void reliable_free(struct p2p_session *s);
+
+/* 空闲休眠（cfg.hibernate_ms）：无在途/待交付数据时释放槽位数组，序列号与协商状态保留；thaw 按原窗口重新分配 */
+bool reliable_drained(const struct p2p_session *s);
+void reliable_hibernate(struct p2p_session *s);
+ret_t reliable_thaw(struct p2p_session *s);
+
+/* 写入本端能力 [caps(1)][window(2)][ack_freq(1)][ack_delay(1)][streams(1)]，返回写入字节数 */
+int  reliable_write_caps(const struct p2p_session *s, uint8_t *buf);
+
+/* 处理对端在 CONN / CONN_ACK 中通告的能力（len 不足视为旧版对端，保持默认） */
+void reliable_on_caps(struct p2p_session *s, const uint8_t *data, int len);
+
+/* 会话续传：重连准备时（reliable_init 之前）保留发送窗口内的包；关闭/释放时归还（见 reliable_resume_t） */
+void reliable_resume_save(struct p2p_session *s);
+void reliable_resume_free(struct p2p_session *s);
 
 /* 发送数据包（加入发送缓冲区等待确认） */
 int  reliable_send_pkt(struct p2p_session *s, const uint8_t *data, int len);
 
+/* 零拷贝入队：借出下一个发送槽位的缓冲区（窗口满/内存不足返回 NULL），原地写入后提交 */
+uint8_t *reliable_send_buf(struct p2p_session *s);
+int  reliable_send_commit(struct p2p_session *s, int len);
+
+/* 为最近提交的数据包设置冗余双发模式 P2P_REDUNDANT_* / 优先级类别 P2P_PRIO_*（stream 组包后按所属流调用） */
+void reliable_set_redundant(struct p2p_session *s, int mode);
+void reliable_set_prio(struct p2p_session *s, int prio);
+
+/* 为最近提交的数据包设置所属消息的过期时间与承载的消息字节数（消息模式按 send_msg_deadline 调用） */
+void reliable_set_deadline(struct p2p_session *s, uint32_t deadline, int raw_len);
+
+/* 待（重）发条目已过期：原地改写为 P2P_FRAG_SKIP 通知（对端未通告 SKIP 时保持原包），改写返回 true */
+bool reliable_expire(struct p2p_session *s, retx_entry_t *e, uint64_t now);
+
+/* 线上序列号为 seq 的包是否已收到（冗余副本去重） */
+bool reliable_recv_has(const struct p2p_session *s, uint16_t seq);
+
 /* 接收已确认的顺序数据包 */
 int  reliable_recv_pkt(struct p2p_session *s, uint8_t *buf, int *out_len);
 
-/* 处理收到的数据包（乱序缓存） */
+/* 下一个顺序数据包的长度（不出队），无可读包返回 -1 */
+int  reliable_recv_peek(const struct p2p_session *s);
+
+/* 借出下一个顺序数据包（不出队、不拷贝），无可读包返回 NULL；处理完后以 reliable_recv_drop 出队 */
+const uint8_t *reliable_recv_ptr(const struct p2p_session *s, int *out_len);
+void reliable_recv_drop(struct p2p_session *s);
+
+/* 处理收到的数据包（乱序缓存；seq 为线上低 16 位，相对 recv_base 还原） */
 int  reliable_on_data(struct p2p_session *s, uint16_t seq, const uint8_t *payload, int len);
 
-/* 处理收到的 ACK（释放已确认数据包） */
+/* 处理收到的 ACK（释放已确认数据包；ack_seq 相对 send_base 还原，超出 send_seq 的返回 -1） */
 int  reliable_on_ack(struct p2p_session *s, uint16_t ack_seq, uint32_t sack_bits, uint64_t now);
 
+/* 处理扩展 ACK 的 SACK 区段 [n(1)][start(2) count(2)]*n */
+int  reliable_on_sack_ranges(struct p2p_session *s, const uint8_t *data, int len, uint64_t now);
+
+/* 处理 ACK 携带的对端接收窗口 */
+void reliable_on_rwnd(struct p2p_session *s, uint32_t rwnd);
+
+/* 处理 ACK 中的 CE 累计数回显（P2P_ACK_FLAG_ECN），增量交给拥塞控制 on_ce */
+void reliable_on_ecn(struct p2p_session *s, uint32_t ce, uint64_t now);
+
+/* 本端当前可通告的接收窗口 (字节) */
+int  reliable_recv_window(const struct p2p_session *s);
+
+/* 对端接收窗口剩余字节数（未协商时返回 INT64_MAX） */
+int64_t reliable_rwnd_avail(const struct p2p_session *s);
+
+/* 对端窗口不足以首发新包时调用：窗口关闭且无在途包超过 RTO 返回 true（发出一个探测包），否则标记 rwnd_blocked */
+bool reliable_rwnd_probe(struct p2p_session *s, int64_t rwnd, uint64_t now);
+
 /* 定时 ACK 处理 */
 void reliable_tick_ack(struct p2p_session *s);
 
 /* 周期 tick：发送队列中尚未发出的包、重传超时包、发送 ACK */
 void reliable_tick(struct p2p_session *s);
 
+/* 同 reliable_tick，但首次发送受拥塞窗口限制（在途字节达到 cwnd 时暂停新包，重传不受限） */
+void reliable_tick_cwnd(struct p2p_session *s, int64_t cwnd);
+
+/* 活跃路径已切换（old_path 为原路径）：在途包立即经新路径重传，重置 RTT/RACK/节奏与传输层拥塞状态 */
+void reliable_on_migrate(struct p2p_session *s, int old_path);
+
+/* 已发出且未确认的字节数 */
+int64_t reliable_inflight_bytes(const struct p2p_session *s);
+
+/* 交付速率采样：包即将发出（首发或重传）时快照交付状态 */
+void reliable_rate_on_send(reliable_t *r, retx_entry_t *e, uint64_t now);
+
+/*
+ * 在途包索引：tick 只检查到期的条目，不再逐槽扫描窗口
+ * + reliable_on_sent：条目已（重）发出（send_time / rto 已更新）后调用，移到发送顺序链表尾部并按新截止时间入堆
+ * + reliable_retx_update：send_time / rto 被改写但未重新发出时，仅调整其在堆中的位置
+ * + reliable_unsent_first：首个未发送条目的序列号（无待发条目时为 send_seq）
+ */
+void reliable_on_sent(reliable_t *r, retx_entry_t *e);
+void reliable_retx_update(reliable_t *r, retx_entry_t *e);
+uint32_t reliable_unsent_first(struct p2p_session *s);
+
+/* 本轮发送未受窗口/拥塞/节奏限制且已无待发包：之后的交付速率样本标记为受应用层限制 */
+void reliable_mark_app_limited(struct p2p_session *s);
+
 /* 查询发送窗口剩余空间 */
 int  reliable_window_avail(const struct p2p_session *s);
 
+/* 发送节奏：本包是否允许立即发出（含发送限速，见 p2p_shaper_t；允许时扣除令牌，否则标记 pace_blocked） */
+bool reliable_pace_take(struct p2p_session *s, int len, uint64_t now);
+
+/* 发送节奏：因令牌耗尽（含发送限速）暂停时距可继续发送的毫秒数，未暂停返回 -1 */
+int  reliable_pace_wait(const struct p2p_session *s, uint64_t now);
+
+/* 距下一次需要 tick 的毫秒数（待发送/待 ACK 返回 0，重传计时到期前返回剩余时间，无定时任务返回 -1） */
+int  reliable_next_timeout(const struct p2p_session *s, uint64_t now);
+
+/* ------------------------------ p2p_cc.c ------------------------------ */
+/*
+ * 可插拔拥塞控制算法（供任意窗口型传输层使用，状态保存在 s->tcp）
+ */
+
+#define P2P_CC_MSS          1200        /* 拥塞窗口计量单位 (字节) */
+
+typedef struct p2p_cc_ops {
+    const char *name;
+
+    /* 初始化拥塞状态 */
+    void    (*init)(struct p2p_session *s);
+
+    /* 新确认 acked 字节 */
+    void    (*on_ack)(struct p2p_session *s, uint32_t acked, uint64_t now);
+
+    /* 检测到丢包（超时重传） */
+    void    (*on_loss)(struct p2p_session *s, uint64_t now);
+
+    /* 对端回显 ce 个新的 CE 标记（可为空；仅 cfg.ecn 开启时调用） */
+    void    (*on_ce)(struct p2p_session *s, uint32_t ce, uint64_t now);
+
+    /* RTT 样本（可为空） */
+    void    (*on_rtt_sample)(struct p2p_session *s, int rtt_ms, uint64_t now);
+
+    /* 当前拥塞窗口 (字节) */
+    int64_t (*cwnd)(struct p2p_session *s);
+
+    /* 发送速率 (字节/秒，0 = 不限速) */
+    int64_t (*pacing_rate)(struct p2p_session *s);
+} p2p_cc_ops_t;
+
+extern const p2p_cc_ops_t p2p_cc_aimd;      /* 加性增乘性减（默认） */
+extern const p2p_cc_ops_t p2p_cc_cubic;     /* CUBIC (RFC 9438) */
+
+/* 按 p2p_cc_algo_t 选择算法（未知值回退 AIMD） */
+const p2p_cc_ops_t* p2p_cc_find(int algo);
+
 /* ------------------------------ p2p_trans_pseudotcp.c ------------------------------ */
 /*
- * PseudoTCP：类 TCP 拥塞控制
+ * PseudoTCP：类 TCP 拥塞控制（算法由 cfg.cc_algo 选择）
  */
 
-/* ACK 回调（更新拥塞窗口） */
+/* ACK 回调（按 1 MSS 更新拥塞窗口） */
 void p2p_pseudotcp_on_ack(struct p2p_session *s, uint16_t ack_seq);
 
+/* ------------------------------ p2p_trans_bbr.c ------------------------------ */
+/*
+ * BBR：基于瓶颈带宽与最小 RTT 模型的拥塞控制（不以丢包为拥塞信号）
+ */
+
+#define BBR_BW_ROUNDS       10          /* 瓶颈带宽取最近 N 轮交付速率的最大值 */
+
+typedef enum {
+    BBR_STARTUP = 0,                    /* 指数探测带宽 */
+    BBR_DRAIN,                          /* 排空 STARTUP 建立的队列 */
+    BBR_PROBE_BW,                       /* 稳态：按增益周期探测带宽 */
+    BBR_PROBE_RTT,                      /* 最小 RTT 过期：缩小窗口重新测量 */
+} bbr_state_t;
+
+typedef struct bbr {
+    bbr_state_t  state;
+    int64_t      bw_round[BBR_BW_ROUNDS];               /* 各轮最大交付速率 (字节/秒) */
+    int64_t      btl_bw;                                /* 瓶颈带宽估计 = max(bw_round) */
+    int          min_rtt;                               /* 最小 RTT 估计 (毫秒，0 = 未知) */
+    uint64_t     min_rtt_ts;                            /* 最小 RTT 更新时间 */
+    uint64_t     round_cnt;                             /* 已完成的往返轮数 */
+    uint64_t     next_round_dlv;                        /* 交付量越过此值即进入下一轮 */
+    int64_t      full_bw;                               /* STARTUP 满管检测基准 */
+    int          full_bw_cnt;                           /* 带宽未增长 25% 的连续轮数 */
+    bool         full_pipe;                             /* 已估计到瓶颈带宽 */
+    int          pacing_gain;                           /* 速率增益（千分比） */
+    int          cwnd_gain;                             /* 窗口增益（千分比） */
+    int          cycle_idx;                             /* PROBE_BW 增益周期下标 */
+    uint64_t     cycle_ts;                              /* 当前增益阶段开始时间 */
+    uint64_t     probe_rtt_done_ts;                     /* PROBE_RTT 结束时间（0 = 等待在途降至最小窗口） */
+    int64_t      prior_cwnd;                            /* 进入 PROBE_RTT 前的窗口 */
+    int64_t      cwnd;                                  /* 拥塞窗口 (字节) */
+    uint64_t     last_delivered;                        /* 上次处理时的累计交付量 */
+} bbr_t;
+
+/* 交付速率样本回调（每次 ACK 处理后由 reliable 调用） */
+void p2p_bbr_on_ack(struct p2p_session *s, uint64_t now);
+
 
 /* ============================================================================
  * 传输层函数声明
@@ -135,6 +542,12 @@ typedef struct p2p_transport_ops {
     /* 发送应用层数据 */
     int (*send_data)(struct p2p_session *s, const void *buf, int len);
 
+    /* 发送指定流（sid > 0）的应用层数据（可选；为空时仅支持 0 号流） */
+    int (*send_stream)(struct p2p_session *s, int sid, const void *buf, int len);
+
+    /* 直接从各流 send_ring 取数据发送（可选；传输层原生多流时使用，不经 send_data 中转缓冲区，保留消息边界） */
+    void (*flush)(struct p2p_session *s);
+
     /* 周期性驱动逻辑 */
     void (*tick)(struct p2p_session *s);
 
@@ -148,11 +561,15 @@ typedef struct p2p_transport_ops {
      * @return          0=成功，-1=失败（数据不可用）
      */
     int (*get_stats)(struct p2p_session *s, uint32_t *rtt_ms, float *loss_rate);
+
+    /* 活跃路径切换：重置拥塞状态（可选；旧路径的窗口与带宽估计不适用于新路径） */
+    void (*on_migrate)(struct p2p_session *s);
 } p2p_trans_ops_t;
 
 // 已知的传输层具体实现
 // 注：reliable 作为基础传输层，直接调用 reliable_* 函数，无需 VTable
 extern const p2p_trans_ops_t p2p_trans_pseudotcp; /* 拥塞控制 */
 extern const p2p_trans_ops_t p2p_trans_sctp;      /* SCTP (usrsctp) */
+extern const p2p_trans_ops_t p2p_trans_bbr;       /* BBR 拥塞控制 */
 
 #endif /* P2P_TRANSPORT_H */
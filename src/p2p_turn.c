@@ -28,7 +28,7 @@
 #define TURN_CREATE_PERM_SUCCESS  0x0108
 #define TURN_CREATE_PERM_ERROR    0x0118
 
-/* ChannelBind 方法 (Method = 0x009) - 预留 */
+/* ChannelBind 方法 (Method = 0x009) */
 #define TURN_CHANNEL_BIND_REQUEST  0x0009
 #define TURN_CHANNEL_BIND_SUCCESS  0x0109
 #define TURN_CHANNEL_BIND_ERROR    0x0119
@@ -40,14 +40,8 @@
 #define STUN_ATTR_MAPPED_ADDRESS       0x0001
 #define STUN_ATTR_USERNAME             0x0006
 #define STUN_ATTR_MESSAGE_INTEGRITY    0x0008
-#define STUN_ATTR_ERROR_CODE           0x0009
 #define STUN_ATTR_UNKNOWN_ATTRIBUTES   0x000A
-#define STUN_ATTR_LIFETIME             0x000D
-#define STUN_ATTR_XOR_PEER_ADDRESS     0x0012  /* 对端地址（Send/Data/CreatePermission） */
-#define STUN_ATTR_DATA                 0x0013  /* 中继数据负载 */
-#define STUN_ATTR_REALM                0x0014
-#define STUN_ATTR_NONCE                0x0015
-#define STUN_ATTR_XOR_RELAYED_ADDRESS  0x0016  /* 中继地址 */
+#define STUN_ATTR_CHANNEL_NUMBER       0x000C  /* 通道号（ChannelBind） */
 #define STUN_ATTR_REQUESTED_TRANSPORT  0x0019
 #define STUN_ATTR_XOR_MAPPED_ADDRESS   0x0020
 #define STUN_ATTR_FINGERPRINT          0x8028
@@ -60,6 +54,31 @@
 /* Permission 刷新间隔（权限 5 分钟过期，提前 1 分钟刷新） */
 #define TURN_PERM_REFRESH_S    240
 
+/* Allocate 重传（RFC 5389 Section 7.2.1：RTO 500ms 起倍增，最多 7 次） */
+#define TURN_RTO_MS            500
+#define TURN_ALLOC_MAX_TRIES   7
+
+/* Refresh 未收到响应时的重发间隔 */
+#define TURN_REFRESH_RETRY_MS  5000
+
+/* 通道号起始值（RFC 5766 Section 11：0x4000-0x7FFF） */
+#define TURN_CHANNEL_BASE      0x4000
+
+/* 通道绑定有效期 10 分钟，提前 2 分钟刷新；未收到响应时按 1 秒间隔重试 */
+#define TURN_CHANNEL_LIFETIME_S 600
+#define TURN_CHANNEL_REFRESH_S  480
+#define TURN_CHANNEL_RETRY_MS   1000
+
+/* 多服务器 RTT 探测：Binding 重发间隔、最多发送次数、探测窗口 */
+#define TURN_PROBE_RTO_MS       250
+#define TURN_PROBE_TRIES        3
+#define TURN_PROBE_WINDOW_MS    1000
+
+/* STUN Binding（RTT 探测） */
+#define TURN_BINDING_REQUEST    0x0001
+#define TURN_BINDING_SUCCESS    0x0101
+#define TURN_BINDING_ERROR      0x0111
+
 /* ============================================================================
  * 内部辅助函数
  * ============================================================================ */
@@ -91,22 +110,26 @@ static void update_body_len(uint8_t *buf, int off) {
     nwrite_s(buf + 2, body);
 }
 
-/* 安全遍历 STUN/TURN 属性（TLV + 4 字节对齐） */
-static inline bool turn_next_attr(const uint8_t **ptr, const uint8_t *end,
-                                  uint16_t *type, uint16_t *len,
-                                  const uint8_t **val) {
-    const uint8_t *p = *ptr;
-    if (!p || p + 4 > end) return false;
-
-    *type = nget_s(p);
-    *len  = nget_s(p + 2);
-    *val  = p + 4;
-
-    const uint8_t *next = *val + ((*len + 3) & ~3);
-    if (next > end) return false;
+/*
+ * ERROR-CODE 属性 (RFC 5389 Section 15.6):
+ *   字节 0-1: 保留
+ *   字节 2:   Class (百位数字, 3-6)
+ *   字节 3:   Number (0-99)
+ * 未携带返回 0
+ */
+static int turn_error_code(const uint8_t *buf, const p2p_stun_attrs_t *a) {
+    int al;
+    const uint8_t *val = p2p_stun_attr(buf, a, STUN_AI_ERROR_CODE, &al);
+    return val && al >= 4 ? (val[2] & 0x07) * 100 + val[3] : 0;
+}
 
-    *ptr = next;
-    return true;
+/* 复制字符串属性（REALM / NONCE）到 out，未携带或超长时保持 out 不变 */
+static void turn_attr_str(const uint8_t *buf, const p2p_stun_attrs_t *a, int ai, char *out, int size) {
+    int al;
+    const uint8_t *val = p2p_stun_attr(buf, a, ai, &al);
+    if (!val || al <= 0 || al >= size) return;
+    memcpy(out, val, al);
+    out[al] = '\0';
 }
 
 /* 解析 XOR-ADDRESS (IPv4): XOR-MAPPED / XOR-RELAYED / XOR-PEER */
@@ -126,16 +149,16 @@ static inline bool turn_parse_xor_addr_v4(const uint8_t *val, uint16_t len,
  *
  * MESSAGE-INTEGRITY 计算规则（RFC 5389 Section 15.4）:
  *   1. 先将 Length 字段设为「到 MI 结尾的长度」（包含 MI 头 + 值 = 24 字节）
- *   2. 以 key 为密钥对「从消息头到 MI 属性头之前」的数据做 HMAC-SHA1
+ *   2. 以 key 为密钥（已缓存的 HMAC 上下文）对「从消息头到 MI 属性头之前」的数据做 HMAC-SHA1
  *   3. 再追加 FINGERPRINT: 将 Length 设为「到 FP 结尾的长度」，CRC32 XOR 0x5354554E
  */
-static int append_integrity(uint8_t *buf, int off, const uint8_t key[16]) {
+static int append_integrity(uint8_t *buf, int off, const p2p_hmac_sha1_ctx_t *hmac) {
     /* MESSAGE-INTEGRITY */
     uint16_t mi_body = (uint16_t)(off - 20 + 24);
     nwrite_s(buf + 2, mi_body);
 
     uint8_t digest[20];
-    p2p_hmac_sha1(key, 16, buf, off, digest);
+    p2p_hmac_sha1_compute(hmac, buf, off, digest);
 
     off = attr_hdr(buf, off, STUN_ATTR_MESSAGE_INTEGRITY, 20);
     memcpy(buf + off, digest, 20);
@@ -206,37 +229,74 @@ static void compute_key(turn_ctx_t *t, const char *user, const char *pass) {
     int n = snprintf(concat, sizeof(concat), "%s:%s:%s", user, t->realm, pass);
     if (n > 0 && n < (int)sizeof(concat)) {
         p2p_md5((const uint8_t *)concat, n, t->key);
+        p2p_hmac_sha1_init(&t->hmac, t->key, 16);
         t->has_key = true;
     }
 }
 
-/* 解析 TURN 服务器地址 */
-static bool resolve_server(turn_ctx_t *t, const char *host, int port) {
-    struct addrinfo hints;
-    struct addrinfo *res = NULL;
-    char port_str[8];
+/*
+ * 加入实例级权限集合（开放寻址 + 线性探测，按 IP 去重，端口无关）
+ * 返回 1 = 新加入，0 = 已存在，-1 = 集合已满
+ */
+static int perm_add(turn_ctx_t *t, uint32_t ip) {
+    uint32_t i = ((ip * 2654435761u) >> 16) & (TURN_PERM_SLOTS - 1);
+    for (; t->perm_ips[i]; i = (i + 1) & (TURN_PERM_SLOTS - 1)) {
+        if (t->perm_ips[i] == ip) return 0;
+    }
+    if (t->perm_count >= TURN_PERM_SLOTS * 3 / 4) return -1;
+    t->perm_ips[i] = ip;
+    t->perm_count++;
+    return 1;
+}
 
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_DGRAM;
+/* 清空权限集合（周期刷新时按当前候选重新创建） */
+static void perm_clear(turn_ctx_t *t) {
+    memset(t->perm_ips, 0, sizeof(t->perm_ips));
+    t->perm_count = 0;
+}
 
-    snprintf(port_str, sizeof(port_str), "%d", port ? port : 3478);
-    if (getaddrinfo(host, port_str, &hints, &res) != 0 || !res) {
-        return false;
-    }
+/* 到服务器的传输为 TCP/TLS（cfg.turn_transport） */
+static inline bool turn_stream(const struct p2p_instance *inst) {
+    return inst->cfg.turn_transport != P2P_TURN_UDP;
+}
 
-    memcpy(&t->server_addr, res->ai_addr, sizeof(t->server_addr));
-    freeaddrinfo(res);
-    return true;
+/* 发往 TURN 服务器：UDP 或该槽位的 TCP/TLS 连接（未就绪时返回 E_NONE_CONTEXT） */
+static ret_t turn_xmit_msgs(struct p2p_instance *inst, turn_ctx_t *t, const sock_msg_t *msgs, int num) {
+    if (turn_stream(inst)) return p2p_turn_tcp_send(inst, t, msgs, num);
+    return p2p_udp_send_msgs(inst, &t->server_addr, msgs, num);
+}
+
+static int turn_xmit(struct p2p_instance *inst, turn_ctx_t *t, const uint8_t *buf, int len) {
+    if (!turn_stream(inst)) return p2p_udp_send_to(inst, &t->server_addr, buf, len);
+    sock_msg_t m;
+    P_msg_set(&m, buf, len);
+    return p2p_turn_tcp_send(inst, t, &m, 1);
+}
+
+/* 请求事务 ID：首发时记录，重传时沿用（服务器据此识别重传） */
+static void request_tsx(turn_ctx_t *t, uint8_t *buf) {
+    if (t->req_tries) memcpy(buf + 8, t->req_tsx, 12);
+    else memcpy(t->req_tsx, buf + 8, 12);
+    t->req_tries++;
+    t->req_ms = p2p_now_ms();
 }
 
-/* 检查某个 IP 是否已有 Permission */
-static bool has_permission(const turn_ctx_t *t, const struct sockaddr_in *addr) {
-    for (int i = 0; i < t->perm_count; i++) {
-        if (t->perms[i].sin_addr.s_addr == addr->sin_addr.s_addr)
-            return true;
+/* 按对端传输地址（IP + 端口）查找通道 */
+static turn_channel_t *find_channel(turn_ctx_t *t, const struct sockaddr_in *addr) {
+    for (int i = 0; i < t->channel_count; i++) {
+        if (t->channels[i].peer.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            t->channels[i].peer.sin_port == addr->sin_port)
+            return &t->channels[i];
     }
-    return false;
+    return NULL;
+}
+
+/* 按 ChannelBind 事务 ID 查找通道 */
+static turn_channel_t *find_channel_tsx(turn_ctx_t *t, const uint8_t *tsx) {
+    for (int i = 0; i < t->channel_count; i++) {
+        if (!memcmp(t->channels[i].tsx, tsx, 12)) return &t->channels[i];
+    }
+    return NULL;
 }
 
 /* ============================================================================
@@ -251,8 +311,7 @@ static bool has_permission(const turn_ctx_t *t, const struct sockaddr_in *addr)
  *   [MESSAGE-INTEGRITY (24)]
  *   [FINGERPRINT (8)]
  * ============================================================================ */
-static int turn_refresh(struct p2p_instance *inst) {
-    turn_ctx_t *t = &inst->turn;
+static int turn_refresh(struct p2p_instance *inst, turn_ctx_t *t) {
     if (t->state != TURN_ALLOCATED || !t->has_key) return -1;
     if (!inst->cfg.turn_user) return -1;
 
@@ -263,9 +322,9 @@ static int turn_refresh(struct p2p_instance *inst) {
 
     /* 认证 */
     off = append_auth_attrs(buf, off, t, inst->cfg.turn_user);
-    off = append_integrity(buf, off, t->key);
+    off = append_integrity(buf, off, &t->hmac);
 
-    return p2p_udp_send_to(inst, &t->server_addr, buf, off);
+    return turn_xmit(inst, t, buf, off);
 }
 
 /* ============================================================================
@@ -280,22 +339,24 @@ static int turn_refresh(struct p2p_instance *inst) {
  *   [MESSAGE-INTEGRITY (24)]
  *   [FINGERPRINT (8)]
  * ============================================================================ */
-static int allocate_auth(struct p2p_instance *inst) {
-    turn_ctx_t *t = &inst->turn;
+static int allocate_auth(struct p2p_instance *inst, turn_ctx_t *t) {
 
     if (!t->has_key) {
         if (!inst->cfg.turn_user || !inst->cfg.turn_pass) {
             print("E:", LA_F("TURN auth required but no credentials configured", LA_F410, 410));
             t->state = TURN_FAILED;
+            assert(inst->turn_pending);
+            --inst->turn_pending;
             return -1;
         }
         compute_key(t, inst->cfg.turn_user, inst->cfg.turn_pass);
     }
 
-    print("I: %s", "Retrying Allocate with long-term credentials");
+    if (!t->req_tries) print("I: %s", "Retrying Allocate with long-term credentials");
 
     uint8_t buf[768];
     write_stun_hdr(buf, TURN_ALLOCATE_REQUEST, 0);
+    request_tsx(t, buf);
 
     int off = 20;
 
@@ -308,13 +369,29 @@ static int allocate_auth(struct p2p_instance *inst) {
     off = append_auth_attrs(buf, off, t, inst->cfg.turn_user);
 
     /* MESSAGE-INTEGRITY + FINGERPRINT */
-    off = append_integrity(buf, off, t->key);
+    off = append_integrity(buf, off, &t->hmac);
 
     t->state = TURN_AUTHENTICATING;
-    return p2p_udp_send_to(inst, &t->server_addr, buf, off);
+    return turn_xmit(inst, t, buf, off);
 }
 
 
+/* 首次 Allocate（无认证）：REQUESTED-TRANSPORT = UDP，共 28 字节 */
+static int allocate_send(struct p2p_instance *inst, turn_ctx_t *t) {
+
+    uint8_t buf[64];
+    write_stun_hdr(buf, TURN_ALLOCATE_REQUEST, 8);
+    request_tsx(t, buf);
+
+    /* REQUESTED-TRANSPORT: UDP (17) */
+    int off = 20;
+    off = attr_hdr(buf, off, STUN_ATTR_REQUESTED_TRANSPORT, 4);
+    buf[off] = TRANSPORT_UDP; buf[off+1] = 0; buf[off+2] = 0; buf[off+3] = 0;
+    off += 4;
+
+    return turn_xmit(inst, t, buf, off);
+}
+
 /* ============================================================================
  * 初始化
  * ============================================================================ */
@@ -324,8 +401,8 @@ void p2p_turn_init(turn_ctx_t *t) {
     t->state = TURN_IDLE;
 }
 
-void p2p_turn_reset(struct p2p_instance *inst) {
-    turn_ctx_t *t = &inst->turn;
+/* 释放单个槽位的分配并清零 */
+static void turn_release(struct p2p_instance *inst, turn_ctx_t *t) {
 
     /* 主动释放 TURN 分配（Refresh lifetime=0，RFC 5766 Section 5） */
     if (t->state == TURN_ALLOCATED && t->has_key && inst->cfg.turn_user) {
@@ -338,16 +415,22 @@ void p2p_turn_reset(struct p2p_instance *inst) {
         off += 4;
 
         off = append_auth_attrs(buf, off, t, inst->cfg.turn_user);
-        off = append_integrity(buf, off, t->key);
+        off = append_integrity(buf, off, &t->hmac);
 
-        p2p_udp_send_to(inst, &t->server_addr, buf, off);
+        turn_xmit(inst, t, buf, off);
         print("V: %s", "TURN Refresh(lifetime=0) sent");
     }
 
+    p2p_turn_tcp_close(inst, t);
     memset(t, 0, sizeof(*t));
     t->state = TURN_IDLE;
 }
 
+void p2p_turn_reset(struct p2p_instance *inst) {
+    for (int i = 0; i < TURN_MAX_ALLOCS; i++) turn_release(inst, &inst->turn[i]);
+    memset(&inst->turn_probe, 0, sizeof(inst->turn_probe));
+}
+
 /* ============================================================================
  * Allocate Request（首次，无认证）
  *
@@ -357,42 +440,240 @@ void p2p_turn_reset(struct p2p_instance *inst) {
  *   Total: 28 bytes
  *
  * 大多数 TURN 服务器会回复 401 Unauthorized，要求认证
+ * 未收到响应时由 p2p_turn_tick 按 RTO 重传，最终超时则置 TURN_FAILED
  * ============================================================================ */
-int p2p_turn_allocate(struct p2p_instance *inst) {
-    if (!inst->cfg.turn_server) return -1;
+/* 服务器地址就绪：发送首个 Allocate（TCP/TLS 时先建立连接，就绪后由 p2p_turn_tick 再次调用） */
+static int allocate_start(struct p2p_instance *inst, turn_ctx_t *t) {
 
-    turn_ctx_t *t = &inst->turn;
+    if (turn_stream(inst) && t->state != TURN_CONNECTING) {
+        if (p2p_turn_tcp_open(inst, t) != E_NONE) return -1;
+        t->state = TURN_CONNECTING;
+        return 0;
+    }
+
+    print("I:", LA_F("Sending Allocate Request to %s:%d", LA_F379, 379), t->host, t->port);
+
+    t->req_tries = 0;
+    int ret = allocate_send(inst, t);
+    if (ret <= 0) {
+        print("E:", LA_F("Failed to send Allocate Request: %d", LA_F292, 292), ret);
+        return -1;
+    }
 
-    if (!resolve_server(t, inst->cfg.turn_server, inst->cfg.turn_port)) {
-        print("E:", LA_F("Failed to resolve TURN server: %s", LA_F291, 291), inst->cfg.turn_server);
+    t->state = TURN_ALLOCATING;
+    return 0;
+}
+
+/* 在槽位上开始分配（host/port 已设置）：主机名未解析完成时进入 RESOLVING，由 p2p_turn_tick 轮询后再发送 Allocate */
+static int alloc_begin(struct p2p_instance *inst, turn_ctx_t *t) {
+
+    int r = p2p_dns_resolve(t->host, t->port, &t->server_addr);
+    if (r < 0) {
+        print("E:", LA_F("Failed to resolve TURN server: %s", LA_F291, 291), t->host);
         t->state = TURN_FAILED;
         return -1;
     }
+    if (r == 0) t->state = TURN_RESOLVING;
+    else if (allocate_start(inst, t) < 0) return -1;
 
-    print("I:", LA_F("Sending Allocate Request to %s:%d", LA_F379, 379),
-                 inst->cfg.turn_server, inst->cfg.turn_port ? inst->cfg.turn_port : 3478);
+    ++inst->turn_pending;
 
-    uint8_t buf[64];
-    write_stun_hdr(buf, TURN_ALLOCATE_REQUEST, 8);
+    return 0;
+}
 
-    /* REQUESTED-TRANSPORT: UDP (17) */
-    int off = 20;
-    off = attr_hdr(buf, off, STUN_ATTR_REQUESTED_TRANSPORT, 4);
-    buf[off] = TRANSPORT_UDP; buf[off+1] = 0; buf[off+2] = 0; buf[off+3] = 0;
-    off += 4;
+/* ============================================================================
+ * 多服务器 RTT 探测
+ *
+ * 候选列表：turn_server 在前，turn_servers 追加 "host[:port],..."（端口缺省同 turn_port）。
+ * 仅一个服务器时直接分配；多个时向各服务器发送 STUN Binding 测 RTT，
+ * 结束后按 RTT 升序在前 cfg.turn_allocs 个服务器上分配（槽位 0 为最近的服务器）。
+ * 探测期间 turn_pending 计 1，候选收集据此等待中继候选。
+ * ============================================================================ */
+static void probe_add(turn_probe_t *p, const char *s, size_t n, uint16_t port) {
 
-    int ret = p2p_udp_send_to(inst, &t->server_addr, buf, off);
-    if (ret <= 0) {
-        print("E:", LA_F("Failed to send Allocate Request: %d", LA_F292, 292), ret);
-        return -1;
+    if (p->cnt >= TURN_MAX_SERVERS) return;
+    turn_server_t *v = &p->servers[p->cnt];
+    while (n > 0 && s[n - 1] == ' ') n--;
+    if (!n || n >= sizeof(v->host)) return;
+
+    memcpy(v->host, s, n);
+    v->host[n] = '\0';
+    char *colon = strchr(v->host, ':');
+    if (colon) { *colon = '\0'; port = (uint16_t)atoi(colon + 1); }
+    if (!v->host[0]) return;
+
+    v->port = port;
+    p->cnt++;
+}
+
+static void probe_parse(struct p2p_instance *inst) {
+
+    turn_probe_t *p = &inst->turn_probe;
+    uint16_t port = inst->cfg.turn_port ? inst->cfg.turn_port : inst->cfg.turn_transport == P2P_TURN_TLS ? 5349 : 3478;
+
+    memset(p, 0, sizeof(*p));
+    probe_add(p, inst->cfg.turn_server, strlen(inst->cfg.turn_server), port);
+    for (const char *q = inst->cfg.turn_servers; q && *q; ) {
+        while (*q == ' ') q++;
+        size_t n = strcspn(q, ",");
+        probe_add(p, q, n, port);
+        q += n;
+        if (*q == ',') q++;
     }
+}
 
-    t->state = TURN_ALLOCATING;
+/* Binding Request（20 字节，无属性）：每次发送使用新事务 ID，迟到的旧响应不计 RTT */
+static void probe_send(struct p2p_instance *inst, turn_server_t *v, uint64_t now_ms) {
+
+    uint8_t buf[20];
+    write_stun_hdr(buf, TURN_BINDING_REQUEST, 0);
+    memcpy(v->tsx, buf + 8, 12);
+    v->sent_ms = now_ms;
+    v->tries++;
+    p2p_udp_send_to(inst, &v->addr, buf, sizeof(buf));
+}
+
+/* 已响应的排在未响应的前面，按 RTT 升序 */
+static bool probe_rtt_less(const turn_server_t *a, const turn_server_t *b) {
+    return a->rtt_ms && (!b->rtt_ms || a->rtt_ms < b->rtt_ms);
+}
+
+/* 同时保持的分配数（cfg.turn_allocs，1..TURN_MAX_ALLOCS） */
+static int alloc_want(const struct p2p_instance *inst) {
+    return inst->cfg.turn_allocs < 1 ? 1 : inst->cfg.turn_allocs > TURN_MAX_ALLOCS ? TURN_MAX_ALLOCS : inst->cfg.turn_allocs;
+}
+
+/* 探测结束：按 RTT 选出服务器并在各槽位上分配（均无响应时按配置顺序） */
+static void probe_finish(struct p2p_instance *inst) {
+
+    turn_probe_t *p = &inst->turn_probe;
+    int order[TURN_MAX_SERVERS], n = 0;
+    for (int i = 0; i < p->cnt; i++) {
+        if (p->servers[i].failed) continue;
+        int k = n++;
+        while (k > 0 && probe_rtt_less(&p->servers[i], &p->servers[order[k - 1]])) { order[k] = order[k - 1]; k--; }
+        order[k] = i;
+    }
+
+    p->active = false;
+    assert(inst->turn_pending);
+    --inst->turn_pending;
+
+    int want = alloc_want(inst);
+    if (!n) print("E:", LA_F("TURN probe: no server resolvable", LA_F667, 667));
+    for (int k = 0; k < n && k < want; k++) {
+        const turn_server_t *v = &p->servers[order[k]];
+        turn_ctx_t *t = &inst->turn[k];
+        p2p_turn_init(t);
+        memcpy(t->host, v->host, sizeof(t->host));
+        t->port = v->port;
+        t->rtt_ms = v->rtt_ms;
+        print("I:", LA_F("TURN server %s:%u selected (rtt=%ums)", LA_F668, 668), t->host, t->port, t->rtt_ms);
+        alloc_begin(inst, t);
+    }
+}
+
+static void turn_probe_tick(struct p2p_instance *inst, uint64_t now_ms) {
+
+    turn_probe_t *p = &inst->turn_probe;
+    bool waiting = false;
+    for (int i = 0; i < p->cnt; i++) {
+        turn_server_t *v = &p->servers[i];
+        if (v->failed || v->rtt_ms) continue;
+        if (!v->resolved) {
+            int r = p2p_dns_resolve(v->host, v->port, &v->addr);
+            if (r < 0) {
+                print("E:", LA_F("Failed to resolve TURN server: %s", LA_F291, 291), v->host);
+                v->failed = true;
+                continue;
+            }
+            if (r == 0) { waiting = true; continue; }
+            v->resolved = true;
+        }
+        if (v->tries < TURN_PROBE_TRIES) {
+            if (!v->tries || tick_diff(now_ms, v->sent_ms) >= TURN_PROBE_RTO_MS) probe_send(inst, v, now_ms);
+            waiting = true;
+        }
+        else if (tick_diff(now_ms, v->sent_ms) < TURN_PROBE_RTO_MS) waiting = true;
+    }
+    if (!waiting || tick_diff(now_ms, p->start_ms) >= TURN_PROBE_WINDOW_MS) probe_finish(inst);
+}
+
+bool p2p_turn_probe_response(struct p2p_instance *inst, const struct sockaddr_in *from,
+                             uint16_t type, const uint8_t *buf, int len) {
+
+    turn_probe_t *p = &inst->turn_probe;
+    if (!p->active || len < 20 || (type != TURN_BINDING_SUCCESS && type != TURN_BINDING_ERROR)) return false;
+
+    for (int i = 0; i < p->cnt; i++) {
+        turn_server_t *v = &p->servers[i];
+        if (!v->resolved || v->addr.sin_addr.s_addr != from->sin_addr.s_addr || memcmp(buf + 8, v->tsx, 12)) continue;
+        if (!v->rtt_ms) {
+            uint64_t rtt = tick_diff(p2p_now_ms(), v->sent_ms);
+            v->rtt_ms = rtt ? (uint32_t)rtt : 1;
+            print("V:", LA_F("TURN probe %s:%u rtt=%ums", LA_F669, 669), v->host, v->port, v->rtt_ms);
+        }
+        return true;                                        // 错误响应同样说明服务器可达
+    }
+    return false;
+}
+
+int p2p_turn_allocate(struct p2p_instance *inst) {
+    if (!inst->cfg.turn_server) return -1;
+
+    turn_probe_t *p = &inst->turn_probe;
+    if (p->active) return 0;                                // 探测结束后统一分配
+
+    // 多服务器已选定：仅重启空闲/失败的槽位，其余分配保持
+    if (p->cnt > 1 && inst->turn[0].host[0]) {
+        int ret = -1;
+        for (int i = 0; i < TURN_MAX_ALLOCS; i++) {
+            turn_ctx_t *t = &inst->turn[i];
+            if (!t->host[0]) continue;
+            if (t->state != TURN_IDLE && t->state != TURN_FAILED) ret = 0;
+            else if (alloc_begin(inst, t) == 0) ret = 0;
+        }
+        return ret;
+    }
+
+    probe_parse(inst);
+    if (!p->cnt) return -1;
+
+    if (p->cnt == 1) {
+        turn_ctx_t *t = &inst->turn[0];
+        memcpy(t->host, p->servers[0].host, sizeof(t->host));
+        t->port = p->servers[0].port;
+        return alloc_begin(inst, t);
+    }
+
+    // TCP/TLS：UDP Binding 测得的 RTT 不反映 TCP/TLS 可达性（UDP 可能正被封锁），按配置顺序分配
+    if (turn_stream(inst)) {
+        int ret = -1;
+        for (int k = 0; k < p->cnt && k < alloc_want(inst); k++) {
+            turn_ctx_t *t = &inst->turn[k];
+            memcpy(t->host, p->servers[k].host, sizeof(t->host));
+            t->port = p->servers[k].port;
+            if (alloc_begin(inst, t) == 0) ret = 0;
+        }
+        return ret;
+    }
+
+    print("I:", LA_F("Probing RTT of %d TURN servers", LA_F670, 670), p->cnt);
+    p->active = true;
+    p->start_ms = p2p_now_ms();
     ++inst->turn_pending;
+    turn_probe_tick(inst, p->start_ms);
 
     return 0;
 }
 
+turn_ctx_t *p2p_turn_active(struct p2p_instance *inst) {
+    for (int i = 0; i < TURN_MAX_ALLOCS; i++) {
+        if (inst->turn[i].state == TURN_ALLOCATED) return &inst->turn[i];
+    }
+    return NULL;
+}
+
 /* ============================================================================
  * Send Indication（无认证）
  *
@@ -404,11 +685,8 @@ int p2p_turn_allocate(struct p2p_instance *inst) {
  *   [XOR-PEER-ADDRESS (12)]
  *   [DATA-HDR (2+2)]
  * ============================================================================ */
-ret_t p2p_turn_send_indication(struct p2p_instance *inst, const struct sockaddr_in *peer_addr,
-                               const sock_msg_t msg[4], int num) {
-    if (num > 4) return E_INVALID;
-    turn_ctx_t *t = &inst->turn;
-    if (t->state != TURN_ALLOCATED) return E_NONE_CONTEXT;
+static ret_t send_indication(struct p2p_instance *inst, turn_ctx_t *t, const struct sockaddr_in *peer_addr,
+                             const sock_msg_t msg[4], int num) {
 
     sock_msg_t msgs[6]; int len = 0;
     for(int i=0;i<num;++i) {
@@ -438,7 +716,146 @@ ret_t p2p_turn_send_indication(struct p2p_instance *inst, const struct sockaddr_
     // 更新消息体长度
     update_body_len(buf, off);
 
-    return P_msg_send_to(p2p_udp_default_fd(inst), msgs, num+1, &t->server_addr);
+    return turn_xmit_msgs(inst, t, msgs, num+1);
+}
+
+ret_t p2p_turn_send_indication(struct p2p_instance *inst, const struct sockaddr_in *peer_addr,
+                               const sock_msg_t msg[4], int num) {
+    if (num > 4) return E_INVALID;
+    turn_ctx_t *t = p2p_turn_active(inst);
+    if (!t) return E_NONE_CONTEXT;
+    return send_indication(inst, t, peer_addr, msg, num);
+}
+
+/* ============================================================================
+ * ChannelBind Request（带认证）
+ *
+ * 将对端传输地址绑定到通道号，绑定成功后双向数据改用 ChannelData 传输。
+ * 绑定同时安装该对端 IP 的 Permission（RFC 5766 Section 11.2）。
+ *
+ * 消息结构:
+ *   [STUN Header (20)]
+ *   [CHANNEL-NUMBER (8)]  — number(2) + RFFU(2)
+ *   [XOR-PEER-ADDRESS (12)]
+ *   [USERNAME + REALM + NONCE (variable)]
+ *   [MESSAGE-INTEGRITY (24)]
+ *   [FINGERPRINT (8)]
+ * ============================================================================ */
+static int turn_channel_bind(struct p2p_instance *inst, turn_ctx_t *t, turn_channel_t *c, uint64_t now_ms) {
+
+    if (t->state != TURN_ALLOCATED || !t->has_key) return -1;
+    if (!inst->cfg.turn_user) return -1;
+
+    print("V:", LA_F("TURN ChannelBind %s:%u -> 0x%04x", LA_F535, 535),
+          inet_ntoa(c->peer.sin_addr), ntohs(c->peer.sin_port), c->number);
+
+    uint8_t buf[768];
+    write_stun_hdr(buf, TURN_CHANNEL_BIND_REQUEST, 0); int off = 20;
+
+    /* CHANNEL-NUMBER */
+    off = attr_hdr(buf, off, STUN_ATTR_CHANNEL_NUMBER, 4);
+    nwrite_s(buf + off, c->number); buf[off+2] = 0; buf[off+3] = 0;
+    off += 4;
+
+    /* XOR-PEER-ADDRESS */
+    off = append_xor_addr(buf, off, STUN_ATTR_XOR_PEER_ADDRESS, &c->peer);
+
+    /* 认证 */
+    off = append_auth_attrs(buf, off, t, inst->cfg.turn_user);
+    off = append_integrity(buf, off, &t->hmac);
+
+    memcpy(c->tsx, buf + 8, 12);
+    c->bind_ms = now_ms;
+    return turn_xmit(inst, t, buf, off);
+}
+
+/* ============================================================================
+ * 中继发送（ChannelData 优先）
+ *
+ * ChannelData 消息结构（RFC 5766 Section 11.4）:
+ *   [CHANNEL-NUMBER (2)][LENGTH (2)][DATA]
+ *   UDP 传输时无需 4 字节对齐填充，每包比 Send Indication 节省 32 字节以上
+ *
+ * 首次向某对端发送时分配通道并发起 ChannelBind，收到 Success 之前（或绑定被拒绝后）
+ * 仍使用 Send Indication，不阻塞数据发送。多个分配时经最近的服务器（p2p_turn_active）发出。
+ * ============================================================================ */
+ret_t p2p_turn_send(struct p2p_instance *inst, const struct sockaddr_in *peer_addr,
+                    const sock_msg_t msg[4], int num) {
+    if (num > 4) return E_INVALID;
+    turn_ctx_t *t = p2p_turn_active(inst);
+    if (!t) return E_NONE_CONTEXT;
+
+    turn_channel_t *c = find_channel(t, peer_addr);
+    if (!c && t->channel_count < TURN_MAX_CHANNELS && t->has_key && inst->cfg.turn_user) {
+        c = &t->channels[t->channel_count];
+        memset(c, 0, sizeof(*c));
+        c->peer = *peer_addr;
+        c->number = (uint16_t)(TURN_CHANNEL_BASE + t->channel_count);
+        t->channel_count++;
+    }
+
+    if (c && c->bound) {
+        sock_msg_t msgs[5]; int len = 0;
+        for (int i = 0; i < num; ++i) {
+            msgs[1+i] = msg[i]; len += P_msg_len(&msg[i]);
+        }
+        if (len > P2P_MTU - 4) return E_OUT_OF_CAPACITY;
+
+        uint8_t hdr[4];
+        nwrite_s(hdr, c->number);
+        nwrite_s(hdr + 2, (uint16_t)len);
+        P_msg_set(&msgs[0], hdr, sizeof(hdr));
+
+        return turn_xmit_msgs(inst, t, msgs, num+1);
+    }
+
+    uint64_t now = p2p_now_ms();
+    if (c && !c->failed && tick_diff(now, c->bind_ms) >= TURN_CHANNEL_RETRY_MS)
+        turn_channel_bind(inst, t, c, now);
+
+    return send_indication(inst, t, peer_addr, msg, num);
+}
+
+/* 按来源查找服务器槽位（IP + 端口优先，其次仅 IP）；尚无已解析的服务器时返回首个槽位 */
+static turn_ctx_t *turn_by_server(struct p2p_instance *inst, const struct sockaddr_in *from) {
+
+    turn_ctx_t *ip_match = NULL; bool any = false;
+    for (int i = 0; i < TURN_MAX_ALLOCS; i++) {
+        turn_ctx_t *t = &inst->turn[i];
+        if (!t->server_addr.sin_addr.s_addr) continue;
+        any = true;
+        if (t->server_addr.sin_addr.s_addr != from->sin_addr.s_addr) continue;
+        if (t->server_addr.sin_port == from->sin_port) return t;
+        if (!ip_match) ip_match = t;
+    }
+    return ip_match ? ip_match : any ? NULL : &inst->turn[0];
+}
+
+/* ============================================================================
+ * 处理 ChannelData 消息
+ *
+ * 首字节 0x40-0x7F 与 STUN（0x00-0x3F）及 P2P 协议包类型不冲突；
+ * 仅接受来自 TURN 服务器、通道号已分配的消息，LENGTH 不得超过实际接收长度。
+ * ============================================================================ */
+int p2p_turn_handle_channel_data(struct p2p_instance *inst, const struct sockaddr_in *from,
+                                 const uint8_t *buf, int len,
+                                 const uint8_t **out_data, int *out_len,
+                                 struct sockaddr_in *out_peer) {
+    turn_ctx_t *t = turn_by_server(inst, from);
+    if (len < 4 || !t || t->state != TURN_ALLOCATED) return 0;
+    if (turn_stream(inst) && !p2p_turn_tcp_rx(t)) return 0;
+    if (from->sin_addr.s_addr != t->server_addr.sin_addr.s_addr ||
+        from->sin_port != t->server_addr.sin_port)
+        return 0;
+
+    int idx = (int)nget_s(buf) - TURN_CHANNEL_BASE;
+    int data_len = nget_s(buf + 2);
+    if (idx < 0 || idx >= t->channel_count || data_len > len - 4) return 0;
+
+    if (out_data)  *out_data = buf + 4;
+    if (out_len)   *out_len  = data_len;
+    if (out_peer)  *out_peer = t->channels[idx].peer;
+    return 1;
 }
 
 /* ============================================================================
@@ -451,41 +868,36 @@ ret_t p2p_turn_send_indication(struct p2p_instance *inst, const struct sockaddr_
  * ============================================================================ */
 int p2p_turn_handle_packet(struct p2p_instance *inst, const struct sockaddr_in *from,
                            uint16_t type, const uint8_t *buf, int len,
+                           const p2p_stun_attrs_t *attrs,
                            const uint8_t **out_data, int *out_len,
                            struct sockaddr_in *out_peer) {
     if (len < 20) return -1;
 
-    /* 来源验证：仅处理来自 TURN 服务器的包（防止伪造） */
-    if (inst->turn.server_addr.sin_addr.s_addr &&
-        from->sin_addr.s_addr != inst->turn.server_addr.sin_addr.s_addr)
-        return -1;
-
-    turn_ctx_t *t = &inst->turn; const uint8_t* ptr = buf + 2;
-    uint16_t msg_len = nget_s(ptr);
+    /* 来源验证：仅处理来自 TURN 服务器的包（防止伪造），并据此确定所属分配 */
+    turn_ctx_t *t = turn_by_server(inst, from);
+    if (!t) return -1;
+    if (turn_stream(inst) && !p2p_turn_tcp_rx(t)) return -1;  // TCP/TLS 分配只接受经连接收到的消息
 
-    /* 安全边界：消息体不超过实际接收长度 */
-    if (20 + msg_len > len) msg_len = (uint16_t)(len - 20);
+    /* 属性索引：消息体按实际接收长度截断，越界前的属性仍可用 */
+    p2p_stun_attrs_t local;
+    if (!attrs) { p2p_stun_attrs_parse(buf, len, &local); attrs = &local; }
+    const uint8_t *val; int al;
 
     /* ----------------------------------------------------------------
      * Allocate Success Response (0x0103)
      * ---------------------------------------------------------------- */
     if (type == TURN_ALLOCATE_SUCCESS) {
+        /* 仅接受当前 Allocate 事务的首个响应（重传可能带来重复/过期响应） */
+        if ((t->state != TURN_ALLOCATING && t->state != TURN_AUTHENTICATING) ||
+            memcmp(buf + 8, t->req_tsx, 12)) return 0;
+
         struct sockaddr_in relay = {0};
         uint32_t lifetime = 600;
 
-        const uint8_t *attr = buf + 20;
-        const uint8_t *end = buf + 20 + msg_len;
-        while (attr + 4 <= end) {
-            uint16_t at = 0, al = 0;
-            const uint8_t *val = NULL;
-            if (!turn_next_attr(&attr, end, &at, &al, &val)) break;
-
-            if (at == STUN_ATTR_XOR_RELAYED_ADDRESS) {
-                turn_parse_xor_addr_v4(val, al, &relay);
-            } else if (at == STUN_ATTR_LIFETIME && al >= 4) {
-                lifetime = nget_l(val);
-            }
-        }
+        if ((val = p2p_stun_attr(buf, attrs, STUN_AI_XOR_RELAYED_ADDRESS, &al)) != NULL)
+            turn_parse_xor_addr_v4(val, (uint16_t)al, &relay);
+        if ((val = p2p_stun_attr(buf, attrs, STUN_AI_LIFETIME, &al)) != NULL && al >= 4)
+            lifetime = nget_l(val);
 
         if (relay.sin_family != AF_INET) {
             print("E: %s", "TURN Allocate success but no relay address found");
@@ -494,7 +906,7 @@ int p2p_turn_handle_packet(struct p2p_instance *inst, const struct sockaddr_in *
 
         t->relay_addr     = relay;
         t->lifetime       = lifetime;
-        t->alloc_time_ms  = P_tick_ms();
+        t->alloc_time_ms  = p2p_now_ms();
         t->last_refresh_ms = t->alloc_time_ms;
         t->last_perm_ms   = t->alloc_time_ms;
         t->state          = TURN_ALLOCATED;
@@ -549,27 +961,14 @@ int p2p_turn_handle_packet(struct p2p_instance *inst, const struct sockaddr_in *
      * 438 Stale Nonce: Nonce 过期，需使用新 Nonce 重试
      * ---------------------------------------------------------------- */
     if (type == TURN_ALLOCATE_ERROR) {
-        int error_code = 0;
+        if ((t->state != TURN_ALLOCATING && t->state != TURN_AUTHENTICATING) ||
+            memcmp(buf + 8, t->req_tsx, 12)) return 0;
+
+        int error_code = turn_error_code(buf, attrs);
         char realm[128] = {0};
         char nonce[128] = {0};
-
-        const uint8_t *attr = buf + 20;
-        const uint8_t *end = buf + 20 + msg_len;
-        while (attr + 4 <= end) {
-            uint16_t at = 0, al = 0;
-            const uint8_t *val = NULL;
-            if (!turn_next_attr(&attr, end, &at, &al, &val)) break;
-
-            if (at == STUN_ATTR_ERROR_CODE && al >= 4) {
-                error_code = (val[2] & 0x07) * 100 + val[3];
-            } else if (at == STUN_ATTR_REALM && al > 0 && al < (int)sizeof(realm)) {
-                memcpy(realm, val, al);
-                realm[al] = '\0';
-            } else if (at == STUN_ATTR_NONCE && al > 0 && al < (int)sizeof(nonce)) {
-                memcpy(nonce, val, al);
-                nonce[al] = '\0';
-            }
-        }
+        turn_attr_str(buf, attrs, STUN_AI_REALM, realm, sizeof(realm));
+        turn_attr_str(buf, attrs, STUN_AI_NONCE, nonce, sizeof(nonce));
 
         /* 401: 首次认证挑战 */
         if (error_code == 401 && t->state == TURN_ALLOCATING && realm[0] && nonce[0]) {
@@ -577,7 +976,8 @@ int p2p_turn_handle_packet(struct p2p_instance *inst, const struct sockaddr_in *
             strncpy(t->realm, realm, sizeof(t->realm) - 1);
             strncpy(t->nonce, nonce, sizeof(t->nonce) - 1);
             t->has_key = false;  /* realm 变化需重新计算 key */
-            allocate_auth(inst);
+            t->req_tries = 0;
+            allocate_auth(inst, t);
             return 0;
         }
 
@@ -585,7 +985,8 @@ int p2p_turn_handle_packet(struct p2p_instance *inst, const struct sockaddr_in *
         if (error_code == 438 && nonce[0]) {
             print("I: %s", "TURN 438 Stale Nonce, retrying...");
             strncpy(t->nonce, nonce, sizeof(t->nonce) - 1);
-            allocate_auth(inst);
+            t->req_tries = 0;
+            allocate_auth(inst, t);
             return 0;
         }
 
@@ -610,36 +1011,58 @@ int p2p_turn_handle_packet(struct p2p_instance *inst, const struct sockaddr_in *
      * CreatePermission Error (0x0118)
      * ---------------------------------------------------------------- */
     if (type == TURN_CREATE_PERM_ERROR) {
-        int error_code = 0;
-        const uint8_t *attr = buf + 20;
-        const uint8_t *end = buf + 20 + msg_len;
-        while (attr + 4 <= end) {
-            uint16_t at = 0, al = 0;
-            const uint8_t *val = NULL;
-            if (!turn_next_attr(&attr, end, &at, &al, &val)) break;
-            if (at == STUN_ATTR_ERROR_CODE && al >= 4)
-                error_code = (val[2] & 0x07) * 100 + val[3];
-        }
+        int error_code = turn_error_code(buf, attrs);
         print("E:", LA_F("TURN CreatePermission failed (error=%d)", LA_F405, 405), error_code);
         return 0;
     }
 
+    /* ----------------------------------------------------------------
+     * ChannelBind Success (0x0109) — 按事务 ID 匹配通道
+     * ---------------------------------------------------------------- */
+    if (type == TURN_CHANNEL_BIND_SUCCESS) {
+        turn_channel_t *c = find_channel_tsx(t, buf + 8);
+        if (c) {
+            if (!c->bound) print("V:", LA_F("TURN channel 0x%04x bound", LA_F536, 536), c->number);
+            c->bound = true;
+            c->bound_ms = p2p_now_ms();
+        }
+        return 0;
+    }
+
+    /* ----------------------------------------------------------------
+     * ChannelBind Error (0x0119)
+     *
+     * 438 Stale Nonce: 更新 nonce 后重试；其他错误标记通道失败，
+     * 该对端后续数据继续使用 Send Indication
+     * ---------------------------------------------------------------- */
+    if (type == TURN_CHANNEL_BIND_ERROR) {
+        turn_channel_t *c = find_channel_tsx(t, buf + 8);
+        if (!c) return 0;
+
+        int error_code = turn_error_code(buf, attrs);
+        char nonce[128] = {0};
+        turn_attr_str(buf, attrs, STUN_AI_NONCE, nonce, sizeof(nonce));
+        if (error_code == 438 && nonce[0]) {
+            strncpy(t->nonce, nonce, sizeof(t->nonce) - 1);
+            turn_channel_bind(inst, t, c, p2p_now_ms());
+            return 0;
+        }
+        print("W:", LA_F("TURN ChannelBind 0x%04x failed (error=%d), using Send Indication", LA_F537, 537),
+              c->number, error_code);
+        c->bound = false;
+        c->failed = true;
+        return 0;
+    }
+
     /* ----------------------------------------------------------------
      * Refresh Success (0x0104)
      * ---------------------------------------------------------------- */
     if (type == TURN_REFRESH_SUCCESS) {
         uint32_t lifetime = 600;
-        const uint8_t *attr = buf + 20;
-        const uint8_t *end = buf + 20 + msg_len;
-        while (attr + 4 <= end) {
-            uint16_t at = 0, al = 0;
-            const uint8_t *val = NULL;
-            if (!turn_next_attr(&attr, end, &at, &al, &val)) break;
-            if (at == STUN_ATTR_LIFETIME && al >= 4)
-                lifetime = nget_l(val);
-        }
+        if ((val = p2p_stun_attr(buf, attrs, STUN_AI_LIFETIME, &al)) != NULL && al >= 4)
+            lifetime = nget_l(val);
         t->lifetime = lifetime;
-        t->last_refresh_ms = P_tick_ms();
+        t->last_refresh_ms = p2p_now_ms();
         print("V:", LA_F("TURN Refresh ok (lifetime=%us)", LA_F409, 409), lifetime);
         return 0;
     }
@@ -648,28 +1071,28 @@ int p2p_turn_handle_packet(struct p2p_instance *inst, const struct sockaddr_in *
      * Refresh Error (0x0114)
      * ---------------------------------------------------------------- */
     if (type == TURN_REFRESH_ERROR) {
-        int error_code = 0;
+        int error_code = turn_error_code(buf, attrs);
         char nonce[128] = {0};
-        const uint8_t *attr = buf + 20;
-        const uint8_t *end = buf + 20 + msg_len;
-        while (attr + 4 <= end) {
-            uint16_t at = 0, al = 0;
-            const uint8_t *val = NULL;
-            if (!turn_next_attr(&attr, end, &at, &al, &val)) break;
-            if (at == STUN_ATTR_ERROR_CODE && al >= 4) {
-                error_code = (val[2] & 0x07) * 100 + val[3];
-            } else if (at == STUN_ATTR_NONCE && al > 0 && al < (int)sizeof(nonce)) {
-                memcpy(nonce, val, al);
-                nonce[al] = '\0';
-            }
-        }
+        turn_attr_str(buf, attrs, STUN_AI_NONCE, nonce, sizeof(nonce));
         /* 438: 更新 nonce 后重试 Refresh */
         if (error_code == 438 && nonce[0]) {
             strncpy(t->nonce, nonce, sizeof(t->nonce) - 1);
-            turn_refresh(inst);
+            turn_refresh(inst, t);
             return 0;
         }
         print("E:", LA_F("TURN Refresh failed (error=%d)", LA_F408, 408), error_code);
+
+        /* 分配已失效：通知 COMPACT 对端移除中继候选 */
+        if (inst->sig_mode == P2P_SIGNALING_MODE_COMPACT) {
+            for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
+                for (int i = 0; i < s->local_cand_cnt; i++) {
+                    const p2p_local_candidate_entry_t *c = &s->local_cands[i];
+                    if (c->type != P2P_CAND_RELAY || !sockaddr_equal(&c->addr, &t->relay_addr)) continue;
+                    p2p_signal_compact_delta_candidate(s, c, true);
+                    break;
+                }
+            }
+        }
         return 0;
     }
 
@@ -688,20 +1111,9 @@ int p2p_turn_handle_packet(struct p2p_instance *inst, const struct sockaddr_in *
         const uint8_t *data = NULL;
         int data_len = 0;
 
-        const uint8_t *attr = buf + 20;
-        const uint8_t *end = buf + 20 + msg_len;
-        while (attr + 4 <= end) {
-            uint16_t at = 0, al = 0;
-            const uint8_t *val = NULL;
-            if (!turn_next_attr(&attr, end, &at, &al, &val)) break;
-
-            if (at == STUN_ATTR_XOR_PEER_ADDRESS) {
-                turn_parse_xor_addr_v4(val, al, &peer);
-            } else if (at == STUN_ATTR_DATA) {
-                data = val;
-                data_len = al;
-            }
-        }
+        if ((val = p2p_stun_attr(buf, attrs, STUN_AI_XOR_PEER_ADDRESS, &al)) != NULL)
+            turn_parse_xor_addr_v4(val, (uint16_t)al, &peer);
+        data = p2p_stun_attr(buf, attrs, STUN_AI_DATA, &data_len);
 
         if (data && data_len > 0 && peer.sin_family == AF_INET) {
             print("V:", LA_F("TURN Data Indication from %s:%u (%d bytes)", LA_F407, 407),
@@ -723,73 +1135,152 @@ int p2p_turn_handle_packet(struct p2p_instance *inst, const struct sockaddr_in *
  *
  * 必须为对端 IP 创建权限，TURN 服务器才会中继来自该 IP 的数据。
  * 权限有效期 5 分钟（RFC 5766 Section 8），需定期刷新。
+ * 一个请求可携带多个 XOR-PEER-ADDRESS（RFC 5766 Section 9.1），批量为多个对端授权。
  *
  * 消息结构:
  *   [STUN Header (20)]
- *   [XOR-PEER-ADDRESS (12)]
+ *   [XOR-PEER-ADDRESS (12)] × n
  *   [USERNAME + REALM + NONCE (variable)]
  *   [MESSAGE-INTEGRITY (24)]
  *   [FINGERPRINT (8)]
  * ============================================================================ */
-static int turn_create_permission(struct p2p_instance *inst, const struct sockaddr_in *peer_addr) {
+static int turn_create_permission(struct p2p_instance *inst, turn_ctx_t *t, const uint32_t *ips, int n) {
 
-    turn_ctx_t *t = &inst->turn;
     if (t->state != TURN_ALLOCATED || !t->has_key) return -1;
     if (!inst->cfg.turn_user) return -1;
 
-    /* 去重：同一 IP 不重复发送（端口无关，RFC 5766 Section 9.1） */
-    if (has_permission(t, peer_addr)) return 0;
-
-    print("V:", LA_F("TURN CreatePermission for %s", LA_F406, 406),
-          inet_ntoa(((struct sockaddr_in *)peer_addr)->sin_addr));
-
-    uint8_t buf[768];
+    uint8_t buf[1024];
     write_stun_hdr(buf, TURN_CREATE_PERM_REQUEST, 0); int off = 20;
 
-    /* XOR-PEER-ADDRESS */
-    off = append_xor_addr(buf, off, STUN_ATTR_XOR_PEER_ADDRESS, peer_addr);
+    /* XOR-PEER-ADDRESS（端口无关，填 0） */
+    for (int i = 0; i < n; i++) {
+        struct sockaddr_in peer = {0};
+        peer.sin_family = AF_INET;
+        peer.sin_addr.s_addr = ips[i];
+        print("V:", LA_F("TURN CreatePermission for %s", LA_F406, 406), inet_ntoa(peer.sin_addr));
+        off = append_xor_addr(buf, off, STUN_ATTR_XOR_PEER_ADDRESS, &peer);
+    }
 
     /* 认证 */
     off = append_auth_attrs(buf, off, t, inst->cfg.turn_user);
-    off = append_integrity(buf, off, t->key);
+    off = append_integrity(buf, off, &t->hmac);
 
-    int ret = p2p_udp_send_to(inst, &t->server_addr, buf, off);
-    if (ret > 0 && t->perm_count < TURN_MAX_PERMISSIONS) {
-        t->perms[t->perm_count] = *peer_addr;
-        t->perm_count++;
-    }
-    return ret;
+    return turn_xmit(inst, t, buf, off);
 }
 
 /* ============================================================================
  * 周期状态机推进
  *
  * 由 p2p_update() 周期调用，负责:
- *   1. Refresh 续期（在 lifetime 到期前 60s 触发）
- *   2. 权限同步（为新到达的远端候选创建 CreatePermission）
+ *   0. Allocate 重传（分配中未收到响应时按 RTO 倍增重发）
+ *   1. Refresh 续期（在 lifetime 到期前 60s 触发）；分配过期则后台重新分配
+ *   2. 权限同步（所有会话的远端候选 IP 汇总去重，新 IP 批量 CreatePermission）
+ *   3. 通道刷新（绑定 8 分钟后重新 ChannelBind，10 分钟未刷新成功则回退 Indication）
+ * 多服务器时先推进 RTT 探测，各分配槽位独立维护（空闲槽位无操作）
  * ============================================================================ */
-void p2p_turn_tick(struct p2p_instance *inst, uint64_t now_ms) {
+static void turn_tick_one(struct p2p_instance *inst, turn_ctx_t *t, uint64_t now_ms) {
+
+    /* ---- TCP/TLS 连接：推进建立、收发消息；服务器随连接删除分配，断开时视同分配过期 ---- */
+    if (turn_stream(inst) && t->state >= TURN_CONNECTING && t->state <= TURN_ALLOCATED) {
+        int r = p2p_turn_tcp_tick(inst, t, now_ms);
+        if (r == 0) return;
+        if (r < 0 && t->state == TURN_ALLOCATED) {
+            perm_clear(t);
+            t->channel_count = 0;
+            t->state = TURN_IDLE;
+            alloc_begin(inst, t);
+            return;
+        }
+        if (r < 0 || (t->state == TURN_CONNECTING && allocate_start(inst, t) < 0)) {
+            t->state = TURN_FAILED;
+            assert(inst->turn_pending);
+            --inst->turn_pending;
+        }
+        if (t->state == TURN_CONNECTING || t->state == TURN_FAILED) return;
+    }
+    if (t->tcp && (t->state == TURN_FAILED || t->state == TURN_IDLE)) p2p_turn_tcp_close(inst, t);
+
+    /* ---- 等待服务器地址解析 ---- */
+    if (t->state == TURN_RESOLVING) {
+        int r = p2p_dns_resolve(t->host, t->port, &t->server_addr);
+        if (r == 0) return;
+        if (r < 0) print("E:", LA_F("Failed to resolve TURN server: %s", LA_F291, 291), t->host);
+        if (r < 0 || allocate_start(inst, t) < 0) {
+            t->state = TURN_FAILED;
+            assert(inst->turn_pending);
+            --inst->turn_pending;
+        }
+        return;
+    }
 
-    turn_ctx_t *t = &inst->turn;
+    /* ---- Allocate 重传 ---- */
+    if (t->state == TURN_ALLOCATING || t->state == TURN_AUTHENTICATING) {
+        if (tick_diff(now_ms, t->req_ms) < ((uint64_t)TURN_RTO_MS << (t->req_tries - 1))) return;
+        if (t->req_tries >= TURN_ALLOC_MAX_TRIES) {
+            print("E:", LA_F("TURN Allocate timeout after %d tries", LA_F538, 538), t->req_tries);
+            t->state = TURN_FAILED;
+            assert(inst->turn_pending);
+            --inst->turn_pending;
+            return;
+        }
+        if (turn_stream(inst)) t->req_tries++;         // 可靠传输不重传，按同一时间表判定超时
+        else if (t->state == TURN_ALLOCATING) allocate_send(inst, t);
+        else allocate_auth(inst, t);
+        t->req_ms = now_ms;
+        return;
+    }
     if (t->state != TURN_ALLOCATED) return;
 
     /* ---- Refresh 续期 ---- */
     uint64_t elapsed_s = tick_diff(now_ms, t->last_refresh_ms) / 1000;
     uint32_t margin = t->lifetime > TURN_REFRESH_MARGIN_S ? TURN_REFRESH_MARGIN_S : t->lifetime / 2;
-    if (elapsed_s + margin >= t->lifetime) {
-        turn_refresh(inst);
+    if (elapsed_s >= t->lifetime) {
+        /* Refresh 始终未成功，分配已在服务器端过期：后台重新分配，新中继地址随 Allocate Success 分发 */
+        print("W:", LA_F("TURN allocation expired, re-allocating", LA_F539, 539));
+        perm_clear(t);
+        t->channel_count = 0;
+        t->state = TURN_IDLE;
+        alloc_begin(inst, t);
+        return;
+    }
+    if (elapsed_s + margin >= t->lifetime && tick_diff(now_ms, t->req_ms) >= TURN_REFRESH_RETRY_MS) {
+        t->req_ms = now_ms;
+        turn_refresh(inst, t);
     }
 
     /* ---- 权限刷新：权限 5 分钟过期，每 4 分钟重新创建 ---- */
     if (t->perm_count > 0 && tick_diff(now_ms, t->last_perm_ms) / 1000 >= TURN_PERM_REFRESH_S) {
-        t->perm_count = 0;
+        perm_clear(t);
         t->last_perm_ms = now_ms;
     }
 
-    /* ---- 权限同步：遍历所有会话的远端候选，为每个 IP 创建 Permission ---- */
-    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
-        for (int i = 0; i < s->remote_cand_cnt; i++) {
-            turn_create_permission(inst, &s->remote_cands[i].addr);
+    /* ---- 权限同步：汇总所有会话远端候选的 IP，集合中没有的按批发送 CreatePermission ----
+     * 注：加入集合即视为已请求；发送失败的 IP 在下一轮权限刷新时重新请求 */
+    if (t->has_key && inst->cfg.turn_user) {
+        uint32_t batch[TURN_PERM_BATCH]; int nb = 0;
+        for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
+            for (int i = 0; i < s->remote_cand_cnt; i++) {
+                uint32_t ip = s->remote_cands[i].addr.sin_addr.s_addr;
+                if (!ip || perm_add(t, ip) <= 0) continue;
+                batch[nb++] = ip;
+                if (nb == TURN_PERM_BATCH) { turn_create_permission(inst, t, batch, nb); nb = 0; }
+            }
         }
+        if (nb) turn_create_permission(inst, t, batch, nb);
+    }
+
+    /* ---- 通道刷新 ---- */
+    for (int i = 0; i < t->channel_count; i++) {
+        turn_channel_t *c = &t->channels[i];
+        if (!c->bound) continue;
+        uint64_t age_s = tick_diff(now_ms, c->bound_ms) / 1000;
+        if (age_s >= TURN_CHANNEL_LIFETIME_S) c->bound = false;
+        else if (age_s >= TURN_CHANNEL_REFRESH_S && tick_diff(now_ms, c->bind_ms) >= TURN_CHANNEL_RETRY_MS)
+            turn_channel_bind(inst, t, c, now_ms);
     }
 }
+
+void p2p_turn_tick(struct p2p_instance *inst, uint64_t now_ms) {
+    if (inst->turn_probe.active) turn_probe_tick(inst, now_ms);
+    for (int i = 0; i < TURN_MAX_ALLOCS; i++) turn_tick_one(inst, &inst->turn[i], now_ms);
+}
@@ -4,6 +4,7 @@
  * 参考文档:
  *   - RFC 5766: TURN - Traversal Using Relays around NAT
  *   - RFC 5389: STUN - Session Traversal Utilities for NAT (基础协议)
+ *   - RFC 6062: TURN Extensions for TCP Allocations（本实现只用其客户端 TCP/TLS 连接，中继地址仍为 UDP）
  *
  * ============================================================================
  * TURN 协议概述
@@ -59,6 +60,9 @@
  * CreatePerm(0x08)| 0x0008   | -          | 0x0108   | 0x0118
  * ChannelBind(0x9)| 0x0009   | -          | 0x0109   | 0x0119
  *
+ * ChannelData 不是 STUN 消息：首字节 0x40-0x7F，[通道号(2)][长度(2)][数据]，
+ * 通道绑定后取代 Send/Data Indication 承载中继数据（RFC 5766 Section 11.4）
+ *
  * ============================================================================
  * STUN/TURN 属性格式（RFC 5389 Section 15）
  * ============================================================================
@@ -116,12 +120,24 @@
  *       新版应使用 XOR-RELAYED-ADDRESS (0x0016)
  *
  * ============================================================================
+ * TCP / TLS 传输（cfg.turn_transport，RFC 5766 Section 2.1 / 11.5）
+ * ============================================================================
+ *
+ * 客户端到服务器改用一条 TCP（或其上的 TLS）连接，分配、权限、通道与 UDP 完全相同，
+ * 中继地址仍为 UDP（REQUESTED-TRANSPORT = 17），对端照常以 UDP 向中继候选发送。
+ * 字节流按消息自身的长度字段分帧，无需额外帧头：
+ *   首字节 0x00-0x3F  STUN 消息，帧长 = 20 + Message Length（总为 4 的倍数）
+ *   首字节 0x40-0x7F  ChannelData，帧长 = 4 + LENGTH 向上取整到 4 的倍数（TCP 上必须填充）
+ * 服务器在连接断开时删除分配：连接丢失视同分配过期，重新连接并分配。
+ *
+ * ============================================================================
  */
 
 #ifndef P2P_TURN_H
 #define P2P_TURN_H
 
 #include "predefine.h"
+#include "p2p_crypto.h"
 
 struct p2p_instance;
 
@@ -130,33 +146,70 @@ struct p2p_instance;
  * ============================================================================
  *
  *  TURN_IDLE ──→ TURN_ALLOCATING ──→ (401 Unauthorized?)
- *                                          │
- *                                          ↓
- *                                    TURN_AUTHENTICATING ──→ TURN_ALLOCATED
+ *      │               ↑                   │
+ *      ↓               │                   ↓
+ *  TURN_RESOLVING ─────┘             TURN_AUTHENTICATING ──→ TURN_ALLOCATED
  *                                          │                      │
  *                                          ↓                      ↓
  *                                     TURN_FAILED          (定期 Refresh)
+ *
+ * + 服务器主机名未解析完成时先进入 RESOLVING（p2p_dns_resolve），由 p2p_turn_tick 轮询，解析失败 TURN_FAILED
+ * + TCP/TLS 传输时地址就绪后先进入 CONNECTING，连接（及 TLS 握手）完成后发送首个 Allocate，失败 TURN_FAILED
+ * + ALLOCATING / AUTHENTICATING 未收到响应时按 RTO 500ms 倍增重传（同一事务 ID），7 次后 TURN_FAILED；
+ *   TCP/TLS 上不重传（RFC 5389 Section 7.2.2），按同一时间表判定超时
+ * + ALLOCATED 期间 Refresh 始终未成功、lifetime 耗尽时回到 IDLE 并在后台重新 Allocate
  */
 typedef enum {
     TURN_IDLE = 0,           // 未启动
+    TURN_RESOLVING,          // 等待服务器地址异步解析
+    TURN_CONNECTING,         // TCP 连接 / TLS 握手中（cfg.turn_transport）
     TURN_ALLOCATING,         // 首次 Allocate 已发送（无认证）
     TURN_AUTHENTICATING,     // 收到 401 后带认证重发中
     TURN_ALLOCATED,          // 分配成功
     TURN_FAILED              // 分配失败
 } turn_state_t;
 
-/* 最大中继权限数 */
-#define TURN_MAX_PERMISSIONS 16
+/* 实例级权限集合槽位数（2 的幂，开放寻址，最多使用 3/4） */
+#define TURN_PERM_SLOTS      256
+
+/* 单个 CreatePermission 请求携带的 XOR-PEER-ADDRESS 上限（RFC 5766 Section 9.1 允许多个） */
+#define TURN_PERM_BATCH      16
+
+/* 最大通道数（ChannelBind，通道号 0x4000 起按槽位分配） */
+#define TURN_MAX_CHANNELS    16
+
+/* 候选 TURN 服务器上限（turn_server + turn_servers）与同时保持的分配数上限（cfg.turn_allocs） */
+#define TURN_MAX_SERVERS     8
+#define TURN_MAX_ALLOCS      2
+
+/*
+ * TURN 通道（RFC 5766 Section 11）
+ * + 绑定成功后发往该对端的数据改用 4 字节 ChannelData 头，取代 36 字节的 Send Indication
+ * + 绑定 10 分钟有效，到期前刷新；绑定完成前（或失败后）仍使用 Indication
+ */
+typedef struct {
+    struct sockaddr_in  peer;                           // 对端传输地址（IP + 端口）
+    uint16_t            number;                         // 通道号（0x4000-0x7FFF）
+    bool                bound;                          // 已收到 ChannelBind Success
+    bool                failed;                         // 服务器拒绝绑定，不再尝试
+    uint8_t             tsx[12];                        // 最近一次 ChannelBind 请求的事务 ID
+    uint64_t            bind_ms;                        // 最近一次 ChannelBind 请求时间
+    uint64_t            bound_ms;                       // 最近一次绑定成功时间
+} turn_channel_t;
 
 /* ============================================================================
  * TURN 会话上下文
  * ============================================================================ */
 typedef struct {
+    char                host[128];                      // 服务器主机名（探测选定后写入）
+    uint16_t            port;
+    uint32_t            rtt_ms;                         // 启动探测测得的 RTT（0 = 未探测/未响应）
     struct sockaddr_in  server_addr;                    // 已解析的 TURN 服务器地址
     struct sockaddr_in  relay_addr;                     // 已分配的中继地址
     char                realm[128];                     // 认证域（401 响应中获取）
     char                nonce[128];                     // 随机数（401 响应中获取）
     uint8_t             key[16];                        // 长期凭证密钥 MD5(user:realm:pass)
+    p2p_hmac_sha1_ctx_t hmac;                           // 以 key 初始化的 HMAC 上下文（随 key 重算）
 
     turn_state_t        state;                          // 当前状态
     bool                has_key;                        // 密钥是否已计算
@@ -164,11 +217,45 @@ typedef struct {
     uint64_t            alloc_time_ms;                  // 分配成功时间
     uint64_t            last_refresh_ms;                // 上次 Refresh 时间
 
-    struct sockaddr_in  perms[TURN_MAX_PERMISSIONS];    // 已授权的对端地址（仅 IP 部分有意义）
-    int                 perm_count;                     // 已授权数量
+    uint8_t             req_tsx[12];                    // 当前 Allocate 请求的事务 ID（重传复用）
+    uint64_t            req_ms;                         // 上次 Allocate/Refresh 请求发送时间
+    int                 req_tries;                      // 当前 Allocate 请求已发送次数
+
+    uint32_t            perm_ips[TURN_PERM_SLOTS];      // 已授权的对端 IP 哈希集合（网络字节序，0 = 空槽）
+    int                 perm_count;                     // 已授权数量（所有会话共享）
     uint64_t            last_perm_ms;                   // 上次 Permission 创建/刷新时间
+
+    turn_channel_t      channels[TURN_MAX_CHANNELS];    // 通道绑定（按首次发送的对端分配）
+    int                 channel_count;                  // 已分配通道数
+
+    struct p2p_turn_tcp *tcp;                           // 到服务器的 TCP/TLS 连接（cfg.turn_transport，UDP 时为 NULL）
 } turn_ctx_t;
 
+/*
+ * 多服务器 RTT 探测（配置了多个 TURN 服务器时）
+ * + 启动时向每个服务器发送 STUN Binding（TURN 服务器均支持），未响应时每 250ms 重发，最多 3 次
+ * + 全部响应或 1 秒窗口结束后按 RTT 升序在前 cfg.turn_allocs 个服务器上 Allocate；均无响应时按配置顺序
+ * + 分配槽位按 RTT 排序，中继发送使用首个已分配的槽位（最近的服务器）
+ */
+typedef struct {
+    char                host[128];
+    uint16_t            port;
+    struct sockaddr_in  addr;
+    bool                resolved;                       // 地址已解析
+    bool                failed;                         // 解析失败，不参与选择
+    uint8_t             tsx[12];                        // 最近一次 Binding 的事务 ID（每次重发换新）
+    uint64_t            sent_ms;                        // 最近一次 Binding 发送时间
+    int                 tries;                          // 已发送次数
+    uint32_t            rtt_ms;                         // 0 = 未响应
+} turn_server_t;
+
+typedef struct {
+    turn_server_t       servers[TURN_MAX_SERVERS];
+    int                 cnt;
+    bool                active;                         // 探测进行中（计入 turn_pending）
+    uint64_t            start_ms;
+} turn_probe_t;
+
 /* ============================================================================
  * API
  * ============================================================================ */
@@ -179,18 +266,29 @@ void p2p_turn_init(turn_ctx_t *t);
 /* 释放 TURN 分配（发送 Refresh lifetime=0）并清零上下文（实例级别） */
 void p2p_turn_reset(struct p2p_instance *inst);
 
-/* 定时维护（权限同步、Refresh 续期）（实例级别） */
+/* 定时维护（Allocate 重传、Refresh 续期、权限同步）（实例级别） */
 void p2p_turn_tick(struct p2p_instance *inst, uint64_t now_ms);
 
 //-----------------------------------------------------------------------------
 
-/* 发起 TURN Allocate 请求（实例级别，首次无认证；已在分配中/已分配则跳过） */
+/* 发起 TURN Allocate 请求（实例级别，首次无认证；配置多个服务器时先探测 RTT 再分配） */
 int p2p_turn_allocate(struct p2p_instance *inst);
 
+/* 首个已分配的槽位（槽位按 RTT 排序，即最近的服务器），无可用分配返回 NULL */
+turn_ctx_t *p2p_turn_active(struct p2p_instance *inst);
+
+/* RTT 探测的 Binding 响应（探测进行中且事务 ID 匹配时消费并返回 true） */
+bool p2p_turn_probe_response(struct p2p_instance *inst, const struct sockaddr_in *from,
+                             uint16_t type, const uint8_t *buf, int len);
+
 /* 通过 TURN 中继发送数据（Send Indication，无需认证） */
 ret_t p2p_turn_send_indication(struct p2p_instance *inst, const struct sockaddr_in *peer_addr,
                                const sock_msg_t msg[4], int num);
 
+/* 通过 TURN 中继发送数据：通道已绑定时用 ChannelData，否则用 Send Indication 并发起 ChannelBind */
+ret_t p2p_turn_send(struct p2p_instance *inst, const struct sockaddr_in *peer_addr,
+                    const sock_msg_t msg[4], int num);
+
 //-----------------------------------------------------------------------------
 
 /*
@@ -200,11 +298,56 @@ ret_t p2p_turn_send_indication(struct p2p_instance *inst, const struct sockaddr_
  *   0 = 控制消息已处理（Allocate/Refresh/CreatePermission 响应）
  *   1 = Data Indication: 中继数据已提取到 out_data/out_len, 对端地址在 out_peer
  *  -1 = 非 TURN 消息（未处理）
+ *
+ * attrs 为派发入口已解析的属性索引（NULL 则内部解析）
  */
 int  p2p_turn_handle_packet(struct p2p_instance *inst, const struct sockaddr_in *from,
-                            uint16_t type, const uint8_t *buf, int len,                            
+                            uint16_t type, const uint8_t *buf, int len,
+                            const p2p_stun_attrs_t *attrs,
                             const uint8_t **out_data, int *out_len,
                             struct sockaddr_in *out_peer);
 
+/*
+ * 处理 ChannelData 消息（首字节 0x40-0x7F，来自 TURN 服务器）
+ *
+ * 返回值:
+ *   1 = 中继数据已提取到 out_data/out_len, 对端地址在 out_peer
+ *   0 = 非已知通道或格式错误（丢弃）
+ */
+int  p2p_turn_handle_channel_data(struct p2p_instance *inst, const struct sockaddr_in *from,
+                                  const uint8_t *buf, int len,
+                                  const uint8_t **out_data, int *out_len,
+                                  struct sockaddr_in *out_peer);
+
+//-----------------------------------------------------------------------------
+// TCP / TLS 传输（p2p_turn_tcp.c），由 p2p_turn.c 驱动，均在实例锁下调用
+
+#define TURN_TCP_POLL_MS        10                      /* 建立中 / 有发送积压时的轮询间隔 */
+#define TURN_TCP_CONNECT_MS     10000                   /* TCP 连接 + TLS 握手时限 */
+#define TURN_TCP_RX_BUF         8192                    /* 接收重组缓冲（单条消息上限） */
+#define TURN_TCP_TX_BUF         (16 * (4 + P2P_MTU))    /* 发送积压上限，满时丢弃整条消息 */
+
+/* 向 t->server_addr 发起非阻塞连接（TLS 时以 t->host 校验证书），已存在的连接先关闭 */
+ret_t p2p_turn_tcp_open(struct p2p_instance *inst, turn_ctx_t *t);
+
+/* 关闭连接并释放（turn_ctx_t 清零前调用） */
+void  p2p_turn_tcp_close(struct p2p_instance *inst, turn_ctx_t *t);
+
+/*
+ * 推进连接 / TLS 握手，读取完整消息并按来自 server_addr 的 UDP 包派发，冲刷发送积压
+ * @return 1 = 已就绪，0 = 建立中，<0 = 连接失败或断开（已关闭）
+ */
+int   p2p_turn_tcp_tick(struct p2p_instance *inst, turn_ctx_t *t, uint64_t now_ms);
+
+/* 发送一条消息（msgs 拼接为一条 STUN 或 ChannelData，ChannelData 补齐 4 字节）；未就绪返回 E_NONE_CONTEXT */
+ret_t p2p_turn_tcp_send(struct p2p_instance *inst, turn_ctx_t *t, const sock_msg_t *msgs, int num);
+
+/* 轮询描述符与事件（无连接返回 P_INVALID_SOCKET）/ 距下次需要 tick 的毫秒数（-1 = 无需） */
+sock_t p2p_turn_tcp_sock(const turn_ctx_t *t, bool *want_write);
+int   p2p_turn_tcp_next_timeout(const turn_ctx_t *t);
+
+/* 正在派发经 t 的连接收到的消息（TCP/TLS 分配据此拒绝来源地址相同的 UDP 包，防止伪造） */
+bool  p2p_turn_tcp_rx(const turn_ctx_t *t);
+
 ///////////////////////////////////////////////////////////////////////////////
 #endif /* P2P_TURN_H */
@@ -0,0 +1,387 @@
+/*
+ * TURN 客户端到服务器的 TCP / TLS 传输（cfg.turn_transport，见 p2p_turn.h）
+ *
+ * 每个分配槽位一条非阻塞连接：CONNECTING ──> (TLS) HANDSHAKE ──> READY
+ *   + 接收：字节流按 STUN / ChannelData 自身长度重组为消息，逐条交给 p2p_dispatch_packet，
+ *           与来自 server_addr 的 UDP 包走同一派发（p2p_turn_handle_* 及内层 P2P 包）
+ *   + 发送：无积压时直接写入，未写完的部分进入积压，保持消息边界连续；积压满时丢弃整条（等同 UDP 丢包）
+ *
+ * TLS 使用 MbedTLS（WITH_DTLS），BIO 回调直接读写套接字；CA 证书查找同 p2p_http.c，
+ * 找不到证书包时降级为不校验服务器证书（打印告警）。
+ */
+#define MOD_TAG "TURN"
+
+#include "p2p_internal.h"
+
+#if defined(WITH_DTLS)
+#include <mbedtls/ssl.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/x509_crt.h>
+#include <mbedtls/net_sockets.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* sock_msg_t 在 POSIX 下为 struct iovec，Windows 下为 WSABUF */
+#ifdef _WIN32
+#define tcp_msg_ptr(m) ((const void *)(m)->buf)
+#else
+#define tcp_msg_ptr(m) ((const void *)(m)->iov_base)
+#endif
+
+typedef enum {
+    TCP_CONNECTING = 0,                         /* 非阻塞 connect 进行中 */
+    TCP_HANDSHAKE,                              /* TLS 握手中 */
+    TCP_READY,                                  /* 可收发 */
+} tcp_st;
+
+struct p2p_turn_tcp {
+    sock_t              sock;
+    tcp_st              state;
+    uint64_t            start_ms;               /* 发起连接的时间（建立时限从此计） */
+    bool                rx_active;              /* 正在派发收到的消息 */
+
+    uint8_t             rx[TURN_TCP_RX_BUF];
+    int                 rx_len;
+    uint8_t             tx[TURN_TCP_TX_BUF];
+    int                 tx_len;
+
+#if defined(WITH_DTLS)
+    bool                tls;
+    int                 tls_wlen;               /* WANT_WRITE 时挂起的写入长度（重试须使用相同参数） */
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config  conf;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_entropy_context  entropy;
+    mbedtls_x509_crt    ca;
+#endif
+};
+
+/* 一条消息的帧长：STUN = 20 + Message Length，ChannelData = 4 + LENGTH 补齐到 4；0 = 头部未收全，-1 = 非法首字节 */
+static int frame_len(const uint8_t *p, int avail) {
+    if (avail < 4) return 0;
+    if (p[0] < 0x40) return 20 + nget_s(p + 2);
+    if (p[0] < 0x80) return 4 + ((nget_s(p + 2) + 3) & ~3);
+    return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// TLS（MbedTLS）
+
+#if defined(WITH_DTLS)
+
+#ifndef P2P_TURN_CA_FILE
+#define P2P_TURN_CA_FILE        NULL
+#endif
+
+static const char *ca_files[] = {
+    P2P_TURN_CA_FILE,
+    "/etc/ssl/certs/ca-certificates.crt",   /* Debian / Ubuntu / Alpine */
+    "/etc/pki/tls/certs/ca-bundle.crt",     /* RHEL / CentOS / Fedora */
+    "/etc/ssl/cert.pem",                    /* macOS / OpenBSD */
+    "/usr/local/etc/openssl/cert.pem",      /* Homebrew */
+};
+
+static int bio_send(void *ctx, const unsigned char *buf, size_t len) {
+    struct p2p_turn_tcp *c = (struct p2p_turn_tcp *)ctx;
+    ssize_t n;
+    do {
+        n = send(c->sock, (const char *)buf, (int)len, MSG_NOSIGNAL);
+    } while (n < 0 && P_sock_is_interrupted());
+    if (n < 0) return P_sock_is_wouldblock() ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_SEND_FAILED;
+    return (int)n;
+}
+
+static int bio_recv(void *ctx, unsigned char *buf, size_t len) {
+    struct p2p_turn_tcp *c = (struct p2p_turn_tcp *)ctx;
+    ssize_t n;
+    do {
+        n = recv(c->sock, (char *)buf, (int)len, 0);
+    } while (n < 0 && P_sock_is_interrupted());
+    if (n < 0) return P_sock_is_wouldblock() ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_RECV_FAILED;
+    return (int)n;                          /* 0 = 对端关闭 */
+}
+
+static ret_t tls_setup(struct p2p_turn_tcp *c, const char *host) {
+
+    c->tls = true;
+    mbedtls_ssl_init(&c->ssl);
+    mbedtls_ssl_config_init(&c->conf);
+    mbedtls_ctr_drbg_init(&c->drbg);
+    mbedtls_entropy_init(&c->entropy);
+    mbedtls_x509_crt_init(&c->ca);
+
+    static const char pers[] = "p2p_turn";
+    if (mbedtls_ctr_drbg_seed(&c->drbg, mbedtls_entropy_func, &c->entropy,
+                              (const unsigned char *)pers, sizeof(pers) - 1) != 0) return E_UNKNOWN;
+    if (mbedtls_ssl_config_defaults(&c->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0) return E_UNKNOWN;
+
+    bool ca = false;
+    for (size_t i = 0; i < sizeof(ca_files) / sizeof(ca_files[0]) && !ca; i++) {
+        ca = ca_files[i] && mbedtls_x509_crt_parse_file(&c->ca, ca_files[i]) >= 0 && c->ca.version;
+    }
+    if (ca) {
+        mbedtls_ssl_conf_ca_chain(&c->conf, &c->ca, NULL);
+        mbedtls_ssl_conf_authmode(&c->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    } else {
+        print("W:", LA_F("no CA bundle found, server certificate will not be verified", LA_F702, 702));
+        mbedtls_ssl_conf_authmode(&c->conf, MBEDTLS_SSL_VERIFY_NONE);
+    }
+    mbedtls_ssl_conf_rng(&c->conf, mbedtls_ctr_drbg_random, &c->drbg);
+
+    if (mbedtls_ssl_setup(&c->ssl, &c->conf) != 0) return E_UNKNOWN;
+    mbedtls_ssl_set_hostname(&c->ssl, host);
+    mbedtls_ssl_set_bio(&c->ssl, c, bio_send, bio_recv, NULL);
+    return E_NONE;
+}
+
+static void tls_free(struct p2p_turn_tcp *c) {
+    if (!c->tls) return;
+    if (c->state == TCP_READY && c->sock != P_INVALID_SOCKET) mbedtls_ssl_close_notify(&c->ssl);
+    mbedtls_ssl_free(&c->ssl);
+    mbedtls_ssl_config_free(&c->conf);
+    mbedtls_ctr_drbg_free(&c->drbg);
+    mbedtls_entropy_free(&c->entropy);
+    mbedtls_x509_crt_free(&c->ca);
+}
+
+#endif /* WITH_DTLS */
+
+/* 写入：>= 0 为已写入字节数，E_BUSY = 暂不可写，其他 < 0 = 连接错误 */
+static int conn_write(struct p2p_turn_tcp *c, const uint8_t *buf, int len) {
+#if defined(WITH_DTLS)
+    if (c->tls) {
+        if (c->tls_wlen) len = c->tls_wlen;
+        int r = mbedtls_ssl_write(&c->ssl, buf, (size_t)len);
+        if (r == MBEDTLS_ERR_SSL_WANT_READ || r == MBEDTLS_ERR_SSL_WANT_WRITE) { c->tls_wlen = len; return E_BUSY; }
+        c->tls_wlen = 0;
+        return r < 0 ? E_UNKNOWN : r;
+    }
+#endif
+    ssize_t n = send(c->sock, (const char *)buf, len, MSG_NOSIGNAL);
+    if (n < 0) return P_sock_is_wouldblock() ? E_BUSY : E_UNKNOWN;
+    return (int)n;
+}
+
+/* 读取：> 0 为读取字节数，0 = 对端关闭，E_BUSY = 暂无数据，其他 < 0 = 连接错误 */
+static int conn_read(struct p2p_turn_tcp *c, uint8_t *buf, int cap) {
+#if defined(WITH_DTLS)
+    if (c->tls) {
+        int r = mbedtls_ssl_read(&c->ssl, buf, (size_t)cap);
+        if (r == MBEDTLS_ERR_SSL_WANT_READ || r == MBEDTLS_ERR_SSL_WANT_WRITE) return E_BUSY;
+        if (r == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) return 0;
+        return r < 0 ? E_UNKNOWN : r;
+    }
+#endif
+    ssize_t n = recv(c->sock, (char *)buf, cap, 0);
+    if (n < 0) return P_sock_is_wouldblock() ? E_BUSY : E_UNKNOWN;
+    return (int)n;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+ret_t p2p_turn_tcp_open(struct p2p_instance *inst, turn_ctx_t *t) {
+
+    p2p_turn_tcp_close(inst, t);
+
+    bool tls = inst->cfg.turn_transport == P2P_TURN_TLS;
+#if !defined(WITH_DTLS)
+    if (tls) {
+        print("E:", LA_F("TURN over TLS requires a WITH_DTLS build", LA_F703, 703));
+        return E_NO_SUPPORT;
+    }
+#endif
+
+    struct p2p_turn_tcp *c = (struct p2p_turn_tcp *)p2p_calloc(1, sizeof(*c));
+    if (!c) return E_OUT_OF_MEMORY;
+
+    c->sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->sock == P_INVALID_SOCKET) { p2p_free(c); return E_EXTERNAL(P_sock_errno()); }
+    P_sock_nonblock(c->sock, true);
+#ifdef TCP_NODELAY
+    int opt = 1;
+    setsockopt(c->sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&opt, sizeof(opt));
+#endif
+
+    if (connect(c->sock, (struct sockaddr *)&t->server_addr, sizeof(t->server_addr)) < 0 && !P_sock_is_inprogress()) {
+        int err = P_sock_errno();
+        print("W:", LA_F("connect %s:%u failed(%d)", LA_F704, 704), t->host, t->port, err);
+        P_sock_close(c->sock);
+        p2p_free(c);
+        return E_EXTERNAL(err);
+    }
+    c->start_ms = p2p_now_ms();
+    t->tcp = c;
+    p2p_mem_add(&inst->mem, P2P_MEM_TURN, sizeof(*c));
+
+#if defined(WITH_DTLS)
+    if (tls && tls_setup(c, t->host) != E_NONE) {
+        p2p_turn_tcp_close(inst, t);
+        return E_UNKNOWN;
+    }
+#endif
+
+    print("V:", LA_F("TURN %s connecting to %s:%u", LA_F705, 705), tls ? "TLS" : "TCP", t->host, t->port);
+    return E_NONE;
+}
+
+void p2p_turn_tcp_close(struct p2p_instance *inst, turn_ctx_t *t) {
+
+    struct p2p_turn_tcp *c = t->tcp;
+    if (!c) return;
+
+#if defined(WITH_DTLS)
+    tls_free(c);
+#endif
+    if (c->sock != P_INVALID_SOCKET) P_sock_close(c->sock);
+    p2p_mem_add(&inst->mem, P2P_MEM_TURN, -(int64_t)sizeof(*c));
+    p2p_free(c);
+    t->tcp = NULL;
+}
+
+/* 连接失败 / 断开：关闭并返回 -1 */
+static int tcp_lost(struct p2p_instance *inst, turn_ctx_t *t, const char *reason) {
+    print("W:", LA_F("TURN connection to %s:%u lost: %s", LA_F706, 706), t->host, t->port, reason);
+    p2p_turn_tcp_close(inst, t);
+    return -1;
+}
+
+/* 派发接收缓冲区中的完整消息；返回 false 表示连接已关闭（消息非法，或处理过程中被关闭） */
+static bool tcp_parse(struct p2p_instance *inst, turn_ctx_t *t, uint64_t now_ms) {
+
+    struct p2p_turn_tcp *c = t->tcp;
+    int off = 0;
+    for (;;) {
+        int len = frame_len(c->rx + off, c->rx_len - off);
+        if (!len) break;
+        if (len < 0 || len > (int)sizeof(c->rx)) { tcp_lost(inst, t, "bad frame"); return false; }
+        if (c->rx_len - off < len) break;
+
+        c->rx_active = true;
+        p2p_dispatch_packet(inst, c->rx + off, len, &t->server_addr, now_ms);
+        if (t->tcp != c) return false;          // 处理过程中连接被关闭（槽位重置）
+        c->rx_active = false;
+        off += len;
+    }
+    if (off) {
+        memmove(c->rx, c->rx + off, c->rx_len - off);
+        c->rx_len -= off;
+    }
+    return true;
+}
+
+static int tcp_flush(struct p2p_instance *inst, turn_ctx_t *t) {
+
+    struct p2p_turn_tcp *c = t->tcp;
+    while (c->tx_len) {
+        int n = conn_write(c, c->tx, c->tx_len);
+        if (n == E_BUSY) break;
+        if (n < 0) return tcp_lost(inst, t, "send error");
+        memmove(c->tx, c->tx + n, c->tx_len - n);
+        c->tx_len -= n;
+    }
+    return 1;
+}
+
+int p2p_turn_tcp_tick(struct p2p_instance *inst, turn_ctx_t *t, uint64_t now_ms) {
+
+    struct p2p_turn_tcp *c = t->tcp;
+    if (!c) return -1;
+
+    if (c->state != TCP_READY && tick_diff(now_ms, c->start_ms) >= TURN_TCP_CONNECT_MS)
+        return tcp_lost(inst, t, "connect timeout");
+
+    if (c->state == TCP_CONNECTING) {
+        fd_set wfds;
+        FD_ZERO(&wfds);
+        FD_SET(c->sock, &wfds);
+        struct timeval tv = {0, 0};
+        if (select((int)c->sock + 1, NULL, &wfds, NULL, &tv) <= 0 || !FD_ISSET(c->sock, &wfds)) return 0;
+
+        int err = 0;
+        socklen_t errlen = sizeof(err);
+        if (getsockopt(c->sock, SOL_SOCKET, SO_ERROR, (char *)&err, &errlen) < 0 || err != 0)
+            return tcp_lost(inst, t, "connect refused");
+#if defined(WITH_DTLS)
+        c->state = c->tls ? TCP_HANDSHAKE : TCP_READY;
+#else
+        c->state = TCP_READY;
+#endif
+    }
+
+#if defined(WITH_DTLS)
+    if (c->state == TCP_HANDSHAKE) {
+        int r = mbedtls_ssl_handshake(&c->ssl);
+        if (r == MBEDTLS_ERR_SSL_WANT_READ || r == MBEDTLS_ERR_SSL_WANT_WRITE) return 0;
+        if (r != 0) {
+            print("W:", LA_F("TLS handshake with %s failed: -0x%04x", LA_F707, 707), t->host, (unsigned)-r);
+            p2p_turn_tcp_close(inst, t);
+            return -1;
+        }
+        c->state = TCP_READY;
+    }
+#endif
+
+    for (;;) {
+        int n = conn_read(c, c->rx + c->rx_len, (int)sizeof(c->rx) - c->rx_len);
+        if (n == E_BUSY) break;
+        if (n == 0) return tcp_lost(inst, t, "closed by server");
+        if (n < 0) return tcp_lost(inst, t, "recv error");
+        c->rx_len += n;
+        if (!tcp_parse(inst, t, now_ms)) return -1;
+    }
+    return tcp_flush(inst, t);
+}
+
+ret_t p2p_turn_tcp_send(struct p2p_instance *inst, turn_ctx_t *t, const sock_msg_t *msgs, int num) {
+
+    struct p2p_turn_tcp *c = t->tcp;
+    if (!c || c->state != TCP_READY) return E_NONE_CONTEXT;
+
+    int len = 0;
+    for (int i = 0; i < num; i++) len += P_msg_len(&msgs[i]);
+    int total = (len + 3) & ~3;                 // ChannelData 补齐到 4 字节（STUN 消息本身已对齐）
+
+    if (c->tx_len + total > (int)sizeof(c->tx)) {
+        print("V:", LA_F("TURN tx backlog full, message dropped (%d bytes)", LA_F708, 708), total);
+        return E_BUSY;
+    }
+
+    // 先追加到积压末尾再冲刷：积压为空时即直接写入，未写完的剩余部分留在积压中，保持消息边界连续
+    uint8_t *p = c->tx + c->tx_len;
+    for (int i = 0; i < num; i++) {
+        int l = P_msg_len(&msgs[i]);
+        memcpy(p, tcp_msg_ptr(&msgs[i]), (size_t)l);
+        p += l;
+    }
+    memset(p, 0, (size_t)(total - len));
+    c->tx_len += total;
+
+    if (c->tx_len == total && tcp_flush(inst, t) < 0) return E_UNKNOWN;
+    return len;
+}
+
+sock_t p2p_turn_tcp_sock(const turn_ctx_t *t, bool *want_write) {
+    const struct p2p_turn_tcp *c = t->tcp;
+    if (!c) return P_INVALID_SOCKET;
+    if (want_write) *want_write = c->state == TCP_CONNECTING || c->tx_len > 0;
+    return c->sock;
+}
+
+int p2p_turn_tcp_next_timeout(const turn_ctx_t *t) {
+    const struct p2p_turn_tcp *c = t->tcp;
+    if (!c) return -1;
+#if defined(WITH_DTLS)
+    // 已解密但未读取的数据不会再触发套接字可读
+    if (c->tls && c->state == TCP_READY && mbedtls_ssl_get_bytes_avail(&c->ssl)) return 0;
+#endif
+    return c->state != TCP_READY || c->tx_len ? TURN_TCP_POLL_MS : -1;
+}
+
+bool p2p_turn_tcp_rx(const turn_ctx_t *t) {
+    return t->tcp && t->tcp->rx_active;
+}
@@ -1,5 +1,656 @@
 
+/* recvmmsg 需要 GNU 扩展 */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "p2p_internal.h"
+#include "p2p_thread.h"
+
+#if defined(__linux__)
+#include <netinet/udp.h>        /* UDP_SEGMENT */
+#include <sys/mman.h>
+#include <sys/syscall.h>
+# if defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#  endif
+# endif
+#endif
+
+/* io_uring 多发 recvmsg（cfg.udp_uring）：编译期需 5.19+ 内核头文件，运行期不支持时回退 */
+#if defined(__linux__) && defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup) && !defined(P2P_SIM)
+#define UDP_URING       1
+#endif
+
+/* 模拟构建（见 p2p_sim.h）：收发经进程内虚拟网络 */
+#ifdef P2P_SIM
+#define UDP_SIM         1
+#else
+#define UDP_SIM         0
+#endif
+
+/* 设置单个套接字的收发缓冲区，返回内核实际接收缓冲区字节数（Linux 读回值含簿记开销，约为请求值两倍） */
+static int udp_sock_set_buf(sock_t fd, int bytes) {
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (const char *)&bytes, sizeof(bytes));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (const char *)&bytes, sizeof(bytes));
+    int eff = 0;
+    socklen_t len = sizeof(eff);
+    if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, (char *)&eff, &len) != 0) eff = 0;
+    return eff;
+}
+
+int p2p_udp_sock_buf_target(struct p2p_instance *inst) {
+
+    int cfg = inst->cfg.sock_buf_size;
+    if (cfg) return cfg < 0 ? 0 : (cfg > P2P_UDP_SOCKBUF_MAX ? P2P_UDP_SOCKBUF_MAX : cfg);
+
+    // 一个完整窗口的突发；所有会话共用套接字，各会话 BDP（交付速率 × 平滑 RTT）累加
+    int window = inst->cfg.reliable_window > 0 ? inst->cfg.reliable_window : RELIABLE_WINDOW;
+    if (window > RELIABLE_WINDOW_MAX) window = RELIABLE_WINDOW_MAX;
+    int64_t bdp = 0;
+    for (struct p2p_session *s = inst->sessions_head; s; s = s->next) {
+        const reliable_t *r = &s->reliable;
+        if (r->rs_rate > 0 && r->srtt > 0) bdp += r->rs_rate * r->srtt / 1000;
+    }
+    int64_t need = (int64_t)window * P2P_MTU;
+    if (bdp > need) need = bdp;
+    need *= 2;
+    if (need < P2P_UDP_SOCKBUF_MIN) need = P2P_UDP_SOCKBUF_MIN;
+    if (need > P2P_UDP_SOCKBUF_MAX) need = P2P_UDP_SOCKBUF_MAX;
+    return (int)need;
+}
+
+void p2p_udp_sock_buf_tick(struct p2p_instance *inst, uint64_t now_ms) {
+
+    if (inst->cfg.sock_buf_size || tick_diff(now_ms, inst->sock_buf_ms) < P2P_UDP_SOCKBUF_TICK_MS) return;
+    inst->sock_buf_ms = now_ms;
+
+    // 只增不减；增幅不足 1/4 时不重新设置（避免吞吐波动引起频繁系统调用）
+    int want = p2p_udp_sock_buf_target(inst);
+    if (want <= inst->sock_buf + inst->sock_buf / 4) return;
+
+    for (int i = 0; i < inst->sock_cnt; i++) {
+        if (inst->socks[i].sock == P_INVALID_SOCKET) continue;
+        int eff = udp_sock_set_buf(inst->socks[i].sock, want);
+        if (!i) inst->sock_buf_eff = eff;
+    }
+    if (inst->sock6_port) udp_sock_set_buf(inst->sock6, want);
+    print("V:", LA_F("socket buffer %d -> %d bytes (kernel %d)", LA_F625, 625), inst->sock_buf, want, inst->sock_buf_eff);
+    inst->sock_buf = want;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#if defined(__linux__)
+
+/* 接收控制消息缓冲区：SO_RXQ_OVFL + SCM_TIMESTAMPNS + IP_TOS */
+#define UDP_CTL_SIZE    (CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(int)))
+
+/* 读取时取一次两个时钟：内核时间戳为墙上时间，按二者差值换算到 P_tick_us 时基 */
+static inline void udp_rx_clock(uint64_t *mono_us, int64_t *real_us) {
+    struct timespec real;
+    *mono_us = P_tick_us();
+    clock_gettime(CLOCK_REALTIME, &real);
+    *real_us = (int64_t)real.tv_sec * 1000000 + real.tv_nsec / 1000;
+}
+
+/*
+ * 解析单个包的控制消息，填充 slot->rx_us / ecn
+ * + SCM_TIMESTAMPNS 换算结果不晚于读出时刻、至多早 1s，否则取读出时刻
+ * + SO_RXQ_OVFL 为套接字生存期累计值（无丢包时内核不附带），增量计入 inst->kernel_drops
+ */
+static void udp_rx_cmsg(struct p2p_instance *inst, p2p_sock_t *ps, struct msghdr *mh, p2p_udp_slot_t *slot,
+                        uint64_t mono_us, int64_t real_us) {
+
+    slot->rx_us = mono_us;
+    slot->ecn = 0;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(mh); cm; cm = CMSG_NXTHDR(mh, cm)) {
+        if (cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_TOS) {
+            slot->ecn = *(const uint8_t *)CMSG_DATA(cm) & P2P_UDP_ECN_MASK;
+            continue;
+        }
+        if (cm->cmsg_level != SOL_SOCKET) continue;
+#ifdef SO_TIMESTAMPNS
+        if (cm->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+            int64_t age = real_us - ((int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+            if (age > 0 && age < 1000000 && (uint64_t)age < mono_us) slot->rx_us = mono_us - (uint64_t)age;
+            continue;
+        }
+#endif
+#ifdef SO_RXQ_OVFL
+        if (cm->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t ovfl;
+            memcpy(&ovfl, CMSG_DATA(cm), sizeof(ovfl));
+            if (ovfl != ps->rxq_ovfl) {
+                __atomic_fetch_add(&inst->kernel_drops, ovfl - ps->rxq_ovfl, __ATOMIC_RELAXED);
+                ps->rxq_ovfl = ovfl;
+            }
+        }
+#endif
+    }
+}
+
+#endif /* __linux__ */
+
+#ifdef _WIN32
+
+#ifndef SIO_UDP_CONNRESET
+#define SIO_UDP_CONNRESET   _WSAIOW(IOC_VENDOR, 12)
+#endif
+
+#define IOCP_WAKE_KEY       ((ULONG_PTR)1)      /* 唤醒项的完成键（套接字完成键为上下文指针） */
+
+struct p2p_udp_iocp_sock;
+
+/* 单个预投递的重叠接收 */
+typedef struct {
+    OVERLAPPED                  ov;                     // 须为首成员：完成项的 lpOverlapped 即本结构
+    struct p2p_udp_iocp_sock*   owner;
+    WSABUF                      wb;
+    struct sockaddr_in          from;
+    INT                         from_len;
+    DWORD                       flags;
+    bool                        busy;                   // 已投递未取回
+    uint8_t                     buf[P2P_MTU_MAX + 16];
+} udp_iocp_op_t;
+
+struct p2p_udp_iocp_sock {
+    sock_t                      sock;
+    int                         posted;                 // 已投递未取回的接收数
+    bool                        closing;                // 套接字已关闭，取回全部投递后释放
+    udp_iocp_op_t               ops[P2P_UDP_IOCP_DEPTH];
+};
+
+struct p2p_udp_iocp {
+    HANDLE                      port;
+    int                         pending;                // 全部套接字已投递未取回的接收数
+    int                         ent_cnt, ent_pos;       // 已从完成端口取出、尚未处理的完成项
+    OVERLAPPED_ENTRY            ent[P2P_UDP_BATCH_SLOTS];
+};
+
+/* 投递空闲的接收；套接字上有立即错误时留待下一次 */
+static void udp_iocp_refill(struct p2p_udp_iocp *io, struct p2p_udp_iocp_sock *ks) {
+
+    for (int i = 0; i < P2P_UDP_IOCP_DEPTH && ks->posted < P2P_UDP_IOCP_DEPTH; i++) {
+        udp_iocp_op_t *op = &ks->ops[i];
+        if (op->busy) continue;
+        memset(&op->ov, 0, sizeof(op->ov));
+        op->owner = ks;
+        op->wb.buf = (char *)op->buf;
+        op->wb.len = sizeof(op->buf);
+        op->from_len = sizeof(op->from);
+        op->flags = 0;
+        // 同步完成也会进入完成端口（未设置 FILE_SKIP_COMPLETION_PORT_ON_SUCCESS），统一按投递计数
+        if (WSARecvFrom(ks->sock, &op->wb, 1, NULL, &op->flags, (struct sockaddr *)&op->from, &op->from_len,
+                        &op->ov, NULL) != 0 && WSAGetLastError() != WSA_IO_PENDING) break;
+        op->busy = true;
+        ks->posted++;
+        io->pending++;
+    }
+}
+
+/* 新套接字关联到实例完成端口并投递接收；失败时该套接字保持非阻塞 recvfrom */
+static void udp_iocp_attach(struct p2p_instance *inst, p2p_sock_t *ps) {
+
+    struct p2p_udp_iocp *io = inst->iocp;
+    if (!io) {
+        io = (struct p2p_udp_iocp *)p2p_malloc(sizeof(*io));
+        if (!io) return;
+        memset(io, 0, sizeof(*io));
+        if (!(io->port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1))) {
+            print("W:", LA_F("IOCP create failed(%d), using recvfrom", LA_F629, 629), (int)GetLastError());
+            p2p_free(io);
+            return;
+        }
+        inst->iocp = io;
+    }
+
+    struct p2p_udp_iocp_sock *ks = (struct p2p_udp_iocp_sock *)p2p_malloc(sizeof(*ks));
+    if (!ks) return;
+    memset(ks, 0, sizeof(*ks));
+    ks->sock = ps->sock;
+    if (!CreateIoCompletionPort((HANDLE)ps->sock, io->port, (ULONG_PTR)ks, 0)) {
+        print("W:", LA_F("IOCP associate failed(%d), using recvfrom", LA_F630, 630), (int)GetLastError());
+        p2p_free(ks);
+        return;
+    }
+
+    // 对端端口不可达的 ICMP 否则会以 WSAECONNRESET 中止投递的接收
+    BOOL off = FALSE;
+    DWORD ret = 0;
+    WSAIoctl(ps->sock, SIO_UDP_CONNRESET, &off, sizeof(off), NULL, 0, &ret, NULL, NULL);
+
+    ps->iocp = ks;
+    udp_iocp_refill(io, ks);
+}
+
+/* 套接字关闭后调用：未取回的投递以中止状态完成，取回最后一个时释放上下文 */
+static void udp_iocp_detach(struct p2p_udp_iocp_sock *ks) {
+    ks->closing = true;
+    if (!ks->posted) p2p_free(ks);
+}
+
+/* 从完成端口取出一批完成项（此前暂存的须已处理完） */
+static int udp_iocp_fetch(struct p2p_udp_iocp *io, int ms) {
+
+    ULONG n = 0;
+    io->ent_cnt = io->ent_pos = 0;
+    if (!GetQueuedCompletionStatusEx(io->port, io->ent, P2P_UDP_BATCH_SLOTS, &n, (DWORD)ms, FALSE)) {
+        DWORD e = GetLastError();
+        return e == WAIT_TIMEOUT ? 0 : E_EXTERNAL((int)e);
+    }
+    io->ent_cnt = (int)n;
+    return (int)n;
+}
+
+int p2p_udp_iocp_wait(struct p2p_instance *inst, int ms) {
+
+    struct p2p_udp_iocp *io = inst->iocp;
+    if (!io) return E_NO_SUPPORT;
+    if (io->ent_pos >= io->ent_cnt) {
+        int n = udp_iocp_fetch(io, ms < 0 ? 0 : ms);
+        if (n <= 0) return n;
+    }
+
+    int r = 0;
+    for (int i = io->ent_pos; i < io->ent_cnt; i++)
+        r |= io->ent[i].lpCompletionKey == IOCP_WAKE_KEY ? P2P_UDP_IOCP_WAKE : P2P_UDP_IOCP_DATA;
+    return r;
+}
+
+void p2p_udp_iocp_wakeup(struct p2p_instance *inst) {
+    struct p2p_udp_iocp *io = inst->iocp;
+    if (io) PostQueuedCompletionStatus(io->port, 0, IOCP_WAKE_KEY, NULL);
+}
+
+/* 取回一个完成项对应的投递；唤醒项或所属套接字已关闭时返回 NULL（取回最后一个投递时释放上下文） */
+static udp_iocp_op_t *udp_iocp_take(struct p2p_udp_iocp *io, const OVERLAPPED_ENTRY *e) {
+
+    if (e->lpCompletionKey == IOCP_WAKE_KEY) return NULL;
+    udp_iocp_op_t *op = (udp_iocp_op_t *)e->lpOverlapped;
+    struct p2p_udp_iocp_sock *ks = op->owner;
+    op->busy = false;
+    ks->posted--;
+    io->pending--;
+    if (ks->closing) {
+        if (!ks->posted) p2p_free(ks);
+        return NULL;
+    }
+    return op;
+}
+
+/* 取出已完成的接收填入 slots 并重新投递（最多 max 个） */
+static int udp_iocp_recv(struct p2p_instance *inst, p2p_udp_slot_t *slots, int max) {
+
+    struct p2p_udp_iocp *io = inst->iocp;
+    int n = 0;
+    while (n < max) {
+        if (io->ent_pos >= io->ent_cnt && udp_iocp_fetch(io, 0) <= 0) break;
+
+        const OVERLAPPED_ENTRY *e = &io->ent[io->ent_pos++];
+        udp_iocp_op_t *op = udp_iocp_take(io, e);
+        if (!op) continue;
+        struct p2p_udp_iocp_sock *ks = op->owner;
+
+        // Internal 为完成状态（NTSTATUS）：非 0 为截断、中止等，丢弃后重新投递
+        int idx = -1;
+        if (!op->ov.Internal) {
+            for (int i = 0; i < inst->sock_cnt; i++) if (inst->socks[i].iocp == ks) { idx = i; break; }
+        }
+        if (idx >= 0) {
+            p2p_udp_slot_t *slot = &slots[n++];
+            slot->from = op->from;
+            slot->len = (int)e->dwNumberOfBytesTransferred;
+            slot->sock_idx = idx;
+            slot->rx_us = P_tick_us();
+            slot->ecn = 0;
+            memcpy(slot->buf, op->buf, (size_t)slot->len);
+        }
+        udp_iocp_refill(io, ks);
+    }
+
+    // 此前因立即错误未投递满的套接字
+    for (int i = 0; i < inst->sock_cnt; i++) {
+        struct p2p_udp_iocp_sock *ks = inst->socks[i].iocp;
+        if (ks && ks->posted < P2P_UDP_IOCP_DEPTH) udp_iocp_refill(io, ks);
+    }
+    return n;
+}
+
+/* 实例释放：等待已关闭套接字的投递全部取回后关闭完成端口 */
+static void udp_iocp_free(struct p2p_instance *inst) {
+
+    struct p2p_udp_iocp *io = inst->iocp;
+    if (!io) return;
+
+    // 套接字均已关闭：暂存项与后续完成项只做回收
+    uint64_t end = P_tick_ms() + P2P_UDP_IOCP_DRAIN_MS;
+    while (io->pending > 0) {
+        while (io->ent_pos < io->ent_cnt) udp_iocp_take(io, &io->ent[io->ent_pos++]);
+        if (io->pending <= 0 || P_tick_ms() >= end || udp_iocp_fetch(io, 10) < 0) break;
+    }
+    if (io->pending > 0)
+        print("W:", LA_F("IOCP close with %d receives outstanding", LA_F631, 631), io->pending);
+    else CloseHandle(io->port);
+    p2p_free(io);
+    inst->iocp = NULL;
+}
+
+#else
+
+int p2p_udp_iocp_wait(struct p2p_instance *inst, int ms) {
+    (void)inst; (void)ms;
+    return E_NO_SUPPORT;
+}
+
+void p2p_udp_iocp_wakeup(struct p2p_instance *inst) {
+    (void)inst;
+}
+
+#endif /* _WIN32 */
+
+///////////////////////////////////////////////////////////////////////////////
+
+/* p2p_sock_t.uring */
+#define URING_OFF           0                   /* 未关联（非阻塞 recvmmsg） */
+#define URING_IDLE          1                   /* 多发接收已结束，待重新提交 */
+#define URING_ARMED         2                   /* 多发接收在途 */
+
+#ifdef UDP_URING
+
+#define URING_BGID          0                   /* 提供缓冲区组 ID */
+#define URING_BUF_SIZE      2048                /* 单个提供缓冲区：recvmsg_out 头 + 地址 + 控制消息 + 数据 */
+#define URING_CANCEL_ID     0                   /* 取消请求的 user_data（套接字请求标识从 1 起，完成项忽略） */
+
+struct p2p_udp_uring {
+    int                         fd;
+    void*                       sq_ring;
+    void*                       cq_ring;            // IORING_FEAT_SINGLE_MMAP 时与 sq_ring 相同
+    size_t                      sq_ring_sz, cq_ring_sz;
+    struct io_uring_sqe*        sqes;
+    size_t                      sqes_sz;
+    unsigned                   *sq_head, *sq_tail, sq_mask;
+    unsigned                   *cq_head, *cq_tail, cq_mask;
+    struct io_uring_cqe*        cqes;
+    unsigned                    to_submit;          // 已写入 SQ 尚未提交的请求数
+    struct io_uring_buf_ring*   br;                 // 提供缓冲区环（与 bufs 同一映射，bufs 紧随其后）
+    uint8_t*                    bufs;
+    size_t                      br_sz;
+    uint16_t                    br_tail;            // 本地尾指针，批量归还后发布
+    uint32_t                    next_id;            // 下一个套接字请求标识
+    struct msghdr               msg;                // 多发 recvmsg 模板：只用 msg_namelen / msg_controllen
+};
+
+static inline int uring_enter(int fd, unsigned submit) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, 0, 0, NULL, 0);
+}
+
+static void uring_submit(struct p2p_udp_uring *u) {
+    while (u->to_submit) {
+        int r = uring_enter(u->fd, u->to_submit);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;                          // 如 CQ 溢出时的 EBUSY：留待下次提交
+        u->to_submit -= (unsigned)r;
+    }
+}
+
+/* 取一个空闲 SQE（SQ 满时先提交一次），调用方填写后以 uring_push 发布 */
+static struct io_uring_sqe *uring_sqe(struct p2p_udp_uring *u) {
+    unsigned tail = *u->sq_tail;
+    if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) > u->sq_mask) {
+        uring_submit(u);
+        if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) > u->sq_mask) return NULL;
+    }
+    struct io_uring_sqe *sqe = &u->sqes[tail & u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static inline void uring_push(struct p2p_udp_uring *u) {
+    __atomic_store_n(u->sq_tail, *u->sq_tail + 1, __ATOMIC_RELEASE);
+    u->to_submit++;
+}
+
+static inline void uring_buf_put(struct p2p_udp_uring *u, uint16_t bid) {
+    struct io_uring_buf *b = &u->br->bufs[u->br_tail & (P2P_UDP_URING_BUFS - 1)];
+    b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid * URING_BUF_SIZE);
+    b->len = URING_BUF_SIZE;
+    b->bid = bid;
+    u->br_tail++;
+}
+
+static inline void uring_buf_publish(struct p2p_udp_uring *u) {
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+/* 为套接字提交多发 recvmsg（缓冲区从提供缓冲区环选取），返回 false 表示 SQ 已满 */
+static bool uring_arm(struct p2p_udp_uring *u, p2p_sock_t *ps) {
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = ps->sock;
+    sqe->addr = (uint64_t)(uintptr_t)&u->msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = ps->uring_id;
+    uring_push(u);
+    ps->uring = URING_ARMED;
+    return true;
+}
+
+static void uring_free(struct p2p_udp_uring *u) {
+    if (u->br) {
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = URING_BGID;
+        // 先注销缓冲区组：此后内核不再向缓冲区写入，关闭环后可安全解除映射
+        syscall(__NR_io_uring_register, u->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+    close(u->fd);
+    if (u->br) munmap(u->br, u->br_sz);
+    if (u->sqes) munmap(u->sqes, u->sqes_sz);
+    if (u->cq_ring && u->cq_ring != u->sq_ring) munmap(u->cq_ring, u->cq_ring_sz);
+    if (u->sq_ring) munmap(u->sq_ring, u->sq_ring_sz);
+    p2p_free(u);
+}
+
+/* 创建环并注册提供缓冲区环，失败返回 NULL（errno 为原因） */
+static struct p2p_udp_uring *uring_open(void) {
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = P2P_UDP_URING_CQ;
+    int fd = (int)syscall(__NR_io_uring_setup, P2P_UDP_URING_SQ, &p);
+    if (fd < 0) return NULL;
+
+    struct p2p_udp_uring *u = (struct p2p_udp_uring *)p2p_malloc(sizeof(*u));
+    if (!u) { close(fd); errno = ENOMEM; return NULL; }
+    memset(u, 0, sizeof(*u));
+    u->fd = fd;
+
+    u->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_ring_sz > u->sq_ring_sz) u->sq_ring_sz = u->cq_ring_sz;
+        u->cq_ring_sz = u->sq_ring_sz;
+    }
+    u->sq_ring = mmap(NULL, u->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) { u->sq_ring = NULL; goto fail; }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) u->cq_ring = u->sq_ring;
+    else {
+        u->cq_ring = mmap(NULL, u->cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED) { u->cq_ring = NULL; goto fail; }
+    }
+    u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = (struct io_uring_sqe *)mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                          fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) { u->sqes = NULL; goto fail; }
+
+    uint8_t *sq = (uint8_t *)u->sq_ring, *cq = (uint8_t *)u->cq_ring;
+    u->sq_head = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    unsigned *sq_array = (unsigned *)(sq + p.sq_off.array);
+    for (unsigned i = 0; i < p.sq_entries; i++) sq_array[i] = i;     // SQE 与槽位一一对应
+    u->cq_head = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // 提供缓冲区环（内核 5.19+）：环头后紧跟数据缓冲区，整体页对齐
+    u->br_sz = P2P_UDP_URING_BUFS * (sizeof(struct io_uring_buf) + URING_BUF_SIZE);
+    void *m = mmap(NULL, u->br_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED) goto fail;
+    u->br = (struct io_uring_buf_ring *)m;
+    u->bufs = (uint8_t *)m + P2P_UDP_URING_BUFS * sizeof(struct io_uring_buf);
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+    reg.ring_entries = P2P_UDP_URING_BUFS;
+    reg.bgid = URING_BGID;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int e = errno;
+        munmap(u->br, u->br_sz);
+        u->br = NULL;
+        errno = e;
+        goto fail;
+    }
+    for (int i = 0; i < P2P_UDP_URING_BUFS; i++) uring_buf_put(u, (uint16_t)i);
+    uring_buf_publish(u);
+
+    u->msg.msg_namelen = sizeof(struct sockaddr_in);
+    u->msg.msg_controllen = UDP_CTL_SIZE;
+    u->next_id = 1;
+    return u;
+
+fail:
+    { int e = errno; uring_free(u); errno = e; }
+    return NULL;
+}
+
+/* 新套接字关联到实例的环；环不可用时关闭 cfg.udp_uring 对本实例的作用，套接字保持 recvmmsg */
+static void udp_uring_attach(struct p2p_instance *inst, p2p_sock_t *ps) {
+
+    if (inst->uring_off) return;
+    if (!inst->uring && !(inst->uring = uring_open())) {
+        print("W:", LA_F("io_uring unavailable(%d), using recvmmsg", LA_F632, 632), errno);
+        inst->uring_off = true;
+        return;
+    }
+    struct p2p_udp_uring *u = inst->uring;
+    ps->uring_id = u->next_id++;
+    if (!u->next_id) u->next_id = 1;
+    if (uring_arm(u, ps)) uring_submit(u);
+    else ps->uring = URING_IDLE;
+}
+
+/* 关闭套接字前：取消在途的多发接收（请求持有套接字引用，否则关闭描述符后仍在接收） */
+static void udp_uring_detach(struct p2p_instance *inst, p2p_sock_t *ps) {
+
+    struct p2p_udp_uring *u = inst->uring;
+    if (ps->uring == URING_ARMED) {
+        struct io_uring_sqe *sqe = uring_sqe(u);
+        if (sqe) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = ps->uring_id;
+            sqe->user_data = URING_CANCEL_ID;
+            uring_push(u);
+            uring_submit(u);
+        }
+    }
+    ps->uring = URING_OFF;
+}
+
+/* 完成项 user_data 对应的套接字索引，-1 = 已关闭或取消请求 */
+static int uring_sock_idx(struct p2p_instance *inst, uint64_t id) {
+    if (id == URING_CANCEL_ID) return -1;
+    for (int i = 0; i < inst->sock_cnt; i++)
+        if (inst->socks[i].uring != URING_OFF && inst->socks[i].uring_id == id) return i;
+    return -1;
+}
+
+/* 解析提供缓冲区中的 recvmsg 结果：[io_uring_recvmsg_out][地址][控制消息][数据] */
+static bool uring_slot(struct p2p_instance *inst, int sock_idx, const uint8_t *b, int res, p2p_udp_slot_t *slot,
+                       uint64_t mono_us, int64_t real_us) {
+
+    struct p2p_udp_uring *u = inst->uring;
+    const struct io_uring_recvmsg_out *o = (const struct io_uring_recvmsg_out *)b;
+    size_t hdr = sizeof(*o) + u->msg.msg_namelen + u->msg.msg_controllen;
+    if ((size_t)res < hdr || (o->flags & MSG_TRUNC) || o->payloadlen > sizeof(slot->buf)
+        || hdr + o->payloadlen > (size_t)res) return false;
+
+    const uint8_t *name = b + sizeof(*o);
+    memset(&slot->from, 0, sizeof(slot->from));
+    memcpy(&slot->from, name, o->namelen < sizeof(slot->from) ? o->namelen : sizeof(slot->from));
+    slot->len = (int)o->payloadlen;
+    slot->sock_idx = sock_idx;
+    memcpy(slot->buf, b + hdr, o->payloadlen);
+
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_control = (void *)(name + u->msg.msg_namelen);
+    mh.msg_controllen = o->controllen;
+    udp_rx_cmsg(inst, &inst->socks[sock_idx], &mh, slot, mono_us, real_us);
+    return true;
+}
+
+/*
+ * 取出 CQ 中已完成的接收填入 slots（最多 max 个），缓冲区随即归还；
+ * 多发接收结束（缓冲区耗尽等）的套接字重新提交，内核不支持多发 recvmsg 时回退为 recvmmsg
+ */
+static int udp_uring_recv(struct p2p_instance *inst, p2p_udp_slot_t *slots, int max) {
+
+    struct p2p_udp_uring *u = inst->uring;
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    uint64_t mono_us = 0;
+    int64_t real_us = 0;
+    bool rearm = false, put = false;
+    int n = 0;
+
+    for (; head != tail && n < max; head++) {
+        const struct io_uring_cqe *cqe = &u->cqes[head & u->cq_mask];
+        int idx = uring_sock_idx(inst, cqe->user_data);
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            if (idx >= 0 && cqe->res > 0) {
+                if (!mono_us) udp_rx_clock(&mono_us, &real_us);
+                if (uring_slot(inst, idx, u->bufs + (size_t)bid * URING_BUF_SIZE, cqe->res, &slots[n], mono_us, real_us))
+                    n++;
+            }
+            uring_buf_put(u, bid);
+            put = true;
+        }
+        if (idx < 0 || (cqe->flags & IORING_CQE_F_MORE)) continue;
+
+        p2p_sock_t *ps = &inst->socks[idx];
+        if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+            print("W:", LA_F("io_uring multishot recvmsg unsupported(%d), using recvmmsg", LA_F633, 633), -cqe->res);
+            ps->uring = URING_OFF;
+        } else {
+            ps->uring = URING_IDLE;
+            rearm = true;
+        }
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    if (put) uring_buf_publish(u);
+
+    for (int i = 0; rearm && i < inst->sock_cnt; i++)
+        if (inst->socks[i].uring == URING_IDLE && !uring_arm(u, &inst->socks[i])) break;
+    if (u->to_submit) uring_submit(u);
+    return n;
+}
+
+#endif /* UDP_URING */
+
+///////////////////////////////////////////////////////////////////////////////
 
 ret_t p2p_udp_open(struct p2p_instance *inst, const struct sockaddr_in *bind_ip, uint16_t port) {
 
@@ -7,6 +658,19 @@ ret_t p2p_udp_open(struct p2p_instance *inst, const struct sockaddr_in *bind_ip,
 
     p2p_sock_t *ps = &inst->socks[inst->sock_cnt];
 
+#ifdef P2P_SIM
+    // 模拟构建：在实例所在虚拟主机上绑定端口，不创建系统套接字
+    ps->sock = P_INVALID_SOCKET;
+    if (p2p_sim_open(inst, ps, port) != E_NONE) return P_INVALID_SOCKET;
+    memset(&ps->mapped_addr, 0, sizeof(ps->mapped_addr));
+    ps->iocp = NULL;
+    ps->uring = URING_OFF;
+    ps->state = 1/*bound*/;
+    inst->sock_cnt++;
+    (void)bind_ip;
+    return E_NONE;
+#endif
+
     ps->sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (ps->sock == P_INVALID_SOCKET) return P_INVALID_SOCKET;
 
@@ -21,6 +685,46 @@ ret_t p2p_udp_open(struct p2p_instance *inst, const struct sockaddr_in *bind_ip,
 #ifdef SO_REUSEPORT
     setsockopt(ps->sock, SOL_SOCKET, SO_REUSEPORT, (const char *)&opt, sizeof(opt));
 #endif
+#ifdef SO_RXQ_OVFL
+    setsockopt(ps->sock, SOL_SOCKET, SO_RXQ_OVFL, (const char *)&opt, sizeof(opt));
+#endif
+#ifdef SO_TIMESTAMPNS
+    // 内核接收时间戳：RTT/抖动不计入包在套接字缓冲区中的排队时间
+    setsockopt(ps->sock, SOL_SOCKET, SO_TIMESTAMPNS, (const char *)&opt, sizeof(opt));
+#endif
+#ifdef IP_RECVTOS
+    setsockopt(ps->sock, IPPROTO_IP, IP_RECVTOS, (const char *)&opt, sizeof(opt));
+#endif
+    if (inst->cfg.ecn) {
+        int tos = inst->cfg.ecn == P2P_ECN_L4S ? P2P_UDP_ECN_ECT1 : P2P_UDP_ECN_ECT0;
+        setsockopt(ps->sock, IPPROTO_IP, IP_TOS, (const char *)&tos, sizeof(tos));
+    }
+#ifdef SO_BUSY_POLL
+    // 低延迟模式：接收时在网卡队列上忙轮询（超出 net.core.busy_poll 需 CAP_NET_ADMIN，失败则忽略）
+    if (inst->cfg.latency_mode) {
+        int us = P2P_UDP_BUSY_POLL_US;
+        setsockopt(ps->sock, SOL_SOCKET, SO_BUSY_POLL, (const char *)&us, sizeof(us));
+    }
+#endif
+
+    // 内核收发缓冲区：新套接字沿用实例当前大小（首个套接字按配置窗口计算）
+    if (!inst->sock_buf) inst->sock_buf = p2p_udp_sock_buf_target(inst);
+    if (inst->sock_buf > 0) {
+        int eff = udp_sock_set_buf(ps->sock, inst->sock_buf);
+        if (!inst->sock_cnt) inst->sock_buf_eff = eff;
+    }
+
+    // 路径 MTU 探测：置 DF，超出路径 MTU 的探测包被丢弃，而不是分片后被误判为可达
+    if (inst->cfg.pmtu_discovery) {
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+        int pmtud = IP_PMTUDISC_PROBE;          // 置 DF 且不受内核缓存的路径 MTU 限制
+        setsockopt(ps->sock, IPPROTO_IP, IP_MTU_DISCOVER, (const char *)&pmtud, sizeof(pmtud));
+#elif defined(IP_DONTFRAGMENT)
+        setsockopt(ps->sock, IPPROTO_IP, IP_DONTFRAGMENT, (const char *)&opt, sizeof(opt));
+#elif defined(IP_DONTFRAG)
+        setsockopt(ps->sock, IPPROTO_IP, IP_DONTFRAG, (const char *)&opt, sizeof(opt));
+#endif
+    }
 
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
@@ -40,6 +744,14 @@ ret_t p2p_udp_open(struct p2p_instance *inst, const struct sockaddr_in *bind_ip,
     }
 
     memset(&ps->mapped_addr, 0, sizeof(ps->mapped_addr));
+    ps->iocp = NULL;
+    ps->uring = URING_OFF;
+#ifdef _WIN32
+    if (inst->cfg.udp_iocp) udp_iocp_attach(inst, ps);
+#endif
+#ifdef UDP_URING
+    if (inst->cfg.udp_uring) udp_uring_attach(inst, ps);
+#endif
     ps->state = 1/*bound*/;
     inst->sock_cnt++;
     return E_NONE;
@@ -48,15 +760,27 @@ ret_t p2p_udp_open(struct p2p_instance *inst, const struct sockaddr_in *bind_ip,
 void p2p_udp_close(struct p2p_instance *inst, int sock_idx) {
     P_check(inst && inst->socks && sock_idx >= 0 && sock_idx < inst->sock_cnt, return;)
 
+#ifdef UDP_URING
+    if (inst->socks[sock_idx].uring) udp_uring_detach(inst, &inst->socks[sock_idx]);
+#endif
     if (inst->socks[sock_idx].sock != P_INVALID_SOCKET) {
         P_sock_close(inst->socks[sock_idx].sock);
     }
+#ifdef _WIN32
+    if (inst->socks[sock_idx].iocp) udp_iocp_detach(inst->socks[sock_idx].iocp);
+#endif
+#ifdef P2P_SIM
+    p2p_sim_close(inst, &inst->socks[sock_idx]);
+#endif
 
     if (sock_idx + 1 < inst->sock_cnt) {
         memmove(&inst->socks[sock_idx], &inst->socks[sock_idx + 1],
                 (size_t)(inst->sock_cnt - sock_idx - 1) * sizeof(*inst->socks));
     }
 
+    // 端口预测套接字位于数组末尾，前移后更新起始索引
+    if (inst->predict_base > sock_idx) inst->predict_base--;
+
     inst->sock_cnt--;
     memset(&inst->socks[inst->sock_cnt], 0, sizeof(*inst->socks));
     inst->socks[inst->sock_cnt].sock = P_INVALID_SOCKET;
@@ -70,16 +794,201 @@ void p2p_udp_close_all(struct p2p_instance *inst) {
         p2p_udp_close(inst, inst->sock_cnt - 1);
     }
 
-    free(inst->socks);
+    p2p_free(inst->socks);
     inst->socks = NULL;
     inst->sock_cap = 0;
+    inst->predict_base = 0;
+
+    if (inst->sock6_port) {
+        P_sock_close(inst->sock6);
+        inst->sock6_port = 0;
+    }
+#ifdef _WIN32
+    udp_iocp_free(inst);
+#endif
+#ifdef UDP_URING
+    if (inst->uring) {
+        uring_free(inst->uring);
+        inst->uring = NULL;
+    }
+#endif
+
+    p2p_free(inst->rx_slots);
+    inst->rx_slots = NULL;
+
+    p2p_free(inst->txq.slots);
+    p2p_free(inst->txq.seals);
+    inst->txq.slots = NULL;
+    inst->txq.seals = NULL;
+    inst->txq.cnt = inst->txq.seal_cnt = 0;
+
+    p2p_netem_free(inst);
+#ifdef P2P_SIM
+    p2p_sim_detach(inst);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * IPv6 别名表（进程内共享，只增不删）
+ * + 表项写入后才发布计数，p2p_udp_v6_real 无锁读取
+ */
+#define V6_ALIAS_NET        0xF0000000u                 /* 240.0.0.0/4 */
+
+static uint8_t          g_v6_alias[P2P_UDP_V6_ALIAS_MAX][16];
+static int              g_v6_alias_cnt;
+static volatile long    g_v6_alias_lock;
+
+#if defined(_MSC_VER)
+#define V6_ALIAS_LOCK()     while (_InterlockedExchange(&g_v6_alias_lock, 1)) {}
+#define V6_ALIAS_UNLOCK()   _InterlockedExchange(&g_v6_alias_lock, 0)
+#define V6_ALIAS_CNT()      (_ReadWriteBarrier(), g_v6_alias_cnt)
+#define V6_ALIAS_PUBLISH(n) (_ReadWriteBarrier(), g_v6_alias_cnt = (n))
+#else
+#define V6_ALIAS_LOCK()     while (__atomic_exchange_n(&g_v6_alias_lock, 1, __ATOMIC_ACQUIRE)) {}
+#define V6_ALIAS_UNLOCK()   __atomic_store_n(&g_v6_alias_lock, 0, __ATOMIC_RELEASE)
+#define V6_ALIAS_CNT()      __atomic_load_n(&g_v6_alias_cnt, __ATOMIC_ACQUIRE)
+#define V6_ALIAS_PUBLISH(n) __atomic_store_n(&g_v6_alias_cnt, (n), __ATOMIC_RELEASE)
+#endif
+
+bool p2p_udp_v6_is_alias(const struct sockaddr_in *addr) {
+    uint32_t ip = ntohl(addr->sin_addr.s_addr);
+    return (ip & V6_ALIAS_NET) == V6_ALIAS_NET && (int)(ip & ~V6_ALIAS_NET) < V6_ALIAS_CNT();
+}
+
+bool p2p_udp_v6_alias(const uint8_t ip6[16], uint16_t port, struct sockaddr_in *out) {
+
+    int idx = -1;
+    V6_ALIAS_LOCK();
+    int cnt = g_v6_alias_cnt;
+    for (int i = 0; i < cnt; i++) {
+        if (!memcmp(g_v6_alias[i], ip6, 16)) { idx = i; break; }
+    }
+    if (idx < 0 && cnt < P2P_UDP_V6_ALIAS_MAX) {
+        memcpy(g_v6_alias[cnt], ip6, 16);
+        V6_ALIAS_PUBLISH(cnt + 1);
+        idx = cnt;
+    }
+    V6_ALIAS_UNLOCK();
+    if (idx < 0) return false;
+
+    memset(out, 0, sizeof(*out));
+    out->sin_family = AF_INET;
+    out->sin_addr.s_addr = htonl(V6_ALIAS_NET | (uint32_t)idx);
+    out->sin_port = port;
+    return true;
+}
+
+bool p2p_udp_v6_real(const struct sockaddr_in *alias, uint8_t ip6[16]) {
+    if (!p2p_udp_v6_is_alias(alias)) return false;
+    memcpy(ip6, g_v6_alias[ntohl(alias->sin_addr.s_addr) & ~V6_ALIAS_NET], 16);
+    return true;
+}
+
+ret_t p2p_udp_open6(struct p2p_instance *inst, uint16_t port) {
+
+    P_check(inst && !inst->sock6_port, return E_INVALID;)
+
+    sock_t fd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (fd == P_INVALID_SOCKET) return E_EXTERNAL(P_sock_errno());
+
+    // 仅收发原生 IPv6：IPv4 仍走 socks[]，避免同一对端出现两种地址形式
+    int opt = 1;
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, (const char *)&opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt, sizeof(opt));
+    if (inst->sock_buf > 0) udp_sock_set_buf(fd, inst->sock_buf);
+
+    struct sockaddr_in6 addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(port);
+
+    // 优先与 socks[0] 同端口（便于防火墙配置），被占用时退回系统分配端口
+    bool bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    if (!bound && port) {
+        addr.sin6_port = 0;
+        bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    }
+    socklen_t len = sizeof(addr);
+    if (!bound || P_sock_nonblock(fd, true) != E_NONE
+        || getsockname(fd, (struct sockaddr *)&addr, &len) != 0 || !addr.sin6_port) {
+        int e = P_sock_errno();
+        P_sock_close(fd);
+        return e ? E_EXTERNAL(e) : E_UNKNOWN;
+    }
+
+    inst->sock6 = fd;
+    inst->sock6_port = addr.sin6_port;
+    return E_NONE;
+}
+
+/* 别名地址 → sockaddr_in6；false = 不是别名或 IPv6 套接字未开启 */
+static bool udp_v6_target(struct p2p_instance *inst, const struct sockaddr_in *alias, struct sockaddr_in6 *to) {
+    if (!inst->sock6_port) return false;
+    memset(to, 0, sizeof(*to));
+    to->sin6_family = AF_INET6;
+    to->sin6_port = alias->sin_port;
+    return p2p_udp_v6_real(alias, (uint8_t *)&to->sin6_addr);
+}
+
+static ret_t udp_send6(struct p2p_instance *inst, const struct sockaddr_in *addr, const void *data, int len) {
+
+    struct sockaddr_in6 to;
+    if (!udp_v6_target(inst, addr, &to)) return E_INVALID;
+
+    ssize_t n = sendto(inst->sock6, (const char *)data, len, 0, (const struct sockaddr *)&to, sizeof(to));
+    if (n != len) {
+        int e = P_sock_errno();
+        return e ? E_EXTERNAL(e) : E_UNKNOWN;
+    }
+    return (int)n;
 }
 
+/* 从 IPv6 套接字读取，来源地址转换为别名（别名表满时丢弃） */
+static int udp_recv6(struct p2p_instance *inst, p2p_udp_slot_t *slots, int max) {
+
+    int n = 0;
+    while (n < max) {
+        struct sockaddr_in6 from;
+        socklen_t from_len = sizeof(from);
+        ssize_t r = recvfrom(inst->sock6, (char *)slots[n].buf, (int)sizeof(slots[n].buf), 0,
+                             (struct sockaddr *)&from, &from_len);
+        if (r < 0) {
+            if (P_sock_is_wouldblock() || n) break;
+            int e = P_sock_errno();
+            return e ? E_EXTERNAL(e) : E_UNKNOWN;
+        }
+        if (!p2p_udp_v6_alias((const uint8_t *)&from.sin6_addr, from.sin6_port, &slots[n].from)) continue;
+        slots[n].len = (int)r;
+        slots[n].sock_idx = 0;
+        slots[n].rx_us = P_tick_us();
+        slots[n].ecn = 0;
+        n++;
+    }
+    return n;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
 ret_t p2p_udp_send_to_sock(struct p2p_instance *inst, int sock_idx,
                            const struct sockaddr_in *addr,
                            const void *data, int len) {
 
     P_check(inst && inst->socks && sock_idx >= 0 && sock_idx < inst->sock_cnt, return E_INVALID;)
+    if (inst->netem && inst->netem->tx.on) return p2p_netem_send(inst, sock_idx, addr, data, len);
+    return p2p_udp_send_raw(inst, sock_idx, addr, data, len);
+}
+
+ret_t p2p_udp_send_raw(struct p2p_instance *inst, int sock_idx,
+                       const struct sockaddr_in *addr,
+                       const void *data, int len) {
+
+    if (p2p_udp_v6_is_alias(addr)) return udp_send6(inst, addr, data, len);
+#ifdef P2P_SIM
+    return p2p_sim_send(inst, sock_idx, addr, data, len);
+#endif
     sock_t fd = inst->socks[sock_idx].sock;
     if (fd == P_INVALID_SOCKET) return E_INVALID;
 
@@ -97,12 +1006,50 @@ ret_t p2p_udp_send_to(struct p2p_instance *inst, const struct sockaddr_in *addr,
     return p2p_udp_send_to_sock(inst, 0, addr, data, len);
 }
 
+/* 单包接收经 rx 损伤队列：刚读到的包（len>0）入队，取出一个已到期的包 */
+static ret_t udp_recv_netem(struct p2p_instance *inst, struct sockaddr_in *from, void *buf, int buf_size,
+                            int *recv_sock_idx, int sock_idx, int len) {
+    p2p_udp_slot_t slot;
+    if (len > 0) {
+        slot.from = *from;
+        slot.sock_idx = sock_idx;
+        slot.len = len;
+        memcpy(slot.buf, buf, (size_t)len);
+    }
+    if (!p2p_netem_recv(inst, &slot, len > 0, 1)) return E_BUSY;
+    if (slot.len > buf_size) slot.len = buf_size;
+    memcpy(buf, slot.buf, (size_t)slot.len);
+    *from = slot.from;
+    if (recv_sock_idx) *recv_sock_idx = slot.sock_idx;
+    return slot.len;
+}
+
 ret_t p2p_udp_recv_from(struct p2p_instance *inst, struct sockaddr_in *from,
                         void *buf, int buf_size, int *recv_sock_idx) {
 
     P_check(inst && inst->socks, return E_INVALID;)
 
-    for (int i = 0; i < inst->sock_cnt; i++) {
+#ifdef P2P_SIM
+    {
+        p2p_udp_slot_t slot;
+        int n = p2p_sim_recv(inst, &slot, 1);
+        if (n) {
+            if (slot.len > buf_size) slot.len = buf_size;
+            memcpy(buf, slot.buf, (size_t)slot.len);
+            *from = slot.from;
+        }
+        if (inst->netem && inst->netem->rx.on) return udp_recv_netem(inst, from, buf, buf_size, recv_sock_idx, slot.sock_idx, n ? slot.len : 0);
+        if (!n) return E_BUSY;
+        if (recv_sock_idx) *recv_sock_idx = slot.sock_idx;
+        return slot.len;
+    }
+#endif
+
+    // 起点每次调用后移一位：某个套接字持续有包时其他套接字仍能轮到
+    int start = inst->sock_cnt ? inst->rx_rr % inst->sock_cnt : 0;
+    if (inst->sock_cnt) inst->rx_rr = (start + 1) % inst->sock_cnt;
+    for (int k = 0; k < inst->sock_cnt; k++) {
+        int i = (start + k) % inst->sock_cnt;
         if (inst->socks[i].sock == P_INVALID_SOCKET) continue;
 
         socklen_t sock_len = sizeof(*from);
@@ -114,9 +1061,412 @@ ret_t p2p_udp_recv_from(struct p2p_instance *inst, struct sockaddr_in *from,
             return e ? E_EXTERNAL(e) : E_UNKNOWN;
         }
 
+        if (inst->netem && inst->netem->rx.on) return udp_recv_netem(inst, from, buf, buf_size, recv_sock_idx, i, (int)n);
         if (recv_sock_idx) *recv_sock_idx = i;
         return (int)n;
     }
 
+    if (inst->sock6_port) {
+        p2p_udp_slot_t slot;
+        int n = udp_recv6(inst, &slot, 1);
+        if (n < 0) return n;
+        if (n && inst->netem && inst->netem->rx.on) {
+            memcpy(buf, slot.buf, (size_t)(slot.len <= buf_size ? slot.len : buf_size));
+            *from = slot.from;
+            return udp_recv_netem(inst, from, buf, buf_size, recv_sock_idx, 0, slot.len <= buf_size ? slot.len : buf_size);
+        }
+        if (n && slot.len <= buf_size) {
+            memcpy(buf, slot.buf, (size_t)slot.len);
+            *from = slot.from;
+            if (recv_sock_idx) *recv_sock_idx = 0;
+            return slot.len;
+        }
+    }
+
+    if (inst->netem && inst->netem->rx.on) return udp_recv_netem(inst, from, buf, buf_size, recv_sock_idx, 0, 0);
     return E_BUSY;
 }
+
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * 从单个套接字批量读取（最多 max 个包）
+ * + Linux 同时读取 SO_RXQ_OVFL（内核累计丢包数），增量计入 inst->kernel_drops
+ * + Linux 读取 SO_TIMESTAMPNS（内核接收时间，CLOCK_REALTIME）换算到 P_tick_us 时基填入 rx_us，
+ *   无时间戳或换算结果不合理时取读出时刻
+ * + IP_RECVTOS 附带的 TOS 字节取低 2 位填入 ecn
+ * @return >=0 读取的包数量；<0 错误
+ */
+static int udp_recv_sock_batch(struct p2p_instance *inst, int sock_idx, p2p_udp_slot_t *slots, int max) {
+
+    p2p_sock_t *ps = &inst->socks[sock_idx];
+    sock_t fd = ps->sock;
+#if defined(__linux__)
+    struct mmsghdr msgs[P2P_UDP_BATCH_SLOTS];
+    struct iovec iovs[P2P_UDP_BATCH_SLOTS];
+    union {
+        char buf[UDP_CTL_SIZE];
+        struct cmsghdr align;
+    } ctl[P2P_UDP_BATCH_SLOTS];
+
+    for (int i = 0; i < max; i++) {
+        iovs[i].iov_base = slots[i].buf;
+        iovs[i].iov_len = sizeof(slots[i].buf);
+        memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+        msgs[i].msg_hdr.msg_name = &slots[i].from;
+        msgs[i].msg_hdr.msg_namelen = sizeof(slots[i].from);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = ctl[i].buf;
+        msgs[i].msg_hdr.msg_controllen = sizeof(ctl[i].buf);
+    }
+
+    int n = recvmmsg(fd, msgs, (unsigned int)max, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        if (P_sock_is_wouldblock()) return 0;
+        int e = P_sock_errno();
+        return e ? E_EXTERNAL(e) : E_UNKNOWN;
+    }
+
+    uint64_t mono_us;
+    int64_t real_us;
+    udp_rx_clock(&mono_us, &real_us);
+    for (int i = 0; i < n; i++) {
+        slots[i].len = (int)msgs[i].msg_len;
+        slots[i].sock_idx = sock_idx;
+        udp_rx_cmsg(inst, ps, &msgs[i].msg_hdr, &slots[i], mono_us, real_us);
+    }
+    return n;
+#else
+    int n = 0;
+    while (n < max) {
+        socklen_t sock_len = sizeof(slots[n].from);
+        ssize_t r = recvfrom(fd, (char *)slots[n].buf, (int)sizeof(slots[n].buf), 0,
+                             (struct sockaddr *)&slots[n].from, &sock_len);
+        if (r < 0) {
+            if (P_sock_is_wouldblock()) break;
+            if (n) break;                           // 已读到的包优先交付，错误留待下次返回
+            int e = P_sock_errno();
+            return e ? E_EXTERNAL(e) : E_UNKNOWN;
+        }
+        slots[n].len = (int)r;
+        slots[n].sock_idx = sock_idx;
+        slots[n].rx_us = P_tick_us();
+        slots[n].ecn = 0;
+        n++;
+    }
+    return n;
+#endif
+}
+
+int p2p_udp_poll_fds(struct p2p_instance *inst, p2p_fd_t *fds, int max) {
+
+    int n = 0;
+#ifdef UDP_URING
+    if (inst->uring) {
+        if (n < max) { fds[n].fd = (intptr_t)inst->uring->fd; fds[n].events = P2P_FD_READ; }
+        n++;
+    }
+#endif
+    for (int i = 0; i < inst->sock_cnt; i++) {
+        // 待重新提交的套接字仍需关注：数据到达后 p2p_update 才会重新提交
+        if (inst->socks[i].sock == P_INVALID_SOCKET || inst->socks[i].uring == URING_ARMED) continue;
+        if (n < max) { fds[n].fd = (intptr_t)inst->socks[i].sock; fds[n].events = P2P_FD_READ; }
+        n++;
+    }
+    if (inst->sock6_port) {
+        if (n < max) { fds[n].fd = (intptr_t)inst->sock6; fds[n].events = P2P_FD_READ; }
+        n++;
+    }
+    return n;
+}
+
+ret_t p2p_udp_recv_batch(struct p2p_instance *inst, int max) {
+
+    P_check(inst && inst->socks && max > 0, return E_INVALID;)
+
+    if (!inst->rx_slots) {
+        inst->rx_slots = (p2p_udp_slot_t *)p2p_malloc(sizeof(p2p_udp_slot_t) * P2P_UDP_BATCH_SLOTS);
+        if (!inst->rx_slots) return E_OUT_OF_MEMORY;
+    }
+    if (max > P2P_UDP_BATCH_SLOTS) max = P2P_UDP_BATCH_SLOTS;
+
+    int cnt = 0;
+#ifdef _WIN32
+    if (inst->iocp) cnt = udp_iocp_recv(inst, inst->rx_slots, max);
+#endif
+#ifdef UDP_URING
+    if (inst->uring) cnt = udp_uring_recv(inst, inst->rx_slots, max);
+#endif
+#ifdef P2P_SIM
+    cnt = p2p_sim_recv(inst, inst->rx_slots, max);        // 虚拟套接字无系统描述符，下面的逐套接字读取全部跳过
+#endif
+
+    // 各套接字公平读取：先每个套接字至多读均分份额（起点每次调用后移一位），
+    // 余量再分给读满份额的套接字；默认套接字上的洪泛不会饿死按接口的 srflx 套接字与 TURN 流量
+    int live = 0;
+    for (int i = 0; i < inst->sock_cnt; i++)
+        if (inst->socks[i].sock != P_INVALID_SOCKET && !inst->socks[i].iocp && !inst->socks[i].uring) live++;
+    if (live && cnt < max) {
+        int start = inst->rx_rr % inst->sock_cnt;
+        inst->rx_rr = (start + 1) % inst->sock_cnt;
+        int share = (max - cnt + live - 1) / live;
+        uint64_t full = 0;                          // 首轮读满份额的套接字（按索引低 6 位，冲突时仅多读一次）
+        bool stop = false;
+        for (int pass = 0; pass < 2 && cnt < max && !stop; pass++) {
+            for (int k = 0; k < inst->sock_cnt && cnt < max; k++) {
+                int i = (start + k) % inst->sock_cnt;
+                if (inst->socks[i].sock == P_INVALID_SOCKET || inst->socks[i].iocp || inst->socks[i].uring) continue;
+                if (pass && !(full & (1ull << (i & 63)))) continue;
+
+                int want = max - cnt;
+                if (!pass && want > share) want = share;
+                int n = udp_recv_sock_batch(inst, i, inst->rx_slots + cnt, want);
+                if (n < 0) {
+                    if (!cnt) return n;
+                    stop = true;                    // 已读到的包优先交付，错误留待下次返回
+                    break;
+                }
+                if (n == want) full |= 1ull << (i & 63);
+                cnt += n;
+            }
+            if (!full) break;
+        }
+    }
+
+    if (inst->sock6_port && cnt < max) {
+        int n = udp_recv6(inst, inst->rx_slots + cnt, max - cnt);
+        if (n < 0 && !cnt) return n;
+        if (n > 0) cnt += n;
+    }
+
+    // 损伤模拟：读到的包全部进入 rx 队列，交付已到期的包
+    if (inst->netem && inst->netem->rx.on) cnt = p2p_netem_recv(inst, inst->rx_slots, cnt, max);
+
+    return cnt ? cnt : E_BUSY;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/* sock_msg_t 在 POSIX 下为 struct iovec，Windows 下为 WSABUF */
+#ifdef _WIN32
+#define udp_msg_ptr(m) ((const void *)(m)->buf)
+#else
+#define udp_msg_ptr(m) ((const void *)(m)->iov_base)
+#endif
+
+/* 当前线程的发送合并队列 */
+static inline p2p_udp_txq_t *udp_txq(struct p2p_instance *inst) {
+#ifdef P2P_THREADED
+    if (p2p_worker_self) return &p2p_worker_self->txq;
+#endif
+    return &inst->txq;
+}
+
+/* 分段消息合并写入队尾槽位（调用方保证队列有空位） */
+static ret_t udp_enqueue(p2p_udp_txq_t *q, const struct sockaddr_in *addr, const sock_msg_t *msgs, int num) {
+
+    p2p_udp_slot_t *slot = &q->slots[q->cnt];
+    int len = 0;
+    for (int i = 0; i < num; i++) {
+        int l = (int)P_msg_len(&msgs[i]);
+        if (len + l > (int)sizeof(slot->buf)) return E_OUT_OF_CAPACITY;
+        memcpy(slot->buf + len, udp_msg_ptr(&msgs[i]), (size_t)l);
+        len += l;
+    }
+    slot->from = *addr;
+    slot->len = len;
+    slot->sock_idx = 0;
+    q->cnt++;
+    return len;
+}
+
+void p2p_udp_tx_begin(struct p2p_instance *inst) {
+    udp_txq(inst)->batching++;
+}
+
+void p2p_udp_tx_end(struct p2p_instance *inst) {
+    p2p_udp_txq_t *q = udp_txq(inst);
+    if (q->batching > 0 && --q->batching == 0) p2p_udp_tx_flush(inst);
+}
+
+ret_t p2p_udp_send_msgs(struct p2p_instance *inst, const struct sockaddr_in *addr,
+                        const sock_msg_t *msgs, int num) {
+
+    P_check(inst && inst->socks && inst->sock_cnt > 0, return E_INVALID;)
+
+    // IPv6 对端不进入发送合并队列（flush 只走默认 IPv4 套接字），合并分段后直接发出
+    // + 损伤模拟开启时同样合并后进入 tx 队列；模拟构建合并后进入虚拟网络
+    bool netem = inst->netem && inst->netem->tx.on;
+    if (netem || UDP_SIM || p2p_udp_v6_is_alias(addr)) {
+        uint8_t buf[P2P_MTU_MAX + 16];
+        int len = 0;
+        for (int i = 0; i < num; i++) {
+            int l = (int)P_msg_len(&msgs[i]);
+            if (len + l > (int)sizeof(buf)) return E_OUT_OF_CAPACITY;
+            memcpy(buf + len, udp_msg_ptr(&msgs[i]), (size_t)l);
+            len += l;
+        }
+        return netem ? p2p_netem_send(inst, 0, addr, buf, len) : p2p_udp_send_raw(inst, 0, addr, buf, len);
+    }
+
+    p2p_udp_txq_t *q = udp_txq(inst);
+    if (!q->batching) return P_msg_send_to(p2p_udp_default_fd(inst), msgs, num, addr);
+
+    if (!q->slots) {
+        q->slots = (p2p_udp_slot_t *)p2p_malloc(sizeof(p2p_udp_slot_t) * P2P_UDP_BATCH_SLOTS);
+        if (!q->slots) return P_msg_send_to(p2p_udp_default_fd(inst), msgs, num, addr);
+    }
+    else if (q->cnt >= P2P_UDP_BATCH_SLOTS) p2p_udp_tx_flush(inst);
+
+    return udp_enqueue(q, addr, msgs, num);
+}
+
+ret_t p2p_udp_send_sealed(struct p2p_instance *inst, const struct sockaddr_in *addr,
+                          const sock_msg_t *msgs, int num, const p2p_aead_job_t *seal, int seal_off) {
+
+#ifdef P2P_THREADED
+    P_check(inst && inst->socks && inst->sock_cnt > 0, return E_INVALID;)
+
+    p2p_udp_txq_t *q = udp_txq(inst);
+    if (!inst->crypto || !q->batching || UDP_SIM || (inst->netem && inst->netem->tx.on) || p2p_udp_v6_is_alias(addr))
+        return E_NONE_CONTEXT;
+
+    if (!q->slots) q->slots = (p2p_udp_slot_t *)p2p_malloc(sizeof(p2p_udp_slot_t) * P2P_UDP_BATCH_SLOTS);
+    if (!q->seals) q->seals = (p2p_aead_job_t *)p2p_malloc(sizeof(p2p_aead_job_t) * P2P_UDP_BATCH_SLOTS);
+    if (!q->slots || !q->seals) return E_NONE_CONTEXT;
+    if (q->cnt >= P2P_UDP_BATCH_SLOTS) p2p_udp_tx_flush(inst);
+
+    p2p_udp_slot_t *slot = &q->slots[q->cnt];
+    ret_t len = udp_enqueue(q, addr, msgs, num);
+    if (len < 0) return len;
+
+    p2p_aead_job_t *j = &q->seals[q->seal_cnt++];
+    *j = *seal;
+    j->in = j->out = slot->buf + seal_off;
+    return len;
+#else
+    (void)inst; (void)addr; (void)msgs; (void)num; (void)seal; (void)seal_off;
+    return E_NONE_CONTEXT;
+#endif
+}
+
+#if defined(__linux__)
+
+/* 将 slots[0..cnt) 通过 sendmmsg 发出 */
+static void udp_send_mmsg(sock_t fd, p2p_udp_slot_t *slots, int cnt) {
+
+    struct mmsghdr msgs[P2P_UDP_BATCH_SLOTS];
+    struct iovec iovs[P2P_UDP_BATCH_SLOTS];
+
+    for (int i = 0; i < cnt; i++) {
+        iovs[i].iov_base = slots[i].buf;
+        iovs[i].iov_len = (size_t)slots[i].len;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &slots[i].from;
+        msgs[i].msg_hdr.msg_namelen = sizeof(slots[i].from);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // sendmmsg 遇错会提前返回已发送数量，跳过出错的包继续发送剩余部分（与逐包 sendto 的丢包语义一致）
+    int off = 0;
+    while (off < cnt) {
+        int n = sendmmsg(fd, msgs + off, (unsigned int)(cnt - off), 0);
+        off += n > 0 ? n : 1;
+    }
+}
+
+#ifdef UDP_SEGMENT
+/*
+ * 将同目标、等长（最后一个可更短）的连续包通过 UDP GSO 一次提交
+ * @return 0 成功；<0 GSO 不可用
+ */
+static int udp_send_gso(sock_t fd, p2p_udp_slot_t *slots, int cnt) {
+
+    struct iovec iovs[P2P_UDP_BATCH_SLOTS];
+    for (int i = 0; i < cnt; i++) {
+        iovs[i].iov_base = slots[i].buf;
+        iovs[i].iov_len = (size_t)slots[i].len;
+    }
+
+    char ctrl[CMSG_SPACE(sizeof(uint16_t))];
+    memset(ctrl, 0, sizeof(ctrl));
+
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_name = &slots[0].from;
+    mh.msg_namelen = sizeof(slots[0].from);
+    mh.msg_iov = iovs;
+    mh.msg_iovlen = (size_t)cnt;
+    mh.msg_control = ctrl;
+    mh.msg_controllen = sizeof(ctrl);
+
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t seg = (uint16_t)slots[0].len;
+    memcpy(CMSG_DATA(cm), &seg, sizeof(seg));
+
+    return sendmsg(fd, &mh, 0) < 0 ? -1 : 0;
+}
+#endif
+
+#endif /* __linux__ */
+
+void p2p_udp_tx_flush(struct p2p_instance *inst) {
+
+    p2p_udp_txq_t *q = udp_txq(inst);
+    if (!q->cnt) return;
+    if (!inst->socks || !inst->sock_cnt || p2p_udp_default_fd(inst) == P_INVALID_SOCKET) {
+        q->cnt = q->seal_cnt = 0;
+        return;
+    }
+
+#ifdef P2P_THREADED
+    // 延后封装的记录：整批并行加密（序号入队时已按会话顺序分配，发送仍按入队顺序）
+    if (q->seal_cnt) {
+        p2p_crypto_run(inst, q->seals, q->seal_cnt);
+        q->seal_cnt = 0;
+    }
+#endif
+
+    sock_t fd = p2p_udp_default_fd(inst);
+    p2p_udp_slot_t *slots = q->slots;
+    int cnt = q->cnt; q->cnt = 0;
+
+#if defined(__linux__)
+# ifdef UDP_SEGMENT
+    int pending = 0;                                    // [pending, i) 为尚未发出的普通包
+    for (int i = 0; i < cnt; ) {
+
+        // 查找同目标、等长的连续包序列（最后一个允许更短）
+        int j = i + 1;
+        if (!inst->tx_gso_off) {
+            while (j < cnt && sockaddr_equal(&slots[j].from, &slots[i].from)
+                   && slots[j].len <= slots[i].len && slots[j - 1].len == slots[i].len) j++;
+        }
+
+        if (j - i >= 2) {
+            // 保持发送顺序：先发出之前积累的普通包
+            if (i > pending) udp_send_mmsg(fd, slots + pending, i - pending);
+            if (udp_send_gso(fd, slots + i, j - i) < 0) {
+                inst->tx_gso_off = true;                // 内核或网卡不支持，后续退回 sendmmsg
+                udp_send_mmsg(fd, slots + i, j - i);
+            }
+            pending = i = j;
+        }
+        else i = j;
+    }
+    if (cnt > pending) udp_send_mmsg(fd, slots + pending, cnt - pending);
+# else
+    udp_send_mmsg(fd, slots, cnt);
+# endif
+#else
+    for (int i = 0; i < cnt; i++) {
+        sendto(fd, (const char *)slots[i].buf, slots[i].len, 0,
+               (const struct sockaddr *)&slots[i].from, sizeof(slots[i].from));
+    }
+#endif
+}
@@ -7,6 +7,7 @@
 
 #include "predefine.h"
 #include <p2pp.h>               /* p2p_packet_hdr_t 定义 */
+#include "p2p_crypto.h"         /* p2p_aead_job_t */
 
 struct p2p_instance;
 struct p2p_session;
@@ -16,15 +17,170 @@ ret_t p2p_udp_open(struct p2p_instance *inst, const struct sockaddr_in *bind_ip,
 void p2p_udp_close(struct p2p_instance *inst, int sock_idx);
 void p2p_udp_close_all(struct p2p_instance *inst);
 
+/*
+ * 套接字内核收发缓冲区（cfg.sock_buf_size）
+ * + 自动模式：按 2 × max(配置窗口, 各会话观测 BDP) 设置 SO_RCVBUF/SO_SNDBUF，只增不减；
+ *   系统上限（net.core.rmem_max / wmem_max）截断的实际值读回到 inst->sock_buf_eff
+ * + Linux 开启 SO_RXQ_OVFL，批量接收时累计内核接收队列溢出丢包（p2p_instance_stats_t.kernel_drops）
+ */
+#define P2P_UDP_SOCKBUF_MIN     (256 * 1024)    // 自动模式下限
+#define P2P_UDP_SOCKBUF_MAX     (16 * 1024 * 1024)
+#define P2P_UDP_SOCKBUF_TICK_MS 1000            // 按 BDP 重新检查的间隔
+
+#define P2P_UDP_BUSY_POLL_US    50              // cfg.latency_mode：SO_BUSY_POLL 忙轮询时长（微秒）
+
+/*
+ * ECN 码点（IP TOS 低 2 位，cfg.ecn）
+ * + 发送：按 cfg.ecn 设置套接字 IP_TOS 为 ECT(0) / ECT(1)
+ * + 接收：始终开启 IP_RECVTOS，批量接收时读出码点填入 p2p_udp_slot_t.ecn（供回显 CE 计数）
+ */
+#define P2P_UDP_ECN_MASK        0x03
+#define P2P_UDP_ECN_ECT1        0x01
+#define P2P_UDP_ECN_ECT0        0x02
+#define P2P_UDP_ECN_CE          0x03
+
+int  p2p_udp_sock_buf_target(struct p2p_instance *inst);
+void p2p_udp_sock_buf_tick(struct p2p_instance *inst, uint64_t now_ms);
+
 #define p2p_udp_default_fd(inst) ((inst)->socks[0].sock)
 
+/*
+ * Windows IOCP 接收（cfg.udp_iocp）
+ * + 实例一个完成端口，每个 IPv4 套接字关联后预投递 P2P_UDP_IOCP_DEPTH 个重叠 WSARecvFrom，
+ *   包由内核直接写入投递的缓冲区；p2p_udp_recv_batch 取出完成项填入 rx_slots 后立即重新投递，
+ *   后续派发与非阻塞路径相同（rx_us 为取出时刻，ecn 恒为 0）
+ * + 关闭套接字时未完成的投递以中止状态完成，上下文待全部取回后释放；p2p_udp_close_all 至多等待
+ *   P2P_UDP_IOCP_DRAIN_MS，超时则放弃（泄漏而不释放仍被内核引用的缓冲区）
+ * + 关联失败（或非 Windows）时回退为非阻塞 recvfrom；IPv6 套接字始终走非阻塞路径
+ * + p2p_udp_iocp_wait 与 p2p_udp_recv_batch 须在同一线程调用（内部线程模式的主线程）
+ */
+#define P2P_UDP_IOCP_DEPTH      64              // 每套接字预投递的接收数
+#define P2P_UDP_IOCP_DRAIN_MS   1000
+#define P2P_UDP_IOCP_DATA       0x01            // p2p_udp_iocp_wait：有已完成的接收
+#define P2P_UDP_IOCP_WAKE       0x02            // p2p_udp_iocp_wait：p2p_udp_iocp_wakeup 唤醒
+
+#define p2p_udp_iocp_on(inst)   ((inst)->iocp != NULL)
+
+/*
+ * Linux io_uring 接收（cfg.udp_uring）
+ * + 实例一个环与一组提供缓冲区（P2P_UDP_URING_BUFS 个），每个 IPv4 套接字提交一个多发 recvmsg：
+ *   到达的包由内核选取缓冲区写入并产生完成项，无需逐包系统调用；p2p_udp_recv_batch 从 CQ 取出
+ *   （控制消息照常解析 rx_us / ecn / 内核丢包计数）后归还缓冲区，多发接收结束时重新提交
+ * + 等待：环描述符在 CQ 非空时可读，p2p_udp_poll_fds 以其代替已关联的套接字
+ * + 环创建或缓冲区注册失败（内核 < 5.19、seccomp 等）时本实例不再尝试；多发 recvmsg 不受支持（< 6.0）时
+ *   该套接字回退 recvmmsg
+ */
+#define P2P_UDP_URING_SQ        64
+#define P2P_UDP_URING_CQ        1024
+#define P2P_UDP_URING_BUFS      256             // 提供缓冲区数（2 的幂，每个 2KB）
+
+/*
+ * poll 等待 UDP 接收时需关注的描述符：io_uring 环、未关联环的 IPv4 套接字、IPv6 套接字
+ * @return 描述符数量（可能大于 max，此时仅填充前 max 项）
+ */
+int  p2p_udp_poll_fds(struct p2p_instance *inst, p2p_fd_t *fds, int max);
+
+/*
+ * 等待完成端口至多 ms 毫秒，取出的完成项暂存供下一次 p2p_udp_recv_batch 读取
+ * @return P2P_UDP_IOCP_* 组合；0 超时；<0 错误（或非 Windows 的 E_NO_SUPPORT）
+ */
+int  p2p_udp_iocp_wait(struct p2p_instance *inst, int ms);
+
+/* 向完成端口投递唤醒项（未开启时为空操作，任意线程可调用） */
+void p2p_udp_iocp_wakeup(struct p2p_instance *inst);
+
 ret_t p2p_udp_send_to(struct p2p_instance *inst, const struct sockaddr_in *addr,
                       const void *data, int len);
 ret_t p2p_udp_send_to_sock(struct p2p_instance *inst, int sock_idx,
                                     const struct sockaddr_in *addr,
                                     const void *data, int len);
 
+/* 直接发出，不经损伤模拟（p2p_netem 释放到期包时使用） */
+ret_t p2p_udp_send_raw(struct p2p_instance *inst, int sock_idx,
+                       const struct sockaddr_in *addr,
+                       const void *data, int len);
+
+/*
+ * IPv6 双栈（cfg.enable_ipv6）
+ *
+ * 内部结构统一使用 struct sockaddr_in，IPv6 对端以 240.0.0.0/4（保留地址段）中的别名表示：
+ *   别名 IP = 240.0.0.0 | 别名表索引，端口即原端口；别名表进程内共享，只增不删
+ * 仅在边界处与真实 IPv6 地址互转：套接字收发（p2p_udp_*）、候选序列化（pack/unpack_candidate）、ICE SDP
+ * + 发往别名地址的包经 inst->sock6 发出，忽略 sock_idx
+ */
+#define P2P_UDP_V6_ALIAS_MAX    256
+
+ret_t p2p_udp_open6(struct p2p_instance *inst, uint16_t port);
+bool p2p_udp_v6_is_alias(const struct sockaddr_in *addr);
+bool p2p_udp_v6_alias(const uint8_t ip6[16], uint16_t port, struct sockaddr_in *out);   // false = 别名表已满
+bool p2p_udp_v6_real(const struct sockaddr_in *alias, uint8_t ip6[16]);
+
 ret_t p2p_udp_recv_from(struct p2p_instance *inst, struct sockaddr_in *from,
                                 void *buf, int buf_size, int *recv_sock_idx);
 
+/*
+ * 批量接收槽位（每实例一组，由 p2p_udp_recv_batch 按需分配，p2p_udp_close_all 释放）
+ */
+#ifndef P2P_FIXED_MEM
+#define P2P_UDP_BATCH_SLOTS     32              // 单次批量接收的最大槽位数
+#else
+#define P2P_UDP_BATCH_SLOTS     8               // 固定内存构建：一组槽位不超过 16KB 级
+#endif
+#define P2P_UDP_BATCH_BUDGET    256             // 每次 p2p_update 默认最多处理的数据包数
+#define P2P_UDP_TIME_BUDGET_US  2000            // 每次 p2p_update 接收阶段的默认时间预算（cfg.recv_budget_us）
+
+typedef struct p2p_udp_slot {
+    struct sockaddr_in  from;                   // 来源地址
+    int                 len;                    // 数据长度
+    int                 sock_idx;               // 接收的套接字索引
+    uint64_t            rx_us;                  // 接收时间（P_tick_us 时基；Linux 取内核 SO_TIMESTAMPNS，否则为读出时刻）
+    uint8_t             ecn;                    // 接收包的 ECN 码点 P2P_UDP_ECN_*（不可读时为 0）
+    uint8_t             buf[P2P_MTU_MAX + 16];  // 数据缓冲区
+} p2p_udp_slot_t;
+
+/*
+ * 批量接收：轮转地从各套接字读取数据包，填充 inst->rx_slots
+ * + 每个套接字先至多读取均分份额，余量再分给仍有数据的套接字，起点每次调用后移一位
+ * + Linux 使用 recvmmsg 一次系统调用读取多个包，其他平台回退为 recvfrom 循环
+ * + Windows 开启 cfg.udp_iocp 时先取完成端口中已完成的接收
+ *
+ * @param max   本次最多读取的包数量（不超过 P2P_UDP_BATCH_SLOTS）
+ * @return      >0 读取到的包数量；E_BUSY 无数据；其他负值为错误
+ */
+ret_t p2p_udp_recv_batch(struct p2p_instance *inst, int max);
+
+/*
+ * 发送合并：p2p_udp_tx_begin/p2p_udp_tx_end 之间经 p2p_udp_send_msgs 发出的数据包
+ * 先拷贝到发送合并队列，end 时统一 flush（Linux 使用 sendmmsg，同目标等长连续包使用 UDP GSO）
+ * + begin/end 可嵌套，最外层 end 时才真正 flush；队列满时自动 flush
+ * + 队列按线程区分：会话分片线程使用各自的队列，其余（主工作线程、手动 update）使用 inst->txq
+ * + 加密线程池开启时，AEAD 记录以明文入队并附带封装任务（p2p_udp_send_sealed），flush 时整批并行封装后发出
+ */
+typedef struct p2p_udp_txq {
+    p2p_udp_slot_t     *slots;                  // 待发送的包（P2P_UDP_BATCH_SLOTS 项，按需分配）
+    int                 cnt;                    // 队列中待发送的包数
+    int                 batching;               // 发送合并嵌套深度（>0 时 p2p_udp_send_msgs 入队）
+    p2p_aead_job_t     *seals;                  // 待封装的记录（P2P_UDP_BATCH_SLOTS 项，指向 slots 内的明文，按需分配）
+    int                 seal_cnt;
+} p2p_udp_txq_t;
+
+void p2p_udp_tx_begin(struct p2p_instance *inst);
+void p2p_udp_tx_end(struct p2p_instance *inst);
+void p2p_udp_tx_flush(struct p2p_instance *inst);
+
+/*
+ * 通过默认套接字发送分段消息（支持发送合并）
+ * @return 发送（或入队）的字节数，<0 为错误
+ */
+ret_t p2p_udp_send_msgs(struct p2p_instance *inst, const struct sockaddr_in *addr,
+                        const sock_msg_t *msgs, int num);
+
+/*
+ * 延后封装发送：msgs 合并后 [seal_off, seal_off + seal->len) 为待加密明文，其后预留 tag 空间；
+ * 入队时复制 seal（in / out 改指向队列中的副本），flush 前由加密线程池封装
+ * @return 入队的字节数；E_NONE_CONTEXT 不可延后（未开启线程池、非发送合并、IPv6 或损伤模拟），未发送，调用方就地封装后走常规发送
+ */
+ret_t p2p_udp_send_sealed(struct p2p_instance *inst, const struct sockaddr_in *addr,
+                          const sock_msg_t *msgs, int num, const p2p_aead_job_t *seal, int seal_off);
+
 #endif /* P2P_UDP_H */
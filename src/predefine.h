@@ -16,4 +16,53 @@
 
 #include <stdc.h>
 
+/*
+ * 日志编译期裁剪与热路径守卫
+ *
+ * P2P_LOG_MAX：编译期保留的最详细等级（默认 P2P_LOG_LEVEL_VERBOSE，即不裁剪）；
+ *   release 构建可定义为 P2P_LOG_LEVEL_INFO 等，以 P2P_LOG_ON 守卫的更详细日志连同参数求值一并被编译器消除
+ * P2P_LOG_ON(lv)：收发包等每包路径上的日志以此守卫（lv 为 P2P_LOG_LEVEL_ 后缀，如 VERBOSE）。
+ *   先做一次预测为不输出的等级判断，通过后才执行 LA_F 查表及 inet_ntoa 等参数求值
+ */
+#ifndef P2P_LOG_MAX
+#define P2P_LOG_MAX             P2P_LOG_LEVEL_VERBOSE
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define P2P_UNLIKELY(x)         __builtin_expect(!!(x), 0)
+#else
+#define P2P_UNLIKELY(x)         (x)
+#endif
+
+#define P2P_LOG_ON(lv)          (P2P_LOG_LEVEL_##lv <= P2P_LOG_MAX && P2P_UNLIKELY(p2p_log_level >= P2P_LOG_LEVEL_##lv))
+
+/*
+ * 延迟直方图埋点（见 p2p_instrument.h）
+ *
+ * P2P_HIST_NOW()：采样起点时间戳（微秒）；P2P_HIST(id, us)：记录一个样本。
+ *   未定义 P2P_METRICS 时 P2P_HIST_NOW() 为常量 0、P2P_HIST 只引用参数（须无副作用），埋点连同时钟读取一并消除
+ */
+#ifdef P2P_METRICS
+void p2p_hist_record(int id, uint64_t us);
+#define P2P_HIST_NOW()          P_tick_us()
+#define P2P_HIST(id, us)        p2p_hist_record((id), (us))
+#else
+#define P2P_HIST_NOW()          ((uint64_t)0)
+#define P2P_HIST(id, us)        ((void)(us))
+#endif
+
+/*
+ * 模拟构建（P2P_SIM，见 p2p_sim.h）：库内时钟与休眠改用虚拟时钟，只由模拟驱动推进
+ */
+#ifdef P2P_SIM
+uint64_t p2p_sim_tick_us(void);
+void     p2p_sim_advance(uint64_t us);
+#undef  P_tick_ms
+#undef  P_tick_us
+#undef  P_usleep
+#define P_tick_ms()             (p2p_sim_tick_us() / 1000)
+#define P_tick_us()             p2p_sim_tick_us()
+#define P_usleep(us)            p2p_sim_advance((uint64_t)(us))
+#endif
+
 #endif //P2P_PREDEFINE_H
@@ -3,9 +3,14 @@
  *
  * 依赖：wslay（third_party/wslay），无其他外部依赖。
  * SHA-1 和 Base64 编码在本文件内自包含实现（仅用于 WS 握手）。
+ * permessage-deflate（RFC 7692）编解码见 ws_deflate.c；帧解析与分片重组由 wslay 增量完成，
+ * 本文件不另设接收缓冲（只暂存握手响应之后已收到的少量字节）。
  */
 
 #include "ws_client.h"
+#include "ws_deflate.h"
+#include "p2p_mem.h"     /* p2p_calloc / p2p_free */
+#include "p2p_dns.h"     /* p2p_dns_resolve */
 #include "predefine.h"   /* stdc.h 已通过 predefine.h 引入，提供 sock_t / P_INVALID_SOCKET /
                         P_sock_close / P_sock_nonblock / P_sock_is_wouldblock 等 */
 
@@ -141,7 +146,6 @@ static void base64_encode_sha1(const uint8_t src[20], char dst[29]) {
  * 内部结构
  * ====================================================================== */
 
-#define WS_RECV_BUF_SIZE 65536
 #define WS_SEND_BUF_SIZE 65536
 #define WS_HTTP_BUF_SIZE 4096
 #define WS_WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
@@ -159,10 +163,15 @@ struct ws_client {
     /* wslay */
     wslay_event_context_ptr  ws_ctx;
 
-    /* 收发缓冲 */
-    uint8_t                  recv_buf[WS_RECV_BUF_SIZE];
-    size_t                   recv_buf_pos;
-    size_t                   recv_buf_len;
+    /* 握手响应之后已收到的帧数据（按实际长度分配，交给 wslay 读完即释放） */
+    uint8_t                 *pending;
+    size_t                   pending_pos;
+    size_t                   pending_len;
+    int                      eof;            /* 对端已关闭 TCP（recv 返回 0） */
+
+    /* permessage-deflate：已协商时文本 / 二进制消息按需压缩发送，RSV1 消息解压后交付 */
+    int                      deflate;
+    int                      deflate_wbits;  /* 本端压缩窗口（服务器响应的 client_max_window_bits） */
 
     /* HTTP 握手缓冲（发送请求 + 接收响应） */
     char                     http_buf[WS_HTTP_BUF_SIZE];
@@ -185,12 +194,12 @@ static ssize_t wslay_recv_cb(wslay_event_context_ptr ctx,
     (void)ctx; (void)flags;
     ws_client_t *c = (ws_client_t *)user_data;
 
-    if (c->recv_buf_len > 0) {
-        /* 从内部缓冲读取已收到的字节 */
-        size_t copy = c->recv_buf_len < len ? c->recv_buf_len : len;
-        memcpy(buf, c->recv_buf + c->recv_buf_pos, copy);
-        c->recv_buf_pos += copy;
-        c->recv_buf_len -= copy;
+    if (c->pending) {
+        /* 先交出握手时随响应一起收到的字节 */
+        size_t copy = c->pending_len - c->pending_pos < len ? c->pending_len - c->pending_pos : len;
+        memcpy(buf, c->pending + c->pending_pos, copy);
+        c->pending_pos += copy;
+        if (c->pending_pos == c->pending_len) { p2p_free(c->pending); c->pending = NULL; }
         return (ssize_t)copy;
     }
 
@@ -206,6 +215,7 @@ static ssize_t wslay_recv_cb(wslay_event_context_ptr ctx,
         return -1;
     }
     if (n == 0) {
+        c->eof = 1;
         wslay_event_set_error(ctx, WSLAY_ERR_CALLBACK_FAILURE);
         return -1;
     }
@@ -263,7 +273,25 @@ static void wslay_on_msg_recv_cb(wslay_event_context_ptr ctx,
         case WSLAY_PONG:         type = WS_MSG_PONG;   break;
         default: return;
     }
-    c->cfg.on_message(c, type, arg->msg, arg->msg_length, c->cfg.user_data);
+
+    /* RSV1：压缩消息（wslay 只对已协商的扩展放行 RSV1，控制帧不会置位） */
+    if (!wslay_get_rsv1(arg->rsv)) {
+        c->cfg.on_message(c, type, arg->msg, arg->msg_length, c->cfg.user_data);
+        return;
+    }
+    uint8_t *out = NULL;
+    int n = -2;
+    for (size_t cap = arg->msg_length * 4 + 256; n == -2; cap *= 2) {
+        if (cap > WS_INFLATE_MAX_LEN) cap = WS_INFLATE_MAX_LEN;
+        uint8_t *p = (uint8_t *)p2p_realloc(out, cap);
+        if (!p) break;
+        out = p;
+        n = ws_inflate(arg->msg, arg->msg_length, out, cap);
+        if (cap == WS_INFLATE_MAX_LEN) break;
+    }
+    if (n >= 0) c->cfg.on_message(c, type, out, (size_t)n, c->cfg.user_data);
+    else wslay_event_queue_close(ctx, WSLAY_CODE_INVALID_FRAME_PAYLOAD_DATA, NULL, 0);
+    p2p_free(out);
 }
 
 /* =========================================================================
@@ -271,7 +299,7 @@ static void wslay_on_msg_recv_cb(wslay_event_context_ptr ctx,
  * ====================================================================== */
 
 ws_client_t *ws_client_create(const ws_client_cfg_t *cfg) {
-    ws_client_t *c = (ws_client_t *)calloc(1, sizeof(*c));
+    ws_client_t *c = (ws_client_t *)p2p_calloc(1, sizeof(*c));
     if (!c) return NULL;
     c->state = WS_CLIENT_CLOSED;
     c->fd    = P_INVALID_SOCKET;
@@ -283,13 +311,18 @@ void ws_client_destroy(ws_client_t *c) {
     if (!c) return;
     if (c->ws_ctx) { wslay_event_context_free(c->ws_ctx); c->ws_ctx = NULL; }
     if (c->fd != P_INVALID_SOCKET) { P_sock_close(c->fd); c->fd = P_INVALID_SOCKET; }
-    free(c);
+    p2p_free(c->pending);
+    p2p_free(c);
 }
 
 ws_client_state_t ws_client_state(const ws_client_t *c) {
     return c ? c->state : WS_CLIENT_CLOSED;
 }
 
+int ws_client_deflate(const ws_client_t *c) {
+    return c ? c->deflate : 0;
+}
+
 /* =========================================================================
  * 连接发起
  * ====================================================================== */
@@ -303,24 +336,9 @@ int ws_client_connect(ws_client_t *c,
     c->port = port;
     strncpy(c->path, path ? path : "/", sizeof(c->path) - 1);
 
-    /* 解析地址 */
+    /* 解析地址（p2p_dns_resolve 非阻塞：解析中同样返回 -1，调用方稍后重试） */
     struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port   = htons(port);
-
-    if (inet_aton(host, &addr.sin_addr) == 0) {
-        /* 尝试 getaddrinfo 解析 */
-        struct addrinfo hints, *res;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family   = AF_INET;
-        hints.ai_socktype = SOCK_STREAM;
-        char port_str[8];
-        snprintf(port_str, sizeof(port_str), "%u", port);
-        if (getaddrinfo(host, port_str, &hints, &res) != 0) return -1;
-        addr = *(struct sockaddr_in *)res->ai_addr;
-        freeaddrinfo(res);
-    }
+    if (p2p_dns_resolve(host, port, &addr) <= 0) return -1;
 
     c->fd = socket(AF_INET, SOCK_STREAM, 0);
     if (c->fd == P_INVALID_SOCKET) return -1;
@@ -375,7 +393,8 @@ int ws_client_connect(ws_client_t *c,
         base64_encode_sha1(digest, c->accept_key);
     }
 
-    /* 构造 HTTP Upgrade 请求 */
+    /* 构造 HTTP Upgrade 请求
+     * permessage-deflate 要求服务器不做上下文接管：每条消息独立解压，连接上不保留 32KB 滑动窗口 */
     int n = snprintf(c->http_buf, sizeof(c->http_buf),
         "GET %s HTTP/1.1\r\n"
         "Host: %s:%u\r\n"
@@ -384,8 +403,11 @@ int ws_client_connect(ws_client_t *c,
         "Sec-WebSocket-Key: %s\r\n"
         "Sec-WebSocket-Version: 13\r\n"
         "%s"
+        "%s"
         "\r\n",
         c->path, c->host, c->port, ws_key_b64,
+        c->cfg.disable_deflate ? "" : "Sec-WebSocket-Extensions: permessage-deflate; "
+                                      "client_no_context_takeover; server_no_context_takeover\r\n",
         c->cfg.extra_headers ? c->cfg.extra_headers : "");
 
     c->http_send_len = (size_t)n;
@@ -427,6 +449,49 @@ static void ws_client_finish_connect(ws_client_t *c) {
     c->state = WS_CLIENT_HANDSHAKING;
 }
 
+/*
+ * 解析响应中的 Sec-WebSocket-Extensions：返回 1 已协商 permessage-deflate，0 未协商，
+ * -1 响应不合法（未提议的扩展、未知参数或缺少所要求的 server_no_context_takeover，RFC 7692 §5 要求断开）
+ */
+static int ws_client_parse_deflate(ws_client_t *c) {
+    const char *h = strstr(c->http_buf, "Sec-WebSocket-Extensions:");
+    if (!h) return 0;
+    if (c->cfg.disable_deflate) return -1;
+    h += 25;
+    const char *end = strstr(h, "\r\n");
+    if (!end || end - h >= 256) return -1;
+
+    char v[256];
+    memcpy(v, h, (size_t)(end - h));
+    v[end - h] = '\0';
+    if (strchr(v, ',')) return -1;                  /* 只提议了一个扩展 */
+
+    int first = 1, no_ctx = 0;
+    c->deflate_wbits = 15;
+    for (char *tok = v, *next; tok; tok = next, first = 0) {
+        next = strchr(tok, ';');
+        if (next) *next++ = '\0';
+        while (*tok == ' ' || *tok == '\t') tok++;
+        size_t len = strlen(tok);
+        while (len && (tok[len - 1] == ' ' || tok[len - 1] == '\t')) tok[--len] = '\0';
+
+        if (first) { if (strcmp(tok, "permessage-deflate")) return -1; continue; }
+        if (!strcmp(tok, "server_no_context_takeover")) no_ctx = 1;
+        else if (!strcmp(tok, "client_no_context_takeover")) {}
+        else if (!strncmp(tok, "server_max_window_bits=", 23)) {
+            int b = atoi(tok + 23);
+            if (b < 8 || b > 15) return -1;
+        }
+        else if (!strncmp(tok, "client_max_window_bits=", 23)) {
+            int b = atoi(tok + 23);
+            if (b < 8 || b > 15) return -1;
+            c->deflate_wbits = b;
+        }
+        else return -1;
+    }
+    return no_ctx ? 1 : -1;
+}
+
 static void ws_client_do_handshake(ws_client_t *c) {
     /* 发送 HTTP 请求 */
     if (!c->http_sent) {
@@ -486,6 +551,14 @@ static void ws_client_do_handshake(ws_client_t *c) {
         }
     }
 
+    int deflate = ws_client_parse_deflate(c);
+    if (deflate < 0) {
+        c->state = WS_CLIENT_ERROR;
+        P_sock_close(c->fd); c->fd = P_INVALID_SOCKET;
+        if (c->cfg.on_close) c->cfg.on_close(c, 0, "extension negotiation failed", c->cfg.user_data);
+        return;
+    }
+
     /* 握手成功，初始化 wslay 客户端上下文 */
     static const struct wslay_event_callbacks cbs = {
         wslay_recv_cb,
@@ -498,6 +571,8 @@ static void ws_client_do_handshake(ws_client_t *c) {
         c->state = WS_CLIENT_ERROR;
         return;
     }
+    c->deflate = deflate;
+    if (deflate) wslay_event_config_set_allowed_rsv_bits(c->ws_ctx, WSLAY_RSV1_BIT);
 
     c->state = WS_CLIENT_OPEN;
 
@@ -506,10 +581,10 @@ static void ws_client_do_handshake(ws_client_t *c) {
     if (body_start) {
         body_start += 4;
         size_t leftover = c->http_buf_len - (size_t)(body_start - c->http_buf);
-        if (leftover > 0 && leftover <= WS_RECV_BUF_SIZE) {
-            memcpy(c->recv_buf, body_start, leftover);
-            c->recv_buf_pos = 0;
-            c->recv_buf_len = leftover;
+        if (leftover > 0 && (c->pending = (uint8_t *)p2p_malloc(leftover)) != NULL) {
+            memcpy(c->pending, body_start, leftover);
+            c->pending_pos = 0;
+            c->pending_len = leftover;
         }
     }
     c->http_buf_len = 0;
@@ -520,24 +595,16 @@ static void ws_client_do_handshake(ws_client_t *c) {
 static void ws_client_do_ws(ws_client_t *c) {
     if (!c->ws_ctx) return;
 
-    /* 读取新到达的 socket 数据到 recv_buf */
-    if (c->recv_buf_len == 0) {
-        c->recv_buf_pos = 0;
-        ssize_t n = recv(c->fd, (char*)c->recv_buf, WS_RECV_BUF_SIZE, 0);
-        if (n > 0) {
-            c->recv_buf_len = (size_t)n;
-        } else if (n == 0) {
-            /* 对端关闭 */
-            c->state = WS_CLIENT_CLOSED;
-            if (c->cfg.on_close) c->cfg.on_close(c, 1001, "eof", c->cfg.user_data);
-            return;
-        }
-        /* n < 0 且 wouldblock：无新数据，忽略 */
-    }
-
+    /* wslay 经 recv 回调直接从 socket 读入其帧解析缓冲，读到 wouldblock 为止 */
     if (wslay_event_want_read(c->ws_ctx)) {
         wslay_event_recv(c->ws_ctx);
     }
+    if (c->eof) {
+        /* 对端关闭 */
+        c->state = WS_CLIENT_CLOSED;
+        if (c->cfg.on_close) c->cfg.on_close(c, 1001, "eof", c->cfg.user_data);
+        return;
+    }
     if (wslay_event_want_write(c->ws_ctx)) {
         wslay_event_send(c->ws_ctx);
     }
@@ -567,23 +634,35 @@ void ws_client_update(ws_client_t *c) {
  * 发送
  * ====================================================================== */
 
-int ws_client_send_text(ws_client_t *c, const char *text) {
+/* 入队一条数据消息：已协商 permessage-deflate 且压缩后更短时以 RSV1 压缩消息发送（wslay 入队时复制负载） */
+static int ws_client_queue(ws_client_t *c, uint8_t opcode, const uint8_t *data, size_t len) {
     if (!c || c->state != WS_CLIENT_OPEN || !c->ws_ctx) return -1;
     struct wslay_event_msg msg;
-    msg.opcode     = WSLAY_TEXT_FRAME;
-    msg.msg        = (const uint8_t *)text;
-    msg.msg_length = strlen(text);
-    return wslay_event_queue_msg(c->ws_ctx, &msg) == 0 ? 0 : -1;
+    msg.opcode     = opcode;
+    msg.msg        = data;
+    msg.msg_length = len;
+
+    uint8_t *z = NULL;
+    int zlen = -1;
+    if (c->deflate && len >= WS_DEFLATE_MIN_LEN && len <= WS_INFLATE_MAX_LEN
+        && (z = (uint8_t *)p2p_malloc(len)) != NULL
+        && (zlen = ws_deflate(data, len, z, len, c->deflate_wbits)) > 0) {
+        msg.msg        = z;
+        msg.msg_length = (size_t)zlen;
+    }
+    int r = wslay_event_queue_msg_ex(c->ws_ctx, &msg, zlen > 0 ? WSLAY_RSV1_BIT : WSLAY_RSV_NONE);
+    p2p_free(z);
+    return r == 0 ? 0 : -1;
+}
+
+int ws_client_send_text(ws_client_t *c, const char *text) {
+    if (!text) return -1;
+    return ws_client_queue(c, WSLAY_TEXT_FRAME, (const uint8_t *)text, strlen(text));
 }
 
 int ws_client_send_binary(ws_client_t *c,
                                const uint8_t *data, size_t len) {
-    if (!c || c->state != WS_CLIENT_OPEN || !c->ws_ctx) return -1;
-    struct wslay_event_msg msg;
-    msg.opcode     = WSLAY_BINARY_FRAME;
-    msg.msg        = data;
-    msg.msg_length = len;
-    return wslay_event_queue_msg(c->ws_ctx, &msg) == 0 ? 0 : -1;
+    return ws_client_queue(c, WSLAY_BINARY_FRAME, data, len);
 }
 
 #endif /* WITH_WSLAY */
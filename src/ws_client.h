@@ -8,6 +8,8 @@
  *   - 非阻塞 TCP + wslay 帧层，集成在应用主循环中调用
  *   - 支持 Text / Binary / Ping / Close 帧
  *   - 回调驱动：on_open / on_message / on_close
+ *   - permessage-deflate（RFC 7692）：握手时提议，协商成功后按需压缩收发
+ *   - 帧由 wslay 增量解析与分片重组，连接不预留整块接收缓冲
  *
  * 典型用法：
  *   ws_client_t *c = ws_client_create(&cfg);
@@ -90,6 +92,9 @@ typedef struct {
 
     /* 额外 HTTP 头（如 "Authorization: Bearer xxx\r\n"），可为 NULL */
     const char             *extra_headers;
+
+    /* 非 0：握手时不提议 permessage-deflate（默认提议，服务器不支持时自动不压缩） */
+    int                     disable_deflate;
 } ws_client_cfg_t;
 
 /* -------------------------------------------------------------------------
@@ -108,7 +113,7 @@ void ws_client_destroy(ws_client_t *c);
 
 /*
  * 发起非阻塞连接。
- * host  — 主机名或 IP（仅支持 IPv4 和 IPv6 数字地址，不做 DNS 解析）
+ * host  — 主机名或 IPv4 地址（主机名经 p2p_dns_resolve 异步解析，尚未就绪时返回 -1，稍后重试）
  * port  — 端口
  * path  — WebSocket 路径，如 "/signal"
  * 返回 0 成功（连接异步进行），-1 失败。
@@ -150,6 +155,9 @@ int ws_client_send_binary(ws_client_t *c,
  * ---------------------------------------------------------------------- */
 ws_client_state_t ws_client_state(const ws_client_t *c);
 
+/* 是否已协商 permessage-deflate（握手完成后有效）*/
+int ws_client_deflate(const ws_client_t *c);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,341 @@
+/*
+ * ws_deflate.c — 原始 DEFLATE（RFC 1951）编解码，格式约定见 ws_deflate.h
+ *
+ * 解压按 RFC 1951 §3.2 的规范 Huffman 码逐位解码（码长计数 + 符号表），无查找表，代码短小，
+ * 信令消息通常只有数百字节到数 KB，逐位解码的开销可以忽略。
+ */
+
+#include "ws_deflate.h"
+
+#include <string.h>
+
+/* 长度 / 距离码的基值与扩展位数（RFC 1951 §3.2.5） */
+static const uint16_t k_len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t  k_len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t k_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t  k_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+/* =========================================================================
+ * 解压
+ * ====================================================================== */
+
+#define INF_MAX_BITS    15
+#define INF_MAX_LCODES  286
+#define INF_MAX_DCODES  30
+
+typedef struct {
+    const uint8_t  *in;
+    size_t          in_len;
+    size_t          pos;            /* 输入读取位置（in_len 之后为补回的 00 00 FF FF） */
+    uint32_t        bitbuf;
+    int             bitcnt;
+    int             err;            /* 输入耗尽 */
+    uint8_t        *out;
+    size_t          out_cap;
+    size_t          out_len;
+} inf_state_t;
+
+/* 规范 Huffman 码：count[len] 为各码长的码数，symbol 按码值顺序排列 */
+typedef struct {
+    uint16_t        count[INF_MAX_BITS + 1];
+    uint16_t        symbol[288];
+} inf_huff_t;
+
+static const uint8_t k_sync_tail[4] = { 0x00, 0x00, 0xFF, 0xFF };
+
+static int inf_byte(inf_state_t *s) {
+    size_t p = s->pos;
+    if (p < s->in_len) { s->pos++; return s->in[p]; }
+    if (p < s->in_len + 4) { s->pos++; return k_sync_tail[p - s->in_len]; }
+    s->err = 1;
+    return 0;
+}
+
+/* 按 LSB 优先读取 need 位（每次只补足所需字节，任何时刻缓冲中不足 8 位） */
+static uint32_t inf_bits(inf_state_t *s, int need) {
+    uint32_t v = s->bitbuf;
+    while (s->bitcnt < need) {
+        v |= (uint32_t)inf_byte(s) << s->bitcnt;
+        s->bitcnt += 8;
+    }
+    s->bitbuf = need < 32 ? v >> need : 0;
+    s->bitcnt -= need;
+    return v & ((1u << need) - 1);
+}
+
+static int inf_decode(inf_state_t *s, const inf_huff_t *h) {
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len <= INF_MAX_BITS; len++) {
+        code |= (int)inf_bits(s, 1);
+        int count = h->count[len];
+        if (code - count < first) return h->symbol[index + (code - first)];
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -1;      /* 码长超出或输入错误 */
+}
+
+/* 由码长构造规范码；返回 <0 超额（非法），0 完整，>0 不完整（只允许用于单个距离码等退化情形） */
+static int inf_build(inf_huff_t *h, const uint8_t *lens, int n) {
+    uint16_t offs[INF_MAX_BITS + 1];
+
+    memset(h->count, 0, sizeof(h->count));
+    for (int i = 0; i < n; i++) h->count[lens[i]]++;
+    if (h->count[0] == n) return 0;
+
+    int left = 1;
+    for (int len = 1; len <= INF_MAX_BITS; len++) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0) return left;
+    }
+
+    offs[1] = 0;
+    for (int len = 1; len < INF_MAX_BITS; len++) offs[len + 1] = (uint16_t)(offs[len] + h->count[len]);
+    for (int i = 0; i < n; i++) {
+        if (lens[i]) h->symbol[offs[lens[i]]++] = (uint16_t)i;
+    }
+    return left;
+}
+
+static int inf_stored(inf_state_t *s) {
+    s->bitbuf = 0;                                  /* 丢弃到字节边界 */
+    s->bitcnt = 0;
+    unsigned len  = (unsigned)inf_byte(s);
+    len |= (unsigned)inf_byte(s) << 8;
+    unsigned nlen = (unsigned)inf_byte(s);
+    nlen |= (unsigned)inf_byte(s) << 8;
+    if (s->err || len != (~nlen & 0xFFFFu)) return -1;
+    if (s->out_len + len > s->out_cap) return -2;
+    while (len--) s->out[s->out_len++] = (uint8_t)inf_byte(s);
+    return s->err ? -1 : 0;
+}
+
+static int inf_codes(inf_state_t *s, const inf_huff_t *lcode, const inf_huff_t *dcode) {
+    for (;;) {
+        int sym = inf_decode(s, lcode);
+        if (s->err || sym < 0) return -1;
+        if (sym < 256) {
+            if (s->out_len >= s->out_cap) return -2;
+            s->out[s->out_len++] = (uint8_t)sym;
+            continue;
+        }
+        if (sym == 256) return 0;
+
+        sym -= 257;
+        if (sym >= 29) return -1;
+        size_t len = k_len_base[sym] + inf_bits(s, k_len_extra[sym]);
+        int dsym = inf_decode(s, dcode);
+        if (dsym < 0 || dsym >= 30) return -1;
+        size_t dist = k_dist_base[dsym] + inf_bits(s, k_dist_extra[dsym]);
+        if (s->err || dist > s->out_len) return -1;
+        if (s->out_len + len > s->out_cap) return -2;
+
+        /* 逐字节复制：距离小于长度时源与目的重叠，按 LZ77 语义重复 */
+        uint8_t *d = s->out + s->out_len;
+        const uint8_t *p = d - dist;
+        for (size_t i = 0; i < len; i++) d[i] = p[i];
+        s->out_len += len;
+    }
+}
+
+static int inf_fixed(inf_state_t *s) {
+    inf_huff_t lcode, dcode;
+    uint8_t lens[288];
+    int i = 0;
+    for (; i < 144; i++) lens[i] = 8;
+    for (; i < 256; i++) lens[i] = 9;
+    for (; i < 280; i++) lens[i] = 7;
+    for (; i < 288; i++) lens[i] = 8;
+    inf_build(&lcode, lens, 288);
+    for (i = 0; i < 30; i++) lens[i] = 5;
+    inf_build(&dcode, lens, 30);
+    return inf_codes(s, &lcode, &dcode);
+}
+
+static int inf_dynamic(inf_state_t *s) {
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    inf_huff_t lcode, dcode;
+    uint8_t lens[INF_MAX_LCODES + INF_MAX_DCODES];
+
+    int nlen  = (int)inf_bits(s, 5) + 257;
+    int ndist = (int)inf_bits(s, 5) + 1;
+    int ncode = (int)inf_bits(s, 4) + 4;
+    if (s->err || nlen > INF_MAX_LCODES || ndist > INF_MAX_DCODES) return -1;
+
+    /* 码长的码长 */
+    int i = 0;
+    for (; i < ncode; i++) lens[order[i]] = (uint8_t)inf_bits(s, 3);
+    for (; i < 19; i++) lens[order[i]] = 0;
+    if (s->err || inf_build(&lcode, lens, 19) != 0) return -1;
+
+    /* 字面量 / 长度码与距离码的码长（16 重复前值，17 / 18 重复 0） */
+    for (i = 0; i < nlen + ndist; ) {
+        int sym = inf_decode(s, &lcode);
+        if (s->err || sym < 0) return -1;
+        if (sym < 16) { lens[i++] = (uint8_t)sym; continue; }
+
+        uint8_t v = 0;
+        int rep;
+        if (sym == 16) {
+            if (i == 0) return -1;
+            v = lens[i - 1];
+            rep = 3 + (int)inf_bits(s, 2);
+        }
+        else if (sym == 17) rep = 3 + (int)inf_bits(s, 3);
+        else rep = 11 + (int)inf_bits(s, 7);
+        if (i + rep > nlen + ndist) return -1;
+        while (rep--) lens[i++] = v;
+    }
+    if (lens[256] == 0) return -1;                  /* 必须有块结束码 */
+
+    int r = inf_build(&lcode, lens, nlen);
+    if (r < 0 || (r > 0 && nlen - lcode.count[0] != 1)) return -1;
+    r = inf_build(&dcode, lens + nlen, ndist);
+    if (r < 0 || (r > 0 && ndist - dcode.count[0] != 1)) return -1;
+
+    return inf_codes(s, &lcode, &dcode);
+}
+
+int ws_inflate(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_cap) {
+
+    inf_state_t s;
+    memset(&s, 0, sizeof(s));
+    s.in = in;
+    s.in_len = in_len;
+    s.out = out;
+    s.out_cap = out_cap;
+
+    /* 发送方按 SYNC_FLUSH 切分消息，最后一块为补回尾部构成的空存储块，读到输入末尾即结束 */
+    int last;
+    do {
+        last = (int)inf_bits(&s, 1);
+        int type = (int)inf_bits(&s, 2);
+        if (s.err) return -1;
+
+        int r = type == 0 ? inf_stored(&s)
+              : type == 1 ? inf_fixed(&s)
+              : type == 2 ? inf_dynamic(&s) : -1;
+        if (r) return r;
+    } while (!last && s.pos < in_len + 4);
+
+    return (int)s.out_len;
+}
+
+/* =========================================================================
+ * 压缩
+ * ====================================================================== */
+
+#define DEF_HASH_BITS   12
+#define DEF_MIN_MATCH   3
+#define DEF_MAX_MATCH   258
+
+typedef struct {
+    uint8_t        *out;
+    size_t          cap;
+    size_t          len;
+    uint32_t        bitbuf;
+    int             bitcnt;
+    int             full;           /* 输出缓冲不足 */
+} def_state_t;
+
+static void def_bits(def_state_t *s, uint32_t v, int n) {
+    s->bitbuf |= v << s->bitcnt;
+    s->bitcnt += n;
+    while (s->bitcnt >= 8) {
+        if (s->len < s->cap) s->out[s->len++] = (uint8_t)s->bitbuf;
+        else s->full = 1;
+        s->bitbuf >>= 8;
+        s->bitcnt -= 8;
+    }
+}
+
+/* Huffman 码按 MSB 优先存放，写入前位反转 */
+static void def_code(def_state_t *s, uint32_t code, int n) {
+    uint32_t r = 0;
+    for (int i = 0; i < n; i++) { r = (r << 1) | (code & 1); code >>= 1; }
+    def_bits(s, r, n);
+}
+
+/* 固定 Huffman 字面量 / 长度码（RFC 1951 §3.2.6） */
+static void def_sym(def_state_t *s, int sym) {
+    if (sym < 144)      def_code(s, 0x30u + (uint32_t)sym, 8);
+    else if (sym < 256) def_code(s, 0x190u + (uint32_t)(sym - 144), 9);
+    else if (sym < 280) def_code(s, (uint32_t)(sym - 256), 7);
+    else                def_code(s, 0xC0u + (uint32_t)(sym - 280), 8);
+}
+
+static void def_match(def_state_t *s, size_t len, size_t dist) {
+    int i = 28;
+    while (k_len_base[i] > len) i--;
+    def_sym(s, 257 + i);
+    def_bits(s, (uint32_t)(len - k_len_base[i]), k_len_extra[i]);
+
+    int d = 29;
+    while (k_dist_base[d] > dist) d--;
+    def_code(s, (uint32_t)d, 5);
+    def_bits(s, (uint32_t)(dist - k_dist_base[d]), k_dist_extra[d]);
+}
+
+static uint32_t def_hash(const uint8_t *p) {
+    uint32_t v = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+    return (v * 2654435761u) >> (32 - DEF_HASH_BITS);
+}
+
+int ws_deflate(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_cap, int window_bits) {
+
+    /* 哈希表记录各 3 字节前缀最近一次出现的位置 + 1（0 = 无） */
+    uint32_t head[1u << DEF_HASH_BITS];
+    memset(head, 0, sizeof(head));
+
+    if (window_bits < 8 || window_bits > 15) window_bits = 15;
+    size_t max_dist = (size_t)1 << window_bits;
+    if (out_cap > in_len) out_cap = in_len;         /* 不短于原文即放弃 */
+
+    def_state_t s;
+    memset(&s, 0, sizeof(s));
+    s.out = out;
+    s.cap = out_cap;
+
+    def_bits(&s, 0, 1);                             /* BFINAL = 0：消息以 SYNC_FLUSH 结束 */
+    def_bits(&s, 1, 2);                             /* BTYPE = 01 固定 Huffman */
+
+    size_t i = 0;
+    while (i < in_len && !s.full) {
+        size_t best = 0, dist = 0;
+        if (i + DEF_MIN_MATCH <= in_len) {
+            uint32_t h = def_hash(in + i);
+            uint32_t cand = head[h];
+            head[h] = (uint32_t)i + 1;
+            if (cand && i - (cand - 1) <= max_dist) {
+                const uint8_t *p = in + cand - 1, *q = in + i;
+                size_t lim = in_len - i < DEF_MAX_MATCH ? in_len - i : DEF_MAX_MATCH;
+                while (best < lim && p[best] == q[best]) best++;
+                dist = i - (cand - 1);
+            }
+        }
+        if (best < DEF_MIN_MATCH) {
+            def_sym(&s, in[i++]);
+            continue;
+        }
+        def_match(&s, best, dist);
+        for (size_t k = 1; k < best && i + k + DEF_MIN_MATCH <= in_len; k++)
+            head[def_hash(in + i + k)] = (uint32_t)(i + k) + 1;
+        i += best;
+    }
+
+    def_sym(&s, 256);                               /* 块结束 */
+    def_bits(&s, 0, 3);                             /* SYNC_FLUSH 空存储块的块头，其余 00 00 FF FF 省略 */
+    if (s.bitcnt) def_bits(&s, 0, 8 - s.bitcnt);
+    return s.full || s.len >= in_len ? -1 : (int)s.len;
+}
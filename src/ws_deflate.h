@@ -0,0 +1,42 @@
+/*
+ * ws_deflate — permessage-deflate（RFC 7692）使用的原始 DEFLATE（RFC 1951）编解码
+ *
+ * ws_client 与 p2p_server/ws_server 共用：零依赖，不分配内存（输出缓冲由调用方提供）。
+ *   - 解压：存储 / 固定 Huffman / 动态 Huffman 块，兼容浏览器与 zlib 的输出
+ *   - 压缩：固定 Huffman + 单哈希表贪心 LZ77，每条消息独立压缩（不使用上下文接管），
+ *           面向候选 / offer JSON 这类重复度高的短文本
+ *
+ * 消息负载为 DEFLATE 数据去掉 SYNC_FLUSH 尾部 00 00 FF FF（RFC 7692 §7.2.1），
+ * ws_inflate 内部补回尾部，ws_deflate 输出已去掉尾部。
+ */
+
+#ifndef WS_DEFLATE_H
+#define WS_DEFLATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WS_DEFLATE_MIN_LEN   64            /* 短于此长度的消息不压缩 */
+#define WS_INFLATE_MAX_LEN   (1u << 20)    /* 解压后消息长度上限（防压缩炸弹） */
+
+/*
+ * 压缩一条消息。window_bits（8..15）为对端允许的 LZ77 窗口（client/server_max_window_bits）。
+ * 返回压缩后长度；out_cap 不足或压缩后不短于原文时返回 -1（调用方改发未压缩消息）。
+ */
+int ws_deflate(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_cap, int window_bits);
+
+/*
+ * 解压一条消息（不使用上下文接管：回溯距离不超出本条消息）。
+ * 返回解压后长度；-1 数据错误；-2 out_cap 不足（调用方扩大缓冲后重试）。
+ */
+int ws_inflate(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WS_DEFLATE_H */
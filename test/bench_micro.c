@@ -0,0 +1,312 @@
+/*
+ * bench_micro.c - 逐包原语微基准（环形缓冲区、CRC32、HMAC-SHA1、STUN 构建 / 解析、包头与候选编解码）
+ *
+ * 每个原语 × 每个消息大小：
+ *   1. 预热后自适应确定迭代次数，使单轮耗时约 -t 毫秒
+ *   2. 重复 5 轮取最快一轮（排除调度与中断干扰），按每次调用折算 cycles / ns，并给出每字节 cycles
+ *
+ * 计时源：x86 为 TSC（rdtsc，恒定频率的参考周期），AArch64 为 cntvct_el0（按计数器频率折算为 ns），
+ * 其它平台为 clock_gettime 纳秒（此时 cycles 列等于 ns）。
+ *
+ * 输出：人读表格写入 stdout；-o 指定时另写 JSON Lines 供版本间比对，例如
+ *   {"bench":"crc32","size":1200,"iters":524288,"cycles":1734.2,"ns":578.1,"cpb":1.445}
+ *
+ * 用法: bench_micro [-f 名称子串] [-t 每轮毫秒=20] [-o 文件]
+ */
+
+#include "test_framework.h"
+#include "../src/p2p_internal.h"
+#include "../src/p2p_stream.h"
+#include "../src/p2p_crypto.h"
+#include "../src/p2p_stun.h"
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define BENCH_REPS              5
+#define BENCH_SIZES_MAX         8
+
+static const char *g_filter;
+static double      g_round_ms = 20;
+static FILE       *g_json;
+static double      g_ns_per_tick = 1;                       // 计时源每个刻度的纳秒数
+static volatile uint32_t g_sink;                            // 防止结果被优化掉
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return now_ns();
+#endif
+}
+
+/* 以 clock_gettime 标定计时源频率 */
+static void calibrate(void) {
+    uint64_t n0 = now_ns(), t0 = ticks();
+    while (now_ns() - n0 < 50000000ull) {}
+    uint64_t n1 = now_ns(), t1 = ticks();
+    if (t1 > t0) g_ns_per_tick = (double)(n1 - n0) / (double)(t1 - t0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 被测原语：fn(ctx, size, iters)，ctx 由 setup 准备
+
+typedef struct {
+    uint8_t                 buf[65536];
+    uint8_t                 out[65536];
+    ringbuf_t               ring;
+    p2p_hmac_sha1_ctx_t     hc;
+    int                     len;
+    p2p_local_candidate_entry_t  lc[8];
+    p2p_remote_candidate_entry_t rc[8];
+} bench_ctx_t;
+
+typedef void (*bench_fn)(bench_ctx_t *c, int size, uint64_t iters);
+
+static void b_ring(bench_ctx_t *c, int size, uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        ring_write(&c->ring, c->buf, size);
+        g_sink += (uint32_t)ring_read(&c->ring, c->out, size);
+    }
+}
+
+static void b_crc32(bench_ctx_t *c, int size, uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) g_sink += p2p_crc32(c->buf, size);
+}
+
+static void b_hmac(bench_ctx_t *c, int size, uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        p2p_hmac_sha1((const uint8_t*)"0123456789abcdef0123", 20, c->buf, size, c->out);
+        g_sink += c->out[0];
+    }
+}
+
+static void b_hmac_ctx(bench_ctx_t *c, int size, uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        p2p_hmac_sha1_compute(&c->hc, c->buf, size, c->out);
+        g_sink += c->out[0];
+    }
+}
+
+static void b_stun_build(bench_ctx_t *c, int size, uint64_t iters) {
+    (void)size;
+    uint8_t tsx[12] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+    for (uint64_t i = 0; i < iters; i++)
+        g_sink += (uint32_t)p2p_stun_build_binding_request(c->out, 512, tsx, NULL, NULL);
+}
+
+/* ICE 连通性检查：USERNAME + PRIORITY + 角色 + MESSAGE-INTEGRITY + FINGERPRINT */
+static void b_stun_build_ice(bench_ctx_t *c, int size, uint64_t iters) {
+    (void)size;
+    uint8_t tsx[12] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+    for (uint64_t i = 0; i < iters; i++)
+        g_sink += (uint32_t)p2p_stun_build_ice_check(c->out, 512, tsx, "abcd:efgh", &c->hc, 0x6e7f00ff, 1,
+                                                     0x1122334455667788ull, 1);
+}
+
+/* 解析：收包分流时对 ICE 检查请求做的属性扫描 */
+static void b_stun_parse(bench_ctx_t *c, int size, uint64_t iters) {
+    (void)size;
+    for (uint64_t i = 0; i < iters; i++) {
+        g_sink += p2p_stun_has_ice_attrs(c->buf, c->len);
+        g_sink += p2p_stun_has_attr(c->buf, c->len, STUN_ATTR_FINGERPRINT);
+    }
+}
+
+static void b_pkt_hdr(bench_ctx_t *c, int size, uint64_t iters) {
+    (void)size;
+    p2p_packet_hdr_t hdr;
+    for (uint64_t i = 0; i < iters; i++) {
+        p2p_pkt_hdr_encode(c->buf, P2P_PKT_DATA, 0, (uint16_t)i);
+        p2p_pkt_hdr_decode(c->buf, &hdr);
+        g_sink += hdr.seq;
+    }
+}
+
+/* size = 候选个数：一次 pack 全部 + 一次 unpack 全部 */
+static void b_cand(bench_ctx_t *c, int size, uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        int off = 0;
+        for (int k = 0; k < size; k++) off += pack_candidate(&c->lc[k], c->buf + off);
+        off = 0;
+        for (int k = 0; k < size; k++) off += unpack_candidate(&c->rc[k], c->buf + off);
+        g_sink += c->rc[size - 1].priority;
+    }
+}
+
+/*
+ * 路径选择：BENCH_SESSIONS 个会话轮流选路（共享一个实例），工作集超出 L1，
+ * 反映逐候选读取路径状态时的缓存开销；size = 每会话候选数
+ */
+#define BENCH_SESSIONS          256
+#define BENCH_CANDS             64
+
+static struct p2p_session *g_sess[BENCH_SESSIONS];
+
+static void path_sessions_setup(void) {
+    static struct p2p_instance inst;
+    if (g_sess[0]) return;
+    for (int k = 0; k < BENCH_SESSIONS; k++) {
+        struct p2p_session *s = (struct p2p_session*)calloc(1, sizeof(*s));
+        s->inst = &inst;
+        s->remote_cands = (p2p_remote_candidate_entry_t*)calloc(BENCH_CANDS, sizeof(*s->remote_cands));
+        s->remote_cand_cap = BENCH_CANDS;
+        for (int i = 0; i < BENCH_CANDS; i++) {
+            p2p_remote_candidate_entry_t *rc = &s->remote_cands[i];
+            rc->type = i % 8 == 7 ? P2P_CAND_RELAY : i % 4 == 1 ? P2P_CAND_HOST : P2P_CAND_SRFLX;
+            rc->addr.sin_family = AF_INET;
+            rc->addr.sin_addr.s_addr = htonl(0x0A000001u + (uint32_t)i);
+            rc->addr.sin_port = htons((uint16_t)(40000 + i));
+            path_stats_init(&rc->stats, rc->type == P2P_CAND_RELAY ? 3 : 0);
+            rc->stats.state = i % 3 ? PATH_STATE_ACTIVE : PATH_STATE_DEGRADED;
+            rc->stats.rtt_ms = 20 + (uint32_t)((k * 7 + i * 13) % 200);
+            rc->stats.rtt_variance = (uint32_t)(i % 20);
+            rc->stats.loss_rate = (float)((i * 5 + k) % 10) * 0.001f;
+            rc->stats.bandwidth_bps = i % 3 ? 0 : 1000000ull * (uint64_t)(i + 1);
+        }
+        g_sess[k] = s;
+    }
+}
+
+static void path_select(int strategy, int size, uint64_t iters) {
+    for (int k = 0; k < BENCH_SESSIONS; k++) {
+        path_manager_init(g_sess[k], (p2p_path_strategy_t)strategy);
+        g_sess[k]->remote_cand_cnt = size;
+        g_sess[k]->active_path = 0;
+    }
+    for (uint64_t i = 0; i < iters; i++)
+        g_sink += (uint32_t)path_manager_select_best_path(g_sess[i % BENCH_SESSIONS]);
+}
+
+static void b_path_perf(bench_ctx_t *c, int size, uint64_t iters) {
+    (void)c;
+    path_select(P2P_PATH_STRATEGY_PERFORMANCE_FIRST, size, iters);
+}
+
+static void b_path_hybrid(bench_ctx_t *c, int size, uint64_t iters) {
+    (void)c;
+    path_select(P2P_PATH_STRATEGY_HYBRID, size, iters);
+}
+
+typedef struct {
+    const char*             name;
+    bench_fn                fn;
+    int                     sizes[BENCH_SIZES_MAX];     // 0 结尾；候选编解码 / 路径选择为候选个数
+    bool                    per_byte;
+} bench_def_t;
+
+static const bench_def_t g_benches[] = {
+    { "ring_write_read",    b_ring,           { 64, 256, 1200, 16384, 0 }, true  },
+    { "crc32",              b_crc32,          { 64, 256, 1200, 16384, 0 }, true  },
+    { "hmac_sha1",          b_hmac,           { 64, 256, 1200, 16384, 0 }, true  },
+    { "hmac_sha1_ctx",      b_hmac_ctx,       { 64, 256, 1200, 16384, 0 }, true  },
+    { "stun_build",         b_stun_build,     { 0 },                       false },
+    { "stun_build_ice",     b_stun_build_ice, { 0 },                       false },
+    { "stun_parse",         b_stun_parse,     { 0 },                       false },
+    { "pkt_hdr_codec",      b_pkt_hdr,        { 4, 0 },                    false },
+    { "cand_pack_unpack",   b_cand,           { 1, 8, 0 },                 false },
+    { "path_select_perf",   b_path_perf,      { 4, 16, BENCH_CANDS, 0 },   false },
+    { "path_select_hybrid", b_path_hybrid,    { 4, 16, BENCH_CANDS, 0 },   false },
+};
+
+/* 固定报文的项（sizes[0] == 0）只跑一次，大小列为 setup 得出的报文长度 */
+static void run(const bench_def_t *b, bench_ctx_t *c) {
+    bool once = !b->sizes[0];
+    for (int si = 0; once || b->sizes[si]; si++) {
+        int size = once ? c->len : b->sizes[si];
+
+        // 自适应迭代次数：倍增至单轮耗时达到 g_round_ms
+        uint64_t iters = 1;
+        for (;;) {
+            uint64_t n0 = now_ns();
+            b->fn(c, size, iters);
+            if ((double)(now_ns() - n0) >= g_round_ms * 1e6 / 4 || iters >= (1ull << 40)) break;
+            iters *= 2;
+        }
+        iters *= 4;
+
+        uint64_t best = UINT64_MAX;
+        for (int r = 0; r < BENCH_REPS; r++) {
+            uint64_t t0 = ticks();
+            b->fn(c, size, iters);
+            uint64_t t = ticks() - t0;
+            if (t < best) best = t;
+        }
+
+        double cyc = (double)best / (double)iters;
+        double ns = cyc * g_ns_per_tick;
+        double cpb = b->per_byte ? cyc / size : 0;
+        printf("  %-18s %6d  %12.1f cyc  %10.1f ns", b->name, size, cyc, ns);
+        if (b->per_byte) printf("  %7.3f cyc/B  %8.1f MB/s", cpb, ns > 0 ? size * 1e3 / ns : 0);
+        printf("\n");
+        if (g_json) {
+            fprintf(g_json, "{\"bench\":\"%s\",\"size\":%d,\"iters\":%llu,\"cycles\":%.1f,\"ns\":%.1f",
+                    b->name, size, (unsigned long long)iters, cyc, ns);
+            if (b->per_byte) fprintf(g_json, ",\"cpb\":%.3f", cpb);
+            fprintf(g_json, "}\n");
+        }
+        if (once) break;
+    }
+}
+
+static void setup(bench_ctx_t *c, const bench_def_t *b) {
+    for (int i = 0; i < (int)sizeof(c->buf); i++) c->buf[i] = (uint8_t)(i * 131 + 7);
+    uint8_t tsx[12] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+    if (b->fn == b_path_perf || b->fn == b_path_hybrid) path_sessions_setup();
+    if (b->fn == b_stun_build) c->len = p2p_stun_build_binding_request(c->out, 512, tsx, NULL, NULL);
+    else if (b->fn == b_stun_build_ice || b->fn == b_stun_parse)
+        c->len = p2p_stun_build_ice_check(c->buf, 512, tsx, "abcd:efgh", &c->hc, 0x6e7f00ff, 1, 0x1122334455667788ull, 1);
+    for (int k = 0; k < 8; k++) {
+        memset(&c->lc[k], 0, sizeof(c->lc[k]));
+        c->lc[k].type = P2P_CAND_HOST;
+        c->lc[k].addr.sin_family = AF_INET;
+        c->lc[k].addr.sin_addr.s_addr = htonl(0xC0A80001u + (uint32_t)k);
+        c->lc[k].addr.sin_port = htons((uint16_t)(40000 + k));
+        c->lc[k].priority = 0x7e0000ffu - (uint32_t)k;
+    }
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "-f")) g_filter = argv[i + 1];
+        else if (!strcmp(argv[i], "-t")) g_round_ms = atof(argv[i + 1]);
+        else if (!strcmp(argv[i], "-o")) {
+            if (!(g_json = fopen(argv[i + 1], "w"))) { perror(argv[i + 1]); return 2; }
+        }
+        else { fprintf(stderr, "usage: %s [-f filter] [-t round_ms] [-o file]\n", argv[0]); return 2; }
+    }
+    if (g_round_ms <= 0) g_round_ms = 1;
+
+    bench_ctx_t *c = (bench_ctx_t*)calloc(1, sizeof(bench_ctx_t));
+    if (!c || ring_init(&c->ring, 1 << 18, 1 << 18) != E_NONE) return 1;
+    p2p_hmac_sha1_init(&c->hc, (const uint8_t*)"0123456789abcdef0123", 20);
+
+    calibrate();
+    printf("Micro benchmarks (%.3f ns/tick, best of %d rounds x ~%.0f ms):\n", g_ns_per_tick, BENCH_REPS, g_round_ms);
+    for (size_t i = 0; i < sizeof(g_benches) / sizeof(g_benches[0]); i++) {
+        if (g_filter && !strstr(g_benches[i].name, g_filter)) continue;
+        setup(c, &g_benches[i]);
+        run(&g_benches[i], c);
+    }
+    for (int k = 0; k < BENCH_SESSIONS && g_sess[k]; k++) {
+        free(g_sess[k]->remote_cands);
+        free(g_sess[k]);
+    }
+
+    ring_release(&c->ring);
+    free(c);
+    if (g_json) fclose(g_json);
+    return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * bench_server_index.c - 服务器热路径索引（flat_index vs uthash）校验与微基准
+ *
+ * 1. 正确性：随机插入 / 删除 / 查找序列与 uthash 结果逐次比对（含扩容与后移删除）
+ * 2. 微基准：模拟 auth_key / session_id 查找，对象大小与服务器一致量级，
+ *    分别测量命中与未命中的平均耗时
+ *
+ * 用法: bench_server_index [条目数=100000] [查找次数=4000000]
+ */
+
+#include "test_framework.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "uthash.h"
+#include "flat_index.h"
+
+/* 与 compact_client_t 相当的对象：热字段之外还有数百字节状态，uthash 版本额外携带句柄 */
+typedef struct item {
+    uint64_t            key;
+    uint8_t             state[320];
+    UT_hash_handle      hh;
+} item_t;
+
+static uint64_t g_rng = 0x9E3779B97F4A7C15ull;
+static uint64_t rnd64(void) {                               // xorshift64*
+    g_rng ^= g_rng >> 12; g_rng ^= g_rng << 25; g_rng ^= g_rng >> 27;
+    return g_rng * 2685821657736338717ull;
+}
+
+static double now_ns(void) {
+    return (double)clock() * 1e9 / CLOCKS_PER_SEC;
+}
+
+/* 随机操作序列：两种索引的查找结果必须始终一致 */
+TEST(flat_index_matches_uthash) {
+    enum { KEYS = 5000, OPS = 200000 };
+    static item_t items[KEYS];
+    static bool in[KEYS];
+    item_t *uh = NULL;
+    flat_index_t fi = { NULL, 0, 0 };
+
+    for (int i = 0; i < KEYS; i++) { items[i].key = (i % 7 == 0) ? (uint64_t)i + 1 : rnd64() | 1; in[i] = false; }
+
+    for (int op = 0; op < OPS; op++) {
+        int i = (int)(rnd64() % KEYS);
+        item_t *u = NULL;
+        HASH_FIND(hh, uh, &items[i].key, sizeof(uint64_t), u);
+        ASSERT(flat_index_find(&fi, items[i].key) == (void*)u);
+        if (rnd64() & 1) {
+            if (!in[i]) { HASH_ADD(hh, uh, key, sizeof(uint64_t), &items[i]); in[i] = true; }
+            ASSERT_EQ(flat_index_put(&fi, items[i].key, &items[i]), 0);
+        } else {
+            if (in[i]) { HASH_DELETE(hh, uh, &items[i]); in[i] = false; }
+            ASSERT(flat_index_del(&fi, items[i].key) == (void*)u);
+        }
+        ASSERT_EQ(fi.count, HASH_COUNT(uh));
+    }
+    for (int i = 0; i < KEYS; i++) ASSERT(flat_index_find(&fi, items[i].key) == (in[i] ? (void*)&items[i] : NULL));
+
+    ASSERT(flat_index_find(&fi, 0) == NULL);
+    ASSERT_EQ(flat_index_put(&fi, 0, items), -1);
+    ASSERT_EQ(flat_index_reserve(&fi, 1000), 0);
+    ASSERT((uint64_t)(fi.count + 1000) * 4 <= (uint64_t)(fi.mask + 1) * 3);
+
+    HASH_CLEAR(hh, uh);
+    flat_index_free(&fi);
+    ASSERT(flat_index_find(&fi, items[0].key) == NULL);
+}
+
+static int g_n = 100000, g_lookups = 4000000;
+
+static void bench(void) {
+    item_t *items = (item_t*)calloc((size_t)g_n, sizeof(item_t));
+    uint64_t *probe = (uint64_t*)malloc(sizeof(uint64_t) * 4096);
+    if (!items || !probe) { free(items); free(probe); return; }
+
+    item_t *uh = NULL;
+    flat_index_t fi = { NULL, 0, 0 };
+    for (int i = 0; i < g_n; i++) {
+        items[i].key = rnd64() | 1;
+        HASH_ADD(hh, uh, key, sizeof(uint64_t), &items[i]);
+        flat_index_put(&fi, items[i].key, &items[i]);
+    }
+
+    for (int miss = 0; miss < 2; miss++) {
+        for (int i = 0; i < 4096; i++) probe[i] = miss ? (rnd64() & ~1ull) | 2 : items[rnd64() % (uint64_t)g_n].key;
+
+        uintptr_t sink = 0;
+        double t0 = now_ns();
+        for (int i = 0; i < g_lookups; i++) {
+            item_t *u = NULL;
+            HASH_FIND(hh, uh, &probe[i & 4095], sizeof(uint64_t), u);
+            sink += (uintptr_t)u;
+        }
+        double t1 = now_ns();
+        for (int i = 0; i < g_lookups; i++) sink -= (uintptr_t)flat_index_find(&fi, probe[i & 4095]);
+        double t2 = now_ns();
+
+        printf("  %-6s n=%d lookups=%d  uthash %.1f ns/op  flat_index %.1f ns/op  (%s)\n",
+               miss ? "miss" : "hit", g_n, g_lookups,
+               (t1 - t0) / g_lookups, (t2 - t1) / g_lookups, sink ? "MISMATCH" : "ok");
+    }
+    printf("  memory: uthash handle %zu B/item + buckets, flat_index %zu B/slot x %u slots\n",
+           sizeof(UT_hash_handle), sizeof(flat_slot_t), fi.mask + 1);
+
+    HASH_CLEAR(hh, uh);
+    flat_index_free(&fi);
+    free(items); free(probe);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) g_n = atoi(argv[1]);
+    if (argc > 2) g_lookups = atoi(argv[2]);
+    if (g_n <= 0) g_n = 1;
+    if (g_lookups <= 0) g_lookups = 1;
+
+    printf("Server index tests:\n");
+    RUN_TEST(flat_index_matches_uthash);
+    if (test_failed) return 1;
+
+    printf("Benchmark:\n");
+    bench();
+    return 0;
+}
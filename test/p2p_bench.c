@@ -0,0 +1,439 @@
+/*
+ * p2p_bench.c - 传输层吞吐 / 时延基准（进程内双实例 + 用户态 netem 代理）
+ *
+ * ============================================================================
+ * 测试方法
+ * ============================================================================
+ * 1. 同一进程内创建实例 A、B（ICE 模式，由本程序交换候选，无需信令服务器 / STUN）
+ * 2. 双方候选均指向本进程内的 UDP 代理：代理端口 PA 面向 A（冒充 B），PB 面向 B（冒充 A），
+ *    每个方向按单向时延 rtt/2 排队、按丢包率随机丢弃后转发 —— 即用户态 netem（无需 root / tc）
+ * 3. 单线程依次驱动 p2p_update(A)、p2p_update(B) 与代理，时钟共享，测量不受调度抖动影响
+ *
+ * 每个组合（传输层 × 加密 × RTT × 丢包 × 消息大小 × 窗口）测两项：
+ *   - 吞吐：A 以 msg 字节为单位向 B 单向写入 bytes 字节，自首次 p2p_send 到 B 收齐的 MB/s
+ *   - 时延：A→B→A 乒乓 samples 次（每次 msg 字节），往返时延的 p50 / p99（微秒）
+ *
+ * ============================================================================
+ * 输出
+ * ============================================================================
+ * 每个组合一行 JSON（JSON Lines，写入 stdout 或 -o 文件），供版本间回归比对：
+ *   {"transport":"reliable","crypto":"none","rtt_ms":20,"loss":0.010,"msg":1024,"window":256,
+ *    "bytes":8388608,"mbps":41.27,"p50_us":20412,"p99_us":41876,"ok":true}
+ * ok=false 表示该组合未能建立连接或未在时限内完成（对应指标为 0）；进度与汇总写入 stderr。
+ *
+ * ============================================================================
+ * 用法
+ * ============================================================================
+ *   p2p_bench [-t reliable,pseudotcp,sctp] [-c none,aead,dtls] [-r 0,20,100] [-l 0,0.01]
+ *             [-m 64,1024,16384] [-w 32,256] [-b 总字节] [-n 乒乓次数] [-p 基础端口] [-o 文件]
+ *
+ *   -t  传输层：reliable（基础 reliable 层）/ pseudotcp（拥塞控制）/ sctp（需 WITH_SCTP）
+ *   -c  加密层：none / aead（内置 ChaCha20-Poly1305）/ dtls（需 WITH_DTLS 或 WITH_OPENSSL）
+ *   -r  往返时延（毫秒），-l 单向丢包率（0~1），-m 每次写入的消息字节数，-w cfg.reliable_window
+ *   -b  吞吐阶段总字节（默认 8MB），-n 时延阶段乒乓次数（默认 200），-p 占用 p..p+3 四个端口
+ *
+ * 未编入的传输层 / 加密后端自动跳过。ctest 中以极小参数运行作为冒烟测试。
+ */
+
+#include <stdc.h>
+#include <p2p.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define BENCH_LIST_MAX          16
+#define BENCH_CONNECT_MS        5000        /* 建立连接时限 */
+#define BENCH_RUN_MS            60000       /* 单项测量时限 */
+#define PROXY_SLOTS             4096        /* 每方向排队包数（满则尾部丢弃，相当于 netem limit） */
+#define PROXY_PKT_MAX           2048
+
+///////////////////////////////////////////////////////////////////////////////
+// 用户态 netem：固定时延 + 随机丢包
+
+typedef struct {
+    uint64_t                due_us;
+    int                     len;
+    uint8_t                 data[PROXY_PKT_MAX];
+} proxy_pkt_t;
+
+typedef struct {
+    proxy_pkt_t*            q;              // 环形队列（时延固定，到期时间单调）
+    unsigned                head, tail;
+    sock_t                  out;            // 转发所用 socket（对端看到的源地址）
+    struct sockaddr_in      to;
+} proxy_dir_t;
+
+static struct {
+    sock_t                  pa, pb;         // PA 面向 A，PB 面向 B
+    proxy_dir_t             a2b, b2a;
+    uint64_t                delay_us;       // 单向时延
+    uint32_t                loss;           // 丢包阈值（相对 2^32）
+    uint64_t                fwd, drop;
+} g_px;
+
+static uint64_t g_rng = 0x9E3779B97F4A7C15ull;
+static uint32_t rnd32(void) {                               // xorshift64*
+    g_rng ^= g_rng >> 12; g_rng ^= g_rng << 25; g_rng ^= g_rng >> 27;
+    return (uint32_t)((g_rng * 2685821657736338717ull) >> 32);
+}
+
+static void loopback(struct sockaddr_in *a, uint16_t port) {
+    memset(a, 0, sizeof(*a));
+    a->sin_family = AF_INET;
+    a->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    a->sin_port = htons(port);
+}
+
+static sock_t udp_bind(uint16_t port) {
+    sock_t s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s == P_INVALID_SOCKET) return s;
+    struct sockaddr_in a; loopback(&a, port);
+    if (bind(s, (struct sockaddr*)&a, sizeof(a)) != 0) { P_sock_close(s); return P_INVALID_SOCKET; }
+    P_sock_nonblock(s, true);
+    return s;
+}
+
+static int proxy_open(uint16_t port_a, uint16_t port_b, uint16_t port_pa, uint16_t port_pb) {
+    memset(&g_px, 0, sizeof(g_px));
+    g_px.pa = udp_bind(port_pa);
+    g_px.pb = udp_bind(port_pb);
+    g_px.a2b.q = (proxy_pkt_t*)malloc(sizeof(proxy_pkt_t) * PROXY_SLOTS);
+    g_px.b2a.q = (proxy_pkt_t*)malloc(sizeof(proxy_pkt_t) * PROXY_SLOTS);
+    if (g_px.pa == P_INVALID_SOCKET || g_px.pb == P_INVALID_SOCKET || !g_px.a2b.q || !g_px.b2a.q) return -1;
+    g_px.a2b.out = g_px.pb; loopback(&g_px.a2b.to, port_b);
+    g_px.b2a.out = g_px.pa; loopback(&g_px.b2a.to, port_a);
+    return 0;
+}
+
+static void proxy_close(void) {
+    if (g_px.pa != P_INVALID_SOCKET) P_sock_close(g_px.pa);
+    if (g_px.pb != P_INVALID_SOCKET) P_sock_close(g_px.pb);
+    free(g_px.a2b.q); free(g_px.b2a.q);
+    memset(&g_px, 0, sizeof(g_px));
+}
+
+static void proxy_recv(sock_t in, proxy_dir_t *d, uint64_t now) {
+    for (;;) {
+        proxy_pkt_t *p = &d->q[d->tail % PROXY_SLOTS];
+        uint8_t sink[PROXY_PKT_MAX];
+        bool full = d->tail - d->head >= PROXY_SLOTS;
+        int n = (int)recvfrom(in, (char*)(full ? sink : p->data), PROXY_PKT_MAX, 0, NULL, NULL);
+        if (n <= 0) break;
+        if (full || (g_px.loss && rnd32() < g_px.loss)) { g_px.drop++; continue; }
+        p->len = n;
+        p->due_us = now + g_px.delay_us;
+        d->tail++;
+    }
+}
+
+static void proxy_send(proxy_dir_t *d, uint64_t now) {
+    while (d->head != d->tail) {
+        proxy_pkt_t *p = &d->q[d->head % PROXY_SLOTS];
+        if (p->due_us > now) break;
+        sendto(d->out, (const char*)p->data, p->len, 0, (struct sockaddr*)&d->to, sizeof(d->to));
+        d->head++;
+        g_px.fwd++;
+    }
+}
+
+static void proxy_pump(void) {
+    uint64_t now = P_tick_us();
+    proxy_recv(g_px.pa, &g_px.a2b, now);
+    proxy_recv(g_px.pb, &g_px.b2a, now);
+    proxy_send(&g_px.a2b, now);
+    proxy_send(&g_px.b2a, now);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 参数
+
+typedef struct {
+    const char*             transport;
+    const char*             crypto;
+    int                     rtt_ms;
+    double                  loss;
+    int                     msg;
+    int                     window;
+} bench_case_t;
+
+static const char *g_transports[BENCH_LIST_MAX] = { "reliable", "pseudotcp" };
+static const char *g_cryptos[BENCH_LIST_MAX] = { "none", "aead" };
+static int    g_rtts[BENCH_LIST_MAX] = { 0, 20 };
+static double g_losses[BENCH_LIST_MAX] = { 0, 0.01 };
+static int    g_msgs[BENCH_LIST_MAX] = { 64, 1024, 16384 };
+static int    g_windows[BENCH_LIST_MAX] = { 32, 256 };
+static int    g_n_transports = 2, g_n_cryptos = 2, g_n_rtts = 2, g_n_losses = 2, g_n_msgs = 3, g_n_windows = 2;
+static long   g_bytes = 8L * 1024 * 1024;
+static int    g_samples = 200;
+static int    g_port = 39400;
+static FILE  *g_out;
+
+/* 逗号分隔列表：字符串项直接指向 argv（就地切分） */
+static int split(char *arg, char **items) {
+    int n = 0;
+    for (char *tok = strtok(arg, ","); tok && n < BENCH_LIST_MAX; tok = strtok(NULL, ",")) items[n++] = tok;
+    return n;
+}
+
+static int parse_ints(char *arg, int *out) {
+    char *items[BENCH_LIST_MAX]; int n = split(arg, items);
+    for (int i = 0; i < n; i++) out[i] = atoi(items[i]);
+    return n;
+}
+
+static int parse_doubles(char *arg, double *out) {
+    char *items[BENCH_LIST_MAX]; int n = split(arg, items);
+    for (int i = 0; i < n; i++) out[i] = atof(items[i]);
+    return n;
+}
+
+/* 按名称填写传输层 / 加密配置，未编入的返回 false（跳过该组合） */
+static bool setup_cfg(p2p_config_t *cfg, const bench_case_t *bc) {
+    if (!strcmp(bc->transport, "pseudotcp")) cfg->use_pseudotcp = true;
+    else if (!strcmp(bc->transport, "sctp")) {
+#ifdef WITH_SCTP
+        cfg->use_sctp = true;
+#else
+        return false;
+#endif
+    } else if (strcmp(bc->transport, "reliable")) return false;
+
+    if (!strcmp(bc->crypto, "aead")) cfg->dtls_backend = 3;
+    else if (!strcmp(bc->crypto, "dtls")) {
+#if defined(WITH_DTLS)
+        cfg->dtls_backend = 1;
+#elif defined(WITH_OPENSSL)
+        cfg->dtls_backend = 2;
+#else
+        return false;
+#endif
+    } else if (strcmp(bc->crypto, "none")) return false;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 单个组合
+
+static p2p_handle_t g_a, g_b;
+static p2p_session_t g_sa, g_sb;
+
+static void pump(void) {
+    p2p_update(g_a);
+    p2p_update(g_b);
+    proxy_pump();
+}
+
+static void add_remote(p2p_session_t s, uint16_t port) {
+    char sdp[128];
+    snprintf(sdp, sizeof(sdp), "a=candidate:1 1 UDP 2130706431 127.0.0.1 %u typ host\r\n", (unsigned)port);
+    p2p_import_ice_sdp(s, sdp);
+}
+
+static bool bench_open(const bench_case_t *bc) {
+    uint16_t pa = (uint16_t)g_port, pb = (uint16_t)(g_port + 1);
+    if (proxy_open(pa, pb, (uint16_t)(g_port + 2), (uint16_t)(g_port + 3)) != 0) return false;
+    g_px.delay_us = (uint64_t)bc->rtt_ms * 500;
+    g_px.loss = (uint32_t)(bc->loss * 4294967295.0);
+
+    p2p_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.signaling_mode = P2P_SIGNALING_MODE_ICE;
+    cfg.skip_stun_test = true;
+    cfg.test_ice_host_off = true;           // 只使用下面手工导入的回环候选
+    cfg.test_ice_srflx_off = true;
+    cfg.test_ice_relay_off = true;
+    cfg.reliable_window = bc->window;
+    cfg.send_buf_size = cfg.recv_buf_size = 1024 * 1024;
+    cfg.auth_key = "p2p_bench";
+    if (!setup_cfg(&cfg, bc)) return false;
+
+    cfg.bind_port = pa;
+    g_a = p2p_create("bench_a", &cfg);
+    cfg.bind_port = pb;
+    g_b = p2p_create("bench_b", &cfg);
+    if (!g_a || !g_b) return false;
+
+    g_sa = p2p_connect(g_a, "bench_b", false);
+    g_sb = p2p_connect(g_b, "bench_a", false);
+    if (!g_sa || !g_sb) return false;
+    add_remote(g_sa, (uint16_t)(g_port + 2));
+    add_remote(g_sb, (uint16_t)(g_port + 3));
+
+    uint64_t t0 = P_tick_ms();
+    while (!(p2p_is_ready(g_sa) && p2p_is_ready(g_sb))) {
+        if (P_tick_ms() - t0 > BENCH_CONNECT_MS + (uint64_t)bc->rtt_ms * 20) return false;
+        pump();
+    }
+    return true;
+}
+
+static void bench_close(void) {
+    if (g_a) p2p_destroy(g_a);
+    if (g_b) p2p_destroy(g_b);
+    g_a = g_b = NULL; g_sa = g_sb = NULL;
+    proxy_close();
+}
+
+/* 吞吐：A → B 单向写入 g_bytes，返回 MB/s（失败 <0） */
+static double bench_throughput(const bench_case_t *bc, uint8_t *buf) {
+    long sent = 0, got = 0;
+    int off = 0;                            // 当前消息已写入部分（p2p_send 可能只接受一部分）
+    uint64_t t0 = P_tick_us();
+    while (got < g_bytes) {
+        if (P_tick_us() - t0 > (uint64_t)BENCH_RUN_MS * 1000) return -1;
+        while (sent < g_bytes) {
+            int want = (int)(bc->msg - off < g_bytes - sent ? bc->msg - off : g_bytes - sent);
+            int n = p2p_send(g_sa, buf + off, want);
+            if (n < 0) return -1;
+            if (n == 0) break;
+            sent += n;
+            off = (off + n) % bc->msg;
+        }
+        pump();
+        int n;
+        while ((n = p2p_recv(g_sb, buf + bc->msg, bc->msg)) > 0) got += n;
+        if (n < 0) return -1;
+    }
+    double sec = (double)(P_tick_us() - t0) / 1e6;
+    return sec > 0 ? (double)g_bytes / (1024.0 * 1024.0) / sec : 0;
+}
+
+/* 从 s 读满 len 字节（期间持续驱动），失败返回 false */
+static bool read_full(p2p_session_t s, uint8_t *buf, int len, uint64_t deadline_us) {
+    int got = 0;
+    while (got < len) {
+        int n = p2p_recv(s, buf + got, len - got);
+        if (n < 0 || P_tick_us() > deadline_us) return false;
+        if (n > 0) { got += n; continue; }
+        pump();
+    }
+    return true;
+}
+
+static bool write_full(p2p_session_t s, const uint8_t *buf, int len, uint64_t deadline_us) {
+    int off = 0;
+    while (off < len) {
+        int n = p2p_send(s, buf + off, len - off);
+        if (n < 0 || P_tick_us() > deadline_us) return false;
+        off += n;
+        if (off < len) pump();
+    }
+    return true;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* 时延：A→B→A 乒乓，输出往返时延 p50 / p99（微秒） */
+static bool bench_latency(const bench_case_t *bc, uint8_t *buf, uint64_t *p50, uint64_t *p99) {
+    uint64_t *rtt = (uint64_t*)malloc(sizeof(uint64_t) * (size_t)g_samples);
+    if (!rtt) return false;
+    uint64_t deadline = P_tick_us() + (uint64_t)BENCH_RUN_MS * 1000;
+    bool ok = true;
+    for (int i = 0; i < g_samples && ok; i++) {
+        uint64_t t0 = P_tick_us();
+        ok = write_full(g_sa, buf, bc->msg, deadline)
+          && read_full(g_sb, buf + bc->msg, bc->msg, deadline)
+          && write_full(g_sb, buf + bc->msg, bc->msg, deadline)
+          && read_full(g_sa, buf + bc->msg, bc->msg, deadline);
+        rtt[i] = P_tick_us() - t0;
+    }
+    if (ok) {
+        qsort(rtt, (size_t)g_samples, sizeof(uint64_t), cmp_u64);
+        *p50 = rtt[g_samples / 2];
+        *p99 = rtt[(g_samples * 99) / 100 < g_samples ? (g_samples * 99) / 100 : g_samples - 1];
+    }
+    free(rtt);
+    return ok;
+}
+
+static int bench_run(const bench_case_t *bc) {
+    p2p_config_t probe;
+    memset(&probe, 0, sizeof(probe));
+    if (!setup_cfg(&probe, bc)) {
+        fprintf(stderr, "  skip %s/%s (not built)\n", bc->transport, bc->crypto);
+        return 0;
+    }
+
+    uint8_t *buf = (uint8_t*)malloc((size_t)bc->msg * 2);
+    if (!buf) return -1;
+    for (int i = 0; i < bc->msg; i++) buf[i] = (uint8_t)rnd32();
+
+    double mbps = 0;
+    uint64_t p50 = 0, p99 = 0;
+    bool ok = bench_open(bc);
+    if (ok) ok = (mbps = bench_throughput(bc, buf)) >= 0;
+    if (ok) ok = bench_latency(bc, buf, &p50, &p99);
+    if (!ok) { mbps = 0; p50 = p99 = 0; }
+    uint64_t fwd = g_px.fwd, drop = g_px.drop;
+    bench_close();
+    free(buf);
+
+    fprintf(g_out, "{\"transport\":\"%s\",\"crypto\":\"%s\",\"rtt_ms\":%d,\"loss\":%.3f,\"msg\":%d,\"window\":%d,"
+                   "\"bytes\":%ld,\"mbps\":%.2f,\"p50_us\":%llu,\"p99_us\":%llu,\"pkts\":%llu,\"dropped\":%llu,\"ok\":%s}\n",
+            bc->transport, bc->crypto, bc->rtt_ms, bc->loss, bc->msg, bc->window,
+            g_bytes, mbps, (unsigned long long)p50, (unsigned long long)p99,
+            (unsigned long long)fwd, (unsigned long long)drop, ok ? "true" : "false");
+    fflush(g_out);
+    fprintf(stderr, "  %-9s %-4s rtt=%-4d loss=%.3f msg=%-6d win=%-5d %8.2f MB/s  p50=%lluus p99=%lluus%s\n",
+            bc->transport, bc->crypto, bc->rtt_ms, bc->loss, bc->msg, bc->window,
+            mbps, (unsigned long long)p50, (unsigned long long)p99, ok ? "" : "  FAILED");
+    return ok ? 0 : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-t reliable,pseudotcp,sctp] [-c none,aead,dtls] [-r rtt_ms,...] [-l loss,...]\n"
+                    "          [-m msg,...] [-w window,...] [-b bytes] [-n samples] [-p base_port] [-o file]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    g_out = stdout;
+    for (int i = 1; i < argc; i++) {
+        char *opt = argv[i], *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (opt[0] != '-' || !opt[1] || opt[2] || !val) { usage(argv[0]); return 2; }
+        i++;
+        switch (opt[1]) {
+            case 't': g_n_transports = split(val, (char**)g_transports); break;
+            case 'c': g_n_cryptos = split(val, (char**)g_cryptos); break;
+            case 'r': g_n_rtts = parse_ints(val, g_rtts); break;
+            case 'l': g_n_losses = parse_doubles(val, g_losses); break;
+            case 'm': g_n_msgs = parse_ints(val, g_msgs); break;
+            case 'w': g_n_windows = parse_ints(val, g_windows); break;
+            case 'b': g_bytes = atol(val); break;
+            case 'n': g_samples = atoi(val); break;
+            case 'p': g_port = atoi(val); break;
+            case 'o':
+                if (!(g_out = fopen(val, "w"))) { perror(val); return 2; }
+                break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (g_bytes <= 0) g_bytes = 1;
+    if (g_samples <= 0) g_samples = 1;
+    for (int i = 0; i < g_n_msgs; i++) if (g_msgs[i] <= 0) g_msgs[i] = 1;
+
+    p2p_log_level = P2P_LOG_LEVEL_ERROR;
+
+    int failed = 0, runs = 0;
+    for (int t = 0; t < g_n_transports; t++)
+    for (int c = 0; c < g_n_cryptos; c++)
+    for (int r = 0; r < g_n_rtts; r++)
+    for (int l = 0; l < g_n_losses; l++)
+    for (int m = 0; m < g_n_msgs; m++)
+    for (int w = 0; w < g_n_windows; w++) {
+        bench_case_t bc = { g_transports[t], g_cryptos[c], g_rtts[r], g_losses[l], g_msgs[m], g_windows[w] };
+        if (bench_run(&bc) != 0) failed++;
+        runs++;
+    }
+
+    fprintf(stderr, "%d runs, %d failed\n", runs, failed);
+    if (g_out != stdout) fclose(g_out);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,375 @@
+/*
+ * p2p_loadgen.c - 信令服务器负载生成（单进程模拟 N 个 COMPACT / RELAY 客户端）
+ *
+ * ============================================================================
+ * 测试方法
+ * ============================================================================
+ * 1. 按 -r 速率逐个创建客户端实例（各自独立 socket，peer id 为 lg<pid>-<i>），
+ *    第 2k 与 2k+1 号互为对端：p2p_connect 触发 ONLINE 与 SYNC0 配对，连通后库内自动 ALIVE 保活
+ * 2. 单线程依次驱动全部实例的 p2p_update，无事可做时 poll 全部描述符
+ * 3. 建连后每个客户端按 -q 速率向对端发 MSG RPC（msg=0 echo，由对端库内自动应答，经服务器中转），
+ *    偶数号客户端按 -D 速率向对端发消息、对端原样回送（-R 时禁用直连候选，数据必经服务器中继）
+ *
+ * 服务器响应时延取自会话建连里程碑（p2p_stats_t.setup_ms）：
+ *   signaled     p2p_connect → 服务器受理会话（ONLINE + SYNC0 / RELAY 会话往返）
+ *   paired       p2p_connect → 收到服务器转来的对端候选（双方均已上线；-R 时不交换候选，不统计）
+ *   connected    p2p_connect → CONNECTED / RELAY
+ * 以及 rpc（请求到应答）与 data（消息往返）时延；各项输出 p50 / p90 / p99 / max（毫秒，data 为微秒）。
+ *
+ * ============================================================================
+ * 输出
+ * ============================================================================
+ * 结束时一行 JSON（stdout 或 -o 文件），各阶段的 ok / fail 计数与分位数，例如：
+ *   {"mode":"compact","clients":1000,"signaled":{"ok":1000,"fail":0,"p50":3,"p90":8,"p99":21,"max":40},
+ *    ...,"rpc":{"sent":5000,"ok":4990,"fail":10,...},"data":{"sent":...},"errors":0.002}
+ * errors 为失败（未受理 / 未配对 / 未连通 / RPC 失败或超时 / 会话出错）次数占尝试次数的比例。
+ * 每秒一行进度写入 stderr。
+ *
+ * ============================================================================
+ * 用法
+ * ============================================================================
+ *   p2p_loadgen -s host[:port] [-m compact|relay] [-n 客户端数] [-r 每秒启动数] [-d 秒]
+ *               [-q 每客户端 RPC/s] [-D 每对消息/s] [-S 消息字节] [-R] [-p 基础端口] [-t 超时毫秒] [-o 文件]
+ *
+ *   -n  客户端数（向上取偶数，默认 100），-r 启动速率（默认 100/s），-d 启动完成后的持续时间（默认 10s）
+ *   -q  RPC 速率（默认 1，0 = 不发），-D 数据消息速率（默认 0），-S 消息字节（默认 64）
+ *   -R  禁用 host / srflx / prflx 候选并开启竞速中转：数据经信令服务器中继
+ *   -p  客户端绑定端口从 p 起连续分配（默认 0 = 系统分配），-t 各阶段超时（默认 10000ms）
+ *
+ * 客户端数受进程描述符上限约束（每个客户端一个 UDP socket，RELAY 模式另加一个 TCP 连接）。
+ */
+
+#include <stdc.h>
+#include <p2p.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+
+#define LG_RPC_SLOTS            64          /* 每客户端在途 RPC 记录数（2 的幂，超出的请求不计时） */
+#define LG_MSG_MAX              4096
+#define LG_POLL_MAX_MS          10
+
+typedef struct {
+    uint64_t                t_us;           // 发出时刻（0 = 空闲）
+    uint16_t                sid;
+} lg_rpc_t;
+
+typedef struct {
+    p2p_handle_t            hdl;
+    p2p_session_t           sess;
+    int                     idx;
+    uint64_t                start_ms;       // p2p_connect 时刻
+    bool                    signaled, paired, connected, failed;
+    uint64_t                next_rpc_us;
+    uint64_t                next_data_us;
+    lg_rpc_t                rpc[LG_RPC_SLOTS];
+} lg_client_t;
+
+/* 样本集合（毫秒或微秒），结束时排序取分位数 */
+typedef struct {
+    uint32_t*               v;
+    int                     n, cap;
+    uint64_t                ok, fail;
+} lg_stat_t;
+
+static lg_stat_t g_signaled, g_paired, g_connected, g_rpc, g_data;
+static uint64_t  g_rpc_sent, g_data_sent, g_sess_err;
+
+static const char *g_host;
+static int    g_port = 9333;
+static int    g_mode = P2P_SIGNALING_MODE_COMPACT;
+static int    g_clients = 100;
+static double g_ramp = 100;
+static int    g_duration = 10;
+static double g_rpc_rate = 1;
+static double g_data_rate = 0;
+static int    g_msg = 64;
+static bool   g_relay_data;
+static int    g_base_port;
+static int    g_timeout_ms = 10000;
+static FILE  *g_out;
+
+static void stat_add(lg_stat_t *st, uint64_t v) {
+    st->ok++;
+    if (st->n == st->cap) {
+        int cap = st->cap ? st->cap * 2 : 1024;
+        uint32_t *p = (uint32_t*)realloc(st->v, sizeof(uint32_t) * (size_t)cap);
+        if (!p) return;
+        st->v = p; st->cap = cap;
+    }
+    st->v[st->n++] = v > UINT32_MAX ? UINT32_MAX : (uint32_t)v;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t pct(const lg_stat_t *st, int p) {
+    if (!st->n) return 0;
+    int i = (st->n - 1) * p / 100;
+    return st->v[i];
+}
+
+static void stat_json(const char *name, lg_stat_t *st, const char *extra) {
+    qsort(st->v, (size_t)st->n, sizeof(uint32_t), cmp_u32);
+    fprintf(g_out, "\"%s\":{%s\"ok\":%llu,\"fail\":%llu,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u}",
+            name, extra, (unsigned long long)st->ok, (unsigned long long)st->fail,
+            pct(st, 50), pct(st, 90), pct(st, 99), st->n ? st->v[st->n - 1] : 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 回调
+
+static void on_response(p2p_session_t sess, uint16_t sid, uint8_t code, const void *data, int len, void *userdata) {
+    (void)sess; (void)code; (void)data;
+    lg_client_t *c = (lg_client_t*)userdata;
+    lg_rpc_t *r = &c->rpc[sid & (LG_RPC_SLOTS - 1)];
+    if (!r->t_us || r->sid != sid) return;                  // 在途记录已被覆盖：不计时
+    if (len < 0) g_rpc.fail++;
+    else stat_add(&g_rpc, (P_tick_us() - r->t_us) / 1000);
+    r->t_us = 0;
+}
+
+static void on_state(p2p_session_t sess, p2p_state_t old_state, p2p_state_t new_state, void *userdata) {
+    (void)sess; (void)old_state;
+    lg_client_t *c = (lg_client_t*)userdata;
+    if (new_state == P2P_STATE_ERROR || new_state == P2P_STATE_CLOSED || new_state == P2P_STATE_LOST) {
+        if (!c->failed) g_sess_err++;
+        c->failed = true;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 客户端
+
+static bool client_start(lg_client_t *c, int idx, uint32_t tag) {
+    p2p_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.signaling_mode = g_mode;
+    cfg.server_host = g_host;
+    cfg.server_port = (uint16_t)g_port;
+    cfg.bind_port = g_base_port ? (uint16_t)(g_base_port + idx) : 0;
+    cfg.skip_stun_test = true;
+    cfg.message_mode = true;
+    cfg.on_state = on_state;
+    cfg.on_response = on_response;
+    cfg.userdata = c;
+    if (g_relay_data) {
+        cfg.test_ice_host_off = cfg.test_ice_srflx_off = cfg.test_ice_prflx_off = true;
+        cfg.path_race = true;
+    }
+
+    char self[32], peer[32];
+    snprintf(self, sizeof(self), "lg%u-%d", tag, idx);
+    snprintf(peer, sizeof(peer), "lg%u-%d", tag, idx ^ 1);
+
+    c->idx = idx;
+    if (!(c->hdl = p2p_create(self, &cfg))) return false;
+    c->start_ms = P_tick_ms();
+    return (c->sess = p2p_connect(c->hdl, peer, false)) != NULL;
+}
+
+/* 里程碑与超时检查；未到达的阶段在超时后计为失败 */
+static void client_check(lg_client_t *c, uint64_t now_ms) {
+    if (c->failed || !c->sess) return;
+    if (c->signaled && c->paired && c->connected) return;
+
+    p2p_stats_t st;
+    if (p2p_get_stats(c->sess, &st) != 0) return;
+    if (!c->signaled && st.setup_ms[P2P_SETUP_SIGNALED] >= 0) {
+        c->signaled = true; stat_add(&g_signaled, (uint64_t)st.setup_ms[P2P_SETUP_SIGNALED]);
+    }
+    if (!c->paired && st.setup_ms[P2P_SETUP_REMOTE_CAND] >= 0) {
+        c->paired = true; stat_add(&g_paired, (uint64_t)st.setup_ms[P2P_SETUP_REMOTE_CAND]);
+    }
+    if (!c->connected && st.setup_ms[P2P_SETUP_CONNECTED] >= 0) {
+        c->connected = true; stat_add(&g_connected, (uint64_t)st.setup_ms[P2P_SETUP_CONNECTED]);
+        uint64_t now_us = P_tick_us();
+        c->next_rpc_us = c->next_data_us = now_us + (uint64_t)(rand() % 1000) * 1000;   // 错开首次发送
+    }
+    if (now_ms < c->start_ms + (uint64_t)g_timeout_ms) return;
+
+    // 超时：未到达的阶段各计一次失败，该客户端不再参与
+    if (!c->signaled) g_signaled.fail++;
+    if (!c->paired && !g_relay_data) g_paired.fail++;     // -R 时无候选交换，不计配对阶段
+    if (!c->connected) g_connected.fail++;
+    c->failed = true;
+}
+
+static void client_traffic(lg_client_t *c, uint64_t now_us) {
+    if (!c->connected || c->failed) return;
+
+    // MSG RPC：msg=0 echo 由对端库内应答；在途超时计为失败
+    for (int i = 0; i < LG_RPC_SLOTS; i++) {
+        lg_rpc_t *r = &c->rpc[i];
+        if (r->t_us && now_us - r->t_us > (uint64_t)g_timeout_ms * 1000) { g_rpc.fail++; r->t_us = 0; }
+    }
+    if (g_rpc_rate > 0 && now_us >= c->next_rpc_us) {
+        c->next_rpc_us += (uint64_t)(1e6 / g_rpc_rate);
+        if (c->next_rpc_us < now_us) c->next_rpc_us = now_us;
+        uint8_t body[LG_MSG_MAX];
+        memset(body, (int)c->idx, (size_t)g_msg);
+        int sid = p2p_request(c->sess, 0, body, g_msg);
+        g_rpc_sent++;
+        if (sid <= 0) g_rpc.fail++;
+        else {
+            lg_rpc_t *r = &c->rpc[sid & (LG_RPC_SLOTS - 1)];
+            r->t_us = now_us; r->sid = (uint16_t)sid;
+        }
+    }
+
+    // 数据：偶数号发出带时间戳的消息，奇数号原样回送
+    uint8_t buf[LG_MSG_MAX];
+    int n;
+    while ((n = p2p_recv_msg(c->sess, buf, sizeof(buf))) > 0) {
+        if (c->idx & 1) { p2p_send_msg(c->sess, buf, n); continue; }
+        uint64_t t;
+        if (n < (int)sizeof(t)) continue;
+        memcpy(&t, buf, sizeof(t));
+        stat_add(&g_data, now_us - t);
+    }
+    if (!(c->idx & 1) && g_data_rate > 0 && now_us >= c->next_data_us) {
+        c->next_data_us += (uint64_t)(1e6 / g_data_rate);
+        if (c->next_data_us < now_us) c->next_data_us = now_us;
+        memset(buf, 0, (size_t)g_msg);
+        memcpy(buf, &now_us, sizeof(now_us));
+        if (p2p_send_msg(c->sess, buf, g_msg) > 0) g_data_sent++;
+        else g_data.fail++;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s -s host[:port] [-m compact|relay] [-n clients] [-r starts_per_sec] [-d seconds]\n"
+                    "          [-q rpc_per_sec] [-D data_per_sec] [-S msg_bytes] [-R] [-p base_port] [-t timeout_ms] [-o file]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    g_out = stdout;
+    for (int i = 1; i < argc; i++) {
+        char *opt = argv[i];
+        if (opt[0] != '-' || !opt[1] || opt[2]) { usage(argv[0]); return 2; }
+        if (opt[1] == 'R') { g_relay_data = true; continue; }
+        char *val = i + 1 < argc ? argv[++i] : NULL;
+        if (!val) { usage(argv[0]); return 2; }
+        switch (opt[1]) {
+            case 's': {
+                char *colon = strrchr(val, ':');
+                if (colon) { *colon = '\0'; g_port = atoi(colon + 1); }
+                g_host = val;
+                break;
+            }
+            case 'm':
+                if (!strcmp(val, "compact")) g_mode = P2P_SIGNALING_MODE_COMPACT;
+                else if (!strcmp(val, "relay")) g_mode = P2P_SIGNALING_MODE_RELAY;
+                else { usage(argv[0]); return 2; }
+                break;
+            case 'n': g_clients = atoi(val); break;
+            case 'r': g_ramp = atof(val); break;
+            case 'd': g_duration = atoi(val); break;
+            case 'q': g_rpc_rate = atof(val); break;
+            case 'D': g_data_rate = atof(val); break;
+            case 'S': g_msg = atoi(val); break;
+            case 'p': g_base_port = atoi(val); break;
+            case 't': g_timeout_ms = atoi(val); break;
+            case 'o':
+                if (!(g_out = fopen(val, "w"))) { perror(val); return 2; }
+                break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (!g_host) { usage(argv[0]); return 2; }
+    if (g_clients < 2) g_clients = 2;
+    g_clients = (g_clients + 1) & ~1;
+    if (g_ramp <= 0) g_ramp = g_clients;
+    if (g_msg < (int)sizeof(uint64_t)) g_msg = sizeof(uint64_t);
+    if (g_msg > LG_MSG_MAX) g_msg = LG_MSG_MAX;
+
+    p2p_log_level = P2P_LOG_LEVEL_ERROR;
+    srand((unsigned)getpid());
+
+    lg_client_t *cl = (lg_client_t*)calloc((size_t)g_clients, sizeof(lg_client_t));
+    struct pollfd *pfd = (struct pollfd*)calloc((size_t)g_clients * 4, sizeof(struct pollfd));
+    p2p_fd_t fds[8];
+    if (!cl || !pfd) return 1;
+
+    uint32_t tag = (uint32_t)getpid();
+    int started = 0, start_fail = 0;
+    uint64_t t0 = P_tick_ms(), ramp_done = 0, last_report = t0;
+    for (;;) {
+        uint64_t now_ms = P_tick_ms(), now_us = P_tick_us();
+
+        // 按速率启动客户端，全部启动后再运行 g_duration 秒
+        int due = (int)((double)(now_ms - t0) * g_ramp / 1000.0) + 1;
+        while (started < g_clients && started < due) {
+            if (!client_start(&cl[started], started, tag)) { start_fail++; cl[started].failed = true; }
+            started++;
+        }
+        if (started == g_clients && !ramp_done) ramp_done = now_ms;
+        if (ramp_done && now_ms - ramp_done >= (uint64_t)g_duration * 1000) break;
+
+        int nfd = 0, wait = LG_POLL_MAX_MS;
+        for (int i = 0; i < started; i++) {
+            lg_client_t *c = &cl[i];
+            if (!c->hdl) continue;
+            p2p_update(c->hdl);
+            client_check(c, now_ms);
+            client_traffic(c, now_us);
+
+            int t = p2p_next_timeout_ms(c->hdl);
+            if (t >= 0 && t < wait) wait = t;
+            int n = p2p_get_fds(c->hdl, fds, 8);
+            for (int k = 0; k < n && k < 8 && nfd < g_clients * 4; k++, nfd++) {
+                pfd[nfd].fd = (int)fds[k].fd;
+                pfd[nfd].events = (short)((fds[k].events & P2P_FD_READ ? POLLIN : 0) | (fds[k].events & P2P_FD_WRITE ? POLLOUT : 0));
+            }
+        }
+        if (g_rpc_rate > 0 || g_data_rate > 0) wait = wait > 1 ? 1 : wait;
+        if (started < g_clients) wait = 1;
+        if (wait > 0) poll(pfd, (nfds_t)nfd, wait);
+
+        if (now_ms - last_report >= 1000) {
+            last_report = now_ms;
+            fprintf(stderr, "[%3llus] started=%d signaled=%llu paired=%llu connected=%llu rpc=%llu/%llu data=%llu/%llu fail=%llu\n",
+                    (unsigned long long)((now_ms - t0) / 1000), started,
+                    (unsigned long long)g_signaled.ok, (unsigned long long)g_paired.ok, (unsigned long long)g_connected.ok,
+                    (unsigned long long)g_rpc.ok, (unsigned long long)g_rpc_sent,
+                    (unsigned long long)g_data.ok, (unsigned long long)g_data_sent,
+                    (unsigned long long)(g_signaled.fail + g_paired.fail + g_connected.fail + g_rpc.fail + g_sess_err));
+        }
+    }
+
+    // 仍未满 g_timeout_ms 的客户端：未到达的阶段计为失败
+    for (int i = 0; i < started; i++) if (!cl[i].failed && cl[i].sess) {
+        lg_client_t *c = &cl[i];
+        if (!c->signaled) g_signaled.fail++;
+        if (!c->paired && !g_relay_data) g_paired.fail++;
+        if (!c->connected) g_connected.fail++;
+    }
+    g_signaled.fail += (uint64_t)start_fail;
+
+    uint64_t attempts = (uint64_t)g_clients * (g_relay_data ? 2 : 3) + g_rpc_sent + g_data_sent;
+    uint64_t errors = g_signaled.fail + g_paired.fail + g_connected.fail + g_rpc.fail + g_data.fail + g_sess_err;
+    char extra[64];
+    fprintf(g_out, "{\"mode\":\"%s\",\"clients\":%d,\"relay_data\":%s,",
+            g_mode == P2P_SIGNALING_MODE_COMPACT ? "compact" : "relay", g_clients, g_relay_data ? "true" : "false");
+    stat_json("signaled", &g_signaled, ""); fputc(',', g_out);
+    stat_json("paired", &g_paired, ""); fputc(',', g_out);
+    stat_json("connected", &g_connected, ""); fputc(',', g_out);
+    snprintf(extra, sizeof(extra), "\"sent\":%llu,", (unsigned long long)g_rpc_sent);
+    stat_json("rpc", &g_rpc, extra); fputc(',', g_out);
+    snprintf(extra, sizeof(extra), "\"sent\":%llu,\"unit\":\"us\",", (unsigned long long)g_data_sent);
+    stat_json("data", &g_data, extra);
+    fprintf(g_out, ",\"session_errors\":%llu,\"errors\":%.4f}\n",
+            (unsigned long long)g_sess_err, attempts ? (double)errors / (double)attempts : 0.0);
+
+    for (int i = 0; i < started; i++) if (cl[i].hdl) p2p_destroy(cl[i].hdl);
+    free(cl); free(pfd);
+    free(g_signaled.v); free(g_paired.v); free(g_connected.v); free(g_rpc.v); free(g_data.v);
+    if (g_out != stdout) fclose(g_out);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,265 @@
+/*
+ * p2p_simnet.c - 规模建连基准（模拟构建 P2P_SIM：进程内虚拟网络 + 虚拟时钟）
+ *
+ * ============================================================================
+ * 测试方法
+ * ============================================================================
+ * 1. 每对对端各占一台虚拟主机，按 -N 列表轮流分配 NAT 类型（每台主机独占一个 NAT，none 为公网主机），
+ *    接入链路按 -l / -d / -j 设置丢包、单向时延与抖动；网络中登记一台虚拟 STUN 服务器
+ * 2. 实例为 ICE 模式，候选经进程内信令服务交换（-s 信令单向时延），Trickle 候选由 on_ice_candidate 转发
+ * 3. 单线程驱动全部实例，虚拟时钟直接跳到下一个事件，与真实时间无关：
+ *    结果只由参数与种子决定，数千对对端的建连在秒级真实时间内完成
+ *
+ * 每对建连后 A 向 B 写入 -b 字节，统计：
+ *   - 建连成功数与路径类型（LAN / PUNCH / 其他）
+ *   - 建连时间（p2p_connect 到双方就绪，虚拟毫秒）的 p50 / p90 / p99
+ *   - 传输完成对数与总吞吐（按虚拟时间）
+ *   - 虚拟时间 / 真实时间（加速比）及虚拟网络计数
+ *
+ * ============================================================================
+ * 输出
+ * ============================================================================
+ * 一行 JSON（写入 stdout 或 -o 文件）：
+ *   {"pairs":1000,"nat":"cone,port,sym,none","loss":0.010,"delay_ms":20,"jitter_ms":5,"seed":1,
+ *    "connected":874,"lan":0,"punch":874,"other":0,"connect_p50_ms":312,"connect_p90_ms":540,"connect_p99_ms":1210,
+ *    "transferred":874,"mbps":96.01,"virtual_ms":30000,"wall_ms":4210,"speedup":7.13,
+ *    "pkts":..., "delivered":..., "lost":..., "filtered":..., "unreachable":..., "ok":true}
+ * ok=false 表示建连成功比例低于 -m；进度写入 stderr。
+ *
+ * ============================================================================
+ * 用法
+ * ============================================================================
+ *   p2p_simnet [-n 对数] [-N cone,restricted,port,sym,none] [-l 丢包率] [-d 时延ms] [-j 抖动ms]
+ *              [-s 信令时延ms] [-t 时长ms] [-b 每对字节] [-S 种子] [-m 最低成功比例] [-o 文件]
+ *
+ * 只在 P2P_SIM 构建中编译（cmake -DP2P_SIM=ON）；模拟构建的库不能用于真实网络。
+ */
+
+#include <stdc.h>
+#include <p2p.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "p2p_sim.h"
+
+#define SIM_NAT_LIST_MAX        8
+#define SIM_SLICE_MS            10          /* 驱动切片：每片之间检查建连与收发 */
+#define SIM_CHUNK               1024        /* 每次 p2p_send 写入字节 */
+
+typedef struct {
+    p2p_handle_t            a, b;
+    p2p_session_t           sa, sb;
+    uint64_t                start_ms;       // p2p_connect 时刻（虚拟）
+    int                     connect_ms;     // 建连耗时，<0 = 未建连
+    int                     path;
+    long                    sent, got;
+    uint64_t                done_ms;        // 传输完成时刻（虚拟），0 = 未完成
+} sim_pair_t;
+
+static const char *g_nat_names[SIM_NAT_LIST_MAX] = { "cone", "port", "sym", "none" };
+static int    g_n_nats = 4;
+static int    g_pairs = 100;
+static double g_loss;
+static int    g_delay_ms = 20, g_jitter_ms = 2, g_signal_ms = 50;
+static int    g_duration_ms = 30000;
+static long   g_bytes = 64 * 1024;
+static uint64_t g_seed = 1;
+static double g_min_ok = 0;
+static FILE  *g_out;
+
+static uint64_t wall_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+/* NAT 名称 → 类型（none 返回 -1 表示公网主机，未知返回 -2） */
+static int nat_type(const char *name) {
+    if (!strcmp(name, "none")) return -1;
+    if (!strcmp(name, "cone") || !strcmp(name, "full")) return P2P_SIM_NAT_FULL_CONE;
+    if (!strcmp(name, "restricted")) return P2P_SIM_NAT_RESTRICTED;
+    if (!strcmp(name, "port")) return P2P_SIM_NAT_PORT_RESTRICTED;
+    if (!strcmp(name, "sym") || !strcmp(name, "symmetric")) return P2P_SIM_NAT_SYMMETRIC;
+    return -2;
+}
+
+static int host_new(int k, const p2p_sim_link_t *link) {
+    int t = nat_type(g_nat_names[k % g_n_nats]);
+    int nat = t >= 0 ? p2p_sim_nat_add((p2p_sim_nat_type_t)t, 0) : -1;
+    return t >= 0 && nat < 0 ? -1 : p2p_sim_host_add(nat, link);
+}
+
+static p2p_handle_t peer_new(int host, const char *id, const p2p_config_t *cfg) {
+    p2p_sim_host_select(host);
+    return p2p_create(id, cfg);
+}
+
+static int cmp_int(const void *a, const void *b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-n pairs] [-N cone,restricted,port,sym,none] [-l loss] [-d delay_ms] [-j jitter_ms]\n"
+                    "          [-s signal_ms] [-t duration_ms] [-b bytes] [-S seed] [-m min_ok] [-o file]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    g_out = stdout;
+    char nat_arg[128] = "cone,port,sym,none";
+    for (int i = 1; i < argc; i++) {
+        char *opt = argv[i], *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (opt[0] != '-' || !opt[1] || opt[2] || !val) { usage(argv[0]); return 2; }
+        i++;
+        switch (opt[1]) {
+            case 'n': g_pairs = atoi(val); break;
+            case 'N':
+                snprintf(nat_arg, sizeof(nat_arg), "%s", val);
+                g_n_nats = 0;
+                for (char *tok = strtok(val, ","); tok && g_n_nats < SIM_NAT_LIST_MAX; tok = strtok(NULL, ",")) {
+                    if (nat_type(tok) == -2) { usage(argv[0]); return 2; }
+                    g_nat_names[g_n_nats++] = tok;
+                }
+                break;
+            case 'l': g_loss = atof(val); break;
+            case 'd': g_delay_ms = atoi(val); break;
+            case 'j': g_jitter_ms = atoi(val); break;
+            case 's': g_signal_ms = atoi(val); break;
+            case 't': g_duration_ms = atoi(val); break;
+            case 'b': g_bytes = atol(val); break;
+            case 'S': g_seed = (uint64_t)strtoull(val, NULL, 10); break;
+            case 'm': g_min_ok = atof(val); break;
+            case 'o':
+                if (!(g_out = fopen(val, "w"))) { perror(val); return 2; }
+                break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (g_pairs <= 0 || !g_n_nats) { usage(argv[0]); return 2; }
+
+    p2p_log_level = P2P_LOG_LEVEL_ERROR;
+    p2p_sim_reset(g_seed);
+
+    struct sockaddr_in stun;
+    if (p2p_sim_stun_add(&stun) != E_NONE) return 1;
+    char stun_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &stun.sin_addr, stun_ip, sizeof(stun_ip));
+
+    // 链路参数按单向总时延拆到两端接入链路
+    p2p_sim_link_t link = { (float)(g_loss / 2), g_delay_ms / 2, g_jitter_ms / 2 };
+
+    p2p_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.signaling_mode = P2P_SIGNALING_MODE_ICE;
+    cfg.stun_server = stun_ip;
+    cfg.stun_port = ntohs(stun.sin_port);
+    cfg.skip_stun_test = true;              // 虚拟 STUN 服务器只有一个地址，不做 Test II/III
+    cfg.test_ice_relay_off = true;
+    cfg.on_ice_candidate = p2p_sim_on_ice_candidate;
+    cfg.auth_key = "p2p_simnet";
+
+    sim_pair_t *pairs = (sim_pair_t*)calloc((size_t)g_pairs, sizeof(*pairs));
+    p2p_handle_t *hdls = (p2p_handle_t*)calloc((size_t)g_pairs * 2, sizeof(*hdls));
+    uint8_t *buf = (uint8_t*)malloc(SIM_CHUNK);
+    if (!pairs || !hdls || !buf) return 1;
+    memset(buf, 0x5A, SIM_CHUNK);
+
+    uint64_t w0 = wall_us(), v0 = p2p_sim_tick_us() / 1000;
+    for (int i = 0; i < g_pairs; i++) {
+        sim_pair_t *p = &pairs[i];
+        char ida[16], idb[16];
+        snprintf(ida, sizeof(ida), "a%d", i);
+        snprintf(idb, sizeof(idb), "b%d", i);
+        int ha = host_new(2 * i, &link), hb = host_new(2 * i + 1, &link);
+        if (ha < 0 || hb < 0) { fprintf(stderr, "topology full at pair %d\n", i); return 1; }
+        p->a = hdls[2 * i] = peer_new(ha, ida, &cfg);
+        p->b = hdls[2 * i + 1] = peer_new(hb, idb, &cfg);
+        if (!p->a || !p->b) { fprintf(stderr, "create failed at pair %d\n", i); return 1; }
+        p->sa = p2p_connect(p->a, idb, false);
+        p->sb = p2p_connect(p->b, ida, false);
+        if (!p->sa || !p->sb) { fprintf(stderr, "connect failed at pair %d\n", i); return 1; }
+        p2p_sim_signal(p->sa, p->sb, g_signal_ms);
+        p->start_ms = p2p_sim_tick_us() / 1000;
+        p->connect_ms = -1;
+    }
+
+    int connected = 0, done = 0;
+    uint64_t elapsed = 0;
+    while (elapsed < (uint64_t)g_duration_ms && done < g_pairs) {
+        p2p_sim_run(hdls, g_pairs * 2, SIM_SLICE_MS);
+        uint64_t now = p2p_sim_tick_us() / 1000;
+        elapsed = now - v0;
+
+        for (int i = 0; i < g_pairs; i++) {
+            sim_pair_t *p = &pairs[i];
+            if (p->done_ms) continue;
+            if (p->connect_ms < 0) {
+                if (!p2p_is_ready(p->sa) || !p2p_is_ready(p->sb)) continue;
+                p->connect_ms = (int)(now - p->start_ms);
+                p->path = p2p_path(p->sa);
+                connected++;
+            }
+            while (p->sent < g_bytes) {
+                int want = (int)(g_bytes - p->sent < SIM_CHUNK ? g_bytes - p->sent : SIM_CHUNK);
+                int n = p2p_send(p->sa, buf, want);
+                if (n <= 0) break;
+                p->sent += n;
+            }
+            int n;
+            uint8_t rx[SIM_CHUNK];
+            while ((n = p2p_recv(p->sb, rx, sizeof(rx))) > 0) p->got += n;
+            if (p->got >= g_bytes) { p->done_ms = now; done++; }
+        }
+    }
+    uint64_t wall = wall_us() - w0;
+
+    int *ct = (int*)malloc(sizeof(int) * (size_t)(connected ? connected : 1));
+    int n_ct = 0, lan = 0, punch = 0, other = 0;
+    uint64_t t_first = 0, t_last = 0;
+    long long total = 0;
+    for (int i = 0; i < g_pairs; i++) {
+        sim_pair_t *p = &pairs[i];
+        if (p->connect_ms < 0) continue;
+        ct[n_ct++] = p->connect_ms;
+        if (p->path == P2P_PATH_LAN) lan++;
+        else if (p->path == P2P_PATH_PUNCH) punch++;
+        else other++;
+        if (!p->done_ms) continue;
+        total += p->got;
+        uint64_t t0 = p->start_ms + (uint64_t)p->connect_ms;
+        if (!t_first || t0 < t_first) t_first = t0;
+        if (p->done_ms > t_last) t_last = p->done_ms;
+    }
+    qsort(ct, (size_t)n_ct, sizeof(int), cmp_int);
+    int p50 = n_ct ? ct[n_ct / 2] : 0, p90 = n_ct ? ct[n_ct * 90 / 100] : 0, p99 = n_ct ? ct[n_ct * 99 / 100] : 0;
+    double span = t_last > t_first ? (double)(t_last - t_first) / 1000.0 : 0;
+    double mbps = span > 0 ? (double)total / (1024.0 * 1024.0) / span : 0;
+    double speedup = wall ? (double)elapsed * 1000.0 / (double)wall : 0;
+    bool ok = (double)connected >= g_min_ok * g_pairs;
+
+    p2p_sim_stats_t st;
+    p2p_sim_get_stats(&st);
+    fprintf(g_out, "{\"pairs\":%d,\"nat\":\"%s\",\"loss\":%.3f,\"delay_ms\":%d,\"jitter_ms\":%d,\"seed\":%llu,"
+                   "\"connected\":%d,\"lan\":%d,\"punch\":%d,\"other\":%d,"
+                   "\"connect_p50_ms\":%d,\"connect_p90_ms\":%d,\"connect_p99_ms\":%d,"
+                   "\"transferred\":%d,\"mbps\":%.2f,\"virtual_ms\":%llu,\"wall_ms\":%llu,\"speedup\":%.2f,"
+                   "\"pkts\":%llu,\"delivered\":%llu,\"lost\":%llu,\"filtered\":%llu,\"unreachable\":%llu,\"ok\":%s}\n",
+            g_pairs, nat_arg, g_loss, g_delay_ms, g_jitter_ms, (unsigned long long)g_seed,
+            connected, lan, punch, other, p50, p90, p99,
+            done, mbps, (unsigned long long)elapsed, (unsigned long long)(wall / 1000), speedup,
+            (unsigned long long)st.sent, (unsigned long long)st.delivered, (unsigned long long)st.lost,
+            (unsigned long long)st.filtered, (unsigned long long)st.unreachable, ok ? "true" : "false");
+    fflush(g_out);
+    fprintf(stderr, "  %d/%d connected (lan=%d punch=%d other=%d), %d transferred, %llums virtual in %llums wall (x%.1f)\n",
+            connected, g_pairs, lan, punch, other, done,
+            (unsigned long long)elapsed, (unsigned long long)(wall / 1000), speedup);
+
+    for (int i = 0; i < g_pairs * 2; i++) if (hdls[i]) p2p_destroy(hdls[i]);
+    p2p_sim_reset(g_seed);
+    free(ct); free(buf); free(hdls); free(pairs);
+    if (g_out != stdout) fclose(g_out);
+    return ok ? 0 : 1;
+}
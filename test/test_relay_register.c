@@ -93,6 +93,14 @@
  *     - 两次都收到 SYNC0_ACK
  *     - session_id 相同
  *
+ * 测试 10: mux_logins
+ *   目标：验证一条连接承载多个登录（P2P_RLY_MUX）
+ *   方法：0 号登录上线后 SELECT 1 上线第二个名字，两个登录互相 SYNC0
+ *   预期：
+ *     - ONLINE_ACK 通告 P2P_RLY_FEATURE_MUX
+ *     - 1 号登录的回复前有 SELECT 1
+ *     - 后 SYNC0 的一方收到 online=1
+ *
  * ============================================================================
  * 依赖与用法
  * ============================================================================
@@ -881,6 +889,98 @@ static void test_sync0_duplicate(void) {
     }
 }
 
+// 构造 MUX 包
+// payload: [login(2)][op(1)]
+static int build_mux(uint8_t *buf, uint16_t login, uint8_t op) {
+    buf[0] = P2P_RLY_MUX;
+    buf[1] = 0;
+    buf[2] = P2P_RLY_MUX_PSZ;
+    buf[3] = (login >> 8) & 0xFF;
+    buf[4] = login & 0xFF;
+    buf[5] = op;
+    return 3 + P2P_RLY_MUX_PSZ;
+}
+
+// 测试 10: 一条连接承载两个登录
+static void test_mux_logins(void) {
+    const char *TEST_NAME = "mux_logins";
+    printf("\n--- Test: %s ---\n", TEST_NAME);
+    clear_logs();
+    
+    sock_t sock = tcp_connect();
+    if (sock == P_INVALID_SOCKET) {
+        TEST_FAIL(TEST_NAME, "failed to connect");
+        return;
+    }
+    
+    uint32_t inst_id = (uint32_t)P_tick_us() + 10000;
+    
+    // 0 号登录（连接本身）按普通方式上线，ONLINE_ACK 应通告 MUX
+    online_ack_t online_ack;
+    if (send_online_recv_ack(sock, "mux_alice", inst_id, &online_ack) <= 0) {
+        P_sock_close(sock);
+        TEST_FAIL(TEST_NAME, "login 0 ONLINE failed");
+        return;
+    }
+    if (!(online_ack.features & P2P_RLY_FEATURE_MUX)) {
+        P_sock_close(sock);
+        TEST_FAIL(TEST_NAME, "server does not advertise MUX");
+        return;
+    }
+    
+    // SELECT 1 + ONLINE：服务器先回 SELECT 1，再回 1 号登录的 ONLINE_ACK
+    uint8_t pkt[64];
+    int pkt_len = build_mux(pkt, 1, P2P_RLY_MUX_SELECT);
+    pkt_len += build_online(pkt + pkt_len, sizeof(pkt) - pkt_len, "mux_bob", inst_id + 1);
+    if (tcp_send_all(sock, pkt, pkt_len) != pkt_len) {
+        P_sock_close(sock);
+        TEST_FAIL(TEST_NAME, "send login 1 ONLINE failed");
+        return;
+    }
+    uint8_t recv_buf[64]; uint8_t type; uint16_t payload_len;
+    if (tcp_recv_relay_packet(sock, recv_buf, sizeof(recv_buf), &type, &payload_len) < 0 ||
+        type != P2P_RLY_MUX || recv_buf[4] != 1 || recv_buf[5] != P2P_RLY_MUX_SELECT) {
+        P_sock_close(sock);
+        TEST_FAIL(TEST_NAME, "expected SELECT 1 before login 1 ONLINE_ACK");
+        return;
+    }
+    if (tcp_recv_relay_packet(sock, recv_buf, sizeof(recv_buf), &type, &payload_len) < 0 ||
+        type != P2P_RLY_ONLINE_ACK) {
+        P_sock_close(sock);
+        TEST_FAIL(TEST_NAME, "no ONLINE_ACK for login 1");
+        return;
+    }
+    
+    // 0 号登录 SYNC0 等待 1 号登录（对端尚未 SYNC0）
+    sync0_ack_t alice_ack;
+    pkt_len = build_mux(pkt, 0, P2P_RLY_MUX_SELECT);
+    tcp_send_all(sock, pkt, pkt_len);
+    if (send_sync0_recv_ack(sock, "mux_bob", 0, NULL, &alice_ack) <= 0 || alice_ack.online != 0) {
+        P_sock_close(sock);
+        TEST_FAIL(TEST_NAME, "login 0 SYNC0 failed");
+        return;
+    }
+    
+    // 1 号登录 SYNC0 等待 0 号登录：同一连接上的两个登录配对成功
+    sync0_ack_t bob_ack;
+    pkt_len = build_mux(pkt, 1, P2P_RLY_MUX_SELECT);
+    tcp_send_all(sock, pkt, pkt_len);
+    if (send_sync0_recv_ack(sock, "mux_alice", 0, NULL, &bob_ack) <= 0 || bob_ack.online != 1) {
+        P_sock_close(sock);
+        TEST_FAIL(TEST_NAME, "login 1 SYNC0 should see login 0 online");
+        return;
+    }
+    
+    P_sock_close(sock);
+    
+    if (find_log("mux_bob' came online") < 0) {
+        TEST_FAIL(TEST_NAME, "server log missing login 1 'came online'");
+        return;
+    }
+    
+    TEST_PASS(TEST_NAME);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // 主函数
 ///////////////////////////////////////////////////////////////////////////////
@@ -951,6 +1051,7 @@ int main(int argc, char *argv[]) {
     // 三、边界/临界态测试
     test_online_reconnect();
     test_sync0_duplicate();
+    test_mux_logins();
     
     // 终止 server
     if (g_server_pid > 0) {
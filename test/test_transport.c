@@ -11,8 +11,13 @@
 #include "../src/p2p_internal.h"
 #include "../src/p2p_stream.h"
 #include "../src/p2p_udp.h"
+#include "../src/p2p_lz.h"
+#ifdef P2P_THREADED
+#include "../src/p2p_thread.h"
+#endif
 #ifndef _WIN32
 #include <sys/socket.h>
+#include <poll.h>
 #include <netinet/in.h>
 #endif
 
@@ -99,7 +104,10 @@ struct p2p_session *create_mock_session(void) {
     s->state = P2P_STATE_CONNECTED;
     
     // 初始化 stream (nagle=0)
-    stream_init(&s->stream, 0);
+    stream_init(&s->stream, 0, 0, 0, 0);
+    s->stream_cnt = 1;
+    p2p_timer_node_init(&s->timer);
+    dgram_init(&s->dgram);
     
     // 初始化 reliable
     reliable_init(s);
@@ -108,6 +116,9 @@ struct p2p_session *create_mock_session(void) {
 }
 
 void destroy_mock_session(struct p2p_session *s) {
+    reliable_free(s);
+    stream_free(&s->stream);
+    dgram_free(&s->dgram);
     free(s->inst->socks);
     free(s->inst);
     free(s);
@@ -138,19 +149,19 @@ TEST(reliable_send_recv) {
     ASSERT_EQ(s->reliable.send_buf[0].seq, 0);
     
     // 测试接收方向：模拟收到数据包
-    uint8_t pkt[100];
+    uint8_t pkt[100] = {0};
     memcpy(pkt + 5, test_data, len);  // 跳过 DATA 头（5字节）
     reliable_on_data(s, 0, pkt, len + 5);
     
-    // 验证数据进入接收缓冲区
-    ASSERT_EQ(s->reliable.recv_bitmap[0], 1);
+    // 无空洞的按序包直接进入 stream 接收缓冲区，不占用重排槽位
+    ASSERT_EQ(s->reliable.recv_bitmap[0], 0);
+    ASSERT_EQ(s->reliable.recv_base, 1);
     
-    // 从 reliable 读取数据
+    // 从 stream 读取数据
     uint8_t recv_buf[100];
-    int recv_len;
-    int ret = reliable_recv_pkt(s, recv_buf, &recv_len);
-    ASSERT_EQ(ret, 0);
-    ASSERT_EQ(recv_len, len + 5);
+    int recv_len = stream_read(&s->stream, recv_buf, sizeof(recv_buf));
+    ASSERT_EQ(recv_len, len);
+    ASSERT_EQ(memcmp(recv_buf, test_data, len), 0);
     
     destroy_mock_session(s);
 }
@@ -181,48 +192,613 @@ TEST(reliable_recv_order) {
     mock_reset();
     struct p2p_session *s = create_mock_session();
     
-    // 模拟接收乱序的包
-    uint8_t pkt1[20], pkt2[20], pkt3[20];
-    memcpy(pkt1, "Packet 1", 9);
-    memcpy(pkt2, "Packet 2", 9);
-    memcpy(pkt3, "Packet 3", 9);
+    // 模拟接收乱序的包（DATA 子头 + 8 字节载荷）
+    uint8_t pkt1[13] = {0}, pkt2[13] = {0}, pkt3[13] = {0};
+    memcpy(pkt1 + 5, "Packet 1", 8);
+    memcpy(pkt2 + 5, "Packet 2", 8);
+    memcpy(pkt3 + 5, "Packet 3", 8);
     
     // 先收到 seq=1 和 seq=2，seq=0 丢失
-    reliable_on_data(s, 1, pkt2, 9);
-    reliable_on_data(s, 2, pkt3, 9);
+    reliable_on_data(s, 1, pkt2, 13);
+    reliable_on_data(s, 2, pkt3, 13);
     
-    // 尝试读取，应该读不到（等待 seq=0）
+    // 乱序包暂存重排槽位，尚无按序数据
     uint8_t buf[100];
-    int len;
-    int ret = reliable_recv_pkt(s, buf, &len);
-    ASSERT_EQ(ret, -1);  // 没有按序的包
-    
-    // 收到 seq=0
-    reliable_on_data(s, 0, pkt1, 9);
+    ASSERT_EQ(stream_feed_from_reliable(s), 0);
+    ASSERT_EQ(stream_read(&s->stream, buf, sizeof(buf)), 0);
+    ASSERT_EQ(s->inst->rel_pool.used, 2);
     
-    // 现在应该能按序读出 3 个包
-    ret = reliable_recv_pkt(s, buf, &len);
-    ASSERT_EQ(ret, 0);
-    ASSERT_EQ(memcmp(buf, "Packet 1", 8), 0);
-    
-    ret = reliable_recv_pkt(s, buf, &len);
-    ASSERT_EQ(ret, 0);
-    ASSERT_EQ(memcmp(buf, "Packet 2", 8), 0);
+    // 收到 seq=0：直接投递，随后按序交付暂存的 seq=1/2
+    reliable_on_data(s, 0, pkt1, 13);
+    ASSERT_EQ(stream_feed_from_reliable(s), 16);
     
-    ret = reliable_recv_pkt(s, buf, &len);
-    ASSERT_EQ(ret, 0);
-    ASSERT_EQ(memcmp(buf, "Packet 3", 8), 0);
+    ASSERT_EQ(stream_read(&s->stream, buf, sizeof(buf)), 24);
+    ASSERT_EQ(memcmp(buf, "Packet 1Packet 2Packet 3", 24), 0);
+    ASSERT_EQ(s->inst->rel_pool.used, 0);  // 交付后缓冲区归还池
     
     destroy_mock_session(s);
 }
 
+/* 多流：共用序列号空间，一条流的空洞不阻塞其他流已到达的数据；flush 在各流间轮转 */
+static void mock_add_stream(struct p2p_session *s) {
+    s->xstreams = calloc(1, sizeof(stream_t));
+    stream_init(&s->xstreams[0], 0, 0, 0, 0);
+    s->xstreams[0].sid = 1;
+    s->stream_cnt = 2;
+}
+
+static void mock_free_stream(struct p2p_session *s) {
+    stream_free(&s->xstreams[0]);
+    free(s->xstreams);
+    s->xstreams = NULL;
+    s->stream_cnt = 1;
+}
+
+TEST(reliable_multi_stream_hol) {
+    mock_reset();
+    struct p2p_session *tx = create_mock_session();
+    struct p2p_session *rx = create_mock_session();
+    mock_add_stream(tx);
+    mock_add_stream(rx);
+
+    // 0 号流两包、1 号流一包：轮转交织为 s0, s1, s0
+    static char big[P2P_STREAM_PAYLOAD + 8];
+    memset(big, 'A', sizeof(big));
+    stream_write(&tx->stream, big, sizeof(big));
+    stream_write(&tx->xstreams[0], "stream-1", 8);
+    ASSERT_EQ(stream_flush_to_reliable(tx), (int)sizeof(big) + 8);
+    ASSERT_EQ(tx->reliable.send_count, 3);
+    ASSERT_EQ(tx->reliable.send_buf[0].data[4] & P2P_FRAG_SID, 0);
+    ASSERT_EQ(tx->reliable.send_buf[1].data[4] & P2P_FRAG_SID, P2P_FRAG_SID);
+    ASSERT_EQ(tx->reliable.send_buf[1].data[5], 1);
+    ASSERT_EQ(tx->reliable.send_buf[1].len, P2P_DATA_SID_HDR_SIZE + 8);
+    ASSERT_EQ(tx->reliable.send_buf[2].data[4] & P2P_FRAG_SID, 0);
+
+    // seq=0（0 号流）丢失：1 号流的 seq=1 越过空洞直接交付，0 号流的 seq=2 仍等待重排
+    uint8_t buf[P2P_STREAM_PAYLOAD * 2];
+    reliable_on_data(rx, 1, tx->reliable.send_buf[1].data, tx->reliable.send_buf[1].len);
+    reliable_on_data(rx, 2, tx->reliable.send_buf[2].data, tx->reliable.send_buf[2].len);
+    ASSERT_EQ(stream_read(&rx->xstreams[0], buf, sizeof(buf)), 8);
+    ASSERT_EQ(memcmp(buf, "stream-1", 8), 0);
+    ASSERT_EQ(stream_read(&rx->stream, buf, sizeof(buf)), 0);
+    ASSERT_EQ(rx->inst->rel_pool.used, 1);
+
+    // seq=0 重传到达：按序交付并越过已提前交付的 seq=1
+    reliable_on_data(rx, 0, tx->reliable.send_buf[0].data, tx->reliable.send_buf[0].len);
+    stream_feed_from_reliable(rx);
+    ASSERT_EQ(stream_read(&rx->stream, buf, sizeof(buf)), (int)sizeof(big));
+    ASSERT_EQ(rx->reliable.recv_base, 3);
+    ASSERT_EQ(rx->inst->rel_pool.used, 0);
+
+    mock_free_stream(tx);
+    mock_free_stream(rx);
+    destroy_mock_session(tx);
+    destroy_mock_session(rx);
+}
+
+/* 32 位序列号：跨越线上 16 位回绕点收发，线上序列号相对 recv_base / send_base 还原；旧包与越界 ACK 被拒绝 */
+TEST(reliable_seq_wrap) {
+    mock_reset();
+    struct p2p_session *tx = create_mock_session();
+    struct p2p_session *rx = create_mock_session();
+    const uint32_t base = 0xFFFA;
+    tx->reliable.send_seq = tx->reliable.send_base = tx->reliable.high_end = base;
+    rx->reliable.recv_base = rx->reliable.recv_next = base;
+
+    static char big[P2P_STREAM_PAYLOAD * 12];
+    memset(big, 'W', sizeof(big));
+    stream_write(&tx->stream, big, sizeof(big));
+    stream_flush_to_reliable(tx);
+    ASSERT_EQ(tx->reliable.send_count, 12);
+    ASSERT_EQ(tx->reliable.send_seq, base + 12);
+
+    // 除第 8 个（线上 seq=0x0002）外全部到达：recv_base 越过 0xFFFF 进位到 0x10002
+    for (int i = 0; i < 12; i++) { retx_entry_t *e = &tx->reliable.send_buf[(base + i) & (tx->reliable.window - 1)];
+        if (i != 8) reliable_on_data(rx, (uint16_t)e->seq, e->data, e->len);
+    }
+    ASSERT_EQ(rx->reliable.recv_base, 0x10002u);
+    ASSERT(reliable_recv_has(rx, 0x0003));
+    ASSERT(!reliable_recv_has(rx, 0x0002));
+    retx_entry_t *gap = &tx->reliable.send_buf[(base + 8) & (tx->reliable.window - 1)];
+    reliable_on_data(rx, (uint16_t)gap->seq, gap->data, gap->len);
+    stream_feed_from_reliable(rx);
+    ASSERT_EQ(rx->reliable.recv_base, base + 12);
+
+    // 滞留的旧包：刚交付过的（还原到 recv_base 之前）与约 40000 包之前的（还原后超出窗口）均被丢弃
+    uint8_t junk[16] = {0};
+    ASSERT(reliable_recv_has(rx, (uint16_t)(base + 1)));
+    ASSERT_EQ(reliable_on_data(rx, (uint16_t)(base + 1), junk, sizeof(junk)), 0);
+    ASSERT_EQ(reliable_on_data(rx, (uint16_t)(base + 12 - 40000), junk, sizeof(junk)), 0);
+    ASSERT_EQ(rx->reliable.recv_base, base + 12);
+
+    // 累积 ACK 线上为 16 位：相对 send_base 还原；超出 send_seq 的 ACK 整体丢弃
+    uint64_t now = P_tick_ms();
+    reliable_on_ack(tx, 0x0002, 0, now);
+    ASSERT_EQ(tx->reliable.send_base, 0x10002u);
+    ASSERT_EQ(tx->reliable.send_count, 4);
+    ASSERT_EQ(reliable_on_ack(tx, 0x0100, 0, now), -1);
+    ASSERT_EQ(tx->reliable.send_base, 0x10002u);
+    reliable_on_ack(tx, (uint16_t)(base + 12), 0, now);
+    ASSERT_EQ(tx->reliable.send_count, 0);
+
+    destroy_mock_session(tx);
+    destroy_mock_session(rx);
+}
+
+TEST(reliable_window_negotiate) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+
+    // 本地配置 200 → 取整为 256，对端通告 128 + EXT_SACK
+    s->inst->cfg.reliable_window = 200;
+    ASSERT_EQ(reliable_init(s), E_NONE);
+    ASSERT_EQ(s->reliable.window, 256);
+    ASSERT_EQ(reliable_window_avail(s), RELIABLE_WINDOW);  // 协商前按旧版窗口
+
+    uint8_t caps[3] = { RELIABLE_CAP_EXT_SACK, 0x00, 0x80 };
+    reliable_on_caps(s, caps, sizeof(caps));
+    ASSERT_EQ(s->reliable.send_window, 128);
+    ASSERT(s->reliable.ext_sack);
+
+    uint8_t data[100];
+    for (int i = 0; i < 128; i++)
+        ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), -1);
+
+    // 区段 SACK：[1][start=60 count=20]，位图之外的包也被确认
+    uint8_t ranges[5] = { 1, 0, 60, 0, 20 };
+    reliable_on_sack_ranges(s, ranges, sizeof(ranges), P_tick_ms());
+    ASSERT_EQ(s->reliable.send_count, 108);
+
+    // SACK 空洞不释放窗口，累积 ACK 推进后才释放
+    ASSERT_EQ(reliable_window_avail(s), 0);
+    reliable_on_ack(s, 80, 0, P_tick_ms());
+    ASSERT_EQ(reliable_window_avail(s), 80);
+    ASSERT_EQ(s->reliable.send_count, 48);
+
+    // 已确认包的缓冲区归还池，仅在途包占用
+    ASSERT_EQ(s->inst->rel_pool.used, 48);
+    reliable_init(s);
+    ASSERT_EQ(s->inst->rel_pool.used, 0);
+
+    destroy_mock_session(s);
+}
+
+/* 接收窗口：超出 recv_ring 空间的包不确认；发送方按 rwnd 限制新包，窗口关闭后按 RTO 探测 */
+TEST(reliable_receive_window) {
+    mock_reset();
+    struct p2p_session *rx = create_mock_session();
+    stream_free(&rx->stream);
+    ASSERT_EQ(stream_init(&rx->stream, 0, 4096, 4096, 4096), E_NONE);
+    uint8_t caps[5] = { RELIABLE_CAP_EXT_SACK | RELIABLE_CAP_RWND, 0x00, 0x20, 1, 10 };
+    reliable_on_caps(rx, caps, sizeof(caps));
+    ASSERT(rx->reliable.ext_rwnd);
+
+    static char fill[3000];
+    ASSERT_EQ(ring_write(&rx->stream.recv_ring, fill, sizeof(fill)), 3000);
+    ASSERT_EQ(reliable_recv_window(rx), 4095 - 3000);
+
+    // 乱序包放得下（暂存重排槽位），第二个乱序包超出：丢弃且不确认
+    uint8_t pkt[1000] = {0};
+    ASSERT_EQ(reliable_on_data(rx, 1, pkt, sizeof(pkt)), 1);
+    ASSERT_EQ(reliable_on_data(rx, 2, pkt, sizeof(pkt)), 0);
+    ASSERT_EQ(rx->reliable.recv_bitmap[2], 0);
+    ASSERT_EQ(reliable_recv_window(rx), 4095 - 3000);   // 乱序包已计入发送方在途，不重复扣除
+
+    // 填补空洞：seq=0 直接写入 recv_ring，seq=1 成为按序暂留包，从窗口中扣除
+    ASSERT_EQ(reliable_on_data(rx, 0, pkt, sizeof(pkt)), 1);
+    ASSERT_EQ(ring_used(&rx->stream.recv_ring), 3000 + 995);
+    ASSERT_EQ(reliable_recv_peek(rx), (int)sizeof(pkt));
+    ASSERT_EQ(reliable_recv_window(rx), 0);
+    destroy_mock_session(rx);
+
+    mock_reset();
+    struct p2p_session *tx = create_mock_session();
+    reliable_on_caps(tx, caps, sizeof(caps));
+    ASSERT_EQ(reliable_rwnd_avail(tx), RELIABLE_RWND_INIT);
+
+    // 通告 2500 字节：3 个 1000 字节包只发出 2 个
+    reliable_on_rwnd(tx, 2500);
+    for (int i = 0; i < 3; i++) ASSERT_EQ(reliable_send_pkt(tx, pkt, sizeof(pkt)), 0);
+    reliable_tick(tx);
+    ASSERT_EQ(reliable_inflight_bytes(tx), 2000);
+    ASSERT(tx->reliable.rwnd_blocked);
+    ASSERT_EQ(reliable_rwnd_avail(tx), 500);
+
+    // 全部确认且窗口关闭：不再发送，按 RTO 等待零窗口探测
+    uint64_t now = P_tick_ms();
+    reliable_on_ack(tx, 2, 0, now);
+    reliable_on_rwnd(tx, 0);
+    reliable_tick(tx);
+    ASSERT_EQ(tx->reliable.send_buf[2].send_time, 0);
+    int t = reliable_next_timeout(tx, P_tick_ms());
+    ASSERT(t > 0 && t <= tx->reliable.rto);
+
+    tx->reliable.persist_ts -= tx->reliable.rto;
+    reliable_tick(tx);
+    ASSERT_EQ(reliable_inflight_bytes(tx), 1000);
+    ASSERT_EQ(tx->reliable.send_buf[2].retx_count, 0);
+
+    destroy_mock_session(tx);
+}
+
+/* 优先级类别：高优先级流先排空，普通/批量流按 P2P_PRIO_WEIGHT:1 轮转；高优先级包越过先排队的包先发出 */
+TEST(stream_priority_classes) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    s->xstreams = calloc(2, sizeof(stream_t));
+    for (int i = 0; i < 2; i++) {
+        stream_init(&s->xstreams[i], 0, 0, 0, 0);
+        s->xstreams[i].sid = i + 1;
+    }
+    s->stream_cnt = 3;
+    s->xstreams[0].prio = P2P_PRIO_HIGH;
+    s->xstreams[1].prio = P2P_PRIO_BULK;
+
+    // 0 号流（普通）6 包、1 号流（高）2 包、2 号流（批量）3 包
+    static char big[P2P_STREAM_PAYLOAD * 6];
+    memset(big, 'A', sizeof(big));
+    const int sid_mss = P2P_MAX_PAYLOAD - P2P_DATA_SID_HDR_SIZE;
+    stream_write(&s->stream, big, P2P_STREAM_PAYLOAD * 6);
+    stream_write(&s->xstreams[0], big, sid_mss * 2);
+    stream_write(&s->xstreams[1], big, sid_mss * 3);
+    ASSERT_EQ(stream_flush_to_reliable(s), P2P_STREAM_PAYLOAD * 6 + sid_mss * 5);
+    ASSERT_EQ(s->reliable.send_count, 11);
+
+    static const int order[11] = { 1, 1, 0, 0, 0, 0, 2, 0, 0, 2, 2 };
+    for (int i = 0; i < 11; i++) {
+        const retx_entry_t *e = &s->reliable.send_buf[i];
+        int sid = (e->data[4] & P2P_FRAG_SID) ? e->data[5] : 0;
+        ASSERT_EQ(sid, order[i]);
+        ASSERT_EQ(e->prio == P2P_PRIO_HIGH, sid == 1);
+    }
+    ASSERT_EQ(s->reliable.high_end, 2);
+    mock_free_stream(s);
+    destroy_mock_session(s);
+
+    // 单流：先排队的普通包因接收窗口未发出，随后的高优先级包优先取得窗口
+    s = create_mock_session();
+    uint8_t caps[5] = { RELIABLE_CAP_EXT_SACK | RELIABLE_CAP_RWND, 0x00, 0x20, 1, 10 };
+    reliable_on_caps(s, caps, sizeof(caps));
+    reliable_on_rwnd(s, 0);
+    stream_write(&s->stream, big, P2P_STREAM_PAYLOAD * 2);
+    ASSERT_EQ(stream_flush_to_reliable(s), P2P_STREAM_PAYLOAD * 2);
+    ASSERT_EQ(p2p_stream_priority((p2p_session_t)s, 0, P2P_PRIO_HIGH), 0);
+    ASSERT_EQ(p2p_stream_priority((p2p_session_t)s, 0, 3), -1);
+    ASSERT_EQ(p2p_stream_priority((p2p_session_t)s, 1, P2P_PRIO_HIGH), -1);
+    stream_write(&s->stream, "urgent", 6);
+    ASSERT_EQ(stream_flush_to_reliable(s), 6);
+    ASSERT_EQ(s->reliable.send_buf[2].prio, P2P_PRIO_HIGH);
+
+    reliable_on_rwnd(s, P2P_STREAM_PAYLOAD);
+    reliable_tick(s);
+    ASSERT(s->reliable.send_buf[2].send_time > 0);
+    ASSERT_EQ(s->reliable.send_buf[0].send_time, 0);
+    ASSERT_EQ(s->reliable.send_buf[1].send_time, 0);
+    destroy_mock_session(s);
+}
+
+TEST(reliable_rack_loss) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+
+    // 3 个包在同一时刻发出（模拟 tick 已发送）
+    uint8_t data[100];
+    uint64_t now = P_tick_ms();
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+        retx_entry_t *e = &s->reliable.send_buf[i];
+        e->send_time = now - 100;
+        e->rto = 1000;
+        e->retx_count = 0;
+        reliable_on_sent(&s->reliable, e);
+    }
+
+    // seq=0 丢失，seq=1/2 经 SACK 确认
+    reliable_on_ack(s, 0, 0x3, now);
+    ASSERT_EQ(s->reliable.send_count, 1);
+    ASSERT_EQ(s->reliable.rack_seq, 2);
+
+    // 未超过 rack_rtt + reo_wnd：等待乱序窗口，而非等待 RTO
+    int t = reliable_next_timeout(s, now);
+    ASSERT(t > 0 && t <= RELIABLE_REO_WND_MIN);
+
+    // 超过乱序窗口：判定丢失，需立即重传
+    s->reliable.send_buf[0].send_time = now - 100 - RELIABLE_REO_WND_MIN;
+    ASSERT_EQ(reliable_next_timeout(s, now), 0);
+    ASSERT_EQ(s->reliable.rto, RELIABLE_RTO_INIT);  // 共享 RTO 未被退避
+
+    destroy_mock_session(s);
+}
+
+/* 尾部丢失：约 2×SRTT 无 ACK 时重发最后一个包一次，不退避 RTO；初始 RTO 可按会话调整 */
+TEST(reliable_tail_loss_probe) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+
+    uint8_t data[100] = {0};
+    for (int i = 0; i < 3; i++) ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    reliable_tick(s);
+    uint64_t now = P_tick_ms();
+    for (int i = 0; i < 3; i++) s->reliable.send_buf[i].send_time = now - 60;
+
+    // seq=0 确认（RTT 10ms），seq=1/2 丢失：20ms 后无新确认，探测到期
+    reliable_on_ack(s, 1, 0, now - 50);
+    ASSERT_EQ(s->reliable.srtt, 10);
+    int rto = s->reliable.rto;
+    ASSERT_EQ(reliable_next_timeout(s, now), 0);
+
+    uint64_t retx = s->stat.retransmits;
+    reliable_tick(s);
+    ASSERT_EQ(s->stat.retransmits, retx + 1);
+    retx_entry_t *e = &s->reliable.send_buf[2];
+    ASSERT_EQ(e->retx_count, 1);
+    ASSERT_EQ(e->rto, RELIABLE_RTO_INIT);               // 不退避
+    ASSERT_EQ(s->reliable.rto, rto);
+    ASSERT_EQ(s->reliable.send_buf[1].retx_count, 0);   // 只重发最后一个包
+
+    // 新确认到达前不再探测
+    retx = s->stat.retransmits;
+    reliable_tick(s);
+    ASSERT_EQ(s->stat.retransmits, retx);
+    ASSERT(reliable_next_timeout(s, now) > 0);
+
+    // 探测包被确认后重新允许探测；关闭后不探测
+    reliable_on_ack(s, 1, 0x1, now);
+    ASSERT(!s->reliable.tlp_out);
+    ASSERT_EQ(p2p_tune_set(NULL, s, P2P_TUNE_TLP, 0), 0);
+    s->reliable.send_buf[1].send_time = now - 50;       // 晚于 RACK 参考包，不会被快速重传
+    s->reliable.ack_rx_ts = now - 100;
+    retx = s->stat.retransmits;
+    reliable_tick_cwnd(s, 0);
+    ASSERT_EQ(s->stat.retransmits, retx);
+    ASSERT_EQ(s->reliable.send_buf[1].retx_count, 0);
+
+    // 初始 RTO：按会话调参，限制在 RTO 上限内
+    ASSERT_EQ(p2p_tune_set(NULL, s, P2P_TUNE_RTO_INIT_MS, 1000), 0);
+    ASSERT_EQ(reliable_init(s), E_NONE);
+    ASSERT_EQ(s->reliable.rto, 1000);
+    ASSERT_EQ(p2p_tune_set(NULL, s, P2P_TUNE_RTO_INIT_MS, 5000), 0);
+    ASSERT_EQ(reliable_init(s), E_NONE);
+    ASSERT_EQ(s->reliable.rto, RELIABLE_RTO_MAX);
+
+    destroy_mock_session(s);
+}
+
+/* 在途包索引：堆顶为最早到期的包，确认后移出；tick 只重传到期的条目 */
+TEST(reliable_retx_index) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    reliable_t *r = &s->reliable;
+    p2p_tune_set(NULL, s, P2P_TUNE_TLP, 0);
+
+    uint8_t data[100] = {0};
+    for (int i = 0; i < 20; i++) ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    ASSERT_EQ(reliable_unsent_first(s), 0u);
+    reliable_tick(s);
+    ASSERT_EQ(reliable_unsent_first(s), 20u);
+    ASSERT_EQ(r->retx_heap_cnt, 20);
+    ASSERT_EQ(reliable_inflight_bytes(s), 20 * (int)sizeof(data));
+
+    // 累积确认 0..4 + SACK 6/8：移出索引，堆与发送顺序链表保持一致
+    uint64_t now = P_tick_ms();
+    reliable_on_ack(s, 5, 0x5, now);
+    ASSERT_EQ(r->send_count, 13);
+    ASSERT_EQ(r->retx_heap_cnt, 13);
+    ASSERT_EQ(r->send_buf[r->sent_head - 1].seq, 5u);
+    ASSERT_EQ(reliable_inflight_bytes(s), 13 * (int)sizeof(data));
+    for (int i = 1; i < r->retx_heap_cnt; i++)
+        ASSERT(r->send_buf[r->retx_heap[(i - 1) / 2]].due <= r->send_buf[r->retx_heap[i]].due);
+
+    // 仅 seq=10 超时：只重传该包，退避后重新入堆、移到发送顺序链表尾部
+    retx_entry_t *e = &r->send_buf[10];
+    e->send_time -= 10000;
+    reliable_retx_update(r, e);
+    ASSERT_EQ(r->retx_heap[0], 10);
+    ASSERT_EQ(reliable_next_timeout(s, P_tick_ms()), 0);
+    uint64_t retx = s->stat.retransmits;
+    reliable_tick(s);
+    ASSERT_EQ(s->stat.retransmits, retx + 1);
+    ASSERT_EQ(e->retx_count, 1);
+    ASSERT_EQ(e->rto, 2 * RELIABLE_RTO_INIT);
+    ASSERT_EQ(r->sent_tail, 11);
+    ASSERT(r->retx_heap[0] != 10);
+    ASSERT(reliable_next_timeout(s, P_tick_ms()) > 0);
+
+    // 全部确认后索引为空
+    reliable_on_ack(s, 20, 0, P_tick_ms());
+    ASSERT_EQ(r->retx_heap_cnt, 0);
+    ASSERT_EQ(r->sent_head, 0);
+    ASSERT_EQ(r->sent_tail, 0);
+
+    destroy_mock_session(s);
+}
+
+/* 交付速率样本写入活跃路径 bandwidth_bps；受应用层限制的低样本不拉低估计 */
+TEST(reliable_delivery_rate) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    s->remote_cands = calloc(1, sizeof(*s->remote_cands));
+    s->remote_cand_cnt = 1;
+    s->active_path = 0;
+    path_stats_t *st = &s->remote_cands[0].stats;
+    path_stats_init(st, 0);
+
+    uint8_t data[100];
+    ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    reliable_tick(s);
+    ASSERT(s->reliable.app_limited != 0);     // 已无待发包
+
+    // 200 字节 / 50ms = 4000 B/s
+    uint64_t now = P_tick_ms();
+    reliable_on_ack(s, 2, 0, now + 50);
+    ASSERT_EQ(s->reliable.rs_rate, 4000);
+    ASSERT(!s->reliable.rs_app_limited);
+    ASSERT_EQ(st->bandwidth_bps, 32000);
+
+    // 空闲后发出的包受应用层限制：速率样本偏低也不更新估计
+    ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    reliable_tick(s);
+    reliable_on_ack(s, 3, 0, now + 1000);
+    ASSERT(s->reliable.rs_app_limited);
+    ASSERT_EQ(st->bandwidth_bps, 32000);
+
+    // 非应用受限的低样本按 1/8 衰减
+    path_manager_on_data_rate(s, 0, 16000, false);
+    ASSERT_EQ(st->bandwidth_bps, 30000);
+
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+
+TEST(reliable_pacing) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    uint64_t now = P_tick_ms();
+
+    // 无 RTT 样本或未启用时不限速
+    ASSERT(reliable_pace_take(s, 1200, now));
+    s->inst->cfg.pacing = P2P_PACING_TOKEN_BUCKET;
+    ASSERT(reliable_pace_take(s, 1200, now));
+
+    // srtt=100ms：速率 = 1.25 * 32 * P2P_MAX_PAYLOAD / 100 ≈ 478 B/ms，桶容量 2 个包
+    s->reliable.srtt = 100;
+    ASSERT(reliable_pace_take(s, 1200, now));
+    ASSERT(reliable_pace_take(s, 1200, now));
+    ASSERT(!reliable_pace_take(s, 1200, now));
+    ASSERT(s->reliable.pace_blocked);
+
+    // 暂停期间给出亚 tick 的等待时长，时间推进后恢复发送
+    int w = reliable_pace_wait(s, now);
+    ASSERT(w > 0 && w < 10);
+    ASSERT(reliable_pace_take(s, 1200, now + w));
+
+    destroy_mock_session(s);
+}
+
+TEST(reliable_rate_limit) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_session *s2 = create_mock_session();
+    struct p2p_instance *inst2 = s2->inst;
+    uint64_t now = P_tick_ms();
+
+    ASSERT_EQ(p2p_set_rate_limit((p2p_session_t)s, -1, 0), -1);
+    ASSERT_EQ(p2p_set_rate_weight((p2p_session_t)s, 0), -1);
+
+    // 100KB/s、桶容量 3000：前 3 个包通过（第 3 个透支），第 4 个暂停
+    ASSERT_EQ(p2p_set_rate_limit((p2p_session_t)s, 100000, 3000), 0);
+    ASSERT(reliable_pace_take(s, 1200, now));
+    ASSERT(reliable_pace_take(s, 1200, now));
+    ASSERT(reliable_pace_take(s, 1200, now));
+    ASSERT(!reliable_pace_take(s, 1200, now));
+    ASSERT(s->reliable.pace_blocked);
+
+    // 欠 600 字节：约 7ms 后补足
+    int w = reliable_pace_wait(s, now);
+    ASSERT(w > 0 && w <= 7);
+    ASSERT(!reliable_pace_take(s, 1200, now + w - 1));
+    ASSERT(reliable_pace_take(s, 1200, now + w));
+
+    // 取消限速后不再暂停
+    ASSERT_EQ(p2p_set_rate_limit((p2p_session_t)s, 0, 0), 0);
+    for (int i = 0; i < 10; i++) ASSERT(reliable_pace_take(s, 1200, now + w));
+
+    // 实例总限速 120KB/s，两个会话按 3:1 分享
+    s2->inst = s->inst;
+    ASSERT_EQ(p2p_set_rate_limit_total((p2p_handle_t)s->inst, 120000, 0), 0);
+    ASSERT_EQ(p2p_set_rate_weight((p2p_session_t)s, 3), 0);
+    uint64_t t = (now / RELIABLE_SHAPE_EPOCH_MS + 1) * RELIABLE_SHAPE_EPOCH_MS;
+    ASSERT(reliable_pace_take(s, 1200, t));
+    ASSERT_EQ(s->shaper.share_rate, 120000);        // 单独发送时独占总速率
+    ASSERT(reliable_pace_take(s2, 1200, t));
+    ASSERT_EQ(s2->shaper.share_rate, 30000);
+    ASSERT(reliable_pace_take(s, 1200, t));
+    ASSERT_EQ(s->shaper.share_rate, 90000);
+
+    // 份额桶（容量为总桶按份额折算）耗尽后暂停，按份额速率给出等待时长
+    while (reliable_pace_take(s, 1200, t)) {}
+    ASSERT(s->reliable.pace_blocked);
+    ASSERT(reliable_pace_wait(s, t) > 0);
+
+    // s2 空闲：下一周期仍按上一周期的权重和计算，再下一周期 s 独占总速率
+    reliable_pace_take(s, 1200, t + RELIABLE_SHAPE_EPOCH_MS);
+    ASSERT_EQ(s->shaper.share_rate, 90000);
+    reliable_pace_take(s, 1200, t + 2 * RELIABLE_SHAPE_EPOCH_MS);
+    ASSERT_EQ(s->shaper.share_rate, 120000);
+
+    // 取消总限速
+    ASSERT_EQ(p2p_set_rate_limit_total((p2p_handle_t)s->inst, 0, 0), 0);
+    ASSERT(reliable_pace_take(s2, 1200, t));
+    ASSERT_EQ(s2->shaper.share_rate, 0);
+
+    s2->inst = inst2;
+    destroy_mock_session(s2);
+    destroy_mock_session(s);
+}
+
+TEST(reliable_ack_frequency) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    uint8_t pkt[20] = {0};
+
+    // 对端请求每 4 个包或 10ms ACK 一次
+    uint8_t caps[5] = { RELIABLE_CAP_EXT_SACK, 0x00, 0x20, 4, 10 };
+    reliable_on_caps(s, caps, sizeof(caps));
+    ASSERT_EQ(s->reliable.ack_freq, 4);
+
+    // 按序 3 个包：延迟 ACK，等待时长不超过 ack_delay
+    for (int i = 0; i < 3; i++) reliable_on_data(s, (uint16_t)i, pkt, sizeof(pkt));
+    ASSERT(!s->reliable.need_ack);
+    int t = reliable_next_timeout(s, P_tick_ms());
+    ASSERT(t >= 0 && t <= 10);
+
+    // 出现空洞（seq=3 丢失）：立即 ACK
+    reliable_on_data(s, 4, pkt, sizeof(pkt));
+    ASSERT(s->reliable.need_ack);
+    ASSERT_EQ(reliable_next_timeout(s, P_tick_ms()), 0);
+
+    destroy_mock_session(s);
+}
+
+TEST(bbr_model) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    s->trans = &p2p_trans_bbr;
+    ASSERT_EQ(s->trans->init(s), 0);
+    ASSERT_EQ(s->bbr.state, BBR_STARTUP);
+
+    // 稳定 1 MB/s、20ms 的交付样本：带宽不再增长 → 满管 → 离开 STARTUP
+    reliable_t *r = &s->reliable;
+    uint64_t now = P_tick_ms();
+    for (int k = 0; k < 8; k++) {
+        r->rs_prior = r->delivered;
+        r->delivered += 20000;
+        r->rs_rate = 1000000;
+        r->rs_rtt = 20;
+        p2p_bbr_on_ack(s, now + (uint64_t)k * 20);
+    }
+    ASSERT(s->bbr.full_pipe);
+    ASSERT_EQ(s->bbr.state, BBR_PROBE_BW);
+    ASSERT_EQ(s->bbr.btl_bw, 1000000);
+    ASSERT_EQ(s->bbr.min_rtt, 20);
+
+    // 窗口收敛到 2 * BDP，速率按增益跟随瓶颈带宽
+    ASSERT_EQ(s->bbr.cwnd, 2 * 1000000 * 20 / 1000);
+    ASSERT_EQ(r->pace_rate, 1000000);
+
+    s->trans->close(s);
+    destroy_mock_session(s);
+}
+
 /* ============================================================================
  * Stream 层测试
  * ============================================================================ */
 
 TEST(stream_write_read) {
     stream_t stream;
-    stream_init(&stream, 0);  // nagle=0
+    stream_init(&stream, 0, 0, 0, 0);  // nagle=0
     
     // 写入数据到发送缓冲区
     const char *data = "Hello, Stream!";
@@ -241,11 +817,13 @@ TEST(stream_write_read) {
     
     ASSERT_EQ(read, len);
     ASSERT_EQ(memcmp(buf, data, len), 0);
+
+    stream_free(&stream);
 }
 
 TEST(stream_ring_buffer_wrap) {
     stream_t stream;
-    stream_init(&stream, 0);  // nagle=0
+    stream_init(&stream, 0, 0, 0, 0);  // nagle=0
     
     // 写入接近满的数据到 recv_ring（模拟接收）
     char large_data[RING_SIZE * 2];
@@ -262,6 +840,8 @@ TEST(stream_ring_buffer_wrap) {
     // 再写入，测试环形缓冲区回绕
     written = ring_write(&stream.recv_ring, large_data, 200);
     ASSERT(written > 0);
+
+    stream_free(&stream);
 }
 
 TEST(stream_flush_fragmentation) {
@@ -285,109 +865,681 @@ TEST(stream_flush_fragmentation) {
     destroy_mock_session(s);
 }
 
-/* 边界测试：空数据 */
-TEST(stream_empty_data) {
-    stream_t stream;
-    stream_init(&stream, 0);
-    
-    // 写入 0 字节
-    int written = stream_write(&stream, "", 0);
-    ASSERT_EQ(written, 0);
-    
-    // 读取应该返回 0
-    char buf[10];
-    int read = stream_read(&stream, buf, sizeof(buf));
-    ASSERT_EQ(read, 0);
-}
+/* 聚集写入：各段首尾相接、一次发布；flush 在可靠层槽位缓冲区内原地组包 */
+TEST(stream_writev_gather) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
 
-/* 边界测试：单字节 */
-TEST(stream_single_byte) {
-    stream_t stream;
-    stream_init(&stream, 0);
-    
-    // 写入 1 字节
-    char data = 'A';
-    ring_write(&stream.recv_ring, &data, 1);
-    
-    // 读取
-    char buf;
-    int read = stream_read(&stream, &buf, 1);
-    ASSERT_EQ(read, 1);
-    ASSERT_EQ(buf, 'A');
+    static char a[1000], b[500];
+    memset(a, 'A', sizeof(a));
+    memset(b, 'B', sizeof(b));
+    p2p_iovec_t iov[3] = { { a, sizeof(a) }, { NULL, 0 }, { b, sizeof(b) } };
+    ASSERT_EQ(stream_writev(&s->stream, iov, 3), 1500);
+    ASSERT_EQ(ring_used(&s->stream.send_ring), 1500);
+
+    ASSERT_EQ(stream_flush_to_reliable(s), 1500);
+    ASSERT_EQ(s->reliable.send_count, 2);
+    ASSERT_EQ(s->inst->rel_pool.used, 2);
+
+    // 首包：段 a 全部 + 段 b 的前 191 字节，跨段边界不切包
+    const uint8_t *pkt = s->reliable.send_buf[0].data;
+    ASSERT_EQ(s->reliable.send_buf[0].len, P2P_MAX_PAYLOAD);
+    ASSERT_EQ(pkt[4], P2P_FRAG_FIRST);
+    ASSERT_EQ(pkt[P2P_DATA_HDR_SIZE + 999], 'A');
+    ASSERT_EQ(pkt[P2P_DATA_HDR_SIZE + 1000], 'B');
+    ASSERT_EQ(s->reliable.send_buf[1].len, P2P_DATA_HDR_SIZE + 1500 - P2P_STREAM_PAYLOAD);
+
+    // 空间不足：只写入可容纳的前缀
+    static char big[RING_SIZE];
+    p2p_iovec_t over[2] = { { big, RING_SIZE - 10 }, { a, sizeof(a) } };
+    ASSERT_EQ(stream_writev(&s->stream, over, 2), RING_SIZE - 1);
+
+    destroy_mock_session(s);
 }
 
-/* 边界测试：正好一个包大小 */
-TEST(stream_exact_packet_size) {
+/* 零拷贝接收：借出连续区段，回绕处分两段返回，归还后空间可复用 */
+TEST(stream_recv_peek_consume) {
     mock_reset();
     struct p2p_session *s = create_mock_session();
-    
-    // 写入正好 P2P_STREAM_PAYLOAD 字节
-    char data[P2P_STREAM_PAYLOAD];
-    memset(data, 'B', sizeof(data));
-    
-    stream_write(&s->stream, data, sizeof(data));
-    int flushed = stream_flush_to_reliable(s);
-    
-    // 应该生成 1 个包
-    ASSERT(flushed == P2P_STREAM_PAYLOAD);
-    ASSERT_EQ(s->reliable.send_count, 1);
-    
+    stream_free(&s->stream);
+    ASSERT_EQ(stream_init(&s->stream, 0, 4096, 4096, 4096), E_NONE);
+
+    const void *ptr;
+    int len;
+    ASSERT_EQ(p2p_recv_peek(s, &ptr, &len), 0);
+    ASSERT(ptr == NULL);
+
+    // 读写指针推进到末尾附近，再写入跨越末尾的数据
+    static char fill[4000], data[200];
+    ring_write(&s->stream.recv_ring, fill, sizeof(fill));
+    ring_skip(&s->stream.recv_ring, sizeof(fill));
+    for (int i = 0; i < (int)sizeof(data); i++) data[i] = (char)i;
+    ASSERT_EQ(ring_write(&s->stream.recv_ring, data, sizeof(data)), 200);
+
+    ASSERT_EQ(p2p_recv_peek(s, &ptr, &len), 96);
+    ASSERT(ptr == s->stream.recv_ring.data + 4000);
+    ASSERT_EQ(memcmp(ptr, data, 96), 0);
+    ASSERT_EQ(p2p_recv_consume(s, 96), 0);
+
+    ASSERT_EQ(p2p_recv_peek(s, &ptr, &len), 104);
+    ASSERT(ptr == s->stream.recv_ring.data);
+    ASSERT_EQ(memcmp(ptr, data + 96, 104), 0);
+    ASSERT_EQ(p2p_recv_consume(s, 4), 0);
+    ASSERT_EQ(ring_used(&s->stream.recv_ring), 100);
+
     destroy_mock_session(s);
 }
 
-/* 边界测试：环形缓冲区完全填满 */
-TEST(ring_buffer_full) {
-    stream_t stream;
-    stream_init(&stream, 0);
-    
-    // 填满整个环形缓冲区（留一个空位）
-    char data[RING_SIZE];
-    memset(data, 'C', sizeof(data));
-    
-    int written = ring_write(&stream.send_ring, data, RING_SIZE - 1);
-    ASSERT_EQ(written, RING_SIZE - 1);
-    
-    // 再写应该失败
-    written = ring_write(&stream.send_ring, "X", 1);
-    ASSERT_EQ(written, 0);
-    
-    // 读取一些数据
-    char buf[100];
-    int read = ring_read(&stream.send_ring, buf, 100);
-    ASSERT_EQ(read, 100);
-    
-    // 现在应该能写入
-    written = ring_write(&stream.send_ring, "YZ", 2);
-    ASSERT_EQ(written, 2);
+/* 消息模式：包不跨消息，FIRST/LAST 标记首尾；接收端只看到完整消息 */
+static int msg_cb_count, msg_cb_len;
+static void on_msg_cb(p2p_session_t session, const void *data, int len, void *userdata) {
+    (void)session; (void)data; (void)userdata;
+    msg_cb_count++;
+    msg_cb_len = len;
 }
 
-/* 边界测试：超大数据（多个窗口） */
-TEST(reliable_large_data) {
+TEST(stream_message_mode) {
     mock_reset();
     struct p2p_session *s = create_mock_session();
-    
-    // 写入超过窗口大小的数据
-    // RELIABLE_WINDOW = 32, P2P_STREAM_PAYLOAD ≈ 1191
-    int total_size = RELIABLE_WINDOW * P2P_STREAM_PAYLOAD + 500;
-    char *large_data = malloc(total_size);
-    memset(large_data, 'D', total_size);
-    
-    stream_write(&s->stream, large_data, total_size);
-    
-    // Flush，应该只发送窗口大小的数据
-    int flushed = stream_flush_to_reliable(s);
-    
-    // 窗口满了，无法全部发送
-    ASSERT(flushed > 0);
-    ASSERT_EQ(s->reliable.send_count, RELIABLE_WINDOW);
-    ASSERT(flushed < total_size);
-    
-    free(large_data);
-    destroy_mock_session(s);
-}
+    s->stream.msg_mode = 1;
 
-/* 边界测试：最大包大小 */
-TEST(reliable_max_payload) {
+    static char big[2000];
+    memset(big, 'M', sizeof(big));
+    ASSERT_EQ(stream_write_msg(&s->stream, "hello", 5), 5);
+    ASSERT_EQ(stream_write_msg(&s->stream, big, sizeof(big)), 2000);
+    ASSERT_EQ(stream_flush_to_reliable(s), 2005);
+
+    // 短消息独占一包，长消息分两片
+    ASSERT_EQ(s->reliable.send_count, 3);
+    ASSERT_EQ(s->reliable.send_buf[0].len, P2P_DATA_HDR_SIZE + 5);
+    ASSERT_EQ(s->reliable.send_buf[0].data[4], P2P_FRAG_FIRST | P2P_FRAG_LAST);
+    ASSERT_EQ(s->reliable.send_buf[1].data[4], P2P_FRAG_FIRST);
+    ASSERT_EQ(s->reliable.send_buf[2].data[4], P2P_FRAG_LAST);
+
+    // 长消息首片到达后尚不可读
+    char buf[4096];
+    ASSERT_EQ(stream_deliver(s, s->reliable.send_buf[0].data, s->reliable.send_buf[0].len), 5);
+    ASSERT(stream_deliver(s, s->reliable.send_buf[1].data, s->reliable.send_buf[1].len) > 0);
+    ASSERT_EQ(stream_read_msg(&s->stream, buf, sizeof(buf)), 5);
+    ASSERT_EQ(memcmp(buf, "hello", 5), 0);
+    ASSERT_EQ(stream_read_msg(&s->stream, buf, sizeof(buf)), 0);
+
+    // 末片到达：整条可读；缓冲区不足时返回长度且消息保留
+    ASSERT(stream_deliver(s, s->reliable.send_buf[2].data, s->reliable.send_buf[2].len) > 0);
+    ASSERT_EQ(stream_read_msg(&s->stream, buf, 100), 2000);
+    ASSERT_EQ(stream_read_msg(&s->stream, buf, sizeof(buf)), 2000);
+    ASSERT_EQ(memcmp(buf, big, 2000), 0);
+    ASSERT_EQ(ring_used(&s->stream.recv_ring), 0);
+
+    // 回调模式：整条消息直接回调，不进入接收缓冲区
+    msg_cb_count = 0;
+    s->inst->cfg.on_message = on_msg_cb;
+    for (int i = 0; i < 3; i++)
+        stream_deliver(s, s->reliable.send_buf[i].data, s->reliable.send_buf[i].len);
+    s->inst->cfg.on_message = NULL;
+    ASSERT_EQ(msg_cb_count, 2);
+    ASSERT_EQ(msg_cb_len, 2000);
+    ASSERT_EQ(ring_used(&s->stream.recv_ring), 0);
+
+    destroy_mock_session(s);
+}
+
+/* 会话续传：重置后双方令牌匹配时，只重新入队对端未交付的包，字节流无缝衔接；令牌不符时丢弃 */
+TEST(session_resume) {
+    mock_reset();
+    struct p2p_session *a = create_mock_session(), *b = create_mock_session();
+    a->resume.token = 0x1111; a->resume.peer_token = 0x2222;
+    b->resume.token = 0x2222; b->resume.peer_token = 0x1111;
+
+    static uint8_t data[3000];
+    for (int i = 0; i < (int)sizeof(data); i++) data[i] = (uint8_t)(i * 7);
+    ASSERT_EQ(stream_write(&a->stream, data, sizeof(data)), (int)sizeof(data));
+    ASSERT_EQ(stream_flush_to_reliable(a), (int)sizeof(data));
+    int sent = a->reliable.send_count;
+    ASSERT(sent >= 2);
+
+    // 对端只交付了首包，随后会话重置（reliable 层序列号从头开始，流偏移保留）
+    ASSERT(stream_deliver(b, a->reliable.send_buf[0].data, a->reliable.send_buf[0].len) > 0);
+    uint32_t delivered = b->stream.recv_offset;
+    reliable_resume_save(a);
+    ASSERT(a->resume.pending);
+    ASSERT_EQ(a->resume.cnt, sent);
+    reliable_init(a);
+    reliable_init(b);
+    ASSERT_EQ(a->reliable.send_count, 0);
+
+    uint8_t caps[RELIABLE_CAPS_MAX_PSZ];
+    int n = reliable_write_caps(b, caps);
+    ASSERT(caps[n - RELIABLE_RESUME_PSZ(1) - 1] & RELIABLE_CAP2_RESUME);
+    reliable_on_caps(a, caps, n);
+    ASSERT(!a->resume.pending);
+    ASSERT_EQ(a->reliable.send_count, sent - 1);
+    ASSERT_EQ(a->reliable.send_seq, (uint32_t)(sent - 1));
+    ASSERT_EQ(nget_l(a->reliable.send_buf[0].data), delivered);
+
+    // 重新入队的包依次交付后字节流完整
+    for (int i = 0; i < a->reliable.send_count; i++)
+        ASSERT(stream_deliver(b, a->reliable.send_buf[i].data, a->reliable.send_buf[i].len) > 0);
+    static uint8_t out[3000];
+    ASSERT_EQ(ring_read(&b->stream.recv_ring, out, sizeof(out)), (int)sizeof(data));
+    ASSERT_EQ(memcmp(out, data, sizeof(data)), 0);
+
+    // 对端令牌变化（进程重启）：保留的包丢弃，不续传
+    reliable_resume_save(a);
+    ASSERT_EQ(a->resume.cnt, sent - 1);
+    reliable_init(a);
+    b->resume.token = 0x3333;
+    n = reliable_write_caps(b, caps);
+    reliable_on_caps(a, caps, n);
+    ASSERT(!a->resume.pending);
+    ASSERT_EQ(a->resume.cnt, 0);
+    ASSERT_EQ(a->reliable.send_count, 0);
+    ASSERT_EQ(a->resume.peer_token, 0x3333u);
+
+    destroy_mock_session(a);
+    destroy_mock_session(b);
+}
+
+/* 消息有效期：未发出的过期消息整条丢弃；已发出的分片改写为 SKIP，对端丢弃不完整消息、偏移照常推进 */
+TEST(stream_msg_deadline) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    s->stream.msg_mode = 1;
+    uint64_t now = p2p_now_ms();
+
+    // 过期消息在组包时丢弃，不占序列号；无有效期的消息照常发出
+    ASSERT_EQ(stream_write_msg_at(&s->stream, "old", 3, stream_deadline(1, now - 10)), 3);
+    ASSERT_EQ(stream_write_msg(&s->stream, "new", 3), 3);
+    ASSERT_EQ(stream_flush_to_reliable(s), 3);
+    ASSERT_EQ(s->reliable.send_count, 1);
+    ASSERT_EQ(s->stream.msg_expired, 1u);
+    ASSERT_EQ(memcmp(s->reliable.send_buf[0].data + P2P_DATA_HDR_SIZE, "new", 3), 0);
+    ASSERT_EQ(s->reliable.send_buf[0].deadline, 0u);
+
+    // 未过期的长消息：各分片记录有效期与消息字节数
+    static char big[2000];
+    memset(big, 'D', sizeof(big));
+    ASSERT_EQ(stream_write_msg_at(&s->stream, big, sizeof(big), stream_deadline(60000, now)), 2000);
+    ASSERT_EQ(stream_flush_to_reliable(s), 2000);
+    ASSERT_EQ(s->reliable.send_count, 3);
+    retx_entry_t *e1 = &s->reliable.send_buf[1], *e2 = &s->reliable.send_buf[2];
+    ASSERT(e1->deadline != 0 && e1->deadline == e2->deadline);
+    ASSERT_EQ(e1->raw_len + e2->raw_len, 2000);
+
+    // 未到期或对端不支持 SKIP：保持原包
+    ASSERT(!reliable_expire(s, e2, now));
+    ASSERT(!reliable_expire(s, e2, now + 120000));
+    s->reliable.skip = true;
+    ASSERT(reliable_expire(s, e2, now + 120000));
+    ASSERT_EQ(e2->len, P2P_DATA_HDR_SIZE + (int)P2P_FRAG_SKIP_PSZ);
+    ASSERT_EQ(e2->data[4], P2P_FRAG_SKIP);
+    ASSERT_EQ((int)nget_l(e2->data + P2P_DATA_HDR_SIZE), e2->raw_len);
+    ASSERT_EQ(e2->deadline, 0u);
+
+    // 对端：首片进入组装，SKIP 到达后丢弃；后续消息不受影响
+    char buf[4096];
+    ASSERT_EQ(stream_deliver(s, s->reliable.send_buf[0].data, s->reliable.send_buf[0].len), 3);
+    ASSERT(stream_deliver(s, e1->data, e1->len) > 0);
+    ASSERT_EQ(s->stream.recv_msg_open, 1);
+    ASSERT_EQ(stream_deliver(s, e2->data, e2->len), 0);
+    ASSERT_EQ(s->stream.recv_msg_open, 0);
+    ASSERT_EQ(s->stream.recv_offset, s->stream.send_offset);
+
+    ASSERT_EQ(stream_write_msg(&s->stream, "tail", 4), 4);
+    ASSERT_EQ(stream_flush_to_reliable(s), 4);
+    ASSERT(stream_deliver(s, s->reliable.send_buf[3].data, s->reliable.send_buf[3].len) > 0);
+    ASSERT_EQ(stream_read_msg(&s->stream, buf, sizeof(buf)), 3);
+    ASSERT_EQ(memcmp(buf, "new", 3), 0);
+    ASSERT_EQ(stream_read_msg(&s->stream, buf, sizeof(buf)), 4);
+    ASSERT_EQ(memcmp(buf, "tail", 4), 0);
+    ASSERT_EQ(stream_read_msg(&s->stream, buf, sizeof(buf)), 0);
+
+    destroy_mock_session(s);
+}
+/* 原生多流投递：回调模式下完整消息以传输层缓冲区直接回调；分段按 FIRST/LAST 组装；无序仅限原生多流的消息流 */
+static const void *native_cb_ptr;
+static void on_native_cb(p2p_session_t session, const void *data, int len, void *userdata) {
+    (void)session; (void)len; (void)userdata;
+    native_cb_ptr = data;
+    msg_cb_count++;
+}
+static void native_flush_stub(struct p2p_session *s) { (void)s; }
+
+TEST(stream_native_deliver) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    s->stream.msg_mode = 1;
+
+    // 回调模式：完整消息不经 recv_ring，回调得到的即传入的缓冲区
+    static const uint8_t whole[] = "native";
+    msg_cb_count = 0;
+    s->inst->cfg.on_message = on_native_cb;
+    ASSERT_EQ(stream_deliver_msg(s, &s->stream, P2P_FRAG_WHOLE, whole, 6), 6);
+    s->inst->cfg.on_message = NULL;
+    ASSERT_EQ(msg_cb_count, 1);
+    ASSERT(native_cb_ptr == whole);
+    ASSERT_EQ(s->stream.recv_ring.wip, 0);
+    ASSERT_EQ(s->stream.recv_offset, 6u);
+
+    // 分段投递：末段到达前不可读
+    char buf[64];
+    ASSERT_EQ(stream_deliver_msg(s, &s->stream, P2P_FRAG_FIRST, (const uint8_t *)"abc", 3), 3);
+    ASSERT_EQ(stream_read_msg(&s->stream, buf, sizeof(buf)), 0);
+    ASSERT_EQ(stream_deliver_msg(s, &s->stream, P2P_FRAG_LAST, (const uint8_t *)"de", 2), 2);
+    ASSERT_EQ(stream_read_msg(&s->stream, buf, sizeof(buf)), 5);
+    ASSERT_EQ(memcmp(buf, "abcde", 5), 0);
+
+    // 无序交付：reliable 层不支持；原生多流传输层仅消息流可设置
+    ASSERT_EQ(p2p_stream_unordered((p2p_session_t)s, 0, 1), -1);
+    p2p_trans_ops_t ops = { .name = "native", .flush = native_flush_stub };
+    s->trans = &ops;
+    ASSERT_EQ(p2p_stream_unordered((p2p_session_t)s, 0, 1), 0);
+    ASSERT_EQ(s->stream.unordered, 1);
+    s->stream.msg_mode = 0;
+    ASSERT_EQ(p2p_stream_unordered((p2p_session_t)s, 0, 0), -1);
+    ASSERT_EQ(p2p_stream_unordered((p2p_session_t)s, 5, 1), -1);
+    s->trans = NULL;
+
+    destroy_mock_session(s);
+}
+/* COMPACT 增量 SYNC：对端按地址增删候选，重复版本忽略；本端停等发送，未确认期间的变更攒入下一版本 */
+TEST(compact_delta_sync) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    inst->sig_mode = P2P_SIGNALING_MODE_COMPACT;
+    inst->sessions_head = s;
+    s->id = 0x1234;
+    s->sig_sess.compact.state = SIG_COMPACT_SESS_READY;
+    uint64_t now = P_tick_ms();
+
+    p2p_local_candidate_entry_t c; memset(&c, 0, sizeof(c));
+    c.type = P2P_CAND_SRFLX;
+    c.addr.sin_family = AF_INET;
+    c.addr.sin_addr.s_addr = htonl(0x0a000001);
+    c.addr.sin_port = htons(5000);
+
+    uint8_t pkt[SIG_PKT_SYNC_DELTA_PSZ(1)];
+    nwrite_l(pkt, s->id);
+    pkt[P2P_SESS_ID_PSZ] = 1; pkt[P2P_SESS_ID_PSZ + 1] = 1;
+    pkt[P2P_SESS_ID_PSZ + 2] = SIG_SYNC_DELTA_ADD;
+    pack_candidate(&c, pkt + P2P_SESS_ID_PSZ + 3);
+
+    // ADD：入表；同版本重发不重复应用
+    p2p_signal_compact_proto(inst, SIG_PKT_SYNC, SIG_SYNC_FLAG_DELTA, 1, pkt, sizeof(pkt), now);
+    ASSERT_EQ(s->remote_cand_cnt, 1);
+    ASSERT_EQ(s->sig_sess.compact.remote_delta_ver, 1);
+    p2p_signal_compact_proto(inst, SIG_PKT_SYNC, SIG_SYNC_FLAG_DELTA, 1, pkt, sizeof(pkt), now);
+    ASSERT_EQ(s->remote_cand_cnt, 1);
+
+    // DEL：按地址定位，路径失效但表项保留
+    pkt[P2P_SESS_ID_PSZ] = 2; pkt[P2P_SESS_ID_PSZ + 2] = SIG_SYNC_DELTA_DEL;
+    p2p_signal_compact_proto(inst, SIG_PKT_SYNC, SIG_SYNC_FLAG_DELTA, 2, pkt, sizeof(pkt), now);
+    ASSERT_EQ(s->remote_cand_cnt, 1);
+    ASSERT_EQ(s->remote_cands[0].stats.state, PATH_STATE_FAILED);
+
+    // 版本号与包头 seq 不符：丢弃
+    pkt[P2P_SESS_ID_PSZ] = 3;
+    p2p_signal_compact_proto(inst, SIG_PKT_SYNC, SIG_SYNC_FLAG_DELTA, 4, pkt, sizeof(pkt), now);
+    ASSERT_EQ(s->sig_sess.compact.remote_delta_ver, 2);
+
+    // 发送端：首个变更立即在途，后续变更攒批（同地址合并）
+    p2p_signal_compact_delta_candidate(s, &c, false);
+    ASSERT_EQ(s->sig_sess.compact.delta_ver, 1);
+    ASSERT_EQ(s->sig_sess.compact.delta_cnt[0], 1);
+    p2p_signal_compact_delta_candidate(s, &c, true);
+    p2p_signal_compact_delta_candidate(s, &c, false);
+    ASSERT_EQ(s->sig_sess.compact.delta_cnt[1], 1);
+
+    // 旧版本的确认忽略；当前版本确认后攒批记录作为新版本发出
+    uint8_t ack[P2P_SESS_ID_PSZ]; nwrite_l(ack, s->id);
+    p2p_signal_compact_proto(inst, SIG_PKT_SYNC_ACK, SIG_SYNC_FLAG_DELTA, 7, ack, sizeof(ack), now);
+    ASSERT_EQ(s->sig_sess.compact.delta_ver, 1);
+    p2p_signal_compact_proto(inst, SIG_PKT_SYNC_ACK, SIG_SYNC_FLAG_DELTA, 1, ack, sizeof(ack), now);
+    ASSERT_EQ(s->sig_sess.compact.delta_ver, 2);
+    ASSERT_EQ(s->sig_sess.compact.delta_cnt[0], 1);
+    ASSERT_EQ(s->sig_sess.compact.delta_cnt[1], 0);
+    p2p_signal_compact_proto(inst, SIG_PKT_SYNC_ACK, SIG_SYNC_FLAG_DELTA, 2, ack, sizeof(ack), now);
+    ASSERT_EQ(s->sig_sess.compact.delta_cnt[0], 0);
+
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+/* COMPACT ONLINE 捎带 SYNC0：登录中 connect 即补发捎带的 ONLINE；ACK 带 SYNC0 标志时会话直接等待 SYNC0_ACK，不带时（旧服务器）照常发送 */
+TEST(compact_online_sync0) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    inst->sig_mode = P2P_SIGNALING_MODE_COMPACT;
+    inst->sessions_head = s;
+    p2p_compact_ctx_t *sig_ctx = &inst->sig_ctx.compact;
+    sig_ctx->state = SIG_COMPACT_WAIT_ONLINE_ACK;
+    sig_ctx->instance_id = 7;
+    strcpy(sig_ctx->local_peer_id, "alice");
+    uint64_t now = P_tick_ms();
+
+    ASSERT_EQ(p2p_signal_compact_connect(s, "bob"), E_NONE);
+    ASSERT_EQ(s->sig_sess.compact.state, SIG_COMPACT_SESS_WAIT_ONLINE);
+    ASSERT(!strcmp(sig_ctx->online_sync0_peer, "bob"));
+    ASSERT_EQ(sig_ctx->online_sync0_cnt, 0);
+
+    uint8_t ack[SIG_PKT_ONLINE_ACK_PSZ]; memset(ack, 0, sizeof(ack));
+    nwrite_l(ack, 7);
+    nwrite_ll(ack + 4, 0x1122334455667788ull);
+    ack[12] = 8;
+    sig_ctx->online_sync0_cnt = 3;
+    sig_ctx->last_send_time = now - 50;
+    p2p_signal_compact_proto(inst, SIG_PKT_ONLINE_ACK, SIG_ONACK_FLAG_SYNC0, 0, ack, sizeof(ack), now);
+    ASSERT_EQ(sig_ctx->state, SIG_COMPACT_ONLINE);
+    ASSERT_EQ(s->sig_sess.compact.state, SIG_COMPACT_SESS_WAIT_SYNC0_ACK);
+    ASSERT_EQ(s->sig_sess.compact.candidates_cached, 3);
+    ASSERT_EQ(s->sig_sess.compact.sync_attempts, 1);
+    ASSERT_EQ(s->sig_sess.compact.sync_send_time, now - 50);
+    ASSERT_EQ(sig_ctx->online_sync0_peer[0], 0);
+
+    // 旧服务器：ACK 不带标志，会话照常经 send_sync0 提交（按 max_candidates 截断）
+    memset(&s->sig_sess.compact, 0, sizeof(s->sig_sess.compact));
+    sig_ctx->state = SIG_COMPACT_WAIT_ONLINE_ACK;
+    sig_ctx->online_sync0_peer[0] = 0;
+    ASSERT_EQ(p2p_signal_compact_connect(s, "bob"), E_NONE);
+    sig_ctx->online_sync0_cnt = 3;
+    p2p_signal_compact_proto(inst, SIG_PKT_ONLINE_ACK, 0, 0, ack, sizeof(ack), now);
+    ASSERT_EQ(s->sig_sess.compact.state, SIG_COMPACT_SESS_WAIT_SYNC0_ACK);
+    ASSERT_EQ(s->sig_sess.compact.candidates_cached, 0);
+    ASSERT_EQ(sig_ctx->online_sync0_peer[0], 0);
+
+    destroy_mock_session(s);
+}
+/* RELAY 中转 BULK 帧：连续新包合为一帧，中转忙时留在队列；接收方拆帧后按序交给 reliable 层 */
+static uint8_t bulk_rec[P2P_PKT_BULK_LARGE_MAX];
+static int bulk_rec_len, bulk_frames;
+static uint16_t bulk_rec_seq;
+static ret_t bulk_capture(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
+                          const void *payload, uint16_t payload_len) {
+    (void)flags;
+    if (type == P2P_PKT_ACK) return E_NONE;
+    if (type != P2P_PKT_BULK || payload_len > sizeof(bulk_rec)) return E_INVALID;
+    if (s->sig_sess.relay.awaiting_relay_ready) return E_BUSY;
+    memcpy(bulk_rec, payload, payload_len);
+    bulk_rec_len = payload_len;
+    bulk_rec_seq = seq;
+    bulk_frames++;
+    s->sig_sess.relay.awaiting_relay_ready = true;
+    return E_NONE;
+}
+
+TEST(relay_bulk_frame) {
+    mock_reset();
+    struct p2p_session *a = create_mock_session(), *b = create_mock_session();
+    for (int i = 0; i < 2; i++) {
+        struct p2p_session *s = i ? b : a;
+        s->inst->sig_mode = P2P_SIGNALING_MODE_RELAY;
+        s->inst->sig_ctx.relay.feature_relay = s->inst->sig_ctx.relay.feature_bulk = true;
+        s->inst->signaling_relay_fn = bulk_capture;
+        s->path_type = P2P_PATH_SIGNALING;
+        s->active_path = PATH_IDX_SIGNALING;
+        s->reliable.bulk = true;
+        s->id = 0x55 + i;
+    }
+    bulk_frames = 0;
+
+    uint8_t pkt[1000];
+    for (int i = 0; i < 5; i++) {
+        memset(pkt, 'a' + i, sizeof(pkt));
+        ASSERT_EQ(reliable_send_pkt(a, pkt, sizeof(pkt)), 0);
+    }
+
+    // 一帧最多 4 个 1000 字节的包（含 2 字节长度前缀）
+    reliable_tick(a);
+    ASSERT_EQ(bulk_frames, 1);
+    ASSERT_EQ(bulk_rec_seq, 0);
+    ASSERT_EQ(bulk_rec_len, 4 * (2 + 1000));
+    ASSERT(a->reliable.send_buf[0].bulk && a->reliable.send_buf[0].send_time);
+    ASSERT_EQ(a->reliable.send_buf[4].send_time, 0);
+
+    // 等待 READY 期间不再成帧，也不按 RACK/RTO 重传
+    reliable_tick(a);
+    ASSERT_EQ(bulk_frames, 1);
+    ASSERT_EQ(a->reliable.send_buf[4].send_time, 0);
+
+    // 接收方拆帧：4 个包按序进入 reliable 层
+    struct sockaddr_in from = { .sin_family = AF_INET };
+    nat_proto(b, P2P_PKT_BULK, 0, bulk_rec_seq, bulk_rec, bulk_rec_len, &from, P_tick_ms());
+    ASSERT_EQ(b->reliable.recv_next, 4);
+
+    // READY 后剩余包组成下一帧
+    a->sig_sess.relay.awaiting_relay_ready = false;
+    reliable_tick(a);
+    ASSERT_EQ(bulk_frames, 2);
+    ASSERT_EQ(bulk_rec_seq, 4);
+    ASSERT_EQ(bulk_rec_len, 2 + 1000);
+
+    // 截断的帧：已解析的包保留，越界记录丢弃
+    nat_proto(b, P2P_PKT_BULK, 0, bulk_rec_seq, bulk_rec, bulk_rec_len - 1, &from, P_tick_ms());
+    ASSERT_EQ(b->reliable.recv_next, 4);
+
+    destroy_mock_session(a);
+    destroy_mock_session(b);
+}
+
+/* BULK 大帧模式：双方通告 RELIABLE_CAP2_BULK_LARGE 时单帧超出 P2P_PKT_BULK_MAX；
+ * 中转发送队列按 chunk 容量切分大帧，拼接后与原帧一致 */
+TEST(relay_bulk_large_frame) {
+    mock_reset();
+    struct p2p_session *a = create_mock_session(), *b = create_mock_session();
+    for (int i = 0; i < 2; i++) {
+        struct p2p_session *s = i ? b : a;
+        p2p_relay_ctx_t *ctx = &s->inst->sig_ctx.relay;
+        s->inst->sig_mode = P2P_SIGNALING_MODE_RELAY;
+        ctx->feature_relay = ctx->feature_bulk = ctx->feature_bulk_large = true;
+        ctx->state = SIG_RELAY_ONLINE;
+        ctx->sockfd = P_INVALID_SOCKET;
+        s->inst->signaling_relay_fn = bulk_capture;
+        s->path_type = P2P_PATH_SIGNALING;
+        s->active_path = PATH_IDX_SIGNALING;
+        s->reliable.bulk = true;
+        s->id = 0x65 + i;
+    }
+
+    // 能力通告：独立连接通告大帧，共享连接不通告
+    uint8_t caps[RELIABLE_CAPS_MAX_PSZ];
+    int n = reliable_write_caps(a, caps);
+    ASSERT(caps[n - 1] & RELIABLE_CAP2_BULK_LARGE);
+    reliable_on_caps(b, caps, n);
+    ASSERT(b->reliable.bulk_large);
+    a->inst->sig_ctx.relay.link = (struct p2p_relay_link *)(void *)1;
+    n = reliable_write_caps(a, caps);
+    ASSERT(!(caps[n - 1] & RELIABLE_CAP2_BULK_LARGE));
+    ASSERT(!p2p_signal_relay_bulk_buf(a->inst));
+    a->inst->sig_ctx.relay.link = NULL;
+
+    // 20 个 1000 字节的包合为一帧（普通 BULK 帧最多 4 个）
+    bulk_frames = 0;
+    uint8_t pkt[1000];
+    for (int i = 0; i < 20; i++) {
+        memset(pkt, 'a' + i, sizeof(pkt));
+        ASSERT_EQ(reliable_send_pkt(b, pkt, sizeof(pkt)), 0);
+    }
+    b->reliable.peer_rwnd = 1 << 20;       // 对端已通告足够的接收窗口
+    reliable_tick(b);
+    ASSERT_EQ(bulk_frames, 1);
+    ASSERT_EQ(bulk_rec_len, 20 * (2 + 1000));
+    ASSERT(b->reliable.send_buf[19].bulk && b->reliable.send_buf[19].send_time);
+
+    struct sockaddr_in from = { .sin_family = AF_INET };
+    nat_proto(a, P2P_PKT_BULK, 0, bulk_rec_seq, bulk_rec, bulk_rec_len, &from, P_tick_ms());
+    ASSERT_EQ(a->reliable.recv_next, 20);
+
+    // 经 RELAY 发送队列：大帧跨多个 chunk，按序拼接即为 [hdr][session_id][P2P hdr][payload]
+    p2p_relay_ctx_t *ctx = &a->inst->sig_ctx.relay;
+    ASSERT_EQ(p2p_signal_relay_packet(a, P2P_PKT_BULK, 0, 7, bulk_rec, (uint16_t)bulk_rec_len), E_NONE);
+    ASSERT(ctx->send_queue_len > 1);
+    static uint8_t wire[sizeof(p2p_relay_hdr_t) + P2P_RLY_PAYLOAD_LARGE_MAX];
+    int wire_len = 0;
+    for (p2p_send_chunk_t *c = ctx->send_queue_head; c; c = c->next) {
+        ASSERT(wire_len + c->len <= (int)sizeof(wire));
+        memcpy(wire + wire_len, c->data, (size_t)c->len);
+        wire_len += c->len;
+    }
+    ASSERT_EQ(wire_len, (int)(sizeof(p2p_relay_hdr_t) + P2P_RLY_PACKET_PSZ(bulk_rec_len)));
+    ASSERT_EQ(wire[0], P2P_RLY_PACKET);
+    ASSERT_EQ(nget_s(wire + 1), P2P_RLY_PACKET_PSZ(bulk_rec_len));
+    ASSERT_EQ(nget_l(wire + 3), a->id);
+    ASSERT_EQ(memcmp(wire + sizeof(p2p_relay_hdr_t) + P2P_RLY_PACKET_PSZ(0), bulk_rec, (size_t)bulk_rec_len), 0);
+
+    // 超出大帧上限仍拒绝
+    a->sig_sess.relay.awaiting_relay_ready = false;
+    ASSERT_EQ(p2p_signal_relay_packet(a, P2P_PKT_BULK, 0, 8, bulk_rec, (uint16_t)(P2P_PKT_BULK_LARGE_MAX + 1)),
+              E_OUT_OF_CAPACITY);
+
+    p2p_signal_relay_offline(a->inst);
+    p2p_signal_relay_offline(b->inst);
+    destroy_mock_session(a);
+    destroy_mock_session(b);
+}
+
+/* 不可靠数据报：到期未发出即丢弃，不进入 reliable 层；接收缓冲区满时丢弃 */
+TEST(stream_dgram_channel) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+
+    ASSERT_EQ(p2p_send_dgram(s, "x", P2P_DGRAM_MAX + 1, 0), -1);
+    ASSERT_EQ(p2p_send_dgram(s, "stale", 5, 1), 5);
+    ASSERT_EQ(p2p_send_dgram(s, "fresh", 5, 0), 5);
+
+    // 首条已过生存期：丢弃；次条发送失败（虚拟 socket）时保留到下次 update 重试
+    ASSERT_EQ(dgram_flush(s, P_tick_ms() + 10), 0);
+    ASSERT_EQ(s->dgram.expired, 1u);
+    ASSERT_EQ(s->dgram.blocked, 1);
+    ASSERT_EQ(ring_used(&s->dgram.send_ring), DGRAM_SEND_HDR_SIZE + 5);
+    ASSERT_EQ(s->reliable.send_count, 0);
+
+    // 接收：缓冲区不足时保留
+    char buf[64];
+    dgram_deliver(s, (const uint8_t*)"voice-frame", 11);
+    ASSERT_EQ(p2p_recv_dgram(s, buf, 4), 11);
+    ASSERT_EQ(p2p_recv_dgram(s, buf, sizeof(buf)), 11);
+    ASSERT_EQ(memcmp(buf, "voice-frame", 11), 0);
+    ASSERT_EQ(p2p_recv_dgram(s, buf, sizeof(buf)), 0);
+
+    // 接收缓冲区满：新数据报丢弃
+    static uint8_t big[P2P_DGRAM_MAX];
+    for (int i = 0; i < DGRAM_BUF_SIZE / P2P_DGRAM_MAX + 1; i++)
+        dgram_deliver(s, big, sizeof(big));
+    ASSERT(s->dgram.dropped > 0);
+
+    destroy_mock_session(s);
+}
+
+/* 边界测试：空数据 */
+TEST(stream_empty_data) {
+    stream_t stream;
+    stream_init(&stream, 0, 0, 0, 0);
+    
+    // 写入 0 字节
+    int written = stream_write(&stream, "", 0);
+    ASSERT_EQ(written, 0);
+    
+    // 读取应该返回 0
+    char buf[10];
+    int read = stream_read(&stream, buf, sizeof(buf));
+    ASSERT_EQ(read, 0);
+
+    stream_free(&stream);
+}
+
+/* 边界测试：单字节 */
+TEST(stream_single_byte) {
+    stream_t stream;
+    stream_init(&stream, 0, 0, 0, 0);
+    
+    // 写入 1 字节
+    char data = 'A';
+    ring_write(&stream.recv_ring, &data, 1);
+    
+    // 读取
+    char buf;
+    int read = stream_read(&stream, &buf, 1);
+    ASSERT_EQ(read, 1);
+    ASSERT_EQ(buf, 'A');
+
+    stream_free(&stream);
+}
+
+/* 边界测试：正好一个包大小 */
+TEST(stream_exact_packet_size) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    
+    // 写入正好 P2P_STREAM_PAYLOAD 字节
+    char data[P2P_STREAM_PAYLOAD];
+    memset(data, 'B', sizeof(data));
+    
+    stream_write(&s->stream, data, sizeof(data));
+    int flushed = stream_flush_to_reliable(s);
+    
+    // 应该生成 1 个包
+    ASSERT(flushed == P2P_STREAM_PAYLOAD);
+    ASSERT_EQ(s->reliable.send_count, 1);
+    
+    destroy_mock_session(s);
+}
+
+/* 边界测试：环形缓冲区完全填满 */
+TEST(ring_buffer_full) {
+    stream_t stream;
+    stream_init(&stream, 0, 0, 0, 0);
+    
+    // 填满整个环形缓冲区（留一个空位）
+    char data[RING_SIZE];
+    memset(data, 'C', sizeof(data));
+    
+    int written = ring_write(&stream.send_ring, data, RING_SIZE - 1);
+    ASSERT_EQ(written, RING_SIZE - 1);
+    
+    // 再写应该失败
+    written = ring_write(&stream.send_ring, "X", 1);
+    ASSERT_EQ(written, 0);
+    
+    // 读取一些数据
+    char buf[100];
+    int read = ring_read(&stream.send_ring, buf, 100);
+    ASSERT_EQ(read, 100);
+    
+    // 现在应该能写入
+    written = ring_write(&stream.send_ring, "YZ", 2);
+    ASSERT_EQ(written, 2);
+
+    stream_free(&stream);
+}
+
+/* 边界测试：超大数据（多个窗口） */
+TEST(reliable_large_data) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    
+    // 写入超过窗口大小的数据
+    // RELIABLE_WINDOW = 32, P2P_STREAM_PAYLOAD ≈ 1191
+    int total_size = RELIABLE_WINDOW * P2P_STREAM_PAYLOAD + 500;
+    char *large_data = malloc(total_size);
+    memset(large_data, 'D', total_size);
+    
+    stream_write(&s->stream, large_data, total_size);
+    
+    // Flush，应该只发送窗口大小的数据
+    int flushed = stream_flush_to_reliable(s);
+    
+    // 窗口满了，无法全部发送
+    ASSERT(flushed > 0);
+    ASSERT_EQ(s->reliable.send_count, RELIABLE_WINDOW);
+    ASSERT(flushed < total_size);
+    
+    free(large_data);
+    destroy_mock_session(s);
+}
+
+/* 边界测试：最大包大小 */
+TEST(reliable_max_payload) {
     mock_reset();
     struct p2p_session *s = create_mock_session();
     
@@ -409,7 +1561,7 @@ TEST(reliable_max_payload) {
 /* 边界测试：环形缓冲区跨越边界读写 */
 TEST(ring_buffer_boundary_cross) {
     stream_t stream;
-    stream_init(&stream, 0);
+    stream_init(&stream, 0, 0, 0, 0);
     
     // 写入大部分缓冲区
     char data[RING_SIZE - 50];
@@ -437,55 +1589,5197 @@ TEST(ring_buffer_boundary_cross) {
     int read = ring_read(&stream.recv_ring, read_buf, sizeof(read_buf));
     ASSERT_EQ(read, 200);
     ASSERT_EQ(memcmp(read_buf, wrap_data, read), 0);
+
+    stream_free(&stream);
 }
 
-/* ============================================================================
- * PseudoTCP 测试
- * ============================================================================ */
+/* 会话时间轮：跨层下放后按时到期；删除/重新调度；next_timeout 不晚于最早到期 */
+/* 扇出发送：同一数据写入同一实例的各会话（消息模式会话整条写入），只登记唤醒 */
+TEST(send_group_fanout) {
+    mock_reset();
+    struct p2p_session *a = create_mock_session();
+    struct p2p_session *b = create_mock_session();
+    struct p2p_session *c = create_mock_session();
+    struct p2p_instance *b_inst = b->inst;
+    b->inst = a->inst;
+    b->stream.msg_mode = 1;
 
-TEST(pseudotcp_congestion_window) {
+    static const char data[] = "state-update";
+    const int len = (int)sizeof(data);
+    p2p_session_t group[4] = { a, b, c, NULL };
+    ASSERT_EQ(p2p_send_group(a->inst, group, 4, data, len), 2);
+    ASSERT_EQ(ring_used(&a->stream.send_ring), len);
+    ASSERT_EQ(ring_used(&b->stream.send_ring), STREAM_MSG_HDR_SIZE + len);
+    ASSERT_EQ(ring_used(&c->stream.send_ring), 0);      // 不属于该实例
+    ASSERT_EQ(a->wake_req, 1);
+    ASSERT_EQ(b->wake_req, 1);
+    ASSERT_EQ(c->wake_req, 0);
+    ASSERT(a->inst->wake_list == b && b->wake_next == a);
+
+    // 未连接的会话不计入
+    b->state = P2P_STATE_CLOSED;
+    ASSERT_EQ(p2p_send_group(a->inst, group, 2, data, len), 1);
+    ASSERT_EQ(ring_used(&a->stream.send_ring), len * 2);
+    ASSERT(a->inst->wake_list == b);                    // 已登记的会话不重复入栈
+    ASSERT_EQ(p2p_send_group(a->inst, group, 2, data, 0), -1);
+    ASSERT_EQ(p2p_send_group(NULL, group, 2, data, len), -1);
+
+    b->inst = b_inst;
+    destroy_mock_session(a);
+    destroy_mock_session(b);
+    destroy_mock_session(c);
+}
+
+/* 0-RTT 数据：启用 early_data 时建连期间即可写入，超出建连阶段仍拒绝 */
+static struct { uint8_t type, flags; uint16_t seq; uint8_t data[P2P_MTU]; int len; } early_pkts[16];
+static int early_cnt;
+static ret_t early_capture(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
+                           const void *payload, uint16_t payload_len) {
+    (void)s;
+    if (early_cnt < 16 && payload_len <= P2P_MTU) {
+        early_pkts[early_cnt].type = type;
+        early_pkts[early_cnt].flags = flags;
+        early_pkts[early_cnt].seq = seq;
+        memcpy(early_pkts[early_cnt].data, payload, payload_len);
+        early_pkts[early_cnt++].len = payload_len;
+    }
+    return E_NONE;
+}
+
+TEST(early_data_send) {
     mock_reset();
     struct p2p_session *s = create_mock_session();
-    
-    // 初始化 PseudoTCP
-    s->inst->cfg.use_pseudotcp = 1;
-    s->trans = &p2p_trans_pseudotcp;
-    s->trans->init(s);
-    
-    // 验证初始拥塞窗口
-    ASSERT(s->tcp.cwnd > 0);
-    ASSERT_EQ(s->tcp.ssthresh, 65535);
-    ASSERT_EQ(s->tcp.dup_acks, 0);
-    
-    // 模拟收到 ACK，拥塞窗口应该增长
-    uint32_t initial_cwnd = s->tcp.cwnd;
-    p2p_pseudotcp_on_ack(s, 0);
-    
-    ASSERT(s->tcp.cwnd > initial_cwnd);
-    
+    s->state = P2P_STATE_PUNCHING;
+    ASSERT_EQ(p2p_send(s, "early", 5), -1);
+
+    s->inst->cfg.early_data = true;
+    ASSERT_EQ(p2p_send(s, "early", 5), 5);
+    s->state = P2P_STATE_SIGNALING;
+    ASSERT_EQ(p2p_send(s, "!", 1), 1);
+    ASSERT_EQ(ring_used(&s->stream.send_ring), 6);
+
+    s->state = P2P_STATE_CLOSED;
+    ASSERT_EQ(p2p_send(s, "x", 1), -1);
+    s->state = P2P_STATE_INIT;
+    ASSERT_EQ(p2p_send(s, "x", 1), -1);
+    ASSERT_EQ(ring_used(&s->stream.send_ring), 6);
+
+    // 发送端：已发出 CONN（NAT_CONNECTING）、尚未收到 CONN_ACK，p2p_update 即把流数据经 reliable 层发出
+    uint64_t now = P_tick_ms();
+    struct p2p_instance *inst = s->inst;
+    p2p_timer_wheel_init(&inst->timers, now);
+    inst->sessions_head = s;
+    inst->socks[0].sock = P_INVALID_SOCKET;                     // mock 描述符不可读
+    inst->signaling.active = true;
+    inst->signaling.stats.state = PATH_STATE_ACTIVE;
+    inst->signaling_relay_fn = early_capture;
+    p2p_set_active_path(s, PATH_IDX_SIGNALING);
+    s->state = P2P_STATE_PUNCHING;
+    s->nat.state = NAT_CONNECTING;
+    s->nat.conn_start_ms = now;
+    early_cnt = 0;
+    p2p_session_wake(s);
+    ASSERT_EQ(p2p_update(inst), 0);
+    ASSERT_EQ(s->nat.state, NAT_CONNECTING);
+    int d = 0;
+    while (d < early_cnt && early_pkts[d].type != P2P_PKT_DATA) ASSERT(early_pkts[d++].type != P2P_PKT_CONN_ACK);
+    ASSERT(d < early_cnt);
+    ASSERT_EQ(early_pkts[d].seq, 0);
+    ASSERT_EQ(ring_used(&s->stream.send_ring), 0);
+    ASSERT_EQ(s->reliable.send_count, 1);
+
+    // 接收端仍在建连：0-RTT 数据暂留 reliable 层，不进入流
+    struct p2p_session *rx = create_mock_session();
+    struct p2p_instance *rx_inst = rx->inst;
+    p2p_timer_wheel_init(&rx_inst->timers, now);
+    rx_inst->sessions_head = rx;
+    rx_inst->socks[0].sock = P_INVALID_SOCKET;
+    rx_inst->signaling.active = true;
+    rx_inst->signaling.stats.state = PATH_STATE_ACTIVE;
+    rx_inst->signaling_relay_fn = early_capture;
+    p2p_set_active_path(rx, PATH_IDX_SIGNALING);
+    rx->state = P2P_STATE_PUNCHING;
+    rx->nat.state = NAT_PUNCHING;
+    rx->nat.punch_start = now;
+    nat_proto(rx, P2P_PKT_DATA, early_pkts[d].flags, early_pkts[d].seq, early_pkts[d].data, early_pkts[d].len,
+              &rx->active_addr, now);
+    p2p_session_wake(rx);
+    ASSERT_EQ(p2p_update(rx_inst), 0);
+    ASSERT(rx->state >= P2P_STATE_SIGNALING && rx->state <= P2P_STATE_PUNCHING);
+    ASSERT_EQ(ring_used(&rx->stream.recv_ring), 0);
+    ASSERT_EQ(rx->reliable.recv_next, 1);
+
+    // 进入 CONNECTED 后交付
+    rx->state = P2P_STATE_CONNECTED;
+    p2p_session_wake(rx);
+    ASSERT_EQ(p2p_update(rx_inst), 0);
+    char out[8];
+    ASSERT_EQ(stream_read(&rx->stream, out, sizeof(out)), 6);
+    ASSERT(memcmp(out, "early!", 6) == 0);
+
+    // 发送端仍在 NAT_CONNECTING：对端的 ACK 照常处理（确认在途包、刷新接收时间）
+    uint8_t ack[P2P_PKT_ACK_PSZ];
+    nwrite_s(ack, 1);
+    nwrite_l(ack + 2, 0);
+    s->nat.last_recv_time = 0;
+    nat_proto(s, P2P_PKT_ACK, 0, 0, ack, sizeof(ack), &s->active_addr, now + 5);
+    ASSERT_EQ(s->nat.last_recv_time, now + 5);
+    ASSERT_EQ(s->reliable.send_base, 1);
+    ASSERT_EQ(s->reliable.send_count, 0);
+
+    free(rx_inst->rx_slots);
+    nat_reset(&rx->nat);
+    destroy_mock_session(rx);
+    free(inst->rx_slots);
+    nat_reset(&s->nat);
     destroy_mock_session(s);
 }
 
-/* ============================================================================
- * 主函数
- * ============================================================================ */
+/* 叠加中继：中转端按 REQ 登记转发表并转发；请求端确认后登记 OVERLAY 候选，不占用地址索引 */
+static struct p2p_instance *overlay_own[3];
+static struct p2p_session *overlay_leg(struct p2p_instance *inst, int k, const char *peer, uint32_t id, uint32_t ip) {
+    struct p2p_session *s = create_mock_session();
+    overlay_own[k] = s->inst;
+    s->inst = inst;
+    strcpy(s->remote_peer_id, peer);
+    p2p_session_set_id(s, id);
+    int i = p2p_cand_push_remote(s);
+    s->remote_cands[i].addr.sin_family = AF_INET;
+    s->remote_cands[i].addr.sin_addr.s_addr = htonl(ip);
+    s->remote_cands[i].addr.sin_port = htons(5000);
+    s->remote_cands[i].type = P2P_CAND_SRFLX;
+    if (ip) p2p_set_active_path(s, i);
+    s->next = inst->sessions_head;
+    inst->sessions_head = s;
+    return s;
+}
 
-int main(void) {
-    printf("\n========================================\n");
-    printf("P2P Transport Layer Unit Tests\n");
-    printf("========================================\n\n");
-    
-    printf("Stream Layer Tests:\n");
-    RUN_TEST(stream_write_read);
-    RUN_TEST(stream_ring_buffer_wrap);
-    RUN_TEST(stream_flush_fragmentation);
-    
-    printf("\nBoundary Tests:\n");
-    RUN_TEST(stream_empty_data);
-    RUN_TEST(stream_single_byte);
-    RUN_TEST(stream_exact_packet_size);
+TEST(overlay_relay_forward) {
+    mock_reset();
+    struct p2p_session *leg = create_mock_session();
+    struct p2p_instance *inst = leg->inst;
+    inst->cfg.multi_session = true;
+    inst->cfg.overlay_relay = true;
+    struct p2p_session *sa = overlay_leg(inst, 0, "alice", 0x100, 0x0a000001);
+    struct p2p_session *sb = overlay_leg(inst, 1, "bob", 0x200, 0x0a000002);
+    uint64_t now = P_tick_ms();
+
+    // 中转端：alice 请求经本端到 bob 的会话 0xAB
+    uint8_t req[P2P_PKT_OVERLAY_PSZ + 4] = { P2P_OVERLAY_OP_REQ };
+    nwrite_l(req + 1, 0xAB);
+    req[P2P_PKT_OVERLAY_PSZ] = 3;
+    memcpy(req + P2P_PKT_OVERLAY_PSZ + 1, "bob", 3);
+    p2p_overlay_on_packet(sa, req, sizeof(req), now);
+    ASSERT_EQ(inst->overlay_cnt, 1);
+    ASSERT(inst->overlay_fwd[0].leg[0] == sa && inst->overlay_fwd[0].leg[1] == sb);
+    p2p_overlay_on_packet(sa, req, sizeof(req), now);     // 刷新不重复登记
+    ASSERT_EQ(inst->overlay_cnt, 1);
+
+    // 未知对端、本端自己的会话 ID：拒绝
+    memcpy(req + P2P_PKT_OVERLAY_PSZ + 1, "bot", 3);
+    nwrite_l(req + 1, 0xCD);
+    p2p_overlay_on_packet(sa, req, sizeof(req), now);
+    memcpy(req + P2P_PKT_OVERLAY_PSZ + 1, "bob", 3);
+    nwrite_l(req + 1, 0x200);
+    p2p_overlay_on_packet(sa, req, sizeof(req), now);
+    ASSERT_EQ(inst->overlay_cnt, 1);
+
+    uint8_t pkt[P2P_HDR_SIZE + P2P_SESS_ID_PSZ + 2];
+    p2p_pkt_hdr_encode(pkt, P2P_PKT_DATA, P2P_FLAG_SESSION, 7);
+    nwrite_l(pkt + P2P_HDR_SIZE, 0xAB);
+    struct sockaddr_in stranger = sa->active_addr;
+    stranger.sin_port = htons(6000);
+    ASSERT(p2p_overlay_forward(inst, 0xAB, pkt, sizeof(pkt), &sb->active_addr, now + 10));
+    ASSERT_EQ(inst->overlay_fwd[0].last_ms, now + 10);
+    ASSERT(p2p_overlay_forward(inst, 0xAB, pkt, sizeof(pkt), &stranger, now + 20));   // 来源不符：丢弃
+    ASSERT_EQ(inst->overlay_fwd[0].last_ms, now + 10);
+    ASSERT(!p2p_overlay_forward(inst, 0xCD, pkt, sizeof(pkt), &sa->active_addr, now));
+
+    // 空闲超时后过期
+    p2p_overlay_tick(inst, now + 10 + P2P_OVERLAY_IDLE_MS);
+    ASSERT_EQ(inst->overlay_cnt, 0);
+
+    // 请求端：经 sa 请求为会话 t 中转，确认后登记 OVERLAY 候选并可选为活跃路径
+    struct p2p_session *t = overlay_leg(inst, 2, "carol", 0xAB, 0);
+    ASSERT_EQ(p2p_overlay_request(t, t, now), E_INVALID);
+    ASSERT_EQ(p2p_overlay_request(t, sa, now), E_NONE);
+    ASSERT(t->overlay.via == sa && t->overlay.tries == 1 && !t->overlay.acked);
+    p2p_overlay_tick(inst, now + P2P_OVERLAY_RETRY_MS);
+    ASSERT_EQ(t->overlay.tries, 2);
+
+    uint8_t ack[P2P_PKT_OVERLAY_PSZ] = { P2P_OVERLAY_OP_ACK };
+    nwrite_l(ack + 1, 0xAB);
+    p2p_overlay_on_packet(sb, ack, sizeof(ack), now);     // 非请求的中转会话：忽略
+    ASSERT(!t->overlay.acked);
+    p2p_overlay_on_packet(sa, ack, sizeof(ack), now);
+    ASSERT(t->overlay.acked);
+    ASSERT_EQ(t->remote_cand_cnt, 2);
+    ASSERT_EQ(t->remote_cands[1].type, P2P_CAND_OVERLAY);
+    ASSERT(sockaddr_equal(&t->remote_cands[1].addr, &sa->active_addr));
+    ASSERT_EQ(t->remote_cands[1].stats.cost_score, P2P_OVERLAY_COST);
+    ASSERT_EQ(p2p_get_path_type(t, 1), P2P_PATH_OVERLAY);
+    p2p_set_active_path(t, 1);
+    ASSERT_EQ(t->path_type, P2P_PATH_OVERLAY);
+    ASSERT(p2p_session_find_by_addr(inst, &sa->active_addr) == sa);
+
+    // 中转会话释放：清除引用
+    p2p_overlay_unlink(sa);
+    ASSERT(t->overlay.via == NULL);
+
+    struct p2p_session *all[3] = { sa, sb, t };
+    for (int i = 0; i < 3; i++) {
+        free(all[i]->remote_cands);
+        all[i]->inst = overlay_own[i];
+    }
+    free(inst->sess_by_id.slots);
+    free(inst->sess_by_addr.slots);
+    for (int i = 0; i < 3; i++) destroy_mock_session(all[i]);
+    destroy_mock_session(leg);
+}
+
+TEST(timer_wheel_cascade) {
+    static p2p_timer_wheel_t w;
+    p2p_timer_t t[4];
+    uint64_t base = 1000003;    // 非对齐起点，覆盖槽位回绕
+    const uint64_t at[4] = { 5, 300, 20000, 3000000 };
+
+    p2p_timer_wheel_init(&w, base);
+    for (int i = 0; i < 4; i++) {
+        p2p_timer_node_init(&t[i]);
+        p2p_timer_add(&w, &t[i], base + at[i]);
+    }
+    ASSERT_EQ(w.count, 4);
+    ASSERT_EQ(p2p_timer_next_timeout(&w, base), 5);
+
+    // 每个定时器恰在到期时刻取出，早 1ms 不取出
+    for (int i = 0; i < 4; i++) {
+        p2p_timer_advance(&w, base + at[i] - 1);
+        ASSERT(p2p_timer_pop(&w) == NULL);
+        ASSERT(p2p_timer_pending(&t[i]));
+        p2p_timer_advance(&w, base + at[i]);
+        ASSERT(p2p_timer_pop(&w) == &t[i]);
+        ASSERT(!p2p_timer_pending(&t[i]));
+    }
+    ASSERT_EQ(w.count, 0);
+    ASSERT_EQ(p2p_timer_next_timeout(&w, base + 3000000), -1);
+
+    // 已过期时刻按当前时刻到期；删除后不再取出
+    uint64_t now = base + 3000000;
+    p2p_timer_add(&w, &t[0], 0);
+    p2p_timer_add(&w, &t[1], now + 100);
+    p2p_timer_del(&w, &t[1]);
+    ASSERT_EQ(p2p_timer_next_timeout(&w, now), 0);
+    p2p_timer_advance(&w, now + 200);
+    ASSERT(p2p_timer_pop(&w) == &t[0]);
+    ASSERT(p2p_timer_pop(&w) == NULL);
+    ASSERT_EQ(w.count, 0);
+}
+
+#ifdef P2P_THREADED
+/* 会话分片：按会话数均衡分配；唤醒进入所属分片时间轮；关闭时清除收件箱残留 */
+TEST(worker_shard_assign) {
+    static struct p2p_instance inst;
+    static p2p_worker_t workers[2];
+    static struct p2p_session sess[3];
+    uint64_t now = P_tick_ms();
+    struct sockaddr_in from;
+    uint8_t pkt[16] = { 0 };
+
+    memset(&inst, 0, sizeof(inst));
+    memset(workers, 0, sizeof(workers));
+    memset(sess, 0, sizeof(sess));
+    memset(&from, 0, sizeof(from));
+    p2p_timer_wheel_init(&inst.timers, now);
+    for (int i = 0; i < 2; i++) {
+        workers[i].inst = &inst;
+        workers[i].wake_rd = workers[i].wake_wr = P_INVALID_SOCKET;
+        P_mutex_init(&workers[i].rx_mtx);
+        p2p_timer_wheel_init(&workers[i].timers, now);
+        workers[i].rx_items[0] = (p2p_rx_item_t*)calloc(P2P_WORKER_INBOX, sizeof(p2p_rx_item_t));
+        workers[i].rx_items[1] = (p2p_rx_item_t*)calloc(P2P_WORKER_INBOX, sizeof(p2p_rx_item_t));
+    }
+    inst.workers = workers;
+    inst.worker_cnt = 2;
+
+    for (int i = 0; i < 3; i++) {
+        sess[i].inst = &inst;
+        p2p_timer_node_init(&sess[i].timer);
+        p2p_thread_assign(&inst, &sess[i]);
+    }
+    ASSERT(sess[0].worker == &workers[0]);
+    ASSERT(sess[1].worker == &workers[1]);
+    ASSERT(sess[2].worker == &workers[0]);
+    ASSERT_EQ(workers[0].sess_cnt, 2);
+    ASSERT_EQ(workers[1].sess_cnt, 1);
+
+    // 唤醒只进入所属分片的时间轮
+    p2p_session_wake(&sess[1]);
+    ASSERT(p2p_timer_pop(&workers[1].timers) == &sess[1].timer);
+    ASSERT(p2p_timer_pop(&workers[0].timers) == NULL);
+    ASSERT(p2p_timer_pop(&inst.timers) == NULL);
+
+    // 收件箱满后丢弃并计数
+    for (int i = 0; i < P2P_WORKER_INBOX + 2; i++)
+        p2p_worker_post(&workers[0], &sess[i % 2 ? 2 : 0], false, pkt, sizeof(pkt), &from, 0, 0);
+    ASSERT_EQ(workers[0].rx_cnt, P2P_WORKER_INBOX);
+    ASSERT_EQ(workers[0].rx_drops, 2);
+
+    // 关闭会话后其残留包不再投递，分片计数回落
+    p2p_thread_detach(&sess[0]);
+    ASSERT(sess[0].worker == NULL);
+    ASSERT_EQ(workers[0].sess_cnt, 1);
+    int left = 0;
+    for (int i = 0; i < workers[0].rx_cnt; i++) {
+        ASSERT(workers[0].rx_items[0][i].s != &sess[0]);
+        if (workers[0].rx_items[0][i].s) left++;
+    }
+    ASSERT_EQ(left, P2P_WORKER_INBOX / 2);
+
+    for (int i = 0; i < 2; i++) {
+        free(workers[i].rx_items[0]);
+        free(workers[i].rx_items[1]);
+        P_mutex_final(&workers[i].rx_mtx);
+    }
+}
+#endif
+
+/* 集群节点选择：同一 key 总选中同一节点；移除一个节点只迁移原属于它的 key */
+TEST(cluster_node_pick) {
+    static const char *full = "10.0.0.1:9333,10.0.0.2:9333,10.0.0.3:9333,10.0.0.4:9333";
+    static const char *less = "10.0.0.1:9333,10.0.0.2:9333,10.0.0.4:9333";
+    int owned[4] = { 0 };
+    char key[P2P_PEER_ID_MAX];
+
+    for (int i = 0; i < 1000; i++) {
+        memset(key, 0, sizeof(key));
+        snprintf(key, sizeof(key), "peer-%d", i);
+        size_t len = 0, len2 = 0;
+        int off = p2p_cluster_pick(full, key, sizeof(key), &len);
+        ASSERT(off >= 0 && len == 13);
+        ASSERT_EQ(p2p_cluster_pick(full, key, sizeof(key), &len2), off);
+        int node = full[off + 7] - '1';
+        owned[node]++;
+
+        int off2 = p2p_cluster_pick(less, key, sizeof(key), &len2);
+        ASSERT(off2 >= 0 && len2 == 13);
+        if (node != 2) ASSERT(memcmp(full + off, less + off2, len) == 0);
+        else           ASSERT(less[off2 + 7] != '3');
+    }
+    for (int n = 0; n < 4; n++) ASSERT(owned[n] > 150);
+
+    size_t len = 0;
+    ASSERT_EQ(p2p_cluster_pick("", "a", 1, &len), -1);
+    ASSERT_EQ(p2p_cluster_pick("solo:1", "a", 1, &len), 0);
+    ASSERT_EQ((int)len, 6);
+}
+
+/* RPC sid 去重窗口：乱序到达的未见 sid 接受一次，重复或落后超过 32 的 sid 拒绝，跨 0 回绕正常 */
+TEST(rpc_sid_window) {
+    uint16_t last = 0; uint32_t seen = 0;
+
+    ASSERT(!p2p_rpc_sid_accept(&last, &seen, 0));
+    ASSERT(p2p_rpc_sid_accept(&last, &seen, 5));
+    ASSERT(!p2p_rpc_sid_accept(&last, &seen, 5));
+    ASSERT(p2p_rpc_sid_accept(&last, &seen, 8));            // 6、7 尚未到达
+    ASSERT(p2p_rpc_sid_accept(&last, &seen, 7));
+    ASSERT(p2p_rpc_sid_accept(&last, &seen, 6));
+    ASSERT(!p2p_rpc_sid_accept(&last, &seen, 6));
+    ASSERT(!p2p_rpc_sid_accept(&last, &seen, 5));
+    ASSERT_EQ((int)last, 8);
+
+    ASSERT(p2p_rpc_sid_accept(&last, &seen, 40));           // 窗口前移 32：8 落在最后一位
+    ASSERT(!p2p_rpc_sid_accept(&last, &seen, 8));
+    ASSERT(!p2p_rpc_sid_accept(&last, &seen, 7));           // 超出位图范围，视为旧请求
+    ASSERT(p2p_rpc_sid_accept(&last, &seen, 9));
+
+    last = 65534; seen = 0;
+    ASSERT(p2p_rpc_sid_accept(&last, &seen, 1));            // 65535、0 跳过，回绕
+    ASSERT(p2p_rpc_sid_accept(&last, &seen, 65535));
+    ASSERT(!p2p_rpc_sid_accept(&last, &seen, 65534));
+    ASSERT(!p2p_rpc_sid_accept(&last, &seen, 1));
+    ASSERT(p2p_rpc_sid_accept(&last, &seen, 100));          // 远超窗口：位图清空
+    ASSERT(!p2p_rpc_sid_accept(&last, &seen, 1));
+    ASSERT_EQ((int)last, 100);
+}
+
+/* MSG RPC 分片：测试代替服务器在两个 COMPACT 会话的请求/响应槽之间转发 */
+void compact_on_request(struct p2p_session *s, uint16_t seq, uint8_t flags, const uint8_t *payload, int len, uint64_t now);
+void compact_on_response(struct p2p_session *s, uint16_t seq, uint8_t flags, const uint8_t *payload, int len, uint64_t now);
+
+static struct { uint16_t sid; uint8_t code; int len; uint8_t data[40000]; int calls; } g_frag_rx, g_frag_resp;
+static int g_frag_reply_len;
+
+static void frag_on_request(p2p_session_t ses, uint16_t sid, uint8_t msg, const void *data, int len, void *ud) {
+    (void)ud;
+    g_frag_rx.sid = sid; g_frag_rx.code = msg; g_frag_rx.len = len; g_frag_rx.calls++;
+    if (len > 0) memcpy(g_frag_rx.data, data, (size_t)len);
+    if (g_frag_reply_len >= 0) {
+        static uint8_t out[40000];
+        for (int i = 0; i < g_frag_reply_len; i++) out[i] = (uint8_t)(i * 7 + 3);
+        p2p_response(ses, 9, out, g_frag_reply_len);
+    }
+}
+
+static void frag_on_response(p2p_session_t ses, uint16_t sid, uint8_t code, const void *data, int len, void *ud) {
+    (void)ses; (void)ud;
+    g_frag_resp.sid = sid; g_frag_resp.code = code; g_frag_resp.len = len; g_frag_resp.calls++;
+    if (len > 0) memcpy(g_frag_resp.data, data, (size_t)len);
+}
+
+static struct p2p_session *create_rpc_session(uint32_t id) {
+    struct p2p_session *s = create_mock_session();
+    s->id = id;
+    s->inst->sig_mode = P2P_SIGNALING_MODE_COMPACT;
+    s->inst->sig_ctx.compact.feature_msg = true;
+    s->inst->sig_ctx.compact.rpc_window = P2P_RPC_WINDOW_MAX;
+    s->inst->cfg.on_request = frag_on_request;
+    s->inst->cfg.on_response = frag_on_response;
+    s->sig_sess.compact.state = SIG_COMPACT_SESS_READY;
+    rpc_init(&s->rpc);
+    return s;
+}
+
+/* 转发 a 的请求到 b、b 的响应回 a，直到没有新的包；返回转发的 RPC 数 */
+static int rpc_loopback(struct p2p_session *a, struct p2p_session *b) {
+    int total = 0, moved;
+    uint8_t pkt[P2P_SESS_ID_PSZ + 3 + P2P_MSG_DATA_MAX];
+    do {
+        moved = 0;
+        for (int i = 0; i < P2P_RPC_WINDOW_MAX; i++) {
+            p2p_compact_rpc_req_t *r = &a->sig_sess.compact.reqs[i];
+            if (!r->sid || r->state != 1) continue;
+            r->state = 2;                                           // 相当于收到 REQ_ACK
+            nwrite_l(pkt, a->id); nwrite_s(pkt + P2P_SESS_ID_PSZ, r->sid); pkt[P2P_SESS_ID_PSZ + 2] = r->msg;
+            memcpy(pkt + P2P_SESS_ID_PSZ + 3, r->data, (size_t)r->data_len);
+            compact_on_request(b, 0, SIG_FLAG_RELAY, pkt, P2P_SESS_ID_PSZ + 3 + r->data_len, P_tick_ms());
+            moved++;
+        }
+        for (int i = 0; i < P2P_RPC_WINDOW_MAX; i++) {
+            p2p_compact_rpc_resp_t *r = &b->sig_sess.compact.resps[i];
+            if (!r->sid || r->state != 1) continue;
+            uint16_t sid = r->sid; r->sid = 0;                     // 相当于收到 RESP_ACK
+            nwrite_l(pkt, r->session_id); nwrite_s(pkt + P2P_SESS_ID_PSZ, sid); pkt[P2P_SESS_ID_PSZ + 2] = r->code;
+            memcpy(pkt + P2P_SESS_ID_PSZ + 3, r->data, (size_t)r->data_len);
+            compact_on_response(a, 0, 0, pkt, P2P_SESS_ID_PSZ + 3 + r->data_len, P_tick_ms());
+            moved++;
+        }
+        total += moved;
+    } while (moved);
+    return total;
+}
+
+TEST(rpc_fragment_roundtrip) {
+    struct p2p_session *a = create_rpc_session(11), *b = create_rpc_session(22);
+    static uint8_t req[30000];
+    for (int i = 0; i < (int)sizeof(req); i++) req[i] = (uint8_t)(i * 31 + 1);
+
+    // 大请求 + 大应答：请求分片在窗口内并发，应答首片随 RESP 返回，其余由 A 拉取
+    memset(&g_frag_rx, 0, sizeof(g_frag_rx)); memset(&g_frag_resp, 0, sizeof(g_frag_resp));
+    g_frag_reply_len = 25000;
+    int sid = p2p_request((p2p_session_t)a, 7, req, sizeof(req));
+    ASSERT(sid > 0);
+    ASSERT_EQ(p2p_request((p2p_session_t)a, 7, req, sizeof(req)), E_BUSY);             // 同时只有一个分片请求
+    ASSERT(rpc_loopback(a, b) >= 2 * ((int)sizeof(req) / RPC_FRAG_CHUNK + 1));
+    ASSERT_EQ(g_frag_rx.calls, 1);
+    ASSERT_EQ(g_frag_rx.code, 7);
+    ASSERT_EQ(g_frag_rx.len, (int)sizeof(req));
+    ASSERT_EQ(memcmp(g_frag_rx.data, req, sizeof(req)), 0);
+    ASSERT_EQ(g_frag_resp.calls, 1);
+    ASSERT_EQ(g_frag_resp.sid, sid);
+    ASSERT_EQ(g_frag_resp.code, 9);
+    ASSERT_EQ(g_frag_resp.len, 25000);
+    for (int i = 0; i < 25000; i++) if (g_frag_resp.data[i] != (uint8_t)(i * 7 + 3)) { ASSERT(0); }
+    ASSERT(!a->rpc.tx_buf && !a->rpc.dl_buf && !b->rpc.rx_buf && !b->rpc.up_buf && !b->rpc.rx_sid);
+
+    // 普通请求的大应答
+    memset(&g_frag_resp, 0, sizeof(g_frag_resp));
+    g_frag_reply_len = 5000;
+    sid = p2p_request((p2p_session_t)a, 3, "hi", 2);
+    ASSERT(sid > 0);
+    rpc_loopback(a, b);
+    ASSERT_EQ(g_frag_rx.len, 2);
+    ASSERT_EQ(g_frag_resp.sid, sid);
+    ASSERT_EQ(g_frag_resp.len, 5000);
+    ASSERT_EQ(g_frag_resp.data[4999], (uint8_t)(4999 * 7 + 3));
+
+    // 大请求 + 一片以内的应答
+    g_frag_reply_len = 10;
+    sid = p2p_request((p2p_session_t)a, 7, req, 4000);
+    rpc_loopback(a, b);
+    ASSERT_EQ(g_frag_rx.len, 4000);
+    ASSERT_EQ(g_frag_resp.sid, sid);
+    ASSERT_EQ(g_frag_resp.len, 10);
+
+    // 超出接收端上限：整个请求以 P2P_MSG_ERR_FRAG 失败，不触发 on_request
+    b->inst->cfg.rpc_max_size = 8192;
+    g_frag_rx.calls = 0;
+    sid = p2p_request((p2p_session_t)a, 7, req, 10000);
+    rpc_loopback(a, b);
+    ASSERT_EQ(g_frag_rx.calls, 0);
+    ASSERT_EQ(g_frag_resp.sid, sid);
+    ASSERT_EQ(g_frag_resp.code, P2P_MSG_ERR_FRAG);
+    ASSERT_EQ(g_frag_resp.len, -1);
+
+    // 超出本端上限、保留 msg
+    a->inst->cfg.rpc_max_size = 2000;
+    ASSERT(p2p_request((p2p_session_t)a, 7, req, 3000) < 0);
+    ASSERT(p2p_request((p2p_session_t)a, P2P_MSG_FRAG, "x", 1) < 0);
+
+    rpc_reset(a); rpc_reset(b);
+    destroy_mock_session(a); destroy_mock_session(b);
+}
+
+/* 流压缩：压缩块按输出容量截断；DATA 包装入更多原始字节，回环投递后数据一致 */
+TEST(stream_lz_compress) {
+    static char json[6000];
+    int n = 0;
+    while (n < (int)sizeof(json) - 64)
+        n += sprintf(json + n, "{\"id\":%d,\"pos\":[%d,%d],\"state\":\"idle\"},", n % 97, n % 13, n % 7);
+
+    // 输出容量不足时只消耗能放下的前缀，解压得到同一前缀
+    uint8_t out[256], raw[P2P_LZ_RAW_MAX];
+    int used = n;
+    int clen = p2p_lz_compress((const uint8_t*)json, &used, out, sizeof(out));
+    ASSERT(clen > 0 && clen <= (int)sizeof(out));
+    ASSERT(used > clen && used < n);
+    ASSERT_EQ(p2p_lz_decompress(out, clen, raw, sizeof(raw)), used);
+    ASSERT_EQ(memcmp(raw, json, used), 0);
+    ASSERT_EQ(p2p_lz_decompress(out, clen, raw, used - 1), -1);
+
+    // 协商压缩后：6KB 文本远少于 6 个包
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    s->reliable.lz = true;
+    ASSERT_EQ(stream_write(&s->stream, json, n), n);
+    ASSERT_EQ(stream_flush_to_reliable(s), n);
+    ASSERT(s->reliable.send_count < n / P2P_STREAM_PAYLOAD);
+    ASSERT(s->reliable.send_buf[0].data[4] & P2P_FRAG_LZ);
+    ASSERT(p2p_compress_ratio(s) > 200);
+
+    int cnt = s->reliable.send_count;
+    for (int i = 0; i < cnt; i++)
+        ASSERT(stream_deliver(s, s->reliable.send_buf[i].data, s->reliable.send_buf[i].len) > 0);
+    static char buf[8192];
+    ASSERT_EQ(stream_read(&s->stream, buf, sizeof(buf)), n);
+    ASSERT_EQ(memcmp(buf, json, n), 0);
+
+    // 不可压缩数据：原样组包，并暂停尝试
+    static uint8_t noise[2000];
+    uint32_t x = 12345;
+    for (int i = 0; i < (int)sizeof(noise); i++) { x = x * 1103515245u + 12345u; noise[i] = (uint8_t)(x >> 16); }
+    stream_write(&s->stream, noise, sizeof(noise));
+    stream_flush_to_reliable(s);
+    ASSERT(!(s->reliable.send_buf[cnt].data[4] & P2P_FRAG_LZ));
+    ASSERT_EQ(s->reliable.send_buf[cnt].len, P2P_MAX_PAYLOAD);
+    ASSERT(s->stream.lz_skip > 0);
+
+    destroy_mock_session(s);
+}
+
+/* 文件收发：文件数据紧随调用前写入的数据，之后写入的数据排在文件之后；接收侧直接写入文件 */
+static int file_done_dir = -1, file_done_ret = 1;
+static int64_t file_progress_done;
+static void on_file_progress_cb(p2p_session_t s, int dir, int64_t done, int64_t total, void *ud) {
+    (void)s; (void)dir; (void)total; (void)ud;
+    file_progress_done = done;
+}
+static void on_file_done_cb(p2p_session_t s, int dir, int result, void *ud) {
+    (void)s; (void)ud;
+    file_done_dir = dir;
+    file_done_ret = result;
+}
+
+TEST(stream_file_transfer) {
+    static char data[3000], back[3000];
+    for (int i = 0; i < (int)sizeof(data); i++) data[i] = (char)(i * 7);
+    FILE *src = tmpfile(), *dst = tmpfile();
+    ASSERT(src && dst);
+    fwrite(data, 1, sizeof(data), src);
+    fflush(src);
+
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    s->file_tx.fd = s->file_rx.fd = -1;
+    s->inst->cfg.on_file_progress = on_file_progress_cb;
+    s->inst->cfg.on_file_done = on_file_done_cb;
+
+    ASSERT_EQ(p2p_send(s, "HDR", 3), 3);
+    ASSERT_EQ(p2p_send_file(s, fileno(src), 0, sizeof(data)), 0);
+    ASSERT_EQ(p2p_send_file(s, fileno(src), 0, sizeof(data)), -1);
+    ASSERT_EQ(p2p_send(s, "TAIL", 4), 4);
+
+    // 调用前的 3 字节单独成包，随后 3 个文件包；TAIL 在文件之后
+    ASSERT_EQ(stream_flush_to_reliable(s), 3 + (int)sizeof(data));
+    ASSERT_EQ(s->reliable.send_count, 4);
+    ASSERT_EQ(s->reliable.send_buf[0].len, P2P_DATA_HDR_SIZE + 3);
+    ASSERT_EQ(file_progress_done, (int64_t)sizeof(data));
+    ASSERT_EQ(stream_flush_to_reliable(s), 4);
+    ASSERT_EQ(s->reliable.send_count, 5);
+    ASSERT_EQ(file_done_dir, -1);
+
+    // 最后一个文件包确认后完成
+    s->reliable.send_base = (uint16_t)(s->reliable.send_seq - 1);
+    stream_flush_to_reliable(s);
+    ASSERT_EQ(file_done_dir, P2P_FILE_SEND);
+    ASSERT_EQ(file_done_ret, 0);
+
+    // 接收：应用读出头部后开始文件接收，已缓冲的文件数据先写入，其余按序写入，超出部分进入 recv_ring
+    char buf[16];
+    ASSERT_EQ(stream_deliver(s, s->reliable.send_buf[0].data, s->reliable.send_buf[0].len), 3);
+    ASSERT(stream_deliver(s, s->reliable.send_buf[1].data, s->reliable.send_buf[1].len) > 0);
+    ASSERT_EQ(p2p_recv(s, buf, 3), 3);
+    ASSERT_EQ(memcmp(buf, "HDR", 3), 0);
+    file_done_dir = -1;
+    ASSERT_EQ(p2p_recv_file(s, fileno(dst), 0, sizeof(data)), 0);
+    ASSERT_EQ(ring_used(&s->stream.recv_ring), 0);
+    for (int i = 2; i < 5; i++)
+        ASSERT(stream_deliver(s, s->reliable.send_buf[i].data, s->reliable.send_buf[i].len) > 0);
+    ASSERT_EQ(file_done_dir, P2P_FILE_RECV);
+    ASSERT_EQ(file_done_ret, 0);
+    ASSERT_EQ(p2p_recv(s, buf, sizeof(buf)), 4);
+    ASSERT_EQ(memcmp(buf, "TAIL", 4), 0);
+
+    rewind(dst);
+    ASSERT_EQ((int)fread(back, 1, sizeof(back), dst), (int)sizeof(data));
+    ASSERT_EQ(memcmp(back, data, sizeof(data)), 0);
+
+    fclose(src);
+    fclose(dst);
+    destroy_mock_session(s);
+}
+
+/* CRC32（STUN FINGERPRINT）：各长度与对齐下与逐位参考实现一致 */
+static uint32_t crc32_ref(const uint8_t *p, int len) {
+    uint32_t crc = 0xffffffff;
+    while (len--) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
+
+TEST(crc32_fingerprint) {
+    ASSERT_EQ(p2p_crc32((const uint8_t*)"123456789", 9), 0xcbf43926u);
+
+    static uint8_t buf[320];
+    for (int i = 0; i < (int)sizeof(buf); i++) buf[i] = (uint8_t)(i * 31 + 7);
+    for (int off = 0; off < 8; off++)
+        for (int len = 0; len + off <= (int)sizeof(buf); len += 13)
+            ASSERT_EQ(p2p_crc32(buf + off, len), crc32_ref(buf + off, len));
+}
+
+/* HMAC 上下文：RFC 2202 向量，且与一次性接口、ICE 检查包的 MESSAGE-INTEGRITY 一致 */
+TEST(hmac_sha1_ctx) {
+    static const struct { uint8_t kc; int klen; const char *msg; uint8_t mac[20]; } v[] = {
+        { 0x0b, 20, "Hi There",
+          {0xb6,0x17,0x31,0x86,0x55,0x05,0x72,0x64,0xe2,0x8b,0xc0,0xb6,0xfb,0x37,0x8c,0x8e,0xf1,0x46,0xbe,0x00} },
+        { 0xaa, 80, "Test Using Larger Than Block-Size Key - Hash Key First",
+          {0xaa,0x4a,0xe5,0xe1,0x52,0x72,0xd0,0x0e,0x95,0x70,0x56,0x37,0xce,0x8a,0x3b,0x55,0xed,0x40,0x21,0x12} },
+    };
+    uint8_t key[80], d1[20], d2[20];
+    for (int i = 0; i < 2; i++) {
+        memset(key, v[i].kc, sizeof(key));
+        p2p_hmac_sha1_ctx_t hc;
+        p2p_hmac_sha1_init(&hc, key, v[i].klen);
+        p2p_hmac_sha1_compute(&hc, (const uint8_t*)v[i].msg, (int)strlen(v[i].msg), d1);
+        ASSERT(memcmp(d1, v[i].mac, 20) == 0);
+        // 上下文可重复使用
+        p2p_hmac_sha1_compute(&hc, (const uint8_t*)v[i].msg, (int)strlen(v[i].msg), d2);
+        ASSERT(memcmp(d2, v[i].mac, 20) == 0);
+    }
+
+    const char *pwd = "Jefe", *msg = "what do ya want for nothing?";
+    static const uint8_t jefe[20] = {0xef,0xfc,0xdf,0x6a,0xe5,0xeb,0x2f,0xa2,0xd2,0x74,
+                                     0x16,0xd5,0xf1,0x84,0xdf,0x9c,0x25,0x9a,0x7c,0x79};
+    p2p_hmac_sha1((const uint8_t*)pwd, 4, (const uint8_t*)msg, (int)strlen(msg), d1);
+    ASSERT(memcmp(d1, jefe, 20) == 0);
+
+    // 0..299 字节各长度（多分组、填充跨入第二分组）的 MAC 异或累积与参考实现一致
+    static const uint8_t fold[20] = {0x22,0x02,0x84,0xf9,0x30,0x5a,0x5d,0x95,0x05,0x59,
+                                     0x0c,0xdd,0x18,0x7c,0x20,0x3c,0xf2,0x93,0x24,0x34};
+    static uint8_t buf[300];
+    uint8_t acc[20] = {0};
+    for (int i = 0; i < (int)sizeof(buf); i++) buf[i] = (uint8_t)(i * 37 + 11);
+    memset(key, 'k', 16);
+    p2p_hmac_sha1_ctx_t hk;
+    p2p_hmac_sha1_init(&hk, key, 16);
+    for (int len = 0; len < (int)sizeof(buf); len++) {
+        p2p_hmac_sha1_compute(&hk, buf, len, d1);
+        for (int j = 0; j < 20; j++) acc[j] ^= d1[j];
+    }
+    ASSERT(memcmp(acc, fold, 20) == 0);
+
+    // ICE 检查包的 MI = HMAC(remote_pwd, MI 之前的全部字节)
+    uint8_t pkt[256];
+    int n = p2p_ice_build_connectivity_check(pkt, sizeof(pkt), "lu", "lp", "ru", "remote-password",
+                                             100, 1, 0x1122334455667788ull, 1);
+    ASSERT(n > 20 + 24 + 8);
+    int mi = n - 8 - 24;
+    ASSERT_EQ(nget_s(pkt + mi), STUN_ATTR_MESSAGE_INTEGRITY);
+    uint16_t saved = nget_s(pkt + 2);
+    nwrite_s(pkt + 2, (uint16_t)(mi + 24 - 20));
+    p2p_hmac_sha1((const uint8_t*)"remote-password", 15, pkt, mi, d1);
+    nwrite_s(pkt + 2, saved);
+    ASSERT(memcmp(pkt + mi + 4, d1, 20) == 0);
+}
+
+/* DTLS 会话恢复缓存：按对端存取、满时替换最早条目、过期与丢弃 */
+TEST(dtls_resume_cache) {
+    struct p2p_instance *inst = calloc(1, sizeof(*inst));
+    ASSERT(inst);
+    ASSERT_EQ(p2p_dtls_cache_create(inst), E_NONE);
+    p2p_dtls_cache_t *c = inst->dtls_cache;
+
+    uint8_t blob[64], out[P2P_DTLS_RESUME_MAX];
+    memset(blob, 0xa5, sizeof(blob));
+    ASSERT_EQ(p2p_dtls_cache_get(inst, "alice", out, sizeof(out)), 0);
+    p2p_dtls_cache_put(inst, "alice", blob, sizeof(blob));
+    ASSERT_EQ(p2p_dtls_cache_get(inst, "alice", out, sizeof(out)), (int)sizeof(blob));
+    ASSERT(memcmp(out, blob, sizeof(blob)) == 0);
+    ASSERT_EQ(p2p_dtls_cache_get(inst, "alice", out, 16), 0);     // 容量不足
+    ASSERT_EQ(p2p_dtls_cache_get(inst, "", out, sizeof(out)), 0);  // 被动方无对端 ID
+
+    // 覆盖同一对端
+    blob[0] = 1;
+    p2p_dtls_cache_put(inst, "alice", blob, 10);
+    ASSERT_EQ(p2p_dtls_cache_get(inst, "alice", out, sizeof(out)), 10);
+    ASSERT_EQ(out[0], 1);
+
+    // 填满后替换最早保存的 alice
+    c->slots[0].stamp -= 1000;
+    char id[16];
+    for (int i = 0; i < P2P_DTLS_RESUME_SLOTS; i++) {
+        snprintf(id, sizeof(id), "peer%d", i);
+        p2p_dtls_cache_put(inst, id, blob, 20);
+    }
+    ASSERT_EQ(p2p_dtls_cache_get(inst, "alice", out, sizeof(out)), 0);
+    ASSERT_EQ(p2p_dtls_cache_get(inst, "peer7", out, sizeof(out)), 20);
+
+    // 过期条目取出时清除；丢弃；超长不缓存
+    for (int i = 0; i < P2P_DTLS_RESUME_SLOTS; i++)
+        if (!strcmp(c->slots[i].peer_id, "peer3")) c->slots[i].stamp -= P2P_DTLS_RESUME_TTL_MS;
+    ASSERT_EQ(p2p_dtls_cache_get(inst, "peer3", out, sizeof(out)), 0);
+    p2p_dtls_cache_drop(inst, "peer4");
+    ASSERT_EQ(p2p_dtls_cache_get(inst, "peer4", out, sizeof(out)), 0);
+    static uint8_t big[P2P_DTLS_RESUME_MAX + 1];
+    p2p_dtls_cache_put(inst, "bob", big, sizeof(big));
+    ASSERT_EQ(p2p_dtls_cache_get(inst, "bob", out, sizeof(out)), 0);
+
+    p2p_dtls_cache_free(inst);
+    ASSERT(inst->dtls_cache == NULL);
+    free(inst);
+}
+
+/* 假加密层：长度 >= 16 的记录视为已认证的应用数据（解出一个 DGRAM），否则视为握手包 */
+static int fake_dtls_decrypt(struct p2p_session *s, const uint8_t *in, int in_len, uint8_t *out, int out_cap) {
+    (void)s; (void)in; (void)out_cap;
+    if (in_len < 16) return 0;
+    p2p_pkt_hdr_encode(out, P2P_PKT_DGRAM, 0, 1);
+    memcpy(out + P2P_HDR_SIZE, "hi", 2);
+    return P2P_HDR_SIZE + 2;
+}
+static const p2p_dtls_ops_t fake_dtls = { .name = "fake", .decrypt_recv = fake_dtls_decrypt };
+
+/* DTLS CID：记录按 CID 找到会话；已认证记录来自新地址时直接迁移活跃路径 */
+TEST(dtls_cid_migrate) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    s->dtls = &fake_dtls;
+    s->nat.state = NAT_CONNECTED;
+    p2p_session_set_id(s, 0x11223344u);
+
+    struct sockaddr_in a = { .sin_family = AF_INET, .sin_port = htons(5000) };
+    struct sockaddr_in b = a, c = a;
+    a.sin_addr.s_addr = htonl(0x0a000001);
+    b.sin_addr.s_addr = htonl(0x0a000002);
+    c.sin_addr.s_addr = htonl(0x0a000003);
+    ASSERT(p2p_cand_push_remote(s) == 0);
+    s->remote_cands[0].addr = a;
+    s->remote_cands[0].type = P2P_CAND_SRFLX;
+    p2p_set_active_path(s, 0);
+    ASSERT_EQ(s->path_type, P2P_PATH_PUNCH);
+
+    // tls12_cid 记录头：[25][ver][epoch][seq(6)][cid(4)][len]
+    uint8_t rec[32] = { P2P_DTLS_CT_CID, 0xfe, 0xfd };
+    nwrite_l(rec + 11, s->id);
+    uint32_t cid = 0;
+    ASSERT(p2p_dtls_record_cid(rec, sizeof(rec), &cid));
+    ASSERT_EQ(cid, s->id);
+    ASSERT(p2p_session_find(inst, cid) == s);
+    rec[0] = 23;
+    ASSERT(!p2p_dtls_record_cid(rec, sizeof(rec), &cid));
+    ASSERT(!p2p_dtls_record_cid(rec, 14, &cid));
+
+    // 未认证（握手）记录不触发迁移
+    uint64_t now = P_tick_ms();
+    nat_proto(s, P2P_PKT_CRYPTO, 0, 0, rec, 8, &c, now);
+    ASSERT_EQ(s->active_path, 0);
+    ASSERT_EQ(s->remote_cand_cnt, 1);
+
+    // 已认证记录来自新地址：切到新 PRFLX 候选，并登记到地址索引
+    nat_proto(s, P2P_PKT_CRYPTO, 0, 0, rec, sizeof(rec), &b, now);
+    ASSERT_EQ(s->remote_cand_cnt, 2);
+    ASSERT_EQ(s->active_path, 1);
+    ASSERT(sockaddr_equal(&s->active_addr, &b));
+    ASSERT(p2p_session_find_by_addr(inst, &b) == s);
+    ASSERT(p2p_session_find_by_addr(inst, &a) == NULL);
+
+    // 来自已知候选的记录由路径管理决定，不触发迁移
+    nat_proto(s, P2P_PKT_CRYPTO, 0, 0, rec, sizeof(rec), &a, now);
+    ASSERT_EQ(s->active_path, 1);
+
+    s->dtls = NULL;
+    free(s->remote_cands);
+    free(inst->sess_by_id.slots);
+    free(inst->sess_by_addr.slots);
+    destroy_mock_session(s);
+}
+
+/* 内置 AEAD 加密层：RFC 8439 向量，CONN 交换随机数后双向加解密，拒绝重放 / 篡改 / 反射 */
+static uint8_t aead_rec[P2P_MTU];
+static int aead_rec_len;
+static ret_t aead_capture(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
+                          const void *payload, uint16_t payload_len) {
+    (void)s; (void)flags; (void)seq;
+    if (type != P2P_PKT_CRYPTO || payload_len > sizeof(aead_rec)) return E_INVALID;
+    memcpy(aead_rec, payload, payload_len);
+    aead_rec_len = payload_len;
+    return E_NONE;
+}
+
+TEST(aead_layer) {
+    static const char sun[] = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip "
+                              "for the future, sunscreen would be it.";
+    const size_t sun_len = sizeof(sun) - 1;
+    uint8_t key[32], nonce[12] = {0}, out[1024], tag[16];
+
+    // ChaCha20（§2.4.2）
+    for (int i = 0; i < 32; i++) key[i] = (uint8_t)i;
+    nonce[7] = 0x4a;
+    static const uint8_t ct0[16] = {0x6e,0x2e,0x35,0x9a,0x25,0x68,0xf9,0x80,0x41,0xba,0x07,0x28,0xdd,0x0d,0x69,0x81};
+    p2p_chacha20_xor(key, nonce, 1, (const uint8_t*)sun, out, sun_len);
+    ASSERT(memcmp(out, ct0, 16) == 0);
+    ASSERT_EQ(out[sun_len - 1], 0x4d);
+
+    // 四块并行与逐块计算一致，且可原地加解密
+    static uint8_t big[1000], ref[1000];
+    for (int i = 0; i < (int)sizeof(big); i++) big[i] = (uint8_t)(i * 7);
+    for (int off = 0; off < (int)sizeof(big); off += 64) {
+        int n = sizeof(big) - off < 64 ? (int)sizeof(big) - off : 64;
+        p2p_chacha20_xor(key, nonce, 1 + off / 64, big + off, ref + off, (size_t)n);
+    }
+    p2p_chacha20_xor(key, nonce, 1, big, big, sizeof(big));
+    ASSERT(memcmp(big, ref, sizeof(big)) == 0);
+
+    // Poly1305（§2.5.2）
+    static const uint8_t pkey[32] = {0x85,0xd6,0xbe,0x78,0x57,0x55,0x6d,0x33,0x7f,0x44,0x52,0xfe,0x42,0xd5,0x06,0xa8,
+                                     0x01,0x03,0x80,0x8a,0xfb,0x0d,0xb2,0xfd,0x4a,0xbf,0xf6,0xaf,0x41,0x49,0xf5,0x1b};
+    static const uint8_t ptag[16] = {0xa8,0x06,0x1d,0xc1,0x30,0x51,0x36,0xc6,0xc2,0x2b,0x8b,0xaf,0x0c,0x01,0x27,0xa9};
+    p2p_poly1305(pkey, (const uint8_t*)"Cryptographic Forum Research Group", 34, tag);
+    ASSERT(memcmp(tag, ptag, 16) == 0);
+
+    // AEAD（§2.8.2）
+    static const uint8_t an[12] = {0x07,0,0,0,0x40,0x41,0x42,0x43,0x44,0x45,0x46,0x47};
+    static const uint8_t aad[12] = {0x50,0x51,0x52,0x53,0xc0,0xc1,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7};
+    static const uint8_t atag[16] = {0x1a,0xe1,0x0b,0x59,0x4f,0x09,0xe2,0x6a,0x7e,0x90,0x2e,0xcb,0xd0,0x60,0x06,0x91};
+    for (int i = 0; i < 32; i++) key[i] = (uint8_t)(0x80 + i);
+    p2p_aead_seal(key, an, aad, sizeof(aad), (const uint8_t*)sun, sun_len, out, tag);
+    ASSERT_EQ(out[0], 0xd3);
+    ASSERT(memcmp(tag, atag, 16) == 0);
+    ASSERT_EQ(p2p_aead_open(key, an, aad, sizeof(aad), out, sun_len, tag, out), 0);
+    ASSERT(memcmp(out, sun, sun_len) == 0);
+    tag[0] ^= 1;
+    ASSERT_EQ(p2p_aead_open(key, an, aad, sizeof(aad), out, sun_len, tag, out), -1);
+
+    // 加密层：无 auth_key 时初始化失败
+    struct p2p_session *a = create_mock_session();
+    struct p2p_session *b = create_mock_session();
+    a->dtls = b->dtls = &p2p_dtls_aead;
+    ASSERT(a->dtls->init(a) != 0);
+    a->inst->cfg.auth_key = b->inst->cfg.auth_key = "shared-secret";
+    ASSERT_EQ(a->dtls->init(a), 0);
+    ASSERT_EQ(b->dtls->init(b), 0);
+    ASSERT(!a->dtls->is_ready(a));
+
+    // 随机数随 CONN / CONN_ACK 能力通告交换，之后双方就绪
+    uint8_t caps[RELIABLE_CAPS_MAX_PSZ];
+    int n = reliable_write_caps(a, caps);
+    ASSERT_EQ(n, RELIABLE_CAPS_PSZ + 1 + 16 + 1);
+    ASSERT(caps[0] & RELIABLE_CAP_CRYPTO);
+    reliable_on_caps(b, caps, n);
+    ASSERT(b->dtls->is_ready(b));
+    ASSERT(b->reliable.bundle);             // caps2 位于加密层参数之后
+    reliable_on_caps(a, caps, reliable_write_caps(b, caps));
+    ASSERT(a->dtls->is_ready(a));
+
+    // a → b：记录 = [seq(8)][密文][tag(16)]
+    a->path_type = P2P_PATH_SIGNALING;
+    a->inst->signaling_relay_fn = aead_capture;
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    uint8_t plain[P2P_HDR_SIZE + 5], rec1[64];
+    p2p_pkt_hdr_encode(plain, P2P_PKT_DGRAM, 0, 7);
+    memcpy(plain + P2P_HDR_SIZE, "hello", 5);
+    ASSERT_EQ(a->dtls->encrypt_send(a, &addr, plain, sizeof(plain)), (int)sizeof(plain));
+    ASSERT_EQ(aead_rec_len, 8 + (int)sizeof(plain) + 16);
+    ASSERT(memcmp(aead_rec + 8, plain, sizeof(plain)) != 0);
+    memcpy(rec1, aead_rec, aead_rec_len);
+    int rec1_len = aead_rec_len;
+    ASSERT_EQ(a->dtls->encrypt_send(a, &addr, plain, sizeof(plain)), (int)sizeof(plain));
+
+    // 乱序到达均可解密；重放、篡改、反射回发送方的记录被拒
+    ASSERT_EQ(b->dtls->decrypt_recv(b, aead_rec, aead_rec_len, out, sizeof(out)), (int)sizeof(plain));
+    ASSERT_EQ(b->dtls->decrypt_recv(b, rec1, rec1_len, out, sizeof(out)), (int)sizeof(plain));
+    ASSERT(memcmp(out, plain, sizeof(plain)) == 0);
+    ASSERT_EQ(b->dtls->decrypt_recv(b, rec1, rec1_len, out, sizeof(out)), -1);
+    ASSERT_EQ(a->dtls->encrypt_send(a, &addr, plain, sizeof(plain)), (int)sizeof(plain));
+    aead_rec[10] ^= 0x80;
+    ASSERT_EQ(b->dtls->decrypt_recv(b, aead_rec, aead_rec_len, out, sizeof(out)), -1);
+    aead_rec[10] ^= 0x80;
+    ASSERT_EQ(a->dtls->decrypt_recv(a, aead_rec, aead_rec_len, out, sizeof(out)), -1);
+    ASSERT_EQ(b->dtls->decrypt_recv(b, aead_rec, aead_rec_len, out, sizeof(out)), (int)sizeof(plain));
+
+    a->dtls->close(a);
+    b->dtls->close(b);
+    a->dtls = b->dtls = NULL;
+    destroy_mock_session(a);
+    destroy_mock_session(b);
+}
+
+/* 加密线程池：发送合并期间记录以明文入队、flush 时并行封装且按序号顺序发出；批量预解开的记录由加密层取用 */
+TEST(crypto_pool) {
+    struct p2p_session *a = create_mock_session();
+    struct p2p_session *b = create_mock_session();
+    struct p2p_instance *inst = a->inst;
+    a->dtls = b->dtls = &p2p_dtls_aead;
+    a->inst->cfg.auth_key = b->inst->cfg.auth_key = "shared-secret";
+    ASSERT_EQ(a->dtls->init(a), 0);
+    ASSERT_EQ(b->dtls->init(b), 0);
+    uint8_t caps[RELIABLE_CAPS_MAX_PSZ];
+    reliable_on_caps(b, caps, reliable_write_caps(a, caps));
+    reliable_on_caps(a, caps, reliable_write_caps(b, caps));
+    ASSERT(a->dtls->is_ready(a) && b->dtls->is_ready(b));
+
+    // 非 AEAD 后端不启用
+    inst->cfg.crypto_workers = 3;
+    ASSERT_EQ(p2p_crypto_start(inst), E_NONE);
+    ASSERT(inst->crypto == NULL);
+    inst->cfg.dtls_backend = 3;
+    ASSERT_EQ(p2p_crypto_start(inst), E_NONE);
+    ASSERT(inst->crypto != NULL && inst->crypto_rx != NULL);
+
+    struct sockaddr_in lo;
+    memset(&lo, 0, sizeof(lo));
+    lo.sin_family = AF_INET;
+    lo.sin_addr.s_addr = htonl(0x7f000001);
+    inst->sock_cnt = 0;
+    ASSERT_EQ(p2p_udp_open(inst, &lo, 0), E_NONE);
+    struct sockaddr_in self = inst->socks[0].local_addr;
+    a->path_type = P2P_PATH_PUNCH;
+    a->active_path = -1;
+
+    // 入队时只分配序号（明文仍可见），flush 后为密文
+    enum { N = 20 };
+    uint8_t plain[P2P_HDR_SIZE + 200];
+    p2p_udp_tx_begin(inst);
+    for (int i = 0; i < N; i++) {
+        p2p_pkt_hdr_encode(plain, P2P_PKT_DGRAM, 0, (uint16_t)i);
+        memset(plain + P2P_HDR_SIZE, 'a' + i, sizeof(plain) - P2P_HDR_SIZE);
+        ASSERT_EQ(a->dtls->encrypt_send(a, &self, plain, sizeof(plain)), (int)sizeof(plain));
+    }
+    ASSERT_EQ(inst->txq.cnt, N);
+    ASSERT_EQ(inst->txq.seal_cnt, N);
+    ASSERT(memcmp(inst->txq.slots[N - 1].buf + P2P_HDR_SIZE + 8, plain, sizeof(plain)) == 0);
+    p2p_udp_tx_end(inst);
+    ASSERT_EQ(inst->txq.cnt, 0);
+    ASSERT_EQ(inst->txq.seal_cnt, 0);
+
+    // 对端按到达顺序解开，内层序号连续
+    int got = 0;
+    uint8_t out[P2P_HDR_SIZE + P2P_PMTU_PAYLOAD_MAX];
+    for (int tries = 0; got < N && tries < 100; tries++) {
+        int n = p2p_udp_recv_batch(inst, P2P_UDP_BATCH_SLOTS);
+        if (n <= 0) { P_usleep(1000); continue; }
+        for (int i = 0; i < n; i++, got++) {
+            p2p_udp_slot_t *slot = &inst->rx_slots[i];
+            ASSERT_EQ(slot->buf[0], P2P_PKT_CRYPTO);
+            ASSERT_EQ(b->dtls->decrypt_recv(b, slot->buf + P2P_HDR_SIZE, slot->len - P2P_HDR_SIZE, out, sizeof(out)),
+                      (int)sizeof(plain));
+            p2p_packet_hdr_t hdr;
+            p2p_pkt_hdr_decode(out, &hdr);
+            ASSERT_EQ(hdr.seq, got);
+            ASSERT_EQ(out[P2P_HDR_SIZE], 'a' + got);
+        }
+    }
+    ASSERT_EQ(got, N);
+
+    // 非发送合并时就地封装后直接发出
+    ASSERT_EQ(a->dtls->encrypt_send(a, &self, plain, sizeof(plain)), (int)sizeof(plain));
+    ASSERT_EQ(inst->txq.cnt, 0);
+
+    // 预解开：认证通过的取用任务明文，篡改的被拒；任务不属于本条记录时就地解密
+    enum { M = 8 };
+    static uint8_t recs[M][8 + sizeof(plain) + 16];
+    a->path_type = P2P_PATH_SIGNALING;
+    a->inst->signaling_relay_fn = aead_capture;
+    for (int i = 0; i < M; i++) {
+        p2p_pkt_hdr_encode(plain, P2P_PKT_DGRAM, 0, (uint16_t)(100 + i));
+        ASSERT_EQ(a->dtls->encrypt_send(a, &self, plain, sizeof(plain)), (int)sizeof(plain));
+        ASSERT_EQ(aead_rec_len, (int)sizeof(recs[i]));
+        memcpy(recs[i], aead_rec, sizeof(recs[i]));
+    }
+    recs[3][20] ^= 1;
+    p2p_aead_job_t *jobs = inst->crypto_rx;
+    for (int i = 0; i < M; i++) ASSERT(b->dtls->open_prepare(b, recs[i], sizeof(recs[i]), &jobs[i]));
+    p2p_crypto_run(inst, jobs, M);
+    for (int i = 0; i < M; i++) {
+        b->inst->crypto_rx_cur = &jobs[i == 5 ? 6 : i];
+        int r = b->dtls->decrypt_recv(b, recs[i], sizeof(recs[i]), out, sizeof(out));
+        b->inst->crypto_rx_cur = NULL;
+        if (i == 3) { ASSERT_EQ(r, -1); ASSERT_EQ(jobs[i].result, -1); continue; }
+        ASSERT_EQ(r, (int)sizeof(plain));
+        p2p_packet_hdr_t hdr;
+        p2p_pkt_hdr_decode(out, &hdr);
+        ASSERT_EQ(hdr.seq, 100 + i);
+    }
+    // 已接受的记录不再预解开（重放）
+    ASSERT(!b->dtls->open_prepare(b, recs[0], sizeof(recs[0]), &jobs[0]));
+
+    p2p_crypto_stop(inst);
+    ASSERT(inst->crypto == NULL && inst->crypto_rx == NULL);
+    P_sock_close(inst->socks[0].sock);
+    inst->socks[0].sock = mock_sock;
+    free(inst->rx_slots); inst->rx_slots = NULL;
+    free(inst->txq.slots); inst->txq.slots = NULL;
+    free(inst->txq.seals); inst->txq.seals = NULL;
+    a->dtls->close(a);
+    b->dtls->close(b);
+    a->dtls = b->dtls = NULL;
+    destroy_mock_session(a);
+    destroy_mock_session(b);
+}
+
+/* 共享执行器：多个实例由同一组线程服务，回环直连建立；不满足条件的实例仍启动独立线程 */
+static void exec_add_remote(p2p_session_t s, uint16_t port) {
+    char sdp[128];
+    snprintf(sdp, sizeof(sdp), "a=candidate:1 1 UDP 2130706431 127.0.0.1 %u typ host\r\n", (unsigned)port);
+    p2p_import_ice_sdp(s, sdp);
+}
+
+TEST(shared_executor) {
+    enum { N = 4 };
+    ASSERT_EQ(p2p_executor_start(0), -1);
+    ASSERT_EQ(p2p_executor_start(2), 0);
+    ASSERT_EQ(p2p_executor_start(2), -1);
+
+    p2p_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.signaling_mode = P2P_SIGNALING_MODE_ICE;
+    cfg.skip_stun_test = true;
+    cfg.test_ice_host_off = true;
+    cfg.test_ice_srflx_off = true;
+    cfg.test_ice_relay_off = true;
+    cfg.threaded = true;
+    cfg.shared_executor = true;
+
+    p2p_handle_t h[N];
+    p2p_session_t s[N];
+    uint16_t base = (uint16_t)(42000 + (getpid() % 1000) * 8);
+    char id[N][16];
+    for (int i = 0; i < N; i++) {
+        snprintf(id[i], sizeof(id[i]), "exec_%d", i);
+        cfg.bind_port = (uint16_t)(base + i);
+        cfg.worker_count = i == N - 1 ? 2 : 0;          // 分片模式不使用共享执行器
+        h[i] = p2p_create(id[i], &cfg);
+        ASSERT(h[i] != NULL);
+        ASSERT(((struct p2p_instance *)h[i])->thread_running);
+        ASSERT_EQ(((struct p2p_instance *)h[i])->exec != NULL, i != N - 1);
+    }
+    for (int i = 0; i < N; i++) {
+        s[i] = p2p_connect(h[i], id[i ^ 1], false);
+        ASSERT(s[i] != NULL);
+        exec_add_remote(s[i], (uint16_t)(base + (i ^ 1)));
+    }
+
+    uint64_t t0 = P_tick_ms();
+    bool ready = false;
+    while (!ready && P_tick_ms() - t0 < 5000) {
+        ready = true;
+        for (int i = 0; i < N; i++) if (!p2p_is_ready(s[i])) ready = false;
+        if (!ready) P_usleep(5000);
+    }
+    ASSERT(ready);
+
+    for (int i = 0; i < N; i++) p2p_destroy(h[i]);
+    p2p_executor_stop();
+    ASSERT_EQ(p2p_executor_start(1), 0);
+    p2p_executor_stop();
+}
+
+/* 检查表调度：按候选对优先级逐个检查，每 Ta 最多一个 PUNCH；同 foundation 冻结，成功后解冻 */
+static void check_add_cand(struct p2p_session *s, p2p_cand_type_t type, uint32_t ip, uint16_t port) {
+    int i = p2p_cand_push_remote(s);
+    s->remote_cands[i].type = type;
+    s->remote_cands[i].addr.sin_family = AF_INET;
+    s->remote_cands[i].addr.sin_addr.s_addr = htonl(ip);
+    s->remote_cands[i].addr.sin_port = htons(port);
+}
+
+TEST(ice_check_schedule) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    strcpy(s->inst->local_peer_id, "alice");
+    strcpy(s->remote_peer_id, "bob");
+
+    check_add_cand(s, P2P_CAND_SRFLX, 0x0a000001, 5000);    // 0
+    check_add_cand(s, P2P_CAND_HOST,  0xc0a80102, 5000);    // 1
+    check_add_cand(s, P2P_CAND_HOST,  0xc0a80102, 5001);    // 2: 与 1 同 foundation
+    check_add_cand(s, P2P_CAND_RELAY, 0x0a000009, 3478);    // 3
+
+    uint64_t now = P_tick_ms();
+    s->nat.state = NAT_PUNCHING;
+    s->nat.punch_start = now;
+
+    // 首拍：最高优先级的 host，同 foundation 的另一个 host 冻结
+    nat_tick(s, now);
+    ASSERT_EQ(s->remote_cands[1].check, NAT_CHECK_IN_PROGRESS);
+    ASSERT_EQ(s->remote_cands[2].check, NAT_CHECK_FROZEN);
+    ASSERT_EQ(s->remote_cands[0].check, NAT_CHECK_WAITING);
+    ASSERT_EQ(s->remote_cands[3].check, NAT_CHECK_WAITING);
+    ASSERT(s->remote_cands[1].pair_prio > s->remote_cands[0].pair_prio);
+    ASSERT(s->remote_cands[0].pair_prio > s->remote_cands[3].pair_prio);
+    ASSERT_EQ(s->remote_cands[1].last_punch_send_ms, now);
+    ASSERT_EQ(s->remote_cands[0].last_punch_send_ms, 0);
+
+    // Ta 内不再发送
+    nat_tick(s, now + 10);
+    ASSERT_EQ(s->remote_cands[0].last_punch_send_ms, 0);
+    ASSERT_EQ(nat_next_timeout(s, now + 10), 40);
+
+    nat_tick(s, now + 50);
+    ASSERT_EQ(s->remote_cands[0].last_punch_send_ms, now + 50);
+    ASSERT_EQ(s->remote_cands[3].last_punch_send_ms, 0);
+
+    // host 路径可写：成功并解冻同 foundation 的候选对，其优先级高于 relay
+    s->remote_cands[1].stats.state = PATH_STATE_ACTIVE;
+    nat_tick(s, now + 100);
+    ASSERT_EQ(s->remote_cands[1].check, NAT_CHECK_SUCCEEDED);
+    ASSERT_EQ(s->remote_cands[2].last_punch_send_ms, now + 100);
+    ASSERT_EQ(s->remote_cands[3].last_punch_send_ms, 0);
+
+    nat_tick(s, now + 150);
+    ASSERT_EQ(s->remote_cands[3].last_punch_send_ms, now + 150);
+
+    // 全部已检查：等待最早发送的候选对到期重传
+    nat_tick(s, now + 200);
+    ASSERT_EQ(nat_next_timeout(s, now + 200), 300);
+
+    // 对端 PUNCH 来自新地址：PRFLX 入表并在下一拍优先检查
+    struct sockaddr_in from = s->remote_cands[0].addr;
+    from.sin_port = htons(6000);
+    uint8_t punch[P2P_PKT_PUNCH_PSZ] = {0};
+    nat_proto(s, P2P_PKT_PUNCH, 0, 1, punch, sizeof(punch), &from, now + 210);
+    ASSERT_EQ(s->remote_cand_cnt, 5);
+    ASSERT_EQ(s->nat.check_trigger, 5);
+    nat_tick(s, now + 250);
+    ASSERT_EQ(s->remote_cands[4].check, NAT_CHECK_IN_PROGRESS);
+    ASSERT_EQ(s->remote_cands[4].last_punch_send_ms, now + 250);
+
+    // 重传仍按 Ta 节拍逐个发送，最久未发送者优先
+    nat_tick(s, now + 500);
+    ASSERT_EQ(s->remote_cands[1].last_punch_send_ms, now + 500);
+    ASSERT_EQ(s->remote_cands[0].last_punch_send_ms, now + 50);
+    nat_tick(s, now + 550);
+    ASSERT_EQ(s->remote_cands[0].last_punch_send_ms, now + 550);
+
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+
+/* 候选类型历史：本网络上打通过的类型先检查，首拍并行检查；只失败过的类型排在后面 */
+TEST(ice_check_history) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    ASSERT_EQ(nat_hist_create(s->inst), E_NONE);
+
+    check_add_cand(s, P2P_CAND_HOST,  0xc0a80102, 5000);    // 0
+    check_add_cand(s, P2P_CAND_SRFLX, 0x0a000001, 5000);    // 1
+    check_add_cand(s, P2P_CAND_RELAY, 0x0a000009, 3478);    // 2
+
+    // 首轮无历史：按候选对优先级逐拍检查，经 srflx 打通
+    uint64_t now = P_tick_ms();
+    s->nat.state = NAT_PUNCHING;
+    s->nat.punch_start = now;
+    nat_tick(s, now);
+    ASSERT_EQ(s->remote_cands[0].check, NAT_CHECK_IN_PROGRESS);
+    ASSERT_EQ(s->remote_cands[1].check, NAT_CHECK_WAITING);
+    nat_tick(s, now + 50);
+    ASSERT_EQ(s->remote_cands[1].check, NAT_CHECK_IN_PROGRESS);
+    s->active_path = 1;
+    nat_hist_record(s, true, now + 80);
+    nat_hist_record(s, false, now + 90);                    // 每轮只记一次
+
+    const nat_hist_entry_t *e = &s->inst->nat_hist->slots[0];
+    ASSERT_EQ(e->tries[P2P_CAND_HOST], 1);
+    ASSERT_EQ(e->wins[P2P_CAND_HOST], 0);
+    ASSERT_EQ(e->tries[P2P_CAND_SRFLX], 1);
+    ASSERT_EQ(e->wins[P2P_CAND_SRFLX], 1);
+    ASSERT_EQ(e->ms[P2P_CAND_SRFLX], 80);
+    ASSERT_EQ(e->tries[P2P_CAND_RELAY], 0);                 // 未检查的类型不计入
+
+    // 下一轮：另一个 srflx 与原 srflx 首拍并行检查，未检查过的 relay 其次，只失败过的 host 最后
+    check_add_cand(s, P2P_CAND_SRFLX, 0x0a000002, 5000);    // 3
+    for (int i = 0; i < s->remote_cand_cnt; i++) s->remote_cands[i].check = NAT_CHECK_NONE;
+    s->nat.last_check_ms = 0;
+    s->nat.hist_done = false;
+    s->active_path = PATH_IDX_NONE;
+    now += 1000;
+    nat_tick(s, now);
+    ASSERT(s->remote_cands[1].hist > NAT_HIST_NEUTRAL);
+    ASSERT_EQ(s->remote_cands[2].hist, NAT_HIST_NEUTRAL);
+    ASSERT(s->remote_cands[0].hist < NAT_HIST_NEUTRAL);
+    ASSERT_EQ(s->remote_cands[1].check, NAT_CHECK_IN_PROGRESS);
+    ASSERT_EQ(s->remote_cands[3].check, NAT_CHECK_IN_PROGRESS);
+    ASSERT_EQ(s->remote_cands[2].check, NAT_CHECK_WAITING);
+    ASSERT_EQ(s->remote_cands[0].check, NAT_CHECK_WAITING);
+    nat_tick(s, now + 50);
+    ASSERT_EQ(s->remote_cands[2].check, NAT_CHECK_IN_PROGRESS);
+    ASSERT_EQ(s->remote_cands[0].check, NAT_CHECK_WAITING);
+
+    // 超时失败：本轮检查过的类型均计一次失败
+    nat_hist_record(s, false, now + 100);
+    ASSERT_EQ(e->tries[P2P_CAND_SRFLX], 2);
+    ASSERT_EQ(e->wins[P2P_CAND_SRFLX], 1);
+    ASSERT_EQ(e->tries[P2P_CAND_RELAY], 1);
+    ASSERT_EQ(e->tries[P2P_CAND_HOST], 1);
+
+    nat_reset(&s->nat);
+    nat_hist_free(s->inst);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+
+/* 同一 NAT 之后（对端 srflx 与本端公网地址同 IP）：host 候选（含不同网段）先于 srflx 并行检查 */
+TEST(ice_check_same_nat) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    s->inst->sig_mode = P2P_SIGNALING_MODE_COMPACT;
+    s->inst->sig_ctx.compact.public_addr.sin_addr.s_addr = htonl(0x01020304);
+
+    check_add_cand(s, P2P_CAND_HOST,  0xc0a80102, 5000);    // 0
+    check_add_cand(s, P2P_CAND_HOST,  0x0a010007, 5000);    // 1: 经内网路由可达的其他网段
+    check_add_cand(s, P2P_CAND_HOST,  0xac100003, 5000);    // 2
+
+    // 尚不知对端公网地址：逐拍检查
+    uint64_t now = P_tick_ms();
+    s->nat.state = NAT_PUNCHING;
+    s->nat.punch_start = now;
+    nat_tick(s, now);
+    ASSERT(!s->nat.same_nat);
+    ASSERT_EQ(s->remote_cands[0].check, NAT_CHECK_IN_PROGRESS);
+    ASSERT_EQ(s->remote_cands[1].check, NAT_CHECK_WAITING);
+
+    // 对端 srflx 与本端同 IP：其余 host 候选下一拍并行检查，srflx 排在后面
+    check_add_cand(s, P2P_CAND_SRFLX, 0x01020304, 6000);    // 3
+    nat_tick(s, now + 50);
+    ASSERT(s->nat.same_nat);
+    ASSERT_EQ(s->remote_cands[1].hist, NAT_HIST_SAME_NAT);
+    ASSERT_EQ(s->remote_cands[1].check, NAT_CHECK_IN_PROGRESS);
+    ASSERT_EQ(s->remote_cands[2].check, NAT_CHECK_IN_PROGRESS);
+    ASSERT_EQ(s->remote_cands[3].check, NAT_CHECK_WAITING);
+    nat_tick(s, now + 100);
+    ASSERT_EQ(s->remote_cands[3].check, NAT_CHECK_IN_PROGRESS);
+
+    // 新一轮：首拍即并行检查全部 host
+    for (int i = 0; i < s->remote_cand_cnt; i++) s->remote_cands[i].check = NAT_CHECK_NONE;
+    s->nat.last_check_ms = 0;
+    now += 1000;
+    nat_tick(s, now);
+    for (int i = 0; i < 3; i++) ASSERT_EQ(s->remote_cands[i].check, NAT_CHECK_IN_PROGRESS);
+    ASSERT_EQ(s->remote_cands[3].check, NAT_CHECK_WAITING);
+
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+
+/* 打洞 / CONN 超时按 RTT 缩放：无样本时取上限，有样本时数个 RTT 后放弃（不低于下限） */
+TEST(nat_rtt_scaled_timeouts) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    check_add_cand(s, P2P_CAND_SRFLX, 0x0a000001, 5000);
+    s->remote_cand_done = true;
+
+    // 无 RTT 样本：打洞超时 = 上限 5000ms
+    uint64_t now = P_tick_ms();
+    s->nat.state = NAT_PUNCHING;
+    s->nat.punching = 1;
+    s->nat.punch_start = now;
+    nat_tick(s, now + 4999);
+    ASSERT_EQ(s->nat.state, NAT_PUNCHING);
+    nat_tick(s, now + 5000);
+    ASSERT_EQ(s->nat.state, NAT_CLOSED);
+
+    // 候选 RTT 20ms：8 RTT + Ta + PUNCH 间隔 = 710ms，取下限 1500ms
+    s->remote_cands[0].stats.rt_rtt_direct_srtt = 20;
+    s->remote_cands[0].check = NAT_CHECK_NONE;
+    s->nat.state = NAT_PUNCHING;
+    s->nat.hist_done = false;
+    s->nat.punch_start = now;
+    nat_tick(s, now + 1499);
+    ASSERT_EQ(s->nat.state, NAT_PUNCHING);
+    nat_tick(s, now + 1500);
+    ASSERT_EQ(s->nat.state, NAT_CLOSED);
+
+    // 下限可调：RTT 200ms → 8 × 200 + 550 = 2150ms
+    ASSERT_EQ(p2p_tune_set(NULL, s, P2P_TUNE_PUNCH_TIMEOUT_MIN_MS, 500), 0);
+    s->remote_cands[0].stats.rt_rtt_direct_srtt = 200;
+    s->nat.state = NAT_PUNCHING;
+    s->nat.punch_start = now;
+    nat_tick(s, now + 2149);
+    ASSERT_EQ(s->nat.state, NAT_PUNCHING);
+    nat_tick(s, now + 2150);
+    ASSERT_EQ(s->nat.state, NAT_CLOSED);
+
+    // CONN：6 RTT + CONN 间隔 = 1700ms（上限 3000ms）
+    s->nat.state = NAT_CONNECTING;
+    s->nat.conn_start_ms = now;
+    s->nat.last_conn_send_ms = now + 1699;
+    nat_tick(s, now + 1699);
+    ASSERT_EQ(s->nat.state, NAT_CONNECTING);
+    nat_tick(s, now + 1700);
+    ASSERT_EQ(s->nat.state, NAT_CLOSED);
+
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+
+/* 提名：积极提名的 PUNCH / ICE-lite 收到首个检查即确认路径并开始 CONN；USE-CANDIDATE 属性解析 */
+TEST(ice_nominate) {
+    struct sockaddr_in peer = { .sin_family = AF_INET, .sin_port = htons(5000) };
+    peer.sin_addr.s_addr = htonl(0x0a000001);
+    uint8_t punch[P2P_PKT_PUNCH_PSZ] = {0};
+
+    for (int mode = 0; mode < 3; mode++) {     // 0: 普通 PUNCH，1: 携带 NOMINATE，2: 本端 ICE-lite
+        mock_reset();
+        struct p2p_session *s = create_mock_session();
+        strcpy(s->inst->local_peer_id, "bob");
+        strcpy(s->remote_peer_id, "alice");
+        s->inst->cfg.ice_lite = mode == 2;
+        s->inst->cfg.ice_aggressive = true;
+        check_add_cand(s, P2P_CAND_SRFLX, 0x0a000001, 5000);
+
+        uint64_t now = P_tick_ms();
+        s->nat.state = NAT_PUNCHING;
+        s->nat.punch_start = now;
+
+        // ICE-lite 只响应，不主动检查；其余为 controlled 角色，不携带提名也照常检查
+        nat_tick(s, now);
+        ASSERT_EQ(s->remote_cands[0].last_punch_send_ms, mode == 2 ? 0 : now);
+        ASSERT_EQ(nat_next_timeout(s, now) < 0, mode == 2);
+
+        nat_proto(s, P2P_PKT_PUNCH, mode == 1 ? P2P_PUNCH_FLAG_NOMINATE : 0, 1,
+                  punch, sizeof(punch), &peer, now + 10);
+        ASSERT(s->rx_confirmed);
+        if (mode == 0) {
+            ASSERT_EQ(s->nat.state, NAT_PUNCHING);
+            ASSERT(!s->tx_confirmed);
+        } else {
+            ASSERT_EQ(s->nat.state, NAT_CONNECTING);
+            ASSERT(s->tx_confirmed);
+            ASSERT_EQ(s->active_path, 0);
+            ASSERT(path_is_selectable(s->remote_cands[0].stats.state));
+        }
+
+        nat_reset(&s->nat);
+        free(s->remote_cands);
+        destroy_mock_session(s);
+    }
+
+    // USE-CANDIDATE 仅由 controlling 端携带
+    uint8_t buf[128];
+    int len = p2p_stun_build_ice_check(buf, sizeof(buf), NULL, NULL, NULL, 1, 1, 7, 1);
+    ASSERT(len > 0 && p2p_stun_has_attr(buf, len, STUN_ATTR_USE_CANDIDATE));
+    ASSERT(p2p_stun_has_attr(buf, len, STUN_ATTR_ICE_CONTROLLING));
+    len = p2p_stun_build_ice_check(buf, sizeof(buf), NULL, NULL, NULL, 1, 0, 7, 1);
+    ASSERT(len > 0 && !p2p_stun_has_attr(buf, len, STUN_ATTR_USE_CANDIDATE));
+    ASSERT(!p2p_stun_has_attr(buf, 10, STUN_ATTR_ICE_CONTROLLED));
+}
+
+/* 对称 NAT 端口预测：常规检查先行，随后按映射增量分批探测；REACH 命中预测端口时登记候选并绑定套接字 */
+TEST(ice_port_predict) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    inst->nat_type = P2P_NAT_SYMMETRIC;
+    inst->sig_mode = P2P_SIGNALING_MODE_COMPACT;
+    inst->sig_ctx.compact.nat_port_delta = 2;
+
+    // 预测套接字视为已打开（socks[1..]）
+    inst->socks = realloc(inst->socks, (1 + NAT_PREDICT_SOCKS) * sizeof(*inst->socks));
+    for (int i = 1; i <= NAT_PREDICT_SOCKS; i++) {
+        memset(&inst->socks[i], 0, sizeof(inst->socks[i]));
+        inst->socks[i].sock = mock_sock;
+        inst->socks[i].state = 3;
+    }
+    inst->sock_cap = inst->sock_cnt = 1 + NAT_PREDICT_SOCKS;
+    inst->predict_base = 1;
+
+    check_add_cand(s, P2P_CAND_SRFLX, 0x0a000001, 5000);
+    uint64_t now = P_tick_ms();
+    s->nat.state = NAT_PUNCHING;
+    s->nat.punch_start = now;
+
+    // 前 1s 只有常规检查
+    nat_tick(s, now);
+    nat_tick(s, now + 500);
+    ASSERT(!s->nat.predict);
+    ASSERT_EQ(nat_next_timeout(s, now + 500), 500);
+
+    nat_tick(s, now + 1000);
+    ASSERT(s->nat.predict);
+    ASSERT_EQ(s->nat.predict_step, 2);
+    ASSERT_EQ(s->nat.predict_next, 9);
+    ASSERT_EQ(nat_next_timeout(s, now + 1000), 50);
+
+    // 每 Ta 一批，探完一轮后间隔 PUNCH_INTERVAL 重新开始
+    uint64_t t = now + 1000;
+    while (s->nat.predict_next < (1 + NAT_PREDICT_SOCKS) * NAT_PREDICT_PORTS) nat_tick(s, t += 50);
+    ASSERT_EQ(t, now + 1450);
+    ASSERT_EQ(nat_next_timeout(s, t), 50);     // 常规检查重传（now + 1500）先到期
+
+    // 回显的 target 与该 seq 的预测端口不符：忽略
+    struct sockaddr_in from = s->remote_cands[0].addr;
+    from.sin_port = htons(7000);
+    struct sockaddr_in target = s->remote_cands[0].addr;
+    target.sin_port = htons(5000 + 2 * 4);
+    uint8_t reach[P2P_PKT_REACH_PSZ];
+    memcpy(reach, &target.sin_addr.s_addr, 4);
+    memcpy(reach + 4, &target.sin_port, 2);
+    int j = 2 * NAT_PREDICT_PORTS + 3;
+    nat_proto(s, P2P_PKT_REACH, 0, (uint16_t)(0xF000 | j), reach, sizeof(reach), &from, t + 10);
+    ASSERT_EQ(p2p_find_remote_candidate_by_addr(s, &target), -1);
+    ASSERT(!s->tx_confirmed);
+
+    // 命中：第 2 个预测套接字发往 5006 的探测
+    target.sin_port = htons(5000 + 2 * 3);
+    memcpy(reach + 4, &target.sin_port, 2);
+    nat_proto(s, P2P_PKT_REACH, 0, (uint16_t)(0xF000 | j), reach, sizeof(reach), &from, t + 20);
+    int idx = p2p_find_remote_candidate_by_addr(s, &target);
+    ASSERT(idx > 0);
+    ASSERT_EQ(s->remote_cands[idx].type, P2P_CAND_PRFLX);
+    ASSERT_EQ(s->remote_cands[idx].sock, 2);
+    ASSERT(s->tx_confirmed);
+    ASSERT_EQ(s->nat.state, NAT_CONNECTING);
+
+    inst->predict_base = 0;
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+
+TEST(path_cache) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    const char *file = "/tmp/p2p_test_path_cache.txt";
+    remove(file);
+    inst->cfg.path_cache_file = file;
+    strcpy(s->remote_peer_id, "bob");
+    s->state = P2P_STATE_SIGNALING;
+
+    // 写入后由新实例从文件恢复
+    ASSERT_EQ(p2p_path_cache_create(inst), E_NONE);
+    p2p_path_hint_t h = { .remote_ip = htonl(0x0a000001), .remote_port = htons(6000),
+                          .local_port = 4000, .path_type = P2P_PATH_PUNCH, .stamp = (uint64_t)time(NULL) };
+    p2p_path_cache_put(inst, "bob", &h);
+    p2p_path_cache_free(inst);
+
+    ASSERT_EQ(p2p_path_cache_create(inst), E_NONE);
+    p2p_path_hint_t got;
+    ASSERT(!p2p_path_cache_get(inst, "alice", &got));
+    ASSERT(p2p_path_cache_get(inst, "bob", &got));
+    ASSERT_EQ(got.remote_ip, h.remote_ip);
+    ASSERT_EQ(got.remote_port, h.remote_port);
+    ASSERT_EQ(got.local_port, 4000);
+    ASSERT_EQ(got.path_type, P2P_PATH_PUNCH);
+
+    // 信令之前即向缓存地址发 PUNCH
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = got.remote_ip;
+    addr.sin_port = got.remote_port;
+    nat_resume(s, &addr, P2P_CAND_PRFLX);
+    ASSERT(s->nat.resume);
+    ASSERT_EQ(s->nat.punch_seq, 1);
+    ASSERT_EQ(s->remote_cand_cnt, 0);
+
+    // 对端 REACH 回显缓存地址：登记候选并进入打洞流程
+    uint8_t reach[P2P_PKT_REACH_PSZ];
+    memcpy(reach, &addr.sin_addr.s_addr, 4);
+    memcpy(reach + 4, &addr.sin_port, 2);
+    nat_proto(s, P2P_PKT_REACH, 0, s->nat.punch_seq, reach, sizeof(reach), &addr, P_tick_ms());
+    ASSERT(!s->nat.resume);
+    int idx = p2p_find_remote_candidate_by_addr(s, &addr);
+    ASSERT(idx >= 0);
+    ASSERT_EQ(s->remote_cands[idx].type, P2P_CAND_PRFLX);
+    ASSERT(s->tx_confirmed);
+    ASSERT(s->nat.state >= NAT_PUNCHING);
+    nat_reset(&s->nat);
+
+    // 超时未应答：作废条目（文件同步删除）
+    s->nat.state = NAT_INIT;
+    nat_resume(s, &addr, P2P_CAND_PRFLX);
+    uint64_t now = s->nat.resume_start;
+    nat_tick(s, now + 5000 - 1);           // NAT_RESUME_TIMEOUT_MS = PUNCH_TIMEOUT_MS
+    ASSERT(s->nat.resume);
+    nat_tick(s, now + 5000);
+    ASSERT(!s->nat.resume);
+    ASSERT(!p2p_path_cache_get(inst, "bob", &got));
+    p2p_path_cache_free(inst);
+    ASSERT_EQ(p2p_path_cache_create(inst), E_NONE);
+    ASSERT(!p2p_path_cache_get(inst, "bob", &got));
+    p2p_path_cache_free(inst);
+
+    remove(file);
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+
+/* 构造一个 LAN ANNOUNCE 并经环回发往组播端口（key 非 NULL 时附 MAC） */
+static void lan_announce(const char *id, const char *want, uint32_t ip, uint16_t port, const char *key) {
+    uint8_t buf[128];
+    int id_len = (int)strlen(id), want_len = want ? (int)strlen(want) : 0;
+    nwrite_l(buf, P2P_LAN_MAGIC);
+    buf[4] = P2P_LAN_VER; buf[5] = key ? P2P_LAN_FLAG_MAC : 0;
+    buf[6] = 1; buf[7] = (uint8_t)id_len; buf[8] = (uint8_t)want_len;
+    int n = P2P_LAN_HDR_SIZE;
+    memcpy(buf + n, id, id_len); n += id_len;
+    memcpy(buf + n, want, want_len); n += want_len;
+    uint32_t a = htonl(ip); uint16_t p = htons(port);
+    memcpy(buf + n, &a, 4); memcpy(buf + n + 4, &p, 2); n += 6;
+    if (key) { p2p_hmac_sha1((const uint8_t *)key, (int)strlen(key), buf, n, buf + n); n += P2P_LAN_MAC_SIZE; }
+
+    struct sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    to.sin_port = htons(P2P_LAN_PORT);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sendto(fd, buf, n, 0, (struct sockaddr *)&to, sizeof(to));
+    close(fd);
+}
+
+static bool lan_seen(struct p2p_instance *inst, const char *id) {
+    for (int i = 0; i < 200; i++) {
+        p2p_lan_tick_recv(inst, P_tick_ms());
+        for (int k = 0; k < P2P_LAN_PEERS; k++)
+            if (!strcmp(inst->lan->peers[k].peer_id, id)) return true;
+        P_usleep(1000);
+    }
+    return false;
+}
+
+TEST(lan_discovery) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    strcpy(inst->local_peer_id, "alice");
+    strcpy(s->remote_peer_id, "bob");
+    s->state = P2P_STATE_SIGNALING;
+
+    ASSERT_EQ(p2p_lan_create(inst), E_NONE);
+
+    // 对端尚未出现：只发查询，不打洞
+    ASSERT(!p2p_lan_connect(s));
+    ASSERT(!s->nat.resume);
+
+    // 对端应答（want = 本端）：记入表，本端随后组播通告
+    lan_announce("bob", "alice", 0x0a000002, 6000, NULL);
+    ASSERT(lan_seen(inst, "bob"));
+    ASSERT(inst->lan->reply);
+    p2p_lan_tick_send(inst, P_tick_ms() + P2P_LAN_REPLY_MS);
+    ASSERT(!inst->lan->reply);
+
+    // 再次连接：直接向对端的 Host 地址打洞
+    ASSERT(p2p_lan_connect(s));
+    ASSERT(s->nat.resume);
+    ASSERT_EQ(s->nat.resume_addr.sin_addr.s_addr, htonl(0x0a000002));
+    ASSERT_EQ(ntohs(s->nat.resume_addr.sin_port), 6000);
+    ASSERT_EQ(s->nat.resume_type, P2P_CAND_HOST);
+
+    // 设置 auth_key：不带 MAC 或 MAC 错误的通告被丢弃
+    inst->cfg.auth_key = "secret";
+    lan_announce("carol", NULL, 0x0a000003, 6000, NULL);
+    lan_announce("dave", NULL, 0x0a000004, 6000, "wrong");
+    ASSERT(!lan_seen(inst, "carol"));
+    ASSERT(!lan_seen(inst, "dave"));
+    lan_announce("erin", NULL, 0x0a000005, 6000, "secret");
+    ASSERT(lan_seen(inst, "erin"));
+
+    p2p_lan_free(inst);
+    ASSERT(!inst->lan);
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+
+TEST(stun_multi_server) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    stun_ctx_t *ctx = &inst->stun_ctx;
+    inst->cfg.stun_server = "127.0.0.1";
+    inst->cfg.stun_port = 3478;
+    inst->cfg.skip_stun_test = true;
+
+    ASSERT(p2p_stun_init(ctx, inst->cfg.stun_server, inst->cfg.stun_port, " 127.0.0.2:3479, 127.0.0.3"));
+    ASSERT_EQ(ctx->server_cnt, 3);
+    ASSERT_EQ(ntohs(ctx->servers[1].sin_port), 3479);
+    ASSERT_EQ(ntohs(ctx->servers[2].sin_port), 3478);
+
+    uint64_t now = P_tick_ms();
+    ASSERT_EQ(p2p_stun_nat_detect_start(inst, false), E_NONE);
+    p2p_stun_nat_detect_tick(inst, now);
+    ASSERT_EQ(ctx->state, STUN_TEST_I_SENT);
+
+    // 第二个服务器先应答：成为本轮检测服务器
+    struct sockaddr_in mapped;
+    sockaddr_init_with_ip(&mapped, "1.2.3.4", 5000);
+    uint8_t resp[256];
+    int len = p2p_stun_build_binding_response(resp, sizeof(resp), ctx->detect_tsx_id, &mapped, NULL);
+    ASSERT(len > 0);
+    p2p_stun_handle_packet(inst, 0, &ctx->servers[1], STUN_BINDING_RESPONSE, resp, len, NULL);
+    ASSERT_EQ(ctx->state, STUN_TEST_I_DONE);
+    ASSERT(sockaddr_equal(&ctx->server_addr, &ctx->servers[1]));
+    ASSERT(sockaddr_equal(&inst->socks[0].mapped_addr, &mapped));
+
+    p2p_stun_nat_detect_tick(inst, now + 10);
+    ASSERT_EQ(inst->nat_type, P2P_NAT_UNKNOWN);
+
+    // 同一服务器的重复应答、映射一致的应答：不改变结论
+    struct sockaddr_in other;
+    sockaddr_init_with_ip(&other, "1.2.3.4", 5002);
+    len = p2p_stun_build_binding_response(resp, sizeof(resp), ctx->test_i_tsx_id, &other, NULL);
+    p2p_stun_handle_packet(inst, 0, &ctx->servers[1], STUN_BINDING_RESPONSE, resp, len, NULL);
+    len = p2p_stun_build_binding_response(resp, sizeof(resp), ctx->test_i_tsx_id, &mapped, NULL);
+    p2p_stun_handle_packet(inst, 0, &ctx->servers[0], STUN_BINDING_RESPONSE, resp, len, NULL);
+    ASSERT(!ctx->symmetric_mapping);
+    ASSERT_EQ(inst->nat_type, P2P_NAT_UNKNOWN);
+
+    // 另一服务器看到不同映射：补全为对称 NAT
+    len = p2p_stun_build_binding_response(resp, sizeof(resp), ctx->test_i_tsx_id, &other, NULL);
+    p2p_stun_handle_packet(inst, 0, &ctx->servers[2], STUN_BINDING_RESPONSE, resp, len, NULL);
+    ASSERT(ctx->symmetric_mapping);
+    ASSERT_EQ(inst->nat_type, P2P_NAT_SYMMETRIC);
+
+    p2p_stun_shared_release(inst);
+    destroy_mock_session(s);
+}
+
+TEST(stun_shared_detect) {
+    mock_reset();
+    struct p2p_session *ss[5];
+    for (int i = 0; i < 5; i++) {
+        ss[i] = create_mock_session();
+        struct p2p_instance *inst = ss[i]->inst;
+        inst->cfg.stun_server = "127.0.0.4";
+        inst->cfg.stun_port = 3478;
+        inst->cfg.skip_stun_test = true;
+        ASSERT(p2p_stun_init(&inst->stun_ctx, inst->cfg.stun_server, inst->cfg.stun_port, NULL));
+    }
+    struct p2p_instance *a = ss[0]->inst, *b = ss[1]->inst, *c = ss[2]->inst, *d = ss[3]->inst, *e = ss[4]->inst;
+    uint64_t now = P_tick_ms();
+
+    // A 检测，B 等待其结果（不发 Test I）
+    p2p_stun_nat_detect_start(a, false);
+    p2p_stun_nat_detect_start(b, false);
+    ASSERT(!a->stun_ctx.shared_wait);
+    ASSERT(b->stun_ctx.shared_wait);
+    p2p_stun_nat_detect_tick(a, now);
+    p2p_stun_nat_detect_tick(b, now);
+    ASSERT_EQ(a->stun_ctx.state, STUN_TEST_I_SENT);
+    ASSERT_EQ(b->stun_ctx.state, STUN_TEST_IDLE);
+
+    struct sockaddr_in mapped;
+    sockaddr_init_with_ip(&mapped, "1.2.3.4", 5000);
+    uint8_t resp[256];
+    int len = p2p_stun_build_binding_response(resp, sizeof(resp), a->stun_ctx.detect_tsx_id, &mapped, NULL);
+    p2p_stun_handle_packet(a, 0, &a->stun_ctx.servers[0], STUN_BINDING_RESPONSE, resp, len, NULL);
+    p2p_stun_nat_detect_tick(a, now + 10);
+    ASSERT_EQ(a->nat_type, P2P_NAT_UNKNOWN);
+
+    p2p_stun_nat_detect_tick(b, now + 20);
+    ASSERT_EQ(b->nat_type, P2P_NAT_UNKNOWN);
+    ASSERT_EQ(b->stun_ctx.state, STUN_TEST_COMPLETED);
+
+    // 之后加入的实例直接采用
+    p2p_stun_nat_detect_start(c, false);
+    ASSERT_EQ(c->nat_type, P2P_NAT_UNKNOWN);
+    ASSERT_EQ(c->stun_ctx.state, STUN_TEST_COMPLETED);
+
+    // 网络变化后重新检测；owner 中途退出由等待者接手
+    p2p_network_changed();
+    p2p_stun_nat_detect_start(d, false);
+    ASSERT_EQ(d->nat_type, P2P_NAT_DETECTING);
+    ASSERT(!d->stun_ctx.shared_wait);
+    p2p_stun_nat_detect_start(e, false);
+    ASSERT(e->stun_ctx.shared_wait);
+    p2p_stun_shared_release(d);
+    p2p_stun_nat_detect_tick(e, now + 30);
+    ASSERT(!e->stun_ctx.shared_wait);
+    ASSERT_EQ(e->stun_ctx.state, STUN_TEST_I_SENT);
+
+    for (int i = 0; i < 5; i++) {
+        p2p_stun_shared_release(ss[i]->inst);
+        destroy_mock_session(ss[i]);
+    }
+}
+
+static int race_conn_cnt;
+static ret_t race_capture(struct p2p_session *s, uint8_t type, uint8_t flags, uint16_t seq,
+                          const void *payload, uint16_t payload_len) {
+    (void)s; (void)flags; (void)seq; (void)payload; (void)payload_len;
+    if (type == P2P_PKT_CONN) race_conn_cnt++;
+    return E_NONE;
+}
+
+TEST(dns_async_resolve) {
+    mock_reset();
+    p2p_dns_flush();
+
+    // 数值地址：不进表，立即就绪
+    struct sockaddr_in addr;
+    ASSERT_EQ(p2p_dns_resolve("10.1.2.3", 3478, &addr), 1);
+    ASSERT_EQ(ntohl(addr.sin_addr.s_addr), 0x0a010203u);
+    ASSERT_EQ(ntohs(addr.sin_port), 3478);
+    ASSERT_EQ(p2p_dns_resolve("", 3478, &addr), -1);
+
+    // 主机名：首次登记后立即返回，由后台线程解析，之后命中缓存（端口按调用填写）
+    int r = p2p_dns_resolve("localhost", 80, &addr);
+#ifdef P2P_THREADED
+    ASSERT_EQ(r, 0);
+#endif
+    for (int i = 0; i < 2000 && r == 0; i++) { P_usleep(1000); r = p2p_dns_resolve("localhost", 80, &addr); }
+    ASSERT_EQ(r, 1);
+    ASSERT_EQ(ntohl(addr.sin_addr.s_addr) >> 24, 127u);
+    ASSERT_EQ(p2p_dns_resolve("localhost", 8080, &addr), 1);
+    ASSERT_EQ(ntohs(addr.sin_port), 8080);
+
+    // STUN 服务器地址未就绪：检测与 collect 等待，解析完成后开始
+    p2p_dns_flush();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    stun_ctx_t *ctx = &inst->stun_ctx;
+    inst->cfg.stun_server = "localhost";
+    inst->cfg.stun_port = 3478;
+    inst->cfg.skip_stun_test = true;
+    ASSERT(p2p_stun_init(ctx, inst->cfg.stun_server, inst->cfg.stun_port, "127.0.0.5"));
+#ifdef P2P_THREADED
+    ASSERT_EQ(ctx->server_cnt, 0);                  // 主服务器就绪前不追加其他服务器
+#endif
+    uint64_t now = P_tick_ms();
+    ASSERT_EQ(p2p_stun_nat_detect_start(inst, false), E_NONE);
+    for (int i = 0; i < 2000 && ctx->state == STUN_TEST_IDLE; i++) {
+        p2p_stun_nat_detect_tick(inst, now);
+        if (ctx->state == STUN_TEST_IDLE) P_usleep(1000);
+    }
+    ASSERT_EQ(ctx->state, STUN_TEST_I_SENT);
+    ASSERT_EQ(ctx->server_cnt, 2);
+    ASSERT_EQ(ntohl(ctx->servers[0].sin_addr.s_addr) >> 24, 127u);
+    ASSERT_EQ(ntohs(ctx->servers[0].sin_port), 3478);
+    ASSERT_EQ(ntohl(ctx->servers[1].sin_addr.s_addr), 0x7f000005u);
+
+    p2p_stun_shared_release(inst);
+    destroy_mock_session(s);
+}
+
+TEST(stun_srflx_prewarm) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    inst->sig_mode = P2P_SIGNALING_MODE_RELAY;
+    inst->cfg.stun_server = "127.0.0.1";
+    inst->cfg.stun_port = 3478;
+    ASSERT(p2p_stun_init(&inst->stun_ctx, inst->cfg.stun_server, inst->cfg.stun_port, NULL));
+    inst->srflx_count = 1;
+    inst->srflx_active = 1;                         // p2p_create 预收集已得到 sock 0 的映射
+
+    // 新鲜的预收集映射：首个 session 直接复用，不重新收集
+    uint64_t now = P_tick_ms() + 2 * STUN_SRFLX_FRESH_MS;
+    inst->socks[0].mapped_ts = now - STUN_SRFLX_FRESH_MS / 2;
+    p2p_stun_srflx_refresh(inst, now);
+    ASSERT_EQ(inst->socks[0].state, 2);
+    ASSERT_EQ(inst->srflx_active, 1);
+    ASSERT_EQ(inst->stun_ctx.collect_time, 0);
+
+    // 有活跃 session：映射由其流量维持
+    inst->socks[0].mapped_ts = now - STUN_SRFLX_FRESH_MS;
+    inst->connections = 1;
+    p2p_stun_srflx_refresh(inst, now);
+    ASSERT_EQ(inst->socks[0].state, 2);
+
+    // 空闲期超过新鲜期：作废并立即补收集
+    inst->connections = 0;
+    p2p_stun_srflx_refresh(inst, now);
+    ASSERT_EQ(inst->socks[0].state, 1);
+    ASSERT_EQ(inst->srflx_active, 0);
+    ASSERT(inst->stun_ctx.collect_time != 0);
+
+    destroy_mock_session(s);
+}
+
+/* 预热会话：p2p_connect 同一对端时直接交给应用 */
+TEST(prewarm_handover) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    inst->sig_mode = P2P_SIGNALING_MODE_RELAY;
+    inst->sessions_head = inst->sessions_rear = s;
+    strcpy(s->remote_peer_id, "peer");
+    s->standby = true;
+
+    ASSERT_EQ(p2p_prewarm((p2p_handle_t)inst, "peer"), 0);      // 已在预热：不重复创建
+    ASSERT(inst->sessions_head == s && !s->next);
+    ASSERT(p2p_connect((p2p_handle_t)inst, "peer", false) == (p2p_session_t)s);
+    ASSERT(!s->standby);
+    ASSERT_EQ(s->state, P2P_STATE_CONNECTED);
+
+    inst->sig_mode = P2P_SIGNALING_MODE_ICE;
+    ASSERT_EQ(p2p_prewarm((p2p_handle_t)inst, "peer"), -1);
+    destroy_mock_session(s);
+}
+
+/* 批量传输：一轮 tx 会话 tick + flush，已提交的包按序交付 rx（放不下即停），交付部分视为已确认 */
+static void bulk_pump(struct p2p_session *tx, struct p2p_session *rx) {
+    if (tx->bulk.b) bulk_tick(tx);
+    stream_flush_to_reliable(tx);
+    reliable_t *r = &tx->reliable;
+    uint16_t seq = r->send_base;
+    for (; seq != r->send_seq; seq++) {
+        retx_entry_t *e = &r->send_buf[seq & (r->window - 1)];
+        if (stream_deliver(rx, e->data, e->len) < 0) break;
+    }
+    reliable_on_ack(tx, seq, 0, P_tick_ms());
+}
+
+/* 可续传批量传输：中途 LOST 与接收端重启后按状态文件续传，其余块经两条会话并行取回 */
+TEST(bulk_resume) {
+    const char *state = "/tmp/p2p_test_bulk.part";
+    remove(state);
+    const int64_t size = 2 * P2P_BULK_CHUNK + 1234;
+    static uint8_t data[2 * P2P_BULK_CHUNK + 1234], back[2 * P2P_BULK_CHUNK + 1234];
+    for (int64_t i = 0; i < size; i++) data[i] = (uint8_t)(i * 131 + (i >> 12));
+    FILE *src = tmpfile(), *dst = tmpfile();
+    ASSERT(src && dst);
+    fwrite(data, 1, sizeof(data), src);
+    fflush(src);
+
+    mock_reset();
+    struct p2p_session *a1 = create_mock_session(), *r1 = create_mock_session();
+    a1->file_tx.fd = a1->file_rx.fd = r1->file_tx.fd = r1->file_rx.fd = -1;
+    struct p2p_bulk *bs = NULL, *br = NULL;
+    ASSERT_EQ(bulk_create(a1->inst, true, fileno(src), size, NULL, &bs), E_NONE);
+    ASSERT_EQ(bulk_create(r1->inst, false, fileno(dst), 0, state, &br), E_NONE);
+    ASSERT_EQ(bs->count, 3);
+    ASSERT_EQ(bulk_attach(bs, a1), E_NONE);
+    ASSERT_EQ(bulk_attach(bs, a1), E_INVALID);
+    ASSERT_EQ(bulk_attach(br, r1), E_NONE);
+
+    // 第一块完成后、第二块进行中断线：在途块退回待取
+    int64_t done = 0, total = 0;
+    for (int k = 0; k < 400 && !(done && r1->file_rx.fd >= 0 && r1->file_rx.done > 100000); k++) {
+        bulk_pump(r1, a1);
+        bulk_pump(a1, r1);
+        bulk_status(br, &done, &total);
+    }
+    ASSERT_EQ(total, size);
+    ASSERT_EQ(done, P2P_BULK_CHUNK);
+    ASSERT(r1->file_rx.fd >= 0);
+    r1->state = a1->state = P2P_STATE_LOST;
+    bulk_tick(r1);
+    bulk_tick(a1);
+    ASSERT(!r1->bulk.b && !a1->bulk.b && r1->file_rx.fd < 0 && a1->file_tx.fd < 0);
+    ASSERT_EQ(br->sess_cnt, 0);
+    ASSERT(!br->busy[0]);
+
+    // 接收端重启：状态文件恢复一块，两条新会话并行取其余块
+    bulk_free(br);
+    struct p2p_session *a2 = create_mock_session(), *a3 = create_mock_session();
+    struct p2p_session *r2 = create_mock_session(), *r3 = create_mock_session();
+    struct p2p_instance *a3_inst = a3->inst, *r3_inst = r3->inst, *a2_inst = a2->inst;
+    a2->inst = a3->inst = a1->inst;
+    r3->inst = r2->inst;
+    struct p2p_session *ss[4] = { a2, a3, r2, r3 };
+    for (int i = 0; i < 4; i++) ss[i]->file_tx.fd = ss[i]->file_rx.fd = -1;
+    ASSERT_EQ(bulk_create(r2->inst, false, fileno(dst), 0, state, &br), E_NONE);
+    ASSERT_EQ(bulk_attach(bs, a2), E_NONE);
+    ASSERT_EQ(bulk_attach(bs, a3), E_NONE);
+    ASSERT_EQ(bulk_attach(br, r2), E_NONE);
+    ASSERT_EQ(bulk_attach(br, r3), E_NONE);
+
+    int ret = 0, rounds = 0;
+    for (; rounds < 400 && ret == 0; rounds++) {
+        bulk_pump(r2, a2); bulk_pump(r3, a3);
+        bulk_pump(a2, r2); bulk_pump(a3, r3);
+        if (rounds == 2) { ASSERT_EQ(br->done_cnt, 1); ASSERT((br->busy[0] & 0x6) == 0x6); }
+        ret = bulk_status(br, &done, &total);
+    }
+    ASSERT_EQ(ret, 1);
+    ASSERT_EQ(done, size);
+    FILE *fp = fopen(state, "rb");
+    ASSERT(!fp);
+
+    rewind(dst);
+    ASSERT_EQ((int)fread(back, 1, sizeof(back), dst), (int)sizeof(data));
+    ASSERT_EQ(memcmp(back, data, sizeof(data)), 0);
+
+    bulk_free(br);
+    bulk_free(bs);
+    fclose(src);
+    fclose(dst);
+    a2->inst = a2_inst; a3->inst = a3_inst; r3->inst = r3_inst;
+    destroy_mock_session(a1); destroy_mock_session(r1);
+    for (int i = 0; i < 4; i++) destroy_mock_session(ss[i]);
+}
+
+TEST(tune_registry) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    p2p_handle_t hdl = (p2p_handle_t)s->inst;
+
+    // 注册表：名称 / 查找 / 默认值 / 范围
+    ASSERT_EQ(p2p_tune_find("rto_max_ms"), P2P_TUNE_RTO_MAX_MS);
+    ASSERT_EQ(p2p_tune_find("nope"), -1);
+    ASSERT(p2p_tune_name(P2P_TUNE_NUM) == NULL);
+    ASSERT_EQ(p2p_tune_get(NULL, NULL, P2P_TUNE_PACING_GAIN), 125);
+    ASSERT_EQ(p2p_tune_get(hdl, s, P2P_TUNE_RTO_MIN_MS), 50);
+    ASSERT_EQ(p2p_tune_set(hdl, NULL, P2P_TUNE_RTO_MAX_MS, 50), -1);
+    ASSERT_EQ(p2p_tune_set(hdl, NULL, P2P_TUNE_NUM, 0), -1);
+
+    // 实例层对会话生效，会话层覆盖实例层，清除后恢复继承
+    ASSERT_EQ(p2p_keepalive_interval(s, NULL), 5000);
+    ASSERT_EQ(p2p_tune_set(hdl, NULL, P2P_TUNE_KEEPALIVE_MS, 15000), 0);
+    ASSERT_EQ(p2p_keepalive_interval(s, NULL), 15000);
+    ASSERT_EQ(p2p_tune_set(hdl, s, P2P_TUNE_KEEPALIVE_MS, 500), 0);
+    ASSERT_EQ(p2p_keepalive_interval(s, NULL), 1000);      // 不低于 1s
+    ASSERT_EQ(p2p_tune_get(hdl, NULL, P2P_TUNE_KEEPALIVE_MS), 15000);
+    ASSERT_EQ(p2p_tune_set(hdl, s, P2P_TUNE_KEEPALIVE_MS, P2P_TUNE_INHERIT), 0);
+    ASSERT_EQ(p2p_keepalive_interval(s, NULL), 15000);
+    ASSERT_EQ(p2p_tune_set(hdl, NULL, P2P_TUNE_KEEPALIVE_MS, P2P_TUNE_INHERIT), 0);
+    ASSERT_EQ(p2p_keepalive_interval(s, NULL), 5000);
+
+    // 进程层（instrument 通道）：发送窗口只收紧协商值
+    int avail = reliable_window_avail(s);
+    p2p_instrument(1, 'X', "tune", "send_window=4", 13);
+    ASSERT_EQ(p2p_tune_get(hdl, s, P2P_TUNE_SEND_WINDOW), 4);
+    ASSERT_EQ(reliable_window_avail(s), 4);
+    ASSERT_EQ(p2p_tune_set(NULL, NULL, P2P_TUNE_SEND_WINDOW, RELIABLE_WINDOW_MAX), 0);
+    ASSERT_EQ(reliable_window_avail(s), avail);
+    p2p_instrument(1, 'X', "tune", "send_window=-1", 14);
+    ASSERT_EQ(p2p_tune_get(NULL, NULL, P2P_TUNE_SEND_WINDOW), 0);
+
+    // RTO 上限在下一个 RTT 样本时生效
+    ASSERT_EQ(p2p_tune_set(hdl, s, P2P_TUNE_RTO_MAX_MS, 100), 0);
+    uint8_t data[32] = {0};
+    ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    reliable_tick(s);
+    s->reliable.srtt = 500;
+    s->reliable.rttvar = 500;
+    reliable_on_ack(s, s->reliable.send_seq, 0, P_tick_ms());
+    ASSERT_EQ(s->reliable.rto, 100);
+
+    destroy_mock_session(s);
+}
+
+/* 会话级传输选项：置位字段覆盖实例配置，其余沿用 */
+TEST(session_opts) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    s->inst->cfg.reliable_window = 64;
+    s->inst->cfg.cc_algo = P2P_CC_AIMD;
+
+    s->opts.set = P2P_SOPT_WINDOW | P2P_SOPT_CC;
+    s->opts.reliable_window = 512;
+    s->opts.cc_algo = P2P_CC_CUBIC;
+    s->opts.pacing = P2P_PACING_TOKEN_BUCKET;
+    reliable_free(s);
+    ASSERT_EQ(reliable_init(s), E_NONE);
+    ASSERT_EQ(s->reliable.window, 512);
+    ASSERT_EQ(P2P_SOPT(s, P2P_SOPT_NAGLE, nagle), s->inst->cfg.nagle);
+
+    s->trans = &p2p_trans_pseudotcp;
+    ASSERT_EQ(s->trans->init(s), 0);
+    ASSERT(s->cc == &p2p_cc_cubic);
+    s->trans->close(s);
+    s->trans = NULL;
+
+    // 未置位：按实例配置
+    s->opts.set = P2P_SOPT_WINDOW;
+    reliable_free(s);
+    ASSERT_EQ(reliable_init(s), E_NONE);
+    ASSERT_EQ(P2P_SOPT(s, P2P_SOPT_CC, pacing), P2P_PACING_OFF);
+
+    p2p_session_opts_t bad = { P2P_SOPT_TRANSPORT, 9 };
+    ASSERT(p2p_connect_opts((p2p_handle_t)s->inst, "peer", false, &bad) == NULL);
+
+    destroy_mock_session(s);
+}
+
+/* 统计 STUN 服务器套接字上收到的请求数 */
+static int drain_udp(int fd) {
+    uint8_t buf[256]; int n = 0;
+    while (recv(fd, (char *)buf, sizeof(buf), 0) > 0) n++;
+    return n;
+}
+
+TEST(stun_multi_collect) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    inst->sig_mode = P2P_SIGNALING_MODE_COMPACT;   // sock 0 的映射由信令服务器获得
+    inst->cfg.stun_server = "127.0.0.1";
+    inst->sock_cap = 4;
+    inst->socks = realloc(inst->socks, 4 * sizeof(*inst->socks));
+
+    struct sockaddr_in lo = { .sin_family = AF_INET };
+    lo.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int srv = (int)socket(AF_INET, SOCK_DGRAM, 0);
+    socklen_t alen = sizeof(lo);
+    ASSERT(bind(srv, (struct sockaddr *)&lo, sizeof(lo)) == 0);
+    getsockname(srv, (struct sockaddr *)&lo, &alen);
+    P_sock_nonblock(srv, true);
+
+    ASSERT_EQ(p2p_udp_open(inst, &lo, 0), E_NONE);
+    ASSERT_EQ(p2p_udp_open(inst, &lo, 0), E_NONE);
+    stun_ctx_t *ctx = &inst->stun_ctx;
+    ctx->servers[0] = lo;
+    ctx->server_cnt = 1;
+    inst->srflx_count = 2;
+
+    // 两个网卡套接字并行发出请求
+    ASSERT(p2p_stun_collect(inst));
+    uint64_t t0 = ctx->collect_time;
+    P_usleep(10 * 1000);
+    ASSERT_EQ(drain_udp(srv), 2);
+
+    // sock 1 已得到映射：间隔到期只向仍未应答的 sock 2 重发（500ms 重发间隔）
+    inst->socks[1].state = 2;
+    inst->srflx_active = 1;
+    p2p_stun_nat_detect_tick(inst, t0 + 600);
+    P_usleep(10 * 1000);
+    ASSERT_EQ(drain_udp(srv), 1);
+    p2p_stun_nat_detect_tick(inst, t0 + 700);
+    ASSERT_EQ(drain_udp(srv), 0);
+
+    // 超时（2s）仍无应答：关闭该套接字，收集结束
+    p2p_stun_nat_detect_tick(inst, t0 + 2100);
+    ASSERT_EQ(inst->sock_cnt, 2);
+    ASSERT_EQ(inst->srflx_count, 1);
+    ASSERT_EQ(ctx->collect_time, 0);
+
+    p2p_udp_close(inst, 1);
+    P_sock_close(srv);
+    destroy_mock_session(s);
+}
+
+static int route_ice_cnt;
+static void route_ice_cb(p2p_session_t session, const char *candidate, void *userdata) {
+    (void)session; (void)candidate; (void)userdata;
+    route_ice_cnt++;
+}
+
+TEST(route_change_refresh) {
+    mock_reset();
+    ASSERT_EQ(route_shared_acquire(), E_NONE);
+    const route_ctx_t *rt = route_shared_get();
+    uint32_t gen = route_shared_gen();
+
+    // 变化通知需静默 ROUTE_SETTLE_MS 才重新枚举；地址集合未变不递增代次
+    uint64_t now = P_tick_ms();
+    route_shared_notify();
+    ASSERT(!route_shared_poll(now));
+    ASSERT(!route_shared_poll(now + ROUTE_SETTLE_MS));
+    ASSERT_EQ(route_shared_gen(), gen);
+
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    inst->sessions_head = s;
+    inst->sig_mode = P2P_SIGNALING_MODE_ICE;
+    inst->cfg.on_ice_candidate = route_ice_cb;
+    inst->socks[0].local_addr.sin_port = htons(4000);
+    route_ice_cnt = 0;
+
+    // 已消失地址上的 Host 候选
+    int idx = p2p_cand_push_local(s);
+    s->local_cands[idx].type = P2P_CAND_HOST;
+    s->local_cands[idx].addr.sin_family = AF_INET;
+    s->local_cands[idx].addr.sin_addr.s_addr = htonl(0x0a630001);
+    s->local_cands[idx].addr.sin_port = htons(4000);
+    s->local_cands[idx].priority = p2p_ice_calc_priority(P2P_ICE_CAND_HOST, 65535, 1);
+
+    // 代次已变：当前每个地址补一个 Host 候选并 Trickle；同一代次只处理一次
+    inst->route_gen = gen - 1;
+    p2p_route_refresh(inst, now);
+    ASSERT_EQ(inst->route_gen, gen);
+    ASSERT_EQ(s->local_cand_cnt, 1 + rt->addr_count);
+    ASSERT_EQ(route_ice_cnt, rt->addr_count);
+    for (int r = 0; r < rt->addr_count; r++) {
+        struct sockaddr_in a = rt->local_addrs[r];
+        a.sin_port = htons(4000);
+        ASSERT(p2p_cand_find_local(s, P2P_CAND_HOST, &a) > 0);
+    }
+    p2p_route_refresh(inst, now);
+    ASSERT_EQ(s->local_cand_cnt, 1 + rt->addr_count);
+
+    // ICE 信令无法撤回：消失的候选保留；COMPACT 撤回（priority 置 0），已有地址不重复追加
+    ASSERT(s->local_cands[0].priority != 0);
+    inst->sig_mode = P2P_SIGNALING_MODE_COMPACT;
+    inst->route_gen = gen - 1;
+    p2p_route_refresh(inst, now);
+    ASSERT_EQ(s->local_cands[0].priority, 0);
+    ASSERT_EQ(s->local_cand_cnt, 1 + rt->addr_count);
+    ASSERT_EQ(route_ice_cnt, rt->addr_count);
+
+    p2p_free(s->local_cands);
+    destroy_mock_session(s);
+    route_shared_release();
+}
+
+TEST(path_race) {
+    mock_reset();
+    struct p2p_session *s[2];
+    uint64_t now = P_tick_ms();
+    for (int i = 0; i < 2; i++) {
+        s[i] = create_mock_session();
+        s[i]->state = P2P_STATE_PUNCHING;
+        s[i]->inst->cfg.path_race = i == 0;
+        s[i]->inst->signaling.active = true;
+        s[i]->inst->signaling.stats.state = PATH_STATE_ACTIVE;
+        s[i]->inst->signaling_relay_fn = race_capture;
+        check_add_cand(s[i], P2P_CAND_SRFLX, 0x0a000001, 5000);     // 始终打不通
+        s[i]->remote_cand_done = true;
+        s[i]->nat.state = NAT_PUNCHING;
+        s[i]->nat.punching = 1;
+        s[i]->nat.punch_start = now;
+    }
+    race_conn_cnt = 0;
+
+    // 直连先行期内只打洞
+    nat_tick(s[0], now + 100);
+    ASSERT_EQ(s[0]->nat.state, NAT_PUNCHING);
+
+    // 先行期满仍无直连：经信令中转进入 CONNECTING，未开启竞速的会话继续打洞
+    nat_tick(s[0], now + 300);
+    nat_tick(s[1], now + 300);
+    ASSERT_EQ(s[0]->nat.state, NAT_CONNECTING);
+    ASSERT_EQ(s[0]->active_path, PATH_IDX_SIGNALING);
+    ASSERT_EQ(s[0]->nat.race_start, now);
+    ASSERT_EQ(race_conn_cnt, 1);
+    ASSERT_EQ(s[1]->nat.state, NAT_PUNCHING);
+
+    // 中继承载数据期间，原打洞超时前按正常节奏后台打洞，之后降频
+    s[0]->nat.state = NAT_RELAY;
+    s[0]->nat.last_retry_send_ms = now + 300;
+    ASSERT_EQ(nat_next_timeout(s[0], now + 300), 500);
+    s[0]->nat.last_retry_send_ms = now + 5000;
+    ASSERT_EQ(nat_next_timeout(s[0], now + 5000), 2000);
+
+    // 未开启竞速：打洞超时后才回退
+    nat_tick(s[1], now + 5000);
+    ASSERT_EQ(s[1]->nat.state, NAT_CONNECTING);
+    ASSERT_EQ(s[1]->nat.race_start, 0);
+
+    for (int i = 0; i < 2; i++) {
+        nat_reset(&s[i]->nat);
+        free(s[i]->remote_cands);
+        destroy_mock_session(s[i]);
+    }
+}
+TEST(ipv6_candidate_wire) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+
+    uint8_t ip6[16] = {0x20,0x01,0x0d,0xb8, 0,0,0,0, 0,0,0,0, 0,0,0,0x42};
+    struct sockaddr_in a, b;
+    ASSERT(p2p_udp_v6_alias(ip6, htons(4000), &a));
+    ASSERT(p2p_udp_v6_is_alias(&a));
+    ASSERT_EQ(ntohl(a.sin_addr.s_addr) & 0xF0000000u, 0xF0000000u);
+    ASSERT(p2p_udp_v6_alias(ip6, htons(4001), &b));             // 同一地址复用同一别名
+    ASSERT_EQ(a.sin_addr.s_addr, b.sin_addr.s_addr);
+
+    struct sockaddr_in v4;
+    sockaddr_init_with_host(&v4, 0xC0A80101, 4000);
+    ASSERT(!p2p_udp_v6_is_alias(&v4));
+
+    // 线格式：别名还原为真实 IPv6，对端解包得到同一别名
+    p2p_local_candidate_entry_t lc; memset(&lc, 0, sizeof(lc));
+    lc.type = P2P_CAND_HOST; lc.addr = a; lc.priority = 100;
+    uint8_t buf[sizeof(p2p_candidate_t)];
+    pack_candidate(&lc, buf);
+    const p2p_candidate_t *w = (const p2p_candidate_t *)buf;
+    ASSERT(!p2p_sockaddr_is_ipv4(&w->addr));
+    ASSERT(!memcmp(w->addr.ip, ip6, 16));
+    p2p_remote_candidate_entry_t rc;
+    unpack_candidate(&rc, buf);
+    ASSERT(sockaddr_equal(&rc.addr, &a));
+
+    // ICE SDP：导出 IPv6 文本，导入后回到别名
+    char sdp[128];
+    ASSERT(p2p_ice_export_candidate(&lc, sdp, sizeof(sdp)) > 0);
+    ASSERT(strstr(sdp, "2001:db8::42 4000 typ host") != NULL);
+    char line[160];
+    snprintf(line, sizeof(line), "a=%s\r\n", sdp);
+    ASSERT_EQ(p2p_ice_import_sdp(line, &rc, 1), 1);
+    ASSERT(sockaddr_equal(&rc.addr, &a));
+
+    // 回环收发：发往别名的包经 IPv6 套接字发出，收到时来源还原为同一别名（环境无 IPv6 时跳过）
+    if (p2p_udp_open6(s->inst, 0) == E_NONE) {
+        s->inst->socks[0].sock = P_INVALID_SOCKET;              // mock 描述符不可读
+        uint8_t lo[16] = {0}; lo[15] = 1;
+        struct sockaddr_in self;
+        ASSERT(p2p_udp_v6_alias(lo, s->inst->sock6_port, &self));
+        ASSERT_EQ(p2p_udp_send_to_sock(s->inst, 0, &self, "v6", 2), 2);
+        int n = E_BUSY;
+        for (int i = 0; i < 50 && n == E_BUSY; i++) { n = p2p_udp_recv_batch(s->inst, 4); if (n == E_BUSY) P_usleep(1000); }
+        ASSERT(n >= 1);
+        p2p_udp_slot_t *slot = &s->inst->rx_slots[n - 1];
+        ASSERT(sockaddr_equal(&slot->from, &self));
+        ASSERT_EQ(slot->len, 2);
+        P_sock_close(s->inst->sock6);
+        s->inst->sock6_port = 0;
+        s->inst->socks[0].sock = mock_sock;
+        free(s->inst->rx_slots); s->inst->rx_slots = NULL;
+    }
+
+    destroy_mock_session(s);
+}
+/* 模拟对端对当前轮次的 REPLY */
+static void bind_reply(struct p2p_session *s, uint64_t now) {
+    uint8_t op = P2P_BIND_OP_REPLY;
+    nat_proto(s, P2P_PKT_BIND_PROBE, 0, s->inst->bind_probe.seq, &op, 1, &s->active_addr, now);
+}
+
+TEST(bind_lifetime_probe) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    s->inst->socks = realloc(s->inst->socks, 2 * sizeof(*s->inst->socks));
+    s->inst->sock_cap = 2;
+    s->inst->cfg.keepalive_adaptive = true;
+    check_add_cand(s, P2P_CAND_SRFLX, 0x7f000001, 9);
+    path_manager_set_path_state(s, 0, PATH_STATE_ACTIVE);
+    s->active_path = 0;
+    s->active_addr = s->remote_cands[0].addr;
+    s->path_type = P2P_PATH_PUNCH;
+    s->nat.state = NAT_CONNECTED;
+    uint64_t t = P_tick_ms();
+    ASSERT_EQ(p2p_keepalive_interval(s, NULL), 5000);
+
+    // 校验轮：打开探测套接字，OPEN 后几乎不空闲即 ECHO
+    nat_tick(s, t);
+    nat_bind_probe_t *bp = &s->inst->bind_probe;
+    ASSERT(bp->owner == s);
+    ASSERT_EQ(s->inst->sock_cnt, 2);
+    ASSERT_EQ(s->inst->socks[1].state, 4);
+    ASSERT_EQ(bp->gap_ms, 500);
+    nat_tick(s, t += 500);
+    ASSERT_EQ(bp->phase, 2);
+    bind_reply(s, t);
+    ASSERT(bp->verified);
+
+    // 15s、30s 逐轮翻倍：15s 存活，30s 三次 ECHO 均无应答判定失效
+    nat_tick(s, t);
+    ASSERT_EQ(bp->gap_ms, 15000);
+    nat_tick(s, t += 15000);
+    bind_reply(s, t);
+    ASSERT_EQ(bp->ok_ms, 15000);
+    nat_tick(s, t);
+    ASSERT_EQ(bp->gap_ms, 30000);
+    nat_tick(s, t += 30000);
+    nat_tick(s, t += 2000);
+    nat_tick(s, t += 2000);
+    ASSERT_EQ(bp->tries, 3);
+    nat_tick(s, t += 2000);
+    ASSERT_EQ(bp->fail_ms, 30000);
+
+    // 二分：22.5s 存活，26.25s 存活，区间收敛到 5s 内即结束
+    nat_tick(s, t);
+    ASSERT_EQ(bp->gap_ms, 22500);
+    nat_tick(s, t += 22500);
+    bind_reply(s, t);
+    nat_tick(s, t);
+    ASSERT_EQ(bp->gap_ms, 26250);
+    nat_tick(s, t += 26250);
+    bind_reply(s, t);
+    ASSERT_EQ(bp->lifetime_ms, 26250);
+    ASSERT(bp->owner == NULL);
+    ASSERT_EQ(s->inst->sock_cnt, 1);
+
+    int life = 0;
+    ASSERT_EQ(p2p_keepalive_interval(s, &life), 13125);
+    ASSERT_EQ(life, 26250);
+
+    // 应答端：记录 OPEN 来源，仅对同一轮次的 ECHO 回复
+    struct sockaddr_in probe_src;
+    sockaddr_init_with_host(&probe_src, 0x7f000001, 4444);
+    uint8_t op = P2P_BIND_OP_OPEN;
+    nat_proto(s, P2P_PKT_BIND_PROBE, 0, 7, &op, 1, &probe_src, t);
+    ASSERT(sockaddr_equal(&s->nat.bind_peer, &probe_src));
+    ASSERT_EQ(s->nat.bind_peer_seq, 7);
+
+    // 对端不支持：校验轮无应答，本会话放弃并关闭探测套接字
+    s->inst->bind_probe = (nat_bind_probe_t){0};
+    nat_tick(s, t += 1000);
+    nat_tick(s, t += 500);
+    nat_tick(s, t += 2000);
+    nat_tick(s, t += 2000);
+    nat_tick(s, t += 2000);
+    ASSERT(s->nat.bind_probe_off);
+    ASSERT(s->inst->bind_probe.owner == NULL);
+    ASSERT_EQ(s->inst->sock_cnt, 1);
+    ASSERT_EQ(p2p_keepalive_interval(s, NULL), 5000);
+
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+/* 已连通的单条直连路径（path[0] = 127.0.0.1:9，PUNCH） */
+static void mock_direct_path(struct p2p_session *s) {
+    check_add_cand(s, P2P_CAND_HOST, 0x7f000001, 9);
+    path_manager_set_path_state(s, 0, PATH_STATE_ACTIVE);
+    s->active_path = 0;
+    s->active_addr = s->remote_cands[0].addr;
+    s->path_type = P2P_PATH_PUNCH;
+    s->nat.state = NAT_CONNECTED;
+}
+
+/* 路径 MTU 探测：校验 → 直接尝试上限 → 二分收敛；DATA 按确认值组包，回退后大包分段发出并在接收端重组 */
+static void pmtu_ack(struct p2p_session *s, uint64_t now) {
+    uint8_t ack[P2P_PKT_PMTU_PROBE_PSZ] = { P2P_PMTU_OP_ACK };
+    nwrite_s(ack + 1, s->remote_cands[s->active_path].stats.pmtu_probe);
+    nat_proto(s, P2P_PKT_PMTU_PROBE, 0, s->nat.pmtu_seq, ack, sizeof(ack), &s->active_addr, now);
+}
+
+TEST(pmtu_discovery) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    s->inst->cfg.pmtu_discovery = true;
+    mock_direct_path(s);
+    path_stats_t *st = &s->remote_cands[0].stats;
+    uint64_t t = P_tick_ms();
+    ASSERT_EQ(p2p_path_mtu(s), P2P_MTU);
+    ASSERT_EQ(nat_pmtu_payload(s), P2P_MAX_PAYLOAD);
+
+    // 校验轮通过后直接尝试上限
+    nat_tick(s, t);
+    ASSERT_EQ(st->pmtu_probe, P2P_MTU);
+    pmtu_ack(s, t);
+    ASSERT_EQ(st->pmtu, P2P_MTU);
+    ASSERT_EQ(st->pmtu_probe, P2P_MTU_MAX);
+
+    // 模拟路径 MTU 1400：超限尺寸三次无应答判定失败，之后二分收敛
+    for (int i = 0; i < 64 && st->pmtu_probe; i++) {
+        if (st->pmtu_probe <= 1400) pmtu_ack(s, t);
+        else nat_tick(s, t += 1000);
+    }
+    ASSERT_EQ(st->pmtu_probe, 0);
+    ASSERT(st->pmtu <= 1400 && st->pmtu > 1400 - 16);
+    ASSERT_EQ(p2p_path_mtu(s), st->pmtu);
+    int big = nat_pmtu_payload(s);
+    ASSERT_EQ(big, st->pmtu - P2P_HDR_SIZE);
+
+    // 流层按确认的负载组包
+    static char data[3000];
+    for (int i = 0; i < (int)sizeof(data); i++) data[i] = (char)i;
+    stream_write(&s->stream, data, sizeof(data));
+    stream_flush_to_reliable(s);
+    ASSERT_EQ(s->reliable.send_buf[0].len, big);
+    reliable_tick(s);
+    uint64_t sent = st->total_packets_sent;
+    ASSERT_EQ(sent, 3);
+
+    // 黑洞回退：路径回到 P2P_MTU，在途大包重传时拆为两个分段
+    nat_pmtu_fallback(s, PATH_IDX_NONE, t);
+    ASSERT_EQ(p2p_path_mtu(s), P2P_MTU);
+    ASSERT_EQ(nat_pmtu_payload(s), P2P_MAX_PAYLOAD);
+    ASSERT_EQ(st->pmtu_fail, big + P2P_HDR_SIZE);
+    s->reliable.send_buf[0].send_time -= 10000;
+    reliable_retx_update(&s->reliable, &s->reliable.send_buf[0]);
+    reliable_tick(s);
+    ASSERT_EQ(st->total_packets_sent, sent + 2);
+
+    // 接收端：分段乱序到达，收齐后按原序列号交付
+    struct p2p_session *rx = create_mock_session();
+    const uint8_t *pkt = s->reliable.send_buf[0].data;
+    uint8_t part[2 + P2P_DATA_PART_SIZE];
+    part[0] = 1; part[1] = 2;
+    memcpy(part + 2, pkt + P2P_DATA_PART_SIZE, big - P2P_DATA_PART_SIZE);
+    nat_proto(rx, P2P_PKT_DATA, P2P_DATA_FLAG_PART, 0, part, 2 + big - P2P_DATA_PART_SIZE, &s->active_addr, t);
+    ASSERT_EQ(ring_used(&rx->stream.recv_ring), 0);
+    ASSERT(rx->nat.part_buf != NULL);
+    part[0] = 0;
+    memcpy(part + 2, pkt, P2P_DATA_PART_SIZE);
+    nat_proto(rx, P2P_PKT_DATA, P2P_DATA_FLAG_PART, 0, part, sizeof(part), &s->active_addr, t);
+    ASSERT_EQ(ring_used(&rx->stream.recv_ring), big - P2P_DATA_HDR_SIZE);
+    ASSERT(rx->nat.part_buf == NULL);
+    char out[3000];
+    ASSERT_EQ(stream_read(&rx->stream, out, sizeof(out)), big - P2P_DATA_HDR_SIZE);
+    ASSERT(memcmp(out, data, big - P2P_DATA_HDR_SIZE) == 0);
+
+    // 对端不支持：校验轮无应答，本会话不再探测
+    path_stats_init(st, 0);
+    nat_tick(s, t += 1000);
+    ASSERT_EQ(st->pmtu_probe, P2P_MTU);
+    for (int i = 0; i < 3; i++) nat_tick(s, t += 1000);
+    ASSERT(s->nat.pmtu_off);
+    ASSERT_EQ(st->pmtu, 0);
+
+    destroy_mock_session(rx);
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+/* 捎带 ACK：有待发 ACK 时经活跃路径发出的 DATA 前置累积确认，本轮不再单独发 ACK；接收方先按 ACK 处理再交付数据 */
+TEST(ack_piggyback) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    uint8_t caps[RELIABLE_CAPS_MAX_PSZ];
+    int clen = reliable_write_caps(s, caps);
+    ASSERT(caps[0] & RELIABLE_CAP_ACK_DATA);
+    reliable_on_caps(s, caps, clen);
+    ASSERT(s->reliable.ack_data);
+    mock_direct_path(s);
+    path_stats_t *st = &s->remote_cands[0].stats;
+
+    // 收到对端 seq=0 后 ACK 延迟待发；本端随即有数据要发：ACK 随 DATA 发出，只发一个包
+    uint8_t pkt[P2P_DATA_ACK_MAX + 16] = {0};
+    memcpy(pkt + P2P_DATA_HDR_SIZE, "ping", 4);
+    ASSERT_EQ(reliable_on_data(s, 0, pkt, P2P_DATA_HDR_SIZE + 4), 1);
+    ASSERT_EQ(s->reliable.ack_pending, 1);
+    stream_write(&s->stream, "pong", 4);
+    stream_flush_to_reliable(s);
+    uint64_t sent = st->total_packets_sent;
+    reliable_tick(s);
+    ASSERT_EQ(st->total_packets_sent, sent + 1);
+    ASSERT_EQ(s->reliable.ack_pending, 0);
+    ASSERT(!s->reliable.need_ack);
+    ASSERT_EQ(reliable_next_timeout(s, P_tick_ms()) > 0, 1);
+
+    // 无待发 ACK 时不捎带（重传也走同一路径）
+    s->reliable.send_buf[0].send_time -= 10000;
+    reliable_retx_update(&s->reliable, &s->reliable.send_buf[0]);
+    reliable_tick(s);
+    ASSERT_EQ(st->total_packets_sent, sent + 2);
+
+    // 接收：对端的 DATA(seq=1) 捎带 ack_seq=1 与 rwnd，确认本端在途的 seq=0
+    int n = 0;
+    pkt[n++] = P2P_ACK_FLAG_RWND;
+    nwrite_s(pkt + n, 1); n += 2;
+    nwrite_l(pkt + n, 0); n += 4;
+    nwrite_l(pkt + n, 5000); n += 4;
+    ASSERT_EQ(n, (int)P2P_DATA_ACK_MAX - 4);         // 不含 ce(4)
+    memset(pkt + n, 0, P2P_DATA_HDR_SIZE);
+    nwrite_l(pkt + n, 4);
+    memcpy(pkt + n + P2P_DATA_HDR_SIZE, "ping", 4);
+    nat_proto(s, P2P_PKT_DATA, P2P_DATA_FLAG_ACK, 1, pkt, n + P2P_DATA_HDR_SIZE + 4, &s->active_addr, P_tick_ms());
+    ASSERT_EQ(s->reliable.send_count, 0);
+    ASSERT_EQ(s->reliable.send_base, 1);
+    ASSERT_EQ(s->reliable.peer_rwnd, 5000);
+    char out[16];
+    ASSERT_EQ(stream_read(&s->stream, out, sizeof(out)), 8);
+    ASSERT(memcmp(out, "pingping", 8) == 0);
+
+    // 捎带部分被截断：整包丢弃
+    nat_proto(s, P2P_PKT_DATA, P2P_DATA_FLAG_ACK, 2, pkt, 5, &s->active_addr, P_tick_ms());
+    ASSERT_EQ(s->reliable.recv_next, 2);
+
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+
+/* 前向纠错：按丢包率分组附发 XOR 校验包，接收方组内单个丢包直接还原，不等重传 */
+static int fec_pkt(uint8_t *pkt, uint32_t off, const char *text) {
+    int n = (int)strlen(text);
+    memset(pkt, 0, P2P_DATA_HDR_SIZE);
+    nwrite_l(pkt, off);
+    memcpy(pkt + P2P_DATA_HDR_SIZE, text, n);
+    return P2P_DATA_HDR_SIZE + n;
+}
+
+TEST(fec_recover) {
+    mock_reset();
+    struct p2p_session *tx = create_mock_session(), *rx = create_mock_session();
+    uint8_t caps[RELIABLE_CAPS_MAX_PSZ];
+    int clen = reliable_write_caps(tx, caps);
+    reliable_on_caps(tx, caps, clen);
+    reliable_on_caps(rx, caps, clen);
+    mock_direct_path(tx);
+    mock_direct_path(rx);
+    ASSERT_EQ(fec_overhead(tx), 0);
+    tx->inst->cfg.fec = true;
+    ASSERT_EQ(fec_overhead(tx), (int)P2P_PKT_FEC_PSZ);
+
+    // 丢包率低于阈值：不发校验包
+    static const char *text[6] = { "alpha ", "bravo!! ", "charlie ", "delta", "echo ", "fox" };
+    uint8_t pkt[6][32]; int len[6]; uint32_t off = 0;
+    for (int i = 0; i < 6; i++) { len[i] = fec_pkt(pkt[i], off, text[i]); off += (uint32_t)strlen(text[i]); }
+    path_stats_t *st = &tx->remote_cands[0].stats;
+    ASSERT_EQ(reliable_send_pkt(tx, pkt[0], len[0]), 0);
+    reliable_tick(tx);
+    ASSERT_EQ(tx->fec.parity_sent, 0);
+    ASSERT_EQ(st->total_packets_sent, 1);
+
+    // 丢包 6%：每 4 个一组，组满即发校验包
+    st->loss_rate = 0.06f;
+    for (int i = 1; i < 5; i++) ASSERT_EQ(reliable_send_pkt(tx, pkt[i], len[i]), 0);
+    reliable_tick(tx);
+    ASSERT_EQ(tx->fec.parity_sent, 1);
+    ASSERT_EQ(st->total_packets_sent, 1 + 4 + 1);
+    ASSERT_EQ(tx->fec.tx_cnt, 0);
+    uint8_t parity[P2P_PKT_FEC_PSZ + 32], tail[P2P_PKT_FEC_PSZ + 32];
+    int plen = (int)P2P_PKT_FEC_PSZ + tx->fec.tx_max;
+    memcpy(parity, tx->fec.tx_buf, plen);
+    ASSERT_EQ(parity[0], 4);
+
+    // 突发尾部不足一组：本轮发送结束时单独成组
+    ASSERT_EQ(reliable_send_pkt(tx, pkt[5], len[5]), 0);
+    reliable_tick(tx);
+    ASSERT_EQ(tx->fec.parity_sent, 2);
+    ASSERT_EQ(st->total_packets_sent, 1 + 4 + 1 + 2);
+    int tlen = (int)P2P_PKT_FEC_PSZ + tx->fec.tx_max;
+    memcpy(tail, tx->fec.tx_buf, tlen);
+    ASSERT_EQ(tail[0], 1);
+
+    // 接收方：首个校验包只启用副本保留；seq=0、1、2、4（组 1..4 中缺 seq=3）到达后由校验包还原
+    uint64_t now = P_tick_ms();
+    nat_proto(rx, P2P_PKT_FEC, 0, 1, parity, plen, &rx->active_addr, now);
+    ASSERT(rx->fec.rx_buf != NULL);
+    ASSERT_EQ(rx->fec.recovered, 0);
+    int got[4] = { 0, 1, 2, 4 };
+    for (int i = 0; i < 4; i++)
+        nat_proto(rx, P2P_PKT_DATA, 0, (uint16_t)got[i], pkt[got[i]], len[got[i]], &rx->active_addr, now);
+    char out[64];
+    ASSERT_EQ(stream_read(&rx->stream, out, sizeof(out)), 22);
+    nat_proto(rx, P2P_PKT_FEC, 0, 1, parity, plen, &rx->active_addr, now);
+    ASSERT_EQ(rx->fec.recovered, 1);
+    stream_feed_from_reliable(rx);
+    ASSERT_EQ(stream_read(&rx->stream, out, sizeof(out)), 10);
+    ASSERT(memcmp(out, "deltaecho ", 10) == 0);
+
+    // 已全部收到：重复的校验包不再还原；缺两个时无法还原
+    nat_proto(rx, P2P_PKT_FEC, 0, 1, parity, plen, &rx->active_addr, now);
+    ASSERT_EQ(rx->fec.recovered, 1);
+    nat_proto(rx, P2P_PKT_FEC, 0, 5, parity, plen, &rx->active_addr, now);
+    ASSERT_EQ(rx->fec.recovered, 1);
+
+    // 单包组：校验包即原包
+    nat_proto(rx, P2P_PKT_FEC, 0, 5, tail, tlen, &rx->active_addr, now);
+    ASSERT_EQ(rx->fec.recovered, 2);
+    ASSERT_EQ(stream_read(&rx->stream, out, sizeof(out)), 3);
+    ASSERT(memcmp(out, "fox", 3) == 0);
+
+    fec_reset(tx);
+    fec_reset(rx);
+    nat_reset(&tx->nat);
+    nat_reset(&rx->nat);
+    free(tx->remote_cands);
+    free(rx->remote_cands);
+    destroy_mock_session(tx);
+    destroy_mock_session(rx);
+}
+
+/* 包合并：数据传输阶段内的小包合为一个 BUNDLE，大包与不可合并的包先发出缓冲；接收方拆开后逐个处理 */
+TEST(bundle_pack) {
+    mock_reset();
+    struct p2p_session *tx = create_mock_session(), *rx = create_mock_session();
+    uint8_t caps[RELIABLE_CAPS_MAX_PSZ];
+    int clen = reliable_write_caps(tx, caps);
+    reliable_on_caps(tx, caps, clen);
+    reliable_on_caps(rx, caps, clen);
+    ASSERT(tx->reliable.bundle);
+    mock_direct_path(tx);
+    mock_direct_path(rx);
+    path_stats_t *st = &tx->remote_cands[0].stats;
+    uint64_t now = P_tick_ms();
+
+    // 未开启 cfg.bundle：逐个发出
+    uint8_t pkt[3][32]; int len[3];
+    len[0] = fec_pkt(pkt[0], 0, "alpha ");
+    len[1] = fec_pkt(pkt[1], 6, "bravo ");
+    len[2] = fec_pkt(pkt[2], 12, "charlie");
+    p2p_bundle_begin(tx);
+    ASSERT(!tx->bundle.open);
+    p2p_send_packet(tx, &tx->active_addr, P2P_PKT_DATA, 0, 0, pkt[0], len[0], now);
+    ASSERT_EQ(tx->bundle.cnt, 0);
+    p2p_bundle_end(tx);
+
+    // 开启后：三个 DATA 进入缓冲区，按包计入路径统计
+    tx->inst->cfg.bundle = true;
+    p2p_bundle_begin(tx);
+    for (int i = 0; i < 3; i++)
+        ASSERT_EQ(p2p_send_packet(tx, &tx->active_addr, P2P_PKT_DATA, 0, (uint16_t)i, pkt[i], len[i], now), 0);
+    ASSERT_EQ(tx->bundle.cnt, 3);
+    ASSERT_EQ(st->total_packets_sent, 4);
+    uint8_t bundle[P2P_MAX_PAYLOAD]; int blen = tx->bundle.len;
+    memcpy(bundle, tx->bundle.buf, blen);
+    ASSERT_EQ(blen, 3 * (int)(P2P_PKT_BUNDLE_FRAME_HDR + P2P_HDR_SIZE) + len[0] + len[1] + len[2]);
+
+    // 放不下的包先发出缓冲（合为一个 BUNDLE）；超过负载上限一半，自身直接发出
+    uint8_t big[P2P_MAX_PAYLOAD] = {0};
+    p2p_send_packet(tx, &tx->active_addr, P2P_PKT_DGRAM, 0, 0, big, P2P_MAX_PAYLOAD - 32, now);
+    ASSERT_EQ(tx->bundle.cnt, 0);
+    ASSERT_EQ(tx->bundle.sent, 1);
+    ASSERT_EQ(tx->bundle.frames, 3);
+
+    // 单个包：阶段结束时原样发出；不可合并的包先发出缓冲
+    p2p_send_packet(tx, &tx->active_addr, P2P_PKT_ACK, 0, 0, big, 7, now);
+    ASSERT_EQ(tx->bundle.cnt, 1);
+    p2p_send_packet(tx, &tx->active_addr, P2P_PKT_FIN, 0, 0, NULL, 0, now);
+    ASSERT_EQ(tx->bundle.cnt, 0);
+    ASSERT_EQ(tx->bundle.sent, 1);
+    p2p_send_packet(tx, &tx->active_addr, P2P_PKT_ACK, 0, 0, big, 7, now);
+    p2p_bundle_end(tx);
+    ASSERT(!tx->bundle.open);
+    ASSERT_EQ(tx->bundle.cnt, 0);
+    ASSERT_EQ(tx->bundle.sent, 1);
+
+    // 接收方：拆开后按 DATA 交给 reliable 层
+    nat_proto(rx, P2P_PKT_BUNDLE, 0, 0, bundle, blen, &rx->active_addr, now);
+    stream_feed_from_reliable(rx);
+    char out[64];
+    ASSERT_EQ(stream_read(&rx->stream, out, sizeof(out)), 19);
+    ASSERT(memcmp(out, "alpha bravo charlie", 19) == 0);
+
+    // 截断的合并帧：已完整的包照常处理，残缺部分丢弃
+    nat_proto(rx, P2P_PKT_BUNDLE, 0, 0, bundle, blen - 1, &rx->active_addr, now);
+    ASSERT_EQ(stream_read(&rx->stream, out, sizeof(out)), 0);
+
+    // 对端未通告 caps2：不合并
+    tx->reliable.bundle = false;
+    p2p_bundle_begin(tx);
+    p2p_send_packet(tx, &tx->active_addr, P2P_PKT_ACK, 0, 0, big, 7, now);
+    ASSERT_EQ(tx->bundle.cnt, 0);
+    p2p_bundle_end(tx);
+
+    p2p_bundle_free(tx);
+    nat_reset(&tx->nat);
+    nat_reset(&rx->nat);
+    free(tx->remote_cands);
+    free(rx->remote_cands);
+    destroy_mock_session(tx);
+    destroy_mock_session(rx);
+}
+
+/* 多路径：按最低 RTT 优先逐包选路，路径窗口满后溢出到次优路径；RACK 与丢包按路径归账 */
+TEST(multipath_striping) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    s->inst->cfg.multipath = true;
+    check_add_cand(s, P2P_CAND_SRFLX, 0x7f000001, 9001);
+    check_add_cand(s, P2P_CAND_SRFLX, 0x7f000001, 9002);
+    for (int i = 0; i < 2; i++) path_manager_set_path_state(s, i, PATH_STATE_ACTIVE);
+    s->remote_cands[0].stats.rt_rtt_direct_srtt = 20;
+    s->remote_cands[1].stats.rt_rtt_direct_srtt = 60;
+    s->active_path = 0;
+    s->active_addr = s->remote_cands[0].addr;
+    s->path_type = P2P_PATH_PUNCH;
+    s->nat.state = NAT_CONNECTED;
+    ASSERT(path_manager_mp_enabled(s));
+
+    // 低 RTT 路径先填满初始窗口（10 个满包），其余溢出到次优路径
+    uint8_t data[1000] = {0};
+    for (int i = 0; i < 14; i++) ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    reliable_tick(s);
+    retx_entry_t *buf = s->reliable.send_buf;
+    for (int i = 0; i < 11; i++) ASSERT_EQ(buf[i].path, 0);
+    for (int i = 11; i < 14; i++) ASSERT_EQ(buf[i].path, 1);
+    ASSERT_EQ(s->remote_cands[0].stats.mp_inflight, 11000);
+    ASSERT_EQ(s->remote_cands[1].stats.mp_inflight, 3000);
+
+    // 慢路径的包发出更早：快路径的确认不能令其按 RACK 判定丢失
+    uint64_t now = P_tick_ms();
+    for (int i = 0; i < 11; i++) buf[i].send_time = now - 50;
+    buf[11].send_time = now - 1000;
+    buf[12].send_time = buf[13].send_time = now - 100;
+    for (int i = 11; i < 14; i++) buf[i].rto = 5000;
+    reliable_on_ack(s, 11, 0, now);
+    path_stats_t *p0 = &s->remote_cands[0].stats, *p1 = &s->remote_cands[1].stats;
+    ASSERT_EQ(p0->mp_inflight, 0);
+    ASSERT_EQ(p0->mp_srtt, 50);
+    ASSERT_EQ(p0->data_rtt, 50);
+    ASSERT_EQ(p0->mp_cwnd, P2P_MP_INIT_CWND + 11000);
+    int t = reliable_next_timeout(s, now);
+    ASSERT(t > 0);
+
+    // 慢路径上之后发出的包被确认：seq=11 在本路径内判定丢失，立即重传到低 RTT 路径
+    reliable_on_ack(s, 11, 0x3, now);
+    ASSERT_EQ(p1->mp_srtt, 100);
+    ASSERT_EQ(reliable_next_timeout(s, now), 0);
+    reliable_tick(s);
+    ASSERT_EQ(buf[11].retx_count, 1);
+    ASSERT_EQ(buf[11].path, 0);
+    ASSERT_EQ(p1->mp_lost, 1);
+    ASSERT_EQ(p1->mp_inflight, 0);
+    ASSERT_EQ(p1->mp_cwnd, (P2P_MP_INIT_CWND + 2000) / 2);   // 两个确认的慢启动增量后减半
+    ASSERT(p1->data_loss_rate > 0.3f && p1->data_loss_rate < 0.34f);
+    ASSERT_EQ(p0->mp_inflight, 1000);
+
+    // 仅一条可用路径：不受路径窗口限制，等同单路径
+    p0->mp_inflight = p0->mp_cwnd;
+    ASSERT_EQ(path_manager_mp_pick(s, 1000, false), 1);
+    path_manager_set_path_state(s, 1, PATH_STATE_FAILED);
+    ASSERT_EQ(path_manager_mp_pick(s, 1000, false), 0);
+
+    // multi_session 按活跃地址派发，不启用多路径
+    s->inst->cfg.multi_session = true;
+    ASSERT(!path_manager_mp_enabled(s));
+
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+/* 冗余双发：流标记双发的包同时经次优路径（PUNCH 活跃时取 TURN）发出，接收端静默丢弃后到的副本 */
+TEST(redundant_dup_send) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    check_add_cand(s, P2P_CAND_SRFLX, 0x7f000001, 9001);
+    check_add_cand(s, P2P_CAND_RELAY, 0x7f000002, 3478);
+    for (int i = 0; i < 2; i++) path_manager_set_path_state(s, i, PATH_STATE_ACTIVE);
+    s->active_path = 0;
+    s->active_addr = s->remote_cands[0].addr;
+    s->path_type = P2P_PATH_PUNCH;
+    s->nat.state = NAT_CONNECTED;
+    ASSERT_EQ(path_manager_select_best_path(s), 0);
+    ASSERT_EQ(path_manager_select_backup_path(s), 1);
+    ASSERT_EQ(s->remote_cands[0].stats.state, PATH_STATE_ACTIVE);
+
+    ASSERT_EQ(p2p_stream_redundant((p2p_session_t)s, 0, P2P_REDUNDANT_ON), 0);
+    ASSERT_EQ(p2p_stream_redundant((p2p_session_t)s, 1, P2P_REDUNDANT_ON), -1);
+    ASSERT_EQ(p2p_stream_redundant((p2p_session_t)s, 0, 3), -1);
+
+    // 双发：两条路径各发一份，发送后活跃路径字段恢复
+    path_stats_t *p0 = &s->remote_cands[0].stats, *p1 = &s->remote_cands[1].stats;
+    uint8_t data[100] = {0};
+    ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    reliable_set_redundant(s, s->stream.redundant);
+    reliable_tick(s);
+    ASSERT_EQ(p0->total_packets_sent, 1);
+    ASSERT_EQ(p1->total_packets_sent, 1);
+    ASSERT_EQ(s->active_path, 0);
+    ASSERT_EQ(s->path_type, P2P_PATH_PUNCH);
+    ASSERT(sockaddr_equal(&s->active_addr, &s->remote_cands[0].addr));
+
+    // 未标记的包只走活跃路径
+    ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    reliable_tick(s);
+    ASSERT_EQ(p0->total_packets_sent, 2);
+    ASSERT_EQ(p1->total_packets_sent, 1);
+
+    // AUTO：活跃路径质量趋势转负时才双发
+    ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    reliable_set_redundant(s, P2P_REDUNDANT_AUTO);
+    ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    reliable_set_redundant(s, P2P_REDUNDANT_AUTO);
+    s->reliable.send_buf[3].send_time = 1;              // 暂不发出第二个包
+    reliable_tick(s);
+    ASSERT_EQ(p1->total_packets_sent, 1);
+    s->reliable.send_buf[3].send_time = 0;
+    p0->quality_trend = -0.5f;
+    ASSERT(path_manager_quality_falling(s));
+    reliable_tick(s);
+    ASSERT_EQ(p1->total_packets_sent, 2);
+
+    // 接收端：已收到的序号再到达 DUP 副本时静默丢弃，不触发立即 ACK；普通重复包仍立即 ACK
+    struct sockaddr_in from = s->remote_cands[1].addr;
+    ASSERT_EQ(reliable_on_data(s, 0, data, sizeof(data)), 1);
+    s->reliable.need_ack = false;
+    nat_proto(s, P2P_PKT_DATA, P2P_DATA_FLAG_DUP, 0, data, sizeof(data), &from, P_tick_ms());
+    ASSERT(!s->reliable.need_ack);
+    nat_proto(s, P2P_PKT_DATA, 0, 0, data, sizeof(data), &from, P_tick_ms());
+    ASSERT(s->reliable.need_ack);
+    ASSERT(reliable_recv_has(s, 0));
+    ASSERT(!reliable_recv_has(s, 5));
+
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+/* 被动 RTT：活跃路径的数据 ACK 样本计入 rt_rtt_direct_srtt，样本新鲜时保活跳过该路径 */
+TEST(passive_ack_rtt) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    check_add_cand(s, P2P_CAND_SRFLX, 0x7f000001, 9001);
+    check_add_cand(s, P2P_CAND_SRFLX, 0x7f000002, 9002);
+    for (int i = 0; i < 2; i++) path_manager_set_path_state(s, i, PATH_STATE_ACTIVE);
+    s->active_path = 0;
+    s->active_addr = s->remote_cands[0].addr;
+    s->path_type = P2P_PATH_PUNCH;
+
+    uint64_t now = P_tick_ms();
+    uint8_t data[100] = {0};
+    ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    reliable_tick(s);
+    s->reliable.send_buf[0].send_time = now - 30;
+    ASSERT(!path_manager_rtt_fresh(s, 0, now, 2500));
+    reliable_on_ack(s, 1, 0, now);
+
+    path_stats_t *p0 = &s->remote_cands[0].stats;
+    ASSERT_EQ(p0->rt_rtt_direct_srtt, 30);
+    ASSERT_EQ(p0->rt_sample_count, 1);
+    ASSERT(path_manager_rtt_fresh(s, 0, now + 100, 2500));
+    ASSERT(!path_manager_rtt_fresh(s, 0, now + 2500, 2500));
+    ASSERT(!path_manager_rtt_fresh(s, 1, now, 2500));
+
+    // 保活：有新鲜样本的活跃路径跳过，备用路径照常探测
+    s->nat.state = NAT_CONNECTED;
+    s->nat.last_recv_time = now;
+    nat_tick(s, now + 100);
+    ASSERT_EQ(s->remote_cands[0].last_punch_send_ms, 0);
+    ASSERT_EQ(s->remote_cands[1].last_punch_send_ms, now + 100);
+
+    // 样本过期后恢复探测
+    s->nat.last_recv_time = now + 10000;
+    nat_tick(s, now + 10000);
+    ASSERT_EQ(s->remote_cands[0].last_punch_send_ms, now + 10000);
+
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+/* 连接后探测分级：活跃 / 次优路径每轮保活，其余疏探测，失效路径不再探测、收到对端包后恢复 */
+TEST(probe_tiers) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    for (int i = 0; i < 4; i++) {
+        check_add_cand(s, P2P_CAND_SRFLX, 0x7f000001 + i, (uint16_t)(9001 + i));
+        path_manager_set_path_state(s, i, PATH_STATE_ACTIVE);
+    }
+    s->active_path = 0;
+    s->active_addr = s->remote_cands[0].addr;
+    s->path_type = P2P_PATH_PUNCH;
+    s->nat.state = NAT_CONNECTED;
+    int backup = path_manager_select_backup_path(s);
+    ASSERT(backup > 0);
+    int sparse = backup == 1 ? 2 : 1;
+
+    uint64_t now = P_tick_ms();
+    uint32_t ka = nat_keepalive_ms(s);
+    int sent[4] = {0};
+    for (int r = 0; r < P2P_PROBE_SPARSE * 2; r++) {
+        now += ka;
+        s->nat.last_recv_time = now;
+        nat_tick(s, now);
+        for (int i = 0; i < 4; i++) sent[i] += s->remote_cands[i].last_punch_send_ms == now;
+    }
+    ASSERT_EQ(sent[0], P2P_PROBE_SPARSE * 2);
+    ASSERT_EQ(sent[backup], P2P_PROBE_SPARSE * 2);
+    ASSERT_EQ(sent[sparse], 2);
+    ASSERT_EQ(s->remote_cands[sparse].stats.probe_period, P2P_PROBE_SPARSE);
+
+    // 疏探测路径的无响应超时按探测周期放宽
+    path_stats_t *sp = &s->remote_cands[sparse].stats;
+    sp->last_recv_ms = now;
+    s->path_mgr.last_health_check_ms = 0;
+    path_manager_tick(s, now + 60000);
+    ASSERT_EQ(sp->state, PATH_STATE_ACTIVE);
+
+    // 连续恢复失败达到上限：不再进入 RECOVERING，也不再探测
+    path_stats_t *dp = &s->remote_cands[3].stats;
+    dp->state = PATH_STATE_FAILED;
+    dp->state_timestamp_ms = now;
+    dp->fail_rounds = P2P_PROBE_DEAD_ROUNDS;
+    ASSERT(path_is_dead(dp));
+    s->path_mgr.last_health_check_ms = 0;
+    path_manager_tick(s, now + 600000);
+    ASSERT_EQ(dp->state, PATH_STATE_FAILED);
+    s->nat.state = NAT_RELAY;
+    nat_tick(s, now += 60000);
+    ASSERT(s->remote_cands[3].last_punch_send_ms < now);
+    ASSERT_EQ(s->remote_cands[2].last_punch_send_ms, now);
+
+    // 对端的包到达：重新进入恢复探测
+    path_manager_on_packet_recv(s, 3, now, 40, false, 0);
+    ASSERT_EQ(dp->state, PATH_STATE_RECOVERING);
+    ASSERT_EQ(dp->fail_rounds, 0);
+
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+
+/* 时间戳回显：RTT 与丢包不依赖 pending 队列，REACH 扣除对端停留时间并给出反向排队延迟 */
+TEST(punch_ts_echo) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    check_add_cand(s, P2P_CAND_SRFLX, 0x7f000001, 9001);
+    check_add_cand(s, P2P_CAND_SRFLX, 0x7f000002, 9002);
+    path_manager_set_path_state(s, 0, PATH_STATE_ACTIVE);
+    path_stats_t *st = &s->remote_cands[0].stats;
+    uint64_t now = P_tick_ms();
+
+    // 带时间戳的 REACH：RTT = 往返 - hold，切换前入队的同 seq 记录被清除
+    path_manager_on_packet_send(s, 0, 77, now, 0, true);
+    ASSERT_EQ(s->path_mgr.pending_count, 1);
+    uint8_t reach[P2P_PKT_REACH_TS_PSZ];
+    memcpy(reach, &s->remote_cands[0].addr.sin_addr.s_addr, 4);
+    memcpy(reach + 4, &s->remote_cands[0].addr.sin_port, 2);
+    uint32_t us = (uint32_t)P_tick_us();
+    nwrite_l(reach + 6, us - 50000);
+    nwrite_l(reach + 10, 30000);
+    nwrite_l(reach + 14, us - 10000);
+    nat_proto(s, P2P_PKT_REACH, 0, 77, reach, sizeof(reach), &s->remote_cands[0].addr, now);
+    ASSERT(s->nat.ts_echo);
+    ASSERT_EQ(s->path_mgr.pending_count, 0);
+    ASSERT(st->rt_rtt_direct_srtt >= 20 && st->rt_rtt_direct_srtt <= 22);
+    ASSERT_EQ(st->rt_packets_lost, 0);
+
+    // 反向单程延迟较最小值增加 20ms：记为反向排队
+    us = (uint32_t)P_tick_us();
+    path_manager_on_echo(s, 0, 0, 78, us - 20000, 0, us - 30000);
+    ASSERT(st->rt_rev_queue_us >= 19000 && st->rt_rev_queue_us <= 21000);
+
+    // 回显计数窗口：上一窗口未回显的探测在轮换时计为丢包，迟到的回显不再计数
+    uint32_t t0 = (uint32_t)P_tick_us() - 100000;
+    for (int i = 0; i < 4; i++) path_manager_on_echo_send(s, 0, t0 + (uint32_t)i * 1000, now);
+    ASSERT_EQ(st->rt_echo_sent[0], 4);
+    ASSERT(path_manager_on_echo(s, 0, 0, 1, t0, 0, t0) >= 99);
+    path_manager_on_echo(s, 0, 0, 2, t0 + 1000, 0, t0);
+    ASSERT_EQ(st->rt_echo_acked[0], 2);
+    s->path_mgr.last_health_check_ms = 0;
+    path_manager_tick(s, now + 3000);
+    ASSERT_EQ(st->rt_packets_lost, 0);
+    ASSERT_EQ(st->rt_echo_sent[1], 4);
+    s->path_mgr.last_health_check_ms = 0;
+    path_manager_tick(s, now + 6000);
+    ASSERT_EQ(st->rt_packets_lost, 2);
+    path_manager_on_echo(s, 0, 0, 3, t0 + 2000, 0, t0);
+    ASSERT_EQ(st->rt_echo_acked[0] + st->rt_echo_acked[1], 0);
+
+    // 应答端：PUNCH 携带时间戳时 REACH 回显（不可写路径进入 reaching 队列）
+    uint8_t punch[P2P_PKT_PUNCH_TS_PSZ];
+    memcpy(punch, &s->remote_cands[1].addr.sin_addr.s_addr, 4);
+    memcpy(punch + 4, &s->remote_cands[1].addr.sin_port, 2);
+    nwrite_l(punch + 6, 0x12345678);
+    path_manager_set_path_state(s, 0, PATH_STATE_FAILED);
+    nat_proto(s, P2P_PKT_PUNCH, 0, 9, punch, sizeof(punch), &s->remote_cands[1].addr, now);
+    ASSERT(s->nat.reaching_head != NULL);
+    ASSERT(s->nat.reaching_head->ts);
+    ASSERT_EQ(s->nat.reaching_head->echo_ts, 0x12345678);
+
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+/* 路径迁移：切换活跃路径保留序号与在途窗口，在途包立即经新路径重传，仅重置 RTT/拥塞状态 */
+TEST(path_migration_keeps_inflight) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    check_add_cand(s, P2P_CAND_SRFLX, 0x7f000001, 9001);
+    check_add_cand(s, P2P_CAND_SRFLX, 0x7f000002, 9002);
+    for (int i = 0; i < 2; i++) path_manager_set_path_state(s, i, PATH_STATE_ACTIVE);
+    p2p_set_active_path(s, 0);
+
+    s->trans = &p2p_trans_pseudotcp;
+    s->trans->init(s);
+    uint8_t data[100] = {0};
+    for (int i = 0; i < 3; i++) ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    reliable_tick_cwnd(s, INT64_MAX);
+    path_stats_t *p0 = &s->remote_cands[0].stats, *p1 = &s->remote_cands[1].stats;
+    ASSERT_EQ(p0->total_packets_sent, 3);
+
+    uint64_t now = P_tick_ms();
+    s->reliable.send_buf[0].send_time = now - 40;
+    reliable_on_ack(s, 1, 0, now);
+    ASSERT(s->reliable.srtt > 0);
+    s->tcp.cwnd = 64 * P2P_CC_MSS;
+
+    // 切到路径 1：序号不变，2 个在途包立即重传（不等 RTO），RTT 与拥塞窗口重置
+    uint16_t send_seq = s->reliable.send_seq;
+    p2p_set_active_path(s, 1);
+    ASSERT_EQ(s->reliable.send_seq, send_seq);
+    ASSERT_EQ(s->reliable.send_base, 1);
+    ASSERT_EQ(s->reliable.send_count, 2);
+    ASSERT_EQ(p1->total_packets_sent, 2);
+    ASSERT_EQ(s->reliable.send_buf[1].retx_count, 1);
+    ASSERT_EQ(s->reliable.send_buf[1].rto, RELIABLE_RTO_INIT);
+    ASSERT_EQ(s->reliable.srtt, 0);
+    ASSERT_EQ(s->reliable.rto, RELIABLE_RTO_INIT);
+    ASSERT(s->tcp.cwnd < 64 * P2P_CC_MSS);
+
+    // 活跃路径不变时不触发
+    p2p_set_active_path(s, 1);
+    ASSERT_EQ(p1->total_packets_sent, 2);
+
+    // 新路径上的确认照常推进窗口
+    reliable_on_ack(s, 3, 0, P_tick_ms());
+    ASSERT_EQ(s->reliable.send_count, 0);
+
+    s->trans->close(s);
+    s->trans = NULL;
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+/* 预测式切换：活跃路径趋势下降即预热次优路径，次优路径不慢于当前样本时跳过稳定窗口直接切换 */
+/* p2p_get_stats / p2p_get_instance_stats：收发计数、重传计数与活跃路径快照 */
+TEST(session_stats) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    check_add_cand(s, P2P_CAND_SRFLX, 0x7f000001, 9001);
+    check_add_cand(s, P2P_CAND_SRFLX, 0x7f000002, 9002);
+    for (int i = 0; i < 2; i++) path_manager_set_path_state(s, i, PATH_STATE_ACTIVE);
+    p2p_set_active_path(s, 0);
+    s->trans = &p2p_trans_pseudotcp;
+    s->trans->init(s);
+
+    uint8_t data[100] = {0};
+    for (int i = 0; i < 3; i++) ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    reliable_tick_cwnd(s, INT64_MAX);
+    uint64_t now = P_tick_ms();
+    path_manager_on_packet_recv(s, 0, now, 40, false, 0);
+
+    p2p_stats_t st;
+    ASSERT_EQ(p2p_get_stats(s, &st), 0);
+    ASSERT_EQ(st.packets_sent, 3);
+    ASSERT_EQ(st.bytes_sent, s->remote_cands[0].stats.total_bytes_sent);
+    ASSERT_EQ(st.packets_recv, 1);
+    ASSERT_EQ(st.bytes_recv, 40);
+    ASSERT_EQ(st.retransmits, 0);
+    ASSERT_EQ(st.inflight, 3);
+    ASSERT_EQ(st.cwnd, s->cc->cwnd(s));
+    ASSERT_EQ(st.ssthresh, (int64_t)s->tcp.ssthresh);
+
+    // 路径迁移重发的在途包计入重传，实例汇总与会话一致
+    p2p_set_active_path(s, 1);
+    ASSERT_EQ(p2p_get_stats(s, &st), 0);
+    ASSERT_EQ(st.retransmits, 3);
+    ASSERT_EQ(st.packets_sent, 6);
+    p2p_instance_stats_t is;
+    ASSERT_EQ(p2p_get_instance_stats(s->inst, &is), 0);
+    ASSERT_EQ(is.packets_sent, st.packets_sent);
+    ASSERT_EQ(is.bytes_recv, st.bytes_recv);
+    ASSERT_EQ(is.retransmits, st.retransmits);
+
+    // 活跃路径快照在健康检查时刷新
+    path_stats_t *p1 = &s->remote_cands[1].stats;
+    p1->rtt_ms = 42;
+    p1->bandwidth_bps = 8000000;
+    path_manager_tick(s, now + 60000);
+    ASSERT_EQ(p2p_get_stats(s, &st), 0);
+    ASSERT_EQ(st.path_rtt_ms, 42);
+    ASSERT_EQ(st.bandwidth_bps, 8000000);
+    ASSERT(st.loss_rate == p1->loss_rate);
+
+    ASSERT_EQ(p2p_get_stats(NULL, &st), -1);
+    ASSERT_EQ(p2p_get_instance_stats(NULL, &is), -1);
+
+    s->trans->close(s);
+    s->trans = NULL;
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+
+/* 事件追踪：埋点写入环形缓冲区，flush 输出 NDJSON；缓冲区满时丢弃并记录丢弃数 */
+TEST(trace_events) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    const char *file = "/tmp/p2p_test_trace.ndjson";
+    remove(file);
+    ASSERT_EQ(p2p_trace_open(inst, file), E_NONE);
+    s->id = 7;
+
+    uint8_t data[100] = {0};
+    for (int i = 0; i < 2; i++) ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    reliable_tick(s);
+    p2p_count_retx(s, 1, "rto");
+    p2p_trace_cwnd(s, 12000, 6000);
+    p2p_trace_cwnd(s, 12000, 6000);                 // 未变化：不重复记录
+    p2p_trace_flush(inst);
+
+    // 写满一圈后再写 5 个：丢弃 5 个
+    for (int i = 0; i < P2P_TRACE_RING + 5; i++) P2P_TRACE(s, P2P_TRACE_SIG, 0, 0, 0, 0, 0, 0, "x");
+    ASSERT_EQ(inst->trace->dropped, 5);
+    p2p_trace_close(inst);
+    ASSERT(inst->trace == NULL);
+
+    FILE *fp = fopen(file, "r");
+    ASSERT(fp != NULL);
+    char line[256];
+    int lines = 0, tx = 0, retx = 0, cwnd = 0, sig = 0, dropped = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        lines++;
+        ASSERT(line[0] == '{' && strstr(line, "}\n"));
+        if (strstr(line, "\"s\":7,\"ev\":\"pkt_tx\",\"type\":\"DATA\"")) tx++;
+        if (strstr(line, "\"ev\":\"retx\",\"seq\":1,\"reason\":\"rto\"")) retx++;
+        if (strstr(line, "\"ev\":\"cwnd\",\"cwnd\":12000,\"ssthresh\":6000")) cwnd++;
+        if (strstr(line, "\"ev\":\"sig\",\"what\":\"x\"")) sig++;
+        if (strstr(line, "\"ev\":\"dropped\",\"n\":5")) dropped++;
+    }
+    fclose(fp);
+    remove(file);
+    ASSERT_EQ(tx, 2);
+    ASSERT_EQ(retx, 1);
+    ASSERT_EQ(cwnd, 1);
+    ASSERT_EQ(sig, P2P_TRACE_RING);
+    ASSERT_EQ(dropped, 1);
+    ASSERT_EQ(lines, tx + retx + cwnd + sig + dropped);
+
+    destroy_mock_session(s);
+}
+
+/* 建连里程碑：首次到达时记录，首次进入 CONNECTED 时回调一次并汇入实例分位数 */
+static int setup_cb_cnt;
+static int setup_cb_ms[P2P_SETUP_NUM];
+static void on_setup_cb(p2p_session_t session, const int ms[P2P_SETUP_NUM], void *userdata) {
+    (void)session; (void)userdata;
+    setup_cb_cnt++;
+    memcpy(setup_cb_ms, ms, sizeof(setup_cb_ms));
+}
+
+TEST(setup_milestones) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    check_add_cand(s, P2P_CAND_SRFLX, 0x7f000001, 9001);
+    path_manager_set_path_state(s, 0, PATH_STATE_ACTIVE);
+    inst->sessions_head = s;
+    inst->cfg.on_setup = on_setup_cb;
+    setup_cb_cnt = 0;
+
+    uint64_t t0 = P_tick_ms() - 500;
+    s->setup_start = t0;
+    s->state = P2P_STATE_SIGNALING;
+    p2p_setup_mark(s, P2P_SETUP_SIGNALED, t0 + 40);
+    p2p_setup_mark(s, P2P_SETUP_REMOTE_CAND, t0 + 60);
+    p2p_setup_mark(s, P2P_SETUP_REMOTE_CAND, t0 + 90);          // 只记录首次
+    inst->setup_gather_wait = 1;
+    p2p_setup_gathered(inst, t0 + 120);
+    ASSERT_EQ(inst->setup_gather_wait, 0);
+    p2p_connecting(s);
+    p2p_connected(s, t0 + 300);
+    ASSERT_EQ(s->state, P2P_STATE_CONNECTED);
+
+    ASSERT_EQ(setup_cb_cnt, 1);
+    ASSERT_EQ(setup_cb_ms[P2P_SETUP_GATHER], 120);
+    ASSERT_EQ(setup_cb_ms[P2P_SETUP_SIGNALED], 40);
+    ASSERT_EQ(setup_cb_ms[P2P_SETUP_REMOTE_CAND], 60);
+    ASSERT_EQ(setup_cb_ms[P2P_SETUP_CANDS_DONE], -1);             // 未到达
+    ASSERT(setup_cb_ms[P2P_SETUP_PUNCH] >= 500);
+    ASSERT_EQ(setup_cb_ms[P2P_SETUP_REACH], 300);
+    ASSERT(setup_cb_ms[P2P_SETUP_CONNECTED] >= setup_cb_ms[P2P_SETUP_PUNCH]);
+
+    p2p_stats_t st;
+    ASSERT_EQ(p2p_get_stats(s, &st), 0);
+    ASSERT(memcmp(st.setup_ms, setup_cb_ms, sizeof(setup_cb_ms)) == 0);
+
+    // 后续状态变化不再回调；实例分位数来自已完成的建连
+    p2p_connected(s, t0 + 400);
+    ASSERT_EQ(setup_cb_cnt, 1);
+    p2p_instance_stats_t is;
+    ASSERT_EQ(p2p_get_instance_stats(inst, &is), 0);
+    ASSERT_EQ(is.setup_count, 1);
+    ASSERT_EQ(is.setup_p50_ms[P2P_SETUP_REACH], 300);
+    ASSERT_EQ(is.setup_max_ms[P2P_SETUP_GATHER], 120);
+    ASSERT_EQ(is.setup_p90_ms[P2P_SETUP_CANDS_DONE], -1);
+
+    // 多个样本：按里程碑独立排序
+    int reach[4] = { 200, 100, 400, 800 };
+    for (int i = 0; i < 4; i++) {
+        for (int m = 0; m < P2P_SETUP_NUM; m++) inst->setup_hist[inst->setup_hist_cnt][m] = -1;
+        inst->setup_hist[inst->setup_hist_cnt++][P2P_SETUP_REACH] = reach[i];
+    }
+    ASSERT_EQ(p2p_get_instance_stats(inst, &is), 0);
+    ASSERT_EQ(is.setup_count, 5);
+    ASSERT_EQ(is.setup_p50_ms[P2P_SETUP_REACH], 300);
+    ASSERT_EQ(is.setup_p90_ms[P2P_SETUP_REACH], 400);
+    ASSERT_EQ(is.setup_max_ms[P2P_SETUP_REACH], 800);
+    ASSERT_EQ(is.setup_max_ms[P2P_SETUP_GATHER], 120);
+
+    inst->sessions_head = NULL;
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+
+TEST(session_hibernate) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    inst->cfg.hibernate_ms = 100;
+    s->file_tx.fd = s->file_rx.fd = -1;
+    s->reliable.send_seq = s->reliable.send_base = 7;
+    s->reliable.recv_next = s->reliable.recv_base = 3;
+    uint64_t now = P_tick_ms();
+
+    // 首次检查开始计时；缓冲区有数据时重新计时
+    p2p_session_hibernate(s, now);
+    p2p_session_hibernate(s, now + 50);
+    ASSERT(!s->hibernated);
+    uint8_t buf[16];
+    ASSERT_EQ(stream_write(&s->stream, "x", 1), 1);
+    p2p_session_hibernate(s, now + 200);
+    ASSERT(!s->hibernated);
+    ASSERT_EQ(ring_read(&s->stream.send_ring, buf, sizeof(buf)), 1);
+    p2p_session_hibernate(s, now + 250);
+    ASSERT(!s->hibernated);
+
+    // 空闲满 hibernate_ms：释放流与 reliable 缓冲区，读取端照常返回无数据
+    p2p_session_hibernate(s, now + 300);
+    ASSERT(s->hibernated);
+    ASSERT(s->stream.send_ring.data == NULL && s->stream.recv_ring.data == NULL);
+    ASSERT(s->reliable.send_buf == NULL && s->reliable.recv_data == NULL);
+    p2p_instance_stats_t is;
+    ASSERT_EQ(p2p_get_instance_stats(inst, &is), 0);
+    ASSERT_EQ(is.hibernated, 1);
+    ASSERT_EQ(p2p_recv(s, buf, sizeof(buf)), 0);
+    ASSERT_EQ(stream_flush_timeout(s, &s->stream, now + 300), -1);
+
+    // p2p_send 透明恢复：初始容量的缓冲区，序列号保留
+    ASSERT_EQ(p2p_send(s, "hi", 2), 2);
+    ASSERT(!s->hibernated);
+    ASSERT_EQ(s->stream.send_ring.size, RING_SIZE);
+    ASSERT(s->reliable.send_buf != NULL);
+    ASSERT_EQ(s->reliable.send_seq, 7);
+    ASSERT_EQ(s->reliable.recv_base, 3);
+    ASSERT_EQ(p2p_get_instance_stats(inst, &is), 0);
+    ASSERT_EQ(is.hibernated, 0);
+    int n = stream_flush_to_reliable(s);
+    ASSERT(n > 0);
+    ASSERT_EQ(s->reliable.send_buf[7 & (s->reliable.window - 1)].seq, 7);
+
+    // 在途包未确认前不休眠
+    uint64_t t = P_tick_ms();
+    p2p_session_hibernate(s, t);
+    p2p_session_hibernate(s, t + 1000);
+    ASSERT(!s->hibernated);
+    reliable_on_ack(s, 8, 0, t + 1000);
+    p2p_session_hibernate(s, t + 1000);
+    p2p_session_hibernate(s, t + 1200);
+    ASSERT(s->hibernated);
+
+    // 收到数据面包同样恢复
+    struct sockaddr_in from = { .sin_family = AF_INET };
+    uint8_t ack[6] = {0};
+    nat_proto(s, P2P_PKT_ACK, 0, 0, ack, sizeof(ack), &from, t + 1300);
+    ASSERT(!s->hibernated);
+    ASSERT(s->stream.recv_ring.data != NULL && s->reliable.recv_bitmap != NULL);
+    ASSERT_EQ(s->data_ts, t + 1300);
+
+    destroy_mock_session(s);
+}
+
+static int tm_allocs, tm_frees;
+static void *tm_malloc(size_t size, void *ud) { (void)ud; tm_allocs++; return malloc(size); }
+static void *tm_realloc(void *ptr, size_t size, void *ud) { (void)ud; if (!ptr) tm_allocs++; return realloc(ptr, size); }
+static void  tm_free(void *ptr, void *ud) { (void)ud; if (ptr) tm_frees++; free(ptr); }
+
+TEST(mem_arena_allocator) {
+    mock_reset();
+    p2p_allocator_t bad = { tm_malloc, NULL, tm_free, NULL };
+    ASSERT_EQ(p2p_set_allocator(&bad), -1);
+    p2p_allocator_t hooks = { tm_malloc, tm_realloc, tm_free, NULL };
+    ASSERT_EQ(p2p_set_allocator(&hooks), 0);
+
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    tm_allocs = tm_frees = 0;
+    inst->arena = p2p_arena_create();
+    ASSERT(inst->arena != NULL);
+
+    // 候选数组在实例内存区内增长（8 -> 16 -> 32），统计为用户字节
+    for (int i = 0; i < 20; i++) check_add_cand(s, P2P_CAND_HOST, 0x0a000001 + i, 5000);
+    ASSERT_EQ(s->remote_cand_cap, 32);
+    p2p_instance_stats_t is;
+    ASSERT_EQ(p2p_get_instance_stats(inst, &is), 0);
+    ASSERT_EQ(is.mem_blocks, 1);
+    ASSERT_EQ(is.mem_bytes, 32 * sizeof(p2p_remote_candidate_entry_t));
+
+    // 环形缓冲挂在同一内存区，释放后占用回落，峰值保留
+    ringbuf_t r;
+    ASSERT_EQ(ring_init_in(&r, 4096, 4096, inst->arena, NULL), 0);
+    ASSERT_EQ(p2p_get_instance_stats(inst, &is), 0);
+    ASSERT_EQ(is.mem_blocks, 2);
+    uint64_t peak = is.mem_bytes;
+    ring_release(&r);
+    ASSERT_EQ(p2p_get_instance_stats(inst, &is), 0);
+    ASSERT_EQ(is.mem_blocks, 1);
+    ASSERT_EQ(is.mem_peak_bytes, peak);
+
+    // 销毁内存区一次性回收剩余块；所有分配都经过自定义钩子且收支平衡
+    ASSERT_EQ(p2p_arena_destroy(inst->arena), 1);
+    inst->arena = NULL;
+    s->remote_cands = NULL; s->remote_cand_cnt = s->remote_cand_cap = 0;
+    ASSERT(tm_allocs >= 3);
+    ASSERT_EQ(tm_allocs, tm_frees);
+
+    destroy_mock_session(s);
+    ASSERT_EQ(p2p_set_allocator(NULL), 0);
+}
+
+/* p2p_memory_stats：各组件在分配 / 释放处计量，会话计数汇总到实例，会话释放时从实例扣除余下部分 */
+TEST(memory_stats) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    struct p2p_session *other = create_mock_session();
+    reliable_free(s);                       // 模拟会话的槽位数组分配时尚未关联实例
+    memset(&s->mem, 0, sizeof(s->mem));
+    s->mem.parent = &inst->mem;
+    inst->rel_pool.mem = &inst->mem;
+    p2p_memory_stats_t ms, is;
+    ASSERT_EQ(p2p_memory_stats(NULL, NULL, &ms), -1);
+    ASSERT_EQ(p2p_memory_stats(inst, other, &ms), -1);
+    ASSERT_EQ(p2p_memory_stats(inst, NULL, &is), 0);
+    ASSERT_EQ(is.total, 0);
+
+    // 候选数组扩容（0 -> 8 -> 16 -> 32）按增长部分累计
+    for (int i = 0; i < 20; i++) check_add_cand(s, P2P_CAND_HOST, 0x0a000001 + i, 5000);
+    ASSERT_EQ(p2p_memory_stats(inst, s, &ms), 0);
+    ASSERT_EQ(ms.cands, 32 * sizeof(p2p_remote_candidate_entry_t));
+
+    // 环形缓冲区按当前容量计量：扩容、休眠、恢复、释放
+    stream_t st;
+    ASSERT_EQ(stream_init_in(&st, NULL, &s->mem, 0, 4096, 4096, 16384), E_NONE);
+    ASSERT_EQ(p2p_memory_stats(inst, s, &ms), 0);
+    ASSERT_EQ(ms.stream, 8192);
+    ASSERT(ring_reserve(&st.send_ring, 6000) >= 6000);
+    ASSERT_EQ(p2p_memory_stats(inst, s, &ms), 0);
+    ASSERT_EQ(ms.stream, 8192 + 4096);
+    stream_hibernate(&st);
+    ASSERT_EQ(p2p_memory_stats(inst, s, &ms), 0);
+    ASSERT_EQ(ms.stream, 0);
+    ASSERT_EQ(ring_thaw(&st.recv_ring), E_NONE);
+    ASSERT_EQ(p2p_memory_stats(inst, s, &ms), 0);
+    ASSERT_EQ(ms.stream, 4096);
+    stream_free(&st);
+
+    // reliable 槽位数组属于会话；共享缓冲区池 slab 只计入实例
+    ASSERT_EQ(reliable_init(s), E_NONE);
+    ASSERT_EQ(p2p_memory_stats(inst, s, &ms), 0);
+    ASSERT(ms.reliable > 0);
+    uint8_t *buf = reliable_pool_get(&inst->rel_pool);
+    ASSERT(buf != NULL);
+    ASSERT_EQ(p2p_memory_stats(inst, NULL, &is), 0);
+    ASSERT(is.reliable > ms.reliable);
+    reliable_pool_put(&inst->rel_pool, buf);
+    reliable_pool_trim(&inst->rel_pool);
+    ASSERT_EQ(p2p_memory_stats(inst, NULL, &is), 0);
+    ASSERT_EQ(is.reliable, ms.reliable);
+    ASSERT_EQ(is.total, ms.total);
+    ASSERT_EQ(ms.total, ms.cands + ms.reliable);
+
+    // 会话释放：余下的字节随之从实例扣除
+    reliable_free(s);
+    p2p_mem_release(&s->mem);
+    ASSERT_EQ(p2p_memory_stats(inst, s, &ms), 0);
+    ASSERT_EQ(ms.total, 0);
+    ASSERT_EQ(p2p_memory_stats(inst, NULL, &is), 0);
+    ASSERT_EQ(is.total, 0);
+
+    free(s->remote_cands);
+    destroy_mock_session(other);
+    destroy_mock_session(s);
+}
+
+/* 延迟直方图：对数-线性分桶的分位数与清零；send_ring 排队与发送到确认埋点（未编译 P2P_METRICS 时查询返回 -1） */
+TEST(latency_histograms) {
+    p2p_hist_stat_t st;
+    ASSERT_EQ(p2p_hist_get(P2P_HIST_NUM, &st), -1);
+    ASSERT_EQ(p2p_hist_get(-1, &st), -1);
+    ASSERT(strcmp(p2p_hist_name(P2P_HIST_SEND_ACK), "send_ack") == 0);
+    ASSERT(p2p_hist_name(P2P_HIST_NUM) == NULL);
+#ifndef P2P_METRICS
+    ASSERT_EQ(p2p_hist_get(P2P_HIST_UPDATE, &st), -1);
+#else
+    p2p_hist_reset(-1);
+    for (int i = 1; i <= 1000; i++) p2p_hist_record(P2P_HIST_UPDATE, (uint64_t)i);
+    ASSERT_EQ(p2p_hist_get(P2P_HIST_UPDATE, &st), 0);
+    ASSERT_EQ(st.count, 1000);
+    ASSERT_EQ(st.sum_us, 500500);
+    ASSERT_EQ(st.min_us, 1);
+    ASSERT_EQ(st.max_us, 1000);
+    ASSERT(st.p50_us >= 440 && st.p50_us <= 560);                 // 子桶相对误差 ≤ 12.5%
+    ASSERT(st.p90_us >= 790 && st.p90_us <= 1000);
+    ASSERT(st.p99_us >= 870 && st.p99_us <= 1000);
+    ASSERT(st.p999_us <= st.max_us);
+    p2p_hist_record(P2P_HIST_UPDATE, UINT64_MAX / 2);             // 超出范围归入末桶
+    ASSERT_EQ(p2p_hist_get(P2P_HIST_UPDATE, &st), 0);
+    ASSERT_EQ(st.count, 1001);
+    p2p_hist_reset(P2P_HIST_UPDATE);
+    ASSERT_EQ(p2p_hist_get(P2P_HIST_UPDATE, &st), 0);
+    ASSERT_EQ(st.count, 0);
+
+    // 写入 send_ring 占用采样槽，末字节组包后记录排队时延并归还
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    uint8_t data[3000] = {0};
+    stream_write(&s->stream, data, sizeof(data));
+    ASSERT(s->stream.queue_ts != 0);
+    ASSERT_EQ(s->stream.queue_left, (int)sizeof(data));
+    stream_write(&s->stream, data, 100);                          // 采样槽占用中：不重新采样
+    ASSERT_EQ(s->stream.queue_left, (int)sizeof(data));
+    ASSERT_EQ(stream_flush_to_reliable(s), (int)sizeof(data) + 100);
+    ASSERT(s->stream.queue_ts == 0);
+    ASSERT_EQ(p2p_hist_get(P2P_HIST_SEND_QUEUE, &st), 0);
+    ASSERT_EQ(st.count, 1);
+
+    // 首次发出的包被确认时记录发送到确认时延
+    int pkts = s->reliable.send_count;
+    reliable_tick(s);
+    uint64_t now = P_tick_ms() + 5;
+    reliable_on_ack(s, (uint16_t)pkts, 0, now);
+    ASSERT_EQ(p2p_hist_get(P2P_HIST_SEND_ACK, &st), 0);
+    ASSERT_EQ(st.count, (uint64_t)pkts);
+    ASSERT(st.min_us >= 5000);
+    p2p_hist_reset(-1);
+    destroy_mock_session(s);
+#endif
+}
+
+TEST(predictive_switch) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    check_add_cand(s, P2P_CAND_SRFLX, 0x7f000001, 9001);
+    check_add_cand(s, P2P_CAND_SRFLX, 0x7f000002, 9002);
+    for (int i = 0; i < 2; i++) path_manager_set_path_state(s, i, PATH_STATE_ACTIVE);
+    p2p_set_active_path(s, 0);
+    s->path_mgr.pending_switch_path = PATH_IDX_NONE;
+    s->path_mgr.prewarm_path = PATH_IDX_NONE;
+    ASSERT_EQ(path_manager_set_threshold(s, P2P_PATH_PUNCH, 50, 0.05f, 3000, 2000, 0.3f), 0);
+
+    path_stats_t *p0 = &s->remote_cands[0].stats, *p1 = &s->remote_cands[1].stats;
+    uint64_t now = P_tick_ms();
+    p0->quality_trend = -0.5f;
+    ASSERT_EQ(path_manager_predict(s, now), PATH_IDX_NONE);       // 未开启
+    s->inst->cfg.path_predictive = true;
+
+    // 备用路径尚无测量：只预热（立即探测一次），不切换
+    ASSERT_EQ(path_manager_predict(s, now), PATH_IDX_NONE);
+    ASSERT_EQ(s->path_mgr.prewarm_path, 1);
+    ASSERT_EQ(s->remote_cands[1].last_punch_send_ms, now);
+    ASSERT_EQ(path_manager_predict(s, now + 100), PATH_IDX_NONE);  // 预热节流
+    ASSERT_EQ(s->remote_cands[1].last_punch_send_ms, now);
+
+    // 备用路径更慢：不切换；快于活跃路径最新样本：切换且不等稳定窗口
+    p0->rt_rtt_direct_srtt = 40; p0->rt_rtt_direct = 80;
+    p1->rt_rtt_direct_srtt = 120;
+    ASSERT_EQ(path_manager_predict(s, now + 200), PATH_IDX_NONE);
+    p1->rt_rtt_direct_srtt = 60;
+    ASSERT_EQ(path_manager_predict(s, now + 300), 1);
+    ASSERT_EQ(path_manager_switch_path(s, 1, "predictive", now + 300), 0);
+    ASSERT_EQ(s->active_path, 1);
+
+    // 迟滞：新路径趋势随即下降也受冷却期约束，不立即切回
+    p1->quality_trend = -0.5f;
+    p0->quality_trend = 0.0f;
+    p0->rt_rtt_direct_srtt = 20; p0->rt_rtt_direct = 20;
+    ASSERT_EQ(path_manager_predict(s, now + 400), 0);
+    ASSERT_EQ(path_manager_switch_path(s, 0, "predictive", now + 400), 1);
+
+    // 趋势恢复：停止预热
+    p1->quality_trend = 0.0f;
+    ASSERT_EQ(path_manager_predict(s, now + 500), PATH_IDX_NONE);
+    ASSERT_EQ(s->path_mgr.prewarm_path, PATH_IDX_NONE);
+
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+/* TURN ChannelData：首次发送发起 ChannelBind，绑定成功后按通道号收发，过期或失败后回退 Indication */
+TEST(turn_channel_data) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    turn_ctx_t *t = &inst->turn[0];
+    t->state = TURN_ALLOCATED;
+    t->has_key = true;
+    inst->cfg.turn_user = "user";
+    t->server_addr.sin_family = AF_INET;
+    t->server_addr.sin_addr.s_addr = htonl(0x0a000001);
+    t->server_addr.sin_port = htons(3478);
+
+    struct sockaddr_in peer = {0};
+    peer.sin_family = AF_INET;
+    peer.sin_addr.s_addr = htonl(0x0a000002);
+    peer.sin_port = htons(5000);
+
+    // 首次发送：分配通道并发起 ChannelBind，数据仍走 Send Indication
+    uint8_t payload[8] = {P2P_PKT_DATA, 0, 0, 1, 'a', 'b', 'c', 'd'};
+    sock_msg_t msg; P_msg_set(&msg, payload, sizeof(payload));
+    p2p_turn_send(inst, &peer, &msg, 1);
+    ASSERT_EQ(t->channel_count, 1);
+    turn_channel_t *c = &t->channels[0];
+    ASSERT_EQ(c->number, 0x4000);
+    ASSERT(!c->bound);
+    ASSERT(c->bind_ms != 0);
+
+    // 事务 ID 不匹配的 Success 被忽略；匹配后绑定完成
+    uint8_t rsp[20] = {0x01, 0x09, 0, 0};
+    nwrite_l(rsp + 4, STUN_MAGIC);
+    ASSERT_EQ(p2p_turn_handle_packet(inst, &t->server_addr, 0x0109, rsp, sizeof(rsp), NULL, NULL, NULL, NULL), 0);
+    ASSERT(!c->bound);
+    memcpy(rsp + 8, c->tsx, 12);
+    ASSERT_EQ(p2p_turn_handle_packet(inst, &t->server_addr, 0x0109, rsp, sizeof(rsp), NULL, NULL, NULL, NULL), 0);
+    ASSERT(c->bound);
+    p2p_turn_send(inst, &peer, &msg, 1);
+    ASSERT_EQ(t->channel_count, 1);
+
+    // 接收：[通道号][长度][数据]，来源必须是 TURN 服务器、通道号已分配、长度不越界
+    uint8_t cd[4 + sizeof(payload)] = {0x40, 0x00, 0, sizeof(payload)};
+    memcpy(cd + 4, payload, sizeof(payload));
+    const uint8_t *data = NULL; int dlen = 0; struct sockaddr_in from = {0};
+    ASSERT_EQ(p2p_turn_handle_channel_data(inst, &t->server_addr, cd, sizeof(cd), &data, &dlen, &from), 1);
+    ASSERT_EQ(dlen, (int)sizeof(payload));
+    ASSERT(data == cd + 4);
+    ASSERT_EQ(from.sin_addr.s_addr, peer.sin_addr.s_addr);
+    ASSERT_EQ(from.sin_port, peer.sin_port);
+    ASSERT_EQ(p2p_turn_handle_channel_data(inst, &peer, cd, sizeof(cd), &data, &dlen, &from), 0);
+    cd[3] = sizeof(payload) + 1;
+    ASSERT_EQ(p2p_turn_handle_channel_data(inst, &t->server_addr, cd, sizeof(cd), &data, &dlen, &from), 0);
+    cd[3] = sizeof(payload); cd[1] = 0x01;
+    ASSERT_EQ(p2p_turn_handle_channel_data(inst, &t->server_addr, cd, sizeof(cd), &data, &dlen, &from), 0);
+
+    // 8 分钟后刷新（重新请求），10 分钟未刷新成功则解除绑定
+    uint64_t bound = c->bound_ms;
+    t->lifetime = 3600;
+    t->last_refresh_ms = t->req_ms = bound;
+    p2p_turn_tick(inst, bound + 480 * 1000);
+    ASSERT_EQ(c->bind_ms, bound + 480 * 1000);
+    ASSERT(c->bound);
+    p2p_turn_tick(inst, bound + 600 * 1000);
+    ASSERT(!c->bound);
+
+    // 服务器拒绝绑定：标记失败，不再重试
+    uint8_t err[28] = {0x01, 0x19, 0, 8};
+    nwrite_l(err + 4, STUN_MAGIC);
+    memcpy(err + 8, c->tsx, 12);
+    nwrite_s(err + 20, 0x0009); nwrite_s(err + 22, 4);
+    err[26] = 4; err[27] = 3;                                  // 403
+    ASSERT_EQ(p2p_turn_handle_packet(inst, &t->server_addr, 0x0119, err, sizeof(err), NULL, NULL, NULL, NULL), 0);
+    ASSERT(c->failed);
+    uint64_t last = c->bind_ms;
+    p2p_turn_send(inst, &peer, &msg, 1);
+    ASSERT_EQ(c->bind_ms, last);
+
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+/* TURN 权限集合实例级共享（跨会话按 IP 去重）；Allocate 未响应时重传，超时后放弃 */
+TEST(turn_perm_share_alloc_retry) {
+    mock_reset();
+    struct p2p_session *a = create_mock_session(), *b = create_mock_session();
+    struct p2p_instance *inst = a->inst;
+    turn_ctx_t *t = &inst->turn[0];
+    inst->sessions_head = a; a->next = b;
+    inst->cfg.turn_user = "user";
+    t->server_addr.sin_family = AF_INET;
+    t->server_addr.sin_addr.s_addr = htonl(0x0a000001);
+    t->server_addr.sin_port = htons(3478);
+
+    // a 与 b 各 20 个候选，其中 10 个 IP 相同（端口不同）
+    for (int i = 0; i < 20; i++) check_add_cand(a, P2P_CAND_SRFLX, 0x0b000000 + i, 5000);
+    for (int i = 10; i < 30; i++) check_add_cand(b, P2P_CAND_SRFLX, 0x0b000000 + i, 6000);
+
+    uint64_t now = P_tick_ms();
+    t->state = TURN_ALLOCATED;
+    t->has_key = true;
+    t->lifetime = 600;
+    t->last_refresh_ms = t->last_perm_ms = t->req_ms = now;
+    p2p_turn_tick(inst, now);
+    ASSERT_EQ(t->perm_count, 30);
+    p2p_turn_tick(inst, now + 1000);
+    ASSERT_EQ(t->perm_count, 30);
+
+    // 4 分钟后整体刷新，按当前候选重建
+    b->remote_cand_cnt = 10;
+    p2p_turn_tick(inst, now + 240 * 1000);
+    ASSERT_EQ(t->perm_count, 20);
+    ASSERT_EQ(t->last_perm_ms, now + 240 * 1000);
+
+    // 集合容量上限 3/4
+    for (int i = 0; i < 300; i++) check_add_cand(b, P2P_CAND_SRFLX, 0x0c000000 + i, 6000);
+    p2p_turn_tick(inst, now + 241 * 1000);
+    ASSERT_EQ(t->perm_count, TURN_PERM_SLOTS * 3 / 4);
+
+    // Allocate 重传：RTO 倍增，7 次后失败并释放 turn_pending
+    t->state = TURN_ALLOCATING;
+    t->req_tries = 1; t->req_ms = now;
+    inst->turn_pending = 1;
+    uint8_t tsx[12]; memcpy(tsx, t->req_tsx, 12);
+    p2p_turn_tick(inst, now + 400);
+    ASSERT_EQ(t->req_tries, 1);
+    p2p_turn_tick(inst, now + 500);
+    ASSERT_EQ(t->req_tries, 2);
+    ASSERT(!memcmp(tsx, t->req_tsx, 12));                      // 重传沿用事务 ID
+    p2p_turn_tick(inst, now + 1400);
+    ASSERT_EQ(t->req_tries, 2);
+    uint64_t at = now + 500;
+    for (int k = 2; k < 7; k++) { at += 500ull << (k - 1); p2p_turn_tick(inst, at); }
+    ASSERT_EQ(t->req_tries, 7);
+    ASSERT_EQ(t->state, TURN_ALLOCATING);
+
+    // 过期事务的响应被忽略
+    uint8_t rsp[20] = {0x01, 0x13, 0, 0};
+    nwrite_l(rsp + 4, STUN_MAGIC);
+    memset(rsp + 8, 0xAA, 12);
+    ASSERT_EQ(p2p_turn_handle_packet(inst, &t->server_addr, 0x0113, rsp, sizeof(rsp), NULL, NULL, NULL, NULL), 0);
+    ASSERT_EQ(t->state, TURN_ALLOCATING);
+
+    p2p_turn_tick(inst, at + (500ull << 6));
+    ASSERT_EQ(t->state, TURN_FAILED);
+    ASSERT_EQ(inst->turn_pending, 0);
+
+    a->next = NULL;
+    free(a->remote_cands);
+    free(b->remote_cands);
+    destroy_mock_session(a);
+    destroy_mock_session(b);
+}
+/* Allocate Success：XOR-RELAYED-ADDRESS 为 ip:port */
+static int turn_alloc_success(uint8_t *buf, const uint8_t *tsx, uint32_t ip, uint16_t port) {
+    memset(buf, 0, 32);
+    nwrite_s(buf, 0x0103); nwrite_s(buf + 2, 12);
+    nwrite_l(buf + 4, STUN_MAGIC);
+    memcpy(buf + 8, tsx, 12);
+    nwrite_s(buf + 20, 0x0016); nwrite_s(buf + 22, 8);
+    buf[25] = 0x01;
+    nwrite_s(buf + 26, port ^ 0x2112);
+    nwrite_l(buf + 28, ip ^ STUN_MAGIC);
+    return 32;
+}
+/* 多 TURN 服务器：Binding 测 RTT，按 RTT 升序在最近的 turn_allocs 个服务器上分配，中继发送经最近的已分配服务器 */
+TEST(turn_server_probe) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    inst->socks[0].sock = socket(AF_INET, SOCK_DGRAM, 0);
+    inst->cfg.turn_server = "127.0.0.1";
+    inst->cfg.turn_servers = "127.0.0.2:3479, 127.0.0.3";
+    inst->cfg.turn_allocs = 2;
+
+    // 启动探测：每个服务器一个 Binding，探测期间 turn_pending 计 1
+    ASSERT_EQ(p2p_turn_allocate(inst), 0);
+    turn_probe_t *p = &inst->turn_probe;
+    ASSERT(p->active);
+    ASSERT_EQ(p->cnt, 3);
+    ASSERT_EQ(p->servers[1].port, 3479);
+    ASSERT_EQ(p->servers[2].port, 3478);
+    ASSERT_EQ(inst->turn_pending, 1);
+    for (int i = 0; i < 3; i++) ASSERT_EQ(p->servers[i].tries, 1);
+    ASSERT_EQ(p2p_turn_allocate(inst), 0);                      // 探测中不重复发起
+    ASSERT_EQ(p->servers[0].tries, 1);
+
+    // 127.0.0.3 约 20ms、127.0.0.2 约 80ms，127.0.0.1 无响应；来源或事务 ID 不符的不计
+    uint64_t now = p2p_now_ms();
+    uint8_t rsp[32] = {0x01, 0x01, 0, 0};
+    nwrite_l(rsp + 4, STUN_MAGIC);
+    memcpy(rsp + 8, p->servers[2].tsx, 12);
+    ASSERT(!p2p_turn_probe_response(inst, &p->servers[1].addr, 0x0101, rsp, 20));
+    p->servers[2].sent_ms = now - 20;
+    ASSERT(p2p_turn_probe_response(inst, &p->servers[2].addr, 0x0101, rsp, 20));
+    ASSERT(p->servers[2].rtt_ms >= 20 && p->servers[2].rtt_ms < 80);
+    memcpy(rsp + 8, p->servers[1].tsx, 12);
+    p->servers[1].sent_ms = now - 80;
+    ASSERT(p2p_turn_probe_response(inst, &p->servers[1].addr, 0x0101, rsp, 20));
+    ASSERT(p->servers[1].rtt_ms >= 80);
+    ASSERT(!p2p_turn_probe_response(inst, &p->servers[0].addr, 0x0101, rsp, 20));
+
+    // 未响应的服务器按 250ms 重发（换新事务 ID）
+    uint8_t tsx[12]; memcpy(tsx, p->servers[0].tsx, 12);
+    uint64_t t0 = p->servers[0].sent_ms;
+    p2p_turn_tick(inst, t0 + 100);
+    ASSERT_EQ(p->servers[0].tries, 1);
+    p2p_turn_tick(inst, t0 + 250);
+    ASSERT_EQ(p->servers[0].tries, 2);
+    ASSERT(memcmp(tsx, p->servers[0].tsx, 12));
+    ASSERT(p->active);
+
+    // 窗口结束：最近的两个服务器各占一个槽位（槽位 0 最近）
+    p2p_turn_tick(inst, p->start_ms + 1000);
+    ASSERT(!p->active);
+    turn_ctx_t *t0s = &inst->turn[0], *t1s = &inst->turn[1];
+    ASSERT(!strcmp(t0s->host, "127.0.0.3"));
+    ASSERT_EQ(t0s->port, 3478);
+    ASSERT(!strcmp(t1s->host, "127.0.0.2"));
+    ASSERT_EQ(t1s->port, 3479);
+    ASSERT_EQ(t0s->state, TURN_ALLOCATING);
+    ASSERT_EQ(t1s->state, TURN_ALLOCATING);
+    ASSERT_EQ(inst->turn_pending, 2);
+    ASSERT_NULL(p2p_turn_active(inst));
+
+    // 响应按来源归属槽位：另一服务器的事务 ID 不被接受，未知来源不处理
+    int n = turn_alloc_success(rsp, t0s->req_tsx, 0x0a000101, 50000);
+    ASSERT_EQ(p2p_turn_handle_packet(inst, &t1s->server_addr, 0x0103, rsp, n, NULL, NULL, NULL, NULL), 0);
+    ASSERT_EQ(t1s->state, TURN_ALLOCATING);
+    struct sockaddr_in other = t0s->server_addr;
+    other.sin_addr.s_addr = htonl(0x7f000009);
+    ASSERT_EQ(p2p_turn_handle_packet(inst, &other, 0x0103, rsp, n, NULL, NULL, NULL, NULL), -1);
+
+    // 较远的服务器先分配成功：暂经它发送；最近的分配成功后改经槽位 0
+    n = turn_alloc_success(rsp, t1s->req_tsx, 0x0a000202, 50001);
+    ASSERT_EQ(p2p_turn_handle_packet(inst, &t1s->server_addr, 0x0103, rsp, n, NULL, NULL, NULL, NULL), 0);
+    ASSERT_EQ(t1s->state, TURN_ALLOCATED);
+    ASSERT(p2p_turn_active(inst) == t1s);
+    n = turn_alloc_success(rsp, t0s->req_tsx, 0x0a000101, 50000);
+    ASSERT_EQ(p2p_turn_handle_packet(inst, &t0s->server_addr, 0x0103, rsp, n, NULL, NULL, NULL, NULL), 0);
+    ASSERT_EQ(t0s->state, TURN_ALLOCATED);
+    ASSERT_EQ(t0s->relay_addr.sin_addr.s_addr, htonl(0x0a000101));
+    ASSERT(p2p_turn_active(inst) == t0s);
+    ASSERT_EQ(inst->turn_pending, 0);
+
+    // 再次请求分配：已有分配保持不变
+    ASSERT_EQ(p2p_turn_allocate(inst), 0);
+    ASSERT_EQ(t0s->state, TURN_ALLOCATED);
+    ASSERT_EQ(t1s->state, TURN_ALLOCATED);
+
+    p2p_turn_reset(inst);
+    ASSERT_EQ(t1s->state, TURN_IDLE);
+    P_sock_close(inst->socks[0].sock);
+    inst->socks[0].sock = mock_sock;
+    destroy_mock_session(s);
+}
+/* TURN over TCP：连接就绪后才发 Allocate，消息按自身长度跨 recv 重组，ChannelData 补齐 4 字节；
+ * 同源 UDP 包不被接受，连接断开时视同分配过期，重新连接并分配 */
+static int turn_tcp_accept(int l, struct p2p_instance *inst, turn_ctx_t *t) {
+    int srv = accept(l, NULL, NULL);
+    for (int i = 0; i < 100 && t->state == TURN_CONNECTING; i++) { p2p_turn_tick(inst, p2p_now_ms()); P_usleep(1000); }
+    return srv;
+}
+
+TEST(turn_tcp_transport) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+
+    int l = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in la = {0};
+    la.sin_family = AF_INET;
+    la.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t alen = sizeof(la);
+    ASSERT_EQ(bind(l, (struct sockaddr *)&la, sizeof(la)), 0);
+    ASSERT_EQ(listen(l, 2), 0);
+    ASSERT_EQ(getsockname(l, (struct sockaddr *)&la, &alen), 0);
+
+    inst->cfg.turn_server = "127.0.0.1";
+    inst->cfg.turn_port = ntohs(la.sin_port);
+    inst->cfg.turn_transport = P2P_TURN_TCP;
+    inst->cfg.turn_user = "user";
+    inst->cfg.turn_pass = "pass";
+
+    // 先建立连接，就绪后发送 Allocate（REQUESTED-TRANSPORT 仍为 UDP）
+    turn_ctx_t *t = &inst->turn[0];
+    ASSERT_EQ(p2p_turn_allocate(inst), 0);
+    ASSERT_EQ(t->state, TURN_CONNECTING);
+    ASSERT_EQ(inst->turn_pending, 1);
+    int srv = turn_tcp_accept(l, inst, t);
+    ASSERT(srv >= 0);
+    ASSERT_EQ(t->state, TURN_ALLOCATING);
+    uint8_t buf[256];
+    ASSERT_EQ(recv(srv, buf, sizeof(buf), 0), 28);
+    ASSERT_EQ(nget_s(buf), 0x0003);
+    ASSERT_EQ(buf[24], 17);
+
+    // Allocate Success 分两段到达；同样的消息经 UDP 到达时不被接受
+    uint8_t rsp[64];
+    int n = turn_alloc_success(rsp, t->req_tsx, 0x0a000101, 50000);
+    ASSERT_EQ(p2p_turn_handle_packet(inst, &t->server_addr, 0x0103, rsp, n, NULL, NULL, NULL, NULL), -1);
+    ASSERT_EQ(send(srv, rsp, 10, 0), 10);
+    p2p_turn_tick(inst, p2p_now_ms());
+    ASSERT_EQ(t->state, TURN_ALLOCATING);
+    ASSERT_EQ(send(srv, rsp + 10, n - 10, 0), n - 10);
+    p2p_turn_tick(inst, p2p_now_ms());
+    ASSERT_EQ(t->state, TURN_ALLOCATED);
+    ASSERT_EQ(t->relay_addr.sin_addr.s_addr, htonl(0x0a000101));
+    ASSERT_EQ(inst->turn_pending, 0);
+
+    // 首次中继发送：ChannelBind + Send Indication
+    t->has_key = true;
+    struct sockaddr_in peer = {0};
+    peer.sin_family = AF_INET;
+    peer.sin_addr.s_addr = htonl(0x0b000001);
+    peer.sin_port = htons(6000);
+    sock_msg_t m;
+    P_msg_set(&m, "hello", 5);
+    ASSERT(p2p_turn_send(inst, &peer, &m, 1) > 0);
+    P_usleep(10000);
+    n = (int)recv(srv, buf, sizeof(buf), MSG_DONTWAIT);
+    ASSERT(n > 20);
+    ASSERT_EQ(nget_s(buf), 0x0009);
+    int off = 20 + nget_s(buf + 2);
+    ASSERT(off + 20 <= n);
+    ASSERT_EQ(nget_s(buf + off), 0x0016);
+    ASSERT_EQ(n, off + 20 + nget_s(buf + off + 2));
+    ASSERT_EQ(t->channel_count, 1);
+
+    // 填充后的 ChannelData 与 ChannelBind Success 在同一段到达：边界正确才能识别后者
+    uint8_t seg[12 + 20] = {0x40, 0x00, 0x00, 0x05, 'h', 'e', 'l', 'l', 'o'};   // 负载 5 字节 + 3 字节填充
+    seg[12] = 0x01; seg[13] = 0x09;
+    nwrite_l(seg + 16, STUN_MAGIC);
+    memcpy(seg + 20, t->channels[0].tsx, 12);
+    ASSERT_EQ(send(srv, seg, sizeof(seg), 0), (ssize_t)sizeof(seg));
+    p2p_turn_tick(inst, p2p_now_ms());
+    ASSERT(t->channels[0].bound);
+
+    // 通道已绑定：ChannelData 补齐到 4 字节
+    ASSERT(p2p_turn_send(inst, &peer, &m, 1) > 0);
+    P_usleep(10000);
+    ASSERT_EQ(recv(srv, buf, sizeof(buf), MSG_DONTWAIT), 12);
+    ASSERT_EQ(nget_s(buf), 0x4000);
+    ASSERT_EQ(nget_s(buf + 2), 5);
+    ASSERT(!memcmp(buf + 4, "hello\0\0\0", 8));
+
+    // 服务器关闭连接：分配随之失效，重新连接并分配
+    close(srv);
+    for (int i = 0; i < 100 && t->state == TURN_ALLOCATED; i++) { p2p_turn_tick(inst, p2p_now_ms()); P_usleep(1000); }
+    ASSERT(t->state == TURN_CONNECTING || t->state == TURN_ALLOCATING);
+    ASSERT_EQ(t->channel_count, 0);
+    ASSERT_EQ(inst->turn_pending, 1);
+    srv = turn_tcp_accept(l, inst, t);
+    ASSERT(srv >= 0);
+    ASSERT_EQ(t->state, TURN_ALLOCATING);
+
+    p2p_turn_reset(inst);
+    ASSERT_EQ(t->state, TURN_IDLE);
+    ASSERT(t->tcp == NULL);
+    close(srv);
+    close(l);
+    destroy_mock_session(s);
+}
+
+/* TCP 路径：与 UDP 候选同地址时按收包来源区分；长度前缀帧跨 recv 拼接，非法帧断开并使路径失效 */
+TEST(tcp_punch_framing) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    check_add_cand(s, P2P_CAND_HOST, 0x0a000002, 5000);
+    check_add_cand(s, P2P_CAND_TCP, 0x0a000002, 5000);
+    ASSERT_EQ(p2p_get_path_type(s, 1), P2P_PATH_TCP);
+    ASSERT(!strcmp(p2p_path_type_str(P2P_PATH_TCP), "TCP"));
+
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    P_sock_nonblock(sv[0], true);
+    p2p_tcp_punch_t *c = (p2p_tcp_punch_t *)calloc(1, sizeof(*c));
+    c->sock = sv[0];
+    c->peer = s->remote_cands[1].addr;
+    c->path = 1;
+    s->tcp_punch = c;
+
+    uint64_t now = P_tick_ms();
+    s->nat.state = NAT_PUNCHING;
+    s->nat.punch_start = now;
+
+    // PUNCH 帧分两段到达
+    uint8_t f[2 + P2P_HDR_SIZE + P2P_PKT_PUNCH_PSZ] = {0};
+    nwrite_s(f, P2P_HDR_SIZE + P2P_PKT_PUNCH_PSZ);
+    p2p_pkt_hdr_encode(f + 2, P2P_PKT_PUNCH, 0, 1);
+    ASSERT_EQ(send(sv[1], f, 3, 0), 3);
+    p2p_tcp_punch_tick(s, now);
+    ASSERT_EQ(s->remote_cands[1].stats.last_recv_ms, 0);
+    ASSERT_EQ(send(sv[1], f + 3, sizeof(f) - 3, 0), (ssize_t)sizeof(f) - 3);
+    p2p_tcp_punch_tick(s, now + 1);
+    ASSERT(s->rx_confirmed);
+    ASSERT(s->remote_cands[1].stats.last_recv_ms != 0);
+    ASSERT_EQ(s->remote_cands[0].stats.last_recv_ms, 0);   // 同地址的 UDP 候选不受影响
+    ASSERT(!s->tcp_rx);
+
+    // 发送：[len(2)][P2P 包]
+    uint8_t buf[64];
+    while (recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT) > 0) {}
+    ASSERT_EQ(p2p_tcp_send_packet(s, P2P_PKT_DATA, 0, 7, "abc", 3), P2P_HDR_SIZE + 3);
+    ASSERT_EQ(recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT), 2 + P2P_HDR_SIZE + 3);
+    ASSERT_EQ(nget_s(buf), P2P_HDR_SIZE + 3);
+    ASSERT_EQ(buf[2], P2P_PKT_DATA);
+    ASSERT(!memcmp(buf + 2 + P2P_HDR_SIZE, "abc", 3));
+
+    // 非法帧长：断开连接，TCP 路径失效，此后发送静默丢弃
+    uint8_t bad[2] = {0, 1};
+    ASSERT_EQ(send(sv[1], bad, 2, 0), 2);
+    p2p_tcp_punch_tick(s, now + 2);
+    ASSERT_EQ(c->sock, P_INVALID_SOCKET);
+    ASSERT_EQ(c->path, -1);
+    ASSERT_EQ(s->remote_cands[1].stats.state, PATH_STATE_FAILED);
+    ASSERT_EQ(p2p_tcp_send_packet(s, P2P_PKT_DATA, 0, 8, "abc", 3), 0);
+    ASSERT(p2p_tcp_punch_next_timeout(s, now + 2) > 0);      // 按 P2P_TCP_RESTART_MS 重新打洞
+
+    p2p_tcp_punch_close(s, true);
+    ASSERT(s->tcp_punch == NULL);
+    close(sv[1]);
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    destroy_mock_session(s);
+}
+
+/* 共享内存路径：同机标识一致时经 HELLO/OFFER 互相映射接收环，帧经环送达 NAT 层；一端关闭后对端路径失效 */
+static int shm_msg(uint8_t *buf, uint8_t op, uint64_t host_id, const char *name) {
+    int n = 0;
+    buf[n++] = op;
+    nwrite_ll(buf + n, host_id); n += 8;
+    if (name) { buf[n++] = (uint8_t)strlen(name); memcpy(buf + n, name, strlen(name)); n += (int)strlen(name); }
+    return n;
+}
+
+TEST(shm_ring_path) {
+    mock_reset();
+    struct p2p_session *a = create_mock_session(), *b = create_mock_session();
+    uint64_t now = P_tick_ms();
+    struct p2p_session *ss[2] = { a, b };
+    for (int i = 0; i < 2; i++) {
+        ss[i]->inst->cfg.enable_shm = true;
+        ss[i]->nat.state = NAT_CONNECTED;
+        ss[i]->nat.punch_start = now;
+        ss[i]->path_type = P2P_PATH_LAN;
+        check_add_cand(ss[i], P2P_CAND_HOST, 0x7f000001, 5000);
+    }
+    uint64_t hid = p2p_shm_host_id(a->inst);
+    ASSERT(hid != 0 && hid == p2p_shm_host_id(b->inst));
+    ASSERT(!strcmp(p2p_path_type_str(P2P_PATH_SHM), "SHM"));
+
+    // 直连建立后发出 HELLO（重发有上限）
+    ASSERT_EQ(p2p_shm_next_timeout(a, now), 0);
+    p2p_shm_tick(a, now);
+    ASSERT(a->shm && a->shm->hello_cnt == 1);
+    ASSERT_EQ(p2p_shm_next_timeout(a, now), P2P_SHM_HELLO_MS);
+
+    // 主机标识不一致：放弃
+    uint8_t m[64];
+    struct p2p_session *c = create_mock_session();
+    c->inst->cfg.enable_shm = true;
+    p2p_shm_on_packet(c, m, shm_msg(m, P2P_SHM_OP_HELLO, hid ^ 1, NULL), now);
+    ASSERT(c->shm && c->shm->failed && !c->shm->rx);
+    p2p_shm_close(c, true);
+    destroy_mock_session(c);
+
+    // A 收到 B 的 HELLO → 创建接收环；B 收到 A 的 OFFER → 映射并创建自己的接收环；A 收到 B 的 OFFER → 双方就绪
+    p2p_shm_on_packet(a, m, shm_msg(m, P2P_SHM_OP_HELLO, hid, NULL), now);
+    ASSERT(a->shm->rx && !a->shm->tx && a->shm->offered);
+    p2p_shm_on_packet(b, m, shm_msg(m, P2P_SHM_OP_OFFER, hid, a->shm->rx_name), now);
+    ASSERT(b->shm->rx && b->shm->tx && b->shm->path == 1);
+    p2p_shm_on_packet(a, m, shm_msg(m, P2P_SHM_OP_OFFER, hid, b->shm->rx_name), now);
+    ASSERT_EQ(a->shm->path, 1);
+    ASSERT_EQ(a->remote_cands[1].type, P2P_CAND_SHM);
+    ASSERT_EQ(p2p_get_path_type(a, 1), P2P_PATH_SHM);
+    ASSERT_EQ(a->remote_cands[1].stats.state, PATH_STATE_ACTIVE);
+    ASSERT_EQ(path_manager_select_best_path(a), 1);        // 可用时优先于 LAN
+
+    // PUNCH 经环送达：按共享内存候选记账，同机 UDP 候选不受影响
+    ASSERT(!p2p_shm_pending(b));
+    ASSERT_EQ(p2p_shm_send_packet(a, P2P_PKT_PUNCH, 0, 1, m, P2P_PKT_PUNCH_PSZ), P2P_HDR_SIZE + P2P_PKT_PUNCH_PSZ);
+    ASSERT(p2p_shm_pending(b));
+    p2p_shm_tick(b, now + 1);
+    ASSERT(!p2p_shm_pending(b));
+    ASSERT(b->rx_confirmed);
+    ASSERT(b->remote_cands[1].stats.last_recv_ms != 0);
+    ASSERT_EQ(b->remote_cands[0].stats.last_recv_ms, 0);
+
+    // 取空后等待门铃：下一次写入通知对端
+    p2p_shm_bell_drain(b);
+    ASSERT_EQ(p2p_shm_send_packet(a, P2P_PKT_PUNCH, 0, 2, m, P2P_PKT_PUNCH_PSZ), P2P_HDR_SIZE + P2P_PKT_PUNCH_PSZ);
+    struct pollfd pfd = { b->shm->bell, POLLIN, 0 };
+    ASSERT_EQ(poll(&pfd, 1, 100), 1);
+    ASSERT_EQ(p2p_shm_next_timeout(b, now + 1), P2P_SHM_IDLE_MS);
+
+    // 环满：整帧丢弃
+    static uint8_t big[P2P_MTU - P2P_HDR_SIZE];
+    int sent = 0; ret_t r;
+    while ((r = p2p_shm_send_packet(a, P2P_PKT_PUNCH, 0, 3, big, sizeof(big))) > 0) sent++;
+    ASSERT_EQ(r, E_BUSY);
+    ASSERT(sent >= P2P_SHM_RING_SIZE / P2P_MTU - 1);
+
+    // A 关闭：B 的共享内存路径失效，此后发送静默丢弃
+    p2p_shm_close(a, true);
+    ASSERT(a->shm == NULL);
+    p2p_shm_tick(b, now + 2);
+    ASSERT_EQ(b->shm->path, -1);
+    ASSERT_EQ(b->remote_cands[1].stats.state, PATH_STATE_FAILED);
+    ASSERT_EQ(p2p_shm_send_packet(b, P2P_PKT_DATA, 0, 4, "abc", 3), 0);
+    ASSERT_EQ(b->inst->shm_cnt, 0);
+
+    p2p_shm_close(b, true);
+    for (int i = 0; i < 2; i++) {
+        nat_reset(&ss[i]->nat);
+        free(ss[i]->remote_cands);
+        destroy_mock_session(ss[i]);
+    }
+}
+
+/* Nagle 尾部限时暂缓；P2P_SEND_MORE 暂缓到 p2p_flush */
+TEST(stream_nagle_deadline) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    stream_t *st = &s->stream;
+    st->nagle = 1;
+    uint64_t now = P_tick_ms();
+
+    // 完整包立即发出，不足一包的尾部暂缓
+    static char data[P2P_STREAM_PAYLOAD + 100];
+    stream_write(st, data, sizeof(data));
+    ASSERT_EQ(stream_flush_to_reliable(s), P2P_STREAM_PAYLOAD);
+    ASSERT_EQ(ring_used(&st->send_ring), 100);
+    ASSERT_EQ(stream_flush_to_reliable(s), 0);
+    int t = stream_flush_timeout(s, st, now);
+    ASSERT(t > 0 && t <= STREAM_NAGLE_DELAY_MS);
+
+    // 超过 nagle_delay 后尾部发出
+    st->nagle_ts -= STREAM_NAGLE_DELAY_MS;
+    ASSERT_EQ(stream_flush_timeout(s, st, P_tick_ms()), 0);
+    ASSERT_EQ(stream_flush_to_reliable(s), 100);
+    ASSERT_EQ(stream_flush_timeout(s, st, P_tick_ms()), -1);
+
+    // cork：无 Nagle 也暂缓，p2p_flush 后立即发出全部
+    st->nagle = 0;
+    ASSERT_EQ(p2p_send_flags(s, data, 10, P2P_SEND_MORE), 10);
+    ASSERT_EQ(stream_flush_to_reliable(s), 0);
+    ASSERT_EQ(p2p_send_flags(s, data, 10, P2P_SEND_MORE), 10);
+    ASSERT_EQ(stream_flush_to_reliable(s), 0);
+    ASSERT_EQ(p2p_flush(s), 0);
+    ASSERT_EQ(stream_flush_timeout(s, st, P_tick_ms()), 0);
+    ASSERT_EQ(stream_flush_to_reliable(s), 20);
+
+    // 不带 P2P_SEND_MORE 的发送解除 cork
+    ASSERT_EQ(p2p_send_flags(s, data, 10, P2P_SEND_MORE), 10);
+    ASSERT_EQ(stream_flush_to_reliable(s), 0);
+    ASSERT_EQ(p2p_send(s, data, 5), 5);
+    ASSERT_EQ(stream_flush_to_reliable(s), 15);
+
+    destroy_mock_session(s);
+}
+
+static int writable_cnt, writable_sid, writable_space;
+static void writable_cb(p2p_session_t session, int sid, int space, void *userdata) {
+    (void)session; (void)userdata;
+    writable_cnt++;
+    writable_sid = sid;
+    writable_space = space;
+}
+
+/* 发送背压：超过低水位后登记，排空到低水位以下回调一次 */
+TEST(send_writable_lowat) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    stream_t *st = &s->stream;
+    s->inst->cfg.on_writable = writable_cb;
+    s->inst->cfg.send_lowat = 1000;
+    writable_cnt = 0;
+
+    static char data[3000], out[3000];
+    int space = p2p_send_space(s);
+    ASSERT_EQ(space, st->send_ring.max - 1);
+
+    // 低水位以内的写入不登记
+    ASSERT_EQ(p2p_send(s, data, 800), 800);
+    ASSERT_EQ(st->writable_wait, 0);
+    ASSERT_EQ(p2p_send_space(s), space - 800);
+
+    // 超过低水位：登记，排空前不回调
+    ASSERT_EQ(p2p_send(s, data, 2200), 2200);
+    ASSERT_EQ(st->writable_wait, 1);
+    stream_writable_poll(s);
+    ASSERT_EQ(writable_cnt, 0);
+
+    ASSERT_EQ(ring_read(&st->send_ring, out, 1500), 1500);
+    stream_writable_poll(s);
+    ASSERT_EQ(writable_cnt, 0);
+
+    // 降到低水位：回调一次并清除登记
+    ASSERT_EQ(ring_read(&st->send_ring, out, 500), 500);
+    stream_writable_poll(s);
+    ASSERT_EQ(writable_cnt, 1);
+    ASSERT_EQ(writable_sid, 0);
+    ASSERT_EQ(writable_space, p2p_send_space(s));
+    ASSERT_EQ(st->writable_wait, 0);
+    stream_writable_poll(s);
+    ASSERT_EQ(writable_cnt, 1);
+
+    // 未连接
+    s->state = P2P_STATE_CLOSED;
+    ASSERT_EQ(p2p_send_space(s), -1);
+
+    destroy_mock_session(s);
+}
+
+/* 环形缓冲区按需扩容（数据保留、不超过上限）与收缩回初始容量 */
+TEST(ring_buffer_grow_shrink) {
+    ringbuf_t r;
+    ASSERT_EQ(ring_init(&r, 5000, 32768), E_NONE);
+    ASSERT_EQ(r.size, 8192);                // 向上取 2 的幂
+
+    // 制造回绕后写满
+    static char data[40000], out[40000];
+    for (int i = 0; i < (int)sizeof(data); i++) data[i] = (char)(i * 7);
+    ring_write(&r, data, 6000);
+    ring_skip(&r, 6000);
+    ASSERT_EQ(ring_write(&r, data, 8191), 8191);
+    ASSERT_EQ(ring_write(&r, "X", 1), 0);
+
+    // 扩容后原数据按序保留
+    ASSERT(ring_reserve(&r, 10000) >= 10000);
+    ASSERT_EQ(r.size, 32768);
+    ASSERT_EQ(ring_used(&r), 8191);
+    ASSERT_EQ(ring_write(&r, data + 8191, 10000), 10000);
+
+    // 不超过上限
+    ASSERT(ring_reserve(&r, 40000) < 40000);
+    ASSERT_EQ(r.size, 32768);
+
+    ASSERT_EQ(ring_read(&r, out, sizeof(out)), 18191);
+    ASSERT_EQ(memcmp(out, data, 18191), 0);
+
+    ring_shrink(&r);
+    ASSERT_EQ(r.size, 8192);
+    ASSERT_EQ(ring_write(&r, data, 100), 100);
+    ring_release(&r);
+}
+
+/* 接收缓冲区不足：包暂留 reliable 层，应用侧 p2p_recv 扩容后继续投递 */
+TEST(stream_recv_backpressure) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    stream_free(&s->stream);
+    ASSERT_EQ(stream_init(&s->stream, 0, 4096, 4096, 8192), E_NONE);
+
+    static char fill[4000], buf[8192];
+    ASSERT_EQ(ring_write(&s->stream.recv_ring, fill, sizeof(fill)), 4000);
+
+    uint8_t pkt[P2P_DATA_HDR_SIZE + 500] = {0};
+    pkt[4] = P2P_FRAG_WHOLE;
+    reliable_on_data(s, 0, pkt, sizeof(pkt));
+    ASSERT_EQ(stream_feed_from_reliable(s), 0);
+    ASSERT_EQ(s->stream.recv_need, 500);
+    ASSERT_EQ(reliable_recv_peek(s), (int)sizeof(pkt));
+
+    ASSERT_EQ(p2p_recv(s, buf, sizeof(buf)), 4000);
+    ASSERT_EQ(s->stream.recv_need, 0);
+    ASSERT_EQ(s->stream.recv_ring.size, 8192);
+    ASSERT_EQ(stream_feed_from_reliable(s), 500);
+    ASSERT_EQ(reliable_recv_peek(s), -1);
+
+    destroy_mock_session(s);
+}
+
+#ifdef P2P_THREADED
+/* 模拟工作线程：稍后投递数据，按 armed 登记唤醒等待方 */
+static int32_t wait_feeder(void *arg) {
+    struct p2p_session *s = (struct p2p_session *)arg;
+    P_usleep(20 * 1000);
+    ring_write(&s->stream.recv_ring, "wake", 4);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    p2p_waiter_t *w = &s->waiters[P2P_WAIT_RECV];
+    if (__atomic_exchange_n(&w->armed, 0, __ATOMIC_SEQ_CST)) p2p_waiter_signal(w);
+    return 0;
+}
+#endif
+
+/* 阻塞等待接口：条件已满足立即返回、超时、线程模式下被唤醒、会话结束 */
+TEST(blocking_wait) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    static char buf[64], data[100];
+
+    // 非线程模式、timeout = 0：只检查一次
+    ASSERT_EQ(p2p_recv_wait(s, buf, sizeof(buf), 0), 0);
+    ASSERT_EQ(ring_write(&s->stream.recv_ring, "abc", 3), 3);
+    ASSERT_EQ(p2p_recv_wait(s, buf, sizeof(buf), 1000), 3);
+    ASSERT_EQ(memcmp(buf, "abc", 3), 0);
+    ASSERT_EQ(p2p_send_wait(s, data, sizeof(data), 0), (int)sizeof(data));
+    ASSERT_EQ(p2p_wait_state(s, P2P_STATE_CONNECTED, 0), 0);
+    ASSERT_EQ(p2p_wait_state(s, P2P_STATE_RELAY, 0), 1);
+
+#ifdef P2P_THREADED
+    for (int i = 0; i < P2P_WAIT_KINDS; i++) s->waiters[i].rd = s->waiters[i].wr = P_INVALID_SOCKET;
+    s->inst->cfg.threaded = true;
+
+    // 无数据：阻塞至超时，登记已撤销
+    uint64_t t0 = P_tick_ms();
+    ASSERT_EQ(p2p_recv_wait(s, buf, sizeof(buf), 30), 0);
+    ASSERT(P_tick_ms() - t0 >= 25);
+    ASSERT(s->waiters[P2P_WAIT_RECV].rd != P_INVALID_SOCKET);
+    ASSERT_EQ(s->waiters[P2P_WAIT_RECV].armed, 0);
+    ASSERT_EQ(s->inst->wait_cnt, 0);
+
+    // 另一线程投递数据后唤醒
+    thd_t th;
+    ASSERT_EQ(P_thread(&th, wait_feeder, s, P_THD_NORMAL, 0), E_NONE);
+    t0 = P_tick_ms();
+    ASSERT_EQ(p2p_recv_wait(s, buf, sizeof(buf), 5000), 4);
+    ASSERT(P_tick_ms() - t0 < 2000);
+    ASSERT_EQ(memcmp(buf, "wake", 4), 0);
+    P_join(th, NULL);
+
+    s->inst->cfg.threaded = false;
+    for (int i = 0; i < P2P_WAIT_KINDS; i++) p2p_waiter_close(&s->waiters[i]);
+#endif
+
+    // 会话已结束
+    s->state = P2P_STATE_CLOSED;
+    ASSERT_EQ(p2p_recv_wait(s, buf, sizeof(buf), 1000), -1);
+    ASSERT_EQ(p2p_send_wait(s, data, sizeof(data), 1000), -1);
+    ASSERT_EQ(p2p_wait_state(s, P2P_STATE_CONNECTED, 1000), -1);
+    ASSERT_EQ(p2p_wait_state(s, P2P_STATE_CLOSED, 0), 0);
+
+    destroy_mock_session(s);
+}
+
+/* ============================================================================
+ * PseudoTCP 测试
+ * ============================================================================ */
+
+TEST(pseudotcp_congestion_window) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    
+    // 初始化 PseudoTCP
+    s->inst->cfg.use_pseudotcp = 1;
+    s->trans = &p2p_trans_pseudotcp;
+    s->trans->init(s);
+    
+    // 验证初始拥塞窗口
+    ASSERT(s->tcp.cwnd > 0);
+    ASSERT_EQ(s->tcp.ssthresh, 65535);
+    ASSERT_EQ(s->tcp.dup_acks, 0);
+    
+    // 模拟收到 ACK，拥塞窗口应该增长
+    uint32_t initial_cwnd = s->tcp.cwnd;
+    p2p_pseudotcp_on_ack(s, 0);
+    
+    ASSERT(s->tcp.cwnd > initial_cwnd);
+    
+    destroy_mock_session(s);
+}
+
+/* 在途按实际字节计：小消息不按 MSS 占用 cwnd，确认时按字节增长 */
+TEST(pseudotcp_small_messages) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    s->inst->cfg.use_pseudotcp = 1;
+    s->trans = &p2p_trans_pseudotcp;
+    ASSERT_EQ(s->trans->init(s), 0);
+
+    // 20 个 64 字节消息 = 1280 字节 < 初始 cwnd (2 MSS)，一轮全部发出
+    uint8_t data[64];
+    for (int i = 0; i < 20; i++)
+        ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    s->trans->tick(s);
+    ASSERT_EQ(reliable_inflight_bytes(s), 20 * 64);
+    ASSERT_EQ(s->reliable.send_buf[19].retx_count, 0);
+
+    // 慢启动：cwnd 增加确认字节数
+    uint32_t cwnd = s->tcp.cwnd;
+    reliable_on_ack(s, 20, 0, P_tick_ms());
+    ASSERT_EQ(s->tcp.cwnd, cwnd + 20 * 64);
+    ASSERT_EQ(reliable_inflight_bytes(s), 0);
+
+    s->trans->close(s);
+    destroy_mock_session(s);
+}
+
+/* CUBIC：乘 0.7 减窗，按三次函数回到 w_max 附近后再探测更高窗口 */
+TEST(pseudotcp_cubic) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    s->inst->cfg.use_pseudotcp = 1;
+    s->inst->cfg.cc_algo = P2P_CC_CUBIC;
+    s->trans = &p2p_trans_pseudotcp;
+    ASSERT_EQ(s->trans->init(s), 0);
+    ASSERT(s->cc == &p2p_cc_cubic);
+
+    uint64_t now = P_tick_ms();
+    s->tcp.cwnd = 20 * P2P_CC_MSS;
+    s->tcp.ssthresh = 2 * P2P_CC_MSS;
+    s->cc->on_loss(s, now);
+    ASSERT_EQ(s->tcp.w_max, 20 * P2P_CC_MSS);
+    ASSERT_EQ(s->tcp.cwnd, 14 * P2P_CC_MSS);
+
+    // 同一 RTT 内的第二次超时不再减窗
+    s->cc->on_loss(s, now + 10);
+    ASSERT_EQ(s->tcp.cwnd, 14 * P2P_CC_MSS);
+
+    // K = cbrt(6 / 0.4) ≈ 2.47s：1s 时仍低于 w_max，5s 后超过
+    for (int ms = 0; ms <= 1000; ms += 10)
+        s->cc->on_ack(s, P2P_CC_MSS, now + 100 + ms);
+    ASSERT(s->tcp.cwnd > 14 * P2P_CC_MSS);
+    ASSERT(s->tcp.cwnd < 20 * P2P_CC_MSS);
+    for (int ms = 1000; ms <= 5000; ms += 10)
+        s->cc->on_ack(s, P2P_CC_MSS, now + 100 + ms);
+    ASSERT(s->tcp.cwnd > 20 * P2P_CC_MSS);
+
+    s->trans->close(s);
+    ASSERT(s->cc == NULL);
+    destroy_mock_session(s);
+}
+
+/* ============================================================================
+ * 主函数
+ * ============================================================================ */
+
+/* 收包直到 netem 两个队列排空，按顺序记录负载首字节，返回收到的包数 */
+static int netem_drain(struct p2p_instance *inst, uint8_t *order, int cap) {
+    int got = 0, idle = 0;
+    while (idle < 20) {
+        p2p_netem_flush(inst);
+        int n = p2p_udp_recv_batch(inst, 16);
+        for (int i = 0; i < n; i++) if (got < cap) order[got++] = inst->rx_slots[i].buf[0];
+        bool queued = inst->netem && (inst->netem->tx.cnt || inst->netem->rx.cnt);
+        if (n > 0 || queued) idle = 0; else idle++;
+        P_usleep(1000);
+    }
+    return got;
+}
+
+TEST(netem_impairment) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    struct sockaddr_in lo;
+    memset(&lo, 0, sizeof(lo));
+    lo.sin_family = AF_INET;
+    lo.sin_addr.s_addr = htonl(0x7f000001);
+    inst->sock_cnt = 0;
+    ASSERT_EQ(p2p_udp_open(inst, &lo, 0), E_NONE);
+    struct sockaddr_in self = inst->socks[0].local_addr;
+
+    // 格式错误：拒绝且不启用
+    ASSERT_EQ(p2p_netem_config(inst, "loss=2"), E_INVALID);
+    ASSERT_EQ(p2p_netem_config(inst, "foo=1"), E_INVALID);
+    ASSERT_EQ(p2p_netem_config(inst, "delay"), E_INVALID);
+    ASSERT(inst->netem == NULL);
+
+    // 丢包 + 复制：交付数 = 进入 - 丢弃 + 复制；同一种子重放得到完全相同的交付序列
+    enum { N = 100 };
+    uint8_t first[2 * N], again[2 * N];
+    int cnt[2];
+    for (int round = 0; round < 2; round++) {
+        ASSERT_EQ(p2p_netem_config(inst, "tx.loss=20%,tx.dup=0.1,seed=3"), E_NONE);
+        ASSERT(inst->netem->tx.on && !inst->netem->rx.on);
+        for (int i = 0; i < N; i++) {
+            uint8_t pkt[8] = { (uint8_t)i };
+            ASSERT_EQ(p2p_udp_send_to_sock(inst, 0, &self, pkt, sizeof(pkt)), (int)sizeof(pkt));
+        }
+        cnt[round] = netem_drain(inst, round ? again : first, 2 * N);
+        p2p_netem_dir_t *tx = &inst->netem->tx;
+        ASSERT_EQ((int)tx->in, N);
+        ASSERT(tx->dropped > 0 && tx->duplicated > 0);
+        ASSERT_EQ(cnt[round], (int)(tx->in - tx->dropped + tx->duplicated));
+        p2p_netem_free(inst);
+    }
+    ASSERT_EQ(cnt[0], cnt[1]);
+    ASSERT(memcmp(first, again, (size_t)cnt[0]) == 0);
+
+    // 接收时延：到期前不交付，next_timeout 给出剩余时间
+    ASSERT_EQ(p2p_netem_config(inst, "rx.delay=30"), E_NONE);
+    ASSERT_EQ(p2p_udp_send_to_sock(inst, 0, &self, "d", 1), 1);
+    uint64_t t0 = P_tick_ms();
+    for (int i = 0; i < 50 && !inst->netem->rx.cnt; i++) {
+        ASSERT_EQ(p2p_udp_recv_batch(inst, 4), E_BUSY);
+        P_usleep(1000);
+    }
+    ASSERT_EQ(inst->netem->rx.cnt, 1);
+    int to = p2p_netem_next_timeout(inst);
+    ASSERT(to > 0 && to <= 30);
+    uint8_t d;
+    ASSERT_EQ(netem_drain(inst, &d, 1), 1);
+    ASSERT(P_tick_ms() - t0 >= 30);
+    ASSERT_EQ(p2p_netem_next_timeout(inst), -1);
+
+    // 空 spec 关闭
+    ASSERT_EQ(p2p_netem_config(inst, ""), E_NONE);
+    ASSERT(inst->netem == NULL);
+
+    P_sock_close(inst->socks[0].sock);
+    inst->socks[0].sock = mock_sock;
+    free(inst->rx_slots); inst->rx_slots = NULL;
+    destroy_mock_session(s);
+}
+
+/* 套接字缓冲区：首个套接字按窗口设置，按观测 BDP 只增不减；内核接收队列溢出计入 kernel_drops */
+TEST(sock_buf_autosize) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    struct sockaddr_in lo;
+    memset(&lo, 0, sizeof(lo));
+    lo.sin_family = AF_INET;
+    lo.sin_addr.s_addr = htonl(0x7f000001);
+    inst->sock_cnt = 0;
+    ASSERT_EQ(p2p_udp_open(inst, &lo, 0), E_NONE);
+    struct sockaddr_in self = inst->socks[0].local_addr;
+    ASSERT_EQ(inst->sock_buf, P2P_UDP_SOCKBUF_MIN);     // 32 包窗口不足下限
+    ASSERT(inst->sock_buf_eff > 0);
+
+    // 观测 BDP = 10MB/s × 100ms：目标为两倍 BDP
+    uint64_t now = P_tick_ms();
+    inst->sessions_head = s;
+    s->reliable.rs_rate = 10 * 1000 * 1000;
+    s->reliable.srtt = 100;
+    ASSERT_EQ(p2p_udp_sock_buf_target(inst), 2 * 1000 * 1000);
+    int eff = inst->sock_buf_eff;
+    p2p_udp_sock_buf_tick(inst, now + P2P_UDP_SOCKBUF_TICK_MS);
+    ASSERT_EQ(inst->sock_buf, 2 * 1000 * 1000);
+    ASSERT(inst->sock_buf_eff >= eff);                  // 受 rmem_max 截断时可能不变
+
+    // 吞吐下降不收缩；固定配置与关闭时不按 BDP 调整
+    s->reliable.rs_rate = 1000;
+    p2p_udp_sock_buf_tick(inst, now + 2 * P2P_UDP_SOCKBUF_TICK_MS);
+    ASSERT_EQ(inst->sock_buf, 2 * 1000 * 1000);
+    inst->cfg.sock_buf_size = 1 << 30;
+    ASSERT_EQ(p2p_udp_sock_buf_target(inst), P2P_UDP_SOCKBUF_MAX);
+    inst->cfg.sock_buf_size = -1;
+    ASSERT_EQ(p2p_udp_sock_buf_target(inst), 0);
+    inst->sessions_head = NULL;
+
+#ifdef SO_RXQ_OVFL
+    // 压小接收缓冲区后灌满：溢出的包由内核计数，批量接收时读出
+    int small = 2048;
+    setsockopt(inst->socks[0].sock, SOL_SOCKET, SO_RCVBUF, (const char *)&small, sizeof(small));
+    uint8_t pkt[1000] = { 0 };
+    for (int i = 0; i < 64; i++) p2p_udp_send_raw(inst, 0, &self, pkt, sizeof(pkt));
+    while (p2p_udp_recv_batch(inst, 16) > 0) {}
+    p2p_udp_send_raw(inst, 0, &self, pkt, sizeof(pkt));
+    P_usleep(1000);
+    ASSERT(p2p_udp_recv_batch(inst, 16) > 0);
+    ASSERT(inst->kernel_drops > 0);
+    ASSERT_EQ(inst->kernel_drops, inst->socks[0].rxq_ovfl);
+#endif
+
+    P_sock_close(inst->socks[0].sock);
+    inst->socks[0].sock = mock_sock;
+    free(inst->rx_slots); inst->rx_slots = NULL;
+    destroy_mock_session(s);
+}
+
+/* 多套接字接收：默认套接字被灌满时，其他套接字在同一批内仍按份额读出；起点逐次轮转 */
+TEST(recv_fair_sockets) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    inst->sock_cap = 2;
+    inst->socks = realloc(inst->socks, 2 * sizeof(*inst->socks));
+    struct sockaddr_in lo;
+    memset(&lo, 0, sizeof(lo));
+    lo.sin_family = AF_INET;
+    lo.sin_addr.s_addr = htonl(0x7f000001);
+    inst->sock_cnt = 0;
+    ASSERT_EQ(p2p_udp_open(inst, &lo, 0), E_NONE);
+    ASSERT_EQ(p2p_udp_open(inst, &lo, 0), E_NONE);
+    struct sockaddr_in a0 = inst->socks[0].local_addr, a1 = inst->socks[1].local_addr;
+
+    uint8_t pkt[64] = { 0 };
+    for (int i = 0; i < 40; i++) p2p_udp_send_raw(inst, 0, &a0, pkt, sizeof(pkt));
+    for (int i = 0; i < 2; i++) p2p_udp_send_raw(inst, 0, &a1, pkt, sizeof(pkt));
+    P_usleep(10 * 1000);
+
+    int n = p2p_udp_recv_batch(inst, 8), on1 = 0;
+    ASSERT_EQ(n, 8);
+    for (int i = 0; i < n; i++) on1 += inst->rx_slots[i].sock_idx == 1;
+    ASSERT_EQ(on1, 2);                                  // sock 1 的包未被 sock 0 的洪泛挤到后面
+
+    // 只有 sock 0 有数据时余量全部给它
+    ASSERT_EQ(p2p_udp_recv_batch(inst, 8), 8);
+    for (int i = 0; i < 8; i++) ASSERT_EQ(inst->rx_slots[i].sock_idx, 0);
+
+    // 逐包接收：起点轮转，两个套接字交替被先读
+    while (p2p_udp_recv_batch(inst, 8) > 0) {}
+    p2p_udp_send_raw(inst, 0, &a0, pkt, sizeof(pkt));
+    p2p_udp_send_raw(inst, 0, &a0, pkt, sizeof(pkt));
+    p2p_udp_send_raw(inst, 0, &a1, pkt, sizeof(pkt));
+    P_usleep(10 * 1000);
+    struct sockaddr_in from;
+    uint8_t buf[128];
+    int idx[2];
+    for (int i = 0; i < 2; i++) ASSERT(p2p_udp_recv_from(inst, &from, buf, sizeof(buf), &idx[i]) > 0);
+    ASSERT(idx[0] != idx[1]);
+
+    for (int i = 0; i < 2; i++) P_sock_close(inst->socks[i].sock);
+    inst->socks[0].sock = mock_sock;
+    inst->sock_cnt = 1;
+    free(inst->rx_slots); inst->rx_slots = NULL;
+    destroy_mock_session(s);
+}
+
+TEST(rx_timestamp_rtt) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    struct sockaddr_in lo;
+    memset(&lo, 0, sizeof(lo));
+    lo.sin_family = AF_INET;
+    lo.sin_addr.s_addr = htonl(0x7f000001);
+    inst->sock_cnt = 0;
+    ASSERT_EQ(p2p_udp_open(inst, &lo, 0), E_NONE);
+    struct sockaddr_in self = inst->socks[0].local_addr;
+
+    // 接收时间为包到达时刻：在套接字缓冲区中停留的时间不计入
+    uint8_t pkt[100] = { 0 };
+    uint64_t t0 = P_tick_us();
+    ASSERT_EQ(p2p_udp_send_raw(inst, 0, &self, pkt, sizeof(pkt)), (int)sizeof(pkt));
+    P_usleep(5000);
+    ASSERT_EQ(p2p_udp_recv_batch(inst, 16), 1);
+    uint64_t t1 = P_tick_us();
+    ASSERT(inst->rx_slots[0].rx_us >= t0 && inst->rx_slots[0].rx_us <= t1);
+#ifdef SO_TIMESTAMPNS
+    ASSERT(t1 - inst->rx_slots[0].rx_us >= 4000);
+#endif
+    P_sock_close(inst->socks[0].sock);
+    inst->socks[0].sock = mock_sock;
+    free(inst->rx_slots); inst->rx_slots = NULL;
+
+    // 亚毫秒样本按微秒平滑：毫秒字段为其取整
+    check_add_cand(s, P2P_CAND_SRFLX, 0x7f000001, 9001);
+    path_manager_set_path_state(s, 0, PATH_STATE_ACTIVE);
+    s->active_path = 0;
+    s->active_addr = s->remote_cands[0].addr;
+    s->path_type = P2P_PATH_PUNCH;
+    reliable_t *r = &s->reliable;
+    path_stats_t *p0 = &s->remote_cands[0].stats;
+    uint8_t data[100] = { 0 };
+    const int samples[2] = { 400, 1600 };
+    for (int i = 0; i < 2; i++) {
+        ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+        reliable_tick(s);
+        retx_entry_t *e = &r->send_buf[i];
+        uint64_t now = P_tick_ms(), us = P_tick_us();
+        e->send_time = now;
+        e->send_us = us - samples[i];
+        s->rx_us = us;
+        reliable_on_ack(s, (uint16_t)(i + 1), 0, now);
+        s->rx_us = 0;
+    }
+    ASSERT_EQ(r->srtt_us, 550);
+    ASSERT_EQ(r->rttvar_us, 450);
+    ASSERT_EQ(r->srtt, 1);
+    ASSERT_EQ(p0->rt_srtt_us, 550);
+    ASSERT_EQ(p0->rt_rtt_direct_srtt, 1);
+
+    // 毫秒字段被外部改写后以其为准；注入的 now 与实时时钟不符时回退毫秒样本
+    r->srtt = 20;
+    r->rttvar = 10;
+    ASSERT_EQ(reliable_send_pkt(s, data, sizeof(data)), 0);
+    reliable_tick(s);
+    uint64_t now = P_tick_ms();
+    r->send_buf[2].send_time = now;
+    reliable_on_ack(s, 3, 0, now + 60);
+    ASSERT_EQ(r->srtt_us, (7 * 20000 + 60000) / 8);
+    ASSERT_EQ(r->srtt, 25);
+
+    nat_reset(&s->nat);
+    destroy_mock_session(s);
+}
+
+TEST(ecn_ce_feedback) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    s->inst->cfg.use_pseudotcp = 1;
+    s->inst->cfg.ecn = P2P_ECN_CLASSIC;
+    s->trans = &p2p_trans_pseudotcp;
+    ASSERT_EQ(s->trans->init(s), 0);
+    reliable_t *r = &s->reliable;
+    r->ecn_echo = true;
+
+    // 接收方：CE 标记的 DATA 计数并立即 ACK，ACK 携带累计计数
+    uint8_t data[10] = { 0 };
+    s->rx_ecn = P2P_UDP_ECN_CE;
+    reliable_on_data(s, 0, data, sizeof(data));
+    s->rx_ecn = P2P_UDP_ECN_ECT0;
+    reliable_on_data(s, 1, data, sizeof(data));
+    s->rx_ecn = 0;
+    ASSERT_EQ(r->ecn_ce_rx, 1);
+    ASSERT(r->need_ack);
+
+    // 经回环套接字发给自己：ACK 带 ECT(0) 标记发出，读出码点与 CE 计数
+    struct p2p_instance *inst = s->inst;
+    struct sockaddr_in lo;
+    memset(&lo, 0, sizeof(lo));
+    lo.sin_family = AF_INET;
+    lo.sin_addr.s_addr = htonl(0x7f000001);
+    inst->sock_cnt = 0;
+    ASSERT_EQ(p2p_udp_open(inst, &lo, 0), E_NONE);
+    struct sockaddr_in from = s->active_addr;
+    s->active_addr = inst->socks[0].local_addr;
+    reliable_tick_ack(s);
+    P_usleep(1000);
+    ASSERT_EQ(p2p_udp_recv_batch(inst, 16), 1);
+    p2p_udp_slot_t *slot = &inst->rx_slots[0];
+    ASSERT_EQ(slot->buf[0], P2P_PKT_ACK);
+    ASSERT(slot->buf[1] & P2P_ACK_FLAG_ECN);
+    ASSERT_EQ(slot->len, P2P_HDR_SIZE + (int)P2P_PKT_ACK_PSZ + 4);
+    ASSERT_EQ(nget_l(slot->buf + P2P_HDR_SIZE + P2P_PKT_ACK_PSZ), 1);
+#if defined(__linux__) && defined(IP_RECVTOS)
+    ASSERT_EQ(slot->ecn, P2P_UDP_ECN_ECT0);
+#endif
+    P_sock_close(inst->socks[0].sock);
+    inst->socks[0].sock = mock_sock;
+    free(inst->rx_slots); inst->rx_slots = NULL;
+    s->active_addr = from;
+
+    // 发送方（经典模式）：CE 按乘性减因子减窗，同一 RTT 内只减一次，旧计数忽略
+    s->nat.state = NAT_CONNECTED;
+    uint64_t now = P_tick_ms();
+    s->tcp.cwnd = s->tcp.ssthresh = 20 * P2P_CC_MSS;
+    uint8_t pl[P2P_PKT_ACK_PSZ + 4] = { 0 };
+    nwrite_l(pl + P2P_PKT_ACK_PSZ, 1);
+    nat_proto(s, P2P_PKT_ACK, P2P_ACK_FLAG_ECN, 0, pl, sizeof(pl), &from, now);
+    ASSERT_EQ(s->tcp.cwnd, 10 * P2P_CC_MSS);
+    ASSERT_EQ(r->ecn_ce_tx, 1);
+    reliable_on_ecn(s, 3, now + 10);
+    ASSERT_EQ(s->tcp.cwnd, 10 * P2P_CC_MSS);
+    reliable_on_ecn(s, 2, now + 500);
+    ASSERT_EQ(r->ecn_ce_tx, 3);
+    ASSERT_EQ(s->tcp.cwnd, 10 * P2P_CC_MSS);
+
+    p2p_stats_t st;
+    ASSERT_EQ(p2p_get_stats(s, &st), 0);
+    ASSERT_EQ(st.ecn_ce_recv, 1);
+    ASSERT_EQ(st.ecn_ce_echoed, 3);
+
+    // L4S：按观察窗口内的标记比例减窗，无标记的窗口 α 衰减
+    s->inst->cfg.ecn = P2P_ECN_L4S;
+    s->cc->init(s);
+    r->srtt = 50;
+    s->tcp.cwnd = s->tcp.ssthresh = 20 * P2P_CC_MSS;
+    s->cc->on_ack(s, P2P_CC_MSS, now);
+    for (int i = 0; i < 10; i++) s->cc->on_ack(s, P2P_CC_MSS, now + 1 + i);
+    reliable_on_ecn(s, 5, now + 20);
+    uint32_t c = s->tcp.cwnd;
+    s->cc->on_ack(s, P2P_CC_MSS, now + 60);
+    ASSERT(s->tcp.cwnd > c / 2 && s->tcp.cwnd < c * 55 / 100);
+    float alpha = s->tcp.ecn_alpha;
+    ASSERT(alpha > 0.94f && alpha < 0.96f);
+    c = s->tcp.cwnd;
+    s->cc->on_ack(s, P2P_CC_MSS, now + 120);
+    ASSERT(s->tcp.cwnd >= c);
+    ASSERT(s->tcp.ecn_alpha < alpha);
+
+    s->trans->close(s);
+    destroy_mock_session(s);
+}
+
+TEST(udp_uring_recv) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    inst->cfg.udp_uring = true;
+    inst->cfg.ecn = P2P_ECN_CLASSIC;
+
+    struct sockaddr_in lo;
+    memset(&lo, 0, sizeof(lo));
+    lo.sin_family = AF_INET;
+    lo.sin_addr.s_addr = htonl(0x7f000001);
+    inst->sock_cnt = 0;
+    ASSERT_EQ(p2p_udp_open(inst, &lo, 0), E_NONE);
+
+    // 环可用时等待描述符为环本身（套接字上的数据由多发接收取走，不再可读）
+    p2p_fd_t fds[4];
+    ASSERT_EQ(p2p_udp_poll_fds(inst, fds, 4), 1);
+    if (inst->uring) ASSERT(fds[0].fd != (intptr_t)inst->socks[0].sock);
+
+    uint8_t pkt[3][64];
+    for (int i = 0; i < 3; i++) {
+        memset(pkt[i], 'a' + i, sizeof(pkt[i]));
+        ASSERT_EQ(p2p_udp_send_raw(inst, 0, &inst->socks[0].local_addr, pkt[i], 20 + i), 20 + i);
+    }
+    struct pollfd pfd = { (int)fds[0].fd, POLLIN, 0 };
+    ASSERT_EQ(poll(&pfd, 1, 100), 1);
+    P_usleep(1000);
+
+    int got = 0;
+    for (int k = 0; k < 10 && got < 3; k++) {
+        int n = p2p_udp_recv_batch(inst, 16);
+        for (int i = 0; n > 0 && i < n; i++, got++) {
+            p2p_udp_slot_t *slot = &inst->rx_slots[i];
+            ASSERT_EQ(slot->len, 20 + got);
+            ASSERT_EQ(slot->buf[0], 'a' + got);
+            ASSERT_EQ(slot->sock_idx, 0);
+            ASSERT_EQ(slot->from.sin_port, inst->socks[0].local_addr.sin_port);
+            ASSERT(slot->rx_us > 0);
+#if defined(IP_RECVTOS)
+            ASSERT_EQ(slot->ecn, P2P_UDP_ECN_ECT0);
+#endif
+        }
+        if (got < 3) P_usleep(1000);
+    }
+    ASSERT_EQ(got, 3);
+    if (inst->uring) ASSERT_EQ(inst->socks[0].uring, 2);
+
+    p2p_udp_close_all(inst);
+    inst->socks = calloc(1, sizeof(*inst->socks));
+    inst->sock_cap = inst->sock_cnt = 1;
+    inst->socks[0].sock = mock_sock;
+    inst->socks[0].state = 2;
+    destroy_mock_session(s);
+}
+
+TEST(low_power_cadence) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    inst->cfg.update_interval_ms = 50;
+    uint64_t now = P_tick_ms() + 10000;
+
+    // 未开启或近期有活动：正常节奏
+    inst->lp_active_ms = now - 4000;
+    ASSERT(!p2p_lp_idle(inst, now));
+    inst->cfg.low_power = true;
+    inst->lp_active_ms = now - 1000;
+    ASSERT(!p2p_lp_idle(inst, now));
+    ASSERT_EQ(p2p_tick_interval(inst, now), 50);
+    inst->lp_active_ms = now + 5;               // 其他线程写入的略晚时刻
+    ASSERT(!p2p_lp_idle(inst, now));
+
+    // 空闲：tick 放宽，唤醒对齐到窗口边界，即时工作不推迟
+    inst->lp_active_ms = now - P2P_LP_IDLE_MS;
+    ASSERT(p2p_lp_idle(inst, now));
+    ASSERT_EQ(p2p_tick_interval(inst, now), P2P_LP_TICK_MS);
+    ASSERT_EQ(p2p_lp_align(1234, 10), 766);
+    ASSERT_EQ(p2p_lp_align(1234, 766), 766);
+    ASSERT_EQ(p2p_lp_align(1234, 0), 0);
+    int t = p2p_next_timeout(inst, now);
+    ASSERT(t >= P2P_LP_TICK_MS && t < P2P_LP_TICK_MS + P2P_LP_WINDOW_MS);
+    ASSERT_EQ((now + (uint64_t)t) % P2P_LP_WINDOW_MS, 0);
+
+    // 恢复活动即回到正常节奏
+    p2p_lp_touch(inst, now);
+    ASSERT(!p2p_lp_idle(inst, now));
+    ASSERT_EQ(p2p_next_timeout(inst, now), 50);
+
+    destroy_mock_session(s);
+}
+
+/* STUN 属性索引：单次遍历记录偏移，MESSAGE-INTEGRITY 之后的属性忽略，截断报文标记不完整 */
+TEST(stun_attr_index) {
+    uint8_t buf[128];
+    p2p_stun_attrs_t a;
+    int al;
+
+    int len = p2p_stun_build_ice_check(buf, sizeof(buf), NULL, "r:l", NULL, 42, 1, 7, 1);
+    ASSERT(len > 0);
+    ASSERT_EQ(p2p_stun_attrs_parse(buf, len, &a), 0);
+    ASSERT(a.intact && a.ice);
+    ASSERT_EQ(a.end, len);
+    ASSERT(a.off[STUN_AI_USERNAME] && a.off[STUN_AI_USE_CANDIDATE] && a.off[STUN_AI_ICE_CONTROLLING]);
+    ASSERT(!a.off[STUN_AI_ICE_CONTROLLED]);
+    ASSERT_EQ(a.off[STUN_AI_FINGERPRINT], len - 8);
+    const uint8_t *val = p2p_stun_attr(buf, &a, STUN_AI_PRIORITY, &al);
+    ASSERT(val && al == 4 && nget_l(val) == 42);
+    ASSERT(!p2p_stun_attr(buf, &a, STUN_AI_XOR_MAPPED_ADDR, NULL));
+
+    // 截断：越界前的属性仍可用，但不作为 ICE 包
+    ASSERT_EQ(p2p_stun_attrs_parse(buf, len - 4, &a), -1);
+    ASSERT(!a.intact && a.off[STUN_AI_USERNAME]);
+    ASSERT(!p2p_stun_has_ice_attrs(buf, len - 4));
+
+    // Binding Response：无 ICE 属性，地址与指纹偏移
+    struct sockaddr_in mapped = { .sin_family = AF_INET, .sin_port = htons(4000) };
+    mapped.sin_addr.s_addr = htonl(0x01020304);
+    len = p2p_stun_build_binding_response(buf, sizeof(buf), buf + 8, &mapped, NULL);
+    ASSERT(len > 0);
+    ASSERT_EQ(p2p_stun_attrs_parse(buf, len, &a), 0);
+    ASSERT(!a.ice && a.off[STUN_AI_XOR_MAPPED_ADDR] == 20);
+    ASSERT_EQ(a.off[STUN_AI_FINGERPRINT], len - 8);
+
+    // MESSAGE-INTEGRITY 之后仅 FINGERPRINT 有效
+    memset(buf, 0, sizeof(buf));
+    nwrite_s(buf, STUN_BINDING_REQUEST);
+    nwrite_s(buf + 2, 24 + 8 + 8);
+    nwrite_l(buf + 4, STUN_MAGIC);
+    nwrite_s(buf + 20, STUN_ATTR_MESSAGE_INTEGRITY); nwrite_s(buf + 22, 20);
+    nwrite_s(buf + 44, STUN_ATTR_PRIORITY);          nwrite_s(buf + 46, 4);
+    nwrite_s(buf + 52, STUN_ATTR_FINGERPRINT);       nwrite_s(buf + 54, 4);
+    ASSERT_EQ(p2p_stun_attrs_parse(buf, 60, &a), 0);
+    ASSERT_EQ(a.off[STUN_AI_MESSAGE_INTEGRITY], 20);
+    ASSERT(!a.off[STUN_AI_PRIORITY] && !a.ice);
+    ASSERT_EQ(a.off[STUN_AI_FINGERPRINT], 52);
+}
+
+/* COMPACT 附加身份：ONLINE_ACK 按 instance_id 归属，SYNC0_ACK 尾部 instance_id 区分两身份连接同一对端的会话 */
+TEST(compact_identities) {
+    mock_reset();
+    struct p2p_session *a = create_mock_session(), *b = create_mock_session();
+    struct p2p_instance *inst = a->inst, *b_inst = b->inst;
+    b->inst = inst;
+    inst->sig_mode = P2P_SIGNALING_MODE_COMPACT;
+    inst->cfg.multi_session = true;
+    strcpy(inst->local_peer_id, "gw");
+    p2p_compact_ctx_t *ctx = &inst->sig_ctx.compact;
+    p2p_signal_compact_init(ctx);
+    ctx->state = SIG_COMPACT_ONLINE;
+    ctx->instance_id = 1;
+    ctx->auth_key = 11;
+    ctx->max_candidates = 8;
+    uint64_t now = P_tick_ms();
+
+    ASSERT_EQ(p2p_signal_compact_ident_add(inst, "dev1"), E_NONE);
+    ASSERT_EQ(p2p_signal_compact_ident_add(inst, "dev1"), E_BUSY);
+    ASSERT_EQ(p2p_signal_compact_ident_add(inst, "gw"), E_BUSY);
+    p2p_compact_ident_t *id = p2p_signal_compact_ident_find(inst, "dev1");
+    ASSERT(id && id->state == SIG_COMPACT_WAIT_ONLINE_ACK);
+    ASSERT(id->instance_id && id->instance_id != ctx->instance_id);
+
+    // 附加身份的 ONLINE_ACK 只分配其 auth_key，不影响主身份
+    uint8_t ack[SIG_PKT_ONLINE_ACK_PSZ]; memset(ack, 0, sizeof(ack));
+    nwrite_l(ack, id->instance_id);
+    nwrite_ll(ack + 4, 22);
+    p2p_signal_compact_proto(inst, SIG_PKT_ONLINE_ACK, 0, 0, ack, sizeof(ack), now);
+    ASSERT_EQ(id->state, SIG_COMPACT_ONLINE);
+    ASSERT(id->auth_key == 22 && ctx->auth_key == 11);
+
+    // 两个身份各有一个连接 peer 的会话
+    inst->sessions_head = a; a->next = b;
+    for (int i = 0; i < 2; i++) { struct p2p_session *s = i ? b : a;
+        strcpy(s->sig_sess.compact.remote_peer_id, "peer");
+        s->sig_sess.compact.state = SIG_COMPACT_SESS_WAIT_SYNC0_ACK;
+        s->state = P2P_STATE_SIGNALING;
+    }
+    b->sig_sess.compact.ident = id;
+    ASSERT_EQ(p2p_signal_compact_ident_remove(inst, "dev1"), E_BUSY);
+
+    uint8_t pkt[SIG_PKT_SYNC0_ACK_PSZ + SIG_PKT_INST_ID_PSZ]; memset(pkt, 0, sizeof(pkt));
+    strcpy((char *)pkt, "peer");
+    nwrite_l(pkt + P2P_PEER_ID_MAX, 0x77);
+    nwrite_l(pkt + SIG_PKT_SYNC0_ACK_PSZ, id->instance_id);
+    p2p_signal_compact_proto(inst, SIG_PKT_SYNC0_ACK, 0, 0, pkt, sizeof(pkt), now);
+    ASSERT(b->id == 0x77 && a->id == 0);
+    ASSERT_EQ(b->sig_sess.compact.state, SIG_COMPACT_SESS_WAIT_PEER);
+
+    // 无尾部（旧服务器）：按对端 ID 首个匹配
+    nwrite_l(pkt + P2P_PEER_ID_MAX, 0x66);
+    p2p_signal_compact_proto(inst, SIG_PKT_SYNC0_ACK, 0, 0, pkt, SIG_PKT_SYNC0_ACK_PSZ, now);
+    ASSERT_EQ(a->id, 0x66);
+
+    p2p_session_set_id(a, 0);
+    p2p_session_set_id(b, 0);
+    free(inst->sess_by_id.slots);
+    b->sig_sess.compact.ident = NULL;
+    ASSERT_EQ(p2p_signal_compact_ident_remove(inst, "dev1"), E_NONE);
+    ASSERT(!p2p_signal_compact_ident_find(inst, "dev1"));
+    free(ctx->idents);
+    b->inst = b_inst;
+    destroy_mock_session(a);
+    destroy_mock_session(b);
+}
+
+/* ALIVE 间隔：按服务器通告（ONLINE_ACK / ALIVE_ACK 尾部），且不超过本端 NAT 绑定存活期的一半 */
+TEST(compact_alive_interval) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    inst->sig_mode = P2P_SIGNALING_MODE_COMPACT;
+    p2p_compact_ctx_t *ctx = &inst->sig_ctx.compact;
+    p2p_signal_compact_init(ctx);
+    ctx->state = SIG_COMPACT_ONLINE;
+    ctx->auth_key = 11;
+    inst->socks[0].sock = socket(AF_INET, SOCK_DGRAM, 0);
+    ctx->server_addr.sin_family = AF_INET;
+    ctx->server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ctx->server_addr.sin_port = htons(9);
+    uint64_t now = P_tick_ms();
+
+    // 未通告：默认 20s
+    ctx->last_send_time = now;
+    p2p_signal_compact_tick_send(inst, now + 20000);
+    ASSERT_EQ(ctx->last_send_time, now + 20000);
+
+    // ALIVE_ACK 通告 50s：20s 时不发，50s 时发
+    uint8_t adv[SIG_PKT_ALIVE_ACK_EXT_PSZ];
+    nwrite_s(adv, 50);
+    p2p_signal_compact_proto(inst, SIG_PKT_ALIVE_ACK, 0, 0, adv, sizeof(adv), now);
+    ASSERT_EQ(ctx->alive_s, 50);
+    ctx->last_send_time = now;
+    p2p_signal_compact_tick_send(inst, now + 20000);
+    ASSERT_EQ(ctx->last_send_time, now);
+    p2p_signal_compact_tick_send(inst, now + 50000);
+    ASSERT_EQ(ctx->last_send_time, now + 50000);
+
+    // 无尾部（旧服务器）的 ALIVE_ACK 不改变已通告的间隔
+    p2p_signal_compact_proto(inst, SIG_PKT_ALIVE_ACK, 0, 0, NULL, 0, now);
+    ASSERT_EQ(ctx->alive_s, 50);
+
+    // 本端测得绑定存活期 30s：间隔不超过 15s
+    inst->bind_probe.lifetime_ms = 30000;
+    ctx->last_send_time = now;
+    p2p_signal_compact_tick_send(inst, now + 15000);
+    ASSERT_EQ(ctx->last_send_time, now + 15000);
+
+    // 过小的通告值被限制在下限
+    nwrite_s(adv, 1);
+    inst->bind_probe.lifetime_ms = 0;
+    p2p_signal_compact_proto(inst, SIG_PKT_ALIVE_ACK, 0, 0, adv, sizeof(adv), now);
+    ctx->last_send_time = now;
+    p2p_signal_compact_tick_send(inst, now + 1000);
+    ASSERT_EQ(ctx->last_send_time, now);
+
+    P_sock_close(inst->socks[0].sock);
+    destroy_mock_session(s);
+}
+
+/* MSG RPC 直连：会话连通后请求 / 应答经 reliable 层的 P2P_FRAG_RPC 包往返，不进入流；超时以 ERR_TIMEOUT 结束 */
+static uint16_t rpc_req_sid, rpc_resp_sid;
+static int rpc_req_msg = -1, rpc_resp_code = -1, rpc_resp_len;
+static char rpc_resp_data[16];
+
+static void rpc_direct_on_request(p2p_session_t session, uint16_t sid, uint8_t msg, const void *data, int len, void *ud) {
+    (void)ud;
+    rpc_req_sid = sid;
+    rpc_req_msg = msg;
+    if (len == 4 && memcmp(data, "ping", 4) == 0) p2p_response_to(session, sid, 9, "pong", 4);
+}
+
+static void rpc_direct_on_response(p2p_session_t session, uint16_t sid, uint8_t code, const void *data, int len, void *ud) {
+    (void)session; (void)ud;
+    rpc_resp_sid = sid;
+    rpc_resp_code = code;
+    rpc_resp_len = len;
+    if (len > 0 && len <= (int)sizeof(rpc_resp_data)) memcpy(rpc_resp_data, data, (size_t)len);
+}
+
+TEST(rpc_direct) {
+    mock_reset();
+    struct p2p_session *a = create_mock_session(), *b = create_mock_session();
+    a->inst->sig_mode = b->inst->sig_mode = P2P_SIGNALING_MODE_ICE;
+    b->inst->cfg.on_request = rpc_direct_on_request;
+    a->inst->cfg.on_response = rpc_direct_on_response;
+
+    // 对端未通告 RELIABLE_CAP2_RPC：ICE 模式无信令 RPC 可用
+    ASSERT(p2p_request(a, 7, "ping", 4) < 0);
+
+    uint8_t caps[RELIABLE_CAPS_MAX_PSZ];
+    reliable_on_caps(b, caps, reliable_write_caps(a, caps));
+    reliable_on_caps(a, caps, reliable_write_caps(b, caps));
+    ASSERT(a->reliable.rpc && b->reliable.rpc);
+
+    // a → b 请求：DATA 包带 P2P_FRAG_RPC，b 在回调中同步回复
+    int sid = p2p_request(a, 7, "ping", 4);
+    ASSERT(sid > 0);
+    ASSERT_EQ(a->reliable.send_count, 1);
+    ASSERT_EQ(a->reliable.send_buf[0].data[4], P2P_FRAG_RPC);
+    ASSERT_EQ(a->reliable.send_buf[0].len, P2P_DATA_HDR_SIZE + RPC_DIRECT_HDR + 4);
+    reliable_on_data(b, 0, a->reliable.send_buf[0].data, a->reliable.send_buf[0].len);
+    ASSERT_EQ(rpc_req_sid, sid);
+    ASSERT_EQ(rpc_req_msg, 7);
+    ASSERT_EQ(b->stream.recv_offset, 0);
+    ASSERT_EQ(b->reliable.send_count, 1);
+
+    reliable_on_data(a, 0, b->reliable.send_buf[0].data, b->reliable.send_buf[0].len);
+    ASSERT_EQ(rpc_resp_sid, sid);
+    ASSERT_EQ(rpc_resp_code, 9);
+    ASSERT_EQ(rpc_resp_len, 4);
+    ASSERT(memcmp(rpc_resp_data, "pong", 4) == 0);
+    ASSERT_EQ(a->stream.recv_offset, 0);
+
+    // 重复到达的应答（sid 已结束）不再回调
+    rpc_resp_code = -1;
+    rpc_on_direct(a, b->reliable.send_buf[0].data + P2P_DATA_HDR_SIZE, b->reliable.send_buf[0].len - P2P_DATA_HDR_SIZE);
+    ASSERT_EQ(rpc_resp_code, -1);
+
+    // msg=0 由对端自动 echo，不触发 on_request
+    rpc_req_msg = -1;
+    sid = p2p_request(a, 0, "echo", 4);
+    reliable_on_data(b, 1, a->reliable.send_buf[1].data, a->reliable.send_buf[1].len);
+    ASSERT_EQ(rpc_req_msg, -1);
+    reliable_on_data(a, 1, b->reliable.send_buf[1].data, b->reliable.send_buf[1].len);
+    ASSERT_EQ(rpc_resp_sid, sid);
+    ASSERT_EQ(rpc_resp_code, 0);
+    ASSERT(memcmp(rpc_resp_data, "echo", 4) == 0);
+
+    // COMPACT 模式：sid 取自信令 RPC 的计数器
+    a->inst->sig_mode = P2P_SIGNALING_MODE_COMPACT;
+    a->sig_sess.compact.rpc_next_sid = 100;
+    sid = p2p_request(a, 5, NULL, 0);
+    ASSERT_EQ(sid, 101);
+    ASSERT_EQ(a->sig_sess.compact.rpc_next_sid, 101);
+
+    // 未获应答：超时后以 ERR_TIMEOUT 结束
+    rpc_tick(a, p2p_now_ms() + RPC_DIRECT_TIMEOUT_MS);
+    ASSERT_EQ(rpc_resp_sid, 101);
+    ASSERT_EQ(rpc_resp_code, P2P_MSG_ERR_TIMEOUT);
+    ASSERT_EQ(rpc_resp_len, -1);
+
+    rpc_reset(a);
+    rpc_reset(b);
+    destroy_mock_session(a);
+    destroy_mock_session(b);
+}
+
+/* 服务器协调的同时起跑：暂缓期间不发 PUNCH，PUNCH_AT 约定起跑时刻（不超过等待上限）；对端 PUNCH 先到则立即起跑 */
+TEST(punch_at_hold) {
+    mock_reset();
+    struct p2p_session *s = create_mock_session();
+    struct p2p_instance *inst = s->inst;
+    inst->sig_mode = P2P_SIGNALING_MODE_COMPACT;
+    inst->sessions_head = s;
+    strcpy(inst->local_peer_id, "alice");
+    strcpy(s->remote_peer_id, "bob");
+    s->id = 0x55;
+    s->sig_sess.compact.state = SIG_COMPACT_SESS_SYNCING;
+    check_add_cand(s, P2P_CAND_SRFLX, 0x0a000001, 5000);
+
+    // 打洞启动前设置等待上限，进入 PUNCHING 后不发 PUNCH，定时器指向等待上限
+    uint64_t now = P_tick_ms();
+    nat_punch_hold(s, now + 1000);
+    s->nat.state = NAT_PUNCHING;
+    s->nat.punch_start = now;
+    nat_tick(s, now);
+    ASSERT_EQ(s->remote_cands[0].last_punch_send_ms, 0);
+    ASSERT_EQ(nat_next_timeout(s, now), 1000);
+
+    // PUNCH_AT：30ms 后起跑，起跑时重置打洞开始时间
+    uint8_t hint[SIG_PKT_PUNCH_AT_PSZ];
+    nwrite_l(hint, 0x55);
+    nwrite_s(hint + P2P_SESS_ID_PSZ, 30);
+    p2p_signal_compact_proto(inst, SIG_PKT_PUNCH_AT, 0, 0, hint, sizeof(hint), now + 100);
+    ASSERT_EQ(s->nat.punch_hold, now + 130);
+    nat_tick(s, now + 120);
+    ASSERT_EQ(s->remote_cands[0].last_punch_send_ms, 0);
+    ASSERT_EQ(nat_next_timeout(s, now + 120), 10);
+    nat_tick(s, now + 130);
+    ASSERT_EQ(s->remote_cands[0].last_punch_send_ms, now + 130);
+    ASSERT_EQ(s->nat.punch_start, now + 130);
+    ASSERT_EQ(s->nat.punch_hold, 0);
+
+    // 已起跑：迟到的提示不再暂缓
+    p2p_signal_compact_proto(inst, SIG_PKT_PUNCH_AT, 0, 0, hint, sizeof(hint), now + 140);
+    ASSERT_EQ(s->nat.punch_hold, 0);
+    nat_punch_hold(s, now + 2000);
+    ASSERT_EQ(s->nat.punch_hold, 0);
+
+    // 新一轮：提示的延迟不超过等待上限；等待期间收到对端 PUNCH 立即起跑
+    nat_reset(&s->nat);
+    s->remote_cands[0].check = NAT_CHECK_NONE;
+    s->remote_cands[0].last_punch_send_ms = 0;
+    now += 1000;
+    nat_punch_hold(s, now + 1000);
+    s->nat.state = NAT_PUNCHING;
+    s->nat.punch_start = now;
+    nwrite_s(hint + P2P_SESS_ID_PSZ, 60000);
+    p2p_signal_compact_proto(inst, SIG_PKT_PUNCH_AT, 0, 0, hint, sizeof(hint), now);
+    ASSERT_EQ(s->nat.punch_hold, now + 1000);
+
+    uint8_t punch[P2P_PKT_PUNCH_PSZ] = {0};
+    nat_proto(s, P2P_PKT_PUNCH, 0, 1, punch, sizeof(punch), &s->remote_cands[0].addr, now + 10);
+    ASSERT_EQ(s->nat.punch_hold, 0);
+    nat_tick(s, now + 10);
+    ASSERT_EQ(s->remote_cands[0].last_punch_send_ms, now + 10);
+
+    nat_reset(&s->nat);
+    free(s->remote_cands);
+    s->id = 0;
+    inst->sessions_head = NULL;
+    destroy_mock_session(s);
+}
+
+int main(void) {
+    printf("\n========================================\n");
+    printf("P2P Transport Layer Unit Tests\n");
+    printf("========================================\n\n");
+    
+    printf("Stream Layer Tests:\n");
+    RUN_TEST(stream_write_read);
+    RUN_TEST(stream_ring_buffer_wrap);
+    RUN_TEST(stream_flush_fragmentation);
+    RUN_TEST(stream_writev_gather);
+    RUN_TEST(stream_recv_peek_consume);
+    RUN_TEST(stream_message_mode);
+    RUN_TEST(stream_msg_deadline);
+    RUN_TEST(session_resume);
+    RUN_TEST(stream_native_deliver);
+    RUN_TEST(compact_delta_sync);
+    RUN_TEST(compact_online_sync0);
+    RUN_TEST(relay_bulk_frame);
+    RUN_TEST(relay_bulk_large_frame);
+    RUN_TEST(stream_dgram_channel);
+    RUN_TEST(stream_lz_compress);
+    RUN_TEST(stream_file_transfer);
+    
+    printf("\nBoundary Tests:\n");
+    RUN_TEST(stream_empty_data);
+    RUN_TEST(stream_single_byte);
+    RUN_TEST(stream_exact_packet_size);
     RUN_TEST(ring_buffer_full);
     RUN_TEST(ring_buffer_boundary_cross);
+    RUN_TEST(ring_buffer_grow_shrink);
+    RUN_TEST(send_writable_lowat);
+    RUN_TEST(send_group_fanout);
+    RUN_TEST(early_data_send);
+    RUN_TEST(overlay_relay_forward);
+    RUN_TEST(timer_wheel_cascade);
+    RUN_TEST(crc32_fingerprint);
+    RUN_TEST(hmac_sha1_ctx);
+    RUN_TEST(dtls_resume_cache);
+    RUN_TEST(dtls_cid_migrate);
+    RUN_TEST(aead_layer);
+    RUN_TEST(ice_check_schedule);
+    RUN_TEST(ice_check_history);
+    RUN_TEST(ice_check_same_nat);
+    RUN_TEST(nat_rtt_scaled_timeouts);
+    RUN_TEST(ice_nominate);
+    RUN_TEST(ice_port_predict);
+    RUN_TEST(path_cache);
+    RUN_TEST(lan_discovery);
+    RUN_TEST(stun_multi_server);
+    RUN_TEST(stun_shared_detect);
+    RUN_TEST(dns_async_resolve);
+    RUN_TEST(stun_srflx_prewarm);
+    RUN_TEST(route_change_refresh);
+    RUN_TEST(path_race);
+    RUN_TEST(ipv6_candidate_wire);
+    RUN_TEST(bind_lifetime_probe);
+    RUN_TEST(pmtu_discovery);
+    RUN_TEST(ack_piggyback);
+    RUN_TEST(fec_recover);
+    RUN_TEST(bundle_pack);
+    RUN_TEST(netem_impairment);
+    RUN_TEST(sock_buf_autosize);
+    RUN_TEST(recv_fair_sockets);
+    RUN_TEST(rx_timestamp_rtt);
+    RUN_TEST(ecn_ce_feedback);
+    RUN_TEST(udp_uring_recv);
+    RUN_TEST(low_power_cadence);
+    RUN_TEST(stun_attr_index);
+    RUN_TEST(compact_identities);
+    RUN_TEST(compact_alive_interval);
+    RUN_TEST(rpc_direct);
+    RUN_TEST(punch_at_hold);
+    RUN_TEST(stun_multi_collect);
+    RUN_TEST(prewarm_handover);
+    RUN_TEST(bulk_resume);
+    RUN_TEST(tune_registry);
+    RUN_TEST(session_opts);
+    RUN_TEST(crypto_pool);
+    RUN_TEST(shared_executor);
+    RUN_TEST(probe_tiers);
+    RUN_TEST(punch_ts_echo);
+    RUN_TEST(multipath_striping);
+    RUN_TEST(redundant_dup_send);
+    RUN_TEST(passive_ack_rtt);
+    RUN_TEST(path_migration_keeps_inflight);
+    RUN_TEST(session_stats);
+    RUN_TEST(trace_events);
+    RUN_TEST(latency_histograms);
+    RUN_TEST(setup_milestones);
+    RUN_TEST(mem_arena_allocator);
+    RUN_TEST(memory_stats);
+    RUN_TEST(session_hibernate);
+    RUN_TEST(predictive_switch);
+    RUN_TEST(turn_channel_data);
+    RUN_TEST(turn_perm_share_alloc_retry);
+    RUN_TEST(turn_server_probe);
+    RUN_TEST(turn_tcp_transport);
+    RUN_TEST(tcp_punch_framing);
+    RUN_TEST(shm_ring_path);
+    RUN_TEST(cluster_node_pick);
+    RUN_TEST(rpc_sid_window);
+    RUN_TEST(rpc_fragment_roundtrip);
+#ifdef P2P_THREADED
+    RUN_TEST(worker_shard_assign);
+#endif
+    RUN_TEST(stream_nagle_deadline);
+    RUN_TEST(stream_recv_backpressure);
+    RUN_TEST(blocking_wait);
     RUN_TEST(reliable_large_data);
     RUN_TEST(reliable_max_payload);
     
@@ -493,9 +6787,24 @@ int main(void) {
     RUN_TEST(reliable_send_recv);
     RUN_TEST(reliable_window_full);
     RUN_TEST(reliable_recv_order);
+    RUN_TEST(reliable_multi_stream_hol);
+    RUN_TEST(reliable_seq_wrap);
+    RUN_TEST(reliable_window_negotiate);
+    RUN_TEST(stream_priority_classes);
+    RUN_TEST(reliable_rack_loss);
+    RUN_TEST(reliable_tail_loss_probe);
+    RUN_TEST(reliable_retx_index);
+    RUN_TEST(reliable_delivery_rate);
+    RUN_TEST(reliable_pacing);
+    RUN_TEST(reliable_rate_limit);
+    RUN_TEST(reliable_ack_frequency);
+    RUN_TEST(reliable_receive_window);
+    RUN_TEST(bbr_model);
     
     printf("\nPseudoTCP Layer Tests:\n");
     RUN_TEST(pseudotcp_congestion_window);
+    RUN_TEST(pseudotcp_small_messages);
+    RUN_TEST(pseudotcp_cubic);
     
     TEST_SUMMARY();
     
@@ -16,6 +16,9 @@
  *   6. server_send_text         — server 发文本，client on_message 收到
  *   7. broadcast                — server 广播给一个 client
  *   8. client_close             — client 主动发 Close 帧
+ *   9. deflate_codec            — ws_deflate / ws_inflate 往返，解压 zlib 生成的动态 Huffman 数据
+ *  10. deflate_roundtrip        — 协商 permessage-deflate，双向发送 / 广播大文本
+ *  11. deflate_declined         — server 不接受扩展，收发仍为未压缩消息
  */
 
 #ifdef WITH_WSLAY
@@ -23,6 +26,7 @@
 #include "../test/test_framework.h"
 #include "../p2p_server/ws_server.h"
 #include "../src/ws_client.h"
+#include "../src/ws_deflate.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -429,6 +433,119 @@ TEST(client_close) {
     ws_server_destroy(srv);
 }
 
+/* -----------------------------------------------------------------------
+ * 测试 9: deflate_codec
+ * -------------------------------------------------------------------- */
+
+/* 8 行候选 JSON（与 zlib 压缩数据对应的原文） */
+static size_t make_candidates(char *buf, size_t cap, int lines) {
+    size_t n = 0;
+    for (int i = 0; i < lines && n < cap; i++)
+        n += (size_t)snprintf(buf + n, cap - n,
+            "{\"type\":\"candidate\",\"candidate\":\"candidate:%d 1 udp 2122260223 192.168.1.%d 5%04d typ host\"}\n",
+            i, i + 10, i * 7);
+    return n;
+}
+
+TEST(deflate_codec) {
+    /* zlib level 9、raw deflate、SYNC_FLUSH 后去掉 00 00 FF FF（动态 Huffman 块） */
+    static const uint8_t zdata[] =
+        "\x9c\xcc\x3b\x0a\xc3\x30\x10\x84\xe1\x3e\xa7\x58\x54\x07\xa1\x1d\xbd\x6c\xdf\xc6\x44\x86\xa4\x49"
+        "\x0c\x71\x8a\x60\x72\x77\x5b\xaa\x54\x2d\x61\xa7\xfa\x99\xe2\xdb\xcd\xf6\x5d\x17\x33\x99\xdb\xfc"
+        "\x2c\x8f\x32\x6f\x8b\xb9\x76\xdd\xfd\x93\x23\xa6\x4f\x59\x09\x0c\x20\x39\xc0\x13\x8f\xb0\x9c\x06"
+        "\xcb\x96\x1d\x45\x77\x8e\x4e\x8e\xee\xaf\xf7\x66\x7e\x97\xfd\x7f\x9b\x45\x9b\x9b\x9d\x95\x36\x44"
+        "\x1b\xd5\xe6\xa0\xb4\xbd\x68\xfb\x6a\x83\x95\x76\x10\xed\xd0\xec\x41\x69\x47\xd1\x8e\xd5\xf6\x51"
+        "\x69\x27\xd1\x4e\xd5\x0e\x50\xda\x59\xb4\x73\xb3\xc7\xde\x3e\x00";
+    static char text[4096];
+    static uint8_t out[8192], z[4096];
+    size_t len = make_candidates(text, sizeof(text), 8);
+
+    int n = ws_inflate(zdata, sizeof(zdata) - 1, out, sizeof(out));
+    ASSERT_EQ(n, (int)len);
+    ASSERT(memcmp(out, text, len) == 0);
+    ASSERT_EQ(ws_inflate(zdata, sizeof(zdata) - 1, out, len - 1), -2);     /* 输出缓冲不足 */
+
+    /* 本端压缩 → 解压往返，窗口受限时同样可解 */
+    for (int wbits = 8; wbits <= 15; wbits += 7) {
+        int zlen = ws_deflate((const uint8_t *)text, len, z, sizeof(z), wbits);
+        ASSERT(zlen > 0 && (size_t)zlen < len / 2);
+        n = ws_inflate(z, (size_t)zlen, out, sizeof(out));
+        ASSERT_EQ(n, (int)len);
+        ASSERT(memcmp(out, text, len) == 0);
+    }
+
+    /* 不可压缩数据放弃压缩；截断 / 损坏数据返回错误而不越界 */
+    for (int i = 0; i < 256; i++) out[i] = (uint8_t)(i * 131 + 7) ^ (uint8_t)(i >> 3);
+    ASSERT_EQ(ws_deflate(out, 16, z, sizeof(z), 15), -1);
+    ASSERT(ws_inflate(zdata, 40, out, sizeof(out)) < 0);
+    ASSERT(ws_inflate((const uint8_t *)"\xff\xff\xff", 3, out, sizeof(out)) < 0);
+}
+
+/* -----------------------------------------------------------------------
+ * 测试 10 / 11: deflate_roundtrip / deflate_declined
+ * -------------------------------------------------------------------- */
+static int g_df_cli_open, g_df_srv_got, g_df_cli_got;
+static ws_client_id_t g_df_cid;
+static char g_df_text[16384];
+static size_t g_df_len;
+
+static void df_cli_on_open(ws_client_t *c, void *ud) { (void)c; (void)ud; g_df_cli_open = 1; }
+static void df_srv_on_connect(ws_server_t *s, ws_client_id_t cid, void *ud) { (void)s; (void)ud; g_df_cid = cid; }
+static void df_srv_on_msg(ws_server_t *s, ws_client_id_t cid, ws_srv_msg_type_t type,
+                          const uint8_t *data, size_t len, void *ud) {
+    (void)s; (void)cid; (void)ud;
+    if (type == WS_SRV_MSG_TEXT && len == g_df_len && !memcmp(data, g_df_text, len)) g_df_srv_got++;
+}
+static void df_cli_on_msg(ws_client_t *c, ws_msg_type_t type, const uint8_t *data, size_t len, void *ud) {
+    (void)c; (void)ud;
+    if (type == WS_MSG_TEXT && len == g_df_len && !memcmp(data, g_df_text, len)) g_df_cli_got++;
+}
+
+/* server_deflate = 0 时 server 拒绝扩展；返回客户端协商结果 */
+static int deflate_exchange(int server_deflate) {
+    g_df_cli_open = g_df_srv_got = g_df_cli_got = 0;
+    g_df_cid = 0;
+    g_df_len = make_candidates(g_df_text, sizeof(g_df_text), 120);
+
+    uint16_t port = pick_free_port();
+    ws_server_cfg_t scfg = {0};
+    scfg.on_connect = df_srv_on_connect;
+    scfg.on_message = df_srv_on_msg;
+    scfg.disable_deflate = !server_deflate;
+    ws_server_t *srv = ws_server_create(&scfg, port);
+    if (!srv) return -1;
+
+    ws_client_cfg_t ccfg = {0};
+    ccfg.on_open    = df_cli_on_open;
+    ccfg.on_message = df_cli_on_msg;
+    ws_client_t *cli = ws_client_create(&ccfg);
+    int deflate = -1;
+    if (cli && ws_client_connect(cli, "127.0.0.1", port, "/") == 0
+        && pump_until(srv, cli, &g_df_cli_open, TICK_LIMIT)) {
+        deflate = ws_client_deflate(cli);
+
+        /* client → server 两条（同一连接上连续消息各自独立解压），server → client 单播 + 广播 */
+        ws_client_send_text(cli, g_df_text);
+        ws_client_send_text(cli, g_df_text);
+        for (int i = 0; i < TICK_LIMIT && (g_df_srv_got < 2 || !g_df_cid); i++) pump(srv, cli, 1);
+        ws_server_send_text(srv, g_df_cid, g_df_text);
+        ws_server_broadcast_text(srv, g_df_text);
+        for (int i = 0; i < TICK_LIMIT && g_df_cli_got < 2; i++) pump(srv, cli, 1);
+        if (g_df_srv_got != 2 || g_df_cli_got != 2) deflate = -1;
+    }
+    ws_client_destroy(cli);
+    ws_server_destroy(srv);
+    return deflate;
+}
+
+TEST(deflate_roundtrip) {
+    ASSERT_EQ(deflate_exchange(1), 1);
+}
+
+TEST(deflate_declined) {
+    ASSERT_EQ(deflate_exchange(0), 0);
+}
+
 /* -----------------------------------------------------------------------
  * main
  * -------------------------------------------------------------------- */
@@ -447,6 +564,9 @@ int main(void) {
     RUN_TEST(server_send_text);
     RUN_TEST(broadcast);
     RUN_TEST(client_close);
+    RUN_TEST(deflate_codec);
+    RUN_TEST(deflate_roundtrip);
+    RUN_TEST(deflate_declined);
 
     printf("\nResults: %d passed, %d failed\n", test_passed, test_failed);
     return test_failed ? 1 : 0;